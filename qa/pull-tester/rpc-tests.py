@@ -49,6 +49,7 @@ BASE_SCRIPTS= [
     'turnstile.py',
     'walletbackup.py',
     'zkey_import_export.py',
+    'wallet_rescan_sapling.py',
     'prioritisetransaction.py',
     'wallet_changeaddresses.py',
     'wallet_listreceived.py',
@@ -56,6 +57,7 @@ BASE_SCRIPTS= [
     'finalsaplingroot.py',
     'wallet_overwintertx.py',
     'wallet_persistence.py',
+    'wallet_archive.py',
     'wallet_listnotes.py',
     # vv Tests less than 60s vv
     'fundrawtransaction.py',
@@ -99,6 +101,9 @@ BASE_SCRIPTS= [
     'timestampindex.py',
     'decodescript.py',
     'blockchain.py',
+    'feature_assumeutxo.py',
+    'feature_loadheaders.py',
+    'feature_verificationthreads.py',
     'disablewallet.py',
     'keypool.py',
     'getblocktemplate.py',
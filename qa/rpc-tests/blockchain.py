@@ -13,7 +13,9 @@ import decimal
 from test_framework.test_framework import BitcoinTestFramework
 from test_framework.util import (
     assert_equal,
+    start_node,
     start_nodes,
+    stop_node,
     connect_nodes_bi,
 )
 
@@ -21,7 +23,7 @@ class BlockchainTest(BitcoinTestFramework):
     """
     Test blockchain-related RPC calls:
 
-        - gettxoutsetinfo
+        - gettxoutsetinfo, with and without -utxostats
 
     """
 
@@ -31,7 +33,9 @@ class BlockchainTest(BitcoinTestFramework):
         self.num_nodes = 2
 
     def setup_network(self, split=False):
-        self.nodes = start_nodes(self.num_nodes, self.options.tmpdir)
+        # Node 1 keeps the UTXO set statistics up to date.
+        self.nodes = start_nodes(self.num_nodes, self.options.tmpdir,
+                                 extra_args=[[], ['-utxostats']])
         connect_nodes_bi(self.nodes, 0, 1)
         self.is_network_split = False
         self.sync_all()
@@ -47,6 +51,43 @@ class BlockchainTest(BitcoinTestFramework):
         assert_equal(res['bytes_serialized'], 14819), # 32*199 + 48*90 + 49*54 + 27*55
         assert_equal(len(res['bestblock']), 64)
         assert_equal(len(res['hash_serialized']), 64)
+        assert_equal(len(res['muhash']), 64)
+
+        self._test_utxostats()
+
+    def assert_stats_equal(self):
+        full = self.nodes[0].gettxoutsetinfo()
+        incremental = self.nodes[1].gettxoutsetinfo()
+        assert 'transactions' not in incremental
+        assert 'hash_serialized' not in incremental
+        for key in ['height', 'bestblock', 'txouts', 'bytes_serialized', 'muhash', 'total_amount']:
+            assert_equal(incremental[key], full[key])
+        return full
+
+    def _test_utxostats(self):
+        start = self.assert_stats_equal()
+
+        # Spend some outputs, so that the block both creates and spends coins.
+        self.nodes[0].sendtoaddress(self.nodes[1].getnewaddress(), 1)
+        self.sync_all()
+        self.nodes[0].generate(1)
+        self.sync_all()
+        after = self.assert_stats_equal()
+        assert after['muhash'] != start['muhash']
+
+        # Disconnecting the block restores the statistics.
+        for node in self.nodes:
+            node.invalidateblock(after['bestblock'])
+        assert_equal(self.nodes[1].gettxoutsetinfo()['muhash'], start['muhash'])
+        self.assert_stats_equal()
+
+        # The statistics are stored when the node shuts down.
+        for node in self.nodes:
+            node.reconsiderblock(after['bestblock'])
+        stop_node(self.nodes[1], 1)
+        self.nodes[1] = start_node(1, self.options.tmpdir, ['-utxostats'])
+        connect_nodes_bi(self.nodes, 0, 1)
+        assert_equal(self.assert_stats_equal()['muhash'], after['muhash'])
 
 
 if __name__ == '__main__':
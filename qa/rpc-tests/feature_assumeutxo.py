@@ -0,0 +1,133 @@
+#!/usr/bin/env python3
+# Copyright (c) 2021 The Zcash developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#
+# Test dumptxoutset and loadtxoutset
+#
+
+from io import BytesIO
+import os
+import time
+
+from test_framework.mininode import CBlockHeader, NodeConn, NodeConnCB, \
+    NetworkThread, msg_headers, mininode_lock
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import assert_equal, assert_raises_message, \
+    connect_nodes_bi, hex_str_to_bytes, p2p_port, start_node, stop_node, \
+    sync_blocks, wait_bitcoinds
+from test_framework.authproxy import JSONRPCException
+
+SNAPSHOT_HEIGHT = 110
+
+
+class HeadersNode(NodeConnCB):
+    def __init__(self):
+        NodeConnCB.__init__(self)
+        self.create_callback_map()
+
+    def wait_for_verack(self):
+        while True:
+            with mininode_lock:
+                if self.verack_received:
+                    return
+            time.sleep(0.05)
+
+
+class AssumeutxoTest(BitcoinTestFramework):
+
+    def __init__(self):
+        super().__init__()
+        self.setup_clean_chain = True
+        self.num_nodes = 2
+
+    def setup_network(self):
+        self.nodes = []
+        self.is_network_split = True
+        self.nodes.append(start_node(0, self.options.tmpdir))
+        # Snapshots cannot be loaded with the wallet enabled.
+        self.nodes.append(start_node(1, self.options.tmpdir, ["-disablewallet"]))
+
+    def run_test(self):
+        node0 = self.nodes[0]
+        node0.generate(SNAPSHOT_HEIGHT)
+
+        path = os.path.join(self.options.tmpdir, "utxo.dat")
+        res = node0.dumptxoutset(path)
+        assert_equal(res['base_height'], SNAPSHOT_HEIGHT)
+        assert_equal(res['base_hash'], node0.getbestblockhash())
+        assert_equal(res['path'], path)
+        info = node0.gettxoutsetinfo()
+        assert_equal(res['coins_written'], info['txouts'])
+
+        # The file is not overwritten.
+        assert_raises_message(JSONRPCException, "already exists",
+            node0.dumptxoutset, path)
+
+        node0.generate(5)
+
+        # Without a pinned hash, the snapshot is refused.
+        assert_raises_message(JSONRPCException, "no snapshot is pinned",
+            self.nodes[1].loadtxoutset, path)
+
+        stop_node(self.nodes[1], 1)
+        wait_bitcoinds()
+        self.nodes[1] = start_node(1, self.options.tmpdir, [
+            "-disablewallet",
+            "-assumeutxo=%d:%s:%s" % (SNAPSHOT_HEIGHT, res['base_hash'], res['snapshot_hash']),
+        ])
+        node1 = self.nodes[1]
+
+        # The header of the base block must have been received.
+        assert_raises_message(JSONRPCException, "has not been received",
+            node1.loadtxoutset, path)
+
+        # Send node1 the headers up to the base, but not the blocks.
+        headers_node = HeadersNode()
+        conn = NodeConn('127.0.0.1', p2p_port(1), node1, headers_node)
+        NetworkThread().start()
+        headers_node.wait_for_verack()
+        msg = msg_headers()
+        for height in range(1, SNAPSHOT_HEIGHT + 1):
+            header = CBlockHeader()
+            header.deserialize(BytesIO(hex_str_to_bytes(
+                node0.getblockheader(node0.getblockhash(height), False))))
+            msg.headers.append(header)
+        conn.send_message(msg)
+        while node1.getblockheader(res['base_hash'])['height'] != SNAPSHOT_HEIGHT:
+            time.sleep(0.1)
+        assert_equal(node1.getblockcount(), 0)
+
+        loaded = node1.loadtxoutset(path)
+        assert_equal(loaded['coins_loaded'], res['coins_written'])
+        assert_equal(loaded['base_hash'], res['base_hash'])
+        assert_equal(loaded['snapshot_hash'], res['snapshot_hash'])
+        assert_equal(node1.getblockcount(), SNAPSHOT_HEIGHT)
+        assert_equal(node1.getbestblockhash(), res['base_hash'])
+
+        info1 = node1.gettxoutsetinfo()
+        assert_equal(info1['bestblock'], info['bestblock'])
+        assert_equal(info1['txouts'], info['txouts'])
+        assert_equal(info1['muhash'], info['muhash'])
+        assert_equal(info1['total_amount'], info['total_amount'])
+
+        # node1 validates the blocks after the base, and new blocks.
+        conn.disconnect_node()
+        connect_nodes_bi(self.nodes, 0, 1)
+        sync_blocks(self.nodes)
+        assert_equal(node1.getblockcount(), SNAPSHOT_HEIGHT + 5)
+        node0.generate(1)
+        sync_blocks(self.nodes)
+        assert_equal(node0.getbestblockhash(), node1.getbestblockhash())
+
+        # The chain state loaded from the snapshot persists across restarts.
+        stop_node(node1, 1)
+        wait_bitcoinds()
+        self.nodes[1] = start_node(1, self.options.tmpdir, ["-disablewallet"])
+        assert_equal(self.nodes[1].getbestblockhash(), node0.getbestblockhash())
+        assert_equal(self.nodes[1].gettxoutsetinfo()['muhash'], node0.gettxoutsetinfo()['muhash'])
+
+
+if __name__ == '__main__':
+    AssumeutxoTest().main()
@@ -0,0 +1,77 @@
+#!/usr/bin/env python3
+# Copyright (c) 2021 The Zcash developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#
+# Test dumpheaders and -loadheaders
+#
+
+import os
+import time
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import assert_equal, assert_raises_message, \
+    connect_nodes_bi, start_node, stop_node, sync_blocks, wait_bitcoinds
+from test_framework.authproxy import JSONRPCException
+
+SNAPSHOT_HEIGHT = 110
+
+
+class LoadHeadersTest(BitcoinTestFramework):
+
+    def __init__(self):
+        super().__init__()
+        self.setup_clean_chain = True
+        self.num_nodes = 2
+
+    def setup_network(self):
+        self.nodes = []
+        self.is_network_split = True
+        self.nodes.append(start_node(0, self.options.tmpdir))
+        self.nodes.append(start_node(1, self.options.tmpdir))
+
+    def wait_for_headers(self, node, height):
+        for _ in range(100):
+            if node.getblockchaininfo()['headers'] == height:
+                return
+            time.sleep(0.1)
+        assert_equal(node.getblockchaininfo()['headers'], height)
+
+    def run_test(self):
+        node0 = self.nodes[0]
+        node0.generate(SNAPSHOT_HEIGHT)
+
+        path = os.path.join(self.options.tmpdir, "headers.dat")
+        res = node0.dumpheaders(path)
+        assert_equal(res['height'], SNAPSHOT_HEIGHT)
+        assert_equal(res['path'], path)
+
+        # The file is not overwritten.
+        assert_raises_message(JSONRPCException, "already exists",
+            node0.dumpheaders, path)
+
+        # The headers are imported before any peer is connected, and the
+        # blocks are then downloaded.
+        stop_node(self.nodes[1], 1)
+        wait_bitcoinds()
+        self.nodes[1] = start_node(1, self.options.tmpdir, ["-loadheaders=%s" % path])
+        node1 = self.nodes[1]
+        self.wait_for_headers(node1, SNAPSHOT_HEIGHT)
+        assert_equal(node1.getblockcount(), 0)
+        assert_equal(node1.getblockheader(node0.getbestblockhash())['height'], SNAPSHOT_HEIGHT)
+
+        connect_nodes_bi(self.nodes, 0, 1)
+        sync_blocks(self.nodes)
+        assert_equal(node1.getbestblockhash(), node0.getbestblockhash())
+
+        # Importing the same headers again changes nothing.
+        stop_node(node1, 1)
+        wait_bitcoinds()
+        self.nodes[1] = start_node(1, self.options.tmpdir, ["-loadheaders=%s" % path])
+        assert_equal(self.nodes[1].getblockcount(), SNAPSHOT_HEIGHT)
+        self.wait_for_headers(self.nodes[1], SNAPSHOT_HEIGHT)
+
+
+if __name__ == '__main__':
+    LoadHeadersTest().main()
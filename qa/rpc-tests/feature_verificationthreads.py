@@ -0,0 +1,68 @@
+#!/usr/bin/env python3
+# Copyright (c) 2021 The Zcash developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#
+# Test setverificationthreads and -adaptivepar
+#
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import assert_equal, assert_raises_message, \
+    start_node, stop_node, wait_bitcoinds
+from test_framework.authproxy import JSONRPCException
+
+
+class VerificationThreadsTest(BitcoinTestFramework):
+
+    def __init__(self):
+        super().__init__()
+        self.setup_clean_chain = True
+        self.num_nodes = 1
+
+    def setup_network(self):
+        self.nodes = [start_node(0, self.options.tmpdir, ["-par=2"])]
+        self.is_network_split = False
+
+    def run_test(self):
+        node = self.nodes[0]
+
+        # A thread is started per core, but only -par of them verify.
+        info = node.setverificationthreads()
+        assert_equal(info['threads'], 2)
+        started = info['started']
+        assert started >= 2
+
+        assert_equal(node.setverificationthreads(1), {'threads': 1, 'started': started})
+        assert_equal(node.setverificationthreads(started), {'threads': started, 'started': started})
+        assert_raises_message(JSONRPCException, "threads must be between 1 and %d" % started,
+            node.setverificationthreads, started + 1)
+        assert_raises_message(JSONRPCException, "threads must be between 1 and %d" % started,
+            node.setverificationthreads, 0)
+
+        # Blocks are still connected with a single verifying thread.
+        node.setverificationthreads(1)
+        node.generate(10)
+        assert_equal(node.getblockcount(), 10)
+
+        # -par=1 disables parallel verification, unless -adaptivepar is set.
+        stop_node(node, 0)
+        wait_bitcoinds()
+        node = self.nodes[0] = start_node(0, self.options.tmpdir, ["-par=1"])
+        assert_equal(node.setverificationthreads(), {'threads': 0, 'started': 0})
+        assert_raises_message(JSONRPCException, "parallel verification is disabled",
+            node.setverificationthreads, 2)
+
+        stop_node(node, 0)
+        wait_bitcoinds()
+        node = self.nodes[0] = start_node(0, self.options.tmpdir, ["-par=1", "-adaptivepar"])
+        # Unless the machine has a single core, the threads are started
+        # and one of them verifies until the checks back up.
+        info = node.setverificationthreads()
+        if info['started'] > 0:
+            assert_equal(node.setverificationthreads(info['started']),
+                {'threads': info['started'], 'started': info['started']})
+
+
+if __name__ == '__main__':
+    VerificationThreadsTest().main()
@@ -6,6 +6,7 @@
 # Exercise the listtransactions API
 
 from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import assert_equal
 
 from decimal import Decimal
 
@@ -108,5 +109,19 @@ class ListTransactionsTest(BitcoinTestFramework):
                            {"category":"receive","amount":Decimal("0.1"),"amountZat":10000000},
                            {"txid":txid, "account" : "watchonly"} )
 
+        # Paging with 'before' returns the same entries as with 'from', and
+        # does not split the entries of a transaction.
+        everything = self.nodes[1].listtransactions("*", 1000)
+        paged = []
+        before = 2**62
+        while True:
+            page = self.nodes[1].listtransactions("*", 3, 0, False, before)
+            if len(page) == 0:
+                break
+            assert(len(set(e["orderpos"] for e in page)) <= 3)
+            before = page[0]["orderpos"]
+            paged = page + paged
+        assert_equal(paged, everything)
+
 if __name__ == '__main__':
     ListTransactionsTest().main()
@@ -179,5 +179,27 @@ class RawTransactionsTest(BitcoinTestFramework):
         decrawtx= self.nodes[0].decoderawtransaction(rawtx)
         assert_equal(decrawtx['vin'][0]['sequence'], 1000)
 
+        # sendrawtransactions admits a child after its parent, whatever their order
+        utxo = self.nodes[0].listunspent()[0]
+        addr = self.nodes[0].getnewaddress()
+        parentTx = self.nodes[0].createrawtransaction(
+            [{'txid': utxo['txid'], 'vout': utxo['vout']}], {addr: utxo['amount'] - Decimal('0.0001')})
+        parentTx = self.nodes[0].signrawtransaction(parentTx)['hex']
+        parent = self.nodes[0].decoderawtransaction(parentTx)
+        childInputs = [{'txid': parent['txid'], 'vout': 0,
+                        'scriptPubKey': parent['vout'][0]['scriptPubKey']['hex'],
+                        'amount': parent['vout'][0]['value']}]
+        childTx = self.nodes[0].createrawtransaction(
+            childInputs, {addr: parent['vout'][0]['value'] - Decimal('0.0001')})
+        childTx = self.nodes[0].signrawtransaction(childTx, childInputs)['hex']
+        child = self.nodes[0].decoderawtransaction(childTx)
+        results = self.nodes[0].sendrawtransactions([childTx, parentTx, "00"])
+        assert_equal(results[0], {'txid': child['txid'], 'error': None})
+        assert_equal(results[1], {'txid': parent['txid'], 'error': None})
+        assert_equal(results[2]['error']['code'], -22)
+        assert('txid' not in results[2])
+        assert(child['txid'] in self.nodes[0].getrawmempool())
+        assert(parent['txid'] in self.nodes[0].getrawmempool())
+
 if __name__ == '__main__':
     RawTransactionsTest().main()
@@ -345,5 +345,64 @@ class RESTTest (BitcoinTestFramework):
         json_obj = json.loads(json_string)
         assert_equal(json_obj['bestblockhash'], bb_hash)
 
+        # test rest valuepools
+        height = self.nodes[0].getblockcount()
+        json_string = http_get_call(url.hostname, url.port, '/rest/valuepools/5/'+str(height - 9)+'/2'+self.FORMAT_SEPARATOR+'json')
+        json_obj = json.loads(json_string)
+        rpc_history = self.nodes[0].getvaluepoolhistory(height - 9, 5, 2)
+        assert_equal([entry['hash'] for entry in json_obj], [entry['hash'] for entry in rpc_history])
+        assert_equal([entry['valuePools'][1]['chainValueZat'] for entry in json_obj],
+                     [entry['valuePools'][1]['chainValueZat'] for entry in rpc_history])
+        assert_equal([entry['height'] for entry in json_obj], list(range(height - 9, height + 1, 2)))
+        assert_equal(json_obj[-1]['hash'], bb_hash)
+        assert_equal(json_obj[-1]['valuePools'][0]['chainValueZat'], self.nodes[0].getblockchaininfo()['valuePools'][0]['chainValueZat'])
+
+        # the history stops at the tip
+        json_string = http_get_call(url.hostname, url.port, '/rest/valuepools/2000/'+str(height)+self.FORMAT_SEPARATOR+'json')
+        assert_equal(len(json.loads(json_string)), 1)
+        response = http_get_call(url.hostname, url.port, '/rest/valuepools/1/'+str(height + 1)+self.FORMAT_SEPARATOR+'json', True)
+        assert_equal(response.status, 404)
+
+        # an interval past the tip returns only the first block
+        json_string = http_get_call(url.hostname, url.port, '/rest/valuepools/2/1/2147483647'+self.FORMAT_SEPARATOR+'json')
+        assert_equal([entry['height'] for entry in json.loads(json_string)], [1])
+        assert_equal(len(self.nodes[0].getvaluepoolhistory(height, 2, 2147483647)), 1)
+
+        # test rest compactblocks
+        json_string = http_get_call(url.hostname, url.port, '/rest/compactblocks/3/'+str(height - 2)+self.FORMAT_SEPARATOR+'json')
+        json_obj = json.loads(json_string)
+        assert_equal([entry['height'] for entry in json_obj], list(range(height - 2, height + 1)))
+        assert_equal(json_obj[-1]['hash'], bb_hash)
+        assert_equal(json_obj[-1]['previousblockhash'], self.nodes[0].getblockhash(height - 1))
+        # these blocks have no Sapling transactions
+        assert_equal([entry['vtx'] for entry in json_obj], [[], [], []])
+
+        # the binary format is the height, hash, previous hash and time of
+        # each block, followed by its compact transactions
+        response = http_get_call(url.hostname, url.port, '/rest/compactblocks/1/'+str(height)+self.FORMAT_SEPARATOR+'bin', True)
+        assert_equal(response.status, 200)
+        response_bytes = response.read()
+        assert_equal(len(response_bytes), 4 + 32 + 32 + 4 + 1)
+        assert_equal(response_bytes[4:36][::-1].hex(), bb_hash)
+
+        response = http_get_call(url.hostname, url.port, '/rest/compactblocks/1/'+str(height + 1)+self.FORMAT_SEPARATOR+'json', True)
+        assert_equal(response.status, 404)
+
+        # test rest blocks, which streams the raw blocks of a range
+        response = http_get_call(url.hostname, url.port, '/rest/blocks/'+str(height - 2)+'/3'+self.FORMAT_SEPARATOR+'hex', True)
+        assert_equal(response.status, 200)
+        assert_equal(response.getheader('Transfer-Encoding'), 'chunked')
+        hex_blocks = response.read().decode("utf-8").split()
+        assert_equal(hex_blocks, [self.nodes[0].getblock(self.nodes[0].getblockhash(h), 0) for h in range(height - 2, height + 1)])
+
+        response = http_get_call(url.hostname, url.port, '/rest/blocks/'+str(height - 1)+'/2000'+self.FORMAT_SEPARATOR+'bin', True)
+        assert_equal(response.status, 200)
+        assert_equal(response.read().hex(), ''.join(hex_blocks[1:]))
+
+        response = http_get_call(url.hostname, url.port, '/rest/blocks/'+str(height + 1)+'/1'+self.FORMAT_SEPARATOR+'bin', True)
+        assert_equal(response.status, 404)
+        response = http_get_call(url.hostname, url.port, '/rest/blocks/'+str(height)+'/2001'+self.FORMAT_SEPARATOR+'bin', True)
+        assert_equal(response.status, 400)
+
 if __name__ == '__main__':
     RESTTest().main()
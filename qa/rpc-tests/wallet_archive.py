@@ -0,0 +1,83 @@
+#!/usr/bin/env python3
+# Copyright (c) 2021 The Zcash developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#
+# Test -walletarchivedepth
+#
+
+from decimal import Decimal
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import assert_equal, connect_nodes_bi, \
+    start_node, stop_node, wait_bitcoinds
+
+ARCHIVE_DEPTH = 100
+
+
+class WalletArchiveTest(BitcoinTestFramework):
+
+    def __init__(self):
+        super().__init__()
+        self.setup_clean_chain = True
+        self.num_nodes = 2
+
+    def setup_network(self):
+        self.nodes = []
+        self.nodes.append(start_node(0, self.options.tmpdir, ["-walletarchivedepth=%d" % ARCHIVE_DEPTH]))
+        self.nodes.append(start_node(1, self.options.tmpdir))
+        connect_nodes_bi(self.nodes, 0, 1)
+        self.is_network_split = False
+
+    def restart_node0(self):
+        stop_node(self.nodes[0], 0)
+        wait_bitcoinds()
+        self.nodes[0] = start_node(0, self.options.tmpdir, ["-walletarchivedepth=%d" % ARCHIVE_DEPTH])
+        connect_nodes_bi(self.nodes, 0, 1)
+
+    def run_test(self):
+        node0 = self.nodes[0]
+        node0.generate(101)
+        self.sync_all()
+
+        # Spend the first coinbase, and bury the spend.
+        coinbase = node0.getblock(node0.getblockhash(1))['tx'][0]
+        spend = node0.sendtoaddress(self.nodes[1].getnewaddress(), Decimal('1'))
+        assert_equal(node0.gettransaction(spend)['details'][0]['category'], 'send')
+        node0.generate(ARCHIVE_DEPTH)
+        self.sync_all()
+
+        balance = node0.getbalance()
+        txcount = node0.getwalletinfo()['txcount']
+        assert_equal(node0.getwalletinfo()['archived_txcount'], 0)
+
+        # The spent coinbase is archived when the wallet is next loaded; the
+        # spend keeps its change, so it stays.
+        self.restart_node0()
+        node0 = self.nodes[0]
+        info = node0.getwalletinfo()
+        assert(info['archived_txcount'] >= 1)
+        assert_equal(info['txcount'] + info['archived_txcount'], txcount)
+        assert_equal(node0.getbalance(), balance)
+        assert(coinbase not in [tx['txid'] for tx in node0.listtransactions('*', 1000)])
+
+        # Archived transactions are still read when asked for, and the
+        # transactions that spend them keep their debit.
+        tx = node0.gettransaction(coinbase)
+        assert_equal(tx['txid'], coinbase)
+        assert_equal(tx['confirmations'], 2 * ARCHIVE_DEPTH + 1)
+        assert_equal(node0.gettransaction(spend)['details'][0]['category'], 'send')
+
+        # The archive survives another restart, and the wallet can still spend.
+        self.restart_node0()
+        node0 = self.nodes[0]
+        assert_equal(node0.getwalletinfo()['archived_txcount'], info['archived_txcount'])
+        assert_equal(node0.getbalance(), balance)
+        node0.sendtoaddress(self.nodes[1].getnewaddress(), Decimal('1'))
+        node0.generate(1)
+        self.sync_all()
+
+
+if __name__ == '__main__':
+    WalletArchiveTest().main()
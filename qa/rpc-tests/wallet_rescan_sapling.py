@@ -0,0 +1,78 @@
+#!/usr/bin/env python3
+# Copyright (c) 2021 The Zcash developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+from decimal import Decimal
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import assert_equal, start_nodes, \
+    initialize_chain_clean, connect_nodes_bi, wait_and_assert_operationid_status, \
+    DEFAULT_FEE
+
+# Blocks between transactions, so that they land in different windows of the
+# rescan read-ahead stage (WALLET_RESCAN_READ_AHEAD is 32).
+GAP = 40
+
+class WalletRescanSaplingTest (BitcoinTestFramework):
+
+    def setup_chain(self):
+        print("Initializing test directory "+self.options.tmpdir)
+        initialize_chain_clean(self.options.tmpdir, 3)
+
+    def setup_network(self, split=False):
+        # Node 1 rescans block by block; node 2 uses the read-ahead workers
+        # and the compact block index.
+        self.nodes = start_nodes(3, self.options.tmpdir, [
+            [],
+            ['-walletdecryptthreads=1'],
+            ['-walletdecryptthreads=4', '-compactblockindex'],
+        ])
+        connect_nodes_bi(self.nodes,0,1)
+        connect_nodes_bi(self.nodes,0,2)
+        self.is_network_split=False
+        self.sync_all()
+
+    def run_test(self):
+        [sender, scanner, compact] = self.nodes
+
+        def z_send(from_addr, to_addr, amount):
+            opid = sender.z_sendmany(from_addr,
+                [{"address": to_addr, "amount": Decimal(amount)}], 1, DEFAULT_FEE)
+            wait_and_assert_operationid_status(sender, opid)
+            self.sync_all()
+            sender.generate(GAP)
+            self.sync_all()
+
+        def received(node, zaddr):
+            return sorted([(tx["txid"], tx["outindex"], tx["amount"])
+                           for tx in node.z_listreceivedbyaddress(zaddr, 0)])
+
+        sender.generate(101)
+        self.sync_all()
+        funding_zaddr = sender.z_getnewaddress()
+        res = sender.z_shieldcoinbase("*", funding_zaddr)
+        wait_and_assert_operationid_status(sender, res['opid'])
+        self.sync_all()
+        sender.generate(1)
+        self.sync_all()
+
+        # Receive notes spread over several read-ahead windows, and spend one
+        # of them so that the rescan has to detect our nullifiers too.
+        zaddr = sender.z_getnewaddress()
+        for amount in ['1.5', '0.25', '2.0']:
+            z_send(funding_zaddr, zaddr, amount)
+        z_send(zaddr, funding_zaddr, '1.0')
+
+        expected_notes = received(sender, zaddr)
+        expected_balance = sender.z_getbalance(zaddr)
+        assert_equal(len(expected_notes), 4)
+
+        key = sender.z_exportkey(zaddr)
+        for node in [scanner, compact]:
+            imported = node.z_importkey(key, "yes")
+            assert_equal(imported["address"], zaddr)
+            assert_equal(received(node, zaddr), expected_notes)
+            assert_equal(node.z_getbalance(zaddr), expected_balance)
+
+if __name__ == '__main__':
+    WalletRescanSaplingTest().main()
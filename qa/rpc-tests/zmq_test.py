@@ -27,8 +27,16 @@ class ZMQTest(BitcoinTestFramework):
         self.zmqSubSocket.setsockopt(zmq.SUBSCRIBE, b"hashblock")
         self.zmqSubSocket.setsockopt(zmq.SUBSCRIBE, b"hashtx")
         self.zmqSubSocket.connect("tcp://127.0.0.1:%i" % self.port)
+        self.zmqBlockSocket = self.zmqContext.socket(zmq.SUB)
+        self.zmqBlockSocket.setsockopt(zmq.SUBSCRIBE, b"blockconnected")
+        self.zmqBlockSocket.connect("tcp://127.0.0.1:%i" % self.port)
+        self.zmqMempoolSocket = self.zmqContext.socket(zmq.SUB)
+        self.zmqMempoolSocket.setsockopt(zmq.SUBSCRIBE, b"mempoolchange")
+        self.zmqMempoolSocket.connect("tcp://127.0.0.1:%i" % self.port)
         return start_nodes(self.num_nodes, self.options.tmpdir, extra_args=[
-            ['-zmqpubhashtx=tcp://127.0.0.1:'+str(self.port), '-zmqpubhashblock=tcp://127.0.0.1:'+str(self.port)],
+            ['-zmqpubhashtx=tcp://127.0.0.1:'+str(self.port), '-zmqpubhashblock=tcp://127.0.0.1:'+str(self.port),
+             '-zmqpubblockconnected=tcp://127.0.0.1:'+str(self.port),
+             '-zmqpubmempoolchange=tcp://127.0.0.1:'+str(self.port)],
             [],
             [],
             []
@@ -79,6 +87,7 @@ class ZMQTest(BitcoinTestFramework):
             assert_equal(genhashes[x], zmqHashes[x]) #blockhash from generate must be equal to the hash received over zmq
 
         #test tx from a second node
+        mempoolSequence = self.nodes[0].getmempoolchanges()['sequence']
         hashRPC = self.nodes[1].sendtoaddress(self.nodes[0].getnewaddress(), 1.0)
         self.sync_all()
 
@@ -94,6 +103,26 @@ class ZMQTest(BitcoinTestFramework):
 
         assert_equal(hashRPC, hashZMQ) #blockhash from generate must be equal to the hash received over zmq
 
+        # the mempool change is published, and returned by getmempoolchanges
+        msg = self.zmqMempoolSocket.recv_multipart()
+        assert_equal(msg[0], b"mempoolchange")
+        assert_equal(bytes_to_hex_str(msg[1][:32]), hashRPC)
+        assert_equal(msg[1][32:33], b"A")
+        assert_equal(struct.unpack('<Q', msg[1][33:])[0], mempoolSequence + 1)
+        changes = self.nodes[0].getmempoolchanges(mempoolSequence)
+        assert_equal(changes['sequence'], mempoolSequence + 1)
+        assert_equal(changes['changes'], [{'txid': hashRPC, 'type': 'added', 'sequence': mempoolSequence + 1}])
+
+        # every connected block was published with its height, in order
+        for x in range(0, n + 1):
+            msg = self.zmqBlockSocket.recv_multipart()
+            assert_equal(msg[0], b"blockconnected")
+            height = struct.unpack('<I', msg[1][:4])[0]
+            assert_equal(bytes_to_hex_str(msg[1][4:]), self.nodes[0].getblockhash(height))
+            msgSequence = struct.unpack('<I', msg[-1])[-1]
+            assert_equal(msgSequence, x)
+            assert_equal(height, self.nodes[0].getblockcount() - n + x)
+
 
 if __name__ == '__main__':
     ZMQTest ().main ()
@@ -185,7 +185,7 @@ case "$1" in
                 zcash_rpc zcbenchmark parameterloading 10
                 ;;
             createsaplingspend)
-                zcash_rpc zcbenchmark createsaplingspend 10
+                zcash_rpc zcbenchmark createsaplingspend 10 "${@:3}"
                 ;;
             verifysaplingspend)
                 zcash_rpc zcbenchmark verifysaplingspend 1000
@@ -247,7 +247,7 @@ case "$1" in
                 zcash_rpc zcbenchmark parameterloading 1
                 ;;
             createsaplingspend)
-                zcash_rpc zcbenchmark createsaplingspend 1
+                zcash_rpc zcbenchmark createsaplingspend 1 "${@:3}"
                 ;;
             verifysaplingspend)
                 zcash_rpc zcbenchmark verifysaplingspend 1
@@ -310,7 +310,7 @@ case "$1" in
                 zcash_rpc zcbenchmark parameterloading 1
                 ;;
             createsaplingspend)
-                zcash_rpc zcbenchmark createsaplingspend 1
+                zcash_rpc zcbenchmark createsaplingspend 1 "${@:3}"
                 ;;
             verifysaplingspend)
                 zcash_rpc zcbenchmark verifysaplingspend 1
@@ -5,6 +5,7 @@
 #ifndef BITCOIN_ADDRMAN_H
 #define BITCOIN_ADDRMAN_H
 
+#include "memusage.h"
 #include "netbase.h"
 #include "protocol.h"
 #include "random.h"
@@ -12,6 +13,7 @@
 #include "timedata.h"
 #include "util.h"
 
+#include <algorithm>
 #include <map>
 #include <set>
 #include <stdint.h>
@@ -171,6 +173,56 @@ public:
 #define ADDRMAN_NEW_BUCKET_COUNT (1 << ADDRMAN_NEW_BUCKET_COUNT_LOG2)
 #define ADDRMAN_BUCKET_SIZE (1 << ADDRMAN_BUCKET_SIZE_LOG2)
 
+/**
+ * The number of occupied positions in each bucket of a table, kept in a
+ * Fenwick tree so that the n-th occupied position of the whole table can be
+ * found in logarithmic time. BUCKETS must be a power of two.
+ */
+template <int BUCKETS>
+class CAddrBucketCounts
+{
+private:
+    //! tree[i] counts the positions of buckets (i - (i & -i), i], one-based
+    int tree[BUCKETS + 1];
+
+public:
+    CAddrBucketCounts() { Clear(); }
+
+    void Clear()
+    {
+        std::fill(tree, tree + BUCKETS + 1, 0);
+    }
+
+    //! Add nDelta to the count of a bucket.
+    void Add(int nBucket, int nDelta)
+    {
+        for (int i = nBucket + 1; i <= BUCKETS; i += i & -i) {
+            tree[i] += nDelta;
+        }
+    }
+
+    //! Return the number of occupied positions in the table.
+    int Total() const
+    {
+        return tree[BUCKETS];
+    }
+
+    //! Return the bucket that holds the nth occupied position of the table,
+    //! counting from zero, and set nth to its index among the occupied
+    //! positions of that bucket. nth must be less than Total().
+    int Find(int& nth) const
+    {
+        int nBucket = 0;
+        for (int nStep = BUCKETS / 2; nStep > 0; nStep /= 2) {
+            if (tree[nBucket + nStep] <= nth) {
+                nBucket += nStep;
+                nth -= tree[nBucket];
+            }
+        }
+        return nBucket;
+    }
+};
+
 /** 
  * Stochastical (IP) address manager 
  */
@@ -204,6 +256,17 @@ private:
     //! list of "new" buckets
     int vvNew[ADDRMAN_NEW_BUCKET_COUNT][ADDRMAN_BUCKET_SIZE];
 
+    //! number of occupied positions in each "tried" and "new" bucket
+    CAddrBucketCounts<ADDRMAN_TRIED_BUCKET_COUNT> triedCounts;
+    CAddrBucketCounts<ADDRMAN_NEW_BUCKET_COUNT> newCounts;
+
+    //! Set a position in a "tried" or "new" bucket, to an nId or -1, keeping the counts up to date.
+    void SetTried(int nKBucket, int nKBucketPos, int nId);
+    void SetNew(int nUBucket, int nUBucketPos, int nId);
+
+    //! Return the nId at a position chosen uniformly among the occupied positions of a table.
+    int SelectPosition(bool fNew);
+
 protected:
     //! secret key to randomize bucket select with
     uint256 nKey;
@@ -378,7 +441,7 @@ public:
                 int nUBucket = info.GetNewBucket(nKey);
                 int nUBucketPos = info.GetBucketPosition(nKey, true, nUBucket);
                 if (vvNew[nUBucket][nUBucketPos] == -1) {
-                    vvNew[nUBucket][nUBucketPos] = n;
+                    SetNew(nUBucket, nUBucketPos, n);
                     info.nRefCount++;
                 }
             }
@@ -398,7 +461,7 @@ public:
                 vRandom.push_back(nIdCount);
                 mapInfo[nIdCount] = info;
                 mapAddr[info] = nIdCount;
-                vvTried[nKBucket][nKBucketPos] = nIdCount;
+                SetTried(nKBucket, nKBucketPos, nIdCount);
                 nIdCount++;
             } else {
                 nLost++;
@@ -418,7 +481,7 @@ public:
                     int nUBucketPos = info.GetBucketPosition(nKey, true, bucket);
                     if (nVersion == 1 && nUBuckets == ADDRMAN_NEW_BUCKET_COUNT && vvNew[bucket][nUBucketPos] == -1 && info.nRefCount < ADDRMAN_NEW_BUCKETS_PER_ADDRESS) {
                         info.nRefCount++;
-                        vvNew[bucket][nUBucketPos] = nIndex;
+                        SetNew(bucket, nUBucketPos, nIndex);
                     }
                 }
             }
@@ -457,6 +520,8 @@ public:
                 vvTried[bucket][entry] = -1;
             }
         }
+        triedCounts.Clear();
+        newCounts.Clear();
 
         nIdCount = 0;
         nTried = 0;
@@ -480,6 +545,16 @@ public:
         return vRandom.size();
     }
 
+    //! Return the memory used by the tables, in bytes.
+    size_t DynamicMemoryUsage() const
+    {
+        LOCK(cs);
+        return memusage::DynamicUsage(mapInfo) +
+               memusage::DynamicUsage(mapAddr) +
+               memusage::DynamicUsage(vRandom) +
+               sizeof(vvTried) + sizeof(vvNew);
+    }
+
     //! Consistency check
     void Check()
     {
@@ -4,6 +4,8 @@
 
 #include "asyncrpcoperation.h"
 
+#include <rust/metrics.h>
+
 #include <boost/uuid/uuid.hpp>
 #include <boost/uuid/uuid_generators.hpp>
 #include <boost/uuid/uuid_io.hpp>
@@ -38,6 +40,7 @@ AsyncRPCOperation::AsyncRPCOperation() : error_code_(0), error_message_() {
 AsyncRPCOperation::AsyncRPCOperation(const AsyncRPCOperation& o) :
         id_(o.id_), creation_time_(o.creation_time_), state_(o.state_.load()),
         start_time_(o.start_time_), end_time_(o.end_time_),
+        phase_(o.phase_), phase_start_time_(o.phase_start_time_), phase_secs_(o.phase_secs_),
         error_code_(o.error_code_), error_message_(o.error_message_),
         result_(o.result_)
 {
@@ -49,6 +52,9 @@ AsyncRPCOperation& AsyncRPCOperation::operator=( const AsyncRPCOperation& other
     this->state_.store(other.state_.load());
     this->start_time_ = other.start_time_;
     this->end_time_ = other.end_time_;
+    this->phase_ = other.phase_;
+    this->phase_start_time_ = other.phase_start_time_;
+    this->phase_secs_ = other.phase_secs_;
     this->error_code_ = other.error_code_;
     this->error_message_ = other.error_message_;
     this->result_ = other.result_;
@@ -74,16 +80,34 @@ void AsyncRPCOperation::cancel() {
 void AsyncRPCOperation::start_execution_clock() {
     std::lock_guard<std::mutex> guard(lock_);
     start_time_ = std::chrono::system_clock::now();
+    MetricsHistogram("zcash.rpc.async.queue.wait.seconds",
+        std::chrono::duration<double>(start_time_ - std::chrono::system_clock::from_time_t(creation_time_)).count());
 }
 
 /**
  * Stop timing the execution run
  */
 void AsyncRPCOperation::stop_execution_clock() {
+    set_phase("");
     std::lock_guard<std::mutex> guard(lock_);
     end_time_ = std::chrono::system_clock::now();
 }
 
+/**
+ * End the current phase of execution, if any, and start the given one.
+ */
+void AsyncRPCOperation::set_phase(const std::string& phase) {
+    std::lock_guard<std::mutex> guard(lock_);
+    auto now = std::chrono::system_clock::now();
+    if (!phase_.empty()) {
+        double secs = std::chrono::duration<double>(now - phase_start_time_).count();
+        phase_secs_.emplace_back(phase_, secs);
+        MetricsHistogram("zcash.rpc.async.phase.seconds", secs, "phase", phase_.c_str());
+    }
+    phase_ = phase;
+    phase_start_time_ = now;
+}
+
 /**
  * Implement this virtual method in any subclass.  This is just an example implementation.
  */
@@ -156,6 +180,22 @@ UniValue AsyncRPCOperation::getStatus() const {
     obj.pushKV("status", OperationStatusMap[status]);
     obj.pushKV("creation_time", this->creation_time_);
     // TODO: Issue #1354: There may be other useful metadata to return to the user.
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        if (!phase_.empty()) {
+            obj.pushKV("phase", phase_);
+        }
+        if (!phase_secs_.empty()) {
+            // A phase may be entered more than once, e.g. to create the
+            // proofs of each transaction of a z_mergetoaddress.
+            UniValue secs(UniValue::VOBJ);
+            for (const auto& entry : phase_secs_) {
+                const UniValue& prev = find_value(secs, entry.first);
+                secs.pushKV(entry.first, (prev.isNull() ? 0.0 : prev.get_real()) + entry.second);
+            }
+            obj.pushKV("phase_secs", secs);
+        }
+    }
     UniValue err = this->getError();
     if (!err.isNull()) {
         obj.pushKV("error", err.get_obj());
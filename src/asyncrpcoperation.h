@@ -14,6 +14,7 @@
 #include <thread>
 #include <utility>
 #include <future>
+#include <vector>
 
 #include <univalue.h>
 
@@ -101,24 +102,41 @@ public:
         return OperationStatus::SUCCESS == getState();
     }
 
+    // The phase of execution that the operation is in, or the empty string
+    // if it is not executing.
+    std::string getPhase() const {
+        std::lock_guard<std::mutex> guard(lock_);
+        return phase_;
+    }
+
 protected:
     // The state_ is atomic because only it can be mutated externally.
     // For example, the user initiates a shut down of the application, which closes
     // the AsyncRPCQueue, which in turn invokes cancel() on all operations.
     // The member variables below are protected rather than private in order to
     // allow subclasses of AsyncRPCOperation the ability to access and update
-    // internal state.  Currently, all operations are executed in a single-thread
-    // by a single worker.
+    // internal state.  Each operation is executed by a single worker, but
+    // several workers may be executing different operations at once.
     mutable std::mutex lock_;   // lock on this when read/writing non-atomics
     UniValue result_;
     int error_code_;
     std::string error_message_;
     std::atomic<OperationStatus> state_;
     std::chrono::time_point<std::chrono::system_clock> start_time_, end_time_;  
+    std::string phase_;
+    std::chrono::time_point<std::chrono::system_clock> phase_start_time_;
+    // The phases that have ended, with their durations in seconds.
+    std::vector<std::pair<std::string, double>> phase_secs_;
 
     void start_execution_clock();
     void stop_execution_clock();
 
+    // Mark the start of a phase of execution, such as selecting the inputs
+    // or creating the proofs, ending the previous one. The time spent in
+    // each phase is reported in the status of the operation, and recorded
+    // in metrics. stop_execution_clock() ends the last phase.
+    void set_phase(const std::string& phase);
+
     void set_state(OperationStatus state) {
         this->state_.store(state);
     }
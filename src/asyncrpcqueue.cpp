@@ -4,6 +4,11 @@
 
 #include "asyncrpcqueue.h"
 
+#include <rust/metrics.h>
+#include <tracing.h>
+
+#include <algorithm>
+
 static std::atomic<size_t> workerCounter(0);
 
 /**
@@ -43,15 +48,15 @@ void AsyncRPCQueue::run(size_t workerId) {
 
             // Exit if the queue is closing.
             if (isClosed()) {
-                while (!operation_id_queue_.empty()) {
-                    operation_id_queue_.pop();
-                }
+                operation_id_queue_.clear();
+                MetricsGauge("zcash.rpc.async.queue.depth", 0.0);
                 break;
             }
 
             // Get operation id
             key = operation_id_queue_.front();
-            operation_id_queue_.pop();
+            operation_id_queue_.pop_front();
+            MetricsGauge("zcash.rpc.async.queue.depth", (double)operation_id_queue_.size());
 
             // Search operation map
             AsyncRPCOperationMap::const_iterator iter = operation_map_.find(key);
@@ -65,6 +70,9 @@ void AsyncRPCQueue::run(size_t workerId) {
         } else if (operation->isCancelled()) {
             // skip cancelled operation
         } else {
+            auto span = TracingSpan("info", "rpc", "AsyncRPCOperation",
+                "id", key.c_str());
+            auto spanGuard = span.Enter();
             operation->main();
         }
     }
@@ -91,7 +99,8 @@ void AsyncRPCQueue::addOperation(const std::shared_ptr<AsyncRPCOperation> &ptrOp
 
     AsyncRPCOperationId id = ptrOperation->getId();
     operation_map_.emplace(id, ptrOperation);
-    operation_id_queue_.push(id);
+    operation_id_queue_.push_back(id);
+    MetricsGauge("zcash.rpc.async.queue.depth", (double)operation_id_queue_.size());
     this->condition_.notify_one();
 }
 
@@ -171,6 +180,19 @@ size_t AsyncRPCQueue::getOperationCount() const {
     return operation_id_queue_.size();
 }
 
+/**
+ * Return the number of operations queued ahead of the given one, or -1 if it
+ * is not waiting in the queue.
+ */
+int AsyncRPCQueue::getQueuePosition(AsyncRPCOperationId id) const {
+    std::lock_guard<std::mutex> guard(lock_);
+    auto it = std::find(operation_id_queue_.begin(), operation_id_queue_.end(), id);
+    if (it == operation_id_queue_.end()) {
+        return -1;
+    }
+    return it - operation_id_queue_.begin();
+}
+
 /**
  * Spawn a worker thread
  */
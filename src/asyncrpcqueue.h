@@ -10,7 +10,7 @@
 #include <iostream>
 #include <string>
 #include <chrono>
-#include <queue>
+#include <deque>
 #include <unordered_map>
 #include <vector>
 #include <future>
@@ -45,6 +45,8 @@ public:
     void finishAndWait(); // block thread until existing operations have finished, threads terminated
     void cancelAllOperations(); // mark all operations in the queue as cancelled
     size_t getOperationCount() const;
+    // The number of operations queued ahead of the given one, or -1 if it is not queued.
+    int getQueuePosition(AsyncRPCOperationId) const;
     std::shared_ptr<AsyncRPCOperation> getOperationForId(AsyncRPCOperationId) const;
     std::shared_ptr<AsyncRPCOperation> popOperationForId(AsyncRPCOperationId);
     void addOperation(const std::shared_ptr<AsyncRPCOperation> &ptrOperation);
@@ -61,7 +63,7 @@ private:
     std::atomic<bool> closed_;
     std::atomic<bool> finish_;
     AsyncRPCOperationMap operation_map_;
-    std::queue <AsyncRPCOperationId> operation_id_queue_;
+    std::deque<AsyncRPCOperationId> operation_id_queue_;
     std::vector<std::thread> workers_;
 };
 
@@ -6,9 +6,14 @@
 
 #include "perf.h"
 
+#include <univalue.h>
+
+#include <algorithm>
 #include <assert.h>
+#include <cmath>
 #include <iostream>
 #include <iomanip>
+#include <regex>
 
 benchmark::BenchRunner::BenchmarkMap &benchmark::BenchRunner::benchmarks() {
     static std::map<std::string, benchmark::BenchFunction> benchmarks_map;
@@ -21,20 +26,68 @@ benchmark::BenchRunner::BenchRunner(std::string name, benchmark::BenchFunction f
 }
 
 void
-benchmark::BenchRunner::RunAll(benchmark::duration elapsedTimeForOne)
+benchmark::BenchRunner::RunAll(const std::string& filter, bool fJson, benchmark::duration elapsedTimeForOne)
 {
     perf_init();
     if (std::ratio_less_equal<benchmark::clock::period, std::micro>::value) {
         std::cerr << "WARNING: Clock precision is worse than microsecond - benchmarks may be less accurate!\n";
     }
-    std::cout << "#Benchmark" << "," << "count" << "," << "min(ns)" << "," << "max(ns)" << "," << "average(ns)" << ","
-              << "min_cycles" << "," << "max_cycles" << "," << "average_cycles" << "\n";
+    if (!fJson) {
+        std::cout << "#Benchmark" << "," << "count" << "," << "min(ns)" << "," << "max(ns)" << "," << "average(ns)" << ","
+                  << "median(ns)" << "," << "stddev(ns)" << ","
+                  << "min_cycles" << "," << "max_cycles" << "," << "average_cycles" << "\n";
+    }
 
+    std::regex reFilter(filter);
+    std::vector<Result> results;
     for (const auto &p: benchmarks()) {
+        if (!std::regex_match(p.first, reFilter)) {
+            continue;
+        }
         State state(p.first, elapsedTimeForOne);
         p.second(state);
+        if (!state.result) {
+            continue;
+        }
+        Result& r = *state.result;
+        r.counters = state.counters;
+        if (!fJson) {
+            std::cout << std::fixed << std::setprecision(0) << r.name << "," << r.count << ","
+                      << r.minElapsed << "," << r.maxElapsed << "," << r.averageElapsed << ","
+                      << r.medianElapsed << "," << r.stddevElapsed << ","
+                      << r.minCycles << "," << r.maxCycles << "," << r.averageCycles << "\n";
+            std::cout.copyfmt(std::ios(nullptr));
+            for (const auto& counter : r.counters) {
+                std::cout << "#" << r.name << "," << counter.first << "," << counter.second << "\n";
+            }
+        }
+        results.push_back(r);
     }
     perf_fini();
+
+    if (fJson) {
+        UniValue arr(UniValue::VARR);
+        for (const Result& r : results) {
+            UniValue obj(UniValue::VOBJ);
+            obj.pushKV("name", r.name);
+            obj.pushKV("count", r.count);
+            obj.pushKV("min_ns", r.minElapsed);
+            obj.pushKV("max_ns", r.maxElapsed);
+            obj.pushKV("average_ns", r.averageElapsed);
+            obj.pushKV("median_ns", r.medianElapsed);
+            obj.pushKV("stddev_ns", r.stddevElapsed);
+            obj.pushKV("min_cycles", r.minCycles);
+            obj.pushKV("max_cycles", r.maxCycles);
+            obj.pushKV("average_cycles", r.averageCycles);
+            UniValue counters(UniValue::VOBJ);
+            for (const auto& counter : r.counters) {
+                counters.pushKV(counter.first, counter.second);
+            }
+            obj.pushKV("counters", counters);
+            arr.push_back(obj);
+        }
+        std::cout << arr.write(2) << "\n";
+    }
 }
 
 bool benchmark::State::KeepRunning()
@@ -62,6 +115,7 @@ bool benchmark::State::KeepRunning()
         uint64_t elapsedOneCycles = (nowCycles - lastCycles) / (countMask + 1);
         if (elapsedOneCycles < minCycles) minCycles = elapsedOneCycles;
         if (elapsedOneCycles > maxCycles) maxCycles = elapsedOneCycles;
+        samples.push_back(std::chrono::duration<double, std::nano>(elapsedOne).count());
 
         if (elapsed*128 < maxElapsed) {
           // If the execution was much too fast (1/128th of maxElapsed), increase the count mask by 8x and restart timing.
@@ -72,6 +126,7 @@ bool benchmark::State::KeepRunning()
           maxTime = duration::zero();
           minCycles = std::numeric_limits<uint64_t>::max();
           maxCycles = std::numeric_limits<uint64_t>::min();
+          samples.clear();
           return true;
         }
         if (elapsed*16 < maxElapsed) {
@@ -91,16 +146,33 @@ bool benchmark::State::KeepRunning()
 
     assert(count != 0 && "count == 0 => (now == 0 && beginTime == 0) => return above");
 
-    // Output results
+    // Record results
     // Duration casts are only necessary here because hardware with sub-nanosecond clocks
     // will lose precision.
-    int64_t min_elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(minTime).count();
-    int64_t max_elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(maxTime).count();
-    int64_t avg_elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>((now-beginTime)/count).count();
-    int64_t averageCycles = (nowCycles-beginCycles)/count;
-    std::cout << std::fixed << std::setprecision(15) << name << "," << count << "," << min_elapsed << "," << max_elapsed << "," << avg_elapsed << ","
-              << minCycles << "," << maxCycles << "," << averageCycles << "\n";
-    std::cout.copyfmt(std::ios(nullptr));
+    Result stats;
+    stats.name = name;
+    stats.count = count;
+    stats.minElapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(minTime).count();
+    stats.maxElapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(maxTime).count();
+    stats.averageElapsed = std::chrono::duration_cast<std::chrono::nanoseconds>((now-beginTime)/count).count();
+    stats.minCycles = minCycles;
+    stats.maxCycles = maxCycles;
+    stats.averageCycles = (nowCycles-beginCycles)/count;
+
+    // The median and standard deviation are those of the batch timings.
+    stats.medianElapsed = stats.averageElapsed;
+    stats.stddevElapsed = 0;
+    if (!samples.empty()) {
+        std::sort(samples.begin(), samples.end());
+        stats.medianElapsed = samples[samples.size() / 2];
+        double mean = 0;
+        for (double sample : samples) mean += sample;
+        mean /= samples.size();
+        double variance = 0;
+        for (double sample : samples) variance += (sample - mean) * (sample - mean);
+        stats.stddevElapsed = std::sqrt(variance / samples.size());
+    }
+    result = stats;
 
     return false;
 }
@@ -8,8 +8,10 @@
 #include <functional>
 #include <limits>
 #include <map>
+#include <optional>
 #include <string>
 #include <chrono>
+#include <vector>
 
 #include <boost/preprocessor/cat.hpp>
 #include <boost/preprocessor/stringize.hpp>
@@ -47,6 +49,15 @@ namespace benchmark {
     using time_point = clock::time_point;
     using duration = clock::duration;
 
+    struct Result {
+        std::string name;
+        uint64_t count;
+        int64_t minElapsed, maxElapsed, averageElapsed, medianElapsed;
+        double stddevElapsed;
+        uint64_t minCycles, maxCycles, averageCycles;
+        std::map<std::string, double> counters;
+    };
+
     class State {
         std::string name;
         duration maxElapsed;
@@ -58,7 +69,14 @@ namespace benchmark {
         uint64_t lastCycles;
         uint64_t minCycles;
         uint64_t maxCycles;
+        // The elapsed time of one iteration in each timed batch, in nanoseconds.
+        std::vector<double> samples;
     public:
+        //! Set once the benchmark has finished running.
+        std::optional<Result> result;
+        //! Further statistics that the benchmark reports, such as throughput.
+        std::map<std::string, double> counters;
+
         State(std::string _name, duration _maxElapsed) :
             name(_name),
             maxElapsed(_maxElapsed),
@@ -84,7 +102,14 @@ namespace benchmark {
     public:
         BenchRunner(std::string name, BenchFunction func);
 
-        static void RunAll(duration elapsedTimeForOne = std::chrono::seconds(1));
+        /**
+         * Run the benchmarks whose names match filter, and print their
+         * statistics to stdout as CSV or, if fJson is set, as a JSON array.
+         */
+        static void RunAll(
+            const std::string& filter = ".*",
+            bool fJson = false,
+            duration elapsedTimeForOne = std::chrono::seconds(1));
     };
 }
 
@@ -4,23 +4,44 @@
 
 #include "bench.h"
 
+#include "chainparams.h"
+#include "crypto/sha256.h"
 #include "fs.h"
 #include "key.h"
 #include "main.h"
+#include "script/sigcache.h"
 #include "util.h"
 
 #include "librustzcash.h"
 
+#include <iostream>
+
 const std::function<std::string(const char*)> G_TRANSLATION_FUN = nullptr;
 
 int
 main(int argc, char** argv)
 {
+    ParseParameters(argc, argv);
+    if (mapArgs.count("-?") || mapArgs.count("-h") || mapArgs.count("-help")) {
+        std::cout << "Usage: bench_bitcoin [options]\n\n"
+                  << "Options:\n"
+                  << "  -filter=<regex>     Run only the benchmarks whose names match <regex> (default: .*)\n"
+                  << "  -printer=<fmt>      Print the results as \"csv\" or \"json\" (default: csv)\n"
+                  << "  -datadir=<dir>      Read the recorded block for the ConnectBlockSlow benchmark\n"
+                  << "                      from <dir>/benchmark (default: the zcashd data directory)\n"
+                  << "  -blockcorpus=<dir>  Replay the blocks written to <dir> by the dumpblockcorpus RPC\n"
+                  << "                      in the ConnectBlockCorpus benchmark\n";
+        return 0;
+    }
+    SHA256AutoDetect();
     ECC_Start();
     auto globalVerifyHandle = new ECCVerifyHandle();
+    InitSignatureCache();
     SetupEnvironment();
     fPrintToDebugLog = false; // don't want to write to debug.log file
 
+    SelectParams(CBaseChainParams::MAIN);
+
     fs::path sapling_spend = ZC_GetParamsDir() / "sapling-spend.params";
     fs::path sapling_output = ZC_GetParamsDir() / "sapling-output.params";
     fs::path sprout_groth16 = ZC_GetParamsDir() / "sprout-groth16.params";
@@ -38,10 +59,15 @@ main(int argc, char** argv)
         reinterpret_cast<const codeunit*>(sapling_output_str.c_str()),
         sapling_output_str.length(),
         reinterpret_cast<const codeunit*>(sprout_groth16_str.c_str()),
-        sprout_groth16_str.length()
+        sprout_groth16_str.length(),
+        nullptr,
+        0,
+        false
     );
 
-    benchmark::BenchRunner::RunAll();
+    benchmark::BenchRunner::RunAll(
+        GetArg("-filter", ".*"),
+        GetArg("-printer", "csv") == "json");
 
     ECC_Stop();
 }
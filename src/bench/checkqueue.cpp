@@ -6,10 +6,12 @@
 #include "util.h"
 #include "main.h"
 #include "checkqueue.h"
+#include "crypto/sha256.h"
 #include "prevector.h"
 #include <vector>
 #include <boost/thread/thread.hpp>
 #include "random.h"
+#include "uint256.h"
 
 
 // This Benchmark tests the CheckQueue with the lightest
@@ -99,5 +101,57 @@ static void CCheckQueueSpeedPrevectorJob(benchmark::State& state)
     tg.interrupt_all();
     tg.join_all();
 }
+
+// This Benchmark tests two queues of different types of checks sharing the
+// workers of one pool, as the script and proof checks of a block do: a few
+// expensive checks are added up front, then many light ones.
+static void CCheckQueueSpeedMixedJobs(benchmark::State& state)
+{
+    struct FakeJobNoWork {
+        bool operator()()
+        {
+            return true;
+        }
+        void swap(FakeJobNoWork& x){};
+    };
+    struct FakeJobSlow {
+        bool operator()()
+        {
+            uint256 hash;
+            for (int i = 0; i < 1000; ++i) {
+                CSHA256().Write(hash.begin(), 32).Finalize(hash.begin());
+            }
+            return true;
+        }
+        void swap(FakeJobSlow& x){};
+    };
+    CCheckPool pool;
+    CCheckQueue<FakeJobNoWork> queue {QUEUE_BATCH_SIZE, &pool};
+    CCheckQueue<FakeJobSlow> slow_queue {1, &pool};
+    boost::thread_group tg;
+    for (auto x = 0; x < std::max(MIN_CORES, GetNumCores()); ++x) {
+       tg.create_thread([&]{pool.Thread();});
+    }
+    while (state.KeepRunning()) {
+        CCheckQueueControl<FakeJobNoWork> control(&queue);
+        CCheckQueueControl<FakeJobSlow> slow_control(&slow_queue);
+
+        std::vector<FakeJobSlow> vSlowChecks(BATCH_SIZE);
+        slow_control.Add(vSlowChecks);
+
+        std::vector<std::vector<FakeJobNoWork>> vBatches(BATCHES);
+        for (auto& vChecks : vBatches) {
+            vChecks.resize(BATCH_SIZE);
+        }
+        for (auto& vChecks : vBatches) {
+            control.Add(vChecks);
+        }
+        control.Wait();
+        slow_control.Wait();
+    }
+    tg.interrupt_all();
+    tg.join_all();
+}
 BENCHMARK(CCheckQueueSpeed);
 BENCHMARK(CCheckQueueSpeedPrevectorJob);
+BENCHMARK(CCheckQueueSpeedMixedJobs);
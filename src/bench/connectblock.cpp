@@ -0,0 +1,137 @@
+// Copyright (c) 2021 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "bench.h"
+
+#include "blockcorpus.h"
+#include "chainparams.h"
+#include "consensus/validation.h"
+#include "main.h"
+#include "streams.h"
+#include "util.h"
+#include "zcbenchmarks.h"
+
+#include <iostream>
+#include <memory>
+
+// Connect mainnet block 107134, whose many transparent inputs made it slow to
+// validate (issue 2017-05-01.a), to a view of its recorded inputs. The block
+// and its inputs are read from the benchmark directory of the data directory,
+// and the benchmark is skipped if they are not there.
+//
+// The signature cache is warm after the first run, as it is for a block whose
+// transactions were relayed to the node before it.
+static void ConnectBlockSlow(benchmark::State& state)
+{
+    const CChainParams& chainparams = Params();
+    CBlock block;
+    FILE* fp = fsbridge::fopen(GetDataDir() / "benchmark/block-107134.dat", "rb");
+    if (!fp) {
+        std::cerr << "ConnectBlockSlow: skipped, "
+                  << (GetDataDir() / "benchmark/block-107134.dat").string() << " not found\n";
+        return;
+    }
+    CAutoFile blkFile(fp, SER_DISK, CLIENT_VERSION);
+    blkFile >> block;
+    blkFile.fclose();
+
+    // Fake its inputs
+    auto hashPrev = uint256S("00000000159a41f468e22135942a567781c3f3dc7ad62257993eb3c69c3f95ef");
+    FakeCoinsViewDB fakeDB("benchmark/block-107134-inputs", hashPrev);
+
+    // Fake the chain
+    CBlockIndex index(block);
+    index.nHeight = 107134;
+    CBlockIndex indexPrev;
+    indexPrev.phashBlock = &hashPrev;
+    indexPrev.nHeight = index.nHeight - 1;
+    index.pprev = &indexPrev;
+
+    LOCK(cs_main);
+    mapBlockIndex.insert(std::make_pair(hashPrev, &indexPrev));
+
+    while (state.KeepRunning()) {
+        CCoinsViewCache view(&fakeDB);
+        CValidationState validationState;
+        assert(ConnectBlock(block, validationState, &index, view, chainparams, true));
+    }
+
+    // Undo alterations to global state
+    mapBlockIndex.erase(hashPrev);
+}
+
+// Replay the blocks of a corpus written by the dumpblockcorpus RPC, in the
+// directory given by -blockcorpus, through ConnectBlock, one block per
+// iteration. The checks that are skipped below the last checkpoint are
+// done. Besides the time per block, the throughput and the average time of
+// each stage of ConnectBlock are reported as counters.
+static void ConnectBlockCorpus(benchmark::State& state)
+{
+    if (!mapArgs.count("-blockcorpus")) {
+        std::cerr << "ConnectBlockCorpus: skipped, -blockcorpus is not set\n";
+        return;
+    }
+    std::vector<CBlockCorpusEntry> entries;
+    std::string strError;
+    if (!ReadBlockCorpus(GetArg("-blockcorpus", ""), entries, strError) || entries.empty()) {
+        std::cerr << "ConnectBlockCorpus: skipped, " << (strError.empty() ? "the corpus is empty" : strError) << "\n";
+        return;
+    }
+
+    // Fake the chain around each block
+    struct ReplayBlock {
+        uint256 hash;
+        CBlockIndex index;
+        CBlockIndex indexPrev;
+
+        explicit ReplayBlock(const CBlock& block) : hash(block.GetHash()), index(block) {}
+    };
+    std::vector<std::unique_ptr<ReplayBlock>> blocks;
+    for (const CBlockCorpusEntry& entry : entries) {
+        auto block = std::make_unique<ReplayBlock>(entry.block);
+        block->index.phashBlock = &block->hash;
+        block->index.nHeight = entry.nHeight;
+        block->index.hashFinalSaplingRoot = entry.hashFinalSaplingRoot;
+        block->index.pprev = &block->indexPrev;
+        block->indexPrev.phashBlock = &entry.hashPrevBlock;
+        block->indexPrev.nHeight = entry.nHeight - 1;
+        blocks.push_back(std::move(block));
+    }
+
+    const CChainParams& chainparams = Params();
+    bool fPrevCheckpointsEnabled = fCheckpointsEnabled;
+    fCheckpointsEnabled = false;
+
+    LOCK(cs_main);
+    for (size_t i = 0; i < entries.size(); i++) {
+        mapBlockIndex.insert(std::make_pair(entries[i].hashPrevBlock, &blocks[i]->indexPrev));
+    }
+
+    ResetBlockStageTimes();
+    size_t nBlocks = 0;
+    auto start = benchmark::clock::now();
+    while (state.KeepRunning()) {
+        size_t i = nBlocks++ % entries.size();
+        CBlockCorpusView corpusView(entries[i]);
+        CCoinsViewCache view(&corpusView);
+        CValidationState validationState;
+        assert(ConnectBlock(entries[i].block, validationState, &blocks[i]->index, view, chainparams, true));
+    }
+    double elapsed = std::chrono::duration<double>(benchmark::clock::now() - start).count();
+
+    state.counters["blocks"] = entries.size();
+    state.counters["blocks_per_second"] = nBlocks / elapsed;
+    for (const auto& stage : GetBlockStageTimes()) {
+        state.counters["stage_" + stage.first + "_us"] = double(stage.second) / nBlocks;
+    }
+
+    // Undo alterations to global state
+    for (const CBlockCorpusEntry& entry : entries) {
+        mapBlockIndex.erase(entry.hashPrevBlock);
+    }
+    fCheckpointsEnabled = fPrevCheckpointsEnabled;
+}
+
+BENCHMARK(ConnectBlockSlow);
+BENCHMARK(ConnectBlockCorpus);
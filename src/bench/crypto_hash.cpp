@@ -6,6 +6,7 @@
 
 #include "bench.h"
 #include "bloom.h"
+#include "hash.h"
 #include "random.h"
 #include "utiltime.h"
 #include "crypto/ripemd160.h"
@@ -13,6 +14,8 @@
 #include "crypto/sha256.h"
 #include "crypto/sha512.h"
 
+#include <rust/blake2b.h>
+
 /* Number of bytes to hash per iteration */
 static const uint64_t BUFFER_SIZE = 1000*1000;
 
@@ -40,6 +43,37 @@ static void SHA256(benchmark::State& state)
         CSHA256().Write(begin_ptr(in), in.size()).Finalize(hash);
 }
 
+static void SHA256_32b(benchmark::State& state)
+{
+    std::vector<uint8_t> in(32,0);
+    while (state.KeepRunning()) {
+        for (int i = 0; i < 1000000; i++) {
+            CSHA256().Write(begin_ptr(in), in.size()).Finalize(&in[0]);
+        }
+    }
+}
+
+static void SHA256D64_1024(benchmark::State& state)
+{
+    std::vector<uint8_t> in(64 * 1024, 0);
+    while (state.KeepRunning()) {
+        SHA256D64(begin_ptr(in), begin_ptr(in), 1024);
+    }
+}
+
+static void SHA256Compress_combine(benchmark::State& state)
+{
+    uint8_t hash[CSHA256::OUTPUT_SIZE] = {};
+    while (state.KeepRunning()) {
+        for (int i = 0; i < 100000; i++) {
+            CSHA256 hasher;
+            hasher.Write(hash, sizeof(hash));
+            hasher.Write(hash, sizeof(hash));
+            hasher.FinalizeNoPadding(hash);
+        }
+    }
+}
+
 static void SHA512(benchmark::State& state)
 {
     uint8_t hash[CSHA512::OUTPUT_SIZE];
@@ -48,6 +82,63 @@ static void SHA512(benchmark::State& state)
         CSHA512().Write(begin_ptr(in), in.size()).Finalize(hash);
 }
 
+/* The Equihash (200, 9) personalization, output length and header size */
+static const unsigned char EQUIHASH_PERSONAL[BLAKE2bPersonalBytes] = {'Z','c','a','s','h','P','o','W',200,0,0,0,9,0,0,0};
+static const size_t EQUIHASH_HASH_LENGTH = 50;
+static const size_t EQUIHASH_INPUT_SIZE = 140;
+
+/* Hashes of the first Equihash rows, one index at a time from a cloned state */
+static void BLAKE2b_EquihashRows(benchmark::State& state)
+{
+    std::vector<unsigned char> input(EQUIHASH_INPUT_SIZE, 0);
+    unsigned char hash[EQUIHASH_HASH_LENGTH];
+    BLAKE2bState* base = blake2b_init(EQUIHASH_HASH_LENGTH, EQUIHASH_PERSONAL);
+    blake2b_update(base, input.data(), input.size());
+    while (state.KeepRunning()) {
+        for (uint32_t g = 0; g < 4096; g++) {
+            BLAKE2bState* row = blake2b_clone(base);
+            blake2b_update(row, (const unsigned char*)&g, sizeof(g));
+            blake2b_finalize(row, hash, sizeof(hash));
+            blake2b_free(row);
+        }
+    }
+    blake2b_free(base);
+}
+
+/* The same hashes, computed several lanes at a time */
+static void BLAKE2b_EquihashRows_Many(benchmark::State& state)
+{
+    std::vector<unsigned char> input(EQUIHASH_INPUT_SIZE, 0);
+    std::vector<uint32_t> indices(256);
+    std::vector<unsigned char> hashes(indices.size() * EQUIHASH_HASH_LENGTH);
+    while (state.KeepRunning()) {
+        for (uint32_t g = 0; g < 4096; g += indices.size()) {
+            for (size_t i = 0; i < indices.size(); i++) {
+                indices[i] = g + i;
+            }
+            blake2b_hash_many(EQUIHASH_HASH_LENGTH, EQUIHASH_PERSONAL,
+                              input.data(), input.size(),
+                              (const unsigned char*)indices.data(), sizeof(uint32_t), indices.size(),
+                              hashes.data());
+        }
+    }
+}
+
+/* A ZIP 243 prevouts digest of 1000 inputs, serialized a field at a time */
+static void BLAKE2b_Writer_Prevouts(benchmark::State& state)
+{
+    const unsigned char personal[BLAKE2bPersonalBytes] = {'Z','c','a','s','h','P','r','e','v','o','u','t','H','a','s','h'};
+    uint256 txid;
+    while (state.KeepRunning()) {
+        CBLAKE2bWriter ss(SER_GETHASH, 0, personal);
+        for (uint32_t n = 0; n < 1000; n++) {
+            ss << txid;
+            ss << n;
+        }
+        txid = ss.GetHash();
+    }
+}
+
 static void FastRandom_32bit(benchmark::State& state)
 {
     FastRandomContext rng(true);
@@ -73,7 +164,13 @@ static void FastRandom_1bit(benchmark::State& state)
 BENCHMARK(RIPEMD160);
 BENCHMARK(SHA1);
 BENCHMARK(SHA256);
+BENCHMARK(SHA256_32b);
+BENCHMARK(SHA256D64_1024);
+BENCHMARK(SHA256Compress_combine);
 BENCHMARK(SHA512);
+BENCHMARK(BLAKE2b_EquihashRows);
+BENCHMARK(BLAKE2b_EquihashRows_Many);
+BENCHMARK(BLAKE2b_Writer_Prevouts);
 
 BENCHMARK(FastRandom_32bit);
 BENCHMARK(FastRandom_1bit);
@@ -0,0 +1,22 @@
+// Copyright (c) 2021 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "bench.h"
+
+#include "chainparams.h"
+#include "pow.h"
+#include "primitives/block.h"
+
+// Validate the Equihash solution of the mainnet genesis block.
+static void EquihashValidation(benchmark::State& state)
+{
+    const CChainParams& params = Params(CBaseChainParams::MAIN);
+    CBlockHeader header = params.GenesisBlock().GetBlockHeader();
+
+    while (state.KeepRunning()) {
+        assert(CheckEquihashSolution(&header, params.GetConsensus()));
+    }
+}
+
+BENCHMARK(EquihashValidation);
@@ -0,0 +1,50 @@
+// Copyright (c) 2021 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "bench.h"
+
+#include "utilstrencodings.h"
+
+#include <string>
+#include <vector>
+
+/* Size of the data encoded and decoded, about that of a large block */
+static const size_t HEX_BENCH_BYTES = 2000000;
+
+static std::vector<unsigned char> HexBenchData()
+{
+    std::vector<unsigned char> data(HEX_BENCH_BYTES);
+    for (size_t i = 0; i < data.size(); i++) {
+        data[i] = (unsigned char)(i * 2654435761u >> 13);
+    }
+    return data;
+}
+
+static void HexStrEncode(benchmark::State& state)
+{
+    std::vector<unsigned char> data = HexBenchData();
+    while (state.KeepRunning()) {
+        HexStr(data.data(), data.data() + data.size());
+    }
+}
+
+static void HexStrEncodeIterator(benchmark::State& state)
+{
+    std::vector<unsigned char> data = HexBenchData();
+    while (state.KeepRunning()) {
+        HexStr(data.begin(), data.end());
+    }
+}
+
+static void ParseHexDecode(benchmark::State& state)
+{
+    std::string hex = HexStr(HexBenchData());
+    while (state.KeepRunning()) {
+        ParseHex(hex);
+    }
+}
+
+BENCHMARK(HexStrEncode);
+BENCHMARK(HexStrEncodeIterator);
+BENCHMARK(ParseHexDecode);
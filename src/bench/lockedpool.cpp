@@ -7,6 +7,7 @@
 #include "support/lockedpool.h"
 
 #include <iostream>
+#include <thread>
 #include <vector>
 
 #define ASIZE 2048
@@ -44,3 +45,60 @@ static void LockedPool(benchmark::State& state)
 }
 
 BENCHMARK(LockedPool);
+
+#define TTHREADS 4
+#define TITER 1000
+#define TSLOTS 16
+
+/** Allocate and free key-sized chunks from the live pool on several threads
+ * at once, as parallel proving and signing do. With fSized, chunks are freed
+ * with their size, as secure_allocator does, so that the per-thread caches
+ * take them. */
+static void LockedPoolThreads(benchmark::State& state, bool fSized)
+{
+    LockedPoolManager &pool = LockedPoolManager::Instance();
+    while (state.KeepRunning()) {
+        std::vector<std::thread> threads;
+        for (int t = 0; t < TTHREADS; ++t) {
+            threads.emplace_back([&pool, fSized, t]() {
+                void *addr[TSLOTS] = {};
+                size_t sizes[TSLOTS] = {};
+                uint32_t s = 0x12345678 + t;
+                for (int x = 0; x < TITER; ++x) {
+                    int idx = s & (TSLOTS - 1);
+                    if (addr[idx]) {
+                        fSized ? pool.free(addr[idx], sizes[idx]) : pool.free(addr[idx]);
+                        addr[idx] = nullptr;
+                    } else {
+                        // 32 to 256 bytes, the sizes of keys and serialized spending keys
+                        sizes[idx] = 32 * (1 + ((s >> 8) & 7));
+                        addr[idx] = pool.alloc(sizes[idx]);
+                    }
+                    bool lsb = s & 1;
+                    s >>= 1;
+                    if (lsb)
+                        s ^= 0xf00f00f0;
+                }
+                for (int idx = 0; idx < TSLOTS; ++idx) {
+                    pool.free(addr[idx]);
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+}
+
+static void LockedPoolThreadsShared(benchmark::State& state)
+{
+    LockedPoolThreads(state, false);
+}
+
+static void LockedPoolThreadsCached(benchmark::State& state)
+{
+    LockedPoolThreads(state, true);
+}
+
+BENCHMARK(LockedPoolThreadsShared);
+BENCHMARK(LockedPoolThreadsCached);
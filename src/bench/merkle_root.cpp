@@ -0,0 +1,59 @@
+// Copyright (c) 2021 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "bench.h"
+
+#include "consensus/merkle.h"
+#include "primitives/block.h"
+#include "random.h"
+#include "uint256.h"
+
+/* Number of transactions in the benchmark block */
+static const size_t MERKLE_LEAVES = 9001;
+
+static CBlock MakeMerkleBlock()
+{
+    CBlock block;
+    block.vtx.reserve(MERKLE_LEAVES);
+    for (size_t i = 0; i < MERKLE_LEAVES; i++) {
+        CMutableTransaction tx;
+        tx.nLockTime = i; // only needs to make the txids unique
+        block.vtx.push_back(CTransaction(tx));
+    }
+    return block;
+}
+
+static void MerkleRoot(benchmark::State& state)
+{
+    std::vector<uint256> leaves(MERKLE_LEAVES);
+    for (auto& leaf : leaves) {
+        leaf = GetRandHash();
+    }
+    while (state.KeepRunning()) {
+        bool mutated = false;
+        ComputeMerkleRoot(leaves, &mutated);
+    }
+}
+
+static void MerkleRoot_Block(benchmark::State& state)
+{
+    CBlock block = MakeMerkleBlock();
+    while (state.KeepRunning()) {
+        bool mutated = false;
+        BlockMerkleRoot(block, &mutated);
+    }
+}
+
+static void MerkleRoot_BuildMerkleTree(benchmark::State& state)
+{
+    CBlock block = MakeMerkleBlock();
+    while (state.KeepRunning()) {
+        bool mutated = false;
+        block.BuildMerkleTree(&mutated);
+    }
+}
+
+BENCHMARK(MerkleRoot);
+BENCHMARK(MerkleRoot_Block);
+BENCHMARK(MerkleRoot_BuildMerkleTree);
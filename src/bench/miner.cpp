@@ -0,0 +1,84 @@
+// Copyright (c) 2021 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "bench.h"
+
+#include "chainparams.h"
+#include "coins.h"
+#include "consensus/upgrades.h"
+#include "fs.h"
+#include "main.h"
+#include "miner.h"
+#include "random.h"
+#include "script/script.h"
+#include "txdb.h"
+#include "txmempool.h"
+#include "util.h"
+
+/* Number of transactions in the mempool of the benchmark */
+static const size_t MEMPOOL_TXS = 1000;
+
+// Create a block template on a regtest chain holding only its genesis block,
+// from a mempool of transparent transactions. The chain state is created in
+// a temporary data directory and removed afterwards.
+static void CreateBlockTemplate(benchmark::State& state)
+{
+    SelectParams(CBaseChainParams::REGTEST);
+    const CChainParams& chainparams = Params();
+
+    std::string strPrevDataDir = GetArg("-datadir", "");
+    fs::path pathTemp = fs::temp_directory_path() /
+        strprintf("bench_bitcoin_%lu_%i", (unsigned long)GetTime(), (int)(GetRand(100000)));
+    fs::create_directories(pathTemp);
+    ClearDatadirCache();
+    mapArgs["-datadir"] = pathTemp.string();
+    pblocktree = new CBlockTreeDB(1 << 20, true);
+    pcoinsdbview = new CCoinsViewDB(1 << 23, true);
+    pcoinsTip = new CCoinsViewCache(pcoinsdbview);
+    InitBlockIndex(chainparams);
+
+    {
+        LOCK2(cs_main, mempool.cs);
+        for (size_t i = 0; i < MEMPOOL_TXS; i++) {
+            COutPoint prevout(GetRandHash(), 0);
+            pcoinsTip->AddCoin(prevout, Coin(CTxOut(COIN, CScript() << OP_TRUE), 0, false), false);
+
+            CMutableTransaction mtx;
+            mtx.vin.emplace_back(prevout);
+            mtx.vout.emplace_back(COIN - 10000, CScript() << OP_TRUE);
+            CTransaction tx(mtx);
+            mempool.addUnchecked(tx.GetHash(), CTxMemPoolEntry(
+                tx, 10000, GetTime(), 0.0, 0, true, false, SPROUT_BRANCH_ID));
+        }
+    }
+
+    boost::shared_ptr<CReserveScript> minerScript(new CReserveScript());
+    minerScript->reserveScript = CScript() << OP_TRUE;
+    MinerAddress minerAddress(minerScript);
+
+    while (state.KeepRunning()) {
+        std::unique_ptr<CBlockTemplate> pblocktemplate(CreateNewBlock(chainparams, minerAddress));
+        assert(pblocktemplate->block.vtx.size() == MEMPOOL_TXS + 1);
+    }
+
+    // Undo alterations to global state
+    mempool.clear();
+    UnloadBlockIndex();
+    delete pcoinsTip;
+    delete pcoinsdbview;
+    delete pblocktree;
+    pcoinsTip = nullptr;
+    pcoinsdbview = nullptr;
+    pblocktree = nullptr;
+    fs::remove_all(pathTemp);
+    if (strPrevDataDir.empty()) {
+        mapArgs.erase("-datadir");
+    } else {
+        mapArgs["-datadir"] = strPrevDataDir;
+    }
+    ClearDatadirCache();
+    SelectParams(CBaseChainParams::MAIN);
+}
+
+BENCHMARK(CreateBlockTemplate);
@@ -0,0 +1,129 @@
+// Copyright (c) 2021 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "bench.h"
+
+#include "chainparams.h"
+#include "consensus/consensus.h"
+#include "librustzcash.h"
+#include "random.h"
+#include "uint256.h"
+#include "zcash/IncrementalMerkleTree.hpp"
+#include "zcash/Note.hpp"
+
+/* Number of witnesses and note commitments in the block benchmark */
+static const size_t BLOCK_WITNESSES = 100;
+static const size_t BLOCK_COMMITMENTS = 100;
+
+struct SaplingTrialDecryptionSetup {
+    const Consensus::Params& params;
+    int nHeight;
+    libzcash::SaplingIncomingViewingKey ivk;
+    libzcash::SaplingEncCiphertext ciphertext;
+    uint256 epk;
+    uint256 cmu;
+
+    SaplingTrialDecryptionSetup() :
+        params(Params(CBaseChainParams::MAIN).GetConsensus()),
+        nHeight(params.vUpgrades[Consensus::UPGRADE_CANOPY].nActivationHeight + ZIP212_GRACE_PERIOD)
+    {
+        auto sk = libzcash::SaplingSpendingKey::random();
+        ivk = sk.full_viewing_key().in_viewing_key();
+        auto addr = sk.default_address();
+
+        libzcash::SaplingNote note(addr, 39393, libzcash::Zip212Enabled::AfterZip212);
+        cmu = note.cmu().value();
+        std::array<unsigned char, ZC_MEMO_SIZE> memo = {{0xF6}};
+        auto enc = libzcash::SaplingNotePlaintext(note, memo).encrypt(addr.pk_d).value();
+        ciphertext = enc.first;
+        epk = enc.second.get_epk();
+    }
+};
+
+// Trial-decrypt an output with the key it was sent to.
+static void SaplingTrialDecryption(benchmark::State& state)
+{
+    SaplingTrialDecryptionSetup setup;
+
+    while (state.KeepRunning()) {
+        auto pt = libzcash::SaplingNotePlaintext::decrypt(
+            setup.params, setup.nHeight, setup.ciphertext, setup.ivk, setup.epk, setup.cmu);
+        assert(pt.has_value());
+    }
+}
+
+// Trial-decrypt an output with another key, which is what a wallet does for
+// almost every output that it scans.
+static void SaplingTrialDecryptionMiss(benchmark::State& state)
+{
+    SaplingTrialDecryptionSetup setup;
+    auto ivk = libzcash::SaplingSpendingKey::random().full_viewing_key().in_viewing_key();
+
+    while (state.KeepRunning()) {
+        auto pt = libzcash::SaplingNotePlaintext::decrypt(
+            setup.params, setup.nHeight, setup.ciphertext, ivk, setup.epk, setup.cmu);
+        assert(!pt.has_value());
+    }
+}
+
+// As above, but with the key agreement already done, as the wallet does when
+// it scans a block, so that only the symmetric decryption is measured.
+static void SaplingTrialDecryptionMissWithSecret(benchmark::State& state)
+{
+    SaplingTrialDecryptionSetup setup;
+    auto ivk = libzcash::SaplingSpendingKey::random().full_viewing_key().in_viewing_key();
+    uint256 dhsecret;
+    bool fAgreed = librustzcash_sapling_ka_agree(setup.epk.begin(), ivk.begin(), dhsecret.begin());
+    assert(fAgreed);
+
+    while (state.KeepRunning()) {
+        auto pt = libzcash::SaplingNotePlaintext::decrypt_with_shared_secret(
+            setup.params, setup.nHeight, setup.ciphertext, ivk, dhsecret, setup.epk, setup.cmu);
+        assert(!pt.has_value());
+    }
+}
+
+// Append a note commitment to a witness.
+static void SaplingWitnessIncrement(benchmark::State& state)
+{
+    SaplingMerkleTree tree;
+    tree.append(GetRandHash());
+    SaplingWitness witness = tree.witness();
+
+    while (state.KeepRunning()) {
+        witness.append(GetRandHash());
+    }
+}
+
+// Append the note commitments of a block to the witnesses of a wallet.
+static void SaplingWitnessIncrementBlock(benchmark::State& state)
+{
+    SaplingMerkleTree tree;
+    std::vector<SaplingWitness> witnesses;
+    for (size_t i = 0; i < BLOCK_WITNESSES; i++) {
+        tree.append(GetRandHash());
+        for (auto& witness : witnesses) {
+            witness.append(tree.last());
+        }
+        witnesses.push_back(tree.witness());
+    }
+    std::vector<SaplingWitness*> pwitnesses;
+    for (auto& witness : witnesses) {
+        pwitnesses.push_back(&witness);
+    }
+    std::vector<libzcash::PedersenHash> commitments(BLOCK_COMMITMENTS);
+    for (auto& cm : commitments) {
+        cm = GetRandHash();
+    }
+
+    while (state.KeepRunning()) {
+        SaplingWitness::append_all(pwitnesses, commitments);
+    }
+}
+
+BENCHMARK(SaplingTrialDecryption);
+BENCHMARK(SaplingTrialDecryptionMiss);
+BENCHMARK(SaplingTrialDecryptionMissWithSecret);
+BENCHMARK(SaplingWitnessIncrement);
+BENCHMARK(SaplingWitnessIncrementBlock);
@@ -0,0 +1,72 @@
+// Copyright (c) 2021 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "bench.h"
+
+#include "chain.h"
+#include "primitives/block.h"
+#include "random.h"
+#include "script/script.h"
+
+#include <univalue.h>
+
+extern UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false);
+
+/* Number of transactions in the block of the benchmarks */
+static const size_t RPC_BENCH_TXS = 1000;
+
+// A block of transactions that each spend two transparent inputs to two
+// P2PKH outputs, as the verbose getblock RPC serializes it.
+static CBlock RPCBenchBlock()
+{
+    CBlock block;
+    for (size_t i = 0; i < RPC_BENCH_TXS; i++) {
+        CMutableTransaction mtx;
+        for (int j = 0; j < 2; j++) {
+            mtx.vin.emplace_back(COutPoint(GetRandHash(), j));
+            mtx.vin.back().scriptSig = CScript() << std::vector<unsigned char>(72, 0x30) << std::vector<unsigned char>(33, 0x02);
+            CScript scriptPubKey = CScript() << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, i & 0xff) << OP_EQUALVERIFY << OP_CHECKSIG;
+            mtx.vout.emplace_back(COIN + j, scriptPubKey);
+        }
+        block.vtx.emplace_back(mtx);
+    }
+    return block;
+}
+
+static void BlockToJsonVerbose(benchmark::State& state)
+{
+    CBlock block = RPCBenchBlock();
+    CBlockIndex index(block);
+    index.nHeight = 1000000;
+    while (state.KeepRunning()) {
+        blockToJSON(block, &index, true);
+    }
+}
+
+static void BlockToJsonVerboseWrite(benchmark::State& state)
+{
+    CBlock block = RPCBenchBlock();
+    CBlockIndex index(block);
+    index.nHeight = 1000000;
+    UniValue obj = blockToJSON(block, &index, true);
+    while (state.KeepRunning()) {
+        obj.write();
+    }
+}
+
+static void BlockToJsonVerboseRead(benchmark::State& state)
+{
+    CBlock block = RPCBenchBlock();
+    CBlockIndex index(block);
+    index.nHeight = 1000000;
+    std::string json = blockToJSON(block, &index, true).write();
+    while (state.KeepRunning()) {
+        UniValue obj;
+        assert(obj.read(json));
+    }
+}
+
+BENCHMARK(BlockToJsonVerbose);
+BENCHMARK(BlockToJsonVerboseWrite);
+BENCHMARK(BlockToJsonVerboseRead);
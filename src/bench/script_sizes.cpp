@@ -0,0 +1,72 @@
+// Copyright (c) 2021 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "bench.h"
+
+#include "primitives/transaction.h"
+#include "streams.h"
+#include "version.h"
+
+#include <vector>
+
+/*
+ * Inputs and outputs with the script sizes of transparent mainnet traffic:
+ * mostly P2PKH spends (107-byte scriptSig) and outputs (25 bytes), some
+ * 2-of-3 multisig P2SH spends (253 bytes) and P2SH outputs (23 bytes), and
+ * coinbase scriptSigs of a few bytes. The scriptSigs of spends do not fit in
+ * the 28 bytes that a CScript holds without a heap allocation.
+ */
+static const size_t SCRIPT_BENCH_TXINS = 1000;
+
+static CScript ScriptOfSize(size_t nSize)
+{
+    CScript script;
+    script.resize(nSize);
+    for (size_t i = 0; i < nSize; i++) {
+        script[i] = (unsigned char)(i * 31 + nSize);
+    }
+    return script;
+}
+
+static void ScriptBenchData(std::vector<CTxIn>& vin, std::vector<CTxOut>& vout)
+{
+    for (size_t i = 0; i < SCRIPT_BENCH_TXINS; i++) {
+        size_t nSigSize = i % 10 == 0 ? 253 : (i % 10 == 1 ? 4 + i % 20 : 107);
+        vin.emplace_back(COutPoint(uint256(), i), ScriptOfSize(nSigSize));
+        vout.emplace_back(i, ScriptOfSize(i % 8 == 0 ? 23 : 25));
+    }
+}
+
+static void DeserializeScriptMix(benchmark::State& state)
+{
+    std::vector<CTxIn> vin;
+    std::vector<CTxOut> vout;
+    ScriptBenchData(vin, vout);
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << vin << vout;
+
+    while (state.KeepRunning()) {
+        CDataStream stream(ss);
+        std::vector<CTxIn> vinRead;
+        std::vector<CTxOut> voutRead;
+        stream >> vinRead >> voutRead;
+        assert(vinRead.size() == SCRIPT_BENCH_TXINS);
+    }
+}
+
+static void CopyScriptMix(benchmark::State& state)
+{
+    std::vector<CTxIn> vin;
+    std::vector<CTxOut> vout;
+    ScriptBenchData(vin, vout);
+
+    while (state.KeepRunning()) {
+        std::vector<CTxIn> vinCopy(vin);
+        std::vector<CTxOut> voutCopy(vout);
+        assert(vinCopy.size() == SCRIPT_BENCH_TXINS);
+    }
+}
+
+BENCHMARK(DeserializeScriptMix);
+BENCHMARK(CopyScriptMix);
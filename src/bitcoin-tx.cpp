@@ -435,24 +435,27 @@ static void MutateTxSign(CMutableTransaction& tx, const std::string& strInput)
             if (nOut < 0)
                 throw std::runtime_error("vout must be positive");
 
+            COutPoint out(txid, nOut);
+
             std::vector<unsigned char> pkData(ParseHexUV(prevOut["scriptPubKey"], "scriptPubKey"));
             CScript scriptPubKey(pkData.begin(), pkData.end());
 
             {
-                CCoinsModifier coins = view.ModifyCoins(txid);
-                if (coins->IsAvailable(nOut) && coins->vout[nOut].scriptPubKey != scriptPubKey) {
+                const Coin& coin = view.AccessCoin(out);
+                if (!coin.IsSpent() && coin.out.scriptPubKey != scriptPubKey) {
                     std::string err("Previous output scriptPubKey mismatch:\n");
-                    err = err + ScriptToAsmStr(coins->vout[nOut].scriptPubKey) + "\nvs:\n"+
+                    err = err + ScriptToAsmStr(coin.out.scriptPubKey) + "\nvs:\n"+
                         ScriptToAsmStr(scriptPubKey);
                     throw std::runtime_error(err);
                 }
-                if ((unsigned int)nOut >= coins->vout.size())
-                    coins->vout.resize(nOut+1);
-                coins->vout[nOut].scriptPubKey = scriptPubKey;
-                coins->vout[nOut].nValue = 0;
+                Coin newcoin;
+                newcoin.out.scriptPubKey = scriptPubKey;
+                newcoin.out.nValue = 0;
                 if (prevOut.exists("amount")) {
-                    coins->vout[nOut].nValue = AmountFromValue(prevOut["amount"]);
+                    newcoin.out.nValue = AmountFromValue(prevOut["amount"]);
                 }
+                newcoin.nHeight = 1;
+                view.AddCoin(out, std::move(newcoin), true);
             }
 
             // if redeemScript given and private keys given,
@@ -474,28 +477,43 @@ static void MutateTxSign(CMutableTransaction& tx, const std::string& strInput)
     // Grab the consensus branch ID for the given height
     auto consensusBranchId = CurrentEpochBranchId(nHeight, Params().GetConsensus());
 
-    // Sign what we can:
+    // The signature hashes do not cover the scriptSigs, so every input is
+    // signed against the unsigned transaction, with the signature hash
+    // components computed once.
+    const CTransaction txConst(mergedTx);
+    const PrecomputedTransactionData txdata(txConst);
+    std::vector<CTxOut> vPrevOuts(mergedTx.vin.size());
+    std::vector<char> vFound(mergedTx.vin.size());
     for (unsigned int i = 0; i < mergedTx.vin.size(); i++) {
-        CTxIn& txin = mergedTx.vin[i];
-        const CCoins* coins = view.AccessCoins(txin.prevout.hash);
-        if (!coins || !coins->IsAvailable(txin.prevout.n)) {
-            fComplete = false;
-            continue;
-        }
-        const CScript& prevPubKey = coins->vout[txin.prevout.n].scriptPubKey;
-        const CAmount& amount = coins->vout[txin.prevout.n].nValue;
+        const Coin& coin = view.AccessCoin(mergedTx.vin[i].prevout);
+        vFound[i] = !coin.IsSpent();
+        if (vFound[i])
+            vPrevOuts[i] = coin.out;
+    }
+
+    // Sign what we can, spreading the inputs over threads:
+    std::vector<char> vVerified(mergedTx.vin.size());
+    ParallelFor(mergedTx.vin.size(), GetNumCores(), [&](size_t i) {
+        if (!vFound[i])
+            return;
+        const CScript& prevPubKey = vPrevOuts[i].scriptPubKey;
+        const CAmount& amount = vPrevOuts[i].nValue;
 
         SignatureData sigdata;
         // Only sign SIGHASH_SINGLE if there's a corresponding output:
         if (!fHashSingle || (i < mergedTx.vout.size()))
-            ProduceSignature(MutableTransactionSignatureCreator(&keystore, &mergedTx, i, amount, nHashType), prevPubKey, sigdata, consensusBranchId);
+            ProduceSignature(TransactionSignatureCreator(&keystore, &txConst, i, amount, txdata, nHashType), prevPubKey, sigdata, consensusBranchId);
 
         // ... and merge in other signatures:
+        TransactionSignatureChecker checker(&txConst, i, amount, txdata);
         for (const CTransaction& txv : txVariants)
-            sigdata = CombineSignatures(prevPubKey, MutableTransactionSignatureChecker(&mergedTx, i, amount), sigdata, DataFromTransaction(txv, i), consensusBranchId);
+            sigdata = CombineSignatures(prevPubKey, checker, sigdata, DataFromTransaction(txv, i), consensusBranchId);
         UpdateTransaction(mergedTx, i, sigdata);
 
-        if (!VerifyScript(txin.scriptSig, prevPubKey, STANDARD_SCRIPT_VERIFY_FLAGS, MutableTransactionSignatureChecker(&mergedTx, i, amount), consensusBranchId))
+        vVerified[i] = VerifyScript(mergedTx.vin[i].scriptSig, prevPubKey, STANDARD_SCRIPT_VERIFY_FLAGS, checker, consensusBranchId);
+    });
+    for (unsigned int i = 0; i < mergedTx.vin.size(); i++) {
+        if (!vVerified[i])
             fComplete = false;
     }
 
@@ -0,0 +1,237 @@
+// Copyright (c) 2021 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "blockcompression.h"
+
+#include "crypto/common.h"
+
+#include <string.h>
+
+namespace {
+
+/**
+ * Byte strings that are common in Zcash blocks and undo data, which matches
+ * near the start of a record can refer to. Changing it changes the format.
+ */
+const unsigned char DICTIONARY[] = {
+    // Block header version, and the compact size of an Equihash (200, 9) solution
+    0x04, 0x00, 0x00, 0x00, 0xfd, 0x40, 0x05,
+    // Overwinter and Sapling transaction headers
+    0x03, 0x00, 0x00, 0x80, 0x70, 0x82, 0xc4, 0x03,
+    0x04, 0x00, 0x00, 0x80, 0x85, 0x20, 0x2f, 0x89,
+    // Coinbase input
+    0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xff, 0xff, 0xff, 0xff,
+    // P2SH and P2PKH output scripts
+    0x17, 0xa9, 0x14, 0x87, 0x19, 0x76, 0xa9, 0x14, 0x88, 0xac,
+    // Empty valueBalance, Sapling spends and outputs, and JoinSplits
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    // Final sequence number, and no lock time
+    0xff, 0xff, 0xff, 0xff, 0x00, 0x00, 0x00, 0x00,
+};
+const size_t DICTIONARY_SIZE = sizeof(DICTIONARY);
+
+// Parameters of the LZ4 block format.
+const size_t MIN_MATCH = 4;
+const size_t MAX_OFFSET = 65535;
+//! The last literals of a block are at least this long.
+const size_t LAST_LITERALS = 5;
+//! The last match starts at least this far from the end of a block.
+const size_t MATCH_LIMIT = 12;
+
+const int HASH_LOG = 16;
+const uint32_t NO_POSITION = 0xffffffff;
+
+//! The format byte and the decompressed size.
+const size_t RECORD_HEADER_SIZE = 1 + sizeof(uint32_t);
+
+inline uint32_t HashSequence(const unsigned char* p)
+{
+    return (ReadLE32(p) * 2654435761U) >> (32 - HASH_LOG);
+}
+
+void WriteLength(std::vector<char>& vOut, size_t nLength)
+{
+    while (nLength >= 255) {
+        vOut.push_back((char)255);
+        nLength -= 255;
+    }
+    vOut.push_back((char)nLength);
+}
+
+void WriteSequence(std::vector<char>& vOut, const unsigned char* pLiterals, size_t nLiterals, size_t nOffset, size_t nMatch)
+{
+    unsigned char token = (nLiterals >= 15 ? 15 : nLiterals) << 4;
+    if (nMatch != 0) {
+        token |= (nMatch - MIN_MATCH >= 15 ? 15 : nMatch - MIN_MATCH);
+    }
+    vOut.push_back((char)token);
+    if (nLiterals >= 15) {
+        WriteLength(vOut, nLiterals - 15);
+    }
+    vOut.insert(vOut.end(), (const char*)pLiterals, (const char*)pLiterals + nLiterals);
+    if (nMatch != 0) {
+        vOut.push_back((char)(nOffset & 0xff));
+        vOut.push_back((char)(nOffset >> 8));
+        if (nMatch - MIN_MATCH >= 15) {
+            WriteLength(vOut, nMatch - MIN_MATCH - 15);
+        }
+    }
+}
+
+bool ReadLength(const unsigned char*& ip, const unsigned char* iend, size_t& nLength)
+{
+    unsigned char b;
+    do {
+        if (ip == iend) {
+            return false;
+        }
+        b = *ip++;
+        nLength += b;
+    } while (b == 255);
+    return true;
+}
+
+} // namespace
+
+bool CompressBlockRecord(const char* pbegin, const char* pend, std::vector<char>& vOut)
+{
+    vOut.clear();
+    size_t nInput = pend - pbegin;
+    if (nInput > 0x7fffffff) {
+        return false;
+    }
+
+    // Matches are found in the input preceded by the dictionary.
+    std::vector<unsigned char> vData(DICTIONARY_SIZE + nInput);
+    memcpy(vData.data(), DICTIONARY, DICTIONARY_SIZE);
+    if (nInput > 0) {
+        memcpy(vData.data() + DICTIONARY_SIZE, pbegin, nInput);
+    }
+    const unsigned char* base = vData.data();
+    const size_t nEnd = vData.size();
+
+    vOut.reserve(nInput);
+    vOut.push_back((char)BLOCK_RECORD_FORMAT_LZ4);
+    unsigned char size[sizeof(uint32_t)];
+    WriteLE32(size, nInput);
+    vOut.insert(vOut.end(), (const char*)size, (const char*)size + sizeof(size));
+
+    std::vector<uint32_t> vTable(1 << HASH_LOG, NO_POSITION);
+    for (size_t i = 0; i + MIN_MATCH <= DICTIONARY_SIZE; i++) {
+        vTable[HashSequence(base + i)] = i;
+    }
+
+    size_t nAnchor = DICTIONARY_SIZE;
+    if (nInput > MATCH_LIMIT) {
+        const size_t nMatchStartLimit = nEnd - MATCH_LIMIT;
+        const size_t nMatchEndLimit = nEnd - LAST_LITERALS;
+        size_t nPos = DICTIONARY_SIZE;
+        while (nPos < nMatchStartLimit) {
+            uint32_t& nCandidate = vTable[HashSequence(base + nPos)];
+            size_t nFound = nCandidate;
+            nCandidate = nPos;
+            if (nFound == NO_POSITION || nPos - nFound > MAX_OFFSET ||
+                memcmp(base + nFound, base + nPos, MIN_MATCH) != 0) {
+                nPos++;
+                continue;
+            }
+
+            size_t nMatch = MIN_MATCH;
+            while (nPos + nMatch < nMatchEndLimit && base[nFound + nMatch] == base[nPos + nMatch]) {
+                nMatch++;
+            }
+            WriteSequence(vOut, base + nAnchor, nPos - nAnchor, nPos - nFound, nMatch);
+            nPos += nMatch;
+            nAnchor = nPos;
+            if (vOut.size() >= nInput) {
+                vOut.clear();
+                return false;
+            }
+        }
+    }
+    WriteSequence(vOut, base + nAnchor, nEnd - nAnchor, 0, 0);
+
+    if (vOut.size() >= nInput) {
+        vOut.clear();
+        return false;
+    }
+    return true;
+}
+
+bool DecompressBlockRecord(const char* pbegin, const char* pend, std::vector<char>& vOut, size_t nMaxSize)
+{
+    vOut.clear();
+    const unsigned char* ip = (const unsigned char*)pbegin;
+    const unsigned char* iend = (const unsigned char*)pend;
+    if (size_t(iend - ip) < RECORD_HEADER_SIZE || ip[0] != BLOCK_RECORD_FORMAT_LZ4) {
+        return false;
+    }
+    size_t nSize = ReadLE32(ip + 1);
+    if (nSize > nMaxSize) {
+        return false;
+    }
+    ip += RECORD_HEADER_SIZE;
+
+    // Matches can refer to the dictionary, which is removed at the end.
+    std::vector<char> vData(DICTIONARY_SIZE + nSize);
+    memcpy(vData.data(), DICTIONARY, DICTIONARY_SIZE);
+    char* base = vData.data();
+    size_t nPos = DICTIONARY_SIZE;
+    const size_t nEnd = vData.size();
+
+    while (true) {
+        if (ip == iend) {
+            return false;
+        }
+        unsigned char token = *ip++;
+
+        size_t nLiterals = token >> 4;
+        if (nLiterals == 15 && !ReadLength(ip, iend, nLiterals)) {
+            return false;
+        }
+        if (size_t(iend - ip) < nLiterals || nEnd - nPos < nLiterals) {
+            return false;
+        }
+        memcpy(base + nPos, ip, nLiterals);
+        ip += nLiterals;
+        nPos += nLiterals;
+
+        // The last sequence has no match.
+        if (ip == iend) {
+            break;
+        }
+
+        if (iend - ip < 2) {
+            return false;
+        }
+        size_t nOffset = ip[0] | (size_t(ip[1]) << 8);
+        ip += 2;
+        size_t nMatch = token & 15;
+        if (nMatch == 15 && !ReadLength(ip, iend, nMatch)) {
+            return false;
+        }
+        nMatch += MIN_MATCH;
+        if (nOffset == 0 || nOffset > nPos || nEnd - nPos < nMatch) {
+            return false;
+        }
+        // Matches may overlap the output they produce.
+        const char* pMatch = base + nPos - nOffset;
+        if (nOffset >= nMatch) {
+            memcpy(base + nPos, pMatch, nMatch);
+        } else {
+            for (size_t i = 0; i < nMatch; i++) {
+                base[nPos + i] = pMatch[i];
+            }
+        }
+        nPos += nMatch;
+    }
+    if (nPos != nEnd) {
+        return false;
+    }
+
+    vOut.assign(vData.begin() + DICTIONARY_SIZE, vData.end());
+    return true;
+}
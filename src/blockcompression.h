@@ -0,0 +1,41 @@
+// Copyright (c) 2021 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifndef ZCASH_BLOCKCOMPRESSION_H
+#define ZCASH_BLOCKCOMPRESSION_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+/** Default for -blockcompression, compressing new records of the block and undo files */
+static const bool DEFAULT_BLOCK_COMPRESSION = false;
+
+/**
+ * Flag set in the size that is written before a record of the block or undo
+ * files when the record is stored compressed; the rest of the size is then
+ * the compressed size. Records are much smaller than 2^31 bytes, so versions
+ * that do not know about compression skip compressed records as too large.
+ */
+static const uint32_t BLOCK_RECORD_COMPRESSED = 0x80000000;
+
+/**
+ * Format of compressed records: the LZ4 block format, with matches allowed to
+ * refer to a built-in dictionary of byte strings common in Zcash blocks.
+ */
+static const unsigned char BLOCK_RECORD_FORMAT_LZ4 = 1;
+
+/**
+ * Compress the serialization in [pbegin, pend) as a compressed record. Returns
+ * false, leaving vOut empty, if that would not make it smaller.
+ */
+bool CompressBlockRecord(const char* pbegin, const char* pend, std::vector<char>& vOut);
+
+/**
+ * Decompress the compressed record in [pbegin, pend) into vOut. Returns false
+ * if the record is invalid, or decompresses to more than nMaxSize bytes.
+ */
+bool DecompressBlockRecord(const char* pbegin, const char* pend, std::vector<char>& vOut, size_t nMaxSize);
+
+#endif // ZCASH_BLOCKCOMPRESSION_H
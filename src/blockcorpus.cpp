@@ -0,0 +1,258 @@
+// Copyright (c) 2021 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "blockcorpus.h"
+
+#include "chain.h"
+#include "chainparams.h"
+#include "clientversion.h"
+#include "consensus/upgrades.h"
+#include "consensus/validation.h"
+#include "main.h"
+#include "streams.h"
+#include "undo.h"
+#include "util.h"
+
+#include <algorithm>
+
+bool CBlockCorpusView::GetSproutAnchorAt(const uint256 &rt, SproutMerkleTree &tree) const {
+    if (rt == SproutMerkleTree::empty_root()) {
+        tree = SproutMerkleTree();
+        return true;
+    }
+    auto it = entry.mapSproutAnchors.find(rt);
+    if (it != entry.mapSproutAnchors.end()) {
+        tree = it->second;
+        return true;
+    }
+    if (base && base->GetSproutAnchorAt(rt, tree)) {
+        entry.mapSproutAnchors.emplace(rt, tree);
+        return true;
+    }
+    return false;
+}
+
+bool CBlockCorpusView::GetSaplingAnchorAt(const uint256 &rt, SaplingMerkleTree &tree) const {
+    if (rt == SaplingMerkleTree::empty_root()) {
+        tree = SaplingMerkleTree();
+        return true;
+    }
+    auto it = entry.mapSaplingAnchors.find(rt);
+    if (it != entry.mapSaplingAnchors.end()) {
+        tree = it->second;
+        return true;
+    }
+    if (base && base->GetSaplingAnchorAt(rt, tree)) {
+        entry.mapSaplingAnchors.emplace(rt, tree);
+        return true;
+    }
+    return false;
+}
+
+bool CBlockCorpusView::HaveSaplingAnchor(const uint256 &rt) const {
+    SaplingMerkleTree tree;
+    return GetSaplingAnchorAt(rt, tree);
+}
+
+bool CBlockCorpusView::GetNullifier(const uint256 &nullifier, ShieldedType type) const {
+    return false;
+}
+
+bool CBlockCorpusView::GetCoin(const COutPoint &outpoint, Coin &coin) const {
+    auto it = entry.mapCoins.find(outpoint);
+    if (it == entry.mapCoins.end()) {
+        return false;
+    }
+    coin = it->second;
+    return true;
+}
+
+bool CBlockCorpusView::HaveCoin(const COutPoint &outpoint) const {
+    return entry.mapCoins.count(outpoint) > 0;
+}
+
+uint256 CBlockCorpusView::GetBestBlock() const {
+    return entry.hashPrevBlock;
+}
+
+uint256 CBlockCorpusView::GetBestAnchor(ShieldedType type) const {
+    switch (type) {
+        case SPROUT:
+            return entry.hashSproutAnchor;
+        case SAPLING:
+            return entry.hashSaplingAnchor;
+        default:
+            throw std::runtime_error("Unknown shielded type");
+    }
+}
+
+HistoryIndex CBlockCorpusView::GetHistoryLength(uint32_t epochId) const {
+    auto it = entry.mapHistoryLengths.find(epochId);
+    return it == entry.mapHistoryLengths.end() ? 0 : it->second;
+}
+
+HistoryNode CBlockCorpusView::GetHistoryAt(uint32_t epochId, HistoryIndex index) const {
+    HistoryNode node = {};
+    auto key = std::make_pair(epochId, index);
+    auto it = entry.mapHistoryNodes.find(key);
+    if (it != entry.mapHistoryNodes.end()) {
+        std::copy(it->second.begin(), it->second.end(), node.bytes);
+        return node;
+    }
+    if (!base) {
+        throw std::runtime_error("History node not in block corpus entry");
+    }
+    node = base->GetHistoryAt(epochId, index);
+    CBlockCorpusEntry::HistoryNodeBytes bytes;
+    std::copy(std::begin(node.bytes), std::end(node.bytes), bytes.begin());
+    entry.mapHistoryNodes.emplace(key, bytes);
+    return node;
+}
+
+uint256 CBlockCorpusView::GetHistoryRoot(uint32_t epochId) const {
+    auto it = entry.mapHistoryRoots.find(epochId);
+    return it == entry.mapHistoryRoots.end() ? uint256() : it->second;
+}
+
+bool RecordBlockCorpusEntry(
+    const CChainParams& chainparams,
+    const CBlockIndex* pindex,
+    CBlockCorpusEntry& entry,
+    std::string& strError)
+{
+    AssertLockHeld(cs_main);
+    const Consensus::Params& consensusParams = chainparams.GetConsensus();
+
+    if (!pindex->pprev || !chainActive.Contains(pindex)) {
+        strError = strprintf("Block at height %d is not a non-genesis block in the active chain", pindex->nHeight);
+        return false;
+    }
+    if (!(pindex->nStatus & BLOCK_HAVE_DATA) || !(pindex->nStatus & BLOCK_HAVE_UNDO)) {
+        strError = strprintf("Block at height %d or its undo data is not available", pindex->nHeight);
+        return false;
+    }
+    if (!ReadBlockFromDisk(entry.block, pindex, consensusParams)) {
+        strError = strprintf("Failed to read block at height %d", pindex->nHeight);
+        return false;
+    }
+    CBlockUndo blockundo;
+    if (!UndoReadFromDisk(blockundo, pindex->GetUndoPos(), pindex->pprev->GetBlockHash())) {
+        strError = strprintf("Failed to read undo data of block at height %d", pindex->nHeight);
+        return false;
+    }
+
+    const CBlockIndex* pindexPrev = pindex->pprev;
+    entry.nHeight = pindex->nHeight;
+    entry.hashPrevBlock = pindexPrev->GetBlockHash();
+    entry.hashFinalSaplingRoot = pindex->hashFinalSaplingRoot;
+    entry.hashSproutAnchor = blockundo.old_sprout_tree_root;
+    // As in DisconnectBlock, the best Sapling anchor before Sapling
+    // activation was the empty root.
+    if (consensusParams.NetworkUpgradeActive(pindexPrev->nHeight, Consensus::UPGRADE_SAPLING)) {
+        entry.hashSaplingAnchor = pindexPrev->hashFinalSaplingRoot;
+    } else {
+        entry.hashSaplingAnchor = SaplingMerkleTree::empty_root();
+    }
+
+    // The coins spent by the block are those in its undo data.
+    for (size_t i = 1; i < entry.block.vtx.size(); i++) {
+        const CTransaction& tx = entry.block.vtx[i];
+        const CTxUndo& txundo = blockundo.vtxundo[i - 1];
+        for (size_t j = 0; j < tx.vin.size(); j++) {
+            entry.mapCoins.emplace(tx.vin[j].prevout, txundo.vprevout[j]);
+        }
+    }
+
+    // The history tree is only appended to, so the tree of the epoch of the
+    // previous block was the prefix of the current one that held one leaf per
+    // block of the epoch, and its root is committed to by this block.
+    uint32_t prevBranchId = CurrentEpochBranchId(pindexPrev->nHeight, consensusParams);
+    if (consensusParams.NetworkUpgradeActive(pindexPrev->nHeight, Consensus::UPGRADE_HEARTWOOD)) {
+        int nEpochStart = consensusParams.vUpgrades[CurrentEpoch(pindexPrev->nHeight, consensusParams)].nActivationHeight;
+        uint64_t nLeaves = pindexPrev->nHeight - nEpochStart + 1;
+        uint64_t nLength = 2 * nLeaves;
+        for (uint64_t n = nLeaves; n != 0; n &= n - 1) {
+            nLength--;
+        }
+        entry.mapHistoryLengths[prevBranchId] = nLength;
+        entry.mapHistoryRoots[prevBranchId] = entry.block.hashLightClientRoot;
+    }
+
+    // Connect the block to record the anchors and history tree nodes that it
+    // reads from the chain state at the tip, and to check the entry.
+    CBlockCorpusView view(entry, pcoinsTip);
+    CCoinsViewCache cache(&view);
+    CValidationState state;
+    if (!ConnectBlock(entry.block, state, const_cast<CBlockIndex*>(pindex), cache, chainparams, true)) {
+        strError = strprintf("Block at height %d does not connect to its corpus entry: %s",
+                             pindex->nHeight, state.GetRejectReason());
+        return false;
+    }
+
+    // The root of the history tree after the block is committed to by the
+    // next block, if it is in the same epoch.
+    uint32_t branchId = CurrentEpochBranchId(pindex->nHeight, consensusParams);
+    const CBlockIndex* pindexNext = chainActive.Next(pindex);
+    if (pindexNext &&
+        consensusParams.NetworkUpgradeActive(pindex->nHeight, Consensus::UPGRADE_HEARTWOOD) &&
+        CurrentEpochBranchId(pindexNext->nHeight, consensusParams) == branchId &&
+        cache.GetHistoryRoot(branchId) != pindexNext->hashChainHistoryRoot)
+    {
+        strError = strprintf("History tree of the corpus entry of block at height %d is inconsistent", pindex->nHeight);
+        return false;
+    }
+
+    return true;
+}
+
+bool WriteBlockCorpusEntry(const fs::path& dir, const CBlockCorpusEntry& entry, std::string& strError)
+{
+    fs::path path = dir / strprintf("%d.blk", entry.nHeight);
+    CAutoFile fileout(fsbridge::fopen(path, "wb"), SER_DISK, CLIENT_VERSION);
+    if (fileout.IsNull()) {
+        strError = "Failed to create " + path.string();
+        return false;
+    }
+    try {
+        fileout << entry;
+    } catch (const std::exception& e) {
+        strError = strprintf("Failed to write %s: %s", path.string(), e.what());
+        return false;
+    }
+    return true;
+}
+
+bool ReadBlockCorpus(const fs::path& dir, std::vector<CBlockCorpusEntry>& entries, std::string& strError)
+{
+    if (!fs::is_directory(dir)) {
+        strError = dir.string() + " is not a directory";
+        return false;
+    }
+    std::vector<fs::path> paths;
+    for (const auto& it : fs::directory_iterator(dir)) {
+        if (fs::is_regular_file(it.path()) && it.path().extension() == ".blk") {
+            paths.push_back(it.path());
+        }
+    }
+
+    entries.clear();
+    entries.reserve(paths.size());
+    for (const fs::path& path : paths) {
+        CAutoFile filein(fsbridge::fopen(path, "rb"), SER_DISK, CLIENT_VERSION);
+        if (filein.IsNull()) {
+            strError = "Failed to open " + path.string();
+            return false;
+        }
+        entries.emplace_back();
+        try {
+            filein >> entries.back();
+        } catch (const std::exception& e) {
+            strError = strprintf("Failed to read %s: %s", path.string(), e.what());
+            return false;
+        }
+    }
+    std::sort(entries.begin(), entries.end(),
+        [](const CBlockCorpusEntry& a, const CBlockCorpusEntry& b) { return a.nHeight < b.nHeight; });
+    return true;
+}
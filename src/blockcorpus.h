@@ -0,0 +1,119 @@
+// Copyright (c) 2021 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifndef ZCASH_BLOCKCORPUS_H
+#define ZCASH_BLOCKCORPUS_H
+
+#include "coins.h"
+#include "fs.h"
+#include "primitives/block.h"
+#include "serialize.h"
+
+#include <array>
+#include <map>
+#include <string>
+#include <vector>
+
+class CBlockIndex;
+class CChainParams;
+
+/**
+ * A block together with the preimages of the chain state that ConnectBlock
+ * reads to connect it: the coins that its transactions spend, the note
+ * commitment trees of the anchors they use, and the history tree nodes that
+ * its history tree update reads. A corpus of these can be replayed through
+ * ConnectBlock without the rest of the chain state.
+ */
+class CBlockCorpusEntry
+{
+public:
+    typedef std::array<unsigned char, NODE_SERIALIZED_LENGTH> HistoryNodeBytes;
+
+    int nHeight;
+    uint256 hashPrevBlock;
+    //! The hashFinalSaplingRoot of the block's index, which its history tree leaf commits to.
+    uint256 hashFinalSaplingRoot;
+    //! The best anchors as of the end of the previous block.
+    uint256 hashSproutAnchor;
+    uint256 hashSaplingAnchor;
+    CBlock block;
+
+    std::map<COutPoint, Coin> mapCoins;
+    std::map<uint256, SproutMerkleTree> mapSproutAnchors;
+    std::map<uint256, SaplingMerkleTree> mapSaplingAnchors;
+    std::map<uint32_t, HistoryIndex> mapHistoryLengths;
+    std::map<uint32_t, uint256> mapHistoryRoots;
+    std::map<std::pair<uint32_t, HistoryIndex>, HistoryNodeBytes> mapHistoryNodes;
+
+    CBlockCorpusEntry() : nHeight(0) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(nHeight);
+        READWRITE(hashPrevBlock);
+        READWRITE(hashFinalSaplingRoot);
+        READWRITE(hashSproutAnchor);
+        READWRITE(hashSaplingAnchor);
+        READWRITE(block);
+        READWRITE(mapCoins);
+        READWRITE(mapSproutAnchors);
+        READWRITE(mapSaplingAnchors);
+        READWRITE(mapHistoryLengths);
+        READWRITE(mapHistoryRoots);
+        READWRITE(mapHistoryNodes);
+    }
+};
+
+/**
+ * A read-only view of the chain state before the block of a corpus entry,
+ * served from the entry's preimages. Nullifiers are never spent.
+ *
+ * If a base view is given, the anchors and history tree nodes that are not
+ * in the entry are read from it and added to the entry, which is how an
+ * entry is recorded.
+ */
+class CBlockCorpusView : public CCoinsView
+{
+private:
+    CBlockCorpusEntry& entry;
+    const CCoinsView* base;
+
+public:
+    CBlockCorpusView(CBlockCorpusEntry& entryIn, const CCoinsView* baseIn = nullptr) :
+        entry(entryIn), base(baseIn) {}
+
+    bool GetSproutAnchorAt(const uint256 &rt, SproutMerkleTree &tree) const;
+    bool GetSaplingAnchorAt(const uint256 &rt, SaplingMerkleTree &tree) const;
+    bool HaveSaplingAnchor(const uint256 &rt) const;
+    bool GetNullifier(const uint256 &nullifier, ShieldedType type) const;
+    bool GetCoin(const COutPoint &outpoint, Coin &coin) const;
+    bool HaveCoin(const COutPoint &outpoint) const;
+    uint256 GetBestBlock() const;
+    uint256 GetBestAnchor(ShieldedType type) const;
+    HistoryIndex GetHistoryLength(uint32_t epochId) const;
+    HistoryNode GetHistoryAt(uint32_t epochId, HistoryIndex index) const;
+    uint256 GetHistoryRoot(uint32_t epochId) const;
+};
+
+/**
+ * Record the corpus entry of a block in the active chain, reading its spent
+ * coins from its undo data and its anchors and history tree nodes from the
+ * chain state at the tip, and check that it connects. Must be called with
+ * cs_main held.
+ */
+bool RecordBlockCorpusEntry(
+    const CChainParams& chainparams,
+    const CBlockIndex* pindex,
+    CBlockCorpusEntry& entry,
+    std::string& strError);
+
+/** Write a corpus entry to <dir>/<height>.blk. */
+bool WriteBlockCorpusEntry(const fs::path& dir, const CBlockCorpusEntry& entry, std::string& strError);
+
+/** Read every corpus entry in a directory, in order of height. */
+bool ReadBlockCorpus(const fs::path& dir, std::vector<CBlockCorpusEntry>& entries, std::string& strError);
+
+#endif // ZCASH_BLOCKCORPUS_H
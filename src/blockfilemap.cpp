@@ -0,0 +1,86 @@
+// Copyright (c) 2021 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "blockfilemap.h"
+
+#include "util.h"
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+CMappedBlockFile::CMappedBlockFile(const fs::path& path) : pdata(nullptr), nSize(0)
+{
+#ifndef WIN32
+    int fd = open(path.string().c_str(), O_RDONLY);
+    if (fd == -1) {
+        LogPrintf("%s: unable to open %s\n", __func__, path.string());
+        return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (p != MAP_FAILED) {
+            pdata = static_cast<const char*>(p);
+            nSize = st.st_size;
+        } else {
+            LogPrintf("%s: unable to map %s\n", __func__, path.string());
+        }
+    }
+    // The mapping does not need the file to stay open.
+    close(fd);
+#endif
+}
+
+CMappedBlockFile::~CMappedBlockFile()
+{
+#ifndef WIN32
+    if (pdata) {
+        munmap(const_cast<char*>(pdata), nSize);
+    }
+#endif
+}
+
+std::shared_ptr<const CMappedBlockFile> CBlockFileMapCache::Get(int nFile, const fs::path& path, size_t nMinSize)
+{
+    LOCK(cs);
+    for (auto it = mappings.begin(); it != mappings.end(); ++it) {
+        if (it->first == nFile) {
+            if (it->second->size() < nMinSize) {
+                // The file has grown since it was mapped.
+                mappings.erase(it);
+                break;
+            }
+            mappings.splice(mappings.begin(), mappings, it);
+            return it->second;
+        }
+    }
+
+    std::shared_ptr<const CMappedBlockFile> mapping = std::make_shared<const CMappedBlockFile>(path);
+    if (mapping->IsNull() || mapping->size() < nMinSize) {
+        return nullptr;
+    }
+    mappings.emplace_front(nFile, mapping);
+    if (mappings.size() > MAX_BLOCK_FILE_MAPPINGS) {
+        mappings.pop_back();
+    }
+    return mapping;
+}
+
+void CBlockFileMapCache::Erase(int nFile)
+{
+    LOCK(cs);
+    mappings.remove_if([nFile](const std::pair<int, std::shared_ptr<const CMappedBlockFile>>& entry) {
+        return entry.first == nFile;
+    });
+}
+
+void CBlockFileMapCache::Clear()
+{
+    LOCK(cs);
+    mappings.clear();
+}
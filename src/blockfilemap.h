@@ -0,0 +1,113 @@
+// Copyright (c) 2021 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifndef ZCASH_BLOCKFILEMAP_H
+#define ZCASH_BLOCKFILEMAP_H
+
+#include "fs.h"
+#include "sync.h"
+
+#include <list>
+#include <memory>
+#include <utility>
+#include <vector>
+
+/** Default for -mapblockfiles, reading blocks through memory mappings of the block files */
+#ifdef WIN32
+static const bool DEFAULT_MAP_BLOCK_FILES = false;
+#else
+static const bool DEFAULT_MAP_BLOCK_FILES = true;
+#endif
+/** Number of block files that are kept mapped. */
+static const size_t MAX_BLOCK_FILE_MAPPINGS = 8;
+
+/** A read-only memory mapping of a whole block file. */
+class CMappedBlockFile
+{
+private:
+    CMappedBlockFile(const CMappedBlockFile&);
+    CMappedBlockFile& operator=(const CMappedBlockFile&);
+
+    const char* pdata;
+    size_t nSize;
+
+public:
+    //! Map the file at path; the mapping is null if that fails.
+    explicit CMappedBlockFile(const fs::path& path);
+    ~CMappedBlockFile();
+
+    bool IsNull() const { return pdata == nullptr; }
+    const char* data() const { return pdata; }
+    size_t size() const { return nSize; }
+};
+
+/**
+ * Cache of the most recently used block file mappings. A mapping stays valid
+ * for as long as a reference to it is held, even once it has been evicted.
+ */
+class CBlockFileMapCache
+{
+private:
+    CCriticalSection cs;
+    //! Most recently used first.
+    std::list<std::pair<int, std::shared_ptr<const CMappedBlockFile>>> mappings;
+
+public:
+    /**
+     * Get a mapping of block file nFile, at path, that covers at least its
+     * first nMinSize bytes. The file is mapped again if it has grown since
+     * it was mapped. Returns null if the file could not be mapped.
+     */
+    std::shared_ptr<const CMappedBlockFile> Get(int nFile, const fs::path& path, size_t nMinSize);
+
+    //! Drop the mapping of block file nFile, for example once it has been pruned.
+    void Erase(int nFile);
+
+    void Clear();
+};
+
+/**
+ * A block as serialized in a block file, which is the same as its network
+ * serialization. It points into a block file mapping that it keeps alive,
+ * or into its own copy of the data if the block file was not mapped.
+ */
+class CRawBlock
+{
+private:
+    std::shared_ptr<const CMappedBlockFile> mapping;
+    std::vector<char> vData;
+    const char* pbegin;
+    const char* pend;
+
+public:
+    CRawBlock() : pbegin(nullptr), pend(nullptr) {}
+
+    void Set(std::shared_ptr<const CMappedBlockFile> mappingIn, const char* pbeginIn, const char* pendIn)
+    {
+        vData.clear();
+        mapping = std::move(mappingIn);
+        pbegin = pbeginIn;
+        pend = pendIn;
+    }
+
+    void Set(std::vector<char>&& vDataIn)
+    {
+        mapping.reset();
+        vData = std::move(vDataIn);
+        pbegin = vData.data();
+        pend = vData.data() + vData.size();
+    }
+
+    const char* begin() const { return pbegin; }
+    const char* end() const { return pend; }
+    size_t size() const { return pend - pbegin; }
+
+    template<typename Stream>
+    void Serialize(Stream& s) const
+    {
+        s.write(pbegin, size());
+    }
+};
+
+#endif // ZCASH_BLOCKFILEMAP_H
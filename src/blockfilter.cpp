@@ -0,0 +1,340 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Copyright (c) 2021 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "blockfilter.h"
+
+#include "crypto/common.h"
+#include "hash.h"
+#include "primitives/block.h"
+#include "script/script.h"
+#include "streams.h"
+#include "undo.h"
+#include "version.h"
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+namespace {
+
+/** Writes bits to a byte vector, the most significant bit of each byte first. */
+class BitWriter
+{
+private:
+    std::vector<unsigned char>& vch;
+    unsigned char buffer = 0;
+    int nBits = 0;
+
+public:
+    explicit BitWriter(std::vector<unsigned char>& vchIn) : vch(vchIn) {}
+
+    /** Write the low nCount bits of data, the most significant first. */
+    void Write(uint64_t data, int nCount)
+    {
+        while (nCount > 0) {
+            int n = std::min(8 - nBits, nCount);
+            buffer |= ((data >> (nCount - n)) & ((1 << n) - 1)) << (8 - nBits - n);
+            nBits += n;
+            nCount -= n;
+            if (nBits == 8) {
+                Flush();
+            }
+        }
+    }
+
+    /** Write out a partial byte, padded with zero bits. */
+    void Flush()
+    {
+        if (nBits == 0) {
+            return;
+        }
+        vch.push_back(buffer);
+        buffer = 0;
+        nBits = 0;
+    }
+};
+
+/** Reads bits from a byte range, the most significant bit of each byte first. */
+class BitReader
+{
+private:
+    const unsigned char* p;
+    const unsigned char* pend;
+    unsigned char buffer = 0;
+    int nBits = 0;
+
+public:
+    BitReader(const unsigned char* pbegin, const unsigned char* pendIn) : p(pbegin), pend(pendIn) {}
+
+    uint64_t Read(int nCount)
+    {
+        uint64_t data = 0;
+        while (nCount > 0) {
+            if (nBits == 0) {
+                if (p == pend) {
+                    throw std::ios_base::failure("BitReader::Read(): end of data");
+                }
+                buffer = *p++;
+                nBits = 8;
+            }
+            int n = std::min(nBits, nCount);
+            data = (data << n) | ((buffer >> (nBits - n)) & ((1 << n) - 1));
+            nBits -= n;
+            nCount -= n;
+        }
+        return data;
+    }
+
+    bool AtEnd() const { return p == pend; }
+};
+
+void GolombRiceEncode(BitWriter& writer, uint8_t P, uint64_t x)
+{
+    // The quotient in unary, then the remainder in P bits.
+    uint64_t q = x >> P;
+    while (q > 0) {
+        int nBits = q <= 64 ? (int)q : 64;
+        writer.Write(~0ULL, nBits);
+        q -= nBits;
+    }
+    writer.Write(0, 1);
+    writer.Write(x, P);
+}
+
+uint64_t GolombRiceDecode(BitReader& reader, uint8_t P)
+{
+    uint64_t q = 0;
+    while (reader.Read(1) == 1) {
+        q++;
+    }
+    uint64_t r = reader.Read(P);
+    return (q << P) + r;
+}
+
+/** Map x uniformly onto [0, n), as (x * n) >> 64. */
+uint64_t MapIntoRange(uint64_t x, uint64_t n)
+{
+#ifdef __SIZEOF_INT128__
+    return (uint64_t)(((unsigned __int128)x * (unsigned __int128)n) >> 64);
+#else
+    uint64_t x_hi = x >> 32, x_lo = x & 0xFFFFFFFF;
+    uint64_t n_hi = n >> 32, n_lo = n & 0xFFFFFFFF;
+    uint64_t ac = x_hi * n_hi;
+    uint64_t ad = x_hi * n_lo;
+    uint64_t bc = x_lo * n_hi;
+    uint64_t bd = x_lo * n_lo;
+    uint64_t mid34 = (bd >> 32) + (bc & 0xFFFFFFFF) + (ad & 0xFFFFFFFF);
+    return ac + (bc >> 32) + (ad >> 32) + (mid34 >> 32);
+#endif
+}
+
+}
+
+GCSFilter::GCSFilter(const Params& paramsIn)
+    : params(paramsIn), N(0), F(0)
+{
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    WriteCompactSize(ss, 0);
+    encoded.assign(ss.begin(), ss.end());
+}
+
+GCSFilter::GCSFilter(const Params& paramsIn, std::vector<unsigned char> encoded_filter)
+    : params(paramsIn), encoded(std::move(encoded_filter))
+{
+    CDataStream ss(encoded, SER_NETWORK, PROTOCOL_VERSION);
+    uint64_t nElements = ReadCompactSize(ss);
+    if (nElements > std::numeric_limits<uint32_t>::max()) {
+        throw std::ios_base::failure("N must be < 2^32");
+    }
+    N = nElements;
+    F = uint64_t(N) * params.M;
+
+    // Decode the whole filter, to check that it holds exactly N elements.
+    const unsigned char* pbegin = encoded.data() + (encoded.size() - ss.size());
+    BitReader reader(pbegin, encoded.data() + encoded.size());
+    for (uint64_t i = 0; i < N; i++) {
+        GolombRiceDecode(reader, params.P);
+    }
+    if (!reader.AtEnd()) {
+        throw std::ios_base::failure("encoded_filter contains excess data");
+    }
+}
+
+GCSFilter::GCSFilter(const Params& paramsIn, const ElementSet& elements)
+    : params(paramsIn)
+{
+    if (elements.size() > std::numeric_limits<uint32_t>::max()) {
+        throw std::invalid_argument("N must be < 2^32");
+    }
+    N = elements.size();
+    F = uint64_t(N) * params.M;
+
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    WriteCompactSize(ss, N);
+    encoded.assign(ss.begin(), ss.end());
+
+    // The sorted hashes are coded as the differences between them.
+    BitWriter writer(encoded);
+    uint64_t last_value = 0;
+    for (uint64_t value : BuildHashedSet(elements)) {
+        GolombRiceEncode(writer, params.P, value - last_value);
+        last_value = value;
+    }
+    writer.Flush();
+}
+
+uint64_t GCSFilter::HashToRange(const Element& element) const
+{
+    uint64_t hash = CSipHasher(params.siphash_k0, params.siphash_k1)
+        .Write(element.data(), element.size())
+        .Finalize();
+    return MapIntoRange(hash, F);
+}
+
+std::vector<uint64_t> GCSFilter::BuildHashedSet(const ElementSet& elements) const
+{
+    std::vector<uint64_t> hashed_elements;
+    hashed_elements.reserve(elements.size());
+    for (const Element& element : elements) {
+        hashed_elements.push_back(HashToRange(element));
+    }
+    std::sort(hashed_elements.begin(), hashed_elements.end());
+    return hashed_elements;
+}
+
+bool GCSFilter::MatchInternal(const uint64_t* element_hashes, size_t size) const
+{
+    CDataStream ss(encoded, SER_NETWORK, PROTOCOL_VERSION);
+    ReadCompactSize(ss);
+    const unsigned char* pbegin = encoded.data() + (encoded.size() - ss.size());
+    BitReader reader(pbegin, encoded.data() + encoded.size());
+
+    // Walk the two sorted lists together.
+    uint64_t value = 0;
+    size_t hashes_index = 0;
+    for (uint32_t i = 0; i < N; i++) {
+        value += GolombRiceDecode(reader, params.P);
+        while (true) {
+            if (hashes_index == size) {
+                return false;
+            } else if (element_hashes[hashes_index] == value) {
+                return true;
+            } else if (element_hashes[hashes_index] > value) {
+                break;
+            }
+            hashes_index++;
+        }
+    }
+    return false;
+}
+
+bool GCSFilter::Match(const Element& element) const
+{
+    uint64_t query = HashToRange(element);
+    return MatchInternal(&query, 1);
+}
+
+bool GCSFilter::MatchAny(const ElementSet& elements) const
+{
+    const std::vector<uint64_t> queries = BuildHashedSet(elements);
+    return MatchInternal(queries.data(), queries.size());
+}
+
+const std::string& BlockFilterTypeName(BlockFilterType filter_type)
+{
+    static const std::string basic = "basic";
+    static const std::string unknown = "";
+    switch (filter_type) {
+    case BlockFilterType::BASIC:
+        return basic;
+    default:
+        return unknown;
+    }
+}
+
+bool BlockFilterTypeByName(const std::string& name, BlockFilterType& filter_type)
+{
+    if (name == BlockFilterTypeName(BlockFilterType::BASIC)) {
+        filter_type = BlockFilterType::BASIC;
+        return true;
+    }
+    return false;
+}
+
+static GCSFilter::ElementSet BasicFilterElements(const CBlock& block, const CBlockUndo& block_undo)
+{
+    GCSFilter::ElementSet elements;
+
+    for (const CTransaction& tx : block.vtx) {
+        for (const CTxOut& txout : tx.vout) {
+            const CScript& script = txout.scriptPubKey;
+            if (script.empty() || script[0] == OP_RETURN) continue;
+            elements.emplace(script.begin(), script.end());
+        }
+    }
+
+    for (const CTxUndo& tx_undo : block_undo.vtxundo) {
+        for (const Coin& prevout : tx_undo.vprevout) {
+            const CScript& script = prevout.out.scriptPubKey;
+            if (script.empty()) continue;
+            elements.emplace(script.begin(), script.end());
+        }
+    }
+
+    return elements;
+}
+
+bool BlockFilter::BuildParams(GCSFilter::Params& params) const
+{
+    // The SipHash key is the first 16 bytes of the block hash.
+    params.siphash_k0 = ReadLE64(m_block_hash.begin());
+    params.siphash_k1 = ReadLE64(m_block_hash.begin() + 8);
+
+    switch (m_filter_type) {
+    case BlockFilterType::BASIC:
+        params.P = BASIC_FILTER_P;
+        params.M = BASIC_FILTER_M;
+        return true;
+    default:
+        return false;
+    }
+}
+
+BlockFilter::BlockFilter(BlockFilterType filter_type, const uint256& block_hash,
+                         std::vector<unsigned char> filter)
+    : m_filter_type(filter_type), m_block_hash(block_hash)
+{
+    GCSFilter::Params params;
+    if (!BuildParams(params)) {
+        throw std::invalid_argument("unknown filter_type");
+    }
+    m_filter = GCSFilter(params, std::move(filter));
+}
+
+BlockFilter::BlockFilter(BlockFilterType filter_type, const CBlock& block, const CBlockUndo& block_undo)
+    : m_filter_type(filter_type), m_block_hash(block.GetHash())
+{
+    GCSFilter::Params params;
+    if (!BuildParams(params)) {
+        throw std::invalid_argument("unknown filter_type");
+    }
+    m_filter = GCSFilter(params, BasicFilterElements(block, block_undo));
+}
+
+uint256 BlockFilter::GetHash() const
+{
+    const std::vector<unsigned char>& data = GetEncodedFilter();
+    return Hash(data.begin(), data.end());
+}
+
+uint256 BlockFilter::ComputeHeader(const uint256& prev_header) const
+{
+    return ComputeFilterHeader(GetHash(), prev_header);
+}
+
+uint256 ComputeFilterHeader(const uint256& filter_hash, const uint256& prev_header)
+{
+    return Hash(filter_hash.begin(), filter_hash.end(), prev_header.begin(), prev_header.end());
+}
@@ -0,0 +1,158 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Copyright (c) 2021 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifndef ZCASH_BLOCKFILTER_H
+#define ZCASH_BLOCKFILTER_H
+
+#include "serialize.h"
+#include "uint256.h"
+
+#include <set>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+class CBlock;
+class CBlockUndo;
+
+/**
+ * A Golomb-coded set, as in BIP 158: a compact filter that holds the hashes
+ * of a set of elements, and can be asked whether an element may be in the
+ * set. An element that is in the set always matches, and one that is not
+ * matches with probability 1/M.
+ */
+class GCSFilter
+{
+public:
+    typedef std::vector<unsigned char> Element;
+    typedef std::set<Element> ElementSet;
+
+    struct Params {
+        uint64_t siphash_k0;
+        uint64_t siphash_k1;
+        //! Golomb-Rice coding parameter
+        uint8_t P;
+        //! Inverse false positive rate
+        uint32_t M;
+
+        Params(uint64_t k0 = 0, uint64_t k1 = 0, uint8_t p = 0, uint32_t m = 1)
+            : siphash_k0(k0), siphash_k1(k1), P(p), M(m) {}
+    };
+
+private:
+    Params params;
+    //! Number of elements in the filter
+    uint32_t N;
+    //! Range of the element hashes, N * M
+    uint64_t F;
+    std::vector<unsigned char> encoded;
+
+    //! Hash an element to an integer in [0, F).
+    uint64_t HashToRange(const Element& element) const;
+
+    std::vector<uint64_t> BuildHashedSet(const ElementSet& elements) const;
+
+    //! Whether any of the sorted hashes is in the filter.
+    bool MatchInternal(const uint64_t* element_hashes, size_t size) const;
+
+public:
+    /** An empty filter. */
+    explicit GCSFilter(const Params& params = Params());
+
+    /** Reconstruct a filter from its encoding, which throws if it is not well formed. */
+    GCSFilter(const Params& params, std::vector<unsigned char> encoded_filter);
+
+    /** Build a filter of a set of elements. */
+    GCSFilter(const Params& params, const ElementSet& elements);
+
+    uint32_t GetN() const { return N; }
+    const Params& GetParams() const { return params; }
+    const std::vector<unsigned char>& GetEncoded() const { return encoded; }
+
+    /** Whether the element may be in the set. */
+    bool Match(const Element& element) const;
+
+    /** Whether any of the elements may be in the set, decoding the filter once. */
+    bool MatchAny(const ElementSet& elements) const;
+};
+
+static const uint8_t BASIC_FILTER_P = 19;
+static const uint32_t BASIC_FILTER_M = 784931;
+
+enum class BlockFilterType : uint8_t
+{
+    //! The scripts of the transparent outputs that a block creates and spends
+    BASIC = 0,
+    INVALID = 255,
+};
+
+/** The name of a filter type, as used in options, RPC and REST, or "" if it has none. */
+const std::string& BlockFilterTypeName(BlockFilterType filter_type);
+
+/** Find a filter type by its name. */
+bool BlockFilterTypeByName(const std::string& name, BlockFilterType& filter_type);
+
+/**
+ * The filter of a block, as in BIP 158. The basic filter holds the
+ * transparent output scripts of the block and those of the outputs that its
+ * inputs spend, other than empty and OP_RETURN scripts. Zcash has shielded
+ * outputs as well, which are not in the filter; light clients find those
+ * with the compact blocks of ZIP 307.
+ */
+class BlockFilter
+{
+private:
+    BlockFilterType m_filter_type = BlockFilterType::INVALID;
+    uint256 m_block_hash;
+    GCSFilter m_filter;
+
+    bool BuildParams(GCSFilter::Params& params) const;
+
+public:
+    BlockFilter() = default;
+
+    /** Reconstruct a filter from its encoding. */
+    BlockFilter(BlockFilterType filter_type, const uint256& block_hash,
+                std::vector<unsigned char> filter);
+
+    /** Build the filter of a block, given its undo data. */
+    BlockFilter(BlockFilterType filter_type, const CBlock& block, const CBlockUndo& block_undo);
+
+    BlockFilterType GetFilterType() const { return m_filter_type; }
+    const uint256& GetBlockHash() const { return m_block_hash; }
+    const GCSFilter& GetFilter() const { return m_filter; }
+    const std::vector<unsigned char>& GetEncodedFilter() const { return m_filter.GetEncoded(); }
+
+    /** The hash of the encoded filter. */
+    uint256 GetHash() const;
+
+    /** The header of the filter, which chains its hash to the header of the previous block's filter. */
+    uint256 ComputeHeader(const uint256& prev_header) const;
+};
+
+/** The header of a filter with the given hash, following prev_header. */
+uint256 ComputeFilterHeader(const uint256& filter_hash, const uint256& prev_header);
+
+/**
+ * A block filter as kept in the block filter index, with its hash and
+ * header, so that cfheaders and cfcheckpt messages are served without
+ * hashing the filters again.
+ */
+struct CBlockFilterEntry {
+    std::vector<unsigned char> vFilter;
+    uint256 hashFilter;
+    uint256 header;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(vFilter);
+        READWRITE(hashFilter);
+        READWRITE(header);
+    }
+};
+
+#endif // ZCASH_BLOCKFILTER_H
@@ -0,0 +1,141 @@
+// Copyright (c) 2021 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "blockindexlookup.h"
+
+#include "chain.h"
+
+#include <assert.h>
+
+CBlockIndexLookup::Table::Table(size_t nSize)
+    : nMask(nSize - 1), slots(new std::atomic<CBlockIndex*>[nSize])
+{
+    assert((nSize & nMask) == 0);
+    for (size_t i = 0; i < nSize; i++) {
+        slots[i].store(nullptr, std::memory_order_relaxed);
+    }
+}
+
+CBlockIndex* CBlockIndexLookup::Tombstone()
+{
+    static CBlockIndex indexTombstone;
+    return &indexTombstone;
+}
+
+bool CBlockIndexLookup::Place(Table& table, uint64_t nHash, CBlockIndex* pindex)
+{
+    // The low bits of the hash pick the shard, so the slot comes from the rest.
+    for (size_t i = (nHash / SHARD_COUNT) & table.nMask; ; i = (i + 1) & table.nMask) {
+        CBlockIndex* pindexSlot = table.slots[i].load(std::memory_order_relaxed);
+        if (pindexSlot == nullptr || pindexSlot == Tombstone()) {
+            table.slots[i].store(pindex, std::memory_order_release);
+            return pindexSlot != nullptr;
+        }
+    }
+}
+
+CBlockIndex* CBlockIndexLookup::Lookup(const uint256& hash) const
+{
+    uint64_t nHash = hash.GetCheapHash();
+    const Table* table = shards[nHash % SHARD_COUNT].table.load(std::memory_order_acquire);
+    if (table == nullptr) {
+        return nullptr;
+    }
+    for (size_t i = (nHash / SHARD_COUNT) & table->nMask; ; i = (i + 1) & table->nMask) {
+        CBlockIndex* pindex = table->slots[i].load(std::memory_order_acquire);
+        if (pindex == Tombstone()) {
+            continue;
+        }
+        if (pindex == nullptr || pindex->GetBlockHash() == hash) {
+            return pindex;
+        }
+    }
+}
+
+void CBlockIndexLookup::Insert(CBlockIndex* pindex)
+{
+    assert(pindex->phashBlock != nullptr);
+    const uint256& hash = pindex->GetBlockHash();
+    uint64_t nHash = hash.GetCheapHash();
+
+    LOCK(csWrite);
+    if (Lookup(hash) != nullptr) {
+        return;
+    }
+
+    Shard& shard = shards[nHash % SHARD_COUNT];
+    Table* table = shard.table.load(std::memory_order_relaxed);
+    // Keep each table at most half full, counting the tombstones, so that
+    // probe sequences stay short.
+    if (table == nullptr || (shard.nCount + shard.nTombstones + 1) * 2 > table->nMask + 1) {
+        size_t nSize = MIN_TABLE_SIZE;
+        while ((shard.nCount + 1) * 4 > nSize) {
+            nSize *= 2;
+        }
+        std::unique_ptr<Table> tableNew(new Table(nSize));
+        if (table) {
+            for (size_t i = 0; i <= table->nMask; i++) {
+                CBlockIndex* pindexOld = table->slots[i].load(std::memory_order_relaxed);
+                if (pindexOld && pindexOld != Tombstone()) {
+                    Place(*tableNew, pindexOld->GetBlockHash().GetCheapHash(), pindexOld);
+                }
+            }
+        }
+        table = tableNew.get();
+        shard.vTables.push_back(std::move(tableNew));
+        shard.table.store(table, std::memory_order_release);
+        shard.nTombstones = 0;
+    }
+
+    if (Place(*table, nHash, pindex)) {
+        shard.nTombstones--;
+    }
+    shard.nCount++;
+}
+
+void CBlockIndexLookup::Remove(const CBlockIndex* pindex)
+{
+    assert(pindex->phashBlock != nullptr);
+    uint64_t nHash = pindex->GetBlockHash().GetCheapHash();
+
+    LOCK(csWrite);
+    Shard& shard = shards[nHash % SHARD_COUNT];
+    Table* table = shard.table.load(std::memory_order_relaxed);
+    if (table == nullptr) {
+        return;
+    }
+    for (size_t i = (nHash / SHARD_COUNT) & table->nMask; ; i = (i + 1) & table->nMask) {
+        CBlockIndex* pindexSlot = table->slots[i].load(std::memory_order_relaxed);
+        if (pindexSlot == nullptr) {
+            return;
+        }
+        if (pindexSlot == pindex) {
+            table->slots[i].store(Tombstone(), std::memory_order_release);
+            shard.nCount--;
+            shard.nTombstones++;
+            return;
+        }
+    }
+}
+
+void CBlockIndexLookup::Clear()
+{
+    LOCK(csWrite);
+    for (Shard& shard : shards) {
+        shard.table.store(nullptr, std::memory_order_release);
+        shard.nCount = 0;
+        shard.nTombstones = 0;
+        shard.vTables.clear();
+    }
+}
+
+size_t CBlockIndexLookup::Size()
+{
+    LOCK(csWrite);
+    size_t nSize = 0;
+    for (const Shard& shard : shards) {
+        nSize += shard.nCount;
+    }
+    return nSize;
+}
@@ -0,0 +1,93 @@
+// Copyright (c) 2021 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifndef ZCASH_BLOCKINDEXLOOKUP_H
+#define ZCASH_BLOCKINDEXLOOKUP_H
+
+#include "sync.h"
+#include "uint256.h"
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+class CBlockIndex;
+
+/**
+ * An index from block hashes to the entries of mapBlockIndex that is read
+ * without any lock, so that network and RPC threads can resolve a block hash
+ * without waiting for cs_main.
+ *
+ * Entries are added and removed while cs_main is held, and are keyed by the
+ * hash their phashBlock points to. The hashes are split between shards, each
+ * an open-addressed table of atomic pointers. A removed entry leaves a
+ * tombstone in its slot, so that the probe sequences through it stay intact.
+ * A shard that fills up is replaced by a copy without the tombstones, twice
+ * the size if its entries need it. The tables it replaces are kept until
+ * Clear(), so that a lookup that is still reading one stays valid.
+ *
+ * As with CChain::AtomicTip(), only the parts of a returned entry that are
+ * fixed once it is added (its hash, height, header and ancestors) should be
+ * read from it without cs_main.
+ */
+class CBlockIndexLookup
+{
+private:
+    static const size_t SHARD_COUNT = 16;
+    static const size_t MIN_TABLE_SIZE = 64;
+
+    struct Table {
+        size_t nMask;
+        std::unique_ptr<std::atomic<CBlockIndex*>[]> slots;
+
+        explicit Table(size_t nSize);
+    };
+
+    struct Shard {
+        std::atomic<Table*> table{nullptr};
+        //! Number of entries, guarded by csWrite.
+        size_t nCount = 0;
+        //! Number of tombstones in the current table, guarded by csWrite.
+        size_t nTombstones = 0;
+        //! The current table and those it replaced, guarded by csWrite.
+        std::vector<std::unique_ptr<Table>> vTables;
+    };
+
+    CCriticalSection csWrite;
+    Shard shards[SHARD_COUNT];
+
+    /** The marker left in the slot of a removed entry. */
+    static CBlockIndex* Tombstone();
+
+    /**
+     * Store pindex in the first free slot or tombstone of its probe sequence.
+     * Returns whether it replaced a tombstone.
+     */
+    static bool Place(Table& table, uint64_t nHash, CBlockIndex* pindex);
+
+public:
+    CBlockIndexLookup() {}
+    CBlockIndexLookup(const CBlockIndexLookup&) = delete;
+    CBlockIndexLookup& operator=(const CBlockIndexLookup&) = delete;
+
+    /** Return the entry for hash, or NULL if it has not been added. Takes no lock. */
+    CBlockIndex* Lookup(const uint256& hash) const;
+
+    /** Add an entry whose phashBlock is set. Adding a hash twice has no effect. */
+    void Insert(CBlockIndex* pindex);
+
+    /**
+     * Remove an entry, if it was added. This must be called before the entry
+     * is deleted, at a point where no other thread can still be using a
+     * pointer to it that Lookup() returned.
+     */
+    void Remove(const CBlockIndex* pindex);
+
+    /** Remove all entries. This must not run concurrently with Lookup(). */
+    void Clear();
+
+    size_t Size();
+};
+
+#endif // ZCASH_BLOCKINDEXLOOKUP_H
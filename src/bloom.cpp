@@ -6,6 +6,7 @@
 
 #include "primitives/transaction.h"
 #include "hash.h"
+#include "memusage.h"
 #include "script/script.h"
 #include "script/standard.h"
 #include "random.h"
@@ -15,6 +16,7 @@
 #include <stdlib.h>
 
 #include <algorithm>
+#include <limits>
 
 #define LN2SQUARED 0.4804530139182014246671025263266649717305529515945455
 #define LN2 0.6931471805599453094172321214581765680755001343602552
@@ -274,3 +276,119 @@ void CRollingBloomFilter::reset()
     nGeneration = 1;
     std::fill(data.begin(), data.end(), 0);
 }
+
+size_t CRollingBloomFilter::DynamicMemoryUsage() const
+{
+    return memusage::DynamicUsage(data);
+}
+
+CGrowingRollingBloomFilter::CGrowingRollingBloomFilter(unsigned int nElements, double nFPRateIn, unsigned int nInitialElementsIn) :
+    nMaxElements(nElements),
+    nFPRate(nFPRateIn),
+    nInitialElements(std::min(nInitialElementsIn, nElements)),
+    nMemoryUsage(0)
+{
+    reset();
+}
+
+void CGrowingRollingBloomFilter::insert(const std::vector<unsigned char>& vKey)
+{
+    if (nCurrentElements < nMaxElements && nCurrentInsertions == current->GetInsertionsBeforeRoll()) {
+        // Grow before the current filter forgets anything. It holds every
+        // entry it was given, so it replaces any previous filter.
+        nPreviousInsertions = nCurrentInsertions;
+        previous = std::move(current);
+        nCurrentElements = std::min(nMaxElements, nCurrentElements * 2);
+        current.reset(new CRollingBloomFilter(nCurrentElements, nFPRate));
+        nCurrentInsertions = 0;
+        UpdateMemoryUsage();
+    }
+    current->insert(vKey);
+    nCurrentInsertions++;
+    if (previous && nCurrentInsertions >= nPreviousInsertions) {
+        previous.reset();
+        UpdateMemoryUsage();
+    }
+}
+
+void CGrowingRollingBloomFilter::insert(const uint256& hash)
+{
+    std::vector<unsigned char> vData(hash.begin(), hash.end());
+    insert(vData);
+}
+
+bool CGrowingRollingBloomFilter::contains(const std::vector<unsigned char>& vKey) const
+{
+    return current->contains(vKey) || (previous && previous->contains(vKey));
+}
+
+bool CGrowingRollingBloomFilter::contains(const uint256& hash) const
+{
+    std::vector<unsigned char> vData(hash.begin(), hash.end());
+    return contains(vData);
+}
+
+void CGrowingRollingBloomFilter::reset()
+{
+    nCurrentElements = nInitialElements;
+    current.reset(new CRollingBloomFilter(nCurrentElements, nFPRate));
+    nCurrentInsertions = 0;
+    previous.reset();
+    nPreviousInsertions = 0;
+    UpdateMemoryUsage();
+}
+
+void CGrowingRollingBloomFilter::UpdateMemoryUsage()
+{
+    size_t nUsage = memusage::MallocUsage(sizeof(CRollingBloomFilter)) + current->DynamicMemoryUsage();
+    if (previous) {
+        nUsage += memusage::MallocUsage(sizeof(CRollingBloomFilter)) + previous->DynamicMemoryUsage();
+    }
+    nMemoryUsage = nUsage;
+}
+
+CBlockedBloomFilter::CBlockedBloomFilter(size_t nCapacityIn) :
+    nCapacity(nCapacityIn),
+    nBlocks(std::max<uint64_t>(1, ((uint64_t)nCapacityIn * BITS_PER_KEY + 511) / 512)),
+    k0(GetRand(std::numeric_limits<uint64_t>::max())),
+    k1(GetRand(std::numeric_limits<uint64_t>::max())),
+    data(new std::atomic<uint64_t>[(size_t)nBlocks * WORDS_PER_BLOCK]())
+{
+}
+
+/**
+ * The upper 32 bits of the hash select the block, by multiplying instead of
+ * taking a modulus, and the lower bits give the start and (odd) stride of the
+ * bit positions in the block, which are therefore all distinct.
+ */
+void CBlockedBloomFilter::insert(const uint256& hash)
+{
+    uint64_t h = SipHashUint256(k0, k1, hash);
+    std::atomic<uint64_t>* block = &data[((h >> 32) * nBlocks >> 32) * WORDS_PER_BLOCK];
+    uint32_t nBit = h & 511;
+    uint32_t nStride = ((h >> 9) & 511) | 1;
+    for (unsigned int i = 0; i < HASH_FUNCS; i++) {
+        block[nBit >> 6].fetch_or((uint64_t)1 << (nBit & 63), std::memory_order_relaxed);
+        nBit = (nBit + nStride) & 511;
+    }
+}
+
+bool CBlockedBloomFilter::contains(const uint256& hash) const
+{
+    uint64_t h = SipHashUint256(k0, k1, hash);
+    const std::atomic<uint64_t>* block = &data[((h >> 32) * nBlocks >> 32) * WORDS_PER_BLOCK];
+    uint32_t nBit = h & 511;
+    uint32_t nStride = ((h >> 9) & 511) | 1;
+    for (unsigned int i = 0; i < HASH_FUNCS; i++) {
+        if (!(block[nBit >> 6].load(std::memory_order_relaxed) & ((uint64_t)1 << (nBit & 63)))) {
+            return false;
+        }
+        nBit = (nBit + nStride) & 511;
+    }
+    return true;
+}
+
+size_t CBlockedBloomFilter::DynamicMemoryUsage() const
+{
+    return memusage::MallocUsage(sizeof(std::atomic<uint64_t>) * nBlocks * WORDS_PER_BLOCK);
+}
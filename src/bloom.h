@@ -7,6 +7,8 @@
 
 #include "serialize.h"
 
+#include <atomic>
+#include <memory>
 #include <vector>
 
 class COutPoint;
@@ -130,6 +132,11 @@ public:
 
     void reset();
 
+    //! The number of insertions before the oldest entries start to be forgotten.
+    unsigned int GetInsertionsBeforeRoll() const { return nEntriesPerGeneration * 3; }
+
+    size_t DynamicMemoryUsage() const;
+
 private:
     int nEntriesPerGeneration;
     int nEntriesThisGeneration;
@@ -139,4 +146,86 @@ private:
     int nHashFuncs;
 };
 
+/**
+ * A CRollingBloomFilter that starts out sized for nInitialElements and
+ * grows, as entries are inserted, until it is sized for nElements. A filter
+ * that few entries are inserted into, such as those of short-lived peers,
+ * then stays small.
+ *
+ * Before the filter would start to forget entries, it is replaced by one
+ * twice as large, and the old one is still queried until the new one holds
+ * as many entries. It therefore remembers at least the last nElements
+ * entries, as a CRollingBloomFilter does, and while both are queried its
+ * false positive rate is up to twice nFPRate.
+ */
+class CGrowingRollingBloomFilter
+{
+public:
+    CGrowingRollingBloomFilter(unsigned int nElements, double nFPRate, unsigned int nInitialElements);
+
+    void insert(const std::vector<unsigned char>& vKey);
+    void insert(const uint256& hash);
+    bool contains(const std::vector<unsigned char>& vKey) const;
+    bool contains(const uint256& hash) const;
+
+    //! Forget all entries, and shrink back to nInitialElements.
+    void reset();
+
+    //! The number of entries that the current filter is sized for.
+    unsigned int GetElements() const { return nCurrentElements; }
+
+    //! May be called without the lock that guards the other methods.
+    size_t DynamicMemoryUsage() const { return nMemoryUsage; }
+
+private:
+    unsigned int nMaxElements;
+    double nFPRate;
+    unsigned int nInitialElements;
+
+    std::unique_ptr<CRollingBloomFilter> current;
+    unsigned int nCurrentElements;
+    unsigned int nCurrentInsertions;
+    std::unique_ptr<CRollingBloomFilter> previous;
+    unsigned int nPreviousInsertions;
+    std::atomic<size_t> nMemoryUsage;
+
+    void UpdateMemoryUsage();
+};
+
+/**
+ * A bloom filter over a large set of uint256 keys, used to find out without
+ * a database lookup that a key is definitely not in the set.
+ *
+ * The bits for each key are all in one 512-bit block, so that a lookup only
+ * reads 64 bytes of memory, and the bit positions come from one salted
+ * SipHash of the key. Sized for its capacity, the false positive rate is about 1%.
+ *
+ * The bits are atomic, so insert() and contains() may be called from
+ * several threads at once. Keys cannot be removed.
+ */
+class CBlockedBloomFilter
+{
+public:
+    // Calls GetRand() at creation time, as CRollingBloomFilter does.
+    explicit CBlockedBloomFilter(size_t nCapacity);
+
+    void insert(const uint256& hash);
+    bool contains(const uint256& hash) const;
+
+    //! The number of keys that the filter is sized for.
+    size_t GetCapacity() const { return nCapacity; }
+
+    size_t DynamicMemoryUsage() const;
+
+private:
+    static const unsigned int WORDS_PER_BLOCK = 8;
+    static const unsigned int HASH_FUNCS = 7;
+    static const unsigned int BITS_PER_KEY = 10;
+
+    size_t nCapacity;
+    uint32_t nBlocks;
+    uint64_t k0, k1;
+    std::unique_ptr<std::atomic<uint64_t>[]> data;
+};
+
 #endif // BITCOIN_BLOOM_H
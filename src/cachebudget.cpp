@@ -0,0 +1,71 @@
+// Copyright (c) 2021 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "cachebudget.h"
+
+#include <algorithm>
+
+//! The share of a budget in use above which it is nearly full.
+static const double NEARLY_FULL = 0.9;
+//! How much more often one cache must miss than the other before memory moves to it.
+static const double MISS_RATE_MARGIN = 0.1;
+
+/** Move up to nAmount from one budget to another, leaving at least nMin. Returns the amount moved. */
+static size_t Move(size_t& nFrom, size_t nMin, size_t& nTo, size_t nAmount)
+{
+    size_t nMoved = nFrom > nMin ? std::min(nFrom - nMin, nAmount) : 0;
+    nFrom -= nMoved;
+    nTo += nMoved;
+    return nMoved;
+}
+
+static double MissRate(uint64_t nMisses, uint64_t nLookups)
+{
+    return nLookups > 0 ? std::min(1.0, (double)nMisses / nLookups) : 0.0;
+}
+
+CCacheBudgets RebalanceCacheBudgets(
+    const CCacheBudgets& current,
+    const CCacheBudgets& configured,
+    const CCacheObservations& observations)
+{
+    CCacheBudgets next = current;
+    size_t nStep = current.Total() / 16;
+    size_t nMinCoinsCache = configured.nCoinsCache / 4;
+    size_t nMinBlockCache = configured.nChainstateBlockCache / 4;
+
+    if (observations.fInitialBlockDownload) {
+        // Transactions are not accepted during initial block download, so
+        // the mempool only has to keep what it already holds.
+        size_t nMinMempool = std::max(configured.nMempool / 4, observations.nMempoolCost);
+        size_t nMoved = Move(next.nMempool, nMinMempool, next.nCoinsCache, nStep);
+        Move(next.nChainstateBlockCache, nMinBlockCache, next.nCoinsCache, nStep - nMoved);
+        return next;
+    }
+
+    if (next.nMempool < configured.nMempool) {
+        size_t nShort = configured.nMempool - next.nMempool;
+        nShort -= Move(next.nCoinsCache, nMinCoinsCache, next.nMempool, nShort);
+        Move(next.nChainstateBlockCache, nMinBlockCache, next.nMempool, nShort);
+        return next;
+    }
+    if (observations.nMempoolCost >= current.nMempool * NEARLY_FULL) {
+        size_t nMoved = Move(next.nCoinsCache, nMinCoinsCache, next.nMempool, nStep);
+        Move(next.nChainstateBlockCache, nMinBlockCache, next.nMempool, nStep - nMoved);
+        return next;
+    }
+    if (next.nMempool > configured.nMempool && observations.nMempoolCost < current.nMempool / 2) {
+        Move(next.nMempool, configured.nMempool, next.nCoinsCache, nStep);
+        return next;
+    }
+
+    double dCoinsMissRate = MissRate(observations.nCoinsMisses, observations.nCoinsHits + observations.nCoinsMisses);
+    double dBlockCacheMissRate = MissRate(observations.nChainstateFileReads, observations.nChainstateReads);
+    if (dBlockCacheMissRate > dCoinsMissRate + MISS_RATE_MARGIN) {
+        Move(next.nCoinsCache, nMinCoinsCache, next.nChainstateBlockCache, nStep);
+    } else if (dCoinsMissRate > dBlockCacheMissRate + MISS_RATE_MARGIN) {
+        Move(next.nChainstateBlockCache, nMinBlockCache, next.nCoinsCache, nStep);
+    }
+    return next;
+}
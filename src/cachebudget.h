@@ -0,0 +1,80 @@
+// Copyright (c) 2021 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifndef ZCASH_CACHEBUDGET_H
+#define ZCASH_CACHEBUDGET_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** Default for -adaptivedbcache */
+static const bool DEFAULT_ADAPTIVE_DBCACHE = false;
+/** Seconds between rebalancings of the cache budgets, with -adaptivedbcache */
+static const int64_t CACHE_REBALANCE_INTERVAL = 60;
+
+/**
+ * The memory given to the caches that can be resized while the node runs.
+ * The sum stays what -dbcache and -mempooltxcostlimit configured; only the
+ * split between them changes.
+ */
+struct CCacheBudgets
+{
+    //! The in-memory UTXO set (nCoinCacheUsage).
+    size_t nCoinsCache;
+    //! The LevelDB block cache of the chain state database.
+    size_t nChainstateBlockCache;
+    //! The cost limit of the mempool.
+    size_t nMempool;
+
+    CCacheBudgets() : nCoinsCache(0), nChainstateBlockCache(0), nMempool(0) {}
+    CCacheBudgets(size_t nCoinsCacheIn, size_t nChainstateBlockCacheIn, size_t nMempoolIn) :
+        nCoinsCache(nCoinsCacheIn), nChainstateBlockCache(nChainstateBlockCacheIn), nMempool(nMempoolIn) {}
+
+    size_t Total() const { return nCoinsCache + nChainstateBlockCache + nMempool; }
+
+    friend bool operator==(const CCacheBudgets& a, const CCacheBudgets& b)
+    {
+        return a.nCoinsCache == b.nCoinsCache &&
+               a.nChainstateBlockCache == b.nChainstateBlockCache &&
+               a.nMempool == b.nMempool;
+    }
+    friend bool operator!=(const CCacheBudgets& a, const CCacheBudgets& b) { return !(a == b); }
+};
+
+/** What the caches did since the budgets were last rebalanced. */
+struct CCacheObservations
+{
+    bool fInitialBlockDownload;
+    //! Lookups in the in-memory UTXO set.
+    uint64_t nCoinsHits;
+    uint64_t nCoinsMisses;
+    //! Point lookups in the chain state database, and the table blocks they read from disk.
+    uint64_t nChainstateReads;
+    uint64_t nChainstateFileReads;
+    //! Cost of the transactions in the mempool.
+    size_t nMempoolCost;
+
+    CCacheObservations() : fInitialBlockDownload(false), nCoinsHits(0), nCoinsMisses(0),
+        nChainstateReads(0), nChainstateFileReads(0), nMempoolCost(0) {}
+};
+
+/**
+ * Move part of the budgets towards the cache that needs it most, given the
+ * budgets configured at startup and what the caches did since the last call.
+ *
+ * During initial block download the UTXO set cache takes memory from the
+ * mempool, which is not used then, and from the LevelDB block cache, as
+ * every coin it keeps saves a database write and read. At the tip the
+ * mempool first gets back its configured limit, and more while it is nearly
+ * full, and the rest moves between the UTXO set cache and the LevelDB block
+ * cache towards the one that misses more often. No budget goes below a
+ * quarter of its configured size, and each call moves at most a sixteenth of
+ * the total, beyond restoring the mempool.
+ */
+CCacheBudgets RebalanceCacheBudgets(
+    const CCacheBudgets& current,
+    const CCacheBudgets& configured,
+    const CCacheObservations& observations);
+
+#endif // ZCASH_CACHEBUDGET_H
@@ -5,10 +5,14 @@
 
 #include "chain.h"
 
+#include "main.h"
+#include "txdb.h"
+
 /**
  * CChain implementation
  */
 void CChain::SetTip(CBlockIndex *pindex) {
+    tipAtomic.store(pindex);
     if (pindex == NULL) {
         vChain.clear();
         return;
@@ -48,14 +52,76 @@ CBlockLocator CChain::GetLocator(const CBlockIndex *pindex) const {
     return CBlockLocator(vHave);
 }
 
+CBlockLocator GetLocator(const CBlockIndex *pindex) {
+    int nStep = 1;
+    std::vector<uint256> vHave;
+    vHave.reserve(32);
+
+    while (pindex) {
+        vHave.push_back(pindex->GetBlockHash());
+        // Stop when we have added the genesis block.
+        if (pindex->nHeight == 0)
+            break;
+        // Exponentially larger steps back, plus the genesis block.
+        pindex = pindex->GetAncestor(std::max(pindex->nHeight - nStep, 0));
+        if (vHave.size() > 10)
+            nStep *= 2;
+    }
+
+    return CBlockLocator(vHave);
+}
+
 const CBlockIndex *CChain::FindFork(const CBlockIndex *pindex) const {
+    if (pindex == NULL)
+        return NULL;
     if (pindex->nHeight > Height())
         pindex = pindex->GetAncestor(Height());
-    while (pindex && !Contains(pindex))
-        pindex = pindex->pprev;
+    while (pindex && !Contains(pindex)) {
+        // Skip back over the part of a long fork that is not in this chain.
+        if (pindex->pskip && !Contains(pindex->pskip))
+            pindex = pindex->pskip;
+        else
+            pindex = pindex->pprev;
+    }
     return pindex;
 }
 
+CBlockIndex* LastCommonAncestor(CBlockIndex* pa, CBlockIndex* pb) {
+    if (pa->nHeight > pb->nHeight) {
+        pa = pa->GetAncestor(pb->nHeight);
+    } else if (pb->nHeight > pa->nHeight) {
+        pb = pb->GetAncestor(pa->nHeight);
+    }
+
+    while (pa != pb && pa && pb) {
+        // Blocks at the same height have skip pointers to the same height,
+        // so if those differ the common ancestor is below them.
+        if (pa->pskip != pb->pskip) {
+            pa = pa->pskip;
+            pb = pb->pskip;
+        } else {
+            pa = pa->pprev;
+            pb = pb->pprev;
+        }
+    }
+
+    // Eventually all chain branches meet at the genesis block.
+    assert(pa == pb);
+    return pa;
+}
+
+std::vector<unsigned char> CBlockIndex::GetSolution() const
+{
+    if (HasSolution()) {
+        return nSolution;
+    }
+    CDiskBlockIndex dbindex;
+    if (pblocktree == NULL || !pblocktree->ReadDiskBlockIndex(GetBlockHash(), dbindex)) {
+        throw std::runtime_error(strprintf("%s: failed to read the block index entry for %s", __func__, GetBlockHash().ToString()));
+    }
+    return dbindex.nSolution;
+}
+
 /** Turn the lowest '1' bit in the binary representation of a number into a '0'. */
 int static inline InvertLowestOne(int n) { return n & (n - 1); }
 
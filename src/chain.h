@@ -7,11 +7,13 @@
 #define BITCOIN_CHAIN_H
 
 #include "arith_uint256.h"
+#include "memusage.h"
 #include "primitives/block.h"
 #include "pow.h"
 #include "tinyformat.h"
 #include "uint256.h"
 
+#include <atomic>
 #include <optional>
 #include <vector>
 
@@ -102,6 +104,9 @@ struct CDiskBlockPos
 {
     int nFile;
     unsigned int nPos;
+    //! Memory only: the number of bytes stored at nPos, which is the
+    //! compressed size of a compressed record (0 = unknown).
+    unsigned int nSize;
 
     ADD_SERIALIZE_METHODS;
 
@@ -118,6 +123,7 @@ struct CDiskBlockPos
     CDiskBlockPos(int nFileIn, unsigned int nPosIn) {
         nFile = nFileIn;
         nPos = nPosIn;
+        nSize = 0;
     }
 
     friend bool operator==(const CDiskBlockPos &a, const CDiskBlockPos &b) {
@@ -128,7 +134,7 @@ struct CDiskBlockPos
         return !(a == b);
     }
 
-    void SetNull() { nFile = -1; nPos = 0; }
+    void SetNull() { nFile = -1; nPos = 0; nSize = 0; }
     bool IsNull() const { return (nFile == -1); }
 
     std::string ToString() const
@@ -278,11 +284,21 @@ public:
     unsigned int nTime;
     unsigned int nBits;
     uint256 nNonce;
+
+protected:
+    //! Equihash solution of the block header. It is trimmed from memory once
+    //! the entry has been written to the block index database, and is then
+    //! read back from the database when it is needed; see GetSolution().
     std::vector<unsigned char> nSolution;
 
+public:
     //! (memory only) Sequential id assigned to distinguish order in which blocks are received.
     uint32_t nSequenceId;
 
+    //! (memory only) Checksum of the "block" network message of this block,
+    //! once it has been sent to a peer, or 0 if it has not been computed.
+    uint32_t nMessageChecksum;
+
     void SetNull()
     {
         phashBlock = NULL;
@@ -300,6 +316,7 @@ public:
         hashSproutAnchor = uint256();
         hashFinalSproutRoot = uint256();
         nSequenceId = 0;
+        nMessageChecksum = 0;
         nSproutValue = std::nullopt;
         nChainSproutValue = std::nullopt;
         nSaplingValue = 0;
@@ -361,10 +378,33 @@ public:
         block.nTime          = nTime;
         block.nBits          = nBits;
         block.nNonce         = nNonce;
-        block.nSolution      = nSolution;
+        block.nSolution      = GetSolution();
         return block;
     }
 
+    //! Whether the Equihash solution is held in memory.
+    bool HasSolution() const
+    {
+        return !nSolution.empty();
+    }
+
+    //! The memory used by the Equihash solution held in memory, if any.
+    size_t SolutionDynamicMemoryUsage() const
+    {
+        return memusage::DynamicUsage(nSolution);
+    }
+
+    //! Get the Equihash solution, reading it from the block index database
+    //! if it has been trimmed. Throws if it cannot be read.
+    std::vector<unsigned char> GetSolution() const;
+
+    //! Release the Equihash solution from memory. The entry must have been
+    //! written to the block index database.
+    void TrimSolution()
+    {
+        std::vector<unsigned char>().swap(nSolution);
+    }
+
     uint256 GetBlockHash() const
     {
         return *phashBlock;
@@ -446,8 +486,13 @@ public:
         hashPrev = uint256();
     }
 
-    explicit CDiskBlockIndex(const CBlockIndex* pindex) : CBlockIndex(*pindex) {
+    //! If fWithSolution is false, a trimmed Equihash solution is left empty
+    //! rather than read from the block index database.
+    explicit CDiskBlockIndex(const CBlockIndex* pindex, bool fWithSolution = true) : CBlockIndex(*pindex) {
         hashPrev = (pprev ? pprev->GetBlockHash() : uint256());
+        if (fWithSolution && !HasSolution()) {
+            nSolution = pindex->GetSolution();
+        }
     }
 
     ADD_SERIALIZE_METHODS;
@@ -549,6 +594,8 @@ public:
 class CChain {
 private:
     std::vector<CBlockIndex*> vChain;
+    //! The last entry of vChain, published for AtomicTip().
+    std::atomic<CBlockIndex*> tipAtomic{nullptr};
 
 public:
     /** Returns the index entry for the genesis block of this chain, or NULL if none. */
@@ -561,6 +608,17 @@ public:
         return vChain.size() > 0 ? vChain[vChain.size() - 1] : NULL;
     }
 
+    /**
+     * Returns the index entry for the tip of this chain, or NULL if none,
+     * without needing the lock that guards the chain. The tip may have
+     * changed by the time it is used, so only the parts of the entry that
+     * are fixed once it is in a chain (its hash, height, header and
+     * ancestors) should be read from it.
+     */
+    CBlockIndex *AtomicTip() const {
+        return tipAtomic.load();
+    }
+
     /** Returns the index entry at a particular height in this chain, or NULL if no such height exists. */
     CBlockIndex *operator[](int nHeight) const {
         if (nHeight < 0 || nHeight >= (int)vChain.size())
@@ -568,6 +626,24 @@ public:
         return vChain[nHeight];
     }
 
+    /**
+     * Returns the index entry at a particular height in this chain, or NULL
+     * if no such height exists, without needing the lock that guards the
+     * chain. This follows the skiplist back from AtomicTip(), so it takes
+     * O(log n) steps rather than one.
+     */
+    CBlockIndex *AtomicAt(int nHeight) const {
+        CBlockIndex *pindexTip = AtomicTip();
+        if (pindexTip == NULL || nHeight < 0 || nHeight > pindexTip->nHeight)
+            return NULL;
+        return pindexTip->GetAncestor(nHeight);
+    }
+
+    /** Check whether a block is present in this chain, as of AtomicTip(). */
+    bool AtomicContains(const CBlockIndex *pindex) const {
+        return AtomicAt(pindex->nHeight) == pindex;
+    }
+
     /** Compare two chains efficiently. */
     friend bool operator==(const CChain &a, const CChain &b) {
         return a.vChain.size() == b.vChain.size() &&
@@ -602,4 +678,14 @@ public:
     const CBlockIndex *FindFork(const CBlockIndex *pindex) const;
 };
 
+/**
+ * Return a CBlockLocator that refers to a block and its ancestors. Unlike
+ * CChain::GetLocator, this only follows the ancestors of pindex, so it does
+ * not need the lock that guards the chain.
+ */
+CBlockLocator GetLocator(const CBlockIndex *pindex);
+
+/** Find the last common ancestor two blocks have. Both pa and pb must be non-NULL. */
+CBlockIndex* LastCommonAncestor(CBlockIndex* pa, CBlockIndex* pb);
+
 #endif // BITCOIN_CHAIN_H
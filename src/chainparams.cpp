@@ -297,6 +297,10 @@ public:
                             //   total number of tx / (checkpoint block height / (24 * 24))
         };
 
+        // UTXO set snapshots that loadtxoutset accepts, as written by
+        // dumptxoutset at the given heights. None are pinned yet.
+        vAssumeutxo = {};
+
         // Hardcoded fallback value for the Sprout shielded value pool balance
         // for nodes that have not reindexed since the introduction of monitoring
         // in #2795.
@@ -759,6 +763,15 @@ public:
     void SetRegTestZIP209Enabled() {
         fZIP209Enabled = true;
     }
+
+    void SetRegTestFastMode() {
+        consensus.fSkipEquihash = true;
+    }
+
+    void UpdateAssumeutxo(const AssumeutxoData& data)
+    {
+        vAssumeutxo.push_back(data);
+    }
 };
 static CRegTestParams regTestParams;
 
@@ -795,6 +808,11 @@ void SelectParams(const std::string& network)
     if (network == CBaseChainParams::REGTEST && mapArgs.count("-developersetpoolsizezero")) {
         regTestParams.SetRegTestZIP209Enabled();
     }
+
+    // Integration test suites can skip the Equihash solutions of their blocks
+    if (network == CBaseChainParams::REGTEST && GetBoolArg("-regtestfastmode", false)) {
+        regTestParams.SetRegTestFastMode();
+    }
 }
 
 
@@ -831,6 +849,15 @@ CScript CChainParams::GetFoundersRewardScriptAtHeight(int nHeight) const {
     return script;
 }
 
+const AssumeutxoData* CChainParams::AssumeutxoForBlock(const uint256& hashBlock) const {
+    for (const AssumeutxoData& data : vAssumeutxo) {
+        if (data.hashBlock == hashBlock) {
+            return &data;
+        }
+    }
+    return nullptr;
+}
+
 std::string CChainParams::GetFoundersRewardAddressAtIndex(int i) const {
     assert(i >= 0 && i < vFoundersRewardAddress.size());
     return vFoundersRewardAddress[i];
@@ -841,6 +868,11 @@ void UpdateNetworkUpgradeParameters(Consensus::UpgradeIndex idx, int nActivation
     regTestParams.UpdateNetworkUpgradeParameters(idx, nActivationHeight);
 }
 
+void UpdateRegtestAssumeutxo(const AssumeutxoData& data)
+{
+    regTestParams.UpdateAssumeutxo(data);
+}
+
 void UpdateFundingStreamParameters(Consensus::FundingStreamIndex idx, Consensus::FundingStream fs)
 {
     regTestParams.UpdateFundingStreamParameters(idx, fs);
@@ -32,6 +32,16 @@ struct CCheckpointData {
     double fTransactionsPerDay;
 };
 
+/**
+ * A UTXO set snapshot that loadtxoutset accepts, identified by the hash of
+ * the file that dumptxoutset writes for the block.
+ */
+struct AssumeutxoData {
+    int nHeight;
+    uint256 hashBlock;
+    uint256 hashSnapshot;
+};
+
 class CBaseKeyConstants : public KeyConstants {
 public:
     const std::vector<unsigned char>& Base58Prefix(Base58Type type) const { return base58Prefixes[type]; }
@@ -86,6 +96,9 @@ public:
     }
     const std::vector<SeedSpec6>& FixedSeeds() const { return vFixedSeeds; }
     const CCheckpointData& Checkpoints() const { return checkpointData; }
+    const std::vector<AssumeutxoData>& Assumeutxo() const { return vAssumeutxo; }
+    /** Return the pinned snapshot for the given block, or nullptr if there is none */
+    const AssumeutxoData* AssumeutxoForBlock(const uint256& hashBlock) const;
     /** Return the founder's reward address and script for a given block height */
     std::string GetFoundersRewardAddressAtHeight(int height) const;
     CScript GetFoundersRewardScriptAtHeight(int height) const;
@@ -114,6 +127,7 @@ protected:
     bool fMineBlocksOnDemand = false;
     bool fTestnetToBeDeprecatedFieldRPC = false;
     CCheckpointData checkpointData;
+    std::vector<AssumeutxoData> vAssumeutxo;
     std::vector<std::string> vFoundersRewardAddress;
 
     CAmount nSproutValuePoolCheckpointHeight = 0;
@@ -150,6 +164,11 @@ void UpdateRegtestPow(
     uint256 powLimit,
     bool noRetargeting);
 
+/**
+ * Allows pinning a UTXO set snapshot in the regtest parameters.
+ */
+void UpdateRegtestAssumeutxo(const AssumeutxoData& data);
+
 /**
  * Allows modifying the regtest funding stream parameters.
  */
@@ -24,16 +24,16 @@ namespace Checkpoints {
      */
     static const double SIGCHECK_VERIFICATION_FACTOR = 5.0;
 
-    //! Guess how far we are in the verification process at the given block index
-    double GuessVerificationProgress(const CCheckpointData& data, CBlockIndex *pindex, bool fSigchecks) {
+    //! Guess the amount of verification work done up to the given block index, and left after it
+    void GuessVerificationWork(const CCheckpointData& data, CBlockIndex *pindex, double& fWorkBefore, double& fWorkAfter, bool fSigchecks) {
+        fWorkBefore = 0.0; // Amount of work done before pindex
+        fWorkAfter = 0.0;  // Amount of work left after pindex (estimated)
         if (pindex==NULL)
-            return 0.0;
+            return;
 
         int64_t nNow = time(NULL);
 
         double fSigcheckVerificationFactor = fSigchecks ? SIGCHECK_VERIFICATION_FACTOR : 1.0;
-        double fWorkBefore = 0.0; // Amount of work done before pindex
-        double fWorkAfter = 0.0;  // Amount of work left after pindex (estimated)
         // Work is defined as: 1.0 per transaction before the last checkpoint, and
         // fSigcheckVerificationFactor per transaction after.
 
@@ -50,7 +50,15 @@ namespace Checkpoints {
             fWorkBefore = nCheapBefore + nExpensiveBefore*fSigcheckVerificationFactor;
             fWorkAfter = nExpensiveAfter*fSigcheckVerificationFactor;
         }
+    }
+
+    //! Guess how far we are in the verification process at the given block index
+    double GuessVerificationProgress(const CCheckpointData& data, CBlockIndex *pindex, bool fSigchecks) {
+        if (pindex==NULL)
+            return 0.0;
 
+        double fWorkBefore, fWorkAfter;
+        GuessVerificationWork(data, pindex, fWorkBefore, fWorkAfter, fSigchecks);
         return std::min(fWorkBefore / (fWorkBefore + fWorkAfter), 1.0);
     }
 
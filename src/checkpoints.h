@@ -25,6 +25,13 @@ int GetTotalBlocksEstimate(const CCheckpointData& data);
 //! Returns last CBlockIndex* in mapBlockIndex that is a checkpoint
 CBlockIndex* GetLastCheckpoint(const CCheckpointData& data);
 
+/**
+ * Guess the verification work done up to the given block index, and the work
+ * left after it, in units of the verification of one transaction before the
+ * last checkpoint. Both are zero if pindex is NULL.
+ */
+void GuessVerificationWork(const CCheckpointData& data, CBlockIndex* pindex, double& fWorkBefore, double& fWorkAfter, bool fSigchecks = true);
+
 double GuessVerificationProgress(const CCheckpointData& data, CBlockIndex* pindex, bool fSigchecks = true);
 
 bool IsAncestorOfLastCheckpoint(const CCheckpointData& data, const CBlockIndex* pindex);
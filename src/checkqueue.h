@@ -6,6 +6,11 @@
 #define BITCOIN_CHECKQUEUE_H
 
 #include <algorithm>
+#include <array>
+#include <assert.h>
+#include <atomic>
+#include <limits>
+#include <memory>
 #include <vector>
 
 #include <boost/thread/condition_variable.hpp>
@@ -17,148 +22,375 @@
 template <typename T>
 class CCheckQueueControl;
 
-/** 
+/** The maximum number of queues that can share a CCheckPool. */
+static const int MAX_CHECK_POOL_QUEUES = 8;
+
+/**
+ * The number of deques in each CCheckQueue: one for the master, and one for
+ * each worker. Workers beyond that share deques, which is correct but adds
+ * contention.
+ */
+static const int CHECK_QUEUE_DEQUES = 64;
+
+/** Interface through which a CCheckPool runs the checks of its queues. */
+class CCheckQueueBase
+{
+public:
+    virtual ~CCheckQueueBase() {}
+
+    /**
+     * Run a batch of checks taken from the given worker's deque, or stolen
+     * from another one. Returns false if there was nothing to run.
+     */
+    virtual bool RunBatch(int nWorker) = 0;
+};
+
+/**
+ * Worker threads shared by one or more CCheckQueues, which may each hold
+ * a different type of check. Workers go through the queues in turn, and
+ * only sleep once none of them has anything to run.
+ */
+class CCheckPool
+{
+private:
+    //! The queues attached to the pool. Only ever appended to.
+    std::array<std::atomic<CCheckQueueBase*>, MAX_CHECK_POOL_QUEUES> queues;
+    std::atomic<int> nQueues;
+
+    //! The number of workers that have joined the pool. Never decreases, so
+    //! that a deque that was given work stays visible to the other workers.
+    std::atomic<int> nWorkers;
+
+    //! Bumped whenever checks are added, so that a worker going to sleep can
+    //! tell whether it missed any.
+    std::atomic<uint64_t> nSignal;
+
+    //! The number of workers waiting on condWorker.
+    std::atomic<int> nSleeping;
+
+    //! The number of workers that may run checks. Those that joined after
+    //! the first nActive park on condParked until it is raised.
+    std::atomic<int> nActive;
+
+    //! The most batches of checks that were waiting at once since the last
+    //! call to TakePeakBacklog().
+    std::atomic<unsigned int> nPeakBacklog;
+
+    //! Mutex and condition variables on which idle and parked workers sleep
+    boost::mutex mutex;
+    boost::condition_variable condWorker;
+    boost::condition_variable condParked;
+
+public:
+    CCheckPool() : nQueues(0), nWorkers(0), nSignal(0), nSleeping(0),
+        nActive(std::numeric_limits<int>::max()), nPeakBacklog(0) {}
+
+    //! Attach a queue, before any worker starts.
+    void Attach(CCheckQueueBase* pqueue)
+    {
+        int n = nQueues.load();
+        assert(n < MAX_CHECK_POOL_QUEUES);
+        queues[n] = pqueue;
+        nQueues = n + 1;
+    }
+
+    int NumWorkers() const
+    {
+        return nWorkers.load();
+    }
+
+    //! The number of workers that run checks, and are not parked.
+    int NumActiveWorkers() const
+    {
+        return std::min(nActive.load(), nWorkers.load());
+    }
+
+    /**
+     * Let only the first n workers run checks. The others finish the batch
+     * they are running and park, without taking any more work, until this
+     * is called again with a larger n.
+     */
+    void SetActiveWorkers(int n)
+    {
+        assert(n >= 0);
+        {
+            boost::lock_guard<boost::mutex> lock(mutex);
+            nActive = n;
+        }
+        condWorker.notify_all();
+        condParked.notify_all();
+    }
+
+    //! Record that nBatches batches of checks are waiting to be run.
+    void NoteBacklog(unsigned int nBatches)
+    {
+        unsigned int nPeak = nPeakBacklog.load();
+        while (nBatches > nPeak && !nPeakBacklog.compare_exchange_weak(nPeak, nBatches)) {}
+    }
+
+    //! The most batches of checks that waited at once since the last call.
+    unsigned int TakePeakBacklog()
+    {
+        return nPeakBacklog.exchange(0);
+    }
+
+    //! Worker thread
+    void Thread()
+    {
+        int nWorker = ++nWorkers;
+        int nNext = 0;
+        while (true) {
+            if (nWorker > nActive.load()) {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                while (nWorker > nActive.load())
+                    condParked.wait(lock);
+                continue;
+            }
+
+            uint64_t nSeen = nSignal.load();
+            int n = nQueues.load();
+            bool fWorked = false;
+            for (int i = 0; i < n; i++) {
+                fWorked |= queues[(nNext + i) % n].load()->RunBatch(nWorker);
+            }
+            // Start from the next queue each round, so that one busy queue
+            // doesn't starve the others.
+            nNext = (nNext + 1) % std::max(n, 1);
+            if (fWorked)
+                continue;
+
+            boost::unique_lock<boost::mutex> lock(mutex);
+            nSleeping++;
+            try {
+                while (nSignal.load() == nSeen && nWorker <= nActive.load())
+                    condWorker.wait(lock);
+            } catch (...) {
+                nSleeping--;
+                throw;
+            }
+            nSleeping--;
+        }
+    }
+
+    //! Wake up workers for nChecks new checks.
+    void Notify(size_t nChecks)
+    {
+        nSignal++;
+        if (nSleeping.load() == 0)
+            return;
+        // A worker that counted itself as sleeping holds the mutex until it
+        // waits, so taking it here ensures the notification isn't lost.
+        {
+            boost::lock_guard<boost::mutex> lock(mutex);
+        }
+        if (nChecks == 1)
+            condWorker.notify_one();
+        else
+            condWorker.notify_all();
+    }
+};
+
+/**
  * Queue for verifications that have to be performed.
   * The verifications are represented by a type T, which must provide an
   * operator(), returning a bool.
   *
   * One thread (the master) is assumed to push batches of verifications
-  * onto the queue, where they are processed by N-1 worker threads. When
-  * the master is done adding work, it temporarily joins the worker pool
-  * as an N'th worker, until all jobs are done.
+  * onto the queue, where they are processed by the workers of a CCheckPool.
+  * Each worker has its own deque of checks, which the master fills in turn,
+  * and steals from the others when it runs out. When the master is done
+  * adding work, it joins in on its own deque and by stealing, until all
+  * jobs are done.
   */
 template <typename T>
-class CCheckQueue
+class CCheckQueue : public CCheckQueueBase
 {
 private:
-    //! Mutex to protect the inner state
-    boost::mutex mutex;
+    /** The checks handed to one worker, padded to a cache line of its own. */
+    struct alignas(64) CheckDeque
+    {
+        boost::mutex mutex;
+        //! As the order of booleans doesn't matter, it is used as a LIFO (stack)
+        std::vector<T> checks;
+    };
 
-    //! Worker threads block on this when out of work
-    boost::condition_variable condWorker;
+    //! The pool created for this queue, if it was not given one.
+    std::unique_ptr<CCheckPool> poolOwned;
 
-    //! Master thread blocks on this when out of work
-    boost::condition_variable condMaster;
+    //! The pool whose workers run the checks.
+    CCheckPool* const pool;
 
-    //! The queue of elements to be processed.
-    //! As the order of booleans doesn't matter, it is used as a LIFO (stack)
-    std::vector<T> queue;
+    //! Deque 0 is the master's, the others are the workers'.
+    std::unique_ptr<CheckDeque[]> deques;
 
-    //! The number of workers (including the master) that are idle.
-    int nIdle;
+    //! The deque that the next call to Add fills. Only used by the master.
+    unsigned int nNextDeque;
 
-    //! The total number of workers (including the master).
-    int nTotal;
+    //! Mutex and condition variable on which the master waits for the checks
+    //! still being run by workers
+    boost::mutex mutex;
+    boost::condition_variable condMaster;
 
     //! The temporary evaluation result.
-    bool fAllOk;
+    std::atomic<bool> fAllOk;
 
     /**
      * Number of verifications that haven't completed yet.
      * This includes elements that are no longer queued, but still in the
      * worker's own batches.
      */
-    unsigned int nTodo;
-
-    //! Whether we're shutting down.
-    bool fQuit;
+    std::atomic<unsigned int> nTodo;
 
     //! The maximum number of elements to be processed in one batch
     unsigned int nBatchSize;
 
-    /** Internal function that does bulk of the verification work. */
-    bool Loop(bool fMaster = false)
+    int DequeOf(int nWorker) const
     {
-        boost::condition_variable& cond = fMaster ? condMaster : condWorker;
-        std::vector<T> vChecks;
-        vChecks.reserve(nBatchSize);
-        unsigned int nNow = 0;
-        bool fOk = true;
-        do {
-            {
-                boost::unique_lock<boost::mutex> lock(mutex);
-                // first do the clean-up of the previous loop run (allowing us to do it in the same critsect)
-                if (nNow) {
-                    fAllOk &= fOk;
-                    nTodo -= nNow;
-                    if (nTodo == 0 && !fMaster)
-                        // We processed the last element; inform the master it can exit and return the result
-                        condMaster.notify_one();
-                } else {
-                    // first iteration
-                    nTotal++;
-                }
-                // logically, the do loop starts here
-                while (queue.empty()) {
-                    if ((fMaster || fQuit) && nTodo == 0) {
-                        nTotal--;
-                        bool fRet = fAllOk;
-                        // reset the status for new work later
-                        if (fMaster)
-                            fAllOk = true;
-                        // return the current status
-                        return fRet;
-                    }
-                    nIdle++;
-                    cond.wait(lock); // wait
-                    nIdle--;
-                }
-                // Decide how many work units to process now.
-                // * Do not try to do everything at once, but aim for increasingly smaller batches so
-                //   all workers finish approximately simultaneously.
-                // * Try to account for idle jobs which will instantly start helping.
-                // * Don't do batches smaller than 1 (duh), or larger than nBatchSize.
-                nNow = std::max(1U, std::min(nBatchSize, (unsigned int)queue.size() / (nTotal + nIdle + 1)));
-                vChecks.resize(nNow);
-                for (unsigned int i = 0; i < nNow; i++) {
-                    // We want the lock on the mutex to be as short as possible, so swap jobs from the global
-                    // queue to the local batch vector instead of copying.
-                    vChecks[i].swap(queue.back());
-                    queue.pop_back();
-                }
-                // Check whether we need to do work at all
-                fOk = fAllOk;
-            }
-            // execute work
-            for (T& check : vChecks)
-                if (fOk)
-                    fOk = check();
-            vChecks.clear();
-        } while (true);
+        return nWorker == 0 ? 0 : 1 + (nWorker - 1) % (CHECK_QUEUE_DEQUES - 1);
+    }
+
+    //! The number of deques that may hold checks.
+    int ActiveDeques() const
+    {
+        return 1 + std::min(pool->NumWorkers(), CHECK_QUEUE_DEQUES - 1);
+    }
+
+    //! The number of deques that new checks are dealt out to: the master's,
+    //! and those of the workers that are not parked.
+    int DealtDeques() const
+    {
+        return 1 + std::min(pool->NumActiveWorkers(), CHECK_QUEUE_DEQUES - 1);
+    }
+
+    /**
+     * Move a batch of checks from deque nDeque into vChecks. A thief takes at
+     * most half of what is left, so that the owner still has work too.
+     */
+    bool Take(int nDeque, std::vector<T>& vChecks, bool fSteal)
+    {
+        CheckDeque& deque = deques[nDeque];
+        boost::unique_lock<boost::mutex> lock(deque.mutex);
+        size_t nSize = deque.checks.size();
+        if (nSize == 0)
+            return false;
+        size_t nNow = std::min((size_t)nBatchSize, fSteal ? (nSize + 1) / 2 : nSize);
+        for (size_t i = 0; i < nNow; i++) {
+            // Swap jobs out of the deque instead of copying them.
+            vChecks.emplace_back();
+            vChecks.back().swap(deque.checks.back());
+            deque.checks.pop_back();
+        }
+        return true;
+    }
+
+    bool TakeOrSteal(int nDeque, std::vector<T>& vChecks)
+    {
+        if (Take(nDeque, vChecks, false))
+            return true;
+        int nDeques = ActiveDeques();
+        for (int i = 1; i < nDeques; i++) {
+            if (Take((nDeque + i) % nDeques, vChecks, true))
+                return true;
+        }
+        return false;
+    }
+
+    /** Run a batch of checks, skipping them if one has already failed. */
+    void Run(std::vector<T>& vChecks)
+    {
+        bool fOk = fAllOk;
+        for (T& check : vChecks)
+            if (fOk)
+                fOk = check();
+        if (!fOk)
+            fAllOk = false;
+        unsigned int nNow = vChecks.size();
+        // Only count the checks as done once they are destroyed, so that the
+        // master can't return while they still hold resources.
+        vChecks.clear();
+        if (nTodo.fetch_sub(nNow) == nNow) {
+            // We processed the last element; inform the master it can exit and return the result
+            boost::lock_guard<boost::mutex> lock(mutex);
+            condMaster.notify_one();
+        }
     }
 
 public:
     //! Mutex to ensure only one concurrent CCheckQueueControl
     boost::mutex ControlMutex;
 
-    //! Create a new check queue
-    CCheckQueue(unsigned int nBatchSizeIn) : nIdle(0), nTotal(0), fAllOk(true), nTodo(0), fQuit(false), nBatchSize(nBatchSizeIn) {}
+    //! Create a new check queue, run by the workers of pool, or of a pool of its own.
+    CCheckQueue(unsigned int nBatchSizeIn, CCheckPool* poolIn = nullptr) :
+        poolOwned(poolIn ? nullptr : new CCheckPool()),
+        pool(poolIn ? poolIn : poolOwned.get()),
+        deques(new CheckDeque[CHECK_QUEUE_DEQUES]),
+        nNextDeque(0), fAllOk(true), nTodo(0), nBatchSize(nBatchSizeIn)
+    {
+        pool->Attach(this);
+    }
 
     //! Worker thread
     void Thread()
     {
-        Loop();
+        pool->Thread();
+    }
+
+    bool RunBatch(int nWorker) override
+    {
+        if (nTodo.load() == 0)
+            return false;
+        static thread_local std::vector<T> vChecks;
+        if (!TakeOrSteal(DequeOf(nWorker), vChecks))
+            return false;
+        Run(vChecks);
+        return true;
     }
 
     //! Wait until execution finishes, and return whether all evaluations were successful.
     bool Wait()
     {
-        return Loop(true);
+        std::vector<T> vChecks;
+        vChecks.reserve(nBatchSize);
+        while (TakeOrSteal(0, vChecks))
+            Run(vChecks);
+        {
+            // Only the master adds checks, so all that is left is what the
+            // workers are running.
+            boost::unique_lock<boost::mutex> lock(mutex);
+            while (nTodo.load() != 0)
+                condMaster.wait(lock);
+        }
+        bool fRet = fAllOk;
+        // reset the status for new work later
+        fAllOk = true;
+        return fRet;
     }
 
     //! Add a batch of checks to the queue
     void Add(std::vector<T>& vChecks)
     {
-        boost::unique_lock<boost::mutex> lock(mutex);
-        for (T& check : vChecks) {
-            queue.push_back(T());
-            check.swap(queue.back());
+        if (vChecks.empty())
+            return;
+        unsigned int nNow = (nTodo += vChecks.size());
+        pool->NoteBacklog((nNow + nBatchSize - 1) / nBatchSize);
+        // Deal the checks out to the active workers' deques in batches, or
+        // keep them for the master if there are none.
+        int nWorkerDeques = DealtDeques() - 1;
+        for (size_t nStart = 0; nStart < vChecks.size(); nStart += nBatchSize) {
+            size_t nEnd = std::min(vChecks.size(), nStart + nBatchSize);
+            int nDeque = 0;
+            if (nWorkerDeques > 0) {
+                nDeque = 1 + nNextDeque % nWorkerDeques;
+                nNextDeque = (nNextDeque + 1) % nWorkerDeques;
+            }
+            CheckDeque& deque = deques[nDeque];
+            boost::lock_guard<boost::mutex> lock(deque.mutex);
+            for (size_t i = nStart; i < nEnd; i++) {
+                deque.checks.emplace_back();
+                deque.checks.back().swap(vChecks[i]);
+            }
         }
-        nTodo += vChecks.size();
-        if (vChecks.size() == 1)
-            condWorker.notify_one();
-        else if (vChecks.size() > 1)
-            condWorker.notify_all();
+        pool->Notify(vChecks.size());
     }
 
     ~CCheckQueue()
@@ -4,51 +4,66 @@
 
 #include "coins.h"
 
+#include "clientversion.h"
 #include "memusage.h"
 #include "random.h"
+#include "streams.h"
 #include "version.h"
 #include "policy/fees.h"
+#include "consensus/consensus.h"
 
 #include <assert.h>
+#include <functional>
+#include <limits>
+#include <set>
 
 #include <tracing.h>
 
-/**
- * calculate number of bytes for the bitmask, and its number of non-zero bytes
- * each bit in the bitmask represents the availability of one output, but the
- * availabilities of the first two outputs are encoded separately
- */
-void CCoins::CalcMaskSize(unsigned int &nBytes, unsigned int &nNonzeroBytes) const {
-    unsigned int nLastUsedByte = 0;
-    for (unsigned int b = 0; 2+b*8 < vout.size(); b++) {
-        bool fZero = true;
-        for (unsigned int i = 0; i < 8 && 2+b*8+i < vout.size(); i++) {
-            if (!vout[2+b*8+i].IsNull()) {
-                fZero = false;
-                continue;
-            }
-        }
-        if (!fZero) {
-            nLastUsedByte = b + 1;
-            nNonzeroBytes++;
-        }
-    }
-    nBytes += nLastUsedByte;
+/** The serialization of a coin that is hashed into CCoinsStats::muhash. */
+static CDataStream SerializeCoinForStats(const COutPoint &outpoint, const Coin &coin)
+{
+    CDataStream ss(SER_DISK, PROTOCOL_VERSION);
+    ss << outpoint;
+    ss << (uint32_t)((coin.nHeight << 1) + coin.fCoinBase);
+    ss << coin.out;
+    return ss;
 }
 
-bool CCoins::Spend(uint32_t nPos) 
-{
-    if (nPos >= vout.size() || vout[nPos].IsNull())
-        return false;
-    vout[nPos].SetNull();
-    Cleanup();
-    return true;
+void CCoinsStats::AddCoin(const COutPoint &outpoint, const Coin &coin) {
+    CDataStream ss = SerializeCoinForStats(outpoint, coin);
+    muhash.Insert((const unsigned char*)&ss[0], ss.size());
+    nTransactionOutputs++;
+    nSerializedSize += 32 + ::GetSerializeSize(coin, SER_DISK, CLIENT_VERSION);
+    nTotalAmount += coin.out.nValue;
+}
+
+void CCoinsStats::RemoveCoin(const COutPoint &outpoint, const Coin &coin) {
+    CDataStream ss = SerializeCoinForStats(outpoint, coin);
+    muhash.Remove((const unsigned char*)&ss[0], ss.size());
+    nTransactionOutputs--;
+    nSerializedSize -= 32 + ::GetSerializeSize(coin, SER_DISK, CLIENT_VERSION);
+    nTotalAmount -= coin.out.nValue;
 }
+
+uint256 CCoinsStats::GetMuHash() const {
+    MuHash3072 tmp = muhash;
+    uint256 hash;
+    tmp.Finalize(hash.begin());
+    return hash;
+}
+
 bool CCoinsView::GetSproutAnchorAt(const uint256 &rt, SproutMerkleTree &tree) const { return false; }
 bool CCoinsView::GetSaplingAnchorAt(const uint256 &rt, SaplingMerkleTree &tree) const { return false; }
+bool CCoinsView::HaveSaplingAnchor(const uint256 &rt) const {
+    SaplingMerkleTree tree;
+    return GetSaplingAnchorAt(rt, tree);
+}
 bool CCoinsView::GetNullifier(const uint256 &nullifier, ShieldedType type) const { return false; }
-bool CCoinsView::GetCoins(const uint256 &txid, CCoins &coins) const { return false; }
-bool CCoinsView::HaveCoins(const uint256 &txid) const { return false; }
+bool CCoinsView::GetCoin(const COutPoint &outpoint, Coin &coin) const { return false; }
+bool CCoinsView::HaveCoin(const COutPoint &outpoint) const {
+    Coin coin;
+    return GetCoin(outpoint, coin);
+}
 uint256 CCoinsView::GetBestBlock() const { return uint256(); }
 uint256 CCoinsView::GetBestAnchor(ShieldedType type) const { return uint256(); };
 HistoryIndex CCoinsView::GetHistoryLength(uint32_t epochId) const { return 0; }
@@ -63,7 +78,8 @@ bool CCoinsView::BatchWrite(CCoinsMap &mapCoins,
                             CAnchorsSaplingMap &mapSaplingAnchors,
                             CNullifiersMap &mapSproutNullifiers,
                             CNullifiersMap &mapSaplingNullifiers,
-                            CHistoryCacheMap &historyCacheMap) { return false; }
+                            CHistoryCacheMap &historyCacheMap,
+                            bool fErase) { return false; }
 bool CCoinsView::GetStats(CCoinsStats &stats) const { return false; }
 
 
@@ -71,9 +87,10 @@ CCoinsViewBacked::CCoinsViewBacked(CCoinsView *viewIn) : base(viewIn) { }
 
 bool CCoinsViewBacked::GetSproutAnchorAt(const uint256 &rt, SproutMerkleTree &tree) const { return base->GetSproutAnchorAt(rt, tree); }
 bool CCoinsViewBacked::GetSaplingAnchorAt(const uint256 &rt, SaplingMerkleTree &tree) const { return base->GetSaplingAnchorAt(rt, tree); }
+bool CCoinsViewBacked::HaveSaplingAnchor(const uint256 &rt) const { return base->HaveSaplingAnchor(rt); }
 bool CCoinsViewBacked::GetNullifier(const uint256 &nullifier, ShieldedType type) const { return base->GetNullifier(nullifier, type); }
-bool CCoinsViewBacked::GetCoins(const uint256 &txid, CCoins &coins) const { return base->GetCoins(txid, coins); }
-bool CCoinsViewBacked::HaveCoins(const uint256 &txid) const { return base->HaveCoins(txid); }
+bool CCoinsViewBacked::GetCoin(const COutPoint &outpoint, Coin &coin) const { return base->GetCoin(outpoint, coin); }
+bool CCoinsViewBacked::HaveCoin(const COutPoint &outpoint) const { return base->HaveCoin(outpoint); }
 uint256 CCoinsViewBacked::GetBestBlock() const { return base->GetBestBlock(); }
 uint256 CCoinsViewBacked::GetBestAnchor(ShieldedType type) const { return base->GetBestAnchor(type); }
 HistoryIndex CCoinsViewBacked::GetHistoryLength(uint32_t epochId) const { return base->GetHistoryLength(epochId); }
@@ -88,24 +105,74 @@ bool CCoinsViewBacked::BatchWrite(CCoinsMap &mapCoins,
                                   CAnchorsSaplingMap &mapSaplingAnchors,
                                   CNullifiersMap &mapSproutNullifiers,
                                   CNullifiersMap &mapSaplingNullifiers,
-                                  CHistoryCacheMap &historyCacheMap) {
+                                  CHistoryCacheMap &historyCacheMap,
+                                  bool fErase) {
     return base->BatchWrite(mapCoins, hashBlock, hashSproutAnchor, hashSaplingAnchor,
                             mapSproutAnchors, mapSaplingAnchors, mapSproutNullifiers, mapSaplingNullifiers,
-                            historyCacheMap);
+                            historyCacheMap, fErase);
 }
 bool CCoinsViewBacked::GetStats(CCoinsStats &stats) const { return base->GetStats(stats); }
 
 SaltedTxidHasher::SaltedTxidHasher() : k0(GetRand(std::numeric_limits<uint64_t>::max())), k1(GetRand(std::numeric_limits<uint64_t>::max())) {}
 
-CCoinsViewCache::CCoinsViewCache(CCoinsView *baseIn) : CCoinsViewBacked(baseIn), hasModifier(false), cachedCoinsUsage(0) { }
+SaltedOutpointHasher::SaltedOutpointHasher() : k0(GetRand(std::numeric_limits<uint64_t>::max())), k1(GetRand(std::numeric_limits<uint64_t>::max())) {}
+
+bool CRecentAnchors::contains(const uint256 &rt)
+{
+    auto it = index.find(rt);
+    if (it == index.end()) {
+        return false;
+    }
+    roots.splice(roots.begin(), roots, it->second);
+    return true;
+}
+
+void CRecentAnchors::insert(const uint256 &rt)
+{
+    if (contains(rt)) {
+        return;
+    }
+    if (roots.size() >= nMaxSize) {
+        index.erase(roots.back());
+        roots.pop_back();
+    }
+    roots.push_front(rt);
+    index.emplace(rt, roots.begin());
+}
+
+void CRecentAnchors::erase(const uint256 &rt)
+{
+    auto it = index.find(rt);
+    if (it != index.end()) {
+        roots.erase(it->second);
+        index.erase(it);
+    }
+}
 
-CCoinsViewCache::~CCoinsViewCache()
+void CRecentAnchors::clear()
 {
-    assert(!hasModifier);
+    roots.clear();
+    index.clear();
 }
 
+CCoinsViewCache::CCoinsViewCache(CCoinsView *baseIn) :
+    CCoinsViewCache(baseIn, COINS_CACHE_POOL_CHUNK_BYTES) { }
+
+CCoinsViewCache::CCoinsViewCache(CCoinsView *baseIn, size_t nPoolChunkBytesIn) : CCoinsViewBacked(baseIn),
+    nPoolChunkBytes(nPoolChunkBytesIn),
+    cacheMemoryResource(nPoolChunkBytesIn),
+    cacheCoins(0, SaltedOutpointHasher(), std::equal_to<COutPoint>(), &cacheMemoryResource),
+    cacheSproutAnchors(0, SaltedTxidHasher(), std::equal_to<uint256>(), &cacheMemoryResource),
+    cacheSaplingAnchors(0, SaltedTxidHasher(), std::equal_to<uint256>(), &cacheMemoryResource),
+    cacheSproutNullifiers(0, SaltedTxidHasher(), std::equal_to<uint256>(), &cacheMemoryResource),
+    cacheSaplingNullifiers(0, SaltedTxidHasher(), std::equal_to<uint256>(), &cacheMemoryResource),
+    cachedCoinsUsage(0), nCacheHits(0), nCacheMisses(0) { }
+
+CCoinsViewCache::~CCoinsViewCache() { }
+
 size_t CCoinsViewCache::DynamicMemoryUsage() const {
-    return memusage::DynamicUsage(cacheCoins) +
+    return memusage::DynamicUsage(cacheMemoryResource) +
+           memusage::DynamicUsage(cacheCoins) +
            memusage::DynamicUsage(cacheSproutAnchors) +
            memusage::DynamicUsage(cacheSaplingAnchors) +
            memusage::DynamicUsage(cacheSproutNullifiers) +
@@ -114,21 +181,23 @@ size_t CCoinsViewCache::DynamicMemoryUsage() const {
            cachedCoinsUsage;
 }
 
-CCoinsMap::const_iterator CCoinsViewCache::FetchCoins(const uint256 &txid) const {
-    CCoinsMap::iterator it = cacheCoins.find(txid);
-    if (it != cacheCoins.end())
+CCoinsMap::iterator CCoinsViewCache::FetchCoin(const COutPoint &outpoint) const {
+    CCoinsMap::iterator it = cacheCoins.find(outpoint);
+    if (it != cacheCoins.end()) {
+        nCacheHits++;
         return it;
-    CCoins tmp;
-    if (!base->GetCoins(txid, tmp))
+    }
+    nCacheMisses++;
+    Coin tmp;
+    if (!base->GetCoin(outpoint, tmp))
         return cacheCoins.end();
-    CCoinsMap::iterator ret = cacheCoins.insert(std::make_pair(txid, CCoinsCacheEntry())).first;
-    tmp.swap(ret->second.coins);
-    if (ret->second.coins.IsPruned()) {
-        // The parent only has an empty entry for this txid; we can consider our
+    CCoinsMap::iterator ret = cacheCoins.emplace(std::piecewise_construct, std::forward_as_tuple(outpoint), std::forward_as_tuple(std::move(tmp))).first;
+    if (ret->second.coin.IsSpent()) {
+        // The parent only has an empty entry for this outpoint; we can consider our
         // version as fresh.
         ret->second.flags = CCoinsCacheEntry::FRESH;
     }
-    cachedCoinsUsage += ret->second.coins.DynamicMemoryUsage();
+    cachedCoinsUsage += ret->second.coin.DynamicMemoryUsage();
     return ret;
 }
 
@@ -179,6 +248,25 @@ bool CCoinsViewCache::GetSaplingAnchorAt(const uint256 &rt, SaplingMerkleTree &t
     return true;
 }
 
+bool CCoinsViewCache::HaveSaplingAnchor(const uint256 &rt) const {
+    // An entry in the map also records anchors that this view has popped.
+    CAnchorsSaplingMap::const_iterator it = cacheSaplingAnchors.find(rt);
+    if (it != cacheSaplingAnchors.end()) {
+        return it->second.entered;
+    }
+
+    if (recentSaplingAnchors.contains(rt)) {
+        return true;
+    }
+
+    if (!base->HaveSaplingAnchor(rt)) {
+        return false;
+    }
+
+    recentSaplingAnchors.insert(rt);
+    return true;
+}
+
 bool CCoinsViewCache::GetNullifier(const uint256 &nullifier, ShieldedType type) const {
     CNullifiersMap* cacheToUse;
     switch (type) {
@@ -222,7 +310,20 @@ HistoryNode CCoinsViewCache::GetHistoryAt(uint32_t epochId, HistoryIndex index)
         return historyCache.appends[index];
     }
 
-    return base->GetHistoryAt(epochId, index);
+    // Nodes below updateDepth are the same as in the base view.
+    auto peaks = historyPeaks.find(epochId);
+    if (peaks != historyPeaks.end()) {
+        auto it = peaks->second.nodes.find(index);
+        if (it != peaks->second.nodes.end()) {
+            return it->second;
+        }
+    }
+
+    HistoryNode node = base->GetHistoryAt(epochId, index);
+    if (peaks != historyPeaks.end()) {
+        peaks->second.nodes.emplace(index, node);
+    }
+    return node;
 }
 
 uint256 CCoinsViewCache::GetHistoryRoot(uint32_t epochId) const {
@@ -281,6 +382,7 @@ template<> void CCoinsViewCache::PushAnchor(const SaplingMerkleTree &tree)
         cacheSaplingAnchors,
         hashSaplingAnchor
     );
+    recentSaplingAnchors.insert(hashSaplingAnchor);
 }
 
 template<>
@@ -331,14 +433,13 @@ static inline uint32_t altitude(uint32_t n) {
     return floor_log2(n + 1) - 1;
 }
 
-uint32_t CCoinsViewCache::PreloadHistoryTree(uint32_t epochId, bool extra, std::vector<HistoryEntry> &entries, std::vector<uint32_t> &entry_indices) {
-    auto treeLength = GetHistoryLength(epochId);
-
-    if (treeLength <= 0) {
-        throw std::runtime_error("Invalid PreloadHistoryTree state called - tree should exist");
-    } else if (treeLength == 1) {
-        entries.push_back(libzcash::LeafToEntry(GetHistoryAt(epochId, 0)));
-        entry_indices.push_back(0);
+// Collects the positions and altitudes of the peaks of a non-empty history
+// tree with treeLength nodes and, if extra is set, of the nodes below its last
+// peak that a deletion also needs. Returns the number of peaks.
+static uint32_t HistoryTreeNodes(uint32_t treeLength, bool extra, std::vector<std::pair<uint32_t, uint32_t>> &nodes) {
+    assert(treeLength > 0);
+    if (treeLength == 1) {
+        nodes.emplace_back(0, 0);
         return 1;
     }
 
@@ -397,7 +498,7 @@ uint32_t CCoinsViewCache::PreloadHistoryTree(uint32_t epochId, bool extra, std::
 
         // If the peak exists, we take it and then continue with its right sibling.
         if (peak_pos < treeLength) {
-            draftMMRNode(entry_indices, entries, GetHistoryAt(epochId, peak_pos), alt, peak_pos);
+            nodes.emplace_back(peak_pos, alt);
 
             last_peak_pos = peak_pos;
             last_peak_alt = alt;
@@ -407,7 +508,7 @@ uint32_t CCoinsViewCache::PreloadHistoryTree(uint32_t epochId, bool extra, std::
         }
     }
 
-    total_peaks = entries.size();
+    total_peaks = nodes.size();
 
     // Return early if we don't require extra nodes.
     if (!extra) return total_peaks;
@@ -435,10 +536,10 @@ uint32_t CCoinsViewCache::PreloadHistoryTree(uint32_t epochId, bool extra, std::
         alt = alt - 1;
 
         // drafting left child
-        draftMMRNode(entry_indices, entries, GetHistoryAt(epochId, left_pos), alt, left_pos);
+        nodes.emplace_back(left_pos, alt);
 
         // drafting right child
-        draftMMRNode(entry_indices, entries, GetHistoryAt(epochId, right_pos), alt, right_pos);
+        nodes.emplace_back(right_pos, alt);
 
         // continuing on right slope
         peak_pos = right_pos;
@@ -447,21 +548,76 @@ uint32_t CCoinsViewCache::PreloadHistoryTree(uint32_t epochId, bool extra, std::
     return total_peaks;
 }
 
+uint32_t CCoinsViewCache::PreloadHistoryTree(uint32_t epochId, bool extra, std::vector<HistoryEntry> &entries, std::vector<uint32_t> &entry_indices) {
+    auto treeLength = GetHistoryLength(epochId);
+
+    if (treeLength <= 0) {
+        throw std::runtime_error("Invalid PreloadHistoryTree state called - tree should exist");
+    }
+
+    std::vector<std::pair<uint32_t, uint32_t>> nodes;
+    uint32_t total_peaks = HistoryTreeNodes(treeLength, extra, nodes);
+    for (const auto& node : nodes) {
+        draftMMRNode(entry_indices, entries, GetHistoryAt(epochId, node.first), node.second, node.first);
+    }
+
+    return total_peaks;
+}
+
 HistoryCache& CCoinsViewCache::SelectHistoryCache(uint32_t epochId) const {
     auto entry = historyCacheMap.find(epochId);
 
     if (entry != historyCacheMap.end()) {
         return entry->second;
     } else {
+        // Without a history cache, any peaks we kept describe the base view.
+        auto peaks = historyPeaks.find(epochId);
+        if (peaks == historyPeaks.end()) {
+            CHistoryPeaks newPeaks;
+            newPeaks.length = base->GetHistoryLength(epochId);
+            newPeaks.root = base->GetHistoryRoot(epochId);
+            peaks = historyPeaks.insert({epochId, newPeaks}).first;
+        }
         auto cache = HistoryCache(
-            base->GetHistoryLength(epochId),
-            base->GetHistoryRoot(epochId),
+            peaks->second.length,
+            peaks->second.root,
             epochId
         );
         return historyCacheMap.insert({epochId, cache}).first->second;
     }
 }
 
+void CCoinsViewCache::UpdateHistoryPeaks(uint32_t epochId, const HistoryCache &historyCache) {
+    CHistoryPeaks& peaks = historyPeaks[epochId];
+    std::map<HistoryIndex, HistoryNode> nodes;
+
+    if (historyCache.length > 0) {
+        std::vector<std::pair<uint32_t, uint32_t>> positions;
+        HistoryTreeNodes(historyCache.length, true, positions);
+        for (const auto& pos : positions) {
+            if (pos.first >= historyCache.updateDepth) {
+                nodes.emplace(pos.first, historyCache.appends.at(pos.first));
+            } else {
+                // Nodes that we have not read yet are read when needed.
+                auto it = peaks.nodes.find(pos.first);
+                if (it != peaks.nodes.end()) {
+                    nodes.insert(*it);
+                }
+            }
+        }
+    }
+
+    peaks.length = historyCache.length;
+    peaks.root = historyCache.root;
+    peaks.nodes = std::move(nodes);
+}
+
+void CCoinsViewCache::UpdateAllHistoryPeaks() {
+    for (const auto& entry : historyCacheMap) {
+        UpdateHistoryPeaks(entry.first, entry.second);
+    }
+}
+
 void CCoinsViewCache::PushHistoryNode(uint32_t epochId, const HistoryNode node) {
     HistoryCache& historyCache = SelectHistoryCache(epochId);
 
@@ -619,13 +775,19 @@ void CCoinsViewCache::PopAnchor(const uint256 &newrt, ShieldedType type) {
             );
             break;
         case SAPLING:
+        {
+            uint256 currentRoot = GetBestAnchor(SAPLING);
             AbstractPopAnchor<SaplingMerkleTree, CAnchorsSaplingMap, CAnchorsSaplingCacheEntry>(
                 newrt,
                 SAPLING,
                 cacheSaplingAnchors,
                 hashSaplingAnchor
             );
+            if (currentRoot != newrt) {
+                recentSaplingAnchors.erase(currentRoot);
+            }
             break;
+        }
         default:
             throw std::runtime_error("Unknown shielded type");
     }
@@ -646,61 +808,209 @@ void CCoinsViewCache::SetNullifiers(const CTransaction& tx, bool spent) {
     }
 }
 
-bool CCoinsViewCache::GetCoins(const uint256 &txid, CCoins &coins) const {
-    CCoinsMap::const_iterator it = FetchCoins(txid);
+bool CCoinsViewCache::GetCoin(const COutPoint &outpoint, Coin &coin) const {
+    CCoinsMap::const_iterator it = FetchCoin(outpoint);
     if (it != cacheCoins.end()) {
-        coins = it->second.coins;
-        return true;
+        coin = it->second.coin;
+        return !coin.IsSpent();
     }
     return false;
 }
 
-CCoinsModifier CCoinsViewCache::ModifyCoins(const uint256 &txid) {
-    assert(!hasModifier);
-    std::pair<CCoinsMap::iterator, bool> ret = cacheCoins.insert(std::make_pair(txid, CCoinsCacheEntry()));
-    size_t cachedCoinUsage = 0;
-    if (ret.second) {
-        if (!base->GetCoins(txid, ret.first->second.coins)) {
-            // The parent view does not have this entry; mark it as fresh.
-            ret.first->second.coins.Clear();
-            ret.first->second.flags = CCoinsCacheEntry::FRESH;
-        } else if (ret.first->second.coins.IsPruned()) {
-            // The parent view only has a pruned entry for this; mark it as fresh.
-            ret.first->second.flags = CCoinsCacheEntry::FRESH;
+void CCoinsViewCache::AddCoin(const COutPoint &outpoint, Coin&& coin, bool possible_overwrite) {
+    assert(!coin.IsSpent());
+    if (coin.out.scriptPubKey.IsUnspendable()) return;
+    CCoinsMap::iterator it;
+    bool inserted;
+    std::tie(it, inserted) = cacheCoins.emplace(std::piecewise_construct, std::forward_as_tuple(outpoint), std::tuple<>());
+    bool fresh = false;
+    if (!inserted) {
+        cachedCoinsUsage -= it->second.coin.DynamicMemoryUsage();
+    }
+    if (!possible_overwrite) {
+        if (!it->second.coin.IsSpent()) {
+            throw std::logic_error("Adding new coin that replaces non-pruned entry");
         }
-    } else {
-        cachedCoinUsage = ret.first->second.coins.DynamicMemoryUsage();
+        fresh = !(it->second.flags & CCoinsCacheEntry::DIRTY);
     }
-    // Assume that whenever ModifyCoins is called, the entry will be modified.
-    ret.first->second.flags |= CCoinsCacheEntry::DIRTY;
-    return CCoinsModifier(*this, ret.first, cachedCoinUsage);
+    it->second.coin = std::move(coin);
+    it->second.flags |= CCoinsCacheEntry::DIRTY | (fresh ? CCoinsCacheEntry::FRESH : 0);
+    cachedCoinsUsage += it->second.coin.DynamicMemoryUsage();
 }
 
-CCoinsModifier CCoinsViewCache::ModifyNewCoins(const uint256 &txid) {
-    assert(!hasModifier);
-    std::pair<CCoinsMap::iterator, bool> ret = cacheCoins.insert(std::make_pair(txid, CCoinsCacheEntry()));
-    ret.first->second.coins.Clear();
-    ret.first->second.flags = CCoinsCacheEntry::FRESH;
-    ret.first->second.flags |= CCoinsCacheEntry::DIRTY;
-    return CCoinsModifier(*this, ret.first, 0);
+void AddCoins(CCoinsViewCache& cache, const CTransaction &tx, int nHeight, bool check) {
+    bool fCoinbase = tx.IsCoinBase();
+    const uint256& txid = tx.GetHash();
+    for (size_t i = 0; i < tx.vout.size(); ++i) {
+        bool overwrite = check ? cache.HaveCoin(COutPoint(txid, i)) : fCoinbase;
+        // Always set the possible_overwrite flag to AddCoin for coinbase txn, in order to correctly
+        // deal with the pre-BIP30 occurrences of duplicate coinbase transactions.
+        cache.AddCoin(COutPoint(txid, i), Coin(tx.vout[i], nHeight, fCoinbase), overwrite);
+    }
 }
 
-const CCoins* CCoinsViewCache::AccessCoins(const uint256 &txid) const {
-    CCoinsMap::const_iterator it = FetchCoins(txid);
+bool CCoinsViewCache::SpendCoin(const COutPoint &outpoint, Coin* moveout) {
+    CCoinsMap::iterator it = FetchCoin(outpoint);
+    if (it == cacheCoins.end()) return false;
+    cachedCoinsUsage -= it->second.coin.DynamicMemoryUsage();
+    if (moveout) {
+        *moveout = std::move(it->second.coin);
+    }
+    if (it->second.flags & CCoinsCacheEntry::FRESH) {
+        cacheCoins.erase(it);
+    } else {
+        it->second.flags |= CCoinsCacheEntry::DIRTY;
+        it->second.coin.Clear();
+    }
+    return true;
+}
+
+static const Coin coinEmpty;
+
+const Coin& CCoinsViewCache::AccessCoin(const COutPoint &outpoint) const {
+    CCoinsMap::const_iterator it = FetchCoin(outpoint);
     if (it == cacheCoins.end()) {
-        return NULL;
+        return coinEmpty;
     } else {
-        return &it->second.coins;
+        return it->second.coin;
     }
 }
 
-bool CCoinsViewCache::HaveCoins(const uint256 &txid) const {
-    CCoinsMap::const_iterator it = FetchCoins(txid);
-    // We're using vtx.empty() instead of IsPruned here for performance reasons,
-    // as we only care about the case where a transaction was replaced entirely
-    // in a reorganization (which wipes vout entirely, as opposed to spending
-    // which just cleans individual outputs).
-    return (it != cacheCoins.end() && !it->second.coins.vout.empty());
+bool CCoinsViewCache::HaveCoin(const COutPoint &outpoint) const {
+    CCoinsMap::const_iterator it = FetchCoin(outpoint);
+    return (it != cacheCoins.end() && !it->second.coin.IsSpent());
+}
+
+bool CCoinsViewCache::HaveCoinInCache(const COutPoint &outpoint) const {
+    CCoinsMap::const_iterator it = cacheCoins.find(outpoint);
+    return (it != cacheCoins.end() && !it->second.coin.IsSpent());
+}
+
+size_t CCoinsPrefetch::size() const {
+    return coins.size() + sproutAnchors.size() + saplingAnchors.size() +
+           sproutNullifiers.size() + saplingNullifiers.size();
+}
+
+void CCoinsPrefetch::Fetch(size_t i) {
+    if (i < coins.size()) {
+        coins[i].found = base->GetCoin(coins[i].key, coins[i].value);
+        return;
+    }
+    i -= coins.size();
+    if (i < sproutAnchors.size()) {
+        sproutAnchors[i].found = base->GetSproutAnchorAt(sproutAnchors[i].key, sproutAnchors[i].value);
+        return;
+    }
+    i -= sproutAnchors.size();
+    if (i < saplingAnchors.size()) {
+        saplingAnchors[i].value = base->HaveSaplingAnchor(saplingAnchors[i].key);
+        saplingAnchors[i].found = true;
+        return;
+    }
+    i -= saplingAnchors.size();
+    if (i < sproutNullifiers.size()) {
+        sproutNullifiers[i].value = base->GetNullifier(sproutNullifiers[i].key, SPROUT);
+        sproutNullifiers[i].found = true;
+        return;
+    }
+    i -= sproutNullifiers.size();
+    assert(i < saplingNullifiers.size());
+    saplingNullifiers[i].value = base->GetNullifier(saplingNullifiers[i].key, SAPLING);
+    saplingNullifiers[i].found = true;
+}
+
+CCoinsPrefetch CCoinsViewCache::GetPrefetch(const std::vector<CTransaction>& vtx) const {
+    CCoinsPrefetch prefetch(base);
+    std::set<uint256> txids;
+    std::set<COutPoint> outpoints;
+    std::set<uint256> sproutAnchors, saplingAnchors, sproutNullifiers, saplingNullifiers;
+    for (const CTransaction& tx : vtx) {
+        if (!tx.IsCoinBase()) {
+            for (const CTxIn& txin : tx.vin) {
+                if (!txids.count(txin.prevout.hash) && !cacheCoins.count(txin.prevout) &&
+                    outpoints.insert(txin.prevout).second) {
+                    prefetch.coins.emplace_back(txin.prevout);
+                }
+            }
+        }
+        for (const JSDescription& joinsplit : tx.vJoinSplit) {
+            // Anchors of intermediate trees in the same block are not found,
+            // and so are not cached.
+            if (!cacheSproutAnchors.count(joinsplit.anchor) && sproutAnchors.insert(joinsplit.anchor).second) {
+                prefetch.sproutAnchors.emplace_back(joinsplit.anchor);
+            }
+            for (const uint256& nullifier : joinsplit.nullifiers) {
+                if (!cacheSproutNullifiers.count(nullifier) && sproutNullifiers.insert(nullifier).second) {
+                    prefetch.sproutNullifiers.emplace_back(nullifier);
+                }
+            }
+        }
+        for (const SpendDescription& spend : tx.vShieldedSpend) {
+            if (!cacheSaplingAnchors.count(spend.anchor) && !recentSaplingAnchors.contains(spend.anchor) &&
+                saplingAnchors.insert(spend.anchor).second) {
+                prefetch.saplingAnchors.emplace_back(spend.anchor);
+            }
+            if (!cacheSaplingNullifiers.count(spend.nullifier) && saplingNullifiers.insert(spend.nullifier).second) {
+                prefetch.saplingNullifiers.emplace_back(spend.nullifier);
+            }
+        }
+        txids.insert(tx.GetHash());
+    }
+    return prefetch;
+}
+
+template<typename Map, typename MapEntry, typename Tree>
+static void AddPrefetchedAnchors(Map &cacheAnchors, std::vector<CCoinsPrefetch::Lookup<uint256, Tree>> &lookups, size_t &cachedCoinsUsage)
+{
+    for (auto& lookup : lookups) {
+        if (!lookup.found) {
+            continue;
+        }
+        auto ret = cacheAnchors.insert(std::make_pair(lookup.key, MapEntry()));
+        if (ret.second) {
+            ret.first->second.entered = true;
+            ret.first->second.tree = std::move(lookup.value);
+            cachedCoinsUsage += ret.first->second.tree.DynamicMemoryUsage();
+        }
+    }
+}
+
+static void AddPrefetchedNullifiers(CNullifiersMap &cacheNullifiers, std::vector<CCoinsPrefetch::Lookup<uint256, bool>> &lookups)
+{
+    for (const auto& lookup : lookups) {
+        if (!lookup.found) {
+            continue;
+        }
+        CNullifiersCacheEntry entry;
+        entry.entered = lookup.value;
+        cacheNullifiers.insert(std::make_pair(lookup.key, entry));
+    }
+}
+
+void CCoinsViewCache::AddPrefetched(CCoinsPrefetch& prefetch) {
+    for (auto& lookup : prefetch.coins) {
+        if (!lookup.found) {
+            continue;
+        }
+        auto ret = cacheCoins.emplace(std::piecewise_construct, std::forward_as_tuple(lookup.key), std::forward_as_tuple(std::move(lookup.value)));
+        if (!ret.second) {
+            continue;
+        }
+        if (ret.first->second.coin.IsSpent()) {
+            // As in FetchCoin, the parent only has an empty entry.
+            ret.first->second.flags = CCoinsCacheEntry::FRESH;
+        }
+        cachedCoinsUsage += ret.first->second.coin.DynamicMemoryUsage();
+    }
+    AddPrefetchedAnchors<CAnchorsSproutMap, CAnchorsSproutCacheEntry>(cacheSproutAnchors, prefetch.sproutAnchors, cachedCoinsUsage);
+    // Sapling spends only need to know that their anchor is valid.
+    for (const auto& lookup : prefetch.saplingAnchors) {
+        if (lookup.value) {
+            recentSaplingAnchors.insert(lookup.key);
+        }
+    }
+    AddPrefetchedNullifiers(cacheSproutNullifiers, prefetch.sproutNullifiers);
+    AddPrefetchedNullifiers(cacheSaplingNullifiers, prefetch.saplingNullifiers);
 }
 
 uint256 CCoinsViewCache::GetBestBlock() const {
@@ -731,7 +1041,7 @@ void CCoinsViewCache::SetBestBlock(const uint256 &hashBlockIn) {
     hashBlock = hashBlockIn;
 }
 
-void BatchWriteNullifiers(CNullifiersMap &mapNullifiers, CNullifiersMap &cacheNullifiers)
+void BatchWriteNullifiers(CNullifiersMap &mapNullifiers, CNullifiersMap &cacheNullifiers, bool fErase)
 {
     for (CNullifiersMap::iterator child_it = mapNullifiers.begin(); child_it != mapNullifiers.end();) {
         if (child_it->second.flags & CNullifiersCacheEntry::DIRTY) { // Ignore non-dirty entries (optimization).
@@ -748,7 +1058,7 @@ void BatchWriteNullifiers(CNullifiersMap &mapNullifiers, CNullifiersMap &cacheNu
                 }
             }
         }
-        child_it = mapNullifiers.erase(child_it);
+        child_it = fErase ? mapNullifiers.erase(child_it) : std::next(child_it);
     }
 }
 
@@ -756,7 +1066,8 @@ template<typename Map, typename MapIterator, typename MapEntry>
 void BatchWriteAnchors(
     Map &mapAnchors,
     Map &cacheAnchors,
-    size_t &cachedCoinsUsage
+    size_t &cachedCoinsUsage,
+    bool fErase
 )
 {
     for (MapIterator child_it = mapAnchors.begin(); child_it != mapAnchors.end();)
@@ -780,7 +1091,7 @@ void BatchWriteAnchors(
             }
         }
 
-        child_it = mapAnchors.erase(child_it);
+        child_it = fErase ? mapAnchors.erase(child_it) : std::next(child_it);
     }
 }
 
@@ -821,49 +1132,91 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins,
                                  CAnchorsSaplingMap &mapSaplingAnchors,
                                  CNullifiersMap &mapSproutNullifiers,
                                  CNullifiersMap &mapSaplingNullifiers,
-                                 CHistoryCacheMap &historyCacheMapIn) {
-    assert(!hasModifier);
-    for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
-        if (it->second.flags & CCoinsCacheEntry::DIRTY) { // Ignore non-dirty entries (optimization).
-            CCoinsMap::iterator itUs = cacheCoins.find(it->first);
-            if (itUs == cacheCoins.end()) {
-                if (!it->second.coins.IsPruned()) {
-                    // The parent cache does not have an entry, while the child
-                    // cache does have (a non-pruned) one. Move the data up, and
-                    // mark it as fresh (if the grandparent did have it, we
-                    // would have pulled it in at first GetCoins).
-                    assert(it->second.flags & CCoinsCacheEntry::FRESH);
-                    CCoinsCacheEntry& entry = cacheCoins[it->first];
-                    entry.coins.swap(it->second.coins);
-                    cachedCoinsUsage += entry.coins.DynamicMemoryUsage();
-                    entry.flags = CCoinsCacheEntry::DIRTY | CCoinsCacheEntry::FRESH;
+                                 CHistoryCacheMap &historyCacheMapIn,
+                                 bool fErase) {
+    for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end(); it = fErase ? mapCoins.erase(it) : std::next(it)) {
+        // Ignore non-dirty entries (optimization).
+        if (!(it->second.flags & CCoinsCacheEntry::DIRTY)) {
+            continue;
+        }
+        CCoinsMap::iterator itUs = cacheCoins.find(it->first);
+        if (itUs == cacheCoins.end()) {
+            // The parent cache does not have an entry, while the child does
+            // We can ignore it if it's both FRESH and pruned in the child
+            if (!(it->second.flags & CCoinsCacheEntry::FRESH && it->second.coin.IsSpent())) {
+                // Otherwise we will need to create it in the parent
+                // and move the data up and mark it as dirty
+                CCoinsCacheEntry& entry = cacheCoins[it->first];
+                if (fErase) {
+                    entry.coin = std::move(it->second.coin);
+                } else {
+                    entry.coin = it->second.coin;
+                }
+                cachedCoinsUsage += entry.coin.DynamicMemoryUsage();
+                entry.flags = CCoinsCacheEntry::DIRTY;
+                // We can mark it FRESH in the parent if it was FRESH in the child
+                // Otherwise it might have just been flushed from the parent's cache
+                // and already exist in the grandparent
+                if (it->second.flags & CCoinsCacheEntry::FRESH) {
+                    entry.flags |= CCoinsCacheEntry::FRESH;
                 }
+            }
+        } else {
+            // Assert that the child cache entry was not marked FRESH if the
+            // parent cache entry has unspent outputs. If this ever happens,
+            // it means the FRESH flag was misapplied and there is a logic
+            // error in the calling code.
+            if ((it->second.flags & CCoinsCacheEntry::FRESH) && !itUs->second.coin.IsSpent()) {
+                throw std::logic_error("FRESH flag misapplied to cache entry for base transaction with spendable outputs");
+            }
+
+            // Found the entry in the parent cache
+            if ((itUs->second.flags & CCoinsCacheEntry::FRESH) && it->second.coin.IsSpent()) {
+                // The grandparent does not have an entry, and the child is
+                // modified and being pruned. This means we can just delete
+                // it from the parent.
+                cachedCoinsUsage -= itUs->second.coin.DynamicMemoryUsage();
+                cacheCoins.erase(itUs);
             } else {
-                if ((itUs->second.flags & CCoinsCacheEntry::FRESH) && it->second.coins.IsPruned()) {
-                    // The grandparent does not have an entry, and the child is
-                    // modified and being pruned. This means we can just delete
-                    // it from the parent.
-                    cachedCoinsUsage -= itUs->second.coins.DynamicMemoryUsage();
-                    cacheCoins.erase(itUs);
+                // A normal modification.
+                cachedCoinsUsage -= itUs->second.coin.DynamicMemoryUsage();
+                if (fErase) {
+                    itUs->second.coin = std::move(it->second.coin);
                 } else {
-                    // A normal modification.
-                    cachedCoinsUsage -= itUs->second.coins.DynamicMemoryUsage();
-                    itUs->second.coins.swap(it->second.coins);
-                    cachedCoinsUsage += itUs->second.coins.DynamicMemoryUsage();
-                    itUs->second.flags |= CCoinsCacheEntry::DIRTY;
+                    itUs->second.coin = it->second.coin;
                 }
+                cachedCoinsUsage += itUs->second.coin.DynamicMemoryUsage();
+                itUs->second.flags |= CCoinsCacheEntry::DIRTY;
+                // NOTE: It is possible the child has a FRESH flag here in
+                // the event the entry we found in the parent is pruned. But
+                // we must not copy that FRESH flag to the parent as that
+                // pruned state likely still needs to be communicated to the
+                // grandparent.
             }
         }
-        it = mapCoins.erase(it);
     }
 
-    ::BatchWriteAnchors<CAnchorsSproutMap, CAnchorsSproutMap::iterator, CAnchorsSproutCacheEntry>(mapSproutAnchors, cacheSproutAnchors, cachedCoinsUsage);
-    ::BatchWriteAnchors<CAnchorsSaplingMap, CAnchorsSaplingMap::iterator, CAnchorsSaplingCacheEntry>(mapSaplingAnchors, cacheSaplingAnchors, cachedCoinsUsage);
+    ::BatchWriteAnchors<CAnchorsSproutMap, CAnchorsSproutMap::iterator, CAnchorsSproutCacheEntry>(mapSproutAnchors, cacheSproutAnchors, cachedCoinsUsage, fErase);
+    // Roots that the child has pushed or popped are remembered or forgotten
+    // here too, since the parent's map entries go away when it is flushed.
+    for (const auto& entry : mapSaplingAnchors) {
+        if (entry.second.flags & CAnchorsSaplingCacheEntry::DIRTY) {
+            if (entry.second.entered) {
+                recentSaplingAnchors.insert(entry.first);
+            } else {
+                recentSaplingAnchors.erase(entry.first);
+            }
+        }
+    }
+    ::BatchWriteAnchors<CAnchorsSaplingMap, CAnchorsSaplingMap::iterator, CAnchorsSaplingCacheEntry>(mapSaplingAnchors, cacheSaplingAnchors, cachedCoinsUsage, fErase);
 
-    ::BatchWriteNullifiers(mapSproutNullifiers, cacheSproutNullifiers);
-    ::BatchWriteNullifiers(mapSaplingNullifiers, cacheSaplingNullifiers);
+    ::BatchWriteNullifiers(mapSproutNullifiers, cacheSproutNullifiers, fErase);
+    ::BatchWriteNullifiers(mapSaplingNullifiers, cacheSaplingNullifiers, fErase);
 
     ::BatchWriteHistory(historyCacheMap, historyCacheMapIn);
+    for (const auto& entry : historyCacheMapIn) {
+        UpdateHistoryPeaks(entry.first, historyCacheMap.at(entry.first));
+    }
 
     hashSproutAnchor = hashSproutAnchorIn;
     hashSaplingAnchor = hashSaplingAnchorIn;
@@ -872,6 +1225,7 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins,
 }
 
 bool CCoinsViewCache::Flush() {
+    UpdateAllHistoryPeaks();
     bool fOk = base->BatchWrite(cacheCoins,
                                 hashBlock,
                                 hashSproutAnchor,
@@ -880,7 +1234,8 @@ bool CCoinsViewCache::Flush() {
                                 cacheSaplingAnchors,
                                 cacheSproutNullifiers,
                                 cacheSaplingNullifiers,
-                                historyCacheMap);
+                                historyCacheMap,
+                                true);
     cacheCoins.clear();
     cacheSproutAnchors.clear();
     cacheSaplingAnchors.clear();
@@ -888,18 +1243,131 @@ bool CCoinsViewCache::Flush() {
     cacheSaplingNullifiers.clear();
     historyCacheMap.clear();
     cachedCoinsUsage = 0;
+    ReallocateCache();
     return fOk;
 }
 
+bool CCoinsViewCache::Sync(size_t nTargetUsage) {
+    UpdateAllHistoryPeaks();
+    bool fOk = base->BatchWrite(cacheCoins,
+                                hashBlock,
+                                hashSproutAnchor,
+                                hashSaplingAnchor,
+                                cacheSproutAnchors,
+                                cacheSaplingAnchors,
+                                cacheSproutNullifiers,
+                                cacheSaplingNullifiers,
+                                historyCacheMap,
+                                false);
+    cacheSproutAnchors.clear();
+    cacheSaplingAnchors.clear();
+    cacheSproutNullifiers.clear();
+    cacheSaplingNullifiers.clear();
+    historyCacheMap.clear();
+
+    // The base view now has all of our coins, so forget the spent ones and
+    // mark the others as clean. This also drops the usage of the anchor
+    // trees from cachedCoinsUsage.
+    cachedCoinsUsage = 0;
+    for (CCoinsMap::iterator it = cacheCoins.begin(); it != cacheCoins.end(); ) {
+        if (it->second.coin.IsSpent()) {
+            it = cacheCoins.erase(it);
+        } else {
+            it->second.flags = 0;
+            cachedCoinsUsage += it->second.coin.DynamicMemoryUsage();
+            it++;
+        }
+    }
+
+    size_t nUsage = DynamicMemoryUsage();
+    if (nUsage <= nTargetUsage) {
+        return fOk;
+    }
+
+    // Keep the youngest coins, in the same proportion of the cache as
+    // nTargetUsage is of its current usage. The memory of the evicted
+    // entries is only returned when the pool is released, so move the
+    // kept coins out, start a new pool and put them back.
+    size_t nKeep = cacheCoins.size() * (double(nTargetUsage) / nUsage);
+    std::vector<int> heights;
+    heights.reserve(cacheCoins.size());
+    for (const auto& entry : cacheCoins) {
+        heights.push_back(entry.second.coin.nHeight);
+    }
+    int nMinHeight = std::numeric_limits<int>::max();
+    if (nKeep > 0) {
+        std::nth_element(heights.begin(), heights.begin() + (nKeep - 1), heights.end(), std::greater<int>());
+        nMinHeight = heights[nKeep - 1];
+    }
+    heights.clear();
+    heights.shrink_to_fit();
+
+    std::vector<std::pair<COutPoint, Coin>> kept;
+    kept.reserve(nKeep);
+    for (auto& entry : cacheCoins) {
+        if ((int)entry.second.coin.nHeight >= nMinHeight && kept.size() < nKeep) {
+            kept.emplace_back(entry.first, std::move(entry.second.coin));
+        }
+    }
+    cacheCoins.clear();
+    ReallocateCache();
+
+    cachedCoinsUsage = 0;
+    cacheCoins.reserve(kept.size());
+    for (auto& coin : kept) {
+        CCoinsCacheEntry& entry = cacheCoins.emplace(std::piecewise_construct, std::forward_as_tuple(coin.first), std::forward_as_tuple(std::move(coin.second))).first->second;
+        cachedCoinsUsage += entry.coin.DynamicMemoryUsage();
+    }
+    return fOk;
+}
+
+void CCoinsViewCache::Reset() {
+    cacheCoins.clear();
+    cacheSproutAnchors.clear();
+    cacheSaplingAnchors.clear();
+    recentSaplingAnchors.clear();
+    cacheSproutNullifiers.clear();
+    cacheSaplingNullifiers.clear();
+    historyCacheMap.clear();
+    historyPeaks.clear();
+    hashBlock.SetNull();
+    hashSproutAnchor.SetNull();
+    hashSaplingAnchor.SetNull();
+    cachedCoinsUsage = 0;
+    ReallocateCache();
+}
+
+void CCoinsViewCache::ReallocateCache()
+{
+    // The maps must be empty, as their nodes are freed with the pool.
+    assert(cacheCoins.empty());
+    assert(cacheSproutAnchors.empty());
+    assert(cacheSaplingAnchors.empty());
+    assert(cacheSproutNullifiers.empty());
+    assert(cacheSaplingNullifiers.empty());
+    cacheCoins.~CCoinsMap();
+    cacheSproutAnchors.~CAnchorsSproutMap();
+    cacheSaplingAnchors.~CAnchorsSaplingMap();
+    cacheSproutNullifiers.~CNullifiersMap();
+    cacheSaplingNullifiers.~CNullifiersMap();
+    cacheMemoryResource.~CCoinsCacheMemoryResource();
+    ::new (&cacheMemoryResource) CCoinsCacheMemoryResource(nPoolChunkBytes);
+    ::new (&cacheCoins) CCoinsMap(0, SaltedOutpointHasher(), std::equal_to<COutPoint>(), &cacheMemoryResource);
+    ::new (&cacheSproutAnchors) CAnchorsSproutMap(0, SaltedTxidHasher(), std::equal_to<uint256>(), &cacheMemoryResource);
+    ::new (&cacheSaplingAnchors) CAnchorsSaplingMap(0, SaltedTxidHasher(), std::equal_to<uint256>(), &cacheMemoryResource);
+    ::new (&cacheSproutNullifiers) CNullifiersMap(0, SaltedTxidHasher(), std::equal_to<uint256>(), &cacheMemoryResource);
+    ::new (&cacheSaplingNullifiers) CNullifiersMap(0, SaltedTxidHasher(), std::equal_to<uint256>(), &cacheMemoryResource);
+}
+
 unsigned int CCoinsViewCache::GetCacheSize() const {
     return cacheCoins.size();
 }
 
 const CTxOut &CCoinsViewCache::GetOutputFor(const CTxIn& input) const
 {
-    const CCoins* coins = AccessCoins(input.prevout.hash);
-    assert(coins && coins->IsAvailable(input.prevout.n));
-    return coins->vout[input.prevout.n];
+    const Coin& coin = AccessCoin(input.prevout);
+    assert(!coin.IsSpent());
+    return coin.out;
 }
 
 CAmount CCoinsViewCache::GetValueIn(const CTransaction& tx) const
@@ -918,10 +1386,22 @@ CAmount CCoinsViewCache::GetValueIn(const CTransaction& tx) const
 
 std::optional<UnsatisfiedShieldedReq> CCoinsViewCache::HaveShieldedRequirements(const CTransaction& tx) const
 {
+    // The trees after each JoinSplit, keyed by root, that later JoinSplits
+    // may be anchored to. The tree after the latest JoinSplit is only added,
+    // and its root only computed, once another JoinSplit follows it, so that
+    // a transaction's last (often only) JoinSplit hashes nothing beyond the
+    // commitments it appends.
     boost::unordered_map<uint256, SproutMerkleTree, SaltedTxidHasher> intermediates;
+    std::optional<SproutMerkleTree> pending;
 
     for (const JSDescription &joinsplit : tx.vJoinSplit)
     {
+        if (pending) {
+            uint256 root = pending->root();
+            intermediates.emplace(root, std::move(*pending));
+            pending.reset();
+        }
+
         for (const uint256& nullifier : joinsplit.nullifiers)
         {
             if (GetNullifier(nullifier, SPROUT)) {
@@ -939,6 +1419,7 @@ std::optional<UnsatisfiedShieldedReq> CCoinsViewCache::HaveShieldedRequirements(
         SproutMerkleTree tree;
         auto it = intermediates.find(joinsplit.anchor);
         if (it != intermediates.end()) {
+            // Copied, as another JoinSplit may be anchored to the same tree.
             tree = it->second;
         } else if (!GetSproutAnchorAt(joinsplit.anchor, tree)) {
             auto txid = tx.GetHash().ToString();
@@ -954,7 +1435,7 @@ std::optional<UnsatisfiedShieldedReq> CCoinsViewCache::HaveShieldedRequirements(
             tree.append(commitment);
         }
 
-        intermediates.insert(std::make_pair(tree.root(), tree));
+        pending = std::move(tree);
     }
 
     for (const SpendDescription &spendDescription : tx.vShieldedSpend) {
@@ -967,8 +1448,7 @@ std::optional<UnsatisfiedShieldedReq> CCoinsViewCache::HaveShieldedRequirements(
             return UnsatisfiedShieldedReq::SaplingDuplicateNullifier;
         }
 
-        SaplingMerkleTree tree;
-        if (!GetSaplingAnchorAt(spendDescription.anchor, tree)) {
+        if (!HaveSaplingAnchor(spendDescription.anchor)) {
             auto txid = tx.GetHash().ToString();
             auto anchor = spendDescription.anchor.ToString();
             TracingWarn("consensus", "Transaction uses unknown Sapling anchor",
@@ -985,9 +1465,7 @@ bool CCoinsViewCache::HaveInputs(const CTransaction& tx) const
 {
     if (!tx.IsCoinBase()) {
         for (unsigned int i = 0; i < tx.vin.size(); i++) {
-            const COutPoint &prevout = tx.vin[i].prevout;
-            const CCoins* coins = AccessCoins(prevout.hash);
-            if (!coins || !coins->IsAvailable(prevout.n)) {
+            if (!HaveCoin(tx.vin[i].prevout)) {
                 return false;
             }
         }
@@ -1013,32 +1491,26 @@ double CCoinsViewCache::GetPriority(const CTransaction &tx, int nHeight) const
     double dResult = 0.0;
     for (const CTxIn& txin : tx.vin)
     {
-        const CCoins* coins = AccessCoins(txin.prevout.hash);
-        assert(coins);
-        if (!coins->IsAvailable(txin.prevout.n)) continue;
-        if (coins->nHeight < nHeight) {
-            dResult += coins->vout[txin.prevout.n].nValue * (nHeight-coins->nHeight);
+        const Coin& coin = AccessCoin(txin.prevout);
+        if (coin.IsSpent()) continue;
+        if (coin.nHeight < nHeight) {
+            dResult += coin.out.nValue * (nHeight-coin.nHeight);
         }
     }
 
     return tx.ComputePriority(dResult);
 }
 
-CCoinsModifier::CCoinsModifier(CCoinsViewCache& cache_, CCoinsMap::iterator it_, size_t usage) : cache(cache_), it(it_), cachedCoinUsage(usage) {
-    assert(!cache.hasModifier);
-    cache.hasModifier = true;
-}
+static const size_t MIN_TRANSACTION_OUTPUT_SIZE = ::GetSerializeSize(CTxOut(), SER_NETWORK, PROTOCOL_VERSION);
+static const size_t MAX_OUTPUTS_PER_BLOCK = MAX_BLOCK_SIZE / MIN_TRANSACTION_OUTPUT_SIZE;
 
-CCoinsModifier::~CCoinsModifier()
+const Coin& AccessByTxid(const CCoinsViewCache& view, const uint256& txid)
 {
-    assert(cache.hasModifier);
-    cache.hasModifier = false;
-    it->second.coins.Cleanup();
-    cache.cachedCoinsUsage -= cachedCoinUsage; // Subtract the old usage
-    if ((it->second.flags & CCoinsCacheEntry::FRESH) && it->second.coins.IsPruned()) {
-        cache.cacheCoins.erase(it);
-    } else {
-        // If the coin still exists after the modification, add the new usage
-        cache.cachedCoinsUsage += it->second.coins.DynamicMemoryUsage();
+    COutPoint iter(txid, 0);
+    while (iter.n < MAX_OUTPUTS_PER_BLOCK) {
+        const Coin& alternate = view.AccessCoin(iter);
+        if (!alternate.IsSpent()) return alternate;
+        ++iter.n;
     }
+    return coinEmpty;
 }
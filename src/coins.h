@@ -8,147 +8,56 @@
 
 #include "compressor.h"
 #include "core_memusage.h"
+#include "crypto/muhash.h"
 #include "hash.h"
 #include "memusage.h"
 #include "serialize.h"
+#include "support/allocators/pool.h"
 #include "uint256.h"
 
 #include <assert.h>
 #include <stdint.h>
 
+#include <algorithm>
+#include <list>
+#include <map>
+#include <unordered_map>
+
 #include <boost/unordered_map.hpp>
 #include "zcash/History.hpp"
 #include "zcash/IncrementalMerkleTree.hpp"
 
 /**
- * Pruned version of CTransaction: only retains metadata and unspent transaction outputs
+ * A UTXO entry.
  *
  * Serialized format:
- * - VARINT(nVersion)
- * - VARINT(nCode)
- * - unspentness bitvector, for vout[2] and further; least significant byte first
- * - the non-spent CTxOuts (via CTxOutCompressor)
- * - VARINT(nHeight)
- *
- * The nCode value consists of:
- * - bit 1: IsCoinBase()
- * - bit 2: vout[0] is not spent
- * - bit 4: vout[1] is not spent
- * - The higher bits encode N, the number of non-zero bytes in the following bitvector.
- *   - In case both bit 2 and bit 4 are unset, they encode N-1, as there must be at
- *     least one non-spent output).
- *
- * Example: 0104835800816115944e077fe7c803cfa57f29b36bf87c1d358bb85e
- *          <><><--------------------------------------------><---->
- *          |  \                  |                             /
- *    version   code             vout[1]                  height
- *
- *    - version = 1
- *    - code = 4 (vout[1] is not spent, and 0 non-zero bytes of bitvector follow)
- *    - unspentness bitvector: as 0 non-zero bytes follow, it has length 0
- *    - vout[1]: 835800816115944e077fe7c803cfa57f29b36bf87c1d35
- *               * 8358: compact amount representation for 60000000000 (600 BTC)
- *               * 00: special txout type pay-to-pubkey-hash
- *               * 816115944e077fe7c803cfa57f29b36bf87c1d35: address uint160
- *    - height = 203998
- *
- *
- * Example: 0109044086ef97d5790061b01caab50f1b8e9c50a5057eb43c2d9563a4eebbd123008c988f1a4a4de2161e0f50aac7f17e7f9555caa486af3b
- *          <><><--><--------------------------------------------------><----------------------------------------------><---->
- *         /  \   \                     |                                                           |                     /
- *  version  code  unspentness       vout[4]                                                     vout[16]           height
- *
- *  - version = 1
- *  - code = 9 (coinbase, neither vout[0] or vout[1] are unspent,
- *                2 (1, +1 because both bit 2 and bit 4 are unset) non-zero bitvector bytes follow)
- *  - unspentness bitvector: bits 2 (0x04) and 14 (0x4000) are set, so vout[2+2] and vout[14+2] are unspent
- *  - vout[4]: 86ef97d5790061b01caab50f1b8e9c50a5057eb43c2d9563a4ee
- *             * 86ef97d579: compact amount representation for 234925952 (2.35 BTC)
- *             * 00: special txout type pay-to-pubkey-hash
- *             * 61b01caab50f1b8e9c50a5057eb43c2d9563a4ee: address uint160
- *  - vout[16]: bbd123008c988f1a4a4de2161e0f50aac7f17e7f9555caa4
- *              * bbd123: compact amount representation for 110397 (0.001 BTC)
- *              * 00: special txout type pay-to-pubkey-hash
- *              * 8c988f1a4a4de2161e0f50aac7f17e7f9555caa4: address uint160
- *  - height = 120891
+ * - VARINT((coinbase ? 1 : 0) | (height << 1))
+ * - the non-spent CTxOut (via CTxOutCompressor)
  */
-class CCoins
+class Coin
 {
 public:
-    //! whether transaction is a coinbase
-    bool fCoinBase;
-
-    //! unspent transaction outputs; spent outputs are .IsNull(); spent outputs at the end of the array are dropped
-    std::vector<CTxOut> vout;
+    //! unspent transaction output
+    CTxOut out;
 
-    //! at which height this transaction was included in the active block chain
-    int nHeight;
-
-    //! version of the CTransaction; accesses to this value should probably check for nHeight as well,
-    //! as new tx version will probably only be introduced at certain heights
-    int nVersion;
+    //! whether containing transaction was a coinbase
+    unsigned int fCoinBase : 1;
 
-    void FromTx(const CTransaction &tx, int nHeightIn) {
-        fCoinBase = tx.IsCoinBase();
-        vout = tx.vout;
-        nHeight = nHeightIn;
-        nVersion = tx.nVersion;
-        ClearUnspendable();
-    }
+    //! at which height this containing transaction was included in the active block chain
+    uint32_t nHeight : 31;
 
-    //! construct a CCoins from a CTransaction, at a given height
-    CCoins(const CTransaction &tx, int nHeightIn) {
-        FromTx(tx, nHeightIn);
-    }
+    //! construct a Coin from a CTxOut and height/coinbase information.
+    Coin(CTxOut&& outIn, int nHeightIn, bool fCoinBaseIn) : out(std::move(outIn)), fCoinBase(fCoinBaseIn), nHeight(nHeightIn) {}
+    Coin(const CTxOut& outIn, int nHeightIn, bool fCoinBaseIn) : out(outIn), fCoinBase(fCoinBaseIn),nHeight(nHeightIn) {}
 
     void Clear() {
+        out.SetNull();
         fCoinBase = false;
-        std::vector<CTxOut>().swap(vout);
         nHeight = 0;
-        nVersion = 0;
     }
 
     //! empty constructor
-    CCoins() : fCoinBase(false), vout(0), nHeight(0), nVersion(0) { }
-
-    //!remove spent outputs at the end of vout
-    void Cleanup() {
-        while (vout.size() > 0 && vout.back().IsNull())
-            vout.pop_back();
-        if (vout.empty())
-            std::vector<CTxOut>().swap(vout);
-    }
-
-    void ClearUnspendable() {
-        for (CTxOut &txout : vout) {
-            if (txout.scriptPubKey.IsUnspendable())
-                txout.SetNull();
-        }
-        Cleanup();
-    }
-
-    void swap(CCoins &to) {
-        std::swap(to.fCoinBase, fCoinBase);
-        to.vout.swap(vout);
-        std::swap(to.nHeight, nHeight);
-        std::swap(to.nVersion, nVersion);
-    }
-
-    //! equality test
-    friend bool operator==(const CCoins &a, const CCoins &b) {
-         // Empty CCoins objects are always equal.
-         if (a.IsPruned() && b.IsPruned())
-             return true;
-         return a.fCoinBase == b.fCoinBase &&
-                a.nHeight == b.nHeight &&
-                a.nVersion == b.nVersion &&
-                a.vout == b.vout;
-    }
-    friend bool operator!=(const CCoins &a, const CCoins &b) {
-        return !(a == b);
-    }
-
-    void CalcMaskSize(unsigned int &nBytes, unsigned int &nNonzeroBytes) const;
+    Coin() : fCoinBase(false), nHeight(0) { }
 
     bool IsCoinBase() const {
         return fCoinBase;
@@ -156,90 +65,28 @@ public:
 
     template<typename Stream>
     void Serialize(Stream &s) const {
-        unsigned int nMaskSize = 0, nMaskCode = 0;
-        CalcMaskSize(nMaskSize, nMaskCode);
-        bool fFirst = vout.size() > 0 && !vout[0].IsNull();
-        bool fSecond = vout.size() > 1 && !vout[1].IsNull();
-        assert(fFirst || fSecond || nMaskCode);
-        unsigned int nCode = 8*(nMaskCode - (fFirst || fSecond ? 0 : 1)) + (fCoinBase ? 1 : 0) + (fFirst ? 2 : 0) + (fSecond ? 4 : 0);
-        // version
-        ::Serialize(s, VARINT(this->nVersion));
-        // header code
-        ::Serialize(s, VARINT(nCode));
-        // spentness bitmask
-        for (unsigned int b = 0; b<nMaskSize; b++) {
-            unsigned char chAvail = 0;
-            for (unsigned int i = 0; i < 8 && 2+b*8+i < vout.size(); i++)
-                if (!vout[2+b*8+i].IsNull())
-                    chAvail |= (1 << i);
-            ::Serialize(s, chAvail);
-        }
-        // txouts themself
-        for (unsigned int i = 0; i < vout.size(); i++) {
-            if (!vout[i].IsNull())
-                ::Serialize(s, CTxOutCompressor(REF(vout[i])));
-        }
-        // coinbase height
-        ::Serialize(s, VARINT(nHeight));
+        assert(!IsSpent());
+        uint32_t code = nHeight * 2 + fCoinBase;
+        ::Serialize(s, VARINT(code));
+        ::Serialize(s, CTxOutCompressor(REF(out)));
     }
 
     template<typename Stream>
     void Unserialize(Stream &s) {
-        unsigned int nCode = 0;
-        // version
-        ::Unserialize(s, VARINT(this->nVersion));
-        // header code
-        ::Unserialize(s, VARINT(nCode));
-        fCoinBase = nCode & 1;
-        std::vector<bool> vAvail(2, false);
-        vAvail[0] = (nCode & 2) != 0;
-        vAvail[1] = (nCode & 4) != 0;
-        unsigned int nMaskCode = (nCode / 8) + ((nCode & 6) != 0 ? 0 : 1);
-        // spentness bitmask
-        while (nMaskCode > 0) {
-            unsigned char chAvail = 0;
-            ::Unserialize(s, chAvail);
-            for (unsigned int p = 0; p < 8; p++) {
-                bool f = (chAvail & (1 << p)) != 0;
-                vAvail.push_back(f);
-            }
-            if (chAvail != 0)
-                nMaskCode--;
-        }
-        // txouts themself
-        vout.assign(vAvail.size(), CTxOut());
-        for (unsigned int i = 0; i < vAvail.size(); i++) {
-            if (vAvail[i])
-                ::Unserialize(s, REF(CTxOutCompressor(vout[i])));
-        }
-        // coinbase height
-        ::Unserialize(s, VARINT(nHeight));
-        Cleanup();
-    }
-
-    //! mark a vout spent
-    bool Spend(uint32_t nPos);
-
-    //! check whether a particular output is still available
-    bool IsAvailable(unsigned int nPos) const {
-        return (nPos < vout.size() && !vout[nPos].IsNull());
+        uint32_t code = 0;
+        ::Unserialize(s, VARINT(code));
+        nHeight = code >> 1;
+        fCoinBase = code & 1;
+        ::Unserialize(s, REF(CTxOutCompressor(out)));
     }
 
-    //! check whether the entire CCoins is spent
-    //! note that only !IsPruned() CCoins can be serialized
-    bool IsPruned() const {
-        for (const CTxOut &out : vout)
-            if (!out.IsNull())
-                return false;
-        return true;
+    //! Spent outputs are represented by a null CTxOut.
+    bool IsSpent() const {
+        return out.IsNull();
     }
 
     size_t DynamicMemoryUsage() const {
-        size_t ret = memusage::DynamicUsage(vout);
-        for (const CTxOut &out : vout) {
-            ret += RecursiveDynamicUsage(out.scriptPubKey);
-        }
-        return ret;
+        return memusage::DynamicUsage(out.scriptPubKey);
     }
 };
 
@@ -262,9 +109,28 @@ public:
     }
 };
 
+class SaltedOutpointHasher
+{
+private:
+    /** Salt */
+    const uint64_t k0, k1;
+
+public:
+    SaltedOutpointHasher();
+
+    /**
+     * This *must* return size_t. With Boost 1.46 on 32-bit systems the
+     * unordered_map will behave unpredictably if the custom hasher returns a
+     * uint64_t, resulting in failures when syncing the chain (#4634).
+     */
+    size_t operator()(const COutPoint& id) const {
+        return SipHashUint256Extra(k0, k1, id.hash, id.n);
+    }
+};
+
 struct CCoinsCacheEntry
 {
-    CCoins coins; // The actual cached data.
+    Coin coin; // The actual cached data.
     unsigned char flags;
 
     enum Flags {
@@ -272,7 +138,8 @@ struct CCoinsCacheEntry
         FRESH = (1 << 1), // The parent view does not have this entry (or it is pruned).
     };
 
-    CCoinsCacheEntry() : coins(), flags(0) {}
+    CCoinsCacheEntry() : flags(0) {}
+    explicit CCoinsCacheEntry(Coin&& coin_) : coin(std::move(coin_)), flags(0) {}
 };
 
 struct CAnchorsSproutCacheEntry
@@ -319,12 +186,65 @@ enum ShieldedType
     SAPLING,
 };
 
-typedef boost::unordered_map<uint256, CCoinsCacheEntry, SaltedTxidHasher> CCoinsMap;
-typedef boost::unordered_map<uint256, CAnchorsSproutCacheEntry, SaltedTxidHasher> CAnchorsSproutMap;
-typedef boost::unordered_map<uint256, CAnchorsSaplingCacheEntry, SaltedTxidHasher> CAnchorsSaplingMap;
-typedef boost::unordered_map<uint256, CNullifiersCacheEntry, SaltedTxidHasher> CNullifiersMap;
+/**
+ * Size of a pool block that can hold a node of a boost::unordered_map of Key
+ * to Entry: the entry itself plus up to four pointers of per-node overhead,
+ * rounded up to the pool alignment.
+ */
+template<typename Key, typename Entry>
+static constexpr size_t CacheNodeBytes()
+{
+    return (sizeof(std::pair<const Key, Entry>) + sizeof(void*) * 4 + alignof(void*) - 1) / alignof(void*) * alignof(void*);
+}
+
+/** Largest block served by the memory pool of a CCoinsViewCache. */
+static constexpr size_t COINS_CACHE_POOL_BLOCK_BYTES = std::max({
+    CacheNodeBytes<COutPoint, CCoinsCacheEntry>(),
+    CacheNodeBytes<uint256, CAnchorsSproutCacheEntry>(),
+    CacheNodeBytes<uint256, CAnchorsSaplingCacheEntry>(),
+    CacheNodeBytes<uint256, CNullifiersCacheEntry>(),
+});
+
+/**
+ * The memory pool shared by the coin, anchor and nullifier maps of a
+ * CCoinsViewCache, so that their nodes are carved out of a few large chunks
+ * that are released together when the cache is flushed.
+ */
+typedef PoolResource<COINS_CACHE_POOL_BLOCK_BYTES, alignof(void*)> CCoinsCacheMemoryResource;
+
+/** The default size of the chunks of a CCoinsCacheMemoryResource. */
+static const size_t COINS_CACHE_POOL_CHUNK_BYTES = 262144;
+
+template<typename Key, typename Entry>
+using CCoinsCacheAllocator = PoolAllocator<std::pair<const Key, Entry>, COINS_CACHE_POOL_BLOCK_BYTES, alignof(void*)>;
+
+typedef boost::unordered_map<COutPoint, CCoinsCacheEntry, SaltedOutpointHasher, std::equal_to<COutPoint>, CCoinsCacheAllocator<COutPoint, CCoinsCacheEntry>> CCoinsMap;
+typedef boost::unordered_map<uint256, CAnchorsSproutCacheEntry, SaltedTxidHasher, std::equal_to<uint256>, CCoinsCacheAllocator<uint256, CAnchorsSproutCacheEntry>> CAnchorsSproutMap;
+typedef boost::unordered_map<uint256, CAnchorsSaplingCacheEntry, SaltedTxidHasher, std::equal_to<uint256>, CCoinsCacheAllocator<uint256, CAnchorsSaplingCacheEntry>> CAnchorsSaplingMap;
+typedef boost::unordered_map<uint256, CNullifiersCacheEntry, SaltedTxidHasher, std::equal_to<uint256>, CCoinsCacheAllocator<uint256, CNullifiersCacheEntry>> CNullifiersMap;
 typedef boost::unordered_map<uint32_t, HistoryCache> CHistoryCacheMap;
 
+/**
+ * The nodes of a history tree that its next append or deletion reads (its
+ * peaks, and the nodes below its last peak), with its length and root, as of
+ * the last time a CCoinsViewCache wrote to or was written by another view.
+ */
+struct CHistoryPeaks
+{
+    HistoryIndex length;
+    uint256 root;
+    std::map<HistoryIndex, HistoryNode> nodes;
+
+    CHistoryPeaks() : length(0) {}
+};
+
+typedef boost::unordered_map<uint32_t, CHistoryPeaks> CHistoryPeaksMap;
+
+/**
+ * Statistics about the UTXO set. All fields but nTransactions and
+ * hashSerialized can also be kept up to date as coins are added and spent,
+ * with AddCoin() and RemoveCoin(); those are serialized.
+ */
 struct CCoinsStats
 {
     int nHeight;
@@ -334,8 +254,28 @@ struct CCoinsStats
     uint64_t nSerializedSize;
     uint256 hashSerialized;
     CAmount nTotalAmount;
+    //! A hash of the set of unspent outputs, which does not depend on their order.
+    MuHash3072 muhash;
 
     CCoinsStats() : nHeight(0), nTransactions(0), nTransactionOutputs(0), nSerializedSize(0), nTotalAmount(0) {}
+
+    void AddCoin(const COutPoint &outpoint, const Coin &coin);
+    void RemoveCoin(const COutPoint &outpoint, const Coin &coin);
+
+    //! The finalized hash of muhash.
+    uint256 GetMuHash() const;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(nHeight);
+        READWRITE(hashBlock);
+        READWRITE(nTransactionOutputs);
+        READWRITE(nSerializedSize);
+        READWRITE(nTotalAmount);
+        READWRITE(muhash);
+    }
 };
 
 
@@ -349,15 +289,20 @@ public:
     //! Retrieve the tree (Sapling) at a particular anchored root in the chain
     virtual bool GetSaplingAnchorAt(const uint256 &rt, SaplingMerkleTree &tree) const;
 
+    //! Just check whether a given root is a valid Sapling anchor in the chain,
+    //! without retrieving its tree.
+    virtual bool HaveSaplingAnchor(const uint256 &rt) const;
+
     //! Determine whether a nullifier is spent or not
     virtual bool GetNullifier(const uint256 &nullifier, ShieldedType type) const;
 
-    //! Retrieve the CCoins (unspent transaction outputs) for a given txid
-    virtual bool GetCoins(const uint256 &txid, CCoins &coins) const;
+    //! Retrieve the Coin (unspent transaction output) for a given outpoint.
+    //! Returns true only when an unspent coin was found, which is returned in coin.
+    //! When false is returned, coin's value is unspecified.
+    virtual bool GetCoin(const COutPoint &outpoint, Coin &coin) const;
 
-    //! Just check whether we have data for a given txid.
-    //! This may (but cannot always) return true for fully spent transactions
-    virtual bool HaveCoins(const uint256 &txid) const;
+    //! Just check whether a given outpoint is unspent.
+    virtual bool HaveCoin(const COutPoint &outpoint) const;
 
     //! Retrieve the block hash whose state this CCoinsView currently represents
     virtual uint256 GetBestBlock() const;
@@ -374,8 +319,9 @@ public:
     //! Get current history root
     virtual uint256 GetHistoryRoot(uint32_t epochId) const;
 
-    //! Do a bulk modification (multiple CCoins changes + BestBlock change).
-    //! The passed mapCoins can be modified.
+    //! Do a bulk modification (multiple Coin changes + BestBlock change).
+    //! The passed maps can be modified. If fErase is false, their entries
+    //! are left in place and unchanged, so that the caller can keep them.
     virtual bool BatchWrite(CCoinsMap &mapCoins,
                             const uint256 &hashBlock,
                             const uint256 &hashSproutAnchor,
@@ -384,7 +330,8 @@ public:
                             CAnchorsSaplingMap &mapSaplingAnchors,
                             CNullifiersMap &mapSproutNullifiers,
                             CNullifiersMap &mapSaplingNullifiers,
-                            CHistoryCacheMap &historyCacheMap);
+                            CHistoryCacheMap &historyCacheMap,
+                            bool fErase);
 
     //! Calculate statistics about the unspent transaction output set
     virtual bool GetStats(CCoinsStats &stats) const;
@@ -404,9 +351,10 @@ public:
     CCoinsViewBacked(CCoinsView *viewIn);
     bool GetSproutAnchorAt(const uint256 &rt, SproutMerkleTree &tree) const;
     bool GetSaplingAnchorAt(const uint256 &rt, SaplingMerkleTree &tree) const;
+    bool HaveSaplingAnchor(const uint256 &rt) const;
     bool GetNullifier(const uint256 &nullifier, ShieldedType type) const;
-    bool GetCoins(const uint256 &txid, CCoins &coins) const;
-    bool HaveCoins(const uint256 &txid) const;
+    bool GetCoin(const COutPoint &outpoint, Coin &coin) const;
+    bool HaveCoin(const COutPoint &outpoint) const;
     uint256 GetBestBlock() const;
     uint256 GetBestAnchor(ShieldedType type) const;
     HistoryIndex GetHistoryLength(uint32_t epochId) const;
@@ -421,53 +369,102 @@ public:
                     CAnchorsSaplingMap &mapSaplingAnchors,
                     CNullifiersMap &mapSproutNullifiers,
                     CNullifiersMap &mapSaplingNullifiers,
-                    CHistoryCacheMap &historyCacheMap);
+                    CHistoryCacheMap &historyCacheMap,
+                    bool fErase);
     bool GetStats(CCoinsStats &stats) const;
 };
 
 
-class CCoinsViewCache;
+/** The set of shielded requirements that might be unsatisfied. */
+enum class UnsatisfiedShieldedReq {
+    SproutDuplicateNullifier,
+    SproutUnknownAnchor,
+    SaplingDuplicateNullifier,
+    SaplingUnknownAnchor,
+};
 
 /**
- * A reference to a mutable cache entry. Encapsulating it allows us to run
- *  cleanup code after the modification is finished, and keeping track of
- *  concurrent modifications.
+ * Lookups of the coins, anchors and nullifiers needed by some transactions,
+ * in the base view of a CCoinsViewCache, that are done before the
+ * transactions are validated (see CCoinsViewCache::GetPrefetch).
+ *
+ * The lookups are independent, so Fetch() may be called for different
+ * lookups from several threads at once, if the base view supports
+ * concurrent reads.
  */
-class CCoinsModifier
+class CCoinsPrefetch
 {
+public:
+    template<typename Key, typename Value>
+    struct Lookup {
+        Key key;
+        Value value;
+        bool found;
+
+        Lookup(const Key& keyIn) : key(keyIn), value(), found(false) {}
+    };
+
 private:
-    CCoinsViewCache& cache;
-    CCoinsMap::iterator it;
-    size_t cachedCoinUsage; // Cached memory usage of the CCoins object before modification
-    CCoinsModifier(CCoinsViewCache& cache_, CCoinsMap::iterator it_, size_t usage);
+    friend class CCoinsViewCache;
+
+    const CCoinsView *base;
+    std::vector<Lookup<COutPoint, Coin>> coins;
+    std::vector<Lookup<uint256, SproutMerkleTree>> sproutAnchors;
+    std::vector<Lookup<uint256, bool>> saplingAnchors;
+    std::vector<Lookup<uint256, bool>> sproutNullifiers;
+    std::vector<Lookup<uint256, bool>> saplingNullifiers;
+
+    CCoinsPrefetch(const CCoinsView *baseIn) : base(baseIn) {}
 
 public:
-    CCoins* operator->() { return &it->second.coins; }
-    CCoins& operator*() { return it->second.coins; }
-    ~CCoinsModifier();
-    friend class CCoinsViewCache;
+    //! The number of lookups.
+    size_t size() const;
+
+    //! Do lookup i, for 0 <= i < size().
+    void Fetch(size_t i);
 };
 
-/** The set of shielded requirements that might be unsatisfied. */
-enum class UnsatisfiedShieldedReq {
-    SproutDuplicateNullifier,
-    SproutUnknownAnchor,
-    SaplingDuplicateNullifier,
-    SaplingUnknownAnchor,
+/**
+ * The most recently used roots that are known to be valid anchors in the
+ * chain. Spends nearly always use one of the last few anchors, so a cache
+ * remembers them after it has flushed their trees, and can answer
+ * HaveSaplingAnchor without reading or copying a tree.
+ */
+class CRecentAnchors
+{
+private:
+    size_t nMaxSize;
+    std::list<uint256> roots;
+    std::unordered_map<uint256, std::list<uint256>::iterator, SaltedTxidHasher> index;
+
+public:
+    static const size_t DEFAULT_SIZE = 128;
+
+    CRecentAnchors(size_t nMaxSizeIn = DEFAULT_SIZE) : nMaxSize(nMaxSizeIn) {}
+
+    //! Whether rt is in the set, marking it as the most recently used if so.
+    bool contains(const uint256 &rt);
+
+    //! Add rt as the most recently used root, evicting the least recently
+    //! used one if the set is full.
+    void insert(const uint256 &rt);
+
+    void erase(const uint256 &rt);
+    void clear();
+    size_t size() const { return roots.size(); }
 };
 
 /** CCoinsView that adds a memory cache for transactions to another CCoinsView */
 class CCoinsViewCache : public CCoinsViewBacked
 {
 protected:
-    /* Whether this cache has an active modifier. */
-    bool hasModifier;
-
-
     /**
      * Make mutable so that we can "fill the cache" even from Get-methods
      * declared as "const".
      */
+    //! The size of the chunks of cacheMemoryResource.
+    const size_t nPoolChunkBytes;
+    mutable CCoinsCacheMemoryResource cacheMemoryResource;
     mutable uint256 hashBlock;
     mutable CCoinsMap cacheCoins;
     mutable uint256 hashSproutAnchor;
@@ -477,20 +474,33 @@ protected:
     mutable CNullifiersMap cacheSproutNullifiers;
     mutable CNullifiersMap cacheSaplingNullifiers;
     mutable CHistoryCacheMap historyCacheMap;
+    mutable CHistoryPeaksMap historyPeaks;
+    mutable CRecentAnchors recentSaplingAnchors;
 
-    /* Cached dynamic memory usage for the inner CCoins objects. */
+    /* Cached dynamic memory usage for the inner Coin objects. */
     mutable size_t cachedCoinsUsage;
 
+    /* Number of coin lookups that were served by the cache, and that were not. */
+    mutable uint64_t nCacheHits;
+    mutable uint64_t nCacheMisses;
+
 public:
     CCoinsViewCache(CCoinsView *baseIn);
+    /**
+     * A cache whose nodes are carved out of chunks of nPoolChunkBytes. The
+     * chunks of the UTXO set cache of the node are LARGE_PAGE_BYTES, so that
+     * they can be backed by huge pages with -largepages.
+     */
+    CCoinsViewCache(CCoinsView *baseIn, size_t nPoolChunkBytesIn);
     ~CCoinsViewCache();
 
     // Standard CCoinsView methods
     bool GetSproutAnchorAt(const uint256 &rt, SproutMerkleTree &tree) const;
     bool GetSaplingAnchorAt(const uint256 &rt, SaplingMerkleTree &tree) const;
+    bool HaveSaplingAnchor(const uint256 &rt) const;
     bool GetNullifier(const uint256 &nullifier, ShieldedType type) const;
-    bool GetCoins(const uint256 &txid, CCoins &coins) const;
-    bool HaveCoins(const uint256 &txid) const;
+    bool GetCoin(const COutPoint &outpoint, Coin &coin) const;
+    bool HaveCoin(const COutPoint &outpoint) const;
     uint256 GetBestBlock() const;
     uint256 GetBestAnchor(ShieldedType type) const;
     HistoryIndex GetHistoryLength(uint32_t epochId) const;
@@ -505,7 +515,8 @@ public:
                     CAnchorsSaplingMap &mapSaplingAnchors,
                     CNullifiersMap &mapSproutNullifiers,
                     CNullifiersMap &mapSaplingNullifiers,
-                    CHistoryCacheMap &historyCacheMap);
+                    CHistoryCacheMap &historyCacheMap,
+                    bool fErase);
 
     // Adds the tree to mapSproutAnchors (or mapSaplingAnchors based on the type of tree)
     // and sets the current commitment root to this root.
@@ -525,28 +536,46 @@ public:
     void PopHistoryNode(uint32_t epochId);
 
     /**
-     * Return a pointer to CCoins in the cache, or NULL if not found. This is
-     * more efficient than GetCoins. Modifications to other cache entries are
-     * allowed while accessing the returned pointer.
+     * Check if we have the given utxo already loaded in this cache.
+     * The semantics are the same as HaveCoin(), but no calls to
+     * the backing CCoinsView are made.
+     */
+    bool HaveCoinInCache(const COutPoint &outpoint) const;
+
+    /**
+     * Return the lookups in the base view of the inputs, anchors and
+     * nullifiers of the given transactions that are not in this cache, other
+     * than the outputs of earlier transactions in vtx. Once they have been
+     * fetched, AddPrefetched() caches their results, as the lookups during
+     * validation would have done.
+     */
+    CCoinsPrefetch GetPrefetch(const std::vector<CTransaction>& vtx) const;
+
+    //! Cache the results of the fetched lookups, unless already cached.
+    void AddPrefetched(CCoinsPrefetch& prefetch);
+
+    /**
+     * Return a reference to Coin in the cache, or a pruned one if not found. This is
+     * more efficient than GetCoin. Modifications to other cache entries are
+     * allowed while accessing the returned reference.
      */
-    const CCoins* AccessCoins(const uint256 &txid) const;
+    const Coin& AccessCoin(const COutPoint &output) const;
 
     /**
-     * Return a modifiable reference to a CCoins. If no entry with the given
-     * txid exists, a new one is created. Simultaneous modifications are not
-     * allowed.
+     * Add a coin. Set possible_overwrite to true if a non-pruned version may
+     * already exist. We rely on Zcash-derived block chains having no duplicate
+     * transactions, since BIP 30 and (except for the genesis block) BIP 34 have
+     * been enforced since launch. See the Zcash protocol specification, section
+     * "Bitcoin Improvement Proposals".
      */
-    CCoinsModifier ModifyCoins(const uint256 &txid);
+    void AddCoin(const COutPoint& outpoint, Coin&& coin, bool possible_overwrite);
 
     /**
-     * Return a modifiable reference to a CCoins. Assumes that no entry with the given
-     * txid exists and creates a new one. This saves a database access in the case where
-     * the coins were to be wiped out by FromTx anyway. We rely on Zcash-derived block chains
-     * having no duplicate transactions, since BIP 30 and (except for the genesis block)
-     * BIP 34 have been enforced since launch. See the Zcash protocol specification, section
-     * "Bitcoin Improvement Proposals". Simultaneous modifications are not allowed.
+     * Spend a coin. Pass moveto in order to get the deleted data.
+     * If no unspent output exists for the passed outpoint, this call
+     * has no effect.
      */
-    CCoinsModifier ModifyNewCoins(const uint256 &txid);
+    bool SpendCoin(const COutPoint &outpoint, Coin* moveto = nullptr);
 
     /**
      * Push the modifications applied to this cache to its base.
@@ -555,12 +584,32 @@ public:
      */
     bool Flush();
 
-    //! Calculate the size of the cache (in number of transactions)
+    /**
+     * Push the modifications applied to this cache to its base like Flush(),
+     * but keep the unspent coins cached as clean entries. If the cache then
+     * uses more than nTargetUsage bytes, only the most recently created coins
+     * are kept, as those are the most likely to be spent soon. The anchor and
+     * nullifier caches are emptied as by Flush().
+     */
+    bool Sync(size_t nTargetUsage);
+
+    /**
+     * Discard the contents of this cache, including any unflushed
+     * modifications, so that it is refilled from its base. Used when the
+     * base view has been replaced, as by loading a UTXO set snapshot.
+     */
+    void Reset();
+
+    //! Calculate the size of the cache (in number of transaction outputs)
     unsigned int GetCacheSize() const;
 
     //! Calculate the size of the cache (in bytes)
     size_t DynamicMemoryUsage() const;
 
+    //! Number of coin lookups that were served by the cache, and that were read from the base view
+    uint64_t GetCacheHits() const { return nCacheHits; }
+    uint64_t GetCacheMisses() const { return nCacheMisses; }
+
     /**
      * Amount of bitcoins coming in to a transaction
      * Note that lightweight clients may not know anything besides the hash of previous transactions,
@@ -582,11 +631,11 @@ public:
 
     const CTxOut &GetOutputFor(const CTxIn& input) const;
 
-    friend class CCoinsModifier;
-
 private:
-    CCoinsMap::iterator FetchCoins(const uint256 &txid);
-    CCoinsMap::const_iterator FetchCoins(const uint256 &txid) const;
+    CCoinsMap::iterator FetchCoin(const COutPoint &outpoint) const;
+
+    //! Release the memory pool of the (empty) cache maps and start a new one.
+    void ReallocateCache();
 
     /**
      * By making the copy constructor private, we prevent accidentally using it when one intends to create a cache on top of a base cache.
@@ -629,6 +678,27 @@ private:
 
     //! Selects history cache for specified epoch.
     HistoryCache& SelectHistoryCache(uint32_t epochId) const;
+
+    //! Keeps the nodes of the history tree of an epoch that its next update
+    //! will need, once its history cache has changed or is about to be
+    //! written to the base view. This lets the tree be updated after a flush
+    //! without reading the base view.
+    void UpdateHistoryPeaks(uint32_t epochId, const HistoryCache &historyCache);
+
+    //! Calls UpdateHistoryPeaks for every epoch in the history cache.
+    void UpdateAllHistoryPeaks();
 };
 
+//! Utility function to add all of a transaction's outputs to a cache.
+// When check is false, this assumes that overwrites are only possible for coinbase transactions.
+// When check is true, the underlying view may be queried to determine whether an addition is
+// an overwrite.
+void AddCoins(CCoinsViewCache& cache, const CTransaction& tx, int nHeight, bool check = false);
+
+//! Utility function to find any unspent output with a given txid.
+// This function can be quite expensive because in the event of a transaction
+// which is not found in the cache, it can cause up to MAX_OUTPUTS_PER_BLOCK
+// lookups to database, so it should be used with care.
+const Coin& AccessByTxid(const CCoinsViewCache& cache, const uint256& txid);
+
 #endif // BITCOIN_COINS_H
@@ -0,0 +1,322 @@
+// Copyright (c) 2021 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "coinssnapshot.h"
+
+#include "util.h"
+
+#include <boost/thread.hpp>
+
+CCoinsViewSnapshot::Batch::Batch() :
+    coins(0, SaltedOutpointHasher(), std::equal_to<COutPoint>(), &resource),
+    sproutAnchors(0, SaltedTxidHasher(), std::equal_to<uint256>(), &resource),
+    saplingAnchors(0, SaltedTxidHasher(), std::equal_to<uint256>(), &resource),
+    sproutNullifiers(0, SaltedTxidHasher(), std::equal_to<uint256>(), &resource),
+    saplingNullifiers(0, SaltedTxidHasher(), std::equal_to<uint256>(), &resource),
+    cachedUsage(0) { }
+
+CCoinsViewSnapshot::CCoinsViewSnapshot(CCoinsView* baseIn) :
+    CCoinsViewBacked(baseIn), fWriting(false), fWritten(false), fFailed(false) { }
+
+CCoinsViewSnapshot::~CCoinsViewSnapshot() { }
+
+bool CCoinsViewSnapshot::GetSproutAnchorAt(const uint256 &rt, SproutMerkleTree &tree) const {
+    if (batch) {
+        CAnchorsSproutMap::const_iterator it = batch->sproutAnchors.find(rt);
+        if (it != batch->sproutAnchors.end()) {
+            if (!it->second.entered) {
+                return false;
+            }
+            tree = it->second.tree;
+            return true;
+        }
+    }
+    return base->GetSproutAnchorAt(rt, tree);
+}
+
+bool CCoinsViewSnapshot::GetSaplingAnchorAt(const uint256 &rt, SaplingMerkleTree &tree) const {
+    if (batch) {
+        CAnchorsSaplingMap::const_iterator it = batch->saplingAnchors.find(rt);
+        if (it != batch->saplingAnchors.end()) {
+            if (!it->second.entered) {
+                return false;
+            }
+            tree = it->second.tree;
+            return true;
+        }
+    }
+    return base->GetSaplingAnchorAt(rt, tree);
+}
+
+bool CCoinsViewSnapshot::HaveSaplingAnchor(const uint256 &rt) const {
+    if (batch) {
+        CAnchorsSaplingMap::const_iterator it = batch->saplingAnchors.find(rt);
+        if (it != batch->saplingAnchors.end()) {
+            return it->second.entered;
+        }
+    }
+    return base->HaveSaplingAnchor(rt);
+}
+
+bool CCoinsViewSnapshot::GetNullifier(const uint256 &nullifier, ShieldedType type) const {
+    if (batch) {
+        const CNullifiersMap* nullifiers = nullptr;
+        switch (type) {
+            case SPROUT:
+                nullifiers = &batch->sproutNullifiers;
+                break;
+            case SAPLING:
+                nullifiers = &batch->saplingNullifiers;
+                break;
+            default:
+                throw std::runtime_error("Unknown shielded type");
+        }
+        CNullifiersMap::const_iterator it = nullifiers->find(nullifier);
+        if (it != nullifiers->end()) {
+            return it->second.entered;
+        }
+    }
+    return base->GetNullifier(nullifier, type);
+}
+
+bool CCoinsViewSnapshot::GetCoin(const COutPoint &outpoint, Coin &coin) const {
+    if (batch) {
+        CCoinsMap::const_iterator it = batch->coins.find(outpoint);
+        if (it != batch->coins.end()) {
+            if (it->second.coin.IsSpent()) {
+                return false;
+            }
+            coin = it->second.coin;
+            return true;
+        }
+    }
+    return base->GetCoin(outpoint, coin);
+}
+
+bool CCoinsViewSnapshot::HaveCoin(const COutPoint &outpoint) const {
+    if (batch) {
+        CCoinsMap::const_iterator it = batch->coins.find(outpoint);
+        if (it != batch->coins.end()) {
+            return !it->second.coin.IsSpent();
+        }
+    }
+    return base->HaveCoin(outpoint);
+}
+
+uint256 CCoinsViewSnapshot::GetBestBlock() const {
+    if (batch && !batch->hashBlock.IsNull()) {
+        return batch->hashBlock;
+    }
+    return base->GetBestBlock();
+}
+
+uint256 CCoinsViewSnapshot::GetBestAnchor(ShieldedType type) const {
+    if (batch) {
+        switch (type) {
+            case SPROUT:
+                if (!batch->hashSproutAnchor.IsNull()) {
+                    return batch->hashSproutAnchor;
+                }
+                break;
+            case SAPLING:
+                if (!batch->hashSaplingAnchor.IsNull()) {
+                    return batch->hashSaplingAnchor;
+                }
+                break;
+            default:
+                throw std::runtime_error("Unknown shielded type");
+        }
+    }
+    return base->GetBestAnchor(type);
+}
+
+HistoryIndex CCoinsViewSnapshot::GetHistoryLength(uint32_t epochId) const {
+    if (batch) {
+        CHistoryCacheMap::const_iterator it = batch->history.find(epochId);
+        if (it != batch->history.end()) {
+            return it->second.length;
+        }
+    }
+    return base->GetHistoryLength(epochId);
+}
+
+HistoryNode CCoinsViewSnapshot::GetHistoryAt(uint32_t epochId, HistoryIndex index) const {
+    if (batch) {
+        CHistoryCacheMap::const_iterator it = batch->history.find(epochId);
+        if (it != batch->history.end() && index >= it->second.updateDepth) {
+            auto node = it->second.appends.find(index);
+            if (node == it->second.appends.end()) {
+                throw std::runtime_error("Invalid history request");
+            }
+            return node->second;
+        }
+    }
+    return base->GetHistoryAt(epochId, index);
+}
+
+uint256 CCoinsViewSnapshot::GetHistoryRoot(uint32_t epochId) const {
+    if (batch) {
+        CHistoryCacheMap::const_iterator it = batch->history.find(epochId);
+        if (it != batch->history.end()) {
+            return it->second.root;
+        }
+    }
+    return base->GetHistoryRoot(epochId);
+}
+
+template<typename Map, typename MapEntry>
+static void TakeAnchors(Map &mapAnchors, Map &batchAnchors, size_t &cachedUsage, bool fErase)
+{
+    for (auto it = mapAnchors.begin(); it != mapAnchors.end(); it = fErase ? mapAnchors.erase(it) : std::next(it)) {
+        if (it->second.flags & MapEntry::DIRTY) {
+            MapEntry& entry = batchAnchors[it->first];
+            entry.entered = it->second.entered;
+            entry.tree = it->second.tree;
+            entry.flags = MapEntry::DIRTY;
+            cachedUsage += entry.tree.DynamicMemoryUsage();
+        }
+    }
+}
+
+static void TakeNullifiers(CNullifiersMap &mapNullifiers, CNullifiersMap &batchNullifiers, bool fErase)
+{
+    for (auto it = mapNullifiers.begin(); it != mapNullifiers.end(); it = fErase ? mapNullifiers.erase(it) : std::next(it)) {
+        if (it->second.flags & CNullifiersCacheEntry::DIRTY) {
+            CNullifiersCacheEntry& entry = batchNullifiers[it->first];
+            entry.entered = it->second.entered;
+            entry.flags = CNullifiersCacheEntry::DIRTY;
+        }
+    }
+}
+
+bool CCoinsViewSnapshot::BatchWrite(CCoinsMap &mapCoins,
+                                    const uint256 &hashBlock,
+                                    const uint256 &hashSproutAnchor,
+                                    const uint256 &hashSaplingAnchor,
+                                    CAnchorsSproutMap &mapSproutAnchors,
+                                    CAnchorsSaplingMap &mapSaplingAnchors,
+                                    CNullifiersMap &mapSproutNullifiers,
+                                    CNullifiersMap &mapSaplingNullifiers,
+                                    CHistoryCacheMap &historyCacheMap,
+                                    bool fErase) {
+    bool fOk = Finish();
+
+    std::unique_ptr<Batch> next(new Batch());
+    for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end(); it = fErase ? mapCoins.erase(it) : std::next(it)) {
+        // Entries that are FRESH and spent were never seen by the base view.
+        if (!(it->second.flags & CCoinsCacheEntry::DIRTY) ||
+            ((it->second.flags & CCoinsCacheEntry::FRESH) && it->second.coin.IsSpent())) {
+            continue;
+        }
+        CCoinsCacheEntry& entry = next->coins[it->first];
+        if (fErase) {
+            entry.coin = std::move(it->second.coin);
+        } else {
+            entry.coin = it->second.coin;
+        }
+        entry.flags = CCoinsCacheEntry::DIRTY;
+        next->cachedUsage += entry.coin.DynamicMemoryUsage();
+    }
+    TakeAnchors<CAnchorsSproutMap, CAnchorsSproutCacheEntry>(mapSproutAnchors, next->sproutAnchors, next->cachedUsage, fErase);
+    TakeAnchors<CAnchorsSaplingMap, CAnchorsSaplingCacheEntry>(mapSaplingAnchors, next->saplingAnchors, next->cachedUsage, fErase);
+    TakeNullifiers(mapSproutNullifiers, next->sproutNullifiers, fErase);
+    TakeNullifiers(mapSaplingNullifiers, next->saplingNullifiers, fErase);
+    next->history = historyCacheMap;
+    next->hashBlock = hashBlock;
+    next->hashSproutAnchor = hashSproutAnchor;
+    next->hashSaplingAnchor = hashSaplingAnchor;
+
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        batch = std::move(next);
+        fWritten = false;
+    }
+    cond.notify_all();
+    return fOk;
+}
+
+bool CCoinsViewSnapshot::WriteBatch() {
+    try {
+        return base->BatchWrite(batch->coins,
+                                batch->hashBlock,
+                                batch->hashSproutAnchor,
+                                batch->hashSaplingAnchor,
+                                batch->sproutAnchors,
+                                batch->saplingAnchors,
+                                batch->sproutNullifiers,
+                                batch->saplingNullifiers,
+                                batch->history,
+                                false);
+    } catch (const std::exception& e) {
+        LogPrintf("%s: error writing the chain state: %s\n", __func__, e.what());
+        return false;
+    }
+}
+
+bool CCoinsViewSnapshot::Finish() {
+    // A flush that is already in progress must not be abandoned.
+    boost::this_thread::disable_interruption di;
+
+    boost::unique_lock<boost::mutex> lock(mutex);
+    while (batch && !fWritten) {
+        if (fWriting) {
+            cond.wait(lock);
+            continue;
+        }
+        fWriting = true;
+        lock.unlock();
+        bool fOk = WriteBatch();
+        lock.lock();
+        fWriting = false;
+        fWritten = true;
+        fFailed |= !fOk;
+        cond.notify_all();
+    }
+    batch.reset();
+    return !fFailed;
+}
+
+bool CCoinsViewSnapshot::ReleaseIfWritten() {
+    boost::unique_lock<boost::mutex> lock(mutex);
+    if (batch && fWritten) {
+        batch.reset();
+    }
+    return !fFailed;
+}
+
+size_t CCoinsViewSnapshot::DynamicMemoryUsage() const {
+    if (!batch) {
+        return 0;
+    }
+    return memusage::DynamicUsage(batch->resource) +
+           memusage::DynamicUsage(batch->coins) +
+           memusage::DynamicUsage(batch->sproutAnchors) +
+           memusage::DynamicUsage(batch->saplingAnchors) +
+           memusage::DynamicUsage(batch->sproutNullifiers) +
+           memusage::DynamicUsage(batch->saplingNullifiers) +
+           memusage::DynamicUsage(batch->history) +
+           batch->cachedUsage;
+}
+
+void CCoinsViewSnapshot::ThreadWrite() {
+    while (true) {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            while (!batch || fWritten || fWriting) {
+                cond.wait(lock);
+            }
+            fWriting = true;
+        }
+        int64_t nStart = GetTimeMicros();
+        bool fOk = WriteBatch();
+        LogPrint("bench", "    - Background chain state write: %.2fms\n", (GetTimeMicros() - nStart) * 0.001);
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            fWriting = false;
+            fWritten = true;
+            fFailed |= !fOk;
+        }
+        cond.notify_all();
+    }
+}
@@ -0,0 +1,115 @@
+// Copyright (c) 2021 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifndef ZCASH_COINSSNAPSHOT_H
+#define ZCASH_COINSSNAPSHOT_H
+
+#include "coins.h"
+
+#include <memory>
+
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+/**
+ * A layer between a CCoinsViewCache and its base that lets the changes
+ * flushed from the cache be written to the base on a background thread.
+ *
+ * BatchWrite() takes the changes and returns without writing them. They are
+ * then frozen: a writer thread running ThreadWrite() writes them to the base
+ * view, while lookups from the cache above keep seeing them until they have
+ * been written. Only one batch is pending at a time, so a flush waits for
+ * the write of the previous one.
+ *
+ * All methods except ThreadWrite() must be called from threads that hold
+ * cs_main. The writer thread only reads the frozen batch, and the batch is
+ * only released on a thread holding cs_main, so lookups do not need to lock.
+ */
+class CCoinsViewSnapshot : public CCoinsViewBacked
+{
+private:
+    struct Batch {
+        CCoinsCacheMemoryResource resource;
+        CCoinsMap coins;
+        uint256 hashBlock;
+        uint256 hashSproutAnchor;
+        uint256 hashSaplingAnchor;
+        CAnchorsSproutMap sproutAnchors;
+        CAnchorsSaplingMap saplingAnchors;
+        CNullifiersMap sproutNullifiers;
+        CNullifiersMap saplingNullifiers;
+        CHistoryCacheMap history;
+
+        //! Dynamic memory usage of the cached coins and anchor trees.
+        size_t cachedUsage;
+
+        Batch();
+    };
+
+    std::unique_ptr<Batch> batch;
+
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    //! The batch is being written to the base view.
+    bool fWriting;
+    //! The batch has been written to the base view.
+    bool fWritten;
+    //! A write to the base view has failed.
+    bool fFailed;
+
+    //! Write the batch to the base view. Called with fWriting set.
+    bool WriteBatch();
+
+public:
+    CCoinsViewSnapshot(CCoinsView* baseIn);
+    ~CCoinsViewSnapshot();
+
+    bool GetSproutAnchorAt(const uint256 &rt, SproutMerkleTree &tree) const;
+    bool GetSaplingAnchorAt(const uint256 &rt, SaplingMerkleTree &tree) const;
+    bool HaveSaplingAnchor(const uint256 &rt) const;
+    bool GetNullifier(const uint256 &nullifier, ShieldedType type) const;
+    bool GetCoin(const COutPoint &outpoint, Coin &coin) const;
+    bool HaveCoin(const COutPoint &outpoint) const;
+    uint256 GetBestBlock() const;
+    uint256 GetBestAnchor(ShieldedType type) const;
+    HistoryIndex GetHistoryLength(uint32_t epochId) const;
+    HistoryNode GetHistoryAt(uint32_t epochId, HistoryIndex index) const;
+    uint256 GetHistoryRoot(uint32_t epochId) const;
+
+    /**
+     * Take the changes to be written to the base view. This waits for the
+     * previous batch to be written, and returns false if that failed.
+     */
+    bool BatchWrite(CCoinsMap &mapCoins,
+                    const uint256 &hashBlock,
+                    const uint256 &hashSproutAnchor,
+                    const uint256 &hashSaplingAnchor,
+                    CAnchorsSproutMap &mapSproutAnchors,
+                    CAnchorsSaplingMap &mapSaplingAnchors,
+                    CNullifiersMap &mapSproutNullifiers,
+                    CNullifiersMap &mapSaplingNullifiers,
+                    CHistoryCacheMap &historyCacheMap,
+                    bool fErase);
+
+    /**
+     * Wait until the pending batch (if any) has been written to the base
+     * view, writing it on this thread if no writer has started on it.
+     * Returns false if a write has failed.
+     */
+    bool Finish();
+
+    /**
+     * Release the pending batch if it has been written, without waiting.
+     * Returns false if a write has failed.
+     */
+    bool ReleaseIfWritten();
+
+    //! Memory used by the pending batch.
+    size_t DynamicMemoryUsage() const;
+
+    //! Write each batch to the base view as it arrives, until interrupted.
+    void ThreadWrite();
+};
+
+#endif // ZCASH_COINSSNAPSHOT_H
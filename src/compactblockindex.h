@@ -0,0 +1,100 @@
+// Copyright (c) 2021 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifndef ZCASH_COMPACTBLOCKINDEX_H
+#define ZCASH_COMPACTBLOCKINDEX_H
+
+#include "primitives/block.h"
+#include "serialize.h"
+#include "uint256.h"
+#include "zcash/NoteEncryption.hpp"
+
+#include <algorithm>
+#include <vector>
+
+/**
+ * The parts of a Sapling output that are needed to detect it with an
+ * incoming viewing key, as in the CompactOutput of ZIP 307.
+ */
+struct CCompactSaplingOutput {
+    uint256 cmu;
+    uint256 epk;
+    libzcash::SaplingCompactCiphertext ciphertext;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(cmu);
+        READWRITE(epk);
+        READWRITE(ciphertext);
+    }
+
+    CCompactSaplingOutput() : ciphertext() {}
+
+    CCompactSaplingOutput(const OutputDescription& output) :
+        cmu(output.cmu), epk(output.ephemeralKey)
+    {
+        std::copy_n(output.encCiphertext.begin(), ciphertext.size(), ciphertext.begin());
+    }
+};
+
+/**
+ * The Sapling nullifiers and outputs of a transaction, as in the CompactTx of
+ * ZIP 307.
+ */
+struct CCompactTx {
+    uint256 hash;
+    std::vector<uint256> vSaplingNullifiers;
+    std::vector<CCompactSaplingOutput> vSaplingOutputs;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(hash);
+        READWRITE(vSaplingNullifiers);
+        READWRITE(vSaplingOutputs);
+    }
+
+    CCompactTx() {}
+
+    CCompactTx(const CTransaction& tx) : hash(tx.GetHash()) {
+        for (const SpendDescription& spend : tx.vShieldedSpend) {
+            vSaplingNullifiers.push_back(spend.nullifier);
+        }
+        for (const OutputDescription& output : tx.vShieldedOutput) {
+            vSaplingOutputs.emplace_back(output);
+        }
+    }
+};
+
+/**
+ * The Sapling data of a block, in the same order as in the block, which is
+ * enough for a wallet to find its Sapling notes and spends and to update
+ * its Sapling witnesses. Transactions without Sapling spends or outputs
+ * are omitted.
+ */
+struct CCompactBlock {
+    std::vector<CCompactTx> vtx;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(vtx);
+    }
+
+    CCompactBlock() {}
+
+    CCompactBlock(const CBlock& block) {
+        for (const CTransaction& tx : block.vtx) {
+            if (!tx.vShieldedSpend.empty() || !tx.vShieldedOutput.empty()) {
+                vtx.emplace_back(tx);
+            }
+        }
+    }
+};
+
+#endif // ZCASH_COMPACTBLOCKINDEX_H
@@ -40,6 +40,14 @@
 #include <unistd.h>
 #endif
 
+// Sockets are waited on with epoll and poll where they are available, which,
+// unlike select, do not limit the number of the sockets or their descriptors.
+#if !defined(WIN32) && defined(HAVE_SYS_EPOLL_H)
+#define USE_EPOLL
+#include <poll.h>
+#include <sys/epoll.h>
+#endif
+
 #ifdef WIN32
 #define MSG_DONTWAIT        0
 #else
@@ -97,7 +105,7 @@ size_t strnlen( const char *start, size_t max_len);
 #endif // HAVE_DECL_STRNLEN
 
 bool static inline IsSelectableSocket(SOCKET s) {
-#ifdef WIN32
+#if defined(WIN32) || defined(USE_EPOLL)
     return true;
 #else
     return (s < FD_SETSIZE);
@@ -0,0 +1,55 @@
+// Copyright (c) 2021 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "consensus/merkle.h"
+
+#include "crypto/sha256.h"
+#include "hash.h"
+
+bool ComputeMerkleLevel(const uint256* in, size_t nSize, uint256* out)
+{
+    assert(nSize > 1);
+
+    // Check for the mutation before hashing, as out may overwrite in.
+    bool mutated = nSize % 2 == 0 && in[nSize - 2] == in[nSize - 1];
+
+    // The last hash of an odd-sized level is read before the pairs are
+    // written, for the same reason.
+    uint256 last;
+    if (nSize % 2 == 1) {
+        last = Hash(in[nSize - 1].begin(), in[nSize - 1].end(),
+                    in[nSize - 1].begin(), in[nSize - 1].end());
+    }
+
+    // Each pair of adjacent hashes is one contiguous 64-byte block.
+    SHA256D64(out[0].begin(), in[0].begin(), nSize / 2);
+    if (nSize % 2 == 1) {
+        out[nSize / 2] = last;
+    }
+    return mutated;
+}
+
+uint256 ComputeMerkleRoot(std::vector<uint256> leaves, bool* mutated)
+{
+    bool mutation = false;
+    size_t nSize = leaves.size();
+    while (nSize > 1) {
+        mutation |= ComputeMerkleLevel(leaves.data(), nSize, leaves.data());
+        nSize = (nSize + 1) / 2;
+    }
+    if (mutated) {
+        *mutated = mutation;
+    }
+    return leaves.empty() ? uint256() : leaves[0];
+}
+
+uint256 BlockMerkleRoot(const CBlock& block, bool* mutated)
+{
+    std::vector<uint256> leaves;
+    leaves.reserve(block.vtx.size());
+    for (const CTransaction& tx : block.vtx) {
+        leaves.push_back(tx.GetHash());
+    }
+    return ComputeMerkleRoot(std::move(leaves), mutated);
+}
@@ -0,0 +1,39 @@
+// Copyright (c) 2021 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifndef ZCASH_CONSENSUS_MERKLE_H
+#define ZCASH_CONSENSUS_MERKLE_H
+
+#include "primitives/block.h"
+#include "uint256.h"
+
+#include <vector>
+
+/**
+ * Hash the nSize hashes of one level of a block's Merkle tree, starting at
+ * in, into the (nSize + 1) / 2 hashes of the next level, starting at out.
+ * The last hash of an odd-sized level is paired with itself. All the pairs
+ * of a level are hashed in one batch. out may be equal to in.
+ *
+ * Returns true if the level ends in two identical hashes, which is how a
+ * duplication of transactions that leaves the Merkle root unchanged shows up
+ * (CVE-2012-2459, see CBlock::BuildMerkleTree).
+ */
+bool ComputeMerkleLevel(const uint256* in, size_t nSize, uint256* out);
+
+/**
+ * Compute the Merkle root of the given leaves, hashing each level in place
+ * in the leaves vector. If non-NULL, *mutated is set to whether mutation was
+ * detected in the tree.
+ */
+uint256 ComputeMerkleRoot(std::vector<uint256> leaves, bool* mutated = NULL);
+
+/**
+ * Compute the Merkle root of a block's transactions without building the
+ * in-memory Merkle tree. If non-NULL, *mutated is set to whether mutation
+ * was detected in the tree, as with CBlock::BuildMerkleTree.
+ */
+uint256 BlockMerkleRoot(const CBlock& block, bool* mutated = NULL);
+
+#endif // ZCASH_CONSENSUS_MERKLE_H
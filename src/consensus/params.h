@@ -342,6 +342,8 @@ struct Params {
     uint256 powLimit;
     std::optional<uint32_t> nPowAllowMinDifficultyBlocksAfterHeight;
     bool fPowNoRetargeting;
+    /** Regtest only (-regtestfastmode): blocks are accepted without a valid Equihash solution. */
+    bool fSkipEquihash = false;
     int64_t nPowAveragingWindow;
     int64_t nPowMaxAdjustDown;
     int64_t nPowMaxAdjustUp;
@@ -26,6 +26,7 @@
 void eh_HashState::Update(const unsigned char *input, size_t inputLen)
 {
     blake2b_update(inner.get(), input, inputLen);
+    this->input.insert(this->input.end(), input, input + inputLen);
 }
 
 void eh_HashState::Finalize(unsigned char *hash, size_t hLen)
@@ -166,13 +167,32 @@ void Equihash<N,K>::InitialiseState(eh_HashState& base_state)
     base_state = eh_HashState((512/N)*N/8, personalization);
 }
 
+/** Number of hashes GenerateHashes() is asked for at a time while building the first list. */
+static const size_t EH_HASH_BATCH_SIZE = 256;
+
+/**
+ * Compute the hashes of base_state's input followed by each of the indices
+ * g, ..., g+count-1, several lanes at a time, writing count hashes of
+ * hLen bytes (the full output length of base_state) to hashes.
+ */
+void GenerateHashes(const eh_HashState& base_state, eh_index g, size_t count,
+                    unsigned char* hashes, size_t hLen)
+{
+    assert(hLen == base_state.length);
+    eh_index lei[EH_HASH_BATCH_SIZE];
+    assert(count <= EH_HASH_BATCH_SIZE);
+    for (size_t i = 0; i < count; i++) {
+        lei[i] = htole32(g + i);
+    }
+    blake2b_hash_many(hLen, base_state.personal.data(),
+                      base_state.input.data(), base_state.input.size(),
+                      (const unsigned char*) lei, sizeof(eh_index), count, hashes);
+}
+
 void GenerateHash(const eh_HashState& base_state, eh_index g,
                   unsigned char* hash, size_t hLen)
 {
-    eh_HashState state(base_state);
-    eh_index lei = htole32(g);
-    state.Update((const unsigned char*) &lei, sizeof(eh_index));
-    state.Finalize(hash, hLen);
+    GenerateHashes(base_state, g, 1, hash, hLen);
 }
 
 // Big-endian so that lexicographic array comparison is equivalent to integer
@@ -349,12 +369,14 @@ bool Equihash<N,K>::BasicSolve(const eh_HashState& base_state,
     size_t lenIndices = sizeof(eh_index);
     std::vector<FullStepRow<FullWidth>> X;
     X.reserve(init_size);
-    unsigned char tmpHash[HashOutput];
-    for (eh_index g = 0; X.size() < init_size; g++) {
-        GenerateHash(base_state, g, tmpHash, HashOutput);
-        for (eh_index i = 0; i < IndicesPerHashOutput && X.size() < init_size; i++) {
-            X.emplace_back(tmpHash+(i*N/8), N/8, HashLength,
-                           CollisionBitLength, (g*IndicesPerHashOutput)+i);
+    unsigned char tmpHashes[EH_HASH_BATCH_SIZE][HashOutput];
+    for (eh_index g = 0; X.size() < init_size; g += EH_HASH_BATCH_SIZE) {
+        GenerateHashes(base_state, g, EH_HASH_BATCH_SIZE, tmpHashes[0], HashOutput);
+        for (eh_index b = 0; b < EH_HASH_BATCH_SIZE && X.size() < init_size; b++) {
+            for (eh_index i = 0; i < IndicesPerHashOutput && X.size() < init_size; i++) {
+                X.emplace_back(tmpHashes[b]+(i*N/8), N/8, HashLength,
+                               CollisionBitLength, ((g+b)*IndicesPerHashOutput)+i);
+            }
         }
         if (cancelled(ListGeneration)) throw solver_cancelled;
     }
@@ -528,12 +550,14 @@ bool Equihash<N,K>::OptimisedSolve(const eh_HashState& base_state,
         size_t lenIndices = sizeof(eh_trunc);
         std::vector<TruncatedStepRow<TruncatedWidth>> Xt;
         Xt.reserve(init_size);
-        unsigned char tmpHash[HashOutput];
-        for (eh_index g = 0; Xt.size() < init_size; g++) {
-            GenerateHash(base_state, g, tmpHash, HashOutput);
-            for (eh_index i = 0; i < IndicesPerHashOutput && Xt.size() < init_size; i++) {
-                Xt.emplace_back(tmpHash+(i*N/8), N/8, HashLength, CollisionBitLength,
-                                (g*IndicesPerHashOutput)+i, CollisionBitLength + 1);
+        unsigned char tmpHashes[EH_HASH_BATCH_SIZE][HashOutput];
+        for (eh_index g = 0; Xt.size() < init_size; g += EH_HASH_BATCH_SIZE) {
+            GenerateHashes(base_state, g, EH_HASH_BATCH_SIZE, tmpHashes[0], HashOutput);
+            for (eh_index b = 0; b < EH_HASH_BATCH_SIZE && Xt.size() < init_size; b++) {
+                for (eh_index i = 0; i < IndicesPerHashOutput && Xt.size() < init_size; i++) {
+                    Xt.emplace_back(tmpHashes[b]+(i*N/8), N/8, HashLength, CollisionBitLength,
+                                    ((g+b)*IndicesPerHashOutput)+i, CollisionBitLength + 1);
+                }
             }
             if (cancelled(ListGeneration)) throw solver_cancelled;
         }
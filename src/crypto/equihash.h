@@ -32,6 +32,7 @@ void EhIndexToArray(const eh_index i, unsigned char* array);
 #include "crypto/sha256.h"
 #include "utilstrencodings.h"
 
+#include <array>
 #include <cstring>
 #include <exception>
 #include <stdexcept>
@@ -43,16 +44,28 @@ void EhIndexToArray(const eh_index i, unsigned char* array);
 struct eh_HashState {
     std::unique_ptr<BLAKE2bState, decltype(&blake2b_free)> inner;
 
-    eh_HashState() : inner(nullptr, blake2b_free) {}
+    // The parameters and input of the state, kept so that the rows of the
+    // first list can be hashed several at a time by blake2b_hash_many().
+    size_t length;
+    std::array<unsigned char, BLAKE2bPersonalBytes> personal;
+    std::vector<unsigned char> input;
 
-    eh_HashState(size_t length, unsigned char personalization[BLAKE2bPersonalBytes]) : inner(blake2b_init(length, personalization), blake2b_free) {}
+    eh_HashState() : inner(nullptr, blake2b_free), length(0), personal() {}
 
-    eh_HashState(eh_HashState&& baseState) : inner(std::move(baseState.inner)) {}
-    eh_HashState(const eh_HashState& baseState) : inner(blake2b_clone(baseState.inner.get()), blake2b_free) {}
+    eh_HashState(size_t length, unsigned char personalization[BLAKE2bPersonalBytes]) : inner(blake2b_init(length, personalization), blake2b_free), length(length)
+    {
+        std::copy(personalization, personalization + BLAKE2bPersonalBytes, personal.begin());
+    }
+
+    eh_HashState(eh_HashState&& baseState) : inner(std::move(baseState.inner)), length(baseState.length), personal(baseState.personal), input(std::move(baseState.input)) {}
+    eh_HashState(const eh_HashState& baseState) : inner(blake2b_clone(baseState.inner.get()), blake2b_free), length(baseState.length), personal(baseState.personal), input(baseState.input) {}
     eh_HashState& operator=(eh_HashState&& baseState)
     {
         if (this != &baseState) {
             inner = std::move(baseState.inner);
+            length = baseState.length;
+            personal = baseState.personal;
+            input = std::move(baseState.input);
         }
         return *this;
     }
@@ -60,6 +73,9 @@ struct eh_HashState {
     {
         if (this != &baseState) {
             inner.reset(blake2b_clone(baseState.inner.get()));
+            length = baseState.length;
+            personal = baseState.personal;
+            input = baseState.input;
         }
         return *this;
     }
@@ -0,0 +1,68 @@
+// Copyright (c) 2021 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifdef ENABLE_SSE41
+
+#include <stddef.h>
+#include <stdint.h>
+#include <immintrin.h>
+
+namespace hex_sse41 {
+
+size_t Encode(const unsigned char* in, size_t len, char* out)
+{
+    const __m128i digits = _mm_setr_epi8('0', '1', '2', '3', '4', '5', '6', '7',
+                                         '8', '9', 'a', 'b', 'c', 'd', 'e', 'f');
+    const __m128i mask = _mm_set1_epi8(0x0f);
+    size_t done = 0;
+    for (; done + 16 <= len; done += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(in + done));
+        __m128i hi = _mm_shuffle_epi8(digits, _mm_and_si128(_mm_srli_epi16(x, 4), mask));
+        __m128i lo = _mm_shuffle_epi8(digits, _mm_and_si128(x, mask));
+        _mm_storeu_si128((__m128i*)(out + 2 * done), _mm_unpacklo_epi8(hi, lo));
+        _mm_storeu_si128((__m128i*)(out + 2 * done + 16), _mm_unpackhi_epi8(hi, lo));
+    }
+    return done;
+}
+
+namespace {
+
+/** Convert 16 hex digits to their values, or return false if any is not a hex digit. */
+bool inline Nibbles(__m128i c, __m128i& values)
+{
+    // Digits are those that are at most 9 above '0', and letters those whose
+    // lower case is at most 5 above 'a'. The comparisons are unsigned.
+    __m128i d = _mm_sub_epi8(c, _mm_set1_epi8('0'));
+    __m128i l = _mm_sub_epi8(_mm_or_si128(c, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+    __m128i isdigit = _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(9)), d);
+    __m128i isletter = _mm_cmpeq_epi8(_mm_min_epu8(l, _mm_set1_epi8(5)), l);
+    if (_mm_movemask_epi8(_mm_or_si128(isdigit, isletter)) != 0xffff) {
+        return false;
+    }
+    values = _mm_blendv_epi8(_mm_add_epi8(l, _mm_set1_epi8(10)), d, isdigit);
+    return true;
+}
+
+} // namespace
+
+size_t Decode(const char* in, size_t len, unsigned char* out)
+{
+    // Each pair of nibbles is combined as high * 16 + low into a 16-bit lane.
+    const __m128i weights = _mm_set1_epi16(0x0110);
+    size_t done = 0;
+    for (; 2 * done + 32 <= len; done += 16) {
+        __m128i v0, v1;
+        if (!Nibbles(_mm_loadu_si128((const __m128i*)(in + 2 * done)), v0) ||
+            !Nibbles(_mm_loadu_si128((const __m128i*)(in + 2 * done + 16)), v1)) {
+            break;
+        }
+        __m128i bytes = _mm_packus_epi16(_mm_maddubs_epi16(v0, weights), _mm_maddubs_epi16(v1, weights));
+        _mm_storeu_si128((__m128i*)(out + done), bytes);
+    }
+    return done;
+}
+
+} // namespace hex_sse41
+
+#endif
@@ -0,0 +1,122 @@
+// Copyright (c) 2017-2020 The Bitcoin Core developers
+// Copyright (c) 2021 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifndef BITCOIN_CRYPTO_MUHASH_H
+#define BITCOIN_CRYPTO_MUHASH_H
+
+#if defined(HAVE_CONFIG_H)
+#include "config/bitcoin-config.h"
+#endif
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/** A number modulo the prime 2^3072 - 1103717. */
+class Num3072
+{
+private:
+    void FullReduce();
+    bool IsOverflow() const;
+    Num3072 GetInverse() const;
+
+public:
+    static constexpr size_t BYTE_SIZE = 384;
+
+#ifdef __SIZEOF_INT128__
+    typedef unsigned __int128 double_limb_t;
+    typedef uint64_t limb_t;
+    static constexpr int LIMBS = 48;
+    static constexpr int LIMB_SIZE = 64;
+#else
+    typedef uint64_t double_limb_t;
+    typedef uint32_t limb_t;
+    static constexpr int LIMBS = 96;
+    static constexpr int LIMB_SIZE = 32;
+#endif
+    limb_t limbs[LIMBS];
+
+    // Sanity check for Num3072 constants
+    static_assert(LIMB_SIZE * LIMBS == 3072, "Num3072 isn't 3072 bits");
+    static_assert(sizeof(double_limb_t) == sizeof(limb_t) * 2, "bad size for double_limb_t");
+    static_assert(sizeof(limb_t) * 8 == LIMB_SIZE, "LIMB_SIZE is incorrect");
+
+    void Multiply(const Num3072& a);
+    void Divide(const Num3072& a);
+    void SetToOne();
+    void ToBytes(unsigned char (&out)[BYTE_SIZE]) const;
+
+    Num3072() { this->SetToOne(); };
+    explicit Num3072(const unsigned char (&data)[BYTE_SIZE]);
+
+    template<typename Stream>
+    void Serialize(Stream& s) const {
+        unsigned char data[BYTE_SIZE];
+        ToBytes(data);
+        s.write((const char*)data, BYTE_SIZE);
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream& s) {
+        unsigned char data[BYTE_SIZE];
+        s.read((char*)data, BYTE_SIZE);
+        *this = Num3072(data);
+    }
+};
+
+/**
+ * A hash of a set of byte strings, which can be updated as strings are
+ * added to or removed from the set, in any order: the MuHash3072 of
+ * Bitcoin Core's coinstats.
+ *
+ * Each string is hashed with SHA256, expanded with ChaCha20 into a number
+ * modulo a 3072-bit prime, and the set is represented by the product of
+ * these numbers. Removing a string divides by its number; to keep that
+ * cheap, the numbers removed are multiplied into a separate denominator,
+ * and the single modular inversion is only done by Finalize().
+ */
+class MuHash3072
+{
+private:
+    Num3072 numerator;
+    Num3072 denominator;
+
+    static Num3072 ToNum3072(const unsigned char* data, size_t len);
+
+public:
+    static constexpr size_t OUTPUT_SIZE = 32;
+
+    //! The hash of the empty set.
+    MuHash3072() {};
+
+    //! Add a string to the set.
+    MuHash3072& Insert(const unsigned char* data, size_t len);
+
+    //! Remove a string from the set.
+    MuHash3072& Remove(const unsigned char* data, size_t len);
+
+    //! Combine with the hash of a disjoint set.
+    MuHash3072& operator*=(const MuHash3072& mul);
+
+    //! Remove a subset, given its hash.
+    MuHash3072& operator/=(const MuHash3072& div);
+
+    //! Compute the SHA256 of the set. This does a modular inversion, which
+    //! is much slower than the other operations.
+    void Finalize(unsigned char out[OUTPUT_SIZE]);
+
+    template<typename Stream>
+    void Serialize(Stream& s) const {
+        numerator.Serialize(s);
+        denominator.Serialize(s);
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream& s) {
+        numerator.Unserialize(s);
+        denominator.Unserialize(s);
+    }
+};
+
+#endif // BITCOIN_CRYPTO_MUHASH_H
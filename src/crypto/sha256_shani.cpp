@@ -0,0 +1,233 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+//
+// Based on https://github.com/noloader/SHA-Intrinsics/blob/master/sha256-x86.c,
+// written and placed in public domain by Jeffrey Walton.
+// Based on code from Intel, and by Sean Gulley for the miTLS project.
+
+#ifdef ENABLE_SHANI
+
+#include <stdint.h>
+#include <stddef.h>
+#include <immintrin.h>
+
+namespace {
+
+// Constants are kept as plain data rather than vectors so that nothing
+// compiled with the SHA extensions runs during static initialization.
+alignas(__m128i) const uint8_t MASK[16] = {0x03, 0x02, 0x01, 0x00, 0x07, 0x06, 0x05, 0x04, 0x0b, 0x0a, 0x09, 0x08, 0x0f, 0x0e, 0x0d, 0x0c};
+alignas(__m128i) const uint32_t INIT[8] = {0x6a09e667ul, 0xbb67ae85ul, 0x3c6ef372ul, 0xa54ff53aul, 0x510e527ful, 0x9b05688cul, 0x1f83d9abul, 0x5be0cd19ul};
+
+/** SHA-256 round constants, four rounds per entry (high, low). */
+const uint64_t K[16][2] = {
+    {0xe9b5dba5b5c0fbcfull, 0x71374491428a2f98ull},
+    {0xab1c5ed5923f82a4ull, 0x59f111f13956c25bull},
+    {0x550c7dc3243185beull, 0x12835b01d807aa98ull},
+    {0xc19bf1749bdc06a7ull, 0x80deb1fe72be5d74ull},
+    {0x240ca1cc0fc19dc6ull, 0xefbe4786e49b69c1ull},
+    {0x76f988da5cb0a9dcull, 0x4a7484aa2de92c6full},
+    {0xbf597fc7b00327c8ull, 0xa831c66d983e5152ull},
+    {0x1429296706ca6351ull, 0xd5a79147c6e00bf3ull},
+    {0x53380d134d2c6dfcull, 0x2e1b213827b70a85ull},
+    {0x92722c8581c2c92eull, 0x766a0abb650a7354ull},
+    {0xc76c51a3c24b8b70ull, 0xa81a664ba2bfe8a1ull},
+    {0x106aa070f40e3585ull, 0xd6990624d192e819ull},
+    {0x34b0bcb52748774cull, 0x1e376c0819a4c116ull},
+    {0x682e6ff35b9cca4full, 0x4ed8aa4a391c0cb3ull},
+    {0x8cc7020884c87814ull, 0x78a5636f748f82eeull},
+    {0xc67178f2bef9a3f7ull, 0xa4506ceb90befffaull},
+};
+
+/** Message words of the padding block that follows a 64-byte input. */
+alignas(__m128i) const uint32_t PAD64[16] = {0x80000000ul, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x200};
+
+/** Message words 8-15 of the block that hashes a 32-byte digest. */
+alignas(__m128i) const uint32_t PAD32[8] = {0x80000000ul, 0, 0, 0, 0, 0, 0, 0x100};
+
+void inline __attribute__((always_inline)) QuadRound(__m128i& state0, __m128i& state1, __m128i m, int i)
+{
+    const __m128i msg = _mm_add_epi32(m, _mm_set_epi64x(K[i][0], K[i][1]));
+    state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+    state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0e));
+}
+
+void inline __attribute__((always_inline)) ShiftMessageA(__m128i& m0, __m128i m1)
+{
+    m0 = _mm_sha256msg1_epu32(m0, m1);
+}
+
+void inline __attribute__((always_inline)) ShiftMessageC(__m128i& m0, __m128i m1, __m128i& m2)
+{
+    m2 = _mm_sha256msg2_epu32(_mm_add_epi32(m2, _mm_alignr_epi8(m1, m0, 4)), m1);
+}
+
+void inline __attribute__((always_inline)) ShiftMessageB(__m128i& m0, __m128i m1, __m128i& m2)
+{
+    ShiftMessageC(m0, m1, m2);
+    ShiftMessageA(m0, m1);
+}
+
+/** Convert a state from A..H word order into the ABEF/CDGH layout the SHA instructions use. */
+void inline __attribute__((always_inline)) Shuffle(__m128i& s0, __m128i& s1)
+{
+    const __m128i t1 = _mm_shuffle_epi32(s0, 0xB1);
+    const __m128i t2 = _mm_shuffle_epi32(s1, 0x1B);
+    s0 = _mm_alignr_epi8(t1, t2, 0x08);
+    s1 = _mm_blend_epi16(t2, t1, 0xF0);
+}
+
+/** Inverse of Shuffle. */
+void inline __attribute__((always_inline)) Unshuffle(__m128i& s0, __m128i& s1)
+{
+    const __m128i t1 = _mm_shuffle_epi32(s0, 0x1B);
+    const __m128i t2 = _mm_shuffle_epi32(s1, 0xB1);
+    s0 = _mm_blend_epi16(t1, t2, 0xF0);
+    s1 = _mm_alignr_epi8(t2, t1, 0x08);
+}
+
+__m128i inline __attribute__((always_inline)) Words(const uint32_t* words)
+{
+    return _mm_load_si128((const __m128i*)words);
+}
+
+__m128i inline __attribute__((always_inline)) Load(const unsigned char* in)
+{
+    return _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)in), Words((const uint32_t*)MASK));
+}
+
+void inline __attribute__((always_inline)) Save(unsigned char* out, __m128i s)
+{
+    _mm_storeu_si128((__m128i*)out, _mm_shuffle_epi8(s, Words((const uint32_t*)MASK)));
+}
+
+void inline __attribute__((always_inline)) Initialize(__m128i& s0, __m128i& s1)
+{
+    s0 = Words(INIT);
+    s1 = Words(INIT + 4);
+    Shuffle(s0, s1);
+}
+
+/**
+ * Run the compression function over N independent (state, message) pairs
+ * at once. The lanes are interleaved so that the SHA instructions of one
+ * stream can issue while another is waiting on its previous round.
+ */
+template<int N>
+void inline __attribute__((always_inline)) Compress(__m128i (&s0)[N], __m128i (&s1)[N], __m128i (&m)[N][4])
+{
+    __m128i a[N], b[N];
+    for (int j = 0; j < N; ++j) {
+        a[j] = s0[j];
+        b[j] = s1[j];
+    }
+
+    for (int j = 0; j < N; ++j) QuadRound(s0[j], s1[j], m[j][0], 0);
+    for (int j = 0; j < N; ++j) QuadRound(s0[j], s1[j], m[j][1], 1);
+    for (int j = 0; j < N; ++j) ShiftMessageA(m[j][0], m[j][1]);
+    for (int j = 0; j < N; ++j) QuadRound(s0[j], s1[j], m[j][2], 2);
+    for (int j = 0; j < N; ++j) ShiftMessageA(m[j][1], m[j][2]);
+    for (int j = 0; j < N; ++j) QuadRound(s0[j], s1[j], m[j][3], 3);
+    for (int i = 4; i < 12; i += 4) {
+        for (int j = 0; j < N; ++j) ShiftMessageB(m[j][2], m[j][3], m[j][0]);
+        for (int j = 0; j < N; ++j) QuadRound(s0[j], s1[j], m[j][0], i);
+        for (int j = 0; j < N; ++j) ShiftMessageB(m[j][3], m[j][0], m[j][1]);
+        for (int j = 0; j < N; ++j) QuadRound(s0[j], s1[j], m[j][1], i + 1);
+        for (int j = 0; j < N; ++j) ShiftMessageB(m[j][0], m[j][1], m[j][2]);
+        for (int j = 0; j < N; ++j) QuadRound(s0[j], s1[j], m[j][2], i + 2);
+        for (int j = 0; j < N; ++j) ShiftMessageB(m[j][1], m[j][2], m[j][3]);
+        for (int j = 0; j < N; ++j) QuadRound(s0[j], s1[j], m[j][3], i + 3);
+    }
+    for (int j = 0; j < N; ++j) ShiftMessageB(m[j][2], m[j][3], m[j][0]);
+    for (int j = 0; j < N; ++j) QuadRound(s0[j], s1[j], m[j][0], 12);
+    for (int j = 0; j < N; ++j) ShiftMessageB(m[j][3], m[j][0], m[j][1]);
+    for (int j = 0; j < N; ++j) QuadRound(s0[j], s1[j], m[j][1], 13);
+    for (int j = 0; j < N; ++j) ShiftMessageC(m[j][0], m[j][1], m[j][2]);
+    for (int j = 0; j < N; ++j) QuadRound(s0[j], s1[j], m[j][2], 14);
+    for (int j = 0; j < N; ++j) ShiftMessageC(m[j][1], m[j][2], m[j][3]);
+    for (int j = 0; j < N; ++j) QuadRound(s0[j], s1[j], m[j][3], 15);
+
+    for (int j = 0; j < N; ++j) {
+        s0[j] = _mm_add_epi32(s0[j], a[j]);
+        s1[j] = _mm_add_epi32(s1[j], b[j]);
+    }
+}
+
+} // namespace
+
+namespace sha256_shani {
+void Transform(uint32_t* s, const unsigned char* chunk, size_t blocks)
+{
+    __m128i s0[1], s1[1], m[1][4];
+
+    s0[0] = _mm_loadu_si128((const __m128i*)s);
+    s1[0] = _mm_loadu_si128((const __m128i*)(s + 4));
+    Shuffle(s0[0], s1[0]);
+
+    while (blocks--) {
+        for (int i = 0; i < 4; ++i) m[0][i] = Load(chunk + 16 * i);
+        Compress<1>(s0, s1, m);
+        chunk += 64;
+    }
+
+    Unshuffle(s0[0], s1[0]);
+    _mm_storeu_si128((__m128i*)s, s0[0]);
+    _mm_storeu_si128((__m128i*)(s + 4), s1[0]);
+}
+}
+
+namespace sha256d64_shani {
+void Transform_2way(unsigned char* out, const unsigned char* in)
+{
+    __m128i s0[2], s1[2], t0[2], t1[2], m[2][4];
+
+    // First hash: the 64-byte input followed by its padding block.
+    for (int j = 0; j < 2; ++j) {
+        Initialize(s0[j], s1[j]);
+        for (int i = 0; i < 4; ++i) m[j][i] = Load(in + 64 * j + 16 * i);
+    }
+    Compress<2>(s0, s1, m);
+    for (int j = 0; j < 2; ++j) {
+        for (int i = 0; i < 4; ++i) m[j][i] = Words(PAD64 + 4 * i);
+    }
+    Compress<2>(s0, s1, m);
+
+    // Second hash: the 32-byte digest, padded into a single block.
+    for (int j = 0; j < 2; ++j) {
+        t0[j] = s0[j];
+        t1[j] = s1[j];
+        Unshuffle(t0[j], t1[j]);
+        m[j][0] = t0[j];
+        m[j][1] = t1[j];
+        m[j][2] = Words(PAD32);
+        m[j][3] = Words(PAD32 + 4);
+        Initialize(s0[j], s1[j]);
+    }
+    Compress<2>(s0, s1, m);
+
+    for (int j = 0; j < 2; ++j) {
+        Unshuffle(s0[j], s1[j]);
+        Save(out + 32 * j, s0[j]);
+        Save(out + 32 * j + 16, s1[j]);
+    }
+}
+
+void Compress64_2way(unsigned char* out, const unsigned char* in)
+{
+    __m128i s0[2], s1[2], m[2][4];
+
+    for (int j = 0; j < 2; ++j) {
+        Initialize(s0[j], s1[j]);
+        for (int i = 0; i < 4; ++i) m[j][i] = Load(in + 64 * j + 16 * i);
+    }
+    Compress<2>(s0, s1, m);
+
+    for (int j = 0; j < 2; ++j) {
+        Unshuffle(s0[j], s1[j]);
+        Save(out + 32 * j, s0[j]);
+        Save(out + 32 * j + 16, s1[j]);
+    }
+}
+}
+
+#endif
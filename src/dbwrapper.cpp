@@ -7,6 +7,12 @@
 #include "fs.h"
 #include "util.h"
 
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <unordered_map>
+
 #include <leveldb/cache.h>
 #include <leveldb/env.h>
 #include <leveldb/filter_policy.h>
@@ -15,13 +21,224 @@
 
 #include <boost/scoped_ptr.hpp>
 
-static leveldb::Options GetOptions(size_t nCacheSize)
+namespace {
+
+//! The reads from table files done by this thread, counted by CountingEnv.
+thread_local uint64_t nThreadFileReads = 0;
+thread_local uint64_t nThreadFileBytes = 0;
+
+class CountingRandomAccessFile : public leveldb::RandomAccessFile
+{
+private:
+    std::unique_ptr<leveldb::RandomAccessFile> file;
+
+public:
+    CountingRandomAccessFile(leveldb::RandomAccessFile* fileIn) : file(fileIn) {}
+
+    leveldb::Status Read(uint64_t offset, size_t n, leveldb::Slice* result, char* scratch) const
+    {
+        leveldb::Status status = file->Read(offset, n, result, scratch);
+        nThreadFileReads++;
+        nThreadFileBytes += result->size();
+        return status;
+    }
+
+    std::string GetName() const { return file->GetName(); }
+};
+
+/** An environment that counts the reads from the table files of a database. */
+class CountingEnv : public leveldb::EnvWrapper
+{
+public:
+    CountingEnv(leveldb::Env* target) : leveldb::EnvWrapper(target) {}
+
+    leveldb::Status NewRandomAccessFile(const std::string& fname, leveldb::RandomAccessFile** result)
+    {
+        leveldb::RandomAccessFile* file;
+        leveldb::Status status = target()->NewRandomAccessFile(fname, &file);
+        *result = status.ok() ? new CountingRandomAccessFile(file) : NULL;
+        return status;
+    }
+};
+
+} // namespace
+
+/**
+ * A LevelDB block cache whose capacity can be changed while the database is
+ * open, which the caches made by leveldb::NewLRUCache() do not allow.
+ *
+ * Like those, it is split into shards by the hash of the key, each with its
+ * own lock and an equal part of the capacity, and evicts the least recently
+ * used entries of a shard once it is over its part. An evicted entry that is
+ * still referenced by a handle is freed when the handle is released.
+ */
+class CResizableLRUCache : public leveldb::Cache
+{
+private:
+    static const size_t SHARD_COUNT = 16;
+
+    struct Entry {
+        std::string key;
+        void* value;
+        size_t charge;
+        void (*deleter)(const leveldb::Slice& key, void* value);
+        //! References held by the cache, while the entry is in it, and by handles.
+        int nRefs;
+        std::list<Entry*>::iterator itLRU;
+    };
+
+    struct Shard {
+        mutable std::mutex mutex;
+        size_t nCapacity = 0;
+        size_t nUsage = 0;
+        std::unordered_map<std::string, Entry*> mapEntries;
+        //! The entries in the cache, most recently used first.
+        std::list<Entry*> listLRU;
+    };
+
+    Shard shards[SHARD_COUNT];
+    std::atomic<uint64_t> nLastId{0};
+
+    Shard& GetShard(const leveldb::Slice& key)
+    {
+        return shards[std::hash<std::string_view>()(std::string_view(key.data(), key.size())) % SHARD_COUNT];
+    }
+
+    static void Unref(Entry* entry)
+    {
+        if (--entry->nRefs == 0) {
+            entry->deleter(leveldb::Slice(entry->key), entry->value);
+            delete entry;
+        }
+    }
+
+    static void Remove(Shard& shard, Entry* entry)
+    {
+        shard.mapEntries.erase(entry->key);
+        shard.listLRU.erase(entry->itLRU);
+        shard.nUsage -= entry->charge;
+        Unref(entry);
+    }
+
+    static void Evict(Shard& shard)
+    {
+        while (shard.nUsage > shard.nCapacity && !shard.listLRU.empty()) {
+            Remove(shard, shard.listLRU.back());
+        }
+    }
+
+public:
+    explicit CResizableLRUCache(size_t nCapacity) { SetCapacity(nCapacity); }
+
+    ~CResizableLRUCache()
+    {
+        for (Shard& shard : shards) {
+            while (!shard.listLRU.empty()) {
+                Remove(shard, shard.listLRU.back());
+            }
+        }
+    }
+
+    Handle* Insert(const leveldb::Slice& key, void* value, size_t charge,
+                   void (*deleter)(const leveldb::Slice& key, void* value))
+    {
+        Entry* entry = new Entry{key.ToString(), value, charge, deleter, 2, {}};
+        Shard& shard = GetShard(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.mapEntries.find(entry->key);
+        if (it != shard.mapEntries.end()) {
+            Remove(shard, it->second);
+        }
+        shard.listLRU.push_front(entry);
+        entry->itLRU = shard.listLRU.begin();
+        shard.mapEntries.emplace(entry->key, entry);
+        shard.nUsage += charge;
+        Evict(shard);
+        return reinterpret_cast<Handle*>(entry);
+    }
+
+    Handle* Lookup(const leveldb::Slice& key)
+    {
+        Shard& shard = GetShard(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.mapEntries.find(key.ToString());
+        if (it == shard.mapEntries.end()) {
+            return NULL;
+        }
+        Entry* entry = it->second;
+        entry->nRefs++;
+        shard.listLRU.splice(shard.listLRU.begin(), shard.listLRU, entry->itLRU);
+        return reinterpret_cast<Handle*>(entry);
+    }
+
+    void Release(Handle* handle)
+    {
+        Entry* entry = reinterpret_cast<Entry*>(handle);
+        std::lock_guard<std::mutex> lock(GetShard(leveldb::Slice(entry->key)).mutex);
+        Unref(entry);
+    }
+
+    void* Value(Handle* handle)
+    {
+        return reinterpret_cast<Entry*>(handle)->value;
+    }
+
+    void Erase(const leveldb::Slice& key)
+    {
+        Shard& shard = GetShard(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.mapEntries.find(key.ToString());
+        if (it != shard.mapEntries.end()) {
+            Remove(shard, it->second);
+        }
+    }
+
+    uint64_t NewId()
+    {
+        return ++nLastId;
+    }
+
+    void Prune()
+    {
+        for (Shard& shard : shards) {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            for (auto it = shard.listLRU.begin(); it != shard.listLRU.end(); ) {
+                Entry* entry = *it++;
+                if (entry->nRefs == 1) {
+                    Remove(shard, entry);
+                }
+            }
+        }
+    }
+
+    size_t TotalCharge() const
+    {
+        size_t nTotal = 0;
+        for (const Shard& shard : shards) {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            nTotal += shard.nUsage;
+        }
+        return nTotal;
+    }
+
+    void SetCapacity(size_t nCapacity)
+    {
+        for (Shard& shard : shards) {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            shard.nCapacity = (nCapacity + SHARD_COUNT - 1) / SHARD_COUNT;
+            Evict(shard);
+        }
+    }
+};
+
+static leveldb::Options GetOptions(size_t nCacheSize, const CDBOptions& dbOptions)
 {
     leveldb::Options options;
-    options.block_cache = leveldb::NewLRUCache(nCacheSize / 2);
+    options.block_cache = new CResizableLRUCache(nCacheSize / 2);
     options.write_buffer_size = nCacheSize / 4; // up to two write buffers may be held in memory simultaneously
-    options.filter_policy = leveldb::NewBloomFilterPolicy(10);
-    options.compression = leveldb::kNoCompression;
+    options.filter_policy = dbOptions.nBloomBits > 0 ? leveldb::NewBloomFilterPolicy(dbOptions.nBloomBits) : NULL;
+    options.block_size = dbOptions.nBlockSize;
+    options.compression = dbOptions.fCompression ? leveldb::kSnappyCompression : leveldb::kNoCompression;
     options.max_open_files = 64;
     if (leveldb::kMajorVersion > 1 || (leveldb::kMajorVersion == 1 && leveldb::kMinorVersion >= 16)) {
         // LevelDB versions before 1.16 consider short writes to be corruption. Only trigger error
@@ -31,19 +248,27 @@ static leveldb::Options GetOptions(size_t nCacheSize)
     return options;
 }
 
-CDBWrapper::CDBWrapper(const fs::path& path, size_t nCacheSize, bool fMemory, bool fWipe)
+CDBWrapper::CDBWrapper(const fs::path& path, size_t nCacheSize, bool fMemory, bool fWipe, const CDBOptions& dbOptions)
 {
     penv = NULL;
     readoptions.verify_checksums = true;
     iteroptions.verify_checksums = true;
     iteroptions.fill_cache = false;
     syncoptions.sync = true;
-    options = GetOptions(nCacheSize);
+    options = GetOptions(nCacheSize, dbOptions);
     options.create_if_missing = true;
+    for (ReadCounters& counters : readCounters) {
+        counters.nReads = 0;
+        counters.nFound = 0;
+        counters.nFileReads = 0;
+        counters.nFileBytes = 0;
+    }
     if (fMemory) {
         penv = leveldb::NewMemEnv(leveldb::Env::Default());
-        options.env = penv;
-    } else {
+    }
+    pcountingenv = new CountingEnv(penv ? penv : leveldb::Env::Default());
+    options.env = pcountingenv;
+    if (!fMemory) {
         if (fWipe) {
             LogPrintf("Wiping LevelDB in %s\n", path.string());
             leveldb::Status result = leveldb::DestroyDB(path.string(), options);
@@ -54,7 +279,8 @@ CDBWrapper::CDBWrapper(const fs::path& path, size_t nCacheSize, bool fMemory, bo
     }
     leveldb::Status status = leveldb::DB::Open(options, path.string(), &pdb);
     dbwrapper_private::HandleError(status);
-    LogPrintf("Opened LevelDB successfully\n");
+    LogPrintf("Opened LevelDB successfully (bloom bits %d, block size %u, compression %s)\n",
+        dbOptions.nBloomBits, dbOptions.nBlockSize, dbOptions.fCompression ? "on" : "off");
 }
 
 CDBWrapper::~CDBWrapper()
@@ -65,10 +291,66 @@ CDBWrapper::~CDBWrapper()
     options.filter_policy = NULL;
     delete options.block_cache;
     options.block_cache = NULL;
+    delete pcountingenv;
+    pcountingenv = NULL;
     delete penv;
     options.env = NULL;
 }
 
+bool CDBWrapper::ReadRaw(const leveldb::Slice& slKey, std::string& strValue) const
+{
+    uint64_t nFileReadsBefore = nThreadFileReads;
+    uint64_t nFileBytesBefore = nThreadFileBytes;
+    leveldb::Status status = pdb->Get(readoptions, slKey, &strValue);
+
+    ReadCounters& counters = readCounters[slKey.empty() ? 0 : (unsigned char)slKey[0]];
+    counters.nReads.fetch_add(1, std::memory_order_relaxed);
+    counters.nFileReads.fetch_add(nThreadFileReads - nFileReadsBefore, std::memory_order_relaxed);
+    counters.nFileBytes.fetch_add(nThreadFileBytes - nFileBytesBefore, std::memory_order_relaxed);
+    if (!status.ok()) {
+        if (status.IsNotFound())
+            return false;
+        LogPrintf("LevelDB read failure: %s\n", status.ToString());
+        dbwrapper_private::HandleError(status);
+    }
+    counters.nFound.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+void CDBWrapper::SetBlockCacheSize(size_t nSize)
+{
+    static_cast<CResizableLRUCache*>(options.block_cache)->SetCapacity(nSize);
+}
+
+size_t CDBWrapper::GetBlockCacheUsage() const
+{
+    return options.block_cache->TotalCharge();
+}
+
+std::map<unsigned char, CDBReadStats> CDBWrapper::GetReadStats() const
+{
+    std::map<unsigned char, CDBReadStats> mapStats;
+    for (int i = 0; i < 256; i++) {
+        const ReadCounters& counters = readCounters[i];
+        if (counters.nReads == 0)
+            continue;
+        CDBReadStats& stats = mapStats[i];
+        stats.nReads = counters.nReads;
+        stats.nFound = counters.nFound;
+        stats.nFileReads = counters.nFileReads;
+        stats.nFileBytes = counters.nFileBytes;
+    }
+    return mapStats;
+}
+
+std::string CDBWrapper::GetProperty(const std::string& name) const
+{
+    std::string value;
+    if (!pdb->GetProperty(name, &value))
+        return "";
+    return value;
+}
+
 bool CDBWrapper::WriteBatch(CDBBatch& batch, bool fSync)
 {
     leveldb::Status status = pdb->Write(fSync ? syncoptions : writeoptions, &batch.batch);
@@ -84,6 +366,26 @@ bool CDBWrapper::IsEmpty()
 }
 
 CDBIterator::~CDBIterator() { delete piter; }
+
+bool CDBRangeReader::ReadBatch()
+{
+    vBuffer.clear();
+    vRecords.clear();
+    leveldb::Slice slEnd(strEnd);
+    leveldb::Iterator* piter = pcursor->piter;
+    while (vBuffer.size() < nBatchSize && piter->Valid()) {
+        leveldb::Slice slKey = piter->key();
+        if (slKey.compare(slEnd) >= 0) {
+            break;
+        }
+        leveldb::Slice slValue = piter->value();
+        vRecords.push_back(Record{vBuffer.size(), slKey.size(), slValue.size()});
+        vBuffer.insert(vBuffer.end(), slKey.data(), slKey.data() + slKey.size());
+        vBuffer.insert(vBuffer.end(), slValue.data(), slValue.data() + slValue.size());
+        piter->Next();
+    }
+    return !vRecords.empty();
+}
 bool CDBIterator::Valid() { return piter->Valid(); }
 void CDBIterator::SeekToFirst() { piter->SeekToFirst(); }
 void CDBIterator::Next() { piter->Next(); }
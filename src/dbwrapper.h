@@ -15,8 +15,55 @@
 #include <leveldb/db.h>
 #include <leveldb/write_batch.h>
 
+#include <atomic>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
 static const size_t DBWRAPPER_PREALLOC_KEY_SIZE = 64;
 static const size_t DBWRAPPER_PREALLOC_VALUE_SIZE = 1024;
+//! Default bytes of keys and values read into each batch of a CDBRangeReader
+static const size_t DBWRAPPER_RANGE_BATCH_SIZE = 1 << 22;
+
+//! Default bits per key of the bloom filters of the tables
+static const int DEFAULT_DB_BLOOM_BITS = 10;
+static const int MAX_DB_BLOOM_BITS = 32;
+//! Default size of the blocks of the tables
+static const size_t DEFAULT_DB_BLOCK_SIZE = 4096;
+static const int MIN_DB_BLOCK_SIZE = 1024;
+static const int MAX_DB_BLOCK_SIZE = 4 << 20;
+//! Default for compressing the blocks of the tables
+static const bool DEFAULT_DB_COMPRESSION = false;
+
+/** The options of the LevelDB database of a CDBWrapper that can be tuned to its access pattern. */
+struct CDBOptions
+{
+    //! Bits per key of the bloom filters of the tables, or 0 for none.
+    int nBloomBits;
+    //! Approximate size of the uncompressed data in a table block.
+    size_t nBlockSize;
+    //! Compress table blocks with Snappy, if LevelDB was built with it.
+    bool fCompression;
+
+    CDBOptions() : nBloomBits(DEFAULT_DB_BLOOM_BITS), nBlockSize(DEFAULT_DB_BLOCK_SIZE), fCompression(DEFAULT_DB_COMPRESSION) {}
+};
+
+/**
+ * Counters of the point lookups in a CDBWrapper of the keys with a given
+ * first byte. The file reads are the reads of table blocks that were not in
+ * the block cache, done by the thread of the lookup, so nFileReads / nReads
+ * is the read amplification.
+ */
+struct CDBReadStats
+{
+    uint64_t nReads;
+    uint64_t nFound;
+    uint64_t nFileReads;
+    uint64_t nFileBytes;
+
+    CDBReadStats() : nReads(0), nFound(0), nFileReads(0), nFileBytes(0) {}
+};
 
 class dbwrapper_error : public std::runtime_error
 {
@@ -45,11 +92,19 @@ private:
     const CDBWrapper &parent;
     leveldb::WriteBatch batch;
 
+    size_t size_estimate;
+
 public:
     /**
      * @param[in] _parent   CDBWrapper that this batch is to be submitted to
      */
-    CDBBatch(const CDBWrapper &_parent) : parent(_parent) { };
+    CDBBatch(const CDBWrapper &_parent) : parent(_parent), size_estimate(0) { };
+
+    void Clear()
+    {
+        batch.Clear();
+        size_estimate = 0;
+    }
 
     template <typename K, typename V>
     void Write(const K& key, const V& value)
@@ -65,6 +120,14 @@ public:
         leveldb::Slice slValue(&ssValue[0], ssValue.size());
 
         batch.Put(slKey, slValue);
+        // LevelDB serializes writes as:
+        // - byte: header
+        // - varint: key length (1 byte up to 127B, 2 bytes up to 16383B, ...)
+        // - byte[]: key
+        // - varint: value length
+        // - byte[]: value
+        // The formula below assumes the key and value are both less than 16k.
+        size_estimate += 3 + (slKey.size() > 127) + slKey.size() + (slValue.size() > 127) + slValue.size();
     }
 
     template <typename K>
@@ -76,11 +139,21 @@ public:
         leveldb::Slice slKey(&ssKey[0], ssKey.size());
 
         batch.Delete(slKey);
+        // LevelDB serializes erases as:
+        // - byte: header
+        // - varint: key length
+        // - byte[]: key
+        // The formula below assumes the key is less than 16kB.
+        size_estimate += 2 + (slKey.size() > 127) + slKey.size();
     }
+
+    size_t SizeEstimate() const { return size_estimate; }
 };
 
 class CDBIterator
 {
+    friend class CDBRangeReader;
+
 private:
     const CDBWrapper &parent;
     leveldb::Iterator *piter;
@@ -112,8 +185,7 @@ public:
     template<typename K> bool GetKey(K& key) {
         leveldb::Slice slKey = piter->key();
         try {
-            CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
-            ssKey >> key;
+            CMemoryReader(SER_DISK, CLIENT_VERSION, slKey.data(), slKey.data() + slKey.size()) >> key;
         } catch(std::exception &e) {
             return false;
         }
@@ -127,8 +199,7 @@ public:
     template<typename V> bool GetValue(V& value) {
         leveldb::Slice slValue = piter->value();
         try {
-            CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
-            ssValue >> value;
+            CMemoryReader(SER_DISK, CLIENT_VERSION, slValue.data(), slValue.data() + slValue.size()) >> value;
         } catch(std::exception &e) {
             return false;
         }
@@ -139,6 +210,11 @@ public:
         return piter->value().size();
     }
 
+    void GetValueRaw(std::string& strValue) {
+        leveldb::Slice slValue = piter->value();
+        strValue.assign(slValue.data(), slValue.size());
+    }
+
 };
 
 class CDBWrapper
@@ -147,6 +223,9 @@ private:
     //! custom environment this database is using (may be NULL in case of default environment)
     leveldb::Env* penv;
 
+    //! environment that counts the reads from table files (wrapping penv or the default environment)
+    leveldb::Env* pcountingenv;
+
     //! database options used
     leveldb::Options options;
 
@@ -165,14 +244,28 @@ private:
     //! the database itself
     leveldb::DB* pdb;
 
+    struct ReadCounters {
+        std::atomic<uint64_t> nReads;
+        std::atomic<uint64_t> nFound;
+        std::atomic<uint64_t> nFileReads;
+        std::atomic<uint64_t> nFileBytes;
+    };
+
+    //! counters of point lookups, by the first byte of the key
+    mutable ReadCounters readCounters[256];
+
+    //! Look up a serialized key, counting the lookup. Returns false if it is not found.
+    bool ReadRaw(const leveldb::Slice& slKey, std::string& strValue) const;
+
 public:
     /**
      * @param[in] path        Location in the filesystem where leveldb data will be stored.
      * @param[in] nCacheSize  Configures various leveldb cache settings.
      * @param[in] fMemory     If true, use leveldb's memory environment.
      * @param[in] fWipe       If true, remove all existing data.
+     * @param[in] dbOptions   Table options tuned to the access pattern of the database.
      */
-    CDBWrapper(const fs::path& path, size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    CDBWrapper(const fs::path& path, size_t nCacheSize, bool fMemory = false, bool fWipe = false, const CDBOptions& dbOptions = CDBOptions());
     ~CDBWrapper();
 
     template <typename K, typename V>
@@ -184,13 +277,8 @@ public:
         leveldb::Slice slKey(&ssKey[0], ssKey.size());
 
         std::string strValue;
-        leveldb::Status status = pdb->Get(readoptions, slKey, &strValue);
-        if (!status.ok()) {
-            if (status.IsNotFound())
-                return false;
-            LogPrintf("LevelDB read failure: %s\n", status.ToString());
-            dbwrapper_private::HandleError(status);
-        }
+        if (!ReadRaw(slKey, strValue))
+            return false;
         try {
             CDataStream ssValue(strValue.data(), strValue.data() + strValue.size(), SER_DISK, CLIENT_VERSION);
             ssValue >> value;
@@ -217,14 +305,7 @@ public:
         leveldb::Slice slKey(&ssKey[0], ssKey.size());
 
         std::string strValue;
-        leveldb::Status status = pdb->Get(readoptions, slKey, &strValue);
-        if (!status.ok()) {
-            if (status.IsNotFound())
-                return false;
-            LogPrintf("LevelDB read failure: %s\n", status.ToString());
-            dbwrapper_private::HandleError(status);
-        }
-        return true;
+        return ReadRaw(slKey, strValue);
     }
 
     template <typename K>
@@ -258,6 +339,107 @@ public:
      * Return true if the database managed by this class contains no entries.
      */
     bool IsEmpty();
+
+    //! Change the capacity of the cache of table blocks, initially half of nCacheSize.
+    void SetBlockCacheSize(size_t nSize);
+    //! The bytes of table blocks in the cache.
+    size_t GetBlockCacheUsage() const;
+    //! The bytes of writes that LevelDB collects in memory before it writes them to a table.
+    size_t GetWriteBufferSize() const { return options.write_buffer_size; }
+
+    //! The counters of the point lookups so far, by the first byte of the key, for the bytes that have any.
+    std::map<unsigned char, CDBReadStats> GetReadStats() const;
+
+    //! A LevelDB property of the database, such as "leveldb.stats", or "" if it is not known.
+    std::string GetProperty(const std::string& name) const;
+
+    template<typename K>
+    void CompactRange(const K& key_begin, const K& key_end) const
+    {
+        CDataStream ssKey1(SER_DISK, CLIENT_VERSION), ssKey2(SER_DISK, CLIENT_VERSION);
+        ssKey1.reserve(DBWRAPPER_PREALLOC_KEY_SIZE);
+        ssKey2.reserve(DBWRAPPER_PREALLOC_KEY_SIZE);
+        ssKey1 << key_begin;
+        ssKey2 << key_end;
+        leveldb::Slice slKey1(&ssKey1[0], ssKey1.size());
+        leveldb::Slice slKey2(&ssKey2[0], ssKey2.size());
+        pdb->CompactRange(&slKey1, &slKey2);
+    }
+};
+
+/**
+ * Reads the records of a range of keys in batches, for scans of large parts
+ * of a database. The keys and values of a batch are copied into one buffer,
+ * which is reused by the next batch, and are deserialized from it in place,
+ * so that a scan does not allocate for each record. As the iterator is not
+ * used to read them, the records of a batch can be deserialized by several
+ * threads (see ParallelFor()).
+ *
+ * Like the other iterators of CDBWrapper, it does not fill the block cache.
+ */
+class CDBRangeReader
+{
+private:
+    struct Record {
+        size_t nKeyPos;
+        size_t nKeySize;
+        size_t nValueSize;
+    };
+
+    std::unique_ptr<CDBIterator> pcursor;
+    //! The serialized key at which the range ends, excluded.
+    std::string strEnd;
+    size_t nBatchSize;
+    std::vector<char> vBuffer;
+    std::vector<Record> vRecords;
+
+    template <typename T>
+    static bool Deserialize(const char* pbegin, size_t nSize, T& obj)
+    {
+        try {
+            CMemoryReader(SER_DISK, CLIENT_VERSION, pbegin, pbegin + nSize) >> obj;
+        } catch (const std::exception&) {
+            return false;
+        }
+        return true;
+    }
+
+public:
+    /**
+     * @param[in] db          The database to read.
+     * @param[in] keyBegin    The first key of the range.
+     * @param[in] keyEnd      The key at which the range ends, which is not read.
+     * @param[in] nBatchSize  The bytes of keys and values after which a batch ends.
+     */
+    template <typename K1, typename K2>
+    CDBRangeReader(CDBWrapper& db, const K1& keyBegin, const K2& keyEnd, size_t nBatchSizeIn = DBWRAPPER_RANGE_BATCH_SIZE) :
+        pcursor(db.NewIterator()), nBatchSize(nBatchSizeIn)
+    {
+        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+        ssKey << keyEnd;
+        strEnd.assign(ssKey.begin(), ssKey.end());
+        pcursor->Seek(keyBegin);
+    }
+
+    /** Read the next batch of records. Returns false once the range has no more. */
+    bool ReadBatch();
+
+    /** The number of records in the batch. */
+    size_t size() const { return vRecords.size(); }
+
+    template <typename K>
+    bool GetKey(size_t i, K& key) const
+    {
+        const Record& record = vRecords[i];
+        return Deserialize(vBuffer.data() + record.nKeyPos, record.nKeySize, key);
+    }
+
+    template <typename V>
+    bool GetValue(size_t i, V& value) const
+    {
+        const Record& record = vRecords[i];
+        return Deserialize(vBuffer.data() + record.nKeyPos + record.nKeySize, record.nValueSize, value);
+    }
 };
 
 #endif // BITCOIN_DBWRAPPER_H
@@ -1,6 +1,8 @@
 #include "gmock/gmock.h"
+#include "crypto/sha256.h"
 #include "key.h"
 #include "pubkey.h"
+#include "script/sigcache.h"
 #include "util.h"
 
 #include "librustzcash.h"
@@ -17,7 +19,9 @@ ECCryptoClosure instance_of_eccryptoclosure;
 
 int main(int argc, char **argv) {
   assert(sodium_init() != -1);
+  SHA256AutoDetect();
   ECC_Start();
+  InitSignatureCache();
 
   fs::path sapling_spend = ZC_GetParamsDir() / "sapling-spend.params";
   fs::path sapling_output = ZC_GetParamsDir() / "sapling-output.params";
@@ -36,7 +40,10 @@ int main(int argc, char **argv) {
         reinterpret_cast<const codeunit*>(sapling_output_str.c_str()),
         sapling_output_str.length(),
         reinterpret_cast<const codeunit*>(sprout_groth16_str.c_str()),
-        sprout_groth16_str.length()
+        sprout_groth16_str.length(),
+        nullptr,
+        0,
+        false
     );
 
   testing::InitGoogleMock(&argc, argv);
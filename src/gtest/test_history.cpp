@@ -21,11 +21,11 @@ public:
         return false;
     }
 
-    bool GetCoins(const uint256 &txid, CCoins &coins) const {
+    bool GetCoin(const COutPoint &outpoint, Coin &coin) const {
         return false;
     }
 
-    bool HaveCoins(const uint256 &txid) const {
+    bool HaveCoin(const COutPoint &outpoint) const {
         return false;
     }
 
@@ -203,3 +203,127 @@ TEST(History, GarbageMemoryHash) {
     // Check history root and garbage history root are equal
     EXPECT_EQ(historyRoot, historyRootGarbage);
 }
+
+// A view that stores history trees, and counts the nodes read from it.
+class HistoryCoinsViewDB : public FakeCoinsViewDB {
+public:
+    std::map<uint32_t, std::vector<HistoryNode>> trees;
+    std::map<uint32_t, uint256> roots;
+    mutable size_t nodeReads = 0;
+
+    HistoryIndex GetHistoryLength(uint32_t epochId) const {
+        auto it = trees.find(epochId);
+        return it == trees.end() ? 0 : it->second.size();
+    }
+
+    HistoryNode GetHistoryAt(uint32_t epochId, HistoryIndex index) const {
+        nodeReads++;
+        return trees.at(epochId).at(index);
+    }
+
+    uint256 GetHistoryRoot(uint32_t epochId) const {
+        auto it = roots.find(epochId);
+        return it == roots.end() ? uint256() : it->second;
+    }
+
+    bool BatchWrite(CCoinsMap &mapCoins,
+                    const uint256 &hashBlock,
+                    const uint256 &hashSproutAnchor,
+                    const uint256 &hashSaplingAnchor,
+                    CAnchorsSproutMap &mapSproutAnchors,
+                    CAnchorsSaplingMap &mapSaplingAnchors,
+                    CNullifiersMap &mapSproutNullifiers,
+                    CNullifiersMap &mapSaplingNullifiers,
+                    CHistoryCacheMap &historyCacheMap,
+                    bool fErase) {
+        for (auto& entry : historyCacheMap) {
+            auto& tree = trees[entry.first];
+            tree.resize(entry.second.updateDepth);
+            for (HistoryIndex i = entry.second.updateDepth; i < entry.second.length; i++) {
+                tree.push_back(entry.second.appends[i]);
+            }
+            roots[entry.first] = entry.second.root;
+        }
+        return true;
+    }
+};
+
+TEST(History, PeaksKeptAcrossFlushes) {
+    HistoryCoinsViewDB db;
+    CCoinsViewCache tip(&db);
+
+    FakeCoinsViewDB fakeDB;
+    CCoinsViewCache reference(&fakeDB);
+
+    // Connect blocks one view at a time, flushing the tip now and then.
+    for (uint64_t i = 1; i <= 50; i++) {
+        {
+            CCoinsViewCache view(&tip);
+            view.PushHistoryNode(1, getLeafN(i));
+            view.Flush();
+        }
+        reference.PushHistoryNode(1, getLeafN(i));
+        if (i % 7 == 0) {
+            tip.Flush();
+        }
+        EXPECT_EQ(tip.GetHistoryRoot(1), reference.GetHistoryRoot(1));
+    }
+
+    // Appending never needs to read the nodes back.
+    EXPECT_EQ(db.nodeReads, 0);
+    tip.Flush();
+
+    // Disconnect some blocks and connect others.
+    for (int i = 0; i < 3; i++) {
+        CCoinsViewCache view(&tip);
+        view.PopHistoryNode(1);
+        view.Flush();
+        reference.PopHistoryNode(1);
+    }
+    EXPECT_EQ(tip.GetHistoryRoot(1), reference.GetHistoryRoot(1));
+    tip.Flush();
+    for (uint64_t i = 100; i < 105; i++) {
+        CCoinsViewCache view(&tip);
+        view.PushHistoryNode(1, getLeafN(i));
+        view.Flush();
+        reference.PushHistoryNode(1, getLeafN(i));
+    }
+    EXPECT_EQ(tip.GetHistoryLength(1), reference.GetHistoryLength(1));
+    EXPECT_EQ(tip.GetHistoryRoot(1), reference.GetHistoryRoot(1));
+    tip.Flush();
+
+    // A fresh view of the database agrees.
+    CCoinsViewCache fresh(&db);
+    EXPECT_EQ(fresh.GetHistoryLength(1), reference.GetHistoryLength(1));
+    EXPECT_EQ(fresh.GetHistoryRoot(1), reference.GetHistoryRoot(1));
+}
+
+TEST(History, Positions) {
+    FakeCoinsViewDB fakeDB;
+    CCoinsViewCache view(&fakeDB);
+
+    for (int i = 1; i <= 11; i++) {
+        view.PushHistoryNode(1, getLeafN(i));
+    }
+    HistoryIndex length = view.GetHistoryLength(1);
+    EXPECT_EQ(length, 19);
+
+    // The leaves are where they were appended.
+    for (uint64_t k = 0; k < 11; k++) {
+        HistoryIndex pos = libzcash::HistoryLeafPosition(k);
+        EXPECT_EQ(libzcash::HistoryNodeHeight(pos), 0);
+        HistoryNode node = view.GetHistoryAt(1, pos);
+        HistoryNode leaf = getLeafN(k + 1);
+        EXPECT_TRUE(std::equal(node.bytes, node.bytes + NODE_SERIALIZED_LENGTH, leaf.bytes));
+    }
+
+    // 11 leaves form perfect subtrees of 8, 2 and 1 leaves.
+    EXPECT_EQ(libzcash::HistoryPeaks(length), std::vector<HistoryIndex>({14, 17, 18}));
+    EXPECT_EQ(libzcash::HistoryNodeHeight(14), 3);
+    EXPECT_EQ(libzcash::HistoryNodeHeight(17), 1);
+
+    // Leaf 5 (position 8) is a right child, under a left child.
+    EXPECT_EQ(libzcash::HistoryAuthPath(length, 8), std::vector<HistoryIndex>({7, 12, 6}));
+    EXPECT_EQ(libzcash::HistoryAuthPath(length, 16), std::vector<HistoryIndex>({15}));
+    EXPECT_TRUE(libzcash::HistoryAuthPath(length, 18).empty());
+}
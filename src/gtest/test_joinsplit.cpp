@@ -583,3 +583,28 @@ TEST(Joinsplit, NoteClass)
     ASSERT_EQ(note.r, clone.r);
     ASSERT_EQ(note.a_pk, clone.a_pk);
 }
+
+TEST(Joinsplit, ProofCacheIsKeyedOnPubKey)
+{
+    SproutSpendingKey recipient_key = SproutSpendingKey::random();
+    SproutPaymentAddress recipient_addr = recipient_key.address();
+    SproutMerkleTree tree;
+
+    Ed25519VerificationKey joinSplitPubKey;
+    GetRandBytes(joinSplitPubKey.bytes, ED25519_VERIFICATION_KEY_LEN);
+
+    std::array<JSInput, 2> inputs = {JSInput(), JSInput()};
+    std::array<JSOutput, 2> outputs = {JSOutput(recipient_addr, 10), JSOutput()};
+    auto jsdesc = makeSproutProof(inputs, outputs, joinSplitPubKey, 10, 0, tree.root());
+
+    // Verifying with cacheStore set adds the description to the cache...
+    auto verifier = ProofVerifier::Strict();
+    ASSERT_TRUE(verifier.VerifySprout(jsdesc, joinSplitPubKey, true));
+    ASSERT_TRUE(verifier.VerifySprout(jsdesc, joinSplitPubKey));
+
+    // ...but only together with the joinSplitPubKey it was verified with,
+    // which the proof binds through h_sig.
+    Ed25519VerificationKey otherPubKey;
+    GetRandBytes(otherPubKey.bytes, ED25519_VERIFICATION_KEY_LEN);
+    ASSERT_FALSE(verifier.VerifySprout(jsdesc, otherPubKey));
+}
@@ -381,6 +381,10 @@ TEST(KeystoreTests, StoreAndRetrieveSpendingKeyInEncryptedStore) {
     ASSERT_TRUE(keyStore.Unlock(vMasterKey));
     ASSERT_TRUE(keyStore.GetSproutSpendingKey(addr, keyOut));
     ASSERT_EQ(sk, keyOut);
+    // The second lookup is served from the decrypted key cache
+    libzcash::SproutSpendingKey keyOut2;
+    ASSERT_TRUE(keyStore.GetSproutSpendingKey(addr, keyOut2));
+    ASSERT_EQ(sk, keyOut2);
 
     keyStore.GetSproutPaymentAddresses(addrs);
     ASSERT_EQ(1, addrs.size());
@@ -398,8 +402,10 @@ TEST(KeystoreTests, StoreAndRetrieveSpendingKeyInEncryptedStore) {
     EXPECT_TRUE(keyStore.GetNoteDecryptor(addr2, decOut));
     EXPECT_EQ(ZCNoteDecryption(sk2.receiving_key()), decOut);
 
+    // Locking wipes the cache of decrypted keys
     ASSERT_TRUE(keyStore.Lock());
     ASSERT_TRUE(keyStore.HaveSproutSpendingKey(addr2));
+    ASSERT_FALSE(keyStore.GetSproutSpendingKey(addr, keyOut));
     ASSERT_FALSE(keyStore.GetSproutSpendingKey(addr2, keyOut));
     EXPECT_TRUE(keyStore.GetNoteDecryptor(addr2, decOut));
     EXPECT_EQ(ZCNoteDecryption(sk2.receiving_key()), decOut);
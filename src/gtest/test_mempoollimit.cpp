@@ -6,7 +6,9 @@
 #include <iostream>
 
 #include "arith_uint256.h"
+#include "core_memusage.h"
 #include "mempool_limit.h"
+#include "streams.h"
 #include "utiltime.h"
 #include "utiltest.h"
 #include "transaction_builder.h"
@@ -53,6 +55,28 @@ TEST(MempoolLimitTests, RecentlyEvictedListDoesNotContainAfterExpiry)
     EXPECT_FALSE(recentlyEvicted.contains(TX_ID3));
 }
 
+TEST(MempoolLimitTests, RecentlyEvictedListRoundTrip)
+{
+    SetMockTime(1);
+    RecentlyEvictedList recentlyEvicted(3, 2);
+    recentlyEvicted.add(TX_ID1);
+    SetMockTime(2);
+    recentlyEvicted.add(TX_ID2);
+
+    CDataStream ss(SER_DISK, PROTOCOL_VERSION);
+    ss << recentlyEvicted;
+
+    // The entries keep the times at which they were added
+    RecentlyEvictedList loaded(2, 2);
+    ss >> loaded;
+    EXPECT_TRUE(loaded.contains(TX_ID1));
+    EXPECT_TRUE(loaded.contains(TX_ID2));
+    EXPECT_FALSE(loaded.contains(TX_ID3));
+    SetMockTime(4);
+    EXPECT_FALSE(loaded.contains(TX_ID1));
+    EXPECT_TRUE(loaded.contains(TX_ID2));
+}
+
 TEST(MempoolLimitTests, RecentlyEvictedDropOneAtATime)
 {
     SetMockTime(1);
@@ -108,6 +132,25 @@ TEST(MempoolLimitTests, WeightedTxTreeCheckSizeAfterDropping)
     }
 }
 
+TEST(MempoolLimitTests, WeightedTxTreeDropsWithLargeTotalWeight)
+{
+    // The total eviction weight of a pool of 100k+ transactions can exceed 2^31
+    const int64_t weight = int64_t(1) << 31;
+    std::set<uint256> testedDropping;
+    while (testedDropping.size() < 3) {
+        WeightedTxTree tree(weight * 2);
+        tree.add(WeightedTxInfo(TX_ID1, TxWeight(weight, weight)));
+        tree.add(WeightedTxInfo(TX_ID2, TxWeight(weight, weight)));
+        tree.add(WeightedTxInfo(TX_ID3, TxWeight(weight, weight)));
+        EXPECT_EQ(weight * 3, tree.getTotalWeight().evictionWeight);
+        std::optional<uint256> drop = tree.maybeDropRandom();
+        ASSERT_TRUE(drop.has_value());
+        testedDropping.insert(drop.value());
+        ASSERT_EQ(weight * 2, tree.getTotalWeight().cost);
+        ASSERT_FALSE(tree.maybeDropRandom().has_value());
+    }
+}
+
 TEST(MempoolLimitTests, WeightedTxInfoFromTx)
 {
     // The transaction creation is based on the test:
@@ -123,7 +166,8 @@ TEST(MempoolLimitTests, WeightedTxInfoFromTx)
         builder.AddSaplingSpend(sk.expanded_spending_key(), testNote.note, testNote.tree.root(), testNote.tree.witness());
         builder.AddSaplingOutput(sk.full_viewing_key().ovk, sk.default_address(), 25000, {});
 
-        WeightedTxInfo info = WeightedTxInfo::from(builder.Build().GetTxOrThrow(), DEFAULT_FEE);
+        auto tx = builder.Build().GetTxOrThrow();
+        WeightedTxInfo info = WeightedTxInfo::from(tx, DEFAULT_FEE, RecursiveDynamicUsage(tx));
         EXPECT_EQ(MIN_TX_COST, info.txWeight.cost);
         EXPECT_EQ(MIN_TX_COST, info.txWeight.evictionWeight);
     }
@@ -136,7 +180,8 @@ TEST(MempoolLimitTests, WeightedTxInfoFromTx)
         static_assert(DEFAULT_FEE == 1000);
         builder.SetFee(DEFAULT_FEE-1);
 
-        WeightedTxInfo info = WeightedTxInfo::from(builder.Build().GetTxOrThrow(), DEFAULT_FEE-1);
+        auto tx = builder.Build().GetTxOrThrow();
+        WeightedTxInfo info = WeightedTxInfo::from(tx, DEFAULT_FEE-1, RecursiveDynamicUsage(tx));
         EXPECT_EQ(MIN_TX_COST, info.txWeight.cost);
         EXPECT_EQ(MIN_TX_COST + LOW_FEE_PENALTY, info.txWeight.evictionWeight);
     }
@@ -154,9 +199,15 @@ TEST(MempoolLimitTests, WeightedTxInfoFromTx)
         if (result.IsError()) {
             std::cerr << result.GetError() << std::endl;
         }
-        WeightedTxInfo info = WeightedTxInfo::from(result.GetTxOrThrow(), DEFAULT_FEE);
+        auto tx = result.GetTxOrThrow();
+        WeightedTxInfo info = WeightedTxInfo::from(tx, DEFAULT_FEE, RecursiveDynamicUsage(tx));
         EXPECT_EQ(5168, info.txWeight.cost);
         EXPECT_EQ(5168, info.txWeight.evictionWeight);
+
+        // The overhead of the mempool entry counts towards the cost
+        info = WeightedTxInfo::from(tx, DEFAULT_FEE, RecursiveDynamicUsage(tx) + 1000);
+        EXPECT_EQ(6168, info.txWeight.cost);
+        EXPECT_EQ(6168, info.txWeight.evictionWeight);
     }
 
     RegtestDeactivateSapling();
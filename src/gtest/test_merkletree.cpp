@@ -285,3 +285,112 @@ TEST(merkletree, testZeroElements) {
         ASSERT_TRUE(newTree.root() == oldroot);
     }
 }
+
+template<typename Tree, typename Witness, typename Hash>
+void test_append_all()
+{
+    // Witness every leaf, appending the rest of the leaves in batches of
+    // each size, and check that the witnesses match ones that were appended
+    // to one leaf at a time.
+    for (size_t batchSize = 1; batchSize <= 5; batchSize++) {
+        Tree tree;
+        std::vector<Witness> expected;
+        std::vector<Witness> actual;
+        std::vector<Hash> pending;
+
+        auto flush = [&]() {
+            std::vector<Witness*> witnesses;
+            for (auto& wit : actual) {
+                witnesses.push_back(&wit);
+            }
+            Witness::append_all(witnesses, pending);
+            pending.clear();
+        };
+
+        for (size_t i = 0; i < 16; i++) {
+            uint256 cm = uint256S(std::to_string(i + 1));
+            tree.append(cm);
+            for (auto& wit : expected) {
+                wit.append(cm);
+            }
+
+            // Witnessing a leaf needs the other witnesses to be up to date.
+            pending.push_back(cm);
+            if (i % 3 == 0) {
+                flush();
+                expected.push_back(tree.witness());
+                actual.push_back(tree.witness());
+            } else if (pending.size() == batchSize) {
+                flush();
+            }
+        }
+        flush();
+
+        ASSERT_EQ(expected.size(), actual.size());
+        for (size_t i = 0; i < expected.size(); i++) {
+            EXPECT_TRUE(expected[i] == actual[i]);
+            EXPECT_EQ(expected[i].root(), actual[i].root());
+            EXPECT_EQ(expected[i].root(), tree.root());
+            EXPECT_EQ(expected[i].path().authentication_path, actual[i].path().authentication_path);
+        }
+
+        // The tree is now full.
+        std::vector<Witness*> witnesses {&actual[0]};
+        std::vector<Hash> extra {uint256()};
+        EXPECT_THROW(Witness::append_all(witnesses, extra), std::runtime_error);
+    }
+}
+
+template<typename Tree, typename Hash>
+void test_append_many()
+{
+    // Append every number of leaves to trees of every size, and check that
+    // the result is the same as appending them one at a time.
+    size_t capacity = 1 << INCREMENTAL_MERKLE_TREE_DEPTH_TESTING;
+    for (size_t start = 0; start <= capacity; start++) {
+        for (size_t count = 0; start + count <= capacity; count++) {
+            Tree expected;
+            for (size_t i = 0; i < start; i++) {
+                expected.append(uint256S(std::to_string(i + 1)));
+            }
+            Tree actual = expected;
+
+            std::vector<Hash> objs;
+            for (size_t i = 0; i < count; i++) {
+                objs.push_back(uint256S(std::to_string(start + i + 1)));
+                expected.append(objs.back());
+            }
+            actual.append_many(objs);
+
+            EXPECT_TRUE(expected == actual);
+            EXPECT_EQ(expected.root(), actual.root());
+            EXPECT_EQ(expected.size(), actual.size());
+        }
+
+        // Leaves that don't all fit are rejected without changing the tree.
+        Tree tree;
+        for (size_t i = 0; i < start; i++) {
+            tree.append(uint256S(std::to_string(i + 1)));
+        }
+        Tree before = tree;
+        std::vector<Hash> objs(capacity - start + 1);
+        EXPECT_THROW(tree.append_many(objs), std::runtime_error);
+        EXPECT_TRUE(tree == before);
+    }
+}
+
+TEST(merkletree, AppendMany) {
+    test_append_many<SproutTestingMerkleTree, libzcash::SHA256Compress>();
+}
+
+TEST(merkletree, AppendManySapling) {
+    test_append_many<SaplingTestingMerkleTree, libzcash::PedersenHash>();
+}
+
+TEST(merkletree, AppendAll) {
+    test_append_all<SproutTestingMerkleTree, SproutTestingWitness, libzcash::SHA256Compress>();
+}
+
+TEST(merkletree, AppendAllSapling) {
+    test_append_all<SaplingTestingMerkleTree, SaplingTestingWitness, libzcash::PedersenHash>();
+}
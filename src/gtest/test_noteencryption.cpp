@@ -601,6 +601,45 @@ TEST(NoteEncryption, SaplingApi)
     ));
 }
 
+TEST(NoteEncryption, SaplingCompactDecryption)
+{
+    using namespace libzcash;
+
+    auto sk = SaplingSpendingKey(uint256()).expanded_spending_key();
+    auto ivk = sk.full_viewing_key().in_viewing_key();
+    SaplingPaymentAddress pk = *ivk.address({0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0});
+
+    std::array<unsigned char, ZC_SAPLING_ENCPLAINTEXT_SIZE> message;
+    for (size_t i = 0; i < ZC_SAPLING_ENCPLAINTEXT_SIZE; i++) {
+        message[i] = (unsigned char) i;
+    }
+
+    uint256 esk;
+    librustzcash_sapling_generate_r(esk.begin());
+    auto enc = *SaplingNoteEncryption::FromDiversifier(pk.d, esk);
+    auto ciphertext = *enc.encrypt_to_recipient(pk.pk_d, message);
+    auto epk = enc.get_epk();
+
+    SaplingCompactCiphertext compactCiphertext;
+    std::copy_n(ciphertext.begin(), compactCiphertext.size(), compactCiphertext.begin());
+
+    // The shared secrets from a batch match those computed one at a time
+    auto dhsecrets = SaplingKaAgreeBatch({epk, random_uint256()}, {uint256(), ivk});
+    ASSERT_EQ(dhsecrets.size(), 4);
+    uint256 dhsecret;
+    ASSERT_TRUE(librustzcash_sapling_ka_agree(epk.begin(), ivk.begin(), dhsecret.begin()));
+    ASSERT_TRUE(dhsecrets[1]);
+    EXPECT_EQ(*dhsecrets[1], dhsecret);
+
+    // The compact ciphertext decrypts to the start of the full plaintext...
+    auto compactPlaintext = AttemptSaplingCompactDecryptionWithSecret(compactCiphertext, dhsecret, epk);
+    EXPECT_TRUE(std::equal(compactPlaintext.begin(), compactPlaintext.end(), message.begin()));
+
+    // ...but not with the wrong shared secret.
+    auto wrongPlaintext = AttemptSaplingCompactDecryptionWithSecret(compactCiphertext, *dhsecrets[0], epk);
+    EXPECT_FALSE(std::equal(wrongPlaintext.begin(), wrongPlaintext.end(), message.begin()));
+}
+
 TEST(NoteEncryption, api)
 {
     uint256 sk_enc = ZCNoteEncryption::generate_privkey(uint252(uint256S("21035d60bc1983e37950ce4803418a8fb33ea68d5b937ca382ecbae7564d6a07")));
@@ -123,3 +123,16 @@ TEST(PoW, MinDifficultyRules) {
     EXPECT_EQ(GetNextWorkRequired(&blocks[lastBlk], &next, params),
               UintToArith256(params.powLimit).GetCompact());
 }
+
+TEST(PoW, SkipEquihash) {
+    SelectParams(CBaseChainParams::REGTEST);
+    Consensus::Params params = Params().GetConsensus();
+
+    CBlockHeader header = Params().GenesisBlock().GetBlockHeader();
+    header.nSolution.assign(header.nSolution.size(), 0);
+    EXPECT_FALSE(CheckEquihashSolution(&header, params));
+
+    // Under -regtestfastmode any solution is accepted
+    params.fSkipEquihash = true;
+    EXPECT_TRUE(CheckEquihashSolution(&header, params));
+}
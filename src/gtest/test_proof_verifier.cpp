@@ -0,0 +1,137 @@
+#include <gtest/gtest.h>
+
+#include "consensus/upgrades.h"
+#include "primitives/transaction.h"
+#include "proof_verifier.h"
+#include "random.h"
+#include "script/interpreter.h"
+#include "transaction_builder.h"
+#include "utiltest.h"
+
+namespace {
+
+CTransaction BuildSaplingTransaction(const Consensus::Params& consensusParams, int nHeight)
+{
+    auto sk = libzcash::SaplingSpendingKey::random();
+    auto expsk = sk.expanded_spending_key();
+    auto fvk = sk.full_viewing_key();
+    auto pa = sk.default_address();
+
+    auto testNote = GetTestSaplingNote(pa, 40000);
+
+    // 0.0004 z-ZEC in, 0.00025 z-ZEC out, default fee, 0.00005 z-ZEC change
+    auto builder = TransactionBuilder(consensusParams, nHeight);
+    builder.AddSaplingSpend(expsk, testNote.note, testNote.tree.root(), testNote.tree.witness());
+    builder.AddSaplingOutput(fvk.ovk, pa, 25000, {});
+    return builder.Build().GetTxOrThrow();
+}
+
+uint256 ShieldedSighash(const CTransaction& tx, const Consensus::Params& consensusParams, int nHeight)
+{
+    CScript scriptCode;
+    return SignatureHash(
+        scriptCode, tx, NOT_AN_INPUT, SIGHASH_ALL, 0,
+        CurrentEpochBranchId(nHeight, consensusParams));
+}
+
+}
+
+TEST(ProofVerifier, SaplingBatchAcceptsValidTransactions)
+{
+    auto consensusParams = RegtestActivateSapling();
+
+    auto tx1 = BuildSaplingTransaction(consensusParams, 2);
+    auto tx2 = BuildSaplingTransaction(consensusParams, 2);
+
+    auto verifier = ProofVerifier::Batched();
+    EXPECT_EQ(verifier.VerifySapling(tx1, ShieldedSighash(tx1, consensusParams, 2)),
+              SaplingVerificationResult::Valid);
+    EXPECT_EQ(verifier.VerifySapling(tx2, ShieldedSighash(tx2, consensusParams, 2)),
+              SaplingVerificationResult::Valid);
+    EXPECT_TRUE(verifier.VerifyBatch());
+
+    // An empty batch is trivially valid.
+    EXPECT_TRUE(verifier.VerifyBatch());
+
+    RegtestDeactivateSapling();
+}
+
+TEST(ProofVerifier, SaplingBatchRejectsInvalidProof)
+{
+    auto consensusParams = RegtestActivateSapling();
+
+    auto tx = BuildSaplingTransaction(consensusParams, 2);
+    auto sighash = ShieldedSighash(tx, consensusParams, 2);
+
+    // Swap the proofs of the payment and change outputs. Both still
+    // deserialize, and the signatures remain valid for the original sighash,
+    // so only the Groth16 proof checks can catch this.
+    CMutableTransaction mtx(tx);
+    ASSERT_EQ(mtx.vShieldedOutput.size(), 2);
+    std::swap(mtx.vShieldedOutput[0].zkproof, mtx.vShieldedOutput[1].zkproof);
+    CTransaction badTx(mtx);
+
+    auto strict = ProofVerifier::Strict();
+    EXPECT_EQ(strict.VerifySapling(badTx, sighash), SaplingVerificationResult::InvalidOutput);
+
+    auto batched = ProofVerifier::Batched();
+    EXPECT_EQ(batched.VerifySapling(tx, sighash), SaplingVerificationResult::Valid);
+    EXPECT_EQ(batched.VerifySapling(badTx, sighash), SaplingVerificationResult::Valid);
+    EXPECT_FALSE(batched.VerifyBatch());
+
+    auto disabled = ProofVerifier::Disabled();
+    EXPECT_EQ(disabled.VerifySapling(badTx, sighash), SaplingVerificationResult::Valid);
+
+    RegtestDeactivateSapling();
+}
+
+TEST(ProofVerifier, JoinSplitSigBatch)
+{
+    CMutableTransaction mtx;
+    Ed25519SigningKey joinSplitPrivKey;
+    ed25519_generate_keypair(&joinSplitPrivKey, &mtx.joinSplitPubKey);
+    uint256 sighash = GetRandHash();
+    ASSERT_TRUE(ed25519_sign(&joinSplitPrivKey, sighash.begin(), 32, &mtx.joinSplitSig));
+    CTransaction tx(mtx);
+    uint256 otherSighash = GetRandHash();
+
+    auto strict = ProofVerifier::Strict();
+    EXPECT_TRUE(strict.VerifyJoinSplitSig(tx, sighash));
+    EXPECT_FALSE(strict.VerifyJoinSplitSig(tx, otherSighash));
+
+    // Signatures are checked even when proofs are not.
+    auto disabled = ProofVerifier::Disabled();
+    EXPECT_FALSE(disabled.VerifyJoinSplitSig(tx, otherSighash));
+
+    // A batched verifier only finds the invalid signature in VerifyBatch().
+    auto batched = ProofVerifier::Batched();
+    EXPECT_TRUE(batched.VerifyJoinSplitSig(tx, sighash));
+    EXPECT_TRUE(batched.VerifyJoinSplitSig(tx, sighash));
+    EXPECT_TRUE(batched.VerifyBatch());
+    EXPECT_TRUE(batched.VerifyJoinSplitSig(tx, sighash));
+    EXPECT_TRUE(batched.VerifyJoinSplitSig(tx, otherSighash));
+    EXPECT_FALSE(batched.VerifyBatch());
+
+    // The batch is emptied by VerifyBatch(), whatever the result.
+    EXPECT_TRUE(batched.VerifyBatch());
+}
+
+TEST(ProofVerifier, SaplingCacheIsKeyedOnSighash)
+{
+    auto consensusParams = RegtestActivateSapling();
+
+    auto tx = BuildSaplingTransaction(consensusParams, 2);
+    auto sighash = ShieldedSighash(tx, consensusParams, 2);
+
+    // Verifying with cacheStore set adds the transaction to the cache...
+    auto strict = ProofVerifier::Strict();
+    EXPECT_EQ(strict.VerifySapling(tx, sighash, true), SaplingVerificationResult::Valid);
+    EXPECT_EQ(strict.VerifySapling(tx, sighash), SaplingVerificationResult::Valid);
+
+    // ...but only for the signature hash it was verified against.
+    uint256 otherSighash;
+    otherSighash.SetHex("01");
+    EXPECT_EQ(strict.VerifySapling(tx, otherSighash), SaplingVerificationResult::InvalidSpend);
+
+    RegtestDeactivateSapling();
+}
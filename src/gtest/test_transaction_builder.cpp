@@ -9,6 +9,7 @@
 #include "transaction_builder.h"
 #include "utiltest.h"
 #include "zcash/Address.hpp"
+#include "zcash/ProvingBackend.hpp"
 
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
@@ -38,11 +39,11 @@ public:
         return false;
     }
 
-    bool GetCoins(const uint256 &txid, CCoins &coins) const {
+    bool GetCoin(const COutPoint &outpoint, Coin &coin) const {
         return false;
     }
 
-    bool HaveCoins(const uint256 &txid) const {
+    bool HaveCoin(const COutPoint &outpoint) const {
         return false;
     }
 
@@ -484,3 +485,87 @@ TEST(TransactionBuilder, CheckSaplingTxVersion)
     // Revert to default
     UpdateNetworkUpgradeParameters(Consensus::UPGRADE_OVERWINTER, Consensus::NetworkUpgrade::NO_ACTIVATION_HEIGHT);
 }
+
+// Counts the proofs it is asked for, and creates them with the built-in backend.
+class CountingProvingBackend : public libzcash::ProvingBackend {
+public:
+    libzcash::ProvingBackend& cpu;
+    std::atomic<int> nSpends{0};
+    std::atomic<int> nOutputs{0};
+
+    CountingProvingBackend(libzcash::ProvingBackend& cpu) : cpu(cpu) {}
+
+    const char* Name() const { return "counting"; }
+
+    bool SaplingSpendProof(
+        void* ctx, const unsigned char* ak, const unsigned char* nsk,
+        const unsigned char* diversifier, const unsigned char* rcm, const unsigned char* ar,
+        uint64_t value, const unsigned char* anchor, const unsigned char* witness,
+        unsigned char* cv, unsigned char* rk, unsigned char* zkproof)
+    {
+        nSpends++;
+        return cpu.SaplingSpendProof(
+            ctx, ak, nsk, diversifier, rcm, ar, value, anchor, witness, cv, rk, zkproof);
+    }
+
+    bool SaplingOutputProof(
+        void* ctx, const unsigned char* esk, const unsigned char* payment_address,
+        const unsigned char* rcm, uint64_t value, unsigned char* cv, unsigned char* zkproof)
+    {
+        nOutputs++;
+        return cpu.SaplingOutputProof(ctx, esk, payment_address, rcm, value, cv, zkproof);
+    }
+
+    void SproutProof(
+        unsigned char* proof_out, const unsigned char* phi, const unsigned char* rt,
+        const unsigned char* h_sig,
+        const unsigned char* in_sk1, uint64_t in_value1, const unsigned char* in_rho1,
+        const unsigned char* in_r1, const unsigned char* in_auth1,
+        const unsigned char* in_sk2, uint64_t in_value2, const unsigned char* in_rho2,
+        const unsigned char* in_r2, const unsigned char* in_auth2,
+        const unsigned char* out_pk1, uint64_t out_value1, const unsigned char* out_r1,
+        const unsigned char* out_pk2, uint64_t out_value2, const unsigned char* out_r2,
+        uint64_t vpub_old, uint64_t vpub_new)
+    {
+        cpu.SproutProof(
+            proof_out, phi, rt, h_sig,
+            in_sk1, in_value1, in_rho1, in_r1, in_auth1,
+            in_sk2, in_value2, in_rho2, in_r2, in_auth2,
+            out_pk1, out_value1, out_r1, out_pk2, out_value2, out_r2,
+            vpub_old, vpub_new);
+    }
+};
+
+TEST(TransactionBuilder, ProvingBackend)
+{
+    auto consensusParams = RegtestActivateSapling();
+
+    EXPECT_FALSE(libzcash::SelectProvingBackend("counting"));
+    ASSERT_TRUE(libzcash::SelectProvingBackend(libzcash::DEFAULT_PROVING_BACKEND));
+    auto backend = new CountingProvingBackend(libzcash::GetProvingBackend());
+    libzcash::RegisterProvingBackend(std::unique_ptr<libzcash::ProvingBackend>(backend));
+    ASSERT_TRUE(libzcash::SelectProvingBackend("counting"));
+    EXPECT_EQ(libzcash::ListProvingBackends(), std::vector<std::string>({"counting", "cpu"}));
+
+    auto sk = libzcash::SaplingSpendingKey::random();
+    auto expsk = sk.expanded_spending_key();
+    auto fvk = sk.full_viewing_key();
+    auto pa = sk.default_address();
+    auto testNote = GetTestSaplingNote(pa, 40000);
+
+    // The proofs of the spend, the output and the change come from the selected backend.
+    auto builder = TransactionBuilder(consensusParams, 2);
+    builder.AddSaplingSpend(expsk, testNote.note, testNote.tree.root(), testNote.tree.witness());
+    builder.AddSaplingOutput(fvk.ovk, pa, 25000, {});
+    auto tx = builder.Build().GetTxOrThrow();
+    EXPECT_EQ(backend->nSpends, 1);
+    EXPECT_EQ(backend->nOutputs, 2);
+
+    CValidationState state;
+    EXPECT_TRUE(ContextualCheckTransaction(tx, state, Params(), 3, true));
+    EXPECT_EQ(state.GetRejectReason(), "");
+
+    // Revert to default
+    libzcash::SelectProvingBackend(libzcash::DEFAULT_PROVING_BACKEND);
+    RegtestDeactivateSapling();
+}
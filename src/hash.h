@@ -155,11 +155,23 @@ class CBLAKE2bWriter
 private:
     BLAKE2bState* state;
 
+    // Digests are mostly serialized a few bytes at a time, so writes are
+    // collected here and passed to BLAKE2b one block at a time.
+    unsigned char buf[128];
+    size_t nBuf;
+
+    void Flush() {
+        if (nBuf > 0) {
+            blake2b_update(state, buf, nBuf);
+            nBuf = 0;
+        }
+    }
+
 public:
     int nType;
     int nVersion;
 
-    CBLAKE2bWriter(int nTypeIn, int nVersionIn, const unsigned char* personal) : nType(nTypeIn), nVersion(nVersionIn) {
+    CBLAKE2bWriter(int nTypeIn, int nVersionIn, const unsigned char* personal) : nBuf(0), nType(nTypeIn), nVersion(nVersionIn) {
         state = blake2b_init(32, personal);
     }
     ~CBLAKE2bWriter() {
@@ -170,12 +182,21 @@ public:
     int GetVersion() const { return nVersion; }
 
     CBLAKE2bWriter& write(const char *pch, size_t size) {
-        blake2b_update(state, (const unsigned char*)pch, size);
+        if (nBuf + size > sizeof(buf)) {
+            Flush();
+            if (size >= sizeof(buf)) {
+                blake2b_update(state, (const unsigned char*)pch, size);
+                return (*this);
+            }
+        }
+        memcpy(buf + nBuf, pch, size);
+        nBuf += size;
         return (*this);
     }
 
     // invalidates the object
     uint256 GetHash() {
+        Flush();
         uint256 result;
         blake2b_finalize(state, (unsigned char*)&result, 32);
         return result;
@@ -236,5 +257,6 @@ public:
  *      .Finalize()
  */
 uint64_t SipHashUint256(uint64_t k0, uint64_t k1, const uint256& val);
+uint64_t SipHashUint256Extra(uint64_t k0, uint64_t k1, const uint256& val, uint32_t extra);
 
 #endif // BITCOIN_HASH_H
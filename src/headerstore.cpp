@@ -0,0 +1,117 @@
+// Copyright (c) 2021 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "headerstore.h"
+
+#include "primitives/block.h"
+#include "serialize.h"
+#include "streams.h"
+#include "util.h"
+#include "version.h"
+
+#include <algorithm>
+#include <assert.h>
+#include <string.h>
+#include <vector>
+
+bool CHeaderStore::Open(const fs::path& pathIn, size_t nSolutionSizeIn)
+{
+    LOCK(cs);
+    if (file) {
+        fclose(file);
+    }
+    mapping.reset();
+
+    path = pathIn;
+    file = fsbridge::fopen(path, "rb+");
+    if (!file) {
+        file = fsbridge::fopen(path, "wb+");
+    }
+    if (!file) {
+        LogPrintf("%s: unable to open %s\n", __func__, path.string());
+        return false;
+    }
+
+    nSolutionSize = nSolutionSizeIn;
+    nRecordSize = 32 + CBlockHeader::HEADER_SIZE + GetSizeOfCompactSize(nSolutionSize) + nSolutionSize + 1;
+    fseek(file, 0, SEEK_END);
+    long nSize = ftell(file);
+    nFileSize = nSize > 0 ? nSize : 0;
+    return true;
+}
+
+void CHeaderStore::Close()
+{
+    LOCK(cs);
+    if (file) {
+        fclose(file);
+        file = nullptr;
+    }
+    mapping.reset();
+    nFileSize = 0;
+}
+
+bool CHeaderStore::Read(int nHeight, const uint256& hash, CRawBlock& header)
+{
+    LOCK(cs);
+    if (!file || nHeight < 0) {
+        return false;
+    }
+    size_t nOffset = (size_t)nHeight * nRecordSize;
+    if (nOffset + nRecordSize > nFileSize) {
+        return false;
+    }
+    if (!mapping || mapping->size() < nOffset + nRecordSize) {
+        // The file has grown since it was mapped.
+        mapping = std::make_shared<const CMappedBlockFile>(path);
+        if (mapping->IsNull() || mapping->size() < nOffset + nRecordSize) {
+            mapping.reset();
+            return false;
+        }
+    }
+
+    const char* pbegin = mapping->data() + nOffset;
+    if (memcmp(pbegin, hash.begin(), 32) != 0) {
+        return false;
+    }
+    // The record is copied under the lock, as a reorganization may rewrite it.
+    header.Set(std::vector<char>(pbegin + 32, pbegin + nRecordSize));
+    return true;
+}
+
+void CHeaderStore::Write(int nHeight, const CBlockHeader& header)
+{
+    LOCK(cs);
+    if (!file || nHeight < 0 || header.nSolution.size() != nSolutionSize) {
+        return;
+    }
+
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << CBlock(header);
+    assert(ss.size() + 32 == nRecordSize);
+    uint256 hash = header.GetHash();
+
+    // The hash is written last, so that a record that was only partly
+    // written, or that is being replaced, never matches a lookup.
+    size_t nOffset = (size_t)nHeight * nRecordSize;
+    static const uint256 hashNull;
+    bool fOk = true;
+    if (nOffset < nFileSize) {
+        fOk = fseek(file, nOffset, SEEK_SET) == 0 &&
+              fwrite(hashNull.begin(), 1, 32, file) == 32 &&
+              fflush(file) == 0;
+    }
+    fOk = fOk &&
+          fseek(file, nOffset + 32, SEEK_SET) == 0 &&
+          fwrite(&ss[0], 1, ss.size(), file) == ss.size() &&
+          fflush(file) == 0 &&
+          fseek(file, nOffset, SEEK_SET) == 0 &&
+          fwrite(hash.begin(), 1, 32, file) == 32 &&
+          fflush(file) == 0;
+    if (!fOk) {
+        LogPrintf("%s: unable to write the header at height %d to %s\n", __func__, nHeight, path.string());
+        return;
+    }
+    nFileSize = std::max(nFileSize, nOffset + nRecordSize);
+}
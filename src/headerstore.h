@@ -0,0 +1,60 @@
+// Copyright (c) 2021 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifndef ZCASH_HEADERSTORE_H
+#define ZCASH_HEADERSTORE_H
+
+#include "blockfilemap.h"
+#include "fs.h"
+#include "sync.h"
+#include "uint256.h"
+
+#include <stdio.h>
+#include <memory>
+
+class CBlockHeader;
+
+/**
+ * A file of block headers, indexed by height, from which headers messages
+ * are served without building CBlockHeader objects or reading the Equihash
+ * solutions, which are not kept in memory, from the block index database.
+ *
+ * Each height has a record of fixed size: the hash of the block followed by
+ * its header as it is sent in a headers message, which is its network
+ * serialization with a zero transaction count. A record whose hash is not
+ * the one asked for, because it was never written or belongs to a block
+ * that was reorganized away, is a miss, so the file needs no other upkeep.
+ * It is read through a memory mapping that is remapped as the file grows.
+ */
+class CHeaderStore
+{
+private:
+    CCriticalSection cs;
+    fs::path path;
+    FILE* file;
+    size_t nSolutionSize;
+    size_t nRecordSize;
+    //! Size of the file, including the records that the mapping does not cover yet.
+    size_t nFileSize;
+    std::shared_ptr<const CMappedBlockFile> mapping;
+
+public:
+    CHeaderStore() : file(nullptr), nSolutionSize(0), nRecordSize(0), nFileSize(0) {}
+    ~CHeaderStore() { Close(); }
+
+    /** Open or create the file at pathIn, for headers whose solutions are nSolutionSizeIn bytes. */
+    bool Open(const fs::path& pathIn, size_t nSolutionSizeIn);
+    void Close();
+
+    /**
+     * Read the header of block hash at height nHeight, as it is sent in a
+     * headers message. Returns false if the store does not have it.
+     */
+    bool Read(int nHeight, const uint256& hash, CRawBlock& header);
+
+    /** Store the header of the block at height nHeight. Headers with solutions of another size are skipped. */
+    void Write(int nHeight, const CBlockHeader& header);
+};
+
+#endif // ZCASH_HEADERSTORE_H
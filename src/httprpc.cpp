@@ -73,6 +73,8 @@ static void JSONErrorReply(HTTPRequest* req, const UniValue& objError, const Uni
 
     std::string strReply = JSONRPCReply(NullUniValue, objError, id);
 
+    // Drop any part of a streamed result that was written before the error.
+    req->DiscardBody();
     req->WriteHeader("Content-Type", "application/json");
     req->WriteReply(nStatus, strReply);
 }
@@ -138,6 +140,14 @@ static bool RPCAuthorized(const std::string& strAuth)
     return multiUserAuthorized(strUserPass);
 }
 
+/** Whether the client accepts a raw serialized result instead of JSON. */
+static bool AcceptsBinary(HTTPRequest* req)
+{
+    std::pair<bool, std::string> acceptHeader = req->GetHeader("accept");
+    return acceptHeader.first &&
+        acceptHeader.second.find("application/octet-stream") != std::string::npos;
+}
+
 static bool HTTPReq_JSONRPC(HTTPRequest* req, const std::string &)
 {
     // JSONRPC handles only POST
@@ -178,10 +188,24 @@ static bool HTTPReq_JSONRPC(HTTPRequest* req, const std::string &)
         if (valRequest.isObject()) {
             jreq.parse(valRequest);
 
-            UniValue result = tableRPC.execute(jreq.strMethod, jreq.params);
+            // Clients that ask for it get the result of commands with a
+            // binary form as the raw serialized data, without the JSON-RPC
+            // envelope. Errors are still reported as JSON.
+            std::string binaryReply;
+            if (AcceptsBinary(req) && tableRPC.executeBinary(jreq.strMethod, jreq.params, binaryReply)) {
+                req->WriteHeader("Content-Type", "application/octet-stream");
+                req->WriteReply(HTTP_OK, binaryReply);
+                return true;
+            }
 
-            // Send reply
-            strReply = JSONRPCReply(result, NullUniValue, jreq.id);
+            // Write the reply into the HTTP reply buffer as the result is
+            // produced, rather than building it as one string.
+            JSONStreamWriter out([req](const char* data, size_t len) {
+                req->WriteBody(data, len);
+            });
+            JSONRPCStreamReply(out, [&jreq](JSONStreamWriter& out) {
+                tableRPC.executeStream(jreq.strMethod, jreq.params, out);
+            }, jreq.id);
 
         // array of requests
         } else if (valRequest.isArray())
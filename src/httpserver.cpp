@@ -11,8 +11,13 @@
 #include "rpc/protocol.h" // For HTTP status codes
 #include "sync.h"
 #include "ui_interface.h"
+#include "utiltime.h"
 
+#include <atomic>
+#include <condition_variable>
 #include <deque>
+#include <map>
+#include <mutex>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -30,6 +35,8 @@
 #include <event2/util.h>
 #include <event2/keyvalq_struct.h>
 
+#include <rust/metrics.h>
+
 #ifdef EVENT__HAVE_NETINET_IN_H
 #include <netinet/in.h>
 #ifdef _XOPEN_SOURCE_EXTENDED
@@ -40,6 +47,9 @@
 /** Maximum size of http request (request line + headers) */
 static const size_t MAX_HEADERS_SIZE = 8192;
 
+/** Bytes of a chunked reply that may wait to be sent before WriteChunk blocks */
+static const size_t MAX_CHUNKED_REPLY_PENDING = 4 * 1024 * 1024;
+
 /** HTTP request work item */
 class HTTPWorkItem : public HTTPClosure
 {
@@ -60,22 +70,35 @@ private:
     HTTPRequestHandler func;
 };
 
-/** Simple work queue for distributing work over multiple threads.
- * Work items are simply callable objects.
+/** Work queue for distributing work over multiple threads.
+ * Work items are simply callable objects. Each client has its own queue,
+ * and the clients with queued work are served in turn, so that a client
+ * sending many requests at once does not hold up or crowd out the others.
  */
 template <typename WorkItem>
 class WorkQueue
 {
 private:
+    struct QueuedItem {
+        std::unique_ptr<WorkItem> item;
+        int64_t nTimeQueued;
+    };
+
     /** Mutex protects entire object */
     std::mutex cs;
     std::condition_variable cond;
-    std::deque<std::unique_ptr<WorkItem>> queue;
+    /** Queued work items of each client */
+    std::map<std::string, std::deque<QueuedItem>> queues;
+    /** Clients with queued work items, in the order they will be served */
+    std::deque<std::string> clients;
+    size_t depth;
     bool running;
     size_t maxDepth;
 
 public:
-    WorkQueue(size_t maxDepth) : running(true),
+    /** maxDepth is the number of work items each client can have queued. */
+    WorkQueue(size_t maxDepth) : depth(0),
+                                 running(true),
                                  maxDepth(maxDepth)
     {
     }
@@ -84,14 +107,20 @@ public:
     ~WorkQueue()
     {
     }
-    /** Enqueue a work item */
-    bool Enqueue(WorkItem* item)
+    /** Enqueue a work item for a client */
+    bool Enqueue(const std::string& client, WorkItem* item)
     {
         std::unique_lock<std::mutex> lock(cs);
+        std::deque<QueuedItem>& queue = queues[client];
         if (queue.size() >= maxDepth) {
             return false;
         }
-        queue.emplace_back(std::unique_ptr<WorkItem>(item));
+        if (queue.empty()) {
+            clients.push_back(client);
+        }
+        queue.push_back(QueuedItem{std::unique_ptr<WorkItem>(item), GetTimeMicros()});
+        depth++;
+        MetricsGauge("zcash.rpc.queue.depth", depth);
         cond.notify_one();
         return true;
     }
@@ -99,17 +128,32 @@ public:
     void Run()
     {
         while (true) {
-            std::unique_ptr<WorkItem> i;
+            QueuedItem i;
             {
                 std::unique_lock<std::mutex> lock(cs);
-                while (running && queue.empty())
+                while (running && clients.empty())
                     cond.wait(lock);
                 if (!running)
                     break;
-                i = std::move(queue.front());
-                queue.pop_front();
+                // Take the oldest item of the next client, and put the client
+                // at the back of the line if it has more.
+                std::string client = std::move(clients.front());
+                clients.pop_front();
+                auto it = queues.find(client);
+                i = std::move(it->second.front());
+                it->second.pop_front();
+                if (it->second.empty()) {
+                    queues.erase(it);
+                } else {
+                    clients.push_back(std::move(client));
+                }
+                depth--;
+                MetricsGauge("zcash.rpc.queue.depth", depth);
             }
-            (*i)();
+            int64_t nTimeStart = GetTimeMicros();
+            MetricsHistogram("zcash.rpc.queue.wait.seconds", (nTimeStart - i.nTimeQueued) * 0.000001);
+            (*i.item)();
+            MetricsHistogram("zcash.rpc.execution.seconds", (GetTimeMicros() - nTimeStart) * 0.000001);
         }
     }
     /** Interrupt and exit loops */
@@ -124,7 +168,7 @@ public:
     size_t Depth()
     {
         std::unique_lock<std::mutex> lock(cs);
-        return queue.size();
+        return depth;
     }
 };
 
@@ -154,6 +198,10 @@ static WorkQueue<HTTPClosure>* workQueue = 0;
 std::vector<HTTPPathHandler> pathHandlers;
 //! Bound listening sockets
 std::vector<evhttp_bound_socket *> boundSockets;
+//! Seconds that a client may take to read or write before it is dropped
+static int httpServerTimeout = DEFAULT_HTTP_SERVER_TIMEOUT;
+//! Set by InterruptHTTPServer, to stop waiting on clients
+static std::atomic<bool> httpInterrupted(false);
 
 /** Check if a network address is allowed to access the HTTP server */
 static bool ClientAllowed(const CNetAddr& netaddr)
@@ -264,13 +312,15 @@ static void http_request_cb(struct evhttp_request* req, void* arg)
 
     // Dispatch to worker thread
     if (i != iend) {
+        // Requests are queued per client address, whatever the connection.
+        std::string client = hreq->GetPeer().ToStringIP();
         std::unique_ptr<HTTPWorkItem> item(new HTTPWorkItem(std::move(hreq), path, i->handler));
         assert(workQueue);
-        if (workQueue->Enqueue(item.get()))
+        if (workQueue->Enqueue(client, item.get()))
         {
             item.release(); /* if true, queue took ownership */
         } else {
-            LogPrintf("WARNING: request rejected because http work queue depth exceeded, it can be increased with the -rpcworkqueue= setting\n");
+            LogPrintf("WARNING: request from %s rejected because its http work queue depth exceeded, it can be increased with the -rpcworkqueue= setting\n", client);
             item->req->WriteReply(HTTP_INTERNAL, "Work queue depth exceeded");
         }
     } else {
@@ -400,7 +450,8 @@ bool InitHTTPServer()
         return false;
     }
 
-    evhttp_set_timeout(http, GetArg("-rpcservertimeout", DEFAULT_HTTP_SERVER_TIMEOUT));
+    httpServerTimeout = GetArg("-rpcservertimeout", DEFAULT_HTTP_SERVER_TIMEOUT);
+    evhttp_set_timeout(http, httpServerTimeout);
     evhttp_set_max_headers_size(http, MAX_HEADERS_SIZE);
     evhttp_set_max_body_size(http, MAX_SIZE);
     evhttp_set_gencb(http, http_request_cb, NULL);
@@ -414,7 +465,7 @@ bool InitHTTPServer()
 
     LogPrint("http", "Initialized HTTP server\n");
     int workQueueDepth = std::max((long)GetArg("-rpcworkqueue", DEFAULT_HTTP_WORKQUEUE), 1L);
-    LogPrintf("HTTP: creating work queue of depth %d\n", workQueueDepth);
+    LogPrintf("HTTP: creating work queue of depth %d per client\n", workQueueDepth);
 
     workQueue = new WorkQueue<HTTPClosure>(workQueueDepth);
     eventBase = base;
@@ -452,6 +503,7 @@ void InterruptHTTPServer()
         // Reject requests on current connections
         evhttp_set_gencb(eventHTTP, http_reject_request_cb, NULL);
     }
+    httpInterrupted = true;
     if (workQueue)
         workQueue->Interrupt();
 }
@@ -531,7 +583,10 @@ HTTPRequest::HTTPRequest(struct evhttp_request* req) : req(req),
 }
 HTTPRequest::~HTTPRequest()
 {
-    if (!replySent) {
+    if (!replySent && chunked) {
+        // A chunked reply that was cut short still has to be finished
+        EndChunkedReply();
+    } else if (!replySent) {
         // Keep track of whether reply was sent to avoid request leaks
         LogPrintf("%s: Unhandled request\n", __func__);
         WriteReply(HTTP_INTERNAL, "Unhandled request");
@@ -577,6 +632,38 @@ void HTTPRequest::WriteHeader(const std::string& hdr, const std::string& value)
     evhttp_add_header(headers, hdr.c_str(), value.c_str());
 }
 
+void HTTPRequest::WriteBody(const char* data, size_t len)
+{
+    assert(!replySent && req);
+    struct evbuffer* evb = evhttp_request_get_output_buffer(req);
+    assert(evb);
+    evbuffer_add(evb, data, len);
+}
+
+void HTTPRequest::DiscardBody()
+{
+    assert(!replySent && req);
+    struct evbuffer* evb = evhttp_request_get_output_buffer(req);
+    assert(evb);
+    evbuffer_drain(evb, evbuffer_get_length(evb));
+}
+
+/** Re-enable reading from the socket of a request once it has been answered.
+ * This is the second part of the libevent workaround in http_request_cb.
+ */
+static void http_reenable_read(struct evhttp_request* req)
+{
+    if (event_get_version_number() >= 0x02010600 && event_get_version_number() < 0x02020001) {
+        evhttp_connection* conn = evhttp_request_get_connection(req);
+        if (conn) {
+            bufferevent* bev = evhttp_connection_get_bufferevent(conn);
+            if (bev) {
+                bufferevent_enable(bev, EV_READ | EV_WRITE);
+            }
+        }
+    }
+}
+
 /** Closure sent to main thread to request a reply to be sent to
  * a HTTP request.
  * Replies must be sent in the main loop in the main http thread,
@@ -584,7 +671,7 @@ void HTTPRequest::WriteHeader(const std::string& hdr, const std::string& value)
  */
 void HTTPRequest::WriteReply(int nStatus, const std::string& strReply)
 {
-    assert(!replySent && req);
+    assert(!replySent && !chunked && req);
     // Send event to main http thread to send reply message
     struct evbuffer* evb = evhttp_request_get_output_buffer(req);
     assert(evb);
@@ -592,17 +679,110 @@ void HTTPRequest::WriteReply(int nStatus, const std::string& strReply)
     auto req_copy = req;
     HTTPEvent* ev = new HTTPEvent(eventBase, true, [req_copy, nStatus]{
         evhttp_send_reply(req_copy, nStatus, nullptr, nullptr);
-        // Re-enable reading from the socket. This is the second part of the libevent
-        // workaround above.
-        if (event_get_version_number() >= 0x02010600 && event_get_version_number() < 0x02020001) {
-            evhttp_connection* conn = evhttp_request_get_connection(req_copy);
-            if (conn) {
-                bufferevent* bev = evhttp_connection_get_bufferevent(conn);
-                if (bev) {
-                    bufferevent_enable(bev, EV_READ | EV_WRITE);
-                }
+        http_reenable_read(req_copy);
+    });
+    ev->trigger(0);
+    replySent = true;
+    req = 0; // transferred back to main thread
+}
+
+/** State of a chunked reply. The chunks are handed to libevent on the http
+ * thread, which tells the worker writing the reply when they have been sent.
+ */
+struct HTTPChunkedReply
+{
+    std::mutex cs;
+    std::condition_variable cond;
+    //! Bytes passed to the http thread that have not been handed to libevent
+    size_t nQueued = 0;
+    //! Bytes handed to libevent that have not been written to the socket
+    size_t nUnsent = 0;
+    //! Whether the connection has been lost, after which chunks are dropped
+    bool fClosed = false;
+};
+
+/** Called by libevent once everything handed to it has been written. */
+static void http_chunk_sent_cb(struct evhttp_connection*, void* arg)
+{
+    HTTPChunkedReply* reply = static_cast<HTTPChunkedReply*>(arg);
+    std::lock_guard<std::mutex> lock(reply->cs);
+    reply->nUnsent = 0;
+    reply->cond.notify_all();
+}
+
+void HTTPRequest::StartChunkedReply(int nStatus)
+{
+    assert(!replySent && !chunked && req);
+    chunked = std::make_shared<HTTPChunkedReply>();
+    auto req_copy = req;
+    HTTPEvent* ev = new HTTPEvent(eventBase, true, [req_copy, nStatus]{
+        evhttp_send_reply_start(req_copy, nStatus, nullptr);
+    });
+    ev->trigger(0);
+}
+
+bool HTTPRequest::WriteChunk(const char* data, size_t len)
+{
+    assert(!replySent && chunked && req);
+    {
+        // Wait for earlier chunks to be sent, giving up on a client that
+        // reads nothing for as long as the server timeout.
+        std::unique_lock<std::mutex> lock(chunked->cs);
+        int64_t nStalled = 0;
+        size_t nUnsent = chunked->nUnsent;
+        while (!chunked->fClosed && chunked->nQueued + chunked->nUnsent + len > MAX_CHUNKED_REPLY_PENDING &&
+               chunked->nQueued + chunked->nUnsent > 0) {
+            if (httpInterrupted)
+                return false;
+            if (chunked->cond.wait_for(lock, std::chrono::seconds(1)) == std::cv_status::timeout &&
+                chunked->nUnsent == nUnsent && ++nStalled >= httpServerTimeout) {
+                LogPrint("http", "Dropping a chunked reply that the client stopped reading\n");
+                return false;
+            }
+            if (chunked->nUnsent != nUnsent) {
+                nStalled = 0;
+                nUnsent = chunked->nUnsent;
+            }
+        }
+        if (chunked->fClosed)
+            return false;
+        chunked->nQueued += len;
+    }
+
+    auto req_copy = req;
+    auto reply = chunked;
+    std::string chunk(data, len);
+    HTTPEvent* ev = new HTTPEvent(eventBase, true, [req_copy, reply, chunk]{
+        {
+            std::lock_guard<std::mutex> lock(reply->cs);
+            reply->nQueued -= chunk.size();
+            // libevent detaches the request from a connection that it has lost.
+            if (reply->fClosed || !evhttp_request_get_connection(req_copy)) {
+                reply->fClosed = true;
+                reply->cond.notify_all();
+                return;
             }
+            reply->nUnsent += chunk.size();
         }
+        struct evbuffer* evb = evbuffer_new();
+        evbuffer_add(evb, chunk.data(), chunk.size());
+        evhttp_send_reply_chunk_with_cb(req_copy, evb, http_chunk_sent_cb, reply.get());
+        evbuffer_free(evb);
+    });
+    ev->trigger(0);
+    return true;
+}
+
+void HTTPRequest::EndChunkedReply()
+{
+    assert(!replySent && chunked && req);
+    auto req_copy = req;
+    auto reply = chunked;
+    HTTPEvent* ev = new HTTPEvent(eventBase, true, [req_copy, reply]{
+        // Ending the reply replaces http_chunk_sent_cb, so the reply state
+        // is not used by libevent once this event is done with it.
+        http_reenable_read(req_copy);
+        evhttp_send_reply_end(req_copy);
     });
     ev->trigger(0);
     replySent = true;
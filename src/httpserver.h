@@ -8,6 +8,7 @@
 #include <string>
 #include <stdint.h>
 #include <functional>
+#include <memory>
 
 static const int DEFAULT_HTTP_THREADS=4;
 static const int DEFAULT_HTTP_WORKQUEUE=16;
@@ -17,6 +18,7 @@ struct evhttp_request;
 struct event_base;
 class CService;
 class HTTPRequest;
+struct HTTPChunkedReply;
 
 /** Initialize HTTP server.
  * Call this before RegisterHTTPHandler or EventBase().
@@ -54,6 +56,8 @@ class HTTPRequest
 {
 private:
     struct evhttp_request* req;
+    //! State of a reply sent with StartChunkedReply, shared with the http thread.
+    std::shared_ptr<HTTPChunkedReply> chunked;
 
     // For test access
 protected:
@@ -104,6 +108,19 @@ public:
      */
     virtual void WriteHeader(const std::string& hdr, const std::string& value);
 
+    /**
+     * Append data to the body of the reply, which is sent by WriteReply.
+     * This lets a large reply be passed to the HTTP server in pieces as it
+     * is produced, instead of being built as one string first.
+     */
+    virtual void WriteBody(const char* data, size_t len);
+
+    /**
+     * Discard anything written by WriteBody, e.g. to send an error reply
+     * instead.
+     */
+    virtual void DiscardBody();
+
     /**
      * Write HTTP reply.
      * nStatus is the HTTP status code to send.
@@ -113,6 +130,30 @@ public:
      * main thread, do not call any other HTTPRequest methods after calling this.
      */
     virtual void WriteReply(int nStatus, const std::string& strReply = "");
+
+    /**
+     * Start a reply whose body is sent with chunked transfer encoding, for
+     * replies too large to be kept in memory. Headers must be written first;
+     * the body is then sent with WriteChunk and finished with
+     * EndChunkedReply, instead of calling WriteReply.
+     */
+    virtual void StartChunkedReply(int nStatus);
+
+    /**
+     * Send a chunk of the body of a chunked reply. This waits while too much
+     * of the reply is still to be sent to the client, so that a slow client
+     * does not make the reply pile up in memory. Returns false if the client
+     * has gone, or stopped reading, in which case the reply should be ended.
+     */
+    virtual bool WriteChunk(const char* data, size_t len);
+
+    /**
+     * Finish a chunked reply.
+     *
+     * @note As with WriteReply, do not call any other HTTPRequest methods
+     * after calling this.
+     */
+    virtual void EndChunkedReply();
 };
 
 /** Event handler closure.
@@ -0,0 +1,176 @@
+// Copyright (c) 2017-2018 The Bitcoin Core developers
+// Copyright (c) 2021 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "index/base.h"
+
+#include "chainparams.h"
+#include "init.h"
+#include "main.h"
+#include "txdb.h"
+#include "ui_interface.h"
+#include "undo.h"
+#include "util.h"
+#include "utiltime.h"
+#include "warnings.h"
+
+#include <functional>
+
+/** Seconds between reports of the progress of a build. */
+static const int64_t INDEX_PROGRESS_INTERVAL = 30;
+
+static void FatalError(const std::string& strMessage)
+{
+    SetMiscWarning(strMessage, GetTime());
+    LogPrintf("*** %s\n", strMessage);
+    uiInterface.ThreadSafeMessageBox(
+        _("Error: A fatal internal error occurred, see debug.log for details"),
+        "", CClientUIInterface::MSG_ERROR);
+    StartShutdown();
+}
+
+int BaseIndex::GetBestHeight() const
+{
+    LOCK(cs_main);
+    if (fSynced) {
+        return chainActive.Height();
+    }
+    return pindexBest ? pindexBest->nHeight : -1;
+}
+
+bool BaseIndex::Init()
+{
+    uint256 hashBest;
+    if (!pblocktree->ReadIndexBest(name, hashBest)) {
+        fSynced = true;
+        return true;
+    }
+
+    LOCK(cs_main);
+    fSynced = false;
+    pindexBest = nullptr;
+    if (hashBest.IsNull()) {
+        fDropFirst = true;
+    } else {
+        BlockMap::const_iterator it = mapBlockIndex.find(hashBest);
+        if (it == mapBlockIndex.end()) {
+            // The block was lost from the block index; start over.
+            LogPrintf("%s: best block of %s not found, building it again\n", __func__, name);
+            fDropFirst = true;
+        } else {
+            pindexBest = it->second;
+        }
+    }
+    return true;
+}
+
+bool BaseIndex::Rebuild()
+{
+    // A null best block means that the old records must be dropped first.
+    if (!pblocktree->WriteIndexBest(name, uint256())) {
+        return error("%s: failed to record the start of %s", __func__, name);
+    }
+    return Init();
+}
+
+bool BaseIndex::Erase()
+{
+    if (!Drop()) {
+        return error("%s: failed to erase %s", __func__, name);
+    }
+    return pblocktree->EraseIndexBest(name);
+}
+
+void BaseIndex::Start(boost::thread_group& threadGroup)
+{
+    if (fSynced) {
+        return;
+    }
+    threadGroup.create_thread(boost::bind(&TraceThread<std::function<void()>>, name.c_str(),
+                                          std::function<void()>(std::bind(&BaseIndex::ThreadSync, this))));
+}
+
+void BaseIndex::ThreadSync()
+{
+    const Consensus::Params& consensusParams = Params().GetConsensus();
+
+    if (fDropFirst) {
+        LogPrintf("%s: erasing the old records of %s\n", __func__, name);
+        if (!Drop()) {
+            FatalError(strprintf("%s: failed to erase the old records of %s", __func__, name));
+            return;
+        }
+        fDropFirst = false;
+    }
+
+    int64_t nLastProgress = GetTime();
+    while (true) {
+        boost::this_thread::interruption_point();
+
+        const CBlockIndex* pindex;
+        bool fRewind;
+        {
+            LOCK(cs_main);
+            if (pindexBest == nullptr) {
+                // The genesis block has no entries in any index.
+                pindexBest = chainActive.Genesis();
+            }
+            if (pindexBest == nullptr) {
+                pindex = nullptr;
+                fRewind = false;
+            } else if (!chainActive.Contains(pindexBest)) {
+                pindex = pindexBest;
+                fRewind = true;
+            } else {
+                pindex = chainActive.Next(pindexBest);
+                fRewind = false;
+                if (pindex == nullptr) {
+                    // Caught up. ConnectBlock also holds cs_main, so it
+                    // writes every block connected from now on.
+                    if (!pblocktree->EraseIndexBest(name)) {
+                        FatalError(strprintf("%s: failed to record that %s is synced", __func__, name));
+                        return;
+                    }
+                    fSynced = true;
+                    LogPrintf("%s is synced at height %d\n", name, pindexBest->nHeight);
+                    return;
+                }
+            }
+        }
+        if (pindex == nullptr) {
+            // The chain has not been loaded yet.
+            MilliSleep(1000);
+            continue;
+        }
+
+        CBlock block;
+        CBlockUndo blockundo;
+        if (!ReadBlockFromDisk(block, pindex, consensusParams) ||
+            !UndoReadFromDisk(blockundo, pindex->GetUndoPos(), pindex->pprev->GetBlockHash()) ||
+            blockundo.vtxundo.size() + 1 != block.vtx.size())
+        {
+            FatalError(strprintf("%s: failed to read block %s for %s", __func__, pindex->GetBlockHash().ToString(), name));
+            return;
+        }
+        if (fRewind ? !RewindBlock(block, blockundo, pindex) : !WriteBlock(block, blockundo, pindex)) {
+            FatalError(strprintf("%s: failed to write block %s to %s", __func__, pindex->GetBlockHash().ToString(), name));
+            return;
+        }
+
+        const CBlockIndex* pindexNew = fRewind ? pindex->pprev : pindex;
+        if (!pblocktree->WriteIndexBest(name, pindexNew->GetBlockHash())) {
+            FatalError(strprintf("%s: failed to record the progress of %s", __func__, name));
+            return;
+        }
+        {
+            LOCK(cs_main);
+            pindexBest = pindexNew;
+        }
+
+        if (GetTime() - nLastProgress >= INDEX_PROGRESS_INTERVAL) {
+            LogPrintf("Building %s: height %d\n", name, pindexNew->nHeight);
+            nLastProgress = GetTime();
+        }
+    }
+}
@@ -0,0 +1,81 @@
+// Copyright (c) 2017-2018 The Bitcoin Core developers
+// Copyright (c) 2021 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifndef ZCASH_INDEX_BASE_H
+#define ZCASH_INDEX_BASE_H
+
+#include <atomic>
+#include <string>
+
+#include <boost/thread.hpp>
+
+class CBlock;
+class CBlockIndex;
+class CBlockUndo;
+
+/**
+ * An index of the block chain that can be built from the block files while
+ * the node keeps running.
+ *
+ * Once an index has caught up with the active chain it is synced, and is
+ * written by ConnectBlock and DisconnectBlock along with the chain state.
+ * Until then, its own thread reads the blocks it is missing from disk and
+ * writes them, recording in the block tree database the last block it has
+ * written, so that the build carries on from there after a restart. Writing
+ * a block to an index more than once has no further effect, so the entries
+ * and the record of progress need not be written atomically.
+ */
+class BaseIndex
+{
+private:
+    const std::string name;
+
+    //! Whether the index has caught up with the active chain.
+    std::atomic<bool> fSynced{true};
+
+    //! Whether the records of an earlier index have to be erased before building.
+    bool fDropFirst = false;
+
+    //! The last block that the build has written, or null if it has not
+    //! started. Guarded by cs_main.
+    const CBlockIndex* pindexBest = nullptr;
+
+    void ThreadSync();
+
+protected:
+    //! Write the entries of a block of the active chain.
+    virtual bool WriteBlock(const CBlock& block, const CBlockUndo& blockundo, const CBlockIndex* pindex) = 0;
+
+    //! Take the entries of a block off again when it has left the active chain.
+    virtual bool RewindBlock(const CBlock& block, const CBlockUndo& blockundo, const CBlockIndex* pindex) = 0;
+
+    //! Erase all the records of the index.
+    virtual bool Drop() = 0;
+
+public:
+    explicit BaseIndex(const std::string& nameIn) : name(nameIn) {}
+    virtual ~BaseIndex() {}
+
+    const std::string& GetName() const { return name; }
+
+    bool IsSynced() const { return fSynced; }
+
+    //! Height of the last block in the index, or -1 if it has none.
+    int GetBestHeight() const;
+
+    //! Load the progress of the build, if the index is being built.
+    bool Init();
+
+    //! Build the index again from the genesis block, erasing whatever it had.
+    bool Rebuild();
+
+    //! Erase the index, along with the progress of any build.
+    bool Erase();
+
+    //! Start building in the background, unless the index is synced.
+    void Start(boost::thread_group& threadGroup);
+};
+
+#endif // ZCASH_INDEX_BASE_H
@@ -0,0 +1,593 @@
+// Copyright (c) 2021 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "index/blockindexes.h"
+
+#include "chainparams.h"
+#include "experimental_features.h"
+#include "main.h"
+#include "timestampindex.h"
+#include "ui_interface.h"
+#include "util.h"
+#include "zcash/IncrementalMerkleTree.hpp"
+
+#include <map>
+
+std::unique_ptr<BaseIndex> g_txindex;
+std::unique_ptr<BaseIndex> g_addressindex;
+std::unique_ptr<BaseIndex> g_spentindex;
+std::unique_ptr<BaseIndex> g_timestampindex;
+std::unique_ptr<BaseIndex> g_blockfilterindex;
+std::unique_ptr<BaseIndex> g_shieldedindex;
+
+namespace {
+
+class TxIndex : public BaseIndex
+{
+protected:
+    bool WriteBlock(const CBlock& block, const CBlockUndo& blockundo, const CBlockIndex* pindex) override
+    {
+        std::vector<std::pair<uint256, CDiskTxPos>> vPos;
+        GetTxIndexEntries(block, pindex, vPos);
+        return pblocktree->WriteTxIndex(vPos);
+    }
+
+    // Like DisconnectBlock, leave the transactions of the block in the index.
+    bool RewindBlock(const CBlock& block, const CBlockUndo& blockundo, const CBlockIndex* pindex) override
+    {
+        return true;
+    }
+
+    bool Drop() override
+    {
+        return pblocktree->DropTxIndex();
+    }
+
+public:
+    TxIndex() : BaseIndex("txindex") {}
+};
+
+class AddressIndex : public BaseIndex
+{
+private:
+    bool Update(const CBlock& block, const CBlockUndo& blockundo, const CBlockIndex* pindex, bool fDisconnect)
+    {
+        std::vector<CAddressIndexDbEntry> addressIndex;
+        std::vector<CAddressUnspentDbEntry> addressUnspentIndex;
+        GetAddressIndexEntries(block, blockundo, pindex->nHeight, fDisconnect, addressIndex, addressUnspentIndex);
+        bool fOk = fDisconnect ? pblocktree->EraseAddressIndex(addressIndex, fAddressBalances)
+                               : pblocktree->WriteAddressIndex(addressIndex, fAddressBalances);
+        return fOk && pblocktree->UpdateAddressUnspentIndex(addressUnspentIndex);
+    }
+
+protected:
+    bool WriteBlock(const CBlock& block, const CBlockUndo& blockundo, const CBlockIndex* pindex) override
+    {
+        return Update(block, blockundo, pindex, false);
+    }
+
+    bool RewindBlock(const CBlock& block, const CBlockUndo& blockundo, const CBlockIndex* pindex) override
+    {
+        return Update(block, blockundo, pindex, true);
+    }
+
+    bool Drop() override
+    {
+        return pblocktree->DropAddressIndex();
+    }
+
+public:
+    AddressIndex() : BaseIndex("addressindex") {}
+};
+
+class SpentIndex : public BaseIndex
+{
+protected:
+    bool WriteBlock(const CBlock& block, const CBlockUndo& blockundo, const CBlockIndex* pindex) override
+    {
+        std::vector<CSpentIndexDbEntry> spentIndex;
+        GetSpentIndexEntries(block, blockundo, pindex->nHeight, false, spentIndex);
+        return pblocktree->UpdateSpentIndex(spentIndex);
+    }
+
+    bool RewindBlock(const CBlock& block, const CBlockUndo& blockundo, const CBlockIndex* pindex) override
+    {
+        std::vector<CSpentIndexDbEntry> spentIndex;
+        GetSpentIndexEntries(block, blockundo, pindex->nHeight, true, spentIndex);
+        return pblocktree->UpdateSpentIndex(spentIndex);
+    }
+
+    bool Drop() override
+    {
+        return pblocktree->DropSpentIndex();
+    }
+
+public:
+    SpentIndex() : BaseIndex("spentindex") {}
+};
+
+class TimestampIndex : public BaseIndex
+{
+protected:
+    bool WriteBlock(const CBlock& block, const CBlockUndo& blockundo, const CBlockIndex* pindex) override
+    {
+        return UpdateTimestampIndex(pindex);
+    }
+
+    // Like DisconnectBlock, leave the timestamps of the block in the index;
+    // getblockhashes can skip blocks that are not in the active chain.
+    bool RewindBlock(const CBlock& block, const CBlockUndo& blockundo, const CBlockIndex* pindex) override
+    {
+        return true;
+    }
+
+    bool Drop() override
+    {
+        return pblocktree->DropTimestampIndex();
+    }
+
+public:
+    TimestampIndex() : BaseIndex("timestampindex") {}
+};
+
+class BlockFilterIndex : public BaseIndex
+{
+protected:
+    bool WriteBlock(const CBlock& block, const CBlockUndo& blockundo, const CBlockIndex* pindex) override
+    {
+        return WriteBlockFilterIndex(block, blockundo, pindex);
+    }
+
+    // The filters are looked up by block hash, so those of blocks that
+    // have left the active chain can stay.
+    bool RewindBlock(const CBlock& block, const CBlockUndo& blockundo, const CBlockIndex* pindex) override
+    {
+        return true;
+    }
+
+    bool Drop() override
+    {
+        return pblocktree->DropBlockFilterIndex();
+    }
+
+public:
+    BlockFilterIndex() : BaseIndex("blockfilterindex") {}
+};
+
+class ShieldedIndex : public BaseIndex
+{
+protected:
+    bool WriteBlock(const CBlock& block, const CBlockUndo& blockundo, const CBlockIndex* pindex) override
+    {
+        return WriteShieldedIndex(block, pindex);
+    }
+
+    bool RewindBlock(const CBlock& block, const CBlockUndo& blockundo, const CBlockIndex* pindex) override
+    {
+        return EraseShieldedIndex(block, pindex);
+    }
+
+    bool Drop() override
+    {
+        return pblocktree->DropShieldedIndex();
+    }
+
+public:
+    ShieldedIndex() : BaseIndex("shieldedindex") {}
+};
+
+/**
+ * Bring one index in line with its option. fEnabled says whether the database
+ * has the index, and is updated to fWanted.
+ */
+bool InitIndex(std::unique_ptr<BaseIndex>& index, std::unique_ptr<BaseIndex> indexNew,
+               bool& fEnabled, bool fWanted, std::string& strError)
+{
+    const std::string name = indexNew->GetName();
+    index.reset();
+    if (fWanted) {
+        if (!fEnabled) {
+            // Pruned blocks can no longer be read to build the index from.
+            if (fHavePruned) {
+                strError = strprintf(_("You need to rebuild the database using -reindex to enable %s"), name);
+                return false;
+            }
+            LogPrintf("%s: building %s in the background\n", __func__, name);
+            if (!indexNew->Rebuild()) {
+                strError = strprintf(_("Error starting to build %s"), name);
+                return false;
+            }
+        } else if (!indexNew->Init()) {
+            strError = strprintf(_("Error loading %s"), name);
+            return false;
+        }
+        index = std::move(indexNew);
+    } else if (fEnabled) {
+        uiInterface.InitMessage(strprintf(_("Erasing %s..."), name));
+        LogPrintf("%s: erasing %s\n", __func__, name);
+        if (!indexNew->Erase()) {
+            strError = strprintf(_("Error erasing %s"), name);
+            return false;
+        }
+    }
+    if (fEnabled != fWanted) {
+        fEnabled = fWanted;
+        if (!pblocktree->WriteFlag(name, fEnabled)) {
+            strError = strprintf(_("Error writing the %s flag"), name);
+            return false;
+        }
+    }
+    return true;
+}
+
+}
+
+bool InitIndexes(std::string& strError)
+{
+    bool fAddressIndexBefore = fAddressIndex;
+
+    if (!InitIndex(g_txindex, std::unique_ptr<BaseIndex>(new TxIndex()),
+                   fTxIndex, GetBoolArg("-txindex", DEFAULT_TXINDEX), strError))
+        return false;
+    if (!InitIndex(g_addressindex, std::unique_ptr<BaseIndex>(new AddressIndex()),
+                   fAddressIndex, fExperimentalInsightExplorer || fExperimentalLightWalletd, strError))
+        return false;
+    if (!InitIndex(g_spentindex, std::unique_ptr<BaseIndex>(new SpentIndex()),
+                   fSpentIndex, fExperimentalInsightExplorer, strError))
+        return false;
+    if (!InitIndex(g_timestampindex, std::unique_ptr<BaseIndex>(new TimestampIndex()),
+                   fTimestampIndex, fExperimentalInsightExplorer, strError))
+        return false;
+    if (!InitIndex(g_blockfilterindex, std::unique_ptr<BaseIndex>(new BlockFilterIndex()),
+                   fBlockFilterIndex, GetBoolArg("-blockfilterindex", DEFAULT_BLOCKFILTERINDEX), strError))
+        return false;
+    if (!InitIndex(g_shieldedindex, std::unique_ptr<BaseIndex>(new ShieldedIndex()),
+                   fShieldedIndex, GetBoolArg("-shieldedindex", DEFAULT_SHIELDEDINDEX), strError))
+        return false;
+
+    // A new address index is built from the genesis block, so it can keep
+    // running balances.
+    if (fAddressIndex != fAddressIndexBefore) {
+        fAddressBalances = fAddressIndex;
+        pblocktree->WriteFlag("addressbalances", fAddressBalances);
+    }
+    pblocktree->WriteFlag("insightexplorer", fExperimentalInsightExplorer);
+    pblocktree->WriteFlag("lightwalletd", fExperimentalLightWalletd);
+    return true;
+}
+
+void StartIndexes(boost::thread_group& threadGroup)
+{
+    for (BaseIndex* index : {g_txindex.get(), g_addressindex.get(), g_spentindex.get(), g_timestampindex.get(),
+                             g_blockfilterindex.get(), g_shieldedindex.get()}) {
+        if (index) {
+            index->Start(threadGroup);
+        }
+    }
+}
+
+void StopIndexes()
+{
+    g_txindex.reset();
+    g_addressindex.reset();
+    g_spentindex.reset();
+    g_timestampindex.reset();
+    g_blockfilterindex.reset();
+    g_shieldedindex.reset();
+}
+
+void GetTxIndexEntries(const CBlock& block, const CBlockIndex* pindex,
+                       std::vector<std::pair<uint256, CDiskTxPos>>& vPos)
+{
+    CDiskTxPos pos(pindex->GetBlockPos(), GetSizeOfCompactSize(block.vtx.size()));
+    vPos.reserve(vPos.size() + block.vtx.size());
+    for (const CTransaction& tx : block.vtx) {
+        pos.nTxSize = ::GetSerializeSize(tx, SER_DISK, CLIENT_VERSION);
+        vPos.push_back(std::make_pair(tx.GetHash(), pos));
+        pos.nTxOffset += pos.nTxSize;
+    }
+}
+
+// https://github.com/bitpay/bitcoin/commit/017f548ea6d89423ef568117447e61dd5707ec42#diff-7ec3c68a81efff79b6ca22ac1f1eabbaR2597
+void GetAddressIndexEntries(const CBlock& block, const CBlockUndo& blockundo, int nHeight, bool fDisconnect,
+                            std::vector<CAddressIndexDbEntry>& addressIndex,
+                            std::vector<CAddressUnspentDbEntry>& addressUnspentIndex)
+{
+    // A transaction can spend the outputs of earlier transactions in the
+    // block, so the unspent index entries are produced in the order that
+    // the transactions are connected, or the reverse order when disconnecting.
+    for (size_t n = 0; n < block.vtx.size(); n++) {
+        const size_t i = fDisconnect ? block.vtx.size() - 1 - n : n;
+        const CTransaction& tx = block.vtx[i];
+        const uint256 hash = tx.GetHash();
+
+        if (i > 0) {
+            const CTxUndo& txundo = blockundo.vtxundo[i - 1];
+            for (size_t j = 0; j < tx.vin.size(); j++) {
+                const CTxIn& input = tx.vin[j];
+                const Coin& coin = txundo.vprevout[j];
+                const CTxOut& prevout = coin.out;
+                CScript::ScriptType scriptType = prevout.scriptPubKey.GetType();
+                if (scriptType == CScript::UNKNOWN) {
+                    continue;
+                }
+                const uint160 addrHash = prevout.scriptPubKey.AddressHash();
+
+                // spending activity
+                addressIndex.push_back(std::make_pair(
+                    CAddressIndexKey(scriptType, addrHash, nHeight, i, hash, j, true),
+                    prevout.nValue * -1));
+
+                // remove the output from the unspent index, or restore it
+                addressUnspentIndex.push_back(std::make_pair(
+                    CAddressUnspentKey(scriptType, addrHash, input.prevout.hash, input.prevout.n),
+                    fDisconnect ? CAddressUnspentValue(prevout.nValue, prevout.scriptPubKey, coin.nHeight)
+                                : CAddressUnspentValue()));
+            }
+        }
+
+        for (size_t k = 0; k < tx.vout.size(); k++) {
+            const CTxOut& out = tx.vout[k];
+            CScript::ScriptType scriptType = out.scriptPubKey.GetType();
+            if (scriptType == CScript::UNKNOWN) {
+                continue;
+            }
+            const uint160 addrHash = out.scriptPubKey.AddressHash();
+
+            // receiving activity
+            addressIndex.push_back(std::make_pair(
+                CAddressIndexKey(scriptType, addrHash, nHeight, i, hash, k, false),
+                out.nValue));
+
+            // add the output to the unspent index, or remove it
+            addressUnspentIndex.push_back(std::make_pair(
+                CAddressUnspentKey(scriptType, addrHash, hash, k),
+                fDisconnect ? CAddressUnspentValue()
+                            : CAddressUnspentValue(out.nValue, out.scriptPubKey, nHeight)));
+        }
+    }
+}
+
+void GetSpentIndexEntries(const CBlock& block, const CBlockUndo& blockundo, int nHeight, bool fDisconnect,
+                          std::vector<CSpentIndexDbEntry>& spentIndex)
+{
+    for (size_t i = 1; i < block.vtx.size(); i++) {
+        const CTransaction& tx = block.vtx[i];
+        const uint256 hash = tx.GetHash();
+        const CTxUndo& txundo = blockundo.vtxundo[i - 1];
+        for (size_t j = 0; j < tx.vin.size(); j++) {
+            const CTxIn& input = tx.vin[j];
+            if (fDisconnect) {
+                spentIndex.push_back(std::make_pair(
+                    CSpentIndexKey(input.prevout.hash, input.prevout.n),
+                    CSpentIndexValue()));
+                continue;
+            }
+            // Add the spent index to determine the txid and input that spent an output
+            // and to find the amount and address from an input.
+            // If we do not recognize the script type, we still add an entry to the
+            // spentindex db, with a script type of 0 and addrhash of all zeroes.
+            const CTxOut& prevout = txundo.vprevout[j].out;
+            spentIndex.push_back(std::make_pair(
+                CSpentIndexKey(input.prevout.hash, input.prevout.n),
+                CSpentIndexValue(hash, j, nHeight, prevout.nValue,
+                                 prevout.scriptPubKey.GetType(), prevout.scriptPubKey.AddressHash())));
+        }
+    }
+}
+
+bool UpdateTimestampIndex(const CBlockIndex* pindex)
+{
+    unsigned int logicalTS = pindex->nTime;
+    unsigned int prevLogicalTS = 0;
+
+    // retrieve logical timestamp of the previous block
+    if (pindex->pprev)
+        if (!pblocktree->ReadTimestampBlockIndex(pindex->pprev->GetBlockHash(), prevLogicalTS))
+            LogPrintf("%s: Failed to read previous block's logical timestamp\n", __func__);
+
+    if (logicalTS <= prevLogicalTS) {
+        logicalTS = prevLogicalTS + 1;
+        LogPrintf("%s: Previous logical timestamp is newer Actual[%d] prevLogical[%d] Logical[%d]\n", __func__, pindex->nTime, prevLogicalTS, logicalTS);
+    }
+
+    if (!pblocktree->WriteTimestampIndex(CTimestampIndexKey(logicalTS, pindex->GetBlockHash())))
+        return error("%s: failed to write timestamp index", __func__);
+
+    if (!pblocktree->WriteTimestampBlockIndex(CTimestampBlockIndexKey(pindex->GetBlockHash()), CTimestampBlockIndexValue(logicalTS)))
+        return error("%s: failed to write blockhash index", __func__);
+
+    return true;
+}
+
+static CBlockFilterEntry GenesisBlockFilter()
+{
+    const CBlock& genesis = Params().GenesisBlock();
+    BlockFilter filter(BlockFilterType::BASIC, genesis, CBlockUndo());
+    CBlockFilterEntry entry;
+    entry.vFilter = filter.GetEncodedFilter();
+    entry.hashFilter = filter.GetHash();
+    entry.header = ComputeFilterHeader(entry.hashFilter, uint256());
+    return entry;
+}
+
+bool LookupBlockFilter(const CBlockIndex* pindex, CBlockFilterEntry& entry)
+{
+    if (pindex->pprev == nullptr) {
+        static const CBlockFilterEntry genesisEntry = GenesisBlockFilter();
+        entry = genesisEntry;
+        return true;
+    }
+    return pblocktree->ReadBlockFilter(pindex->GetBlockHash(), entry);
+}
+
+bool WriteBlockFilterIndex(const CBlock& block, const CBlockUndo& blockundo, const CBlockIndex* pindex)
+{
+    CBlockFilterEntry prev;
+    if (!LookupBlockFilter(pindex->pprev, prev))
+        return error("%s: filter of block %s is not in the index", __func__, pindex->pprev->GetBlockHash().ToString());
+
+    BlockFilter filter(BlockFilterType::BASIC, block, blockundo);
+    CBlockFilterEntry entry;
+    entry.vFilter = filter.GetEncodedFilter();
+    entry.hashFilter = filter.GetHash();
+    entry.header = ComputeFilterHeader(entry.hashFilter, prev.header);
+    return pblocktree->WriteBlockFilter(pindex->GetBlockHash(), entry);
+}
+
+void GetShieldedIndexEntries(const CBlock& block, int nHeight, uint64_t nTreeSize,
+                             std::vector<CSaplingSpendIndexDbEntry>& spends,
+                             std::vector<CSaplingOutputIndexDbEntry>& outputs)
+{
+    // The commitments are appended to the tree in the order of the
+    // transactions and of their outputs.
+    for (const CTransaction& tx : block.vtx) {
+        const uint256& txid = tx.GetHash();
+        for (unsigned int i = 0; i < tx.vShieldedSpend.size(); i++) {
+            spends.push_back(std::make_pair(tx.vShieldedSpend[i].nullifier,
+                                            CSaplingSpendIndexValue(txid, i, nHeight)));
+        }
+        for (unsigned int i = 0; i < tx.vShieldedOutput.size(); i++) {
+            outputs.push_back(std::make_pair(tx.vShieldedOutput[i].cmu,
+                                             CSaplingOutputIndexValue(txid, i, nHeight, nTreeSize++)));
+        }
+    }
+}
+
+bool LookupSaplingTreeSize(const CBlockIndex* pindex, uint64_t& nSize)
+{
+    // The genesis block, which is not connected, has no Sapling outputs.
+    if (pindex->pprev == nullptr) {
+        nSize = 0;
+        return true;
+    }
+    return pblocktree->ReadSaplingTreeSize(pindex->GetBlockHash(), nSize);
+}
+
+namespace {
+
+/**
+ * Reads nodes of the Sapling tree from the shielded index, with the nodes
+ * of a block that is being written on top.
+ */
+class SaplingTreeReader
+{
+private:
+    std::map<CSaplingTreeNodeKey, libzcash::PedersenHash> pending;
+
+public:
+    void Add(int nLevel, uint64_t nIndex, const libzcash::PedersenHash& node)
+    {
+        pending[CSaplingTreeNodeKey(nLevel, nIndex)] = node;
+    }
+
+    /** A complete node: read if its level is kept, and computed from its children otherwise. */
+    bool Get(int nLevel, uint64_t nIndex, libzcash::PedersenHash& node)
+    {
+        if (nLevel % SAPLING_TREE_INDEX_STRIDE == 0) {
+            auto it = pending.find(CSaplingTreeNodeKey(nLevel, nIndex));
+            if (it != pending.end()) {
+                node = it->second;
+                return true;
+            }
+            uint256 value;
+            if (!pblocktree->ReadSaplingTreeNode(CSaplingTreeNodeKey(nLevel, nIndex), value))
+                return false;
+            node = value;
+            return true;
+        }
+        return Compute(nLevel, nIndex, node);
+    }
+
+    /** A complete node, computed from its children. */
+    bool Compute(int nLevel, uint64_t nIndex, libzcash::PedersenHash& node)
+    {
+        libzcash::PedersenHash left, right;
+        if (!Get(nLevel - 1, 2 * nIndex, left) || !Get(nLevel - 1, 2 * nIndex + 1, right))
+            return false;
+        node = libzcash::PedersenHash::combine(left, right, nLevel - 1);
+        return true;
+    }
+};
+
+}
+
+bool WriteShieldedIndex(const CBlock& block, const CBlockIndex* pindex)
+{
+    uint64_t nTreeSize;
+    if (!LookupSaplingTreeSize(pindex->pprev, nTreeSize))
+        return error("%s: Sapling tree size of block %s is not in the index", __func__, pindex->pprev->GetBlockHash().ToString());
+
+    std::vector<CSaplingSpendIndexDbEntry> spends;
+    std::vector<CSaplingOutputIndexDbEntry> outputs;
+    GetShieldedIndexEntries(block, pindex->nHeight, nTreeSize, spends, outputs);
+    const uint64_t nTreeSizeEnd = nTreeSize + outputs.size();
+
+    // The commitments of the block, and the kept subtree roots that they
+    // complete, lowest level first so that each is computed from the last.
+    SaplingTreeReader reader;
+    std::vector<CSaplingTreeNodeDbEntry> nodes;
+    for (const CSaplingOutputIndexDbEntry& output : outputs) {
+        reader.Add(0, output.second.position, output.first);
+        nodes.push_back(std::make_pair(CSaplingTreeNodeKey(0, output.second.position), output.first));
+    }
+    for (int nLevel = SAPLING_TREE_INDEX_STRIDE; nLevel < SAPLING_INCREMENTAL_MERKLE_TREE_DEPTH; nLevel += SAPLING_TREE_INDEX_STRIDE) {
+        for (uint64_t nIndex = nTreeSize >> nLevel; nIndex < nTreeSizeEnd >> nLevel; nIndex++) {
+            libzcash::PedersenHash node;
+            if (!reader.Compute(nLevel, nIndex, node))
+                return error("%s: Sapling tree node %d/%u of block %s is not in the index", __func__, nLevel, nIndex, pindex->GetBlockHash().ToString());
+            reader.Add(nLevel, nIndex, node);
+            nodes.push_back(std::make_pair(CSaplingTreeNodeKey(nLevel, nIndex), node));
+        }
+    }
+
+    return pblocktree->WriteShieldedIndex(spends, outputs, nodes, pindex->GetBlockHash(), nTreeSizeEnd);
+}
+
+bool GetSaplingAuthPath(uint64_t nTreeSize, uint64_t nPosition, std::vector<libzcash::PedersenHash>& path,
+                        libzcash::PedersenHash& root)
+{
+    if (nPosition >= nTreeSize)
+        return false;
+
+    // frontier is the node at each level that holds the last commitments of
+    // the tree, padded with uncommitted leaves; nodes to its left are
+    // complete, and nodes to its right are empty.
+    SaplingTreeReader reader;
+    libzcash::PedersenHash frontier = libzcash::PedersenHash::EmptyRoot(0);
+    path.clear();
+    for (int nLevel = 0; nLevel < SAPLING_INCREMENTAL_MERKLE_TREE_DEPTH; nLevel++) {
+        const uint64_t nFrontier = nTreeSize >> nLevel;
+        const uint64_t nSibling = (nPosition >> nLevel) ^ 1;
+        libzcash::PedersenHash sibling;
+        if (nSibling < nFrontier) {
+            if (!reader.Get(nLevel, nSibling, sibling))
+                return error("%s: Sapling tree node %d/%u is not in the index", __func__, nLevel, nSibling);
+        } else if (nSibling == nFrontier) {
+            sibling = frontier;
+        } else {
+            sibling = libzcash::PedersenHash::EmptyRoot(nLevel);
+        }
+        path.push_back(sibling);
+
+        if (nFrontier & 1) {
+            libzcash::PedersenHash left = sibling;
+            if (nSibling != nFrontier - 1 && !reader.Get(nLevel, nFrontier - 1, left))
+                return error("%s: Sapling tree node %d/%u is not in the index", __func__, nLevel, nFrontier - 1);
+            frontier = libzcash::PedersenHash::combine(left, frontier, nLevel);
+        } else {
+            frontier = libzcash::PedersenHash::combine(frontier, libzcash::PedersenHash::EmptyRoot(nLevel), nLevel);
+        }
+    }
+    root = frontier;
+    return true;
+}
+
+bool EraseShieldedIndex(const CBlock& block, const CBlockIndex* pindex)
+{
+    std::vector<CSaplingSpendIndexDbEntry> spends;
+    std::vector<CSaplingOutputIndexDbEntry> outputs;
+    GetShieldedIndexEntries(block, pindex->nHeight, 0, spends, outputs);
+    return pblocktree->EraseShieldedIndex(spends, outputs);
+}
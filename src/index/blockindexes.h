@@ -0,0 +1,126 @@
+// Copyright (c) 2021 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifndef ZCASH_INDEX_BLOCKINDEXES_H
+#define ZCASH_INDEX_BLOCKINDEXES_H
+
+#include "blockfilter.h"
+#include "chain.h"
+#include "index/base.h"
+#include "primitives/block.h"
+#include "txdb.h"
+#include "undo.h"
+#include "zcash/IncrementalMerkleTree.hpp"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <boost/thread.hpp>
+
+/**
+ * The optional indexes of the block tree database: the transaction index
+ * (-txindex), and the address, spent and timestamp indexes of the insight
+ * explorer and lightwalletd. Each is null if it is not enabled.
+ */
+extern std::unique_ptr<BaseIndex> g_txindex;
+extern std::unique_ptr<BaseIndex> g_addressindex;
+extern std::unique_ptr<BaseIndex> g_spentindex;
+extern std::unique_ptr<BaseIndex> g_timestampindex;
+/** The index of basic block filters (-blockfilterindex), or null if it is not enabled. */
+extern std::unique_ptr<BaseIndex> g_blockfilterindex;
+/** The index of Sapling nullifiers and note commitments (-shieldedindex), or null if it is not enabled. */
+extern std::unique_ptr<BaseIndex> g_shieldedindex;
+
+/**
+ * Whether ConnectBlock and DisconnectBlock should write an enabled index,
+ * which they do unless it is still being built in the background.
+ */
+inline bool IsIndexSynced(const std::unique_ptr<BaseIndex>& index)
+{
+    return !index || index->IsSynced();
+}
+
+/**
+ * Bring the indexes in line with the options: build those that have been
+ * enabled, and erase those that have been disabled. Called once the block
+ * index has been loaded.
+ */
+bool InitIndexes(std::string& strError);
+
+/** Start building the indexes that have not caught up with the chain. */
+void StartIndexes(boost::thread_group& threadGroup);
+
+/** Release the indexes, once their threads have been stopped. */
+void StopIndexes();
+
+/** The transaction index entries of a block. */
+void GetTxIndexEntries(const CBlock& block, const CBlockIndex* pindex,
+                       std::vector<std::pair<uint256, CDiskTxPos>>& vPos);
+
+/**
+ * The address index and address unspent index entries of a block, given its
+ * undo data. If fDisconnect is set, the unspent index entries are those that
+ * disconnecting the block writes, and the address index entries are to be
+ * erased.
+ */
+void GetAddressIndexEntries(const CBlock& block, const CBlockUndo& blockundo, int nHeight, bool fDisconnect,
+                            std::vector<CAddressIndexDbEntry>& addressIndex,
+                            std::vector<CAddressUnspentDbEntry>& addressUnspentIndex);
+
+/**
+ * The spent index entries of a block, given its undo data. If fDisconnect is
+ * set, they erase the entries that connecting the block wrote.
+ */
+void GetSpentIndexEntries(const CBlock& block, const CBlockUndo& blockundo, int nHeight, bool fDisconnect,
+                          std::vector<CSpentIndexDbEntry>& spentIndex);
+
+/** Write the timestamp index entries of a block of the active chain. */
+bool UpdateTimestampIndex(const CBlockIndex* pindex);
+
+/**
+ * Write the basic filter of a block to the block filter index, given its
+ * undo data. Its header follows that of the previous block, which must be
+ * in the index already.
+ */
+bool WriteBlockFilterIndex(const CBlock& block, const CBlockUndo& blockundo, const CBlockIndex* pindex);
+
+/**
+ * Read the basic filter of a block from the block filter index. The filter
+ * of the genesis block, which is not connected, is computed instead.
+ */
+bool LookupBlockFilter(const CBlockIndex* pindex, CBlockFilterEntry& entry);
+
+/**
+ * The shielded index entries of a block at height nHeight: the spends that
+ * reveal its Sapling nullifiers, and the outputs that create its note
+ * commitments, at positions in the Sapling tree that follow nTreeSize.
+ */
+void GetShieldedIndexEntries(const CBlock& block, int nHeight, uint64_t nTreeSize,
+                             std::vector<CSaplingSpendIndexDbEntry>& spends,
+                             std::vector<CSaplingOutputIndexDbEntry>& outputs);
+
+/**
+ * Write the Sapling spends and outputs of a block to the shielded index,
+ * with the nodes of the Sapling tree that its note commitments fill in. The
+ * positions of the commitments follow the size of the tree as of the
+ * previous block, which must be in the index already.
+ */
+bool WriteShieldedIndex(const CBlock& block, const CBlockIndex* pindex);
+
+/** The size of the Sapling tree as of the end of a block, from the shielded index. */
+bool LookupSaplingTreeSize(const CBlockIndex* pindex, uint64_t& nSize);
+
+/**
+ * The authentication path of the commitment at nPosition in the Sapling tree
+ * of nTreeSize commitments, from the shielded index: the sibling of the path
+ * at each level, leaves first, and the root of the tree.
+ */
+bool GetSaplingAuthPath(uint64_t nTreeSize, uint64_t nPosition, std::vector<libzcash::PedersenHash>& path,
+                        libzcash::PedersenHash& root);
+
+/** Erase the Sapling spends and outputs of a block that has left the active chain from the shielded index. */
+bool EraseShieldedIndex(const CBlock& block, const CBlockIndex* pindex);
+
+#endif // ZCASH_INDEX_BLOCKINDEXES_H
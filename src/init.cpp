@@ -10,14 +10,19 @@
 #include "init.h"
 #include "addrman.h"
 #include "amount.h"
+#include "blockcompression.h"
+#include "cachebudget.h"
 #include "checkpoints.h"
+#include "coinssnapshot.h"
 #include "compat/sanity.h"
 #include "consensus/upgrades.h"
 #include "consensus/validation.h"
+#include "crypto/sha256.h"
 #include "experimental_features.h"
 #include "fs.h"
 #include "httpserver.h"
 #include "httprpc.h"
+#include "index/blockindexes.h"
 #include "key.h"
 #if defined(ENABLE_MINING) || defined(ENABLE_WALLET)
 #include "key_io.h"
@@ -28,11 +33,13 @@
 #include "miner.h"
 #include "net.h"
 #include "policy/policy.h"
+#include "proof_verifier.h"
 #include "rpc/server.h"
 #include "rpc/register.h"
 #include "script/standard.h"
 #include "script/sigcache.h"
 #include "scheduler.h"
+#include "support/largepages.h"
 #include "txdb.h"
 #include "torcontrol.h"
 #include "ui_interface.h"
@@ -46,6 +53,8 @@
 #include "warnings.h"
 #include <stdint.h>
 #include <stdio.h>
+#include <future>
+#include <thread>
 
 #ifndef WIN32
 #include <signal.h>
@@ -62,6 +71,7 @@
 
 #if ENABLE_ZMQ
 #include "zmq/zmqnotificationinterface.h"
+#include "zmq/zmqpublisher.h"
 #endif
 
 #include <rust/metrics.h>
@@ -74,11 +84,14 @@ extern void ThreadSendAlert();
 
 TracingHandle* pTracingHandle = nullptr;
 
-bool fFeeEstimatesInitialized = false;
+static std::atomic<bool> fFeeEstimatesInitialized(false);
+// Set once mempool.dat has been loaded, so that a node shut down before then does not overwrite it.
+static std::atomic<bool> fDumpMempoolLater(false);
 static const bool DEFAULT_PROXYRANDOMIZE = true;
 static const bool DEFAULT_REST_ENABLE = false;
 static const bool DEFAULT_DISABLE_SAFEMODE = false;
 static const bool DEFAULT_STOPAFTERBLOCKIMPORT = false;
+static const bool DEFAULT_PRELOAD_PROVING_PARAMS = false;
 
 
 #if ENABLE_ZMQ
@@ -103,6 +116,10 @@ enum BindFlags {
 };
 
 static const char* FEE_ESTIMATES_FILENAME="fee_estimates.dat";
+/** Seconds between folding newly connected blocks into the fee estimates */
+static const int64_t FEE_ESTIMATES_UPDATE_INTERVAL = 1;
+/** Seconds between writes of the fee estimates to disk */
+static const int64_t FEE_ESTIMATES_DUMP_INTERVAL = 15 * 60;
 CClientUIInterface uiInterface; // Declared but not defined in ui_interface.h
 
 //////////////////////////////////////////////////////////////////////////////
@@ -146,9 +163,9 @@ class CCoinsViewErrorCatcher : public CCoinsViewBacked
 {
 public:
     CCoinsViewErrorCatcher(CCoinsView* view) : CCoinsViewBacked(view) {}
-    bool GetCoins(const uint256 &txid, CCoins &coins) const {
+    bool GetCoin(const COutPoint &outpoint, Coin &coin) const {
         try {
-            return CCoinsViewBacked::GetCoins(txid, coins);
+            return CCoinsViewBacked::GetCoin(outpoint, coin);
         } catch(const std::runtime_error& e) {
             uiInterface.ThreadSafeMessageBox(_("Error reading from database, shutting down."), "", CClientUIInterface::MSG_ERROR);
             LogPrintf("Error reading from database: %s\n", e.what());
@@ -162,10 +179,33 @@ public:
     // Writes do not need similar protection, as failure to write is handled by the caller.
 };
 
-static CCoinsViewDB *pcoinsdbview = NULL;
 static CCoinsViewErrorCatcher *pcoinscatcher = NULL;
 static boost::scoped_ptr<ECCVerifyHandle> globalVerifyHandle;
 
+static void DumpFeeEstimates()
+{
+    // Called from both the scheduler thread and Shutdown.
+    static CCriticalSection cs_dumpFeeEstimates;
+    LOCK(cs_dumpFeeEstimates);
+    if (!fFeeEstimatesInitialized)
+        return;
+
+    fs::path est_path = GetDataDir() / FEE_ESTIMATES_FILENAME;
+    fs::path est_path_tmp = est_path;
+    est_path_tmp += ".new";
+    CAutoFile est_fileout(fsbridge::fopen(est_path_tmp, "wb"), SER_DISK, CLIENT_VERSION);
+    if (est_fileout.IsNull()) {
+        LogPrintf("%s: Failed to write fee estimates to %s\n", __func__, est_path_tmp.string());
+        return;
+    }
+    if (!mempool.WriteFeeEstimates(est_fileout))
+        return;
+    FileCommit(est_fileout.Get());
+    est_fileout.fclose();
+    if (!RenameOver(est_path_tmp, est_path))
+        LogPrintf("%s: Failed to rename %s to %s\n", __func__, est_path_tmp.string(), est_path.string());
+}
+
 void Interrupt(boost::thread_group& threadGroup)
 {
     InterruptHTTPServer();
@@ -207,25 +247,28 @@ void Shutdown()
     StopNode();
     StopTorControl();
     UnregisterNodeSignals(GetNodeSignals());
+    UnregisterBackgroundSignalScheduler();
 
-    if (fFeeEstimatesInitialized)
-    {
-        fs::path est_path = GetDataDir() / FEE_ESTIMATES_FILENAME;
-        CAutoFile est_fileout(fsbridge::fopen(est_path, "wb"), SER_DISK, CLIENT_VERSION);
-        if (!est_fileout.IsNull())
-            mempool.WriteFeeEstimates(est_fileout);
-        else
-            LogPrintf("%s: Failed to write fee estimates to %s\n", __func__, est_path.string());
-        fFeeEstimatesInitialized = false;
+    if (fDumpMempoolLater && GetBoolArg("-persistmempool", DEFAULT_PERSIST_MEMPOOL)) {
+        DumpMempool();
     }
 
+    DumpFeeEstimates();
+    fFeeEstimatesInitialized = false;
+
+    StopIndexes();
+
     {
         LOCK(cs_main);
         if (pcoinsTip != NULL) {
             FlushStateToDisk();
+            WriteBlockIndexCache();
         }
+        FlushPrunedFiles();
         delete pcoinsTip;
         pcoinsTip = NULL;
+        delete pcoinsSnapshot;
+        pcoinsSnapshot = NULL;
         delete pcoinscatcher;
         pcoinscatcher = NULL;
         delete pcoinsdbview;
@@ -233,6 +276,7 @@ void Shutdown()
         delete pblocktree;
         pblocktree = NULL;
     }
+    CloseHeaderStore();
 #ifdef ENABLE_WALLET
     if (pwalletMain)
         pwalletMain->Flush(true);
@@ -329,11 +373,17 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-?", _("This help message"));
     strUsage += HelpMessageOpt("-alerts", strprintf(_("Receive and display P2P network alerts (default: %u)"), DEFAULT_ALERTS));
     strUsage += HelpMessageOpt("-alertnotify=<cmd>", _("Execute command when a relevant alert is received or we see a really long fork (%s in cmd is replaced by message)"));
+    strUsage += HelpMessageOpt("-assumevalidheaders", strprintf(_("Skip checking most Equihash solutions of headers and blocks up to the last checkpoint, which commits to them; has no effect when checkpoints are disabled (default: %u)"), DEFAULT_ASSUME_VALID_HEADERS));
+    strUsage += HelpMessageOpt("-blockcompression", strprintf(_("Compress new blocks and undo data written to the block files; they remain readable with this option off, but not by older versions (default: %u)"), DEFAULT_BLOCK_COMPRESSION));
+    strUsage += HelpMessageOpt("-blockindexcache", strprintf(_("Write the block index to a cache file at shutdown, which is loaded instead of the block index database at the next start (default: %u)"), DEFAULT_BLOCK_INDEX_CACHE));
+    strUsage += HelpMessageOpt("-blockfilterindex", strprintf(_("Maintain an index of the basic block filters of BIP 158, built in the background if it is enabled on an existing node (default: %u)"), DEFAULT_BLOCKFILTERINDEX));
     strUsage += HelpMessageOpt("-blocknotify=<cmd>", _("Execute command when the best block changes (%s in cmd is replaced by block hash)"));
     if (showDebug)
         strUsage += HelpMessageOpt("-blocksonly", strprintf(_("Whether to reject transactions from network peers. Automatic broadcast and rebroadcast of any transactions from inbound peers is disabled, unless '-whitelistforcerelay' is '1', in which case whitelisted peers' transactions will be relayed. RPC transactions are not affected. (default: %u)"), DEFAULT_BLOCKSONLY));
     strUsage += HelpMessageOpt("-checkblocks=<n>", strprintf(_("How many blocks to check at startup (default: %u, 0 = all)"), DEFAULT_CHECKBLOCKS));
+    strUsage += HelpMessageOpt("-checkblockshalt", strprintf(_("Shut down if the background check of -checkblocks finds a corrupted block, instead of only warning (default: %u)"), DEFAULT_CHECKBLOCKS_HALT));
     strUsage += HelpMessageOpt("-checklevel=<n>", strprintf(_("How thorough the block verification of -checkblocks is (0-4, default: %u)"), DEFAULT_CHECKLEVEL));
+    strUsage += HelpMessageOpt("-compactblockindex", strprintf(_("Maintain an index of the Sapling nullifiers and compact outputs of each block, used to speed up wallet rescans after importing Sapling keys (default: %u)"), DEFAULT_COMPACTBLOCKINDEX));
     strUsage += HelpMessageOpt("-conf=<file>", strprintf(_("Specify configuration file (default: %s)"), BITCOIN_CONF_FILENAME));
     if (mode == HMM_BITCOIND)
     {
@@ -341,28 +391,53 @@ std::string HelpMessage(HelpMessageMode mode)
         strUsage += HelpMessageOpt("-daemon", _("Run in the background as a daemon and accept commands"));
 #endif
     }
+    strUsage += HelpMessageOpt("-asyncflush", strprintf(_("Write the chain state to disk on a background thread while block validation continues; the UTXO set cache may then temporarily use up to twice its share of -dbcache (default: %u)"), DEFAULT_ASYNC_FLUSH));
     strUsage += HelpMessageOpt("-datadir=<dir>", _("Specify data directory"));
     strUsage += HelpMessageOpt("-paramsdir=<dir>", _("Specify Zcash network parameters directory"));
     strUsage += HelpMessageOpt("-dbcache=<n>", strprintf(_("Set database cache size in megabytes (%d to %d, default: %d)"), nMinDbCache, nMaxDbCache, nDefaultDbCache));
+    strUsage += HelpMessageOpt("-adaptivedbcache", strprintf(_("Move memory between the in-memory UTXO set, the chain state database cache and the mempool while running, as they need it, within the total of -dbcache and -mempooltxcostlimit (default: %u)"), DEFAULT_ADAPTIVE_DBCACHE));
+    strUsage += HelpMessageOpt("-largepages=<mode>", strprintf(_("Back the UTXO set cache and the signature cache with huge pages: none, transparent (madvise), or explicit (reserved with vm.nr_hugepages, falling back to transparent) (default: %s)"), DEFAULT_LARGE_PAGES));
+    strUsage += HelpMessageOpt("-numainterleave", strprintf(_("Spread the pages of the UTXO set cache and the signature cache over all NUMA nodes, rather than placing each on the node of the thread that first uses it (default: %u)"), DEFAULT_NUMA_INTERLEAVE));
+    strUsage += HelpMessageOpt("-dbcachekeep=<n>", strprintf(_("Percentage of the in-memory UTXO set cache to keep, as its most recently created coins, when it is written to disk (0 to %d, default: %d)"), nMaxDbCacheKeep, nDefaultDbCacheKeep));
     strUsage += HelpMessageOpt("-debuglogfile=<file>", strprintf(_("Specify location of debug log file: this can be an absolute path or a path relative to the data directory (default: %s)"), DEFAULT_DEBUGLOGFILE));
     strUsage += HelpMessageOpt("-exportdir=<dir>", _("Specify directory to be used when exporting data"));
     strUsage += HelpMessageOpt("-ibdskiptxverification", strprintf(_("Skip transaction verification during initial block download up to the last checkpoint height. Incompatible with flags that disable checkpoints. (default = %u)"), DEFAULT_IBD_SKIP_TX_VERIFICATION));
     strUsage += HelpMessageOpt("-loadblock=<file>", _("Imports blocks from external blk000??.dat file on startup"));
+    strUsage += HelpMessageOpt("-loadheaders=<file>", _("Imports the headers of a header snapshot written by dumpheaders on startup, if it matches the checkpoints and has the minimum chain work"));
+    strUsage += HelpMessageOpt("-lazymempoolindex", strprintf(_("With -insightexplorer or -lightwalletd, build the mempool address and spent indexes when they are first queried instead of as transactions enter the mempool (default: %u)"), DEFAULT_LAZY_MEMPOOL_INDEX));
     strUsage += HelpMessageOpt("-maxorphantx=<n>", strprintf(_("Keep at most <n> unconnectable transactions in memory (default: %u)"), DEFAULT_MAX_ORPHAN_TRANSACTIONS));
-    strUsage += HelpMessageOpt("-par=<n>", strprintf(_("Set the number of script verification threads (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)"),
+    strUsage += HelpMessageOpt("-nullifierfilter", strprintf(_("Keep an in-memory filter over the spent Sprout and Sapling nullifiers, built at startup, so that most checks for double-spends do not read the chain state database (default: %u)"), DEFAULT_NULLIFIER_FILTER));
+    strUsage += HelpMessageOpt("-par=<n>", strprintf(_("Set the number of script verification threads (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d). A thread is started per core, and those beyond this number are kept for -adaptivepar and setverificationthreads"),
         -GetNumCores(), MAX_SCRIPTCHECK_THREADS, DEFAULT_SCRIPTCHECK_THREADS));
+    strUsage += HelpMessageOpt("-adaptivepar", strprintf(_("Use more script verification threads than -par, up to one per core, while checks back up during initial block download, and return to -par at the tip (default: %u)"), DEFAULT_ADAPTIVE_PAR));
+    strUsage += HelpMessageOpt("-preloadprovingparams", strprintf(_("Load the Sapling proving parameters at startup, rather than when the first Sapling proof is created (default: %u)"), DEFAULT_PRELOAD_PROVING_PARAMS));
+    strUsage += HelpMessageOpt("-prefetchthreads=<n>", strprintf(_("Set the number of threads that read the inputs, anchors and nullifiers of a block from the chain state database in parallel before it is validated (0 to %d, 0 = disabled, default: %d)"),
+        MAX_PREFETCH_THREADS, DEFAULT_PREFETCH_THREADS));
+    strUsage += HelpMessageOpt("-persistmempool", strprintf(_("Whether to save the mempool on shutdown and load on restart (default: %u)"), DEFAULT_PERSIST_MEMPOOL));
 #ifndef WIN32
     strUsage += HelpMessageOpt("-pid=<file>", strprintf(_("Specify pid file (default: %s)"), BITCOIN_PID_FILENAME));
 #endif
     strUsage += HelpMessageOpt("-prune=<n>", strprintf(_("Reduce storage requirements by pruning (deleting) old blocks. This mode disables wallet support and is incompatible with -txindex. "
             "Warning: Reverting this setting requires re-downloading the entire blockchain. "
-            "(default: 0 = disable pruning blocks, >%u = target size in MiB to use for block files)"), MIN_DISK_SPACE_FOR_BLOCK_FILES / 1024 / 1024));
+            "The target is lowered while less than %u MiB is free on the disk. "
+            "(default: 0 = disable pruning blocks, >%u = target size in MiB to use for block files)"),
+            PRUNE_MIN_FREE_SPACE / 1024 / 1024, MIN_DISK_SPACE_FOR_BLOCK_FILES / 1024 / 1024));
     strUsage += HelpMessageOpt("-reindex", _("Rebuild block chain index from current blk000??.dat files on startup"));
+    strUsage += HelpMessageOpt("-reindex-chainstate", _("Rebuild the chain state from the blocks in the current block index on startup. Proofs and scripts are not checked again in blocks that this node connected before"));
+    strUsage += HelpMessageOpt("-reindexthreads=<n>", strprintf(_("Set the number of threads that read the block files and check the proofs of work of their blocks ahead of validation during -reindex; up to this many block files are held in memory (0 to %d, 0 = disabled, default: %d)"),
+        MAX_REINDEX_THREADS, DEFAULT_REINDEX_THREADS));
+    strUsage += HelpMessageOpt("-schedulerthreads=<n>", strprintf(_("Set the number of threads that run background tasks such as wallet notifications, address and fee estimate dumps and metrics exports (1 to %d, default: %d)"),
+        MAX_SCHEDULER_THREADS, DEFAULT_SCHEDULER_THREADS));
+    strUsage += HelpMessageOpt("-shieldedindex", strprintf(_("Maintain an index of the Sapling nullifiers and note commitments of the block chain, used by the getsaplingspend and getsaplingoutput calls; built in the background if it is enabled on an existing node (default: %u)"), DEFAULT_SHIELDEDINDEX));
+    strUsage += HelpMessageOpt("-startupcheckblocks=<n>", strprintf(_("How many of the -checkblocks blocks to check before the node starts. The rest are checked in the background once it has started, at most at -checklevel 2 (default: %u, -1 = all)"), DEFAULT_STARTUP_CHECKBLOCKS));
 #ifndef WIN32
     strUsage += HelpMessageOpt("-sysperms", _("Create new files with system default permissions, instead of umask 077 (only effective with disabled wallet functionality)"));
 #endif
+    strUsage += HelpMessageOpt("-threads=<n>", strprintf(_("Set the number of worker threads shared by the parallel work of block index and wallet loading, transaction signing and proving, and RPC calls; the highest priority work gets the free ones (%d to %d, 0 = one per core, <0 = leave that many cores free, default: %d)"),
+        -GetNumCores(), GetNumCores(), DEFAULT_WORKER_THREADS));
     strUsage += HelpMessageOpt("-txexpirynotify=<cmd>", _("Execute command when transaction expires (%s in cmd is replaced by transaction id)"));
     strUsage += HelpMessageOpt("-txindex", strprintf(_("Maintain a full transaction index, used by the getrawtransaction rpc call (default: %u)"), DEFAULT_TXINDEX));
+    strUsage += HelpMessageOpt("-utxostats", strprintf(_("Keep the statistics of the UTXO set up to date as blocks are connected, so that gettxoutsetinfo returns them without scanning the chain state (default: %u)"), DEFAULT_UTXO_STATS));
 
     strUsage += HelpMessageGroup(_("Connection options:"));
     strUsage += HelpMessageOpt("-addnode=<ip>", _("Add a node to connect to and attempt to keep the connection open"));
@@ -374,6 +449,8 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-dns", _("Allow DNS lookups for -addnode, -seednode and -connect") + " " + strprintf(_("(default: %u)"), DEFAULT_NAME_LOOKUP));
     strUsage += HelpMessageOpt("-dnsseed", _("Query for peer addresses via DNS lookup, if low on addresses (default: 1 unless -connect/-noconnect)"));
     strUsage += HelpMessageOpt("-externalip=<ip>", _("Specify your own public address"));
+    strUsage += HelpMessageOpt("-filteredblockthreads=<n>", strprintf(_("Set the number of threads that serve bloom-filtered blocks to peers (0 to %d, 0 = serve them in the message handler, default: %d)"),
+        MAX_FILTERED_BLOCK_THREADS, DEFAULT_FILTERED_BLOCK_THREADS));
     strUsage += HelpMessageOpt("-forcednsseed", strprintf(_("Always query for peer addresses via DNS lookup (default: %u)"), DEFAULT_FORCEDNSSEED));
     strUsage += HelpMessageOpt("-listen", _("Accept connections from outside (default: 1 if no -proxy or -connect/-noconnect)"));
     strUsage += HelpMessageOpt("-listenonion", strprintf(_("Automatically create Tor hidden service (default: %d)"), DEFAULT_LISTEN_ONION));
@@ -385,6 +462,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-onion=<ip:port>", strprintf(_("Use separate SOCKS5 proxy to reach peers via Tor hidden services (default: %s)"), "-proxy"));
     strUsage += HelpMessageOpt("-onlynet=<net>", _("Only connect to nodes in network <net> (ipv4, ipv6 or onion)"));
     strUsage += HelpMessageOpt("-permitbaremultisig", strprintf(_("Relay non-P2SH multisig (default: %u)"), DEFAULT_PERMIT_BAREMULTISIG));
+    strUsage += HelpMessageOpt("-peerblockfilters", strprintf(_("Serve compact block filters to peers per BIP 157 (requires -blockfilterindex, default: %u)"), DEFAULT_PEERBLOCKFILTERS));
     strUsage += HelpMessageOpt("-peerbloomfilters", strprintf(_("Support filtering of blocks and transaction with bloom filters (default: %u)"), DEFAULT_PEERBLOOMFILTERS));
     if (showDebug)
         strUsage += HelpMessageOpt("-enforcenodebloom", strprintf("Enforce minimum protocol version to limit use of bloom filters (default: %u)", DEFAULT_ENFORCENODEBLOOM));
@@ -396,11 +474,14 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-timeout=<n>", strprintf(_("Specify connection timeout in milliseconds (minimum: 1, default: %d)"), DEFAULT_CONNECT_TIMEOUT));
     strUsage += HelpMessageOpt("-torcontrol=<ip>:<port>", strprintf(_("Tor control port to use if onion listening enabled (default: %s)"), DEFAULT_TOR_CONTROL));
     strUsage += HelpMessageOpt("-torpassword=<pass>", _("Tor control port password (default: empty)"));
+    strUsage += HelpMessageOpt("-txreconciliation", strprintf(_("Announce transactions to peers that support it by set reconciliation instead of inv messages (default: %u)"), DEFAULT_TXRECONCILIATION));
     strUsage += HelpMessageOpt("-whitebind=<addr>", _("Bind to given address and whitelist peers connecting to it. Use [host]:port notation for IPv6"));
     strUsage += HelpMessageOpt("-whitelist=<netmask>", _("Whitelist peers connecting from the given netmask or IP address. Can be specified multiple times.") +
         " " + _("Whitelisted peers cannot be DoS banned and their transactions are always relayed, even if they are already in the mempool, useful e.g. for a gateway"));
     strUsage += HelpMessageOpt("-whitelistrelay", strprintf(_("Accept relayed transactions received from whitelisted inbound peers even when not relaying transactions (default: %d)"), DEFAULT_WHITELISTRELAY));
     strUsage += HelpMessageOpt("-whitelistforcerelay", strprintf(_("Force relay of transactions from whitelisted inbound peers even they violate local relay policy (default: %d)"), DEFAULT_WHITELISTFORCERELAY));
+    strUsage += HelpMessageOpt("-maxhistoricaluploadrate=<n>", strprintf(_("Limit the rate at which blocks older than a week are served to all peers together, in KiB per second, 0 = no limit (default: %d)"), DEFAULT_MAX_HISTORICAL_UPLOAD_RATE));
+    strUsage += HelpMessageOpt("-maxpeerhistoricaluploadrate=<n>", strprintf(_("Limit the rate at which blocks older than a week are served to each peer, in KiB per second, 0 = no limit (default: %d)"), DEFAULT_MAX_HISTORICAL_UPLOAD_RATE));
     strUsage += HelpMessageOpt("-maxuploadtarget=<n>", strprintf(_("Tries to keep outbound traffic under the given target (in MiB per 24h), 0 = no limit (default: %d)"), DEFAULT_MAX_UPLOAD_TARGET));
 
 #ifdef ENABLE_WALLET
@@ -413,6 +494,10 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-zmqpubhashtx=<address>", _("Enable publish hash transaction in <address>"));
     strUsage += HelpMessageOpt("-zmqpubrawblock=<address>", _("Enable publish raw block in <address>"));
     strUsage += HelpMessageOpt("-zmqpubrawtx=<address>", _("Enable publish raw transaction in <address>"));
+    strUsage += HelpMessageOpt("-zmqpubblocktemplate=<address>", _("Enable publish the longpollid of new getblocktemplate templates in <address>"));
+    strUsage += HelpMessageOpt("-zmqpubblockconnected=<address>", _("Enable publish height and hash of each connected block in <address>"));
+    strUsage += HelpMessageOpt("-zmqpubmempoolchange=<address>", _("Enable publish each transaction added to or removed from the mempool, with its mempool sequence number, in <address>"));
+    strUsage += HelpMessageOpt("-zmqqueuesize=<n>", strprintf(_("Maximum number of notifications waiting to be published, beyond which they are dropped (default: %u)"), DEFAULT_ZMQ_QUEUE_SIZE));
 #endif
 
     strUsage += HelpMessageGroup(_("Monitoring options:"));
@@ -428,12 +513,19 @@ std::string HelpMessage(HelpMessageMode mode)
     if (showDebug)
     {
         strUsage += HelpMessageOpt("-checkpoints", strprintf("Disable expensive verification for known chain history (default: %u)", DEFAULT_CHECKPOINTS_ENABLED));
+        strUsage += HelpMessageOpt("-chainstatebloombits=<n>", strprintf("Bits per key of the bloom filters of the chain state database tables, or 0 for none (0 to %d, default: %d)", MAX_DB_BLOOM_BITS, DEFAULT_DB_BLOOM_BITS));
+        strUsage += HelpMessageOpt("-chainstateblocksize=<n>", strprintf("Size in bytes of the blocks of the chain state database tables (%d to %d, default: %u)", MIN_DB_BLOCK_SIZE, MAX_DB_BLOCK_SIZE, DEFAULT_DB_BLOCK_SIZE));
+        strUsage += HelpMessageOpt("-chainstatebulkwrite", strprintf("During initial block download and reindexing, write the chain state in chunks sorted by key, to reduce LevelDB compaction. A crash during a write then requires -reindex-chainstate (default: %u)", DEFAULT_CHAINSTATE_BULK_WRITE));
+        strUsage += HelpMessageOpt("-chainstatecompression", strprintf("Compress the blocks of the chain state database tables, if LevelDB was built with Snappy (default: %u)", DEFAULT_DB_COMPRESSION));
         strUsage += HelpMessageOpt("-disablesafemode", strprintf("Disable safemode, override a real safe mode event (default: %u)", DEFAULT_DISABLE_SAFEMODE));
         strUsage += HelpMessageOpt("-testsafemode", strprintf("Force safe mode (default: %u)", DEFAULT_TESTSAFEMODE));
+        strUsage += HelpMessageOpt("-mapblockfiles", strprintf("Read blocks through memory mappings of the block files, and serve headers from blocks/headers.dat (default: %u)", DEFAULT_MAP_BLOCK_FILES));
         strUsage += HelpMessageOpt("-dropmessagestest=<n>", "Randomly drop 1 of every <n> network messages");
         strUsage += HelpMessageOpt("-fuzzmessagestest=<n>", "Randomly fuzz 1 of every <n> network messages");
         strUsage += HelpMessageOpt("-stopafterblockimport", strprintf("Stop running after importing blocks from disk (default: %u)", DEFAULT_STOPAFTERBLOCKIMPORT));
         strUsage += HelpMessageOpt("-nuparams=hexBranchId:activationHeight", "Use given activation height for specified network upgrade (regtest-only)");
+        strUsage += HelpMessageOpt("-assumeutxo=height:blockHash:snapshotHash", "Accept the UTXO set snapshot with the given hash for the block in loadtxoutset (regtest-only)");
+        strUsage += HelpMessageOpt("-regtestfastmode", "Accept any Equihash solution of the right size, and create and accept placeholder zk-SNARK proofs, for fast tests (regtest-only)");
         strUsage += HelpMessageOpt("-nurejectoldversions", strprintf("Reject peers that don't know about the current epoch (regtest-only) (default: %u)", DEFAULT_NU_REJECT_OLD_VERSIONS));
         strUsage += HelpMessageOpt(
                 "-fundingstream=streamId:startHeight:endHeight:comma_delimited_addresses",
@@ -446,13 +538,17 @@ std::string HelpMessage(HelpMessageMode mode)
         _("For multiple specific categories use -debug=<category> multiple times."));
     strUsage += HelpMessageOpt("-experimentalfeatures", _("Enable use of experimental features"));
     strUsage += HelpMessageOpt("-help-debug", _("Show all debugging options (usage: --help -help-debug)"));
+    strUsage += HelpMessageOpt("-logbufferlines=<n>", strprintf(_("Number of lines that can wait to be written to the debug log file (default: %u)"), DEFAULT_LOG_BUFFER_LINES));
+    strUsage += HelpMessageOpt("-logdroponoverflow", strprintf(_("Drop the lines logged while -logbufferlines lines are waiting to be written, instead of waiting for them to be written (default: %u)"), DEFAULT_LOG_DROP_ON_OVERFLOW));
     strUsage += HelpMessageOpt("-logips", strprintf(_("Include IP addresses in debug output (default: %u)"), DEFAULT_LOGIPS));
+    strUsage += HelpMessageOpt("-lograte=<n>", strprintf(_("Log at most <n> lines per second of each -debug category, and drop the rest (default: %u, 0 = unlimited)"), DEFAULT_LOG_RATE));
     strUsage += HelpMessageOpt("-logtimestamps", strprintf(_("Prepend debug output with timestamp (default: %u)"), DEFAULT_LOGTIMESTAMPS));
     if (showDebug)
     {
         strUsage += HelpMessageOpt("-limitfreerelay=<n>", strprintf("Continuously rate-limit free transactions to <n>*1000 bytes per minute (default: %u)", DEFAULT_LIMITFREERELAY));
         strUsage += HelpMessageOpt("-relaypriority", strprintf("Require high priority for relaying free or low-fee transactions (default: %u)", DEFAULT_RELAYPRIORITY));
-        strUsage += HelpMessageOpt("-maxsigcachesize=<n>", strprintf("Limit size of signature cache to <n> MiB (default: %u)", DEFAULT_MAX_SIG_CACHE_SIZE));
+        strUsage += HelpMessageOpt("-maxproofcachesize=<n>", strprintf("Limit size of Sprout and Sapling proof verification cache to <n> MiB (default: %u)", DEFAULT_MAX_PROOF_CACHE_SIZE));
+        strUsage += HelpMessageOpt("-maxsigcachesize=<n>", strprintf("Limit size of signature cache to <n> MiB, 0 to disable it (default: %u)", DEFAULT_MAX_SIG_CACHE_SIZE));
         strUsage += HelpMessageOpt("-maxtipage=<n>", strprintf("Maximum tip age in seconds to consider node in initial block download (default: %u)", DEFAULT_MAX_TIP_AGE));
     }
     strUsage += HelpMessageOpt("-minrelaytxfee=<amt>", strprintf(_("Fees (in %s/kB) smaller than this are considered zero fee for relaying, mining and transaction creation (default: %s)"),
@@ -476,6 +572,10 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-blockminsize=<n>", strprintf(_("Set minimum block size in bytes (default: %u)"), DEFAULT_BLOCK_MIN_SIZE));
     strUsage += HelpMessageOpt("-blockmaxsize=<n>", strprintf(_("Set maximum block size in bytes (default: %d)"), DEFAULT_BLOCK_MAX_SIZE));
     strUsage += HelpMessageOpt("-blockprioritysize=<n>", strprintf(_("Set maximum size of high-priority/low-fee transactions in bytes (default: %d)"), DEFAULT_BLOCK_PRIORITY_SIZE));
+    strUsage += HelpMessageOpt("-precomputecoinbase", strprintf(_("When blocks are mined to a Sapling address, build their coinbase transactions in the background ahead of the templates that use them (default: %u)"), DEFAULT_PRECOMPUTE_COINBASE));
+    strUsage += HelpMessageOpt("-precomputedcoinbaseforfeit=<amt>", strprintf(_("Fees in %s that a template may leave unclaimed to use a coinbase transaction built in the background (default: %s, or 0 on regtest)"),
+        CURRENCY_UNIT, FormatMoney(DEFAULT_PRECOMPUTED_COINBASE_FORFEIT)));
+    strUsage += HelpMessageOpt("-prebuildtemplates", strprintf(_("Once getblocktemplate has been called, build the template for the next block in the background whenever a new block is connected (default: %u)"), DEFAULT_PREBUILD_TEMPLATES));
     if (GetBoolArg("-help-debug", false))
         strUsage += HelpMessageOpt("-blockversion=<n>", strprintf("Override block version to test forking scenarios (default: %d)", (int)CBlock::CURRENT_VERSION));
 
@@ -484,6 +584,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-gen", strprintf(_("Generate coins (default: %u)"), DEFAULT_GENERATE));
     strUsage += HelpMessageOpt("-genproclimit=<n>", strprintf(_("Set the number of threads for coin generation if enabled (-1 = all cores, default: %d)"), DEFAULT_GENERATE_THREADS));
     strUsage += HelpMessageOpt("-equihashsolver=<name>", _("Specify the Equihash solver to be used if enabled (default: \"default\")"));
+    strUsage += HelpMessageOpt("-equihashsolverthreads=<n>", strprintf(_("Set the number of threads each mining thread's \"tromp\" Equihash solver uses. Each solver needs about 144MB, so this uses less memory than more -genproclimit threads (default: %d)"), DEFAULT_EQUIHASH_SOLVER_THREADS));
     strUsage += HelpMessageOpt("-mineraddress=<addr>", _("Send mined coins to a specific single address"));
     strUsage += HelpMessageOpt("-minetolocalwallet", strprintf(
             _("Require that mined blocks use a coinbase address in the local wallet (default: %u)"),
@@ -498,20 +599,21 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageGroup(_("RPC server options:"));
     strUsage += HelpMessageOpt("-server", _("Accept command line and JSON-RPC commands"));
     strUsage += HelpMessageOpt("-rest", strprintf(_("Accept public REST requests (default: %u)"), DEFAULT_REST_ENABLE));
+    strUsage += HelpMessageOpt("-rpcblockcache=<n>", strprintf(_("Keep the getblock results of the last <n> connected blocks in memory, 0 to disable (default: %d)"), DEFAULT_RPC_BLOCK_CACHE));
     strUsage += HelpMessageOpt("-rpcbind=<addr>", _("Bind to given address to listen for JSON-RPC connections. Use [host]:port notation for IPv6. This option can be specified multiple times (default: bind to all interfaces)"));
     strUsage += HelpMessageOpt("-rpcuser=<user>", _("Username for JSON-RPC connections"));
     strUsage += HelpMessageOpt("-rpcpassword=<pw>", _("Password for JSON-RPC connections"));
     strUsage += HelpMessageOpt("-rpcauth=<userpw>", _("Username and hashed password for JSON-RPC connections. The field <userpw> comes in the format: <USERNAME>:<SALT>$<HASH>. A canonical python script is included in share/rpcuser. This option can be specified multiple times"));
     strUsage += HelpMessageOpt("-rpcport=<port>", strprintf(_("Listen for JSON-RPC connections on <port> (default: %u or testnet: %u)"), 8232, 18232));
     strUsage += HelpMessageOpt("-rpcallowip=<ip>", _("Allow JSON-RPC connections from specified source. Valid for <ip> are a single IP (e.g. 1.2.3.4), a network/netmask (e.g. 1.2.3.4/255.255.255.0) or a network/CIDR (e.g. 1.2.3.4/24). This option can be specified multiple times"));
+    strUsage += HelpMessageOpt("-rpcasyncthreads=<n>", strprintf(_("Set the number of threads that run async operations such as z_sendmany at once, up to %d (default: %d)"), MAX_RPC_ASYNC_THREADS, DEFAULT_RPC_ASYNC_THREADS));
+    strUsage += HelpMessageOpt("-rpcbatchthreads=<n>", strprintf(_("Set the number of threads that run the requests of one JSON-RPC batch in parallel, up to %d (default: %d)"), MAX_RPC_BATCH_THREADS, DEFAULT_RPC_BATCH_THREADS));
     strUsage += HelpMessageOpt("-rpcthreads=<n>", strprintf(_("Set the number of threads to service RPC calls (default: %d)"), DEFAULT_HTTP_THREADS));
     if (showDebug) {
-        strUsage += HelpMessageOpt("-rpcworkqueue=<n>", strprintf("Set the depth of the work queue to service RPC calls (default: %d)", DEFAULT_HTTP_WORKQUEUE));
+        strUsage += HelpMessageOpt("-rpcworkqueue=<n>", strprintf("Set the depth of the work queue of each client to service RPC calls (default: %d)", DEFAULT_HTTP_WORKQUEUE));
         strUsage += HelpMessageOpt("-rpcservertimeout=<n>", strprintf("Timeout during HTTP requests (default: %d)", DEFAULT_HTTP_SERVER_TIMEOUT));
     }
 
-    // Disabled until we can lock notes and also tune performance of the prover which by default uses multiple threads
-    //strUsage += HelpMessageOpt("-rpcasyncthreads=<n>", strprintf(_("Set the number of threads to service Async RPC calls (default: %d)"), 1));
 
     if (mode == HMM_BITCOIND) {
         strUsage += HelpMessageGroup(_("Metrics Options (only if -daemon and -printtoconsole are not set):"));
@@ -617,18 +719,9 @@ void ThreadImport(std::vector<fs::path> vImportFiles, const CChainParams& chainp
             fullSize += fs::file_size(blkFile);
         }
         nFullSizeToReindex = std::max<size_t>(1, fullSize);
-        nFile = 0;
-        while (true) {
-            CDiskBlockPos pos(nFile, 0);
-            if (!fs::exists(GetBlockPosFilename(pos, "blk")))
-                break; // No block files left to reindex
-            FILE *file = OpenBlockFile(pos, true);
-            if (!file)
-                break; // This error is logged in OpenBlockFile
-            LogPrintf("Reindexing block file blk%05u.dat...\n", (unsigned int)nFile);
-            LoadExternalBlockFile(chainparams, file, &pos);
-            nFile++;
-        }
+        int nReindexThreads = GetArg("-reindexthreads", DEFAULT_REINDEX_THREADS);
+        nReindexThreads = std::max(0, std::min(nReindexThreads, MAX_REINDEX_THREADS));
+        ReindexBlockFiles(chainparams, nFile, nReindexThreads);
         pblocktree->WriteReindexing(false);
         fReindex = false;
         nSizeReindexed = 0;
@@ -638,6 +731,39 @@ void ThreadImport(std::vector<fs::path> vImportFiles, const CChainParams& chainp
         InitBlockIndex(chainparams);
     }
 
+    // Connect the best chain in the block index. This rebuilds the chain
+    // state after -reindex-chainstate, or carries on with it if a previous
+    // run was stopped part way.
+    {
+        std::optional<CImportingNow> imp;
+        if (fReindexChainState) {
+            imp.emplace();
+            LogPrintf("Rebuilding the chain state from the block index\n");
+        }
+        CValidationState state;
+        if (!ActivateBestChain(state, chainparams)) {
+            LogPrintf("Failed to connect the best block: %s\n", state.GetRejectReason());
+            StartShutdown();
+            return;
+        }
+        if (fReindexChainState) {
+            fReindexChainState = false;
+            LogPrintf("Rebuilding the chain state finished\n");
+        }
+    }
+
+    // -loadheaders=
+    if (mapArgs.count("-loadheaders")) {
+        fs::path path = fs::absolute(GetArg("-loadheaders", ""), GetDataDir());
+        CImportingNow imp;
+        LogPrintf("Importing headers file %s...\n", path.string());
+        int nHeaders;
+        std::string strError;
+        if (!LoadHeaderSnapshot(chainparams, path, nHeaders, strError)) {
+            LogPrintf("Warning: Could not import headers file %s: %s\n", path.string(), strError);
+        }
+    }
+
     // hardcoded $DATADIR/bootstrap.dat
     fs::path pathBootstrap = GetDataDir() / "bootstrap.dat";
     if (fs::exists(pathBootstrap)) {
@@ -669,6 +795,11 @@ void ThreadImport(std::vector<fs::path> vImportFiles, const CChainParams& chainp
         LogPrintf("Stopping after block import\n");
         StartShutdown();
     }
+
+    if (GetBoolArg("-persistmempool", DEFAULT_PERSIST_MEMPOOL)) {
+        LoadMempool(chainparams);
+        fDumpMempoolLater = !fRequestShutdown;
+    }
 }
 
 /** Sanity checks
@@ -688,7 +819,59 @@ bool InitSanityCheck(void)
 }
 
 
-static void ZC_LoadParams(
+/**
+ * A step of initialization that runs on its own thread, so that it overlaps
+ * with the steps that do not depend on it. Wait() must be called before any
+ * step that depends on it; an exception thrown by the step is rethrown there.
+ * The thread is joined when the stage is destroyed, so that returning early
+ * from AppInit2 does not leave it running.
+ */
+class CInitStage
+{
+private:
+    std::string name;
+    std::future<bool> result;
+    std::thread thread;
+    bool fResult;
+
+public:
+    CInitStage(const std::string& nameIn, std::function<bool()> func) : name(nameIn), fResult(false)
+    {
+        std::packaged_task<bool()> task([nameIn, func]() {
+            RenameThread(strprintf("zcash-init-%s", nameIn).c_str());
+            int64_t nStart = GetTimeMillis();
+            bool fRet = func();
+            LogPrintf("Init stage %s finished in %dms\n", nameIn, GetTimeMillis() - nStart);
+            return fRet;
+        });
+        result = task.get_future();
+        thread = std::thread(std::move(task));
+    }
+
+    ~CInitStage()
+    {
+        if (thread.joinable()) {
+            thread.join();
+        }
+    }
+
+    CInitStage(const CInitStage&) = delete;
+    CInitStage& operator=(const CInitStage&) = delete;
+
+    /** Wait for the stage to finish, and return whether it succeeded. */
+    bool Wait()
+    {
+        if (thread.joinable()) {
+            int64_t nStart = GetTimeMillis();
+            thread.join();
+            LogPrintf("Waited %dms for init stage %s\n", GetTimeMillis() - nStart, name);
+            fResult = result.get();
+        }
+        return fResult;
+    }
+};
+
+static bool ZC_LoadParams(
     const CChainParams& chainparams
 )
 {
@@ -711,7 +894,7 @@ static void ZC_LoadParams(
                 ZC_GetParamsDir()),
             "", CClientUIInterface::MSG_ERROR);
         StartShutdown();
-        return;
+        return false;
     }
 
     static_assert(
@@ -720,6 +903,11 @@ static void ZC_LoadParams(
     auto sapling_spend_str = sapling_spend.native();
     auto sapling_output_str = sapling_output.native();
     auto sprout_groth16_str = sprout_groth16.native();
+    // The verifying keys are cached in the data directory, as the parameters
+    // directory may be shared or read-only.
+    fs::path vk_cache = GetDataDir() / "zkparams-vk.cache";
+    auto vk_cache_str = vk_cache.native();
+    bool fPreloadProving = GetBoolArg("-preloadprovingparams", DEFAULT_PRELOAD_PROVING_PARAMS);
 
     LogPrintf("Loading Sapling (Spend) parameters from %s\n", sapling_spend.string().c_str());
     LogPrintf("Loading Sapling (Output) parameters from %s\n", sapling_output.string().c_str());
@@ -732,12 +920,22 @@ static void ZC_LoadParams(
         reinterpret_cast<const codeunit*>(sapling_output_str.c_str()),
         sapling_output_str.length(),
         reinterpret_cast<const codeunit*>(sprout_groth16_str.c_str()),
-        sprout_groth16_str.length()
+        sprout_groth16_str.length(),
+        reinterpret_cast<const codeunit*>(vk_cache_str.c_str()),
+        vk_cache_str.length(),
+        fPreloadProving
     );
 
     gettimeofday(&tv_end, 0);
     elapsed = float(tv_end.tv_sec-tv_start.tv_sec) + (tv_end.tv_usec-tv_start.tv_usec)/float(1000000);
-    LogPrintf("Loaded Sapling parameters in %fs seconds.\n", elapsed);
+    LogPrintf("Loaded Sapling %s in %fs seconds.\n",
+              fPreloadProving ? "parameters" : "verifying keys", elapsed);
+
+    // Once loaded, the Sapling proving parameters are held in memory in about
+    // the size of their files. The Sprout proving parameters are read for
+    // each proof and then freed.
+    nZkParamsSize = fs::file_size(sapling_spend) + fs::file_size(sapling_output);
+    return true;
 }
 
 bool AppInitServers(boost::thread_group& threadGroup)
@@ -853,7 +1051,10 @@ void InitLogging()
     pTracingHandle = tracing_init(
         pathDebugCStr, pathDebugLen,
         initialFilter.c_str(),
-        fLogTimestamps);
+        fLogTimestamps,
+        std::max<int64_t>(1, GetArg("-logbufferlines", DEFAULT_LOG_BUFFER_LINES)),
+        GetBoolArg("-logdroponoverflow", DEFAULT_LOG_DROP_ON_OVERFLOW),
+        std::max<int64_t>(0, std::min<int64_t>(std::numeric_limits<uint32_t>::max(), GetArg("-lograte", DEFAULT_LOG_RATE))));
 
     LogPrintf("\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n");
     LogPrintf("Zcash version %s (%s)\n", FormatFullVersion(), CLIENT_DATE);
@@ -949,6 +1150,9 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
             return InitError(_("Rescans are not possible in pruned mode. You will need to use -reindex which will download the whole blockchain again."));
         }
 #endif
+        if (GetBoolArg("-reindex-chainstate", false)) {
+            return InitError(_("-reindex-chainstate is not possible in pruned mode. You will need to use -reindex which will download the whole blockchain again."));
+        }
     }
 
     // Make sure enough file descriptors are available
@@ -957,7 +1161,13 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     nMaxConnections = std::max(nUserMaxConnections, 0);
 
     // Trim requested connection counts, to fit into system limitations
-    nMaxConnections = std::max(std::min(nMaxConnections, FD_SETSIZE - nBind - MIN_CORE_FILEDESCRIPTORS), 0);
+#ifdef USE_EPOLL
+    // The number of sockets is only limited by the file descriptors available.
+    int nMaxFD = std::numeric_limits<int>::max();
+#else
+    int nMaxFD = FD_SETSIZE;
+#endif
+    nMaxConnections = std::max(std::min(nMaxConnections, nMaxFD - nBind - MIN_CORE_FILEDESCRIPTORS), 0);
     int nFD = RaiseFileDescriptorLimit(nMaxConnections + MIN_CORE_FILEDESCRIPTORS);
     if (nFD < MIN_CORE_FILEDESCRIPTORS)
         return InitError(_("Not enough file descriptors available."));
@@ -1013,19 +1223,46 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     int64_t mempoolTotalCostLimit = GetArg("-mempooltxcostlimit", DEFAULT_MEMPOOL_TOTAL_COST_LIMIT);
     int64_t mempoolEvictionMemorySeconds = GetArg("-mempoolevictionmemoryminutes", DEFAULT_MEMPOOL_EVICTION_MEMORY_MINUTES) * 60;
     mempool.SetMempoolCostLimit(mempoolTotalCostLimit, mempoolEvictionMemorySeconds);
+    mempool.setLazyInsightIndexes(GetBoolArg("-lazymempoolindex", DEFAULT_LAZY_MEMPOOL_INDEX));
 
     fCheckBlockIndex = GetBoolArg("-checkblockindex", chainparams.DefaultConsistencyChecks());
+    fMapBlockFiles = GetBoolArg("-mapblockfiles", DEFAULT_MAP_BLOCK_FILES);
+    fCompressBlockFiles = GetBoolArg("-blockcompression", DEFAULT_BLOCK_COMPRESSION);
     fIBDSkipTxVerification = GetBoolArg("-ibdskiptxverification", DEFAULT_IBD_SKIP_TX_VERIFICATION);
     fCheckpointsEnabled = GetBoolArg("-checkpoints", DEFAULT_CHECKPOINTS_ENABLED);
+    fAssumeValidHeaders = GetBoolArg("-assumevalidheaders", DEFAULT_ASSUME_VALID_HEADERS);
+
+    LargePageMode largePageMode;
+    if (!ParseLargePageMode(GetArg("-largepages", DEFAULT_LARGE_PAGES), largePageMode))
+        return InitError(strprintf(_("Invalid -largepages mode: '%s'"), GetArg("-largepages", "")));
+    bool fNumaInterleave = GetBoolArg("-numainterleave", DEFAULT_NUMA_INTERLEAVE);
+    SetLargePageOptions(largePageMode, fNumaInterleave);
 
     // -par=0 means autodetect, but nScriptCheckThreads==0 means no concurrency
-    nScriptCheckThreads = GetArg("-par", DEFAULT_SCRIPTCHECK_THREADS);
-    if (nScriptCheckThreads <= 0)
-        nScriptCheckThreads += GetNumCores();
-    if (nScriptCheckThreads <= 1)
+    int nParThreads = GetArg("-par", DEFAULT_SCRIPTCHECK_THREADS);
+    if (nParThreads <= 0)
+        nParThreads += GetNumCores();
+    nParThreads = std::max(1, std::min(nParThreads, MAX_SCRIPTCHECK_THREADS));
+    // Start a thread per core even if -par asked for fewer, so that
+    // -adaptivepar and setverificationthreads can put them to work; those
+    // beyond -par start out parked. -par=1 without -adaptivepar still means
+    // that checks are not run in parallel.
+    nScriptCheckThreads = std::max(nParThreads, std::min(GetNumCores(), MAX_SCRIPTCHECK_THREADS));
+    if (nScriptCheckThreads <= 1 || (nParThreads == 1 && !GetBoolArg("-adaptivepar", DEFAULT_ADAPTIVE_PAR)))
         nScriptCheckThreads = 0;
-    else if (nScriptCheckThreads > MAX_SCRIPTCHECK_THREADS)
-        nScriptCheckThreads = MAX_SCRIPTCHECK_THREADS;
+
+    // -threads=0 means one per core; the threads that call ParallelFor also
+    // run its items, so the pool is one smaller.
+    int nWorkerThreads = GetArg("-threads", DEFAULT_WORKER_THREADS);
+    if (nWorkerThreads <= 0)
+        nWorkerThreads += GetNumCores();
+    SetWorkerThreads(std::max(1, nWorkerThreads) - 1);
+
+    nPrefetchThreads = GetArg("-prefetchthreads", DEFAULT_PREFETCH_THREADS);
+    if (nPrefetchThreads < 0)
+        nPrefetchThreads = 0;
+    else if (nPrefetchThreads > MAX_PREFETCH_THREADS)
+        nPrefetchThreads = MAX_PREFETCH_THREADS;
 
     fServer = GetBoolArg("-server", false);
 
@@ -1086,6 +1323,12 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     if (GetBoolArg("-peerbloomfilters", DEFAULT_PEERBLOOMFILTERS))
         nLocalServices |= NODE_BLOOM;
 
+    if (GetBoolArg("-peerblockfilters", DEFAULT_PEERBLOCKFILTERS)) {
+        if (!GetBoolArg("-blockfilterindex", DEFAULT_BLOCKFILTERINDEX))
+            return InitError(_("Cannot set -peerblockfilters without -blockfilterindex."));
+        nLocalServices |= NODE_COMPACT_FILTERS;
+    }
+
     nMaxTipAge = GetArg("-maxtipage", DEFAULT_MAX_TIP_AGE);
 
     KeyIO keyIO(chainparams);
@@ -1139,6 +1382,37 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
         }
     }
 
+    if (GetBoolArg("-regtestfastmode", false)) {
+        // Skip Equihash and zk-SNARK proofs for fast tests
+        if (chainparams.NetworkIDString() != "regtest") {
+            return InitError("-regtestfastmode may only be set on regtest.");
+        }
+        SetPlaceholderProofs(true);
+    }
+
+    if (!mapMultiArgs["-assumeutxo"].empty()) {
+        // Allow pinning UTXO set snapshots for testing
+        if (chainparams.NetworkIDString() != "regtest") {
+            return InitError("UTXO set snapshots may only be pinned on regtest.");
+        }
+        for (auto i : mapMultiArgs["-assumeutxo"]) {
+            std::vector<std::string> vSnapshotParams;
+            boost::split(vSnapshotParams, i, boost::is_any_of(":"));
+            AssumeutxoData data;
+            if (vSnapshotParams.size() != 3 ||
+                !ParseInt32(vSnapshotParams[0], &data.nHeight) ||
+                !IsHex(vSnapshotParams[1]) || vSnapshotParams[1].size() != 64 ||
+                !IsHex(vSnapshotParams[2]) || vSnapshotParams[2].size() != 64) {
+                return InitError("UTXO set snapshot parameters malformed, expecting height:blockHash:snapshotHash");
+            }
+            data.hashBlock = uint256S(vSnapshotParams[1]);
+            data.hashSnapshot = uint256S(vSnapshotParams[2]);
+            UpdateRegtestAssumeutxo(data);
+            LogPrintf("Pinning the UTXO set snapshot %s for block %s at height %d\n",
+                data.hashSnapshot.GetHex(), data.hashBlock.GetHex(), data.nHeight);
+        }
+    }
+
     if (mapArgs.count("-nurejectoldversions")) {
         if (chainparams.NetworkIDString() != "regtest") {
             return InitError("-nurejectoldversions may only be set on regtest.");
@@ -1191,9 +1465,14 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
         return false;
     }
 
+    // Initialize SHA256 implementation
+    std::string sha256_algo = SHA256AutoDetect();
+    LogPrintf("Using the '%s' SHA256 implementation\n", sha256_algo);
+
     // Initialize elliptic curve code
     ECC_Start();
     globalVerifyHandle.reset(new ECCVerifyHandle());
+    InitSignatureCache();
 
     // Sanity check
     if (!InitSanityCheck())
@@ -1231,19 +1510,37 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     LogPrintf("Using at most %i connections (%i file descriptors available)\n", nMaxConnections, nFD);
     std::ostringstream strErrors;
 
-    LogPrintf("Using %u threads for script verification\n", nScriptCheckThreads);
+    LogPrintf("Using %u of %u threads for script, proof and header verification, and to prepare received messages\n",
+        nScriptCheckThreads ? nParThreads : 0, nScriptCheckThreads);
     if (nScriptCheckThreads) {
-        for (int i=0; i<nScriptCheckThreads-1; i++)
-            threadGroup.create_thread(&ThreadScriptCheck);
+        InitVerificationThreads(nParThreads);
+        for (int i=0; i<nScriptCheckThreads-1; i++) {
+            threadGroup.create_thread(&ThreadCheckPool);
+        }
     }
+    if (nPrefetchThreads) {
+        LogPrintf("Using %u threads to prefetch the inputs of blocks\n", nPrefetchThreads);
+        for (int i=0; i<nPrefetchThreads; i++) {
+            threadGroup.create_thread(&ThreadPrefetchCheck);
+        }
+    }
+    threadGroup.create_thread(&ThreadShieldedTxVerification);
 
-    // Start the lightweight task scheduler thread
+    // Start the lightweight task scheduler threads
+    int nSchedulerThreads = GetArg("-schedulerthreads", DEFAULT_SCHEDULER_THREADS);
+    nSchedulerThreads = std::max(1, std::min(nSchedulerThreads, MAX_SCHEDULER_THREADS));
     CScheduler::Function serviceLoop = boost::bind(&CScheduler::serviceQueue, &scheduler);
-    threadGroup.create_thread(boost::bind(&TraceThread<CScheduler::Function>, "scheduler", serviceLoop));
+    for (int i = 0; i < nSchedulerThreads; i++) {
+        threadGroup.create_thread(boost::bind(&TraceThread<CScheduler::Function>, "scheduler", serviceLoop));
+    }
+    RegisterBackgroundSignalScheduler(scheduler);
 
     // Count uptime
     MarkStartTime();
 
+    // Sample the chain sync progress, for getsyncprogress and Prometheus
+    scheduler.scheduleEvery(&SampleSyncProgress, SYNC_METRICS_INTERVAL, CScheduler::PRIORITY_HIGH);
+
     int prometheusPort = GetArg("-prometheusport", -1);
     if (prometheusPort > 0) {
         const std::vector<std::string>& vAllow = mapMultiArgs["-metricsallowip"];
@@ -1264,6 +1561,13 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
         if (!metrics_run(metricsBindCstr, vAllowCstr.data(), vAllowCstr.size(), prometheusPort)) {
             return InitError(strprintf(_("Failed to start Prometheus metrics exporter")));
         }
+
+        // Export the lock contention profile periodically, rather than on
+        // every lock, to keep the cost of taking a lock low.
+        scheduler.scheduleEvery(&ExportLockMetrics, LOCK_METRICS_INTERVAL, CScheduler::PRIORITY_LOW);
+        scheduler.scheduleEvery(&ExportMemoryMetrics, MEMORY_METRICS_INTERVAL, CScheduler::PRIORITY_LOW);
+        scheduler.scheduleEvery(&ExportLogMetrics, LOG_METRICS_INTERVAL, CScheduler::PRIORITY_LOW);
+        scheduler.scheduleEvery(boost::bind(&ExportSchedulerMetrics, &scheduler), SCHEDULER_METRICS_INTERVAL, CScheduler::PRIORITY_LOW);
     }
 
     // Expose binary metadata to metrics, using a single time series with value 1.
@@ -1280,8 +1584,10 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
         threadGroup.create_thread(&ThreadShowMetricsScreen);
     }
 
-    // Initialize Zcash circuit parameters
-    ZC_LoadParams(chainparams);
+    // Initialize Zcash circuit parameters. Nothing needs them until blocks
+    // or wallet transactions are checked, so they are loaded while the
+    // network is initialized and the block index is loaded.
+    CInitStage paramsStage("params", [&chainparams]() { return ZC_LoadParams(chainparams); });
 
     /* Start the RPC server already.  It will be started in "warmup" mode
      * and not really process calls already (but it will signify connections
@@ -1299,9 +1605,11 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
 
     // ********************************************************* Step 5: verify wallet database integrity
 #ifdef ENABLE_WALLET
+    // The wallet database is only read in Step 8, so it is verified while
+    // the network is initialized and the block index is loaded.
+    std::unique_ptr<CInitStage> walletVerifyStage;
     if (!fDisableWallet) {
-        if (!CWallet::Verify())
-            return false;
+        walletVerifyStage.reset(new CInitStage("walletverify", &CWallet::Verify));
     } // (!fDisableWallet)
 #endif // ENABLE_WALLET
     // ********************************************************* Step 6: network initialization
@@ -1383,6 +1691,7 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     fListen = GetBoolArg("-listen", DEFAULT_LISTEN);
     fDiscover = GetBoolArg("-discover", true);
     fNameLookup = GetBoolArg("-dns", DEFAULT_NAME_LOOKUP);
+    fTxReconciliation = GetBoolArg("-txreconciliation", DEFAULT_TXRECONCILIATION);
 
     bool fBound = false;
     if (fListen) {
@@ -1436,12 +1745,26 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
             chainparams.GetConsensus().nPostBlossomPowTargetSpacing,
             GetArg("-maxuploadtarget", DEFAULT_MAX_UPLOAD_TARGET)*1024*1024);
     }
+    int64_t nMaxHistoricalUploadRate = GetArg("-maxhistoricaluploadrate", DEFAULT_MAX_HISTORICAL_UPLOAD_RATE);
+    int64_t nMaxPeerHistoricalUploadRate = GetArg("-maxpeerhistoricaluploadrate", DEFAULT_MAX_HISTORICAL_UPLOAD_RATE);
+    if (nMaxHistoricalUploadRate < 0 || nMaxPeerHistoricalUploadRate < 0)
+        return InitError(_("The historical block upload rates must not be negative."));
+    CNode::SetMaxHistoricalUploadRate(nMaxHistoricalUploadRate * 1024, nMaxPeerHistoricalUploadRate * 1024);
 
     // ********************************************************* Step 7: load block chain
 
+    // At -checklevel 4 and above, VerifyDB connects blocks, which checks
+    // their proofs.
+    if (GetArg("-checklevel", DEFAULT_CHECKLEVEL) >= 4 && !paramsStage.Wait())
+        return false;
+
     fReindex = GetBoolArg("-reindex", false);
+    fReindexChainState = GetBoolArg("-reindex-chainstate", false);
 
     fs::create_directories(GetDataDir() / "blocks");
+    if (fMapBlockFiles) {
+        OpenHeaderStore(chainparams.GetConsensus());
+    }
 
     // cache size calculations
     int64_t nTotalCache = (GetArg("-dbcache", nDefaultDbCache) << 20);
@@ -1463,15 +1786,47 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     int64_t nCoinDBCache = std::min(nTotalCache / 2, (nTotalCache / 4) + (1 << 23)); // use 25%-50% of the remainder for disk cache
     nTotalCache -= nCoinDBCache;
     nCoinCacheUsage = nTotalCache; // the rest goes to in-memory cache
+    int64_t nCoinCacheKeep = std::max(int64_t(0), std::min(GetArg("-dbcachekeep", nDefaultDbCacheKeep), nMaxDbCacheKeep));
+    nCoinCacheKeepUsage = nCoinCacheUsage / 100 * nCoinCacheKeep;
     LogPrintf("Cache configuration:\n");
     LogPrintf("* Using %.1fMiB for block index database\n", nBlockTreeDBCache * (1.0 / 1024 / 1024));
     LogPrintf("* Using %.1fMiB for chain state database\n", nCoinDBCache * (1.0 / 1024 / 1024));
     LogPrintf("* Using %.1fMiB for in-memory UTXO set\n", nCoinCacheUsage * (1.0 / 1024 / 1024));
+    if (nCoinCacheKeepUsage > 0) {
+        LogPrintf("* Keeping up to %.1fMiB of the UTXO set in memory when it is flushed\n", nCoinCacheKeepUsage * (1.0 / 1024 / 1024));
+    }
+
+    // The table options only apply to the tables written after a change.
+    CDBOptions chainstateOptions;
+    int64_t nChainstateBloomBits = GetArg("-chainstatebloombits", DEFAULT_DB_BLOOM_BITS);
+    int64_t nChainstateBlockSize = GetArg("-chainstateblocksize", DEFAULT_DB_BLOCK_SIZE);
+    if (nChainstateBloomBits < 0 || nChainstateBloomBits > MAX_DB_BLOOM_BITS) {
+        return InitError(strprintf(_("-chainstatebloombits must be between 0 and %d"), MAX_DB_BLOOM_BITS));
+    }
+    if (nChainstateBlockSize < MIN_DB_BLOCK_SIZE || nChainstateBlockSize > MAX_DB_BLOCK_SIZE) {
+        return InitError(strprintf(_("-chainstateblocksize must be between %d and %d"), MIN_DB_BLOCK_SIZE, MAX_DB_BLOCK_SIZE));
+    }
+    chainstateOptions.nBloomBits = nChainstateBloomBits;
+    chainstateOptions.nBlockSize = nChainstateBlockSize;
+    chainstateOptions.fCompression = GetBoolArg("-chainstatecompression", DEFAULT_DB_COMPRESSION);
+    fChainstateBulkWrite = GetBoolArg("-chainstatebulkwrite", DEFAULT_CHAINSTATE_BULK_WRITE);
 
     bool clearWitnessCaches = false;
 
+    // Only the blocks nearest the tip are checked before the node starts.
+    // The blocks below those, down to nBackgroundCheckStop, are checked in
+    // the background once it has started.
+    int nCheckBlocks = GetArg("-checkblocks", DEFAULT_CHECKBLOCKS);
+    int nStartupCheckBlocks = GetArg("-startupcheckblocks", DEFAULT_STARTUP_CHECKBLOCKS);
+    bool fBackgroundCheck = nStartupCheckBlocks >= 0 && (nCheckBlocks <= 0 || nStartupCheckBlocks < nCheckBlocks);
+    if (!fBackgroundCheck) {
+        nStartupCheckBlocks = nCheckBlocks;
+    }
+    int nBackgroundCheckStart = 0;
+    int nBackgroundCheckStop = 0;
+
     bool fLoaded = false;
-    while (!fLoaded) {
+    while (!fLoaded && !fRequestShutdown) {
         bool fReset = fReindex;
         std::string strLoadError;
 
@@ -1481,15 +1836,49 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
         do {
             try {
                 UnloadBlockIndex();
+                fUTXOStats = false;
                 delete pcoinsTip;
+                delete pcoinsSnapshot;
+                pcoinsSnapshot = NULL;
                 delete pcoinsdbview;
                 delete pcoinscatcher;
                 delete pblocktree;
 
                 pblocktree = new CBlockTreeDB(nBlockTreeDBCache, false, fReindex);
-                pcoinsdbview = new CCoinsViewDB(nCoinDBCache, false, fReindex);
+                pcoinsdbview = new CCoinsViewDB(nCoinDBCache, false, fReindex || fReindexChainState, chainstateOptions);
                 pcoinscatcher = new CCoinsViewErrorCatcher(pcoinsdbview);
-                pcoinsTip = new CCoinsViewCache(pcoinscatcher);
+
+                // If necessary, upgrade from the per-transaction UTXO database format.
+                if (!pcoinsdbview->Upgrade()) {
+                    strLoadError = _("Error upgrading chainstate database");
+                    break;
+                }
+
+                if (pcoinsdbview->IsLoadingSnapshot()) {
+                    strLoadError = _("Loading a UTXO set snapshot was interrupted. You need to rebuild the database using -reindex");
+                    break;
+                }
+
+                if (pcoinsdbview->IsBulkWriteInterrupted()) {
+                    strLoadError = _("Writing the chain state in bulk was interrupted. You need to rebuild the database using -reindex-chainstate");
+                    break;
+                }
+
+                if (GetBoolArg("-nullifierfilter", DEFAULT_NULLIFIER_FILTER)) {
+                    uiInterface.InitMessage(_("Loading nullifier filters..."));
+                    pcoinsdbview->LoadNullifierFilters();
+                }
+
+                // Carve the UTXO set cache out of chunks that can each be a
+                // huge page, or interleaved across the NUMA nodes.
+                size_t nCoinsChunkBytes = LargePagesEnabled() || fNumaInterleave ?
+                    LARGE_PAGE_BYTES : COINS_CACHE_POOL_CHUNK_BYTES;
+                if (GetBoolArg("-asyncflush", DEFAULT_ASYNC_FLUSH)) {
+                    pcoinsSnapshot = new CCoinsViewSnapshot(pcoinscatcher);
+                    pcoinsTip = new CCoinsViewCache(pcoinsSnapshot, nCoinsChunkBytes);
+                } else {
+                    pcoinsTip = new CCoinsViewCache(pcoinscatcher, nCoinsChunkBytes);
+                }
 
                 if (fReindex) {
                     pblocktree->WriteReindexing(true);
@@ -1514,32 +1903,30 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
                     break;
                 }
 
-                // Check for changed -txindex state
-                if (fTxIndex != GetBoolArg("-txindex", DEFAULT_TXINDEX)) {
-                    strLoadError = _("You need to rebuild the database using -reindex to change -txindex");
+                // Check for changed -compactblockindex state
+                if (fCompactBlockIndex != GetBoolArg("-compactblockindex", DEFAULT_COMPACTBLOCKINDEX)) {
+                    strLoadError = _("You need to rebuild the database using -reindex to change -compactblockindex");
                     break;
                 }
 
-                // Check for changed -insightexplorer state
-                bool fInsightExplorerPreviouslySet = false;
-                pblocktree->ReadFlag("insightexplorer", fInsightExplorerPreviouslySet);
-                if (fExperimentalInsightExplorer != fInsightExplorerPreviouslySet) {
-                    strLoadError = _("You need to rebuild the database using -reindex to change -insightexplorer");
+                // Check for changed -prune state.  What we are concerned about is a user who has pruned blocks
+                // in the past, but is now trying to run unpruned.
+                if (fHavePruned && !fPruneMode) {
+                    strLoadError = _("You need to rebuild the database using -reindex to go back to unpruned mode.  This will redownload the entire blockchain");
                     break;
                 }
 
-                // Check for changed -lightwalletd state
-                bool fLightWalletdPreviouslySet = false;
-                pblocktree->ReadFlag("lightwalletd", fLightWalletdPreviouslySet);
-                if (fExperimentalLightWalletd != fLightWalletdPreviouslySet) {
-                    strLoadError = _("You need to rebuild the database using -reindex to change -lightwalletd");
+                // The chain state is replayed from the stored blocks, all of
+                // which must still be on disk.
+                if (fReindexChainState && fHavePruned) {
+                    strLoadError = _("-reindex-chainstate is not possible once blocks have been pruned. You will need to use -reindex which will download the whole blockchain again");
                     break;
                 }
 
-                // Check for changed -prune state.  What we are concerned about is a user who has pruned blocks
-                // in the past, but is now trying to run unpruned.
-                if (fHavePruned && !fPruneMode) {
-                    strLoadError = _("You need to rebuild the database using -reindex to go back to unpruned mode.  This will redownload the entire blockchain");
+                // Build the indexes enabled by -txindex, -blockfilterindex,
+                // -shieldedindex, -insightexplorer and -lightwalletd in the
+                // background, and erase the ones that have been disabled.
+                if (!InitIndexes(strLoadError)) {
                     break;
                 }
 
@@ -1568,11 +1955,30 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
                     }
                 }
 
-                if (!CVerifyDB().VerifyDB(chainparams, pcoinsdbview, GetArg("-checklevel", DEFAULT_CHECKLEVEL),
-                              GetArg("-checkblocks", DEFAULT_CHECKBLOCKS))) {
+                if ((!fBackgroundCheck || nStartupCheckBlocks > 0) &&
+                    !CVerifyDB().VerifyDB(chainparams, pcoinsdbview, GetArg("-checklevel", DEFAULT_CHECKLEVEL),
+                              nStartupCheckBlocks)) {
                     strLoadError = _("Corrupted block database detected");
                     break;
                 }
+                if (fBackgroundCheck) {
+                    // VerifyDB checks one block more than its depth.
+                    LOCK(cs_main);
+                    nBackgroundCheckStart = chainActive.Height() - (nStartupCheckBlocks > 0 ? nStartupCheckBlocks + 1 : 0);
+                    nBackgroundCheckStop = nCheckBlocks > 0 ? chainActive.Height() - nCheckBlocks : 1;
+                }
+
+                // The statistics are loaded after the rewind above, which does
+                // not keep them up to date.
+                if (GetBoolArg("-utxostats", DEFAULT_UTXO_STATS)) {
+                    uiInterface.InitMessage(_("Loading UTXO set statistics..."));
+                    LOCK(cs_main);
+                    if (!LoadUTXOStats()) {
+                        strLoadError = _("Error computing the UTXO set statistics");
+                        break;
+                    }
+                    fUTXOStats = true;
+                }
             } catch (const std::exception& e) {
                 if (fDebug) LogPrintf("%s\n", e.what());
                 strLoadError = _("Error opening block database");
@@ -1582,7 +1988,7 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
             fLoaded = true;
         } while(false);
 
-        if (!fLoaded) {
+        if (!fLoaded && !fRequestShutdown) {
             // first suggest a reindex
             if (!fReset) {
                 bool fRet = uiInterface.ThreadSafeQuestion(
@@ -1612,6 +2018,14 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     }
     LogPrintf(" block index %15dms\n", GetTimeMillis() - nStart);
 
+    if (pcoinsSnapshot) {
+        LogPrintf("Writing the chain state to disk in the background\n");
+        threadGroup.create_thread(&ThreadFlushChainstate);
+    }
+    if (fPruneMode) {
+        threadGroup.create_thread(&ThreadUnlinkPrunedFiles);
+    }
+
     fs::path est_path = GetDataDir() / FEE_ESTIMATES_FILENAME;
     CAutoFile est_filein(fsbridge::fopen(est_path, "rb"), SER_DISK, CLIENT_VERSION);
     // Allowed to fail as this file IS missing on first startup.
@@ -1619,13 +2033,50 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
         mempool.ReadFeeEstimates(est_filein);
     fFeeEstimatesInitialized = true;
 
+    // Keep the estimates current and on disk without doing that work while
+    // connecting blocks.
+    scheduler.scheduleEvery(boost::bind(&CTxMemPool::UpdateFeeEstimates, &mempool), FEE_ESTIMATES_UPDATE_INTERVAL);
+    scheduler.scheduleEvery(&DumpFeeEstimates, FEE_ESTIMATES_DUMP_INTERVAL, CScheduler::PRIORITY_LOW);
+
+    if (GetBoolArg("-adaptivedbcache", DEFAULT_ADAPTIVE_DBCACHE)) {
+        // Half of the chain state database cache is its block cache; the
+        // write buffers and the block tree database keep their sizes.
+        InitCacheBudgets(CCacheBudgets(nCoinCacheUsage, nCoinDBCache / 2, mempoolTotalCostLimit), nCoinCacheKeep);
+        scheduler.scheduleEvery(&RebalanceCaches, CACHE_REBALANCE_INTERVAL, CScheduler::PRIORITY_LOW);
+    }
+    if (nScriptCheckThreads && GetBoolArg("-adaptivepar", DEFAULT_ADAPTIVE_PAR)) {
+        scheduler.scheduleEvery(&AdaptVerificationThreads, VERIFICATION_THREADS_ADAPT_INTERVAL, CScheduler::PRIORITY_LOW);
+    }
+
 
     // ********************************************************* Step 8: load wallet
+
+    // Loading the wallet checks the proofs of its transactions, and
+    // everything after this connects blocks.
+    if (!paramsStage.Wait())
+        return false;
+
 #ifdef ENABLE_WALLET
+    if (walletVerifyStage && !walletVerifyStage->Wait())
+        return false;
     if (fDisableWallet) {
         pwalletMain = NULL;
         LogPrintf("Wallet disabled!\n");
     } else {
+        // Start the trial decryption and rescan workers first, so that a
+        // rescan while loading the wallet can use them.
+        LogPrintf("Using %u threads for Sapling trial decryption\n", nSaplingDecryptThreads);
+        for (int i = 0; i < nSaplingDecryptThreads - 1; i++) {
+            threadGroup.create_thread(&ThreadSaplingTrialDecryption);
+            threadGroup.create_thread(&ThreadWalletRescanRead);
+        }
+        if (nWitnessUpdateThreads) {
+            LogPrintf("Using %u threads for note witness updates\n", nWitnessUpdateThreads);
+        }
+        for (int i = 0; i < nWitnessUpdateThreads - 1; i++) {
+            threadGroup.create_thread(&ThreadNoteWitnessUpdate);
+        }
+
         CWallet::InitLoadWallet(clearWitnessCaches);
         if (!pwalletMain)
             return false;
@@ -1735,6 +2186,8 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     }
     threadGroup.create_thread(boost::bind(&ThreadImport, vImportFiles, chainparams));
 
+    StartIndexes(threadGroup);
+
     // Wait for genesis block to be processed
     bool fHaveGenesis = false;
     while (!fHaveGenesis && !fRequestShutdown) {
@@ -1778,8 +2231,31 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     if (GetBoolArg("-listenonion", DEFAULT_LISTEN_ONION))
         StartTorControl(threadGroup, scheduler);
 
+    // Serve bloom-filtered blocks on worker threads, before peers connect.
+    if (nLocalServices & NODE_BLOOM) {
+        int nFilteredBlockThreads = GetArg("-filteredblockthreads", DEFAULT_FILTERED_BLOCK_THREADS);
+        nFilteredBlockThreads = std::max(0, std::min(nFilteredBlockThreads, MAX_FILTERED_BLOCK_THREADS));
+        if (nFilteredBlockThreads > 0)
+            StartFilteredBlockServer(threadGroup, nFilteredBlockThreads);
+    }
+
     StartNode(threadGroup, scheduler);
 
+    if (GetBoolArg("-prebuildtemplates", DEFAULT_PREBUILD_TEMPLATES))
+        StartTemplatePrebuilder(threadGroup);
+
+    if (GetBoolArg("-precomputecoinbase", DEFAULT_PRECOMPUTE_COINBASE)) {
+        // Tests on regtest expect the coinbase to claim all of the fees.
+        CAmount nMaxForfeit = chainparams.MineBlocksOnDemand() ? 0 : DEFAULT_PRECOMPUTED_COINBASE_FORFEIT;
+        if (mapArgs.count("-precomputedcoinbaseforfeit") &&
+            !ParseMoney(mapArgs["-precomputedcoinbaseforfeit"], nMaxForfeit))
+            return InitError(strprintf(_("Invalid amount for -precomputedcoinbaseforfeit=<amount>: '%s'"), mapArgs["-precomputedcoinbaseforfeit"]));
+        StartCoinbasePrecomputer(threadGroup, nMaxForfeit);
+    }
+
+    if (GetArg("-rpcblockcache", DEFAULT_RPC_BLOCK_CACHE) > 0)
+        StartRecentBlockCache(GetArg("-rpcblockcache", DEFAULT_RPC_BLOCK_CACHE));
+
 #ifdef ENABLE_MINING
     // Generate coins in the background
     GenerateBitcoins(GetBoolArg("-gen", DEFAULT_GENERATE), GetArg("-genproclimit", DEFAULT_GENERATE_THREADS), chainparams);
@@ -1790,6 +2266,12 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     SetRPCWarmupFinished();
     uiInterface.InitMessage(_("Done loading"));
 
+    if (nBackgroundCheckStart >= std::max(nBackgroundCheckStop, 1)) {
+        threadGroup.create_thread(boost::bind(&ThreadVerifyDB, boost::cref(chainparams),
+            (int)GetArg("-checklevel", DEFAULT_CHECKLEVEL), nBackgroundCheckStart, nBackgroundCheckStop,
+            GetBoolArg("-checkblockshalt", DEFAULT_CHECKBLOCKS_HALT)));
+    }
+
 #ifdef ENABLE_WALLET
     if (pwalletMain) {
         // Add wallet transactions that aren't already in a block to mapTransactions
@@ -1797,6 +2279,12 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
 
         // Run a thread to flush wallet periodically
         threadGroup.create_thread(boost::bind(&ThreadFlushWalletDB, boost::ref(pwalletMain->strWalletFile)));
+
+        // Keep the Sapling address pool filled
+        if (pwalletMain->nSaplingAddressPoolSize > 0) {
+            scheduler.scheduleEvery(boost::bind(&CWallet::TopUpSaplingAddressPool, pwalletMain),
+                                    SAPLING_ADDRESS_POOL_TOPUP_INTERVAL, CScheduler::PRIORITY_LOW);
+        }
     }
 #endif
 
@@ -18,6 +18,9 @@
 static const bool DEFAULT_LOGTIMEMICROS = false;
 static const bool DEFAULT_LOGIPS        = false;
 static const bool DEFAULT_LOGTIMESTAMPS = true;
+static const unsigned int DEFAULT_LOG_BUFFER_LINES = 128000;
+static const bool DEFAULT_LOG_DROP_ON_OVERFLOW = true;
+static const unsigned int DEFAULT_LOG_RATE = 0;
 extern const char * const DEFAULT_DEBUGLOGFILE;
 
 extern bool fPrintToConsole;
@@ -0,0 +1,87 @@
+// Copyright (c) 2021 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifndef ZCASH_LRUCACHE_H
+#define ZCASH_LRUCACHE_H
+
+#include <assert.h>
+#include <functional>
+#include <list>
+#include <map>
+#include <utility>
+
+/**
+ * Map that keeps at most N elements, evicting the least recently used one
+ * to make room for a new one. It is not thread-safe; callers lock around it.
+ */
+template <typename K, typename V, typename Compare = std::less<K>>
+class lrucache
+{
+public:
+    typedef K key_type;
+    typedef V mapped_type;
+    typedef typename std::list<std::pair<K, V>>::size_type size_type;
+
+private:
+    //! Elements, most recently used first.
+    std::list<std::pair<K, V>> items;
+    typedef typename std::list<std::pair<K, V>>::iterator item_iterator;
+    std::map<K, item_iterator, Compare> map;
+    size_type nMaxSize;
+
+public:
+    explicit lrucache(size_type nMaxSizeIn) : nMaxSize(nMaxSizeIn)
+    {
+        assert(nMaxSizeIn > 0);
+    }
+
+    size_type size() const { return items.size(); }
+    bool empty() const { return items.empty(); }
+    size_type max_size() const { return nMaxSize; }
+
+    /** Look up a key, marking it as the most recently used if it is present. */
+    bool get(const key_type& k, mapped_type& v)
+    {
+        auto it = map.find(k);
+        if (it == map.end())
+            return false;
+        items.splice(items.begin(), items, it->second);
+        v = it->second->second;
+        return true;
+    }
+
+    /** Insert or replace the value of a key. */
+    void put(const key_type& k, const mapped_type& v)
+    {
+        auto it = map.find(k);
+        if (it != map.end()) {
+            it->second->second = v;
+            items.splice(items.begin(), items, it->second);
+            return;
+        }
+        if (items.size() >= nMaxSize) {
+            map.erase(items.back().first);
+            items.pop_back();
+        }
+        items.emplace_front(k, v);
+        map.emplace(k, items.begin());
+    }
+
+    void erase(const key_type& k)
+    {
+        auto it = map.find(k);
+        if (it == map.end())
+            return;
+        items.erase(it->second);
+        map.erase(it);
+    }
+
+    void clear()
+    {
+        map.clear();
+        items.clear();
+    }
+};
+
+#endif // ZCASH_LRUCACHE_H
@@ -9,17 +9,29 @@
 #include "addrman.h"
 #include "alert.h"
 #include "arith_uint256.h"
+#include "blockcompression.h"
+#include "blockencodings.h"
+#include "cachebudget.h"
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "checkqueue.h"
+#include "coinssnapshot.h"
+#include "compactblockindex.h"
+#include "crypto/common.h"
+#include "crypto/equihash.h"
 #include "consensus/consensus.h"
 #include "consensus/funding.h"
+#include "consensus/merkle.h"
 #include "consensus/upgrades.h"
 #include "consensus/validation.h"
+#include "core_memusage.h"
 #include "deprecation.h"
 #include "experimental_features.h"
+#include "headerstore.h"
+#include "index/blockindexes.h"
 #include "init.h"
 #include "key_io.h"
+#include "lrucache.h"
 #include "merkleblock.h"
 #include "metrics.h"
 #include "net.h"
@@ -38,6 +50,11 @@
 
 #include <algorithm>
 #include <atomic>
+#include <deque>
+#include <functional>
+#include <future>
+#include <list>
+#include <map>
 #include <sstream>
 #include <variant>
 
@@ -63,26 +80,39 @@ using namespace std;
 CCriticalSection cs_main;
 
 BlockMap mapBlockIndex;
+CBlockIndexLookup blockIndexLookup;
 CChain chainActive;
 CBlockIndex *pindexBestHeader = NULL;
 static std::atomic<int64_t> nTimeBestReceived(0); // Used only to inform the wallet of when we last received a block
 CWaitableCriticalSection csBestBlock;
 CConditionVariable cvBlockChange;
 int nScriptCheckThreads = 0;
+int nPrefetchThreads = 0;
 std::atomic_bool fImporting(false);
 std::atomic_bool fReindex(false);
+std::atomic_bool fReindexChainState(false);
 bool fTxIndex = false;
+bool fCompactBlockIndex = false;
+bool fBlockFilterIndex = false;
+bool fShieldedIndex = false;
 bool fAddressIndex = false;     // insightexplorer || lightwalletd
+bool fAddressBalances = false;  // fAddressIndex, built since genesis with balances
 bool fSpentIndex = false;       // insightexplorer
 bool fTimestampIndex = false;   // insightexplorer
 bool fHavePruned = false;
 bool fPruneMode = false;
 bool fIsBareMultisigStd = DEFAULT_PERMIT_BAREMULTISIG;
 bool fCheckBlockIndex = false;
+bool fMapBlockFiles = DEFAULT_MAP_BLOCK_FILES;
+bool fCompressBlockFiles = DEFAULT_BLOCK_COMPRESSION;
 bool fCheckpointsEnabled = DEFAULT_CHECKPOINTS_ENABLED;
+bool fAssumeValidHeaders = DEFAULT_ASSUME_VALID_HEADERS;
 bool fIBDSkipTxVerification = DEFAULT_IBD_SKIP_TX_VERIFICATION;
 bool fCoinbaseEnforcedShieldingEnabled = true;
 size_t nCoinCacheUsage = 5000 * 300;
+size_t nCoinCacheKeepUsage = 0;
+bool fUTXOStats = false;
+bool fChainstateBulkWrite = DEFAULT_CHAINSTATE_BULK_WRITE;
 uint64_t nPruneTarget = 0;
 bool fAlerts = DEFAULT_ALERTS;
 int64_t nMaxTipAge = DEFAULT_MAX_TIP_AGE;
@@ -95,13 +125,63 @@ CAmount maxTxFee = DEFAULT_TRANSACTION_MAXFEE;
 CTxMemPool mempool(::minRelayTxFee);
 
 struct COrphanTx {
-    CTransaction tx;
+    CTransactionRef tx;
     NodeId fromPeer;
+    //! The time after which the orphan is dropped.
+    int64_t nTimeExpire;
+    //! The serialized size of tx.
+    size_t nSize;
 };
-map<uint256, COrphanTx> mapOrphanTransactions GUARDED_BY(cs_main);;
-map<uint256, set<uint256> > mapOrphanTransactionsByPrev GUARDED_BY(cs_main);;
+map<uint256, COrphanTx> mapOrphanTransactions GUARDED_BY(cs_main);
+//! The orphans that spend each outpoint.
+map<COutPoint, set<uint256> > mapOrphanTransactionsByPrev GUARDED_BY(cs_main);
+//! The orphans received from each peer.
+map<NodeId, set<uint256> > mapOrphanTransactionsByPeer GUARDED_BY(cs_main);
+//! The total serialized size of the orphans.
+size_t nOrphanTransactionsSize GUARDED_BY(cs_main) = 0;
+//! The time at which expired orphans are next looked for.
+static int64_t nNextOrphanSweep GUARDED_BY(cs_main) = 0;
+//! Orphans whose parents have been accepted to the mempool, waiting to be processed.
+static set<uint256> setOrphanWork GUARDED_BY(cs_main);
+static std::atomic<bool> fOrphanWork(false);
 void EraseOrphansFor(NodeId peer) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 
+/**
+ * Shielded transactions received from peers that have passed the cheap
+ * checks under cs_main, and are waiting for ThreadShieldedTxVerification to
+ * verify their proofs before being committed to the mempool. They are
+ * verified in order of their fee per unit of verification cost, so that
+ * cheap transactions are not held up behind ones with many outputs.
+ */
+struct CPendingShieldedTx {
+    CTransactionRef tx;
+    NodeId fromPeer;
+    bool fWhitelisted;
+    uint32_t consensusBranchId;
+    //! The cost of verifying the transaction; see GetShieldedVerificationCost().
+    int64_t nCost;
+    //! The fee of the transaction per unit of nCost, or 0 if it is not known.
+    double dFeeRate;
+    //! The order in which the transaction was queued.
+    uint64_t nSequence;
+};
+struct CompareShieldedTxPriority {
+    bool operator()(const CPendingShieldedTx& a, const CPendingShieldedTx& b) const
+    {
+        if (a.dFeeRate != b.dFeeRate)
+            return a.dFeeRate > b.dFeeRate;
+        return a.nSequence < b.nSequence;
+    }
+};
+CWaitableCriticalSection cs_pendingShieldedTxs;
+CConditionVariable cvPendingShieldedTxs;
+std::set<CPendingShieldedTx, CompareShieldedTxPriority> pendingShieldedTxQueue GUARDED_BY(cs_pendingShieldedTxs);
+std::set<uint256> setPendingShieldedTxs GUARDED_BY(cs_pendingShieldedTxs);
+//! The verification cost of the queued transactions of each peer.
+std::map<NodeId, int64_t> mapPendingShieldedCost GUARDED_BY(cs_pendingShieldedTxs);
+uint64_t nPendingShieldedTxSequence GUARDED_BY(cs_pendingShieldedTxs) = 0;
+std::atomic<bool> fShieldedTxVerificationThread(false);
+
 /**
  * Returns true if there are nRequired or more blocks of minVersion or above
  * in the last Consensus::Params::nMajorityWindow blocks, starting at pstart and going backwards.
@@ -247,9 +327,21 @@ namespace {
         int64_t nTime;           //!< Time of "getdata" request in microseconds.
         bool fValidatedHeaders;  //!< Whether this block has validated headers at the time of request.
         int64_t nTimeDisconnect; //!< The timeout for this block request (for disconnecting a slow peer)
+        int64_t nEstimatedSize;  //!< The size assumed for this block in the bytes in flight from the peer.
+        std::unique_ptr<PartiallyDownloadedBlock> partialBlock; //!< Optional, for blocks requested as compact blocks.
     };
     map<uint256, pair<NodeId, list<QueuedBlock>::iterator> > mapBlocksInFlight;
 
+    /** Moving average of the size of the blocks received, used to estimate the size of blocks that are requested. */
+    int64_t nAverageBlockSize = DEFAULT_BLOCK_SIZE_ESTIMATE;
+
+    /** Peers that we asked to announce new blocks with cmpctblock messages, oldest first. Protected by cs_main. */
+    std::list<NodeId> lNodesAnnouncingHeaderAndIDs;
+
+    /** The compact block of the most recent block it was built for, shared by the peers it is sent to. Protected by cs_main. */
+    std::shared_ptr<const CBlockHeaderAndShortTxIDs> pMostRecentCompactBlock;
+    uint256 hashMostRecentCompactBlock;
+
     /** Number of blocks in flight with validated headers. */
     int nQueuedValidatedHeaders = 0;
 
@@ -305,11 +397,30 @@ struct CNodeState {
     bool fSyncStarted;
     //! Since when we're stalling block download progress (in microseconds), or 0.
     int64_t nStallingSince;
+    //! Since when the progress of this peer while stalling is measured (in microseconds), or 0.
+    int64_t nStallingMeasuredSince;
+    //! The bytes received from this peer, and the estimated size of its blocks in flight, at nStallingMeasuredSince.
+    uint64_t nStallingRecvBytes;
+    int64_t nStallingBytesInFlight;
     list<QueuedBlock> vBlocksInFlight;
     int nBlocksInFlight;
     int nBlocksInFlightValidHeaders;
+    //! Estimated size of the blocks in flight from this peer.
+    int64_t nBlockBytesInFlight;
+    //! Rate at which this peer delivers blocks, in bytes per second, or 0 if not measured yet.
+    double dBlockBandwidth;
+    //! Time it takes this peer to start delivering a block once it is requested (in microseconds).
+    int64_t nBlockLatency;
+    //! When the last block requested from this peer was received (in microseconds), or 0.
+    int64_t nLastBlockReceived;
     //! Whether we consider this a preferred download peer.
     bool fPreferredDownload;
+    //! Whether this peer can send us compact blocks, and wants new blocks announced with cmpctblock messages.
+    bool fProvidesHeaderAndIDs;
+    bool fPreferHeaderAndIDs;
+    //! Whether we want this peer to announce new blocks with cmpctblock messages, and what we last told it.
+    bool fRequestHBCmpct;
+    bool fSentHBCmpct;
 
     CNodeState() {
         fCurrentlyConnected = false;
@@ -320,9 +431,20 @@ struct CNodeState {
         pindexLastCommonBlock = NULL;
         fSyncStarted = false;
         nStallingSince = 0;
+        nStallingMeasuredSince = 0;
+        nStallingRecvBytes = 0;
+        nStallingBytesInFlight = 0;
         nBlocksInFlight = 0;
         nBlocksInFlightValidHeaders = 0;
+        nBlockBytesInFlight = 0;
+        dBlockBandwidth = 0;
+        nBlockLatency = 0;
+        nLastBlockReceived = 0;
         fPreferredDownload = false;
+        fProvidesHeaderAndIDs = false;
+        fPreferHeaderAndIDs = false;
+        fRequestHBCmpct = false;
+        fSentHBCmpct = false;
     }
 };
 
@@ -381,6 +503,7 @@ void FinalizeNode(NodeId nodeid) {
         mapBlocksInFlight.erase(entry.hash);
     EraseOrphansFor(nodeid);
     nPreferredDownload -= state->fPreferredDownload;
+    lNodesAnnouncingHeaderAndIDs.remove(nodeid);
 
     mapNodeState.erase(nodeid);
 }
@@ -393,9 +516,11 @@ bool MarkBlockAsReceived(const uint256& hash) {
         CNodeState *state = State(itInFlight->second.first);
         nQueuedValidatedHeaders -= itInFlight->second.second->fValidatedHeaders;
         state->nBlocksInFlightValidHeaders -= itInFlight->second.second->fValidatedHeaders;
+        state->nBlockBytesInFlight -= itInFlight->second.second->nEstimatedSize;
         state->vBlocksInFlight.erase(itInFlight->second.second);
         state->nBlocksInFlight--;
         state->nStallingSince = 0;
+        state->nStallingMeasuredSince = 0;
         mapBlocksInFlight.erase(itInFlight);
         return true;
     }
@@ -403,21 +528,124 @@ bool MarkBlockAsReceived(const uint256& hash) {
 }
 
 // Requires cs_main.
-void MarkBlockAsInFlight(NodeId nodeid, const uint256& hash, const Consensus::Params& consensusParams, CBlockIndex *pindex = NULL) {
+// If pit is given, the block gets a PartiallyDownloadedBlock, and *pit is set to its entry. Returns false, only
+// setting *pit, if the block was already in flight from this peer.
+bool MarkBlockAsInFlight(NodeId nodeid, const uint256& hash, const Consensus::Params& consensusParams, CBlockIndex *pindex = NULL, list<QueuedBlock>::iterator **pit = NULL) {
     CNodeState *state = State(nodeid);
     assert(state != NULL);
 
+    map<uint256, pair<NodeId, list<QueuedBlock>::iterator> >::iterator itInFlight = mapBlocksInFlight.find(hash);
+    if (pit && itInFlight != mapBlocksInFlight.end() && itInFlight->second.first == nodeid) {
+        *pit = &itInFlight->second.second;
+        return false;
+    }
+
     // Make sure it's not listed somewhere already.
     MarkBlockAsReceived(hash);
 
     int64_t nNow = GetTimeMicros();
     int nHeight = pindex != NULL ? pindex->nHeight : chainActive.Height(); // Help block timeout computation
-    QueuedBlock newentry = {hash, pindex, nNow, pindex != NULL, GetBlockTimeout(nNow, nQueuedValidatedHeaders, consensusParams, nHeight)};
+    QueuedBlock newentry = {hash, pindex, nNow, pindex != NULL, GetBlockTimeout(nNow, nQueuedValidatedHeaders, consensusParams, nHeight), nAverageBlockSize,
+                            std::unique_ptr<PartiallyDownloadedBlock>(pit ? new PartiallyDownloadedBlock(&mempool) : NULL)};
     nQueuedValidatedHeaders += newentry.fValidatedHeaders;
-    list<QueuedBlock>::iterator it = state->vBlocksInFlight.insert(state->vBlocksInFlight.end(), newentry);
+    list<QueuedBlock>::iterator it = state->vBlocksInFlight.insert(state->vBlocksInFlight.end(), std::move(newentry));
     state->nBlocksInFlight++;
-    state->nBlocksInFlightValidHeaders += newentry.fValidatedHeaders;
-    mapBlocksInFlight[hash] = std::make_pair(nodeid, it);
+    state->nBlocksInFlightValidHeaders += it->fValidatedHeaders;
+    state->nBlockBytesInFlight += it->nEstimatedSize;
+    itInFlight = mapBlocksInFlight.insert(std::make_pair(hash, std::make_pair(nodeid, it))).first;
+    if (pit)
+        *pit = &itInFlight->second.second;
+    return true;
+}
+
+// Requires cs_main.
+// Ask a peer that supports compact blocks, and that sent us a new tip, to announce new blocks with cmpctblock
+// messages. As per BIP 152, at most three peers are asked, replacing the one that was asked first.
+void MaybeSetPeerAsAnnouncingHeaderAndIDs(NodeId nodeid) {
+    CNodeState *nodestate = State(nodeid);
+    if (nodestate == NULL || !nodestate->fProvidesHeaderAndIDs)
+        return;
+    for (NodeId id : lNodesAnnouncingHeaderAndIDs) {
+        if (id == nodeid)
+            return;
+    }
+    if (lNodesAnnouncingHeaderAndIDs.size() >= 3) {
+        CNodeState *stateStop = State(lNodesAnnouncingHeaderAndIDs.front());
+        if (stateStop != NULL)
+            stateStop->fRequestHBCmpct = false;
+        lNodesAnnouncingHeaderAndIDs.pop_front();
+    }
+    nodestate->fRequestHBCmpct = true;
+    lNodesAnnouncingHeaderAndIDs.push_back(nodeid);
+}
+
+// Requires cs_main.
+// Returns the compact block of a block, reusing the one built last if it is for the same block, or NULL if the
+// block cannot be read.
+std::shared_ptr<const CBlockHeaderAndShortTxIDs> GetCompactBlock(const CBlockIndex* pindex, const Consensus::Params& consensusParams) {
+    if (pMostRecentCompactBlock && hashMostRecentCompactBlock == pindex->GetBlockHash())
+        return pMostRecentCompactBlock;
+    CBlock block;
+    if (!ReadBlockFromDisk(block, pindex, consensusParams))
+        return NULL;
+    pMostRecentCompactBlock = std::make_shared<const CBlockHeaderAndShortTxIDs>(block);
+    hashMostRecentCompactBlock = pindex->GetBlockHash();
+    return pMostRecentCompactBlock;
+}
+
+// Requires cs_main.
+// Whether we are close enough to the tip to request announced blocks directly, rather than after their headers.
+bool CanDirectFetch(const Consensus::Params& consensusParams) {
+    return chainActive.Tip()->GetBlockTime() > GetTime() - consensusParams.PoWTargetSpacing(pindexBestHeader->nHeight) * 20;
+}
+
+// Requires cs_main.
+// Update the estimates of block sizes, and of the bandwidth and latency of the peer, with a block of nSize bytes
+// that it sent. This must be called before the block is marked as received.
+void UpdateBlockDownloadEstimates(NodeId nodeid, const uint256& hash, unsigned int nSize) {
+    nAverageBlockSize += ((int64_t)nSize - nAverageBlockSize) / 16;
+
+    map<uint256, pair<NodeId, list<QueuedBlock>::iterator> >::iterator itInFlight = mapBlocksInFlight.find(hash);
+    if (itInFlight == mapBlocksInFlight.end() || itInFlight->second.first != nodeid)
+        return;
+    CNodeState *state = State(nodeid);
+    const QueuedBlock& queued = *itInFlight->second.second;
+
+    int64_t nNow = GetTimeMicros();
+    if (queued.nTime < state->nLastBlockReceived) {
+        // The block was already in flight when the previous one arrived, so the peer has been sending it since then.
+        double dBandwidth = nSize * 1000000.0 / std::max<int64_t>(1, nNow - state->nLastBlockReceived);
+        state->dBlockBandwidth = state->dBlockBandwidth == 0 ? dBandwidth : state->dBlockBandwidth + (dBandwidth - state->dBlockBandwidth) / 4;
+    } else {
+        // The peer was idle when the block was requested, so the time it took also includes the round trip.
+        int64_t nElapsed = std::max<int64_t>(1, nNow - queued.nTime);
+        if (state->dBlockBandwidth == 0) {
+            state->dBlockBandwidth = nSize * 1000000.0 / nElapsed;
+        } else {
+            int64_t nLatency = std::max<int64_t>(0, nElapsed - nSize * 1000000.0 / state->dBlockBandwidth);
+            state->nBlockLatency += (nLatency - state->nBlockLatency) / 4;
+        }
+    }
+    state->nLastBlockReceived = nNow;
+}
+
+// Requires cs_main.
+// Returns the estimated size of the blocks that should be in flight from a peer to keep it busy.
+int64_t GetBlockBytesInFlightTarget(const CNodeState* state) {
+    if (state->dBlockBandwidth == 0)
+        return MIN_BLOCK_BYTES_IN_FLIGHT;
+    double dTarget = state->dBlockBandwidth * (state->nBlockLatency + BLOCK_DOWNLOAD_QUEUE_TIME * 1000000.0) / 1000000.0;
+    return std::max<int64_t>(MIN_BLOCK_BYTES_IN_FLIGHT, std::min<double>(dTarget, MAX_BLOCK_BYTES_IN_FLIGHT));
+}
+
+// Requires cs_main.
+// Returns how many more blocks can be requested from a peer.
+int GetBlocksToRequest(const CNodeState* state) {
+    int64_t nBytesAvailable = GetBlockBytesInFlightTarget(state) - state->nBlockBytesInFlight;
+    if (nBytesAvailable <= 0)
+        return 0;
+    int64_t nBlocks = (nBytesAvailable + nAverageBlockSize - 1) / std::max<int64_t>(1, nAverageBlockSize);
+    return std::max(0, std::min<int>(nBlocks, MAX_BLOCKS_IN_TRANSIT_PER_PEER - state->nBlocksInFlight));
 }
 
 /** Check whether the last unknown block a peer advertized is not yet known. */
@@ -453,25 +681,6 @@ void UpdateBlockAvailability(NodeId nodeid, const uint256 &hash) {
     }
 }
 
-/** Find the last common ancestor two blocks have.
- *  Both pa and pb must be non-NULL. */
-CBlockIndex* LastCommonAncestor(CBlockIndex* pa, CBlockIndex* pb) {
-    if (pa->nHeight > pb->nHeight) {
-        pa = pa->GetAncestor(pb->nHeight);
-    } else if (pb->nHeight > pa->nHeight) {
-        pb = pb->GetAncestor(pa->nHeight);
-    }
-
-    while (pa != pb && pa && pb) {
-        pa = pa->pprev;
-        pb = pb->pprev;
-    }
-
-    // Eventually all chain branches meet at the genesis block.
-    assert(pa == pb);
-    return pa;
-}
-
 /** Update pindexLastCommonBlock and add not-in-flight missing successors to vBlocks, until it has
  *  at most count entries. */
 void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBlockIndex*>& vBlocks, NodeId& nodeStaller) {
@@ -576,6 +785,7 @@ bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats) {
 void RegisterNodeSignals(CNodeSignals& nodeSignals)
 {
     nodeSignals.GetHeight.connect(&GetHeight);
+    nodeSignals.PrepareMessages.connect(&PrepareMessages);
     nodeSignals.ProcessMessages.connect(&ProcessMessages);
     nodeSignals.SendMessages.connect(&SendMessages);
     nodeSignals.InitializeNode.connect(&InitializeNode);
@@ -585,6 +795,7 @@ void RegisterNodeSignals(CNodeSignals& nodeSignals)
 void UnregisterNodeSignals(CNodeSignals& nodeSignals)
 {
     nodeSignals.GetHeight.disconnect(&GetHeight);
+    nodeSignals.PrepareMessages.disconnect(&PrepareMessages);
     nodeSignals.ProcessMessages.disconnect(&ProcessMessages);
     nodeSignals.SendMessages.disconnect(&SendMessages);
     nodeSignals.InitializeNode.disconnect(&InitializeNode);
@@ -609,7 +820,13 @@ CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& loc
     return chain.Genesis();
 }
 
+CCoinsViewDB *pcoinsdbview = NULL;
 CCoinsViewCache *pcoinsTip = NULL;
+CCoinsViewSnapshot *pcoinsSnapshot = NULL;
+CBlockIndex *pindexSnapshotBase = NULL;
+
+/** The statistics of the UTXO set at the tip of chainActive, kept up to date if fUTXOStats is set (protected by cs_main). */
+static CCoinsStats utxoStats;
 CBlockTreeDB *pblocktree = NULL;
 
 //////////////////////////////////////////////////////////////////////////////
@@ -617,8 +834,9 @@ CBlockTreeDB *pblocktree = NULL;
 // mapOrphanTransactions
 //
 
-bool AddOrphanTx(const CTransaction& tx, NodeId peer) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+bool AddOrphanTx(const CTransactionRef& ptx, NodeId peer) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
 {
+    const CTransaction& tx = *ptx;
     uint256 hash = tx.GetHash();
     if (mapOrphanTransactions.count(hash))
         return false;
@@ -628,22 +846,25 @@ bool AddOrphanTx(const CTransaction& tx, NodeId peer) EXCLUSIVE_LOCKS_REQUIRED(c
     // large transaction with a missing parent then we assume
     // it will rebroadcast it later, after the parent transaction(s)
     // have been mined or received.
-    // 10,000 orphans, each of which is at most 5,000 bytes big is
-    // at most 500 megabytes of orphans:
     unsigned int sz = GetSerializeSize(tx, SER_NETWORK, tx.nVersion);
-    if (sz > 5000)
+    if (sz > MAX_ORPHAN_TX_SIZE)
     {
         LogPrint("mempool", "ignoring large orphan tx (size: %u, hash: %s)\n", sz, hash.ToString());
         return false;
     }
 
-    mapOrphanTransactions[hash].tx = tx;
-    mapOrphanTransactions[hash].fromPeer = peer;
+    COrphanTx& orphan = mapOrphanTransactions[hash];
+    orphan.tx = ptx;
+    orphan.fromPeer = peer;
+    orphan.nTimeExpire = GetTime() + ORPHAN_TX_EXPIRE_TIME;
+    orphan.nSize = sz;
     for (const CTxIn& txin : tx.vin)
-        mapOrphanTransactionsByPrev[txin.prevout.hash].insert(hash);
+        mapOrphanTransactionsByPrev[txin.prevout].insert(hash);
+    mapOrphanTransactionsByPeer[peer].insert(hash);
+    nOrphanTransactionsSize += sz;
 
-    LogPrint("mempool", "stored orphan tx %s (mapsz %u prevsz %u)\n", hash.ToString(),
-             mapOrphanTransactions.size(), mapOrphanTransactionsByPrev.size());
+    LogPrint("mempool", "stored orphan tx %s (mapsz %u prevsz %u bytes %u)\n", hash.ToString(),
+             mapOrphanTransactions.size(), mapOrphanTransactionsByPrev.size(), nOrphanTransactionsSize);
     return true;
 }
 
@@ -652,39 +873,72 @@ void static EraseOrphanTx(uint256 hash) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
     map<uint256, COrphanTx>::iterator it = mapOrphanTransactions.find(hash);
     if (it == mapOrphanTransactions.end())
         return;
-    for (const CTxIn& txin : it->second.tx.vin)
+    for (const CTxIn& txin : it->second.tx->vin)
     {
-        map<uint256, set<uint256> >::iterator itPrev = mapOrphanTransactionsByPrev.find(txin.prevout.hash);
+        map<COutPoint, set<uint256> >::iterator itPrev = mapOrphanTransactionsByPrev.find(txin.prevout);
         if (itPrev == mapOrphanTransactionsByPrev.end())
             continue;
         itPrev->second.erase(hash);
         if (itPrev->second.empty())
             mapOrphanTransactionsByPrev.erase(itPrev);
     }
+    map<NodeId, set<uint256> >::iterator itPeer = mapOrphanTransactionsByPeer.find(it->second.fromPeer);
+    if (itPeer != mapOrphanTransactionsByPeer.end()) {
+        itPeer->second.erase(hash);
+        if (itPeer->second.empty())
+            mapOrphanTransactionsByPeer.erase(itPeer);
+    }
+    nOrphanTransactionsSize -= it->second.nSize;
     mapOrphanTransactions.erase(it);
 }
 
 void EraseOrphansFor(NodeId peer)
 {
-    int nErased = 0;
-    map<uint256, COrphanTx>::iterator iter = mapOrphanTransactions.begin();
-    while (iter != mapOrphanTransactions.end())
-    {
-        map<uint256, COrphanTx>::iterator maybeErase = iter++; // increment to avoid iterator becoming invalid
-        if (maybeErase->second.fromPeer == peer)
-        {
-            EraseOrphanTx(maybeErase->second.tx.GetHash());
-            ++nErased;
-        }
-    }
-    if (nErased > 0) LogPrint("mempool", "Erased %d orphan tx from peer %d\n", nErased, peer);
+    map<NodeId, set<uint256> >::iterator itPeer = mapOrphanTransactionsByPeer.find(peer);
+    if (itPeer == mapOrphanTransactionsByPeer.end())
+        return;
+    // EraseOrphanTx() erases the set of the peer along with its last orphan.
+    set<uint256> setErase;
+    setErase.swap(itPeer->second);
+    mapOrphanTransactionsByPeer.erase(itPeer);
+    for (const uint256& hash : setErase)
+        EraseOrphanTx(hash);
+    LogPrint("mempool", "Erased %d orphan tx from peer %d\n", setErase.size(), peer);
 }
 
+static void ClearOrphanTransactions() EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+{
+    mapOrphanTransactions.clear();
+    mapOrphanTransactionsByPrev.clear();
+    mapOrphanTransactionsByPeer.clear();
+    nOrphanTransactionsSize = 0;
+    setOrphanWork.clear();
+    fOrphanWork = false;
+}
 
 unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
 {
     unsigned int nEvicted = 0;
-    while (mapOrphanTransactions.size() > nMaxOrphans)
+
+    // Drop the orphans whose parents have not arrived in time, which likely never will.
+    int64_t nNow = GetTime();
+    if (nNextOrphanSweep <= nNow) {
+        int nExpired = 0;
+        map<uint256, COrphanTx>::iterator iter = mapOrphanTransactions.begin();
+        while (iter != mapOrphanTransactions.end())
+        {
+            map<uint256, COrphanTx>::iterator maybeErase = iter++; // increment to avoid iterator becoming invalid
+            if (maybeErase->second.nTimeExpire <= nNow) {
+                EraseOrphanTx(maybeErase->first);
+                ++nExpired;
+            }
+        }
+        nNextOrphanSweep = nNow + ORPHAN_TX_EXPIRE_INTERVAL;
+        if (nExpired > 0) LogPrint("mempool", "Erased %d orphan tx due to expiration\n", nExpired);
+        nEvicted += nExpired;
+    }
+
+    while (mapOrphanTransactions.size() > nMaxOrphans || nOrphanTransactionsSize > MAX_ORPHAN_TRANSACTIONS_SIZE)
     {
         // Evict a random orphan:
         uint256 randomhash = GetRandHash();
@@ -793,6 +1047,9 @@ unsigned int GetP2SHSigOpCount(const CTransaction& tx, const CCoinsViewCache& in
  *    nHeight can become valid at a later height), we make the bans conditional on not
  *    being in Initial Block Download mode.
  * 4. The isInitBlockDownload argument is a function parameter to assist with testing.
+ * 5. If saplingVerifier is non-null, the JoinSplit signature and Sapling descriptions are
+ *    verified with it (which may defer the signature and Sapling proofs to a batch);
+ *    otherwise they are verified strictly.
  */
 bool ContextualCheckTransaction(
         const CTransaction& tx,
@@ -800,7 +1057,9 @@ bool ContextualCheckTransaction(
         const CChainParams& chainparams,
         const int nHeight,
         const bool isMined,
-        bool (*isInitBlockDownload)(const Consensus::Params&))
+        bool (*isInitBlockDownload)(const Consensus::Params&),
+        ProofVerifier* saplingVerifier,
+        const PrecomputedTransactionData* txdata)
 {
     const int DOS_LEVEL_BLOCK = 100;
     // DoS level set to 10 to be more forgiving.
@@ -1084,8 +1343,8 @@ bool ContextualCheckTransaction(
         // Empty output script.
         CScript scriptCode;
         try {
-            dataToBeSigned = SignatureHash(scriptCode, tx, NOT_AN_INPUT, SIGHASH_ALL, 0, consensusBranchId);
-            prevDataToBeSigned = SignatureHash(scriptCode, tx, NOT_AN_INPUT, SIGHASH_ALL, 0, prevConsensusBranchId);
+            dataToBeSigned = SignatureHash(scriptCode, tx, NOT_AN_INPUT, SIGHASH_ALL, 0, consensusBranchId, txdata);
+            prevDataToBeSigned = SignatureHash(scriptCode, tx, NOT_AN_INPUT, SIGHASH_ALL, 0, prevConsensusBranchId, txdata);
         } catch (std::logic_error ex) {
             // A logic error should never occur because we pass NOT_AN_INPUT and
             // SIGHASH_ALL to SignatureHash().
@@ -1094,9 +1353,12 @@ bool ContextualCheckTransaction(
         }
     }
 
+    auto strictVerifier = ProofVerifier::Strict();
+    auto& verifier = saplingVerifier ? *saplingVerifier : strictVerifier;
+
     if (!tx.vJoinSplit.empty())
     {
-        if (!ed25519_verify(&tx.joinSplitPubKey, &tx.joinSplitSig, dataToBeSigned.begin(), 32)) {
+        if (!verifier.VerifyJoinSplitSig(tx, dataToBeSigned)) {
             // Check whether the failure was caused by an outdated consensus
             // branch ID; if so, inform the node that they need to upgrade. We
             // only check the previous epoch's branch ID, on the assumption that
@@ -1121,68 +1383,36 @@ bool ContextualCheckTransaction(
     if (!tx.vShieldedSpend.empty() ||
         !tx.vShieldedOutput.empty())
     {
-        auto ctx = librustzcash_sapling_verification_ctx_init();
-
-        for (const SpendDescription &spend : tx.vShieldedSpend) {
-            if (!librustzcash_sapling_check_spend(
-                ctx,
-                spend.cv.begin(),
-                spend.anchor.begin(),
-                spend.nullifier.begin(),
-                spend.rk.begin(),
-                spend.zkproof.begin(),
-                spend.spendAuthSig.begin(),
-                dataToBeSigned.begin()
-            ))
-            {
-                librustzcash_sapling_verification_ctx_free(ctx);
+
+        // Cache the result of verifying loose transactions, so that they
+        // are not verified again when they are mined.
+        switch (verifier.VerifySapling(tx, dataToBeSigned, !isMined)) {
+            case SaplingVerificationResult::Valid:
+                break;
+            case SaplingVerificationResult::InvalidSpend:
                 return state.DoS(
                     dosLevelPotentiallyRelaxing,
                     error("ContextualCheckTransaction(): Sapling spend description invalid"),
                     REJECT_INVALID, "bad-txns-sapling-spend-description-invalid");
-            }
-        }
-
-        for (const OutputDescription &output : tx.vShieldedOutput) {
-            if (!librustzcash_sapling_check_output(
-                ctx,
-                output.cv.begin(),
-                output.cmu.begin(),
-                output.ephemeralKey.begin(),
-                output.zkproof.begin()
-            ))
-            {
-                librustzcash_sapling_verification_ctx_free(ctx);
+            case SaplingVerificationResult::InvalidOutput:
                 // This should be a non-contextual check, but we check it here
                 // as we need to pass over the outputs anyway in order to then
-                // call librustzcash_sapling_final_check().
+                // check the binding signature.
                 return state.DoS(100, error("ContextualCheckTransaction(): Sapling output description invalid"),
                                       REJECT_INVALID, "bad-txns-sapling-output-description-invalid");
-            }
-        }
-
-        if (!librustzcash_sapling_final_check(
-            ctx,
-            tx.valueBalance,
-            tx.bindingSig.begin(),
-            dataToBeSigned.begin()
-        ))
-        {
-            librustzcash_sapling_verification_ctx_free(ctx);
-            return state.DoS(
-                dosLevelPotentiallyRelaxing,
-                error("ContextualCheckTransaction(): Sapling binding signature invalid"),
-                REJECT_INVALID, "bad-txns-sapling-binding-signature-invalid");
+            case SaplingVerificationResult::InvalidBindingSig:
+                return state.DoS(
+                    dosLevelPotentiallyRelaxing,
+                    error("ContextualCheckTransaction(): Sapling binding signature invalid"),
+                    REJECT_INVALID, "bad-txns-sapling-binding-signature-invalid");
         }
-
-        librustzcash_sapling_verification_ctx_free(ctx);
     }
     return true;
 }
 
 
 bool CheckTransaction(const CTransaction& tx, CValidationState &state,
-                      ProofVerifier& verifier)
+                      ProofVerifier& verifier, bool cacheStore)
 {
     // Don't count coinbase transactions because mining skews the count
     if (!tx.IsCoinBase()) {
@@ -1194,13 +1424,13 @@ bool CheckTransaction(const CTransaction& tx, CValidationState &state,
     } else {
         // Ensure that zk-SNARKs verify
         for (const JSDescription &joinsplit : tx.vJoinSplit) {
-            if (!verifier.VerifySprout(joinsplit, tx.joinSplitPubKey)) {
+            if (!verifier.VerifySprout(joinsplit, tx.joinSplitPubKey, cacheStore)) {
                 return state.DoS(100, error("CheckTransaction(): joinsplit does not verify"),
                                     REJECT_INVALID, "bad-txns-joinsplit-verification-failed");
             }
         }
 
-        // Sapling zk-SNARK proofs are checked in librustzcash_sapling_check_{spend,output},
+        // Sapling zk-SNARK proofs are checked by ProofVerifier::VerifySapling,
         // called from ContextualCheckTransaction.
 
         return true;
@@ -1477,12 +1707,19 @@ CAmount GetMinRelayFee(const CTransaction& tx, unsigned int nBytes, bool fAllowF
 }
 
 
-bool AcceptToMemoryPool(
+/**
+ * ptx, if not null, is tx itself, which the mempool entry then shares instead
+ * of taking a copy.
+ */
+static bool AcceptToMemoryPoolWorker(
         const CChainParams& chainparams,
-        CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
-        bool* pfMissingInputs, bool fRejectAbsurdFee)
+        CTxMemPool& pool, CValidationState &state, const CTransaction &tx, const CTransactionRef& ptx,
+        bool fLimitFree, bool* pfMissingInputs, bool fRejectAbsurdFee, bool fProofsVerified)
 {
     AssertLockHeld(cs_main);
+    auto span = TracingSpan("debug", "mempool", "AcceptToMemoryPool",
+        "txid", tx.GetHash().GetHex().c_str());
+    auto spanGuard = span.Enter();
     LOCK(pool.cs); // mempool "read lock" (held through pool.addUnchecked())
     if (pfMissingInputs) {
         *pfMissingInputs = false;
@@ -1498,12 +1735,20 @@ bool AcceptToMemoryPool(
         return false;
     }
 
-    auto verifier = ProofVerifier::Strict();
-    if (!CheckTransaction(tx, state, verifier))
+    // The proofs of transactions admitted through ThreadShieldedTxVerification
+    // have already been verified (against consensusBranchId) outside cs_main.
+    auto verifier = fProofsVerified ? ProofVerifier::Disabled() : ProofVerifier::Strict();
+    if (!CheckTransaction(tx, state, verifier, true))
         return error("AcceptToMemoryPool: CheckTransaction failed");
 
+    // The signature hash midstates are kept with the mempool entry, for
+    // ContextualCheckBlock and ConnectBlock to reuse when the transaction is
+    // mined.
+    std::shared_ptr<const PrecomputedTransactionData> txdata = std::make_shared<const PrecomputedTransactionData>(tx);
+
     // Check transaction contextually against the set of consensus rules which apply in the next block to be mined.
-    if (!ContextualCheckTransaction(tx, state, chainparams, nextBlockHeight, false)) {
+    if (!ContextualCheckTransaction(tx, state, chainparams, nextBlockHeight, false,
+                                    IsInitialBlockDownload, fProofsVerified ? &verifier : nullptr, txdata.get())) {
         return error("AcceptToMemoryPool: ContextualCheckTransaction failed");
     }
 
@@ -1569,14 +1814,16 @@ bool AcceptToMemoryPool(
         view.SetBackend(viewMemPool);
 
         // do we already have it?
-        if (view.HaveCoins(hash))
-            return false;
+        for (size_t out = 0; out < tx.vout.size(); out++) {
+            if (view.HaveCoin(COutPoint(hash, out)))
+                return false;
+        }
 
         // do all inputs exist?
-        // Note that this does not check for the presence of actual outputs (see the next check for that),
-        // and only helps with filling in pfMissingInputs (to determine missing vs spent).
+        // Spent and missing outputs are no longer distinguishable, so both
+        // set pfMissingInputs.
         for (const CTxIn txin : tx.vin) {
-            if (!view.HaveCoins(txin.prevout.hash)) {
+            if (!view.HaveCoin(txin.prevout)) {
                 if (pfMissingInputs)
                     *pfMissingInputs = true;
                 return false;
@@ -1633,8 +1880,8 @@ bool AcceptToMemoryPool(
         // during reorgs to ensure COINBASE_MATURITY is still met.
         bool fSpendsCoinbase = false;
         for (const CTxIn &txin : tx.vin) {
-            const CCoins *coins = view.AccessCoins(txin.prevout.hash);
-            if (coins->IsCoinBase()) {
+            const Coin &coin = view.AccessCoin(txin.prevout);
+            if (coin.IsCoinBase()) {
                 fSpendsCoinbase = true;
                 break;
             }
@@ -1643,7 +1890,7 @@ bool AcceptToMemoryPool(
         // We don't yet know if the transaction commits to consensusBranchId,
         // but if the entry gets added to the mempool, then it has passed
         // ContextualCheckInputs and therefore this is correct.
-        CTxMemPoolEntry entry(tx, nFees, GetTime(), dPriority, chainActive.Height(), mempool.HasNoInputsOf(tx), fSpendsCoinbase, consensusBranchId);
+        CTxMemPoolEntry entry(ptx ? ptx : MakeTransactionRef(tx), nFees, GetTime(), dPriority, chainActive.Height(), mempool.HasNoInputsOf(tx), fSpendsCoinbase, consensusBranchId, txdata);
         unsigned int nSize = entry.GetTxSize();
 
         // Before zcashd 4.2.0, we had a condition here to always accept a tx if it contained
@@ -1697,8 +1944,7 @@ bool AcceptToMemoryPool(
 
         // Check against previous transactions
         // This is done last to help prevent CPU exhaustion denial-of-service attacks.
-        PrecomputedTransactionData txdata(tx);
-        if (!ContextualCheckInputs(tx, state, view, true, STANDARD_SCRIPT_VERIFY_FLAGS, true, txdata, chainparams.GetConsensus(), consensusBranchId))
+        if (!ContextualCheckInputs(tx, state, view, true, STANDARD_SCRIPT_VERIFY_FLAGS, true, *txdata, chainparams.GetConsensus(), consensusBranchId))
         {
             return error("AcceptToMemoryPool: ConnectInputs failed %s", hash.ToString());
         }
@@ -1712,7 +1958,7 @@ bool AcceptToMemoryPool(
         // There is a similar check in CreateNewBlock() to prevent creating
         // invalid blocks, however allowing such transactions into the mempool
         // can be exploited as a DoS attack.
-        if (!ContextualCheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true, txdata, chainparams.GetConsensus(), consensusBranchId))
+        if (!ContextualCheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true, *txdata, chainparams.GetConsensus(), consensusBranchId))
         {
             return error("AcceptToMemoryPool: BUG! PLEASE REPORT THIS! ConnectInputs failed against MANDATORY but not STANDARD flags %s", hash.ToString());
         }
@@ -1749,6 +1995,24 @@ bool AcceptToMemoryPool(
     return true;
 }
 
+bool AcceptToMemoryPool(
+        const CChainParams& chainparams,
+        CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
+        bool* pfMissingInputs, bool fRejectAbsurdFee, bool fProofsVerified)
+{
+    return AcceptToMemoryPoolWorker(chainparams, pool, state, tx, nullptr, fLimitFree,
+                                    pfMissingInputs, fRejectAbsurdFee, fProofsVerified);
+}
+
+bool AcceptToMemoryPool(
+        const CChainParams& chainparams,
+        CTxMemPool& pool, CValidationState &state, const CTransactionRef &ptx, bool fLimitFree,
+        bool* pfMissingInputs, bool fRejectAbsurdFee, bool fProofsVerified)
+{
+    return AcceptToMemoryPoolWorker(chainparams, pool, state, *ptx, ptx, fLimitFree,
+                                    pfMissingInputs, fRejectAbsurdFee, fProofsVerified);
+}
+
 bool GetTimestampIndex(unsigned int high, unsigned int low, bool fActiveOnly,
     std::vector<std::pair<uint256, unsigned int> > &hashes)
 {
@@ -1767,7 +2031,7 @@ bool GetSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value)
     if (!fSpentIndex)
         return error("Spent index not enabled");
 
-    if (mempool.getSpentIndex(key, value))
+    if (mempool.getSpentIndex(key, value, pcoinsTip))
         return true;
 
     if (!pblocktree->ReadSpentIndex(key, value))
@@ -1778,17 +2042,32 @@ bool GetSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value)
 
 bool GetAddressIndex(const uint160& addressHash, int type,
                      std::vector<CAddressIndexDbEntry>& addressIndex,
-                     int start, int end)
+                     int start, int end,
+                     const CAddressIndexKey* after, size_t limit)
 {
     if (!fAddressIndex)
         return error("address index not enabled");
 
-    if (!pblocktree->ReadAddressIndex(addressHash, type, addressIndex, start, end))
+    if (!pblocktree->ReadAddressIndex(addressHash, type, addressIndex, start, end, after, limit))
         return error("unable to get txids for address");
 
     return true;
 }
 
+bool GetAddressBalance(const uint160& addressHash, int type, CAmount& balance, CAmount& received)
+{
+    if (!fAddressBalances)
+        return false;
+
+    CAddressBalanceValue value;
+    if (!pblocktree->ReadAddressBalance(addressHash, type, value))
+        return error("unable to get balance for address");
+
+    balance = value.balance;
+    received = value.received;
+    return true;
+}
+
 bool GetAddressUnspent(const uint160& addressHash, int type,
                        std::vector<CAddressUnspentDbEntry>& unspentOutputs)
 {
@@ -1801,6 +2080,157 @@ bool GetAddressUnspent(const uint160& addressHash, int type,
     return true;
 }
 
+/**
+ * Read the size that is written before the record at pos of a block or undo
+ * file, leaving file at pos.
+ */
+static unsigned int ReadRecordSize(CAutoFile& file, const CDiskBlockPos& pos)
+{
+    if (pos.nPos < sizeof(uint32_t) || fseek(file.Get(), pos.nPos - sizeof(uint32_t), SEEK_SET) != 0)
+        throw std::ios_base::failure("cannot seek to the size of the record");
+    unsigned int nSize;
+    file >> nSize;
+    return nSize;
+}
+
+/**
+ * Read and decompress the compressed record at the position of file, of
+ * which nSize is the size read by ReadRecordSize().
+ */
+static void ReadCompressedRecord(CAutoFile& file, unsigned int nSize, size_t nMaxSize, std::vector<char>& vData)
+{
+    std::vector<char> vCompressed(nSize & ~BLOCK_RECORD_COMPRESSED);
+    if (vCompressed.size() > nMaxSize)
+        throw std::ios_base::failure("compressed record too large");
+    file.read(vCompressed.data(), vCompressed.size());
+    if (!DecompressBlockRecord(vCompressed.data(), vCompressed.data() + vCompressed.size(), vData, nMaxSize))
+        throw std::ios_base::failure("invalid compressed record");
+}
+
+/**
+ * Compress the serialization of obj for a record of the block or undo files,
+ * if -blockcompression is set and that makes it smaller.
+ */
+template <typename T>
+static bool CompressForDisk(const T& obj, std::vector<char>& vCompressed)
+{
+    vCompressed.clear();
+    if (!fCompressBlockFiles)
+        return false;
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << obj;
+    return CompressBlockRecord(&ss[0], &ss[0] + ss.size(), vCompressed);
+}
+
+/**
+ * Transactions of the most recently connected blocks, with the hashes of
+ * those blocks, so that lookups of recently confirmed transactions under
+ * -txindex do not read the block files.
+ */
+static CCriticalSection cs_recentTxs;
+static lrucache<uint256, std::pair<CTransactionRef, uint256>> recentTxs(RECENT_TX_CACHE_SIZE);
+
+static void AddRecentTransactions(const CBlock& block, const std::vector<std::pair<uint256, CDiskTxPos>>& vPos, const uint256& hashBlock)
+{
+    std::vector<CTransactionRef> vtx;
+    vtx.reserve(block.vtx.size());
+    for (unsigned int i = 0; i < block.vtx.size(); i++) {
+        if (vPos[i].second.nTxSize > MAX_RECENT_TX_SIZE) {
+            vtx.push_back(nullptr);
+            continue;
+        }
+        // Share the mempool's copy of the transaction if it has one.
+        CTransactionRef ptx = mempool.get(vPos[i].first);
+        vtx.push_back(ptx ? ptx : MakeTransactionRef(block.vtx[i]));
+    }
+
+    LOCK(cs_recentTxs);
+    for (unsigned int i = 0; i < vtx.size(); i++) {
+        if (vtx[i]) {
+            recentTxs.put(vPos[i].first, std::make_pair(vtx[i], hashBlock));
+        }
+    }
+}
+
+static void EraseRecentTransactions(const CBlock& block)
+{
+    LOCK(cs_recentTxs);
+    for (const CTransaction& tx : block.vtx) {
+        recentTxs.erase(tx.GetHash());
+    }
+}
+
+static bool LookupRecentTransaction(const uint256& hash, CTransactionRef& ptx, uint256& hashBlock)
+{
+    std::pair<CTransactionRef, uint256> entry;
+    {
+        LOCK(cs_recentTxs);
+        if (!recentTxs.get(hash, entry))
+            return false;
+    }
+    ptx = entry.first;
+    hashBlock = entry.second;
+    return true;
+}
+
+/**
+ * Read the header of the block that holds the indexed transaction at postx,
+ * then call readTx with a stream positioned at the transaction.
+ */
+template <typename ReadTx>
+static void ReadIndexedTransaction(const CDiskTxPos& postx, CBlockHeader& header, ReadTx readTx)
+{
+    CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
+    if (file.IsNull())
+        throw std::ios_base::failure("OpenBlockFile failed");
+    unsigned int nSize = ReadRecordSize(file, postx);
+    if (nSize & BLOCK_RECORD_COMPRESSED) {
+        // The offset is in the decompressed block.
+        std::vector<char> vData;
+        ReadCompressedRecord(file, nSize, MAX_BLOCK_SIZE, vData);
+        CMemoryReader reader(SER_DISK, CLIENT_VERSION, vData.data(), vData.data() + vData.size());
+        reader >> header;
+        reader.ignore(postx.nTxOffset);
+        readTx(reader);
+    } else {
+        file >> header;
+        fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
+        readTx(file);
+    }
+}
+
+bool GetTransactionData(const uint256& hash, std::vector<char>& vTx, uint256& hashBlock)
+{
+    if (!fTxIndex)
+        return false;
+
+    CTransactionRef ptx;
+    if (LookupRecentTransaction(hash, ptx, hashBlock)) {
+        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+        ss << *ptx;
+        vTx.assign(ss.begin(), ss.end());
+        return true;
+    }
+
+    // Entries written before the size of the transaction was recorded are
+    // left to GetTransaction().
+    CDiskTxPos postx;
+    if (!pblocktree->ReadTxIndex(hash, postx) || postx.nTxSize == 0)
+        return false;
+    CBlockHeader header;
+    try {
+        vTx.resize(postx.nTxSize);
+        ReadIndexedTransaction(postx, header, [&](auto& s) { s.read(vTx.data(), vTx.size()); });
+    } catch (const std::exception& e) {
+        return error("%s: Deserialize or I/O error - %s", __func__, e.what());
+    }
+    // The txid is the hash of the serialization.
+    if (Hash(vTx.begin(), vTx.end()) != hash)
+        return error("%s: txid mismatch", __func__);
+    hashBlock = header.GetHash();
+    return true;
+}
+
 /**
  * Return transaction in txOut, and if it was found inside a block, its hash is placed in hashBlock.
  * If blockIndex is provided, the transaction is fetched from the corresponding block.
@@ -1809,8 +2239,9 @@ bool GetTransaction(const uint256& hash, CTransaction& txOut, const Consensus::P
 {
     CBlockIndex* pindexSlow = blockIndex;
 
-    LOCK(cs_main);
-
+    // The mempool and the transaction index have their own locks, and block
+    // files are only appended to, so cs_main is only taken for the coins
+    // database and the block index.
     if (!blockIndex) {
         if (mempool.lookup(hash, txOut))
         {
@@ -1818,16 +2249,17 @@ bool GetTransaction(const uint256& hash, CTransaction& txOut, const Consensus::P
         }
 
         if (fTxIndex) {
+            CTransactionRef ptx;
+            if (LookupRecentTransaction(hash, ptx, hashBlock)) {
+                txOut = *ptx;
+                return true;
+            }
+
             CDiskTxPos postx;
             if (pblocktree->ReadTxIndex(hash, postx)) {
-                CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
-                if (file.IsNull())
-                    return error("%s: OpenBlockFile failed", __func__);
                 CBlockHeader header;
                 try {
-                    file >> header;
-                    fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
-                    file >> txOut;
+                    ReadIndexedTransaction(postx, header, [&](auto& s) { s >> txOut; });
                 } catch (const std::exception& e) {
                     return error("%s: Deserialize or I/O error - %s", __func__, e.what());
                 }
@@ -1842,21 +2274,21 @@ bool GetTransaction(const uint256& hash, CTransaction& txOut, const Consensus::P
         }
 
         if (fAllowSlow) { // use coin database to locate block that contains transaction, and scan it
-            int nHeight = -1;
-            {
-                CCoinsViewCache &view = *pcoinsTip;
-                const CCoins* coins = view.AccessCoins(hash);
-                if (coins)
-                    nHeight = coins->nHeight;
-            }
-            if (nHeight > 0)
-                pindexSlow = chainActive[nHeight];
+            LOCK(cs_main);
+            const Coin& coin = AccessByTxid(*pcoinsTip, hash);
+            if (!coin.IsSpent())
+                pindexSlow = chainActive[coin.nHeight];
         }
     }
 
     if (pindexSlow) {
+        CDiskBlockPos pos;
+        {
+            LOCK(cs_main);
+            pos = pindexSlow->GetBlockPos();
+        }
         CBlock block;
-        if (ReadBlockFromDisk(block, pindexSlow, consensusParams)) {
+        if (ReadBlockFromDisk(block, pos, consensusParams) && block.GetHash() == pindexSlow->GetBlockHash()) {
             for (const CTransaction &tx : block.vtx) {
                 if (tx.GetHash() == hash) {
                     txOut = tx;
@@ -1875,7 +2307,8 @@ bool GetTransaction(const uint256& hash, CTransaction& txOut, const Consensus::P
 // CBlock and CBlockIndex
 //
 
-bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart)
+bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart, const std::vector<char>& vCompressed,
+                      const char* pRawBegin, const char* pRawEnd)
 {
     // Open history file to append
     CAutoFile fileout(OpenBlockFile(pos), SER_DISK, CLIENT_VERSION);
@@ -1883,7 +2316,13 @@ bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHea
         return error("WriteBlockToDisk: OpenBlockFile failed");
 
     // Write index header
-    unsigned int nSize = GetSerializeSize(fileout, block);
+    unsigned int nSize;
+    if (!vCompressed.empty())
+        nSize = vCompressed.size() | BLOCK_RECORD_COMPRESSED;
+    else if (pRawBegin != NULL)
+        nSize = pRawEnd - pRawBegin;
+    else
+        nSize = GetSerializeSize(fileout, block);
     fileout << FLATDATA(messageStart) << nSize;
 
     // Write block
@@ -1891,26 +2330,106 @@ bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHea
     if (fileOutPos < 0)
         return error("WriteBlockToDisk: ftell failed");
     pos.nPos = (unsigned int)fileOutPos;
-    fileout << block;
+    if (!vCompressed.empty())
+        fileout.write(vCompressed.data(), vCompressed.size());
+    else if (pRawBegin != NULL)
+        fileout.write(pRawBegin, pRawEnd - pRawBegin);
+    else
+        fileout << block;
 
     return true;
 }
 
+/** The most recently used block file mappings. */
+static CBlockFileMapCache mapBlockFiles;
+
+/** Headers of the blocks in the active chain, from which headers messages are served. */
+static CHeaderStore headerStore;
+
+void OpenHeaderStore(const Consensus::Params& params)
+{
+    headerStore.Open(GetDataDir() / "blocks" / "headers.dat",
+                     equihash_solution_size(params.nEquihashN, params.nEquihashK));
+}
+
+void CloseHeaderStore()
+{
+    headerStore.Close();
+}
+
+/**
+ * Locate the serialized block at pos in a mapping of its block file, using
+ * the size written before it, and whether it is compressed. Returns null if
+ * the file cannot be mapped.
+ */
+static std::shared_ptr<const CMappedBlockFile> MapBlockFromDisk(const CDiskBlockPos& pos, const char*& pbegin, const char*& pend, bool& fCompressed)
+{
+    // The block is preceded by the message start and its size.
+    if (!fMapBlockFiles || pos.IsNull() || pos.nPos < MESSAGE_START_SIZE + sizeof(uint32_t))
+        return nullptr;
+
+    fs::path path = GetBlockPosFilename(pos, "blk");
+    std::shared_ptr<const CMappedBlockFile> mapping = mapBlockFiles.Get(pos.nFile, path, pos.nPos);
+    if (!mapping)
+        return nullptr;
+    unsigned int nSize = ReadLE32((const unsigned char*)mapping->data() + pos.nPos - sizeof(uint32_t));
+    fCompressed = (nSize & BLOCK_RECORD_COMPRESSED) != 0;
+    nSize &= ~BLOCK_RECORD_COMPRESSED;
+    if (nSize > MAX_BLOCK_SIZE)
+        return nullptr;
+    if (size_t(pos.nPos) + nSize > mapping->size()) {
+        mapping = mapBlockFiles.Get(pos.nFile, path, size_t(pos.nPos) + nSize);
+        if (!mapping)
+            return nullptr;
+    }
+    pbegin = mapping->data() + pos.nPos;
+    pend = pbegin + nSize;
+    return mapping;
+}
+
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams)
 {
     block.SetNull();
 
-    // Open history file to read
-    CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull())
-        return error("ReadBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
+    const char* pbegin;
+    const char* pend;
+    bool fCompressed;
+    std::shared_ptr<const CMappedBlockFile> mapping = MapBlockFromDisk(pos, pbegin, pend, fCompressed);
+    if (mapping) {
+        // Read block from the mapping
+        try {
+            if (fCompressed) {
+                std::vector<char> vData;
+                if (!DecompressBlockRecord(pbegin, pend, vData, MAX_BLOCK_SIZE))
+                    return error("%s: invalid compressed block at %s", __func__, pos.ToString());
+                CMemoryReader(SER_DISK, CLIENT_VERSION, vData.data(), vData.data() + vData.size()) >> block;
+            } else {
+                CMemoryReader(SER_DISK, CLIENT_VERSION, pbegin, pend) >> block;
+            }
+        }
+        catch (const std::exception& e) {
+            return error("%s: Deserialize error - %s at %s", __func__, e.what(), pos.ToString());
+        }
+    } else {
+        // Open history file to read
+        CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
+        if (filein.IsNull())
+            return error("ReadBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
 
-    // Read block
-    try {
-        filein >> block;
-    }
-    catch (const std::exception& e) {
-        return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), pos.ToString());
+        // Read block
+        try {
+            unsigned int nSize = ReadRecordSize(filein, pos);
+            if (nSize & BLOCK_RECORD_COMPRESSED) {
+                std::vector<char> vData;
+                ReadCompressedRecord(filein, nSize, MAX_BLOCK_SIZE, vData);
+                CMemoryReader(SER_DISK, CLIENT_VERSION, vData.data(), vData.data() + vData.size()) >> block;
+            } else {
+                filein >> block;
+            }
+        }
+        catch (const std::exception& e) {
+            return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), pos.ToString());
+        }
     }
 
     // Check the header
@@ -1931,6 +2450,70 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus
     return true;
 }
 
+bool ReadRawBlockFromDisk(CRawBlock& block, const CBlockIndex* pindex, const CMessageHeader::MessageStartChars& messageStart)
+{
+    CDiskBlockPos pos = pindex->GetBlockPos();
+    if (pos.IsNull() || pos.nPos < MESSAGE_START_SIZE + sizeof(uint32_t))
+        return error("%s: no block data for %s", __func__, pindex->ToString());
+
+    const char* pbegin;
+    const char* pend;
+    bool fCompressed;
+    std::shared_ptr<const CMappedBlockFile> mapping = MapBlockFromDisk(pos, pbegin, pend, fCompressed);
+    if (mapping) {
+        if (memcmp(pbegin - MESSAGE_START_SIZE - sizeof(uint32_t), messageStart, MESSAGE_START_SIZE) != 0)
+            return error("%s: block magic mismatch at %s", __func__, pos.ToString());
+        if (fCompressed) {
+            std::vector<char> vData;
+            if (!DecompressBlockRecord(pbegin, pend, vData, MAX_BLOCK_SIZE))
+                return error("%s: invalid compressed block at %s", __func__, pos.ToString());
+            block.Set(std::move(vData));
+        } else {
+            block.Set(mapping, pbegin, pend);
+        }
+    } else {
+        CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
+        if (filein.IsNull())
+            return error("%s: OpenBlockFile failed for %s", __func__, pos.ToString());
+        try {
+            if (fseek(filein.Get(), pos.nPos - MESSAGE_START_SIZE - sizeof(uint32_t), SEEK_SET) != 0)
+                return error("%s: fseek failed for %s", __func__, pos.ToString());
+            CMessageHeader::MessageStartChars blockStart;
+            unsigned int nSize;
+            filein >> FLATDATA(blockStart) >> nSize;
+            if (memcmp(blockStart, messageStart, MESSAGE_START_SIZE) != 0)
+                return error("%s: block magic mismatch at %s", __func__, pos.ToString());
+            if ((nSize & ~BLOCK_RECORD_COMPRESSED) > MAX_BLOCK_SIZE)
+                return error("%s: block size %u too large at %s", __func__, nSize & ~BLOCK_RECORD_COMPRESSED, pos.ToString());
+            std::vector<char> vData;
+            if (nSize & BLOCK_RECORD_COMPRESSED) {
+                ReadCompressedRecord(filein, nSize, MAX_BLOCK_SIZE, vData);
+            } else {
+                vData.resize(nSize);
+                filein.read(vData.data(), nSize);
+            }
+            block.Set(std::move(vData));
+        }
+        catch (const std::exception& e) {
+            return error("%s: I/O error - %s at %s", __func__, e.what(), pos.ToString());
+        }
+    }
+
+    // The index entry has been checked, so checking the header hash against
+    // it is enough to know that the data is the block.
+    CBlockHeader header;
+    try {
+        CMemoryReader(SER_DISK, CLIENT_VERSION, block.begin(), block.end()) >> header;
+    }
+    catch (const std::exception& e) {
+        return error("%s: Deserialize error - %s at %s", __func__, e.what(), pos.ToString());
+    }
+    if (header.GetHash() != pindex->GetBlockHash())
+        return error("%s: GetHash() doesn't match index for %s at %s",
+                __func__, pindex->ToString(), pos.ToString());
+    return true;
+}
+
 CAmount GetBlockSubsidy(int nHeight, const Consensus::Params& consensusParams)
 {
     CAmount nSubsidy = 12.5 * COIN;
@@ -2186,20 +2769,10 @@ void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, CTxUndo &txund
     if (!tx.IsCoinBase()) {
         txundo.vprevout.reserve(tx.vin.size());
         for (const CTxIn &txin : tx.vin) {
-            CCoinsModifier coins = inputs.ModifyCoins(txin.prevout.hash);
-            unsigned nPos = txin.prevout.n;
-
-            if (nPos >= coins->vout.size() || coins->vout[nPos].IsNull())
-                assert(false);
             // mark an outpoint spent, and construct undo information
-            txundo.vprevout.push_back(CTxInUndo(coins->vout[nPos]));
-            coins->Spend(nPos);
-            if (coins->vout.size() == 0) {
-                CTxInUndo& undo = txundo.vprevout.back();
-                undo.nHeight = coins->nHeight;
-                undo.fCoinBase = coins->fCoinBase;
-                undo.nVersion = coins->nVersion;
-            }
+            txundo.vprevout.emplace_back();
+            bool is_spent = inputs.SpendCoin(txin.prevout, &txundo.vprevout.back());
+            assert(is_spent);
         }
     }
 
@@ -2207,7 +2780,7 @@ void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, CTxUndo &txund
     inputs.SetNullifiers(tx, true);
 
     // add outputs
-    inputs.ModifyNewCoins(tx.GetHash())->FromTx(tx, nHeight);
+    AddCoins(inputs, tx, nHeight);
 }
 
 void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, int nHeight)
@@ -2224,6 +2797,20 @@ bool CScriptCheck::operator()() {
     return true;
 }
 
+bool CProofCheck::operator()() {
+    if (psaplingBatch) {
+        if (!psaplingBatch->VerifyBatch()) {
+            return ::error("CProofCheck(): proof and signature batch does not verify");
+        }
+    } else if (pjoinsplit) {
+        auto verifier = ProofVerifier::Strict();
+        if (!verifier.VerifySprout(*pjoinsplit, *pjoinSplitPubKey, cacheStore)) {
+            return ::error("CProofCheck(): joinsplit does not verify");
+        }
+    }
+    return true;
+}
+
 int GetSpendHeight(const CCoinsViewCache& inputs)
 {
     LOCK(cs_main);
@@ -2257,14 +2844,14 @@ bool CheckTxInputs(const CTransaction& tx, CValidationState& state, const CCoins
         for (unsigned int i = 0; i < tx.vin.size(); i++)
         {
             const COutPoint &prevout = tx.vin[i].prevout;
-            const CCoins *coins = inputs.AccessCoins(prevout.hash);
-            assert(coins);
+            const Coin& coin = inputs.AccessCoin(prevout);
+            assert(!coin.IsSpent());
 
-            if (coins->IsCoinBase()) {
+            if (coin.IsCoinBase()) {
                 // Ensure that coinbases are matured
-                if (nSpendHeight - coins->nHeight < COINBASE_MATURITY) {
+                if (nSpendHeight - coin.nHeight < COINBASE_MATURITY) {
                     return state.Invalid(
-                        error("CheckInputs(): tried to spend coinbase at depth %d", nSpendHeight - coins->nHeight),
+                        error("CheckInputs(): tried to spend coinbase at depth %d", nSpendHeight - coin.nHeight),
                         REJECT_INVALID, "bad-txns-premature-spend-of-coinbase");
                 }
 
@@ -2280,8 +2867,8 @@ bool CheckTxInputs(const CTransaction& tx, CValidationState& state, const CCoins
             }
 
             // Check for negative or overflow input values
-            nValueIn += coins->vout[prevout.n].nValue;
-            if (!MoneyRange(coins->vout[prevout.n].nValue) || !MoneyRange(nValueIn))
+            nValueIn += coin.out.nValue;
+            if (!MoneyRange(coin.out.nValue) || !MoneyRange(nValueIn))
                 return state.DoS(100, error("CheckInputs(): txin values out of range"),
                                  REJECT_INVALID, "bad-txns-inputvalues-outofrange");
 
@@ -2317,7 +2904,7 @@ bool ContextualCheckInputs(
     bool fScriptChecks,
     unsigned int flags,
     bool cacheStore,
-    PrecomputedTransactionData& txdata,
+    const PrecomputedTransactionData& txdata,
     const Consensus::Params& consensusParams,
     uint32_t consensusBranchId,
     std::vector<CScriptCheck> *pvChecks)
@@ -2341,11 +2928,11 @@ bool ContextualCheckInputs(
         if (fScriptChecks) {
             for (unsigned int i = 0; i < tx.vin.size(); i++) {
                 const COutPoint &prevout = tx.vin[i].prevout;
-                const CCoins* coins = inputs.AccessCoins(prevout.hash);
-                assert(coins);
+                const Coin& coin = inputs.AccessCoin(prevout);
+                assert(!coin.IsSpent());
 
                 // Verify signature
-                CScriptCheck check(*coins, tx, i, flags, cacheStore, consensusBranchId, &txdata);
+                CScriptCheck check(coin.out, tx, i, flags, cacheStore, consensusBranchId, &txdata);
                 if (pvChecks) {
                     pvChecks->push_back(CScriptCheck());
                     check.swap(pvChecks->back());
@@ -2358,7 +2945,7 @@ bool ContextualCheckInputs(
                     // notice their transactions failing before a second network
                     // upgrade occurs.
                     auto prevConsensusBranchId = PrevEpochBranchId(consensusBranchId, consensusParams);
-                    CScriptCheck checkPrev(*coins, tx, i, flags, cacheStore, prevConsensusBranchId, &txdata);
+                    CScriptCheck checkPrev(coin.out, tx, i, flags, cacheStore, prevConsensusBranchId, &txdata);
                     if (checkPrev()) {
                         return state.DoS(
                             10, false, REJECT_INVALID, strprintf(
@@ -2373,7 +2960,7 @@ bool ContextualCheckInputs(
                         // arguments; if so, don't trigger DoS protection to
                         // avoid splitting the network between upgraded and
                         // non-upgraded nodes.
-                        CScriptCheck check2(*coins, tx, i,
+                        CScriptCheck check2(coin.out, tx, i,
                                 flags & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, cacheStore, consensusBranchId, &txdata);
                         if (check2())
                             return state.Invalid(false, REJECT_NONSTANDARD, strprintf("non-mandatory-script-verify-flag (%s)", ScriptErrorString(check.GetScriptError())));
@@ -2392,7 +2979,7 @@ bool ContextualCheckInputs(
 
 namespace {
 
-bool UndoWriteToDisk(const CBlockUndo& blockundo, CDiskBlockPos& pos, const uint256& hashBlock, const CMessageHeader::MessageStartChars& messageStart)
+bool UndoWriteToDisk(const CBlockUndo& blockundo, const std::vector<char>& vCompressed, CDiskBlockPos& pos, const uint256& hashBlock, const CMessageHeader::MessageStartChars& messageStart)
 {
     // Open history file to append
     CAutoFile fileout(OpenUndoFile(pos), SER_DISK, CLIENT_VERSION);
@@ -2400,7 +2987,7 @@ bool UndoWriteToDisk(const CBlockUndo& blockundo, CDiskBlockPos& pos, const uint
         return error("%s: OpenUndoFile failed", __func__);
 
     // Write index header
-    unsigned int nSize = GetSerializeSize(fileout, blockundo);
+    unsigned int nSize = vCompressed.empty() ? GetSerializeSize(fileout, blockundo) : vCompressed.size() | BLOCK_RECORD_COMPRESSED;
     fileout << FLATDATA(messageStart) << nSize;
 
     // Write undo data
@@ -2408,7 +2995,10 @@ bool UndoWriteToDisk(const CBlockUndo& blockundo, CDiskBlockPos& pos, const uint
     if (fileOutPos < 0)
         return error("%s: ftell failed", __func__);
     pos.nPos = (unsigned int)fileOutPos;
-    fileout << blockundo;
+    if (vCompressed.empty())
+        fileout << blockundo;
+    else
+        fileout.write(vCompressed.data(), vCompressed.size());
 
     // calculate & write checksum
     CHashWriter hasher(SER_GETHASH, PROTOCOL_VERSION);
@@ -2419,6 +3009,8 @@ bool UndoWriteToDisk(const CBlockUndo& blockundo, CDiskBlockPos& pos, const uint
     return true;
 }
 
+} // anon namespace
+
 bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uint256& hashBlock)
 {
     // Open history file to read
@@ -2429,7 +3021,14 @@ bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uin
     // Read block
     uint256 hashChecksum;
     try {
-        filein >> blockundo;
+        unsigned int nSize = ReadRecordSize(filein, pos);
+        if (nSize & BLOCK_RECORD_COMPRESSED) {
+            std::vector<char> vData;
+            ReadCompressedRecord(filein, nSize, MAX_SIZE, vData);
+            CMemoryReader(SER_DISK, CLIENT_VERSION, vData.data(), vData.data() + vData.size()) >> blockundo;
+        } else {
+            filein >> blockundo;
+        }
         filein >> hashChecksum;
     }
     catch (const std::exception& e) {
@@ -2446,123 +3045,133 @@ bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uin
     return true;
 }
 
-} // anon namespace
-
-/**
- * Apply the undo operation of a CTxInUndo to the given chain state.
- * @param undo The undo object.
- * @param view The coins view to which to apply the changes.
+enum DisconnectResult
+{
+    DISCONNECT_OK,      // All good.
+    DISCONNECT_UNCLEAN, // Rolled back, but UTXO set was inconsistent with block.
+    DISCONNECT_FAILED   // Something else went wrong.
+};
+
+/**
+ * Restore the UTXO in a Coin at a given COutPoint.
+ * @param undo The Coin to be restored.
+ * @param view The coins view to which to apply the changes.
  * @param out The out point that corresponds to the tx input.
- * @return True on success.
+ * @return DISCONNECT_OK, DISCONNECT_UNCLEAN if the output already existed, or
+ *         DISCONNECT_FAILED if the undo data lacks the output's metadata.
  */
-static bool ApplyTxInUndo(const CTxInUndo& undo, CCoinsViewCache& view, const COutPoint& out)
+static DisconnectResult ApplyTxInUndo(Coin&& undo, CCoinsViewCache& view, const COutPoint& out)
 {
     bool fClean = true;
 
-    CCoinsModifier coins = view.ModifyCoins(out.hash);
-    if (undo.nHeight != 0) {
-        // undo data contains height: this is the last output of the prevout tx being spent
-        if (!coins->IsPruned())
-            fClean = fClean && error("%s: undo data overwriting existing transaction", __func__);
-        coins->Clear();
-        coins->fCoinBase = undo.fCoinBase;
-        coins->nHeight = undo.nHeight;
-        coins->nVersion = undo.nVersion;
-    } else {
-        if (coins->IsPruned())
-            fClean = fClean && error("%s: undo data adding output to missing transaction", __func__);
-    }
-    if (coins->IsAvailable(out.n))
+    if (view.HaveCoin(out))
         fClean = fClean && error("%s: undo data overwriting existing output", __func__);
-    if (coins->vout.size() < out.n+1)
-        coins->vout.resize(out.n+1);
-    coins->vout[out.n] = undo.txout;
 
-    return fClean;
+    if (undo.nHeight == 0) {
+        // Missing undo metadata (height and coinbase). Older versions included this
+        // information only in undo records for the last spend of a transaction's
+        // outputs. This implies that it must be present for some other output of the same tx.
+        const Coin& alternate = AccessByTxid(view, out.hash);
+        if (alternate.IsSpent()) {
+            error("%s: undo data adding output to missing transaction", __func__);
+            return DISCONNECT_FAILED;
+        }
+        undo.nHeight = alternate.nHeight;
+        undo.fCoinBase = alternate.fCoinBase;
+    }
+    // The possible_overwrite parameter to AddCoin is only allowed to be false if we know for
+    // sure that the coin did not already exist in the cache. As we have queried for that above
+    // using HaveCoin, we don't need to guess. When fClean is false, a coin already existed and
+    // it is an overwrite.
+    view.AddCoin(out, std::move(undo), !fClean);
+
+    return fClean ? DISCONNECT_OK : DISCONNECT_UNCLEAN;
 }
 
-enum DisconnectResult
+/**
+ * Apply the changes that a block makes to the UTXO set to the statistics:
+ * its spendable outputs are added and the coins that it spends removed, or
+ * the other way around when the block is disconnected.
+ */
+static void UpdateUTXOStats(CCoinsStats& stats, const CBlock& block, const CBlockUndo& blockundo, int nHeight, bool fConnect)
 {
-    DISCONNECT_OK,      // All good.
-    DISCONNECT_UNCLEAN, // Rolled back, but UTXO set was inconsistent with block.
-    DISCONNECT_FAILED   // Something else went wrong.
-};
+    for (size_t i = 0; i < block.vtx.size(); i++) {
+        const CTransaction& tx = block.vtx[i];
+        const uint256& hash = tx.GetHash();
+        for (size_t o = 0; o < tx.vout.size(); o++) {
+            if (!tx.vout[o].scriptPubKey.IsUnspendable()) {
+                Coin coin(tx.vout[o], nHeight, tx.IsCoinBase());
+                if (fConnect) {
+                    stats.AddCoin(COutPoint(hash, o), coin);
+                } else {
+                    stats.RemoveCoin(COutPoint(hash, o), coin);
+                }
+            }
+        }
+        if (i > 0) {
+            const CTxUndo& txundo = blockundo.vtxundo[i-1];
+            for (size_t j = 0; j < tx.vin.size(); j++) {
+                if (fConnect) {
+                    stats.RemoveCoin(tx.vin[j].prevout, txundo.vprevout[j]);
+                } else {
+                    stats.AddCoin(tx.vin[j].prevout, txundo.vprevout[j]);
+                }
+            }
+        }
+    }
+}
 
 /** Undo the effects of this block (with given index) on the UTXO set represented by coins.
  *  When UNCLEAN or FAILED is returned, view is left in an indeterminate state.
- *  The addressIndex and spentIndex will be updated if requested.
+ *  The addressIndex and spentIndex will be updated if requested, and so will
+ *  the UTXO set statistics if pstats is not null. The undo data of the block
+ *  is read from disk unless it is given in pblockUndo.
  */
 static DisconnectResult DisconnectBlock(const CBlock& block, CValidationState& state,
     const CBlockIndex* pindex, CCoinsViewCache& view, const CChainParams& chainparams,
-    const bool updateIndices)
+    const bool updateIndices, CCoinsStats* pstats = nullptr, const CBlockUndo* pblockUndo = nullptr)
 {
     assert(pindex->GetBlockHash() == view.GetBestBlock());
 
     bool fClean = true;
 
-    CBlockUndo blockUndo;
-    CDiskBlockPos pos = pindex->GetUndoPos();
-    if (pos.IsNull()) {
-        error("DisconnectBlock(): no undo data available");
-        return DISCONNECT_FAILED;
-    }
-    if (!UndoReadFromDisk(blockUndo, pos, pindex->pprev->GetBlockHash())) {
-        error("DisconnectBlock(): failure reading undo data");
-        return DISCONNECT_FAILED;
+    CBlockUndo blockUndoRead;
+    if (!pblockUndo) {
+        CDiskBlockPos pos = pindex->GetUndoPos();
+        if (pos.IsNull()) {
+            error("DisconnectBlock(): no undo data available");
+            return DISCONNECT_FAILED;
+        }
+        if (!UndoReadFromDisk(blockUndoRead, pos, pindex->pprev->GetBlockHash())) {
+            error("DisconnectBlock(): failure reading undo data");
+            return DISCONNECT_FAILED;
+        }
+        pblockUndo = &blockUndoRead;
     }
+    const CBlockUndo& blockUndo = *pblockUndo;
 
     if (blockUndo.vtxundo.size() + 1 != block.vtx.size()) {
         error("DisconnectBlock(): block and undo data inconsistent");
         return DISCONNECT_FAILED;
     }
-    std::vector<CAddressIndexDbEntry> addressIndex;
-    std::vector<CAddressUnspentDbEntry> addressUnspentIndex;
-    std::vector<CSpentIndexDbEntry> spentIndex;
 
     // undo transactions in reverse order
     for (int i = block.vtx.size() - 1; i >= 0; i--) {
         const CTransaction &tx = block.vtx[i];
         uint256 const hash = tx.GetHash();
 
-        // insightexplorer
-        // https://github.com/bitpay/bitcoin/commit/017f548ea6d89423ef568117447e61dd5707ec42#diff-7ec3c68a81efff79b6ca22ac1f1eabbaR2236
-        if (fAddressIndex && updateIndices) {
-            for (unsigned int k = tx.vout.size(); k-- > 0;) {
-                const CTxOut &out = tx.vout[k];
-                CScript::ScriptType scriptType = out.scriptPubKey.GetType();
-                if (scriptType != CScript::UNKNOWN) {
-                    uint160 const addrHash = out.scriptPubKey.AddressHash();
-
-                    // undo receiving activity
-                    addressIndex.push_back(make_pair(
-                        CAddressIndexKey(scriptType, addrHash, pindex->nHeight, i, hash, k, false),
-                        out.nValue));
-
-                    // undo unspent index
-                    addressUnspentIndex.push_back(make_pair(
-                        CAddressUnspentKey(scriptType, addrHash, hash, k),
-                        CAddressUnspentValue()));
-                }
-            }
-        }
-
         // Check that all outputs are available and match the outputs in the block itself
         // exactly.
-        {
-        CCoinsModifier outs = view.ModifyCoins(hash);
-        outs->ClearUnspendable();
-
-        CCoins outsBlock(tx, pindex->nHeight);
-        // The CCoins serialization does not serialize negative numbers.
-        // No network rules currently depend on the version here, so an inconsistency is harmless
-        // but it must be corrected before txout nversion ever influences a network rule.
-        if (outsBlock.nVersion < 0)
-            outs->nVersion = outsBlock.nVersion;
-        if (*outs != outsBlock)
-            fClean = fClean && error("DisconnectBlock(): added transaction mismatch? database corrupted");
-
-        // remove outputs
-        outs->Clear();
+        bool is_coinbase = tx.IsCoinBase();
+        for (size_t o = 0; o < tx.vout.size(); o++) {
+            if (!tx.vout[o].scriptPubKey.IsUnspendable()) {
+                COutPoint out(hash, o);
+                Coin coin;
+                bool is_spent = view.SpendCoin(out, &coin);
+                if (!is_spent || tx.vout[o] != coin.out || pindex->nHeight != coin.nHeight || is_coinbase != coin.fCoinBase) {
+                    fClean = fClean && error("DisconnectBlock(): added transaction mismatch? database corrupted");
+                }
+            }
         }
 
         // unspend nullifiers
@@ -2577,37 +3186,10 @@ static DisconnectResult DisconnectBlock(const CBlock& block, CValidationState& s
             }
             for (unsigned int j = tx.vin.size(); j-- > 0;) {
                 const COutPoint &out = tx.vin[j].prevout;
-                const CTxInUndo &undo = txundo.vprevout[j];
-                if (!ApplyTxInUndo(undo, view, out))
-                    fClean = false;
-
-                // insightexplorer
-                // https://github.com/bitpay/bitcoin/commit/017f548ea6d89423ef568117447e61dd5707ec42#diff-7ec3c68a81efff79b6ca22ac1f1eabbaR2304
-                const CTxIn input = tx.vin[j];
-                if (fAddressIndex && updateIndices) {
-                    const CTxOut &prevout = view.GetOutputFor(input);
-                    CScript::ScriptType scriptType = prevout.scriptPubKey.GetType();
-                    if (scriptType != CScript::UNKNOWN) {
-                        uint160 const addrHash = prevout.scriptPubKey.AddressHash();
-
-                        // undo spending activity
-                        addressIndex.push_back(make_pair(
-                            CAddressIndexKey(scriptType, addrHash, pindex->nHeight, i, hash, j, true),
-                            prevout.nValue * -1));
-
-                        // restore unspent index
-                        addressUnspentIndex.push_back(make_pair(
-                            CAddressUnspentKey(scriptType, addrHash, input.prevout.hash, input.prevout.n),
-                            CAddressUnspentValue(prevout.nValue, prevout.scriptPubKey, undo.nHeight)));
-                    }
-                }
-                // insightexplorer
-                if (fSpentIndex && updateIndices) {
-                    // undo and delete the spent index
-                    spentIndex.push_back(make_pair(
-                        CSpentIndexKey(input.prevout.hash, input.prevout.n),
-                        CSpentIndexValue()));
-                }
+                Coin undo = txundo.vprevout[j];
+                DisconnectResult res = ApplyTxInUndo(std::move(undo), view, out);
+                if (res == DISCONNECT_FAILED) return DISCONNECT_FAILED;
+                fClean = fClean && res != DISCONNECT_UNCLEAN;
             }
         }
     }
@@ -2638,8 +3220,12 @@ static DisconnectResult DisconnectBlock(const CBlock& block, CValidationState& s
     view.SetBestBlock(pindex->pprev->GetBlockHash());
 
     // insightexplorer
-    if (fAddressIndex && updateIndices) {
-        if (!pblocktree->EraseAddressIndex(addressIndex)) {
+    // Indexes that are still being built rewind on their own threads.
+    if (fAddressIndex && updateIndices && IsIndexSynced(g_addressindex)) {
+        std::vector<CAddressIndexDbEntry> addressIndex;
+        std::vector<CAddressUnspentDbEntry> addressUnspentIndex;
+        GetAddressIndexEntries(block, blockUndo, pindex->nHeight, true, addressIndex, addressUnspentIndex);
+        if (!pblocktree->EraseAddressIndex(addressIndex, fAddressBalances)) {
             AbortNode(state, "Failed to delete address index");
             return DISCONNECT_FAILED;
         }
@@ -2649,12 +3235,32 @@ static DisconnectResult DisconnectBlock(const CBlock& block, CValidationState& s
         }
     }
     // insightexplorer
-    if (fSpentIndex && updateIndices) {
+    if (fSpentIndex && updateIndices && IsIndexSynced(g_spentindex)) {
+        std::vector<CSpentIndexDbEntry> spentIndex;
+        GetSpentIndexEntries(block, blockUndo, pindex->nHeight, true, spentIndex);
         if (!pblocktree->UpdateSpentIndex(spentIndex)) {
             AbortNode(state, "Failed to write transaction index");
             return DISCONNECT_FAILED;
         }
     }
+    if (fTxIndex && updateIndices) {
+        EraseRecentTransactions(block);
+    }
+    if (fShieldedIndex && updateIndices && IsIndexSynced(g_shieldedindex)) {
+        if (!EraseShieldedIndex(block, pindex)) {
+            AbortNode(state, "Failed to write shielded index");
+            return DISCONNECT_FAILED;
+        }
+    }
+    if (fTimestampIndex) {
+        // The timestamp index keeps the entries of disconnected blocks, but
+        // lookups of the active chain no longer include them.
+        pblocktree->ClearTimestampIndexCache();
+    }
+
+    if (pstats) {
+        UpdateUTXOStats(*pstats, block, blockUndo, pindex->nHeight, false);
+    }
     return fClean ? DISCONNECT_OK : DISCONNECT_UNCLEAN;
 }
 
@@ -2683,11 +3289,193 @@ void static FlushBlockFile(bool fFinalize = false)
 
 bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos, unsigned int nAddSize);
 
-static CCheckQueue<CScriptCheck> scriptcheckqueue(128);
+/**
+ * Workers shared by the script, proof and header checks and the preparation
+ * of received messages, so that the proofs of a block are checked by the
+ * same threads as its scripts rather than by a set of threads of their own.
+ */
+static CCheckPool checkpool;
+
+void ThreadCheckPool() {
+    RenameThread("zcash-checks");
+    checkpool.Thread();
+}
+
+//! The verification threads that run checks, and the number that -par or
+//! setverificationthreads asked for.
+static std::atomic<int> nVerificationThreads{0};
+static std::atomic<int> nVerificationThreadsConfigured{0};
+
+static void ApplyVerificationThreads(int nThreads)
+{
+    nVerificationThreads = nThreads;
+    // The thread that connects blocks runs checks too, and is not a worker.
+    checkpool.SetActiveWorkers(nThreads - 1);
+    MetricsGauge("zcash.verification.threads", (double)nThreads);
+}
+
+void InitVerificationThreads(int nThreads)
+{
+    nVerificationThreadsConfigured = nThreads;
+    ApplyVerificationThreads(nThreads);
+}
+
+int GetVerificationThreads()
+{
+    return std::max(nVerificationThreads.load(), 1);
+}
+
+bool SetVerificationThreads(int nThreads)
+{
+    if (nScriptCheckThreads == 0 || nThreads < 1 || nThreads > nScriptCheckThreads) {
+        return false;
+    }
+    InitVerificationThreads(nThreads);
+    return true;
+}
+
+void AdaptVerificationThreads()
+{
+    int nThreads = GetVerificationThreads();
+    int nConfigured = nVerificationThreadsConfigured;
+    unsigned int nBacklog = checkpool.TakePeakBacklog();
+
+    // At the tip, give the cores back to RPC and the wallet at once. During
+    // initial block download, add a quarter more threads whenever more than
+    // two batches of checks per thread waited at once, and remove one when
+    // less than one did.
+    int nNext = nConfigured;
+    if (IsInitialBlockDownload(Params().GetConsensus())) {
+        nNext = nThreads;
+        if (nBacklog > 2 * (unsigned int)nThreads) {
+            nNext = std::min(nThreads + std::max(nThreads / 4, 1), nScriptCheckThreads);
+        } else if (nBacklog < (unsigned int)nThreads) {
+            nNext = std::max(nThreads - 1, nConfigured);
+        }
+    }
+    if (nNext == nThreads) {
+        return;
+    }
+
+    LogPrint("bench", "Verifying with %d threads (peak backlog %u batches)\n", nNext, nBacklog);
+    ApplyVerificationThreads(nNext);
+}
+
+static CCheckQueue<CScriptCheck> scriptcheckqueue(128, &checkpool);
+
+// Proof checks are orders of magnitude more expensive than script checks,
+// so workers take them one at a time.
+static CCheckQueue<CProofCheck> proofcheckqueue(1, &checkpool);
+
+/**
+ * Hashes of the block headers whose Equihash solutions were found valid. The
+ * hash of a header commits to its solution, so a header that arrives again,
+ * from another peer or as part of its block, is not checked again.
+ */
+static CCriticalSection cs_validSolutions;
+static lrucache<uint256, bool> validSolutions(VALID_SOLUTION_CACHE_SIZE);
+
+/** Check the Equihash solution of a header with the given hash, unless it has been found valid before. */
+static bool CheckEquihashSolutionCached(const CBlockHeader& header, const uint256& hash, const Consensus::Params& params)
+{
+    {
+        LOCK(cs_validSolutions);
+        bool fValid;
+        if (validSolutions.get(hash, fValid))
+            return true;
+    }
+    if (!CheckEquihashSolution(&header, params))
+        return false;
+    LOCK(cs_validSolutions);
+    validSolutions.put(hash, true);
+    return true;
+}
+
+/** A check of the Equihash solution and proof of work of a block header, done before it is accepted. */
+class CHeaderCheck
+{
+private:
+    const CBlockHeader *pheader;
+    uint256 hash;
+    const Consensus::Params *pparams;
+
+public:
+    CHeaderCheck() : pheader(nullptr), pparams(nullptr) {}
+    CHeaderCheck(const CBlockHeader& headerIn, const uint256& hashIn, const Consensus::Params& paramsIn) :
+        pheader(&headerIn), hash(hashIn), pparams(&paramsIn) {}
+
+    bool operator()() {
+        return CheckEquihashSolutionCached(*pheader, hash, *pparams) && CheckProofOfWork(hash, pheader->nBits, *pparams);
+    }
+
+    void swap(CHeaderCheck &check) {
+        std::swap(pheader, check.pheader);
+        std::swap(hash, check.hash);
+        std::swap(pparams, check.pparams);
+    }
+};
+
+// Each Equihash solution takes about a millisecond to check, so workers take
+// a few at a time.
+static CCheckQueue<CHeaderCheck> headercheckqueue(4, &checkpool);
+
+/** A lookup in the chain state that is done before a block is connected. */
+class CPrefetchCheck
+{
+private:
+    CCoinsPrefetch *pprefetch;
+    size_t nIndex;
+
+public:
+    CPrefetchCheck() : pprefetch(nullptr), nIndex(0) {}
+    CPrefetchCheck(CCoinsPrefetch& prefetchIn, size_t nIndexIn) : pprefetch(&prefetchIn), nIndex(nIndexIn) {}
+
+    bool operator()() {
+        pprefetch->Fetch(nIndex);
+        return true;
+    }
+
+    void swap(CPrefetchCheck &check) {
+        std::swap(pprefetch, check.pprefetch);
+        std::swap(nIndex, check.nIndex);
+    }
+};
+
+static CCheckQueue<CPrefetchCheck> prefetchqueue(16);
+
+void ThreadPrefetchCheck() {
+    RenameThread("zcash-prefetch");
+    prefetchqueue.Thread();
+}
+
+/**
+ * Read the inputs, anchors and nullifiers of a block that are not cached
+ * into pcoinsTip, in parallel, so that ConnectBlock does not have to wait
+ * for each of the reads in turn.
+ */
+static void PrefetchBlockInputs(const CBlock& block)
+{
+    AssertLockHeld(cs_main);
+    CCoinsPrefetch prefetch = pcoinsTip->GetPrefetch(block.vtx);
+    if (prefetch.size() == 0) {
+        return;
+    }
+    std::vector<CPrefetchCheck> vChecks;
+    vChecks.reserve(prefetch.size());
+    for (size_t i = 0; i < prefetch.size(); i++) {
+        vChecks.emplace_back(prefetch, i);
+    }
+    {
+        CCheckQueueControl<CPrefetchCheck> control(&prefetchqueue);
+        control.Add(vChecks);
+        control.Wait();
+    }
+    pcoinsTip->AddPrefetched(prefetch);
+}
 
-void ThreadScriptCheck() {
-    RenameThread("zcash-scriptch");
-    scriptcheckqueue.Thread();
+void ThreadFlushChainstate() {
+    RenameThread("zcash-coinsflush");
+    pcoinsSnapshot->ThreadWrite();
 }
 
 static int64_t nTimeVerify = 0;
@@ -2696,6 +3484,62 @@ static int64_t nTimeIndex = 0;
 static int64_t nTimeCallbacks = 0;
 static int64_t nTimeTotal = 0;
 
+BlockMetricsLabels::BlockMetricsLabels(const CBlock& block)
+{
+    size_t nSize = ::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION);
+    if (nSize < 10000) {
+        size = "<10k";
+    } else if (nSize < 100000) {
+        size = "10k-100k";
+    } else if (nSize < 1000000) {
+        size = "100k-1M";
+    } else {
+        size = ">=1M";
+    }
+
+    size_t nShielded = 0;
+    for (const CTransaction& tx : block.vtx) {
+        if (!(tx.vJoinSplit.empty() && tx.vShieldedSpend.empty() && tx.vShieldedOutput.empty())) {
+            nShielded++;
+        }
+    }
+    if (nShielded == 0) {
+        shielded = "0";
+    } else if (nShielded < 10) {
+        shielded = "1-9";
+    } else if (nShielded < 100) {
+        shielded = "10-99";
+    } else {
+        shielded = ">=100";
+    }
+}
+
+static CCriticalSection cs_blockStageTimes;
+static std::map<std::string, int64_t> mapBlockStageTimes;
+
+void RecordBlockStageTime(const char* stage, const BlockMetricsLabels& labels, int64_t nMicros)
+{
+    MetricsHistogram(
+        "zcash.chain.verified.block.stage.seconds", nMicros * 0.000001,
+        "stage", stage,
+        "size", labels.size,
+        "shielded", labels.shielded);
+    LOCK(cs_blockStageTimes);
+    mapBlockStageTimes[stage] += nMicros;
+}
+
+std::map<std::string, int64_t> GetBlockStageTimes()
+{
+    LOCK(cs_blockStageTimes);
+    return mapBlockStageTimes;
+}
+
+void ResetBlockStageTimes()
+{
+    LOCK(cs_blockStageTimes);
+    mapBlockStageTimes.clear();
+}
+
 /**
  * Determine whether to do transaction checks when verifying blocks.
  * Returns `false` (allowing transaction checks to be skipped) only if all
@@ -2712,9 +3556,14 @@ static bool ShouldCheckTransactions(const CChainParams& chainparams, const CBloc
 }
 
 bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex,
-                  CCoinsViewCache& view, const CChainParams& chainparams, bool fJustCheck)
+                  CCoinsViewCache& view, const CChainParams& chainparams, bool fJustCheck,
+                  CCoinsStats* pstats)
 {
     AssertLockHeld(cs_main);
+    auto span = TracingSpan("info", "main", "ConnectBlock",
+        "height", std::to_string(pindex->nHeight).c_str(),
+        "txs", std::to_string(block.vtx.size()).c_str());
+    auto spanGuard = span.Enter();
 
     bool fExpensiveChecks = true;
 
@@ -2723,6 +3572,13 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         fExpensiveChecks = false;
     }
 
+    // While -reindex-chainstate replays the chain, a block that this node
+    // connected before had its proofs and scripts checked then; CheckBlock
+    // still ties its transactions to the header through the merkle root.
+    if (fReindexChainState && pindex->IsValid(BLOCK_VALID_SCRIPTS)) {
+        fExpensiveChecks = false;
+    }
+
     // proof verification is expensive, disable if possible
     auto verifier = fExpensiveChecks ? ProofVerifier::Strict() : ProofVerifier::Disabled();
 
@@ -2730,8 +3586,14 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     // and -ibdskiptxverification is set, disable all transaction checks.
     bool fCheckTransactions = ShouldCheckTransactions(chainparams, pindex);
 
+    // If there are proof check threads, JoinSplit proofs are verified on them
+    // in parallel with the rest of ConnectBlock, rather than inline in CheckBlock.
+    bool fParallelProofs = fExpensiveChecks && fCheckTransactions && nScriptCheckThreads;
+    auto deferredVerifier = ProofVerifier::Disabled();
+
     // Check it again to verify JoinSplit proofs, and in case a previous version let a bad block in
-    if (!CheckBlock(block, state, chainparams, verifier, !fJustCheck, !fJustCheck, fCheckTransactions))
+    if (!CheckBlock(block, state, chainparams, fParallelProofs ? deferredVerifier : verifier,
+                    !fJustCheck, !fJustCheck, fCheckTransactions))
         return false;
 
     // verify that the view's current state corresponds to the previous block
@@ -2784,10 +3646,12 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     // Do not allow blocks that contain transactions which 'overwrite' older transactions,
     // unless those are already completely spent.
     for (const CTransaction& tx : block.vtx) {
-        const CCoins* coins = view.AccessCoins(tx.GetHash());
-        if (coins && !coins->IsPruned())
-            return state.DoS(100, error("ConnectBlock(): tried to overwrite transaction"),
-                             REJECT_INVALID, "bad-txns-BIP30");
+        for (size_t o = 0; o < tx.vout.size(); o++) {
+            if (view.HaveCoin(COutPoint(tx.GetHash(), o))) {
+                return state.DoS(100, error("ConnectBlock(): tried to overwrite transaction"),
+                                 REJECT_INVALID, "bad-txns-BIP30");
+            }
+        }
     }
 
     unsigned int flags = SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_CHECKLOCKTIMEVERIFY;
@@ -2798,6 +3662,17 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
     CCheckQueueControl<CScriptCheck> control(fExpensiveChecks && nScriptCheckThreads ? &scriptcheckqueue : NULL);
 
+    CCheckQueueControl<CProofCheck> proofControl(fParallelProofs ? &proofcheckqueue : NULL);
+    if (fParallelProofs) {
+        std::vector<CProofCheck> vProofChecks;
+        for (const CTransaction& tx : block.vtx) {
+            for (const JSDescription& joinsplit : tx.vJoinSplit) {
+                vProofChecks.emplace_back(joinsplit, tx.joinSplitPubKey);
+            }
+        }
+        proofControl.Add(vProofChecks);
+    }
+
     int64_t nTimeStart = GetTimeMicros();
     CAmount nFees = 0;
     int nInputs = 0;
@@ -2806,9 +3681,6 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     std::vector<std::pair<uint256, CDiskTxPos> > vPos;
     vPos.reserve(block.vtx.size());
     blockundo.vtxundo.reserve(block.vtx.size() - 1);
-    std::vector<CAddressIndexDbEntry> addressIndex;
-    std::vector<CAddressUnspentDbEntry> addressUnspentIndex;
-    std::vector<CSpentIndexDbEntry> spentIndex;
 
     // Construct the incremental merkle tree at the current
     // block position,
@@ -2828,6 +3700,11 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         assert(sprout_tree.root() == old_sprout_tree_root);
     }
 
+    // The block's note commitments are appended to the tree together, once
+    // all of its transactions have been connected.
+    std::vector<libzcash::SHA256Compress> sprout_commitments;
+    std::vector<libzcash::PedersenHash> sapling_commitments;
+
     SaplingMerkleTree sapling_tree;
     assert(view.GetSaplingAnchorAt(view.GetBestAnchor(SAPLING), sapling_tree));
 
@@ -2837,13 +3714,27 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
     size_t total_sapling_tx = 0;
 
-    std::vector<PrecomputedTransactionData> txdata;
-    txdata.reserve(block.vtx.size()); // Required so that pointers to individual PrecomputedTransactionData don't get invalidated
+    // The time spent in each stage, for the per-stage metrics
+    int64_t nTimeLookups = 0;
+    int64_t nTimeScripts = 0;
+
+    // Transactions that were in the mempool have their signature hash
+    // midstates and serialized size from admission; the others get them
+    // computed here. The script checks hold pointers to the midstates.
+    std::vector<std::shared_ptr<const PrecomputedTransactionData>> txdata;
+    txdata.reserve(block.vtx.size());
     for (unsigned int i = 0; i < block.vtx.size(); i++)
     {
         const CTransaction &tx = block.vtx[i];
         const uint256 hash = tx.GetHash();
 
+        std::shared_ptr<const PrecomputedTransactionData> ptxdata;
+        size_t nTxSize = 0;
+        if (tx.IsCoinBase() || !mempool.GetTxData(hash, ptxdata, nTxSize) || !ptxdata) {
+            ptxdata = std::make_shared<const PrecomputedTransactionData>(tx);
+            nTxSize = ::GetSerializeSize(tx, SER_DISK, CLIENT_VERSION);
+        }
+
         nInputs += tx.vin.size();
         nSigOps += GetLegacySigOpCount(tx);
         if (nSigOps > MAX_BLOCK_SIGOPS)
@@ -2852,6 +3743,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
         if (!tx.IsCoinBase())
         {
+            int64_t nTimeLookupStart = GetTimeMicros();
             if (!view.HaveInputs(tx))
                 return state.DoS(100, error("ConnectBlock(): inputs missing/spent"),
                                  REJECT_INVALID, "bad-txns-inputs-missingorspent");
@@ -2869,38 +3761,6 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
                 return state.DoS(100, false, rejectCode, rejectReason);
             }
 
-            // insightexplorer
-            // https://github.com/bitpay/bitcoin/commit/017f548ea6d89423ef568117447e61dd5707ec42#diff-7ec3c68a81efff79b6ca22ac1f1eabbaR2597
-            if (fAddressIndex || fSpentIndex) {
-                for (size_t j = 0; j < tx.vin.size(); j++) {
-
-                    const CTxIn input = tx.vin[j];
-                    const CTxOut &prevout = view.GetOutputFor(tx.vin[j]);
-                    CScript::ScriptType scriptType = prevout.scriptPubKey.GetType();
-                    const uint160 addrHash = prevout.scriptPubKey.AddressHash();
-                    if (fAddressIndex && scriptType != CScript::UNKNOWN) {
-                        // record spending activity
-                        addressIndex.push_back(make_pair(
-                            CAddressIndexKey(scriptType, addrHash, pindex->nHeight, i, hash, j, true),
-                            prevout.nValue * -1));
-
-                        // remove address from unspent index
-                        addressUnspentIndex.push_back(make_pair(
-                            CAddressUnspentKey(scriptType, addrHash, input.prevout.hash, input.prevout.n),
-                            CAddressUnspentValue()));
-                    }
-                    if (fSpentIndex) {
-                        // Add the spent index to determine the txid and input that spent an output
-                        // and to find the amount and address from an input.
-                        // If we do not recognize the script type, we still add an entry to the
-                        // spentindex db, with a script type of 0 and addrhash of all zeroes.
-                        spentIndex.push_back(make_pair(
-                            CSpentIndexKey(input.prevout.hash, input.prevout.n),
-                            CSpentIndexValue(hash, j, pindex->nHeight, prevout.nValue, scriptType, addrHash)));
-                    }
-                }
-            }
-
             // Add in sigops done by pay-to-script-hash inputs;
             // this is to prevent a "rogue miner" from creating
             // an incredibly-expensive-to-validate block.
@@ -2908,9 +3768,10 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
             if (nSigOps > MAX_BLOCK_SIGOPS)
                 return state.DoS(100, error("ConnectBlock(): too many sigops"),
                                  REJECT_INVALID, "bad-blk-sigops");
+            nTimeLookups += GetTimeMicros() - nTimeLookupStart;
         }
 
-        txdata.emplace_back(tx);
+        txdata.push_back(ptxdata);
 
         if (!tx.IsCoinBase())
         {
@@ -2918,31 +3779,11 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
             std::vector<CScriptCheck> vChecks;
             bool fCacheResults = fJustCheck; /* Don't cache results if we're actually connecting blocks (still consult the cache, though) */
-            if (!ContextualCheckInputs(tx, state, view, fExpensiveChecks, flags, fCacheResults, txdata[i], chainparams.GetConsensus(), consensusBranchId, nScriptCheckThreads ? &vChecks : NULL))
+            int64_t nTimeScriptStart = GetTimeMicros();
+            if (!ContextualCheckInputs(tx, state, view, fExpensiveChecks, flags, fCacheResults, *txdata[i], chainparams.GetConsensus(), consensusBranchId, nScriptCheckThreads ? &vChecks : NULL))
                 return false;
             control.Add(vChecks);
-        }
-
-        // insightexplorer
-        // https://github.com/bitpay/bitcoin/commit/017f548ea6d89423ef568117447e61dd5707ec42#diff-7ec3c68a81efff79b6ca22ac1f1eabbaR2656
-        if (fAddressIndex) {
-            for (unsigned int k = 0; k < tx.vout.size(); k++) {
-                const CTxOut &out = tx.vout[k];
-                CScript::ScriptType scriptType = out.scriptPubKey.GetType();
-                if (scriptType != CScript::UNKNOWN) {
-                    uint160 const addrHash = out.scriptPubKey.AddressHash();
-
-                    // record receiving activity
-                    addressIndex.push_back(make_pair(
-                        CAddressIndexKey(scriptType, addrHash, pindex->nHeight, i, hash, k, false),
-                        out.nValue));
-
-                    // record unspent output
-                    addressUnspentIndex.push_back(make_pair(
-                        CAddressUnspentKey(scriptType, addrHash, hash, k),
-                        CAddressUnspentValue(out.nValue, out.scriptPubKey, pindex->nHeight)));
-                }
-            }
+            nTimeScripts += GetTimeMicros() - nTimeScriptStart;
         }
 
         CTxUndo undoDummy;
@@ -2953,26 +3794,31 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
         for (const JSDescription &joinsplit : tx.vJoinSplit) {
             for (const uint256 &note_commitment : joinsplit.commitments) {
-                // Insert the note commitments into our temporary tree.
-
-                sprout_tree.append(note_commitment);
+                sprout_commitments.push_back(note_commitment);
             }
         }
 
         for (const OutputDescription &outputDescription : tx.vShieldedOutput) {
-            sapling_tree.append(outputDescription.cmu);
+            sapling_commitments.push_back(outputDescription.cmu);
         }
 
         if (!(tx.vShieldedSpend.empty() && tx.vShieldedOutput.empty())) {
             total_sapling_tx += 1;
         }
 
+        pos.nTxSize = nTxSize;
         vPos.push_back(std::make_pair(tx.GetHash(), pos));
-        pos.nTxOffset += ::GetSerializeSize(tx, SER_DISK, CLIENT_VERSION);
+        pos.nTxOffset += nTxSize;
     }
 
+    // Insert the note commitments into our temporary tree.
+    int64_t nTimeTreesStart = GetTimeMicros();
+    sprout_tree.append_many(sprout_commitments);
+    sapling_tree.append_many(sapling_commitments);
+
     view.PushAnchor(sprout_tree);
     view.PushAnchor(sapling_tree);
+    int64_t nTimeTrees = GetTimeMicros() - nTimeTreesStart;
     if (!fJustCheck) {
         pindex->hashFinalSproutRoot = sprout_tree.root();
         // - If this block is before Heartwood activation, then we don't set
@@ -3021,6 +3867,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     }
 
     // History read/write is started with Heartwood update.
+    int64_t nTimeHistoryStart = GetTimeMicros();
     if (chainparams.GetConsensus().NetworkUpgradeActive(pindex->nHeight, Consensus::UPGRADE_HEARTWOOD)) {
         auto historyNode = libzcash::NewLeaf(
             block.GetHash(),
@@ -3036,6 +3883,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     }
 
     int64_t nTime1 = GetTimeMicros(); nTimeConnect += nTime1 - nTimeStart;
+    int64_t nTimeHistory = nTime1 - nTimeHistoryStart;
     LogPrint("bench", "      - Connect %u transactions: %.2fms (%.3fms/tx, %.3fms/txin) [%.2fs]\n", (unsigned)block.vtx.size(), 0.001 * (nTime1 - nTimeStart), 0.001 * (nTime1 - nTimeStart) / block.vtx.size(), nInputs <= 1 ? 0 : 0.001 * (nTime1 - nTimeStart) / (nInputs-1), nTimeConnect * 0.000001);
 
     CAmount blockReward = nFees + GetBlockSubsidy(pindex->nHeight, chainparams.GetConsensus());
@@ -3045,8 +3893,14 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
                                block.vtx[0].GetValueOut(), blockReward),
                                REJECT_INVALID, "bad-cb-amount");
 
+    int64_t nTimeWaitStart = GetTimeMicros();
     if (!control.Wait())
         return state.DoS(100, false);
+    int64_t nTimeProofStart = GetTimeMicros();
+    nTimeScripts += nTimeProofStart - nTimeWaitStart;
+    if (!proofControl.Wait())
+        return state.DoS(100, error("ConnectBlock(): joinsplit does not verify"),
+                         REJECT_INVALID, "bad-txns-joinsplit-verification-failed");
     int64_t nTime2 = GetTimeMicros(); nTimeVerify += nTime2 - nTimeStart;
     LogPrint("bench", "    - Verify %u txins: %.2fms (%.3fms/txin) [%.2fs]\n", nInputs - 1, 0.001 * (nTime2 - nTimeStart), nInputs <= 1 ? 0 : 0.001 * (nTime2 - nTimeStart) / (nInputs-1), nTimeVerify * 0.000001);
 
@@ -3058,9 +3912,11 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     {
         if (pindex->GetUndoPos().IsNull()) {
             CDiskBlockPos _pos;
-            if (!FindUndoPos(state, pindex->nFile, _pos, ::GetSerializeSize(blockundo, SER_DISK, CLIENT_VERSION) + 40))
+            std::vector<char> vCompressed;
+            unsigned int nUndoSize = CompressForDisk(blockundo, vCompressed) ? vCompressed.size() : ::GetSerializeSize(blockundo, SER_DISK, CLIENT_VERSION);
+            if (!FindUndoPos(state, pindex->nFile, _pos, nUndoSize + 40))
                 return error("ConnectBlock(): FindUndoPos failed");
-            if (!UndoWriteToDisk(blockundo, _pos, pindex->pprev->GetBlockHash(), chainparams.MessageStart()))
+            if (!UndoWriteToDisk(blockundo, vCompressed, _pos, pindex->pprev->GetBlockHash(), chainparams.MessageStart()))
                 return AbortNode(state, "Failed to write undo data");
 
             // update nUndoPos in block index
@@ -3083,49 +3939,57 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         setDirtyBlockIndex.insert(pindex);
     }
 
-    if (fTxIndex)
+    // Indexes that are still being built are written by their own threads.
+    if (fTxIndex && IsIndexSynced(g_txindex))
         if (!pblocktree->WriteTxIndex(vPos))
             return AbortNode(state, "Failed to write transaction index");
+    if (fTxIndex)
+        AddRecentTransactions(block, vPos, pindex->GetBlockHash());
+
+    if (fCompactBlockIndex)
+        if (!pblocktree->WriteCompactBlock(pindex->GetBlockHash(), CCompactBlock(block)))
+            return AbortNode(state, "Failed to write compact block index");
+
+    if (fBlockFilterIndex && IsIndexSynced(g_blockfilterindex))
+        if (!WriteBlockFilterIndex(block, blockundo, pindex))
+            return AbortNode(state, "Failed to write block filter index");
+
+    if (fShieldedIndex && IsIndexSynced(g_shieldedindex))
+        if (!WriteShieldedIndex(block, pindex))
+            return AbortNode(state, "Failed to write shielded index");
 
     // START insightexplorer
-    if (fAddressIndex) {
-        if (!pblocktree->WriteAddressIndex(addressIndex)) {
+    if (fAddressIndex && IsIndexSynced(g_addressindex)) {
+        std::vector<CAddressIndexDbEntry> addressIndex;
+        std::vector<CAddressUnspentDbEntry> addressUnspentIndex;
+        GetAddressIndexEntries(block, blockundo, pindex->nHeight, false, addressIndex, addressUnspentIndex);
+        if (!pblocktree->WriteAddressIndex(addressIndex, fAddressBalances)) {
             return AbortNode(state, "Failed to write address index");
         }
         if (!pblocktree->UpdateAddressUnspentIndex(addressUnspentIndex)) {
             return AbortNode(state, "Failed to write address unspent index");
         }
     }
-    if (fSpentIndex) {
+    if (fSpentIndex && IsIndexSynced(g_spentindex)) {
+        std::vector<CSpentIndexDbEntry> spentIndex;
+        GetSpentIndexEntries(block, blockundo, pindex->nHeight, false, spentIndex);
         if (!pblocktree->UpdateSpentIndex(spentIndex)) {
             return AbortNode(state, "Failed to write spent index");
         }
     }
-    if (fTimestampIndex) {
-        unsigned int logicalTS = pindex->nTime;
-        unsigned int prevLogicalTS = 0;
-
-        // retrieve logical timestamp of the previous block
-        if (pindex->pprev)
-            if (!pblocktree->ReadTimestampBlockIndex(pindex->pprev->GetBlockHash(), prevLogicalTS))
-                LogPrintf("%s: Failed to read previous block's logical timestamp\n", __func__);
-
-        if (logicalTS <= prevLogicalTS) {
-            logicalTS = prevLogicalTS + 1;
-            LogPrintf("%s: Previous logical timestamp is newer Actual[%d] prevLogical[%d] Logical[%d]\n", __func__, pindex->nTime, prevLogicalTS, logicalTS);
-        }
-
-        if (!pblocktree->WriteTimestampIndex(CTimestampIndexKey(logicalTS, pindex->GetBlockHash())))
+    if (fTimestampIndex && IsIndexSynced(g_timestampindex)) {
+        if (!UpdateTimestampIndex(pindex))
             return AbortNode(state, "Failed to write timestamp index");
-
-        if (!pblocktree->WriteTimestampBlockIndex(CTimestampBlockIndexKey(pindex->GetBlockHash()), CTimestampBlockIndexValue(logicalTS)))
-            return AbortNode(state, "Failed to write blockhash index");
     }
     // END insightexplorer
 
     // add this block to the view's block chain
     view.SetBestBlock(pindex->GetBlockHash());
 
+    if (pstats) {
+        UpdateUTXOStats(*pstats, block, blockundo, pindex->nHeight, true);
+    }
+
     int64_t nTime3 = GetTimeMicros(); nTimeIndex += nTime3 - nTime2;
     LogPrint("bench", "    - Index writing: %.2fms [%.2fs]\n", 0.001 * (nTime3 - nTime2), nTimeIndex * 0.000001);
 
@@ -3137,6 +4001,18 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     int64_t nTime4 = GetTimeMicros(); nTimeCallbacks += nTime4 - nTime3;
     LogPrint("bench", "    - Callbacks: %.2fms [%.2fs]\n", 0.001 * (nTime4 - nTime3), nTimeCallbacks * 0.000001);
 
+    // The script checks and JoinSplit proofs run on the check threads
+    // alongside the loop above, so their stages are the time spent on them
+    // inline plus the time spent waiting for the threads to finish.
+    BlockMetricsLabels metricsLabels(block);
+    RecordBlockStageTime("lookups", metricsLabels, nTimeLookups);
+    RecordBlockStageTime("scripts", metricsLabels, nTimeScripts);
+    RecordBlockStageTime("sprout_proofs", metricsLabels, nTime2 - nTimeProofStart);
+    RecordBlockStageTime("trees", metricsLabels, nTimeTrees);
+    RecordBlockStageTime("history_tree", metricsLabels, nTimeHistory);
+    RecordBlockStageTime("index", metricsLabels, nTime3 - nTime2);
+    RecordBlockStageTime("callbacks", metricsLabels, nTime4 - nTime3);
+
     return true;
 }
 
@@ -3163,6 +4039,10 @@ bool static FlushStateToDisk(
     std::set<int> setFilesToPrune;
     bool fFlushForPrune = false;
     try {
+    // Release the previous chain state flush once it has been written in the
+    // background, so that its memory is freed as early as possible.
+    if (pcoinsSnapshot && !pcoinsSnapshot->ReleaseIfWritten())
+        return AbortNode(state, "Failed to write to coin database");
     if (fPruneMode && fCheckForPruning && !fReindex) {
         FindFilesToPrune(setFilesToPrune, chainparams.PruneAfterHeight());
         fCheckForPruning = false;
@@ -3209,14 +4089,21 @@ bool static FlushStateToDisk(
                 it = setDirtyFileInfo.erase(it);
             }
             std::vector<const CBlockIndex*> vBlocks;
+            std::vector<CBlockIndex*> vWritten;
             vBlocks.reserve(setDirtyBlockIndex.size());
+            vWritten.reserve(setDirtyBlockIndex.size());
             for (set<CBlockIndex*>::iterator it = setDirtyBlockIndex.begin(); it != setDirtyBlockIndex.end(); ) {
                 vBlocks.push_back(*it);
+                vWritten.push_back(*it);
                 it = setDirtyBlockIndex.erase(it);
             }
             if (!pblocktree->WriteBatchSync(vFiles, nLastBlockFile, vBlocks)) {
                 return AbortNode(state, "Files to write to block index database");
             }
+            // The Equihash solutions can now be read back from disk when needed.
+            for (CBlockIndex* pindex : vWritten) {
+                pindex->TrimSolution();
+            }
         }
         // Finally remove any pruned files
         if (fFlushForPrune)
@@ -3225,17 +4112,34 @@ bool static FlushStateToDisk(
     }
     // Flush best chain related state. This can only be done if the blocks / block index write was also done.
     if (fDoFullFlush) {
-        // Typical CCoins structures on disk are around 128 bytes in size.
+        // Typical Coin structures on disk are around 48 bytes in size.
         // Pushing a new one to the database can cause it to be written
         // twice (once in the log, and once in the tables). This is already
         // an overestimation, as most will delete an existing entry or
         // overwrite one. Still, use a conservative safety factor of 2.
-        if (!CheckDiskSpace(128 * 2 * 2 * pcoinsTip->GetCacheSize()))
+        if (!CheckDiskSpace(48 * 2 * 2 * pcoinsTip->GetCacheSize()))
             return state.Error("out of disk space");
         // Flush the chainstate (which may refer to block index entries).
-        if (!pcoinsTip->Flush())
+        // Unless we are asked to write everything out, keep the youngest
+        // coins cached so that the blocks after the flush do not have to
+        // read them back from disk.
+        if (fChainstateBulkWrite)
+            pcoinsdbview->SetBulkWrite(fReindex || IsInitialBlockDownload(chainparams.GetConsensus()));
+        bool fSyncOk = (nCoinCacheKeepUsage > 0 && mode != FLUSH_STATE_ALWAYS) ?
+            pcoinsTip->Sync(nCoinCacheKeepUsage) :
+            pcoinsTip->Flush();
+        // With -asyncflush the chainstate is written in the background,
+        // except when we are asked to write everything out now.
+        if (fSyncOk && pcoinsSnapshot && mode == FLUSH_STATE_ALWAYS)
+            fSyncOk = pcoinsSnapshot->Finish();
+        if (!fSyncOk)
             return AbortNode(state, "Failed to write to coin database");
+        // The statistics are written after the chainstate, and are only
+        // used at startup if they are for the best block in the chainstate.
+        if (fUTXOStats && !pblocktree->WriteUTXOStats(utxoStats))
+            return AbortNode(state, "Failed to write UTXO set statistics");
         nLastFlush = nNow;
+        nCoinsCacheFlushes++;
     }
     // Don't flush the wallet witness cache (SetBestChain()) here, see #4301
     } catch (const std::runtime_error& e) {
@@ -3244,6 +4148,40 @@ bool static FlushStateToDisk(
     return true;
 }
 
+bool LoadUTXOStats()
+{
+    AssertLockHeld(cs_main);
+    uint256 hashBestBlock = pcoinsTip->GetBestBlock();
+    if (pblocktree->ReadUTXOStats(utxoStats) && utxoStats.hashBlock == hashBestBlock) {
+        return true;
+    }
+    utxoStats = CCoinsStats();
+    if (hashBestBlock.IsNull()) {
+        // The chainstate is empty.
+        return true;
+    }
+    // The statistics are computed from the coins database, so the cache
+    // must be written out first.
+    FlushStateToDisk();
+    LogPrintf("Computing the UTXO set statistics...\n");
+    CCoinsStats stats;
+    if (!pcoinsTip->GetStats(stats)) {
+        return false;
+    }
+    utxoStats = std::move(stats);
+    return true;
+}
+
+bool GetUTXOStats(CCoinsStats& stats)
+{
+    LOCK(cs_main);
+    if (!fUTXOStats || utxoStats.hashBlock.IsNull()) {
+        return false;
+    }
+    stats = utxoStats;
+    return true;
+}
+
 void FlushStateToDisk() {
     CValidationState state;
     FlushStateToDisk(Params(), state, FLUSH_STATE_ALWAYS);
@@ -3255,6 +4193,98 @@ void PruneAndFlush() {
     FlushStateToDisk(Params(), state, FLUSH_STATE_NONE);
 }
 
+static CCacheBudgets cacheBudgetsConfigured;
+static CCacheBudgets cacheBudgets;
+static int64_t nCacheBudgetCoinCacheKeep = 0;
+
+void InitCacheBudgets(const CCacheBudgets& budgets, int64_t nCoinCacheKeep) {
+    LOCK(cs_main);
+    cacheBudgetsConfigured = budgets;
+    cacheBudgets = budgets;
+    nCacheBudgetCoinCacheKeep = nCoinCacheKeep;
+}
+
+void RebalanceCaches() {
+    // The counters of the caches only grow, so what they did is the change since the last call.
+    static const CCoinsViewCache* pcoinsLast = nullptr;
+    static uint64_t nCoinsHitsLast = 0, nCoinsMissesLast = 0;
+    static uint64_t nChainstateReadsLast = 0, nChainstateFileReadsLast = 0;
+
+    CCacheObservations observations;
+    CCacheBudgets next;
+    {
+        LOCK(cs_main);
+        if (pcoinsTip == nullptr || pcoinsdbview == nullptr || cacheBudgets.Total() == 0) {
+            return;
+        }
+        observations.fInitialBlockDownload = IsInitialBlockDownload(Params().GetConsensus());
+
+        uint64_t nCoinsHits = pcoinsTip->GetCacheHits();
+        uint64_t nCoinsMisses = pcoinsTip->GetCacheMisses();
+        if (pcoinsTip != pcoinsLast) {
+            pcoinsLast = pcoinsTip;
+            nCoinsHitsLast = 0;
+            nCoinsMissesLast = 0;
+        }
+        observations.nCoinsHits = nCoinsHits - nCoinsHitsLast;
+        observations.nCoinsMisses = nCoinsMisses - nCoinsMissesLast;
+        nCoinsHitsLast = nCoinsHits;
+        nCoinsMissesLast = nCoinsMisses;
+
+        uint64_t nChainstateReads = 0, nChainstateFileReads = 0;
+        for (const auto& item : pcoinsdbview->GetReadStats()) {
+            nChainstateReads += item.second.nReads;
+            nChainstateFileReads += item.second.nFileReads;
+        }
+        if (nChainstateReads < nChainstateReadsLast) {
+            nChainstateReadsLast = 0;
+            nChainstateFileReadsLast = 0;
+        }
+        observations.nChainstateReads = nChainstateReads - nChainstateReadsLast;
+        observations.nChainstateFileReads = nChainstateFileReads - nChainstateFileReadsLast;
+        nChainstateReadsLast = nChainstateReads;
+        nChainstateFileReadsLast = nChainstateFileReads;
+
+        observations.nMempoolCost = mempool.GetMempoolCost();
+        next = RebalanceCacheBudgets(cacheBudgets, cacheBudgetsConfigured, observations);
+        if (next == cacheBudgets) {
+            return;
+        }
+
+        cacheBudgets = next;
+        nCoinCacheUsage = next.nCoinsCache;
+        nCoinCacheKeepUsage = nCoinCacheUsage / 100 * nCacheBudgetCoinCacheKeep;
+        pcoinsdbview->SetBlockCacheSize(next.nChainstateBlockCache);
+        mempool.ResizeMempoolCostLimit(next.nMempool);
+    }
+
+    LogPrint("coindb", "Rebalanced caches: UTXO set %.1fMiB, chain state block cache %.1fMiB, mempool %.1fMiB\n",
+        next.nCoinsCache * (1.0 / 1024 / 1024),
+        next.nChainstateBlockCache * (1.0 / 1024 / 1024),
+        next.nMempool * (1.0 / 1024 / 1024));
+    MetricsGauge("zcash.cache.budget.bytes", (double)next.nCoinsCache, "cache", "coins");
+    MetricsGauge("zcash.cache.budget.bytes", (double)next.nChainstateBlockCache, "cache", "chainstate_blocks");
+    MetricsGauge("zcash.cache.budget.bytes", (double)next.nMempool, "cache", "mempool");
+}
+
+void WriteBlockIndexCache() {
+    AssertLockHeld(cs_main);
+    // The cache must match the database, so nothing can be left to flush.
+    if (!GetBoolArg("-blockindexcache", DEFAULT_BLOCK_INDEX_CACHE) || !setDirtyBlockIndex.empty()) {
+        return;
+    }
+
+    int64_t nStart = GetTimeMillis();
+    std::vector<const CBlockIndex*> vBlocks;
+    vBlocks.reserve(mapBlockIndex.size());
+    for (const auto& entry : mapBlockIndex) {
+        vBlocks.push_back(entry.second);
+    }
+    if (pblocktree->WriteBlockIndexCache(vBlocks)) {
+        LogPrintf("Wrote %u block index entries to the cache: %dms\n", vBlocks.size(), GetTimeMillis() - nStart);
+    }
+}
+
 struct PoolMetrics {
     std::optional<size_t> created;
     std::optional<size_t> spent;
@@ -3373,54 +4403,342 @@ void static UpdateTip(CBlockIndex *pindexNew, const CChainParams& chainParams) {
     cvBlockChange.notify_all();
 }
 
+/** Maximum memory used by the transactions of disconnected blocks that wait to be re-admitted to the mempool. */
+static const size_t MAX_DISCONNECTED_TX_POOL_SIZE = 20 * 1000000;
+
 /**
- * Disconnect chainActive's tip. You probably want to call mempool.removeForReorg and
- * mempool.removeWithoutBranchId after this, with cs_main held.
+ * The transactions of the blocks that a reorg disconnects from chainActive,
+ * and the note commitment tree roots that stopped being the tip anchors, kept
+ * until the blocks of the new chain have been connected. Parents come before
+ * their children: the transactions of each disconnected block are put in
+ * front of those of the blocks disconnected before it.
  */
-bool static DisconnectTip(CValidationState &state, const CChainParams& chainparams, bool fBare = false)
+struct CDisconnectedBlockTransactions
 {
-    CBlockIndex *pindexDelete = chainActive.Tip();
-    assert(pindexDelete);
-    // Read block from disk.
-    CBlock block;
-    if (!ReadBlockFromDisk(block, pindexDelete, chainparams.GetConsensus()))
-        return AbortNode(state, "Failed to read block");
-    // Apply the block atomically to the chain state.
-    uint256 sproutAnchorBeforeDisconnect = pcoinsTip->GetBestAnchor(SPROUT);
-    uint256 saplingAnchorBeforeDisconnect = pcoinsTip->GetBestAnchor(SAPLING);
-    int64_t nStart = GetTimeMicros();
-    {
-        CCoinsViewCache view(pcoinsTip);
-        // insightexplorer: update indices (true)
-        if (DisconnectBlock(block, state, pindexDelete, view, chainparams, true) != DISCONNECT_OK)
-            return error("DisconnectTip(): DisconnectBlock %s failed", pindexDelete->GetBlockHash().ToString());
-        assert(view.Flush());
+    std::deque<CTransaction> queuedTx;
+    size_t cachedInnerUsage = 0;
+    std::set<uint256> setSproutAnchors;
+    std::set<uint256> setSaplingAnchors;
+};
+
+void CacheTransactionProofs(const std::vector<const CTransaction*>& vtx, uint32_t consensusBranchId)
+{
+    if (!nScriptCheckThreads) {
+        return;
     }
-    LogPrint("bench", "- Disconnect block: %.2fms\n", (GetTimeMicros() - nStart) * 0.001);
-    uint256 sproutAnchorAfterDisconnect = pcoinsTip->GetBestAnchor(SPROUT);
+
+    std::vector<ProofVerifier> saplingVerifiers;
+    int nVerifiers = GetVerificationThreads();
+    saplingVerifiers.reserve(nVerifiers);
+    for (int i = 0; i < nVerifiers; i++) {
+        saplingVerifiers.push_back(ProofVerifier::Batched());
+    }
+    size_t nSaplingTxs = 0;
+    std::vector<CProofCheck> vProofChecks;
+    for (const CTransaction* ptx : vtx) {
+        const CTransaction& tx = *ptx;
+        for (const JSDescription& joinsplit : tx.vJoinSplit) {
+            vProofChecks.emplace_back(joinsplit, tx.joinSplitPubKey, true);
+        }
+        if (!tx.vShieldedSpend.empty() || !tx.vShieldedOutput.empty()) {
+            // Empty output script.
+            CScript scriptCode;
+            uint256 dataToBeSigned;
+            try {
+                dataToBeSigned = SignatureHash(scriptCode, tx, NOT_AN_INPUT, SIGHASH_ALL, 0, consensusBranchId);
+            } catch (std::logic_error ex) {
+                continue;
+            }
+            saplingVerifiers[nSaplingTxs++ % saplingVerifiers.size()].VerifySapling(tx, dataToBeSigned, true);
+        }
+    }
+    if (vProofChecks.empty() && nSaplingTxs == 0) {
+        return;
+    }
+    for (auto& saplingVerifier : saplingVerifiers) {
+        vProofChecks.emplace_back(saplingVerifier);
+    }
+    // The outcome does not matter: AcceptToMemoryPool verifies every proof
+    // that this did not store in the cache.
+    CCheckQueueControl<CProofCheck> proofControl(&proofcheckqueue);
+    proofControl.Add(vProofChecks);
+    proofControl.Wait();
+}
+
+/**
+ * Put the transactions of the blocks disconnected by a reorg back into the
+ * mempool, and remove the mempool transactions that the reorg has made
+ * invalid. Called once the blocks of the new chain have been connected, so
+ * that transactions which the new chain also contains are not re-admitted
+ * only to be removed again.
+ */
+static void UpdateMempoolForReorg(const CChainParams& chainparams, CDisconnectedBlockTransactions& disconnectpool)
+{
+    AssertLockHeld(cs_main);
+    int64_t nStart = GetTimeMicros();
+    int nextBlockHeight = chainActive.Height() + 1;
+    auto consensusBranchId = CurrentEpochBranchId(nextBlockHeight, chainparams.GetConsensus());
+
+    // Skip the transactions whose nullifiers the new chain has already
+    // revealed; they cannot be re-admitted.
+    std::vector<const CTransaction*> vtxProofs;
+    for (const CTransaction& tx : disconnectpool.queuedTx) {
+        bool fSpent = false;
+        for (const JSDescription& joinsplit : tx.vJoinSplit) {
+            for (const uint256& nf : joinsplit.nullifiers) {
+                fSpent = fSpent || pcoinsTip->GetNullifier(nf, SPROUT);
+            }
+        }
+        for (const SpendDescription& spendDescription : tx.vShieldedSpend) {
+            fSpent = fSpent || pcoinsTip->GetNullifier(spendDescription.nullifier, SAPLING);
+        }
+        if (!fSpent) {
+            vtxProofs.push_back(&tx);
+        }
+    }
+    CacheTransactionProofs(vtxProofs, consensusBranchId);
+
+    size_t nResurrected = 0;
+    for (const CTransaction& tx : disconnectpool.queuedTx) {
+        // ignore validation errors in resurrected transactions
+        list<CTransaction> removed;
+        CValidationState stateDummy;
+        if (AcceptToMemoryPool(chainparams, mempool, stateDummy, tx, false, NULL)) {
+            nResurrected++;
+        } else {
+            mempool.remove(tx, removed, true);
+        }
+    }
+
+    // The anchors of the disconnected blocks may not have changed between
+    // them, or the new chain may have them too, in which case the mempool
+    // transactions that use them are still valid.
+    std::set<uint256> setInvalidSproutAnchors;
+    for (const uint256& root : disconnectpool.setSproutAnchors) {
+        SproutMerkleTree tree;
+        if (!pcoinsTip->GetSproutAnchorAt(root, tree)) {
+            setInvalidSproutAnchors.insert(root);
+        }
+    }
+    std::set<uint256> setInvalidSaplingAnchors;
+    for (const uint256& root : disconnectpool.setSaplingAnchors) {
+        SaplingMerkleTree tree;
+        if (!pcoinsTip->GetSaplingAnchorAt(root, tree)) {
+            setInvalidSaplingAnchors.insert(root);
+        }
+    }
+    mempool.removeForReorg(pcoinsTip, nextBlockHeight, STANDARD_LOCKTIME_VERIFY_FLAGS,
+                           setInvalidSproutAnchors, setInvalidSaplingAnchors, consensusBranchId);
+
+    LogPrint("bench", "- Update mempool after reorg: %.2fms (%u of %u txs resurrected)\n",
+             (GetTimeMicros() - nStart) * 0.001, nResurrected, disconnectpool.queuedTx.size());
+    disconnectpool = CDisconnectedBlockTransactions();
+}
+
+/** Number of threads reading the blocks of a reorg ahead of DisconnectTip() */
+static const int DISCONNECT_PREFETCH_THREADS = 4;
+/** Maximum number of blocks whose data is read ahead of the block being disconnected */
+static const size_t MAX_DISCONNECT_PREFETCH_BLOCKS = 16;
+
+/**
+ * Reads the blocks and undo data of the blocks from the tip of the active
+ * chain down to a fork point on a few threads, ahead of DisconnectTip()
+ * disconnecting them one at a time. The positions of the data are copied
+ * from the block index when it is constructed, so the threads do not need
+ * cs_main.
+ */
+class CDisconnectPrefetcher
+{
+private:
+    struct Entry {
+        uint256 hash;
+        uint256 hashPrev;
+        CDiskBlockPos blockPos;
+        CDiskBlockPos undoPos;
+        bool fDone = false;
+        bool fRead = false;
+        CBlock block;
+        CBlockUndo blockUndo;
+    };
+
+    const Consensus::Params& consensusParams;
+    //! The blocks to be disconnected, the tip first.
+    std::vector<Entry> vEntries;
+
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    //! The next block to read.
+    size_t nNextRead = 0;
+    //! The next block to be taken by DisconnectTip().
+    size_t nNextTake = 0;
+    bool fStop = false;
+
+    boost::thread_group threadGroup;
+
+    void ThreadRead()
+    {
+        while (true) {
+            size_t i;
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                // Only read a bounded number of blocks ahead, to bound the memory used.
+                while (!fStop && nNextRead < vEntries.size() && nNextRead >= nNextTake + MAX_DISCONNECT_PREFETCH_BLOCKS) {
+                    cond.wait(lock);
+                }
+                if (fStop || nNextRead >= vEntries.size()) {
+                    return;
+                }
+                i = nNextRead++;
+            }
+
+            // The entry is only touched by this thread until it is done.
+            Entry& entry = vEntries[i];
+            bool fRead = ReadBlockFromDisk(entry.block, entry.blockPos, consensusParams) &&
+                entry.block.GetHash() == entry.hash &&
+                !entry.undoPos.IsNull() &&
+                UndoReadFromDisk(entry.blockUndo, entry.undoPos, entry.hashPrev);
+
+            boost::unique_lock<boost::mutex> lock(mutex);
+            entry.fDone = true;
+            entry.fRead = fRead;
+            cond.notify_all();
+        }
+    }
+
+public:
+    CDisconnectPrefetcher(const CChainParams& chainparams, const CBlockIndex* pindexTip, const CBlockIndex* pindexFork) :
+        consensusParams(chainparams.GetConsensus())
+    {
+        AssertLockHeld(cs_main);
+        for (const CBlockIndex* pindex = pindexTip; pindex && pindex != pindexFork && pindex->pprev; pindex = pindex->pprev) {
+            // DisconnectTip() fails at a block whose data has been pruned.
+            if (!(pindex->nStatus & BLOCK_HAVE_DATA) || !(pindex->nStatus & BLOCK_HAVE_UNDO)) {
+                break;
+            }
+            Entry entry;
+            entry.hash = pindex->GetBlockHash();
+            entry.hashPrev = pindex->pprev->GetBlockHash();
+            entry.blockPos = pindex->GetBlockPos();
+            entry.undoPos = pindex->GetUndoPos();
+            vEntries.push_back(std::move(entry));
+        }
+        int nThreads = std::min<int>(DISCONNECT_PREFETCH_THREADS, vEntries.size());
+        for (int i = 0; i < nThreads; i++) {
+            threadGroup.create_thread(boost::bind(&CDisconnectPrefetcher::ThreadRead, this));
+        }
+    }
+
+    ~CDisconnectPrefetcher()
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            fStop = true;
+            cond.notify_all();
+        }
+        threadGroup.join_all();
+    }
+
+    /**
+     * Take the data of pindex, which must be the next block to be
+     * disconnected, waiting for it to be read. Returns false if the data
+     * could not be read, or if pindex is not the next block of the range, in
+     * which case the caller reads the data itself.
+     */
+    bool Take(const CBlockIndex* pindex, CBlock& block, CBlockUndo& blockUndo)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (nNextTake >= vEntries.size() || vEntries[nNextTake].hash != pindex->GetBlockHash()) {
+            return false;
+        }
+        Entry& entry = vEntries[nNextTake];
+        while (!entry.fDone) {
+            cond.wait(lock);
+        }
+        nNextTake++;
+        cond.notify_all();
+        if (!entry.fRead) {
+            return false;
+        }
+        block = std::move(entry.block);
+        blockUndo = std::move(entry.blockUndo);
+        return true;
+    }
+};
+
+/**
+ * Disconnect chainActive's tip. Unless pdisconnectpool is NULL, the transactions
+ * of the block are added to it, and you probably want to call UpdateMempoolForReorg
+ * after this, with cs_main held. The block and its undo data are taken from
+ * pprefetcher if it is not NULL and has read them.
+ */
+bool static DisconnectTip(CValidationState &state, const CChainParams& chainparams, CDisconnectedBlockTransactions* pdisconnectpool,
+    CDisconnectPrefetcher* pprefetcher = nullptr)
+{
+    CBlockIndex *pindexDelete = chainActive.Tip();
+    assert(pindexDelete);
+    auto span = TracingSpan("info", "main", "DisconnectTip",
+        "height", std::to_string(pindexDelete->nHeight).c_str());
+    auto spanGuard = span.Enter();
+    // The blocks before the base of a UTXO set snapshot are not stored.
+    if (pindexDelete == pindexSnapshotBase)
+        return error("DisconnectTip(): cannot disconnect the base of the UTXO set snapshot %s", pindexDelete->GetBlockHash().ToString());
+    // Read block from disk, unless it has been read ahead.
+    CBlock block;
+    CBlockUndo blockUndo;
+    bool fPrefetched = pprefetcher && pprefetcher->Take(pindexDelete, block, blockUndo);
+    if (!fPrefetched && !ReadBlockFromDisk(block, pindexDelete, chainparams.GetConsensus()))
+        return AbortNode(state, "Failed to read block");
+    // Apply the block atomically to the chain state.
+    uint256 sproutAnchorBeforeDisconnect = pcoinsTip->GetBestAnchor(SPROUT);
+    uint256 saplingAnchorBeforeDisconnect = pcoinsTip->GetBestAnchor(SAPLING);
+    int64_t nStart = GetTimeMicros();
+    {
+        CCoinsViewCache view(pcoinsTip);
+        CCoinsStats stats;
+        if (fUTXOStats)
+            stats = utxoStats;
+        // insightexplorer: update indices (true)
+        if (DisconnectBlock(block, state, pindexDelete, view, chainparams, true, fUTXOStats ? &stats : nullptr,
+                            fPrefetched ? &blockUndo : nullptr) != DISCONNECT_OK)
+            return error("DisconnectTip(): DisconnectBlock %s failed", pindexDelete->GetBlockHash().ToString());
+        assert(view.Flush());
+        if (fUTXOStats) {
+            stats.hashBlock = pindexDelete->pprev->GetBlockHash();
+            stats.nHeight = pindexDelete->pprev->nHeight;
+            utxoStats = std::move(stats);
+        }
+    }
+    LogPrint("bench", "- Disconnect block: %.2fms\n", (GetTimeMicros() - nStart) * 0.001);
+    uint256 sproutAnchorAfterDisconnect = pcoinsTip->GetBestAnchor(SPROUT);
     uint256 saplingAnchorAfterDisconnect = pcoinsTip->GetBestAnchor(SAPLING);
     // Write the chain state to disk, if necessary.
     if (!FlushStateToDisk(chainparams, state, FLUSH_STATE_IF_NEEDED))
         return false;
 
-    if (!fBare) {
-        // Resurrect mempool transactions from the disconnected block.
-        for (const CTransaction &tx : block.vtx) {
-            // ignore validation errors in resurrected transactions
-            list<CTransaction> removed;
-            CValidationState stateDummy;
-            if (tx.IsCoinBase() || !AcceptToMemoryPool(chainparams, mempool, stateDummy, tx, false, NULL))
-                mempool.remove(tx, removed, true);
-        }
+    if (pdisconnectpool) {
+        // Queue the transactions of the disconnected block for re-admission to the
+        // mempool. The coinbase is only valid in a block, so remove its spends now.
+        list<CTransaction> removed;
+        mempool.remove(block.vtx[0], removed, true);
+        pdisconnectpool->queuedTx.insert(pdisconnectpool->queuedTx.begin(), block.vtx.begin() + 1, block.vtx.end());
+        for (auto it = block.vtx.begin() + 1; it != block.vtx.end(); ++it) {
+            pdisconnectpool->cachedInnerUsage += RecursiveDynamicUsage(*it);
+        }
+        // Over the limit, drop the transactions of the blocks disconnected first,
+        // which come last, so that no queued transaction loses its parents.
+        while (pdisconnectpool->cachedInnerUsage > MAX_DISCONNECTED_TX_POOL_SIZE) {
+            const CTransaction& tx = pdisconnectpool->queuedTx.back();
+            pdisconnectpool->cachedInnerUsage -= RecursiveDynamicUsage(tx);
+            mempool.remove(tx, removed, true);
+            pdisconnectpool->queuedTx.pop_back();
+        }
+        // The anchor may not change between block disconnects, in which case
+        // we don't want to evict from the mempool!
         if (sproutAnchorBeforeDisconnect != sproutAnchorAfterDisconnect) {
-            // The anchor may not change between block disconnects,
-            // in which case we don't want to evict from the mempool yet!
-            mempool.removeWithAnchor(sproutAnchorBeforeDisconnect, SPROUT);
+            pdisconnectpool->setSproutAnchors.insert(sproutAnchorBeforeDisconnect);
         }
         if (saplingAnchorBeforeDisconnect != saplingAnchorAfterDisconnect) {
-            // The anchor may not change between block disconnects,
-            // in which case we don't want to evict from the mempool yet!
-            mempool.removeWithAnchor(saplingAnchorBeforeDisconnect, SAPLING);
+            pdisconnectpool->setSaplingAnchors.insert(saplingAnchorBeforeDisconnect);
         }
     }
 
@@ -3451,14 +4769,25 @@ uint64_t nNotifiedSequence = 0;
 bool static ConnectTip(CValidationState& state, const CChainParams& chainparams, CBlockIndex* pindexNew, const CBlock* pblock)
 {
     assert(pblock && pindexNew->pprev == chainActive.Tip());
+    auto span = TracingSpan("info", "main", "ConnectTip",
+        "height", std::to_string(pindexNew->nHeight).c_str());
+    auto spanGuard = span.Enter();
     int64_t nTime1 = GetTimeMicros();
     // Apply the block atomically to the chain state.
     int64_t nTime2 = GetTimeMicros(); nTimeReadFromDisk += nTime2 - nTime1;
     int64_t nTime3;
     LogPrint("bench", "  - Load block from disk: %.2fms [%.2fs]\n", (nTime2 - nTime1) * 0.001, nTimeReadFromDisk * 0.000001);
     {
+        if (nPrefetchThreads) {
+            PrefetchBlockInputs(*pblock);
+            int64_t nTimePrefetch = GetTimeMicros();
+            LogPrint("bench", "  - Prefetch inputs: %.2fms\n", (nTimePrefetch - nTime2) * 0.001);
+        }
         CCoinsViewCache view(pcoinsTip);
-        bool rv = ConnectBlock(*pblock, state, pindexNew, view, chainparams);
+        CCoinsStats stats;
+        if (fUTXOStats)
+            stats = utxoStats;
+        bool rv = ConnectBlock(*pblock, state, pindexNew, view, chainparams, false, fUTXOStats ? &stats : nullptr);
         GetMainSignals().BlockChecked(*pblock, state);
         if (!rv) {
             if (state.IsInvalid())
@@ -3469,6 +4798,11 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
         nTime3 = GetTimeMicros(); nTimeConnectTotal += nTime3 - nTime2;
         LogPrint("bench", "  - Connect total: %.2fms [%.2fs]\n", (nTime3 - nTime2) * 0.001, nTimeConnectTotal * 0.000001);
         assert(view.Flush());
+        if (fUTXOStats) {
+            stats.hashBlock = pindexNew->GetBlockHash();
+            stats.nHeight = pindexNew->nHeight;
+            utxoStats = std::move(stats);
+        }
     }
     int64_t nTime4 = GetTimeMicros(); nTimeFlush += nTime4 - nTime3;
     LogPrint("bench", "  - Flush: %.2fms [%.2fs]\n", (nTime4 - nTime3) * 0.001, nTimeFlush * 0.000001);
@@ -3490,6 +4824,7 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
 
     // Update chainActive & related variables.
     UpdateTip(pindexNew, chainparams);
+    headerStore.Write(pindexNew->nHeight, *pblock);
 
     // Cache the conflicted transactions for subsequent notification.
     // Updates to connected wallets are triggered by ThreadNotifyWallets
@@ -3501,8 +4836,18 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
     int64_t nTime6 = GetTimeMicros(); nTimePostConnect += nTime6 - nTime5; nTimeTotal += nTime6 - nTime1;
     LogPrint("bench", "  - Connect postprocess: %.2fms [%.2fs]\n", (nTime6 - nTime5) * 0.001, nTimePostConnect * 0.000001);
     LogPrint("bench", "- Connect block: %.2fms [%.2fs]\n", (nTime6 - nTime1) * 0.001, nTimeTotal * 0.000001);
+    size_t nShieldedOutputs = 0;
+    for (const CTransaction& tx : pblock->vtx) {
+        nShieldedOutputs += tx.vShieldedOutput.size() + 2 * tx.vJoinSplit.size();
+    }
+    nShieldedOutputsConnected += nShieldedOutputs;
     MetricsIncrementCounter("zcash.chain.verified.block.total");
     MetricsHistogram("zcash.chain.verified.block.seconds", (nTime6 - nTime1) * 0.000001);
+    BlockMetricsLabels metricsLabels(*pblock);
+    RecordBlockStageTime("connect", metricsLabels, nTime3 - nTime2);
+    RecordBlockStageTime("flush", metricsLabels, nTime4 - nTime3);
+    RecordBlockStageTime("chainstate", metricsLabels, nTime5 - nTime4);
+    RecordBlockStageTime("postprocess", metricsLabels, nTime6 - nTime5);
     return true;
 }
 
@@ -3601,11 +4946,183 @@ static void PruneBlockIndexCandidates() {
     assert(!setBlockIndexCandidates.empty());
 }
 
+/**
+ * Hashes of blocks that passed the checks of CheckBlock() that follow those
+ * of their headers, without the verification of proofs, ahead of validation:
+ * when their messages were prepared, or when they were read ahead of being
+ * connected. Only used on the thread that is validating them.
+ */
+static thread_local std::set<uint256> setPrecheckedBlocks;
+
+/** Number of threads reading the blocks to be connected ahead of ConnectTip() */
+static const int CONNECT_PREFETCH_THREADS = 4;
+/** Maximum number of blocks that are read ahead of the block being connected */
+static const int MAX_CONNECT_PREFETCH_BLOCKS = 16;
+
+/**
+ * Reads the blocks that ActivateBestChain() is about to connect on a few
+ * threads, and runs the checks of CheckBlock() that do not depend on the
+ * chain state on them, while the blocks before them are being connected.
+ * The blocks are still connected one at a time, in order. The positions of
+ * the blocks are copied from the block index when they are scheduled, so the
+ * threads do not need cs_main.
+ */
+class CConnectPrefetcher
+{
+private:
+    struct Entry {
+        uint256 hash;
+        CDiskBlockPos pos;
+        bool fClaimed = false;
+        bool fDone = false;
+        bool fRead = false;
+        bool fChecked = false;
+        CBlock block;
+    };
+
+    const CChainParams& chainparams;
+    //! The blocks to be connected next, in order. An entry that is dropped
+    //! while it is being read is kept alive by the thread reading it.
+    std::deque<std::shared_ptr<Entry>> queue;
+
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    bool fStop = false;
+
+    boost::thread_group threadGroup;
+
+    void ThreadRead()
+    {
+        while (true) {
+            std::shared_ptr<Entry> entry;
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                while (!fStop) {
+                    for (const std::shared_ptr<Entry>& queued : queue) {
+                        if (!queued->fClaimed) {
+                            entry = queued;
+                            break;
+                        }
+                    }
+                    if (entry) {
+                        break;
+                    }
+                    cond.wait(lock);
+                }
+                if (fStop) {
+                    return;
+                }
+                entry->fClaimed = true;
+            }
+
+            // The entry is only touched by this thread until it is done.
+            CValidationState state;
+            auto verifier = ProofVerifier::Disabled();
+            bool fRead = ReadBlockFromDisk(entry->block, entry->pos, chainparams.GetConsensus()) &&
+                entry->block.GetHash() == entry->hash;
+            bool fChecked = fRead && CheckBlock(entry->block, state, chainparams, verifier, false, true, true);
+
+            boost::unique_lock<boost::mutex> lock(mutex);
+            entry->fDone = true;
+            entry->fRead = fRead;
+            entry->fChecked = fChecked;
+            cond.notify_all();
+        }
+    }
+
+public:
+    explicit CConnectPrefetcher(const CChainParams& chainparamsIn) : chainparams(chainparamsIn)
+    {
+        for (int i = 0; i < CONNECT_PREFETCH_THREADS; i++) {
+            threadGroup.create_thread(boost::bind(&CConnectPrefetcher::ThreadRead, this));
+        }
+    }
+
+    ~CConnectPrefetcher()
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            fStop = true;
+            cond.notify_all();
+        }
+        threadGroup.join_all();
+    }
+
+    /**
+     * Schedule the blocks after pindexFork on the way to pindexMostWork to be
+     * read, up to MAX_CONNECT_PREFETCH_BLOCKS of them, keeping those that are
+     * already scheduled and dropping the others.
+     */
+    void Schedule(const CBlockIndex* pindexFork, const CBlockIndex* pindexMostWork)
+    {
+        AssertLockHeld(cs_main);
+        std::vector<const CBlockIndex*> vBlocks;
+        int nHeight = pindexFork ? pindexFork->nHeight + 1 : 0;
+        int nStopHeight = std::min(nHeight + MAX_CONNECT_PREFETCH_BLOCKS, pindexMostWork->nHeight + 1);
+        for (; nHeight < nStopHeight; nHeight++) {
+            const CBlockIndex* pindex = pindexMostWork->GetAncestor(nHeight);
+            if (!(pindex->nStatus & BLOCK_HAVE_DATA)) {
+                break;
+            }
+            vBlocks.push_back(pindex);
+        }
+
+        boost::unique_lock<boost::mutex> lock(mutex);
+        // Drop the blocks before the first one to be connected, which were
+        // connected from memory, or are no longer on the way.
+        if (!vBlocks.empty()) {
+            while (!queue.empty() && queue.front()->hash != vBlocks[0]->GetBlockHash()) {
+                queue.pop_front();
+            }
+        }
+        size_t i = 0;
+        while (i < queue.size() && i < vBlocks.size() && queue[i]->hash == vBlocks[i]->GetBlockHash()) {
+            i++;
+        }
+        queue.resize(i);
+        for (; i < vBlocks.size(); i++) {
+            auto entry = std::make_shared<Entry>();
+            entry->hash = vBlocks[i]->GetBlockHash();
+            entry->pos = vBlocks[i]->GetBlockPos();
+            queue.push_back(std::move(entry));
+        }
+        cond.notify_all();
+    }
+
+    /**
+     * Take pindex, which must be the next block to be connected, waiting for
+     * it to be read. fChecked is set if it passed the checks of CheckBlock()
+     * that follow those of its header. Returns false if the block could not
+     * be read, or is not the next one scheduled, in which case the caller
+     * reads it itself.
+     */
+    bool Take(const CBlockIndex* pindex, CBlock& block, bool& fChecked)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (queue.empty() || queue.front()->hash != pindex->GetBlockHash()) {
+            return false;
+        }
+        std::shared_ptr<Entry> entry = queue.front();
+        while (!entry->fDone) {
+            cond.wait(lock);
+        }
+        queue.pop_front();
+        if (!entry->fRead) {
+            return false;
+        }
+        block = std::move(entry->block);
+        fChecked = entry->fChecked;
+        return true;
+    }
+};
+
 /**
  * Try to make some progress towards making pindexMostWork the active block.
  * pblock is either NULL or a pointer to a CBlock corresponding to pindexMostWork.
+ * The other blocks are taken from pprefetcher if it is not NULL and has read them.
  */
-static bool ActivateBestChainStep(CValidationState& state, const CChainParams& chainparams, CBlockIndex* pindexMostWork, const CBlock* pblock)
+static bool ActivateBestChainStep(CValidationState& state, const CChainParams& chainparams, CBlockIndex* pindexMostWork, const CBlock* pblock,
+                                  CConnectPrefetcher* pprefetcher)
 {
     AssertLockHeld(cs_main);
     bool fInvalidFound = false;
@@ -3639,9 +5156,16 @@ static bool ActivateBestChainStep(CValidationState& state, const CChainParams& c
 
     // Disconnect active blocks which are no longer in the best chain.
     bool fBlocksDisconnected = false;
+    CDisconnectedBlockTransactions disconnectpool;
+    std::unique_ptr<CDisconnectPrefetcher> prefetcher;
+    if (pindexFork && chainActive.Height() > pindexFork->nHeight + 1) {
+        prefetcher.reset(new CDisconnectPrefetcher(chainparams, chainActive.Tip(), pindexFork));
+    }
     while (chainActive.Tip() && chainActive.Tip() != pindexFork) {
-        if (!DisconnectTip(state, chainparams))
+        if (!DisconnectTip(state, chainparams, &disconnectpool, prefetcher.get())) {
+            UpdateMempoolForReorg(chainparams, disconnectpool);
             return false;
+        }
         fBlocksDisconnected = true;
     }
 
@@ -3666,16 +5190,23 @@ static bool ActivateBestChainStep(CValidationState& state, const CChainParams& c
         for (CBlockIndex *pindexConnect : reverse_iterate(vpindexToConnect)) {
             const CBlock* pconnectBlock;
             CBlock block;
+            bool fPrechecked = false;
             if (pblock && pindexConnect == pindexMostWork) {
                 pconnectBlock = pblock;
             } else {
-                // read the block to be connected from disk
-                if (!ReadBlockFromDisk(block, pindexConnect, chainparams.GetConsensus()))
+                // read the block to be connected from disk, unless it has been read ahead
+                if (!(pprefetcher && pprefetcher->Take(pindexConnect, block, fPrechecked)) &&
+                    !ReadBlockFromDisk(block, pindexConnect, chainparams.GetConsensus()))
                     return AbortNode(state, "Failed to read block");
                 pconnectBlock = &block;
             }
 
-            if (!ConnectTip(state, chainparams, pindexConnect, pconnectBlock)) {
+            if (fPrechecked)
+                setPrecheckedBlocks.insert(pindexConnect->GetBlockHash());
+            bool fConnected = ConnectTip(state, chainparams, pindexConnect, pconnectBlock);
+            if (fPrechecked)
+                setPrecheckedBlocks.erase(pindexConnect->GetBlockHash());
+            if (!fConnected) {
                 if (state.IsInvalid()) {
                     // The block violates a consensus rule.
                     if (!state.CorruptionPossible())
@@ -3686,6 +5217,8 @@ static bool ActivateBestChainStep(CValidationState& state, const CChainParams& c
                     break;
                 } else {
                     // A system error occurred (disk space, database error, ...).
+                    if (fBlocksDisconnected)
+                        UpdateMempoolForReorg(chainparams, disconnectpool);
                     return false;
                 }
             } else {
@@ -3700,10 +5233,11 @@ static bool ActivateBestChainStep(CValidationState& state, const CChainParams& c
     }
 
     if (fBlocksDisconnected) {
-        mempool.removeForReorg(pcoinsTip, chainActive.Tip()->nHeight + 1, STANDARD_LOCKTIME_VERIFY_FLAGS);
+        UpdateMempoolForReorg(chainparams, disconnectpool);
+    } else {
+        mempool.removeWithoutBranchId(
+            CurrentEpochBranchId(chainActive.Tip()->nHeight + 1, chainparams.GetConsensus()));
     }
-    mempool.removeWithoutBranchId(
-        CurrentEpochBranchId(chainActive.Tip()->nHeight + 1, chainparams.GetConsensus()));
     mempool.check(pcoinsTip);
 
     // Callbacks/notifications for a new best chain.
@@ -3722,11 +5256,18 @@ static bool ActivateBestChainStep(CValidationState& state, const CChainParams& c
  */
 bool ActivateBestChain(CValidationState& state, const CChainParams& chainparams, const CBlock* pblock)
 {
+    auto span = TracingSpan("info", "main", "ActivateBestChain");
+    auto spanGuard = span.Enter();
+
     CBlockIndex *pindexMostWork = NULL;
     CBlockIndex *pindexNewTip = NULL;
+    std::unique_ptr<CConnectPrefetcher> prefetcher;
     do {
         boost::this_thread::interruption_point();
 
+        // Don't let block connection get too far ahead of the listeners.
+        LimitValidationInterfaceQueue();
+
         bool fInitialDownload;
         int nNewHeight;
         {
@@ -3737,7 +5278,15 @@ bool ActivateBestChain(CValidationState& state, const CChainParams& chainparams,
             if (pindexMostWork == NULL || pindexMostWork == chainActive.Tip())
                 return true;
 
-            if (!ActivateBestChainStep(state, chainparams, pindexMostWork, pblock && pblock->GetHash() == pindexMostWork->GetBlockHash() ? pblock : NULL))
+            // The blocks are read ahead when there are several to connect.
+            const CBlockIndex* pindexFork = chainActive.FindFork(pindexMostWork);
+            if (!prefetcher && pindexMostWork->nHeight > (pindexFork ? pindexFork->nHeight : -1) + 1)
+                prefetcher.reset(new CConnectPrefetcher(chainparams));
+            if (prefetcher)
+                prefetcher->Schedule(pindexFork, pindexMostWork);
+
+            if (!ActivateBestChainStep(state, chainparams, pindexMostWork, pblock && pblock->GetHash() == pindexMostWork->GetBlockHash() ? pblock : NULL,
+                                       prefetcher.get()))
                 return false;
 
             pindexNewTip = chainActive.Tip();
@@ -3761,8 +5310,10 @@ bool ActivateBestChain(CValidationState& state, const CChainParams& chainparams,
                     if (nNewHeight > (pnode->nStartingHeight != -1 ? pnode->nStartingHeight - 2000 : nBlockEstimate))
                         pnode->PushInventory(CInv(MSG_BLOCK, hashNewTip));
             }
-            // Notify external listeners about the new tip.
-            GetMainSignals().UpdatedBlockTip(pindexNewTip);
+            // Notify external listeners about the new tip, in the background.
+            CallFunctionInValidationInterfaceQueue([pindexNewTip] {
+                GetMainSignals().UpdatedBlockTip(pindexNewTip);
+            });
         }
     } while (pindexNewTip != pindexMostWork);
     CheckBlockIndex(chainparams.GetConsensus());
@@ -3784,6 +5335,11 @@ bool InvalidateBlock(CValidationState& state, const CChainParams& chainparams, C
     setDirtyBlockIndex.insert(pindex);
     setBlockIndexCandidates.erase(pindex);
 
+    CDisconnectedBlockTransactions disconnectpool;
+    std::unique_ptr<CDisconnectPrefetcher> prefetcher;
+    if (chainActive.Contains(pindex) && chainActive.Height() > pindex->nHeight) {
+        prefetcher.reset(new CDisconnectPrefetcher(chainparams, chainActive.Tip(), pindex->pprev));
+    }
     while (chainActive.Contains(pindex)) {
         CBlockIndex *pindexWalk = chainActive.Tip();
         pindexWalk->nStatus |= BLOCK_FAILED_CHILD;
@@ -3791,10 +5347,8 @@ bool InvalidateBlock(CValidationState& state, const CChainParams& chainparams, C
         setBlockIndexCandidates.erase(pindexWalk);
         // ActivateBestChain considers blocks already in chainActive
         // unconditionally valid already, so force disconnect away from it.
-        if (!DisconnectTip(state, chainparams)) {
-            mempool.removeForReorg(pcoinsTip, chainActive.Tip()->nHeight + 1, STANDARD_LOCKTIME_VERIFY_FLAGS);
-            mempool.removeWithoutBranchId(
-                CurrentEpochBranchId(chainActive.Tip()->nHeight + 1, chainparams.GetConsensus()));
+        if (!DisconnectTip(state, chainparams, &disconnectpool, prefetcher.get())) {
+            UpdateMempoolForReorg(chainparams, disconnectpool);
             return false;
         }
     }
@@ -3810,9 +5364,7 @@ bool InvalidateBlock(CValidationState& state, const CChainParams& chainparams, C
     }
 
     InvalidChainFound(pindex, chainparams);
-    mempool.removeForReorg(pcoinsTip, chainActive.Tip()->nHeight + 1, STANDARD_LOCKTIME_VERIFY_FLAGS);
-    mempool.removeWithoutBranchId(
-        CurrentEpochBranchId(chainActive.Tip()->nHeight + 1, chainparams.GetConsensus()));
+    UpdateMempoolForReorg(chainparams, disconnectpool);
     return true;
 }
 
@@ -3891,6 +5443,7 @@ CBlockIndex* AddToBlockIndex(const CBlockHeader& block, const Consensus::Params&
         pindexBestHeader = pindexNew;
 
     setDirtyBlockIndex.insert(pindexNew);
+    blockIndexLookup.Insert(pindexNew);
 
     return pindexNew;
 }
@@ -3935,6 +5488,52 @@ void FallbackSproutValuePoolBalance(
 }
 
 /** Mark a block as having its data received and checked (up to BLOCK_VALID_TRANSACTIONS). */
+/**
+ * Set the values that depend on the transactions of all previous blocks for
+ * each block in queue, whose parent has them, and then for the descendants
+ * that were waiting for it in mapBlocksUnlinked.
+ */
+static void LinkBlockTransactions(deque<CBlockIndex*> queue, const CChainParams& chainparams)
+{
+    // Recursively process any descendant blocks that now may be eligible to be connected.
+    while (!queue.empty()) {
+        CBlockIndex *pindex = queue.front();
+        queue.pop_front();
+        pindex->nChainTx = (pindex->pprev ? pindex->pprev->nChainTx : 0) + pindex->nTx;
+        if (pindex->pprev) {
+            if (pindex->pprev->nChainSproutValue && pindex->nSproutValue) {
+                pindex->nChainSproutValue = *pindex->pprev->nChainSproutValue + *pindex->nSproutValue;
+            } else {
+                pindex->nChainSproutValue = std::nullopt;
+            }
+            if (pindex->pprev->nChainSaplingValue) {
+                pindex->nChainSaplingValue = *pindex->pprev->nChainSaplingValue + pindex->nSaplingValue;
+            } else {
+                pindex->nChainSaplingValue = std::nullopt;
+            }
+        } else {
+            pindex->nChainSproutValue = pindex->nSproutValue;
+            pindex->nChainSaplingValue = pindex->nSaplingValue;
+        }
+
+        // Fall back to hardcoded Sprout value pool balance
+        FallbackSproutValuePoolBalance(pindex, chainparams);
+
+        {
+            LOCK(cs_nBlockSequenceId);
+            pindex->nSequenceId = nBlockSequenceId++;
+        }
+        if (chainActive.Tip() == NULL || !setBlockIndexCandidates.value_comp()(pindex, chainActive.Tip())) {
+            setBlockIndexCandidates.insert(pindex);
+        }
+        std::pair<std::multimap<CBlockIndex*, CBlockIndex*>::iterator, std::multimap<CBlockIndex*, CBlockIndex*>::iterator> range = mapBlocksUnlinked.equal_range(pindex);
+        while (range.first != range.second) {
+            queue.push_back(range.first->second);
+            range.first = mapBlocksUnlinked.erase(range.first);
+        }
+    }
+}
+
 bool ReceivedBlockTransactions(
     const CBlock &block,
     CValidationState& state,
@@ -3971,46 +5570,7 @@ bool ReceivedBlockTransactions(
 
     if (pindexNew->pprev == NULL || pindexNew->pprev->nChainTx) {
         // If pindexNew is the genesis block or all parents are BLOCK_VALID_TRANSACTIONS.
-        deque<CBlockIndex*> queue;
-        queue.push_back(pindexNew);
-
-        // Recursively process any descendant blocks that now may be eligible to be connected.
-        while (!queue.empty()) {
-            CBlockIndex *pindex = queue.front();
-            queue.pop_front();
-            pindex->nChainTx = (pindex->pprev ? pindex->pprev->nChainTx : 0) + pindex->nTx;
-            if (pindex->pprev) {
-                if (pindex->pprev->nChainSproutValue && pindex->nSproutValue) {
-                    pindex->nChainSproutValue = *pindex->pprev->nChainSproutValue + *pindex->nSproutValue;
-                } else {
-                    pindex->nChainSproutValue = std::nullopt;
-                }
-                if (pindex->pprev->nChainSaplingValue) {
-                    pindex->nChainSaplingValue = *pindex->pprev->nChainSaplingValue + pindex->nSaplingValue;
-                } else {
-                    pindex->nChainSaplingValue = std::nullopt;
-                }
-            } else {
-                pindex->nChainSproutValue = pindex->nSproutValue;
-                pindex->nChainSaplingValue = pindex->nSaplingValue;
-            }
-
-            // Fall back to hardcoded Sprout value pool balance
-            FallbackSproutValuePoolBalance(pindex, chainparams);
-
-            {
-                LOCK(cs_nBlockSequenceId);
-                pindex->nSequenceId = nBlockSequenceId++;
-            }
-            if (chainActive.Tip() == NULL || !setBlockIndexCandidates.value_comp()(pindex, chainActive.Tip())) {
-                setBlockIndexCandidates.insert(pindex);
-            }
-            std::pair<std::multimap<CBlockIndex*, CBlockIndex*>::iterator, std::multimap<CBlockIndex*, CBlockIndex*>::iterator> range = mapBlocksUnlinked.equal_range(pindex);
-            while (range.first != range.second) {
-                queue.push_back(range.first->second);
-                range.first = mapBlocksUnlinked.erase(range.first);
-            }
-        }
+        LinkBlockTransactions({pindexNew}, chainparams);
     } else {
         if (pindexNew->pprev && pindexNew->pprev->IsValid(BLOCK_VALID_TREE)) {
             mapBlocksUnlinked.insert(std::make_pair(pindexNew->pprev, pindexNew));
@@ -4108,6 +5668,13 @@ bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos, unsigne
     return true;
 }
 
+/**
+ * Hashes of block headers whose Equihash solutions and proofs of work have
+ * been checked ahead of validation, by ReindexBlockFiles() or
+ * PrecheckBlockHeaders(), on the thread that is validating them.
+ */
+static thread_local std::set<uint256> setPrecheckedHeaders;
+
 bool CheckBlockHeader(
     const CBlockHeader& block,
     CValidationState& state,
@@ -4119,38 +5686,124 @@ bool CheckBlockHeader(
         return state.DoS(100, error("CheckBlockHeader(): block version too low"),
                          REJECT_INVALID, "version-too-low");
 
-    // Check Equihash solution is valid
-    if (fCheckPOW && !CheckEquihashSolution(&block, chainparams.GetConsensus()))
-        return state.DoS(100, error("CheckBlockHeader(): Equihash solution invalid"),
-                         REJECT_INVALID, "invalid-solution");
+    if (fCheckPOW) {
+        // Skip the checks if the header was checked ahead of validation.
+        uint256 hash = block.GetHash();
+        bool fPrechecked = setPrecheckedHeaders.count(hash) != 0;
+
+        // Check Equihash solution is valid
+        if (!fPrechecked && !CheckEquihashSolutionCached(block, hash, chainparams.GetConsensus()))
+            return state.DoS(100, error("CheckBlockHeader(): Equihash solution invalid"),
+                             REJECT_INVALID, "invalid-solution");
 
-    // Check proof of work matches claimed amount
-    if (fCheckPOW && !CheckProofOfWork(block.GetHash(), block.nBits, chainparams.GetConsensus()))
-        return state.DoS(50, error("CheckBlockHeader(): proof of work failed"),
-                         REJECT_INVALID, "high-hash");
+        // Check proof of work matches claimed amount
+        if (!fPrechecked && !CheckProofOfWork(hash, block.nBits, chainparams.GetConsensus()))
+            return state.DoS(50, error("CheckBlockHeader(): proof of work failed"),
+                             REJECT_INVALID, "high-hash");
+    }
 
     return true;
 }
 
-bool CheckBlock(const CBlock& block,
-                CValidationState& state,
-                const CChainParams& chainparams,
-                ProofVerifier& verifier,
-                bool fCheckPOW,
-                bool fCheckMerkleRoot,
-                bool fCheckTransactions)
-{
-    // These are checks that are independent of context.
+/**
+ * The last header of the chain of headers that were accepted under
+ * -assumevalidheaders without checking all of their Equihash solutions, and
+ * whether a sampled solution of such a header was invalid, which turns the
+ * option off until restart. Protected by cs_main.
+ */
+static CBlockIndex* pindexAssumedValidHeaders = NULL;
+static bool fAssumedValidHeadersFailed = false;
 
-    // Check that the header is valid (particularly PoW).  This is mostly
-    // redundant with the call in AcceptBlockHeader.
-    if (!CheckBlockHeader(block, state, chainparams, fCheckPOW))
+/**
+ * Whether nCount headers that extend pindexPrev may be accepted without
+ * checking their Equihash solutions. Until the last checkpoint is known, a
+ * single chain of headers below its height is accepted that way, as the
+ * checkpoint, whose hash commits to their solutions, will tell whether it is
+ * valid. Other headers, and forks of that chain, are checked as usual, and
+ * blocks are only accepted without the check once the checkpoint is known.
+ * Requires cs_main.
+ */
+static bool MayAssumeValidHeaders(const CBlockIndex* pindexPrev, int nCount, const CChainParams& chainparams)
+{
+    AssertLockHeld(cs_main);
+    if (!fAssumeValidHeaders || !fCheckpointsEnabled || fAssumedValidHeadersFailed || pindexPrev == NULL)
         return false;
-
+    const MapCheckpoints& checkpoints = chainparams.Checkpoints().mapCheckpoints;
+    if (checkpoints.empty() || mapBlockIndex.count(checkpoints.rbegin()->second))
+        return false;
+    if (pindexAssumedValidHeaders == NULL)
+        pindexAssumedValidHeaders = pindexBestHeader;
+    return pindexPrev == pindexAssumedValidHeaders && pindexPrev->nHeight + nCount <= checkpoints.rbegin()->first;
+}
+
+/**
+ * Check the Equihash solutions and proofs of work of a batch of headers
+ * received from a peer on the header checking threads, so that
+ * CheckBlockHeader() skips those checks when the headers are accepted in
+ * order. If any check fails, none of the headers are marked as checked, and
+ * CheckBlockHeader() finds and rejects the invalid one.
+ */
+static void PrecheckBlockHeaders(const std::vector<CBlockHeader>& headers, const CChainParams& chainparams)
+{
+    const Consensus::Params& params = chainparams.GetConsensus();
+    setPrecheckedHeaders.clear();
+    if (!nScriptCheckThreads || headers.size() < 2)
+        return;
+
+    // Headers that are already known are not checked again.
+    std::vector<uint256> vHashes;
+    std::vector<CHeaderCheck> vChecks;
+    vHashes.reserve(headers.size());
+    vChecks.reserve(headers.size());
+    {
+        LOCK(cs_main);
+        // Most of the solutions of headers that extend the assumed valid
+        // headers are not checked at all.
+        BlockMap::iterator miPrev = mapBlockIndex.find(headers[0].hashPrevBlock);
+        if (miPrev != mapBlockIndex.end() && MayAssumeValidHeaders(miPrev->second, headers.size(), chainparams))
+            return;
+        for (const CBlockHeader& header : headers) {
+            uint256 hash = header.GetHash();
+            if (mapBlockIndex.count(hash) == 0) {
+                vHashes.push_back(hash);
+                vChecks.emplace_back(header, hash, params);
+            }
+        }
+    }
+    if (vChecks.size() < 2)
+        return;
+
+    CCheckQueueControl<CHeaderCheck> control(&headercheckqueue);
+    control.Add(vChecks);
+    if (control.Wait())
+        setPrecheckedHeaders.insert(vHashes.begin(), vHashes.end());
+}
+
+bool CheckBlock(const CBlock& block,
+                CValidationState& state,
+                const CChainParams& chainparams,
+                ProofVerifier& verifier,
+                bool fCheckPOW,
+                bool fCheckMerkleRoot,
+                bool fCheckTransactions)
+{
+    // These are checks that are independent of context.
+
+    // Check that the header is valid (particularly PoW).  This is mostly
+    // redundant with the call in AcceptBlockHeader.
+    if (!CheckBlockHeader(block, state, chainparams, fCheckPOW))
+        return false;
+
+    // Skip the rest if the block was checked ahead of validation, unless its
+    // proofs are to be verified.
+    if (fCheckMerkleRoot && !verifier.PerformsVerification() &&
+        !setPrecheckedBlocks.empty() && setPrecheckedBlocks.count(block.GetHash()) != 0)
+        return true;
+
     // Check the merkle root.
     if (fCheckMerkleRoot) {
         bool mutated;
-        uint256 hashMerkleRoot2 = block.BuildMerkleTree(&mutated);
+        uint256 hashMerkleRoot2 = BlockMerkleRoot(block, &mutated);
         if (block.hashMerkleRoot != hashMerkleRoot2)
             return state.DoS(100, error("CheckBlock(): hashMerkleRoot mismatch"),
                              REJECT_INVALID, "bad-txnmrklroot", true);
@@ -4274,13 +5927,42 @@ bool ContextualCheckBlock(
 {
     const int nHeight = pindexPrev == NULL ? 0 : pindexPrev->nHeight + 1;
     const Consensus::Params& consensusParams = chainparams.GetConsensus();
+    auto span = TracingSpan("info", "main", "ContextualCheckBlock",
+        "height", std::to_string(nHeight).c_str());
+    auto spanGuard = span.Enter();
 
     if (fCheckTransactions) {
+        // The Sapling proofs and JoinSplit signatures of the transactions in
+        // the block are deferred to batches that are verified after all other
+        // checks. If there are proof check threads, the transactions are spread
+        // over one batch per thread so that the batches can be verified in
+        // parallel.
+        std::vector<ProofVerifier> saplingVerifiers;
+        int nVerifiers = GetVerificationThreads();
+        saplingVerifiers.reserve(nVerifiers);
+        for (int i = 0; i < nVerifiers; i++) {
+            saplingVerifiers.push_back(ProofVerifier::Batched());
+        }
+        size_t nSaplingTxs = 0;
+
         // Check that all transactions are finalized
         for (const CTransaction& tx : block.vtx) {
+            auto& saplingVerifier = saplingVerifiers[nSaplingTxs % saplingVerifiers.size()];
+            if (!(tx.vJoinSplit.empty() && tx.vShieldedSpend.empty() && tx.vShieldedOutput.empty())) {
+                nSaplingTxs++;
+            }
+
+            // Reuse the signature hash midstates of a shielded transaction
+            // from when it was admitted to the mempool.
+            std::shared_ptr<const PrecomputedTransactionData> txdata;
+            size_t nTxSize;
+            if (!tx.vJoinSplit.empty() || !tx.vShieldedSpend.empty() || !tx.vShieldedOutput.empty()) {
+                mempool.GetTxData(tx.GetHash(), txdata, nTxSize);
+            }
 
             // Check transaction contextually against consensus rules at block height
-            if (!ContextualCheckTransaction(tx, state, chainparams, nHeight, true)) {
+            if (!ContextualCheckTransaction(tx, state, chainparams, nHeight, true,
+                                            IsInitialBlockDownload, &saplingVerifier, txdata.get())) {
                 return false; // Failure reason has been set in validation state object
             }
 
@@ -4293,6 +5975,32 @@ bool ContextualCheckBlock(
                                  REJECT_INVALID, "bad-txns-nonfinal");
             }
         }
+
+        bool fSaplingValid;
+        int64_t nTimeSaplingStart = GetTimeMicros();
+        if (nScriptCheckThreads && nSaplingTxs > 1) {
+            CCheckQueueControl<CProofCheck> proofControl(&proofcheckqueue);
+            std::vector<CProofCheck> vProofChecks;
+            for (auto& saplingVerifier : saplingVerifiers) {
+                vProofChecks.emplace_back(saplingVerifier);
+            }
+            proofControl.Add(vProofChecks);
+            fSaplingValid = proofControl.Wait();
+        } else {
+            fSaplingValid = saplingVerifiers[0].VerifyBatch();
+        }
+        RecordBlockStageTime("sapling_proofs", BlockMetricsLabels(block), GetTimeMicros() - nTimeSaplingStart);
+
+        if (!fSaplingValid) {
+            // At least one proof or signature in the block is invalid. Check each transaction
+            // on its own so that the failure is attributed to the right one; the
+            // individual checks are authoritative.
+            for (const CTransaction& tx : block.vtx) {
+                if (!ContextualCheckTransaction(tx, state, chainparams, nHeight, true)) {
+                    return false;
+                }
+            }
+        }
     }
 
     // Enforce BIP 34 rule that the coinbase starts with serialized block height.
@@ -4358,8 +6066,36 @@ static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state
         return true;
     }
 
-    if (!CheckBlockHeader(block, state, chainparams))
+    // Under -assumevalidheaders, the Equihash solutions of a random sample of
+    // the headers are still checked, so that a peer that sends a chain of
+    // invalid headers is soon found out.
+    bool fAssumeValid = false;
+    bool fSampled = false;
+    BlockMap::iterator miPrev = mapBlockIndex.find(block.hashPrevBlock);
+    if (miPrev != mapBlockIndex.end() && MayAssumeValidHeaders(miPrev->second, 1, chainparams)) {
+        const MapCheckpoints& checkpoints = chainparams.Checkpoints().mapCheckpoints;
+        MapCheckpoints::const_iterator itCheckpoint = checkpoints.find(miPrev->second->nHeight + 1);
+        if (itCheckpoint != checkpoints.end()) {
+            fAssumeValid = itCheckpoint->second == hash;
+        } else {
+            fSampled = GetRand(ASSUMED_VALID_HEADERS_SAMPLE) == 0;
+            fAssumeValid = !fSampled;
+        }
+    }
+
+    if (fAssumeValid) {
+        if (!CheckBlockHeader(block, state, chainparams, false))
+            return false;
+        if (!CheckProofOfWork(hash, block.nBits, chainparams.GetConsensus()))
+            return state.DoS(50, error("%s: proof of work failed", __func__),
+                             REJECT_INVALID, "high-hash");
+    } else if (!CheckBlockHeader(block, state, chainparams)) {
+        if (fSampled) {
+            LogPrintf("%s: invalid header %s extends the assumed valid headers; checking all Equihash solutions\n", __func__, hash.ToString());
+            fAssumedValidHeadersFailed = true;
+        }
         return false;
+    }
 
     // Get prev block index
     CBlockIndex* pindexPrev = NULL;
@@ -4378,6 +6114,9 @@ static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state
     if (pindex == NULL)
         pindex = AddToBlockIndex(block, chainparams.GetConsensus());
 
+    if (fAssumeValid || fSampled)
+        pindexAssumedValidHeaders = pindex;
+
     if (ppindex)
         *ppindex = pindex;
 
@@ -4392,7 +6131,8 @@ static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state
  * (ProcessNewBlock) later invokes ActivateBestChain, which ultimately calls
  * ConnectBlock in a manner that can verify the proofs
  */
-static bool AcceptBlock(const CBlock& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex, bool fRequested, CDiskBlockPos* dbp)
+static bool AcceptBlock(const CBlock& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex, bool fRequested, CDiskBlockPos* dbp,
+                        const char* pRawBegin, const char* pRawEnd)
 {
     AssertLockHeld(cs_main);
 
@@ -4425,7 +6165,11 @@ static bool AcceptBlock(const CBlock& block, CValidationState& state, const CCha
     // See method docstring for why this is always disabled.
     auto verifier = ProofVerifier::Disabled();
     bool fCheckTransactions = ShouldCheckTransactions(chainparams, pindex);
-    if ((!CheckBlock(block, state, chainparams, verifier, true, true, fCheckTransactions)) ||
+    // The hash of a checkpoint commits to the Equihash solutions of its
+    // ancestors, so they need not be checked again.
+    bool fCheckPOW = !(fAssumeValidHeaders && fCheckpointsEnabled &&
+                       Checkpoints::IsAncestorOfLastCheckpoint(chainparams.Checkpoints(), pindex));
+    if ((!CheckBlock(block, state, chainparams, verifier, fCheckPOW, true, fCheckTransactions)) ||
          !ContextualCheckBlock(block, state, chainparams, pindex->pprev, fCheckTransactions)) {
         if (state.IsInvalid() && !state.CorruptionPossible()) {
             pindex->nStatus |= BLOCK_FAILED_VALID;
@@ -4438,14 +6182,28 @@ static bool AcceptBlock(const CBlock& block, CValidationState& state, const CCha
 
     // Write block to history file
     try {
-        unsigned int nBlockSize = ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION);
+        std::vector<char> vCompressed;
+        unsigned int nBlockSize;
+        if (dbp != NULL && dbp->nSize != 0)
+            nBlockSize = dbp->nSize;
+        else if (dbp == NULL && pRawBegin != NULL) {
+            // The block is compressed, or written, as it was received.
+            if (fCompressBlockFiles && CompressBlockRecord(pRawBegin, pRawEnd, vCompressed))
+                nBlockSize = vCompressed.size();
+            else
+                nBlockSize = pRawEnd - pRawBegin;
+        }
+        else if (dbp == NULL && CompressForDisk(block, vCompressed))
+            nBlockSize = vCompressed.size();
+        else
+            nBlockSize = ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION);
         CDiskBlockPos blockPos;
         if (dbp != NULL)
             blockPos = *dbp;
         if (!FindBlockPos(state, blockPos, nBlockSize+8, nHeight, block.GetBlockTime(), dbp != NULL))
             return error("AcceptBlock(): FindBlockPos failed");
         if (dbp == NULL)
-            if (!WriteBlockToDisk(block, blockPos, chainparams.MessageStart()))
+            if (!WriteBlockToDisk(block, blockPos, chainparams.MessageStart(), vCompressed, pRawBegin, pRawEnd))
                 AbortNode(state, "Failed to write block");
         if (!ReceivedBlockTransactions(block, state, chainparams, pindex, blockPos))
             return error("AcceptBlock(): ReceivedBlockTransactions failed");
@@ -4472,9 +6230,11 @@ static bool IsSuperMajority(int minVersion, const CBlockIndex* pstart, unsigned
 }
 
 
-bool ProcessNewBlock(CValidationState& state, const CChainParams& chainparams, const CNode* pfrom, const CBlock* pblock, bool fForceProcessing, CDiskBlockPos* dbp)
+bool ProcessNewBlock(CValidationState& state, const CChainParams& chainparams, const CNode* pfrom, const CBlock* pblock, bool fForceProcessing, CDiskBlockPos* dbp,
+                     const char* pRawBegin, const char* pRawEnd)
 {
-    auto span = TracingSpan("info", "main", "ProcessNewBlock");
+    auto span = TracingSpan("info", "main", "ProcessNewBlock",
+        "hash", pblock->GetHash().GetHex().c_str());
     auto spanGuard = span.Enter();
 
     {
@@ -4483,7 +6243,7 @@ bool ProcessNewBlock(CValidationState& state, const CChainParams& chainparams, c
 
         // Store to disk
         CBlockIndex *pindex = NULL;
-        bool ret = AcceptBlock(*pblock, state, chainparams, &pindex, fRequested, dbp);
+        bool ret = AcceptBlock(*pblock, state, chainparams, &pindex, fRequested, dbp, pRawBegin, pRawEnd);
         if (pindex && pfrom) {
             mapBlockSource[pindex->GetBlockHash()] = pfrom->GetId();
         }
@@ -4576,21 +6336,110 @@ void PruneOneBlockFile(const int fileNumber)
 }
 
 
+/** Pruned files that are waiting to be unlinked, and their size. */
+static boost::mutex csPrunedFiles;
+static boost::condition_variable condPrunedFiles;
+static std::deque<std::pair<int, uint64_t>> vPrunedFiles;
+static uint64_t nPrunedFilesBytes = 0;
+
 void UnlinkPrunedFiles(std::set<int>& setFilesToPrune)
 {
-    for (set<int>::iterator it = setFilesToPrune.begin(); it != setFilesToPrune.end(); ++it) {
-        CDiskBlockPos pos(*it, 0);
-        fs::remove(GetBlockPosFilename(pos, "blk"));
-        fs::remove(GetBlockPosFilename(pos, "rev"));
-        LogPrintf("Prune: %s deleted blk/rev (%05u)\n", __func__, *it);
+    {
+        boost::unique_lock<boost::mutex> lock(csPrunedFiles);
+        for (set<int>::iterator it = setFilesToPrune.begin(); it != setFilesToPrune.end(); ++it) {
+            mapBlockFiles.Erase(*it);
+            CDiskBlockPos pos(*it, 0);
+            uint64_t nBytes = 0;
+            for (const char* prefix : {"blk", "rev"}) {
+                boost::system::error_code ec;
+                uintmax_t nSize = fs::file_size(GetBlockPosFilename(pos, prefix), ec);
+                nBytes += ec ? 0 : nSize;
+            }
+            vPrunedFiles.emplace_back(*it, nBytes);
+            nPrunedFilesBytes += nBytes;
+        }
+    }
+    condPrunedFiles.notify_all();
+}
+
+/** Unlink the pair of block and undo files at the front of the queue, if any. */
+static bool UnlinkOnePrunedFile()
+{
+    std::pair<int, uint64_t> file;
+    {
+        boost::unique_lock<boost::mutex> lock(csPrunedFiles);
+        if (vPrunedFiles.empty()) {
+            return false;
+        }
+        file = vPrunedFiles.front();
+        vPrunedFiles.pop_front();
+    }
+    CDiskBlockPos pos(file.first, 0);
+    fs::remove(GetBlockPosFilename(pos, "blk"));
+    fs::remove(GetBlockPosFilename(pos, "rev"));
+    LogPrintf("Prune: %s deleted blk/rev (%05u)\n", __func__, file.first);
+    {
+        boost::unique_lock<boost::mutex> lock(csPrunedFiles);
+        nPrunedFilesBytes -= file.second;
+    }
+    return true;
+}
+
+void ThreadUnlinkPrunedFiles()
+{
+    while (true) {
+        {
+            boost::unique_lock<boost::mutex> lock(csPrunedFiles);
+            while (vPrunedFiles.empty()) {
+                condPrunedFiles.wait(lock);
+            }
+        }
+        // One pair at a time, so that the deletions do not saturate the disk
+        // while blocks are being connected.
+        boost::this_thread::disable_interruption di;
+        UnlinkOnePrunedFile();
+    }
+}
+
+void FlushPrunedFiles()
+{
+    while (UnlinkOnePrunedFile()) {}
+}
+
+uint64_t GetPruneTarget()
+{
+    if (nPruneTarget == 0) {
+        return 0;
+    }
+    // If the free space cannot be read, prune to the configured target.
+    boost::system::error_code ec;
+    fs::space_info space = fs::space(GetDataDir() / "blocks", ec);
+    if (ec) {
+        LogPrintf("%s: unable to read the free disk space: %s\n", __func__, ec.message());
+        return nPruneTarget;
+    }
+    // Files that are waiting to be unlinked will free their space.
+    uint64_t nFree = space.available;
+    {
+        boost::unique_lock<boost::mutex> lock(csPrunedFiles);
+        nFree += nPrunedFilesBytes;
+    }
+    if (nFree >= PRUNE_MIN_FREE_SPACE) {
+        return nPruneTarget;
     }
+    // Shrink the target by the shortfall, but not below the minimum that
+    // keeps the last MIN_BLOCKS_TO_KEEP blocks.
+    uint64_t nShortfall = PRUNE_MIN_FREE_SPACE - nFree;
+    uint64_t nUsage = std::min(CalculateCurrentUsage(), nPruneTarget);
+    return std::max(MIN_DISK_SPACE_FOR_BLOCK_FILES, nUsage > nShortfall ? nUsage - nShortfall : 0);
 }
 
 /* Calculate the block/rev files that should be deleted to remain under target*/
 void FindFilesToPrune(std::set<int>& setFilesToPrune, uint64_t nPruneAfterHeight)
 {
     LOCK2(cs_main, cs_LastBlockFile);
-    if (chainActive.Tip() == NULL || nPruneTarget == 0) {
+    uint64_t nTarget = GetPruneTarget();
+    if (chainActive.Tip() == NULL || nTarget == 0) {
         return;
     }
     if (chainActive.Tip()->nHeight <= nPruneAfterHeight) {
@@ -4606,14 +6455,14 @@ void FindFilesToPrune(std::set<int>& setFilesToPrune, uint64_t nPruneAfterHeight
     uint64_t nBytesToPrune;
     int count=0;
 
-    if (nCurrentUsage + nBuffer >= nPruneTarget) {
+    if (nCurrentUsage + nBuffer >= nTarget) {
         for (int fileNumber = 0; fileNumber < nLastBlockFile; fileNumber++) {
             nBytesToPrune = vinfoBlockFile[fileNumber].nSize + vinfoBlockFile[fileNumber].nUndoSize;
 
             if (vinfoBlockFile[fileNumber].nSize == 0)
                 continue;
 
-            if (nCurrentUsage + nBuffer < nPruneTarget)  // are we below our target?
+            if (nCurrentUsage + nBuffer < nTarget)  // are we below our target?
                 break;
 
             // don't prune files that could have a block within MIN_BLOCKS_TO_KEEP of the main chain's tip but keep scanning
@@ -4629,8 +6478,8 @@ void FindFilesToPrune(std::set<int>& setFilesToPrune, uint64_t nPruneAfterHeight
     }
 
     LogPrint("prune", "Prune: target=%dMiB actual=%dMiB diff=%dMiB max_prune_height=%d removed %d blk/rev pairs\n",
-           nPruneTarget/1024/1024, nCurrentUsage/1024/1024,
-           ((int64_t)nPruneTarget - (int64_t)nCurrentUsage)/1024/1024,
+           nTarget/1024/1024, nCurrentUsage/1024/1024,
+           ((int64_t)nTarget - (int64_t)nCurrentUsage)/1024/1024,
            nLastBlockWeCanPrune, count);
 }
 
@@ -4701,11 +6550,33 @@ CBlockIndex * InsertBlockIndex(uint256 hash)
     return pindexNew;
 }
 
+/**
+ * Set the values of the block index entry for the base of a UTXO set
+ * snapshot that would otherwise be computed from the blocks before it.
+ */
+static void SetSnapshotBaseValues(CBlockIndex* pindex, const CSnapshotMetadata& metadata, const Consensus::Params& consensusParams)
+{
+    pindex->nChainTx = metadata.nChainTx;
+    pindex->nChainSproutValue = metadata.nChainSproutValue;
+    pindex->nChainSaplingValue = metadata.nChainSaplingValue;
+    pindex->nCachedBranchId = CurrentEpochBranchId(pindex->nHeight, consensusParams);
+}
+
 bool static LoadBlockIndexDB(const CChainParams& chainparams)
 {
     if (!pblocktree->LoadBlockIndexGuts(InsertBlockIndex, chainparams))
         return false;
 
+    // Check whether the chain state was loaded from a UTXO set snapshot
+    CSnapshotMetadata snapshotBase;
+    if (pblocktree->ReadSnapshotBase(snapshotBase)) {
+        BlockMap::iterator mi = mapBlockIndex.find(snapshotBase.hashBlock);
+        if (mi == mapBlockIndex.end())
+            return error("%s: the base %s of the UTXO set snapshot is not in the block index", __func__, snapshotBase.hashBlock.ToString());
+        pindexSnapshotBase = mi->second;
+        LogPrintf("%s: chain state loaded from a UTXO set snapshot at height %d\n", __func__, pindexSnapshotBase->nHeight);
+    }
+
     // Calculate nChainWork
     vector<pair<int, CBlockIndex*> > vSortedByHeight;
     vSortedByHeight.reserve(mapBlockIndex.size());
@@ -4721,7 +6592,9 @@ bool static LoadBlockIndexDB(const CChainParams& chainparams)
         pindex->nChainWork = (pindex->pprev ? pindex->pprev->nChainWork : 0) + GetBlockProof(*pindex);
         // We can link the chain of blocks for which we've received transactions at some point.
         // Pruned nodes may have deleted the block.
-        if (pindex->nTx > 0) {
+        if (pindex == pindexSnapshotBase) {
+            SetSnapshotBaseValues(pindex, snapshotBase, chainparams.GetConsensus());
+        } else if (pindex->nTx > 0) {
             if (pindex->pprev) {
                 if (pindex->pprev->nChainTx) {
                     pindex->nChainTx = pindex->pprev->nChainTx + pindex->nTx;
@@ -4779,6 +6652,7 @@ bool static LoadBlockIndexDB(const CChainParams& chainparams)
             pindex->BuildSkip();
         if (pindex->IsValid(BLOCK_VALID_TREE) && (pindexBestHeader == NULL || CBlockIndexWorkComparator()(pindexBestHeader, pindex)))
             pindexBestHeader = pindex;
+        blockIndexLookup.Insert(pindex);
     }
 
     // Load block file info
@@ -4830,6 +6704,18 @@ bool static LoadBlockIndexDB(const CChainParams& chainparams)
     pblocktree->ReadFlag("txindex", fTxIndex);
     LogPrintf("%s: transaction index %s\n", __func__, fTxIndex ? "enabled" : "disabled");
 
+    // Check whether we have a compact block index
+    pblocktree->ReadFlag("compactblockindex", fCompactBlockIndex);
+    LogPrintf("%s: compact block index %s\n", __func__, fCompactBlockIndex ? "enabled" : "disabled");
+
+    // Check whether we have a block filter index
+    pblocktree->ReadFlag("blockfilterindex", fBlockFilterIndex);
+    LogPrintf("%s: block filter index %s\n", __func__, fBlockFilterIndex ? "enabled" : "disabled");
+
+    // Check whether we have a shielded index
+    pblocktree->ReadFlag("shieldedindex", fShieldedIndex);
+    LogPrintf("%s: shielded index %s\n", __func__, fShieldedIndex ? "enabled" : "disabled");
+
     // insightexplorer and lightwalletd
     // Check whether block explorer features are enabled
     bool fInsightExplorer = false;
@@ -4838,6 +6724,8 @@ bool static LoadBlockIndexDB(const CChainParams& chainparams)
     pblocktree->ReadFlag("lightwalletd", fLightWalletd);
     LogPrintf("%s: insight explorer %s\n", __func__, fInsightExplorer ? "enabled" : "disabled");
     LogPrintf("%s: light wallet daemon %s\n", __func__, fLightWalletd ? "enabled" : "disabled");
+    // Address indexes built before running balances were added do not have them.
+    pblocktree->ReadFlag("addressbalances", fAddressBalances);
     if (fInsightExplorer) {
         fAddressIndex = true;
         fSpentIndex = true;
@@ -4846,6 +6734,10 @@ bool static LoadBlockIndexDB(const CChainParams& chainparams)
     else if (fLightWalletd) {
         fAddressIndex = true;
     }
+    // Since the indexes can be built and erased on their own, each has a flag.
+    pblocktree->ReadFlag("addressindex", fAddressIndex);
+    pblocktree->ReadFlag("spentindex", fSpentIndex);
+    pblocktree->ReadFlag("timestampindex", fTimestampIndex);
 
     // Fill in-memory data
     for (const std::pair<uint256, CBlockIndex*>& item : mapBlockIndex)
@@ -4881,114 +6773,688 @@ bool static LoadBlockIndexDB(const CChainParams& chainparams)
     return true;
 }
 
-CVerifyDB::CVerifyDB()
+/**
+ * Check that the UTXO set snapshot with the given metadata is pinned in the
+ * chain parameters and can replace the chain state, and find its base block.
+ */
+static bool CheckSnapshotMetadata(const CChainParams& chainparams, const CSnapshotMetadata& metadata, CBlockIndex*& pindexBase, std::string& strError)
 {
-    uiInterface.ShowProgress(_("Verifying blocks..."), 0);
+    AssertLockHeld(cs_main);
+    if (metadata.nVersion != CSnapshotMetadata::CURRENT_VERSION) {
+        strError = strprintf("unsupported snapshot version %u", metadata.nVersion);
+        return false;
+    }
+    if (memcmp(metadata.networkMagic.data(), chainparams.MessageStart(), MESSAGE_START_SIZE) != 0) {
+        strError = "the snapshot is for a different network";
+        return false;
+    }
+    const AssumeutxoData* pdata = chainparams.AssumeutxoForBlock(metadata.hashBlock);
+    if (!pdata || pdata->nHeight != metadata.nHeight) {
+        strError = strprintf("no snapshot is pinned for block %s", metadata.hashBlock.ToString());
+        return false;
+    }
+    BlockMap::iterator mi = mapBlockIndex.find(metadata.hashBlock);
+    if (mi == mapBlockIndex.end()) {
+        strError = strprintf("the header of block %s has not been received", metadata.hashBlock.ToString());
+        return false;
+    }
+    pindexBase = mi->second;
+    if (pindexBase->nStatus & BLOCK_FAILED_MASK) {
+        strError = strprintf("block %s is invalid", metadata.hashBlock.ToString());
+        return false;
+    }
+    CBlockIndex* pindexTip = chainActive.Tip();
+    if (pindexTip && (pindexBase->nHeight <= pindexTip->nHeight || pindexBase->GetAncestor(pindexTip->nHeight) != pindexTip)) {
+        strError = "the snapshot is not for a descendant of the active chain tip";
+        return false;
+    }
+    return true;
 }
 
-CVerifyDB::~CVerifyDB()
+bool DumpUTXOSnapshot(const fs::path& path, CSnapshotMetadata& metadata, uint256& hashSnapshot, uint64_t& nCoins, std::string& strError)
 {
-    uiInterface.ShowProgress("", 100);
+    const CChainParams& chainparams = Params();
+    std::unique_ptr<CDBIterator> pcursor;
+    {
+        LOCK(cs_main);
+        // Write the chain state out, so that the database is at the tip.
+        FlushStateToDisk();
+        CBlockIndex* pindex = chainActive.Tip();
+        if (!pindex || pcoinsdbview->GetBestBlock() != pindex->GetBlockHash()) {
+            strError = "unable to write the chain state to disk";
+            return false;
+        }
+        metadata = CSnapshotMetadata();
+        std::copy(chainparams.MessageStart(), chainparams.MessageStart() + MESSAGE_START_SIZE, metadata.networkMagic.begin());
+        metadata.hashBlock = pindex->GetBlockHash();
+        metadata.nHeight = pindex->nHeight;
+        metadata.nChainTx = pindex->nChainTx;
+        metadata.nChainSproutValue = pindex->nChainSproutValue;
+        metadata.nChainSaplingValue = pindex->nChainSaplingValue;
+        // The cursor sees the database as it is now, so it can be read
+        // without cs_main while blocks are connected.
+        pcursor.reset(pcoinsdbview->NewSnapshotCursor());
+    }
+
+    fs::path pathTmp = path;
+    pathTmp += ".incomplete";
+    CAutoFile file(fsbridge::fopen(pathTmp, "wb"), SER_DISK, CLIENT_VERSION);
+    if (file.IsNull()) {
+        strError = strprintf("unable to open %s for writing", pathTmp.string());
+        return false;
+    }
+    try {
+        CHashWriter hasher(SER_DISK, CLIENT_VERSION);
+        file << metadata;
+        hasher << metadata;
+        if (!pcoinsdbview->WriteSnapshot(pcursor.get(), file, hasher, nCoins)) {
+            strError = "unable to read the chain state";
+            return false;
+        }
+        hashSnapshot = hasher.GetHash();
+        file << hashSnapshot;
+    } catch (const std::exception& e) {
+        strError = strprintf("unable to write the snapshot: %s", e.what());
+        return false;
+    }
+    FileCommit(file.Get());
+    file.fclose();
+    if (!RenameOver(pathTmp, path)) {
+        strError = strprintf("unable to rename %s to %s", pathTmp.string(), path.string());
+        return false;
+    }
+    LogPrintf("%s: wrote %u coins at height %d to %s\n", __func__, nCoins, metadata.nHeight, path.string());
+    return true;
 }
 
-bool CVerifyDB::VerifyDB(const CChainParams& chainparams, CCoinsView *coinsview, int nCheckLevel, int nCheckDepth)
+bool LoadUTXOSnapshot(const fs::path& path, CSnapshotMetadata& metadata, uint256& hashSnapshot, uint64_t& nCoins, std::string& strError)
 {
-    LOCK(cs_main);
-    if (chainActive.Tip() == NULL || chainActive.Tip()->pprev == NULL)
-        return true;
-
-    // Verify blocks in the best chain
-    if (nCheckDepth <= 0)
-        nCheckDepth = 1000000000; // suffices until the year 19000
-    if (nCheckDepth > chainActive.Height())
-        nCheckDepth = chainActive.Height();
-    nCheckLevel = std::max(0, std::min(4, nCheckLevel));
-    LogPrintf("Verifying last %i blocks at level %i\n", nCheckDepth, nCheckLevel);
-    CCoinsViewCache coins(coinsview);
-    CBlockIndex* pindexState = chainActive.Tip();
-    CBlockIndex* pindexFailure = NULL;
-    int nGoodTransactions = 0;
-    CValidationState state;
-
-    // Flags used to permit skipping checks for efficiency
-    auto verifier = ProofVerifier::Disabled(); // No need to verify JoinSplits twice
-    bool fCheckTransactions = true;
+    const CChainParams& chainparams = Params();
+    CBlockIndex* pindexBase = NULL;
 
-    for (CBlockIndex* pindex = chainActive.Tip(); pindex && pindex->pprev; pindex = pindex->pprev)
+    // Check the whole snapshot before the chain state is touched.
     {
-        boost::this_thread::interruption_point();
-        uiInterface.ShowProgress(_("Verifying blocks..."), std::max(1, std::min(99, (int)(((double)(chainActive.Height() - pindex->nHeight)) / (double)nCheckDepth * (nCheckLevel >= 4 ? 50 : 100)))));
-        if (pindex->nHeight < chainActive.Height()-nCheckDepth)
-            break;
-
-        CBlock block;
-        // check level 0: read from disk
-        if (!ReadBlockFromDisk(block, pindex, chainparams.GetConsensus()))
-            return error("VerifyDB(): *** ReadBlockFromDisk failed at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
+        CAutoFile file(fsbridge::fopen(path, "rb"), SER_DISK, CLIENT_VERSION);
+        if (file.IsNull()) {
+            strError = strprintf("unable to open %s", path.string());
+            return false;
+        }
+        try {
+            CHashWriter hasher(SER_DISK, CLIENT_VERSION);
+            file >> metadata;
+            hasher << metadata;
+            {
+                LOCK(cs_main);
+                if (!CheckSnapshotMetadata(chainparams, metadata, pindexBase, strError))
+                    return false;
+            }
+            if (!pcoinsdbview->ReadSnapshot(file, hasher, false, nCoins)) {
+                strError = "the snapshot is malformed";
+                return false;
+            }
+            uint256 hashTrailer;
+            file >> hashTrailer;
+            hashSnapshot = hasher.GetHash();
+            if (hashTrailer != hashSnapshot) {
+                strError = "the snapshot is corrupted";
+                return false;
+            }
+        } catch (const std::exception& e) {
+            strError = strprintf("unable to read the snapshot: %s", e.what());
+            return false;
+        }
+        uint256 hashPinned = chainparams.AssumeutxoForBlock(metadata.hashBlock)->hashSnapshot;
+        if (hashSnapshot != hashPinned) {
+            strError = strprintf("the snapshot hash %s does not match the pinned hash %s", hashSnapshot.ToString(), hashPinned.ToString());
+            return false;
+        }
+    }
 
-        // check level 1: verify block validity
-        fCheckTransactions = ShouldCheckTransactions(chainparams, pindex);
-        if (nCheckLevel >= 1 && !CheckBlock(block, state, chainparams, verifier, true, true, fCheckTransactions))
-            return error("VerifyDB(): *** found bad block at %d, hash=%s\n", pindex->nHeight, pindex->GetBlockHash().ToString());
+    {
+        LOCK(cs_main);
+        if (!CheckSnapshotMetadata(chainparams, metadata, pindexBase, strError))
+            return false;
+        FlushStateToDisk();
 
-        // check level 2: verify undo validity
-        if (nCheckLevel >= 2 && pindex) {
-            CBlockUndo undo;
-            CDiskBlockPos pos = pindex->GetUndoPos();
-            if (!pos.IsNull()) {
-                if (!UndoReadFromDisk(undo, pos, pindex->pprev->GetBlockHash()))
-                    return error("VerifyDB(): *** found bad undo data at %d, hash=%s\n", pindex->nHeight, pindex->GetBlockHash().ToString());
+        CAutoFile file(fsbridge::fopen(path, "rb"), SER_DISK, CLIENT_VERSION);
+        if (file.IsNull()) {
+            strError = strprintf("unable to open %s", path.string());
+            return false;
+        }
+        LogPrintf("%s: loading %u coins at height %d from %s\n", __func__, nCoins, metadata.nHeight, path.string());
+        // From here on, a failure leaves the chain state incomplete, and it
+        // must be rebuilt with -reindex.
+        if (!pcoinsdbview->BeginLoadSnapshot()) {
+            strError = "unable to erase the chain state";
+            return AbortNode(strError);
+        }
+        try {
+            CHashWriter hasher(SER_DISK, CLIENT_VERSION);
+            CSnapshotMetadata metadataAgain;
+            file >> metadataAgain;
+            hasher << metadataAgain;
+            uint64_t nCoinsAgain;
+            if (!pcoinsdbview->ReadSnapshot(file, hasher, true, nCoinsAgain) || hasher.GetHash() != hashSnapshot) {
+                strError = "the snapshot changed while it was being loaded";
+                return AbortNode(strError);
             }
+        } catch (const std::exception& e) {
+            strError = strprintf("unable to load the snapshot: %s", e.what());
+            return AbortNode(strError);
+        }
+        if (!pcoinsdbview->EndLoadSnapshot(metadata.hashBlock)) {
+            strError = "unable to write the chain state";
+            return AbortNode(strError);
         }
 
-        // check level 3: check for inconsistencies during memory-only disconnect of tip blocks
-        if (nCheckLevel >= 3 && pindex == pindexState && (coins.DynamicMemoryUsage() + pcoinsTip->DynamicMemoryUsage()) <= nCoinCacheUsage) {
-            // insightexplorer: do not update indices (false)
-            DisconnectResult res = DisconnectBlock(block, state, pindex, coins, chainparams, false);
-            if (res == DISCONNECT_FAILED) {
-                return error("VerifyDB(): *** irrecoverable inconsistency in block data at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
-            }
-            pindexState = pindex->pprev;
-            if (res == DISCONNECT_UNCLEAN) {
-                nGoodTransactions = 0;
-                pindexFailure = pindex;
-            } else {
-                nGoodTransactions += block.vtx.size();
-            }
+        // Nothing cached above the database is valid for the new chain state.
+        pcoinsTip->Reset();
+        mempool.clear();
+
+        SetSnapshotBaseValues(pindexBase, metadata, chainparams.GetConsensus());
+        pindexBase->RaiseValidity(BLOCK_VALID_SCRIPTS);
+        setDirtyBlockIndex.insert(pindexBase);
+        if (!pblocktree->WriteSnapshotBase(metadata)) {
+            strError = "unable to write the block index";
+            return AbortNode(strError);
         }
+        pindexSnapshotBase = pindexBase;
+        chainActive.SetTip(pindexBase);
+        pindexBase->hashFinalSproutRoot = pcoinsTip->GetBestAnchor(SPROUT);
+        setBlockIndexCandidates.insert(pindexBase);
+        PruneBlockIndexCandidates();
 
-        if (ShutdownRequested())
-            return true;
-    }
-    if (pindexFailure)
-        return error("VerifyDB(): *** coin database inconsistencies found (last %i blocks, %i good transactions before that)\n", chainActive.Height() - pindexFailure->nHeight + 1, nGoodTransactions);
+        // Link the blocks after the base that have already been received.
+        deque<CBlockIndex*> queue;
+        auto range = mapBlocksUnlinked.equal_range(pindexBase);
+        while (range.first != range.second) {
+            queue.push_back(range.first->second);
+            range.first = mapBlocksUnlinked.erase(range.first);
+        }
+        LinkBlockTransactions(queue, chainparams);
+        FlushStateToDisk();
 
-    // check level 4: try reconnecting blocks
-    if (nCheckLevel >= 4) {
-        CBlockIndex *pindex = pindexState;
-        while (pindex != chainActive.Tip()) {
-            boost::this_thread::interruption_point();
-            uiInterface.ShowProgress(_("Verifying blocks..."), std::max(1, std::min(99, 100 - (int)(((double)(chainActive.Height() - pindex->nHeight)) / (double)nCheckDepth * 50))));
-            pindex = chainActive.Next(pindex);
-            CBlock block;
-            if (!ReadBlockFromDisk(block, pindex, chainparams.GetConsensus()))
-                return error("VerifyDB(): *** ReadBlockFromDisk failed at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
-            if (!ConnectBlock(block, state, pindex, coins, chainparams))
-                return error("VerifyDB(): *** found unconnectable block at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
+        if (fUTXOStats && !LoadUTXOStats()) {
+            strError = "unable to compute the UTXO set statistics";
+            return AbortNode(strError);
         }
+        LogPrintf("%s: chain state loaded from the UTXO set snapshot at height %d\n", __func__, pindexBase->nHeight);
     }
+    uiInterface.NotifyBlockTip(IsInitialBlockDownload(chainparams.GetConsensus()), pindexBase);
 
-    LogPrintf("No coin database inconsistencies in last %i blocks (%i transactions)\n", chainActive.Height() - pindexState->nHeight, nGoodTransactions);
-
+    CValidationState state;
+    if (!ActivateBestChain(state, chainparams)) {
+        strError = strprintf("unable to connect the blocks after the snapshot: %s", state.GetRejectReason());
+        return false;
+    }
     return true;
 }
 
-bool RewindBlockIndex(const CChainParams& chainparams, bool& clearWitnessCaches)
+bool DumpHeaderSnapshot(const fs::path& path, int& nHeight, std::string& strError)
 {
-    LOCK(cs_main);
+    const CChainParams& chainparams = Params();
+    std::vector<const CBlockIndex*> vIndex;
+    {
+        LOCK(cs_main);
+        // Only the entries are collected here; their headers, whose solutions
+        // may have been trimmed from memory, are read a batch at a time below.
+        vIndex.reserve(chainActive.Height() + 1);
+        for (const CBlockIndex* pindex = chainActive.Tip(); pindex; pindex = pindex->pprev) {
+            vIndex.push_back(pindex);
+        }
+        std::reverse(vIndex.begin(), vIndex.end());
+    }
+    if (vIndex.empty()) {
+        strError = "there is no active chain";
+        return false;
+    }
+    nHeight = vIndex.back()->nHeight;
 
-    // RewindBlockIndex is called after LoadBlockIndex, so at this point every block
-    // index will have nCachedBranchId set based on the values previously persisted
+    fs::path pathTmp = path;
+    pathTmp += ".incomplete";
+    CAutoFile file(fsbridge::fopen(pathTmp, "wb"), SER_DISK, CLIENT_VERSION);
+    if (file.IsNull()) {
+        strError = strprintf("unable to open %s for writing", pathTmp.string());
+        return false;
+    }
+    try {
+        file << FLATDATA(chainparams.MessageStart());
+        file << (uint32_t)vIndex.size();
+        std::vector<CBlockHeader> headers;
+        for (size_t nBegin = 0; nBegin < vIndex.size(); nBegin += HEADER_SNAPSHOT_BATCH_SIZE) {
+            size_t nEnd = std::min(vIndex.size(), nBegin + HEADER_SNAPSHOT_BATCH_SIZE);
+            headers.clear();
+            {
+                LOCK(cs_main);
+                for (size_t i = nBegin; i < nEnd; i++) {
+                    headers.push_back(vIndex[i]->GetBlockHeader());
+                }
+            }
+            for (const CBlockHeader& header : headers) {
+                file << header;
+            }
+        }
+    } catch (const std::exception& e) {
+        strError = strprintf("unable to write the header snapshot: %s", e.what());
+        return false;
+    }
+    FileCommit(file.Get());
+    file.fclose();
+    if (!RenameOver(pathTmp, path)) {
+        strError = strprintf("unable to rename %s to %s", pathTmp.string(), path.string());
+        return false;
+    }
+    LogPrintf("%s: wrote %u headers up to height %d to %s\n", __func__, vIndex.size(), nHeight, path.string());
+    return true;
+}
+
+/**
+ * Read the headers of a header snapshot, from the genesis block on, checking
+ * that they are for this network and are linked. With fAccept, add each
+ * batch to the block index; otherwise only sum their work and check them
+ * against the checkpoints, which needs no Equihash solution to be checked.
+ */
+static bool ReadHeaderSnapshot(const CChainParams& chainparams, const fs::path& path, bool fAccept, int& nHeaders, arith_uint256& nChainWork, std::string& strError)
+{
+    const Consensus::Params& params = chainparams.GetConsensus();
+    const MapCheckpoints& checkpoints = chainparams.Checkpoints().mapCheckpoints;
+    CAutoFile file(fsbridge::fopen(path, "rb"), SER_DISK, CLIENT_VERSION);
+    if (file.IsNull()) {
+        strError = strprintf("unable to open %s", path.string());
+        return false;
+    }
+    try {
+        CMessageHeader::MessageStartChars pchMessageStart;
+        file >> FLATDATA(pchMessageStart);
+        if (memcmp(pchMessageStart, chainparams.MessageStart(), MESSAGE_START_SIZE) != 0) {
+            strError = "the header snapshot is for a different network";
+            return false;
+        }
+        uint32_t nCount;
+        file >> nCount;
+        nHeaders = 0;
+        nChainWork = 0;
+        uint256 hashPrev;
+        std::vector<CBlockHeader> headers;
+        while ((uint32_t)nHeaders < nCount) {
+            headers.resize(std::min<uint32_t>(nCount - nHeaders, HEADER_SNAPSHOT_BATCH_SIZE));
+            for (CBlockHeader& header : headers) {
+                file >> header;
+                uint256 hash = header.GetHash();
+                if (nHeaders == 0 ? hash != params.hashGenesisBlock : header.hashPrevBlock != hashPrev) {
+                    strError = strprintf("the header at height %d does not extend the one before it", nHeaders);
+                    return false;
+                }
+                MapCheckpoints::const_iterator itCheckpoint = checkpoints.find(nHeaders);
+                if (itCheckpoint != checkpoints.end() && itCheckpoint->second != hash) {
+                    strError = strprintf("the header at height %d does not match the checkpoint", nHeaders);
+                    return false;
+                }
+                nChainWork += GetBlockProof(CBlockIndex(header));
+                hashPrev = hash;
+                nHeaders++;
+            }
+            if (!fAccept)
+                continue;
+
+            PrecheckBlockHeaders(headers, chainparams);
+            LOCK(cs_main);
+            for (const CBlockHeader& header : headers) {
+                CValidationState state;
+                if (!AcceptBlockHeader(header, state, chainparams)) {
+                    strError = strprintf("invalid header %s: %s", header.GetHash().ToString(), state.GetRejectReason());
+                    return false;
+                }
+            }
+        }
+    } catch (const std::exception& e) {
+        strError = strprintf("unable to read the header snapshot: %s", e.what());
+        return false;
+    }
+    return true;
+}
+
+bool LoadHeaderSnapshot(const CChainParams& chainparams, const fs::path& path, int& nHeaders, std::string& strError)
+{
+    int64_t nStart = GetTimeMillis();
+    const Consensus::Params& params = chainparams.GetConsensus();
+
+    // The snapshot is only trusted as far as the checkpoints and the minimum
+    // chain work vouch for it, so check those before anything is added.
+    arith_uint256 nChainWork;
+    if (!ReadHeaderSnapshot(chainparams, path, false, nHeaders, nChainWork, strError))
+        return false;
+    const MapCheckpoints& checkpoints = chainparams.Checkpoints().mapCheckpoints;
+    if (fCheckpointsEnabled && !checkpoints.empty() && nHeaders <= checkpoints.rbegin()->first) {
+        strError = "the header snapshot does not reach the last checkpoint";
+        return false;
+    }
+    if (nChainWork < UintToArith256(params.nMinimumChainWork)) {
+        strError = "the header snapshot has less than the minimum chain work";
+        return false;
+    }
+
+    // Under -assumevalidheaders most Equihash solutions below the last
+    // checkpoint are then skipped, and a sample of them checked.
+    if (!ReadHeaderSnapshot(chainparams, path, true, nHeaders, nChainWork, strError))
+        return false;
+
+    LOCK(cs_main);
+    CheckBlockIndex(params);
+    LogPrintf("Imported %d headers from %s, best header at height %d: %dms\n",
+        nHeaders, path.string(), pindexBestHeader ? pindexBestHeader->nHeight : -1, GetTimeMillis() - nStart);
+    return true;
+}
+
+static const uint64_t MEMPOOL_DUMP_VERSION = 1;
+/** Number of transactions read from mempool.dat whose proofs are verified together before they are admitted. */
+static const size_t MEMPOOL_LOAD_BATCH_SIZE = 100;
+
+bool DumpMempool()
+{
+    int64_t nStart = GetTimeMillis();
+    fs::path path = GetDataDir() / "mempool.dat";
+    fs::path pathTmp = path;
+    pathTmp += ".new";
+    CAutoFile file(fsbridge::fopen(pathTmp, "wb"), SER_DISK, CLIENT_VERSION);
+    if (file.IsNull()) {
+        return error("%s: unable to open %s for writing", __func__, pathTmp.string());
+    }
+
+    size_t nTransactions;
+    try {
+        LOCK(mempool.cs);
+        // Write the transactions with fewer in-mempool ancestors first, so that
+        // every transaction comes after its parents and can be re-admitted.
+        std::vector<const CTxMemPoolEntry*> vEntries;
+        vEntries.reserve(mempool.mapTx.size());
+        for (const CTxMemPoolEntry& entry : mempool.mapTx) {
+            vEntries.push_back(&entry);
+        }
+        std::sort(vEntries.begin(), vEntries.end(), [](const CTxMemPoolEntry* a, const CTxMemPoolEntry* b) {
+            return a->GetCountWithAncestors() < b->GetCountWithAncestors();
+        });
+
+        file << MEMPOOL_DUMP_VERSION;
+        // Written as an ordered map, so the format doesn't depend on the salt.
+        file << std::map<uint256, std::pair<double, CAmount>>(mempool.mapDeltas.begin(), mempool.mapDeltas.end());
+        mempool.WriteRecentlyEvicted(file);
+        file << (uint64_t)vEntries.size();
+        for (const CTxMemPoolEntry* pentry : vEntries) {
+            file << pentry->GetTx();
+        }
+        nTransactions = vEntries.size();
+    } catch (const std::exception& e) {
+        return error("%s: unable to write the mempool: %s", __func__, e.what());
+    }
+    FileCommit(file.Get());
+    file.fclose();
+    if (!RenameOver(pathTmp, path)) {
+        return error("%s: unable to rename %s to %s", __func__, pathTmp.string(), path.string());
+    }
+    LogPrintf("Dumped %u mempool transactions to disk: %dms\n", nTransactions, GetTimeMillis() - nStart);
+    return true;
+}
+
+bool LoadMempool(const CChainParams& chainparams)
+{
+    int64_t nStart = GetTimeMillis();
+    CAutoFile file(fsbridge::fopen(GetDataDir() / "mempool.dat", "rb"), SER_DISK, CLIENT_VERSION);
+    if (file.IsNull()) {
+        LogPrintf("Failed to open mempool file from disk. Continuing anyway.\n");
+        return false;
+    }
+
+    uint64_t nAccepted = 0;
+    uint64_t nFailed = 0;
+    try {
+        uint64_t nVersion;
+        file >> nVersion;
+        if (nVersion != MEMPOOL_DUMP_VERSION) {
+            return error("%s: unknown mempool file version %d", __func__, nVersion);
+        }
+
+        // The deltas are applied before the transactions are admitted, as
+        // AcceptToMemoryPool takes them into account.
+        std::map<uint256, std::pair<double, CAmount>> mapDeltas;
+        file >> mapDeltas;
+        for (const auto& delta : mapDeltas) {
+            mempool.PrioritiseTransaction(delta.first, delta.first.ToString(), delta.second.first, delta.second.second);
+        }
+        mempool.ReadRecentlyEvicted(file);
+
+        // Only a batch of transactions is held in memory at a time.
+        uint64_t nTransactions;
+        file >> nTransactions;
+        std::vector<CTransaction> vBatch;
+        while (nTransactions > 0) {
+            vBatch.clear();
+            while (nTransactions > 0 && vBatch.size() < MEMPOOL_LOAD_BATCH_SIZE) {
+                CTransaction tx;
+                file >> tx;
+                vBatch.push_back(tx);
+                nTransactions--;
+            }
+
+            uint32_t consensusBranchId;
+            {
+                LOCK(cs_main);
+                consensusBranchId = CurrentEpochBranchId(chainActive.Height() + 1, chainparams.GetConsensus());
+            }
+            std::vector<const CTransaction*> vtxProofs;
+            for (const CTransaction& tx : vBatch) {
+                vtxProofs.push_back(&tx);
+            }
+            CacheTransactionProofs(vtxProofs, consensusBranchId);
+
+            LOCK(cs_main);
+            for (const CTransaction& tx : vBatch) {
+                CValidationState state;
+                if (AcceptToMemoryPool(chainparams, mempool, state, tx, false, NULL)) {
+                    nAccepted++;
+                } else {
+                    nFailed++;
+                }
+            }
+            if (ShutdownRequested())
+                return false;
+        }
+    } catch (const std::exception& e) {
+        LogPrintf("%s: failed to deserialize mempool data on disk: %s. Continuing anyway.\n", __func__, e.what());
+        return false;
+    }
+
+    LogPrintf("Imported mempool transactions from disk: %u successes, %u failed: %dms\n",
+              nAccepted, nFailed, GetTimeMillis() - nStart);
+    return true;
+}
+
+CVerifyDB::CVerifyDB()
+{
+    uiInterface.ShowProgress(_("Verifying blocks..."), 0);
+}
+
+CVerifyDB::~CVerifyDB()
+{
+    uiInterface.ShowProgress("", 100);
+}
+
+bool CVerifyDB::VerifyDB(const CChainParams& chainparams, CCoinsView *coinsview, int nCheckLevel, int nCheckDepth)
+{
+    LOCK(cs_main);
+    if (chainActive.Tip() == NULL || chainActive.Tip()->pprev == NULL)
+        return true;
+
+    // Verify blocks in the best chain
+    if (nCheckDepth <= 0)
+        nCheckDepth = 1000000000; // suffices until the year 19000
+    if (nCheckDepth > chainActive.Height())
+        nCheckDepth = chainActive.Height();
+    // The blocks up to the base of a UTXO set snapshot are not stored.
+    if (pindexSnapshotBase) {
+        nCheckDepth = std::min(nCheckDepth, chainActive.Height() - pindexSnapshotBase->nHeight - 1);
+        if (nCheckDepth < 0)
+            return true;
+    }
+    nCheckLevel = std::max(0, std::min(4, nCheckLevel));
+    LogPrintf("Verifying last %i blocks at level %i\n", nCheckDepth, nCheckLevel);
+    CCoinsViewCache coins(coinsview);
+    CBlockIndex* pindexState = chainActive.Tip();
+    CBlockIndex* pindexFailure = NULL;
+    int nGoodTransactions = 0;
+    CValidationState state;
+
+    // Flags used to permit skipping checks for efficiency
+    auto verifier = ProofVerifier::Disabled(); // No need to verify JoinSplits twice
+    bool fCheckTransactions = true;
+
+    for (CBlockIndex* pindex = chainActive.Tip(); pindex && pindex->pprev; pindex = pindex->pprev)
+    {
+        boost::this_thread::interruption_point();
+        uiInterface.ShowProgress(_("Verifying blocks..."), std::max(1, std::min(99, (int)(((double)(chainActive.Height() - pindex->nHeight)) / (double)nCheckDepth * (nCheckLevel >= 4 ? 50 : 100)))));
+        if (pindex->nHeight < chainActive.Height()-nCheckDepth)
+            break;
+
+        CBlock block;
+        // check level 0: read from disk
+        if (!ReadBlockFromDisk(block, pindex, chainparams.GetConsensus()))
+            return error("VerifyDB(): *** ReadBlockFromDisk failed at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
+
+        // check level 1: verify block validity
+        fCheckTransactions = ShouldCheckTransactions(chainparams, pindex);
+        if (nCheckLevel >= 1 && !CheckBlock(block, state, chainparams, verifier, true, true, fCheckTransactions))
+            return error("VerifyDB(): *** found bad block at %d, hash=%s\n", pindex->nHeight, pindex->GetBlockHash().ToString());
+
+        // check level 2: verify undo validity
+        if (nCheckLevel >= 2 && pindex) {
+            CBlockUndo undo;
+            CDiskBlockPos pos = pindex->GetUndoPos();
+            if (!pos.IsNull()) {
+                if (!UndoReadFromDisk(undo, pos, pindex->pprev->GetBlockHash()))
+                    return error("VerifyDB(): *** found bad undo data at %d, hash=%s\n", pindex->nHeight, pindex->GetBlockHash().ToString());
+            }
+        }
+
+        // check level 3: check for inconsistencies during memory-only disconnect of tip blocks
+        if (nCheckLevel >= 3 && pindex == pindexState && (coins.DynamicMemoryUsage() + pcoinsTip->DynamicMemoryUsage()) <= nCoinCacheUsage) {
+            // insightexplorer: do not update indices (false)
+            DisconnectResult res = DisconnectBlock(block, state, pindex, coins, chainparams, false);
+            if (res == DISCONNECT_FAILED) {
+                return error("VerifyDB(): *** irrecoverable inconsistency in block data at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
+            }
+            pindexState = pindex->pprev;
+            if (res == DISCONNECT_UNCLEAN) {
+                nGoodTransactions = 0;
+                pindexFailure = pindex;
+            } else {
+                nGoodTransactions += block.vtx.size();
+            }
+        }
+
+        if (ShutdownRequested())
+            return true;
+    }
+    if (pindexFailure)
+        return error("VerifyDB(): *** coin database inconsistencies found (last %i blocks, %i good transactions before that)\n", chainActive.Height() - pindexFailure->nHeight + 1, nGoodTransactions);
+
+    // check level 4: try reconnecting blocks
+    if (nCheckLevel >= 4) {
+        CBlockIndex *pindex = pindexState;
+        while (pindex != chainActive.Tip()) {
+            boost::this_thread::interruption_point();
+            uiInterface.ShowProgress(_("Verifying blocks..."), std::max(1, std::min(99, 100 - (int)(((double)(chainActive.Height() - pindex->nHeight)) / (double)nCheckDepth * 50))));
+            pindex = chainActive.Next(pindex);
+            CBlock block;
+            if (!ReadBlockFromDisk(block, pindex, chainparams.GetConsensus()))
+                return error("VerifyDB(): *** ReadBlockFromDisk failed at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
+            if (!ConnectBlock(block, state, pindex, coins, chainparams))
+                return error("VerifyDB(): *** found unconnectable block at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
+        }
+    }
+
+    LogPrintf("No coin database inconsistencies in last %i blocks (%i transactions)\n", chainActive.Height() - pindexState->nHeight, nGoodTransactions);
+
+    return true;
+}
+
+/** Time that ThreadVerifyDB waits between blocks, to leave cs_main and the disk to the node */
+static const int64_t VERIFYDB_BACKGROUND_DELAY_MS = 20;
+
+void ThreadVerifyDB(const CChainParams& chainparams, int nCheckLevel, int nStartHeight, int nStopHeight, bool fHaltOnFailure)
+{
+    RenameThread("zcash-verifydb");
+    SetThreadPriority(THREAD_PRIORITY_LOWEST);
+
+    // The disconnect and reconnect checks of levels 3 and 4 need the chain
+    // state at the tip, which changes while this runs.
+    nCheckLevel = std::max(0, std::min(2, nCheckLevel));
+    {
+        LOCK(cs_main);
+        // The blocks up to the base of a UTXO set snapshot are not stored.
+        if (pindexSnapshotBase) {
+            nStopHeight = std::max(nStopHeight, pindexSnapshotBase->nHeight + 1);
+        }
+    }
+    nStopHeight = std::max(nStopHeight, 1);
+    LogPrintf("Verifying blocks %i to %i at level %i in the background\n", nStopHeight, nStartHeight, nCheckLevel);
+
+    int64_t nStart = GetTimeMillis();
+    auto verifier = ProofVerifier::Disabled();
+    for (int nHeight = nStartHeight; nHeight >= nStopHeight; nHeight--) {
+        MilliSleep(VERIFYDB_BACKGROUND_DELAY_MS);
+        if (ShutdownRequested())
+            return;
+
+        std::string strError;
+        {
+            LOCK(cs_main);
+            CBlockIndex* pindex = chainActive[nHeight];
+            if (!pindex) {
+                continue;
+            }
+            // Pruned blocks are not checked.
+            if (fHavePruned && !(pindex->nStatus & BLOCK_HAVE_DATA)) {
+                break;
+            }
+
+            CBlock block;
+            CValidationState state;
+            if (!ReadBlockFromDisk(block, pindex, chainparams.GetConsensus())) {
+                strError = "ReadBlockFromDisk failed";
+            } else if (nCheckLevel >= 1 &&
+                       !CheckBlock(block, state, chainparams, verifier, true, true, ShouldCheckTransactions(chainparams, pindex))) {
+                strError = "found bad block";
+            } else if (nCheckLevel >= 2 && !pindex->GetUndoPos().IsNull()) {
+                CBlockUndo undo;
+                if (!UndoReadFromDisk(undo, pindex->GetUndoPos(), pindex->pprev->GetBlockHash())) {
+                    strError = "found bad undo data";
+                }
+            }
+            if (!strError.empty()) {
+                strError = strprintf("VerifyDB(): *** %s at %d, hash=%s", strError, pindex->nHeight, pindex->GetBlockHash().ToString());
+            }
+        }
+
+        if (!strError.empty()) {
+            if (fHaltOnFailure) {
+                AbortNode(strError, _("Corrupted block database detected. Please restart with -reindex to recover."));
+            } else {
+                LogPrintf("%s\n", strError);
+                SetMiscWarning(_("Warning: Corrupted block database detected. Please restart with -reindex to recover."), GetTime());
+            }
+            return;
+        }
+    }
+
+    LogPrintf("No problems found in blocks %i to %i: %dms\n", nStopHeight, nStartHeight, GetTimeMillis() - nStart);
+}
+
+bool RewindBlockIndex(const CChainParams& chainparams, bool& clearWitnessCaches)
+{
+    LOCK(cs_main);
+
+    // RewindBlockIndex is called after LoadBlockIndex, so at this point every block
+    // index will have nCachedBranchId set based on the values previously persisted
     // to disk. By definition, a set nCachedBranchId means that the block was
     // fully-validated under the corresponding consensus rules. Thus we can quickly
     // identify whether the current active chain matches our expected sequence of
@@ -5005,7 +7471,9 @@ bool RewindBlockIndex(const CChainParams& chainparams, bool& clearWitnessCaches)
             *pindex->nCachedBranchId == CurrentEpochBranchId(pindex->nHeight, consensus);
     };
 
-    int lastValidHeight = 0;
+    // The base of a UTXO set snapshot was validated by whoever pinned its
+    // hash, and the blocks before it are not stored.
+    int lastValidHeight = pindexSnapshotBase ? pindexSnapshotBase->nHeight : 0;
     while (lastValidHeight < chainActive.Height()) {
         if (sufficientlyValidated(chainActive[lastValidHeight + 1])) {
             lastValidHeight++;
@@ -5064,6 +7532,10 @@ bool RewindBlockIndex(const CChainParams& chainparams, bool& clearWitnessCaches)
 
     CValidationState state;
     CBlockIndex* pindex = chainActive.Tip();
+    std::unique_ptr<CDisconnectPrefetcher> prefetcher;
+    if (chainActive.Height() > lastValidHeight + 1) {
+        prefetcher.reset(new CDisconnectPrefetcher(chainparams, chainActive.Tip(), chainActive[lastValidHeight]));
+    }
     while (chainActive.Height() > lastValidHeight) {
         if (fPruneMode && !(chainActive.Tip()->nStatus & BLOCK_HAVE_DATA)) {
             // If pruning, don't try rewinding past the HAVE_DATA point;
@@ -5073,7 +7545,7 @@ bool RewindBlockIndex(const CChainParams& chainparams, bool& clearWitnessCaches)
             // of the blockchain).
             break;
         }
-        if (!DisconnectTip(state, chainparams, true)) {
+        if (!DisconnectTip(state, chainparams, NULL, prefetcher.get())) {
             return error("RewindBlockIndex: unable to disconnect block at height %i", pindex->nHeight);
         }
         // Occasionally flush state to disk.
@@ -5129,6 +7601,7 @@ bool RewindBlockIndex(const CChainParams& chainparams, bool& clearWitnessCaches)
         auto ret = mapBlockIndex.find(*pindex->phashBlock);
         if (ret != mapBlockIndex.end()) {
             mapBlockIndex.erase(ret);
+            blockIndexLookup.Remove(pindex);
             delete pindex;
         }
     }
@@ -5159,9 +7632,9 @@ void UnloadBlockIndex()
     chainActive.SetTip(NULL);
     pindexBestInvalid = NULL;
     pindexBestHeader = NULL;
+    pindexSnapshotBase = NULL;
     mempool.clear();
-    mapOrphanTransactions.clear();
-    mapOrphanTransactionsByPrev.clear();
+    ClearOrphanTransactions();
     nSyncStarted = 0;
     mapBlocksUnlinked.clear();
     vinfoBlockFile.clear();
@@ -5176,6 +7649,7 @@ void UnloadBlockIndex()
     mapNodeState.clear();
     recentRejects.reset(NULL);
 
+    blockIndexLookup.Clear();
     for (BlockMap::value_type& entry : mapBlockIndex) {
         delete entry.second;
     }
@@ -5183,6 +7657,19 @@ void UnloadBlockIndex()
     fHavePruned = false;
 }
 
+size_t BlockIndexDynamicMemoryUsage()
+{
+    AssertLockHeld(cs_main);
+    size_t usage = memusage::DynamicUsage(mapBlockIndex);
+    for (const BlockMap::value_type& entry : mapBlockIndex) {
+        // Only the Equihash solutions of the entries that are not yet
+        // written to the block index database are kept in memory.
+        usage += memusage::MallocUsage(sizeof(CBlockIndex)) +
+                 entry.second->SolutionDynamicMemoryUsage();
+    }
+    return usage;
+}
+
 bool LoadBlockIndex()
 {
     // Load block index from databases
@@ -5198,14 +7685,28 @@ bool InitBlockIndex(const CChainParams& chainparams)
     // Initialize global variables that cannot be constructed at startup.
     recentRejects.reset(new CRollingBloomFilter(120000, 0.000001));
 
-    // Check whether we're already initialized
-    if (chainActive.Genesis() != NULL)
+    // Check whether we're already initialized. This looks in the block index
+    // rather than chainActive, which follows the chain state and is empty when
+    // -reindex-chainstate has wiped it.
+    if (mapBlockIndex.count(chainparams.GetConsensus().hashGenesisBlock))
         return true;
 
     // Use the provided setting for -txindex in the new database
     fTxIndex = GetBoolArg("-txindex", DEFAULT_TXINDEX);
     pblocktree->WriteFlag("txindex", fTxIndex);
 
+    // Use the provided setting for -compactblockindex in the new database
+    fCompactBlockIndex = GetBoolArg("-compactblockindex", DEFAULT_COMPACTBLOCKINDEX);
+    pblocktree->WriteFlag("compactblockindex", fCompactBlockIndex);
+
+    // Use the provided setting for -blockfilterindex in the new database
+    fBlockFilterIndex = GetBoolArg("-blockfilterindex", DEFAULT_BLOCKFILTERINDEX);
+    pblocktree->WriteFlag("blockfilterindex", fBlockFilterIndex);
+
+    // Use the provided setting for -shieldedindex in the new database
+    fShieldedIndex = GetBoolArg("-shieldedindex", DEFAULT_SHIELDEDINDEX);
+    pblocktree->WriteFlag("shieldedindex", fShieldedIndex);
+
     // Use the provided setting for -insightexplorer or -lightwalletd in the new database
     pblocktree->WriteFlag("insightexplorer", fExperimentalInsightExplorer);
     pblocktree->WriteFlag("lightwalletd", fExperimentalLightWalletd);
@@ -5217,6 +7718,12 @@ bool InitBlockIndex(const CChainParams& chainparams)
     else if (fExperimentalLightWalletd) {
         fAddressIndex = true;
     }
+    pblocktree->WriteFlag("addressindex", fAddressIndex);
+    pblocktree->WriteFlag("spentindex", fSpentIndex);
+    pblocktree->WriteFlag("timestampindex", fTimestampIndex);
+    // A new address index keeps the running balance of each address.
+    fAddressBalances = fAddressIndex;
+    pblocktree->WriteFlag("addressbalances", fAddressBalances);
 
     LogPrintf("Initializing databases...\n");
 
@@ -5247,102 +7754,142 @@ bool InitBlockIndex(const CChainParams& chainparams)
     return true;
 }
 
-bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskBlockPos *dbp)
+/** Map of disk positions for blocks with unknown parent (only used for reindex) */
+static std::multimap<uint256, CDiskBlockPos> mapBlocksUnknownParent;
+
+/**
+ * Scan fileIn, in the format of the block files, for blocks, and call
+ * processBlock with each block, its position in the file and the number of
+ * bytes it is stored in, until it returns false. This takes over fileIn.
+ */
+static void ScanExternalBlockFile(
+    const CChainParams& chainparams,
+    FILE* fileIn,
+    const std::function<bool(CBlock&, uint64_t, unsigned int)>& processBlock)
 {
-    // Map of disk positions for blocks with unknown parent (only used for reindex)
-    static std::multimap<uint256, CDiskBlockPos> mapBlocksUnknownParent;
-    int64_t nStart = GetTimeMillis();
+    // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
+    CBufferedFile blkdat(fileIn, 2*MAX_BLOCK_SIZE, MAX_BLOCK_SIZE+8, SER_DISK, CLIENT_VERSION);
+    uint64_t nRewind = blkdat.GetPos();
+    while (!blkdat.eof()) {
+        boost::this_thread::interruption_point();
 
-    int nLoaded = 0;
-    try {
-        // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
-        CBufferedFile blkdat(fileIn, 2*MAX_BLOCK_SIZE, MAX_BLOCK_SIZE+8, SER_DISK, CLIENT_VERSION);
-        uint64_t nRewind = blkdat.GetPos();
-        size_t initialSize = nSizeReindexed;
-        while (!blkdat.eof()) {
-            boost::this_thread::interruption_point();
-
-            if (fReindex)
-               nSizeReindexed = initialSize + nRewind;
+        blkdat.SetPos(nRewind);
+        nRewind++; // start one byte further next time, in case of failure
+        blkdat.SetLimit(); // remove former limit
+        unsigned int nSize = 0;
+        try {
+            // locate a header
+            unsigned char buf[MESSAGE_START_SIZE];
+            blkdat.FindByte(chainparams.MessageStart()[0]);
+            nRewind = blkdat.GetPos()+1;
+            blkdat >> FLATDATA(buf);
+            if (memcmp(buf, chainparams.MessageStart(), MESSAGE_START_SIZE))
+                continue;
+            // read size
+            blkdat >> nSize;
+            if ((nSize & ~BLOCK_RECORD_COMPRESSED) > MAX_BLOCK_SIZE)
+                continue;
+            if (!(nSize & BLOCK_RECORD_COMPRESSED) && nSize < 80)
+                continue;
+        } catch (const std::exception&) {
+            // no valid block header found; don't complain
+            break;
+        }
+        try {
+            // read block
+            uint64_t nBlockPos = blkdat.GetPos();
+            unsigned int nStoredSize = nSize & ~BLOCK_RECORD_COMPRESSED;
+            blkdat.SetLimit(nBlockPos + nStoredSize);
+            blkdat.SetPos(nBlockPos);
+            CBlock block;
+            if (nSize & BLOCK_RECORD_COMPRESSED) {
+                std::vector<char> vCompressed(nStoredSize);
+                std::vector<char> vData;
+                blkdat.read(vCompressed.data(), nStoredSize);
+                if (!DecompressBlockRecord(vCompressed.data(), vCompressed.data() + nStoredSize, vData, MAX_BLOCK_SIZE))
+                    throw std::ios_base::failure("invalid compressed block");
+                CMemoryReader(SER_DISK, CLIENT_VERSION, vData.data(), vData.data() + vData.size()) >> block;
+            } else {
+                blkdat >> block;
+            }
+            nRewind = blkdat.GetPos();
 
-            blkdat.SetPos(nRewind);
-            nRewind++; // start one byte further next time, in case of failure
-            blkdat.SetLimit(); // remove former limit
-            unsigned int nSize = 0;
-            try {
-                // locate a header
-                unsigned char buf[MESSAGE_START_SIZE];
-                blkdat.FindByte(chainparams.MessageStart()[0]);
-                nRewind = blkdat.GetPos()+1;
-                blkdat >> FLATDATA(buf);
-                if (memcmp(buf, chainparams.MessageStart(), MESSAGE_START_SIZE))
-                    continue;
-                // read size
-                blkdat >> nSize;
-                if (nSize < 80 || nSize > MAX_BLOCK_SIZE)
-                    continue;
-            } catch (const std::exception&) {
-                // no valid block header found; don't complain
+            if (!processBlock(block, nBlockPos, nStoredSize))
                 break;
-            }
-            try {
-                // read block
-                uint64_t nBlockPos = blkdat.GetPos();
-                if (dbp)
-                    dbp->nPos = nBlockPos;
-                blkdat.SetLimit(nBlockPos + nSize);
-                blkdat.SetPos(nBlockPos);
-                CBlock block;
-                blkdat >> block;
-                nRewind = blkdat.GetPos();
-
-                // detect out of order blocks, and store them for later
-                uint256 hash = block.GetHash();
-                if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex.find(block.hashPrevBlock) == mapBlockIndex.end()) {
-                    LogPrint("reindex", "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
-                            block.hashPrevBlock.ToString());
-                    if (dbp)
-                        mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, *dbp));
-                    continue;
-                }
+        } catch (const std::exception& e) {
+            LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
+        }
+    }
+}
 
-                // process in case the block isn't known yet
-                if (mapBlockIndex.count(hash) == 0 || (mapBlockIndex[hash]->nStatus & BLOCK_HAVE_DATA) == 0) {
-                    CValidationState state;
-                    if (ProcessNewBlock(state, chainparams, NULL, &block, true, dbp))
-                        nLoaded++;
-                    if (state.IsError())
-                        break;
-                } else if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex[hash]->nHeight % 1000 == 0) {
-                    LogPrintf("Block Import: already had block %s at height %d\n", hash.ToString(), mapBlockIndex[hash]->nHeight);
-                }
+/**
+ * Process a block read from a block file or an external file, and then the
+ * blocks read earlier whose parent it is. Returns false if loading has to
+ * stop because of a system error.
+ */
+static bool ProcessExternalBlock(const CChainParams& chainparams, CBlock& block, const uint256& hash, CDiskBlockPos *dbp, int& nLoaded)
+{
+    // detect out of order blocks, and store them for later
+    if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex.find(block.hashPrevBlock) == mapBlockIndex.end()) {
+        LogPrint("reindex", "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
+                block.hashPrevBlock.ToString());
+        if (dbp)
+            mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, *dbp));
+        return true;
+    }
 
-                // Recursively process earlier encountered successors of this block
-                deque<uint256> queue;
-                queue.push_back(hash);
-                while (!queue.empty()) {
-                    uint256 head = queue.front();
-                    queue.pop_front();
-                    std::pair<std::multimap<uint256, CDiskBlockPos>::iterator, std::multimap<uint256, CDiskBlockPos>::iterator> range = mapBlocksUnknownParent.equal_range(head);
-                    while (range.first != range.second) {
-                        if (ReadBlockFromDisk(block, range.first->second, chainparams.GetConsensus()))
-                        {
-                            LogPrintf("%s: Processing out of order child %s of %s\n", __func__, block.GetHash().ToString(),
-                                    head.ToString());
-                            CValidationState dummy;
-                            if (ProcessNewBlock(dummy, chainparams, NULL, &block, true, &(range.first->second)))
-                            {
-                                nLoaded++;
-                                queue.push_back(block.GetHash());
-                            }
-                        }
-                        range.first = mapBlocksUnknownParent.erase(range.first);
-                    }
+    // process in case the block isn't known yet
+    if (mapBlockIndex.count(hash) == 0 || (mapBlockIndex[hash]->nStatus & BLOCK_HAVE_DATA) == 0) {
+        CValidationState state;
+        if (ProcessNewBlock(state, chainparams, NULL, &block, true, dbp))
+            nLoaded++;
+        if (state.IsError())
+            return false;
+    } else if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex[hash]->nHeight % 1000 == 0) {
+        LogPrintf("Block Import: already had block %s at height %d\n", hash.ToString(), mapBlockIndex[hash]->nHeight);
+    }
+
+    // Recursively process earlier encountered successors of this block
+    deque<uint256> queue;
+    queue.push_back(hash);
+    while (!queue.empty()) {
+        uint256 head = queue.front();
+        queue.pop_front();
+        std::pair<std::multimap<uint256, CDiskBlockPos>::iterator, std::multimap<uint256, CDiskBlockPos>::iterator> range = mapBlocksUnknownParent.equal_range(head);
+        while (range.first != range.second) {
+            if (ReadBlockFromDisk(block, range.first->second, chainparams.GetConsensus()))
+            {
+                LogPrintf("%s: Processing out of order child %s of %s\n", __func__, block.GetHash().ToString(),
+                        head.ToString());
+                CValidationState dummy;
+                if (ProcessNewBlock(dummy, chainparams, NULL, &block, true, &(range.first->second)))
+                {
+                    nLoaded++;
+                    queue.push_back(block.GetHash());
                 }
-            } catch (const std::exception& e) {
-                LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
             }
+            range.first = mapBlocksUnknownParent.erase(range.first);
         }
+    }
+    return true;
+}
+
+bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskBlockPos *dbp)
+{
+    int64_t nStart = GetTimeMillis();
+
+    int nLoaded = 0;
+    try {
+        size_t initialSize = nSizeReindexed;
+        ScanExternalBlockFile(chainparams, fileIn, [&](CBlock& block, uint64_t nBlockPos, unsigned int nStoredSize) {
+            if (fReindex)
+                nSizeReindexed = initialSize + nBlockPos;
+            if (dbp) {
+                dbp->nPos = nBlockPos;
+                dbp->nSize = nStoredSize;
+            }
+            return ProcessExternalBlock(chainparams, block, block.GetHash(), dbp, nLoaded);
+        });
     } catch (const std::runtime_error& e) {
         AbortNode(std::string("System error: ") + e.what());
     }
@@ -5351,6 +7898,173 @@ bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskB
     return nLoaded > 0;
 }
 
+namespace {
+
+/** A block scanned from a block file ahead of validation. */
+struct ScannedBlock {
+    uint64_t nPos;
+    unsigned int nSize;
+    uint256 hash;
+    //! The Equihash solution and proof of work of the header are valid.
+    bool fChecked;
+    CBlock block;
+};
+
+/** Block files scanned ahead of validation by ReindexBlockFiles(). */
+class CBlockFileScanner
+{
+private:
+    const CChainParams& chainparams;
+    const int nFiles;
+    const int nThreads;
+
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    //! The next file to scan.
+    int nNextScan;
+    //! The next file to be handed to validation.
+    int nNextProcess;
+    std::map<int, std::vector<ScannedBlock>> mapScanned;
+    bool fStop;
+
+    boost::thread_group threadGroup;
+
+    void ThreadScan()
+    {
+        const Consensus::Params& consensusParams = chainparams.GetConsensus();
+        while (true) {
+            int nFile;
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                // Only scan as far ahead as there are threads, to bound the memory used.
+                while (!fStop && nNextScan < nFiles && nNextScan >= nNextProcess + nThreads) {
+                    cond.wait(lock);
+                }
+                if (fStop || nNextScan >= nFiles) {
+                    return;
+                }
+                nFile = nNextScan++;
+            }
+
+            std::vector<ScannedBlock> vBlocks;
+            FILE* file = OpenBlockFile(CDiskBlockPos(nFile, 0), true);
+            if (file) {
+                try {
+                    ScanExternalBlockFile(chainparams, file, [&](CBlock& block, uint64_t nBlockPos, unsigned int nStoredSize) {
+                        ScannedBlock scanned;
+                        scanned.nPos = nBlockPos;
+                        scanned.nSize = nStoredSize;
+                        scanned.hash = block.GetHash();
+                        scanned.fChecked = CheckEquihashSolution(&block, consensusParams) &&
+                                           CheckProofOfWork(scanned.hash, block.nBits, consensusParams);
+                        scanned.block = std::move(block);
+                        vBlocks.push_back(std::move(scanned));
+                        return true;
+                    });
+                } catch (const std::runtime_error& e) {
+                    LogPrintf("%s: error reading blk%05u.dat: %s\n", __func__, (unsigned int)nFile, e.what());
+                }
+            }
+
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                mapScanned[nFile] = std::move(vBlocks);
+            }
+            cond.notify_all();
+        }
+    }
+
+public:
+    CBlockFileScanner(const CChainParams& chainparamsIn, int nFilesIn, int nThreadsIn) :
+        chainparams(chainparamsIn), nFiles(nFilesIn), nThreads(nThreadsIn),
+        nNextScan(0), nNextProcess(0), fStop(false)
+    {
+        for (int i = 0; i < nThreads; i++) {
+            threadGroup.create_thread([this] { ThreadScan(); });
+        }
+    }
+
+    ~CBlockFileScanner()
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            fStop = true;
+        }
+        cond.notify_all();
+        threadGroup.interrupt_all();
+        threadGroup.join_all();
+    }
+
+    //! Wait for the blocks of file nFile, which must be the next one.
+    std::vector<ScannedBlock> Take(int nFile)
+    {
+        std::vector<ScannedBlock> vBlocks;
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            assert(nFile == nNextProcess);
+            while (!mapScanned.count(nFile)) {
+                cond.wait(lock);
+            }
+            vBlocks = std::move(mapScanned[nFile]);
+            mapScanned.erase(nFile);
+            nNextProcess++;
+        }
+        cond.notify_all();
+        return vBlocks;
+    }
+};
+
+} // namespace
+
+void ReindexBlockFiles(const CChainParams& chainparams, int nFiles, int nThreads)
+{
+    if (nThreads == 0) {
+        for (int nFile = 0; nFile < nFiles; nFile++) {
+            CDiskBlockPos pos(nFile, 0);
+            FILE *file = OpenBlockFile(pos, true);
+            if (!file)
+                break; // This error is logged in OpenBlockFile
+            LogPrintf("Reindexing block file blk%05u.dat...\n", (unsigned int)nFile);
+            LoadExternalBlockFile(chainparams, file, &pos);
+        }
+        return;
+    }
+
+    // The block files are scanned, and the Equihash solutions and proofs of
+    // work of their blocks checked, on nThreads threads, while the blocks
+    // are validated on this thread in the order of the files.
+    CBlockFileScanner scanner(chainparams, nFiles, nThreads);
+    for (int nFile = 0; nFile < nFiles; nFile++) {
+        std::vector<ScannedBlock> vBlocks = scanner.Take(nFile);
+        LogPrintf("Reindexing block file blk%05u.dat...\n", (unsigned int)nFile);
+        int64_t nStart = GetTimeMillis();
+        int nLoaded = 0;
+        size_t initialSize = nSizeReindexed;
+        CDiskBlockPos pos(nFile, 0);
+        for (ScannedBlock& scanned : vBlocks) {
+            boost::this_thread::interruption_point();
+            nSizeReindexed = initialSize + scanned.nPos;
+            pos.nPos = scanned.nPos;
+            pos.nSize = scanned.nSize;
+            if (scanned.fChecked)
+                setPrecheckedHeaders.insert(scanned.hash);
+            bool fContinue = true;
+            try {
+                fContinue = ProcessExternalBlock(chainparams, scanned.block, scanned.hash, &pos, nLoaded);
+            } catch (const std::exception& e) {
+                LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
+            }
+            setPrecheckedHeaders.clear();
+            // Release the block as soon as it has been processed.
+            scanned.block.SetNull();
+            if (!fContinue)
+                break;
+        }
+        if (nLoaded > 0)
+            LogPrintf("Loaded %i blocks from external file in %dms\n", nLoaded, GetTimeMillis() - nStart);
+    }
+}
+
 void static CheckBlockIndex(const Consensus::Params& consensusParams)
 {
     if (!fCheckBlockIndex) {
@@ -5367,6 +8081,13 @@ void static CheckBlockIndex(const Consensus::Params& consensusParams)
         return;
     }
 
+    // The invariants below assume that every block of the active chain has
+    // been received, which is not the case below the base of a UTXO set
+    // snapshot.
+    if (pindexSnapshotBase) {
+        return;
+    }
+
     // Build forward-pointing map of the entire block tree.
     std::multimap<CBlockIndex*,CBlockIndex*> forward;
     for (BlockMap::iterator it = mapBlockIndex.begin(); it != mapBlockIndex.end(); it++) {
@@ -5560,188 +8281,906 @@ bool static AlreadyHave(const CInv& inv) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
                 recentRejects->reset();
             }
 
+            {
+                boost::unique_lock<boost::mutex> lock(cs_pendingShieldedTxs);
+                if (setPendingShieldedTxs.count(inv.hash))
+                    return true;
+            }
+
+            // Use pcoinsTip->HaveCoinInCache as a quick approximation to exclude
+            // requesting or processing some txs which have already been included in a block
             return recentRejects->contains(inv.hash) ||
                    mempool.exists(inv.hash) ||
                    mapOrphanTransactions.count(inv.hash) ||
-                   pcoinsTip->HaveCoins(inv.hash);
+                   pcoinsTip->HaveCoinInCache(COutPoint(inv.hash, 0)) ||
+                   pcoinsTip->HaveCoinInCache(COutPoint(inv.hash, 1));
         }
     case MSG_BLOCK:
-        return mapBlockIndex.count(inv.hash);
+        return blockIndexLookup.Lookup(inv.hash) != NULL;
     }
     // Don't know what it is, just say we already got one
     return true;
 }
 
-void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParams)
+/**
+ * Serves the merkleblock messages of BIP 37 on worker threads, so that the
+ * message handler does not build them with cs_main held. Blocks are read
+ * once for all the peers that ask for them at about the same time, as they
+ * do for a new tip. Each peer has a budget of worker time that refills over
+ * time, so that peers with expensive filters only delay their own requests.
+ */
+class CFilteredBlockServer
+{
+private:
+    struct Request {
+        CNode* pnode;
+        const CBlockIndex* pindex;
+        //! Tip to announce after the block, if it was the peer's hashContinue
+        uint256 hashContinueTip;
+    };
+
+    struct PeerQueue {
+        std::deque<Request> requests;
+        //! Worker time in microseconds that the peer may still use
+        int64_t nBudget = FILTERED_BLOCK_BUDGET_BURST;
+        int64_t nLastRefill = 0;
+        //! Whether a worker is serving one of its requests, which are served in order
+        bool fBusy = false;
+    };
+
+    typedef std::shared_future<std::shared_ptr<const CBlock>> BlockFuture;
+
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    std::map<NodeId, PeerQueue> peers;
+    //! The peer to look at first for the next request, so that peers take turns
+    NodeId nNextPeer = 0;
+
+    //! Recently read blocks, the most recent first. Guarded by csBlocks.
+    boost::mutex csBlocks;
+    std::list<std::pair<uint256, BlockFuture>> recentBlocks;
+
+    /** Take the next request of a peer that is within its budget. */
+    bool Next(NodeId& id, Request& request, bool& fThrottled)
+    {
+        int64_t nNow = GetTimeMicros();
+        fThrottled = false;
+        auto it = peers.lower_bound(nNextPeer);
+        for (size_t i = 0, n = peers.size(); i < n; i++) {
+            if (it == peers.end())
+                it = peers.begin();
+            PeerQueue& queue = it->second;
+            queue.nBudget = std::min(FILTERED_BLOCK_BUDGET_BURST,
+                queue.nBudget + (nNow - queue.nLastRefill) * FILTERED_BLOCK_BUDGET_RATE / 1000000);
+            queue.nLastRefill = nNow;
+            if (!queue.fBusy && !queue.requests.empty()) {
+                if (queue.nBudget >= 0) {
+                    id = it->first;
+                    request = queue.requests.front();
+                    queue.requests.pop_front();
+                    queue.fBusy = true;
+                    nNextPeer = id + 1;
+                    return true;
+                }
+                fThrottled = true;
+            }
+            // Forget peers that have been idle long enough to refill their budget.
+            if (!queue.fBusy && queue.requests.empty() && queue.nBudget == FILTERED_BLOCK_BUDGET_BURST) {
+                it = peers.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        return false;
+    }
+
+    /** Read a block, or wait for another worker that is reading it. */
+    std::shared_ptr<const CBlock> GetBlock(const CBlockIndex* pindex)
+    {
+        const uint256 hash = pindex->GetBlockHash();
+        std::promise<std::shared_ptr<const CBlock>> promise;
+        BlockFuture future;
+        {
+            boost::unique_lock<boost::mutex> lock(csBlocks);
+            auto it = std::find_if(recentBlocks.begin(), recentBlocks.end(),
+                [&hash](const std::pair<uint256, BlockFuture>& entry) { return entry.first == hash; });
+            if (it != recentBlocks.end()) {
+                recentBlocks.splice(recentBlocks.begin(), recentBlocks, it);
+                MetricsIncrementCounter("zcash.net.filteredblocks.cache.hits");
+                return it->second.get();
+            }
+            future = promise.get_future().share();
+            recentBlocks.emplace_front(hash, future);
+            if (recentBlocks.size() > FILTERED_BLOCK_CACHE_SIZE)
+                recentBlocks.pop_back();
+        }
+
+        auto pblock = std::make_shared<CBlock>();
+        if (!ReadBlockFromDisk(*pblock, pindex, Params().GetConsensus())) {
+            pblock.reset();
+            boost::unique_lock<boost::mutex> lock(csBlocks);
+            recentBlocks.remove_if([&hash](const std::pair<uint256, BlockFuture>& entry) { return entry.first == hash; });
+        }
+        promise.set_value(pblock);
+        return pblock;
+    }
+
+    void Serve(const Request& request)
+    {
+        CNode* pfrom = request.pnode;
+        if (pfrom->fDisconnect)
+            return;
+
+        std::shared_ptr<const CBlock> pblock = GetBlock(request.pindex);
+        if (!pblock) {
+            LogPrint("net", "%s: cannot load block %s for peer=%d\n", __func__, request.pindex->GetBlockHash().ToString(), pfrom->id);
+            return;
+        }
+
+        bool send = false;
+        CMerkleBlock merkleBlock;
+        {
+            LOCK(pfrom->cs_filter);
+            if (pfrom->pfilter) {
+                send = true;
+                merkleBlock = CMerkleBlock(*pblock, *pfrom->pfilter);
+            }
+        }
+        if (send) {
+            pfrom->PushMessage("merkleblock", merkleBlock);
+            // As in ProcessGetData, the matched transactions follow, since
+            // the peer has no other way to ask for them.
+            for (const std::pair<unsigned int, uint256>& pair : merkleBlock.vMatchedTxn)
+                pfrom->PushMessage("tx", pblock->vtx[pair.first]);
+        }
+
+        if (!request.hashContinueTip.IsNull()) {
+            vector<CInv> vInv;
+            vInv.push_back(CInv(MSG_BLOCK, request.hashContinueTip));
+            pfrom->PushMessage("inv", vInv);
+        }
+    }
+
+public:
+    /** Queue a filtered block for a peer. */
+    void Add(CNode* pfrom, const CBlockIndex* pindex, const uint256& hashContinueTip)
+    {
+        pfrom->AddRef();
+        pfrom->nFilteredBlocksPending++;
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            peers[pfrom->GetId()].requests.push_back(Request{pfrom, pindex, hashContinueTip});
+        }
+        cond.notify_one();
+    }
+
+    void ThreadServe()
+    {
+        while (true) {
+            NodeId id;
+            Request request;
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                bool fThrottled;
+                while (!Next(id, request, fThrottled)) {
+                    // Peers over their budget are looked at again once it has refilled a little.
+                    if (fThrottled) {
+                        cond.timed_wait(lock, boost::posix_time::milliseconds(100));
+                    } else {
+                        cond.wait(lock);
+                    }
+                }
+            }
+
+            int64_t nStart = GetTimeMicros();
+            Serve(request);
+            int64_t nTime = GetTimeMicros() - nStart;
+            MetricsIncrementCounter("zcash.net.filteredblocks.served");
+            MetricsCounter("zcash.net.filteredblocks.worker.microseconds", nTime);
+
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                PeerQueue& queue = peers[id];
+                queue.fBusy = false;
+                queue.nBudget -= nTime;
+            }
+            // The next request of the peer may be taken by another worker.
+            cond.notify_one();
+
+            request.pnode->nFilteredBlocksPending--;
+            request.pnode->Release();
+            WakeMessageHandler();
+        }
+    }
+};
+
+static CFilteredBlockServer* pFilteredBlockServer = nullptr;
+
+void StartFilteredBlockServer(boost::thread_group& threadGroup, int nThreads)
+{
+    assert(pFilteredBlockServer == nullptr);
+    pFilteredBlockServer = new CFilteredBlockServer();
+    for (int i = 0; i < nThreads; i++) {
+        threadGroup.create_thread(boost::bind(&TraceThread<std::function<void()>>, "filteredblock",
+            std::function<void()>(std::bind(&CFilteredBlockServer::ThreadServe, pFilteredBlockServer))));
+    }
+}
+
+void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParams)
+{
+    int currentHeight = GetHeight();
+
+    std::deque<CInv>::iterator it = pfrom->vRecvGetData.begin();
+
+    vector<CInv> vNotFound;
+
+    LOCK(cs_main);
+
+    while (it != pfrom->vRecvGetData.end()) {
+        // Don't bother if send buffer is too full to respond anyway
+        if (pfrom->nSendSize >= SendBufferSize())
+            break;
+
+        // While filtered blocks are being served on the worker threads, only
+        // further filtered blocks are handed to them, so that the replies to
+        // the peer stay in the order of its requests.
+        if (pfrom->nFilteredBlocksPending > 0 &&
+            (it->type != MSG_FILTERED_BLOCK || pfrom->nFilteredBlocksPending >= MAX_FILTERED_BLOCKS_PENDING))
+            break;
+
+        const CInv &inv = *it;
+        {
+            boost::this_thread::interruption_point();
+            it++;
+
+            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK || inv.type == MSG_CMPCT_BLOCK)
+            {
+                bool send = false;
+                BlockMap::iterator mi = mapBlockIndex.find(inv.hash);
+                if (mi != mapBlockIndex.end())
+                {
+                    if (chainActive.Contains(mi->second)) {
+                        send = true;
+                    } else {
+                        static const int nOneMonth = 30 * 24 * 60 * 60;
+                        // To prevent fingerprinting attacks, only send blocks outside of the active
+                        // chain if they are valid, and no more than a month older (both in time, and in
+                        // best equivalent proof of work) than the best header chain we know about.
+                        send = mi->second->IsValid(BLOCK_VALID_SCRIPTS) && (pindexBestHeader != NULL) &&
+                            (pindexBestHeader->GetBlockTime() - mi->second->GetBlockTime() < nOneMonth) &&
+                            (GetBlockProofEquivalentTime(*pindexBestHeader, *mi->second, *pindexBestHeader, consensusParams) < nOneMonth);
+                        if (!send) {
+                            LogPrintf("%s: ignoring request from peer=%i for old block that isn't in the main chain\n", __func__, pfrom->GetId());
+                        }
+                    }
+                }
+                bool fHistorical = send && (pindexBestHeader != NULL) &&
+                    (pindexBestHeader->GetBlockTime() - mi->second->GetBlockTime() > HISTORICAL_BLOCK_AGE);
+                // disconnect node in case we have reached the outbound limit for serving historical blocks
+                // never disconnect whitelisted nodes
+                if (send && CNode::OutboundTargetReached(consensusParams.PoWTargetSpacing(currentHeight), true) &&
+                    (fHistorical || inv.type == MSG_FILTERED_BLOCK) && !pfrom->fWhitelisted)
+                {
+                    LogPrint("net", "historical block serving limit reached, disconnect peer=%d\n", pfrom->GetId());
+
+                    //disconnect node
+                    pfrom->fDisconnect = true;
+                    send = false;
+                }
+                // Historical blocks wait at the front of the queue while the
+                // peer's or the node's budget for serving them refills, so
+                // that peers syncing from us share the upload bandwidth, and
+                // new blocks and transactions are relayed to others first.
+                bool fShaped = fHistorical && inv.type != MSG_FILTERED_BLOCK && !pfrom->fWhitelisted;
+                if (send && fShaped && (mi->second->nStatus & BLOCK_HAVE_DATA) && !pfrom->HistoricalUploadAllowed()) {
+                    it--;
+                    break;
+                }
+                // Pruned nodes may have deleted the block, so check whether
+                // it's available before trying to send.
+                if (send && (mi->second->nStatus & BLOCK_HAVE_DATA) &&
+                    inv.type == MSG_FILTERED_BLOCK && pFilteredBlockServer)
+                {
+                    uint256 hashContinueTip;
+                    if (inv.hash == pfrom->hashContinue) {
+                        hashContinueTip = chainActive.Tip()->GetBlockHash();
+                        pfrom->hashContinue.SetNull();
+                    }
+                    pFilteredBlockServer->Add(pfrom, mi->second, hashContinueTip);
+                    GetMainSignals().Inventory(inv.hash);
+                    // Carry on with the next request, which the loop only
+                    // takes if it is another filtered block.
+                    continue;
+                }
+                else if (send && (mi->second->nStatus & BLOCK_HAVE_DATA))
+                {
+                    // Send block from disk, as it is stored if possible
+                    CRawBlock rawBlock;
+                    if (inv.type == MSG_BLOCK && ReadRawBlockFromDisk(rawBlock, (*mi).second, Params().MessageStart()))
+                    {
+                        // Blocks are served to many peers in turn, so the
+                        // checksum of the message is kept to avoid hashing
+                        // the block again.
+                        std::optional<uint32_t> nChecksum;
+                        if (mi->second->nMessageChecksum != 0)
+                            nChecksum = mi->second->nMessageChecksum;
+                        pfrom->PushMessageWithChecksum("block", rawBlock, nChecksum);
+                        if (nChecksum)
+                            mi->second->nMessageChecksum = *nChecksum;
+                        if (fShaped)
+                            pfrom->RecordHistoricalUpload(rawBlock.size());
+                    }
+                    else if (inv.type == MSG_CMPCT_BLOCK && mi->second->nHeight >= chainActive.Height() - MAX_CMPCTBLOCK_DEPTH)
+                    {
+                        std::shared_ptr<const CBlockHeaderAndShortTxIDs> pcmpctblock = GetCompactBlock(mi->second, consensusParams);
+                        if (!pcmpctblock)
+                            assert(!"cannot load block from disk");
+                        pfrom->PushMessage("cmpctblock", *pcmpctblock);
+                    }
+                    else
+                    {
+                        CBlock block;
+                        if (!ReadBlockFromDisk(block, (*mi).second, consensusParams))
+                            assert(!"cannot load block from disk");
+                        // Peers would have few of the transactions of older blocks, which are sent in full.
+                        if (inv.type == MSG_BLOCK || inv.type == MSG_CMPCT_BLOCK) {
+                            pfrom->PushMessage("block", block);
+                            if (fShaped)
+                                pfrom->RecordHistoricalUpload(::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION));
+                        }
+                        else // MSG_FILTERED_BLOCK)
+                        {
+                            bool send = false;
+                            CMerkleBlock merkleBlock;
+                            {
+                                LOCK(pfrom->cs_filter);
+                                if (pfrom->pfilter) {
+                                    send = true;
+                                    merkleBlock = CMerkleBlock(block, *pfrom->pfilter);
+                                }
+                            }
+                            if (send) {
+                                pfrom->PushMessage("merkleblock", merkleBlock);
+                                // CMerkleBlock just contains hashes, so also push any transactions in the block the client did not see
+                                // This avoids hurting performance by pointlessly requiring a round-trip
+                                // Note that there is currently no way for a node to request any single transactions we didn't send here -
+                                // they must either disconnect and retry or request the full block.
+                                // Thus, the protocol spec specified allows for us to provide duplicate txn here,
+                                // however we MUST always provide at least what the remote peer needs
+                                typedef std::pair<unsigned int, uint256> PairType;
+                                for (PairType& pair : merkleBlock.vMatchedTxn)
+                                    pfrom->PushMessage("tx", block.vtx[pair.first]);
+                            }
+                            // else
+                                // no response
+                        }
+                    }
+
+                    // Trigger the peer node to send a getblocks request for the next batch of inventory
+                    if (inv.hash == pfrom->hashContinue)
+                    {
+                        // Bypass PushInventory, this must send even if redundant,
+                        // and we want it right after the last block so they don't
+                        // wait for other stuff first.
+                        vector<CInv> vInv;
+                        vInv.push_back(CInv(MSG_BLOCK, chainActive.Tip()->GetBlockHash()));
+                        pfrom->PushMessage("inv", vInv);
+                        pfrom->hashContinue.SetNull();
+                    }
+                }
+            }
+            else if (inv.IsKnownType())
+            {
+                // Check the mempool to see if a transaction is expiring soon.  If so, do not send to peer.
+                // Note that a transaction enters the mempool first, before it is kept
+                // in mapRelay after a successful relay.
+                bool isExpiringSoon = false;
+                bool pushed = false;
+                CTransactionRef ptx = inv.type == MSG_TX ? mempool.get(inv.hash) : nullptr;
+                bool isInMempool = ptx != nullptr;
+                if (isInMempool) {
+                    isExpiringSoon = IsExpiringSoonTx(*ptx, currentHeight + 1);
+                }
+
+                if (!isExpiringSoon) {
+                    // Send stream from relay memory
+                    {
+                        LOCK(cs_mapRelay);
+                        map<CInv, CTransactionRef>::iterator mi = mapRelay.find(inv);
+                        if (mi != mapRelay.end()) {
+                            pfrom->PushMessage(inv.GetCommand(), *mi->second);
+                            pushed = true;
+                        }
+                    }
+                    if (!pushed && inv.type == MSG_TX) {
+                        if (isInMempool) {
+                            pfrom->PushMessage("tx", *ptx);
+                            pushed = true;
+                        }
+                    }
+                }
+
+                if (!pushed) {
+                    vNotFound.push_back(inv);
+                }
+            }
+
+            // Track requests for our stuff.
+            GetMainSignals().Inventory(inv.hash);
+
+            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK || inv.type == MSG_CMPCT_BLOCK)
+                break;
+        }
+    }
+
+    pfrom->vRecvGetData.erase(pfrom->vRecvGetData.begin(), it);
+
+    if (!vNotFound.empty()) {
+        // Let the peer know that we didn't find what it asked for, so it doesn't
+        // have to wait around forever. Currently only SPV clients actually care
+        // about this message: it's needed when they are recursively walking the
+        // dependencies of relevant unconfirmed transactions. SPV clients want to
+        // do that because they want to know about (and store and rebroadcast and
+        // risk analyze) the dependencies of transactions relevant to them, without
+        // having to download the entire memory pool.
+        pfrom->PushMessage("notfound", vNotFound);
+    }
+}
+
+/** Queue the orphans that spend the outputs of tx, which has been accepted to the mempool, to be processed. */
+void static AddOrphanWork(const CTransaction& tx) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+{
+    uint256 hash = tx.GetHash();
+    for (uint32_t i = 0; i < tx.vout.size(); i++) {
+        map<COutPoint, set<uint256> >::iterator itByPrev = mapOrphanTransactionsByPrev.find(COutPoint(hash, i));
+        if (itByPrev != mapOrphanTransactionsByPrev.end())
+            setOrphanWork.insert(itByPrev->second.begin(), itByPrev->second.end());
+    }
+    fOrphanWork = !setOrphanWork.empty();
+}
+
+bool HaveOrphanWork()
+{
+    return fOrphanWork;
+}
+
+/**
+ * Process the queued orphans until one of them is accepted to the mempool or
+ * rejected, so that a burst of orphans whose parent has arrived is spread
+ * over several turns of the message handler. The orphans of an accepted
+ * orphan are queued in turn.
+ */
+void static ProcessOrphanWork(const CChainParams& chainparams) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+{
+    while (!setOrphanWork.empty())
+    {
+        uint256 orphanHash = *setOrphanWork.begin();
+        setOrphanWork.erase(setOrphanWork.begin());
+        map<uint256, COrphanTx>::iterator it = mapOrphanTransactions.find(orphanHash);
+        if (it == mapOrphanTransactions.end())
+            continue;
+
+        CTransactionRef porphanTx = it->second.tx;
+        NodeId fromPeer = it->second.fromPeer;
+        bool fMissingInputs2 = false;
+        // Use a dummy CValidationState so someone can't setup nodes to counter-DoS based on orphan
+        // resolution (that is, feeding people an invalid transaction based on LegitTxX in order to get
+        // anyone relaying LegitTxX banned)
+        CValidationState stateDummy;
+
+        if (AcceptToMemoryPool(chainparams, mempool, stateDummy, porphanTx, true, &fMissingInputs2))
+        {
+            LogPrint("mempool", "   accepted orphan tx %s\n", orphanHash.ToString());
+            RelayTransaction(porphanTx);
+            EraseOrphanTx(orphanHash);
+            AddOrphanWork(*porphanTx);
+            mempool.check(pcoinsTip);
+            break;
+        }
+        else if (!fMissingInputs2)
+        {
+            int nDos = 0;
+            if (stateDummy.IsInvalid(nDos) && nDos > 0)
+            {
+                // Punish peer that gave us an invalid orphan tx
+                Misbehaving(fromPeer, nDos);
+                LogPrint("mempool", "   invalid orphan tx %s\n", orphanHash.ToString());
+            }
+            // Has inputs but not accepted to mempool
+            // Probably non-standard or insufficient fee/priority
+            LogPrint("mempool", "   removed orphan tx %s\n", orphanHash.ToString());
+            EraseOrphanTx(orphanHash);
+            assert(recentRejects);
+            recentRejects->insert(orphanHash);
+            mempool.check(pcoinsTip);
+            break;
+        }
+    }
+    fOrphanWork = !setOrphanWork.empty();
+}
+
+/**
+ * Verify the proofs of a pending shielded transaction. Sprout proofs are
+ * verified immediately; Sapling proofs are added to saplingVerifier, which
+ * the caller must check afterwards.
+ */
+bool static VerifyPendingShieldedTxProofs(const CPendingShieldedTx& entry, ProofVerifier& saplingVerifier)
+{
+    const CTransaction& tx = *entry.tx;
+
+    auto sproutVerifier = ProofVerifier::Strict();
+    for (const JSDescription& joinsplit : tx.vJoinSplit) {
+        if (!sproutVerifier.VerifySprout(joinsplit, tx.joinSplitPubKey, true)) {
+            return false;
+        }
+    }
+
+    if (!tx.vShieldedSpend.empty() || !tx.vShieldedOutput.empty()) {
+        // Empty output script.
+        CScript scriptCode;
+        uint256 dataToBeSigned;
+        try {
+            dataToBeSigned = SignatureHash(scriptCode, tx, NOT_AN_INPUT, SIGHASH_ALL, 0, entry.consensusBranchId);
+        } catch (std::logic_error ex) {
+            return false;
+        }
+        if (saplingVerifier.VerifySapling(tx, dataToBeSigned, true) != SaplingVerificationResult::Valid) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Commit a shielded transaction to the mempool once its proofs have been
+ * verified, or reject it (with a full re-check, so that the peer is given
+ * the same reject reason and DoS score as with synchronous admission).
+ */
+void static ProcessPendingShieldedTx(const CChainParams& chainparams, const CPendingShieldedTx& entry, bool fProofsValid) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+{
+    const CTransaction& tx = *entry.tx;
+    CValidationState state;
+    bool fMissingInputs = false;
+
+    // If the tip has crossed a network upgrade since the transaction was
+    // queued, its proofs were verified against a stale consensus branch ID.
+    int nextBlockHeight = chainActive.Height() + 1;
+    bool fProofsVerified = fProofsValid &&
+        entry.consensusBranchId == CurrentEpochBranchId(nextBlockHeight, chainparams.GetConsensus());
+
+    if (AcceptToMemoryPool(chainparams, mempool, state, entry.tx, true, &fMissingInputs, false, fProofsVerified)) {
+        mempool.check(pcoinsTip);
+        RelayTransaction(entry.tx);
+
+        LogPrint("mempool", "AcceptToMemoryPool: peer=%d: accepted shielded %s (poolsz %u)\n",
+            entry.fromPeer,
+            tx.GetHash().ToString(),
+            mempool.mapTx.size());
+
+        AddOrphanWork(tx);
+    } else {
+        // Shielded transactions are never added to mapOrphans.
+        assert(recentRejects);
+        recentRejects->insert(tx.GetHash());
+
+        int nDoS = 0;
+        if (entry.fWhitelisted && GetBoolArg("-whitelistforcerelay", DEFAULT_WHITELISTFORCERELAY) &&
+            (!state.IsInvalid(nDoS) || nDoS == 0)) {
+            LogPrintf("Force relaying tx %s from whitelisted peer=%d\n", tx.GetHash().ToString(), entry.fromPeer);
+            RelayTransaction(entry.tx);
+        }
+    }
+
+    int nDoS = 0;
+    if (state.IsInvalid(nDoS))
+    {
+        LogPrint("mempool", "%s from peer=%d was not accepted into the memory pool: %s\n", tx.GetHash().ToString(),
+            entry.fromPeer,
+            state.GetRejectReason());
+        {
+            LOCK(cs_vNodes);
+            for (CNode* pnode : vNodes) {
+                if (pnode->GetId() == entry.fromPeer) {
+                    pnode->PushMessage("reject", std::string("tx"), state.GetRejectCode(),
+                                       state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), tx.GetHash());
+                    break;
+                }
+            }
+        }
+        if (nDoS > 0)
+            Misbehaving(entry.fromPeer, nDoS);
+    }
+}
+
+/**
+ * The cost of verifying the proofs and signatures of a shielded transaction,
+ * estimated from the numbers of its Sapling spends and outputs and JoinSplits.
+ */
+static int64_t GetShieldedVerificationCost(const CTransaction& tx)
+{
+    return SHIELDED_TX_VERIFICATION_COST +
+        SAPLING_SPEND_VERIFICATION_COST * tx.vShieldedSpend.size() +
+        SAPLING_OUTPUT_VERIFICATION_COST * tx.vShieldedOutput.size() +
+        JOINSPLIT_VERIFICATION_COST * tx.vJoinSplit.size();
+}
+
+/** The fee of a transaction, or 0 if some of its transparent inputs are not known. */
+static CAmount GetPendingShieldedTxFee(const CTransaction& tx) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+{
+    CAmount nValueIn = tx.GetShieldedValueIn();
+    if (!tx.vin.empty()) {
+        LOCK(mempool.cs);
+        CCoinsView dummy;
+        CCoinsViewCache view(&dummy);
+        CCoinsViewMemPool viewMemPool(pcoinsTip, mempool);
+        view.SetBackend(viewMemPool);
+        if (!view.HaveInputs(tx))
+            return 0;
+        nValueIn = view.GetValueIn(tx);
+    }
+    CAmount nFee = nValueIn - tx.GetValueOut();
+    return MoneyRange(nFee) ? nFee : 0;
+}
+
+/** Remove the cost of a transaction that leaves the queue from the cost of its peer. */
+static void ReleasePendingShieldedCost(const CPendingShieldedTx& entry) EXCLUSIVE_LOCKS_REQUIRED(cs_pendingShieldedTxs)
 {
-    int currentHeight = GetHeight();
+    auto it = mapPendingShieldedCost.find(entry.fromPeer);
+    if (it != mapPendingShieldedCost.end() && (it->second -= entry.nCost) <= 0)
+        mapPendingShieldedCost.erase(it);
+}
 
-    std::deque<CInv>::iterator it = pfrom->vRecvGetData.begin();
+/**
+ * Queue a shielded transaction for proof verification outside cs_main.
+ * Returns false if the transaction should instead be admitted synchronously.
+ * A transaction that does not fit in the queue is dropped, without being
+ * marked as rejected, so that it can be requested again.
+ */
+bool static QueuePendingShieldedTx(const CChainParams& chainparams, const CTransactionRef& ptx, CNode* pfrom, bool fContextFreeChecked) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+{
+    const CTransaction& tx = *ptx;
+    if (!fShieldedTxVerificationThread)
+        return false;
 
-    vector<CInv> vNotFound;
+    // Run the cheap context-free checks now, unless the message handler
+    // thread has already done so, so that malformed transactions are
+    // rejected without occupying a slot in the queue.
+    CValidationState state;
+    if (!fContextFreeChecked && !CheckTransactionWithoutProofVerification(tx, state))
+        return false;
 
-    LOCK(cs_main);
+    int nextBlockHeight = chainActive.Height() + 1;
+    int64_t nCost = GetShieldedVerificationCost(tx);
+    CPendingShieldedTx entry {
+        ptx, pfrom->GetId(), pfrom->fWhitelisted,
+        CurrentEpochBranchId(nextBlockHeight, chainparams.GetConsensus()),
+        nCost, (double)GetPendingShieldedTxFee(tx) / nCost, 0};
 
-    while (it != pfrom->vRecvGetData.end()) {
-        // Don't bother if send buffer is too full to respond anyway
-        if (pfrom->nSendSize >= SendBufferSize())
-            break;
+    {
+        boost::unique_lock<boost::mutex> lock(cs_pendingShieldedTxs);
+        if (setPendingShieldedTxs.count(tx.GetHash()))
+            return true;
 
-        const CInv &inv = *it;
-        {
-            boost::this_thread::interruption_point();
-            it++;
+        // A peer can only queue so much verification work at a time, so that
+        // one that sends many expensive transactions mostly delays its own.
+        auto itPeer = mapPendingShieldedCost.find(entry.fromPeer);
+        int64_t nPeerCost = itPeer != mapPendingShieldedCost.end() ? itPeer->second : 0;
+        if (!entry.fWhitelisted && nPeerCost + nCost > MAX_PENDING_SHIELDED_COST_PER_PEER) {
+            LogPrint("mempool", "Dropping shielded tx %s from peer=%d, which has too many pending\n",
+                tx.GetHash().ToString(), entry.fromPeer);
+            return true;
+        }
+
+        // When the queue is full, the transaction takes the place of the one
+        // with the lowest fee rate, if its own is higher.
+        if (pendingShieldedTxQueue.size() >= MAX_PENDING_SHIELDED_TXS) {
+            auto itLast = std::prev(pendingShieldedTxQueue.end());
+            if (entry.dFeeRate <= itLast->dFeeRate) {
+                LogPrint("mempool", "Dropping shielded tx %s from peer=%d, as the verification queue is full\n",
+                    tx.GetHash().ToString(), entry.fromPeer);
+                return true;
+            }
+            ReleasePendingShieldedCost(*itLast);
+            setPendingShieldedTxs.erase(itLast->tx->GetHash());
+            pendingShieldedTxQueue.erase(itLast);
+        }
+
+        entry.nSequence = nPendingShieldedTxSequence++;
+        mapPendingShieldedCost[entry.fromPeer] += nCost;
+        setPendingShieldedTxs.insert(tx.GetHash());
+        pendingShieldedTxQueue.insert(std::move(entry));
+    }
+    cvPendingShieldedTxs.notify_one();
+    return true;
+}
+
+void ThreadShieldedTxVerification()
+{
+    RenameThread("zcash-shieldtx");
+    const CChainParams& chainparams = Params();
+    fShieldedTxVerificationThread = true;
 
-            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK)
+    try {
+        while (true) {
+            std::vector<CPendingShieldedTx> vBatch;
             {
-                bool send = false;
-                BlockMap::iterator mi = mapBlockIndex.find(inv.hash);
-                if (mi != mapBlockIndex.end())
-                {
-                    if (chainActive.Contains(mi->second)) {
-                        send = true;
-                    } else {
-                        static const int nOneMonth = 30 * 24 * 60 * 60;
-                        // To prevent fingerprinting attacks, only send blocks outside of the active
-                        // chain if they are valid, and no more than a month older (both in time, and in
-                        // best equivalent proof of work) than the best header chain we know about.
-                        send = mi->second->IsValid(BLOCK_VALID_SCRIPTS) && (pindexBestHeader != NULL) &&
-                            (pindexBestHeader->GetBlockTime() - mi->second->GetBlockTime() < nOneMonth) &&
-                            (GetBlockProofEquivalentTime(*pindexBestHeader, *mi->second, *pindexBestHeader, consensusParams) < nOneMonth);
-                        if (!send) {
-                            LogPrintf("%s: ignoring request from peer=%i for old block that isn't in the main chain\n", __func__, pfrom->GetId());
-                        }
-                    }
+                boost::unique_lock<boost::mutex> lock(cs_pendingShieldedTxs);
+                while (pendingShieldedTxQueue.empty()) {
+                    cvPendingShieldedTxs.wait(lock);
                 }
-                // disconnect node in case we have reached the outbound limit for serving historical blocks
-                // never disconnect whitelisted nodes
-                static const int nOneWeek = 7 * 24 * 60 * 60; // assume > 1 week = historical
-                if (send && CNode::OutboundTargetReached(consensusParams.PoWTargetSpacing(currentHeight), true) && (
-                        (
-                            (pindexBestHeader != NULL) &&
-                            (pindexBestHeader->GetBlockTime() - mi->second->GetBlockTime() > nOneWeek)
-                        ) || inv.type == MSG_FILTERED_BLOCK
-                    ) && !pfrom->fWhitelisted)
-                {
-                    LogPrint("net", "historical block serving limit reached, disconnect peer=%d\n", pfrom->GetId());
-
-                    //disconnect node
-                    pfrom->fDisconnect = true;
-                    send = false;
+                // The cost of a batch is bounded, so that transactions that
+                // arrive while it is verified do not wait long.
+                int64_t nBatchCost = 0;
+                while (!pendingShieldedTxQueue.empty() && vBatch.size() < MAX_SHIELDED_TX_VERIFICATION_BATCH &&
+                       (vBatch.empty() || nBatchCost + pendingShieldedTxQueue.begin()->nCost <= MAX_SHIELDED_TX_VERIFICATION_BATCH_COST)) {
+                    auto node = pendingShieldedTxQueue.extract(pendingShieldedTxQueue.begin());
+                    ReleasePendingShieldedCost(node.value());
+                    nBatchCost += node.value().nCost;
+                    vBatch.push_back(std::move(node.value()));
                 }
-                // Pruned nodes may have deleted the block, so check whether
-                // it's available before trying to send.
-                if (send && (mi->second->nStatus & BLOCK_HAVE_DATA))
-                {
-                    // Send block from disk
-                    CBlock block;
-                    if (!ReadBlockFromDisk(block, (*mi).second, consensusParams))
-                        assert(!"cannot load block from disk");
-                    if (inv.type == MSG_BLOCK)
-                        pfrom->PushMessage("block", block);
-                    else // MSG_FILTERED_BLOCK)
-                    {
-                        bool send = false;
-                        CMerkleBlock merkleBlock;
-                        {
-                            LOCK(pfrom->cs_filter);
-                            if (pfrom->pfilter) {
-                                send = true;
-                                merkleBlock = CMerkleBlock(block, *pfrom->pfilter);
-                            }
-                        }
-                        if (send) {
-                            pfrom->PushMessage("merkleblock", merkleBlock);
-                            // CMerkleBlock just contains hashes, so also push any transactions in the block the client did not see
-                            // This avoids hurting performance by pointlessly requiring a round-trip
-                            // Note that there is currently no way for a node to request any single transactions we didn't send here -
-                            // they must either disconnect and retry or request the full block.
-                            // Thus, the protocol spec specified allows for us to provide duplicate txn here,
-                            // however we MUST always provide at least what the remote peer needs
-                            typedef std::pair<unsigned int, uint256> PairType;
-                            for (PairType& pair : merkleBlock.vMatchedTxn)
-                                pfrom->PushMessage("tx", block.vtx[pair.first]);
-                        }
-                        // else
-                            // no response
-                    }
+            }
 
-                    // Trigger the peer node to send a getblocks request for the next batch of inventory
-                    if (inv.hash == pfrom->hashContinue)
-                    {
-                        // Bypass PushInventory, this must send even if redundant,
-                        // and we want it right after the last block so they don't
-                        // wait for other stuff first.
-                        vector<CInv> vInv;
-                        vInv.push_back(CInv(MSG_BLOCK, chainActive.Tip()->GetBlockHash()));
-                        pfrom->PushMessage("inv", vInv);
-                        pfrom->hashContinue.SetNull();
-                    }
-                }
+            // Verify the proofs of the whole batch without holding cs_main.
+            auto saplingVerifier = ProofVerifier::Batched();
+            std::vector<bool> vProofsValid;
+            for (const CPendingShieldedTx& entry : vBatch) {
+                vProofsValid.push_back(VerifyPendingShieldedTxProofs(entry, saplingVerifier));
             }
-            else if (inv.IsKnownType())
-            {
-                // Check the mempool to see if a transaction is expiring soon.  If so, do not send to peer.
-                // Note that a transaction enters the mempool first, before the serialized form is cached
-                // in mapRelay after a successful relay.
-                bool isExpiringSoon = false;
-                bool pushed = false;
-                CTransaction tx;
-                bool isInMempool = mempool.lookup(inv.hash, tx);
-                if (isInMempool) {
-                    isExpiringSoon = IsExpiringSoonTx(tx, currentHeight + 1);
+            if (!saplingVerifier.VerifyBatch()) {
+                // At least one Sapling proof in the batch is invalid; find out
+                // which by verifying each transaction individually.
+                for (size_t i = 0; i < vBatch.size(); i++) {
+                    auto strictVerifier = ProofVerifier::Strict();
+                    vProofsValid[i] = vProofsValid[i] && VerifyPendingShieldedTxProofs(vBatch[i], strictVerifier);
                 }
+            }
 
-                if (!isExpiringSoon) {
-                    // Send stream from relay memory
-                    {
-                        LOCK(cs_mapRelay);
-                        map<CInv, CDataStream>::iterator mi = mapRelay.find(inv);
-                        if (mi != mapRelay.end()) {
-                            pfrom->PushMessage(inv.GetCommand(), (*mi).second);
-                            pushed = true;
-                        }
-                    }
-                    if (!pushed && inv.type == MSG_TX) {
-                        if (isInMempool) {
-                            CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-                            ss.reserve(1000);
-                            ss << tx;
-                            pfrom->PushMessage("tx", ss);
-                            pushed = true;
-                        }
-                    }
+            {
+                LOCK(cs_main);
+                for (size_t i = 0; i < vBatch.size(); i++) {
+                    ProcessPendingShieldedTx(chainparams, vBatch[i], vProofsValid[i]);
                 }
-
-                if (!pushed) {
-                    vNotFound.push_back(inv);
+                boost::unique_lock<boost::mutex> lock(cs_pendingShieldedTxs);
+                for (const CPendingShieldedTx& entry : vBatch) {
+                    setPendingShieldedTxs.erase(entry.tx->GetHash());
                 }
             }
+        }
+    } catch (const boost::thread_interrupted&) {
+        fShieldedTxVerificationThread = false;
+        throw;
+    }
+}
 
-            // Track requests for our stuff.
-            GetMainSignals().Inventory(inv.hash);
+/**
+ * Record how long a block took from the receipt of the message that completed
+ * it to its connection to the active chain.
+ */
+static void RecordBlockPropagation(const string& strCommand, int64_t nTimeReceived)
+{
+    AssertLockHeld(cs_main);
+    MetricsHistogram(
+        "zcash.net.block.validated.seconds",
+        (GetTimeMicros() - nTimeReceived) * 0.000001,
+        "command", strCommand.c_str());
+}
 
-            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK)
-                break;
+/**
+ * Fill a block that is being downloaded from a peer as a compact block with the
+ * transactions that it was missing, and process it. Must not be called with
+ * cs_main held, like ProcessNewBlock.
+ */
+void static ProcessBlockTransactions(const CChainParams& chainparams, CNode* pfrom, const string& strCommand, const BlockTransactions& resp, int64_t nTimeReceived)
+{
+    CBlock block;
+    {
+        LOCK(cs_main);
+
+        map<uint256, pair<NodeId, list<QueuedBlock>::iterator> >::iterator it = mapBlocksInFlight.find(resp.blockhash);
+        if (it == mapBlocksInFlight.end() || !it->second.second->partialBlock ||
+                it->second.first != pfrom->GetId()) {
+            LogPrint("net", "Peer %d sent us block transactions for block we weren't expecting\n", pfrom->id);
+            return;
+        }
+
+        ReadStatus status = it->second.second->partialBlock->FillBlock(block, resp.txn);
+        if (status == READ_STATUS_INVALID) {
+            MarkBlockAsReceived(resp.blockhash); // Reset in-flight state in case of whitelist
+            Misbehaving(pfrom->GetId(), 100);
+            LogPrintf("Peer %d sent us invalid compact block/non-matching block transactions\n", pfrom->id);
+            return;
+        }
+        // The partial block cannot be filled again.
+        it->second.second->partialBlock.reset();
+        if (status == READ_STATUS_FAILED) {
+            // Might have collided, fall back to getdata now
+            std::vector<CInv> vInv(1, CInv(MSG_BLOCK, resp.blockhash));
+            pfrom->PushMessage("getdata", vInv);
+            return;
         }
     }
 
-    pfrom->vRecvGetData.erase(pfrom->vRecvGetData.begin(), it);
+    CValidationState state;
+    ProcessNewBlock(state, chainparams, pfrom, &block, false, NULL);
+    int nDoS;
+    if (state.IsInvalid(nDoS)) {
+        pfrom->PushMessage("reject", strCommand, state.GetRejectCode(),
+                           state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), resp.blockhash);
+        if (nDoS > 0) {
+            LOCK(cs_main);
+            Misbehaving(pfrom->GetId(), nDoS);
+        }
+    } else {
+        LOCK(cs_main);
+        if (chainActive.Tip()->GetBlockHash() == resp.blockhash)
+            RecordBlockPropagation(strCommand, nTimeReceived);
+        if (!IsInitialBlockDownload(chainparams.GetConsensus()) && chainActive.Tip()->GetBlockHash() == resp.blockhash)
+            MaybeSetPeerAsAnnouncingHeaderAndIDs(pfrom->GetId());
+    }
+}
 
-    if (!vNotFound.empty()) {
-        // Let the peer know that we didn't find what it asked for, so it doesn't
-        // have to wait around forever. Currently only SPV clients actually care
-        // about this message: it's needed when they are recursively walking the
-        // dependencies of relevant unconfirmed transactions. SPV clients want to
-        // do that because they want to know about (and store and rebroadcast and
-        // risk analyze) the dependencies of transactions relevant to them, without
-        // having to download the entire memory pool.
-        pfrom->PushMessage("notfound", vNotFound);
+/**
+ * Check a getcfilters, getcfheaders or getcfcheckpt request from a peer, and
+ * find its stop block. Peers that ask for filters that the node does not
+ * serve, or for more than nMaxBlocks of them, are disconnected. Requests are
+ * ignored while the block filter index is being built.
+ */
+static bool PrepareBlockFilterRequest(CNode* pfrom, uint8_t filterType, uint32_t nStartHeight,
+                                      const uint256& hashStop, uint32_t nMaxBlocks,
+                                      const CBlockIndex*& pindexStop)
+{
+    AssertLockHeld(cs_main);
+
+    if (!(nLocalServices & NODE_COMPACT_FILTERS) || !fBlockFilterIndex ||
+        filterType != static_cast<uint8_t>(BlockFilterType::BASIC)) {
+        LogPrint("net", "peer=%d requested unsupported block filter type %d\n", pfrom->id, filterType);
+        pfrom->fDisconnect = true;
+        return false;
+    }
+    if (!IsIndexSynced(g_blockfilterindex)) {
+        LogPrint("net", "Ignoring block filter request from peer=%d while the block filter index is being built\n", pfrom->id);
+        return false;
     }
+
+    BlockMap::const_iterator it = mapBlockIndex.find(hashStop);
+    if (it == mapBlockIndex.end() || !it->second->IsValid(BLOCK_VALID_SCRIPTS)) {
+        LogPrint("net", "peer=%d requested block filters up to unknown or invalid block %s\n", pfrom->id, hashStop.ToString());
+        pfrom->fDisconnect = true;
+        return false;
+    }
+    pindexStop = it->second;
+
+    uint32_t nStopHeight = pindexStop->nHeight;
+    if (nStartHeight > nStopHeight || nStopHeight - nStartHeight >= nMaxBlocks) {
+        LogPrint("net", "peer=%d requested block filters for heights %d to %d\n", pfrom->id, nStartHeight, nStopHeight);
+        pfrom->fDisconnect = true;
+        return false;
+    }
+    return true;
+}
+
+/** Announce transactions that were reconciled with a peer, in inv messages. */
+static void AnnounceTransactions(CNode* pnode, const std::vector<uint256>& vTxids)
+{
+    std::vector<CInv> vInv;
+    for (const uint256& txid : vTxids) {
+        vInv.push_back(CInv(MSG_TX, txid));
+        if (vInv.size() >= 1000) {
+            pnode->PushMessage("inv", vInv);
+            vInv.clear();
+        }
+    }
+    if (!vInv.empty())
+        pnode->PushMessage("inv", vInv);
 }
 
-bool static ProcessMessage(const CChainParams& chainparams, CNode* pfrom, string strCommand, CDataStream& vRecv, int64_t nTimeReceived)
+bool static ProcessMessage(const CChainParams& chainparams, CNode* pfrom, string strCommand, CNetDataStream& vRecv, int64_t nTimeReceived, const CPreparedMessage& prepared)
 {
+    auto span = TracingSpan("debug", "net", "ProcessMessage",
+        "command", SanitizeString(strCommand).c_str(),
+        "size", std::to_string(vRecv.size()).c_str(),
+        "peer", std::to_string(pfrom->id).c_str());
+    auto spanGuard = span.Enter();
     LogPrint("net", "received: %s (%u bytes) peer=%d\n", SanitizeString(strCommand), vRecv.size(), pfrom->id);
     if (mapArgs.count("-dropmessagestest") && GetRand(atoi(mapArgs["-dropmessagestest"])) == 0)
     {
@@ -5923,9 +9362,23 @@ bool static ProcessMessage(const CChainParams& chainparams, CNode* pfrom, string
             LOCK(cs_main);
             State(pfrom->GetId())->fCurrentlyConnected = true;
         }
+
+        // Tell the peer that we can receive compact blocks, though not yet that
+        // we want new blocks to be announced with them; see
+        // MaybeSetPeerAsAnnouncingHeaderAndIDs. Peers that do not know the
+        // message ignore it.
+        pfrom->PushMessage("sendcmpct", false, CMPCTBLOCKS_VERSION);
+
+        // Offer to reconcile the transactions to announce, rather than
+        // sending an inv for each of them.
+        if (fTxReconciliation && pfrom->fRelayTxes) {
+            pfrom->nReconSalt = GetRand(std::numeric_limits<uint64_t>::max() - 1) + 1;
+            pfrom->PushMessage("sendrecon", TXRECONCILIATION_VERSION, pfrom->nReconSalt);
+        }
     }
 
 
+
     // Disconnect existing peer connection when:
     // 1. The version message has been received
     // 2. Peer version is below the minimum version for the current epoch
@@ -6055,9 +9508,10 @@ bool static ProcessMessage(const CChainParams& chainparams, CNode* pfrom, string
                     pfrom->PushMessage("getheaders", chainActive.GetLocator(pindexBestHeader), inv.hash);
                     CNodeState *nodestate = State(pfrom->GetId());
 
-                    if (chainActive.Tip()->GetBlockTime() > GetTime() - chainparams.GetConsensus().PoWTargetSpacing(pindexBestHeader->nHeight) * 20 &&
-                        nodestate->nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
-                        vToFetch.push_back(inv);
+                    if (CanDirectFetch(chainparams.GetConsensus()) && GetBlocksToRequest(nodestate) > 0) {
+                        // The block most likely succeeds our tip, so a peer
+                        // that supports it sends the block as a compact block.
+                        vToFetch.push_back(nodestate->fProvidesHeaderAndIDs ? CInv(MSG_CMPCT_BLOCK, inv.hash) : inv);
                         // Mark block as in flight already, even though the actual "getdata" message only goes out
                         // later (within the same cs_main lock, though).
                         MarkBlockAsInFlight(pfrom->GetId(), inv.hash, chainparams.GetConsensus());
@@ -6140,58 +9594,171 @@ bool static ProcessMessage(const CChainParams& chainparams, CNode* pfrom, string
                 LogPrint("net", " getblocks stopping, pruned or too old block at %d %s\n", pindex->nHeight, pindex->GetBlockHash().ToString());
                 break;
             }
-            pfrom->PushInventory(CInv(MSG_BLOCK, pindex->GetBlockHash()));
-            if (--nLimit <= 0)
-            {
-                // When this block is requested, we'll send an inv that'll
-                // trigger the peer to getblocks the next batch of inventory.
-                LogPrint("net", "  getblocks stopping at limit %d %s\n", pindex->nHeight, pindex->GetBlockHash().ToString());
-                pfrom->hashContinue = pindex->GetBlockHash();
-                break;
+            pfrom->PushInventory(CInv(MSG_BLOCK, pindex->GetBlockHash()));
+            if (--nLimit <= 0)
+            {
+                // When this block is requested, we'll send an inv that'll
+                // trigger the peer to getblocks the next batch of inventory.
+                LogPrint("net", "  getblocks stopping at limit %d %s\n", pindex->nHeight, pindex->GetBlockHash().ToString());
+                pfrom->hashContinue = pindex->GetBlockHash();
+                break;
+            }
+        }
+    }
+
+
+    else if (strCommand == "getheaders")
+    {
+        CBlockLocator locator;
+        uint256 hashStop;
+        vRecv >> locator >> hashStop;
+
+        LOCK(cs_main);
+        if (IsInitialBlockDownload(chainparams.GetConsensus()) && !pfrom->fWhitelisted) {
+            LogPrint("net", "Ignoring getheaders from peer=%d because node is in initial block download\n", pfrom->id);
+            return true;
+        }
+        CBlockIndex* pindex = NULL;
+        if (locator.IsNull())
+        {
+            // If locator is null, return the hashStop block
+            BlockMap::iterator mi = mapBlockIndex.find(hashStop);
+            if (mi == mapBlockIndex.end())
+                return true;
+            pindex = (*mi).second;
+        }
+        else
+        {
+            // Find the last block the caller has in the main chain
+            pindex = FindForkInGlobalIndex(chainActive, locator);
+            if (pindex)
+                pindex = chainActive.Next(pindex);
+        }
+
+        // Headers are sent as they are serialized in the header store, which
+        // is that of a CBlock, as a CBlockHeader won't include the 0x00 nTx
+        // count at the end. Those that are not in the store yet are built
+        // from the block index, and added to it.
+        std::vector<CRawBlock> vHeaders;
+        int nLimit = MAX_HEADERS_RESULTS;
+        LogPrint("net", "getheaders %d to %s from peer=%d\n", (pindex ? pindex->nHeight : -1), hashStop.ToString(), pfrom->id);
+        for (; pindex; pindex = chainActive.Next(pindex))
+        {
+            vHeaders.emplace_back();
+            if (!headerStore.Read(pindex->nHeight, pindex->GetBlockHash(), vHeaders.back())) {
+                CBlockHeader header = pindex->GetBlockHeader();
+                CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+                ss << CBlock(header);
+                vHeaders.back().Set(std::vector<char>(ss.begin(), ss.end()));
+                headerStore.Write(pindex->nHeight, header);
+            }
+            if (--nLimit <= 0 || pindex->GetBlockHash() == hashStop)
+                break;
+        }
+        pfrom->PushMessage("headers", vHeaders);
+    }
+
+
+    else if (strCommand == "getcfilters")
+    {
+        uint8_t filterType;
+        uint32_t nStartHeight;
+        uint256 hashStop;
+        vRecv >> filterType >> nStartHeight >> hashStop;
+
+        // Only the lookup of the blocks needs cs_main; their filters are read afterwards.
+        std::vector<const CBlockIndex*> vBlocks;
+        {
+            LOCK(cs_main);
+            const CBlockIndex* pindexStop;
+            if (!PrepareBlockFilterRequest(pfrom, filterType, nStartHeight, hashStop, MAX_GETCFILTERS_SIZE, pindexStop))
+                return true;
+            for (const CBlockIndex* pindex = pindexStop; pindex && pindex->nHeight >= (int)nStartHeight; pindex = pindex->pprev)
+                vBlocks.push_back(pindex);
+        }
+
+        for (auto it = vBlocks.rbegin(); it != vBlocks.rend(); ++it) {
+            CBlockFilterEntry entry;
+            if (!LookupBlockFilter(*it, entry)) {
+                LogPrint("net", "Failed to find the block filter of %s for peer=%d\n", (*it)->GetBlockHash().ToString(), pfrom->id);
+                return true;
+            }
+            pfrom->PushMessage("cfilter", filterType, (*it)->GetBlockHash(), entry.vFilter);
+        }
+    }
+
+
+    else if (strCommand == "getcfheaders")
+    {
+        uint8_t filterType;
+        uint32_t nStartHeight;
+        uint256 hashStop;
+        vRecv >> filterType >> nStartHeight >> hashStop;
+
+        std::vector<const CBlockIndex*> vBlocks;
+        const CBlockIndex* pindexPrev = nullptr;
+        {
+            LOCK(cs_main);
+            const CBlockIndex* pindexStop;
+            if (!PrepareBlockFilterRequest(pfrom, filterType, nStartHeight, hashStop, MAX_GETCFHEADERS_SIZE, pindexStop))
+                return true;
+            const CBlockIndex* pindex = pindexStop;
+            for (; pindex && pindex->nHeight >= (int)nStartHeight; pindex = pindex->pprev)
+                vBlocks.push_back(pindex);
+            pindexPrev = pindex;
+        }
+
+        // The headers are sent as the header of the filter before the first
+        // block, followed by the hashes of the filters of the blocks.
+        uint256 prevHeader;
+        CBlockFilterEntry entry;
+        if (pindexPrev) {
+            if (!LookupBlockFilter(pindexPrev, entry)) {
+                LogPrint("net", "Failed to find the block filter of %s for peer=%d\n", pindexPrev->GetBlockHash().ToString(), pfrom->id);
+                return true;
+            }
+            prevHeader = entry.header;
+        }
+        std::vector<uint256> vFilterHashes;
+        vFilterHashes.reserve(vBlocks.size());
+        for (auto it = vBlocks.rbegin(); it != vBlocks.rend(); ++it) {
+            if (!LookupBlockFilter(*it, entry)) {
+                LogPrint("net", "Failed to find the block filter of %s for peer=%d\n", (*it)->GetBlockHash().ToString(), pfrom->id);
+                return true;
             }
+            vFilterHashes.push_back(entry.hashFilter);
         }
+        pfrom->PushMessage("cfheaders", filterType, hashStop, prevHeader, vFilterHashes);
     }
 
 
-    else if (strCommand == "getheaders")
+    else if (strCommand == "getcfcheckpt")
     {
-        CBlockLocator locator;
+        uint8_t filterType;
         uint256 hashStop;
-        vRecv >> locator >> hashStop;
+        vRecv >> filterType >> hashStop;
 
-        LOCK(cs_main);
-        if (IsInitialBlockDownload(chainparams.GetConsensus()) && !pfrom->fWhitelisted) {
-            LogPrint("net", "Ignoring getheaders from peer=%d because node is in initial block download\n", pfrom->id);
-            return true;
-        }
-        CBlockIndex* pindex = NULL;
-        if (locator.IsNull())
+        std::vector<const CBlockIndex*> vBlocks;
         {
-            // If locator is null, return the hashStop block
-            BlockMap::iterator mi = mapBlockIndex.find(hashStop);
-            if (mi == mapBlockIndex.end())
+            LOCK(cs_main);
+            const CBlockIndex* pindexStop;
+            if (!PrepareBlockFilterRequest(pfrom, filterType, 0, hashStop, std::numeric_limits<uint32_t>::max(), pindexStop))
                 return true;
-            pindex = (*mi).second;
-        }
-        else
-        {
-            // Find the last block the caller has in the main chain
-            pindex = FindForkInGlobalIndex(chainActive, locator);
-            if (pindex)
-                pindex = chainActive.Next(pindex);
+            for (int nHeight = CFCHECKPT_INTERVAL; nHeight <= pindexStop->nHeight; nHeight += CFCHECKPT_INTERVAL)
+                vBlocks.push_back(pindexStop->GetAncestor(nHeight));
         }
 
-        // we must use CBlocks, as CBlockHeaders won't include the 0x00 nTx count at the end
-        vector<CBlock> vHeaders;
-        int nLimit = MAX_HEADERS_RESULTS;
-        LogPrint("net", "getheaders %d to %s from peer=%d\n", (pindex ? pindex->nHeight : -1), hashStop.ToString(), pfrom->id);
-        for (; pindex; pindex = chainActive.Next(pindex))
-        {
-            vHeaders.push_back(pindex->GetBlockHeader());
-            if (--nLimit <= 0 || pindex->GetBlockHash() == hashStop)
-                break;
+        std::vector<uint256> vHeaders;
+        vHeaders.reserve(vBlocks.size());
+        for (const CBlockIndex* pindex : vBlocks) {
+            CBlockFilterEntry entry;
+            if (!LookupBlockFilter(pindex, entry)) {
+                LogPrint("net", "Failed to find the block filter of %s for peer=%d\n", pindex->GetBlockHash().ToString(), pfrom->id);
+                return true;
+            }
+            vHeaders.push_back(entry.header);
         }
-        pfrom->PushMessage("headers", vHeaders);
+        pfrom->PushMessage("cfcheckpt", filterType, hashStop, vHeaders);
     }
 
 
@@ -6205,10 +9772,12 @@ bool static ProcessMessage(const CChainParams& chainparams, CNode* pfrom, string
             return true;
         }
 
-        vector<uint256> vWorkQueue;
-        vector<uint256> vEraseQueue;
-        CTransaction tx;
-        vRecv >> tx;
+        // The transaction has usually been deserialized ahead of processing.
+        // It is shared from here on with the mempool, relay and orphan maps.
+        CTransactionRef ptx = prepared.ptx;
+        if (!ptx)
+            vRecv >> ptx;
+        const CTransaction& tx = *ptx;
 
         CInv inv(MSG_TX, tx.GetHash());
         pfrom->AddInventoryKnown(inv);
@@ -6221,70 +9790,25 @@ bool static ProcessMessage(const CChainParams& chainparams, CNode* pfrom, string
         pfrom->setAskFor.erase(inv.hash);
         mapAlreadyAskedFor.erase(inv);
 
-        if (!AlreadyHave(inv) && AcceptToMemoryPool(chainparams, mempool, state, tx, true, &fMissingInputs))
+        // Shielded transactions are admitted asynchronously, so that their
+        // proofs can be batch-verified without holding cs_main.
+        if ((!tx.vJoinSplit.empty() || !tx.vShieldedSpend.empty() || !tx.vShieldedOutput.empty()) &&
+            !AlreadyHave(inv) && QueuePendingShieldedTx(chainparams, ptx, pfrom, prepared.ptx != nullptr))
+        {
+            return true;
+        }
+
+        if (!AlreadyHave(inv) && AcceptToMemoryPool(chainparams, mempool, state, ptx, true, &fMissingInputs))
         {
             mempool.check(pcoinsTip);
-            RelayTransaction(tx);
-            vWorkQueue.push_back(inv.hash);
+            RelayTransaction(ptx);
 
             LogPrint("mempool", "AcceptToMemoryPool: peer=%d %s: accepted %s (poolsz %u)\n",
                 pfrom->id, pfrom->cleanSubVer,
                 tx.GetHash().ToString(),
                 mempool.mapTx.size());
 
-            // Recursively process any orphan transactions that depended on this one
-            set<NodeId> setMisbehaving;
-            for (unsigned int i = 0; i < vWorkQueue.size(); i++)
-            {
-                map<uint256, set<uint256> >::iterator itByPrev = mapOrphanTransactionsByPrev.find(vWorkQueue[i]);
-                if (itByPrev == mapOrphanTransactionsByPrev.end())
-                    continue;
-                for (set<uint256>::iterator mi = itByPrev->second.begin();
-                     mi != itByPrev->second.end();
-                     ++mi)
-                {
-                    const uint256& orphanHash = *mi;
-                    const CTransaction& orphanTx = mapOrphanTransactions[orphanHash].tx;
-                    NodeId fromPeer = mapOrphanTransactions[orphanHash].fromPeer;
-                    bool fMissingInputs2 = false;
-                    // Use a dummy CValidationState so someone can't setup nodes to counter-DoS based on orphan
-                    // resolution (that is, feeding people an invalid transaction based on LegitTxX in order to get
-                    // anyone relaying LegitTxX banned)
-                    CValidationState stateDummy;
-
-
-                    if (setMisbehaving.count(fromPeer))
-                        continue;
-                    if (AcceptToMemoryPool(chainparams, mempool, stateDummy, orphanTx, true, &fMissingInputs2))
-                    {
-                        LogPrint("mempool", "   accepted orphan tx %s\n", orphanHash.ToString());
-                        RelayTransaction(orphanTx);
-                        vWorkQueue.push_back(orphanHash);
-                        vEraseQueue.push_back(orphanHash);
-                    }
-                    else if (!fMissingInputs2)
-                    {
-                        int nDos = 0;
-                        if (stateDummy.IsInvalid(nDos) && nDos > 0)
-                        {
-                            // Punish peer that gave us an invalid orphan tx
-                            Misbehaving(fromPeer, nDos);
-                            setMisbehaving.insert(fromPeer);
-                            LogPrint("mempool", "   invalid orphan tx %s\n", orphanHash.ToString());
-                        }
-                        // Has inputs but not accepted to mempool
-                        // Probably non-standard or insufficient fee/priority
-                        LogPrint("mempool", "   removed orphan tx %s\n", orphanHash.ToString());
-                        vEraseQueue.push_back(orphanHash);
-                        assert(recentRejects);
-                        recentRejects->insert(orphanHash);
-                    }
-                    mempool.check(pcoinsTip);
-                }
-            }
-
-            for (uint256 hash : vEraseQueue)
-                EraseOrphanTx(hash);
+            AddOrphanWork(tx);
         }
         // TODO: currently, prohibit joinsplits and shielded spends/outputs from entering mapOrphans
         else if (fMissingInputs &&
@@ -6292,7 +9816,7 @@ bool static ProcessMessage(const CChainParams& chainparams, CNode* pfrom, string
                  tx.vShieldedSpend.empty() &&
                  tx.vShieldedOutput.empty())
         {
-            AddOrphanTx(tx, pfrom->GetId());
+            AddOrphanTx(ptx, pfrom->GetId());
 
             // DoS prevention: do not allow mapOrphanTransactions to grow unbounded
             unsigned int nMaxOrphanTx = (unsigned int)std::max((int64_t)0, GetArg("-maxorphantx", DEFAULT_MAX_ORPHAN_TRANSACTIONS));
@@ -6315,7 +9839,7 @@ bool static ProcessMessage(const CChainParams& chainparams, CNode* pfrom, string
                 int nDoS = 0;
                 if (!state.IsInvalid(nDoS) || nDoS == 0) {
                     LogPrintf("Force relaying tx %s from whitelisted peer=%d\n", tx.GetHash().ToString(), pfrom->id);
-                    RelayTransaction(tx);
+                    RelayTransaction(ptx);
                 } else {
                     LogPrintf("Not relaying invalid transaction %s from whitelisted peer=%d (%s (code %d))\n",
                         tx.GetHash().ToString(), pfrom->id, state.GetRejectReason(), state.GetRejectCode());
@@ -6353,6 +9877,10 @@ bool static ProcessMessage(const CChainParams& chainparams, CNode* pfrom, string
             ReadCompactSize(vRecv); // ignore tx count; assume it is 0.
         }
 
+        // Check the Equihash solutions in parallel before taking cs_main;
+        // the rest of the checks need the preceding headers.
+        PrecheckBlockHeaders(headers, chainparams);
+
         LOCK(cs_main);
 
         if (nCount == 0) {
@@ -6410,12 +9938,20 @@ bool static ProcessMessage(const CChainParams& chainparams, CNode* pfrom, string
 
     else if (strCommand == "block" && !fImporting && !fReindex) // Ignore blocks received while importing
     {
-        CBlock block;
-        vRecv >> block;
+        unsigned int nSize = vRecv.size();
+        CBlock blockReceived;
+        if (!prepared.pblock)
+            vRecv >> blockReceived;
+        const CBlock& block = prepared.pblock ? *prepared.pblock : blockReceived;
 
         CInv inv(MSG_BLOCK, block.GetHash());
         LogPrint("net", "received block %s peer=%d\n", inv.hash.ToString(), pfrom->id);
 
+        {
+            LOCK(cs_main);
+            UpdateBlockDownloadEstimates(pfrom->GetId(), inv.hash, nSize);
+        }
+
         pfrom->AddInventoryKnown(inv);
 
         CValidationState state;
@@ -6424,7 +9960,16 @@ bool static ProcessMessage(const CChainParams& chainparams, CNode* pfrom, string
         // Such an unrequested block may still be processed, subject to the
         // conditions in AcceptBlock().
         bool forceProcessing = pfrom->fWhitelisted && !IsInitialBlockDownload(chainparams.GetConsensus());
-        ProcessNewBlock(state, chainparams, pfrom, &block, forceProcessing, NULL);
+        if (prepared.fHeaderValid)
+            setPrecheckedHeaders.insert(inv.hash);
+        if (prepared.fBlockValid)
+            setPrecheckedBlocks.insert(inv.hash);
+        // The payload is only written to disk as it is when it was prepared.
+        const char* pRawBegin = prepared.nBlockSize != 0 ? &vRecv[0] : NULL;
+        const char* pRawEnd = pRawBegin != NULL ? pRawBegin + prepared.nBlockSize : NULL;
+        ProcessNewBlock(state, chainparams, pfrom, &block, forceProcessing, NULL, pRawBegin, pRawEnd);
+        setPrecheckedHeaders.erase(inv.hash);
+        setPrecheckedBlocks.erase(inv.hash);
         int nDoS;
         if (state.IsInvalid(nDoS)) {
             pfrom->PushMessage("reject", strCommand, state.GetRejectCode(),
@@ -6433,8 +9978,302 @@ bool static ProcessMessage(const CChainParams& chainparams, CNode* pfrom, string
                 LOCK(cs_main);
                 Misbehaving(pfrom->GetId(), nDoS);
             }
+        } else {
+            LOCK(cs_main);
+            if (chainActive.Tip()->GetBlockHash() == inv.hash)
+                RecordBlockPropagation(strCommand, nTimeReceived);
+            if (!IsInitialBlockDownload(chainparams.GetConsensus()) && chainActive.Tip()->GetBlockHash() == inv.hash)
+                MaybeSetPeerAsAnnouncingHeaderAndIDs(pfrom->GetId());
+        }
+
+    }
+
+
+    else if (strCommand == "sendcmpct")
+    {
+        bool fAnnounceUsingCMPCTBLOCK = false;
+        uint64_t nCMPCTBLOCKVersion = 0;
+        vRecv >> fAnnounceUsingCMPCTBLOCK >> nCMPCTBLOCKVersion;
+        if (nCMPCTBLOCKVersion == CMPCTBLOCKS_VERSION) {
+            LOCK(cs_main);
+            State(pfrom->GetId())->fProvidesHeaderAndIDs = true;
+            State(pfrom->GetId())->fPreferHeaderAndIDs = fAnnounceUsingCMPCTBLOCK;
+        }
+    }
+
+
+    else if (strCommand == "cmpctblock" && !fImporting && !fReindex) // Ignore blocks received while importing
+    {
+        CBlockHeaderAndShortTxIDs cmpctblock;
+        vRecv >> cmpctblock;
+
+        BlockTransactions txn;
+        {
+            LOCK(cs_main);
+
+            if (mapBlockIndex.find(cmpctblock.header.hashPrevBlock) == mapBlockIndex.end()) {
+                // Doesn't connect (or is genesis), instead of DoSing in AcceptBlockHeader, request deeper headers
+                if (!IsInitialBlockDownload(chainparams.GetConsensus()))
+                    pfrom->PushMessage("getheaders", chainActive.GetLocator(pindexBestHeader), uint256());
+                return true;
+            }
+
+            CBlockIndex *pindex = NULL;
+            CValidationState state;
+            if (!AcceptBlockHeader(cmpctblock.header, state, chainparams, &pindex)) {
+                int nDoS;
+                if (state.IsInvalid(nDoS)) {
+                    if (nDoS > 0)
+                        Misbehaving(pfrom->GetId(), nDoS);
+                    LogPrintf("Peer %d sent us invalid header via cmpctblock\n", pfrom->id);
+                    return true;
+                }
+            }
+
+            // If AcceptBlockHeader returned true, it set pindex
+            assert(pindex);
+            UpdateBlockAvailability(pfrom->GetId(), pindex->GetBlockHash());
+            pfrom->AddInventoryKnown(CInv(MSG_BLOCK, pindex->GetBlockHash()));
+
+            map<uint256, pair<NodeId, list<QueuedBlock>::iterator> >::iterator blockInFlightIt = mapBlocksInFlight.find(pindex->GetBlockHash());
+            bool fAlreadyInFlight = blockInFlightIt != mapBlocksInFlight.end();
+
+            if (pindex->nStatus & BLOCK_HAVE_DATA) // Nothing to do here
+                return true;
+
+            if (pindex->nChainWork <= chainActive.Tip()->nChainWork || // We know something better
+                    pindex->nTx != 0) { // We had this block at some point, but pruned it
+                if (fAlreadyInFlight) {
+                    // We requested this block for some reason, but our mempool will probably be useless
+                    // so we just grab the block via normal getdata
+                    std::vector<CInv> vInv(1, CInv(MSG_BLOCK, pindex->GetBlockHash()));
+                    pfrom->PushMessage("getdata", vInv);
+                }
+                return true;
+            }
+
+            // If we're not close to tip yet, give up and let parallel block fetch work its magic
+            if (!fAlreadyInFlight && !CanDirectFetch(chainparams.GetConsensus()))
+                return true;
+
+            CNodeState *nodestate = State(pfrom->GetId());
+
+            // Only blocks that are about to connect are reconstructed, as our
+            // mempool is of little use for others, and reconstruction costs
+            // memory and a scan of the mempool.
+            if (pindex->nHeight > chainActive.Height() + 2) {
+                if (fAlreadyInFlight) {
+                    // We requested this block, but it's far into the future, so
+                    // request the block normally. Otherwise the header was
+                    // accepted, and the block is downloaded like any other.
+                    std::vector<CInv> vInv(1, CInv(MSG_BLOCK, pindex->GetBlockHash()));
+                    pfrom->PushMessage("getdata", vInv);
+                }
+                return true;
+            }
+
+            if (fAlreadyInFlight ? blockInFlightIt->second.first != pfrom->GetId() : GetBlocksToRequest(nodestate) <= 0)
+                return true;
+
+            list<QueuedBlock>::iterator *queuedBlockIt = NULL;
+            if (!MarkBlockAsInFlight(pfrom->GetId(), pindex->GetBlockHash(), chainparams.GetConsensus(), pindex, &queuedBlockIt)) {
+                if (!(*queuedBlockIt)->partialBlock) {
+                    (*queuedBlockIt)->partialBlock.reset(new PartiallyDownloadedBlock(&mempool));
+                } else {
+                    // The block was already in flight using compact blocks from the same peer
+                    LogPrint("net", "Peer sent us compact block we were already syncing!\n");
+                    return true;
+                }
+            }
+
+            PartiallyDownloadedBlock& partialBlock = *(*queuedBlockIt)->partialBlock;
+            ReadStatus status = partialBlock.InitData(cmpctblock);
+            if (status == READ_STATUS_INVALID) {
+                MarkBlockAsReceived(pindex->GetBlockHash()); // Reset in-flight state in case of whitelist
+                Misbehaving(pfrom->GetId(), 100);
+                LogPrintf("Peer %d sent us invalid compact block\n", pfrom->id);
+                return true;
+            } else if (status == READ_STATUS_FAILED) {
+                // Duplicate txindexes, the block is now in-flight, so just request it
+                (*queuedBlockIt)->partialBlock.reset();
+                std::vector<CInv> vInv(1, CInv(MSG_BLOCK, pindex->GetBlockHash()));
+                pfrom->PushMessage("getdata", vInv);
+                return true;
+            }
+
+            BlockTransactionsRequest req;
+            for (size_t i = 0; i < cmpctblock.BlockTxCount(); i++) {
+                if (!partialBlock.IsTxAvailable(i))
+                    req.indexes.push_back(i);
+            }
+            if (!req.indexes.empty()) {
+                req.blockhash = pindex->GetBlockHash();
+                pfrom->PushMessage("getblocktxn", req);
+                return true;
+            }
+            txn.blockhash = pindex->GetBlockHash();
+        }
+
+        // All transactions were available.
+        ProcessBlockTransactions(chainparams, pfrom, strCommand, txn, nTimeReceived);
+    }
+
+
+    else if (strCommand == "getblocktxn")
+    {
+        BlockTransactionsRequest req;
+        vRecv >> req;
+
+        LOCK(cs_main);
+
+        BlockMap::iterator it = mapBlockIndex.find(req.blockhash);
+        if (it == mapBlockIndex.end() || !(it->second->nStatus & BLOCK_HAVE_DATA)) {
+            LogPrint("net", "Peer %d sent us a getblocktxn for a block we don't have\n", pfrom->id);
+            return true;
+        }
+
+        if (it->second->nHeight < chainActive.Height() - MAX_BLOCKTXN_DEPTH) {
+            // Sending the full block for an older block, which should not be
+            // requested in practice, makes a peer that sends many getblocktxn
+            // requests to trigger disk reads receive all the data that is read.
+            LogPrint("net", "Peer %d sent us a getblocktxn for a block > %i deep\n", pfrom->id, MAX_BLOCKTXN_DEPTH);
+            pfrom->vRecvGetData.push_back(CInv(MSG_BLOCK, req.blockhash));
+            ProcessGetData(pfrom, chainparams.GetConsensus());
+            return true;
+        }
+
+        CBlock block;
+        if (!ReadBlockFromDisk(block, it->second, chainparams.GetConsensus()))
+            assert(!"cannot load block from disk");
+
+        BlockTransactions resp(req);
+        for (size_t i = 0; i < req.indexes.size(); i++) {
+            if (req.indexes[i] >= block.vtx.size()) {
+                Misbehaving(pfrom->GetId(), 100);
+                LogPrintf("Peer %d sent us a getblocktxn with out-of-bounds tx indices\n", pfrom->id);
+                return true;
+            }
+            resp.txn[i] = block.vtx[req.indexes[i]];
+        }
+        pfrom->PushMessage("blocktxn", resp);
+    }
+
+
+    else if (strCommand == "blocktxn" && !fImporting && !fReindex) // Ignore blocks received while importing
+    {
+        BlockTransactions resp;
+        vRecv >> resp;
+
+        ProcessBlockTransactions(chainparams, pfrom, strCommand, resp, nTimeReceived);
+    }
+
+
+    else if (strCommand == "sendrecon")
+    {
+        uint32_t nReconVersion = 0;
+        uint64_t nSalt = 0;
+        vRecv >> nReconVersion >> nSalt;
+
+        // Reconciliation is only used if we offered it too, which we did on
+        // receiving the verack of the peer, which it sent before this.
+        if (pfrom->nReconSalt != 0 && nReconVersion >= TXRECONCILIATION_VERSION) {
+            LOCK(pfrom->cs_inventory);
+            if (!pfrom->reconState) {
+                pfrom->reconState.reset(new CTxReconciliationState(!pfrom->fInbound, pfrom->nReconSalt, nSalt));
+                pfrom->reconState->nNextRequest = GetTime() + RECON_REQUEST_INTERVAL;
+                LogPrint("net", "reconciling transactions with peer=%d\n", pfrom->id);
+            }
+        }
+    }
+
+
+    else if (strCommand == "reqrecon")
+    {
+        uint32_t nRemoteSize = 0;
+        vRecv >> nRemoteSize;
+
+        CTxSketch sketch;
+        {
+            LOCK(pfrom->cs_inventory);
+            CTxReconciliationState* recon = pfrom->reconState.get();
+            if (!recon || recon->fInitiator) {
+                LogPrint("net", "unexpected reqrecon from peer=%d\n", pfrom->id);
+                return true;
+            }
+            // The transactions of a previous sketch that was not followed by
+            // a reconcildiff are reconciled again.
+            recon->setSketched.insert(recon->setLocal.begin(), recon->setLocal.end());
+            recon->setLocal.clear();
+            sketch = recon->GetSketch(recon->setSketched, GetSketchCells(recon->setSketched.size(), nRemoteSize));
+            recon->fAwaitingDiff = true;
+        }
+        pfrom->PushMessage("sketch", sketch);
+    }
+
+
+    else if (strCommand == "sketch")
+    {
+        CTxSketch sketch;
+        vRecv >> sketch;
+
+        std::vector<uint256> vAnnounce;
+        std::vector<uint32_t> vAsk;
+        bool fSuccess = false;
+        {
+            LOCK(pfrom->cs_inventory);
+            CTxReconciliationState* recon = pfrom->reconState.get();
+            if (!recon || !recon->fInitiator || !recon->fAwaitingSketch) {
+                LogPrint("net", "unexpected sketch from peer=%d\n", pfrom->id);
+                return true;
+            }
+            recon->fAwaitingSketch = false;
+
+            std::vector<uint32_t> vMissing;
+            if (sketch.IsValid() && sketch.Subtract(recon->GetSketch(recon->setLocal, sketch.size()))) {
+                fSuccess = sketch.Decode(vAsk, vMissing);
+            }
+            if (fSuccess) {
+                vAnnounce = recon->GetByShortIDs(recon->setLocal, vMissing);
+            } else {
+                // Fall back to announcing all of the transactions.
+                LogPrint("net", "failed to reconcile %u transactions with peer=%d\n", recon->setLocal.size(), pfrom->id);
+                vAnnounce.assign(recon->setLocal.begin(), recon->setLocal.end());
+                vAsk.clear();
+            }
+            recon->setLocal.clear();
+            for (const uint256& txid : vAnnounce)
+                pfrom->filterInventoryKnown.insert(txid);
         }
+        pfrom->PushMessage("reconcildiff", fSuccess, vAsk);
+        AnnounceTransactions(pfrom, vAnnounce);
+    }
+
+
+    else if (strCommand == "reconcildiff")
+    {
+        bool fSuccess = false;
+        std::vector<uint32_t> vAsk;
+        vRecv >> fSuccess >> vAsk;
 
+        std::vector<uint256> vAnnounce;
+        {
+            LOCK(pfrom->cs_inventory);
+            CTxReconciliationState* recon = pfrom->reconState.get();
+            if (!recon || recon->fInitiator || !recon->fAwaitingDiff) {
+                LogPrint("net", "unexpected reconcildiff from peer=%d\n", pfrom->id);
+                return true;
+            }
+            recon->fAwaitingDiff = false;
+            if (fSuccess) {
+                vAnnounce = recon->GetByShortIDs(recon->setSketched, vAsk);
+            } else {
+                vAnnounce.assign(recon->setSketched.begin(), recon->setSketched.end());
+            }
+            recon->setSketched.clear();
+            for (const uint256& txid : vAnnounce)
+                pfrom->filterInventoryKnown.insert(txid);
+        }
+        AnnounceTransactions(pfrom, vAnnounce);
     }
 
 
@@ -6712,7 +10551,8 @@ bool static ProcessMessage(const CChainParams& chainparams, CNode* pfrom, string
         // message would be undesirable as we transmit it ourselves.
     }
 
-    else if (!(strCommand == "tx" || strCommand == "block" || strCommand == "headers" || strCommand == "alert")) {
+    else if (!(strCommand == "tx" || strCommand == "block" || strCommand == "headers" || strCommand == "alert" ||
+               strCommand == "cmpctblock" || strCommand == "blocktxn")) {
         // Ignore unknown commands for extensibility
         LogPrint("net", "Unknown command \"%s\" from peer=%d\n", SanitizeString(strCommand), pfrom->id);
     }
@@ -6722,6 +10562,124 @@ bool static ProcessMessage(const CChainParams& chainparams, CNode* pfrom, string
     return true;
 }
 
+/**
+ * The preparation of a complete message for processing: the check of its
+ * checksum and, for transactions and blocks, their deserialization and the
+ * checks that do not depend on the chain state.
+ */
+class CMessagePrepare
+{
+private:
+    CNetMessage *pmsg;
+    const CChainParams *pchainparams;
+    bool fCheckHeader;
+
+public:
+    CMessagePrepare() : pmsg(nullptr), pchainparams(nullptr), fCheckHeader(false) {}
+    CMessagePrepare(CNetMessage& msgIn, const CChainParams& chainparamsIn, bool fCheckHeaderIn) :
+        pmsg(&msgIn), pchainparams(&chainparamsIn), fCheckHeader(fCheckHeaderIn) {}
+
+    bool operator()();
+
+    void swap(CMessagePrepare &check) {
+        std::swap(pmsg, check.pmsg);
+        std::swap(pchainparams, check.pchainparams);
+        std::swap(fCheckHeader, check.fCheckHeader);
+    }
+};
+
+bool CMessagePrepare::operator()()
+{
+    CNetMessage& msg = *pmsg;
+    CPreparedMessage& prepared = msg.prepared;
+    prepared.fDone = true;
+
+    // Messages that fail these checks are rejected when they are processed.
+    if (memcmp(msg.hdr.pchMessageStart, pchainparams->MessageStart(), MESSAGE_START_SIZE) != 0 ||
+        !msg.hdr.IsValid(pchainparams->MessageStart())) {
+        return true;
+    }
+    const CNetDataStream& vRecv = msg.vRecv;
+    uint256 hash = Hash(vRecv.begin(), vRecv.begin() + msg.hdr.nMessageSize);
+    prepared.fChecksumValid = ReadLE32((unsigned char*)&hash) == msg.hdr.nChecksum;
+    if (!prepared.fChecksumValid) {
+        return true;
+    }
+
+    // Payloads are deserialized in place, leaving vRecv as it is, so that a
+    // malformed one is rejected when the message is processed.
+    std::string strCommand = msg.hdr.GetCommand();
+    const char* pbegin = vRecv.empty() ? nullptr : &vRecv[0];
+    CMemoryReader reader(vRecv.GetType(), vRecv.GetVersion(), pbegin, pbegin + vRecv.size());
+    try {
+        if (strCommand == "tx") {
+            auto ptx = std::make_shared<CTransaction>();
+            reader >> *ptx;
+            CValidationState state;
+            if (CheckTransactionWithoutProofVerification(*ptx, state)) {
+                prepared.ptx = ptx;
+            }
+        } else if (strCommand == "block") {
+            auto pblock = std::make_shared<CBlock>();
+            reader >> *pblock;
+            // The received serialization of the block is written to disk,
+            // unless it is not the one that the block would be written as.
+            size_t nSize = vRecv.size() - reader.size();
+            if (nSize == ::GetSerializeSize(*pblock, SER_DISK, CLIENT_VERSION))
+                prepared.nBlockSize = nSize;
+            const Consensus::Params& params = pchainparams->GetConsensus();
+            uint256 hash = pblock->GetHash();
+            prepared.fHeaderValid = fCheckHeader &&
+                CheckEquihashSolutionCached(*pblock, hash, params) &&
+                CheckProofOfWork(hash, pblock->nBits, params);
+            // The merkle root, size limits and transactions of the block are
+            // checked here, on the worker threads, for several blocks at a
+            // time. Its proofs are verified when it is connected.
+            CValidationState state;
+            auto verifier = ProofVerifier::Disabled();
+            prepared.fBlockValid = CheckBlock(*pblock, state, *pchainparams, verifier, false, true, true);
+            prepared.pblock = pblock;
+        }
+    } catch (const std::exception&) {
+        // Processing the message reports the error.
+    }
+    // Failures are recorded rather than returned, which would stop the queue
+    // from preparing the messages of other peers.
+    return true;
+}
+
+// Messages are small, apart from blocks, so workers take a few at a time.
+static CCheckQueue<CMessagePrepare> messagepreparequeue(8, &checkpool);
+
+// Only called by the message handler thread
+void PrepareMessages(const CChainParams& chainparams, const std::vector<CNode*>& vNodes)
+{
+    std::vector<CNetMessage*> vMessages;
+    for (CNode* pnode : vNodes) {
+        if (pnode->fDisconnect)
+            continue;
+        for (CNetMessage& msg : pnode->vProcessMsg) {
+            if (!msg.prepared.fDone)
+                vMessages.push_back(&msg);
+        }
+    }
+    if (vMessages.empty())
+        return;
+
+    // The Equihash solutions of most blocks received during the initial block
+    // download are not checked (see -assumevalidheaders), nor checked here.
+    bool fCheckHeaders = !IsInitialBlockDownload(chainparams.GetConsensus());
+    std::vector<CMessagePrepare> vChecks;
+    vChecks.reserve(vMessages.size());
+    for (CNetMessage* pmsg : vMessages) {
+        vChecks.emplace_back(*pmsg, chainparams, fCheckHeaders);
+    }
+
+    CCheckQueueControl<CMessagePrepare> control(&messagepreparequeue);
+    control.Add(vChecks);
+    control.Wait();
+}
+
 // requires LOCK(cs_vRecvMsg)
 bool ProcessMessages(const CChainParams& chainparams, CNode* pfrom)
 {
@@ -6738,32 +10696,33 @@ bool ProcessMessages(const CChainParams& chainparams, CNode* pfrom)
     //
     bool fOk = true;
 
+    // Orphans whose parents have arrived are processed one at a time, on the
+    // turns of all the peers.
+    if (HaveOrphanWork()) {
+        LOCK(cs_main);
+        ProcessOrphanWork(chainparams);
+    }
+
     if (!pfrom->vRecvGetData.empty())
         ProcessGetData(pfrom, chainparams.GetConsensus());
 
     // this maintains the order of responses
-    if (!pfrom->vRecvGetData.empty()) return fOk;
+    if (!pfrom->vRecvGetData.empty() || pfrom->nFilteredBlocksPending > 0) return fOk;
 
-    std::deque<CNetMessage>::iterator it = pfrom->vRecvMsg.begin();
-    while (!pfrom->fDisconnect && it != pfrom->vRecvMsg.end()) {
+    while (!pfrom->fDisconnect && !pfrom->vProcessMsg.empty()) {
         // Don't bother if send buffer is too full to respond anyway
         if (pfrom->nSendSize >= SendBufferSize())
             break;
 
-        // get next message
-        CNetMessage& msg = *it;
+        // get next message, which is deleted when it goes out of scope
+        std::list<CNetMessage> msgs;
+        msgs.splice(msgs.begin(), pfrom->vProcessMsg, pfrom->vProcessMsg.begin());
+        CNetMessage& msg = msgs.front();
+        pfrom->nProcessQueueSize -= msg.vRecv.size() + 24;
 
         //if (fDebug)
-        //    LogPrintf("%s(message %u msgsz, %u bytes, complete:%s)\n", __func__,
-        //            msg.hdr.nMessageSize, msg.vRecv.size(),
-        //            msg.complete() ? "Y" : "N");
-
-        // end, if an incomplete message is found
-        if (!msg.complete())
-            break;
-
-        // at this point, any failure means we can delete the current message
-        it++;
+        //    LogPrintf("%s(message %u msgsz, %u bytes)\n", __func__,
+        //            msg.hdr.nMessageSize, msg.vRecv.size());
 
         // Scan for message start
         if (memcmp(msg.hdr.pchMessageStart, chainparams.MessageStart(), MESSAGE_START_SIZE) != 0) {
@@ -6784,22 +10743,30 @@ bool ProcessMessages(const CChainParams& chainparams, CNode* pfrom)
         // Message size
         unsigned int nMessageSize = hdr.nMessageSize;
 
-        // Checksum
-        CDataStream& vRecv = msg.vRecv;
-        uint256 hash = Hash(vRecv.begin(), vRecv.begin() + nMessageSize);
-        unsigned int nChecksum = ReadLE32((unsigned char*)&hash);
-        if (nChecksum != hdr.nChecksum)
+        // Checksum, which has usually been checked ahead of processing
+        CNetDataStream& vRecv = msg.vRecv;
+        if (!(msg.prepared.fDone && msg.prepared.fChecksumValid))
         {
-            LogPrintf("%s(%s, %u bytes): CHECKSUM ERROR nChecksum=%08x hdr.nChecksum=%08x\n", __func__,
-               SanitizeString(strCommand), nMessageSize, nChecksum, hdr.nChecksum);
-            continue;
+            uint256 hash = Hash(vRecv.begin(), vRecv.begin() + nMessageSize);
+            unsigned int nChecksum = ReadLE32((unsigned char*)&hash);
+            if (nChecksum != hdr.nChecksum)
+            {
+                LogPrintf("%s(%s, %u bytes): CHECKSUM ERROR nChecksum=%08x hdr.nChecksum=%08x\n", __func__,
+                   SanitizeString(strCommand), nMessageSize, nChecksum, hdr.nChecksum);
+                continue;
+            }
         }
 
         // Process message
         bool fRet = false;
+        string strCommandLabel = SanitizeString(strCommand);
+        int64_t nTimeStart = GetTimeMicros();
+        MetricsHistogram(
+            "zcash.net.in.queued.seconds", (nTimeStart - msg.nTime) * 0.000001,
+            "command", strCommandLabel.c_str());
         try
         {
-            fRet = ProcessMessage(chainparams, pfrom, strCommand, vRecv, msg.nTime);
+            fRet = ProcessMessage(chainparams, pfrom, strCommand, vRecv, msg.nTime, msg.prepared);
             boost::this_thread::interruption_point();
         }
         catch (const std::ios_base::failure& e)
@@ -6828,6 +10795,9 @@ bool ProcessMessages(const CChainParams& chainparams, CNode* pfrom)
         } catch (...) {
             PrintExceptionContinue(NULL, "ProcessMessages()");
         }
+        MetricsHistogram(
+            "zcash.net.in.processed.seconds", (GetTimeMicros() - nTimeStart) * 0.000001,
+            "command", strCommandLabel.c_str());
 
         if (!fRet)
             LogPrintf("%s(%s, %u bytes) FAILED peer=%d\n", __func__, SanitizeString(strCommand), nMessageSize, pfrom->id);
@@ -6835,10 +10805,6 @@ bool ProcessMessages(const CChainParams& chainparams, CNode* pfrom)
         break;
     }
 
-    // In case the connection got shut down, its receive buffer was wiped
-    if (!pfrom->fDisconnect)
-        pfrom->vRecvMsg.erase(pfrom->vRecvMsg.begin(), it);
-
     return fOk;
 }
 
@@ -6884,20 +10850,23 @@ bool SendMessages(const Consensus::Params& params, CNode* pto, bool fSendTrickle
             return true;
 
         // Address refresh broadcast
+        // A newly learnt address, such as an onion service that Tor
+        // published after the peers connected, is advertised at once.
         static int64_t nLastRebroadcast;
-        if (!IsInitialBlockDownload(params) && (GetTime() - nLastRebroadcast > 24 * 60 * 60))
+        bool fPeriodicRebroadcast = GetTime() - nLastRebroadcast > 24 * 60 * 60;
+        if (!IsInitialBlockDownload(params) && (fPeriodicRebroadcast || fLocalAddressAdded.exchange(false)))
         {
             LOCK(cs_vNodes);
             for (CNode* pnode : vNodes)
             {
                 // Periodically clear addrKnown to allow refresh broadcasts
-                if (nLastRebroadcast)
+                if (nLastRebroadcast && fPeriodicRebroadcast)
                     pnode->addrKnown.reset();
 
                 // Rebroadcast our address
                 AdvertizeLocal(pnode);
             }
-            if (!vNodes.empty())
+            if (!vNodes.empty() && fPeriodicRebroadcast)
                 nLastRebroadcast = GetTime();
         }
 
@@ -6947,6 +10916,35 @@ bool SendMessages(const Consensus::Params& params, CNode* pto, bool fSendTrickle
             pto->PushMessage("reject", (string)"block", reject.chRejectCode, reject.strRejectReason, reject.hashBlock);
         state.rejects.clear();
 
+        //
+        // Message: reqrecon
+        //
+        {
+            LOCK(pto->cs_inventory);
+            CTxReconciliationState* recon = pto->reconState.get();
+            if (recon && recon->fInitiator && recon->fAwaitingSketch && GetTime() >= recon->nNextRequest + RECON_RESPONSE_TIMEOUT) {
+                // Announce the transactions with inv if the peer does not respond.
+                LogPrint("net", "reconciliation timeout, peer=%d\n", pto->id);
+                for (const uint256& txid : recon->setLocal)
+                    pto->vInventoryToSend.push_back(CInv(MSG_TX, txid));
+                recon->setLocal.clear();
+                recon->fAwaitingSketch = false;
+            }
+            if (recon && recon->fInitiator && !recon->fAwaitingSketch && GetTime() >= recon->nNextRequest) {
+                pto->PushMessage("reqrecon", (uint32_t)recon->setLocal.size());
+                recon->fAwaitingSketch = true;
+                recon->nNextRequest = GetTime() + RECON_REQUEST_INTERVAL;
+            }
+        }
+
+        //
+        // Message: sendcmpct
+        //
+        if (state.fRequestHBCmpct != state.fSentHBCmpct) {
+            pto->PushMessage("sendcmpct", state.fRequestHBCmpct, CMPCTBLOCKS_VERSION);
+            state.fSentHBCmpct = state.fRequestHBCmpct;
+        }
+
         // Start block sync
         if (pindexBestHeader == NULL)
             pindexBestHeader = chainActive.Tip();
@@ -7013,6 +11011,16 @@ bool SendMessages(const Consensus::Params& params, CNode* pto, bool fSendTrickle
 
                 pto->filterInventoryKnown.insert(inv.hash);
 
+                // Peers that asked for it get our new tip as a compact block
+                // rather than an inv, saving the round trips of a getdata.
+                if (inv.type == MSG_BLOCK && state.fPreferHeaderAndIDs && inv.hash == chainActive.Tip()->GetBlockHash()) {
+                    std::shared_ptr<const CBlockHeaderAndShortTxIDs> pcmpctblock = GetCompactBlock(chainActive.Tip(), params);
+                    if (pcmpctblock) {
+                        pto->PushMessage("cmpctblock", *pcmpctblock);
+                        continue;
+                    }
+                }
+
                 vInv.push_back(inv);
                 if (vInv.size() >= 1000)
                 {
@@ -7027,12 +11035,32 @@ bool SendMessages(const Consensus::Params& params, CNode* pto, bool fSendTrickle
 
         // Detect whether we're stalling
         int64_t nNow = GetTimeMicros();
-        if (!pto->fDisconnect && state.nStallingSince && state.nStallingSince < nNow - 1000000 * BLOCK_STALLING_TIMEOUT) {
-            // Stalling only triggers when the block download window cannot move. During normal steady state,
-            // the download window should be much larger than the to-be-downloaded set of blocks, so disconnection
-            // should only happen during initial block download.
-            LogPrintf("Peer=%d is stalling block download, disconnecting\n", pto->id);
-            pto->fDisconnect = true;
+        if (!pto->fDisconnect && state.nStallingSince) {
+            uint64_t nRecvBytes;
+            {
+                LOCK(pto->cs_vRecv);
+                nRecvBytes = pto->nRecvBytes;
+            }
+            if (state.nStallingMeasuredSince == 0) {
+                state.nStallingMeasuredSince = nNow;
+                state.nStallingRecvBytes = nRecvBytes;
+                state.nStallingBytesInFlight = state.nBlockBytesInFlight;
+            } else if (state.nStallingSince < nNow - 1000000 * BLOCK_STALLING_TIMEOUT) {
+                // Stalling only triggers when the block download window cannot move. During normal steady state,
+                // the download window should be much larger than the to-be-downloaded set of blocks, so disconnection
+                // should only happen during initial block download.
+                // A peer that has been receiving bytes fast enough to finish sending its blocks in flight within
+                // BLOCK_STALLING_TIMEOUT is kept for longer, so that a large block that is nearly delivered is not
+                // requested again from another peer.
+                int64_t nReceived = nRecvBytes - state.nStallingRecvBytes;
+                int64_t nRemaining = std::max<int64_t>(0, state.nStallingBytesInFlight - nReceived);
+                int64_t nMeasured = nNow - state.nStallingMeasuredSince;
+                bool fDelivering = nReceived > 0 && nRemaining * nMeasured < nReceived * 1000000 * BLOCK_STALLING_TIMEOUT;
+                if (!fDelivering || state.nStallingSince < nNow - 1000000 * BLOCK_STALLING_TIMEOUT * MAX_BLOCK_STALLING_EXTENSION) {
+                    LogPrintf("Peer=%d is stalling block download, disconnecting\n", pto->id);
+                    pto->fDisconnect = true;
+                }
+            }
         }
         // In case there is a block that has been in flight from this peer for (2 + 0.5 * N) times the block interval
         // (with N the number of validated blocks that were in flight at the time it was requested), disconnect due to
@@ -7061,12 +11089,15 @@ bool SendMessages(const Consensus::Params& params, CNode* pto, bool fSendTrickle
         // Message: getdata (blocks)
         //
         vector<CInv> vGetData;
-        if (!pto->fDisconnect && !pto->fClient && (fFetch || !IsInitialBlockDownload(params)) && state.nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
+        int nBlocksToRequest = GetBlocksToRequest(&state);
+        if (!pto->fDisconnect && !pto->fClient && (fFetch || !IsInitialBlockDownload(params)) && nBlocksToRequest > 0) {
             vector<CBlockIndex*> vToDownload;
             NodeId staller = -1;
-            FindNextBlocksToDownload(pto->GetId(), MAX_BLOCKS_IN_TRANSIT_PER_PEER - state.nBlocksInFlight, vToDownload, staller);
+            FindNextBlocksToDownload(pto->GetId(), nBlocksToRequest, vToDownload, staller);
             for (CBlockIndex *pindex : vToDownload) {
-                vGetData.push_back(CInv(MSG_BLOCK, pindex->GetBlockHash()));
+                // A block that connects to our tip is requested as a compact block when the peer supports it.
+                bool fCompact = state.fProvidesHeaderAndIDs && pindex->pprev == chainActive.Tip() && CanDirectFetch(params);
+                vGetData.push_back(CInv(fCompact ? MSG_CMPCT_BLOCK : MSG_BLOCK, pindex->GetBlockHash()));
                 MarkBlockAsInFlight(pto->GetId(), pindex->GetBlockHash(), params, pindex);
                 LogPrint("net", "Requesting block %s (%d) peer=%d\n", pindex->GetBlockHash().ToString(),
                     pindex->nHeight, pto->id);
@@ -7074,6 +11105,7 @@ bool SendMessages(const Consensus::Params& params, CNode* pto, bool fSendTrickle
             if (state.nBlocksInFlight == 0 && staller != -1) {
                 if (State(staller)->nStallingSince == 0) {
                     State(staller)->nStallingSince = nNow;
+                    State(staller)->nStallingMeasuredSince = 0;
                     LogPrint("net", "Stall started peer=%d\n", staller);
                 }
             }
@@ -7126,8 +11158,7 @@ public:
         mapBlockIndex.clear();
 
         // orphan transactions
-        mapOrphanTransactions.clear();
-        mapOrphanTransactionsByPrev.clear();
+        ClearOrphanTransactions();
     }
 } instance_of_cmaincleanup;
 
@@ -11,6 +11,8 @@
 #endif
 
 #include "amount.h"
+#include "blockfilemap.h"
+#include "blockindexlookup.h"
 #include "chain.h"
 #include "chainparams.h"
 #include "coins.h"
@@ -46,10 +48,14 @@
 
 class CBlockIndex;
 class CBlockTreeDB;
+class CBlockUndo;
 class CBloomFilter;
+struct CCacheBudgets;
 class CChainParams;
+class CCoinsViewSnapshot;
 class CInv;
 class CScriptCheck;
+class CProofCheck;
 class CValidationInterface;
 class CValidationState;
 class PrecomputedTransactionData;
@@ -74,6 +80,30 @@ static const CAmount HIGH_TX_FEE_PER_KB = 0.01 * COIN;
 static const CAmount HIGH_MAX_TX_FEE = 100 * HIGH_TX_FEE_PER_KB;
 /** Default for -maxorphantx, maximum number of orphan transactions kept in memory */
 static const unsigned int DEFAULT_MAX_ORPHAN_TRANSACTIONS = 100;
+/** Maximum serialized size of an orphan transaction */
+static const unsigned int MAX_ORPHAN_TX_SIZE = 5000;
+/** Maximum total serialized size of the orphan transactions kept in memory */
+static const size_t MAX_ORPHAN_TRANSACTIONS_SIZE = 5 * 1000 * 1000;
+/** Time in seconds after which an orphan transaction whose parents have not arrived is dropped */
+static const int64_t ORPHAN_TX_EXPIRE_TIME = 20 * 60;
+/** Minimum time in seconds between two looks for expired orphan transactions */
+static const int64_t ORPHAN_TX_EXPIRE_INTERVAL = 5 * 60;
+/** Maximum number of shielded transactions waiting for off-lock proof verification */
+static const unsigned int MAX_PENDING_SHIELDED_TXS = 1000;
+/** Maximum number of shielded transactions whose proofs are verified in a single batch */
+static const unsigned int MAX_SHIELDED_TX_VERIFICATION_BATCH = 64;
+/**
+ * Relative costs of verifying a shielded transaction: a base cost for its
+ * signatures, and costs for each Sapling spend, Sapling output and JoinSplit.
+ */
+static const int64_t SHIELDED_TX_VERIFICATION_COST = 1;
+static const int64_t SAPLING_SPEND_VERIFICATION_COST = 3;
+static const int64_t SAPLING_OUTPUT_VERIFICATION_COST = 2;
+static const int64_t JOINSPLIT_VERIFICATION_COST = 5;
+/** Maximum verification cost of the shielded transactions of a peer waiting for verification */
+static const int64_t MAX_PENDING_SHIELDED_COST_PER_PEER = 10000;
+/** Maximum verification cost of a batch, unless it has a single transaction */
+static const int64_t MAX_SHIELDED_TX_VERIFICATION_BATCH_COST = 1000;
 /** Default for -txexpirydelta, in number of blocks */
 static const unsigned int DEFAULT_PRE_BLOSSOM_TX_EXPIRY_DELTA = 20;
 static const unsigned int DEFAULT_POST_BLOSSOM_TX_EXPIRY_DELTA = DEFAULT_PRE_BLOSSOM_TX_EXPIRY_DELTA * Consensus::BLOSSOM_POW_TARGET_SPACING_RATIO;
@@ -87,13 +117,49 @@ static const unsigned int BLOCKFILE_CHUNK_SIZE = 0x1000000; // 16 MiB
 static const unsigned int UNDOFILE_CHUNK_SIZE = 0x100000; // 1 MiB
 
 /** Maximum number of script-checking threads allowed */
-static const int MAX_SCRIPTCHECK_THREADS = 16;
+static const int MAX_SCRIPTCHECK_THREADS = 64;
 /** -par default (number of script-checking threads, 0 = auto) */
 static const int DEFAULT_SCRIPTCHECK_THREADS = 0;
-/** Number of blocks that can be requested at any given time from a single peer. */
-static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 16;
+/** Default for -adaptivepar */
+static const bool DEFAULT_ADAPTIVE_PAR = false;
+/** Seconds between adjustments of the verification threads, with -adaptivepar */
+static const int64_t VERIFICATION_THREADS_ADAPT_INTERVAL = 10;
+/** Maximum number of threads allowed to prefetch the inputs of blocks */
+static const int MAX_PREFETCH_THREADS = 16;
+/** -prefetchthreads default (number of threads prefetching the inputs of blocks, 0 = disabled) */
+static const int DEFAULT_PREFETCH_THREADS = 0;
+/** Maximum number of threads allowed to scan block files during -reindex */
+static const int MAX_REINDEX_THREADS = 16;
+/** -reindexthreads default (number of threads scanning block files ahead of validation during -reindex, 0 = none) */
+static const int DEFAULT_REINDEX_THREADS = 2;
+/** Default for -asyncflush, writing the chain state on a background thread */
+static const bool DEFAULT_ASYNC_FLUSH = false;
+/** Default for -utxostats */
+static const bool DEFAULT_UTXO_STATS = false;
+/** Default for -blockindexcache, writing the block index to a cache file at shutdown */
+static const bool DEFAULT_BLOCK_INDEX_CACHE = true;
+/** Default for -persistmempool */
+static const bool DEFAULT_PERSIST_MEMPOOL = true;
+/** Maximum number of blocks that can be requested at any given time from a single peer. The number
+ *  actually requested is limited by the estimated size of the blocks in flight from the peer. */
+static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 32;
+/** Estimated size of the blocks in flight from a peer below which more can always be requested from it. */
+static const int64_t MIN_BLOCK_BYTES_IN_FLIGHT = MAX_BLOCK_SIZE;
+/** Maximum estimated size of the blocks in flight from a single peer. */
+static const int64_t MAX_BLOCK_BYTES_IN_FLIGHT = 16 * MAX_BLOCK_SIZE;
+/** Time in seconds, beyond a round trip, for which the blocks in flight from a peer should keep it busy at its
+ *  measured bandwidth. */
+static const unsigned int BLOCK_DOWNLOAD_QUEUE_TIME = 1;
+/** Size assumed for blocks that are requested before any block has been received. */
+static const int64_t DEFAULT_BLOCK_SIZE_ESTIMATE = MAX_BLOCK_SIZE / 8;
 /** Timeout in seconds during which a peer must stall block download progress before being disconnected. */
 static const unsigned int BLOCK_STALLING_TIMEOUT = 2;
+/** Multiple of BLOCK_STALLING_TIMEOUT for which a stalling peer that is still delivering its blocks is kept. */
+static const unsigned int MAX_BLOCK_STALLING_EXTENSION = 8;
+/** Maximum depth of the blocks that are sent as compact blocks when requested; deeper blocks are sent in full. */
+static const int MAX_CMPCTBLOCK_DEPTH = 5;
+/** Maximum depth of the blocks whose transactions are sent in a blocktxn message; deeper blocks are sent in full. */
+static const int MAX_BLOCKTXN_DEPTH = 10;
 /** Number of headers sent in one getheaders result. We rely on the assumption that if a peer sends
  *  less than this number, we reached its tip. Changing this value is a protocol upgrade. */
 static const unsigned int MAX_HEADERS_RESULTS = 160;
@@ -119,8 +185,24 @@ static const int64_t DEFAULT_MAX_TIP_AGE = 24 * 60 * 60;
 /** Default for -permitbaremultisig */
 static const bool DEFAULT_PERMIT_BAREMULTISIG = true;
 static const bool DEFAULT_CHECKPOINTS_ENABLED = true;
+/** Default for -assumevalidheaders */
+static const bool DEFAULT_ASSUME_VALID_HEADERS = true;
+/** One in this many headers accepted without checking their Equihash solutions under -assumevalidheaders is checked. */
+static const int ASSUMED_VALID_HEADERS_SAMPLE = 32;
+/** Number of hashes of headers with valid Equihash solutions that are remembered, so that their solutions are not checked again. */
+static const size_t VALID_SOLUTION_CACHE_SIZE = 4096;
+/** Number of headers of a header snapshot (-loadheaders) that are read, checked and added to the block index together. */
+static const size_t HEADER_SNAPSHOT_BATCH_SIZE = 2000;
 static const bool DEFAULT_IBD_SKIP_TX_VERIFICATION = false;
 static const bool DEFAULT_TXINDEX = false;
+/** Number of recently confirmed transactions that are kept in memory for lookups when -txindex is set. */
+static const size_t RECENT_TX_CACHE_SIZE = 4096;
+/** Transactions larger than this are not kept with the recently confirmed ones. */
+static const size_t MAX_RECENT_TX_SIZE = 10000;
+static const bool DEFAULT_LAZY_MEMPOOL_INDEX = false;
+static const bool DEFAULT_COMPACTBLOCKINDEX = false;
+static const bool DEFAULT_BLOCKFILTERINDEX = false;
+static const bool DEFAULT_SHIELDEDINDEX = false;
 static const unsigned int DEFAULT_BANSCORE_THRESHOLD = 100;
 
 /** Default for -nurejectoldversions */
@@ -132,6 +214,24 @@ static const bool DEFAULT_NU_REJECT_OLD_VERSIONS = true;
 
 static const bool DEFAULT_PEERBLOOMFILTERS = true;
 static const bool DEFAULT_ENFORCENODEBLOOM = false;
+static const bool DEFAULT_PEERBLOCKFILTERS = false;
+/** Default for -filteredblockthreads, the threads that serve BIP 37 filtered blocks (0 = the message handler serves them) */
+static const int DEFAULT_FILTERED_BLOCK_THREADS = 2;
+static const int MAX_FILTERED_BLOCK_THREADS = 16;
+/** Maximum number of filtered blocks of a peer that are handed to the worker threads at a time */
+static const int MAX_FILTERED_BLOCKS_PENDING = 16;
+/** Worker time in microseconds that each peer is granted per second for its filtered blocks */
+static const int64_t FILTERED_BLOCK_BUDGET_RATE = 250000;
+/** Most worker time in microseconds that a peer can save up for its filtered blocks */
+static const int64_t FILTERED_BLOCK_BUDGET_BURST = 2000000;
+/** Number of recently read blocks that are shared by the filtered block requests of all peers */
+static const size_t FILTERED_BLOCK_CACHE_SIZE = 4;
+/** Maximum number of filters served in reply to one getcfilters message */
+static const int MAX_GETCFILTERS_SIZE = 1000;
+/** Maximum number of filter hashes served in reply to one getcfheaders message */
+static const int MAX_GETCFHEADERS_SIZE = 2000;
+/** Interval in blocks between the filter headers of a cfcheckpt message */
+static const int CFCHECKPT_INTERVAL = 1000;
 
 struct BlockHasher
 {
@@ -144,6 +244,8 @@ extern CCriticalSection cs_main;
 extern CTxMemPool mempool;
 typedef boost::unordered_map<uint256, CBlockIndex*, BlockHasher> BlockMap;
 extern BlockMap mapBlockIndex;
+/** The entries of mapBlockIndex, for lookups without cs_main. */
+extern CBlockIndexLookup blockIndexLookup;
 extern uint64_t nLastBlockTx;
 extern uint64_t nLastBlockSize;
 extern const std::string strMessageMagic;
@@ -151,8 +253,22 @@ extern CWaitableCriticalSection csBestBlock;
 extern CConditionVariable cvBlockChange;
 extern std::atomic_bool fImporting;
 extern std::atomic_bool fReindex;
+/** Whether the chain state is being rebuilt from the block files by -reindex-chainstate. */
+extern std::atomic_bool fReindexChainState;
+/**
+ * The number of verification threads started, counting the thread that
+ * connects blocks, or 0 if checks are not run in parallel. Of these, only
+ * GetVerificationThreads() run checks at any time.
+ */
 extern int nScriptCheckThreads;
+extern int nPrefetchThreads;
 extern bool fTxIndex;
+// Maintain an index of the Sapling data of each block, used to speed up wallet rescans
+extern bool fCompactBlockIndex;
+// Maintain an index of the basic block filters of BIP 158, served to light clients
+extern bool fBlockFilterIndex;
+// Maintain an index of the Sapling nullifiers and note commitments of the active chain
+extern bool fShieldedIndex;
 
 // The following flags enable specific indices (DB tables), but are not exposed as
 // separate command-line options; instead they are enabled by experimental feature "-insightexplorer"
@@ -160,6 +276,10 @@ extern bool fTxIndex;
 // Maintain a full address index, used to query for the balance, txids and unspent outputs for addresses
 extern bool fAddressIndex;
 
+// Keep the running balance of each address with the address index. Only set
+// if the address index was built with them from the start.
+extern bool fAddressBalances;
+
 // Maintain a full spent index, used to query the spending txid and input index for an outpoint
 extern bool fSpentIndex;
 
@@ -170,12 +290,24 @@ extern bool fTimestampIndex;
 
 extern bool fIsBareMultisigStd;
 extern bool fCheckBlockIndex;
+/** Read blocks through memory mappings of the block files, rather than with file reads. */
+extern bool fMapBlockFiles;
+/** Compress new records of the block and undo files. */
+extern bool fCompressBlockFiles;
 extern bool fCheckpointsEnabled;
+/** Skip the Equihash checks of headers and blocks that lead to the last checkpoint. */
+extern bool fAssumeValidHeaders;
 extern bool fIBDSkipTxVerification;
 // TODO: remove this flag by structuring our code such that
 // it is unneeded for testing
 extern bool fCoinbaseEnforcedShieldingEnabled;
 extern size_t nCoinCacheUsage;
+/** Bytes of the coins cache to keep when the chain state is flushed; 0 empties it. */
+extern size_t nCoinCacheKeepUsage;
+/** Whether the UTXO set statistics are kept up to date as blocks are connected (-utxostats) */
+extern bool fUTXOStats;
+/** Whether the chain state is written in sorted chunks while catching up (-chainstatebulkwrite) */
+extern bool fChainstateBulkWrite;
 /** A fee rate smaller than this is considered zero fee (for relaying, mining and transaction creation) */
 extern CFeeRate minRelayTxFee;
 /** Absolute maximum transaction fee (in satoshis) used by wallet and mempool (rejects high fee in sendrawtransaction) */
@@ -202,6 +334,10 @@ static const unsigned int MIN_BLOCKS_TO_KEEP = 288;
 
 static const signed int DEFAULT_CHECKBLOCKS = MIN_BLOCKS_TO_KEEP;
 static const unsigned int DEFAULT_CHECKLEVEL = 3;
+/** Number of the -checkblocks blocks that are checked before the node starts */
+static const signed int DEFAULT_STARTUP_CHECKBLOCKS = 6;
+/** Whether to shut down if the background check of -checkblocks fails */
+static const bool DEFAULT_CHECKBLOCKS_HALT = true;
 
 // Require that user allocate at least 550MB for block & undo files (blk???.dat and rev???.dat)
 // At 1MB per block, 288 blocks = 288MB.
@@ -213,6 +349,15 @@ static const unsigned int DEFAULT_CHECKLEVEL = 3;
 // Setting the target to > than 550MB will make it likely we can respect the target.
 static const uint64_t MIN_DISK_SPACE_FOR_BLOCK_FILES = 550 * 1024 * 1024;
 
+/** Free space that pruning tries to leave on the volume of the block files, by lowering its target */
+static const uint64_t PRUNE_MIN_FREE_SPACE = 1024 * 1024 * 1024;
+
+/**
+ * Serve the filtered blocks that peers ask for with getdata on nThreads
+ * worker threads, rather than in the message handler.
+ */
+void StartFilteredBlockServer(boost::thread_group& threadGroup, int nThreads);
+
 /** Register with a network node to receive its signals */
 void RegisterNodeSignals(CNodeSignals& nodeSignals);
 /** Unregister a network node */
@@ -228,9 +373,11 @@ void UnregisterNodeSignals(CNodeSignals& nodeSignals);
  * @param[in]   pblock  The block we want to process.
  * @param[in]   fForceProcessing Process this block even if unrequested; used for non-network block sources and whitelisted peers.
  * @param[out]  dbp     If pblock is stored to disk (or already there), this will be set to its location.
+ * @param[in]   pRawBegin, pRawEnd  The serialization of pblock as it was received, if known, which is written to disk instead of serializing it again.
  * @return True if state.IsValid()
  */
-bool ProcessNewBlock(CValidationState& state, const CChainParams& chainparams, const CNode* pfrom, const CBlock* pblock, bool fForceProcessing, CDiskBlockPos* dbp);
+bool ProcessNewBlock(CValidationState& state, const CChainParams& chainparams, const CNode* pfrom, const CBlock* pblock, bool fForceProcessing, CDiskBlockPos* dbp,
+                     const char* pRawBegin = NULL, const char* pRawEnd = NULL);
 /** Check whether enough disk space is available for an incoming block */
 bool CheckDiskSpace(uint64_t nAdditionalBytes = 0);
 /** Open a block file (blk?????.dat) */
@@ -241,14 +388,29 @@ FILE* OpenUndoFile(const CDiskBlockPos &pos, bool fReadOnly = false);
 fs::path GetBlockPosFilename(const CDiskBlockPos &pos, const char *prefix);
 /** Import blocks from an external file */
 bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskBlockPos *dbp = NULL);
+/**
+ * Reindex the first nFiles block files. With nThreads > 0, the files are
+ * scanned and the block headers checked on that many threads, ahead of the
+ * validation of their blocks on this thread.
+ */
+void ReindexBlockFiles(const CChainParams& chainparams, int nFiles, int nThreads);
 /** Initialize a new block tree database + block data on disk */
 bool InitBlockIndex(const CChainParams& chainparams);
 /** Load the block tree and coins database from disk */
 bool LoadBlockIndex();
 /** Unload database information */
 void UnloadBlockIndex();
+/** The memory used by mapBlockIndex and its entries, in bytes. Requires cs_main. */
+size_t BlockIndexDynamicMemoryUsage();
+/**
+ * Prepare the complete messages received from the given nodes for processing,
+ * in parallel. Only called by the message handler thread.
+ */
+void PrepareMessages(const CChainParams& chainparams, const std::vector<CNode*>& vNodes);
 /** Process protocol messages received from a given node */
 bool ProcessMessages(const CChainParams& chainparams, CNode* pfrom);
+/** Whether there are orphan transactions whose parents have arrived, which ProcessMessages() processes */
+bool HaveOrphanWork();
 /**
  * Send queued protocol messages to be sent to a give node.
  *
@@ -257,14 +419,55 @@ bool ProcessMessages(const CChainParams& chainparams, CNode* pfrom);
  * @param[in]   fSendTrickle    When true send the trickled data, otherwise trickle the data until true.
  */
 bool SendMessages(const Consensus::Params& params, CNode* pto, bool fSendTrickle);
-/** Run an instance of the script checking thread */
-void ThreadScriptCheck();
+/**
+ * Run an instance of the thread that checks scripts, proofs and the Equihash
+ * solutions of received headers, and prepares received messages for processing
+ */
+void ThreadCheckPool();
+/**
+ * Set the number of verification threads that -par asked for, which run
+ * checks from startup, and that -adaptivepar returns to at the tip.
+ */
+void InitVerificationThreads(int nThreads);
+/** The number of verification threads that run checks, counting the thread that connects blocks. */
+int GetVerificationThreads();
+/**
+ * Run checks on nThreads of the nScriptCheckThreads verification threads,
+ * and make that the number -adaptivepar returns to at the tip. Returns false
+ * if nThreads is out of range.
+ */
+bool SetVerificationThreads(int nThreads);
+/**
+ * Add verification threads while the checks back up during initial block
+ * download, and remove them once they don't or at the tip (-adaptivepar).
+ */
+void AdaptVerificationThreads();
+/** Run an instance of the thread that reads the inputs of blocks before they are connected */
+void ThreadPrefetchCheck();
+/** Run the thread that writes the chain state to disk when -asyncflush is set */
+void ThreadFlushChainstate();
+/** Run the thread that verifies the proofs of shielded transactions received from peers */
+void ThreadShieldedTxVerification();
+/**
+ * Run the thread that checks the blocks of the active chain from height
+ * nStartHeight down to nStopHeight at up to -checklevel 2, one block at a
+ * time, in the background. If a block fails, the node is shut down if
+ * fHaltOnFailure is set, and a warning is raised otherwise.
+ */
+void ThreadVerifyDB(const CChainParams& chainparams, int nCheckLevel, int nStartHeight, int nStopHeight, bool fHaltOnFailure);
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
 bool IsInitialBlockDownload(const Consensus::Params& params);
 /** Format a string that describes several potential problems detected by the core */
 std::pair<std::string, int64_t> GetWarnings(const std::string& strFor);
 /** Retrieve a transaction (from memory pool, or from disk, if possible) */
 bool GetTransaction(const uint256& hash, CTransaction& tx, const Consensus::Params& params, uint256& hashBlock, bool fAllowSlow = false, CBlockIndex* blockIndex = nullptr);
+/**
+ * Retrieve the serialization of a confirmed transaction from the recently
+ * confirmed transactions or the transaction index, without deserializing it.
+ * Returns false if it is not found this way, in which case GetTransaction()
+ * may still find it.
+ */
+bool GetTransactionData(const uint256& hash, std::vector<char>& vTx, uint256& hashBlock);
 /** Find the best known block, and make it the tip of the block chain */
 bool ActivateBestChain(CValidationState& state, const CChainParams& chainparams, const CBlock* pblock = NULL);
 CAmount GetBlockSubsidy(int nHeight, const Consensus::Params& consensusParams);
@@ -287,10 +490,23 @@ CAmount GetBlockSubsidy(int nHeight, const Consensus::Params& consensusParams);
 void FindFilesToPrune(std::set<int>& setFilesToPrune, uint64_t nPruneAfterHeight);
 
 /**
- *  Actually unlink the specified files
+ * Queue the specified files to be unlinked by ThreadUnlinkPrunedFiles. Must
+ * only be called once the block index no longer refers to them.
  */
 void UnlinkPrunedFiles(std::set<int>& setFilesToPrune);
 
+/** Unlink the queued pruned files, one pair at a time, off cs_main. */
+void ThreadUnlinkPrunedFiles();
+
+/** Unlink the pruned files that are still queued, on this thread. */
+void FlushPrunedFiles();
+
+/**
+ * The number of bytes of block and undo files to stay below: nPruneTarget,
+ * lowered when the volume has less than PRUNE_MIN_FREE_SPACE free.
+ */
+uint64_t GetPruneTarget();
+
 /** Create a new block index entry for a given block hash */
 CBlockIndex * InsertBlockIndex(uint256 hash);
 /** Get statistics from node state */
@@ -301,12 +517,57 @@ void Misbehaving(NodeId nodeid, int howmuch);
 void FlushStateToDisk();
 /** Prune block files and flush state to disk. */
 void PruneAndFlush();
+/** Set the cache budgets configured at startup, from which RebalanceCaches() starts. */
+void InitCacheBudgets(const CCacheBudgets& budgets, int64_t nCoinCacheKeep);
+/** Resize the caches and the mempool from what they did since the last call (-adaptivedbcache). */
+void RebalanceCaches();
+/** Write the block index to a cache file read at the next start, if it has been flushed to disk. */
+void WriteBlockIndexCache();
+/** Load the UTXO set statistics for the chainstate, computing them if they were not stored for its best block. */
+bool LoadUTXOStats();
+/** Get the UTXO set statistics at the tip, if -utxostats is set. */
+bool GetUTXOStats(CCoinsStats& stats);
+/** Write the transactions of the mempool, their fee deltas and the recently evicted list to mempool.dat. */
+bool DumpMempool();
+/** Re-admit the transactions written to mempool.dat to the mempool, a batch at a time. */
+bool LoadMempool(const CChainParams& chainparams);
+/** Write the chain state at the tip to a UTXO set snapshot file. */
+bool DumpUTXOSnapshot(const fs::path& path, CSnapshotMetadata& metadata, uint256& hashSnapshot, uint64_t& nCoins, std::string& strError);
+/**
+ * Replace the chain state with a UTXO set snapshot pinned in the chain
+ * parameters, for a descendant of the tip whose header has been received.
+ * The blocks up to its base are then never downloaded or validated.
+ */
+bool LoadUTXOSnapshot(const fs::path& path, CSnapshotMetadata& metadata, uint256& hashSnapshot, uint64_t& nCoins, std::string& strError);
+/** Write the headers of the active chain, from the genesis block on, to a header snapshot file. */
+bool DumpHeaderSnapshot(const fs::path& path, int& nHeight, std::string& strError);
+/**
+ * Add the headers of a header snapshot (-loadheaders) to the block index, so
+ * that block download can start without syncing the headers from peers. The
+ * snapshot must be for this network, match the checkpoints, reach the last
+ * of them and have the minimum chain work; only then are its headers
+ * accepted, with their Equihash solutions sampled under -assumevalidheaders.
+ */
+bool LoadHeaderSnapshot(const CChainParams& chainparams, const fs::path& path, int& nHeaders, std::string& strError);
+
+/**
+ * Verify the proofs of transactions that are about to be passed to
+ * AcceptToMemoryPool in parallel on the proof check threads, which stores
+ * them in the proof cache, so that AcceptToMemoryPool does not verify them one
+ * at a time under cs_main. Does nothing without proof check threads.
+ */
+void CacheTransactionProofs(const std::vector<const CTransaction*>& vtx, uint32_t consensusBranchId);
 
 /** (try to) add transaction to memory pool **/
 bool AcceptToMemoryPool(
         const CChainParams& chainparams,
         CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
-        bool* pfMissingInputs, bool fRejectAbsurdFee=false);
+        bool* pfMissingInputs, bool fRejectAbsurdFee=false, bool fProofsVerified=false);
+/** As above, with the mempool entry sharing ptx rather than holding a copy of it **/
+bool AcceptToMemoryPool(
+        const CChainParams& chainparams,
+        CTxMemPool& pool, CValidationState &state, const CTransactionRef &ptx, bool fLimitFree,
+        bool* pfMissingInputs, bool fRejectAbsurdFee=false, bool fProofsVerified=false);
 
 
 struct CNodeStateStats {
@@ -343,22 +604,31 @@ unsigned int GetP2SHSigOpCount(const CTransaction& tx, const CCoinsViewCache& ma
  * instead of being performed inline.
  */
 bool ContextualCheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &view, bool fScriptChecks,
-                           unsigned int flags, bool cacheStore, PrecomputedTransactionData& txdata,
+                           unsigned int flags, bool cacheStore, const PrecomputedTransactionData& txdata,
                            const Consensus::Params& consensusParams, uint32_t consensusBranchId,
                            std::vector<CScriptCheck> *pvChecks = NULL);
 
-/** Check a transaction contextually against a set of consensus rules */
+/**
+ * Check a transaction contextually against a set of consensus rules. txdata,
+ * if not null, is used for the signature hash of the shielded parts.
+ */
 bool ContextualCheckTransaction(const CTransaction& tx, CValidationState &state,
                                 const CChainParams& chainparams, int nHeight, bool isMined,
-                                bool (*isInitBlockDownload)(const Consensus::Params&) = IsInitialBlockDownload);
+                                bool (*isInitBlockDownload)(const Consensus::Params&) = IsInitialBlockDownload,
+                                ProofVerifier* saplingVerifier = nullptr,
+                                const PrecomputedTransactionData* txdata = nullptr);
 
 /** Apply the effects of this transaction on the UTXO set represented by view */
 void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, int nHeight);
 
 /** Transaction validation functions */
 
-/** Context-independent validity checks */
-bool CheckTransaction(const CTransaction& tx, CValidationState& state, ProofVerifier& verifier);
+/**
+ * Context-independent validity checks. If cacheStore is set, the JoinSplit
+ * proofs that verify are added to the proof verification cache.
+ */
+bool CheckTransaction(const CTransaction& tx, CValidationState& state, ProofVerifier& verifier,
+                      bool cacheStore = false);
 bool CheckTransactionWithoutProofVerification(const CTransaction& tx, CValidationState &state);
 
 namespace Consensus {
@@ -414,12 +684,12 @@ private:
     bool cacheStore;
     uint32_t consensusBranchId;
     ScriptError error;
-    PrecomputedTransactionData *txdata;
+    const PrecomputedTransactionData *txdata;
 
 public:
     CScriptCheck(): amount(0), ptxTo(0), nIn(0), nFlags(0), cacheStore(false), consensusBranchId(0), error(SCRIPT_ERR_UNKNOWN_ERROR) {}
-    CScriptCheck(const CCoins& txFromIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, bool cacheIn, uint32_t consensusBranchIdIn, PrecomputedTransactionData* txdataIn) :
-        scriptPubKey(txFromIn.vout[txToIn.vin[nInIn].prevout.n].scriptPubKey), amount(txFromIn.vout[txToIn.vin[nInIn].prevout.n].nValue),
+    CScriptCheck(const CTxOut& outIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, bool cacheIn, uint32_t consensusBranchIdIn, const PrecomputedTransactionData* txdataIn) :
+        scriptPubKey(outIn.scriptPubKey), amount(outIn.nValue),
         ptxTo(&txToIn), nIn(nInIn), nFlags(nFlagsIn), cacheStore(cacheIn), consensusBranchId(consensusBranchIdIn), error(SCRIPT_ERR_UNKNOWN_ERROR), txdata(txdataIn) { }
 
     bool operator()();
@@ -439,19 +709,75 @@ public:
     ScriptError GetScriptError() const { return error; }
 };
 
+/**
+ * Closure representing one zk-SNARK verification job: either the proof of a
+ * single Sprout JoinSplit, or a batch of Sapling proofs and JoinSplit
+ * signatures that were deferred to a batched ProofVerifier.
+ * Note that this stores references to the JoinSplit or to the verifier.
+ */
+class CProofCheck
+{
+private:
+    const JSDescription *pjoinsplit;
+    const Ed25519VerificationKey *pjoinSplitPubKey;
+    ProofVerifier *psaplingBatch;
+    bool cacheStore;
+
+public:
+    CProofCheck(): pjoinsplit(nullptr), pjoinSplitPubKey(nullptr), psaplingBatch(nullptr), cacheStore(false) {}
+    CProofCheck(const JSDescription& joinsplitIn, const Ed25519VerificationKey& joinSplitPubKeyIn, bool cacheStoreIn = false) :
+        pjoinsplit(&joinsplitIn), pjoinSplitPubKey(&joinSplitPubKeyIn), psaplingBatch(nullptr), cacheStore(cacheStoreIn) { }
+    explicit CProofCheck(ProofVerifier& saplingBatchIn) :
+        pjoinsplit(nullptr), pjoinSplitPubKey(nullptr), psaplingBatch(&saplingBatchIn), cacheStore(false) { }
+
+    bool operator()();
+
+    void swap(CProofCheck &check) {
+        std::swap(pjoinsplit, check.pjoinsplit);
+        std::swap(pjoinSplitPubKey, check.pjoinSplitPubKey);
+        std::swap(psaplingBatch, check.psaplingBatch);
+        std::swap(cacheStore, check.cacheStore);
+    }
+};
+
 bool GetSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value);
 bool GetAddressIndex(const uint160& addressHash, int type,
         std::vector<CAddressIndexDbEntry> &addressIndex,
-        int start = 0, int end = 0);
+        int start = 0, int end = 0,
+        const CAddressIndexKey* after = nullptr, size_t limit = 0);
+/**
+ * Get the balance of an address, and the total it received, from its running
+ * balance. Returns false if running balances are not kept.
+ */
+bool GetAddressBalance(const uint160& addressHash, int type, CAmount& balance, CAmount& received);
 bool GetAddressUnspent(const uint160& addressHash, int type,
         std::vector<CAddressUnspentDbEntry>& unspentOutputs);
 bool GetTimestampIndex(unsigned int high, unsigned int low, bool fActiveOnly,
     std::vector<std::pair<uint256, unsigned int> > &hashes);
 
 /** Functions for disk access for blocks */
-bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart);
+/**
+ * Write block to the block file at pos, or vCompressed, its compressed serialization, if it is not empty,
+ * or else the serialization of the block from pRawBegin to pRawEnd, as it was received, if it is given.
+ */
+bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart, const std::vector<char>& vCompressed = std::vector<char>(),
+                      const char* pRawBegin = NULL, const char* pRawEnd = NULL);
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams);
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams);
+/** Read the undo data of a block from its undo file; hashBlock is the hash of its parent. */
+bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uint256& hashBlock);
+/**
+ * Read the serialized block of pindex from its block file without
+ * deserializing it, checking its header hash. When the block file is mapped,
+ * the block points into the mapping rather than being copied.
+ */
+bool ReadRawBlockFromDisk(CRawBlock& block, const CBlockIndex* pindex, const CMessageHeader::MessageStartChars& messageStart);
+/**
+ * Open the store of the headers of the active chain, blocks/headers.dat,
+ * from which headers messages are served. Nothing is stored while it is closed.
+ */
+void OpenHeaderStore(const Consensus::Params& params);
+void CloseHeaderStore();
 
 /** Functions for validating blocks and updating the block tree */
 
@@ -480,9 +806,36 @@ bool ContextualCheckBlock(const CBlock& block, CValidationState& state,
 
 /** Apply the effects of this block (with given index) on the UTXO set represented by coins.
  *  Validity checks that depend on the UTXO set are also done; ConnectBlock()
- *  can fail if those validity checks fail (among other reasons). */
+ *  can fail if those validity checks fail (among other reasons). If pstats is
+ *  not null, the changes to the UTXO set are also applied to it. */
 bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& coins,
-                  const CChainParams& chainparams, bool fJustCheck = false);
+                  const CChainParams& chainparams, bool fJustCheck = false,
+                  CCoinsStats* pstats = nullptr);
+
+/**
+ * Coarse buckets of a block's serialized size and number of shielded
+ * transactions, used to label its per-stage validation metrics so that the
+ * number of exported series stays bounded.
+ */
+struct BlockMetricsLabels {
+    const char* size;
+    const char* shielded;
+
+    explicit BlockMetricsLabels(const CBlock& block);
+};
+
+/**
+ * Record the time a stage of validating, connecting or notifying a block
+ * took in the zcash.chain.verified.block.stage.seconds histogram.
+ */
+void RecordBlockStageTime(const char* stage, const BlockMetricsLabels& labels, int64_t nMicros);
+
+/**
+ * Return the total time in microseconds recorded for each stage by
+ * RecordBlockStageTime since the last reset. Used by benchmarks.
+ */
+std::map<std::string, int64_t> GetBlockStageTimes();
+void ResetBlockStageTimes();
 
 /**
  * Check a block is completely valid from start to finish (only works on top
@@ -521,12 +874,21 @@ bool ReconsiderBlock(CValidationState& state, CBlockIndex *pindex);
 /** The currently-connected chain of blocks (protected by cs_main). */
 extern CChain chainActive;
 
+/** The coin database (protected by cs_main) */
+extern CCoinsViewDB *pcoinsdbview;
+
 /** Global variable that points to the active CCoinsView (protected by cs_main) */
 extern CCoinsViewCache *pcoinsTip;
 
+/** The layer below pcoinsTip that writes it to disk in the background, if -asyncflush is set (protected by cs_main) */
+extern CCoinsViewSnapshot *pcoinsSnapshot;
+
 /** Global variable that points to the active block tree (protected by cs_main) */
 extern CBlockTreeDB *pblocktree;
 
+/** The block at which the chain state was loaded from a UTXO set snapshot, if it was (protected by cs_main) */
+extern CBlockIndex *pindexSnapshotBase;
+
 /**
  * Return the spend height, which is one more than the inputs.GetBestBlock().
  * While checking, GetBestBlock() refers to the parent block. (protected by cs_main)
@@ -4,7 +4,6 @@
 
 #include "mempool_limit.h"
 
-#include "core_memusage.h"
 #include "logging.h"
 #include "random.h"
 #include "serialize.h"
@@ -57,20 +56,26 @@ void WeightedTxTree::backPropagate(size_t fromIndex, const TxWeight& weightDelta
     }
 }
 
-size_t WeightedTxTree::findByEvictionWeight(size_t fromIndex, int64_t weightToFind) const
+size_t WeightedTxTree::findByEvictionWeight(int64_t weightToFind) const
 {
-    int leftWeight = getWeightAt(fromIndex * 2 + 1).evictionWeight;
-    int rightWeight = getWeightAt(fromIndex).evictionWeight - getWeightAt(fromIndex * 2 + 2).evictionWeight;
-    // On Left
-    if (weightToFind < leftWeight) {
-        return findByEvictionWeight(fromIndex * 2 + 1, weightToFind);
+    size_t index = 0;
+    while (true) {
+        int64_t leftWeight = getWeightAt(index * 2 + 1).evictionWeight;
+        // On Left
+        if (weightToFind < leftWeight) {
+            index = index * 2 + 1;
+            continue;
+        }
+        weightToFind -= leftWeight;
+        // Found
+        int64_t nodeWeight = txIdAndWeights[index].txWeight.evictionWeight;
+        if (weightToFind < nodeWeight) {
+            return index;
+        }
+        // On Right
+        weightToFind -= nodeWeight;
+        index = index * 2 + 2;
     }
-    // Found
-    if (weightToFind < rightWeight) {
-        return fromIndex;
-    }
-    // On Right
-    return findByEvictionWeight(fromIndex * 2 + 2, weightToFind - rightWeight);
 }
 
 TxWeight WeightedTxTree::getTotalWeight() const
@@ -127,8 +132,9 @@ std::optional<uint256> WeightedTxTree::maybeDropRandom()
         return std::nullopt;
     }
     LogPrint("mempool", "Mempool cost limit exceeded (cost=%d, limit=%d)\n", totalTxWeight.cost, capacity);
-    int randomWeight = GetRand(totalTxWeight.evictionWeight);
-    WeightedTxInfo drop = txIdAndWeights[findByEvictionWeight(0, randomWeight)];
+    // The total eviction weight of a large pool does not fit in an int.
+    int64_t randomWeight = GetRand(totalTxWeight.evictionWeight);
+    WeightedTxInfo drop = txIdAndWeights[findByEvictionWeight(randomWeight)];
     LogPrint("mempool", "Evicting transaction (txid=%s, cost=%d, evictionWeight=%d)\n",
         drop.txId.ToString(), drop.txWeight.cost, drop.txWeight.evictionWeight);
     remove(drop.txId);
@@ -147,9 +153,8 @@ TxWeight TxWeight::negate() const
 }
 
 
-WeightedTxInfo WeightedTxInfo::from(const CTransaction& tx, const CAmount& fee)
+WeightedTxInfo WeightedTxInfo::from(const CTransaction& tx, const CAmount& fee, size_t memUsage)
 {
-    size_t memUsage = RecursiveDynamicUsage(tx);
     int64_t cost = std::max((int64_t) memUsage, (int64_t) MIN_TX_COST);
     int64_t evictionWeight = cost;
     if (fee < DEFAULT_FEE) {
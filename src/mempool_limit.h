@@ -13,6 +13,7 @@
 
 #include "primitives/transaction.h"
 #include "policy/fees.h"
+#include "serialize.h"
 #include "uint256.h"
 
 const size_t DEFAULT_MEMPOOL_TOTAL_COST_LIMIT = 80000000;
@@ -47,12 +48,38 @@ public:
 
     void add(const uint256& txId);
     bool contains(const uint256& txId);
+
+    // The entries keep the times at which they were added, so that a list
+    // that is written at shutdown and read back at startup expires on time.
+    template<typename Stream>
+    void Serialize(Stream& s) const {
+        std::vector<std::pair<uint256, int64_t>> entries(txIdsAndTimes.begin(), txIdsAndTimes.end());
+        s << entries;
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream& s) {
+        std::vector<std::pair<uint256, int64_t>> entries;
+        s >> entries;
+        for (const auto& entry : entries) {
+            if (txIdSet.count(entry.first)) {
+                continue;
+            }
+            if (txIdsAndTimes.size() == capacity) {
+                txIdSet.erase(txIdsAndTimes.front().first);
+                txIdsAndTimes.pop_front();
+            }
+            txIdsAndTimes.push_back(entry);
+            txIdSet.insert(entry.first);
+        }
+        pruneList();
+    }
 };
 
 
 // The mempool of a node holds a set of transactions. Each transaction has a *cost*,
 // which is an integer defined as:
-//   max(serialized transaction size in bytes, 4000)
+//   max(memory used by the transaction and its mempool entry in bytes, 4000)
 // Each transaction also has an *eviction weight*, which is *cost* + *fee_penalty*,
 // where *fee_penalty* is 16000 if the transaction pays a fee less than 10000 zatoshi,
 // otherwise 0.
@@ -75,8 +102,9 @@ struct WeightedTxInfo {
 
     WeightedTxInfo(uint256 txId_, TxWeight txWeight_) : txId(txId_), txWeight(txWeight_) {}
 
-    // Factory method which calculates cost based on size in bytes and fee.
-    static WeightedTxInfo from(const CTransaction& tx, const CAmount& fee);
+    // Factory method which calculates cost based on the memory used by the
+    // transaction in the mempool (in bytes) and fee.
+    static WeightedTxInfo from(const CTransaction& tx, const CAmount& fee, size_t memUsage);
 };
 
 
@@ -88,7 +116,7 @@ struct WeightedTxInfo {
 // allows for addition, removal, and random selection/dropping in logarithmic time.
 class WeightedTxTree
 {
-    const int64_t capacity;
+    int64_t capacity;
     size_t size = 0;
 
     // The following two vectors are the tree representation of this collection.
@@ -108,9 +136,9 @@ class WeightedTxTree
     // ancestors to reflect its cost.
     void backPropagate(size_t fromIndex, const TxWeight& weightDelta);
 
-    // For a given random cost + fee penalty, this method recursively finds the
-    // correct transaction. This is used by WeightedTxTree::maybeDropRandom().
-    size_t findByEvictionWeight(size_t fromIndex, int64_t weightToFind) const;
+    // For a given random cost + fee penalty, this method walks down from the root
+    // to the correct transaction. This is used by WeightedTxTree::maybeDropRandom().
+    size_t findByEvictionWeight(int64_t weightToFind) const;
 
 public:
     WeightedTxTree(int64_t capacity_) : capacity(capacity_) {
@@ -119,6 +147,14 @@ public:
 
     TxWeight getTotalWeight() const;
 
+    int64_t getCapacity() const { return capacity; }
+    // Change the cost limit. Transactions over a lower limit are dropped by
+    // the following calls to maybeDropRandom().
+    void setCapacity(int64_t capacity_) {
+        assert(capacity_ >= 0);
+        capacity = capacity_;
+    }
+
     void add(const WeightedTxInfo& weightedTxInfo);
     void remove(const uint256& txId);
 
@@ -5,9 +5,13 @@
 #ifndef BITCOIN_MEMUSAGE_H
 #define BITCOIN_MEMUSAGE_H
 
+#include "prevector.h"
+#include "support/allocators/pool.h"
+
 #include <stdlib.h>
 
 #include <map>
+#include <memory>
 #include <set>
 #include <vector>
 
@@ -69,6 +73,14 @@ private:
     X x;
 };
 
+// The control block of a shared_ptr: a vtable pointer and the use and weak counts
+struct stl_shared_counter
+{
+    void* class_type;
+    size_t use_count;
+    size_t weak_count;
+};
+
 template<typename X>
 static inline size_t DynamicUsage(const std::vector<X>& v)
 {
@@ -93,6 +105,14 @@ static inline size_t DynamicUsage(const std::map<X, Y, C>& m)
     return MallocUsage(sizeof(stl_tree_node<std::pair<const X, Y> >)) * m.size();
 }
 
+template<typename X>
+static inline size_t DynamicUsage(const std::shared_ptr<X>& p)
+{
+    // std::make_shared puts the object and the control block in a single
+    // allocation, which can't be told apart from two here; assume the worst.
+    return p ? MallocUsage(sizeof(X)) + MallocUsage(sizeof(stl_shared_counter)) : 0;
+}
+
 // Boost data structures
 
 template<typename X>
@@ -114,6 +134,29 @@ static inline size_t DynamicUsage(const boost::unordered_map<X, Y, Z>& m)
     return MallocUsage(sizeof(boost_unordered_node<std::pair<const X, Y> >)) * m.size() + MallocUsage(sizeof(void*) * m.bucket_count());
 }
 
+// Pool allocated data structures
+
+/** The chunks of a PoolResource, including the blocks on its freelists. */
+template<std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES>
+static inline size_t DynamicUsage(const PoolResource<MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& resource)
+{
+    // The allocated chunks are stored in a std::list. Size per node should
+    // therefore be 3 pointers: next, previous, and a pointer to the chunk.
+    size_t estimated_list_node_size = MallocUsage(sizeof(void*) * 3);
+    return (estimated_list_node_size + MallocUsage(resource.ChunkSizeBytes())) * resource.NumAllocatedChunks();
+}
+
+/**
+ * The nodes of a pool allocated map live in the chunks of its PoolResource,
+ * which may be shared by several maps and must be counted once on its own,
+ * so only the bucket array is counted here.
+ */
+template<typename X, typename Y, typename Z, typename T, std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES>
+static inline size_t DynamicUsage(const boost::unordered_map<X, Y, Z, std::equal_to<X>, PoolAllocator<T, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES> >& m)
+{
+    return MallocUsage(sizeof(void*) * m.bucket_count());
+}
+
 }
 
 #endif // BITCOIN_MEMUSAGE_H
@@ -2,17 +2,37 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or https://www.opensource.org/licenses/mit-license.php .
 
+#if defined(HAVE_CONFIG_H)
+#include "config/bitcoin-config.h"
+#endif
+
 #include "metrics.h"
 
+#include "addrman.h"
 #include "chainparams.h"
 #include "checkpoints.h"
+#include "coinssnapshot.h"
+#include "init.h"
+#include "librustzcash.h"
 #include "main.h"
+#include "scheduler.h"
+#include "script/sigcache.h"
+#include "sync.h"
+#include "txmempool.h"
 #include "timedata.h"
 #include "ui_interface.h"
 #include "util.h"
 #include "utiltime.h"
 #include "utilmoneystr.h"
 #include "utilstrencodings.h"
+#ifdef ENABLE_WALLET
+#include "wallet/wallet.h"
+#endif
+
+#include <rust/metrics.h>
+
+#include <deque>
+#include <map>
 
 #include <boost/range/irange.hpp>
 #include <boost/thread.hpp>
@@ -84,6 +104,9 @@ static AtomicCounter minedBlocks;
 AtomicTimer miningTimer;
 std::atomic<size_t> nSizeReindexed(0);   // valid only during reindex
 std::atomic<size_t> nFullSizeToReindex(1);   // valid only during reindex
+std::atomic<uint64_t> nShieldedOutputsConnected(0);
+std::atomic<uint64_t> nCoinsCacheFlushes(0);
+std::atomic<size_t> nZkParamsSize(0);
 
 static boost::synchronized_value<std::list<uint256>> trackedBlocks;
 
@@ -93,6 +116,273 @@ static bool loaded = false;
 
 extern int64_t GetNetworkHashPS(int lookup, int height);
 
+void ExportLockMetrics()
+{
+    struct LockSiteTotals {
+        uint64_t nLocks = 0;
+        uint64_t nContentions = 0;
+        uint64_t nWaitMicros = 0;
+        uint64_t nHoldMicros = 0;
+    };
+    static std::map<const CLockSite*, LockSiteTotals> mapExported;
+
+    for (const CLockSite* site : GetLockSites()) {
+        LockSiteTotals& exported = mapExported[site];
+        LockSiteTotals current;
+        current.nLocks = site->nLocks.load(std::memory_order_relaxed);
+        if (current.nLocks == exported.nLocks) {
+            continue;
+        }
+        current.nContentions = site->nContentions.load(std::memory_order_relaxed);
+        current.nWaitMicros = site->nWaitMicros.load(std::memory_order_relaxed);
+        current.nHoldMicros = site->nHoldMicros.load(std::memory_order_relaxed);
+
+        std::string strSite = strprintf("%s:%d", site->pszFile, site->nLine);
+        MetricsCounter("zcash.lock.acquired.total", current.nLocks - exported.nLocks,
+            "lock", site->pszName, "site", strSite.c_str());
+        MetricsCounter("zcash.lock.contended.total", current.nContentions - exported.nContentions,
+            "lock", site->pszName, "site", strSite.c_str());
+        MetricsCounter("zcash.lock.wait.microseconds", current.nWaitMicros - exported.nWaitMicros,
+            "lock", site->pszName, "site", strSite.c_str());
+        MetricsCounter("zcash.lock.hold.microseconds", current.nHoldMicros - exported.nHoldMicros,
+            "lock", site->pszName, "site", strSite.c_str());
+        exported = current;
+    }
+}
+
+std::map<std::string, size_t> GetMemoryUsage()
+{
+    std::map<std::string, size_t> usage;
+    {
+        LOCK(cs_main);
+        if (pcoinsTip) {
+            usage["coins_cache"] = pcoinsTip->DynamicMemoryUsage();
+        }
+        if (pcoinsSnapshot) {
+            usage["coins_cache"] += pcoinsSnapshot->DynamicMemoryUsage();
+        }
+        usage["block_index"] = BlockIndexDynamicMemoryUsage();
+#ifdef ENABLE_WALLET
+        if (pwalletMain) {
+            LOCK(pwalletMain->cs_wallet);
+            pwalletMain->GetMemoryUsage(
+                usage["wallet_transactions"], usage["wallet_witnesses"], usage["wallet_notes"]);
+        }
+#endif
+    }
+    {
+        // The address and spent indexes are reported apart from the entries.
+        LOCK(mempool.cs);
+        usage["mempool_indexes"] = mempool.InsightMemoryUsage();
+        usage["mempool"] = mempool.DynamicMemoryUsage() - usage["mempool_indexes"];
+    }
+    usage["sigcache"] = SignatureCacheMemoryUsage();
+    usage["addrman"] = addrman.DynamicMemoryUsage();
+    {
+        size_t nPeerBuffers = 0;
+        size_t nPeerFilters = 0;
+        LOCK(cs_vNodes);
+        for (CNode* pnode : vNodes) {
+            {
+                LOCK(pnode->cs_vSend);
+                nPeerBuffers += pnode->nSendSize;
+            }
+            nPeerBuffers += pnode->nProcessQueueSize;
+            nPeerFilters += pnode->addrKnown.DynamicMemoryUsage() +
+                            pnode->filterInventoryKnown.DynamicMemoryUsage();
+        }
+        usage["peer_buffers"] = nPeerBuffers;
+        usage["peer_filters"] = nPeerFilters;
+    }
+    usage["zk_params"] = librustzcash_sapling_proving_params_loaded() ? nZkParamsSize.load() : 0;
+    return usage;
+}
+
+void ExportMemoryMetrics()
+{
+    for (const auto& item : GetMemoryUsage()) {
+        MetricsGauge("zcash.memory.usage.bytes", (double)item.second, "structure", item.first.c_str());
+    }
+}
+
+void ExportLogMetrics()
+{
+    static uint64_t nExported = 0;
+    if (!pTracingHandle) {
+        return;
+    }
+    uint64_t nDropped = tracing_dropped_lines(pTracingHandle);
+    if (nDropped > nExported) {
+        MetricsCounter("zcashd.debug_log.dropped_lines", nDropped - nExported, "reason", "overflow");
+        nExported = nDropped;
+    }
+}
+
+void ExportSchedulerMetrics(const CScheduler* scheduler)
+{
+    static CScheduler::Stats exported[CScheduler::PRIORITY_COUNT];
+    for (int i = 0; i < CScheduler::PRIORITY_COUNT; i++) {
+        CScheduler::Priority priority = (CScheduler::Priority)i;
+        CScheduler::Stats current = scheduler->getStats(priority);
+        if (current.nTasks == exported[i].nTasks) {
+            continue;
+        }
+        const char* name = CScheduler::PriorityName(priority);
+        MetricsCounter("zcashd.scheduler.tasks.total", current.nTasks - exported[i].nTasks,
+            "priority", name);
+        MetricsCounter("zcashd.scheduler.latency.microseconds", current.nLatencyMicros - exported[i].nLatencyMicros,
+            "priority", name);
+        MetricsCounter("zcashd.scheduler.run.microseconds", current.nRunMicros - exported[i].nRunMicros,
+            "priority", name);
+        MetricsCounter("zcashd.scheduler.overruns.total", current.nOverruns - exported[i].nOverruns,
+            "priority", name);
+        exported[i] = current;
+    }
+}
+
+//! Lengths in seconds of the rolling windows of the chain sync throughput
+static const int64_t SYNC_RATE_WINDOWS[] = {60, 600, 3600};
+//! The window over which the time left is estimated
+static const int64_t SYNC_ETA_WINDOW = 600;
+
+struct SyncSample {
+    int64_t nTimeMillis;
+    int nHeight;
+    int nHeadersHeight;
+    bool fInitialBlockDownload;
+    uint64_t nChainTx;
+    uint64_t nShieldedOutputs;
+    uint64_t nBytesReceived;
+    uint64_t nCacheHits;
+    uint64_t nCacheMisses;
+    uint64_t nFlushes;
+    double fWorkBefore;
+    double fWorkAfter;
+};
+
+static CCriticalSection cs_syncSamples;
+//! Samples covering the longest window, oldest first
+static std::deque<SyncSample> syncSamples;
+
+//! Counters can go down across a reorg or a reload of the chain state.
+static double SyncDelta(uint64_t nCurrent, uint64_t nPrevious)
+{
+    return nCurrent > nPrevious ? double(nCurrent - nPrevious) : 0.0;
+}
+
+//! The oldest sample within nWindow seconds of the latest one.
+static const SyncSample& SyncWindowStart(int64_t nWindow)
+{
+    AssertLockHeld(cs_syncSamples);
+    int64_t nStart = syncSamples.back().nTimeMillis - nWindow * 1000;
+    for (const SyncSample& sample : syncSamples) {
+        if (sample.nTimeMillis >= nStart) {
+            return sample;
+        }
+    }
+    return syncSamples.back();
+}
+
+SyncProgress GetSyncProgress()
+{
+    LOCK(cs_syncSamples);
+    SyncProgress progress = {};
+    if (syncSamples.empty()) {
+        progress.nHeight = -1;
+        progress.nHeadersHeight = -1;
+        return progress;
+    }
+    const SyncSample& latest = syncSamples.back();
+    progress.nHeight = latest.nHeight;
+    progress.nHeadersHeight = latest.nHeadersHeight;
+    if (latest.fWorkBefore + latest.fWorkAfter > 0) {
+        progress.fVerificationProgress = std::min(latest.fWorkBefore / (latest.fWorkBefore + latest.fWorkAfter), 1.0);
+    }
+
+    for (int64_t nWindow : SYNC_RATE_WINDOWS) {
+        const SyncSample& start = SyncWindowStart(nWindow);
+        SyncRates rates = {};
+        rates.nWindow = nWindow;
+        rates.nElapsed = (latest.nTimeMillis - start.nTimeMillis) / 1000;
+        double fElapsed = (latest.nTimeMillis - start.nTimeMillis) / 1000.0;
+        if (fElapsed > 0) {
+            rates.fBlocksPerSecond = std::max(latest.nHeight - start.nHeight, 0) / fElapsed;
+            rates.fTransactionsPerSecond = SyncDelta(latest.nChainTx, start.nChainTx) / fElapsed;
+            rates.fShieldedOutputsPerSecond = SyncDelta(latest.nShieldedOutputs, start.nShieldedOutputs) / fElapsed;
+            rates.fBytesReceivedPerSecond = SyncDelta(latest.nBytesReceived, start.nBytesReceived) / fElapsed;
+        }
+        double fHits = SyncDelta(latest.nCacheHits, start.nCacheHits);
+        double fMisses = SyncDelta(latest.nCacheMisses, start.nCacheMisses);
+        if (fHits + fMisses > 0) {
+            rates.fCacheHitRate = fHits / (fHits + fMisses);
+        }
+        rates.nFlushes = SyncDelta(latest.nFlushes, start.nFlushes);
+        progress.rates.push_back(rates);
+    }
+
+    if (!latest.fInitialBlockDownload) {
+        progress.nSecondsLeft = 0;
+    } else {
+        const SyncSample& start = SyncWindowStart(SYNC_ETA_WINDOW);
+        double fElapsed = (latest.nTimeMillis - start.nTimeMillis) / 1000.0;
+        double fWorkDone = latest.fWorkBefore - start.fWorkBefore;
+        if (fElapsed > 0 && fWorkDone > 0) {
+            progress.nSecondsLeft = int64_t(latest.fWorkAfter * fElapsed / fWorkDone);
+        }
+    }
+    return progress;
+}
+
+void SampleSyncProgress()
+{
+    SyncSample sample;
+    {
+        LOCK(cs_main);
+        if (pcoinsTip == nullptr) {
+            return;
+        }
+        CBlockIndex* pindex = chainActive.Tip();
+        sample.nHeight = chainActive.Height();
+        sample.nHeadersHeight = pindexBestHeader ? pindexBestHeader->nHeight : -1;
+        sample.fInitialBlockDownload = IsInitialBlockDownload(Params().GetConsensus());
+        sample.nChainTx = pindex ? pindex->nChainTx : 0;
+        sample.nCacheHits = pcoinsTip->GetCacheHits();
+        sample.nCacheMisses = pcoinsTip->GetCacheMisses();
+        Checkpoints::GuessVerificationWork(Params().Checkpoints(), pindex, sample.fWorkBefore, sample.fWorkAfter);
+    }
+    sample.nTimeMillis = GetTimeMillis();
+    sample.nShieldedOutputs = nShieldedOutputsConnected.load();
+    sample.nBytesReceived = CNode::GetTotalBytesRecv();
+    sample.nFlushes = nCoinsCacheFlushes.load();
+
+    {
+        LOCK(cs_syncSamples);
+        syncSamples.push_back(sample);
+        // Keep the newest sample that is at least as old as the longest window.
+        int64_t nOldest = sample.nTimeMillis - SYNC_RATE_WINDOWS[std::size(SYNC_RATE_WINDOWS) - 1] * 1000;
+        while (syncSamples.size() > 1 && syncSamples[1].nTimeMillis <= nOldest) {
+            syncSamples.pop_front();
+        }
+    }
+
+    SyncProgress progress = GetSyncProgress();
+    MetricsGauge("zcash.sync.verification.progress", progress.fVerificationProgress);
+    if (progress.nSecondsLeft) {
+        MetricsGauge("zcash.sync.eta.seconds", (double)progress.nSecondsLeft.value());
+    }
+    for (const SyncRates& rates : progress.rates) {
+        std::string strWindow = strprintf("%ds", rates.nWindow);
+        MetricsGauge("zcash.sync.blocks.per_second", rates.fBlocksPerSecond, "window", strWindow.c_str());
+        MetricsGauge("zcash.sync.transactions.per_second", rates.fTransactionsPerSecond, "window", strWindow.c_str());
+        MetricsGauge("zcash.sync.shielded_outputs.per_second", rates.fShieldedOutputsPerSecond, "window", strWindow.c_str());
+        MetricsGauge("zcash.sync.received.bytes.per_second", rates.fBytesReceivedPerSecond, "window", strWindow.c_str());
+        if (rates.fCacheHitRate) {
+            MetricsGauge("zcash.sync.coins_cache.hit_ratio", rates.fCacheHitRate.value(), "window", strWindow.c_str());
+        }
+        MetricsGauge("zcash.sync.coins_cache.flushes", (double)rates.nFlushes, "window", strWindow.c_str());
+    }
+}
+
 void TrackMinedBlock(uint256 hash)
 {
     LOCK(cs_metrics);
@@ -353,6 +643,15 @@ int printStats(MetricsStats stats, bool isScreen, bool mining)
                 << stats.height << " (" << nHeaders << " " << _("headers") << ") / ~" << netheight
                 << " (" << downloadPercent << "%)" << std::endl;
 
+            // Show the block rate over the ten minute window, as for the time left.
+            SyncProgress progress = GetSyncProgress();
+            if (progress.nSecondsLeft && progress.rates.size() > 1) {
+                std::cout << "              " << _("Time left") << " | ~"
+                    << DisplayDuration(progress.nSecondsLeft.value(), DurationFormat::REDUCED)
+                    << strprintf(" (%.1f %s)", progress.rates[1].fBlocksPerSecond, _("blocks/s")) << std::endl;
+                lines++;
+            }
+
             if (isScreen) {
                 // Draw 50-character progress bar, which will fit into a 79-character line.
                 int blockChars = downloadPercent / 2;
@@ -9,9 +9,13 @@
 #include "consensus/params.h"
 
 #include <atomic>
+#include <map>
 #include <mutex>
 #include <optional>
 #include <string>
+#include <vector>
+
+class CScheduler;
 
 struct AtomicCounter {
     std::atomic<uint64_t> value;
@@ -70,6 +74,9 @@ extern AtomicCounter solutionTargetChecks;
 extern AtomicTimer miningTimer;
 extern std::atomic<size_t> nSizeReindexed; // valid only during reindex
 extern std::atomic<size_t> nFullSizeToReindex; // valid only during reindex
+extern std::atomic<uint64_t> nShieldedOutputsConnected;
+extern std::atomic<uint64_t> nCoinsCacheFlushes;
+extern std::atomic<size_t> nZkParamsSize; // size of the Sapling proving parameter files
 
 void TrackMinedBlock(uint256 hash);
 
@@ -86,6 +93,91 @@ void TriggerRefresh();
 void ConnectMetricsScreen();
 void ThreadShowMetricsScreen();
 
+//! Seconds between exports of the lock profiling counters to Prometheus
+static const int64_t LOCK_METRICS_INTERVAL = 10;
+
+/**
+ * Export the lock profiling counters of each lock site (see CLockSite) that
+ * changed since the last call. Must only be called from one thread.
+ */
+void ExportLockMetrics();
+
+//! Seconds between exports of the memory usage to Prometheus
+static const int64_t MEMORY_METRICS_INTERVAL = 60;
+
+/**
+ * The memory used by each of the node's major data structures, in bytes,
+ * keyed by name. The sizes are estimated from the sizes of their elements
+ * and allocations, so they are less than the memory that the process uses.
+ */
+std::map<std::string, size_t> GetMemoryUsage();
+
+/** Export GetMemoryUsage to Prometheus. */
+void ExportMemoryMetrics();
+
+//! Seconds between exports of the number of dropped debug log lines
+static const int64_t LOG_METRICS_INTERVAL = 10;
+
+/**
+ * Export the number of debug log lines that were dropped because the queue
+ * of the log file was full. The lines dropped by -lograte are counted when
+ * they are dropped. Must only be called from one thread.
+ */
+void ExportLogMetrics();
+
+//! Seconds between exports of the scheduler task counters
+static const int64_t SCHEDULER_METRICS_INTERVAL = 10;
+
+/**
+ * Export the number of tasks that the scheduler ran for each priority since
+ * the last call, how late they started, for how long they ran, and how many
+ * of them started more than SCHEDULER_OVERRUN_MICROS late. Must only be
+ * called from one thread.
+ */
+void ExportSchedulerMetrics(const CScheduler* scheduler);
+
+//! Seconds between samples of the chain sync progress
+static const int64_t SYNC_METRICS_INTERVAL = 10;
+
+/** The throughput of the chain sync over a rolling window. */
+struct SyncRates {
+    //! Length of the window, in seconds
+    int64_t nWindow;
+    //! Seconds covered by the samples, which is less than nWindow after startup
+    int64_t nElapsed;
+    double fBlocksPerSecond;
+    double fTransactionsPerSecond;
+    double fShieldedOutputsPerSecond;
+    double fBytesReceivedPerSecond;
+    //! Fraction of the coin lookups served by the coins cache, if there were any
+    std::optional<double> fCacheHitRate;
+    uint64_t nFlushes;
+};
+
+struct SyncProgress {
+    int nHeight;
+    int nHeadersHeight;
+    double fVerificationProgress;
+    std::vector<SyncRates> rates;
+    //! Estimated seconds until the initial block download is done, if known
+    std::optional<int64_t> nSecondsLeft;
+};
+
+/**
+ * Sample the totals of the chain sync (blocks, transactions, shielded outputs,
+ * bytes received, coins cache lookups and flushes), and export its throughput
+ * over each rolling window to Prometheus. Must only be called from one thread.
+ */
+void SampleSyncProgress();
+
+/**
+ * The chain sync progress as of the last sample. The time left is estimated
+ * from the verification work left (see Checkpoints::GuessVerificationWork),
+ * which weighs each height by its transactions, and the rate at which that
+ * work was done over the ten minute window.
+ */
+SyncProgress GetSyncProgress();
+
 /**
  * Heart image: https://commons.wikimedia.org/wiki/File:Heart_coraz%C3%B3n.svg
  * License: CC BY-SA 3.0
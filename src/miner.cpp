@@ -5,7 +5,7 @@
 
 #include "miner.h"
 #ifdef ENABLE_MINING
-#include "pow/tromp/equi_miner.h"
+#include "pow/tromp/solver.h"
 #endif
 
 #include "amount.h"
@@ -38,10 +38,14 @@
 
 #include <boost/thread.hpp>
 #include <boost/tuple/tuple.hpp>
+#include <algorithm>
+#include <deque>
 #ifdef ENABLE_MINING
 #include <functional>
 #endif
+#include <map>
 #include <mutex>
+#include <tuple>
 
 using namespace std;
 
@@ -50,32 +54,11 @@ using namespace std;
 // BitcoinMiner
 //
 
-//
-// Unconfirmed transactions in the memory pool often depend on other
-// transactions in the memory pool. When we select transactions from the
-// pool, we select by highest priority or fee rate, so we might consider
-// transactions that depend on transactions that aren't yet in the block.
-// The COrphan class keeps track of these 'temporary orphans' while
-// CreateBlock is figuring out which transactions to include.
-//
-class COrphan
-{
-public:
-    const CTransaction* ptx;
-    set<uint256> setDependsOn;
-    CFeeRate feeRate;
-    double dPriority;
-
-    COrphan(const CTransaction* ptxIn) : ptx(ptxIn), feeRate(0), dPriority(0)
-    {
-    }
-};
-
 uint64_t nLastBlockTx = 0;
 uint64_t nLastBlockSize = 0;
 
 // We want to sort transactions by priority and fee rate, so:
-typedef boost::tuple<double, CFeeRate, const CTransaction*> TxPriority;
+typedef boost::tuple<double, CFeeRate, const CTxMemPoolEntry*> TxPriority;
 class TxPriorityCompare
 {
     bool byFee;
@@ -245,7 +228,7 @@ public:
 
     // Create shielded output
     void operator()(const libzcash::SaplingPaymentAddress &pa) const {
-        auto ctx = librustzcash_sapling_proving_ctx_init();
+        auto ctx = SaplingProvingContextInit();
 
         auto miner_reward = SetFoundersRewardAndGetMinerValue(ctx);
         mtx.valueBalance -= miner_reward;
@@ -270,7 +253,7 @@ public:
     // Create transparent output
     void operator()(const boost::shared_ptr<CReserveScript> &coinbaseScript) const {
         // Add the FR output and fetch the miner's output value.
-        auto ctx = librustzcash_sapling_proving_ctx_init();
+        auto ctx = SaplingProvingContextInit();
 
         // Miner output will be vout[0]; Founders' Reward & funding stream outputs
         // will follow.
@@ -288,7 +271,7 @@ public:
     }
 };
 
-CMutableTransaction CreateCoinbaseTransaction(const CChainParams& chainparams, CAmount nFees, const MinerAddress& minerAddress, int nHeight)
+static CMutableTransaction BuildCoinbaseTransaction(const CChainParams& chainparams, CAmount nFees, const MinerAddress& minerAddress, int nHeight)
 {
         CMutableTransaction mtx = CreateNewContextualCMutableTransaction(chainparams.GetConsensus(), nHeight);
         mtx.vin.resize(1);
@@ -305,8 +288,152 @@ CMutableTransaction CreateCoinbaseTransaction(const CChainParams& chainparams, C
         return mtx;
 }
 
+/**
+ * Builds shielded coinbase transactions in the background, so that
+ * CreateCoinbaseTransaction does not create their Sapling output proofs
+ * while a template is being requested. Each transaction pays the block
+ * subsidy and a level of fees to a Sapling address at a height. A template
+ * whose fees are at least that level, and at most nMaxForfeit above it, uses
+ * the transaction and leaves the rest of its fees unclaimed.
+ *
+ * Each template asks for the transaction for its own height and fees, to be
+ * used by the templates that replace it, and for the empty block above it.
+ */
+class CCoinbasePrecomputer : public CValidationInterface
+{
+private:
+    typedef std::tuple<int, libzcash::SaplingPaymentAddress, CAmount> Key;
+
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    const CAmount nMaxForfeit;
+    //! Transactions below this height are not built, and are dropped once built
+    int nMinHeight = 0;
+    std::deque<Key> pending;
+    std::map<Key, CMutableTransaction> built;
+
+    void DropBelow(int nHeight)
+    {
+        nMinHeight = nHeight;
+        built.erase(built.begin(), built.lower_bound(Key(nHeight, libzcash::SaplingPaymentAddress(), 0)));
+        pending.erase(std::remove_if(pending.begin(), pending.end(),
+            [nHeight](const Key& key) { return std::get<0>(key) < nHeight; }), pending.end());
+    }
+
+protected:
+    void UpdatedBlockTip(const CBlockIndex *pindex)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        DropBelow(pindex->nHeight + 1);
+    }
+
+public:
+    explicit CCoinbasePrecomputer(CAmount nMaxForfeitIn) : nMaxForfeit(nMaxForfeitIn) {}
+
+    /** Get the transaction built for the highest level of fees that a coinbase with nFees may use. */
+    bool Get(int nHeight, const libzcash::SaplingPaymentAddress& pa, CAmount nFees, CMutableTransaction& mtx)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        auto it = built.upper_bound(Key(nHeight, pa, nFees));
+        if (it == built.begin())
+            return false;
+        --it;
+        if (std::get<0>(it->first) != nHeight || !(std::get<1>(it->first) == pa) ||
+            nFees - std::get<2>(it->first) > nMaxForfeit)
+            return false;
+        mtx = it->second;
+        return true;
+    }
+
+    /** Ask for the transaction for a height and level of fees to be built, unless it has been. */
+    void Request(int nHeight, const libzcash::SaplingPaymentAddress& pa, CAmount nFees)
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            Key key(nHeight, pa, nFees);
+            if (nHeight < nMinHeight || built.count(key) ||
+                std::find(pending.begin(), pending.end(), key) != pending.end())
+                return;
+            pending.push_back(key);
+            if (pending.size() > MAX_PENDING_COINBASES)
+                pending.pop_front();
+        }
+        cond.notify_all();
+    }
+
+    void ThreadBuild()
+    {
+        RenameThread("zcash-coinbase");
+        while (true) {
+            Key key;
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                while (pending.empty()) {
+                    cond.wait(lock);
+                }
+                key = pending.front();
+                pending.pop_front();
+            }
+
+            int64_t nStart = GetTimeMicros();
+            CMutableTransaction mtx;
+            try {
+                mtx = BuildCoinbaseTransaction(Params(), std::get<2>(key), std::get<1>(key), std::get<0>(key));
+            } catch (const boost::thread_interrupted&) {
+                throw;
+            } catch (...) {
+                LogPrintf("%s: failed to build the coinbase transaction for block %d\n", __func__, std::get<0>(key));
+                continue;
+            }
+            LogPrint("bench", "    - Precomputed coinbase for block %d: %.2fms\n",
+                     std::get<0>(key), (GetTimeMicros() - nStart) * 0.001);
+
+            boost::unique_lock<boost::mutex> lock(mutex);
+            if (std::get<0>(key) >= nMinHeight) {
+                built.emplace(key, std::move(mtx));
+                while (built.size() > MAX_PRECOMPUTED_COINBASES) {
+                    built.erase(built.begin());
+                }
+            }
+        }
+    }
+
+    //! Requests beyond this many replace the oldest ones
+    static const size_t MAX_PENDING_COINBASES = 4;
+    //! Built transactions beyond this many are dropped, lowest heights first
+    static const size_t MAX_PRECOMPUTED_COINBASES = 8;
+};
+
+static CCoinbasePrecomputer* pCoinbasePrecomputer = nullptr;
+
+void StartCoinbasePrecomputer(boost::thread_group& threadGroup, CAmount nMaxForfeit)
+{
+    assert(pCoinbasePrecomputer == nullptr);
+    pCoinbasePrecomputer = new CCoinbasePrecomputer(nMaxForfeit);
+    RegisterValidationInterface(pCoinbasePrecomputer);
+    threadGroup.create_thread(boost::bind(&CCoinbasePrecomputer::ThreadBuild, pCoinbasePrecomputer));
+}
+
+CMutableTransaction CreateCoinbaseTransaction(const CChainParams& chainparams, CAmount nFees, const MinerAddress& minerAddress, int nHeight)
+{
+    const libzcash::SaplingPaymentAddress* pa = std::get_if<libzcash::SaplingPaymentAddress>(&minerAddress);
+    if (pa && pCoinbasePrecomputer) {
+        CMutableTransaction mtx;
+        bool fPrecomputed = pCoinbasePrecomputer->Get(nHeight, *pa, nFees, mtx);
+        pCoinbasePrecomputer->Request(nHeight, *pa, nFees);
+        pCoinbasePrecomputer->Request(nHeight + 1, *pa, 0);
+        if (fPrecomputed) {
+            return mtx;
+        }
+    }
+    return BuildCoinbaseTransaction(chainparams, nFees, minerAddress, nHeight);
+}
+
 CBlockTemplate* CreateNewBlock(const CChainParams& chainparams, const MinerAddress& minerAddress, const std::optional<CMutableTransaction>& next_cb_mtx)
 {
+    auto span = TracingSpan("info", "main", "CreateNewBlock");
+    auto spanGuard = span.Enter();
+
     // Create new block
     std::unique_ptr<CBlockTemplate> pblocktemplate(new CBlockTemplate());
     if(!pblocktemplate.get())
@@ -353,105 +480,15 @@ CBlockTemplate* CreateNewBlock(const CChainParams& chainparams, const MinerAddre
         SaplingMerkleTree sapling_tree;
         assert(view.GetSaplingAnchorAt(view.GetBestAnchor(SAPLING), sapling_tree));
 
-        // Priority order to process transactions
-        list<COrphan> vOrphan; // list memory doesn't move
-        map<uint256, vector<COrphan*> > mapDependers;
         bool fPrintPriority = GetBoolArg("-printpriority", DEFAULT_PRINTPRIORITY);
-
-        // This vector will be sorted into a priority queue:
-        vector<TxPriority> vecPriority;
-        vecPriority.reserve(mempool.mapTx.size());
-
-        // If we're given a coinbase tx, it's been precomputed, its fees are zero,
-        // so we can't include any mempool transactions; this will be an empty block.
-        if (!next_cb_mtx) {
-            for (CTxMemPool::indexed_transaction_set::iterator mi = mempool.mapTx.begin();
-                mi != mempool.mapTx.end(); ++mi)
-            {
-                const CTransaction& tx = mi->GetTx();
-
-                int64_t nLockTimeCutoff = (STANDARD_LOCKTIME_VERIFY_FLAGS & LOCKTIME_MEDIAN_TIME_PAST)
-                                        ? nMedianTimePast
-                                        : pblock->GetBlockTime();
-
-                if (tx.IsCoinBase() || !IsFinalTx(tx, nHeight, nLockTimeCutoff) || IsExpiredTx(tx, nHeight))
-                    continue;
-
-                COrphan* porphan = NULL;
-                double dPriority = 0;
-                CAmount nTotalIn = 0;
-                bool fMissingInputs = false;
-                for (const CTxIn& txin : tx.vin)
-                {
-                    // Read prev transaction
-                    if (!view.HaveCoins(txin.prevout.hash))
-                    {
-                        // This should never happen; all transactions in the memory
-                        // pool should connect to either transactions in the chain
-                        // or other transactions in the memory pool.
-                        if (!mempool.mapTx.count(txin.prevout.hash))
-                        {
-                            LogPrintf("ERROR: mempool transaction missing input\n");
-                            if (fDebug) assert("mempool transaction missing input" == 0);
-                            fMissingInputs = true;
-                            if (porphan)
-                                vOrphan.pop_back();
-                            break;
-                        }
-
-                        // Has to wait for dependencies
-                        if (!porphan)
-                        {
-                            // Use list for automatic deletion
-                            vOrphan.push_back(COrphan(&tx));
-                            porphan = &vOrphan.back();
-                        }
-                        mapDependers[txin.prevout.hash].push_back(porphan);
-                        porphan->setDependsOn.insert(txin.prevout.hash);
-                        nTotalIn += mempool.mapTx.find(txin.prevout.hash)->GetTx().vout[txin.prevout.n].nValue;
-                        continue;
-                    }
-                    const CCoins* coins = view.AccessCoins(txin.prevout.hash);
-                    assert(coins);
-
-                    CAmount nValueIn = coins->vout[txin.prevout.n].nValue;
-                    nTotalIn += nValueIn;
-
-                    int nConf = nHeight - coins->nHeight;
-
-                    dPriority += (double)nValueIn * nConf;
-                }
-                nTotalIn += tx.GetShieldedValueIn();
-
-                if (fMissingInputs) continue;
-
-                // Priority is sum(valuein * age) / modified_txsize
-                unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-                dPriority = tx.ComputePriority(dPriority, nTxSize);
-
-                uint256 hash = tx.GetHash();
-                mempool.ApplyDeltas(hash, dPriority, nTotalIn);
-
-                CFeeRate feeRate(nTotalIn-tx.GetValueOut(), nTxSize);
-
-                if (porphan)
-                {
-                    porphan->dPriority = dPriority;
-                    porphan->feeRate = feeRate;
-                }
-                else
-                    vecPriority.push_back(TxPriority(dPriority, feeRate, &(mi->GetTx())));
-            }
-        }
+        int64_t nLockTimeCutoff = (STANDARD_LOCKTIME_VERIFY_FLAGS & LOCKTIME_MEDIAN_TIME_PAST)
+                                ? nMedianTimePast
+                                : pblock->GetBlockTime();
 
         // Collect transactions into block
         uint64_t nBlockSize = 1000;
         uint64_t nBlockTx = 0;
         int nBlockSigOps = 100;
-        bool fSortedByFee = (nBlockPrioritySize <= 0);
-
-        TxPriorityCompare comparer(fSortedByFee);
-        std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
 
         // We want to track the value pool, but if the miner gets
         // invoked on an old block before the hardcoded fallback
@@ -475,52 +512,60 @@ CBlockTemplate* CreateNewBlock(const CChainParams& chainparams, const MinerAddre
             }
         }
 
-        while (!vecPriority.empty())
-        {
-            // Take highest priority transaction off the priority queue:
-            double dPriority = vecPriority.front().get<0>();
-            CFeeRate feeRate = vecPriority.front().get<1>();
-            const CTransaction& tx = *(vecPriority.front().get<2>());
+        // The mempool entries cache the fees, sizes and priorities of the
+        // transactions, and its mining_score index keeps them sorted by fee
+        // rate as they enter and leave the pool, so only the transactions
+        // that are considered for the block have their inputs looked up.
+        std::set<uint256> setInBlock;
+
+        // A transaction can only be added after its parents in the mempool.
+        auto fParentsInBlock = [&](const CTransaction& tx) {
+            for (const CTxIn& txin : tx.vin) {
+                if (!setInBlock.count(txin.prevout.hash) && mempool.mapTx.count(txin.prevout.hash))
+                    return false;
+            }
+            return true;
+        };
 
-            std::pop_heap(vecPriority.begin(), vecPriority.end(), comparer);
-            vecPriority.pop_back();
+        // Release the transactions of mapWaiting that spend outputs of the
+        // transaction that was just added, once all of their parents are in.
+        auto ReleaseChildren = [&](const CTransaction& tx, auto& mapWaiting, auto fRelease) {
+            const uint256& hash = tx.GetHash();
+            for (uint32_t i = 0; i < tx.vout.size(); i++) {
+                auto it = mempool.mapNextTx.find(COutPoint(hash, i));
+                if (it == mempool.mapNextTx.end())
+                    continue;
+                auto wit = mapWaiting.find(it->second.ptx->GetHash());
+                if (wit != mapWaiting.end() && fParentsInBlock(*it->second.ptx)) {
+                    fRelease(wit->second);
+                    mapWaiting.erase(wit);
+                }
+            }
+        };
+
+        auto TryAddToBlock = [&](const CTxMemPoolEntry& entry, double dPriority) {
+            const CTransaction& tx = entry.GetTx();
+            if (tx.IsCoinBase() || !IsFinalTx(tx, nHeight, nLockTimeCutoff) || IsExpiredTx(tx, nHeight))
+                return false;
 
             // Size limits
-            unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
+            unsigned int nTxSize = entry.GetTxSize();
             if (nBlockSize + nTxSize >= nBlockMaxSize)
-                continue;
+                return false;
 
             // Legacy limits on sigOps:
             unsigned int nTxSigOps = GetLegacySigOpCount(tx);
             if (nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
-                continue;
-
-            // Skip free transactions if we're past the minimum block size:
-            const uint256& hash = tx.GetHash();
-            double dPriorityDelta = 0;
-            CAmount nFeeDelta = 0;
-            mempool.ApplyDeltas(hash, dPriorityDelta, nFeeDelta);
-            if (fSortedByFee && (dPriorityDelta <= 0) && (nFeeDelta <= 0) && (feeRate < ::minRelayTxFee) && (nBlockSize + nTxSize >= nBlockMinSize))
-                continue;
-
-            // Prioritise by fee once past the priority size or we run out of high-priority
-            // transactions:
-            if (!fSortedByFee &&
-                ((nBlockSize + nTxSize >= nBlockPrioritySize) || !AllowFree(dPriority)))
-            {
-                fSortedByFee = true;
-                comparer = TxPriorityCompare(fSortedByFee);
-                std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
-            }
+                return false;
 
             if (!view.HaveInputs(tx))
-                continue;
+                return false;
 
             CAmount nTxFees = view.GetValueIn(tx)-tx.GetValueOut();
 
             nTxSigOps += GetP2SHSigOpCount(tx, view);
             if (nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
-                continue;
+                return false;
 
             // Note that flags: we don't want to set mempool/IsStandard()
             // policy here, but we still have to ensure that the block we
@@ -528,7 +573,7 @@ CBlockTemplate* CreateNewBlock(const CChainParams& chainparams, const MinerAddre
             CValidationState state;
             PrecomputedTransactionData txdata(tx);
             if (!ContextualCheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true, txdata, chainparams.GetConsensus(), consensusBranchId))
-                continue;
+                return false;
 
             if (chainparams.ZIP209Enabled() && monitoring_pool_balances) {
                 // Does this transaction lead to a turnstile violation?
@@ -545,11 +590,11 @@ CBlockTemplate* CreateNewBlock(const CChainParams& chainparams, const MinerAddre
 
                 if (sproutValueDummy < 0) {
                     LogPrintf("CreateNewBlock(): tx %s appears to violate Sprout turnstile\n", tx.GetHash().ToString());
-                    continue;
+                    return false;
                 }
                 if (saplingValueDummy < 0) {
                     LogPrintf("CreateNewBlock(): tx %s appears to violate Sapling turnstile\n", tx.GetHash().ToString());
-                    continue;
+                    return false;
                 }
 
                 sproutValue = sproutValueDummy;
@@ -566,29 +611,117 @@ CBlockTemplate* CreateNewBlock(const CChainParams& chainparams, const MinerAddre
             ++nBlockTx;
             nBlockSigOps += nTxSigOps;
             nFees += nTxFees;
+            setInBlock.insert(tx.GetHash());
 
             if (fPrintPriority)
             {
                 LogPrintf("priority %.1f fee %s txid %s\n",
-                    dPriority, feeRate.ToString(), tx.GetHash().ToString());
+                    dPriority, CFeeRate(entry.GetModifiedFee(), nTxSize).ToString(), tx.GetHash().ToString());
             }
+            return true;
+        };
 
-            // Add transactions that depend on this one to the priority queue
-            if (mapDependers.count(hash))
-            {
-                for (COrphan* porphan : mapDependers[hash])
+        // If we're given a coinbase tx, it's been precomputed, its fees are zero,
+        // so we can't include any mempool transactions; this will be an empty block.
+        if (!next_cb_mtx) {
+            // First fill the part of the block dedicated to high-priority
+            // transactions. Priorities grow with the height at different
+            // rates, so they are sorted here, but using the cached values.
+            if (nBlockPrioritySize > 0) {
+                vector<TxPriority> vecPriority;
+                vecPriority.reserve(mempool.mapTx.size());
+                for (const CTxMemPoolEntry& entry : mempool.mapTx) {
+                    double dPriority = entry.GetPriority(nHeight);
+                    CAmount dummy = 0;
+                    mempool.ApplyDeltas(entry.GetTx().GetHash(), dPriority, dummy);
+                    vecPriority.push_back(TxPriority(dPriority, CFeeRate(entry.GetModifiedFee(), entry.GetTxSize()), &entry));
+                }
+
+                TxPriorityCompare comparer(false);
+                std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
+
+                std::map<uint256, TxPriority> mapWaitPriority;
+                while (!vecPriority.empty())
                 {
-                    if (!porphan->setDependsOn.empty())
-                    {
-                        porphan->setDependsOn.erase(hash);
-                        if (porphan->setDependsOn.empty())
-                        {
-                            vecPriority.push_back(TxPriority(porphan->dPriority, porphan->feeRate, porphan->ptx));
+                    // Take highest priority transaction off the priority queue:
+                    TxPriority txPriority = vecPriority.front();
+                    std::pop_heap(vecPriority.begin(), vecPriority.end(), comparer);
+                    vecPriority.pop_back();
+
+                    double dPriority = txPriority.get<0>();
+                    const CTxMemPoolEntry& entry = *txPriority.get<2>();
+                    const uint256& hash = entry.GetTx().GetHash();
+
+                    // Prioritise by fee once past the priority size or we run out of high-priority
+                    // transactions:
+                    if ((nBlockSize + entry.GetTxSize() >= nBlockPrioritySize) || !AllowFree(dPriority))
+                        break;
+
+                    if (!fParentsInBlock(entry.GetTx())) {
+                        mapWaitPriority.insert(std::make_pair(hash, txPriority));
+                        continue;
+                    }
+
+                    if (TryAddToBlock(entry, dPriority)) {
+                        ReleaseChildren(entry.GetTx(), mapWaitPriority, [&](const TxPriority& child) {
+                            vecPriority.push_back(child);
                             std::push_heap(vecPriority.begin(), vecPriority.end(), comparer);
-                        }
+                        });
                     }
                 }
             }
+
+            // Then fill the rest of the block in order of fee rate. A
+            // transaction that pays a higher fee rate than one of its parents
+            // is considered as soon as the last of them has been added.
+            std::map<uint256, const CTxMemPoolEntry*> mapWaitFee;
+            std::vector<const CTxMemPoolEntry*> vCleared;
+            int nConsecutiveFailed = 0;
+            auto mi = mempool.mapTx.get<mining_score>().begin();
+            while (mi != mempool.mapTx.get<mining_score>().end() || !vCleared.empty())
+            {
+                const CTxMemPoolEntry* pentry;
+                bool fFromIndex = vCleared.empty();
+                if (fFromIndex) {
+                    pentry = &*mi++;
+                } else {
+                    pentry = vCleared.back();
+                    vCleared.pop_back();
+                }
+                const uint256& hash = pentry->GetTx().GetHash();
+                if (setInBlock.count(hash))
+                    continue;
+
+                // Skip free transactions if we're past the minimum block size:
+                CFeeRate feeRate(pentry->GetModifiedFee(), pentry->GetTxSize());
+                if (feeRate < ::minRelayTxFee && (nBlockSize + pentry->GetTxSize() >= nBlockMinSize)) {
+                    // Without prioritised transactions, the rest of the index
+                    // pays even less.
+                    if (fFromIndex && mempool.mapDeltas.empty())
+                        break;
+                    double dPriorityDelta = 0;
+                    CAmount nFeeDelta = 0;
+                    mempool.ApplyDeltas(hash, dPriorityDelta, nFeeDelta);
+                    if ((dPriorityDelta <= 0) && (nFeeDelta <= 0))
+                        continue;
+                }
+
+                if (!fParentsInBlock(pentry->GetTx())) {
+                    mapWaitFee.insert(std::make_pair(hash, pentry));
+                    continue;
+                }
+
+                if (TryAddToBlock(*pentry, pentry->GetPriority(nHeight))) {
+                    nConsecutiveFailed = 0;
+                    ReleaseChildren(pentry->GetTx(), mapWaitFee, [&](const CTxMemPoolEntry* pchild) {
+                        vCleared.push_back(pchild);
+                    });
+                } else if (nBlockSize > nBlockMaxSize - 1000 && ++nConsecutiveFailed > 50) {
+                    // The block is almost full, and the remaining transactions
+                    // are unlikely to fit.
+                    break;
+                }
+            }
         }
 
         nLastBlockTx = nBlockTx;
@@ -641,6 +774,154 @@ CBlockTemplate* CreateNewBlock(const CChainParams& chainparams, const MinerAddre
     return pblocktemplate.release();
 }
 
+//////////////////////////////////////////////////////////////////////////////
+//
+// Template prebuilding
+//
+
+/**
+ * Builds the template for the next block on a background thread as soon as
+ * the tip changes, so that getblocktemplate does not have to wait for
+ * CreateNewBlock after a new block. Nothing is built until getblocktemplate
+ * has been called, and templates pay to the address of its latest call.
+ */
+class CTemplatePrebuilder : public CValidationInterface
+{
+private:
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    bool fStopped = false;
+    std::optional<MinerAddress> minerAddress;
+    //! Tip that a template is to be built on next, or NULL
+    const CBlockIndex* pindexPending = nullptr;
+    //! Tip that a template is being built on, or NULL
+    const CBlockIndex* pindexBuilding = nullptr;
+
+    //! The last template built, if it has not been taken yet
+    std::unique_ptr<CBlockTemplate> pblocktemplate;
+    const CBlockIndex* pindexTemplate = nullptr;
+    MinerAddress templateAddress;
+    unsigned int nTemplateTransactionsUpdated = 0;
+
+protected:
+    void UpdatedBlockTip(const CBlockIndex *pindex)
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            if (!minerAddress)
+                return;
+            pindexPending = pindex;
+        }
+        cond.notify_all();
+    }
+
+public:
+    void ThreadBuild();
+    CBlockTemplate* Take(const CBlockIndex* pindexPrev, const MinerAddress& requestAddress,
+                         MinerAddress& templateAddressOut, unsigned int& nTransactionsUpdatedOut);
+};
+
+void CTemplatePrebuilder::ThreadBuild()
+{
+    RenameThread("zcash-template");
+    try {
+        while (true) {
+            const CBlockIndex* pindexPrev;
+            MinerAddress address;
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                while (pindexPending == nullptr) {
+                    cond.wait(lock);
+                }
+                pindexPrev = pindexBuilding = pindexPending;
+                pindexPending = nullptr;
+                address = *minerAddress;
+            }
+
+            std::unique_ptr<CBlockTemplate> pnewtemplate;
+            unsigned int nTransactionsUpdated = 0;
+            int64_t nStart = GetTimeMicros();
+            try {
+                LOCK(cs_main);
+                // Skip tips that have been replaced already; the new tip is pending.
+                if (chainActive.Tip() == pindexPrev) {
+                    nTransactionsUpdated = mempool.GetTransactionsUpdated();
+                    pnewtemplate.reset(CreateNewBlock(Params(), address));
+                }
+            } catch (const std::runtime_error& e) {
+                LogPrintf("%s: %s\n", __func__, e.what());
+            }
+            if (pnewtemplate) {
+                LogPrint("bench", "    - Prebuilt template for block %d: %.2fms\n",
+                         pindexPrev->nHeight + 1, (GetTimeMicros() - nStart) * 0.001);
+            }
+
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                pindexBuilding = nullptr;
+                if (pnewtemplate) {
+                    pblocktemplate = std::move(pnewtemplate);
+                    pindexTemplate = pindexPrev;
+                    templateAddress = address;
+                    nTemplateTransactionsUpdated = nTransactionsUpdated;
+                }
+            }
+            cond.notify_all();
+        }
+    } catch (const boost::thread_interrupted&) {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            fStopped = true;
+        }
+        cond.notify_all();
+        throw;
+    }
+}
+
+CBlockTemplate* CTemplatePrebuilder::Take(const CBlockIndex* pindexPrev, const MinerAddress& requestAddress,
+                                         MinerAddress& templateAddressOut, unsigned int& nTransactionsUpdatedOut)
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    minerAddress = requestAddress;
+    if (pindexTemplate != pindexPrev) {
+        // The tip may have changed before the first getblocktemplate call, or
+        // the notification may not have arrived yet; build on it either way.
+        if (pindexPending != pindexPrev && pindexBuilding != pindexPrev) {
+            pindexPending = pindexPrev;
+            cond.notify_all();
+        }
+        while (!fStopped && (pindexPending == pindexPrev || pindexBuilding == pindexPrev)) {
+            cond.wait(lock);
+        }
+    }
+    if (pindexTemplate != pindexPrev || !pblocktemplate)
+        return NULL;
+
+    templateAddressOut = templateAddress;
+    nTransactionsUpdatedOut = nTemplateTransactionsUpdated;
+    pindexTemplate = nullptr;
+    return pblocktemplate.release();
+}
+
+static CTemplatePrebuilder* pTemplatePrebuilder = nullptr;
+
+void StartTemplatePrebuilder(boost::thread_group& threadGroup)
+{
+    assert(pTemplatePrebuilder == nullptr);
+    pTemplatePrebuilder = new CTemplatePrebuilder();
+    RegisterValidationInterface(pTemplatePrebuilder);
+    threadGroup.create_thread(boost::bind(&CTemplatePrebuilder::ThreadBuild, pTemplatePrebuilder));
+}
+
+CBlockTemplate* TakePrebuiltTemplate(const CBlockIndex* pindexPrev, const MinerAddress& minerAddress,
+                                     MinerAddress& templateAddress, unsigned int& nTransactionsUpdated)
+{
+    AssertLockNotHeld(cs_main);
+    if (pTemplatePrebuilder == nullptr)
+        return NULL;
+    return pTemplatePrebuilder->Take(pindexPrev, minerAddress, templateAddress, nTransactionsUpdated);
+}
+
 //////////////////////////////////////////////////////////////////////////////
 //
 // Internal miner
@@ -743,8 +1024,20 @@ void static BitcoinMiner(const CChainParams& chainparams)
 
     std::string solver = GetArg("-equihashsolver", "default");
     assert(solver == "tromp" || solver == "default");
+    if (solver == "tromp" && !TrompSolver::Supports(n, k)) {
+        LogPrintf("Equihash solver \"tromp\" does not support n = %u, k = %u, using \"default\"\n", n, k);
+        solver = "default";
+    }
     LogPrint("pow", "Using Equihash solver \"%s\" with n = %u, k = %u\n", solver, n, k);
 
+    // The tromp solver's tables are allocated once per mining thread and
+    // reused for every nonce.
+    std::unique_ptr<TrompSolver> trompSolver;
+    if (solver == "tromp") {
+        int nSolverThreads = std::max(1, (int)GetArg("-equihashsolverthreads", DEFAULT_EQUIHASH_SOLVER_THREADS));
+        trompSolver.reset(new TrompSolver(nSolverThreads));
+    }
+
     std::mutex m_cs;
     bool cancelSolver = false;
     boost::signals2::connection c = uiInterface.NotifyBlockTip.connect(
@@ -868,52 +1161,23 @@ void static BitcoinMiner(const CChainParams& chainparams)
                     return cancelSolver;
                 };
 
-                // TODO: factor this out into a function with the same API for each solver.
-                if (solver == "tromp") {
-                    // Create solver and initialize it.
-                    equi eq(1);
-                    eq.setstate(curr_state.inner.get());
-
-                    // Initialization done, start algo driver.
-                    eq.digit0(0);
-                    eq.xfull = eq.bfull = eq.hfull = 0;
-                    eq.showbsizes(0);
-                    for (u32 r = 1; r < WK; r++) {
-                        (r&1) ? eq.digitodd(r, 0) : eq.digiteven(r, 0);
-                        eq.xfull = eq.bfull = eq.hfull = 0;
-                        eq.showbsizes(r);
-                    }
-                    eq.digitK(0);
+                try {
+                    // If we find a valid block, we rebuild. Under
+                    // -regtestfastmode any solution of the right size is
+                    // accepted, so only the nonce is searched.
+                    bool found = chainparams.GetConsensus().fSkipEquihash ?
+                        validBlock(std::vector<unsigned char>(equihash_solution_size(n, k))) :
+                        trompSolver ?
+                        trompSolver->Solve(curr_state, validBlock, cancelled) :
+                        EhOptimisedSolve(n, k, curr_state, validBlock, cancelled);
                     ehSolverRuns.increment();
-
-                    // Convert solution indices to byte array (decompress) and pass it to validBlock method.
-                    for (size_t s = 0; s < eq.nsols; s++) {
-                        LogPrint("pow", "Checking solution %d\n", s+1);
-                        std::vector<eh_index> index_vector(PROOFSIZE);
-                        for (size_t i = 0; i < PROOFSIZE; i++) {
-                            index_vector[i] = eq.sols[s][i];
-                        }
-                        std::vector<unsigned char> sol_char = GetMinimalFromIndices(index_vector, DIGITBITS);
-
-                        if (validBlock(sol_char)) {
-                            // If we find a POW solution, do not try other solutions
-                            // because they become invalid as we created a new block in blockchain.
-                            break;
-                        }
-                    }
-                } else {
-                    try {
-                        // If we find a valid block, we rebuild
-                        bool found = EhOptimisedSolve(n, k, curr_state, validBlock, cancelled);
-                        ehSolverRuns.increment();
-                        if (found) {
-                            break;
-                        }
-                    } catch (EhSolverCancelledException&) {
-                        LogPrint("pow", "Equihash solver cancelled\n");
-                        std::lock_guard<std::mutex> lock{m_cs};
-                        cancelSolver = false;
+                    if (found) {
+                        break;
                     }
+                } catch (EhSolverCancelledException&) {
+                    LogPrint("pow", "Equihash solver cancelled\n");
+                    std::lock_guard<std::mutex> lock{m_cs};
+                    cancelSolver = false;
                 }
 
                 // Check for stop or if block needs to be rebuilt
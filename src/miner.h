@@ -6,6 +6,7 @@
 #ifndef BITCOIN_MINER_H
 #define BITCOIN_MINER_H
 
+#include "amount.h"
 #include "primitives/block.h"
 
 #include <stdint.h>
@@ -18,10 +19,22 @@ class CChainParams;
 class CScript;
 namespace Consensus { struct Params; };
 
+namespace boost {
+    class thread_group;
+} // namespace boost
+
 static const bool DEFAULT_GENERATE = false;
 static const int DEFAULT_GENERATE_THREADS = 1;
+/** Default for -equihashsolverthreads, the threads each "tromp" solver splits its rounds between */
+static const int DEFAULT_EQUIHASH_SOLVER_THREADS = 1;
 
 static const bool DEFAULT_PRINTPRIORITY = false;
+/** Default for -prebuildtemplates, building the next block template in the background on a new tip */
+static const bool DEFAULT_PREBUILD_TEMPLATES = true;
+/** Default for -precomputecoinbase, building shielded coinbase transactions for the next templates in the background */
+static const bool DEFAULT_PRECOMPUTE_COINBASE = true;
+/** Default for -precomputedcoinbaseforfeit, the fees that a template may leave unclaimed to use a precomputed shielded coinbase */
+static const CAmount DEFAULT_PRECOMPUTED_COINBASE_FORFEIT = 100000;
 
 class InvalidMinerAddress {
 public:
@@ -71,11 +84,38 @@ struct CBlockTemplate
     std::vector<int64_t> vTxSigOps;
 };
 
+/**
+ * Create the coinbase transaction of a block at nHeight, claiming nFees. If
+ * the miner address is a Sapling address and a transaction has been built
+ * in the background for a level of fees at most nMaxForfeit below nFees (see
+ * StartCoinbasePrecomputer), that transaction is returned instead.
+ */
 CMutableTransaction CreateCoinbaseTransaction(const CChainParams& chainparams, CAmount nFees, const MinerAddress& minerAddress, int nHeight);
 
 /** Generate a new block, without valid proof-of-work */
 CBlockTemplate* CreateNewBlock(const CChainParams& chainparams, const MinerAddress& minerAddress, const std::optional<CMutableTransaction>& next_coinbase_mtx = std::nullopt);
 
+/** Start building the template for the next block in the background whenever the tip changes */
+void StartTemplatePrebuilder(boost::thread_group& threadGroup);
+/**
+ * Start building the shielded coinbase transactions that templates ask for
+ * in the background, so that later templates use them instead of creating
+ * their Sapling output proofs. A template may leave up to nMaxForfeit of its
+ * fees unclaimed to use one.
+ */
+void StartCoinbasePrecomputer(boost::thread_group& threadGroup, CAmount nMaxForfeit);
+/**
+ * Take the template built in the background on top of pindexPrev, waiting
+ * for it if it is still being built, and remember minerAddress for the
+ * templates of later tips. Must be called without cs_main held. Returns NULL
+ * if the prebuilder is not running or no template could be built on
+ * pindexPrev. Otherwise the caller owns the template, templateAddress is set
+ * to the address it pays to, and nTransactionsUpdated to the mempool update
+ * count at the time it was built.
+ */
+CBlockTemplate* TakePrebuiltTemplate(const CBlockIndex* pindexPrev, const MinerAddress& minerAddress,
+                                     MinerAddress& templateAddress, unsigned int& nTransactionsUpdated);
+
 #ifdef ENABLE_MINING
 /** Get -mineraddress */
 void GetMinerAddress(MinerAddress &minerAddress);
@@ -28,6 +28,8 @@
 #include <fcntl.h>
 #endif
 
+#include <cmath>
+
 #include <boost/thread.hpp>
 
 #include <rust/metrics.h>
@@ -57,9 +59,11 @@ namespace {
 //
 bool fDiscover = true;
 bool fListen = true;
+bool fTxReconciliation = DEFAULT_TXRECONCILIATION;
 uint64_t nLocalServices = NODE_NETWORK;
 CCriticalSection cs_mapLocalHost;
 map<CNetAddr, LocalServiceInfo> mapLocalHost;
+std::atomic<bool> fLocalAddressAdded(false);
 static bool vfLimited[NET_MAX] = {};
 static CNode* pnodeLocalHost = NULL;
 uint64_t nLocalHostNonce = 0;
@@ -71,7 +75,7 @@ std::string strSubVersion;
 
 vector<CNode*> vNodes;
 CCriticalSection cs_vNodes;
-map<CInv, CDataStream> mapRelay;
+map<CInv, CTransactionRef> mapRelay;
 deque<pair<int64_t, CInv> > vRelayExpiration;
 CCriticalSection cs_mapRelay;
 limitedmap<CInv, int64_t> mapAlreadyAskedFor(MAX_INV_SZ);
@@ -230,6 +234,8 @@ bool AddLocal(const CService& addr, int nScore)
             info.nScore = nScore + (fAlready ? 1 : 0);
             info.nPort = addr.GetPort();
         }
+        if (!fAlready)
+            fLocalAddressAdded = true;
     }
 
     return true;
@@ -317,6 +323,8 @@ uint64_t CNode::nMaxOutboundLimit = 0;
 uint64_t CNode::nMaxOutboundTotalBytesSentInCycle = 0;
 uint64_t CNode::nMaxOutboundTimeframe = 60*60*24; //1 day
 uint64_t CNode::nMaxOutboundCycleStartTime = 0;
+CTokenBucket CNode::historicalUploadBucketTotal;
+uint64_t CNode::nMaxPeerHistoricalUploadRate = 0;
 
 CNode* FindNode(const CNetAddr& ip)
 {
@@ -749,6 +757,18 @@ bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes)
     return true;
 }
 
+void CNode::MoveCompleteMessages()
+{
+    std::list<CNetMessage>::iterator it = vRecvMsg.begin();
+    size_t nSize = 0;
+    while (it != vRecvMsg.end() && it->complete()) {
+        nSize += it->vRecv.size() + 24;
+        ++it;
+    }
+    vProcessMsg.splice(vProcessMsg.end(), vRecvMsg, vRecvMsg.begin(), it);
+    nProcessQueueSize += nSize;
+}
+
 int CNetMessage::readHeader(const char *pch, unsigned int nBytes)
 {
     // copy data to temporary parsing buffer
@@ -807,10 +827,10 @@ int CNetMessage::readData(const char *pch, unsigned int nBytes)
 // requires LOCK(cs_vSend)
 void SocketSendData(CNode *pnode)
 {
-    std::deque<CSerializeData>::iterator it = pnode->vSendMsg.begin();
+    std::deque<CNetSerializeData>::iterator it = pnode->vSendMsg.begin();
 
     while (it != pnode->vSendMsg.end()) {
-        const CSerializeData &data = *it;
+        const CNetSerializeData &data = *it;
         assert(data.size() > pnode->nSendOffset);
         int nBytes = 0;
         {
@@ -854,6 +874,9 @@ void SocketSendData(CNode *pnode)
         assert(pnode->nSendOffset == 0);
         assert(pnode->nSendSize == 0);
     }
+    for (auto sent = pnode->vSendMsg.begin(); sent != it; ++sent) {
+        pnode->RecycleSendBuffer(*sent);
+    }
     pnode->vSendMsg.erase(pnode->vSendMsg.begin(), it);
 }
 
@@ -1081,9 +1104,247 @@ static void AcceptConnection(const ListenSocket& hListenSocket) {
     }
 }
 
+/**
+ * Whether to wait for the socket of a node to become ready to receive or to
+ * send data. Requires cs_vNodes.
+ */
+static void GetSocketEvents(CNode* pnode, bool& select_recv, bool& select_send)
+{
+    // Implement the following logic:
+    // * If there is data to send, select() for sending data. As this only
+    //   happens when optimistic write failed, we choose to first drain the
+    //   write buffer in this case before receiving more. This avoids
+    //   needlessly queueing received data, if the remote peer is not themselves
+    //   receiving data. This means properly utilizing TCP flow control signaling.
+    // * Otherwise, if there is no (complete) message in the receive buffer,
+    //   or there is space left in the buffer, select() for receiving data.
+    // * (if neither of the above applies, there is certainly one message
+    //   in the receiver buffer ready to be processed).
+    // Together, that means that at least one of the following is always possible,
+    // so we don't deadlock:
+    // * We send some data.
+    // * We wait for data to be received (and disconnect after timeout).
+    // * We process a message in the buffer (message handler thread).
+    {
+        TRY_LOCK(pnode->cs_vSend, lockSend);
+        select_send = lockSend && !pnode->vSendMsg.empty();
+    }
+
+    {
+        TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
+        select_recv = !select_send && lockRecv && (
+            (pnode->nProcessQueueSize == 0 &&
+             (pnode->vRecvMsg.empty() || !pnode->vRecvMsg.front().complete())) ||
+            pnode->GetTotalRecvSize() <= ReceiveFloodSize());
+    }
+}
+
+/** Wait up to 50ms for the listening sockets and the sockets of the nodes with select(). */
+static void SocketEventsSelect(std::set<SOCKET>& recv_set, std::set<SOCKET>& send_set, std::set<SOCKET>& error_set)
+{
+    struct timeval timeout;
+    timeout.tv_sec  = 0;
+    timeout.tv_usec = 50000; // frequency to poll pnode->vSend
+
+    fd_set fdsetRecv;
+    fd_set fdsetSend;
+    fd_set fdsetError;
+    FD_ZERO(&fdsetRecv);
+    FD_ZERO(&fdsetSend);
+    FD_ZERO(&fdsetError);
+    SOCKET hSocketMax = 0;
+    bool have_fds = false;
+    std::vector<SOCKET> vSockets;
+
+    for (const ListenSocket& hListenSocket : vhListenSocket) {
+#ifdef USE_EPOLL
+        // Only used if epoll is not available at run time.
+        if (hListenSocket.socket >= FD_SETSIZE)
+            continue;
+#endif
+        FD_SET(hListenSocket.socket, &fdsetRecv);
+        hSocketMax = max(hSocketMax, hListenSocket.socket);
+        vSockets.push_back(hListenSocket.socket);
+        have_fds = true;
+    }
+
+    {
+        LOCK(cs_vNodes);
+        for (CNode* pnode : vNodes)
+        {
+            bool select_recv, select_send;
+            GetSocketEvents(pnode, select_recv, select_send);
+
+            LOCK(pnode->cs_hSocket);
+            if (pnode->hSocket == INVALID_SOCKET)
+                continue;
+#ifdef USE_EPOLL
+            if (pnode->hSocket >= FD_SETSIZE)
+                continue;
+#endif
+
+            FD_SET(pnode->hSocket, &fdsetError);
+            hSocketMax = max(hSocketMax, pnode->hSocket);
+            vSockets.push_back(pnode->hSocket);
+            have_fds = true;
+
+            if (select_send) {
+                FD_SET(pnode->hSocket, &fdsetSend);
+            } else if (select_recv) {
+                FD_SET(pnode->hSocket, &fdsetRecv);
+            }
+        }
+    }
+
+    int nSelect = select(have_fds ? hSocketMax + 1 : 0,
+                         &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
+    boost::this_thread::interruption_point();
+
+    if (nSelect == SOCKET_ERROR)
+    {
+        if (have_fds)
+        {
+            int nErr = WSAGetLastError();
+            LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
+            recv_set.insert(vSockets.begin(), vSockets.end());
+        }
+        MilliSleep(timeout.tv_usec/1000);
+        return;
+    }
+
+    for (SOCKET hSocket : vSockets) {
+        if (FD_ISSET(hSocket, &fdsetRecv))
+            recv_set.insert(hSocket);
+        if (FD_ISSET(hSocket, &fdsetSend))
+            send_set.insert(hSocket);
+        if (FD_ISSET(hSocket, &fdsetError))
+            error_set.insert(hSocket);
+    }
+}
+
+#ifdef USE_EPOLL
+/**
+ * The listening sockets and the sockets of the nodes, waited on with epoll.
+ * Sockets are registered once, and their events are only changed when the
+ * events to wait for change, so that waiting does not take time in
+ * proportion to the number of connections. Events are level-triggered, as
+ * a socket is not always drained when it is ready (see GetSocketEvents).
+ * Only used by ThreadSocketHandler.
+ */
+class CSocketEventsEpoll
+{
+private:
+    int hEpoll;
+    //! The registered sockets, with the node that they belong to (or -1 for
+    //! listening sockets), as closed descriptors are reused, and their events.
+    std::map<SOCKET, std::pair<NodeId, uint32_t>> mapRegistered;
+    std::vector<struct epoll_event> vEvents;
+
+    bool Register(SOCKET hSocket, NodeId id, uint32_t events)
+    {
+        struct epoll_event ev = {};
+        ev.events = events;
+        ev.data.fd = hSocket;
+        auto it = mapRegistered.find(hSocket);
+        if (it != mapRegistered.end() && it->second.first == id) {
+            if (it->second.second == events)
+                return true;
+            if (epoll_ctl(hEpoll, EPOLL_CTL_MOD, hSocket, &ev) != 0)
+                return false;
+        } else if (epoll_ctl(hEpoll, EPOLL_CTL_ADD, hSocket, &ev) != 0) {
+            // The descriptor of a closed socket is removed from the epoll
+            // instance, unless it has been duplicated.
+            if (errno != EEXIST || epoll_ctl(hEpoll, EPOLL_CTL_MOD, hSocket, &ev) != 0)
+                return false;
+        }
+        mapRegistered[hSocket] = std::make_pair(id, events);
+        return true;
+    }
+
+public:
+    CSocketEventsEpoll() : hEpoll(epoll_create1(EPOLL_CLOEXEC))
+    {
+        if (hEpoll == -1)
+            LogPrintf("epoll_create1 failed: %s, using select()\n", NetworkErrorString(errno));
+    }
+
+    ~CSocketEventsEpoll()
+    {
+        if (hEpoll != -1)
+            close(hEpoll);
+    }
+
+    bool IsValid() const { return hEpoll != -1; }
+
+    /** Wait up to 50ms for the listening sockets and the sockets of the nodes. */
+    void Wait(std::set<SOCKET>& recv_set, std::set<SOCKET>& send_set, std::set<SOCKET>& error_set)
+    {
+        std::set<SOCKET> setCurrent;
+        for (const ListenSocket& hListenSocket : vhListenSocket) {
+            if (Register(hListenSocket.socket, -1, EPOLLIN))
+                setCurrent.insert(hListenSocket.socket);
+        }
+
+        {
+            LOCK(cs_vNodes);
+            for (CNode* pnode : vNodes)
+            {
+                bool select_recv, select_send;
+                GetSocketEvents(pnode, select_recv, select_send);
+
+                // The socket is only closed with cs_hSocket held.
+                LOCK(pnode->cs_hSocket);
+                if (pnode->hSocket == INVALID_SOCKET)
+                    continue;
+                uint32_t events = select_send ? EPOLLOUT : select_recv ? EPOLLIN : 0;
+                if (Register(pnode->hSocket, pnode->GetId(), events)) {
+                    setCurrent.insert(pnode->hSocket);
+                } else {
+                    LogPrintf("epoll_ctl error %s peer=%d\n", NetworkErrorString(errno), pnode->GetId());
+                }
+            }
+        }
+
+        // Forget the sockets that have been closed since the last wait.
+        for (auto it = mapRegistered.begin(); it != mapRegistered.end(); ) {
+            if (setCurrent.count(it->first) == 0) {
+                struct epoll_event ev = {};
+                epoll_ctl(hEpoll, EPOLL_CTL_DEL, it->first, &ev);
+                it = mapRegistered.erase(it);
+            } else {
+                ++it;
+            }
+        }
+
+        vEvents.resize(std::max(mapRegistered.size(), (size_t)1));
+        int nEvents = epoll_wait(hEpoll, vEvents.data(), vEvents.size(), 50);
+        boost::this_thread::interruption_point();
+        if (nEvents < 0) {
+            if (errno != EINTR)
+                LogPrintf("socket epoll_wait error %s\n", NetworkErrorString(errno));
+            MilliSleep(50);
+            return;
+        }
+
+        for (int i = 0; i < nEvents; i++) {
+            SOCKET hSocket = vEvents[i].data.fd;
+            if (vEvents[i].events & EPOLLIN)
+                recv_set.insert(hSocket);
+            if (vEvents[i].events & EPOLLOUT)
+                send_set.insert(hSocket);
+            if (vEvents[i].events & (EPOLLERR | EPOLLHUP))
+                error_set.insert(hSocket);
+        }
+    }
+};
+#endif
+
 void ThreadSocketHandler()
 {
     unsigned int nPrevNodeCount = 0;
+#ifdef USE_EPOLL
+    CSocketEventsEpoll socketEvents;
+#endif
     while (true)
     {
         //
@@ -1096,7 +1357,7 @@ void ThreadSocketHandler()
             for (CNode* pnode : vNodesCopy)
             {
                 if (pnode->fDisconnect ||
-                    (pnode->GetRefCount() <= 0 && pnode->vRecvMsg.empty() && pnode->nSendSize == 0 && pnode->ssSend.empty()))
+                    (pnode->GetRefCount() <= 0 && pnode->vRecvMsg.empty() && pnode->nProcessQueueSize == 0 && pnode->nSendSize == 0 && pnode->ssSend.empty()))
                 {
                     auto spanGuard = pnode->span.Enter();
 
@@ -1160,101 +1421,21 @@ void ThreadSocketHandler()
         //
         // Find which sockets have data to receive
         //
-        struct timeval timeout;
-        timeout.tv_sec  = 0;
-        timeout.tv_usec = 50000; // frequency to poll pnode->vSend
-
-        fd_set fdsetRecv;
-        fd_set fdsetSend;
-        fd_set fdsetError;
-        FD_ZERO(&fdsetRecv);
-        FD_ZERO(&fdsetSend);
-        FD_ZERO(&fdsetError);
-        SOCKET hSocketMax = 0;
-        bool have_fds = false;
-
-        for (const ListenSocket& hListenSocket : vhListenSocket) {
-            FD_SET(hListenSocket.socket, &fdsetRecv);
-            hSocketMax = max(hSocketMax, hListenSocket.socket);
-            have_fds = true;
-        }
-
-        {
-            LOCK(cs_vNodes);
-            for (CNode* pnode : vNodes)
-            {
-                // Implement the following logic:
-                // * If there is data to send, select() for sending data. As this only
-                //   happens when optimistic write failed, we choose to first drain the
-                //   write buffer in this case before receiving more. This avoids
-                //   needlessly queueing received data, if the remote peer is not themselves
-                //   receiving data. This means properly utilizing TCP flow control signaling.
-                // * Otherwise, if there is no (complete) message in the receive buffer,
-                //   or there is space left in the buffer, select() for receiving data.
-                // * (if neither of the above applies, there is certainly one message
-                //   in the receiver buffer ready to be processed).
-                // Together, that means that at least one of the following is always possible,
-                // so we don't deadlock:
-                // * We send some data.
-                // * We wait for data to be received (and disconnect after timeout).
-                // * We process a message in the buffer (message handler thread).
-
-                bool select_send;
-                {
-                    TRY_LOCK(pnode->cs_vSend, lockSend);
-                    select_send = lockSend && !pnode->vSendMsg.empty();
-                }
-
-                bool select_recv;
-                {
-                    TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
-                    select_recv = lockRecv && (
-                        pnode->vRecvMsg.empty() || !pnode->vRecvMsg.front().complete() ||
-                        pnode->GetTotalRecvSize() <= ReceiveFloodSize());
-                }
-
-                LOCK(pnode->cs_hSocket);
-                if (pnode->hSocket == INVALID_SOCKET)
-                    continue;
-
-                FD_SET(pnode->hSocket, &fdsetError);
-                hSocketMax = max(hSocketMax, pnode->hSocket);
-                have_fds = true;
-
-                if (select_send) {
-                    FD_SET(pnode->hSocket, &fdsetSend);
-                    continue;
-                }
-                if (select_recv) {
-                    FD_SET(pnode->hSocket, &fdsetRecv);
-                }
-            }
-        }
-
-        int nSelect = select(have_fds ? hSocketMax + 1 : 0,
-                             &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
+        std::set<SOCKET> recv_set, send_set, error_set;
+#ifdef USE_EPOLL
+        if (socketEvents.IsValid())
+            socketEvents.Wait(recv_set, send_set, error_set);
+        else
+#endif
+            SocketEventsSelect(recv_set, send_set, error_set);
         boost::this_thread::interruption_point();
 
-        if (nSelect == SOCKET_ERROR)
-        {
-            if (have_fds)
-            {
-                int nErr = WSAGetLastError();
-                LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
-                for (unsigned int i = 0; i <= hSocketMax; i++)
-                    FD_SET(i, &fdsetRecv);
-            }
-            FD_ZERO(&fdsetSend);
-            FD_ZERO(&fdsetError);
-            MilliSleep(timeout.tv_usec/1000);
-        }
-
         //
         // Accept new connections
         //
         for (const ListenSocket& hListenSocket : vhListenSocket)
         {
-            if (hListenSocket.socket != INVALID_SOCKET && FD_ISSET(hListenSocket.socket, &fdsetRecv))
+            if (hListenSocket.socket != INVALID_SOCKET && recv_set.count(hListenSocket.socket) > 0)
             {
                 AcceptConnection(hListenSocket);
             }
@@ -1270,6 +1451,8 @@ void ThreadSocketHandler()
             for (CNode* pnode : vNodesCopy)
                 pnode->AddRef();
         }
+        size_t nSendQueueBytes = 0;
+        size_t nProcessQueueBytes = 0;
         for (CNode* pnode : vNodesCopy)
         {
             boost::this_thread::interruption_point();
@@ -1286,9 +1469,9 @@ void ThreadSocketHandler()
                 LOCK(pnode->cs_hSocket);
                 if (pnode->hSocket == INVALID_SOCKET)
                     continue;
-                recvSet = FD_ISSET(pnode->hSocket, &fdsetRecv);
-                sendSet = FD_ISSET(pnode->hSocket, &fdsetSend);
-                errorSet = FD_ISSET(pnode->hSocket, &fdsetError);
+                recvSet = recv_set.count(pnode->hSocket) > 0;
+                sendSet = send_set.count(pnode->hSocket) > 0;
+                errorSet = error_set.count(pnode->hSocket) > 0;
             }
             if (recvSet || errorSet)
             {
@@ -1341,12 +1524,15 @@ void ThreadSocketHandler()
             //
             // Send
             //
-            if (sendSet)
             {
                 TRY_LOCK(pnode->cs_vSend, lockSend);
-                if (lockSend)
-                    SocketSendData(pnode);
+                if (lockSend) {
+                    if (sendSet)
+                        SocketSendData(pnode);
+                    nSendQueueBytes += pnode->nSendSize;
+                }
             }
+            nProcessQueueBytes += pnode->nProcessQueueSize;
 
             //
             // Inactivity checking
@@ -1376,6 +1562,8 @@ void ThreadSocketHandler()
                 }
             }
         }
+        MetricsGauge("zcash.net.out.queue.bytes", nSendQueueBytes);
+        MetricsGauge("zcash.net.in.queue.bytes", nProcessQueueBytes);
         {
             LOCK(cs_vNodes);
             for (CNode* pnode : vNodesCopy)
@@ -1699,6 +1887,20 @@ void ThreadMessageHandler()
 
         bool fSleep = true;
 
+        // Move the complete messages of each peer out of its receive buffer,
+        // and prepare them for all peers in parallel, so that only the parts
+        // of their processing that need the chain state are done in turn.
+        for (CNode* pnode : vNodesCopy)
+        {
+            if (pnode->fDisconnect)
+                continue;
+            TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
+            if (lockRecv)
+                pnode->MoveCompleteMessages();
+        }
+        g_signals.PrepareMessages(chainparams, vNodesCopy);
+        boost::this_thread::interruption_point();
+
         for (CNode* pnode : vNodesCopy)
         {
             if (pnode->fDisconnect)
@@ -1714,9 +1916,15 @@ void ThreadMessageHandler()
                     if (!g_signals.ProcessMessages(chainparams, pnode))
                         pnode->CloseSocketDisconnect();
 
-                    if (pnode->nSendSize < SendBufferSize())
+                    // A peer waiting for its filtered blocks is woken by the
+                    // worker threads once they have been sent.
+                    // A peer whose historical blocks wait for its upload
+                    // budget to refill is retried on the next turn.
+                    if (pnode->nSendSize < SendBufferSize() && pnode->nFilteredBlocksPending == 0 &&
+                        pnode->nHistoricalUploadWaitUntil <= GetTimeMicros())
                     {
-                        if (!pnode->vRecvGetData.empty() || (!pnode->vRecvMsg.empty() && pnode->vRecvMsg[0].complete()))
+                        if (!pnode->vRecvGetData.empty() || !pnode->vProcessMsg.empty() ||
+                            (!pnode->vRecvMsg.empty() && pnode->vRecvMsg.front().complete()))
                         {
                             fSleep = false;
                         }
@@ -1740,6 +1948,9 @@ void ThreadMessageHandler()
                 pnode->Release();
         }
 
+        if (HaveOrphanWork())
+            fSleep = false;
+
         if (fSleep)
             messageHandlerCondition.timed_wait(lock, boost::posix_time::microsec_clock::universal_time() + boost::posix_time::milliseconds(100));
     }
@@ -1899,6 +2110,11 @@ void static Discover(boost::thread_group& threadGroup)
 #endif
 }
 
+void WakeMessageHandler()
+{
+    messageHandlerCondition.notify_one();
+}
+
 void StartNode(boost::thread_group& threadGroup, CScheduler& scheduler)
 {
     uiInterface.InitMessage(_("Loading addresses..."));
@@ -1971,7 +2187,7 @@ void StartNode(boost::thread_group& threadGroup, CScheduler& scheduler)
     threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "msghand", &ThreadMessageHandler));
 
     // Dump network addresses
-    scheduler.scheduleEvery(&DumpData, DUMP_ADDRESSES_INTERVAL);
+    scheduler.scheduleEvery(&DumpData, DUMP_ADDRESSES_INTERVAL, CScheduler::PRIORITY_LOW);
 }
 
 bool StopNode()
@@ -2037,14 +2253,12 @@ instance_of_cnetcleanup;
 
 void RelayTransaction(const CTransaction& tx)
 {
-    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-    ss.reserve(10000);
-    ss << tx;
-    RelayTransaction(tx, ss);
+    RelayTransaction(MakeTransactionRef(tx));
 }
 
-void RelayTransaction(const CTransaction& tx, const CDataStream& ss)
+void RelayTransaction(const CTransactionRef& ptx)
 {
+    const CTransaction& tx = *ptx;
     CInv inv(MSG_TX, tx.GetHash());
     {
         LOCK(cs_mapRelay);
@@ -2055,8 +2269,9 @@ void RelayTransaction(const CTransaction& tx, const CDataStream& ss)
             vRelayExpiration.pop_front();
         }
 
-        // Save original serialized message so newer versions are preserved
-        mapRelay.insert(std::make_pair(inv, ss));
+        // Keep the transaction for getdata requests after it has left the
+        // mempool; it is usually shared with the mempool entry until then.
+        mapRelay.insert(std::make_pair(inv, ptx));
         vRelayExpiration.push_back(std::make_pair(GetTime() + 15 * 60, inv));
     }
     LOCK(cs_vNodes);
@@ -2175,6 +2390,73 @@ uint64_t CNode::GetOutboundTargetBytesLeft()
     return (nMaxOutboundTotalBytesSentInCycle >= nMaxOutboundLimit) ? 0 : nMaxOutboundLimit - nMaxOutboundTotalBytesSentInCycle;
 }
 
+void CTokenBucket::SetRate(uint64_t nRateIn)
+{
+    nRate = nRateIn;
+    dTokens = nRate;
+    nLastRefillMicros = GetTimeMicros();
+}
+
+void CTokenBucket::Refill(int64_t nNowMicros)
+{
+    if (nNowMicros <= nLastRefillMicros)
+        return;
+    dTokens = std::min<double>(nRate, dTokens + (double)nRate * (nNowMicros - nLastRefillMicros) / 1000000);
+    nLastRefillMicros = nNowMicros;
+}
+
+int64_t CTokenBucket::TimeUntilAvailable(int64_t nNowMicros)
+{
+    if (nRate == 0)
+        return 0;
+    Refill(nNowMicros);
+    if (dTokens >= 0)
+        return 0;
+    return (int64_t)std::ceil(-dTokens * 1000000 / nRate);
+}
+
+void CTokenBucket::Consume(uint64_t nBytes, int64_t nNowMicros)
+{
+    if (nRate == 0)
+        return;
+    Refill(nNowMicros);
+    dTokens -= nBytes;
+}
+
+void CNode::SetMaxHistoricalUploadRate(uint64_t totalRate, uint64_t peerRate)
+{
+    LOCK(cs_totalBytesSent);
+    historicalUploadBucketTotal.SetRate(totalRate);
+    nMaxPeerHistoricalUploadRate = peerRate;
+}
+
+bool CNode::HistoricalUploadAllowed()
+{
+    int64_t nNow = GetTimeMicros();
+    if (nHistoricalUploadWaitUntil > nNow)
+        return false;
+
+    int64_t nWait = historicalUploadBucket.TimeUntilAvailable(nNow);
+    {
+        LOCK(cs_totalBytesSent);
+        nWait = std::max(nWait, historicalUploadBucketTotal.TimeUntilAvailable(nNow));
+    }
+    if (nWait > 0) {
+        nHistoricalUploadWaitUntil = nNow + nWait;
+        MetricsIncrementCounter("zcash.net.out.historical.throttled");
+        return false;
+    }
+    return true;
+}
+
+void CNode::RecordHistoricalUpload(uint64_t bytes)
+{
+    int64_t nNow = GetTimeMicros();
+    historicalUploadBucket.Consume(bytes, nNow);
+    LOCK(cs_totalBytesSent);
+    historicalUploadBucketTotal.Consume(bytes, nNow);
+}
+
 uint64_t CNode::GetTotalBytesRecv()
 {
     LOCK(cs_totalBytesRecv);
@@ -2197,21 +2479,21 @@ void CNode::Fuzz(int nChance)
     case 0:
         // xor a random byte with a random value:
         if (!ssSend.empty()) {
-            CDataStream::size_type pos = GetRand(ssSend.size());
+            CNetDataStream::size_type pos = GetRand(ssSend.size());
             ssSend[pos] ^= (unsigned char)(GetRand(256));
         }
         break;
     case 1:
         // delete a random byte:
         if (!ssSend.empty()) {
-            CDataStream::size_type pos = GetRand(ssSend.size());
+            CNetDataStream::size_type pos = GetRand(ssSend.size());
             ssSend.erase(ssSend.begin()+pos);
         }
         break;
     case 2:
         // insert a random byte at a random position
         {
-            CDataStream::size_type pos = GetRand(ssSend.size());
+            CNetDataStream::size_type pos = GetRand(ssSend.size());
             char ch = (char)GetRand(256);
             ssSend.insert(ssSend.begin()+pos, ch);
         }
@@ -2230,8 +2512,8 @@ CNode::CNode(SOCKET hSocketIn, const CAddress& addrIn, const std::string& addrNa
     nTimeConnected(GetTime()),
     addr(addrIn),
     nKeyedNetGroup(CalculateKeyedNetGroup(addrIn)),
-    addrKnown(5000, 0.001),
-    filterInventoryKnown(50000, 0.000001)
+    addrKnown(5000, 0.001, 500),
+    filterInventoryKnown(50000, 0.000001, 1000)
 {
     nServices = 0;
     hSocket = hSocketIn;
@@ -2240,6 +2522,7 @@ CNode::CNode(SOCKET hSocketIn, const CAddress& addrIn, const std::string& addrNa
     nLastRecv = 0;
     nSendBytes = 0;
     nRecvBytes = 0;
+    nProcessQueueSize = 0;
     nTimeOffset = 0;
     addrName = addrNameIn == "" ? addr.ToStringIPPort() : addrNameIn;
     nVersion = 0;
@@ -2252,6 +2535,7 @@ CNode::CNode(SOCKET hSocketIn, const CAddress& addrIn, const std::string& addrNa
     fSuccessfullyConnected = false;
     fDisconnect = false;
     nRefCount = 0;
+    nReconSalt = 0;
     nSendSize = 0;
     nSendOffset = 0;
     hashContinue = uint256();
@@ -2261,6 +2545,12 @@ CNode::CNode(SOCKET hSocketIn, const CAddress& addrIn, const std::string& addrNa
     fRelayTxes = false;
     fSentAddr = false;
     pfilter = new CBloomFilter();
+    nFilteredBlocksPending = 0;
+    nHistoricalUploadWaitUntil = 0;
+    {
+        LOCK(cs_totalBytesSent);
+        historicalUploadBucket.SetRate(nMaxPeerHistoricalUploadRate);
+    }
     nPingNonceSent = 0;
     nPingUsecStart = 0;
     nPingUsecTime = 0;
@@ -2362,6 +2652,12 @@ void CNode::AbortMessage() UNLOCK_FUNCTION(cs_vSend)
 }
 
 void CNode::EndMessage() UNLOCK_FUNCTION(cs_vSend)
+{
+    std::optional<uint32_t> nChecksum;
+    EndMessage(nChecksum);
+}
+
+void CNode::EndMessage(std::optional<uint32_t>& nChecksum) UNLOCK_FUNCTION(cs_vSend)
 {
     MetricsIncrementCounter("zcash.net.out.messages", "command", strSendCommand.c_str());
     // The -*messagestest options are intentionally not documented in the help message,
@@ -2373,8 +2669,11 @@ void CNode::EndMessage() UNLOCK_FUNCTION(cs_vSend)
         AbortMessage();
         return;
     }
-    if (mapArgs.count("-fuzzmessagestest"))
+    bool fFuzzed = false;
+    if (mapArgs.count("-fuzzmessagestest")) {
         Fuzz(GetArg("-fuzzmessagestest", 10));
+        fFuzzed = true;
+    }
 
     if (ssSend.size() == 0)
     {
@@ -2385,17 +2684,30 @@ void CNode::EndMessage() UNLOCK_FUNCTION(cs_vSend)
     unsigned int nSize = ssSend.size() - CMessageHeader::HEADER_SIZE;
     WriteLE32((uint8_t*)&ssSend[CMessageHeader::MESSAGE_SIZE_OFFSET], nSize);
 
-    // Set the checksum
-    uint256 hash = Hash(ssSend.begin() + CMessageHeader::HEADER_SIZE, ssSend.end());
-    unsigned int nChecksum = 0;
-    memcpy(&nChecksum, &hash, sizeof(nChecksum));
-    assert(ssSend.size () >= CMessageHeader::CHECKSUM_OFFSET + sizeof(nChecksum));
-    memcpy((char*)&ssSend[CMessageHeader::CHECKSUM_OFFSET], &nChecksum, sizeof(nChecksum));
+    // Set the checksum, unless it is known for this payload
+    if (!nChecksum || fFuzzed) {
+        uint256 hash = Hash(ssSend.begin() + CMessageHeader::HEADER_SIZE, ssSend.end());
+        uint32_t nHashChecksum = 0;
+        memcpy(&nHashChecksum, &hash, sizeof(nHashChecksum));
+        nChecksum = nHashChecksum;
+    }
+    assert(ssSend.size () >= CMessageHeader::CHECKSUM_OFFSET + sizeof(*nChecksum));
+    memcpy((char*)&ssSend[CMessageHeader::CHECKSUM_OFFSET], &*nChecksum, sizeof(*nChecksum));
+    if (fFuzzed) {
+        // The checksum is not that of the payload that was asked for.
+        nChecksum = std::nullopt;
+    }
 
     LogPrint("net", "(%d bytes) peer=%d\n", nSize, id);
 
-    std::deque<CSerializeData>::iterator it = vSendMsg.insert(vSendMsg.end(), CSerializeData());
-    ssSend.GetAndClear(*it);
+    // Move the message to the send queue without copying it, and continue
+    // with the buffer of a message that has already been sent.
+    std::deque<CNetSerializeData>::iterator it = vSendMsg.insert(vSendMsg.end(), CNetSerializeData());
+    ssSend.swap(*it);
+    if (!vSendBufferPool.empty()) {
+        ssSend.swap(vSendBufferPool.back());
+        vSendBufferPool.pop_back();
+    }
     nSendSize += (*it).size();
     MetricsCounter(
         "zcash.net.out.bytes", (*it).size(),
@@ -2409,6 +2721,15 @@ void CNode::EndMessage() UNLOCK_FUNCTION(cs_vSend)
     LEAVE_CRITICAL_SECTION(cs_vSend);
 }
 
+void CNode::RecycleSendBuffer(CNetSerializeData& data)
+{
+    AssertLockHeld(cs_vSend);
+    if (vSendBufferPool.size() < MAX_SEND_BUFFER_POOL && data.capacity() <= MAX_POOLED_SEND_BUFFER_SIZE) {
+        data.clear();
+        vSendBufferPool.push_back(std::move(data));
+    }
+}
+
 /* static */ uint64_t CNode::CalculateKeyedNetGroup(const CAddress& ad)
 {
     static const uint64_t k0 = GetRand(std::numeric_limits<uint64_t>::max());
@@ -16,11 +16,15 @@
 #include "random.h"
 #include "streams.h"
 #include "sync.h"
+#include "txreconciliation.h"
 #include "uint256.h"
 #include "utilstrencodings.h"
 #include "chainparams.h"
 
 #include <deque>
+#include <list>
+#include <memory>
+#include <optional>
 #include <stdint.h>
 #include <atomic>
 
@@ -63,6 +67,10 @@ static const size_t SETASKFOR_MAX_SZ = 2 * MAX_INV_SZ;
 static const unsigned int DEFAULT_MAX_PEER_CONNECTIONS = 125;
 /** The default for -maxuploadtarget. 0 = Unlimited */
 static const uint64_t DEFAULT_MAX_UPLOAD_TARGET = 0;
+/** The default for -maxhistoricaluploadrate and -maxpeerhistoricaluploadrate. 0 = Unlimited */
+static const uint64_t DEFAULT_MAX_HISTORICAL_UPLOAD_RATE = 0;
+/** Blocks older than this, in seconds, are historical blocks, whose serving is limited. */
+static const int64_t HISTORICAL_BLOCK_AGE = 7 * 24 * 60 * 60;
 /** Default for blocks only*/
 static const bool DEFAULT_BLOCKSONLY = false;
 /**
@@ -76,6 +84,11 @@ static const size_t DEFAULT_MAXRECEIVEBUFFER = 5 * 1000;
 static const size_t DEFAULT_MAXSENDBUFFER    = 1 * 1000;
 
 // NOTE: When adjusting this, update rpcnet:setban's help ("24h")
+/** The number of buffers of sent messages that each peer keeps for reuse. */
+static const size_t MAX_SEND_BUFFER_POOL = 4;
+/** The largest buffer of a sent message that is kept for reuse. */
+static const size_t MAX_POOLED_SEND_BUFFER_SIZE = 64 * 1024;
+
 static const unsigned int DEFAULT_MISBEHAVING_BANTIME = 60 * 60 * 24;  // Default 24-hour ban
 
 unsigned int ReceiveFloodSize();
@@ -93,6 +106,8 @@ unsigned short GetListenPort();
 bool BindListenPort(const CService &bindAddr, std::string& strError, bool fWhitelisted = false);
 void StartNode(boost::thread_group& threadGroup, CScheduler& scheduler);
 bool StopNode();
+/** Wake the message handler thread, when a peer has more work to be done. */
+void WakeMessageHandler();
 void SocketSendData(CNode *pnode);
 
 typedef int NodeId;
@@ -116,6 +131,7 @@ struct CombinerAll
 struct CNodeSignals
 {
     boost::signals2::signal<int ()> GetHeight;
+    boost::signals2::signal<void (const CChainParams&, const std::vector<CNode*>&)> PrepareMessages;
     boost::signals2::signal<bool (const CChainParams&, CNode*), CombinerAll> ProcessMessages;
     boost::signals2::signal<bool (const Consensus::Params&, CNode*, bool), CombinerAll> SendMessages;
     boost::signals2::signal<void (NodeId, const CNode*)> InitializeNode;
@@ -155,8 +171,13 @@ CAddress GetLocalAddress(const CNetAddr *paddrPeer = NULL);
 
 extern bool fDiscover;
 extern bool fListen;
+/** Whether to reconcile the transactions to announce with peers that support it (-txreconciliation) */
+extern bool fTxReconciliation;
 extern uint64_t nLocalServices;
 extern uint64_t nLocalHostNonce;
+/** Set when AddLocal learns an address, so that it is advertised to the
+ * connected peers without waiting for the daily rebroadcast. */
+extern std::atomic<bool> fLocalAddressAdded;
 extern CAddrMan addrman;
 
 /** Maximum number of connections to simultaneously allow (aka connection slots) */
@@ -164,7 +185,7 @@ extern int nMaxConnections;
 
 extern std::vector<CNode*> vNodes;
 extern CCriticalSection cs_vNodes;
-extern std::map<CInv, CDataStream> mapRelay;
+extern std::map<CInv, CTransactionRef> mapRelay;
 extern std::deque<std::pair<int64_t, CInv> > vRelayExpiration;
 extern CCriticalSection cs_mapRelay;
 extern limitedmap<CInv, int64_t> mapAlreadyAskedFor;
@@ -212,19 +233,43 @@ public:
 
 
 
+/**
+ * The results of the preparation of a complete message for processing, which
+ * is independent of the chain state and is done for the messages of all
+ * peers in parallel.
+ */
+struct CPreparedMessage {
+    bool fDone = false;
+    bool fChecksumValid = false;
+    //! The transaction of a "tx" message, if it passed the context-free checks.
+    std::shared_ptr<const CTransaction> ptx;
+    //! The block of a "block" message.
+    std::shared_ptr<const CBlock> pblock;
+    //! Whether the Equihash solution and proof of work of pblock are valid.
+    bool fHeaderValid = false;
+    //! Whether pblock passed the checks of CheckBlock() that follow those of
+    //! its header, without the verification of its proofs.
+    bool fBlockValid = false;
+    //! The size of the serialization of pblock at the start of the payload,
+    //! or 0 if it cannot be written to disk as it is.
+    size_t nBlockSize = 0;
+};
+
 class CNetMessage {
 public:
     bool in_data;                   // parsing header (false) or data (true)
 
-    CDataStream hdrbuf;             // partially received header
+    CNetDataStream hdrbuf;          // partially received header
     CMessageHeader hdr;             // complete header
     unsigned int nHdrPos;
 
-    CDataStream vRecv;              // received message data
+    CNetDataStream vRecv;           // received message data
     unsigned int nDataPos;
 
     int64_t nTime;                  // time (in microseconds) of message receipt.
 
+    CPreparedMessage prepared;      // set by the message handler thread
+
     CNetMessage(const CMessageHeader::MessageStartChars& pchMessageStartIn, int nTypeIn, int nVersionIn) : hdrbuf(nTypeIn, nVersionIn), hdr(pchMessageStartIn), vRecv(nTypeIn, nVersionIn) {
         hdrbuf.resize(24);
         in_data = false;
@@ -244,6 +289,7 @@ public:
     {
         hdrbuf.SetVersion(nVersionIn);
         vRecv.SetVersion(nVersionIn);
+        prepared = CPreparedMessage();
     }
 
     int readHeader(const char *pch, unsigned int nBytes);
@@ -251,6 +297,33 @@ public:
 };
 
 
+/**
+ * A token bucket that fills at a fixed rate, up to one second's worth. Bytes
+ * may be taken whenever the bucket is not in debt, and taking them may put it
+ * in debt, so that messages larger than the bucket are still sent, and are
+ * paid for by waiting. A rate of zero is no limit.
+ */
+class CTokenBucket
+{
+private:
+    uint64_t nRate;
+    double dTokens;
+    int64_t nLastRefillMicros;
+
+    void Refill(int64_t nNowMicros);
+
+public:
+    CTokenBucket() : nRate(0), dTokens(0), nLastRefillMicros(0) {}
+
+    /** Set the rate in bytes per second, and start with a full bucket. */
+    void SetRate(uint64_t nRateIn);
+    bool IsLimited() const { return nRate > 0; }
+
+    /** Return how long, in microseconds, until bytes may be taken, or 0 if they may be taken now. */
+    int64_t TimeUntilAvailable(int64_t nNowMicros);
+    void Consume(uint64_t nBytes, int64_t nNowMicros);
+};
+
 /** Information about a peer */
 class CNode
 {
@@ -258,19 +331,25 @@ public:
     // socket
     std::atomic<uint64_t> nServices;
     SOCKET hSocket;
-    CDataStream ssSend;
+    CNetDataStream ssSend;
     std::string strSendCommand; // Current command being assembled in ssSend
     size_t nSendSize; // total size of all vSendMsg entries
     size_t nSendOffset; // offset inside the first vSendMsg already sent
     uint64_t nSendBytes;
-    std::deque<CSerializeData> vSendMsg;
+    std::deque<CNetSerializeData> vSendMsg;
+    std::vector<CNetSerializeData> vSendBufferPool; // emptied buffers of sent messages, for reuse
     CCriticalSection cs_vSend;
     CCriticalSection cs_hSocket;
     CCriticalSection cs_vRecv;
 
     std::deque<CInv> vRecvGetData;
-    std::deque<CNetMessage> vRecvMsg;
+    std::list<CNetMessage> vRecvMsg;
     CCriticalSection cs_vRecvMsg;
+    // Complete messages that are waiting to be processed. Only the message
+    // handler thread accesses them, so that it can prepare them without
+    // holding cs_vRecvMsg; other threads only read the size.
+    std::list<CNetMessage> vProcessMsg;
+    std::atomic<size_t> nProcessQueueSize;
     uint64_t nRecvBytes;
     int nRecvVersion;
 
@@ -302,6 +381,14 @@ public:
     CSemaphoreGrant grantOutbound;
     CCriticalSection cs_filter;
     CBloomFilter* pfilter;
+    // Filtered blocks handed to the worker threads that have not been sent
+    // yet. No other messages of the peer are processed until they are.
+    std::atomic<int> nFilteredBlocksPending;
+    // Budget for the historical blocks served to this peer, and the time in
+    // microseconds until which its requests wait for it to refill. Only used
+    // by the message handler thread.
+    CTokenBucket historicalUploadBucket;
+    std::atomic<int64_t> nHistoricalUploadWaitUntil;
     NodeId id;
     std::atomic<int> nRefCount;
 
@@ -333,16 +420,20 @@ public:
 
     // flood relay
     std::vector<CAddress> vAddrToSend;
-    CRollingBloomFilter addrKnown;
+    CGrowingRollingBloomFilter addrKnown;
     bool fGetAddr;
     std::set<uint256> setKnown;
 
     // inventory based relay
-    CRollingBloomFilter filterInventoryKnown;
+    CGrowingRollingBloomFilter filterInventoryKnown;
     std::vector<CInv> vInventoryToSend;
     CCriticalSection cs_inventory;
     std::set<uint256> setAskFor;
     std::multimap<int64_t, CInv> mapAskFor;
+    // The salt sent in our "sendrecon" message, or 0 if none was sent.
+    uint64_t nReconSalt;
+    // Set if both peers sent "sendrecon"; protected by cs_inventory.
+    std::unique_ptr<CTxReconciliationState> reconState;
 
     // Ping time measurement:
     // The pong reply we're expecting, or 0 if no pong expected.
@@ -372,6 +463,10 @@ private:
     static uint64_t nMaxOutboundLimit;
     static uint64_t nMaxOutboundTimeframe;
 
+    // historical block serving rates, guarded by cs_totalBytesSent
+    static CTokenBucket historicalUploadBucketTotal;
+    static uint64_t nMaxPeerHistoricalUploadRate;
+
     CNode(const CNode&);
     void operator=(const CNode&);
 
@@ -402,12 +497,15 @@ public:
     // requires LOCK(cs_vRecvMsg)
     unsigned int GetTotalRecvSize()
     {
-        unsigned int total = 0;
+        unsigned int total = nProcessQueueSize;
         for (const CNetMessage &msg : vRecvMsg)
             total += msg.vRecv.size() + 24;
         return total;
     }
 
+    // requires LOCK(cs_vRecvMsg), and may only be called by the message handler thread
+    void MoveCompleteMessages();
+
     // requires LOCK(cs_vRecvMsg)
     bool ReceiveMsgBytes(const char *pch, unsigned int nBytes);
 
@@ -417,6 +515,9 @@ public:
         nRecvVersion = nVersionIn;
         for (CNetMessage &msg : vRecvMsg)
             msg.SetVersion(nVersionIn);
+        // This is called while the message handler thread processes a message.
+        for (CNetMessage &msg : vProcessMsg)
+            msg.SetVersion(nVersionIn);
     }
 
     CService GetAddrLocal() const;
@@ -461,6 +562,10 @@ public:
         {
             LOCK(cs_inventory);
             filterInventoryKnown.insert(inv.hash);
+            if (reconState) {
+                reconState->setLocal.erase(inv.hash);
+                reconState->setSketched.erase(inv.hash);
+            }
         }
     }
 
@@ -470,6 +575,10 @@ public:
             LOCK(cs_inventory);
             if (inv.type == MSG_TX && filterInventoryKnown.contains(inv.hash))
                 return;
+            // Transactions are announced to the peers that we reconcile
+            // with at the next reconciliation.
+            if (inv.type == MSG_TX && reconState && reconState->AddTransaction(inv.hash))
+                return;
             vInventoryToSend.push_back(inv);
         }
     }
@@ -485,6 +594,14 @@ public:
     // TODO: Document the precondition of this function.  Is cs_vSend locked?
     void EndMessage() UNLOCK_FUNCTION(cs_vSend);
 
+    //! As EndMessage(), but using nChecksum as the checksum of the payload if
+    //! it is set, and otherwise setting it to the checksum that was computed.
+    void EndMessage(std::optional<uint32_t>& nChecksum) UNLOCK_FUNCTION(cs_vSend);
+
+    //! Keep the buffer of a message that has been sent, if it is small
+    //! enough, for a later message to be written to. Requires cs_vSend.
+    void RecycleSendBuffer(CNetSerializeData& data);
+
     void PushVersion();
 
 
@@ -518,6 +635,27 @@ public:
         }
     }
 
+    /**
+     * Push a message whose payload is a1, using nChecksum as its checksum if
+     * it is set, and otherwise setting it. This avoids hashing large payloads
+     * again each time they are sent.
+     */
+    template<typename T1>
+    void PushMessageWithChecksum(const char* pszCommand, const T1& a1, std::optional<uint32_t>& nChecksum)
+    {
+        try
+        {
+            BeginMessage(pszCommand);
+            ssSend << a1;
+            EndMessage(nChecksum);
+        }
+        catch (...)
+        {
+            AbortMessage();
+            throw;
+        }
+    }
+
     template<typename T1, typename T2>
     void PushMessage(const char* pszCommand, const T1& a1, const T2& a2)
     {
@@ -711,6 +849,17 @@ public:
     //!response the time in seconds left in the current max outbound cycle
     // in case of no limit, it will always respond with 0
     static uint64_t GetMaxOutboundTimeLeftInCycle();
+
+    //!set the rates in bytes per second at which historical blocks are
+    // served to all peers together and to each peer, 0 = no limit
+    static void SetMaxHistoricalUploadRate(uint64_t totalRate, uint64_t peerRate);
+
+    //!check whether a historical block may be served to this peer now, which
+    // it may once both its own and the node's budgets have bytes left
+    bool HistoricalUploadAllowed();
+
+    //!record the bytes of a historical block served to this peer
+    void RecordHistoricalUpload(uint64_t bytes);
     std::string GetAddrName() const;
     //! Sets the addrName only if it was not previously set
     void MaybeSetAddrName(const std::string& addrNameIn);
@@ -720,7 +869,7 @@ public:
 
 class CTransaction;
 void RelayTransaction(const CTransaction& tx);
-void RelayTransaction(const CTransaction& tx, const CDataStream& ss);
+void RelayTransaction(const CTransactionRef& ptx);
 
 
 #endif // BITCOIN_NET_H
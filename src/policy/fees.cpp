@@ -6,6 +6,7 @@
 #include "policy/fees.h"
 
 #include "amount.h"
+#include "clientversion.h"
 #include "primitives/transaction.h"
 #include "streams.h"
 #include "txmempool.h"
@@ -41,11 +42,9 @@ void TxConfirmStats::Initialize(std::vector<double>& defaultBuckets,
 }
 
 // Zero out the data for the current block
-void TxConfirmStats::ClearCurrent(unsigned int nBlockHeight)
+void TxConfirmStats::ClearCurrent()
 {
     for (unsigned int j = 0; j < buckets.size(); j++) {
-        oldUnconfTxs[j] += unconfTxs[nBlockHeight%unconfTxs.size()][j];
-        unconfTxs[nBlockHeight%unconfTxs.size()][j] = 0;
         for (unsigned int i = 0; i < curBlockConf.size(); i++)
             curBlockConf[i][j] = 0;
         curBlockTxCt[j] = 0;
@@ -53,6 +52,15 @@ void TxConfirmStats::ClearCurrent(unsigned int nBlockHeight)
     }
 }
 
+void TxConfirmStats::RotateUnconfirmed(unsigned int nBlockHeight)
+{
+    std::vector<int>& expiring = unconfTxs[nBlockHeight % unconfTxs.size()];
+    for (unsigned int j = 0; j < buckets.size(); j++) {
+        oldUnconfTxs[j] += expiring[j];
+        expiring[j] = 0;
+    }
+}
+
 unsigned int TxConfirmStats::FindBucketIndex(double val)
 {
     auto it = bucketMap.lower_bound(val);
@@ -66,9 +74,8 @@ void TxConfirmStats::Record(int blocksToConfirm, double val)
     if (blocksToConfirm < 1)
         return;
     unsigned int bucketindex = FindBucketIndex(val);
-    for (size_t i = blocksToConfirm; i <= curBlockConf.size(); i++) {
-        curBlockConf[i - 1][bucketindex]++;
-    }
+    if ((unsigned int)blocksToConfirm <= curBlockConf.size())
+        curBlockConf[blocksToConfirm - 1][bucketindex]++;
     curBlockTxCt[bucketindex]++;
     curBlockVal[bucketindex] += val;
 }
@@ -76,8 +83,12 @@ void TxConfirmStats::Record(int blocksToConfirm, double val)
 void TxConfirmStats::UpdateMovingAverages()
 {
     for (unsigned int j = 0; j < buckets.size(); j++) {
-        for (unsigned int i = 0; i < confAvg.size(); i++)
-            confAvg[i][j] = confAvg[i][j] * decay + curBlockConf[i][j];
+        // A transaction confirmed in Y blocks was also confirmed within any Z >= Y blocks
+        int nConfirmedWithin = 0;
+        for (unsigned int i = 0; i < confAvg.size(); i++) {
+            nConfirmedWithin += curBlockConf[i][j];
+            confAvg[i][j] = confAvg[i][j] * decay + nConfirmedWithin;
+        }
         avg[j] = avg[j] * decay + curBlockVal[j];
         txCtAvg[j] = txCtAvg[j] * decay + curBlockTxCt[j];
     }
@@ -182,7 +193,7 @@ double TxConfirmStats::EstimateMedianVal(int confTarget, double sufficientTxVal,
     return median;
 }
 
-void TxConfirmStats::Write(CAutoFile& fileout)
+void TxConfirmStats::Write(CDataStream& fileout)
 {
     fileout << decay;
     fileout << buckets;
@@ -293,6 +304,7 @@ void TxConfirmStats::removeTx(unsigned int entryHeight, unsigned int nBestSeenHe
 
 void CBlockPolicyEstimator::removeTx(uint256 hash)
 {
+    LOCK(cs_feeEstimator);
     std::map<uint256, TxStatsInfo>::iterator pos = mapMemPoolTxs.find(hash);
     if (pos == mapMemPoolTxs.end()) {
         LogPrint("estimatefee", "Blockpolicy error mempool tx %s not found for removeTx\n",
@@ -351,6 +363,7 @@ bool CBlockPolicyEstimator::isPriDataPoint(const CFeeRate &fee, double pri)
 
 void CBlockPolicyEstimator::processTransaction(const CTxMemPoolEntry& entry, bool fCurrentEstimate)
 {
+    LOCK(cs_feeEstimator);
     unsigned int txHeight = entry.GetHeight();
     uint256 hash = entry.GetTx().GetHash();
     if (mapMemPoolTxs[hash].stats != NULL) {
@@ -403,7 +416,7 @@ void CBlockPolicyEstimator::processTransaction(const CTxMemPoolEntry& entry, boo
     LogPrint("estimatefee", "\n");
 }
 
-void CBlockPolicyEstimator::processBlockTx(unsigned int nBlockHeight, const CTxMemPoolEntry& entry)
+void CBlockPolicyEstimator::processBlockTx(PendingBlock& pending, const CTxMemPoolEntry& entry)
 {
     if (!entry.WasClearAtEntry()) {
         // This transaction depended on other transactions in the mempool to
@@ -415,7 +428,7 @@ void CBlockPolicyEstimator::processBlockTx(unsigned int nBlockHeight, const CTxM
     // How many blocks did it take for miners to include this transaction?
     // blocksToConfirm is 1-based, so a transaction included in the earliest
     // possible block has confirmation count of 1
-    int blocksToConfirm = nBlockHeight - entry.GetHeight();
+    int blocksToConfirm = pending.nBlockHeight - entry.GetHeight();
     if (blocksToConfirm <= 0) {
         // This can't happen because we don't process transactions from a block with a height
         // lower than our greatest seen height
@@ -428,21 +441,22 @@ void CBlockPolicyEstimator::processBlockTx(unsigned int nBlockHeight, const CTxM
 
     // Want the priority of the tx at confirmation.  The priority when it
     // entered the mempool could easily be very small and change quickly
-    double curPri = entry.GetPriority(nBlockHeight);
+    double curPri = entry.GetPriority(pending.nBlockHeight);
 
     // Record this as a priority estimate
     if (entry.GetFee() == 0 || isPriDataPoint(feeRate, curPri)) {
-        priStats.Record(blocksToConfirm, curPri);
+        pending.vPriTxs.push_back(std::make_pair(blocksToConfirm, curPri));
     }
     // Record this as a fee estimate
     else if (isFeeDataPoint(feeRate, curPri)) {
-        feeStats.Record(blocksToConfirm, (double)feeRate.GetFeePerK());
+        pending.vFeeTxs.push_back(std::make_pair(blocksToConfirm, (double)feeRate.GetFeePerK()));
     }
 }
 
 void CBlockPolicyEstimator::processBlock(unsigned int nBlockHeight,
-                                         std::vector<CTxMemPoolEntry>& entries, bool fCurrentEstimate)
+                                         const std::vector<const CTxMemPoolEntry*>& entries, bool fCurrentEstimate)
 {
+    LOCK(cs_feeEstimator);
     if (nBlockHeight <= nBestSeenHeight) {
         // Ignore side chains and re-orgs; assuming they are random
         // they don't affect the estimate.
@@ -458,48 +472,87 @@ void CBlockPolicyEstimator::processBlock(unsigned int nBlockHeight,
     if (!fCurrentEstimate)
         return;
 
+    // The mempool removes the block's transactions from our tracking right
+    // after this, against the new nBestSeenHeight, so the unconfirmed counts
+    // have to be rotated now rather than when the block is folded in.
+    feeStats.RotateUnconfirmed(nBlockHeight);
+    priStats.RotateUnconfirmed(nBlockHeight);
+
+    vPendingBlocks.emplace_back();
+    PendingBlock& pending = vPendingBlocks.back();
+    pending.nBlockHeight = nBlockHeight;
+    for (const CTxMemPoolEntry* pentry : entries)
+        processBlockTx(pending, *pentry);
+
+    // Nothing has drained the queue in a while (e.g. there is no scheduler
+    // thread); don't let it grow without bound.
+    if (vPendingBlocks.size() >= MAX_PENDING_ESTIMATE_BLOCKS)
+        processPendingBlocks();
+}
+
+void CBlockPolicyEstimator::UpdateCutoffs()
+{
     // Update the dynamic cutoffs
     // a fee/priority is "likely" the reason your tx was included in a block if >85% of such tx's
     // were confirmed in 2 blocks and is "unlikely" if <50% were confirmed in 10 blocks
     LogPrint("estimatefee", "Blockpolicy recalculating dynamic cutoffs:\n");
-    priLikely = priStats.EstimateMedianVal(2, SUFFICIENT_PRITXS, MIN_SUCCESS_PCT, true, nBlockHeight);
+    priLikely = priStats.EstimateMedianVal(2, SUFFICIENT_PRITXS, MIN_SUCCESS_PCT, true, nBestSeenHeight);
     if (priLikely == -1)
         priLikely = INF_PRIORITY;
 
-    double feeLikelyEst = feeStats.EstimateMedianVal(2, SUFFICIENT_FEETXS, MIN_SUCCESS_PCT, true, nBlockHeight);
+    double feeLikelyEst = feeStats.EstimateMedianVal(2, SUFFICIENT_FEETXS, MIN_SUCCESS_PCT, true, nBestSeenHeight);
     if (feeLikelyEst == -1)
         feeLikely = CFeeRate(INF_FEERATE);
     else
         feeLikely = CFeeRate(feeLikelyEst);
 
-    priUnlikely = priStats.EstimateMedianVal(10, SUFFICIENT_PRITXS, UNLIKELY_PCT, false, nBlockHeight);
+    priUnlikely = priStats.EstimateMedianVal(10, SUFFICIENT_PRITXS, UNLIKELY_PCT, false, nBestSeenHeight);
     if (priUnlikely == -1)
         priUnlikely = 0;
 
-    double feeUnlikelyEst = feeStats.EstimateMedianVal(10, SUFFICIENT_FEETXS, UNLIKELY_PCT, false, nBlockHeight);
+    double feeUnlikelyEst = feeStats.EstimateMedianVal(10, SUFFICIENT_FEETXS, UNLIKELY_PCT, false, nBestSeenHeight);
     if (feeUnlikelyEst == -1)
         feeUnlikely = CFeeRate(0);
     else
         feeUnlikely = CFeeRate(feeUnlikelyEst);
+}
 
-    // Clear the current block states
-    feeStats.ClearCurrent(nBlockHeight);
-    priStats.ClearCurrent(nBlockHeight);
+void CBlockPolicyEstimator::processPendingBlocks()
+{
+    LOCK(cs_feeEstimator);
+    if (vPendingBlocks.empty())
+        return;
 
-    // Repopulate the current block states
-    for (unsigned int i = 0; i < entries.size(); i++)
-        processBlockTx(nBlockHeight, entries[i]);
+    size_t nEntries = 0;
+    for (const PendingBlock& pending : vPendingBlocks) {
+        // Clear the current block states
+        feeStats.ClearCurrent();
+        priStats.ClearCurrent();
+
+        // Repopulate the current block states
+        for (const std::pair<int, double>& tx : pending.vFeeTxs)
+            feeStats.Record(tx.first, tx.second);
+        for (const std::pair<int, double>& tx : pending.vPriTxs)
+            priStats.Record(tx.first, tx.second);
+        nEntries += pending.vFeeTxs.size() + pending.vPriTxs.size();
+
+        // Update all exponential averages with the current block states
+        feeStats.UpdateMovingAverages();
+        priStats.UpdateMovingAverages();
+    }
 
-    // Update all exponential averages with the current block states
-    feeStats.UpdateMovingAverages();
-    priStats.UpdateMovingAverages();
+    LogPrint("estimatefee", "Blockpolicy after updating estimates for %u blocks with %u data points, new mempool map size %u\n",
+             vPendingBlocks.size(), nEntries, mapMemPoolTxs.size());
+    vPendingBlocks.clear();
 
-    LogPrint("estimatefee", "Blockpolicy after updating estimates for %u confirmed entries, new mempool map size %u\n",
-             entries.size(), mapMemPoolTxs.size());
+    UpdateCutoffs();
 }
 
 CFeeRate CBlockPolicyEstimator::estimateFee(int confTarget)
 {
+    LOCK(cs_feeEstimator);
+    processPendingBlocks();
+
     // Return failure if trying to analyze a target we're not tracking
     if (confTarget <= 0 || (unsigned int)confTarget > feeStats.GetMaxConfirms())
         return CFeeRate(0);
@@ -514,6 +567,9 @@ CFeeRate CBlockPolicyEstimator::estimateFee(int confTarget)
 
 double CBlockPolicyEstimator::estimatePriority(int confTarget)
 {
+    LOCK(cs_feeEstimator);
+    processPendingBlocks();
+
     // Return failure if trying to analyze a target we're not tracking
     if (confTarget <= 0 || (unsigned int)confTarget > priStats.GetMaxConfirms())
         return -1;
@@ -523,15 +579,24 @@ double CBlockPolicyEstimator::estimatePriority(int confTarget)
 
 void CBlockPolicyEstimator::Write(CAutoFile& fileout)
 {
-    fileout << nBestSeenHeight;
-    feeStats.Write(fileout);
-    priStats.Write(fileout);
+    // Take a snapshot so that the disk write doesn't hold up the mempool.
+    CDataStream ssEstimates(SER_DISK, CLIENT_VERSION);
+    {
+        LOCK(cs_feeEstimator);
+        processPendingBlocks();
+        ssEstimates << nBestSeenHeight;
+        feeStats.Write(ssEstimates);
+        priStats.Write(ssEstimates);
+    }
+    fileout << ssEstimates;
 }
 
 void CBlockPolicyEstimator::Read(CAutoFile& filein)
 {
     int nFileBestSeenHeight;
     filein >> nFileBestSeenHeight;
+    LOCK(cs_feeEstimator);
+    vPendingBlocks.clear();
     feeStats.Read(filein);
     priStats.Read(filein);
     nBestSeenHeight = nFileBestSeenHeight;
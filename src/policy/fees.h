@@ -6,6 +6,7 @@
 #define BITCOIN_POLICY_FEES_H
 
 #include "amount.h"
+#include "sync.h"
 #include "uint256.h"
 
 #include <map>
@@ -15,6 +16,7 @@
 static const CAmount DEFAULT_FEE = 1000;
 
 class CAutoFile;
+class CDataStream;
 class CFeeRate;
 class CTxMemPoolEntry;
 
@@ -66,6 +68,12 @@ class CTxMemPoolEntry;
  * the number of transactions we've seen in that fee bucket when calculating
  * an estimate for any number of confirmations below the number of blocks
  * they've been outstanding.
+ *
+ * Connecting a block only does constant work per confirmed transaction: the
+ * mempool hands us each transaction's confirmation delay and bucket value
+ * while it holds its lock, and the moving averages and the dynamic cutoffs
+ * are brought up to date later by processPendingBlocks(), from the scheduler
+ * thread or before the next estimate is returned.
  */
 
 /** Decay of .998 is a half-life of 346 blocks or about 2.4 days */
@@ -99,7 +107,8 @@ private:
     // Count the total # of txs confirmed within Y blocks in each bucket
     // Track the historical moving average of theses totals over blocks
     std::vector<std::vector<double> > confAvg; // confAvg[Y][X]
-    // and calcuate the totals for the current block to update the moving averages
+    // and count the txs confirmed in exactly Y blocks in the current block;
+    // UpdateMovingAverages sums these into the "within Y blocks" totals
     std::vector<std::vector<int> > curBlockConf; // curBlockConf[Y][X]
 
     // Sum the total priority/fee of all txs in each bucket
@@ -138,7 +147,13 @@ public:
     void Initialize(std::vector<double>& defaultBuckets, unsigned int maxConfirms, double decay, std::string dataTypeString);
 
     /** Clear the state of the curBlock variables to start counting for the new block */
-    void ClearCurrent(unsigned int nBlockHeight);
+    void ClearCurrent();
+
+    /**
+     * Move the mempool counts of the transactions that have now been unconfirmed
+     * for the maximum number of blocks into the oldUnconfTxs counts.
+     */
+    void RotateUnconfirmed(unsigned int nBlockHeight);
 
     /**
      * Record a new transaction data point in the current block stats
@@ -176,8 +191,8 @@ public:
     /** Return the max number of confirms we're tracking */
     unsigned int GetMaxConfirms() { return confAvg.size(); }
 
-    /** Write state of estimation data to a file*/
-    void Write(CAutoFile& fileout);
+    /** Write state of estimation data to a stream */
+    void Write(CDataStream& fileout);
 
     /**
      * Read saved state of estimation data from a file and replace all internal data structures and
@@ -218,6 +233,12 @@ static const double FEE_SPACING = 1.1;
 /** Spacing of Priority buckets */
 static const double PRI_SPACING = 2;
 
+/**
+ * Connected blocks we queue up before folding them into the estimates on the
+ * calling thread, should nothing else have done so in the meantime.
+ */
+static const unsigned int MAX_PENDING_ESTIMATE_BLOCKS = MAX_BLOCK_CONFIRMS;
+
 /**
  *  We want to be able to estimate fees or priorities that are needed on txs to be included in
  * a certain number of blocks.  Every time a block is added to the best chain, this class records
@@ -229,12 +250,16 @@ public:
     /** Create new BlockPolicyEstimator and initialize stats tracking classes with default values */
     CBlockPolicyEstimator(const CFeeRate& minRelayFee);
 
-    /** Process all the transactions that have been included in a block */
+    /**
+     * Process all the transactions that have been included in a block. This is
+     * called before they are removed from the mempool and only queues up the
+     * data points; see processPendingBlocks().
+     */
     void processBlock(unsigned int nBlockHeight,
-                      std::vector<CTxMemPoolEntry>& entries, bool fCurrentEstimate);
+                      const std::vector<const CTxMemPoolEntry*>& entries, bool fCurrentEstimate);
 
-    /** Process a transaction confirmed in a block*/
-    void processBlockTx(unsigned int nBlockHeight, const CTxMemPoolEntry& entry);
+    /** Fold the blocks queued by processBlock into the moving averages and update the dynamic cutoffs */
+    void processPendingBlocks();
 
     /** Process a transaction accepted to the mempool*/
     void processTransaction(const CTxMemPoolEntry& entry, bool fCurrentEstimate);
@@ -254,13 +279,19 @@ public:
     /** Return a priority estimate */
     double estimatePriority(int confTarget);
 
-    /** Write estimation data to a file */
+    /** Write estimation data to a file. The file is not written to while cs_feeEstimator is held. */
     void Write(CAutoFile& fileout);
 
     /** Read estimation data from a file */
     void Read(CAutoFile& filein);
 
 private:
+    /**
+     * Guards all of the state below. Taken after CTxMemPool::cs by the mempool
+     * callbacks, and on its own by the estimate, scheduler and persistence paths.
+     */
+    CCriticalSection cs_feeEstimator;
+
     CFeeRate minTrackedFee;    //!< Passed to constructor to avoid dependency on main
     double minTrackedPriority; //!< Set to AllowFreeThreshold
     unsigned int nBestSeenHeight;
@@ -275,6 +306,21 @@ private:
     // map of txids to information about that transaction
     std::map<uint256, TxStatsInfo> mapMemPoolTxs;
 
+    /** The data points of a connected block that have not been folded into the moving averages yet */
+    struct PendingBlock
+    {
+        unsigned int nBlockHeight;
+        std::vector<std::pair<int, double> > vFeeTxs; //!< (blocksToConfirm, fee rate)
+        std::vector<std::pair<int, double> > vPriTxs; //!< (blocksToConfirm, priority)
+    };
+    std::vector<PendingBlock> vPendingBlocks;
+
+    /** Queue a transaction confirmed in a block as a data point of pending */
+    void processBlockTx(PendingBlock& pending, const CTxMemPoolEntry& entry);
+
+    /** Recalculate feeLikely, feeUnlikely, priLikely and priUnlikely */
+    void UpdateCutoffs();
+
     /** Classes to track historical data on transaction confirmations */
     TxConfirmStats feeStats, priStats;
 
@@ -104,6 +104,10 @@ unsigned int CalculateNextWorkRequired(arith_uint256 bnAvg,
 
 bool CheckEquihashSolution(const CBlockHeader *pblock, const Consensus::Params& params)
 {
+    if (params.fSkipEquihash) {
+        return true;
+    }
+
     unsigned int n = params.nEquihashN;
     unsigned int k = params.nEquihashK;
 
@@ -73,6 +73,8 @@ static const u32 NRESTS = 1<<RESTBITS;
 static const u32 NBLOCKS = (NHASHES+HASHESPERBLAKE-1)/HASHESPERBLAKE;
 // nothing larger found in 100000 runs
 static const u32 MAXSOLS = 8;
+// number of blocks of hashes computed by each blake2b_hash_many call
+static const u32 BLAKEBATCH = 64;
 
 // tree node identifying its children as two different slots in
 // a bucket on previous layer with the same rest bits (x-tra hash)
@@ -207,7 +209,9 @@ u32 min(const u32 a, const u32 b) {
 }
 
 struct equi {
-  BLAKE2bState* blake_ctx;
+  uchar personal[BLAKE2bPersonalBytes];
+  uchar *blake_input;
+  u32 blake_inputlen;
   htalloc hta;
   bsizes *nslots; // PUT IN BUCKET STRUCT
   proof *sols;
@@ -219,6 +223,8 @@ struct equi {
   pthread_barrier_t barry;
   equi(const u32 n_threads) {
     assert(sizeof(hashunit) == 4);
+    blake_input = NULL;
+    blake_inputlen = 0;
     nthreads = n_threads;
     const int err = pthread_barrier_init(&barry, NULL, nthreads);
     assert(!err);
@@ -230,11 +236,18 @@ struct equi {
     hta.dealloctrees();
     free(nslots);
     free(sols);
-    blake2b_free(blake_ctx);
+    free(blake_input);
   }
-  void setstate(const BLAKE2bState *ctx) {
-    blake_ctx = blake2b_clone(ctx);
-    memset(nslots, 0, NBUCKETS * sizeof(au32)); // only nslots[0] needs zeroing
+  // personalization and input absorbed so far by the base blake2b state;
+  // may be called again to reuse the tables for another solve
+  void setstate(const uchar *personalization, const uchar *input, const u32 inputlen) {
+    memcpy(personal, personalization, BLAKE2bPersonalBytes);
+    blake_input = (uchar *)realloc(blake_input, inputlen ? inputlen : 1);
+    assert(blake_input);
+    memcpy(blake_input, input, inputlen);
+    blake_inputlen = inputlen;
+    // a cancelled solve can leave either layer's bucket sizes behind
+    memset(nslots, 0, 2 * NBUCKETS * sizeof(au32));
     nsols = 0;
   }
   u32 getslot(const u32 r, const u32 bucketi) {
@@ -434,16 +447,19 @@ struct equi {
   };
 
   void digit0(const u32 id) {
-    uchar hash[HASHOUT];
-    BLAKE2bState* state;
+    uchar hashes[BLAKEBATCH][HASHOUT];
+    u32 lebs[BLAKEBATCH];
     htlayout htl(this, 0);
     const u32 hashbytes = hashsize(0);
-    for (u32 block = id; block < NBLOCKS; block += nthreads) {
-      state = blake2b_clone(blake_ctx);
-      u32 leb = htole32(block);
-      blake2b_update(state, (uchar *)&leb, sizeof(u32));
-      blake2b_finalize(state, hash, HASHOUT);
-      blake2b_free(state);
+    for (u32 block0 = id * BLAKEBATCH; block0 < NBLOCKS; block0 += nthreads * BLAKEBATCH) {
+     const u32 nblocks = min(BLAKEBATCH, NBLOCKS - block0);
+     for (u32 j = 0; j < nblocks; j++)
+      lebs[j] = htole32(block0 + j);
+     blake2b_hash_many(HASHOUT, personal, blake_input, blake_inputlen,
+                       (uchar *)lebs, sizeof(u32), nblocks, hashes[0]);
+     for (u32 j = 0; j < nblocks; j++) {
+      const u32 block = block0 + j;
+      const uchar *hash = hashes[j];
       for (u32 i = 0; i<HASHESPERBLAKE; i++) {
         const uchar *ph = hash + i * WN/8;
 #if BUCKBITS == 16 && RESTBITS == 4
@@ -469,6 +485,7 @@ struct equi {
         s.attr = tree(block * HASHESPERBLAKE + i);
         memcpy(s.hash->bytes+htl.nextbo, ph+WN/8-hashbytes, hashbytes);
       }
+     }
     }
   }
   
@@ -0,0 +1,68 @@
+// Copyright (c) 2021 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "pow/tromp/solver.h"
+
+#include "pow/tromp/equi_miner.h"
+
+#include <thread>
+
+bool TrompSolver::Supports(unsigned int n, unsigned int k)
+{
+    return n == WN && k == WK;
+}
+
+TrompSolver::TrompSolver(unsigned int nThreadsIn) : nThreads(std::max(1u, nThreadsIn))
+{
+    eq.reset(new equi(nThreads));
+}
+
+TrompSolver::~TrompSolver()
+{
+}
+
+void TrompSolver::RunRound(const std::function<void(uint32_t)>& round)
+{
+    // Each round only reads the buckets of the previous one, so joining the
+    // threads is the barrier between rounds.
+    std::vector<std::thread> threads;
+    for (uint32_t id = 1; id < nThreads; id++) {
+        threads.emplace_back(round, id);
+    }
+    round(0);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+bool TrompSolver::Solve(const eh_HashState& base_state,
+                        const std::function<bool(std::vector<unsigned char>)> validBlock,
+                        const std::function<bool(EhSolverCancelCheck)> cancelled)
+{
+    assert(base_state.length == HASHOUT);
+    eq->setstate(base_state.personal.data(), base_state.input.data(), base_state.input.size());
+
+    RunRound([this](uint32_t id) { eq->digit0(id); });
+    eq->xfull = eq->bfull = eq->hfull = 0;
+    if (cancelled(ListColliding)) throw EhSolverCancelledException();
+
+    for (u32 r = 1; r < WK; r++) {
+        RunRound([this, r](uint32_t id) { (r&1) ? eq->digitodd(r, id) : eq->digiteven(r, id); });
+        eq->xfull = eq->bfull = eq->hfull = 0;
+        if (cancelled(RoundEnd)) throw EhSolverCancelledException();
+    }
+
+    RunRound([this](uint32_t id) { eq->digitK(id); });
+    if (cancelled(FinalColliding)) throw EhSolverCancelledException();
+
+    // Convert the solution indices to the minimal encoding and check them.
+    const u32 nsols = std::min<u32>(eq->nsols, MAXSOLS);
+    for (u32 s = 0; s < nsols; s++) {
+        std::vector<eh_index> index_vector(eq->sols[s], eq->sols[s] + PROOFSIZE);
+        if (validBlock(GetMinimalFromIndices(index_vector, DIGITBITS))) {
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,51 @@
+// Copyright (c) 2021 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifndef ZCASH_POW_TROMP_SOLVER_H
+#define ZCASH_POW_TROMP_SOLVER_H
+
+#include "crypto/equihash.h"
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+struct equi;
+
+/**
+ * Driver for John Tromp's Equihash solver (pow/tromp/equi_miner.h), which
+ * sorts the rows of each round into buckets and keeps compact index trees
+ * instead of full index lists.
+ *
+ * The solver's tables (about 144MB) are allocated once and reused for every
+ * nonce. Each round is split between nThreads threads, so one solver can use
+ * several cores without the memory of one solver per core, trading memory
+ * for speed against running more mining threads.
+ *
+ * Solve() has the same interface as EhOptimisedSolve: every candidate
+ * solution is passed to validBlock until one is accepted, and cancelled is
+ * polled between rounds, throwing EhSolverCancelledException if it returns
+ * true.
+ */
+class TrompSolver
+{
+private:
+    std::unique_ptr<equi> eq;
+    unsigned int nThreads;
+
+    void RunRound(const std::function<void(uint32_t)>& round);
+
+public:
+    /** Only the parameters the solver was compiled for are supported. */
+    static bool Supports(unsigned int n, unsigned int k);
+
+    explicit TrompSolver(unsigned int nThreads);
+    ~TrompSolver();
+
+    bool Solve(const eh_HashState& base_state,
+               const std::function<bool(std::vector<unsigned char>)> validBlock,
+               const std::function<bool(EhSolverCancelCheck)> cancelled);
+};
+
+#endif // ZCASH_POW_TROMP_SOLVER_H
@@ -22,14 +22,14 @@ std::string SaplingOutPoint::ToString() const
 CTxIn::CTxIn(COutPoint prevoutIn, CScript scriptSigIn, uint32_t nSequenceIn)
 {
     prevout = prevoutIn;
-    scriptSig = scriptSigIn;
+    scriptSig = std::move(scriptSigIn);
     nSequence = nSequenceIn;
 }
 
 CTxIn::CTxIn(uint256 hashPrevTx, uint32_t nOut, CScript scriptSigIn, uint32_t nSequenceIn)
 {
     prevout = COutPoint(hashPrevTx, nOut);
-    scriptSig = scriptSigIn;
+    scriptSig = std::move(scriptSigIn);
     nSequence = nSequenceIn;
 }
 
@@ -51,7 +51,7 @@ std::string CTxIn::ToString() const
 CTxOut::CTxOut(const CAmount& nValueIn, CScript scriptPubKeyIn)
 {
     nValue = nValueIn;
-    scriptPubKey = scriptPubKeyIn;
+    scriptPubKey = std::move(scriptPubKeyIn);
 }
 
 uint256 CTxOut::GetHash() const
@@ -82,6 +82,21 @@ uint256 CMutableTransaction::GetHash() const
 void CTransaction::UpdateHash() const
 {
     *const_cast<uint256*>(&hash) = SerializeHash(*this);
+    UpdateSerializedSize();
+}
+
+void CTransaction::UpdateHash(const char* pbegin, const char* pend) const
+{
+    *const_cast<uint256*>(&hash) = Hash(pbegin, pend);
+    *const_cast<size_t*>(&nSerializedSize) = pend - pbegin;
+}
+
+void CTransaction::UpdateSerializedSize() const
+{
+    // GetSerializeSize would return the cached size.
+    CSizeComputer s(SER_NETWORK, PROTOCOL_VERSION);
+    NCONST_PTR(this)->SerializationOp(s, CSerActionSerialize());
+    *const_cast<size_t*>(&nSerializedSize) = s.size();
 }
 
 CTransaction::CTransaction() : nVersion(CTransaction::SPROUT_MIN_CURRENT_VERSION),
@@ -89,7 +104,10 @@ CTransaction::CTransaction() : nVersion(CTransaction::SPROUT_MIN_CURRENT_VERSION
                                vin(), vout(), nLockTime(0),
                                valueBalance(0), vShieldedSpend(), vShieldedOutput(),
                                vJoinSplit(), joinSplitPubKey(), joinSplitSig(),
-                               bindingSig() { }
+                               bindingSig()
+{
+    UpdateSerializedSize();
+}
 
 CTransaction::CTransaction(const CMutableTransaction &tx) : nVersion(tx.nVersion), fOverwintered(tx.fOverwintered), nVersionGroupId(tx.nVersionGroupId), nExpiryHeight(tx.nExpiryHeight),
                                                             vin(tx.vin), vout(tx.vout), nLockTime(tx.nLockTime),
@@ -111,6 +129,7 @@ CTransaction::CTransaction(
                               bindingSig(tx.bindingSig)
 {
     assert(evilDeveloperFlag);
+    UpdateSerializedSize();
 }
 
 CTransaction::CTransaction(CMutableTransaction &&tx) : nVersion(tx.nVersion),
@@ -142,6 +161,7 @@ CTransaction& CTransaction::operator=(const CTransaction &tx) {
     *const_cast<Ed25519Signature*>(&joinSplitSig) = tx.joinSplitSig;
     *const_cast<binding_sig_t*>(&bindingSig) = tx.bindingSig;
     *const_cast<uint256*>(&hash) = tx.hash;
+    *const_cast<size_t*>(&nSerializedSize) = tx.nSerializedSize;
     return *this;
 }
 
@@ -16,6 +16,7 @@
 #include "consensus/upgrades.h"
 
 #include <array>
+#include <memory>
 #include <variant>
 
 #include "zcash/NoteEncryption.hpp"
@@ -503,7 +504,16 @@ class CTransaction
 private:
     /** Memory only. */
     const uint256 hash;
+    /**
+     * Memory only. The size of the serialization, which is the same for
+     * every stream type and version, so that GetSerializeSize does not walk
+     * the transaction.
+     */
+    const size_t nSerializedSize = 0;
     void UpdateHash() const;
+    /** Set the hash and size from the serialization of the transaction. */
+    void UpdateHash(const char* pbegin, const char* pend) const;
+    void UpdateSerializedSize() const;
 
 protected:
     /** Developer testing only.  Set evilDeveloperFlag to true.
@@ -569,7 +579,32 @@ public:
 
     CTransaction& operator=(const CTransaction& tx);
 
-    ADD_SERIALIZE_METHODS;
+    template <typename Stream>
+    void Serialize(Stream& s) const {
+        NCONST_PTR(this)->SerializationOp(s, CSerActionSerialize());
+    }
+
+    void Serialize(CSizeComputer& s) const {
+        s.seek(nSerializedSize);
+    }
+
+    template <typename Stream>
+    void Unserialize(Stream& s) {
+        SerializationOp(s, CSerActionUnserialize());
+        UpdateHash();
+    }
+
+    /**
+     * Deserialize from memory, which is how blocks are read from disk and
+     * how received transactions and blocks are read. The hash is taken over
+     * the bytes that were read, rather than over the transaction serialized
+     * again; the serialization is canonical, so they are the same.
+     */
+    void Unserialize(CMemoryReader& s) {
+        const char* pbegin = s.data();
+        SerializationOp(s, CSerActionUnserialize());
+        UpdateHash(pbegin, s.data());
+    }
 
     template <typename Stream, typename Operation>
     inline void SerializationOp(Stream& s, Operation ser_action) {
@@ -634,8 +669,6 @@ public:
         if ((isSaplingV4 || isFuture) && !(vShieldedSpend.empty() && vShieldedOutput.empty())) {
             READWRITE(*const_cast<binding_sig_t*>(&bindingSig));
         }
-        if (ser_action.ForRead())
-            UpdateHash();
     }
 
     template <typename Stream>
@@ -797,4 +830,15 @@ struct CMutableTransaction
     uint256 GetHash() const;
 };
 
+/**
+ * A transaction shared, without copying it, between the mempool, relay,
+ * orphan and pending verification structures that hold it at once.
+ */
+typedef std::shared_ptr<const CTransaction> CTransactionRef;
+template <typename... Args>
+static inline CTransactionRef MakeTransactionRef(Args&&... args)
+{
+    return std::make_shared<const CTransaction>(std::forward<Args>(args)...);
+}
+
 #endif // BITCOIN_PRIMITIVES_TRANSACTION_H
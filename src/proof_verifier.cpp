@@ -4,12 +4,103 @@
 
 #include <proof_verifier.h>
 
+#include <crypto/sha256.h>
+#include <hash.h>
+#include <memusage.h>
+#include <random.h>
+#include <util.h>
 #include <zcash/JoinSplit.hpp>
 
+#include <atomic>
 #include <variant>
 
+#include <boost/thread.hpp>
+#include <boost/unordered_set.hpp>
+
 #include <librustzcash.h>
 
+namespace {
+
+/**
+ * We're hashing a nonce into the entries themselves, so we don't need extra
+ * blinding in the set hash computation.
+ */
+class CProofCacheHasher
+{
+public:
+    size_t operator()(const uint256& key) const {
+        return key.GetCheapHash();
+    }
+};
+
+/**
+ * Valid proof cache, to avoid doing expensive zk-SNARK verification twice
+ * for every transaction (once when accepted into memory pool, and again
+ * when accepted into the block chain)
+ */
+class CProofCache
+{
+private:
+    //! Entries are SHA256(nonce || txid || signature hash) for Sapling, and
+    //! SHA256d(nonce || JoinSplit description || joinSplitPubKey) for Sprout:
+    uint256 nonce;
+    typedef boost::unordered_set<uint256, CProofCacheHasher> map_type;
+    map_type setValid;
+    boost::shared_mutex cs_proofcache;
+
+public:
+    CProofCache()
+    {
+        GetRandBytes(nonce.begin(), 32);
+    }
+
+    void
+    ComputeSaplingEntry(uint256& entry, const uint256& txid, const uint256& sighash)
+    {
+        CSHA256().Write(nonce.begin(), 32).Write(txid.begin(), 32).Write(sighash.begin(), 32).Finalize(entry.begin());
+    }
+
+    void
+    ComputeSproutEntry(uint256& entry, const JSDescription& jsdesc, const Ed25519VerificationKey& joinSplitPubKey)
+    {
+        // Serialize the description as in a v4 transaction, which is the
+        // encoding that includes a Groth16 proof.
+        CHashWriter ss(SER_GETHASH, static_cast<int>((1U << 31) | SAPLING_TX_VERSION));
+        ss << nonce << jsdesc;
+        ss.write((const char*)joinSplitPubKey.bytes, ED25519_VERIFICATION_KEY_LEN);
+        entry = ss.GetHash();
+    }
+
+    bool
+    Get(const uint256& entry)
+    {
+        boost::shared_lock<boost::shared_mutex> lock(cs_proofcache);
+        return setValid.count(entry);
+    }
+
+    void Set(const uint256& entry)
+    {
+        size_t nMaxCacheSize = GetArg("-maxproofcachesize", DEFAULT_MAX_PROOF_CACHE_SIZE) * ((size_t) 1 << 20);
+        if (nMaxCacheSize <= 0) return;
+
+        boost::unique_lock<boost::shared_mutex> lock(cs_proofcache);
+        while (memusage::DynamicUsage(setValid) > nMaxCacheSize)
+        {
+            map_type::size_type s = GetRand(setValid.bucket_count());
+            map_type::local_iterator it = setValid.begin(s);
+            if (it != setValid.end(s)) {
+                setValid.erase(*it);
+            }
+        }
+
+        setValid.insert(entry);
+    }
+};
+
+CProofCache proofCache;
+
+}
+
 class SproutProofVerifier
 {
     ProofVerifier& verifier;
@@ -50,22 +141,248 @@ public:
     }
 };
 
+static std::atomic<bool> placeholderProofs{false};
+
+void SetPlaceholderProofs(bool enabled)
+{
+    placeholderProofs = enabled;
+}
+
+bool PlaceholderProofs()
+{
+    return placeholderProofs;
+}
+
+ProofVerifier::ProofVerifier(bool perform_verification, bool batch) :
+    perform_verification(perform_verification),
+    sapling_batch(batch ? librustzcash_sapling_batch_validator_init() : nullptr),
+    joinsplit_sig_batch(batch ? ed25519_batch_validator_init() : nullptr) { }
+
+ProofVerifier::ProofVerifier(ProofVerifier&& other) :
+    perform_verification(other.perform_verification),
+    sapling_batch(other.sapling_batch),
+    sapling_batch_cache_entries(std::move(other.sapling_batch_cache_entries)),
+    joinsplit_sig_batch(other.joinsplit_sig_batch)
+{
+    other.sapling_batch = nullptr;
+    other.joinsplit_sig_batch = nullptr;
+}
+
+ProofVerifier& ProofVerifier::operator=(ProofVerifier&& other)
+{
+    if (this != &other) {
+        if (sapling_batch) {
+            librustzcash_sapling_batch_validator_free(sapling_batch);
+        }
+        if (joinsplit_sig_batch) {
+            ed25519_batch_validator_free(joinsplit_sig_batch);
+        }
+        perform_verification = other.perform_verification;
+        sapling_batch = other.sapling_batch;
+        sapling_batch_cache_entries = std::move(other.sapling_batch_cache_entries);
+        joinsplit_sig_batch = other.joinsplit_sig_batch;
+        other.sapling_batch = nullptr;
+        other.joinsplit_sig_batch = nullptr;
+    }
+    return *this;
+}
+
+ProofVerifier::~ProofVerifier()
+{
+    if (sapling_batch) {
+        librustzcash_sapling_batch_validator_free(sapling_batch);
+    }
+    if (joinsplit_sig_batch) {
+        ed25519_batch_validator_free(joinsplit_sig_batch);
+    }
+}
+
 ProofVerifier ProofVerifier::Strict() {
-    return ProofVerifier(true);
+    return ProofVerifier(true, false);
+}
+
+ProofVerifier ProofVerifier::Batched() {
+    return ProofVerifier(true, true);
 }
 
 ProofVerifier ProofVerifier::Disabled() {
-    return ProofVerifier(false);
+    return ProofVerifier(false, false);
 }
 
 bool ProofVerifier::VerifySprout(
     const JSDescription& jsdesc,
-    const Ed25519VerificationKey& joinSplitPubKey
+    const Ed25519VerificationKey& joinSplitPubKey,
+    bool cacheStore
 ) {
-    if (!perform_verification) {
+    if (!perform_verification || PlaceholderProofs()) {
         return true;
     }
 
+    // PHGR proofs are never verified, so there is no point caching them.
+    bool cacheable = std::holds_alternative<libzcash::GrothProof>(jsdesc.proof);
+    uint256 entry;
+    if (cacheable) {
+        proofCache.ComputeSproutEntry(entry, jsdesc, joinSplitPubKey);
+        if (proofCache.Get(entry)) {
+            return true;
+        }
+    }
+
     auto pv = SproutProofVerifier(*this, joinSplitPubKey, jsdesc);
-    return std::visit(pv, jsdesc.proof);
+    if (!std::visit(pv, jsdesc.proof)) {
+        return false;
+    }
+
+    if (cacheable && cacheStore) {
+        proofCache.Set(entry);
+    }
+    return true;
+}
+
+bool ProofVerifier::VerifyJoinSplitSig(
+    const CTransaction& tx,
+    const uint256& dataToBeSigned
+) {
+    if (joinsplit_sig_batch) {
+        ed25519_batch_validator_queue(
+            joinsplit_sig_batch,
+            &tx.joinSplitPubKey,
+            &tx.joinSplitSig,
+            dataToBeSigned.begin(), 32);
+        return true;
+    }
+
+    return ed25519_verify(&tx.joinSplitPubKey, &tx.joinSplitSig, dataToBeSigned.begin(), 32);
+}
+
+SaplingVerificationResult ProofVerifier::VerifySapling(
+    const CTransaction& tx,
+    const uint256& dataToBeSigned,
+    bool cacheStore
+) {
+    if (!perform_verification || PlaceholderProofs() ||
+        (tx.vShieldedSpend.empty() && tx.vShieldedOutput.empty())) {
+        return SaplingVerificationResult::Valid;
+    }
+
+    uint256 entry;
+    proofCache.ComputeSaplingEntry(entry, tx.GetHash(), dataToBeSigned);
+    if (proofCache.Get(entry)) {
+        return SaplingVerificationResult::Valid;
+    }
+
+    if (sapling_batch) {
+        for (const SpendDescription &spend : tx.vShieldedSpend) {
+            if (!librustzcash_sapling_batch_validator_check_spend(
+                sapling_batch,
+                spend.cv.begin(),
+                spend.anchor.begin(),
+                spend.nullifier.begin(),
+                spend.rk.begin(),
+                spend.zkproof.begin(),
+                spend.spendAuthSig.begin(),
+                dataToBeSigned.begin()))
+            {
+                return SaplingVerificationResult::InvalidSpend;
+            }
+        }
+
+        for (const OutputDescription &output : tx.vShieldedOutput) {
+            if (!librustzcash_sapling_batch_validator_check_output(
+                sapling_batch,
+                output.cv.begin(),
+                output.cmu.begin(),
+                output.ephemeralKey.begin(),
+                output.zkproof.begin()))
+            {
+                return SaplingVerificationResult::InvalidOutput;
+            }
+        }
+
+        if (!librustzcash_sapling_batch_validator_final_check(
+            sapling_batch,
+            tx.valueBalance,
+            tx.bindingSig.begin(),
+            dataToBeSigned.begin()))
+        {
+            return SaplingVerificationResult::InvalidBindingSig;
+        }
+
+        if (cacheStore) {
+            sapling_batch_cache_entries.push_back(entry);
+        }
+        return SaplingVerificationResult::Valid;
+    }
+
+    auto ctx = librustzcash_sapling_verification_ctx_init();
+    auto result = SaplingVerificationResult::Valid;
+
+    for (const SpendDescription &spend : tx.vShieldedSpend) {
+        if (!librustzcash_sapling_check_spend(
+            ctx,
+            spend.cv.begin(),
+            spend.anchor.begin(),
+            spend.nullifier.begin(),
+            spend.rk.begin(),
+            spend.zkproof.begin(),
+            spend.spendAuthSig.begin(),
+            dataToBeSigned.begin()))
+        {
+            result = SaplingVerificationResult::InvalidSpend;
+            break;
+        }
+    }
+
+    if (result == SaplingVerificationResult::Valid) {
+        for (const OutputDescription &output : tx.vShieldedOutput) {
+            if (!librustzcash_sapling_check_output(
+                ctx,
+                output.cv.begin(),
+                output.cmu.begin(),
+                output.ephemeralKey.begin(),
+                output.zkproof.begin()))
+            {
+                result = SaplingVerificationResult::InvalidOutput;
+                break;
+            }
+        }
+    }
+
+    if (result == SaplingVerificationResult::Valid &&
+        !librustzcash_sapling_final_check(
+            ctx,
+            tx.valueBalance,
+            tx.bindingSig.begin(),
+            dataToBeSigned.begin()))
+    {
+        result = SaplingVerificationResult::InvalidBindingSig;
+    }
+
+    librustzcash_sapling_verification_ctx_free(ctx);
+
+    if (result == SaplingVerificationResult::Valid && cacheStore) {
+        proofCache.Set(entry);
+    }
+    return result;
+}
+
+bool ProofVerifier::VerifyBatch()
+{
+    bool valid = true;
+    if (joinsplit_sig_batch) {
+        valid = ed25519_batch_validator_validate(joinsplit_sig_batch);
+    }
+
+    if (perform_verification && sapling_batch) {
+        // The Sapling cache entries only depend on the Sapling proofs.
+        bool saplingValid = librustzcash_sapling_batch_validator_validate(sapling_batch);
+        if (saplingValid) {
+            for (const uint256& entry : sapling_batch_cache_entries) {
+                proofCache.Set(entry);
+            }
+        }
+        sapling_batch_cache_entries.clear();
+        valid = valid && saplingValid;
+    }
+    return valid;
 }
@@ -8,13 +8,48 @@
 #include <primitives/transaction.h>
 #include <uint256.h>
 
-#include <rust/ed25519/types.h>
+#include <rust/ed25519.h>
+
+#include <vector>
+
+// DoS prevention: limit cache size to less than 10MB (over 100000
+// entries on 64-bit systems).
+static const unsigned int DEFAULT_MAX_PROOF_CACHE_SIZE = 10;
+
+// Regtest only (-regtestfastmode): shielded transactions are created with
+// placeholder proofs, and the proofs and Sapling signatures of transactions
+// are not verified, as if every verifier were disabled.
+void SetPlaceholderProofs(bool enabled);
+bool PlaceholderProofs();
+
+/**
+ * The outcome of verifying the Sapling spend descriptions, output
+ * descriptions and binding signature of a transaction.
+ */
+enum class SaplingVerificationResult {
+    Valid,
+    InvalidSpend,
+    InvalidOutput,
+    InvalidBindingSig,
+};
 
 class ProofVerifier {
 private:
     bool perform_verification;
 
-    ProofVerifier(bool perform_verification) : perform_verification(perform_verification) { }
+    // If non-null, a librustzcash batch validator into which Sapling proofs
+    // are accumulated instead of being verified immediately.
+    void* sapling_batch;
+
+    // Proof cache entries for the transactions in sapling_batch,
+    // stored once the batch has been verified.
+    std::vector<uint256> sapling_batch_cache_entries;
+
+    // If non-null, a batch validator into which JoinSplit signatures
+    // are queued instead of being verified immediately.
+    Ed25519BatchValidator* joinsplit_sig_batch;
+
+    ProofVerifier(bool perform_verification, bool batch);
 
 public:
     // ProofVerifier should never be copied
@@ -22,21 +57,69 @@ public:
     ProofVerifier& operator=(const ProofVerifier&) = delete;
     ProofVerifier(ProofVerifier&&);
     ProofVerifier& operator=(ProofVerifier&&);
+    ~ProofVerifier();
 
     // Creates a verification context that strictly verifies
     // all proofs.
     static ProofVerifier Strict();
 
+    // Creates a verification context that strictly verifies
+    // all proofs, but defers the Groth16 proofs of the Sapling
+    // descriptions passed to VerifySapling(), and the signatures
+    // passed to VerifyJoinSplitSig(), until VerifyBatch() is
+    // called, so that those of many transactions can be checked
+    // together.
+    static ProofVerifier Batched();
+
     // Creates a verification context that performs no
     // verification, used when avoiding duplicate effort
     // such as during reindexing.
     static ProofVerifier Disabled();
 
+    // Whether this verifier checks proofs, which a Disabled() one does not.
+    bool PerformsVerification() const { return perform_verification; }
+
     // Verifies that the JoinSplit proof is correct.
+    //
+    // JoinSplits found in the proof cache are not verified again.
+    // If cacheStore is set, JoinSplits that verify are added to
+    // the cache.
     bool VerifySprout(
         const JSDescription& jsdesc,
-        const Ed25519VerificationKey& joinSplitPubKey
+        const Ed25519VerificationKey& joinSplitPubKey,
+        bool cacheStore = false
+    );
+
+    // Verifies the JoinSplit signature of the given transaction
+    // against its signature hash. A batched verifier only queues
+    // it and returns true. Unlike proofs, signatures are verified
+    // even by a disabled verifier.
+    bool VerifyJoinSplitSig(
+        const CTransaction& tx,
+        const uint256& dataToBeSigned
+    );
+
+    // Verifies the Sapling spend and output descriptions and the
+    // binding signature of the given transaction against its
+    // signature hash. For a batched verifier, a Valid result only
+    // means that everything except the Groth16 proofs is valid.
+    //
+    // Transactions found in the proof cache are not verified again.
+    // If cacheStore is set, transactions that verify are added to
+    // the cache (for a batched verifier, once the batch verifies).
+    SaplingVerificationResult VerifySapling(
+        const CTransaction& tx,
+        const uint256& dataToBeSigned,
+        bool cacheStore = false
     );
+
+    // Verifies every Sapling proof and JoinSplit signature deferred
+    // by VerifySapling() and VerifyJoinSplitSig() since the last
+    // call. If this returns false, at least one of them is invalid,
+    // and the transactions must be checked individually to find
+    // out which. Always returns true for verifiers that are not
+    // batched.
+    bool VerifyBatch();
 };
 
 #endif // ZCASH_PROOF_VERIFIER_H
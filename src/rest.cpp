@@ -3,7 +3,10 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or https://www.opensource.org/licenses/mit-license.php .
 
+#include "blockfilter.h"
 #include "chainparams.h"
+#include "compactblockindex.h"
+#include "index/blockindexes.h"
 #include "primitives/block.h"
 #include "primitives/transaction.h"
 #include "main.h"
@@ -11,6 +14,7 @@
 #include "rpc/server.h"
 #include "streams.h"
 #include "sync.h"
+#include "txdb.h"
 #include "txmempool.h"
 #include "utilstrencodings.h"
 #include "version.h"
@@ -23,6 +27,8 @@
 using namespace std;
 
 static const size_t MAX_GETUTXOS_OUTPOINTS = 15; //allow a max of 15 outpoints to be queried at once
+static const long MAX_REST_COMPACT_BLOCKS = 1000; //allow a max of 1000 compact blocks to be queried at once
+static const long MAX_REST_BLOCKS = 2000; //allow a max of 2000 raw blocks to be streamed at once
 
 enum RetFormat {
     RF_UNDEF,
@@ -42,27 +48,57 @@ static const struct {
 };
 
 struct CCoin {
-    uint32_t nTxVer; // Don't call this nVersion, that name has a special meaning inside IMPLEMENT_SERIALIZE
     uint32_t nHeight;
     CTxOut out;
 
     ADD_SERIALIZE_METHODS;
 
+    CCoin() : nHeight(0) {}
+    CCoin(Coin&& in) : nHeight(in.nHeight), out(std::move(in.out)) {}
+
     template <typename Stream, typename Operation>
     inline void SerializationOp(Stream& s, Operation ser_action)
     {
-        READWRITE(nTxVer);
+        // The transaction version is no longer stored with each output, but
+        // a placeholder is kept so that the BIP 64 response format is unchanged.
+        uint32_t nTxVerDummy = 0;
+        READWRITE(nTxVerDummy);
         READWRITE(nHeight);
         READWRITE(out);
     }
 };
 
+/**
+ * A compact block as returned by /rest/compactblocks/: the position of the
+ * block in the chain, followed by its Sapling data.
+ */
+struct CRestCompactBlock {
+    int32_t nHeight;
+    uint256 hash;
+    uint256 hashPrevBlock;
+    uint32_t nTime;
+    CCompactBlock block;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action)
+    {
+        READWRITE(nHeight);
+        READWRITE(hash);
+        READWRITE(hashPrevBlock);
+        READWRITE(nTime);
+        READWRITE(block);
+    }
+};
+
 extern void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue& entry);
 extern UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false);
 extern UniValue mempoolInfoToJSON();
 extern UniValue mempoolToJSON(bool fVerbose = false);
 extern void ScriptPubKeyToJSON(const CScript& scriptPubKey, UniValue& out, bool fIncludeHex);
 extern UniValue blockheaderToJSON(const CBlockIndex* blockindex);
+extern UniValue valuePoolHistoryToJSON(int nStart, int nCount, int nInterval);
 
 static bool RESTERR(HTTPRequest* req, enum HTTPStatusCode status, string message)
 {
@@ -116,6 +152,32 @@ static bool CheckWarmup(HTTPRequest* req)
     return true;
 }
 
+/**
+ * Return the blocks of the active chain from the block hash on, up to count
+ * of them, or none if that block is not in the active chain. This reads the
+ * chain through its published tip, so it does not need cs_main.
+ */
+static std::vector<const CBlockIndex*> ActiveChainFrom(const uint256& hash, long count)
+{
+    std::vector<const CBlockIndex*> blocks;
+    const CBlockIndex* pindex = blockIndexLookup.Lookup(hash);
+    const CBlockIndex* tip = chainActive.AtomicTip();
+    if (pindex == NULL || tip == NULL || pindex->nHeight > tip->nHeight)
+        return blocks;
+
+    // Walk back from the last block, which is found through the skiplist.
+    int nLast = std::min<int64_t>(tip->nHeight, (int64_t)pindex->nHeight + count - 1);
+    const CBlockIndex* pindexWalk = tip->GetAncestor(nLast);
+    blocks.resize(nLast - pindex->nHeight + 1);
+    for (size_t i = blocks.size(); i-- > 0; ) {
+        blocks[i] = pindexWalk;
+        pindexWalk = pindexWalk->pprev;
+    }
+    if (blocks[0] != pindex)
+        blocks.clear();
+    return blocks;
+}
+
 static bool rest_headers(HTTPRequest* req,
                          const std::string& strURIPart)
 {
@@ -138,19 +200,7 @@ static bool rest_headers(HTTPRequest* req,
     if (!ParseHashStr(hashStr, hash))
         return RESTERR(req, HTTP_BAD_REQUEST, "Invalid hash: " + hashStr);
 
-    std::vector<const CBlockIndex *> headers;
-    headers.reserve(count);
-    {
-        LOCK(cs_main);
-        BlockMap::const_iterator it = mapBlockIndex.find(hash);
-        const CBlockIndex *pindex = (it != mapBlockIndex.end()) ? it->second : NULL;
-        while (pindex != NULL && chainActive.Contains(pindex)) {
-            headers.push_back(pindex);
-            if (headers.size() == (unsigned long)count)
-                break;
-            pindex = chainActive.Next(pindex);
-        }
-    }
+    std::vector<const CBlockIndex *> headers = ActiveChainFrom(hash, count);
 
     CDataStream ssHeader(SER_NETWORK, PROTOCOL_VERSION);
     for (const CBlockIndex *pindex : headers) {
@@ -193,6 +243,159 @@ static bool rest_headers(HTTPRequest* req,
     return true; // continue to process further HTTP reqs on this cxn
 }
 
+/**
+ * Find the filter type of a REST request for block filters, and check that
+ * the node keeps an index of them.
+ */
+static bool ParseBlockFilterType(HTTPRequest* req, const std::string& strType, BlockFilterType& filterType)
+{
+    if (!BlockFilterTypeByName(strType, filterType))
+        return RESTERR(req, HTTP_BAD_REQUEST, "Unknown filtertype " + strType);
+    if (!fBlockFilterIndex)
+        return RESTERR(req, HTTP_BAD_REQUEST, "Index is not enabled for filtertype " + strType);
+    if (!IsIndexSynced(g_blockfilterindex))
+        return RESTERR(req, HTTP_SERVICE_UNAVAILABLE, "Index is being built for filtertype " + strType);
+    return true;
+}
+
+static bool rest_block_filter(HTTPRequest* req, const std::string& strURIPart)
+{
+    if (!CheckWarmup(req))
+        return false;
+    vector<string> params;
+    const RetFormat rf = ParseDataFormat(params, strURIPart);
+    vector<string> path;
+    boost::split(path, params[0], boost::is_any_of("/"));
+
+    if (path.size() != 2)
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid URI format. Expected /rest/blockfilter/<filtertype>/<blockhash>.<ext>.");
+
+    BlockFilterType filterType;
+    if (!ParseBlockFilterType(req, path[0], filterType))
+        return false;
+
+    uint256 hash;
+    if (!ParseHashStr(path[1], hash))
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid hash: " + path[1]);
+
+    const CBlockIndex* pindex;
+    {
+        LOCK(cs_main);
+        BlockMap::const_iterator it = mapBlockIndex.find(hash);
+        if (it == mapBlockIndex.end() || !it->second->IsValid(BLOCK_VALID_SCRIPTS))
+            return RESTERR(req, HTTP_NOT_FOUND, path[1] + " not found");
+        pindex = it->second;
+    }
+
+    CBlockFilterEntry entry;
+    if (!LookupBlockFilter(pindex, entry))
+        return RESTERR(req, HTTP_NOT_FOUND, "Filter not found for " + path[1]);
+
+    CDataStream ssFilter(SER_NETWORK, PROTOCOL_VERSION);
+    ssFilter << static_cast<uint8_t>(filterType) << hash << entry.vFilter;
+
+    switch (rf) {
+    case RF_BINARY: {
+        string binaryFilter = ssFilter.str();
+        req->WriteHeader("Content-Type", "application/octet-stream");
+        req->WriteReply(HTTP_OK, binaryFilter);
+        return true;
+    }
+    case RF_HEX: {
+        string strHex = HexStr(ssFilter.begin(), ssFilter.end()) + "\n";
+        req->WriteHeader("Content-Type", "text/plain");
+        req->WriteReply(HTTP_OK, strHex);
+        return true;
+    }
+    case RF_JSON: {
+        UniValue ret(UniValue::VOBJ);
+        ret.pushKV("filter", HexStr(entry.vFilter));
+        ret.pushKV("header", entry.header.GetHex());
+        string strJSON = ret.write() + "\n";
+        req->WriteHeader("Content-Type", "application/json");
+        req->WriteReply(HTTP_OK, strJSON);
+        return true;
+    }
+    default: {
+        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: " + AvailableDataFormatsString() + ")");
+    }
+    }
+}
+
+static bool rest_block_filter_headers(HTTPRequest* req, const std::string& strURIPart)
+{
+    if (!CheckWarmup(req))
+        return false;
+    vector<string> params;
+    const RetFormat rf = ParseDataFormat(params, strURIPart);
+    vector<string> path;
+    boost::split(path, params[0], boost::is_any_of("/"));
+
+    if (path.size() != 3)
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid URI format. Expected /rest/blockfilterheaders/<filtertype>/<count>/<blockhash>.<ext>.");
+
+    BlockFilterType filterType;
+    if (!ParseBlockFilterType(req, path[0], filterType))
+        return false;
+
+    long count = strtol(path[1].c_str(), NULL, 10);
+    if (count < 1 || count > MAX_GETCFHEADERS_SIZE)
+        return RESTERR(req, HTTP_BAD_REQUEST, "Header count out of range: " + path[1]);
+
+    uint256 hash;
+    if (!ParseHashStr(path[2], hash))
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid hash: " + path[2]);
+
+    // As for /rest/headers/, the headers of the blocks of the active chain
+    // from the given one on.
+    std::vector<const CBlockIndex*> blocks = ActiveChainFrom(hash, count);
+
+    std::vector<uint256> headers;
+    headers.reserve(blocks.size());
+    for (const CBlockIndex* pindex : blocks) {
+        CBlockFilterEntry entry;
+        if (!LookupBlockFilter(pindex, entry))
+            return RESTERR(req, HTTP_NOT_FOUND, "Filter not found for " + pindex->GetBlockHash().GetHex());
+        headers.push_back(entry.header);
+    }
+
+    switch (rf) {
+    case RF_BINARY: {
+        CDataStream ssHeaders(SER_NETWORK, PROTOCOL_VERSION);
+        for (const uint256& header : headers) {
+            ssHeaders << header;
+        }
+        string binaryHeaders = ssHeaders.str();
+        req->WriteHeader("Content-Type", "application/octet-stream");
+        req->WriteReply(HTTP_OK, binaryHeaders);
+        return true;
+    }
+    case RF_HEX: {
+        CDataStream ssHeaders(SER_NETWORK, PROTOCOL_VERSION);
+        for (const uint256& header : headers) {
+            ssHeaders << header;
+        }
+        string strHex = HexStr(ssHeaders.begin(), ssHeaders.end()) + "\n";
+        req->WriteHeader("Content-Type", "text/plain");
+        req->WriteReply(HTTP_OK, strHex);
+        return true;
+    }
+    case RF_JSON: {
+        UniValue jsonHeaders(UniValue::VARR);
+        for (const uint256& header : headers) {
+            jsonHeaders.push_back(header.GetHex());
+        }
+        string strJSON = jsonHeaders.write() + "\n";
+        req->WriteHeader("Content-Type", "application/json");
+        req->WriteReply(HTTP_OK, strJSON);
+        return true;
+    }
+    default: {
+        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: " + AvailableDataFormatsString() + ")");
+    }
+    }
+}
+
 static bool rest_block(HTTPRequest* req,
                        const std::string& strURIPart,
                        bool showTxDetails)
@@ -208,6 +411,7 @@ static bool rest_block(HTTPRequest* req,
         return RESTERR(req, HTTP_BAD_REQUEST, "Invalid hash: " + hashStr);
 
     CBlock block;
+    CRawBlock rawBlock;
     CBlockIndex* pblockindex = NULL;
     {
         LOCK(cs_main);
@@ -218,23 +422,24 @@ static bool rest_block(HTTPRequest* req,
         if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
             return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not available (pruned data)");
 
-        if (!ReadBlockFromDisk(block, pblockindex, Params().GetConsensus()))
+        // The binary and hex formats are the block as it is stored.
+        if (rf == RF_BINARY || rf == RF_HEX) {
+            if (!ReadRawBlockFromDisk(rawBlock, pblockindex, Params().MessageStart()))
+                return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not found");
+        } else if (!ReadBlockFromDisk(block, pblockindex, Params().GetConsensus()))
             return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not found");
     }
 
-    CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
-    ssBlock << block;
-
     switch (rf) {
     case RF_BINARY: {
-        string binaryBlock = ssBlock.str();
+        string binaryBlock(rawBlock.begin(), rawBlock.end());
         req->WriteHeader("Content-Type", "application/octet-stream");
         req->WriteReply(HTTP_OK, binaryBlock);
         return true;
     }
 
     case RF_HEX: {
-        string strHex = HexStr(ssBlock.begin(), ssBlock.end()) + "\n";
+        string strHex = HexStr(rawBlock.begin(), rawBlock.end()) + "\n";
         req->WriteHeader("Content-Type", "text/plain");
         req->WriteReply(HTTP_OK, strHex);
         return true;
@@ -271,6 +476,72 @@ static bool rest_block_notxdetails(HTTPRequest* req, const std::string& strURIPa
     return rest_block(req, strURIPart, false);
 }
 
+static bool rest_blocks(HTTPRequest* req, const std::string& strURIPart)
+{
+    if (!CheckWarmup(req))
+        return false;
+    vector<string> params;
+    const RetFormat rf = ParseDataFormat(params, strURIPart);
+    vector<string> path;
+    boost::split(path, params[0], boost::is_any_of("/"));
+
+    if (path.size() != 2)
+        return RESTERR(req, HTTP_BAD_REQUEST, "No block count specified. Use /rest/blocks/<height>/<count>.<ext>.");
+
+    int32_t height;
+    if (!ParseInt32(path[0], &height) || height < 0)
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid height: " + path[0]);
+
+    long count = strtol(path[1].c_str(), NULL, 10);
+    if (count < 1 || count > MAX_REST_BLOCKS)
+        return RESTERR(req, HTTP_BAD_REQUEST, "Block count out of range: " + path[1]);
+
+    if (rf != RF_BINARY && rf != RF_HEX)
+        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: .bin, .hex)");
+
+    // Only the lookup of the blocks needs cs_main; they are read afterwards.
+    std::vector<const CBlockIndex*> blocks;
+    {
+        LOCK(cs_main);
+        if (height > chainActive.Height())
+            return RESTERR(req, HTTP_NOT_FOUND, "Block height out of range: " + path[0]);
+        for (int h = height; h <= chainActive.Height() && blocks.size() < (size_t)count; h++) {
+            const CBlockIndex* pindex = chainActive[h];
+            if (fHavePruned && !(pindex->nStatus & BLOCK_HAVE_DATA) && pindex->nTx > 0)
+                return RESTERR(req, HTTP_NOT_FOUND, pindex->GetBlockHash().GetHex() + " not available (pruned data)");
+            blocks.push_back(pindex);
+        }
+    }
+
+    // The first block is read before the reply is started, so that a
+    // missing block can still be reported as an error.
+    CRawBlock rawBlock;
+    if (!ReadRawBlockFromDisk(rawBlock, blocks[0], Params().MessageStart()))
+        return RESTERR(req, HTTP_NOT_FOUND, blocks[0]->GetBlockHash().GetHex() + " not found");
+
+    // The blocks are streamed one at a time as they are read, as the blocks
+    // of a range can be far too large to be held in memory together. If a
+    // block cannot be read or the client goes away, the reply ends early;
+    // clients can tell from the number of blocks they have parsed.
+    req->WriteHeader("Content-Type", rf == RF_BINARY ? "application/octet-stream" : "text/plain");
+    req->StartChunkedReply(HTTP_OK);
+    for (size_t i = 0; i < blocks.size(); i++) {
+        if (i > 0 && !ReadRawBlockFromDisk(rawBlock, blocks[i], Params().MessageStart()))
+            break;
+        bool fSent;
+        if (rf == RF_BINARY) {
+            fSent = req->WriteChunk(rawBlock.begin(), rawBlock.size());
+        } else {
+            string strHex = HexStr(rawBlock.begin(), rawBlock.end()) + "\n";
+            fSent = req->WriteChunk(strHex.data(), strHex.size());
+        }
+        if (!fSent)
+            break;
+    }
+    req->EndChunkedReply();
+    return true;
+}
+
 // A bit of a hack - dependency on a function defined in rpc/blockchain.cpp
 UniValue getblockchaininfo(const UniValue& params, bool fHelp);
 
@@ -299,6 +570,177 @@ static bool rest_chaininfo(HTTPRequest* req, const std::string& strURIPart)
     return true; // continue to process further HTTP reqs on this cxn
 }
 
+static bool rest_valuepools(HTTPRequest* req, const std::string& strURIPart)
+{
+    if (!CheckWarmup(req))
+        return false;
+    vector<string> params;
+    const RetFormat rf = ParseDataFormat(params, strURIPart);
+    vector<string> path;
+    boost::split(path, params[0], boost::is_any_of("/"));
+
+    if (path.size() < 2 || path.size() > 3)
+        return RESTERR(req, HTTP_BAD_REQUEST, "No block count specified. Use /rest/valuepools/<count>/<height>[/<interval>].<ext>.");
+
+    long count = strtol(path[0].c_str(), NULL, 10);
+    if (count < 1 || count > 2000)
+        return RESTERR(req, HTTP_BAD_REQUEST, "Block count out of range: " + path[0]);
+
+    int32_t height;
+    if (!ParseInt32(path[1], &height) || height < 0)
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid height: " + path[1]);
+
+    int32_t interval = 1;
+    if (path.size() == 3 && (!ParseInt32(path[2], &interval) || interval < 1))
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid interval: " + path[2]);
+
+    switch (rf) {
+    case RF_JSON: {
+        UniValue history;
+        {
+            LOCK(cs_main);
+            if (height > chainActive.Height())
+                return RESTERR(req, HTTP_NOT_FOUND, "Block height out of range: " + path[1]);
+            history = valuePoolHistoryToJSON(height, count, interval);
+        }
+        string strJSON = history.write() + "\n";
+        req->WriteHeader("Content-Type", "application/json");
+        req->WriteReply(HTTP_OK, strJSON);
+        return true;
+    }
+    default: {
+        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: json)");
+    }
+    }
+
+    // not reached
+    return true; // continue to process further HTTP reqs on this cxn
+}
+
+static UniValue CompactBlockToJSON(const CRestCompactBlock& entry)
+{
+    UniValue result(UniValue::VOBJ);
+    result.pushKV("height", entry.nHeight);
+    result.pushKV("hash", entry.hash.GetHex());
+    result.pushKV("previousblockhash", entry.hashPrevBlock.GetHex());
+    result.pushKV("time", (int64_t)entry.nTime);
+    UniValue txs(UniValue::VARR);
+    for (const CCompactTx& ctx : entry.block.vtx) {
+        UniValue tx(UniValue::VOBJ);
+        tx.pushKV("txid", ctx.hash.GetHex());
+        UniValue spends(UniValue::VARR);
+        for (const uint256& nullifier : ctx.vSaplingNullifiers) {
+            spends.push_back(nullifier.GetHex());
+        }
+        tx.pushKV("spends", spends);
+        UniValue outputs(UniValue::VARR);
+        for (const CCompactSaplingOutput& output : ctx.vSaplingOutputs) {
+            UniValue out(UniValue::VOBJ);
+            out.pushKV("cmu", output.cmu.GetHex());
+            out.pushKV("epk", output.epk.GetHex());
+            out.pushKV("ciphertext", HexStr(output.ciphertext.begin(), output.ciphertext.end()));
+            outputs.push_back(out);
+        }
+        tx.pushKV("outputs", outputs);
+        txs.push_back(tx);
+    }
+    result.pushKV("vtx", txs);
+    return result;
+}
+
+static bool rest_compactblocks(HTTPRequest* req, const std::string& strURIPart)
+{
+    if (!CheckWarmup(req))
+        return false;
+    vector<string> params;
+    const RetFormat rf = ParseDataFormat(params, strURIPart);
+    vector<string> path;
+    boost::split(path, params[0], boost::is_any_of("/"));
+
+    if (path.size() != 2)
+        return RESTERR(req, HTTP_BAD_REQUEST, "No block count specified. Use /rest/compactblocks/<count>/<height>.<ext>.");
+
+    long count = strtol(path[0].c_str(), NULL, 10);
+    if (count < 1 || count > MAX_REST_COMPACT_BLOCKS)
+        return RESTERR(req, HTTP_BAD_REQUEST, "Block count out of range: " + path[0]);
+
+    int32_t height;
+    if (!ParseInt32(path[1], &height) || height < 0)
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid height: " + path[1]);
+
+    if (rf != RF_BINARY && rf != RF_HEX && rf != RF_JSON)
+        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: " + AvailableDataFormatsString() + ")");
+
+    // Only the lookup of the blocks needs cs_main; they are read afterwards.
+    std::vector<const CBlockIndex*> blocks;
+    {
+        LOCK(cs_main);
+        if (height > chainActive.Height())
+            return RESTERR(req, HTTP_NOT_FOUND, "Block height out of range: " + path[1]);
+        for (int h = height; h <= chainActive.Height() && blocks.size() < (size_t)count; h++) {
+            const CBlockIndex* pindex = chainActive[h];
+            if (fHavePruned && !(pindex->nStatus & BLOCK_HAVE_DATA) && pindex->nTx > 0)
+                return RESTERR(req, HTTP_NOT_FOUND, pindex->GetBlockHash().GetHex() + " not available (pruned data)");
+            blocks.push_back(pindex);
+        }
+    }
+
+    switch (rf) {
+    case RF_BINARY:
+        req->WriteHeader("Content-Type", "application/octet-stream");
+        break;
+    case RF_HEX:
+        req->WriteHeader("Content-Type", "text/plain");
+        break;
+    default:
+        req->WriteHeader("Content-Type", "application/json");
+        req->WriteBody("[", 1);
+        break;
+    }
+
+    // The compact blocks are passed on one at a time as they are read, using
+    // the compact block index when it has them.
+    for (size_t i = 0; i < blocks.size(); i++) {
+        const CBlockIndex* pindex = blocks[i];
+        CRestCompactBlock entry;
+        entry.nHeight = pindex->nHeight;
+        entry.hash = pindex->GetBlockHash();
+        entry.hashPrevBlock = pindex->pprev ? pindex->pprev->GetBlockHash() : uint256();
+        entry.nTime = pindex->nTime;
+        if (!(fCompactBlockIndex && pblocktree->ReadCompactBlock(entry.hash, entry.block))) {
+            CBlock block;
+            if (!ReadBlockFromDisk(block, pindex, Params().GetConsensus())) {
+                req->DiscardBody();
+                return RESTERR(req, HTTP_NOT_FOUND, entry.hash.GetHex() + " not found");
+            }
+            entry.block = CCompactBlock(block);
+        }
+
+        if (rf == RF_JSON) {
+            string strJSON = CompactBlockToJSON(entry).write();
+            if (i > 0)
+                req->WriteBody(",", 1);
+            req->WriteBody(strJSON.data(), strJSON.size());
+        } else {
+            CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
+            ssBlock << entry;
+            if (rf == RF_BINARY) {
+                req->WriteBody(&ssBlock[0], ssBlock.size());
+            } else {
+                string strHex = HexStr(ssBlock.begin(), ssBlock.end());
+                req->WriteBody(strHex.data(), strHex.size());
+            }
+        }
+    }
+
+    if (rf == RF_JSON)
+        req->WriteBody("]\n", 2);
+    else if (rf == RF_HEX)
+        req->WriteBody("\n", 1);
+    req->WriteReply(HTTP_OK);
+    return true;
+}
+
 static bool rest_mempool_info(HTTPRequest* req, const std::string& strURIPart)
 {
     if (!CheckWarmup(req))
@@ -363,11 +805,16 @@ static bool rest_tx(HTTPRequest* req, const std::string& strURIPart)
 
     CTransaction tx;
     uint256 hashBlock = uint256();
-    if (!GetTransaction(hash, tx, Params().GetConsensus(), hashBlock, true))
-        return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not found");
-
     CDataStream ssTx(SER_NETWORK, PROTOCOL_VERSION);
-    ssTx << tx;
+    std::vector<char> vTx;
+    if (rf != RF_JSON && GetTransactionData(hash, vTx, hashBlock)) {
+        // The serialization is all that is returned.
+        ssTx.write(vTx.data(), vTx.size());
+    } else {
+        if (!GetTransaction(hash, tx, Params().GetConsensus(), hashBlock, true))
+            return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not found");
+        ssTx << tx;
+    }
 
     switch (rf) {
     case RF_BINARY: {
@@ -514,21 +961,10 @@ static bool rest_getutxos(HTTPRequest* req, const std::string& strURIPart)
             view.SetBackend(viewMempool); // switch cache backend to db+mempool in case user likes to query mempool
 
         for (size_t i = 0; i < vOutPoints.size(); i++) {
-            CCoins coins;
-            uint256 hash = vOutPoints[i].hash;
-            if (view.GetCoins(hash, coins)) {
-                mempool.pruneSpent(hash, coins);
-                if (coins.IsAvailable(vOutPoints[i].n)) {
-                    hits[i] = true;
-                    // Safe to index into vout here because IsAvailable checked if it's off the end of the array, or if
-                    // n is valid but points to an already spent output (IsNull).
-                    CCoin coin;
-                    coin.nTxVer = coins.nVersion;
-                    coin.nHeight = coins.nHeight;
-                    coin.out = coins.vout.at(vOutPoints[i].n);
-                    assert(!coin.out.IsNull());
-                    outs.push_back(coin);
-                }
+            Coin coin;
+            if (view.GetCoin(vOutPoints[i], coin) && !mempool.isSpent(vOutPoints[i])) {
+                hits[i] = true;
+                outs.emplace_back(std::move(coin));
             }
 
             bitmapStringRepresentation.append(hits[i] ? "1" : "0"); // form a binary string representation (human-readable for json output)
@@ -571,7 +1007,6 @@ static bool rest_getutxos(HTTPRequest* req, const std::string& strURIPart)
         UniValue utxos(UniValue::VARR);
         for (const CCoin& coin : outs) {
             UniValue utxo(UniValue::VOBJ);
-            utxo.pushKV("txvers", (int32_t)coin.nTxVer);
             utxo.pushKV("height", (int32_t)coin.nHeight);
             utxo.pushKV("value", ValueFromAmount(coin.out.nValue));
 
@@ -605,10 +1040,15 @@ static const struct {
       {"/rest/tx/", rest_tx},
       {"/rest/block/notxdetails/", rest_block_notxdetails},
       {"/rest/block/", rest_block_extended},
+      {"/rest/blocks/", rest_blocks},
       {"/rest/chaininfo", rest_chaininfo},
+      {"/rest/valuepools/", rest_valuepools},
+      {"/rest/compactblocks/", rest_compactblocks},
       {"/rest/mempool/info", rest_mempool_info},
       {"/rest/mempool/contents", rest_mempool_contents},
       {"/rest/headers/", rest_headers},
+      {"/rest/blockfilter/", rest_block_filter},
+      {"/rest/blockfilterheaders/", rest_block_filter_headers},
       {"/rest/getutxos", rest_getutxos},
 };
 
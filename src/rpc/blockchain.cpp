@@ -4,11 +4,13 @@
 // file COPYING or https://www.opensource.org/licenses/mit-license.php .
 
 #include "amount.h"
+#include "blockcorpus.h"
 #include "chain.h"
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "consensus/validation.h"
 #include "experimental_features.h"
+#include "index/blockindexes.h"
 #include "key_io.h"
 #include "main.h"
 #include "metrics.h"
@@ -17,16 +19,29 @@
 #include "streams.h"
 #include "sync.h"
 #include "util.h"
+#include "validationinterface.h"
+#include "zcash/util.h"
+#ifdef ENABLE_WALLET
+#include "wallet/wallet.h"
+#endif
 
 #include <stdint.h>
 
 #include <univalue.h>
 
+#include <rust/metrics.h>
+
+#include <deque>
+#include <memory>
+#include <mutex>
 #include <optional>
 #include <regex>
 
 using namespace std;
 
+/** The maximum number of blocks returned by getvaluepoolhistory. */
+static const int MAX_VALUE_POOL_HISTORY = 2000;
+
 extern void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue& entry);
 void ScriptPubKeyToJSON(const CScript& scriptPubKey, UniValue& out, bool fIncludeHex);
 
@@ -101,35 +116,58 @@ static UniValue ValuePoolDesc(
     return rv;
 }
 
-UniValue blockheaderToJSON(const CBlockIndex* blockindex)
+/**
+ * A copy of a block's index entry and of its place in the active chain,
+ * taken under cs_main, from which a reply about the block can be built
+ * without holding cs_main.
+ */
+struct BlockIndexInfo {
+    CBlockIndex index;
+    //! -1 if the block is not on the main chain.
+    int confirmations;
+    const CBlockIndex* pnext;
+};
+
+static BlockIndexInfo GetBlockIndexInfo(const CBlockIndex* blockindex)
 {
     AssertLockHeld(cs_main);
-    UniValue result(UniValue::VOBJ);
-    result.pushKV("hash", blockindex->GetBlockHash().GetHex());
-    int confirmations = -1;
+    BlockIndexInfo info{*blockindex, -1, chainActive.Next(blockindex)};
     // Only report confirmations if the block is on the main chain
     if (chainActive.Contains(blockindex))
-        confirmations = chainActive.Height() - blockindex->nHeight + 1;
-    result.pushKV("confirmations", confirmations);
+        info.confirmations = chainActive.Height() - blockindex->nHeight + 1;
+    return info;
+}
+
+static UniValue blockheaderToJSON(const BlockIndexInfo& info)
+{
+    const CBlockIndex* blockindex = &info.index;
+    UniValue result(UniValue::VOBJ);
+    result.pushKV("hash", blockindex->GetBlockHash().GetHex());
+    result.pushKV("confirmations", info.confirmations);
     result.pushKV("height", blockindex->nHeight);
     result.pushKV("version", blockindex->nVersion);
     result.pushKV("merkleroot", blockindex->hashMerkleRoot.GetHex());
     result.pushKV("finalsaplingroot", blockindex->hashFinalSaplingRoot.GetHex());
     result.pushKV("time", (int64_t)blockindex->nTime);
     result.pushKV("nonce", blockindex->nNonce.GetHex());
-    result.pushKV("solution", HexStr(blockindex->nSolution));
+    result.pushKV("solution", HexStr(blockindex->GetSolution()));
     result.pushKV("bits", strprintf("%08x", blockindex->nBits));
     result.pushKV("difficulty", GetDifficulty(blockindex));
     result.pushKV("chainwork", blockindex->nChainWork.GetHex());
 
     if (blockindex->pprev)
         result.pushKV("previousblockhash", blockindex->pprev->GetBlockHash().GetHex());
-    CBlockIndex *pnext = chainActive.Next(blockindex);
-    if (pnext)
-        result.pushKV("nextblockhash", pnext->GetBlockHash().GetHex());
+    if (info.pnext)
+        result.pushKV("nextblockhash", info.pnext->GetBlockHash().GetHex());
     return result;
 }
 
+UniValue blockheaderToJSON(const CBlockIndex* blockindex)
+{
+    AssertLockHeld(cs_main);
+    return blockheaderToJSON(GetBlockIndexInfo(blockindex));
+}
+
 // insightexplorer
 UniValue blockToDeltasJSON(const CBlock& block, const CBlockIndex* blockindex)
 {
@@ -175,10 +213,10 @@ UniValue blockToDeltasJSON(const CBlock& block, const CBlockIndex* blockindex)
                 delta.pushKV("prevtxid", input.prevout.hash.GetHex());
                 delta.pushKV("prevout", (int)input.prevout.n);
 
-                inputs.push_back(delta);
+                inputs.push_back(std::move(delta));
             }
         }
-        entry.pushKV("inputs", inputs);
+        entry.pushKV("inputs", std::move(inputs));
 
         UniValue outputs(UniValue::VARR);
         for (unsigned int k = 0; k < tx.vout.size(); k++) {
@@ -198,12 +236,12 @@ UniValue blockToDeltasJSON(const CBlock& block, const CBlockIndex* blockindex)
             delta.pushKV("satoshis", out.nValue);
             delta.pushKV("index", (int)k);
 
-            outputs.push_back(delta);
+            outputs.push_back(std::move(delta));
         }
-        entry.pushKV("outputs", outputs);
-        deltas.push_back(entry);
+        entry.pushKV("outputs", std::move(outputs));
+        deltas.push_back(std::move(entry));
     }
-    result.pushKV("deltas", deltas);
+    result.pushKV("deltas", std::move(deltas));
     result.pushKV("time", block.GetBlockTime());
     result.pushKV("mediantime", (int64_t)blockindex->GetMedianTimePast());
     result.pushKV("nonce", block.nNonce.GetHex());
@@ -219,35 +257,27 @@ UniValue blockToDeltasJSON(const CBlock& block, const CBlockIndex* blockindex)
     return result;
 }
 
-UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false)
+// The fields of blockToJSON that come before "tx".
+static UniValue blockHeaderFieldsToJSON(const CBlock& block, const BlockIndexInfo& info)
 {
-    AssertLockHeld(cs_main);
+    const CBlockIndex* blockindex = &info.index;
     UniValue result(UniValue::VOBJ);
     result.pushKV("hash", block.GetHash().GetHex());
-    int confirmations = -1;
-    // Only report confirmations if the block is on the main chain
-    if (chainActive.Contains(blockindex))
-        confirmations = chainActive.Height() - blockindex->nHeight + 1;
-    result.pushKV("confirmations", confirmations);
+    result.pushKV("confirmations", info.confirmations);
     result.pushKV("size", (int)::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION));
     result.pushKV("height", blockindex->nHeight);
     result.pushKV("version", block.nVersion);
     result.pushKV("merkleroot", block.hashMerkleRoot.GetHex());
     result.pushKV("finalsaplingroot", blockindex->hashFinalSaplingRoot.GetHex());
     result.pushKV("chainhistoryroot", blockindex->hashChainHistoryRoot.GetHex());
-    UniValue txs(UniValue::VARR);
-    for (const CTransaction&tx : block.vtx)
-    {
-        if(txDetails)
-        {
-            UniValue objTx(UniValue::VOBJ);
-            TxToJSON(tx, uint256(), objTx);
-            txs.push_back(objTx);
-        }
-        else
-            txs.push_back(tx.GetHash().GetHex());
-    }
-    result.pushKV("tx", txs);
+    return result;
+}
+
+// The fields of blockToJSON that come after "tx".
+static UniValue blockTrailerFieldsToJSON(const CBlock& block, const BlockIndexInfo& info)
+{
+    const CBlockIndex* blockindex = &info.index;
+    UniValue result(UniValue::VOBJ);
     result.pushKV("time", block.GetBlockTime());
     result.pushKV("nonce", block.nNonce.GetHex());
     result.pushKV("solution", HexStr(block.nSolution));
@@ -259,16 +289,215 @@ UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool tx
     UniValue valuePools(UniValue::VARR);
     valuePools.push_back(ValuePoolDesc("sprout", blockindex->nChainSproutValue, blockindex->nSproutValue));
     valuePools.push_back(ValuePoolDesc("sapling", blockindex->nChainSaplingValue, blockindex->nSaplingValue));
-    result.pushKV("valuePools", valuePools);
+    result.pushKV("valuePools", std::move(valuePools));
 
     if (blockindex->pprev)
         result.pushKV("previousblockhash", blockindex->pprev->GetBlockHash().GetHex());
-    CBlockIndex *pnext = chainActive.Next(blockindex);
-    if (pnext)
-        result.pushKV("nextblockhash", pnext->GetBlockHash().GetHex());
+    if (info.pnext)
+        result.pushKV("nextblockhash", info.pnext->GetBlockHash().GetHex());
+    return result;
+}
+
+static UniValue blockToJSON(const CBlock& block, const BlockIndexInfo& info, bool txDetails)
+{
+    UniValue result = blockHeaderFieldsToJSON(block, info);
+    UniValue txs(UniValue::VARR);
+    for (const CTransaction&tx : block.vtx)
+    {
+        if(txDetails)
+        {
+            UniValue objTx(UniValue::VOBJ);
+            TxToJSON(tx, uint256(), objTx);
+            txs.push_back(std::move(objTx));
+        }
+        else
+            txs.push_back(tx.GetHash().GetHex());
+    }
+    result.pushKV("tx", std::move(txs));
+    result.pushKVs(blockTrailerFieldsToJSON(block, info));
     return result;
 }
 
+UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false)
+{
+    AssertLockHeld(cs_main);
+    return blockToJSON(block, GetBlockIndexInfo(blockindex), txDetails);
+}
+
+// Same as blockToJSON, but writes each transaction out as soon as it has been
+// converted, so that only one is held as a UniValue at a time.
+static void blockToJSON(const CBlock& block, const BlockIndexInfo& info, bool txDetails, JSONStreamWriter& out)
+{
+    out.BeginObject();
+    out.Fields(blockHeaderFieldsToJSON(block, info));
+    out.Key("tx");
+    out.BeginArray();
+    for (const CTransaction&tx : block.vtx)
+    {
+        if(txDetails)
+        {
+            UniValue objTx(UniValue::VOBJ);
+            TxToJSON(tx, uint256(), objTx);
+            out.Value(objTx);
+        }
+        else
+            out.Value(tx.GetHash().GetHex());
+    }
+    out.EndArray();
+    out.Fields(blockTrailerFieldsToJSON(block, info));
+    out.EndObject();
+}
+
+// Recent blocks
+
+/**
+ * The getblock results of the most recently connected blocks, which
+ * explorers and light wallet servers request over and over. Each block is
+ * added with its serialization as it is connected, and is dropped again when
+ * it is disconnected. Its JSON is rendered the first time it is requested at
+ * each verbosity. Only the confirmations and the next block hash of a block
+ * change as the chain grows; they are filled in for each request.
+ */
+class CRecentBlockCache : public CValidationInterface
+{
+private:
+    struct Entry {
+        uint256 hash;
+        std::shared_ptr<const std::string> raw;
+        //! The fields before and after "tx", without "nextblockhash".
+        UniValue header;
+        UniValue trailer;
+        //! The serialized "tx" array, of txids and of transactions.
+        std::shared_ptr<const std::string> txs[2];
+    };
+
+    std::mutex cs;
+    //! Most recently connected last.
+    std::deque<Entry> entries;
+    const size_t nMaxBlocks;
+
+    Entry* Find(const uint256& hash)
+    {
+        for (auto it = entries.rbegin(); it != entries.rend(); ++it) {
+            if (it->hash == hash)
+                return &*it;
+        }
+        return nullptr;
+    }
+
+protected:
+    void ChainTip(const CBlockIndex *pindex, const CBlock *pblock,
+                  std::optional<std::pair<SproutMerkleTree, SaplingMerkleTree>> added)
+    {
+        if (!added.has_value()) {
+            std::lock_guard<std::mutex> lock(cs);
+            for (auto it = entries.begin(); it != entries.end(); ++it) {
+                if (it->hash == pindex->GetBlockHash()) {
+                    entries.erase(it);
+                    break;
+                }
+            }
+            return;
+        }
+
+        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+        ss << *pblock;
+        Entry entry;
+        entry.hash = pindex->GetBlockHash();
+        entry.raw = std::make_shared<const std::string>(ss.begin(), ss.end());
+
+        std::lock_guard<std::mutex> lock(cs);
+        entries.push_back(std::move(entry));
+        while (entries.size() > nMaxBlocks)
+            entries.pop_front();
+    }
+
+public:
+    explicit CRecentBlockCache(size_t nMaxBlocksIn) : nMaxBlocks(nMaxBlocksIn) {}
+
+    std::shared_ptr<const std::string> GetRaw(const uint256& hash)
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        Entry* entry = Find(hash);
+        if (entry == nullptr) {
+            MetricsIncrementCounter("zcash.rpc.blockcache.misses");
+            return nullptr;
+        }
+        MetricsIncrementCounter("zcash.rpc.blockcache.hits");
+        return entry->raw;
+    }
+
+    /**
+     * Get the parts of the JSON of a block, if it is in the cache, with the
+     * confirmations and next block hash of info.
+     */
+    bool GetJSON(const BlockIndexInfo& info, bool txDetails,
+                 UniValue& header, std::shared_ptr<const std::string>& txs, UniValue& trailer)
+    {
+        const uint256 hash = info.index.GetBlockHash();
+        std::shared_ptr<const std::string> raw;
+        {
+            std::lock_guard<std::mutex> lock(cs);
+            Entry* entry = Find(hash);
+            if (entry == nullptr) {
+                MetricsIncrementCounter("zcash.rpc.blockcache.misses");
+                return false;
+            }
+            MetricsIncrementCounter("zcash.rpc.blockcache.hits");
+            if (entry->txs[txDetails]) {
+                header = entry->header;
+                txs = entry->txs[txDetails];
+                trailer = entry->trailer;
+            } else {
+                raw = entry->raw;
+            }
+        }
+
+        if (raw) {
+            // Render the block outside the lock, from its serialization.
+            CBlock block;
+            CDataStream ss(raw->data(), raw->data() + raw->size(), SER_NETWORK, PROTOCOL_VERSION);
+            ss >> block;
+            BlockIndexInfo infoFixed{info.index, -1, nullptr};
+            header = blockHeaderFieldsToJSON(block, infoFixed);
+            trailer = blockTrailerFieldsToJSON(block, infoFixed);
+            UniValue arrTxs(UniValue::VARR);
+            for (const CTransaction& tx : block.vtx) {
+                if (txDetails) {
+                    UniValue objTx(UniValue::VOBJ);
+                    TxToJSON(tx, uint256(), objTx);
+                    arrTxs.push_back(objTx);
+                } else {
+                    arrTxs.push_back(tx.GetHash().GetHex());
+                }
+            }
+            txs = std::make_shared<const std::string>(arrTxs.write());
+
+            std::lock_guard<std::mutex> lock(cs);
+            Entry* entry = Find(hash);
+            if (entry != nullptr) {
+                entry->header = header;
+                entry->trailer = trailer;
+                entry->txs[txDetails] = txs;
+            }
+        }
+
+        header.pushKV("confirmations", info.confirmations);
+        if (info.pnext)
+            trailer.pushKV("nextblockhash", info.pnext->GetBlockHash().GetHex());
+        return true;
+    }
+};
+
+static CRecentBlockCache* pRecentBlockCache = nullptr;
+
+void StartRecentBlockCache(size_t nBlocks)
+{
+    assert(pRecentBlockCache == nullptr);
+    pRecentBlockCache = new CRecentBlockCache(nBlocks);
+    RegisterValidationInterface(pRecentBlockCache);
+}
+
 UniValue getblockcount(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() != 0)
@@ -282,8 +511,8 @@ UniValue getblockcount(const UniValue& params, bool fHelp)
             + HelpExampleRpc("getblockcount", "")
         );
 
-    LOCK(cs_main);
-    return chainActive.Height();
+    const CBlockIndex* tip = chainActive.AtomicTip();
+    return tip ? tip->nHeight : -1;
 }
 
 UniValue getbestblockhash(const UniValue& params, bool fHelp)
@@ -299,8 +528,7 @@ UniValue getbestblockhash(const UniValue& params, bool fHelp)
             + HelpExampleRpc("getbestblockhash", "")
         );
 
-    LOCK(cs_main);
-    return chainActive.Tip()->GetBlockHash().GetHex();
+    return chainActive.AtomicTip()->GetBlockHash().GetHex();
 }
 
 UniValue getdifficulty(const UniValue& params, bool fHelp)
@@ -320,6 +548,34 @@ UniValue getdifficulty(const UniValue& params, bool fHelp)
     return GetNetworkDifficulty();
 }
 
+static UniValue mempoolEntryToJSON(const CTxMemPoolEntry& e)
+{
+    AssertLockHeld(mempool.cs);
+    UniValue info(UniValue::VOBJ);
+    info.pushKV("size", (int)e.GetTxSize());
+    info.pushKV("fee", ValueFromAmount(e.GetFee()));
+    info.pushKV("time", e.GetTime());
+    info.pushKV("height", (int)e.GetHeight());
+    info.pushKV("startingpriority", e.GetPriority(e.GetHeight()));
+    info.pushKV("currentpriority", e.GetPriority(chainActive.Height()));
+    const CTransaction& tx = e.GetTx();
+    set<string> setDepends;
+    for (const CTxIn& txin : tx.vin)
+    {
+        if (mempool.exists(txin.prevout.hash))
+            setDepends.insert(txin.prevout.hash.ToString());
+    }
+
+    UniValue depends(UniValue::VARR);
+    for (const string& dep : setDepends)
+    {
+        depends.push_back(dep);
+    }
+
+    info.pushKV("depends", depends);
+    return info;
+}
+
 UniValue mempoolToJSON(bool fVerbose = false)
 {
     if (fVerbose)
@@ -329,29 +585,7 @@ UniValue mempoolToJSON(bool fVerbose = false)
         for (const CTxMemPoolEntry& e : mempool.mapTx)
         {
             const uint256& hash = e.GetTx().GetHash();
-            UniValue info(UniValue::VOBJ);
-            info.pushKV("size", (int)e.GetTxSize());
-            info.pushKV("fee", ValueFromAmount(e.GetFee()));
-            info.pushKV("time", e.GetTime());
-            info.pushKV("height", (int)e.GetHeight());
-            info.pushKV("startingpriority", e.GetPriority(e.GetHeight()));
-            info.pushKV("currentpriority", e.GetPriority(chainActive.Height()));
-            const CTransaction& tx = e.GetTx();
-            set<string> setDepends;
-            for (const CTxIn& txin : tx.vin)
-            {
-                if (mempool.exists(txin.prevout.hash))
-                    setDepends.insert(txin.prevout.hash.ToString());
-            }
-
-            UniValue depends(UniValue::VARR);
-            for (const string& dep : setDepends)
-            {
-                depends.push_back(dep);
-            }
-
-            info.pushKV("depends", depends);
-            o.pushKV(hash.ToString(), info);
+            o.pushKV(hash.ToString(), mempoolEntryToJSON(e));
         }
         return o;
     }
@@ -409,6 +643,35 @@ UniValue getrawmempool(const UniValue& params, bool fHelp)
     return mempoolToJSON(fVerbose);
 }
 
+// Same as getrawmempool, but writes each entry out as soon as it has been
+// converted.
+static void getrawmempool_stream(const UniValue& params, JSONStreamWriter& out)
+{
+    if (params.size() > 1)
+        getrawmempool(params, true);
+
+    LOCK(cs_main);
+
+    bool fVerbose = false;
+    if (params.size() > 0)
+        fVerbose = params[0].get_bool();
+
+    LOCK(mempool.cs);
+    if (fVerbose) {
+        out.BeginObject();
+        for (const CTxMemPoolEntry& e : mempool.mapTx) {
+            out.KV(e.GetTx().GetHash().ToString(), mempoolEntryToJSON(e));
+        }
+        out.EndObject();
+    } else {
+        out.BeginArray();
+        for (const CTxMemPoolEntry& e : mempool.mapTx) {
+            out.Value(e.GetTx().GetHash().ToString());
+        }
+        out.EndArray();
+    }
+}
+
 // insightexplorer
 UniValue getblockdeltas(const UniValue& params, bool fHelp)
 {
@@ -619,10 +882,10 @@ UniValue getblockhash(const UniValue& params, bool fHelp)
             + HelpExampleRpc("getblockhash", "1000")
         );
 
-    LOCK(cs_main);
-
-    const CBlockIndex* pblockindex = chainActive[interpretHeightArg(params[0].get_int(), chainActive.Height())];
-    return pblockindex->GetBlockHash().GetHex();
+    // The active chain is read through its published tip, without cs_main.
+    const CBlockIndex* tip = chainActive.AtomicTip();
+    int nHeight = interpretHeightArg(params[0].get_int(), tip ? tip->nHeight : -1);
+    return tip->GetAncestor(nHeight)->GetBlockHash().GetHex();
 }
 
 UniValue getblockheader(const UniValue& params, bool fHelp)
@@ -657,8 +920,6 @@ UniValue getblockheader(const UniValue& params, bool fHelp)
             + HelpExampleRpc("getblockheader", "\"00000000c937983704a73af28acdec37b049d214adbda81d7e2a3dd146f6ed09\"")
         );
 
-    LOCK(cs_main);
-
     std::string strHash = params[0].get_str();
     uint256 hash(uint256S(strHash));
 
@@ -666,20 +927,74 @@ UniValue getblockheader(const UniValue& params, bool fHelp)
     if (params.size() > 1)
         fVerbose = params[1].get_bool();
 
-    if (mapBlockIndex.count(hash) == 0)
+    // The entry is found without cs_main, and the reply is built from a
+    // copy of it that is taken under cs_main.
+    const CBlockIndex* pblockindex = blockIndexLookup.Lookup(hash);
+    if (pblockindex == NULL)
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
-
-    CBlockIndex* pblockindex = mapBlockIndex[hash];
+    std::optional<BlockIndexInfo> info;
+    {
+        LOCK(cs_main);
+        info = GetBlockIndexInfo(pblockindex);
+    }
 
     if (!fVerbose)
     {
         CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
-        ssBlock << pblockindex->GetBlockHeader();
+        ssBlock << info->index.GetBlockHeader();
         std::string strHex = HexStr(ssBlock.begin(), ssBlock.end());
         return strHex;
     }
 
-    return blockheaderToJSON(pblockindex);
+    return blockheaderToJSON(*info);
+}
+
+// Finds the block that getblock was asked for, by hash or height.
+static CBlockIndex* getblockIndex(std::string strHash, int verbosity)
+{
+    AssertLockHeld(cs_main);
+
+    // If height is supplied, find the hash
+    if (strHash.size() < (2 * sizeof(uint256))) {
+        strHash = chainActive[parseHeightArg(strHash, chainActive.Height())]->GetBlockHash().GetHex();
+    }
+
+    uint256 hash(uint256S(strHash));
+
+    if (verbosity < 0 || verbosity > 2) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Verbosity must be in range from 0 to 2");
+    }
+
+    if (mapBlockIndex.count(hash) == 0)
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
+
+    CBlockIndex* pblockindex = mapBlockIndex[hash];
+
+    if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Block not available (pruned data)");
+
+    return pblockindex;
+}
+
+// Copies the index entry of the block that getblock was asked for, so that
+// the block can be read and converted without holding cs_main.
+static BlockIndexInfo getblockIndexInfo(const std::string& strHash, int verbosity)
+{
+    LOCK(cs_main);
+    return GetBlockIndexInfo(getblockIndex(strHash, verbosity));
+}
+
+static int getblockVerbosity(const UniValue& params)
+{
+    int verbosity = 1;
+    if (params.size() > 1) {
+        if(params[1].isNum()) {
+            verbosity = params[1].get_int();
+        } else {
+            verbosity = params[1].get_bool() ? 1 : 0;
+        }
+    }
+    return verbosity;
 }
 
 UniValue getblock(const UniValue& params, bool fHelp)
@@ -730,51 +1045,101 @@ UniValue getblock(const UniValue& params, bool fHelp)
             + HelpExampleRpc("getblock", "12800")
         );
 
-    LOCK(cs_main);
+    int verbosity = getblockVerbosity(params);
 
-    std::string strHash = params[0].get_str();
+    CBlock block;
+    BlockIndexInfo info = getblockIndexInfo(params[0].get_str(), verbosity);
 
-    // If height is supplied, find the hash
-    if (strHash.size() < (2 * sizeof(uint256))) {
-        strHash = chainActive[parseHeightArg(strHash, chainActive.Height())]->GetBlockHash().GetHex();
-    }
+    if (verbosity == 0)
+    {
+        if (pRecentBlockCache) {
+            std::shared_ptr<const std::string> raw = pRecentBlockCache->GetRaw(info.index.GetBlockHash());
+            if (raw)
+                return HexStr(raw->begin(), raw->end());
+        }
 
-    uint256 hash(uint256S(strHash));
+        // The block is stored in its network serialization.
+        CRawBlock rawBlock;
+        if (!ReadRawBlockFromDisk(rawBlock, &info.index, Params().MessageStart()))
+            throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
+        std::string strHex = HexStr(rawBlock.begin(), rawBlock.end());
+        return strHex;
+    }
 
-    int verbosity = 1;
-    if (params.size() > 1) {
-        if(params[1].isNum()) {
-            verbosity = params[1].get_int();
-        } else {
-            verbosity = params[1].get_bool() ? 1 : 0;
+    if (pRecentBlockCache) {
+        UniValue header, trailer;
+        std::shared_ptr<const std::string> txs;
+        if (pRecentBlockCache->GetJSON(info, verbosity >= 2, header, txs, trailer)) {
+            UniValue arrTxs;
+            arrTxs.read(*txs);
+            header.pushKV("tx", arrTxs);
+            header.pushKVs(trailer);
+            return header;
         }
     }
 
-    if (verbosity < 0 || verbosity > 2) {
-        throw JSONRPCError(RPC_INVALID_PARAMETER, "Verbosity must be in range from 0 to 2");
+    if(!ReadBlockFromDisk(block, &info.index, Params().GetConsensus()))
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
+
+    return blockToJSON(block, info, verbosity >= 2);
+}
+
+static void getblock_stream(const UniValue& params, JSONStreamWriter& out)
+{
+    // The JSON of recent blocks is written out as it was cached.
+    if (pRecentBlockCache && params.size() >= 1 && params.size() <= 2 && getblockVerbosity(params) >= 1) {
+        int verbosity = getblockVerbosity(params);
+        BlockIndexInfo info = getblockIndexInfo(params[0].get_str(), verbosity);
+        UniValue header, trailer;
+        std::shared_ptr<const std::string> txs;
+        if (pRecentBlockCache->GetJSON(info, verbosity >= 2, header, txs, trailer)) {
+            out.BeginObject();
+            out.Fields(header);
+            out.Key("tx");
+            out.RawValue(*txs);
+            out.Fields(trailer);
+            out.EndObject();
+            return;
+        }
     }
 
-    if (mapBlockIndex.count(hash) == 0)
-        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
+    // Only the transactions of verbosity 2 are large enough to stream.
+    if (params.size() != 2 || !params[1].isNum() || params[1].get_int() != 2) {
+        out.Value(getblock(params, false));
+        return;
+    }
 
     CBlock block;
-    CBlockIndex* pblockindex = mapBlockIndex[hash];
-
-    if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
-        throw JSONRPCError(RPC_INTERNAL_ERROR, "Block not available (pruned data)");
+    BlockIndexInfo info = getblockIndexInfo(params[0].get_str(), 2);
 
-    if(!ReadBlockFromDisk(block, pblockindex, Params().GetConsensus()))
+    if(!ReadBlockFromDisk(block, &info.index, Params().GetConsensus()))
         throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
 
-    if (verbosity == 0)
-    {
-        CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
-        ssBlock << block;
-        std::string strHex = HexStr(ssBlock.begin(), ssBlock.end());
-        return strHex;
+    blockToJSON(block, info, true, out);
+}
+
+static bool getblock_binary(const UniValue& params, std::string& out)
+{
+    // Verbosity 0 is the serialized block, which is sent as it is stored
+    // rather than hex-encoded.
+    if (params.size() < 1 || params.size() > 2 || getblockVerbosity(params) != 0)
+        return false;
+
+    BlockIndexInfo info = getblockIndexInfo(params[0].get_str(), 0);
+
+    if (pRecentBlockCache) {
+        std::shared_ptr<const std::string> raw = pRecentBlockCache->GetRaw(info.index.GetBlockHash());
+        if (raw) {
+            out = *raw;
+            return true;
+        }
     }
 
-    return blockToJSON(block, pblockindex, verbosity >= 2);
+    CRawBlock rawBlock;
+    if (!ReadRawBlockFromDisk(rawBlock, &info.index, Params().MessageStart()))
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
+    out.assign(rawBlock.begin(), rawBlock.end());
+    return true;
 }
 
 UniValue gettxoutsetinfo(const UniValue& params, bool fHelp)
@@ -783,7 +1148,9 @@ UniValue gettxoutsetinfo(const UniValue& params, bool fHelp)
         throw runtime_error(
             "gettxoutsetinfo\n"
             "\nReturns statistics about the unspent transaction output set.\n"
-            "Note this call may take some time.\n"
+            "Note this call may take some time, unless the node was started with -utxostats. The statistics\n"
+            "are then kept up to date as blocks are connected, and \"transactions\" and \"hash_serialized\",\n"
+            "which need a scan of the whole set, are omitted.\n"
             "\nResult:\n"
             "{\n"
             "  \"height\":n,     (numeric) The current block height (index)\n"
@@ -792,6 +1159,7 @@ UniValue gettxoutsetinfo(const UniValue& params, bool fHelp)
             "  \"txouts\": n,            (numeric) The number of output transactions\n"
             "  \"bytes_serialized\": n,  (numeric) The serialized size\n"
             "  \"hash_serialized\": \"hash\",   (string) The serialized hash\n"
+            "  \"muhash\": \"hash\",     (string) The MuHash3072 of the set of unspent outputs, which does not depend on their order\n"
             "  \"total_amount\": x.xxx          (numeric) The total amount\n"
             "}\n"
             "\nExamples:\n"
@@ -802,6 +1170,16 @@ UniValue gettxoutsetinfo(const UniValue& params, bool fHelp)
     UniValue ret(UniValue::VOBJ);
 
     CCoinsStats stats;
+    if (GetUTXOStats(stats)) {
+        ret.pushKV("height", (int64_t)stats.nHeight);
+        ret.pushKV("bestblock", stats.hashBlock.GetHex());
+        ret.pushKV("txouts", (int64_t)stats.nTransactionOutputs);
+        ret.pushKV("bytes_serialized", (int64_t)stats.nSerializedSize);
+        ret.pushKV("muhash", stats.GetMuHash().GetHex());
+        ret.pushKV("total_amount", ValueFromAmount(stats.nTotalAmount));
+        return ret;
+    }
+
     FlushStateToDisk();
     if (pcoinsTip->GetStats(stats)) {
         ret.pushKV("height", (int64_t)stats.nHeight);
@@ -810,28 +1188,484 @@ UniValue gettxoutsetinfo(const UniValue& params, bool fHelp)
         ret.pushKV("txouts", (int64_t)stats.nTransactionOutputs);
         ret.pushKV("bytes_serialized", (int64_t)stats.nSerializedSize);
         ret.pushKV("hash_serialized", stats.hashSerialized.GetHex());
+        ret.pushKV("muhash", stats.GetMuHash().GetHex());
         ret.pushKV("total_amount", ValueFromAmount(stats.nTotalAmount));
     }
     return ret;
 }
 
-UniValue gettxout(const UniValue& params, bool fHelp)
+UniValue dumptxoutset(const UniValue& params, bool fHelp)
 {
-    if (fHelp || params.size() < 2 || params.size() > 3)
+    if (fHelp || params.size() != 1)
         throw runtime_error(
-            "gettxout \"txid\" n ( includemempool )\n"
-            "\nReturns details about an unspent transaction output.\n"
+            "dumptxoutset \"path\"\n"
+            "\nWrites the chain state at the tip, including the unspent transaction outputs, the commitment\n"
+            "trees, the nullifiers and the history tree, to a UTXO set snapshot file that loadtxoutset can load.\n"
             "\nArguments:\n"
-            "1. \"txid\"       (string, required) The transaction id\n"
-            "2. n              (numeric, required) vout value\n"
-            "3. includemempool  (boolean, optional) Whether to include the mempool\n"
+            "1. \"path\"    (string, required) The file to write, relative to the data directory if not absolute\n"
             "\nResult:\n"
             "{\n"
-            "  \"bestblock\" : \"hash\",    (string) the block hash\n"
-            "  \"confirmations\" : n,       (numeric) The number of confirmations\n"
-            "  \"value\" : x.xxx,           (numeric) The transaction value in " + CURRENCY_UNIT + "\n"
-            "  \"scriptPubKey\" : {         (json object)\n"
-            "     \"asm\" : \"code\",       (string) \n"
+            "  \"coins_written\": n,       (numeric) The number of unspent transaction outputs written\n"
+            "  \"base_hash\": \"hash\",     (string) The hash of the block at the tip\n"
+            "  \"base_height\": n,         (numeric) The height of the block at the tip\n"
+            "  \"path\": \"path\",          (string) The absolute path of the file\n"
+            "  \"snapshot_hash\": \"hash\"  (string) The hash of the snapshot, to be pinned for loadtxoutset\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("dumptxoutset", "\"utxo.dat\"")
+            + HelpExampleRpc("dumptxoutset", "\"utxo.dat\"")
+        );
+
+    fs::path path = fs::absolute(params[0].get_str(), GetDataDir());
+    if (fs::exists(path)) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, path.string() + " already exists");
+    }
+
+    CSnapshotMetadata metadata;
+    uint256 hashSnapshot;
+    uint64_t nCoins;
+    std::string strError;
+    if (!DumpUTXOSnapshot(path, metadata, hashSnapshot, nCoins, strError)) {
+        throw JSONRPCError(RPC_MISC_ERROR, strError);
+    }
+
+    UniValue ret(UniValue::VOBJ);
+    ret.pushKV("coins_written", (int64_t)nCoins);
+    ret.pushKV("base_hash", metadata.hashBlock.GetHex());
+    ret.pushKV("base_height", metadata.nHeight);
+    ret.pushKV("path", path.string());
+    ret.pushKV("snapshot_hash", hashSnapshot.GetHex());
+    return ret;
+}
+
+UniValue dumpheaders(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "dumpheaders \"path\"\n"
+            "\nWrites the headers of the active chain, from the genesis block on, to a header snapshot file that\n"
+            "a new node can import with -loadheaders instead of syncing the headers from its peers.\n"
+            "\nArguments:\n"
+            "1. \"path\"    (string, required) The file to write, relative to the data directory if not absolute\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"height\": n,        (numeric) The height of the last header written\n"
+            "  \"path\": \"path\"     (string) The absolute path of the file\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("dumpheaders", "\"headers.dat\"")
+            + HelpExampleRpc("dumpheaders", "\"headers.dat\"")
+        );
+
+    fs::path path = fs::absolute(params[0].get_str(), GetDataDir());
+    if (fs::exists(path)) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, path.string() + " already exists");
+    }
+
+    int nHeight;
+    std::string strError;
+    if (!DumpHeaderSnapshot(path, nHeight, strError)) {
+        throw JSONRPCError(RPC_MISC_ERROR, strError);
+    }
+
+    UniValue ret(UniValue::VOBJ);
+    ret.pushKV("height", nHeight);
+    ret.pushKV("path", path.string());
+    return ret;
+}
+
+UniValue dumpblockcorpus(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() < 2 || params.size() > 3)
+        throw runtime_error(
+            "dumpblockcorpus \"directory\" height ( count )\n"
+            "\nWrites blocks of the active chain, with the spent coins, anchors and history tree nodes that\n"
+            "connecting them reads, to a corpus that the ConnectBlockCorpus benchmark of bench_bitcoin replays.\n"
+            "Each block is written to <height>.blk in the directory. The blocks and their undo data must not\n"
+            "have been pruned.\n"
+            "\nArguments:\n"
+            "1. \"directory\"  (string, required) The directory to write to, relative to the data directory if not absolute\n"
+            "2. height       (numeric, required) The height of the first block\n"
+            "3. count        (numeric, optional, default=1) The number of blocks\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"blocks_written\": n,   (numeric) The number of blocks written\n"
+            "  \"path\": \"path\"        (string) The absolute path of the directory\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("dumpblockcorpus", "\"corpus\" 1000000 100")
+            + HelpExampleRpc("dumpblockcorpus", "\"corpus\", 1000000, 100")
+        );
+
+    fs::path path = fs::absolute(params[0].get_str(), GetDataDir());
+    int nHeight = params[1].get_int();
+    int nCount = params.size() > 2 ? params[2].get_int() : 1;
+    if (nCount < 1) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "count must be at least 1");
+    }
+    fs::create_directories(path);
+
+    LOCK(cs_main);
+    if (nHeight < 1 || nHeight + nCount - 1 > chainActive.Height()) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Block height out of range");
+    }
+    for (int i = 0; i < nCount; i++) {
+        CBlockCorpusEntry entry;
+        std::string strError;
+        if (!RecordBlockCorpusEntry(Params(), chainActive[nHeight + i], entry, strError) ||
+            !WriteBlockCorpusEntry(path, entry, strError)) {
+            throw JSONRPCError(RPC_MISC_ERROR, strError);
+        }
+    }
+
+    UniValue ret(UniValue::VOBJ);
+    ret.pushKV("blocks_written", nCount);
+    ret.pushKV("path", path.string());
+    return ret;
+}
+
+UniValue loadtxoutset(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "loadtxoutset \"path\"\n"
+            "\nReplaces the chain state with a UTXO set snapshot written by dumptxoutset, so that the node can\n"
+            "validate blocks after it without downloading the blocks before it. The hash of the snapshot must\n"
+            "be pinned in the chain parameters, and the header of its block must have been received and must\n"
+            "descend from the current tip.\n"
+            "\nThe blocks up to the snapshot are then never downloaded or validated, and the chain cannot be\n"
+            "reorganized below it. Not available when the wallet is enabled.\n"
+            "\nArguments:\n"
+            "1. \"path\"    (string, required) The file to load, relative to the data directory if not absolute\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"coins_loaded\": n,        (numeric) The number of unspent transaction outputs loaded\n"
+            "  \"base_hash\": \"hash\",     (string) The hash of the block of the snapshot\n"
+            "  \"base_height\": n,         (numeric) The height of the block of the snapshot\n"
+            "  \"snapshot_hash\": \"hash\"  (string) The hash of the snapshot\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("loadtxoutset", "\"utxo.dat\"")
+            + HelpExampleRpc("loadtxoutset", "\"utxo.dat\"")
+        );
+
+#ifdef ENABLE_WALLET
+    // The wallet would miss the transactions in the blocks that are skipped.
+    if (pwalletMain) {
+        throw JSONRPCError(RPC_MISC_ERROR, "UTXO set snapshots cannot be loaded when the wallet is enabled");
+    }
+#endif
+
+    fs::path path = fs::absolute(params[0].get_str(), GetDataDir());
+
+    CSnapshotMetadata metadata;
+    uint256 hashSnapshot;
+    uint64_t nCoins;
+    std::string strError;
+    if (!LoadUTXOSnapshot(path, metadata, hashSnapshot, nCoins, strError)) {
+        throw JSONRPCError(RPC_MISC_ERROR, strError);
+    }
+
+    UniValue ret(UniValue::VOBJ);
+    ret.pushKV("coins_loaded", (int64_t)nCoins);
+    ret.pushKV("base_hash", metadata.hashBlock.GetHex());
+    ret.pushKV("base_height", metadata.nHeight);
+    ret.pushKV("snapshot_hash", hashSnapshot.GetHex());
+    return ret;
+}
+
+static UniValue ReadStatsToJSON(const std::map<unsigned char, CDBReadStats>& mapStats)
+{
+    UniValue ret(UniValue::VOBJ);
+    for (const auto& entry : mapStats) {
+        const CDBReadStats& stats = entry.second;
+        UniValue obj(UniValue::VOBJ);
+        obj.pushKV("reads", (int64_t)stats.nReads);
+        obj.pushKV("found", (int64_t)stats.nFound);
+        obj.pushKV("file_reads", (int64_t)stats.nFileReads);
+        obj.pushKV("file_bytes", (int64_t)stats.nFileBytes);
+        obj.pushKV("read_amplification", (double)stats.nFileReads / stats.nReads);
+        std::string key = isprint(entry.first) ? std::string(1, entry.first) : strprintf("0x%02x", entry.first);
+        ret.pushKV(key, obj);
+    }
+    return ret;
+}
+
+UniValue getindexinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getindexinfo\n"
+            "\nReturns the state of the enabled indexes, which are built in the background when they are first enabled.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"name\": {               (json object) An enabled index: txindex, addressindex, spentindex, timestampindex,\n"
+            "                            blockfilterindex or shieldedindex\n"
+            "    \"synced\": xxxx,       (boolean) Whether the index has caught up with the best block chain\n"
+            "    \"best_block_height\": xxxxxx, (numeric) The height of the last block in the index\n"
+            "  },\n"
+            "  ...\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getindexinfo", "")
+            + HelpExampleRpc("getindexinfo", "")
+        );
+
+    UniValue result(UniValue::VOBJ);
+    for (const BaseIndex* index : {g_txindex.get(), g_addressindex.get(), g_spentindex.get(), g_timestampindex.get(),
+                                   g_blockfilterindex.get(), g_shieldedindex.get()}) {
+        if (!index) {
+            continue;
+        }
+        UniValue info(UniValue::VOBJ);
+        info.pushKV("synced", index->IsSynced());
+        info.pushKV("best_block_height", index->GetBestHeight());
+        result.pushKV(index->GetName(), info);
+    }
+    return result;
+}
+
+// Lookups of the shielded index are refused until it has been built, as
+// entries that it is still missing would look like unknown ones.
+static void EnsureShieldedIndex(const std::string& strMethod)
+{
+    if (!fShieldedIndex)
+        throw JSONRPCError(RPC_MISC_ERROR, "Error: " + strMethod + " requires -shieldedindex");
+    if (!IsIndexSynced(g_shieldedindex))
+        throw JSONRPCError(RPC_IN_WARMUP, "The shielded index is still being built; see getindexinfo");
+}
+
+UniValue getsaplingspend(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "getsaplingspend \"nullifier\"\n"
+            "\nReturns the transaction of the active chain that spent the Sapling note with the given nullifier.\n"
+            "Requires -shieldedindex.\n"
+            "\nArguments:\n"
+            "1. \"nullifier\"   (string, required) The nullifier, as shown by getrawtransaction\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"txid\": \"hex\",     (string) The spending transaction\n"
+            "  \"index\": n,        (numeric) The index of the spend in its vShieldedSpend\n"
+            "  \"height\": n        (numeric) The height of the block of the transaction\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getsaplingspend", "\"1e0a16a4d8b0ea45f3d4b1c7ad2cd6f66f6f8d4b2b4a0a8db6c1eb2e3a7f1cd5\"")
+            + HelpExampleRpc("getsaplingspend", "\"1e0a16a4d8b0ea45f3d4b1c7ad2cd6f66f6f8d4b2b4a0a8db6c1eb2e3a7f1cd5\"")
+        );
+
+    EnsureShieldedIndex("getsaplingspend");
+    uint256 nullifier = ParseHashV(params[0], "nullifier");
+
+    CSaplingSpendIndexValue value;
+    if (!pblocktree->ReadSaplingSpendIndex(nullifier, value))
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No spend of this nullifier in the active chain");
+
+    UniValue obj(UniValue::VOBJ);
+    obj.pushKV("txid", value.txid.GetHex());
+    obj.pushKV("index", (int)value.spendIndex);
+    obj.pushKV("height", value.blockHeight);
+    return obj;
+}
+
+UniValue getsaplingoutput(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "getsaplingoutput \"cmu\"\n"
+            "\nReturns the Sapling output of the active chain with the given note commitment, and the position\n"
+            "of the commitment in the Sapling note commitment tree. Requires -shieldedindex.\n"
+            "\nArguments:\n"
+            "1. \"cmu\"         (string, required) The note commitment, as shown by getrawtransaction\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"txid\": \"hex\",     (string) The transaction of the output\n"
+            "  \"index\": n,        (numeric) The index of the output in its vShieldedOutput\n"
+            "  \"height\": n,       (numeric) The height of the block of the transaction\n"
+            "  \"position\": n      (numeric) The number of commitments before this one in the tree\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getsaplingoutput", "\"3b6b7d1a8c2e8e3f2f10b9a16e5e3c9d2f8a47a2e9fd0f4b3c1de2ab7b5c4d60\"")
+            + HelpExampleRpc("getsaplingoutput", "\"3b6b7d1a8c2e8e3f2f10b9a16e5e3c9d2f8a47a2e9fd0f4b3c1de2ab7b5c4d60\"")
+        );
+
+    EnsureShieldedIndex("getsaplingoutput");
+    uint256 cmu = ParseHashV(params[0], "cmu");
+
+    CSaplingOutputIndexValue value;
+    if (!pblocktree->ReadSaplingOutputIndex(cmu, value))
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No output with this note commitment in the active chain");
+
+    UniValue obj(UniValue::VOBJ);
+    obj.pushKV("txid", value.txid.GetHex());
+    obj.pushKV("index", (int)value.outputIndex);
+    obj.pushKV("height", value.blockHeight);
+    obj.pushKV("position", value.position);
+    return obj;
+}
+
+UniValue getsaplingwitness(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() < 1 || params.size() > 2)
+        throw runtime_error(
+            "getsaplingwitness \"cmu\"|position ( anchorheight )\n"
+            "\nReturns the authentication path of a Sapling note commitment to the anchor of a block of the active\n"
+            "chain, which is all that is needed to spend the note. Requires -shieldedindex.\n"
+            "\nArguments:\n"
+            "1. \"cmu\"|position  (string or numeric, required) The note commitment, or its position in the Sapling tree\n"
+            "2. anchorheight    (numeric, optional, default=the current height) The height of the block whose final\n"
+            "                   Sapling tree is the anchor\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"cmu\": \"hex\",          (string) The note commitment\n"
+            "  \"position\": n,         (numeric) The position of the commitment in the tree\n"
+            "  \"anchorheight\": n,     (numeric) The height of the anchor\n"
+            "  \"anchor\": \"hex\",       (string) The Sapling root as of that block, as in its finalsaplingroot\n"
+            "  \"authpath\": [          (json array of string) The sibling of the path at each level, leaves first\n"
+            "    \"hex\", ...\n"
+            "  ],\n"
+            "  \"merklepath\": \"hex\"    (string) The serialized Merkle path, as taken by the Sapling spend prover\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getsaplingwitness", "\"3b6b7d1a8c2e8e3f2f10b9a16e5e3c9d2f8a47a2e9fd0f4b3c1de2ab7b5c4d60\"")
+            + HelpExampleCli("getsaplingwitness", "1234 1000000")
+            + HelpExampleRpc("getsaplingwitness", "1234, 1000000")
+        );
+
+    EnsureShieldedIndex("getsaplingwitness");
+
+    // zcash-cli passes the position as a string, which is shorter than a cmu.
+    uint64_t nPosition;
+    int nMinHeight = 0;
+    if (params[0].isNum() || params[0].get_str().size() < 64) {
+        int64_t n;
+        if (params[0].isNum()) {
+            n = params[0].get_int64();
+        } else if (!ParseInt64(params[0].get_str(), &n)) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid position or cmu");
+        }
+        if (n < 0)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Position out of range");
+        nPosition = n;
+    } else {
+        CSaplingOutputIndexValue value;
+        if (!pblocktree->ReadSaplingOutputIndex(ParseHashV(params[0], "cmu"), value))
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No output with this note commitment in the active chain");
+        nPosition = value.position;
+        nMinHeight = value.blockHeight;
+    }
+
+    const CBlockIndex* pindex;
+    {
+        LOCK(cs_main);
+        int nHeight = params.size() > 1 ? params[1].get_int() : chainActive.Height();
+        if (nHeight < nMinHeight || nHeight > chainActive.Height())
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Anchor height out of range");
+        pindex = chainActive[nHeight];
+    }
+
+    uint64_t nTreeSize;
+    if (!LookupSaplingTreeSize(pindex, nTreeSize))
+        throw JSONRPCError(RPC_DATABASE_ERROR, "Sapling tree size of the anchor block is not in the index");
+    if (nPosition >= nTreeSize)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Position is not in the Sapling tree as of the anchor height");
+
+    std::vector<libzcash::PedersenHash> path;
+    libzcash::PedersenHash root;
+    uint256 cmu;
+    if (!GetSaplingAuthPath(nTreeSize, nPosition, path, root) ||
+        !pblocktree->ReadSaplingTreeNode(CSaplingTreeNodeKey(0, nPosition), cmu))
+        throw JSONRPCError(RPC_DATABASE_ERROR, "Sapling tree nodes are missing from the index");
+    if (root != pindex->hashFinalSaplingRoot)
+        throw JSONRPCError(RPC_DATABASE_ERROR, "The Sapling tree in the index does not match the anchor");
+
+    // The Merkle path is root first, as IncrementalWitness::path() returns it.
+    UniValue authpath(UniValue::VARR);
+    std::vector<std::vector<bool>> vPath;
+    std::vector<bool> vIndex;
+    for (size_t i = 0; i < path.size(); i++) {
+        authpath.push_back(path[i].GetHex());
+        vPath.insert(vPath.begin(), convertBytesVectorToVector(std::vector<unsigned char>(path[i].begin(), path[i].end())));
+        vIndex.insert(vIndex.begin(), (nPosition >> i) & 1);
+    }
+    CDataStream ssPath(SER_NETWORK, PROTOCOL_VERSION);
+    ssPath << libzcash::MerklePath(vPath, vIndex);
+
+    UniValue obj(UniValue::VOBJ);
+    obj.pushKV("cmu", cmu.GetHex());
+    obj.pushKV("position", nPosition);
+    obj.pushKV("anchorheight", pindex->nHeight);
+    obj.pushKV("anchor", root.GetHex());
+    obj.pushKV("authpath", authpath);
+    obj.pushKV("merklepath", HexStr(ssPath.begin(), ssPath.end()));
+    return obj;
+}
+
+UniValue getdbstats(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getdbstats\n"
+            "\nReturns counters of the point lookups in the chain state and block index databases since the\n"
+            "node started, by record type (the first byte of the key), and the LevelDB statistics of each\n"
+            "database. Lookups served from the in-memory caches above the databases are not counted.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"chainstate\": {\n"
+            "    \"reads\": {\n"
+            "      \"x\": {                    (object) The counters for the records of type x\n"
+            "        \"reads\": n,             (numeric) The number of lookups\n"
+            "        \"found\": n,             (numeric) The number of lookups that found a record\n"
+            "        \"file_reads\": n,        (numeric) The number of table blocks read from disk by the lookups\n"
+            "        \"file_bytes\": n,        (numeric) The number of bytes read from disk by the lookups\n"
+            "        \"read_amplification\": x.xxx  (numeric) The number of table blocks read per lookup\n"
+            "      }, ...\n"
+            "    },\n"
+            "    \"leveldb\": \"...\"          (string) The LevelDB statistics of the database\n"
+            "  },\n"
+            "  \"blockindex\": { ... }         (object) The same for the block index database\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getdbstats", "")
+            + HelpExampleRpc("getdbstats", "")
+        );
+
+    LOCK(cs_main);
+
+    UniValue ret(UniValue::VOBJ);
+    if (pcoinsdbview) {
+        UniValue obj(UniValue::VOBJ);
+        obj.pushKV("reads", ReadStatsToJSON(pcoinsdbview->GetReadStats()));
+        obj.pushKV("leveldb", pcoinsdbview->GetDBProperty("leveldb.stats"));
+        ret.pushKV("chainstate", obj);
+    }
+    if (pblocktree) {
+        UniValue obj(UniValue::VOBJ);
+        obj.pushKV("reads", ReadStatsToJSON(pblocktree->GetReadStats()));
+        obj.pushKV("leveldb", pblocktree->GetProperty("leveldb.stats"));
+        ret.pushKV("blockindex", obj);
+    }
+    return ret;
+}
+
+UniValue gettxout(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() < 2 || params.size() > 3)
+        throw runtime_error(
+            "gettxout \"txid\" n ( includemempool )\n"
+            "\nReturns details about an unspent transaction output.\n"
+            "\nArguments:\n"
+            "1. \"txid\"       (string, required) The transaction id\n"
+            "2. n              (numeric, required) vout value\n"
+            "3. includemempool  (boolean, optional) Whether to include the mempool\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"bestblock\" : \"hash\",    (string) the block hash\n"
+            "  \"confirmations\" : n,       (numeric) The number of confirmations\n"
+            "  \"value\" : x.xxx,           (numeric) The transaction value in " + CURRENCY_UNIT + "\n"
+            "  \"scriptPubKey\" : {         (json object)\n"
+            "     \"asm\" : \"code\",       (string) \n"
             "     \"hex\" : \"hex\",        (string) \n"
             "     \"reqSigs\" : n,          (numeric) Number of required signatures\n"
             "     \"type\" : \"pubkeyhash\", (string) The type, eg pubkeyhash\n"
@@ -840,7 +1674,6 @@ UniValue gettxout(const UniValue& params, bool fHelp)
             "        ,...\n"
             "     ]\n"
             "  },\n"
-            "  \"version\" : n,              (numeric) The version\n"
             "  \"coinbase\" : true|false     (boolean) Coinbase or not\n"
             "}\n"
 
@@ -864,33 +1697,33 @@ UniValue gettxout(const UniValue& params, bool fHelp)
     if (params.size() > 2)
         fMempool = params[2].get_bool();
 
-    CCoins coins;
+    if (n < 0)
+        return NullUniValue;
+    COutPoint out(hash, n);
+
+    Coin coin;
     if (fMempool) {
         LOCK(mempool.cs);
         CCoinsViewMemPool view(pcoinsTip, mempool);
-        if (!view.GetCoins(hash, coins))
+        if (!view.GetCoin(out, coin) || mempool.isSpent(out)) // TODO: filtering spent coins should be done by the CCoinsViewMemPool
             return NullUniValue;
-        mempool.pruneSpent(hash, coins); // TODO: this should be done by the CCoinsViewMemPool
     } else {
-        if (!pcoinsTip->GetCoins(hash, coins))
+        if (!pcoinsTip->GetCoin(out, coin))
             return NullUniValue;
     }
-    if (n<0 || (unsigned int)n>=coins.vout.size() || coins.vout[n].IsNull())
-        return NullUniValue;
 
     BlockMap::iterator it = mapBlockIndex.find(pcoinsTip->GetBestBlock());
     CBlockIndex *pindex = it->second;
     ret.pushKV("bestblock", pindex->GetBlockHash().GetHex());
-    if ((unsigned int)coins.nHeight == MEMPOOL_HEIGHT)
+    if (coin.nHeight == MEMPOOL_HEIGHT)
         ret.pushKV("confirmations", 0);
     else
-        ret.pushKV("confirmations", pindex->nHeight - coins.nHeight + 1);
-    ret.pushKV("value", ValueFromAmount(coins.vout[n].nValue));
+        ret.pushKV("confirmations", (int64_t)(pindex->nHeight - coin.nHeight + 1));
+    ret.pushKV("value", ValueFromAmount(coin.out.nValue));
     UniValue o(UniValue::VOBJ);
-    ScriptPubKeyToJSON(coins.vout[n].scriptPubKey, o, true);
+    ScriptPubKeyToJSON(coin.out.scriptPubKey, o, true);
     ret.pushKV("scriptPubKey", o);
-    ret.pushKV("version", coins.nVersion);
-    ret.pushKV("coinbase", coins.fCoinBase);
+    ret.pushKV("coinbase", (bool)coin.fCoinBase);
 
     return ret;
 }
@@ -1102,6 +1935,147 @@ UniValue getblockchaininfo(const UniValue& params, bool fHelp)
     return obj;
 }
 
+UniValue valuePoolHistoryToJSON(int nStart, int nCount, int nInterval)
+{
+    AssertLockHeld(cs_main);
+    UniValue history(UniValue::VARR);
+    // No interval needs to reach past the tip, so this cannot overflow below.
+    nInterval = std::min(nInterval, chainActive.Height() + 1);
+    for (int nHeight = nStart; nHeight <= chainActive.Height() && (int)history.size() < nCount; nHeight += nInterval) {
+        const CBlockIndex* pindex = chainActive[nHeight];
+        if (pindex == NULL) {
+            break;
+        }
+        UniValue entry(UniValue::VOBJ);
+        entry.pushKV("height", pindex->nHeight);
+        entry.pushKV("hash", pindex->GetBlockHash().GetHex());
+        entry.pushKV("time", (int64_t)pindex->nTime);
+        UniValue valuePools(UniValue::VARR);
+        valuePools.push_back(ValuePoolDesc("sprout", pindex->nChainSproutValue, pindex->nSproutValue));
+        valuePools.push_back(ValuePoolDesc("sapling", pindex->nChainSaplingValue, pindex->nSaplingValue));
+        entry.pushKV("valuePools", valuePools);
+        history.push_back(entry);
+        if (nInterval > chainActive.Height() - nHeight) {
+            break;
+        }
+    }
+    return history;
+}
+
+UniValue getvaluepoolhistory(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() < 1 || params.size() > 3)
+        throw runtime_error(
+            "getvaluepoolhistory startheight ( count interval )\n"
+            "\nReturns the value of the shielded pools after each of a range of blocks in the best chain.\n"
+            "The values are kept in the block index, so this does not read any blocks from disk.\n"
+            "\nArguments:\n"
+            "1. startheight    (numeric, required) The height of the first block\n"
+            "2. count          (numeric, optional, default=" + std::to_string(MAX_VALUE_POOL_HISTORY) + ") The maximum number of blocks to return, at most " + std::to_string(MAX_VALUE_POOL_HISTORY) + "\n"
+            "3. interval       (numeric, optional, default=1) The difference between the heights of consecutive blocks returned\n"
+            "\nResult:\n"
+            "[\n"
+            "  {\n"
+            "    \"height\": n,           (numeric) The block height\n"
+            "    \"hash\": \"hash\",        (string) The block hash\n"
+            "    \"time\": n,             (numeric) The block time in seconds since epoch (Jan 1 1970 GMT)\n"
+            "    \"valuePools\": [        (array) The value pools after the block, as in getblock\n"
+            "      {\n"
+            "        \"id\": \"xxxx\",           (string) The name of the pool\n"
+            "        \"monitored\": xx,          (boolean) true if the value of the pool is known\n"
+            "        \"chainValue\": x.xxx,      (numeric) The value of the pool, if monitored\n"
+            "        \"chainValueZat\": n,       (numeric) The value of the pool in " + MINOR_CURRENCY_UNIT + ", if monitored\n"
+            "        \"valueDelta\": x.xxx,      (numeric) The change in the value of the pool in this block\n"
+            "        \"valueDeltaZat\": n,       (numeric) The change in the value of the pool in this block, in " + MINOR_CURRENCY_UNIT + "\n"
+            "      }, ...\n"
+            "    ]\n"
+            "  }, ...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getvaluepoolhistory", "1000000 100 1152")
+            + HelpExampleRpc("getvaluepoolhistory", "1000000, 100, 1152")
+        );
+
+    int nStart = params[0].get_int();
+    int nCount = MAX_VALUE_POOL_HISTORY;
+    if (params.size() > 1)
+        nCount = params[1].get_int();
+    int nInterval = 1;
+    if (params.size() > 2)
+        nInterval = params[2].get_int();
+
+    LOCK(cs_main);
+    if (nStart < 0 || nStart > chainActive.Height())
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Block height out of range");
+    if (nCount < 1 || nCount > MAX_VALUE_POOL_HISTORY)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Count out of range");
+    if (nInterval < 1)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Interval must be positive");
+
+    return valuePoolHistoryToJSON(nStart, nCount, nInterval);
+}
+
+UniValue getsyncprogress(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getsyncprogress\n"
+            "Returns the throughput of the chain sync over rolling windows, and an estimate of the\n"
+            "time left until the initial block download is done. The chain state is sampled every\n"
+            + strprintf("%d", SYNC_METRICS_INTERVAL) + " seconds, so the result can be that old.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"blocks\": xxxxxx,               (numeric) the height of the chain tip\n"
+            "  \"headers\": xxxxxx,              (numeric) the height of the best header\n"
+            "  \"verificationprogress\": xxxx,   (numeric) estimate of verification progress [0..1]\n"
+            "  \"estimatedsecondsleft\": xxxx,   (numeric, optional) estimate of the seconds until the initial block download is done,\n"
+            "                                   from the verification work left and its rate over the last ten minutes\n"
+            "  \"windows\": [                    (array) the throughput over each rolling window\n"
+            "     {\n"
+            "        \"seconds\": xxxx,                   (numeric) the length of the window\n"
+            "        \"elapsed\": xxxx,                   (numeric) the seconds covered by the samples, less than the window after startup\n"
+            "        \"blockspersecond\": xxxx,           (numeric) blocks connected per second\n"
+            "        \"transactionspersecond\": xxxx,     (numeric) transactions connected per second\n"
+            "        \"shieldedoutputspersecond\": xxxx,  (numeric) Sapling outputs and JoinSplit outputs connected per second\n"
+            "        \"bytesreceivedpersecond\": xxxx,    (numeric) bytes received from peers per second\n"
+            "        \"cachehitrate\": xxxx,              (numeric, optional) fraction of the coin lookups served by the coins cache\n"
+            "        \"flushes\": xxxx                    (numeric) number of times the coins cache was flushed to disk\n"
+            "     }, ...\n"
+            "  ]\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getsyncprogress", "")
+            + HelpExampleRpc("getsyncprogress", "")
+        );
+
+    SyncProgress progress = GetSyncProgress();
+
+    UniValue obj(UniValue::VOBJ);
+    obj.pushKV("blocks", progress.nHeight);
+    obj.pushKV("headers", progress.nHeadersHeight);
+    obj.pushKV("verificationprogress", progress.fVerificationProgress);
+    if (progress.nSecondsLeft) {
+        obj.pushKV("estimatedsecondsleft", progress.nSecondsLeft.value());
+    }
+    UniValue windows(UniValue::VARR);
+    for (const SyncRates& rates : progress.rates) {
+        UniValue window(UniValue::VOBJ);
+        window.pushKV("seconds", rates.nWindow);
+        window.pushKV("elapsed", rates.nElapsed);
+        window.pushKV("blockspersecond", rates.fBlocksPerSecond);
+        window.pushKV("transactionspersecond", rates.fTransactionsPerSecond);
+        window.pushKV("shieldedoutputspersecond", rates.fShieldedOutputsPerSecond);
+        window.pushKV("bytesreceivedpersecond", rates.fBytesReceivedPerSecond);
+        if (rates.fCacheHitRate) {
+            window.pushKV("cachehitrate", rates.fCacheHitRate.value());
+        }
+        window.pushKV("flushes", rates.nFlushes);
+        windows.push_back(window);
+    }
+    obj.pushKV("windows", windows);
+    return obj;
+}
+
 /** Comparison function for sorting the getchaintips heads.  */
 struct CompareBlocksByHeight
 {
@@ -1349,6 +2323,196 @@ UniValue getmempoolinfo(const UniValue& params, bool fHelp)
     return mempoolInfoToJSON();
 }
 
+UniValue getmempoolchanges(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() > 1)
+        throw runtime_error(
+            "getmempoolchanges ( since )\n"
+            "\nReturns the transactions added to and removed from the mempool after the"
+            "\nmempool sequence number \"since\", so that a copy of the mempool can be kept"
+            "\nup to date with work proportional to the changes. Without \"since\", returns"
+            "\nthe whole mempool and its current sequence number to start from.\n"
+            "\nThe last " + std::to_string(MEMPOOL_EVENT_LOG_SIZE) + " changes are kept. If \"since\" is older, an error is"
+            "\nreturned and the copy must be started again without it.\n"
+            "\nArguments:\n"
+            "1. since          (numeric, optional) The sequence number returned by the previous call\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"sequence\": n,  (numeric) The mempool sequence number, to pass as \"since\" to the next call\n"
+            "  \"txids\": [      (array, only without \"since\") The transaction ids in the mempool\n"
+            "    \"transactionid\"\n"
+            "    ,...\n"
+            "  ],\n"
+            "  \"changes\": [    (array, only with \"since\") The changes, in the order they happened\n"
+            "    {\n"
+            "      \"txid\": \"transactionid\", (string) The transaction id\n"
+            "      \"type\": \"added\"|\"removed\", (string) Whether the transaction entered or left the mempool\n"
+            "      \"sequence\": n    (numeric) The sequence number of the change\n"
+            "    }\n"
+            "    ,...\n"
+            "  ]\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getmempoolchanges", "")
+            + HelpExampleCli("getmempoolchanges", "1234")
+            + HelpExampleRpc("getmempoolchanges", "1234")
+        );
+
+    UniValue ret(UniValue::VOBJ);
+    LOCK(mempool.cs);
+    if (params.size() == 0) {
+        vector<uint256> vtxid;
+        mempool.queryHashes(vtxid);
+        UniValue txids(UniValue::VARR);
+        for (const uint256& hash : vtxid)
+            txids.push_back(hash.ToString());
+        ret.pushKV("sequence", mempool.GetEventSequence());
+        ret.pushKV("txids", txids);
+        return ret;
+    }
+
+    int64_t nSince = params[0].get_int64();
+    std::vector<CMempoolEvent> events;
+    if (nSince < 0 || !mempool.GetEventsSince(nSince, events)) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "The mempool changes since this sequence number are not known; call getmempoolchanges without it to start again");
+    }
+    UniValue changes(UniValue::VARR);
+    for (const CMempoolEvent& event : events) {
+        UniValue change(UniValue::VOBJ);
+        change.pushKV("txid", event.txid.ToString());
+        change.pushKV("type", event.fAdded ? "added" : "removed");
+        change.pushKV("sequence", event.nSequence);
+        changes.push_back(change);
+    }
+    ret.pushKV("sequence", mempool.GetEventSequence());
+    ret.pushKV("changes", changes);
+    return ret;
+}
+
+/** Maximum number of heights that one getchainhistoryproof call proves. */
+static const size_t MAX_CHAIN_HISTORY_PROOF_HEIGHTS = 1000;
+
+UniValue getchainhistoryproof(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "getchainhistoryproof [height,...]\n"
+            "\nReturns a proof that the blocks at the given heights are in the ZIP 221 chain"
+            "\nhistory tree of their network upgrade epoch, as of the current chain tip. The"
+            "\nproof holds, for each height, the tree node of its block and the nodes on its"
+            "\npath up to a peak, and the peaks of the tree, which commit to its root. Nodes"
+            "\nshared by the paths are returned once, so the proof for a set of heights grows"
+            "\nwith the logarithm of the length of the chain.\n"
+            "\nThe heights must be in one epoch from Heartwood on. At most " + std::to_string(MAX_CHAIN_HISTORY_PROOF_HEIGHTS) + " heights"
+            "\nare proved at once.\n"
+            "\nArguments:\n"
+            "1. heights        (array, required) The heights of the blocks to prove\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"branchid\": \"hex\",      (string) The consensus branch id of the epoch\n"
+            "  \"tipheight\": n,          (numeric) The height of the chain tip the proof is for\n"
+            "  \"length\": n,             (numeric) The number of nodes in the epoch's history tree\n"
+            "  \"root\": \"hex\",          (string) The root of the tree; while the epoch is current, it is\n"
+            "                            the hashLightClientRoot of the next block\n"
+            "  \"peaks\": [n,...],        (array) The positions of the peaks, left to right\n"
+            "  \"leaves\": [              (array) The requested blocks\n"
+            "    {\n"
+            "      \"height\": n,         (numeric) The height of the block\n"
+            "      \"position\": n,       (numeric) The position of its node\n"
+            "      \"path\": [n,...]      (array) The positions of the siblings on its path to a peak, from the bottom\n"
+            "    }\n"
+            "    ,...\n"
+            "  ],\n"
+            "  \"nodes\": [               (array) The nodes of the proof, by position\n"
+            "    {\n"
+            "      \"position\": n,       (numeric) The position of the node in the tree\n"
+            "      \"node\": \"hex\"        (string) The serialized node\n"
+            "    }\n"
+            "    ,...\n"
+            "  ]\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getchainhistoryproof", "\"[903000, 903100]\"")
+            + HelpExampleRpc("getchainhistoryproof", "[903000, 903100]")
+        );
+
+    const UniValue& heights = params[0].get_array();
+    if (heights.empty()) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "No heights given");
+    }
+    if (heights.size() > MAX_CHAIN_HISTORY_PROOF_HEIGHTS) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("At most %u heights can be proved at once", MAX_CHAIN_HISTORY_PROOF_HEIGHTS));
+    }
+
+    const Consensus::Params& consensusParams = Params().GetConsensus();
+    LOCK(cs_main);
+    int nTipHeight = chainActive.Height();
+    std::optional<int> epoch;
+    std::vector<std::pair<int, HistoryIndex>> vLeaves;
+    for (size_t i = 0; i < heights.size(); i++) {
+        int nHeight = heights[i].get_int();
+        if (nHeight < 0 || nHeight > nTipHeight) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Block height %d out of range", nHeight));
+        }
+        if (!consensusParams.NetworkUpgradeActive(nHeight, Consensus::UPGRADE_HEARTWOOD)) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Block height %d is before the chain history tree", nHeight));
+        }
+        int nEpoch = CurrentEpoch(nHeight, consensusParams);
+        if (epoch && *epoch != nEpoch) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "The heights are in different network upgrade epochs");
+        }
+        epoch = nEpoch;
+        uint64_t nLeaf = nHeight - consensusParams.vUpgrades[nEpoch].nActivationHeight;
+        vLeaves.emplace_back(nHeight, libzcash::HistoryLeafPosition(nLeaf));
+    }
+
+    uint32_t nBranchId = NetworkUpgradeInfo[*epoch].nBranchId;
+    HistoryIndex nLength = pcoinsTip->GetHistoryLength(nBranchId);
+    std::vector<HistoryIndex> vPeaks = libzcash::HistoryPeaks(nLength);
+    std::set<HistoryIndex> setNodes(vPeaks.begin(), vPeaks.end());
+
+    UniValue leaves(UniValue::VARR);
+    for (const auto& leaf : vLeaves) {
+        if (leaf.second >= nLength) {
+            throw JSONRPCError(RPC_INTERNAL_ERROR, "History tree is shorter than the chain");
+        }
+        UniValue path(UniValue::VARR);
+        for (HistoryIndex pos : libzcash::HistoryAuthPath(nLength, leaf.second)) {
+            path.push_back((uint64_t)pos);
+            setNodes.insert(pos);
+        }
+        setNodes.insert(leaf.second);
+        UniValue entry(UniValue::VOBJ);
+        entry.pushKV("height", leaf.first);
+        entry.pushKV("position", (uint64_t)leaf.second);
+        entry.pushKV("path", path);
+        leaves.push_back(entry);
+    }
+
+    UniValue peaks(UniValue::VARR);
+    for (HistoryIndex pos : vPeaks) {
+        peaks.push_back((uint64_t)pos);
+    }
+    UniValue nodes(UniValue::VARR);
+    for (HistoryIndex pos : setNodes) {
+        HistoryNode node = pcoinsTip->GetHistoryAt(nBranchId, pos);
+        UniValue entry(UniValue::VOBJ);
+        entry.pushKV("position", (uint64_t)pos);
+        entry.pushKV("node", HexStr(node.bytes, node.bytes + NODE_SERIALIZED_LENGTH));
+        nodes.push_back(entry);
+    }
+
+    UniValue ret(UniValue::VOBJ);
+    ret.pushKV("branchid", HexInt(nBranchId));
+    ret.pushKV("tipheight", nTipHeight);
+    ret.pushKV("length", (uint64_t)nLength);
+    ret.pushKV("root", pcoinsTip->GetHistoryRoot(nBranchId).GetHex());
+    ret.pushKV("peaks", peaks);
+    ret.pushKV("leaves", leaves);
+    ret.pushKV("nodes", nodes);
+    return ret;
+}
+
 UniValue invalidateblock(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() != 1)
@@ -1430,18 +2594,31 @@ static const CRPCCommand commands[] =
 { //  category              name                      actor (function)         okSafeMode
   //  --------------------- ------------------------  -----------------------  ----------
     { "blockchain",         "getblockchaininfo",      &getblockchaininfo,      true  },
+    { "blockchain",         "getsyncprogress",        &getsyncprogress,        true  },
     { "blockchain",         "getbestblockhash",       &getbestblockhash,       true  },
     { "blockchain",         "getblockcount",          &getblockcount,          true  },
     { "blockchain",         "getblock",               &getblock,               true  },
     { "blockchain",         "getblockhash",           &getblockhash,           true  },
     { "blockchain",         "getblockheader",         &getblockheader,         true  },
     { "blockchain",         "getchaintips",           &getchaintips,           true  },
+    { "blockchain",         "getvaluepoolhistory",    &getvaluepoolhistory,    true  },
     { "blockchain",         "z_gettreestate",         &z_gettreestate,         true  },
     { "blockchain",         "getdifficulty",          &getdifficulty,          true  },
     { "blockchain",         "getmempoolinfo",         &getmempoolinfo,         true  },
+    { "blockchain",         "getmempoolchanges",      &getmempoolchanges,      true  },
+    { "blockchain",         "getchainhistoryproof",   &getchainhistoryproof,   true  },
     { "blockchain",         "getrawmempool",          &getrawmempool,          true  },
     { "blockchain",         "gettxout",               &gettxout,               true  },
     { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        true  },
+    { "blockchain",         "dumptxoutset",           &dumptxoutset,           true  },
+    { "blockchain",         "dumpblockcorpus",        &dumpblockcorpus,        true  },
+    { "blockchain",         "dumpheaders",            &dumpheaders,            true  },
+    { "blockchain",         "loadtxoutset",           &loadtxoutset,           false },
+    { "blockchain",         "getdbstats",             &getdbstats,             true  },
+    { "blockchain",         "getindexinfo",           &getindexinfo,           true  },
+    { "blockchain",         "getsaplingspend",        &getsaplingspend,        true  },
+    { "blockchain",         "getsaplingoutput",       &getsaplingoutput,       true  },
+    { "blockchain",         "getsaplingwitness",      &getsaplingwitness,      true  },
     { "blockchain",         "verifychain",            &verifychain,            true  },
 
     // insightexplorer
@@ -1457,4 +2634,8 @@ void RegisterBlockchainRPCCommands(CRPCTable &tableRPC)
 {
     for (unsigned int vcidx = 0; vcidx < ARRAYLEN(commands); vcidx++)
         tableRPC.appendCommand(commands[vcidx].name, &commands[vcidx]);
+
+    tableRPC.appendStreamCommand("getblock", &getblock_stream);
+    tableRPC.appendStreamCommand("getrawmempool", &getrawmempool_stream);
+    tableRPC.appendBinaryCommand("getblock", &getblock_binary);
 }
@@ -50,6 +50,9 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "getbalance", 2 },
     { "getbalance", 3 },
     { "getblockhash", 0 },
+    { "getvaluepoolhistory", 0 },
+    { "getvaluepoolhistory", 1 },
+    { "getvaluepoolhistory", 2 },
     { "move", 2 },
     { "move", 3 },
     { "sendfrom", 2 },
@@ -57,6 +60,7 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "listtransactions", 1 },
     { "listtransactions", 2 },
     { "listtransactions", 3 },
+    { "listtransactions", 4 },
     { "listaccounts", 0 },
     { "listaccounts", 1 },
     { "walletpassphrase", 1 },
@@ -84,6 +88,8 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "signrawtransaction", 1 },
     { "signrawtransaction", 2 },
     { "sendrawtransaction", 1 },
+    { "sendrawtransactions", 0 },
+    { "sendrawtransactions", 1 },
     { "fundrawtransaction", 1 },
     { "gettxout", 1 },
     { "gettxout", 2 },
@@ -94,10 +100,14 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "importaddress", 2 },
     { "importaddress", 3 },
     { "importpubkey", 2 },
+    { "dumpblockcorpus", 1 },
+    { "dumpblockcorpus", 2 },
     { "verifychain", 0 },
     { "verifychain", 1 },
     { "keypoolrefill", 0 },
     { "getrawmempool", 0 },
+    { "getmempoolchanges", 0 },
+    { "getchainhistoryproof", 0 },
     { "estimatefee", 0 },
     { "estimatepriority", 0 },
     { "prioritisetransaction", 1 },
@@ -105,6 +115,7 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "setban", 2 },
     { "setban", 3 },
     { "getspentinfo", 0},
+    { "getsaplingwitness", 1},
     { "getaddresstxids", 0},
     { "getaddressbalance", 0},
     { "getaddressdeltas", 0},
@@ -114,12 +125,17 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "getblockhashes", 1},
     { "getblockhashes", 2},
     { "getblockdeltas", 0},
+    { "getlockstats", 1},
+    { "setverificationthreads", 0},
+    { "setspanprofiling", 0},
+    { "setspanprofiling", 2},
     { "zcrawjoinsplit", 1 },
     { "zcrawjoinsplit", 2 },
     { "zcrawjoinsplit", 3 },
     { "zcrawjoinsplit", 4 },
     { "zcbenchmark", 1 },
     { "zcbenchmark", 2 },
+    { "zcbenchmark", 3 },
     { "getblocksubsidy", 0},
     { "z_listaddresses", 0},
     { "z_listreceivedbyaddress", 1},
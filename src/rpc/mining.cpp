@@ -238,6 +238,15 @@ UniValue generate(const UniValue& params, bool fHelp)
             // target -- 1 in 2^(2^256). That ain't gonna happen
             pblock->nNonce = ArithToUint256(UintToArith256(pblock->nNonce) + 1);
 
+            // Under -regtestfastmode any solution of the right size is accepted.
+            if (Params().GetConsensus().fSkipEquihash) {
+                pblock->nSolution.assign(equihash_solution_size(n, k), 0);
+                if (CheckProofOfWork(pblock->GetHash(), pblock->nBits, Params().GetConsensus())) {
+                    goto endloop;
+                }
+                continue;
+            }
+
             // H(I||V||...
             eh_HashState curr_state(eh_state);
             curr_state.Update(pblock->nNonce.begin(), pblock->nNonce.size());
@@ -265,6 +274,8 @@ endloop:
         //mark miner address as important because it was used at least for one coinbase output
         std::visit(KeepMinerAddress(), minerAddress);
     }
+    // Deliver the notifications of the new blocks before returning.
+    SyncWithValidationInterfaceQueue();
     return blockHashes;
 }
 
@@ -561,6 +572,13 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp)
     MinerAddress minerAddress;
     GetMainSignals().AddressForMining(minerAddress);
 
+    // The template is shared by all requests. It is identified in longpollids
+    // by the hash of the block it builds on and a sequence number that is
+    // increased whenever it is replaced.
+    static CBlockIndex* pindexPrev;
+    static int64_t nStart;
+    static CBlockTemplate* pblocktemplate;
+    static uint64_t nTemplateId;
     static unsigned int nTransactionsUpdatedLast;
     static std::optional<CMutableTransaction> cached_next_cb_mtx;
     static int cached_next_cb_height;
@@ -573,33 +591,34 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp)
 
     std::optional<CMutableTransaction> next_cb_mtx(cached_next_cb_mtx);
 
+    uint64_t nTemplateIdLP = 0;
     if (!lpval.isNull())
     {
-        // Wait to respond until either the best block changes, OR some time passes and there are more transactions
+        // Wait to respond until either the best block changes, another request replaces
+        // the template, OR some time passes and there are more transactions
         uint256 hashWatchedChain;
         boost::system_time checktxtime;
-        unsigned int nTransactionsUpdatedLastLP;
 
         if (lpval.isStr())
         {
-            // Format: <hashBestChain><nTransactionsUpdatedLast>
+            // Format: <hashBestChain><nTemplateId>
             std::string lpstr = lpval.get_str();
 
             hashWatchedChain.SetHex(lpstr.substr(0, 64));
-            nTransactionsUpdatedLastLP = atoi64(lpstr.substr(64));
+            nTemplateIdLP = atoi64(lpstr.substr(64));
         }
         else
         {
             // NOTE: Spec does not specify behaviour for non-string longpollid, but this makes testing easier
             hashWatchedChain = chainActive.Tip()->GetBlockHash();
-            nTransactionsUpdatedLastLP = nTransactionsUpdatedLast;
+            nTemplateIdLP = nTemplateId;
         }
 
         {
             checktxtime = boost::get_system_time() + boost::posix_time::seconds(10);
 
             boost::unique_lock<boost::mutex> lock(csBestBlock);
-            while (chainActive.Tip()->GetBlockHash() == hashWatchedChain && IsRPCRunning())
+            while (chainActive.Tip()->GetBlockHash() == hashWatchedChain && nTemplateId == nTemplateIdLP && IsRPCRunning())
             {
                 // Release the main lock while waiting
                 LEAVE_CRITICAL_SECTION(cs_main);
@@ -623,8 +642,11 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp)
                 // while waiting for cs_main; if so, don't discard next_cb_mtx.
                 if (chainActive.Tip()->GetBlockHash() != hashWatchedChain) break;
 
+                // Another request has replaced the template
+                if (nTemplateId != nTemplateIdLP) break;
+
                 // Timeout: Check transactions for update
-                if (timedout && mempool.GetTransactionsUpdated() != nTransactionsUpdatedLastLP) {
+                if (timedout && mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast) {
                     // Create a non-empty block.
                     next_cb_mtx = nullopt;
                     break;
@@ -642,13 +664,33 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp)
         // TODO: Maybe recheck connections/IBD and (if something wrong) send an expires-immediately template to stop miners?
     }
 
-    // Update block
-    static CBlockIndex* pindexPrev;
-    static int64_t nStart;
-    static CBlockTemplate* pblocktemplate;
-    if (!lpval.isNull() || pindexPrev != chainActive.Tip() ||
-        (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast && GetTime() - nStart > 5))
+    // Update block, unless a request that waited for the same change has
+    // already done so
+    bool fTransactionsUpdated = mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast;
+    if (pindexPrev != chainActive.Tip() ||
+        (fTransactionsUpdated && (GetTime() - nStart > 5 || (!lpval.isNull() && nTemplateId == nTemplateIdLP))))
     {
+        // Throw an error if no address valid for mining was provided.
+        if (!std::visit(IsValidMinerAddress(), minerAddress)) {
+            throw JSONRPCError(RPC_INTERNAL_ERROR, "No miner address available (mining requires a wallet or -mineraddress)");
+        }
+
+        // After a new block, use the template that is built for it in the
+        // background, releasing the main lock while it is finished.
+        CBlockTemplate* pprebuilt = nullptr;
+        MinerAddress prebuiltAddress;
+        unsigned int nTransactionsUpdatedPrebuilt = 0;
+        if (pindexPrev != chainActive.Tip()) {
+            CBlockIndex* pindexTip = chainActive.Tip();
+            LEAVE_CRITICAL_SECTION(cs_main);
+            pprebuilt = TakePrebuiltTemplate(pindexTip, minerAddress, prebuiltAddress, nTransactionsUpdatedPrebuilt);
+            ENTER_CRITICAL_SECTION(cs_main);
+            if (pprebuilt && chainActive.Tip() != pindexTip) {
+                delete pprebuilt;
+                pprebuilt = nullptr;
+            }
+        }
+
         // Clear pindexPrev so future calls make a new block, despite any failures from here on
         pindexPrev = nullptr;
 
@@ -670,20 +712,28 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp)
             pblocktemplate = nullptr;
         }
 
-        // Throw an error if no address valid for mining was provided.
-        if (!std::visit(IsValidMinerAddress(), minerAddress)) {
-            throw JSONRPCError(RPC_INTERNAL_ERROR, "No miner address available (mining requires a wallet or -mineraddress)");
-        }
+        if (pprebuilt) {
+            pblocktemplate = pprebuilt;
+            nTransactionsUpdatedLast = nTransactionsUpdatedPrebuilt;
 
-        pblocktemplate = CreateNewBlock(Params(), minerAddress, next_cb_mtx);
-        if (!pblocktemplate)
-            throw JSONRPCError(RPC_OUT_OF_MEMORY, "Out of memory");
+            // Mark script as important because it was used at least for one coinbase output
+            std::visit(KeepMinerAddress(), prebuiltAddress);
+        } else {
+            pblocktemplate = CreateNewBlock(Params(), minerAddress, next_cb_mtx);
+            if (!pblocktemplate)
+                throw JSONRPCError(RPC_OUT_OF_MEMORY, "Out of memory");
 
-        // Mark script as important because it was used at least for one coinbase output
-        std::visit(KeepMinerAddress(), minerAddress);
+            // Mark script as important because it was used at least for one coinbase output
+            std::visit(KeepMinerAddress(), minerAddress);
+        }
 
         // Need to update only after we know CreateNewBlock succeeded
         pindexPrev = pindexPrevNew;
+        nTemplateId++;
+
+        // Wake up the other longpoll requests, and announce the new template
+        cvBlockChange.notify_all();
+        GetMainSignals().NewBlockTemplate(pindexPrev->GetBlockHash().GetHex() + i64tostr(nTemplateId));
     }
     CBlock* pblock = &pblocktemplate->block; // pointer for convenience
 
@@ -767,7 +817,7 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp)
         result.pushKV("coinbaseaux", aux);
         result.pushKV("coinbasevalue", (int64_t)pblock->vtx[0].vout[0].nValue);
     }
-    result.pushKV("longpollid", chainActive.Tip()->GetBlockHash().GetHex() + i64tostr(nTransactionsUpdatedLast));
+    result.pushKV("longpollid", pindexPrev->GetBlockHash().GetHex() + i64tostr(nTemplateId));
     result.pushKV("target", hashTarget.GetHex());
     result.pushKV("mintime", (int64_t)pindexPrev->GetMedianTimePast()+1);
     result.pushKV("mutable", aMutable);
@@ -8,6 +8,7 @@
 #include "key_io.h"
 #include "experimental_features.h"
 #include "main.h"
+#include "metrics.h"
 #include "net.h"
 #include "netbase.h"
 #include "rpc/server.h"
@@ -638,7 +639,11 @@ UniValue getaddressmempool(const UniValue& params, bool fHelp)
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address");
     }
     std::vector<std::pair<CMempoolAddressDeltaKey, CMempoolAddressDelta>> indexes;
-    mempool.getAddressIndex(addresses, indexes);
+    {
+        // The index may have to be built from the chain state.
+        LOCK(cs_main);
+        mempool.getAddressIndex(addresses, indexes, pcoinsTip);
+    }
     std::sort(indexes.begin(), indexes.end(),
         [](const std::pair<CMempoolAddressDeltaKey, CMempoolAddressDelta>& a,
            const std::pair<CMempoolAddressDeltaKey, CMempoolAddressDelta>& b) -> bool {
@@ -662,7 +667,7 @@ UniValue getaddressmempool(const UniValue& params, bool fHelp)
             delta.pushKV("prevtxid", it.second.prevhash.GetHex());
             delta.pushKV("prevout", (int)it.second.prevout);
         }
-        result.push_back(delta);
+        result.push_back(std::move(delta));
     }
     return result;
 }
@@ -800,8 +805,8 @@ static void getHeightRange(const UniValue& params, int& start, int& end)
         }
     }
 
-    LOCK(cs_main);  // for chainActive
-    if (start > chainActive.Height() || end > chainActive.Height()) {
+    const CBlockIndex* tip = chainActive.AtomicTip();
+    if (start > tip->nHeight || end > tip->nHeight) {
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Start or end is outside chain range");
     }
 }
@@ -848,6 +853,8 @@ UniValue getaddressdeltas(const UniValue& params, bool fHelp)
             "  \"start\"       (number, optional) The start block height\n"
             "  \"end\"         (number, optional) The end block height\n"
             "  \"chainInfo\"   (boolean, optional, default=false) Include chain info in results, only applies if start and end specified\n"
+            "  \"limit\"       (number, optional) Return at most this many deltas, and a cursor for the next page\n"
+            "  \"cursor\"      (string, optional) Continue after the delta that a previous page ended with\n"
             "}\n"
             "(or)\n"
             "\"address\"       (string) The base58check encoded address\n"
@@ -861,6 +868,12 @@ UniValue getaddressdeltas(const UniValue& params, bool fHelp)
             "    \"address\"   (string) The base58check encoded address\n"
             "  }, ...\n"
             "]\n\n"
+            "(or, if limit is given):\n\n"
+            "{\n"
+            "  \"deltas\":\n"
+            "    [ ... ],        (array) The deltas, as above, in the order of the given addresses\n"
+            "  \"cursor\"        (string, optional) Pass this as cursor to get the next page; absent on the last page\n"
+            "}\n\n"
             "(or, if chainInfo is true):\n\n"
             "{\n"
             "  \"deltas\":\n"
@@ -898,9 +911,61 @@ UniValue getaddressdeltas(const UniValue& params, bool fHelp)
     int end = 0;
     getHeightRange(params, start, end);
 
+    size_t limit = 0;
+    bool fCursor = false;
+    CAddressIndexKey cursor;
+    if (params[0].isObject()) {
+        UniValue limitValue = find_value(params[0].get_obj(), "limit");
+        if (!limitValue.isNull()) {
+            int nLimit = limitValue.get_int();
+            if (nLimit <= 0) {
+                throw JSONRPCError(RPC_INVALID_PARAMETER, "Limit is expected to be greater than zero");
+            }
+            limit = nLimit;
+        }
+        UniValue cursorValue = find_value(params[0].get_obj(), "cursor");
+        if (!cursorValue.isNull()) {
+            std::vector<unsigned char> cursorData(ParseHexV(cursorValue, "cursor"));
+            CDataStream ssCursor(cursorData, SER_NETWORK, PROTOCOL_VERSION);
+            try {
+                ssCursor >> cursor;
+            } catch (const std::exception&) {
+                throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid cursor");
+            }
+            fCursor = true;
+        }
+    }
+
     std::vector<std::pair<uint160, int>> addresses;
     std::vector<std::pair<CAddressIndexKey, CAmount>> addressIndex;
-    getAddressesInHeightRange(params, start, end, addresses, addressIndex);
+    if (limit == 0 && !fCursor) {
+        getAddressesInHeightRange(params, start, end, addresses, addressIndex);
+    } else {
+        if (!getAddressesFromParams(params, addresses)) {
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address");
+        }
+        // Addresses are walked in the order given, so a cursor resumes within
+        // the address it names and skips the ones before it.
+        auto it = addresses.begin();
+        if (fCursor) {
+            it = std::find(addresses.begin(), addresses.end(),
+                           std::make_pair(cursor.hashBytes, (int)cursor.type));
+            if (it == addresses.end()) {
+                throw JSONRPCError(RPC_INVALID_PARAMETER, "Cursor does not match any of the addresses");
+            }
+        }
+        for (bool fFirst = true; it != addresses.end(); ++it, fFirst = false) {
+            size_t nRemaining = limit == 0 ? 0 : limit - addressIndex.size();
+            if (limit > 0 && nRemaining == 0) {
+                break;
+            }
+            const CAddressIndexKey* after = (fCursor && fFirst) ? &cursor : nullptr;
+            if (!GetAddressIndex(it->first, it->second, addressIndex, start, end, after, nRemaining)) {
+                throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY,
+                    "No information available for address");
+            }
+        }
+    }
 
     bool includeChainInfo = false;
     if (params[0].isObject()) {
@@ -924,11 +989,22 @@ UniValue getaddressdeltas(const UniValue& params, bool fHelp)
         delta.pushKV("index", (int)it.first.index);
         delta.pushKV("satoshis", it.second);
         delta.pushKV("txid", it.first.txhash.GetHex());
-        deltas.push_back(delta);
+        deltas.push_back(std::move(delta));
     }
 
     UniValue result(UniValue::VOBJ);
 
+    if (limit > 0) {
+        result.pushKV("deltas", deltas);
+        // A full page may be followed by more; the next page can be empty.
+        if (addressIndex.size() == limit) {
+            CDataStream ssCursor(SER_NETWORK, PROTOCOL_VERSION);
+            ssCursor << addressIndex.back().first;
+            result.pushKV("cursor", HexStr(ssCursor.begin(), ssCursor.end()));
+        }
+        return result;
+    }
+
     if (!(includeChainInfo && start > 0 && end > 0)) {
         return deltas;
     }
@@ -936,12 +1012,13 @@ UniValue getaddressdeltas(const UniValue& params, bool fHelp)
     UniValue startInfo(UniValue::VOBJ);
     UniValue endInfo(UniValue::VOBJ);
     {
-        LOCK(cs_main);  // for chainActive
-        if (start > chainActive.Height() || end > chainActive.Height()) {
+        // The blocks are found from the tip, which does not need cs_main.
+        const CBlockIndex* tip = chainActive.AtomicTip();
+        if (start > tip->nHeight || end > tip->nHeight) {
             throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Start or end is outside chain range");
         }
-        startInfo.pushKV("hash", chainActive[start]->GetBlockHash().GetHex());
-        endInfo.pushKV("hash", chainActive[end]->GetBlockHash().GetHex());
+        startInfo.pushKV("hash", tip->GetAncestor(start)->GetBlockHash().GetHex());
+        endInfo.pushKV("hash", tip->GetAncestor(end)->GetBlockHash().GetHex());
     }
     startInfo.pushKV("height", start);
     endInfo.pushKV("height", end);
@@ -990,14 +1067,38 @@ UniValue getaddressbalance(const UniValue& params, bool fHelp)
             "Run './zcash-cli help getaddressbalance' for instructions on how to enable this feature.");
     }
 
+    CAmount balance = 0;
+    CAmount received = 0;
+
+    // Use the running balances kept with the address index if there are any,
+    // rather than adding up the whole history of each address.
+    if (fAddressBalances) {
+        std::vector<std::pair<uint160, int>> addresses;
+        if (!getAddressesFromParams(params, addresses)) {
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address");
+        }
+        for (const auto& it : addresses) {
+            CAmount addressBalance = 0;
+            CAmount addressReceived = 0;
+            if (!GetAddressBalance(it.first, it.second, addressBalance, addressReceived)) {
+                throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY,
+                    "No information available for address");
+            }
+            balance += addressBalance;
+            received += addressReceived;
+        }
+        UniValue result(UniValue::VOBJ);
+        result.pushKV("balance", balance);
+        result.pushKV("received", received);
+        return result;
+    }
+
     std::vector<std::pair<uint160, int>> addresses;
     std::vector<std::pair<CAddressIndexKey, CAmount>> addressIndex;
     // this method doesn't take start and end block height params, so set
     // to zero (full range, entire blockchain)
     getAddressesInHeightRange(params, 0, 0, addresses, addressIndex);
 
-    CAmount balance = 0;
-    CAmount received = 0;
     for (const auto& it : addressIndex) {
         if (it.second > 0) {
             received += it.second;
@@ -1166,6 +1267,20 @@ UniValue getmemoryinfo(const UniValue& params, bool fHelp)
             "    \"locked\": xxxxxx,       (numeric) Amount of bytes that succeeded locking. If this number is smaller than total, locking pages failed at some point and key data could be swapped to disk.\n"
             "    \"chunks_used\": xxxxx,   (numeric) Number allocated chunks\n"
             "    \"chunks_free\": xxxxx,   (numeric) Number unused chunks\n"
+            "  },\n"
+            "  \"usage\": {                (json object) Estimated number of bytes used by each major data structure\n"
+            "    \"addrman\": xxxxx,             (numeric) The table of known peer addresses\n"
+            "    \"block_index\": xxxxx,         (numeric) The block index, with the Equihash solutions it holds\n"
+            "    \"coins_cache\": xxxxx,         (numeric) The coins cache, including a chain state flush in progress\n"
+            "    \"mempool\": xxxxx,             (numeric) The mempool entries and their metadata\n"
+            "    \"mempool_indexes\": xxxxx,     (numeric) The mempool address and spent indexes\n"
+            "    \"peer_buffers\": xxxxx,        (numeric) The messages queued to be sent to and processed from peers\n"
+            "    \"peer_filters\": xxxxx,        (numeric) The filters of the addresses and inventory known to each peer\n"
+            "    \"sigcache\": xxxxx,            (numeric) The signature cache\n"
+            "    \"wallet_notes\": xxxxx,        (numeric) The wallet note indexes and nullifier maps, if the wallet is enabled\n"
+            "    \"wallet_transactions\": xxxxx, (numeric) The wallet transactions, if the wallet is enabled\n"
+            "    \"wallet_witnesses\": xxxxx,    (numeric) The witnesses of the wallet notes, if the wallet is enabled\n"
+            "    \"zk_params\": xxxxx            (numeric) The Sapling proving parameters, once they are loaded\n"
             "  }\n"
             "}\n"
             "\nExamples:\n"
@@ -1174,6 +1289,129 @@ UniValue getmemoryinfo(const UniValue& params, bool fHelp)
         );
     UniValue obj(UniValue::VOBJ);
     obj.pushKV("locked", RPCLockedMemoryInfo());
+    UniValue usage(UniValue::VOBJ);
+    for (const auto& item : GetMemoryUsage()) {
+        usage.pushKV(item.first, (uint64_t)item.second);
+    }
+    obj.pushKV("usage", usage);
+    return obj;
+}
+
+UniValue getlockstats(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() > 2)
+        throw runtime_error(
+            "getlockstats ( \"lock\" count )\n"
+            "Returns the lock sites that spent the most time waiting for their lock\n"
+            "since the node started, with how long they waited for and held it.\n"
+            "\nArguments:\n"
+            "1. \"lock\"      (string, optional) Only return the sites of locks whose name contains this, e.g. \"cs_main\"\n"
+            "2. count         (numeric, optional, default=20) The number of sites to return\n"
+            "\nResult:\n"
+            "[\n"
+            "  {\n"
+            "    \"lock\": \"name\",        (string) The lock, as written at the site\n"
+            "    \"site\": \"file:line\",   (string) Where the lock is taken\n"
+            "    \"locks\": n,             (numeric) The number of times the lock was taken there\n"
+            "    \"contentions\": n,       (numeric) How many of those had to wait for another thread\n"
+            "    \"wait_secs\": x.xxx,     (numeric) The total time spent waiting for the lock there\n"
+            "    \"hold_secs\": x.xxx      (numeric) The total time the lock was held from there\n"
+            "  }, ...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getlockstats", "")
+            + HelpExampleCli("getlockstats", "\"cs_main\" 10")
+            + HelpExampleRpc("getlockstats", "\"cs_main\", 10")
+        );
+
+    std::string strFilter;
+    if (params.size() > 0) {
+        strFilter = params[0].get_str();
+    }
+    int nCount = 20;
+    if (params.size() > 1) {
+        nCount = params[1].get_int();
+        if (nCount < 0)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Negative count");
+    }
+
+    // A site inside a template or a header can be registered more than once.
+    struct SiteTotals {
+        uint64_t nLocks = 0;
+        uint64_t nContentions = 0;
+        uint64_t nWaitMicros = 0;
+        uint64_t nHoldMicros = 0;
+    };
+    std::map<std::pair<std::string, std::string>, SiteTotals> mapSites;
+    for (const CLockSite* site : GetLockSites()) {
+        std::string strName(site->pszName);
+        if (strName.find(strFilter) == std::string::npos) {
+            continue;
+        }
+        SiteTotals& totals = mapSites[std::make_pair(strName, strprintf("%s:%d", site->pszFile, site->nLine))];
+        totals.nLocks += site->nLocks.load(std::memory_order_relaxed);
+        totals.nContentions += site->nContentions.load(std::memory_order_relaxed);
+        totals.nWaitMicros += site->nWaitMicros.load(std::memory_order_relaxed);
+        totals.nHoldMicros += site->nHoldMicros.load(std::memory_order_relaxed);
+    }
+
+    std::vector<std::pair<std::pair<std::string, std::string>, SiteTotals>> vSites(mapSites.begin(), mapSites.end());
+    std::sort(vSites.begin(), vSites.end(), [](const auto& a, const auto& b) {
+        return a.second.nWaitMicros > b.second.nWaitMicros;
+    });
+    if (vSites.size() > (size_t)nCount) {
+        vSites.resize(nCount);
+    }
+
+    UniValue result(UniValue::VARR);
+    for (const auto& [key, totals] : vSites) {
+        UniValue obj(UniValue::VOBJ);
+        obj.pushKV("lock", key.first);
+        obj.pushKV("site", key.second);
+        obj.pushKV("locks", totals.nLocks);
+        obj.pushKV("contentions", totals.nContentions);
+        obj.pushKV("wait_secs", totals.nWaitMicros * 0.000001);
+        obj.pushKV("hold_secs", totals.nHoldMicros * 0.000001);
+        result.push_back(obj);
+    }
+    return result;
+}
+
+UniValue setverificationthreads(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() > 1)
+        throw runtime_error(
+            "setverificationthreads ( threads )\n"
+            "Sets how many of the started threads verify scripts, proofs and headers and\n"
+            "prepare received messages, without restarting the node. With -adaptivepar,\n"
+            "the number also replaces -par as the one returned to at the tip.\n"
+            "\nArguments:\n"
+            "1. threads       (numeric, optional) The number of threads, counting the one that connects blocks,\n"
+            "                 from 1 to \"started\". If omitted, the number is not changed.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"threads\": n,          (numeric) The number of threads that verify\n"
+            "  \"started\": n           (numeric) The number of threads started, or 0 if -par=1 disabled parallel verification\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("setverificationthreads", "4")
+            + HelpExampleRpc("setverificationthreads", "4")
+        );
+
+    if (params.size() > 0) {
+        int nThreads = params[0].get_int();
+        if (nScriptCheckThreads == 0) {
+            throw JSONRPCError(RPC_MISC_ERROR, "Error: parallel verification is disabled. Restart with -par set to more than 1 or with -adaptivepar.");
+        }
+        if (!SetVerificationThreads(nThreads)) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER,
+                strprintf("threads must be between 1 and %d", nScriptCheckThreads));
+        }
+    }
+
+    UniValue obj(UniValue::VOBJ);
+    obj.pushKV("threads", nScriptCheckThreads ? GetVerificationThreads() : 0);
+    obj.pushKV("started", nScriptCheckThreads);
     return obj;
 }
 
@@ -1182,6 +1420,8 @@ static const CRPCCommand commands[] =
   //  --------------------- ------------------------  -----------------------  ----------
     { "control",            "getinfo",                &getinfo,                true  }, /* uses wallet if enabled */
     { "control",            "getmemoryinfo",          &getmemoryinfo,          true  },
+    { "control",            "getlockstats",           &getlockstats,           true  },
+    { "control",            "setverificationthreads", &setverificationthreads, true  },
     { "util",               "validateaddress",        &validateaddress,        true  }, /* uses wallet if enabled */
     { "util",               "z_validateaddress",      &z_validateaddress,      true  }, /* uses wallet if enabled */
     { "util",               "createmultisig",         &createmultisig,         true  },
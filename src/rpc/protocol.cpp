@@ -61,6 +61,117 @@ UniValue JSONRPCError(int code, const string& message)
     return error;
 }
 
+JSONStreamWriter::JSONStreamWriter(Sink sinkIn, size_t nChunkSizeIn) :
+    sink(sinkIn), nChunkSize(nChunkSizeIn), fAfterKey(false)
+{
+}
+
+void JSONStreamWriter::Separate()
+{
+    if (fAfterKey) {
+        fAfterKey = false;
+        return;
+    }
+    if (!vNonEmpty.empty()) {
+        if (vNonEmpty.back()) {
+            buffer += ',';
+        }
+        vNonEmpty.back() = true;
+    }
+}
+
+void JSONStreamWriter::Write(const std::string& str)
+{
+    buffer += str;
+    if (buffer.size() >= nChunkSize) {
+        Flush();
+    }
+}
+
+void JSONStreamWriter::BeginObject()
+{
+    Separate();
+    buffer += '{';
+    vNonEmpty.push_back(false);
+}
+
+void JSONStreamWriter::EndObject()
+{
+    assert(!vNonEmpty.empty() && !fAfterKey);
+    vNonEmpty.pop_back();
+    Write("}");
+}
+
+void JSONStreamWriter::BeginArray()
+{
+    Separate();
+    buffer += '[';
+    vNonEmpty.push_back(false);
+}
+
+void JSONStreamWriter::EndArray()
+{
+    assert(!vNonEmpty.empty() && !fAfterKey);
+    vNonEmpty.pop_back();
+    Write("]");
+}
+
+void JSONStreamWriter::Key(const std::string& key)
+{
+    assert(!vNonEmpty.empty() && !fAfterKey);
+    Separate();
+    // A string value writes itself with the escaping that JSON keys need.
+    buffer += UniValue(key).write();
+    buffer += ':';
+    fAfterKey = true;
+}
+
+void JSONStreamWriter::Value(const UniValue& value)
+{
+    Separate();
+    Write(value.write());
+}
+
+void JSONStreamWriter::Fields(const UniValue& obj)
+{
+    const std::vector<std::string>& keys = obj.getKeys();
+    const std::vector<UniValue>& values = obj.getValues();
+    for (size_t i = 0; i < keys.size(); i++) {
+        KV(keys[i], values[i]);
+    }
+}
+
+void JSONStreamWriter::Raw(const std::string& json)
+{
+    Write(json);
+}
+
+void JSONStreamWriter::RawValue(const std::string& json)
+{
+    Separate();
+    Write(json);
+}
+
+void JSONStreamWriter::Flush()
+{
+    if (!buffer.empty()) {
+        sink(buffer.data(), buffer.size());
+        buffer.clear();
+    }
+}
+
+void JSONRPCStreamReply(JSONStreamWriter& out, const std::function<void(JSONStreamWriter&)>& writeResult, const UniValue& id)
+{
+    out.BeginObject();
+    out.Key("result");
+    writeResult(out);
+    out.KV("error", NullUniValue);
+    out.KV("id", id);
+    out.EndObject();
+    out.Raw("\n");
+    out.Flush();
+}
+
 /** Username used when cookie authentication is in use (arbitrary, only for
  * recognizability in debugging/logging purposes)
  */
@@ -8,10 +8,12 @@
 
 #include "fs.h"
 
+#include <functional>
 #include <list>
 #include <map>
 #include <stdint.h>
 #include <string>
+#include <vector>
 
 #include <univalue.h>
 
@@ -82,6 +84,66 @@ UniValue JSONRPCReplyObj(const UniValue& result, const UniValue& error, const Un
 std::string JSONRPCReply(const UniValue& result, const UniValue& error, const UniValue& id);
 UniValue JSONRPCError(int code, const std::string& message);
 
+/**
+ * Writes JSON text a value at a time, passing it on to a sink in chunks of
+ * about nChunkSize bytes. Large RPC results can be written this way as they
+ * are produced, instead of being built as one UniValue and then written out
+ * as one string. Values written with Value() produce the same text as
+ * UniValue::write().
+ */
+class JSONStreamWriter
+{
+public:
+    typedef std::function<void(const char* data, size_t len)> Sink;
+
+    static const size_t DEFAULT_CHUNK_SIZE = 64 * 1024;
+
+private:
+    Sink sink;
+    size_t nChunkSize;
+    std::string buffer;
+    //! For each open object or array, whether it has any elements yet.
+    std::vector<bool> vNonEmpty;
+    bool fAfterKey;
+
+    void Separate();
+    void Write(const std::string& str);
+
+public:
+    JSONStreamWriter(Sink sinkIn, size_t nChunkSizeIn = DEFAULT_CHUNK_SIZE);
+
+    void BeginObject();
+    void EndObject();
+    void BeginArray();
+    void EndArray();
+    void Key(const std::string& key);
+    void Value(const UniValue& value);
+
+    void KV(const std::string& key, const UniValue& value)
+    {
+        Key(key);
+        Value(value);
+    }
+
+    //! Write the (key, value) pairs of obj into the current object.
+    void Fields(const UniValue& obj);
+
+    //! Write raw, already serialized JSON text.
+    void Raw(const std::string& json);
+
+    //! Write a value that is already serialized JSON text.
+    void RawValue(const std::string& json);
+
+    //! Pass everything written so far on to the sink.
+    void Flush();
+};
+
+/**
+ * Write a JSON-RPC reply whose result is written by writeResult, in the same
+ * format as JSONRPCReply.
+ */
+void JSONRPCStreamReply(JSONStreamWriter& out, const std::function<void(JSONStreamWriter&)>& writeResult, const UniValue& id);
+
 /** Get name of RPC authentication cookie file */
 fs::path GetAuthCookieFile();
 /** Generate a new RPC authentication cookie and write it to disk */
@@ -130,7 +130,7 @@ UniValue TxShieldedSpendsToJSON(const CTransaction& tx) {
         obj.pushKV("rk", spendDesc.rk.GetHex());
         obj.pushKV("proof", HexStr(spendDesc.zkproof.begin(), spendDesc.zkproof.end()));
         obj.pushKV("spendAuthSig", HexStr(spendDesc.spendAuthSig.begin(), spendDesc.spendAuthSig.end()));
-        vdesc.push_back(obj);
+        vdesc.push_back(std::move(obj));
     }
     return vdesc;
 }
@@ -145,7 +145,7 @@ UniValue TxShieldedOutputsToJSON(const CTransaction& tx) {
         obj.pushKV("encCiphertext", HexStr(outputDesc.encCiphertext.begin(), outputDesc.encCiphertext.end()));
         obj.pushKV("outCiphertext", HexStr(outputDesc.outCiphertext.begin(), outputDesc.outCiphertext.end()));
         obj.pushKV("proof", HexStr(outputDesc.zkproof.begin(), outputDesc.zkproof.end()));
-        vdesc.push_back(obj);
+        vdesc.push_back(std::move(obj));
     }
     return vdesc;
 }
@@ -179,7 +179,7 @@ void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue& entry)
             UniValue o(UniValue::VOBJ);
             o.pushKV("asm", ScriptToAsmStr(txin.scriptSig, true));
             o.pushKV("hex", HexStr(txin.scriptSig.begin(), txin.scriptSig.end()));
-            in.pushKV("scriptSig", o);
+            in.pushKV("scriptSig", std::move(o));
 
             // Add address and value info if spentindex enabled
             CSpentIndexValue spentInfo;
@@ -196,9 +196,9 @@ void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue& entry)
             }
         }
         in.pushKV("sequence", (int64_t)txin.nSequence);
-        vin.push_back(in);
+        vin.push_back(std::move(in));
     }
-    entry.pushKV("vin", vin);
+    entry.pushKV("vin", std::move(vin));
     UniValue vout(UniValue::VARR);
     for (unsigned int i = 0; i < tx.vout.size(); i++) {
         const CTxOut& txout = tx.vout[i];
@@ -209,7 +209,7 @@ void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue& entry)
         out.pushKV("n", (int64_t)i);
         UniValue o(UniValue::VOBJ);
         ScriptPubKeyToJSON(txout.scriptPubKey, o, true);
-        out.pushKV("scriptPubKey", o);
+        out.pushKV("scriptPubKey", std::move(o));
 
         // Add spent information if spentindex is enabled
         CSpentIndexValue spentInfo;
@@ -219,12 +219,12 @@ void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue& entry)
             out.pushKV("spentIndex", (int)spentInfo.inputIndex);
             out.pushKV("spentHeight", spentInfo.blockHeight);
         }
-        vout.push_back(out);
+        vout.push_back(std::move(out));
     }
-    entry.pushKV("vout", vout);
+    entry.pushKV("vout", std::move(vout));
 
     UniValue vjoinsplit = TxJoinSplitToJSON(tx);
-    entry.pushKV("vjoinsplit", vjoinsplit);
+    entry.pushKV("vjoinsplit", std::move(vjoinsplit));
 
     if (tx.fOverwintered && tx.nVersion >= SAPLING_TX_VERSION) {
         entry.pushKV("valueBalance", ValueFromAmount(tx.valueBalance));
@@ -253,6 +253,7 @@ void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue& entry)
 
     if (!hashBlock.IsNull()) {
         entry.pushKV("blockhash", hashBlock.GetHex());
+        LOCK(cs_main);
         BlockMap::iterator mi = mapBlockIndex.find(hashBlock);
         if (mi != mapBlockIndex.end() && (*mi).second) {
             CBlockIndex* pindex = (*mi).second;
@@ -269,6 +270,65 @@ void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue& entry)
     }
 }
 
+// Finds the transaction that getrawtransaction was asked for. Unless the
+// block to look in is given, this does not need cs_main when -txindex is on.
+static void getrawtransactionLookup(const UniValue& params, CTransaction& tx, uint256& hash_block,
+                                    CBlockIndex*& blockindex, bool& in_active_chain)
+{
+    uint256 hash = ParseHashV(params[0], "parameter 1");
+
+    if (params.size() > 2) {
+        uint256 blockhash = ParseHashV(params[2], "parameter 3");
+        if (!blockhash.IsNull()) {
+            LOCK(cs_main);
+            BlockMap::iterator it = mapBlockIndex.find(blockhash);
+            if (it == mapBlockIndex.end()) {
+                throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block hash not found");
+            }
+            blockindex = it->second;
+            in_active_chain = chainActive.Contains(blockindex);
+        }
+    }
+
+    if (!GetTransaction(hash, tx, Params().GetConsensus(), hash_block, true, blockindex)) {
+        std::string errmsg;
+        if (blockindex) {
+            LOCK(cs_main);
+            if (!(blockindex->nStatus & BLOCK_HAVE_DATA)) {
+                throw JSONRPCError(RPC_MISC_ERROR, "Block not available");
+            }
+            errmsg = "No such transaction found in the provided block";
+        } else {
+            errmsg = fTxIndex
+              ? "No such mempool or blockchain transaction"
+              : "No such mempool transaction. Use -txindex to enable blockchain transaction queries";
+        }
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, errmsg + ". Use gettransaction for wallet transactions.");
+    }
+}
+
+// The serialization of the transaction that getrawtransaction was asked for.
+// Transactions found through -txindex are not deserialized.
+static std::string getrawtransactionData(const UniValue& params)
+{
+    if (params.size() < 3 || ParseHashV(params[2], "parameter 3").IsNull()) {
+        std::vector<char> vTx;
+        uint256 hash_block;
+        if (GetTransactionData(ParseHashV(params[0], "parameter 1"), vTx, hash_block))
+            return std::string(vTx.begin(), vTx.end());
+    }
+
+    CTransaction tx;
+    uint256 hash_block;
+    CBlockIndex* blockindex = nullptr;
+    bool in_active_chain = true;
+    getrawtransactionLookup(params, tx, hash_block, blockindex, in_active_chain);
+
+    CDataStream ssTx(SER_NETWORK, PROTOCOL_VERSION);
+    ssTx << tx;
+    return ssTx.str();
+}
+
 UniValue getrawtransaction(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() < 1 || params.size() > 3)
@@ -371,50 +431,23 @@ UniValue getrawtransaction(const UniValue& params, bool fHelp)
             + HelpExampleCli("getrawtransaction", "\"mytxid\" 1 \"myblockhash\"")
         );
 
-    LOCK(cs_main);
-
-    bool in_active_chain = true;
-    uint256 hash = ParseHashV(params[0], "parameter 1");
-    CBlockIndex* blockindex = nullptr;
-
     bool fVerbose = false;
     if (params.size() > 1)
         fVerbose = (params[1].get_int() != 0);
 
-    if (params.size() > 2) {
-        uint256 blockhash = ParseHashV(params[2], "parameter 3");
-        if (!blockhash.IsNull()) {
-            BlockMap::iterator it = mapBlockIndex.find(blockhash);
-            if (it == mapBlockIndex.end()) {
-                throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block hash not found");
-            }
-            blockindex = it->second;
-            in_active_chain = chainActive.Contains(blockindex);
-        }
+    if (!fVerbose) {
+        std::string strTx = getrawtransactionData(params);
+        return HexStr(strTx.begin(), strTx.end());
     }
 
     CTransaction tx;
     uint256 hash_block;
-    if (!GetTransaction(hash, tx, Params().GetConsensus(), hash_block, true, blockindex)) {
-        std::string errmsg;
-        if (blockindex) {
-            if (!(blockindex->nStatus & BLOCK_HAVE_DATA)) {
-                throw JSONRPCError(RPC_MISC_ERROR, "Block not available");
-            }
-            errmsg = "No such transaction found in the provided block";
-        } else {
-            errmsg = fTxIndex
-              ? "No such mempool or blockchain transaction"
-              : "No such mempool transaction. Use -txindex to enable blockchain transaction queries";
-        }
-        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, errmsg + ". Use gettransaction for wallet transactions.");
-    }
+    CBlockIndex* blockindex = nullptr;
+    bool in_active_chain = true;
+    getrawtransactionLookup(params, tx, hash_block, blockindex, in_active_chain);
 
     string strHex = EncodeHexTx(tx);
 
-    if (!fVerbose)
-        return strHex;
-
     UniValue result(UniValue::VOBJ);
     if (blockindex) result.pushKV("in_active_chain", in_active_chain);
     result.pushKV("hex", strHex);
@@ -422,6 +455,16 @@ UniValue getrawtransaction(const UniValue& params, bool fHelp)
     return result;
 }
 
+static bool getrawtransaction_binary(const UniValue& params, std::string& out)
+{
+    // Only the non-verbose result is the serialized transaction.
+    if (params.size() < 1 || params.size() > 3 || (params.size() > 1 && params[1].get_int() != 0))
+        return false;
+
+    out = getrawtransactionData(params);
+    return true;
+}
+
 UniValue gettxoutproof(const UniValue& params, bool fHelp)
 {
     if (fHelp || (params.size() != 1 && params.size() != 2))
@@ -470,9 +513,9 @@ UniValue gettxoutproof(const UniValue& params, bool fHelp)
             throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
         pblockindex = mapBlockIndex[hashBlock];
     } else {
-        CCoins coins;
-        if (pcoinsTip->GetCoins(oneTxid, coins) && coins.nHeight > 0 && coins.nHeight <= chainActive.Height())
-            pblockindex = chainActive[coins.nHeight];
+        const Coin& coin = AccessByTxid(*pcoinsTip, oneTxid);
+        if (!coin.IsSpent() && coin.nHeight > 0 && coin.nHeight <= chainActive.Height())
+            pblockindex = chainActive[coin.nHeight];
     }
 
     if (pblockindex == NULL)
@@ -912,9 +955,7 @@ UniValue signrawtransaction(const UniValue& params, bool fHelp)
         view.SetBackend(viewMempool); // temporarily switch cache backend to db+mempool view
 
         for (const CTxIn& txin : mergedTx.vin) {
-            const uint256& prevHash = txin.prevout.hash;
-            CCoins coins;
-            view.AccessCoins(prevHash); // this is certainly allowed to fail
+            view.AccessCoin(txin.prevout); // Load entries from viewChain into view; can fail.
         }
 
         view.SetBackend(viewDummy); // switch back to avoid locking mempool for too long
@@ -958,24 +999,27 @@ UniValue signrawtransaction(const UniValue& params, bool fHelp)
             if (nOut < 0)
                 throw JSONRPCError(RPC_DESERIALIZATION_ERROR, "vout must be positive");
 
+            COutPoint out(txid, nOut);
+
             vector<unsigned char> pkData(ParseHexO(prevOut, "scriptPubKey"));
             CScript scriptPubKey(pkData.begin(), pkData.end());
 
             {
-                CCoinsModifier coins = view.ModifyCoins(txid);
-                if (coins->IsAvailable(nOut) && coins->vout[nOut].scriptPubKey != scriptPubKey) {
+                const Coin& coin = view.AccessCoin(out);
+                if (!coin.IsSpent() && coin.out.scriptPubKey != scriptPubKey) {
                     string err("Previous output scriptPubKey mismatch:\n");
-                    err = err + ScriptToAsmStr(coins->vout[nOut].scriptPubKey) + "\nvs:\n"+
+                    err = err + ScriptToAsmStr(coin.out.scriptPubKey) + "\nvs:\n"+
                         ScriptToAsmStr(scriptPubKey);
                     throw JSONRPCError(RPC_DESERIALIZATION_ERROR, err);
                 }
-                if ((unsigned int)nOut >= coins->vout.size())
-                    coins->vout.resize(nOut+1);
-                coins->vout[nOut].scriptPubKey = scriptPubKey;
-                coins->vout[nOut].nValue = 0;
+                Coin newcoin;
+                newcoin.out.scriptPubKey = scriptPubKey;
+                newcoin.out.nValue = 0;
                 if (prevOut.exists("amount")) {
-                    coins->vout[nOut].nValue = AmountFromValue(find_value(prevOut, "amount"));
+                    newcoin.out.nValue = AmountFromValue(find_value(prevOut, "amount"));
                 }
+                newcoin.nHeight = 1;
+                view.AddCoin(out, std::move(newcoin), true);
             }
 
             // if redeemScript given and not using the local wallet (private keys
@@ -1038,34 +1082,51 @@ UniValue signrawtransaction(const UniValue& params, bool fHelp)
     UniValue vErrors(UniValue::VARR);
 
     // Use CTransaction for the constant parts of the
-    // transaction to avoid rehashing.
+    // transaction to avoid rehashing. The signature hashes do not cover the
+    // scriptSigs, so every input is signed against it, with the signature
+    // hash components computed once.
     const CTransaction txConst(mergedTx);
-    // Sign what we can:
+    const PrecomputedTransactionData txdata(txConst);
+    std::vector<CTxOut> vPrevOuts(mergedTx.vin.size());
+    std::vector<char> vFound(mergedTx.vin.size());
     for (unsigned int i = 0; i < mergedTx.vin.size(); i++) {
-        CTxIn& txin = mergedTx.vin[i];
-        const CCoins* coins = view.AccessCoins(txin.prevout.hash);
-        if (coins == NULL || !coins->IsAvailable(txin.prevout.n)) {
-            TxInErrorToJSON(txin, vErrors, "Input not found or already spent");
-            continue;
+        const Coin& coin = view.AccessCoin(mergedTx.vin[i].prevout);
+        vFound[i] = !coin.IsSpent();
+        if (vFound[i]) {
+            vPrevOuts[i] = coin.out;
+        }
+    }
+
+    // Sign what we can, spreading the inputs over threads:
+    std::vector<ScriptError> vScriptErrors(mergedTx.vin.size(), SCRIPT_ERR_OK);
+    std::vector<char> vVerified(mergedTx.vin.size());
+    ParallelFor(mergedTx.vin.size(), GetNumCores(), [&](size_t i) {
+        if (!vFound[i]) {
+            return;
         }
-        const CScript& prevPubKey = coins->vout[txin.prevout.n].scriptPubKey;
-        const CAmount& amount = coins->vout[txin.prevout.n].nValue;
+        const CScript& prevPubKey = vPrevOuts[i].scriptPubKey;
+        const CAmount& amount = vPrevOuts[i].nValue;
 
         SignatureData sigdata;
         // Only sign SIGHASH_SINGLE if there's a corresponding output:
         if (!fHashSingle || (i < mergedTx.vout.size()))
-            ProduceSignature(MutableTransactionSignatureCreator(&keystore, &mergedTx, i, amount, nHashType), prevPubKey, sigdata, consensusBranchId);
+            ProduceSignature(TransactionSignatureCreator(&keystore, &txConst, i, amount, txdata, nHashType), prevPubKey, sigdata, consensusBranchId);
 
         // ... and merge in other signatures:
+        TransactionSignatureChecker checker(&txConst, i, amount, txdata);
         for (const CMutableTransaction& txv : txVariants) {
-            sigdata = CombineSignatures(prevPubKey, TransactionSignatureChecker(&txConst, i, amount), sigdata, DataFromTransaction(txv, i), consensusBranchId);
+            sigdata = CombineSignatures(prevPubKey, checker, sigdata, DataFromTransaction(txv, i), consensusBranchId);
         }
 
         UpdateTransaction(mergedTx, i, sigdata);
 
-        ScriptError serror = SCRIPT_ERR_OK;
-        if (!VerifyScript(txin.scriptSig, prevPubKey, STANDARD_SCRIPT_VERIFY_FLAGS, TransactionSignatureChecker(&txConst, i, amount), consensusBranchId, &serror)) {
-            TxInErrorToJSON(txin, vErrors, ScriptErrorString(serror));
+        vVerified[i] = VerifyScript(mergedTx.vin[i].scriptSig, prevPubKey, STANDARD_SCRIPT_VERIFY_FLAGS, checker, consensusBranchId, &vScriptErrors[i]);
+    });
+    for (unsigned int i = 0; i < mergedTx.vin.size(); i++) {
+        if (!vFound[i]) {
+            TxInErrorToJSON(mergedTx.vin[i], vErrors, "Input not found or already spent");
+        } else if (!vVerified[i]) {
+            TxInErrorToJSON(mergedTx.vin[i], vErrors, ScriptErrorString(vScriptErrors[i]));
         }
     }
     bool fComplete = vErrors.empty();
@@ -1080,6 +1141,56 @@ UniValue signrawtransaction(const UniValue& params, bool fHelp)
     return result;
 }
 
+/**
+ * Add a decoded transaction to the mempool and relay it, as
+ * sendrawtransaction does, throwing the JSON-RPC error it returns if the
+ * transaction is rejected.
+ */
+static void SubmitRawTransaction(const CChainParams& chainparams, const CTransaction& tx, bool fOverrideFees)
+{
+    AssertLockHeld(cs_main);
+    uint256 hashTx = tx.GetHash();
+
+    // DoS mitigation: reject transactions expiring soon
+    if (tx.nExpiryHeight > 0) {
+        int nextBlockHeight = chainActive.Height() + 1;
+        if (chainparams.GetConsensus().NetworkUpgradeActive(nextBlockHeight, Consensus::UPGRADE_OVERWINTER)) {
+            if (nextBlockHeight + TX_EXPIRING_SOON_THRESHOLD > tx.nExpiryHeight) {
+                throw JSONRPCError(RPC_TRANSACTION_REJECTED,
+                    strprintf("tx-expiring-soon: expiryheight is %d but should be at least %d to avoid transaction expiring soon",
+                    tx.nExpiryHeight,
+                    nextBlockHeight + TX_EXPIRING_SOON_THRESHOLD));
+            }
+        }
+    }
+
+    CCoinsViewCache &view = *pcoinsTip;
+    bool fHaveChain = false;
+    for (size_t o = 0; !fHaveChain && o < tx.vout.size(); o++) {
+        const Coin& existingCoin = view.AccessCoin(COutPoint(hashTx, o));
+        fHaveChain = !existingCoin.IsSpent();
+    }
+    bool fHaveMempool = mempool.exists(hashTx);
+    if (!fHaveMempool && !fHaveChain) {
+        // push to local node and sync with wallets
+        CValidationState state;
+        bool fMissingInputs;
+        if (!AcceptToMemoryPool(chainparams, mempool, state, tx, false, &fMissingInputs, !fOverrideFees)) {
+            if (state.IsInvalid()) {
+                throw JSONRPCError(RPC_TRANSACTION_REJECTED, strprintf("%i: %s", state.GetRejectCode(), state.GetRejectReason()));
+            } else {
+                if (fMissingInputs) {
+                    throw JSONRPCError(RPC_TRANSACTION_ERROR, "Missing inputs");
+                }
+                throw JSONRPCError(RPC_TRANSACTION_ERROR, state.GetRejectReason());
+            }
+        }
+    } else if (fHaveChain) {
+        throw JSONRPCError(RPC_TRANSACTION_ALREADY_IN_CHAIN, "transaction already in block chain");
+    }
+    RelayTransaction(tx);
+}
+
 UniValue sendrawtransaction(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() < 1 || params.size() > 2)
@@ -1110,51 +1221,144 @@ UniValue sendrawtransaction(const UniValue& params, bool fHelp)
     CTransaction tx;
     if (!DecodeHexTx(tx, params[0].get_str()))
         throw JSONRPCError(RPC_DESERIALIZATION_ERROR, "TX decode failed");
-    uint256 hashTx = tx.GetHash();
 
-    auto chainparams = Params();
+    bool fOverrideFees = false;
+    if (params.size() > 1)
+        fOverrideFees = params[1].get_bool();
 
-    // DoS mitigation: reject transactions expiring soon
-    if (tx.nExpiryHeight > 0) {
-        int nextBlockHeight = chainActive.Height() + 1;
-        if (chainparams.GetConsensus().NetworkUpgradeActive(nextBlockHeight, Consensus::UPGRADE_OVERWINTER)) {
-            if (nextBlockHeight + TX_EXPIRING_SOON_THRESHOLD > tx.nExpiryHeight) {
-                throw JSONRPCError(RPC_TRANSACTION_REJECTED,
-                    strprintf("tx-expiring-soon: expiryheight is %d but should be at least %d to avoid transaction expiring soon",
-                    tx.nExpiryHeight,
-                    nextBlockHeight + TX_EXPIRING_SOON_THRESHOLD));
-            }
-        }
-    }
+    SubmitRawTransaction(Params(), tx, fOverrideFees);
+    return tx.GetHash().GetHex();
+}
 
+UniValue sendrawtransactions(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() < 1 || params.size() > 2)
+        throw runtime_error(
+            "sendrawtransactions [\"hexstring\",...] ( allowhighfees )\n"
+            "\nSubmits many raw transactions (serialized, hex-encoded) to local node and network.\n"
+            "\nThe context-free checks of the transactions are run in parallel, and their"
+            "\nproofs and signatures are verified together, without holding the lock that"
+            "\nsendrawtransaction holds while it verifies them. The transactions are then"
+            "\nadded to the mempool with parents before children, so they may spend each"
+            "\nother's outputs. Each transaction is accepted or rejected on its own.\n"
+            "\nArguments:\n"
+            "1. \"hexstrings\"   (array, required) The hex strings of the raw transactions\n"
+            "2. allowhighfees    (boolean, optional, default=false) Allow high fees\n"
+            "\nResult:\n"
+            "[                   (array) One object per transaction, in the order they were given\n"
+            "  {\n"
+            "    \"txid\": \"hex\",   (string) The transaction hash, unless it could not be decoded\n"
+            "    \"error\": {       (object) The error sendrawtransaction would have returned, or null if it was accepted\n"
+            "      \"code\": n,     (numeric) The error code\n"
+            "      \"message\": \"text\" (string) The error message\n"
+            "    }\n"
+            "  }\n"
+            "  ,...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("sendrawtransactions", "\"[\\\"signedhex\\\",\\\"signedhex\\\"]\"") +
+            "\nAs a json rpc call\n"
+            + HelpExampleRpc("sendrawtransactions", "[\"signedhex\",\"signedhex\"]")
+        );
+
+    RPCTypeCheck(params, boost::assign::list_of(UniValue::VARR)(UniValue::VBOOL));
+    const UniValue& hexstrings = params[0].get_array();
     bool fOverrideFees = false;
     if (params.size() > 1)
         fOverrideFees = params[1].get_bool();
 
-    CCoinsViewCache &view = *pcoinsTip;
-    const CCoins* existingCoins = view.AccessCoins(hashTx);
-    bool fHaveMempool = mempool.exists(hashTx);
-    bool fHaveChain = existingCoins && existingCoins->nHeight < 1000000000;
-    if (!fHaveMempool && !fHaveChain) {
-        // push to local node and sync with wallets
-        CValidationState state;
-        bool fMissingInputs;
-        if (!AcceptToMemoryPool(chainparams, mempool, state, tx, false, &fMissingInputs, !fOverrideFees)) {
-            if (state.IsInvalid()) {
-                throw JSONRPCError(RPC_TRANSACTION_REJECTED, strprintf("%i: %s", state.GetRejectCode(), state.GetRejectReason()));
-            } else {
-                if (fMissingInputs) {
-                    throw JSONRPCError(RPC_TRANSACTION_ERROR, "Missing inputs");
-                }
-                throw JSONRPCError(RPC_TRANSACTION_ERROR, state.GetRejectReason());
+    auto chainparams = Params();
+    size_t nTxs = hexstrings.size();
+    std::vector<CTransaction> vtx(nTxs);
+    std::vector<bool> vDecoded(nTxs, false);
+    std::vector<UniValue> vErrors(nTxs, NullUniValue);
+    for (size_t i = 0; i < nTxs; i++) {
+        if (!hexstrings[i].isStr() || !DecodeHexTx(vtx[i], hexstrings[i].get_str())) {
+            vErrors[i] = JSONRPCError(RPC_DESERIALIZATION_ERROR, "TX decode failed");
+        } else {
+            vDecoded[i] = true;
+        }
+    }
+
+    // Run the context-free checks in parallel, so that malformed transactions
+    // are rejected before any of their proofs are verified.
+    std::vector<CValidationState> vStates(nTxs);
+    std::vector<char> vChecked(nTxs, false);
+    ParallelFor(nTxs, GetNumCores(), [&](size_t i) {
+        vChecked[i] = vDecoded[i] && CheckTransactionWithoutProofVerification(vtx[i], vStates[i]);
+    }, WorkPriority::MEMPOOL);
+
+    // Verify the proofs of the transactions that passed together, without
+    // holding cs_main. AcceptToMemoryPool then finds them in the proof cache.
+    uint32_t consensusBranchId;
+    {
+        LOCK(cs_main);
+        consensusBranchId = CurrentEpochBranchId(chainActive.Height() + 1, chainparams.GetConsensus());
+    }
+    std::vector<const CTransaction*> vtxProofs;
+    std::map<uint256, size_t> mapBatch;
+    for (size_t i = 0; i < nTxs; i++) {
+        if (vChecked[i]) {
+            vtxProofs.push_back(&vtx[i]);
+            mapBatch.emplace(vtx[i].GetHash(), i);
+        } else if (vDecoded[i]) {
+            vErrors[i] = JSONRPCError(RPC_TRANSACTION_REJECTED, strprintf("%i: %s", vStates[i].GetRejectCode(), vStates[i].GetRejectReason()));
+        }
+    }
+    CacheTransactionProofs(vtxProofs, consensusBranchId);
+
+    // Submit the transactions with the parents in the batch first. This
+    // orders them with Kahn's algorithm rather than by recursion, so that a
+    // long chain within the batch cannot exhaust the stack.
+    std::vector<size_t> vParents(nTxs, 0);
+    std::vector<std::vector<size_t>> vChildren(nTxs);
+    for (size_t i = 0; i < nTxs; i++) {
+        if (!vChecked[i]) {
+            continue;
+        }
+        std::set<size_t> setParents;
+        for (const CTxIn& txin : vtx[i].vin) {
+            auto it = mapBatch.find(txin.prevout.hash);
+            if (it != mapBatch.end() && it->second != i && setParents.insert(it->second).second) {
+                vChildren[it->second].push_back(i);
+            }
+        }
+        vParents[i] = setParents.size();
+    }
+    std::vector<size_t> vOrder;
+    for (size_t i = 0; i < nTxs; i++) {
+        if (vChecked[i] && vParents[i] == 0) {
+            vOrder.push_back(i);
+        }
+    }
+    for (size_t n = 0; n < vOrder.size(); n++) {
+        for (size_t child : vChildren[vOrder[n]]) {
+            if (--vParents[child] == 0) {
+                vOrder.push_back(child);
+            }
+        }
+    }
+    {
+        LOCK(cs_main);
+        for (size_t i : vOrder) {
+            try {
+                SubmitRawTransaction(chainparams, vtx[i], fOverrideFees);
+            } catch (const UniValue& objError) {
+                vErrors[i] = objError;
             }
         }
-    } else if (fHaveChain) {
-        throw JSONRPCError(RPC_TRANSACTION_ALREADY_IN_CHAIN, "transaction already in block chain");
     }
-    RelayTransaction(tx);
 
-    return hashTx.GetHex();
+    UniValue results(UniValue::VARR);
+    for (size_t i = 0; i < nTxs; i++) {
+        UniValue result(UniValue::VOBJ);
+        if (vDecoded[i]) {
+            result.pushKV("txid", vtx[i].GetHash().GetHex());
+        }
+        result.pushKV("error", vErrors[i]);
+        results.push_back(result);
+    }
+    return results;
 }
 
 static const CRPCCommand commands[] =
@@ -1165,6 +1369,7 @@ static const CRPCCommand commands[] =
     { "rawtransactions",    "decoderawtransaction",   &decoderawtransaction,   true  },
     { "rawtransactions",    "decodescript",           &decodescript,           true  },
     { "rawtransactions",    "sendrawtransaction",     &sendrawtransaction,     false },
+    { "rawtransactions",    "sendrawtransactions",    &sendrawtransactions,    false },
     { "rawtransactions",    "signrawtransaction",     &signrawtransaction,     false }, /* uses wallet if enabled */
 
     { "blockchain",         "gettxoutproof",          &gettxoutproof,          true  },
@@ -1175,4 +1380,6 @@ void RegisterRawTransactionRPCCommands(CRPCTable &tableRPC)
 {
     for (unsigned int vcidx = 0; vcidx < ARRAYLEN(commands); vcidx++)
         tableRPC.appendCommand(commands[vcidx].name, &commands[vcidx]);
+
+    tableRPC.appendBinaryCommand("getrawtransaction", &getrawtransaction_binary);
 }
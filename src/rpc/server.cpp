@@ -16,7 +16,9 @@
 #include "utilstrencodings.h"
 #include "asyncrpcqueue.h"
 
+#include <atomic>
 #include <memory>
+#include <thread>
 
 #include <univalue.h>
 
@@ -38,6 +40,7 @@ static bool fRPCRunning = false;
 static bool fRPCInWarmup = true;
 static std::string rpcWarmupStatus("RPC server started");
 static CCriticalSection cs_rpcWarmup;
+int nRPCBatchThreads = DEFAULT_RPC_BATCH_THREADS;
 /* Timer-creating functions */
 static std::vector<RPCTimerInterface*> timerInterfaces;
 /* Map of name to timer.
@@ -288,6 +291,62 @@ UniValue setlogfilter(const UniValue& params, bool fHelp)
 }
 
 
+UniValue setspanprofiling(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() < 1 || params.size() > 3) {
+        throw runtime_error(
+            "setspanprofiling enabled ( \"filename\" samplerate )\n"
+            "\nStarts or stops writing a sampled profile of the time spent in the tracing\n"
+            "spans that the log filter enables (see setlogfilter), in the folded stack\n"
+            "format read by flame graph tools such as inferno and flamegraph.pl.\n"
+            "\nArguments:\n"
+            "1. enabled      (boolean, required) Whether to write the profile.\n"
+            "2. \"filename\"   (string, optional, default=\"spans.folded\") The file to write, relative to the data directory.\n"
+            "3. samplerate   (numeric, optional, default=1) Record one in every samplerate trees of spans.\n"
+            "\nExamples:\n"
+            + HelpExampleCli("setspanprofiling", "true \"spans.folded\" 10")
+            + HelpExampleCli("setspanprofiling", "false")
+            + HelpExampleRpc("setspanprofiling", "true, \"spans.folded\", 10")
+        );
+    }
+
+    if (!pTracingHandle) {
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Tracing is not initialized");
+    }
+
+    if (!params[0].get_bool()) {
+        tracing_profile_stop(pTracingHandle);
+        return NullUniValue;
+    }
+
+    std::string strFilename = "spans.folded";
+    if (params.size() > 1) {
+        strFilename = params[1].get_str();
+    }
+    int nSampleRate = 1;
+    if (params.size() > 2) {
+        nSampleRate = params[2].get_int();
+        if (nSampleRate < 1) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "samplerate must be at least 1");
+        }
+    }
+
+    fs::path pathProfile = fs::absolute(strFilename, GetDataDir());
+    const fs::path::string_type& pathProfileStr = pathProfile.native();
+    static_assert(sizeof(fs::path::value_type) == sizeof(codeunit),
+                    "native path has unexpected code unit size");
+    if (!tracing_profile_start(
+            pTracingHandle,
+            reinterpret_cast<const codeunit*>(pathProfileStr.c_str()),
+            pathProfileStr.length(),
+            nSampleRate)) {
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Failed to create the profile; check logs");
+    }
+
+    return NullUniValue;
+}
+
+
 UniValue stop(const UniValue& params, bool fHelp)
 {
     // Accept the deprecated and ignored 'detach' boolean argument
@@ -310,6 +369,7 @@ static const CRPCCommand vRPCCommands[] =
     /* Overall control/query calls */
     { "control",            "help",                   &help,                   true  },
     { "control",            "setlogfilter",           &setlogfilter,           true  },
+    { "control",            "setspanprofiling",       &setspanprofiling,       true  },
     { "control",            "stop",                   &stop,                   true  },
 };
 
@@ -347,26 +407,43 @@ bool CRPCTable::appendCommand(const std::string& name, const CRPCCommand* pcmd)
     return true;
 }
 
+bool CRPCTable::appendStreamCommand(const std::string& name, rpcstreamfn_type fn)
+{
+    if (IsRPCRunning())
+        return false;
+
+    if (!mapCommands.count(name) || mapStreamCommands.count(name))
+        return false;
+
+    mapStreamCommands[name] = fn;
+    return true;
+}
+
+bool CRPCTable::appendBinaryCommand(const std::string& name, rpcbinaryfn_type fn)
+{
+    if (IsRPCRunning())
+        return false;
+
+    if (!mapCommands.count(name) || mapBinaryCommands.count(name))
+        return false;
+
+    mapBinaryCommands[name] = fn;
+    return true;
+}
+
 bool StartRPC()
 {
     LogPrint("rpc", "Starting RPC\n");
     fRPCRunning = true;
     g_rpcSignals.Started();
 
-    // Launch one async rpc worker.  The ability to launch multiple workers is not recommended at present and thus the option is disabled.
-    getAsyncRPCQueue()->addWorker();
-/*
-    int n = GetArg("-rpcasyncthreads", 1);
-    if (n<1) {
-        LogPrintf("ERROR: Invalid value %d for -rpcasyncthreads.  Must be at least 1.\n", n);
-        strerr = strprintf(_("An error occurred while setting up the Async RPC threads, invalid parameter value of %d (must be at least 1)."), n);
-        uiInterface.ThreadSafeMessageBox(strerr, "", CClientUIInterface::MSG_ERROR);
-        StartShutdown();
-        return;
-    }
-    for (int i = 0; i < n; i++)
+    nRPCBatchThreads = std::max(1, std::min((int)GetArg("-rpcbatchthreads", DEFAULT_RPC_BATCH_THREADS), MAX_RPC_BATCH_THREADS));
+
+    // The operations lock the inputs that they select, so several workers
+    // can run them at once. Their proofs share the -provingthreads threads.
+    int nAsyncThreads = std::max(1, std::min((int)GetArg("-rpcasyncthreads", DEFAULT_RPC_ASYNC_THREADS), MAX_RPC_ASYNC_THREADS));
+    for (int i = 0; i < nAsyncThreads; i++)
         getAsyncRPCQueue()->addWorker();
-*/
     return true;
 }
 
@@ -470,9 +547,26 @@ static UniValue JSONRPCExecOne(const UniValue& req)
 
 std::string JSONRPCExecBatch(const UniValue& vReq)
 {
+    // The thread serving the request takes elements in turn with the helper
+    // threads, so that one slow element does not hold up the others.
+    std::vector<UniValue> replies(vReq.size());
+    std::atomic<size_t> nextIdx{0};
+    auto execElements = [&vReq, &replies, &nextIdx]() {
+        for (size_t reqIdx = nextIdx++; reqIdx < vReq.size(); reqIdx = nextIdx++)
+            replies[reqIdx] = JSONRPCExecOne(vReq[reqIdx]);
+    };
+
+    size_t nThreads = std::min((size_t)nRPCBatchThreads, vReq.size());
+    std::vector<std::thread> helpers;
+    for (size_t i = 1; i < nThreads; i++)
+        helpers.emplace_back(execElements);
+    execElements();
+    for (std::thread& helper : helpers)
+        helper.join();
+
     UniValue ret(UniValue::VARR);
-    for (size_t reqIdx = 0; reqIdx < vReq.size(); reqIdx++)
-        ret.push_back(JSONRPCExecOne(vReq[reqIdx]));
+    for (UniValue& reply : replies)
+        ret.push_back(std::move(reply));
 
     return ret.write() + "\n";
 }
@@ -506,6 +600,71 @@ UniValue CRPCTable::execute(const std::string &strMethod, const UniValue &params
     g_rpcSignals.PostCommand(*pcmd);
 }
 
+void CRPCTable::executeStream(const std::string &strMethod, const UniValue &params, JSONStreamWriter &out) const
+{
+    // Return immediately if in warmup
+    {
+        LOCK(cs_rpcWarmup);
+        if (fRPCInWarmup)
+            throw JSONRPCError(RPC_IN_WARMUP, rpcWarmupStatus);
+    }
+
+    // Find method
+    const CRPCCommand *pcmd = tableRPC[strMethod];
+    if (!pcmd)
+        throw JSONRPCError(RPC_METHOD_NOT_FOUND, "Method not found");
+
+    g_rpcSignals.PreCommand(*pcmd);
+
+    try
+    {
+        // Execute
+        std::map<std::string, rpcstreamfn_type>::const_iterator it = mapStreamCommands.find(strMethod);
+        if (it != mapStreamCommands.end()) {
+            it->second(params, out);
+        } else {
+            out.Value(pcmd->actor(params, false));
+        }
+    }
+    catch (const std::exception& e)
+    {
+        throw JSONRPCError(RPC_MISC_ERROR, e.what());
+    }
+
+    g_rpcSignals.PostCommand(*pcmd);
+}
+
+bool CRPCTable::executeBinary(const std::string &strMethod, const UniValue &params, std::string &out) const
+{
+    std::map<std::string, rpcbinaryfn_type>::const_iterator it = mapBinaryCommands.find(strMethod);
+    if (it == mapBinaryCommands.end())
+        return false;
+
+    // Return immediately if in warmup
+    {
+        LOCK(cs_rpcWarmup);
+        if (fRPCInWarmup)
+            throw JSONRPCError(RPC_IN_WARMUP, rpcWarmupStatus);
+    }
+
+    const CRPCCommand *pcmd = tableRPC[strMethod];
+    g_rpcSignals.PreCommand(*pcmd);
+
+    bool fBinary;
+    try
+    {
+        // Execute
+        fBinary = it->second(params, out);
+    }
+    catch (const std::exception& e)
+    {
+        throw JSONRPCError(RPC_MISC_ERROR, e.what());
+    }
+
+    g_rpcSignals.PostCommand(*pcmd);
+    return fBinary;
+}
+
 std::vector<std::string> CRPCTable::listCommands() const
 {
     std::vector<std::string> commandList;
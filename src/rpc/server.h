@@ -21,6 +21,17 @@
 class AsyncRPCQueue;
 class CRPCCommand;
 
+/** Default for -rpcbatchthreads, the number of threads that run the elements of a batch request */
+static const int DEFAULT_RPC_BATCH_THREADS = 1;
+/** Maximum for -rpcbatchthreads */
+static const int MAX_RPC_BATCH_THREADS = 16;
+/** Default for -rpcblockcache, the number of recent blocks whose getblock results are cached */
+static const int DEFAULT_RPC_BLOCK_CACHE = 10;
+/** Default for -rpcasyncthreads, the number of workers that run async operations such as z_sendmany */
+static const int DEFAULT_RPC_ASYNC_THREADS = 1;
+/** Maximum for -rpcasyncthreads */
+static const int MAX_RPC_ASYNC_THREADS = 16;
+
 namespace RPCServer
 {
     void OnStarted(std::function<void ()> slot);
@@ -117,6 +128,20 @@ void RPCRunLater(const std::string& name, std::function<void(void)> func, int64_
 
 typedef UniValue(*rpcfn_type)(const UniValue& params, bool fHelp);
 
+/**
+ * Writes the result of a command with large results to out as it is
+ * produced. Invalid parameters are reported by throwing, as with rpcfn_type,
+ * before anything is written.
+ */
+typedef void(*rpcstreamfn_type)(const UniValue& params, JSONStreamWriter& out);
+
+/**
+ * Sets out to the raw serialization of a command's result, for clients that
+ * ask for a binary reply. Returns false if the result asked for by params
+ * has no binary form, in which case the command's JSON result is used.
+ */
+typedef bool(*rpcbinaryfn_type)(const UniValue& params, std::string& out);
+
 class CRPCCommand
 {
 public:
@@ -133,6 +158,8 @@ class CRPCTable
 {
 private:
     std::map<std::string, const CRPCCommand*> mapCommands;
+    std::map<std::string, rpcstreamfn_type> mapStreamCommands;
+    std::map<std::string, rpcbinaryfn_type> mapBinaryCommands;
 public:
     CRPCTable();
     const CRPCCommand* operator[](const std::string& name) const;
@@ -147,6 +174,24 @@ public:
      */
     UniValue execute(const std::string &method, const UniValue &params) const;
 
+    /**
+     * Execute a method, writing its result to out. Methods with a streaming
+     * variant write their result as it is produced; for the others, this is
+     * the same as writing the result of execute().
+     * @throws an exception (UniValue) when an error happens, in which case
+     * part of the result may already have been written.
+     */
+    void executeStream(const std::string &method, const UniValue &params, JSONStreamWriter &out) const;
+
+    /**
+     * Execute a method for a client that asked for a binary reply.
+     * @returns true if out was set to the raw serialization of the result,
+     * or false if the method has no binary form for these params, in which
+     * case the caller should execute it as usual.
+     * @throws an exception (UniValue) when an error happens.
+     */
+    bool executeBinary(const std::string &method, const UniValue &params, std::string &out) const;
+
     /**
     * Returns a list of registered commands
     * @returns List of registered commands.
@@ -160,6 +205,18 @@ public:
      * Commands cannot be overwritten (returns false).
      */
     bool appendCommand(const std::string& name, const CRPCCommand* pcmd);
+
+    /**
+     * Appends a streaming variant of an existing command. The command's
+     * CRPCCommand still provides its help, and serves batch requests.
+     */
+    bool appendStreamCommand(const std::string& name, rpcstreamfn_type fn);
+
+    /**
+     * Appends a binary variant of an existing command, used for singleton
+     * requests whose Accept header asks for application/octet-stream.
+     */
+    bool appendBinaryCommand(const std::string& name, rpcbinaryfn_type fn);
 };
 
 extern CRPCTable tableRPC;
@@ -174,6 +231,8 @@ extern std::vector<unsigned char> ParseHexV(const UniValue& v, std::string strNa
 extern std::vector<unsigned char> ParseHexO(const UniValue& o, std::string strKey);
 
 extern int64_t nWalletUnlockTime;
+/** Number of threads that run the elements of a batch request, set from -rpcbatchthreads */
+extern int nRPCBatchThreads;
 extern CAmount AmountFromValue(const UniValue& value);
 extern UniValue ValueFromAmount(const CAmount& amount);
 extern double GetDifficulty(const CBlockIndex* blockindex = NULL);
@@ -184,9 +243,19 @@ extern std::string HelpExampleRpc(const std::string& methodname, const std::stri
 
 extern void EnsureWalletIsUnlocked();
 
+/**
+ * Keep the getblock results of the nBlocks most recently connected blocks in
+ * memory, as they are requested far more often than older blocks.
+ */
+void StartRecentBlockCache(size_t nBlocks);
+
 bool StartRPC();
 void InterruptRPC();
 void StopRPC();
+/**
+ * Execute the elements of a batch request, on up to -rpcbatchthreads
+ * threads, and return the replies in the order of the requests.
+ */
 std::string JSONRPCExecBatch(const UniValue& vReq);
 
 extern std::string experimentalDisabledHelpMsg(const std::string& rpc, const std::vector<std::string>& enableArgs);
@@ -46,17 +46,31 @@ extern "C" {
 
     bool librustzcash_ivk_to_pkd(const unsigned char *ivk, const unsigned char *diversifier, unsigned char *result);
 
-    /// Loads the zk-SNARK parameters into memory and saves
-    /// paths as necessary. Only called once.
+    /// Loads the verifying keys of the zk-SNARK parameters into
+    /// memory and saves paths as necessary. Only called once.
+    ///
+    /// The verifying keys are read from the cache file at
+    /// vk_cache_path if it was written for the same parameter
+    /// files, and otherwise from the parameter files, after which
+    /// the cache file is written. vk_cache_path may be null. The
+    /// Sapling proving parameters are loaded when they are first
+    /// used, or immediately if load_proving is true.
     void librustzcash_init_zksnark_params(
         const codeunit* spend_path,
         size_t spend_path_len,
         const codeunit* output_path,
         size_t output_path_len,
         const codeunit* sprout_path,
-        size_t sprout_path_len
+        size_t sprout_path_len,
+        const codeunit* vk_cache_path,
+        size_t vk_cache_path_len,
+        bool load_proving
     );
 
+    /// Returns whether the Sapling proving parameters have been
+    /// loaded.
+    bool librustzcash_sapling_proving_params_loaded();
+
     /// Validates the provided Equihash solution against
     /// the given parameters, input and nonce.
     bool librustzcash_eh_isvalid(
@@ -93,6 +107,25 @@ extern "C" {
         unsigned char *result
     );
 
+    /// Computes the merkle tree hashes of `count` pairs of
+    /// nodes at a given depth, as `librustzcash_merkle_hash`
+    /// would for each pair. The `depth` parameter should not
+    /// be larger than 62.
+    ///
+    /// `nodes` must be of length `64 * count`, holding the
+    /// left and right child of each pair back to back, and
+    /// each node must be a scalar of BLS12-381.
+    ///
+    /// The hashes are placed in `result`, which must be of
+    /// length `32 * count`. Large batches are hashed on
+    /// several threads.
+    void librustzcash_merkle_hash_many(
+        size_t depth,
+        const unsigned char *nodes,
+        size_t count,
+        unsigned char *result
+    );
+
     /// Computes the signature for each Spend description, given the key
     /// `ask`, the re-randomization `ar`, the 32-byte sighash `sighash`,
     /// and an output `result` buffer of 64-bytes for the signature.
@@ -108,6 +141,11 @@ extern "C" {
     /// Creates a Sapling proving context. Please free this when you're done.
     void * librustzcash_sapling_proving_ctx_init();
 
+    /// Creates a Sapling proving context that writes placeholders instead of
+    /// proofs, for regtest with `-regtestfastmode`. Please free this when
+    /// you're done.
+    void * librustzcash_sapling_proving_ctx_init_placeholder();
+
     /// This function (using the proving context) constructs a Spend proof
     /// given the necessary witness information. It outputs `cv` (the value
     /// commitment) and `rk` (so that you don't have to compute it) along
@@ -154,6 +192,11 @@ extern "C" {
     /// `librustzcash_sapling_proving_ctx_init`.
     void librustzcash_sapling_proving_ctx_free(void *);
 
+    /// Adds the spends and outputs proved with the Sapling proving context
+    /// `other` to `ctx`, so that the binding signature can be made with
+    /// `ctx`. `other` is left unchanged, and must still be freed.
+    void librustzcash_sapling_proving_ctx_merge(void *ctx, const void *other);
+
     /// Creates a Sapling verification context. Please free this
     /// when you're done.
     void * librustzcash_sapling_verification_ctx_init();
@@ -194,6 +237,56 @@ extern "C" {
     /// `librustzcash_sapling_verification_ctx_init`.
     void librustzcash_sapling_verification_ctx_free(void *);
 
+    /// Creates a Sapling batch validator. Please free this when you're done.
+    ///
+    /// A batch validator performs the same checks as a verification context,
+    /// but defers the Groth16 proof checks of every description passed to it,
+    /// across any number of transactions, to a single call to
+    /// `librustzcash_sapling_batch_validator_validate`.
+    void * librustzcash_sapling_batch_validator_init();
+
+    /// Check the validity of a Sapling Spend description, accumulating the
+    /// value commitment into the batch and queueing its proof.
+    bool librustzcash_sapling_batch_validator_check_spend(
+        void *batch,
+        const unsigned char *cv,
+        const unsigned char *anchor,
+        const unsigned char *nullifier,
+        const unsigned char *rk,
+        const unsigned char *zkproof,
+        const unsigned char *spendAuthSig,
+        const unsigned char *sighashValue
+    );
+
+    /// Check the validity of a Sapling Output description, accumulating the
+    /// value commitment into the batch and queueing its proof.
+    bool librustzcash_sapling_batch_validator_check_output(
+        void *batch,
+        const unsigned char *cv,
+        const unsigned char *cm,
+        const unsigned char *ephemeralKey,
+        const unsigned char *zkproof
+    );
+
+    /// Checks the binding signature of the transaction whose descriptions
+    /// were most recently added to the batch, given valueBalance. This must
+    /// be called once per transaction, after all of its descriptions.
+    bool librustzcash_sapling_batch_validator_final_check(
+        void *batch,
+        int64_t valueBalance,
+        const unsigned char *bindingSig,
+        const unsigned char *sighashValue
+    );
+
+    /// Verifies all proofs queued in the batch. If this returns false, at
+    /// least one queued proof is invalid, and the transactions must be
+    /// checked individually to identify it.
+    bool librustzcash_sapling_batch_validator_validate(void *batch);
+
+    /// Frees a Sapling batch validator returned from
+    /// `librustzcash_sapling_batch_validator_init`.
+    void librustzcash_sapling_batch_validator_free(void *batch);
+
     /// Compute a Sapling nullifier.
     ///
     /// The `diversifier` parameter must be 11 bytes in length.
@@ -236,6 +329,22 @@ extern "C" {
         unsigned char *result
     );
 
+    /// Compute [ivk] [8] epk for every pair of one
+    /// of the n_epks 32-byte points in epks and one
+    /// of the n_ivks 32-byte Fs in ivks. The result
+    /// for epks[i] and ivks[j] is written to the
+    /// 32 bytes at results + 32 * (i * n_ivks + j),
+    /// and valid[i * n_ivks + j] is set to false if
+    /// either key is invalid.
+    void librustzcash_sapling_ka_agree_batch(
+        const unsigned char *epks,
+        size_t n_epks,
+        const unsigned char *ivks,
+        size_t n_ivks,
+        unsigned char *results,
+        bool *valid
+    );
+
     /// Compute g_d = GH(diversifier) and returns
     /// false if the diversifier is invalid.
     /// Computes [esk] g_d and writes the result
@@ -52,6 +52,25 @@ void blake2b_finalize(
     unsigned char* output,
     size_t output_len);
 
+/// Computes `count` BLAKE2b hashes with no key and no salt, several at a
+/// time using the widest vector instructions the CPU supports.
+///
+/// Message `i` is the `prefix_len` bytes at `prefix` followed by the
+/// `suffix_len` bytes at `suffixes + i * suffix_len`, and its hash is written
+/// to `outputs + i * output_len`.
+///
+/// `personalization` MUST be a pointer to a 16-byte array, and `outputs` MUST
+/// have room for `count * output_len` bytes.
+void blake2b_hash_many(
+    size_t output_len,
+    const unsigned char* personalization,
+    const unsigned char* prefix,
+    size_t prefix_len,
+    const unsigned char* suffixes,
+    size_t suffix_len,
+    size_t count,
+    unsigned char* outputs);
+
 #ifdef __cplusplus
 }
 #endif
@@ -18,6 +18,9 @@
 extern "C" {
 #endif
 
+struct Ed25519BatchValidator;
+typedef struct Ed25519BatchValidator Ed25519BatchValidator;
+
 /// Generates a new Ed25519 keypair.
 void ed25519_generate_keypair(
     Ed25519SigningKey* sk,
@@ -52,6 +55,30 @@ bool ed25519_verify(
     const unsigned char* msg,
     size_t msglen);
 
+/// Creates a batch validator for Ed25519 signatures.
+///
+/// Please free this with `ed25519_batch_validator_free` when you are done.
+Ed25519BatchValidator* ed25519_batch_validator_init();
+
+/// Frees a batch validator returned by `ed25519_batch_validator_init`.
+void ed25519_batch_validator_free(Ed25519BatchValidator* batch);
+
+/// Queues a purported `signature` on the given `msg` for verification by
+/// `ed25519_batch_validator_validate`.
+void ed25519_batch_validator_queue(
+    Ed25519BatchValidator* batch,
+    const Ed25519VerificationKey* vk,
+    const Ed25519Signature* signature,
+    const unsigned char* msg,
+    size_t msglen);
+
+/// Verifies every signature queued in the batch since the last call, with
+/// the same consensus rules as `ed25519_verify`, and empties the batch.
+///
+/// Returns false if any of them is invalid, without identifying which; the
+/// signatures must then be verified individually to find it.
+bool ed25519_batch_validator_validate(Ed25519BatchValidator* batch);
+
 #ifdef __cplusplus
 }
 #endif
@@ -23,21 +23,49 @@ typedef struct TracingHandle TracingHandle;
 /// Initializes the tracing crate, returning a handle for the logging
 /// component. The handle must be freed to close the logging component.
 ///
-/// If log_path is NULL, logging is sent to standard output.
+/// If log_path is NULL, logging is sent to standard output. Otherwise lines
+/// are written to the file by a worker thread, through a queue that holds up
+/// to buffered_lines lines. When it is full, lines are dropped if lossy is
+/// set, and the logging thread waits otherwise.
+///
+/// If rate_limit is not zero, the debug and trace events of each target
+/// beyond rate_limit per second are dropped.
 TracingHandle* tracing_init(
     const codeunit* log_path,
     size_t log_path_len,
     const char* initial_filter,
-    bool log_timestamps);
+    bool log_timestamps,
+    size_t buffered_lines,
+    bool lossy,
+    uint32_t rate_limit);
 
 /// Frees a tracing handle returned from `tracing_init`;
 void tracing_free(TracingHandle* handle);
 
+/// Returns the number of lines that were dropped because the queue of the
+/// log file was full.
+uint64_t tracing_dropped_lines(const TracingHandle* handle);
+
 /// Reloads the tracing filter.
 ///
 /// Returns `true` if the reload succeeded.
 bool tracing_reload(TracingHandle* handle, const char* new_filter);
 
+/// Starts writing a sampled profile of the entered spans to the file at
+/// profile_path, in the folded stack format read by flame graph tools. One
+/// in every sample_rate trees of spans is recorded. If a profile is already
+/// being written, it is closed and replaced.
+///
+/// Returns `false` if the file could not be created.
+bool tracing_profile_start(
+    TracingHandle* handle,
+    const codeunit* profile_path,
+    size_t profile_path_len,
+    uint64_t sample_rate);
+
+/// Stops the profile started by `tracing_profile_start`, if any.
+void tracing_profile_stop(TracingHandle* handle);
+
 struct TracingCallsite;
 typedef struct TracingCallsite TracingCallsite;
 
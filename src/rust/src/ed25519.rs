@@ -2,7 +2,7 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or https://www.opensource.org/licenses/mit-license.php .
 
-use ed25519_zebra::{Signature, SigningKey, VerificationKey};
+use ed25519_zebra::{batch, Signature, SigningKey, VerificationKey, VerificationKeyBytes};
 use libc::{c_uchar, size_t};
 use rand_core::OsRng;
 use std::convert::TryFrom;
@@ -65,3 +65,44 @@ pub extern "C" fn ed25519_verify(
 
     vk.verify(&signature, msg).is_ok()
 }
+
+#[no_mangle]
+pub extern "C" fn ed25519_batch_validator_init() -> *mut batch::Verifier {
+    Box::into_raw(Box::new(batch::Verifier::new()))
+}
+
+#[no_mangle]
+pub extern "C" fn ed25519_batch_validator_free(batch: *mut batch::Verifier) {
+    if !batch.is_null() {
+        drop(unsafe { Box::from_raw(batch) });
+    }
+}
+
+#[no_mangle]
+pub extern "C" fn ed25519_batch_validator_queue(
+    batch: *mut batch::Verifier,
+    vk: *const [u8; 32],
+    signature: *const [u8; 64],
+    msg: *const c_uchar,
+    msg_len: size_t,
+) {
+    let batch = unsafe { batch.as_mut() }.unwrap();
+
+    // The encoding of the verification key is only checked when the batch
+    // is verified, with the same rules as ed25519_verify.
+    let vk = VerificationKeyBytes::from(*unsafe { vk.as_ref() }.unwrap());
+    let signature = Signature::from(*unsafe { signature.as_ref() }.unwrap());
+    let msg = unsafe { slice::from_raw_parts(msg, msg_len) };
+
+    batch.queue((vk, signature, &msg));
+}
+
+#[no_mangle]
+pub extern "C" fn ed25519_batch_validator_validate(batch: *mut batch::Verifier) -> bool {
+    let batch = unsafe { batch.as_mut() }.unwrap();
+
+    // Verifying consumes the queued signatures; leave an empty batch behind.
+    std::mem::replace(batch, batch::Verifier::new())
+        .verify(OsRng)
+        .is_ok()
+}
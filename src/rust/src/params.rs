@@ -0,0 +1,166 @@
+//! Loading of the zk-SNARK parameters.
+//!
+//! Validating the chain only needs the verifying keys, which are at the start
+//! of each parameter file. The verifying keys are cached in a small file, so
+//! that later startups do not have to read and hash the parameter files. The
+//! proving parameters are only read when a proof is first created.
+
+use bellman::groth16::{Parameters, VerifyingKey};
+use bls12_381::Bls12;
+use std::fs::{self, File};
+use std::io::{self, BufReader, Read};
+use std::path::Path;
+use std::time::UNIX_EPOCH;
+
+/// The BLAKE2b-512 hashes of the parameter files, as checked by
+/// `zcash_proofs::load_parameters`.
+pub(crate) const SAPLING_SPEND_HASH: &str = "8270785a1a0d0bc77196f000ee6d221c9c9894f55307bd9357c3f0105d31ca63991ab91324160d8f53e2bbd3c2633a6eb8bdf5205d822e7f3f73edac51b2b70c";
+pub(crate) const SAPLING_OUTPUT_HASH: &str = "657e3d38dbb5cb5e7dd2970e8b03d69b4787dd907285b5a7f0790dcc8072f60bf593b32cc2d1c030e00ff5ae64bf84c5c3beb84ddc841d48264b4a171744d028";
+pub(crate) const SPROUT_HASH: &str = "e9b238411bd6c0ec4791e9d04245ec350c9c5744f5610dfcce4365d5ca49dfefd5054e371842b3f88fa1b9d7e8e075249b3ebabd167fa8b0f3161292d36c180a";
+
+/// Identifies the format of a verifying key cache file.
+const VK_CACHE_MAGIC: &[u8; 8] = b"zcvkc001";
+
+/// Hashes everything that is read through it.
+struct HashReader<R: Read> {
+    reader: R,
+    hasher: blake2b_simd::State,
+}
+
+impl<R: Read> HashReader<R> {
+    fn new(reader: R) -> Self {
+        HashReader {
+            reader,
+            hasher: blake2b_simd::State::new(),
+        }
+    }
+
+    fn into_hash(self) -> String {
+        self.hasher.finalize().to_hex().to_string()
+    }
+}
+
+impl<R: Read> Read for HashReader<R> {
+    fn read(&mut self, buf: &mut [u8]) -> io::Result<usize> {
+        let n = self.reader.read(buf)?;
+        self.hasher.update(&buf[..n]);
+        Ok(n)
+    }
+}
+
+fn open_params(path: &Path, name: &str) -> BufReader<File> {
+    let fs = File::open(path)
+        .unwrap_or_else(|e| panic!("couldn't load {} parameters file: {}", name, e));
+    BufReader::with_capacity(1024 * 1024, fs)
+}
+
+/// Reads the verifying key at the start of a parameter file, and checks the
+/// hash of the whole file.
+pub(crate) fn read_verifying_key(path: &Path, hash: &str, name: &str) -> VerifyingKey<Bls12> {
+    let mut fs = HashReader::new(open_params(path, name));
+    let vk = VerifyingKey::<Bls12>::read(&mut fs)
+        .unwrap_or_else(|e| panic!("couldn't deserialize {} verifying key: {}", name, e));
+
+    // Read the rest of the file, so that its hash can be checked.
+    io::copy(&mut fs, &mut io::sink())
+        .unwrap_or_else(|e| panic!("couldn't finish reading {} parameters file: {}", name, e));
+    if fs.into_hash() != hash {
+        panic!(
+            "{} parameter file is not correct, please clean your `~/.zcash-params/` and re-run `fetch-params`.",
+            name
+        );
+    }
+
+    vk
+}
+
+/// Reads all of a parameter file, and checks that its verifying key is the
+/// one that was checked when the node started.
+pub(crate) fn read_parameters(
+    path: &Path,
+    vk: &VerifyingKey<Bls12>,
+    name: &str,
+) -> Parameters<Bls12> {
+    let mut fs = open_params(path, name);
+    let params = Parameters::<Bls12>::read(&mut fs, false)
+        .unwrap_or_else(|e| panic!("couldn't deserialize {} parameters file: {}", name, e));
+    if params.vk != *vk {
+        panic!(
+            "{} parameter file has changed since the node started, please restart it.",
+            name
+        );
+    }
+    params
+}
+
+/// The length and modification time of a file, which identify the parameter
+/// file that a cached verifying key was read from.
+fn file_identity(path: &Path) -> io::Result<(u64, u64)> {
+    let metadata = fs::metadata(path)?;
+    let mtime = metadata
+        .modified()?
+        .duration_since(UNIX_EPOCH)
+        .map(|d| d.as_secs())
+        .unwrap_or(0);
+    Ok((metadata.len(), mtime))
+}
+
+fn read_u64(reader: &mut &[u8]) -> Option<u64> {
+    let mut bytes = [0u8; 8];
+    reader.read_exact(&mut bytes).ok()?;
+    Some(u64::from_le_bytes(bytes))
+}
+
+/// Reads the verifying keys of the given parameter files from a cache file,
+/// if it is intact and was written for the same files.
+///
+/// The cache file holds the magic bytes, then for each parameter file its
+/// length, its modification time and its verifying key, and then the
+/// BLAKE2b-512 hash of all of that.
+pub(crate) fn read_vk_cache(cache: &Path, files: &[&Path]) -> Option<Vec<VerifyingKey<Bls12>>> {
+    let data = fs::read(cache).ok()?;
+    if data.len() < VK_CACHE_MAGIC.len() + 64 {
+        return None;
+    }
+    let (body, hash) = data.split_at(data.len() - 64);
+    if blake2b_simd::blake2b(body).as_bytes() != hash || !body.starts_with(VK_CACHE_MAGIC) {
+        return None;
+    }
+
+    let mut reader = &body[VK_CACHE_MAGIC.len()..];
+    let mut vks = Vec::with_capacity(files.len());
+    for path in files {
+        let (len, mtime) = file_identity(path).ok()?;
+        if read_u64(&mut reader)? != len || read_u64(&mut reader)? != mtime {
+            return None;
+        }
+        vks.push(VerifyingKey::<Bls12>::read(&mut reader).ok()?);
+    }
+    if !reader.is_empty() {
+        return None;
+    }
+    Some(vks)
+}
+
+/// Writes the verifying keys of the given parameter files to a cache file.
+pub(crate) fn write_vk_cache(
+    cache: &Path,
+    files: &[&Path],
+    vks: &[&VerifyingKey<Bls12>],
+) -> io::Result<()> {
+    let mut body = VK_CACHE_MAGIC.to_vec();
+    for (path, vk) in files.iter().zip(vks) {
+        let (len, mtime) = file_identity(path)?;
+        body.extend_from_slice(&len.to_le_bytes());
+        body.extend_from_slice(&mtime.to_le_bytes());
+        vk.write(&mut body)?;
+    }
+    let hash = blake2b_simd::blake2b(&body);
+    body.extend_from_slice(hash.as_bytes());
+
+    // Write the cache in full before replacing the previous one, so that a
+    // partial write is never read.
+    let tmp = cache.with_extension("tmp");
+    fs::write(&tmp, &body)?;
+    fs::rename(&tmp, cache)
+}
@@ -0,0 +1,244 @@
+// Copyright (c) 2021 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+//! Sapling proving contexts that can be merged.
+//!
+//! A [`ProvingContext`] creates Spend and Output proofs in the same way as
+//! `SaplingProvingContext`, accumulating the value commitment randomness that
+//! the binding signature is made with. Unlike it, the accumulators of several
+//! contexts can be added together with [`ProvingContext::merge`], so that the
+//! proofs of one transaction can be created on separate threads, each with a
+//! context of its own.
+//!
+//! A context made with [`ProvingContext::new_placeholder`] skips the Groth16
+//! proofs, writing placeholders that no verifier accepts, but computes the
+//! value commitments and randomized keys as usual. It is only used on regtest
+//! with `-regtestfastmode`, where proofs are not verified.
+
+use bellman::{
+    gadgets::multipack,
+    groth16::{create_random_proof, verify_proof, Parameters, PreparedVerifyingKey, Proof},
+};
+use bls12_381::Bls12;
+use group::{Curve, GroupEncoding};
+use rand_core::{OsRng, RngCore};
+use zcash_primitives::{
+    constants::{
+        SPENDING_KEY_GENERATOR, VALUE_COMMITMENT_RANDOMNESS_GENERATOR,
+        VALUE_COMMITMENT_VALUE_GENERATOR,
+    },
+    merkle_tree::MerklePath,
+    primitives::{Diversifier, Note, PaymentAddress, ProofGenerationKey, Rseed, ValueCommitment},
+    redjubjub::{PrivateKey, PublicKey, Signature},
+    sapling::Node,
+    transaction::components::Amount,
+};
+use zcash_proofs::circuit::sapling::{Output, Spend};
+
+pub struct ProvingContext {
+    /// The value commitment randomness of the spends, less that of the outputs.
+    bsk: jubjub::Fr,
+    /// The value commitments of the spends, less those of the outputs.
+    bvk: jubjub::ExtendedPoint,
+    /// Whether placeholders are written instead of proofs.
+    placeholder: bool,
+}
+
+/// The proof written by placeholder contexts.
+fn placeholder_proof() -> Proof<Bls12> {
+    Proof {
+        a: bls12_381::G1Affine::identity(),
+        b: bls12_381::G2Affine::identity(),
+        c: bls12_381::G1Affine::identity(),
+    }
+}
+
+/// Returns uniformly random value commitment randomness.
+fn random_rcv() -> jubjub::Fr {
+    let mut bytes = [0u8; 64];
+    OsRng.fill_bytes(&mut bytes);
+    jubjub::Fr::from_bytes_wide(&bytes)
+}
+
+impl ProvingContext {
+    pub fn new() -> Self {
+        ProvingContext {
+            bsk: jubjub::Fr::zero(),
+            bvk: jubjub::ExtendedPoint::identity(),
+            placeholder: false,
+        }
+    }
+
+    pub fn new_placeholder() -> Self {
+        ProvingContext {
+            placeholder: true,
+            ..ProvingContext::new()
+        }
+    }
+
+    /// Creates a Spend proof, and returns it with the value commitment and
+    /// the re-randomized spend authorizing key of the spend.
+    #[allow(clippy::too_many_arguments)]
+    pub fn spend_proof(
+        &mut self,
+        proof_generation_key: ProofGenerationKey,
+        diversifier: Diversifier,
+        rseed: Rseed,
+        ar: jubjub::Fr,
+        value: u64,
+        anchor: bls12_381::Scalar,
+        merkle_path: MerklePath<Node>,
+        proving_key: &Parameters<Bls12>,
+        verifying_key: &PreparedVerifyingKey<Bls12>,
+    ) -> Result<(Proof<Bls12>, jubjub::ExtendedPoint, PublicKey), ()> {
+        let rcv = random_rcv();
+        let value_commitment = ValueCommitment {
+            value,
+            randomness: rcv,
+        };
+
+        let viewing_key = proof_generation_key.to_viewing_key();
+        let payment_address = viewing_key.to_payment_address(diversifier).ok_or(())?;
+
+        let rk = PublicKey(proof_generation_key.ak.clone().into())
+            .randomize(ar, SPENDING_KEY_GENERATOR);
+
+        if self.placeholder {
+            let value_commitment: jubjub::ExtendedPoint = value_commitment.commitment().into();
+            self.bsk += rcv;
+            self.bvk += value_commitment;
+            return Ok((placeholder_proof(), value_commitment, rk));
+        }
+
+        let note = Note {
+            value,
+            g_d: diversifier.g_d().ok_or(())?,
+            pk_d: payment_address.pk_d().clone(),
+            rseed,
+        };
+        let nullifier = note.nf(&viewing_key, merkle_path.position);
+
+        let instance = Spend {
+            value_commitment: Some(value_commitment.clone()),
+            proof_generation_key: Some(proof_generation_key),
+            payment_address: Some(payment_address),
+            commitment_randomness: Some(note.rcm()),
+            ar: Some(ar),
+            auth_path: merkle_path
+                .auth_path
+                .iter()
+                .map(|(node, b)| Some(((*node).into(), *b)))
+                .collect(),
+            anchor: Some(anchor),
+        };
+
+        let proof = create_random_proof(instance, proving_key, &mut OsRng)
+            .expect("proving should not fail");
+
+        let value_commitment: jubjub::ExtendedPoint = value_commitment.commitment().into();
+
+        // Check the proof, in case the hardware is faulty.
+        let mut public_input = [bls12_381::Scalar::zero(); 7];
+        {
+            let affine = rk.0.to_affine();
+            public_input[0] = affine.get_u();
+            public_input[1] = affine.get_v();
+        }
+        {
+            let affine = value_commitment.to_affine();
+            public_input[2] = affine.get_u();
+            public_input[3] = affine.get_v();
+        }
+        public_input[4] = anchor;
+        {
+            let nullifier = multipack::bytes_to_bits_le(&nullifier[..]);
+            let nullifier: Vec<bls12_381::Scalar> = multipack::compute_multipacking(&nullifier);
+            assert_eq!(nullifier.len(), 2);
+            public_input[5] = nullifier[0];
+            public_input[6] = nullifier[1];
+        }
+        if verify_proof(verifying_key, &proof, &public_input[..]).is_err() {
+            return Err(());
+        }
+
+        self.bsk += rcv;
+        self.bvk += value_commitment;
+
+        Ok((proof, value_commitment, rk))
+    }
+
+    /// Creates an Output proof, and returns it with the value commitment of
+    /// the output.
+    pub fn output_proof(
+        &mut self,
+        esk: jubjub::Fr,
+        payment_address: PaymentAddress,
+        rcm: jubjub::Fr,
+        value: u64,
+        proving_key: &Parameters<Bls12>,
+    ) -> (Proof<Bls12>, jubjub::ExtendedPoint) {
+        let rcv = random_rcv();
+        let value_commitment = ValueCommitment {
+            value,
+            randomness: rcv,
+        };
+
+        let proof = if self.placeholder {
+            placeholder_proof()
+        } else {
+            let instance = Output {
+                value_commitment: Some(value_commitment.clone()),
+                payment_address: Some(payment_address),
+                commitment_randomness: Some(rcm),
+                esk: Some(esk),
+            };
+
+            create_random_proof(instance, proving_key, &mut OsRng)
+                .expect("proving should not fail")
+        };
+
+        let value_commitment: jubjub::ExtendedPoint = value_commitment.commitment().into();
+
+        self.bsk -= rcv;
+        self.bvk -= value_commitment;
+
+        (proof, value_commitment)
+    }
+
+    /// Adds the spends and outputs proved with another context to this one.
+    pub fn merge(&mut self, other: &ProvingContext) {
+        self.bsk += other.bsk;
+        self.bvk += other.bvk;
+    }
+
+    /// Creates the binding signature of a transaction whose spends and
+    /// outputs were all proved with this context, or merged into it.
+    pub fn binding_sig(&self, value_balance: Amount, sighash: &[u8; 32]) -> Result<Signature, ()> {
+        let bsk = PrivateKey(self.bsk);
+        let bvk = PublicKey::from_private(&bsk, VALUE_COMMITMENT_RANDOMNESS_GENERATOR);
+
+        // The value commitments less the value balance must be a commitment
+        // to zero, with randomness bsk.
+        let value_balance = i64::from(value_balance);
+        let mut value_balance_point: jubjub::ExtendedPoint = (VALUE_COMMITMENT_VALUE_GENERATOR
+            * jubjub::Fr::from(value_balance.abs() as u64))
+        .into();
+        if value_balance < 0 {
+            value_balance_point = -value_balance_point;
+        }
+        if bvk.0 != self.bvk - value_balance_point {
+            return Err(());
+        }
+
+        let mut data_to_be_signed = [0u8; 64];
+        data_to_be_signed[0..32].copy_from_slice(&bvk.0.to_bytes());
+        data_to_be_signed[32..64].copy_from_slice(&sighash[..]);
+
+        Ok(bsk.sign(
+            &data_to_be_signed,
+            &mut OsRng,
+            VALUE_COMMITMENT_RANDOMNESS_GENERATOR,
+        ))
+    }
+}
@@ -19,7 +19,8 @@
 // See https://github.com/rust-lang/rfcs/pull/2585 for more background.
 #![allow(clippy::not_unsafe_ptr_arg_deref)]
 
-use bellman::groth16::{Parameters, PreparedVerifyingKey, Proof};
+use bellman::groth16::{prepare_verifying_key, Parameters, PreparedVerifyingKey, Proof, VerifyingKey};
+use bellman::multicore::Worker;
 use blake2s_simd::Params as Blake2sParams;
 use bls12_381::Bls12;
 use group::{cofactor::CofactorGroup, GroupEncoding};
@@ -27,8 +28,9 @@ use libc::{c_uchar, size_t};
 use rand_core::{OsRng, RngCore};
 use std::fs::File;
 use std::io::BufReader;
-use std::path::{Path, PathBuf};
+use std::path::PathBuf;
 use std::slice;
+use std::sync::Once;
 use subtle::CtOption;
 
 #[cfg(not(target_os = "windows"))]
@@ -53,17 +55,20 @@ use zcash_primitives::{
     zip32,
 };
 use zcash_proofs::{
-    circuit::sapling::TREE_DEPTH as SAPLING_TREE_DEPTH,
-    load_parameters,
-    sapling::{SaplingProvingContext, SaplingVerificationContext},
+    circuit::sapling::TREE_DEPTH as SAPLING_TREE_DEPTH, sapling::SaplingVerificationContext,
     sprout,
 };
 
 use zcash_history::{Entry as MMREntry, NodeData as MMRNodeData, Tree as MMRTree};
 
+use crate::prover::ProvingContext;
+
 mod blake2b;
 mod ed25519;
 mod metrics_ffi;
+mod params;
+mod prover;
+mod sapling;
 mod tracing_ffi;
 
 #[cfg(test)]
@@ -73,8 +78,16 @@ static mut SAPLING_SPEND_VK: Option<PreparedVerifyingKey<Bls12>> = None;
 static mut SAPLING_OUTPUT_VK: Option<PreparedVerifyingKey<Bls12>> = None;
 static mut SPROUT_GROTH16_VK: Option<PreparedVerifyingKey<Bls12>> = None;
 
+// The unprepared verifying keys, which the batch validator uses.
+static mut SAPLING_SPEND_BATCH_VK: Option<VerifyingKey<Bls12>> = None;
+static mut SAPLING_OUTPUT_BATCH_VK: Option<VerifyingKey<Bls12>> = None;
+
+// The proving parameters are loaded by sapling_proving_params on first use.
+static LOAD_SAPLING_PROVING_PARAMS: Once = Once::new();
 static mut SAPLING_SPEND_PARAMS: Option<Parameters<Bls12>> = None;
 static mut SAPLING_OUTPUT_PARAMS: Option<Parameters<Bls12>> = None;
+static mut SAPLING_SPEND_PARAMS_PATH: Option<PathBuf> = None;
+static mut SAPLING_OUTPUT_PARAMS_PATH: Option<PathBuf> = None;
 static mut SPROUT_GROTH16_PARAMS_PATH: Option<PathBuf> = None;
 
 /// Converts CtOption<t> into Option<T>
@@ -95,8 +108,36 @@ fn fixed_scalar_mult(from: &[u8; 32], p_g: &jubjub::SubgroupPoint) -> jubjub::Su
     p_g * f
 }
 
-/// Loads the zk-SNARK parameters into memory and saves paths as necessary.
-/// Only called once.
+#[cfg(not(target_os = "windows"))]
+fn path_from_ffi(path: *const u8, path_len: usize) -> Option<PathBuf> {
+    if path.is_null() {
+        None
+    } else {
+        Some(PathBuf::from(OsStr::from_bytes(unsafe {
+            slice::from_raw_parts(path, path_len)
+        })))
+    }
+}
+
+#[cfg(target_os = "windows")]
+fn path_from_ffi(path: *const u16, path_len: usize) -> Option<PathBuf> {
+    if path.is_null() {
+        None
+    } else {
+        Some(PathBuf::from(OsString::from_wide(unsafe {
+            slice::from_raw_parts(path, path_len)
+        })))
+    }
+}
+
+/// Loads the verifying keys of the zk-SNARK parameters into memory and saves
+/// the paths of the parameter files. Only called once.
+///
+/// The verifying keys are read from the cache file at `vk_cache_path`, if it
+/// is not null and was written for the same parameter files. Otherwise they
+/// are read from the parameter files, whose hashes are checked, and the cache
+/// file is written. The Sapling proving parameters are loaded when they are
+/// first used, or now if `load_proving` is true.
 #[no_mangle]
 pub extern "C" fn librustzcash_init_zksnark_params(
     #[cfg(not(target_os = "windows"))] spend_path: *const u8,
@@ -108,59 +149,101 @@ pub extern "C" fn librustzcash_init_zksnark_params(
     #[cfg(not(target_os = "windows"))] sprout_path: *const u8,
     #[cfg(target_os = "windows")] sprout_path: *const u16,
     sprout_path_len: usize,
+    #[cfg(not(target_os = "windows"))] vk_cache_path: *const u8,
+    #[cfg(target_os = "windows")] vk_cache_path: *const u16,
+    vk_cache_path_len: usize,
+    load_proving: bool,
 ) {
-    #[cfg(not(target_os = "windows"))]
-    let (spend_path, output_path, sprout_path) = {
-        (
-            OsStr::from_bytes(unsafe { slice::from_raw_parts(spend_path, spend_path_len) }),
-            OsStr::from_bytes(unsafe { slice::from_raw_parts(output_path, output_path_len) }),
-            if sprout_path.is_null() {
-                None
-            } else {
-                Some(OsStr::from_bytes(unsafe {
-                    slice::from_raw_parts(sprout_path, sprout_path_len)
-                }))
-            },
-        )
-    };
-
-    #[cfg(target_os = "windows")]
-    let (spend_path, output_path, sprout_path) = {
-        (
-            OsString::from_wide(unsafe { slice::from_raw_parts(spend_path, spend_path_len) }),
-            OsString::from_wide(unsafe { slice::from_raw_parts(output_path, output_path_len) }),
-            if sprout_path.is_null() {
-                None
-            } else {
-                Some(OsString::from_wide(unsafe {
-                    slice::from_raw_parts(sprout_path, sprout_path_len)
-                }))
-            },
-        )
+    let spend_path = path_from_ffi(spend_path, spend_path_len).expect("spend path is required");
+    let output_path = path_from_ffi(output_path, output_path_len).expect("output path is required");
+    let sprout_path = path_from_ffi(sprout_path, sprout_path_len);
+    let vk_cache_path = path_from_ffi(vk_cache_path, vk_cache_path_len);
+
+    let mut files = vec![spend_path.as_path(), output_path.as_path()];
+    files.extend(sprout_path.as_deref());
+
+    let cached = vk_cache_path
+        .as_deref()
+        .and_then(|cache| params::read_vk_cache(cache, &files));
+    let mut vks = match cached {
+        Some(vks) => vks,
+        None => {
+            let mut vks = vec![
+                params::read_verifying_key(&spend_path, params::SAPLING_SPEND_HASH, "Sapling spend"),
+                params::read_verifying_key(&output_path, params::SAPLING_OUTPUT_HASH, "Sapling output"),
+            ];
+            if let Some(sprout_path) = &sprout_path {
+                vks.push(params::read_verifying_key(sprout_path, params::SPROUT_HASH, "Sprout Groth16"));
+            }
+            if let Some(cache) = &vk_cache_path {
+                // The cache only saves time at the next startup, so failing
+                // to write it is not an error.
+                if let Err(e) = params::write_vk_cache(cache, &files, &vks.iter().collect::<Vec<_>>()) {
+                    tracing::warn!("Failed to write verifying key cache {}: {}", cache.display(), e);
+                }
+            }
+            vks
+        }
     };
-
-    let (spend_path, output_path, sprout_path) = (
-        Path::new(&spend_path),
-        Path::new(&output_path),
-        sprout_path.as_ref().map(|p| Path::new(p)),
-    );
-
-    // Load params
-    let params = load_parameters(spend_path, output_path, sprout_path);
+    let sprout_vk = if sprout_path.is_some() { vks.pop() } else { None };
+    let output_vk = vks.pop().unwrap();
+    let spend_vk = vks.pop().unwrap();
 
     // Caller is responsible for calling this function once, so
     // these global mutations are safe.
     unsafe {
-        SAPLING_SPEND_PARAMS = Some(params.spend_params);
-        SAPLING_OUTPUT_PARAMS = Some(params.output_params);
-        SPROUT_GROTH16_PARAMS_PATH = sprout_path.map(|p| p.to_owned());
+        SAPLING_SPEND_VK = Some(prepare_verifying_key(&spend_vk));
+        SAPLING_OUTPUT_VK = Some(prepare_verifying_key(&output_vk));
+        SPROUT_GROTH16_VK = sprout_vk.as_ref().map(prepare_verifying_key);
 
-        SAPLING_SPEND_VK = Some(params.spend_vk);
-        SAPLING_OUTPUT_VK = Some(params.output_vk);
-        SPROUT_GROTH16_VK = params.sprout_vk;
+        SAPLING_SPEND_BATCH_VK = Some(spend_vk);
+        SAPLING_OUTPUT_BATCH_VK = Some(output_vk);
+
+        SAPLING_SPEND_PARAMS_PATH = Some(spend_path);
+        SAPLING_OUTPUT_PARAMS_PATH = Some(output_path);
+        SPROUT_GROTH16_PARAMS_PATH = sprout_path;
+    }
+
+    if load_proving {
+        sapling_proving_params();
     }
 }
 
+/// Returns the Sapling spend and output proving parameters, loading them on
+/// first use.
+fn sapling_proving_params() -> (&'static Parameters<Bls12>, &'static Parameters<Bls12>) {
+    // The parameters are only written once, inside call_once, after
+    // librustzcash_init_zksnark_params has set the paths and verifying keys.
+    unsafe {
+        LOAD_SAPLING_PROVING_PARAMS.call_once(|| {
+            SAPLING_SPEND_PARAMS = Some(params::read_parameters(
+                SAPLING_SPEND_PARAMS_PATH
+                    .as_ref()
+                    .expect("parameters should have been initialized"),
+                SAPLING_SPEND_BATCH_VK.as_ref().unwrap(),
+                "Sapling spend",
+            ));
+            SAPLING_OUTPUT_PARAMS = Some(params::read_parameters(
+                SAPLING_OUTPUT_PARAMS_PATH
+                    .as_ref()
+                    .expect("parameters should have been initialized"),
+                SAPLING_OUTPUT_BATCH_VK.as_ref().unwrap(),
+                "Sapling output",
+            ));
+        });
+        (
+            SAPLING_SPEND_PARAMS.as_ref().unwrap(),
+            SAPLING_OUTPUT_PARAMS.as_ref().unwrap(),
+        )
+    }
+}
+
+/// Returns whether the Sapling proving parameters have been loaded.
+#[no_mangle]
+pub extern "C" fn librustzcash_sapling_proving_params_loaded() -> bool {
+    LOAD_SAPLING_PROVING_PARAMS.is_completed()
+}
+
 /// Writes the "uncommitted" note value for empty leaves of the Merkle tree.
 ///
 /// `result` must be a valid pointer to 32 bytes which will be written.
@@ -198,6 +281,65 @@ pub extern "C" fn librustzcash_merkle_hash(
     *result = tmp;
 }
 
+/// Below this many pairs, spreading a batch across threads costs more than
+/// the hashing itself.
+const MERKLE_HASH_PARALLEL_THRESHOLD: usize = 64;
+
+/// Returns the worker used to hash large batches of tree nodes, creating it
+/// on first use.
+fn merkle_worker() -> &'static Worker {
+    static INIT: Once = Once::new();
+    static mut WORKER: Option<Worker> = None;
+
+    // WORKER is only written once, inside call_once.
+    unsafe {
+        INIT.call_once(|| WORKER = Some(Worker::new()));
+        WORKER.as_ref().unwrap()
+    }
+}
+
+fn merkle_hash_pairs(depth: usize, nodes: &[[u8; 64]], result: &mut [[u8; 32]]) {
+    let mut lhs = [0u8; 32];
+    let mut rhs = [0u8; 32];
+    for (pair, out) in nodes.iter().zip(result.iter_mut()) {
+        lhs.copy_from_slice(&pair[..32]);
+        rhs.copy_from_slice(&pair[32..]);
+        *out = merkle_hash(depth, &lhs, &rhs);
+    }
+}
+
+#[no_mangle]
+pub extern "C" fn librustzcash_merkle_hash_many(
+    depth: size_t,
+    nodes: *const [c_uchar; 64],
+    count: size_t,
+    result: *mut [c_uchar; 32],
+) {
+    if count == 0 {
+        return;
+    }
+
+    // Should be okay, because caller is responsible for ensuring
+    // `nodes` points to `count` pairs of 32-byte nodes, and `result`
+    // to `count` mutable 32-byte outputs.
+    let nodes = unsafe { slice::from_raw_parts(nodes, count) };
+    let result = unsafe { slice::from_raw_parts_mut(result, count) };
+
+    if count < MERKLE_HASH_PARALLEL_THRESHOLD {
+        merkle_hash_pairs(depth, nodes, result);
+        return;
+    }
+
+    merkle_worker().scope(count, |scope, chunk_size| {
+        for (nodes, result) in nodes
+            .chunks(chunk_size)
+            .zip(result.chunks_mut(chunk_size))
+        {
+            scope.spawn(move |_| merkle_hash_pairs(depth, nodes, result));
+        }
+    });
+}
+
 #[no_mangle] // ToScalar
 pub extern "C" fn librustzcash_to_scalar(input: *const [c_uchar; 64], result: *mut [c_uchar; 32]) {
     // Should be okay, because caller is responsible for ensuring
@@ -448,6 +590,66 @@ pub extern "C" fn librustzcash_sapling_ka_agree(
     true
 }
 
+/// Computes \[ivk\] \[8\] epk for every pair of one of the `n_epks` 32-byte
+/// points in `epks` and one of the `n_ivks` 32-byte Fs in `ivks`, as needed to
+/// trial-decrypt many outputs with many incoming viewing keys.
+///
+/// Each epk is decoded and has its cofactor cleared once, and each ivk is
+/// decoded once, so this is cheaper than calling
+/// [`librustzcash_sapling_ka_agree`] for each pair. The multiplications by
+/// the ivks are constant-time, as there. The shared secret for `epks[i]` and `ivks[j]` is written to
+/// `results[i * n_ivks + j]`, and `valid[i * n_ivks + j]` is set to false if
+/// either key is invalid (in which case that result is left unchanged).
+#[no_mangle]
+pub extern "C" fn librustzcash_sapling_ka_agree_batch(
+    epks: *const [c_uchar; 32],
+    n_epks: size_t,
+    ivks: *const [c_uchar; 32],
+    n_ivks: size_t,
+    results: *mut [c_uchar; 32],
+    valid: *mut bool,
+) {
+    if n_epks == 0 || n_ivks == 0 {
+        return;
+    }
+
+    let epks = unsafe { slice::from_raw_parts(epks, n_epks) };
+    let ivks = unsafe { slice::from_raw_parts(ivks, n_ivks) };
+    let results = unsafe { slice::from_raw_parts_mut(results, n_epks * n_ivks) };
+    let valid = unsafe { slice::from_raw_parts_mut(valid, n_epks * n_ivks) };
+
+    // Deserialize the ivks once, rather than once per epk
+    let ivks: Vec<Option<jubjub::Scalar>> = ivks
+        .iter()
+        .map(|ivk| de_ct(jubjub::Scalar::from_bytes(ivk)))
+        .collect();
+
+    for ((epk, results), valid) in epks
+        .iter()
+        .zip(results.chunks_mut(n_ivks))
+        .zip(valid.chunks_mut(n_ivks))
+    {
+        let epk = match de_ct(jubjub::ExtendedPoint::from_bytes(epk)) {
+            Some(p) => p,
+            None => {
+                valid.iter_mut().for_each(|v| *v = false);
+                continue;
+            }
+        };
+
+        let epk = epk.clear_cofactor();
+        for ((ivk, result), valid) in ivks.iter().zip(results.iter_mut()).zip(valid.iter_mut()) {
+            match ivk {
+                Some(ivk) => {
+                    *result = (epk * ivk).to_bytes();
+                    *valid = true;
+                }
+                None => *valid = false,
+            }
+        }
+    }
+}
+
 /// Compute g_d = GH(diversifier) and returns false if the diversifier is
 /// invalid. Computes \[esk\] g_d and writes the result to the 32-byte `result`
 /// buffer. Returns false if `esk` is not a valid scalar.
@@ -760,7 +962,7 @@ pub extern "C" fn librustzcash_sprout_verify(
 /// the necessary witness information. It outputs `cv` and the `zkproof`.
 #[no_mangle]
 pub extern "C" fn librustzcash_sapling_output_proof(
-    ctx: *mut SaplingProvingContext,
+    ctx: *mut ProvingContext,
     esk: *const [c_uchar; 32],
     payment_address: *const [c_uchar; 43],
     rcm: *const [c_uchar; 32],
@@ -792,7 +994,7 @@ pub extern "C" fn librustzcash_sapling_output_proof(
         payment_address,
         rcm,
         value,
-        unsafe { SAPLING_OUTPUT_PARAMS.as_ref() }.unwrap(),
+        sapling_proving_params().1,
     );
 
     // Write the proof out to the caller
@@ -849,7 +1051,7 @@ pub extern "C" fn librustzcash_sapling_spend_sig(
 /// consistency.
 #[no_mangle]
 pub extern "C" fn librustzcash_sapling_binding_sig(
-    ctx: *const SaplingProvingContext,
+    ctx: *const ProvingContext,
     value_balance: i64,
     sighash: *const [c_uchar; 32],
     result: *mut [c_uchar; 64],
@@ -877,7 +1079,7 @@ pub extern "C" fn librustzcash_sapling_binding_sig(
 /// `rk` (so that you don't have to compute it) along with the proof.
 #[no_mangle]
 pub extern "C" fn librustzcash_sapling_spend_proof(
-    ctx: *mut SaplingProvingContext,
+    ctx: *mut ProvingContext,
     ak: *const [c_uchar; 32],
     nsk: *const [c_uchar; 32],
     diversifier: *const [c_uchar; 11],
@@ -953,7 +1155,7 @@ pub extern "C" fn librustzcash_sapling_spend_proof(
             value,
             anchor,
             merkle_path,
-            unsafe { SAPLING_SPEND_PARAMS.as_ref() }.unwrap(),
+            sapling_proving_params().0,
             unsafe { SAPLING_SPEND_VK.as_ref() }.unwrap(),
         )
         .expect("proving should not fail");
@@ -975,8 +1177,18 @@ pub extern "C" fn librustzcash_sapling_spend_proof(
 
 /// Creates a Sapling proving context. Please free this when you're done.
 #[no_mangle]
-pub extern "C" fn librustzcash_sapling_proving_ctx_init() -> *mut SaplingProvingContext {
-    let ctx = Box::new(SaplingProvingContext::new());
+pub extern "C" fn librustzcash_sapling_proving_ctx_init() -> *mut ProvingContext {
+    let ctx = Box::new(ProvingContext::new());
+
+    Box::into_raw(ctx)
+}
+
+/// Creates a Sapling proving context that writes placeholders instead of
+/// proofs, for regtest with `-regtestfastmode`. Please free this when you're
+/// done.
+#[no_mangle]
+pub extern "C" fn librustzcash_sapling_proving_ctx_init_placeholder() -> *mut ProvingContext {
+    let ctx = Box::new(ProvingContext::new_placeholder());
 
     Box::into_raw(ctx)
 }
@@ -984,10 +1196,20 @@ pub extern "C" fn librustzcash_sapling_proving_ctx_init() -> *mut SaplingProving
 /// Frees a Sapling proving context returned from
 /// [`librustzcash_sapling_proving_ctx_init`].
 #[no_mangle]
-pub extern "C" fn librustzcash_sapling_proving_ctx_free(ctx: *mut SaplingProvingContext) {
+pub extern "C" fn librustzcash_sapling_proving_ctx_free(ctx: *mut ProvingContext) {
     drop(unsafe { Box::from_raw(ctx) });
 }
 
+/// Adds the spends and outputs proved with the Sapling proving context `other`
+/// to `ctx`, so that the binding signature can be made with `ctx`.
+#[no_mangle]
+pub extern "C" fn librustzcash_sapling_proving_ctx_merge(
+    ctx: *mut ProvingContext,
+    other: *const ProvingContext,
+) {
+    unsafe { &mut *ctx }.merge(unsafe { &*other });
+}
+
 /// Derive the master ExtendedSpendingKey from a seed.
 #[no_mangle]
 pub extern "C" fn librustzcash_zip32_xsk_master(
@@ -0,0 +1,357 @@
+// Copyright (c) 2021 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+//! Batch validation of Sapling spend and output descriptions.
+//!
+//! A [`BatchValidator`] performs the same checks as `SaplingVerificationContext`,
+//! except that the Groth16 proofs are not verified as they are presented.
+//! Instead they are accumulated (across any number of transactions) and then
+//! checked together in [`librustzcash_sapling_batch_validator_validate`], using
+//! a single multi-Miller loop per verifying key.
+
+use bellman::{
+    gadgets::multipack,
+    groth16::{Proof, VerifyingKey},
+};
+use bls12_381::{Bls12, G1Affine, G1Projective, G2Prepared};
+use group::{Curve, GroupEncoding};
+use libc::c_uchar;
+use rand_core::{OsRng, RngCore};
+use zcash_primitives::{
+    constants::{
+        SPENDING_KEY_GENERATOR, VALUE_COMMITMENT_RANDOMNESS_GENERATOR,
+        VALUE_COMMITMENT_VALUE_GENERATOR,
+    },
+    redjubjub::{PublicKey, Signature},
+    transaction::components::Amount,
+};
+
+use crate::{de_ct, GROTH_PROOF_SIZE, SAPLING_OUTPUT_BATCH_VK, SAPLING_SPEND_BATCH_VK};
+
+/// A Groth16 proof together with the public inputs it must be verified against.
+struct BatchItem {
+    proof: Proof<Bls12>,
+    inputs: Vec<bls12_381::Scalar>,
+}
+
+pub struct BatchValidator {
+    /// Value commitment accumulator for the transaction currently being checked.
+    bvk: jubjub::ExtendedPoint,
+    spends: Vec<BatchItem>,
+    outputs: Vec<BatchItem>,
+}
+
+impl BatchValidator {
+    fn new() -> Self {
+        BatchValidator {
+            bvk: jubjub::ExtendedPoint::identity(),
+            spends: vec![],
+            outputs: vec![],
+        }
+    }
+}
+
+/// Returns a random 128-bit scalar, which is sufficient for the soundness of
+/// the random linear combination used in batch verification.
+fn batch_scalar() -> bls12_381::Scalar {
+    bls12_381::Scalar::from_raw([OsRng.next_u64(), OsRng.next_u64(), 0, 0])
+}
+
+/// Verifies a batch of Groth16 proofs that were all created with the same
+/// verifying key.
+///
+/// For proofs `(A_i, B_i, C_i)` with public input accumulators `acc_i` and
+/// random scalars `z_i`, this checks that
+///
+/// ```text
+/// ∏ e(z_i·A_i, B_i) · e(-Σ z_i·acc_i, γ) · e(-Σ z_i·C_i, δ) = e(α, β)^(Σ z_i)
+/// ```
+fn verify_groth16_batch(vk: &VerifyingKey<Bls12>, items: &[BatchItem]) -> bool {
+    if items.is_empty() {
+        return true;
+    }
+
+    let mut terms: Vec<(G1Affine, G2Prepared)> = Vec::with_capacity(items.len() + 2);
+    let mut acc_inputs = G1Projective::identity();
+    let mut acc_c = G1Projective::identity();
+    let mut z_sum = bls12_381::Scalar::zero();
+
+    for item in items {
+        if item.inputs.len() + 1 != vk.ic.len() {
+            return false;
+        }
+
+        let z = batch_scalar();
+
+        let mut acc = G1Projective::from(vk.ic[0]);
+        for (input, base) in item.inputs.iter().zip(vk.ic.iter().skip(1)) {
+            acc += base * input;
+        }
+
+        acc_inputs += acc * z;
+        acc_c += &item.proof.c * &z;
+        z_sum += z;
+
+        terms.push((
+            G1Affine::from(&item.proof.a * &z),
+            G2Prepared::from(item.proof.b),
+        ));
+    }
+
+    terms.push((
+        G1Affine::from(-acc_inputs),
+        G2Prepared::from(vk.gamma_g2),
+    ));
+    terms.push((G1Affine::from(-acc_c), G2Prepared::from(vk.delta_g2)));
+
+    let term_refs: Vec<_> = terms.iter().map(|(a, b)| (a, b)).collect();
+    let lhs = bls12_381::multi_miller_loop(&term_refs).final_exponentiation();
+    let rhs = bls12_381::pairing(&vk.alpha_g1, &vk.beta_g2) * z_sum;
+
+    lhs == rhs
+}
+
+/// Creates a Sapling batch validator. Please free this when you're done.
+#[no_mangle]
+pub extern "C" fn librustzcash_sapling_batch_validator_init() -> *mut BatchValidator {
+    Box::into_raw(Box::new(BatchValidator::new()))
+}
+
+/// Frees a Sapling batch validator returned from
+/// [`librustzcash_sapling_batch_validator_init`].
+#[no_mangle]
+pub extern "C" fn librustzcash_sapling_batch_validator_free(batch: *mut BatchValidator) {
+    drop(unsafe { Box::from_raw(batch) });
+}
+
+/// Checks the non-proof parts of a Sapling Spend description, accumulating
+/// the value commitment into the batch and queueing the proof for
+/// verification by [`librustzcash_sapling_batch_validator_validate`].
+#[no_mangle]
+pub extern "C" fn librustzcash_sapling_batch_validator_check_spend(
+    batch: *mut BatchValidator,
+    cv: *const [c_uchar; 32],
+    anchor: *const [c_uchar; 32],
+    nullifier: *const [c_uchar; 32],
+    rk: *const [c_uchar; 32],
+    zkproof: *const [c_uchar; GROTH_PROOF_SIZE],
+    spend_auth_sig: *const [c_uchar; 64],
+    sighash_value: *const [c_uchar; 32],
+) -> bool {
+    let batch = unsafe { &mut *batch };
+
+    // Deserialize the value commitment
+    let cv = match de_ct(jubjub::ExtendedPoint::from_bytes(unsafe { &*cv })) {
+        Some(p) => p,
+        None => return false,
+    };
+
+    // Deserialize the anchor, which should be an element
+    // of Fr.
+    let anchor = match de_ct(bls12_381::Scalar::from_bytes(unsafe { &*anchor })) {
+        Some(a) => a,
+        None => return false,
+    };
+
+    // Deserialize rk
+    let rk = match PublicKey::read(&(unsafe { &*rk })[..]) {
+        Ok(p) => p,
+        Err(_) => return false,
+    };
+
+    // Deserialize the signature
+    let spend_auth_sig = match Signature::read(&(unsafe { &*spend_auth_sig })[..]) {
+        Ok(sig) => sig,
+        Err(_) => return false,
+    };
+
+    // Deserialize the proof
+    let zkproof = match Proof::read(&(unsafe { &*zkproof })[..]) {
+        Ok(p) => p,
+        Err(_) => return false,
+    };
+
+    // Neither cv nor rk may be of small order.
+    if (cv.is_small_order() | rk.0.is_small_order()).into() {
+        return false;
+    }
+
+    // Accumulate the value commitment in the context
+    batch.bvk += cv;
+
+    // Grab the message and check the spend authorization signature
+    let mut data_to_be_signed = [0u8; 64];
+    data_to_be_signed[0..32].copy_from_slice(&rk.0.to_bytes());
+    data_to_be_signed[32..64].copy_from_slice(unsafe { &*sighash_value });
+    if !rk.verify(&data_to_be_signed, &spend_auth_sig, SPENDING_KEY_GENERATOR) {
+        return false;
+    }
+
+    // Construct the public input for the circuit
+    let mut inputs = Vec::with_capacity(7);
+    {
+        let affine = rk.0.to_affine();
+        inputs.push(affine.get_u());
+        inputs.push(affine.get_v());
+    }
+    {
+        let affine = cv.to_affine();
+        inputs.push(affine.get_u());
+        inputs.push(affine.get_v());
+    }
+    inputs.push(anchor);
+    {
+        let nullifier = multipack::bytes_to_bits_le(unsafe { &*nullifier });
+        let nullifier: Vec<bls12_381::Scalar> = multipack::compute_multipacking(&nullifier);
+        assert_eq!(nullifier.len(), 2);
+        inputs.extend(nullifier);
+    }
+
+    batch.spends.push(BatchItem {
+        proof: zkproof,
+        inputs,
+    });
+
+    true
+}
+
+/// Checks the non-proof parts of a Sapling Output description, accumulating
+/// the value commitment into the batch and queueing the proof for
+/// verification by [`librustzcash_sapling_batch_validator_validate`].
+#[no_mangle]
+pub extern "C" fn librustzcash_sapling_batch_validator_check_output(
+    batch: *mut BatchValidator,
+    cv: *const [c_uchar; 32],
+    cm: *const [c_uchar; 32],
+    epk: *const [c_uchar; 32],
+    zkproof: *const [c_uchar; GROTH_PROOF_SIZE],
+) -> bool {
+    let batch = unsafe { &mut *batch };
+
+    // Deserialize the value commitment
+    let cv = match de_ct(jubjub::ExtendedPoint::from_bytes(unsafe { &*cv })) {
+        Some(p) => p,
+        None => return false,
+    };
+
+    // Deserialize the commitment, which should be an element
+    // of Fr.
+    let cm = match de_ct(bls12_381::Scalar::from_bytes(unsafe { &*cm })) {
+        Some(a) => a,
+        None => return false,
+    };
+
+    // Deserialize the ephemeral key
+    let epk = match de_ct(jubjub::ExtendedPoint::from_bytes(unsafe { &*epk })) {
+        Some(p) => p,
+        None => return false,
+    };
+
+    // Deserialize the proof
+    let zkproof = match Proof::read(&(unsafe { &*zkproof })[..]) {
+        Ok(p) => p,
+        Err(_) => return false,
+    };
+
+    // Neither cv nor epk may be of small order.
+    if (cv.is_small_order() | epk.is_small_order()).into() {
+        return false;
+    }
+
+    // Accumulate the value commitment in the context
+    batch.bvk -= cv;
+
+    // Construct the public input for the circuit
+    let mut inputs = Vec::with_capacity(5);
+    {
+        let affine = cv.to_affine();
+        inputs.push(affine.get_u());
+        inputs.push(affine.get_v());
+    }
+    {
+        let affine = epk.to_affine();
+        inputs.push(affine.get_u());
+        inputs.push(affine.get_v());
+    }
+    inputs.push(cm);
+
+    batch.outputs.push(BatchItem {
+        proof: zkproof,
+        inputs,
+    });
+
+    true
+}
+
+/// Checks the binding signature of the transaction whose descriptions were
+/// most recently passed to the batch, and resets the value commitment
+/// accumulator so that the next transaction can be checked.
+#[no_mangle]
+pub extern "C" fn librustzcash_sapling_batch_validator_final_check(
+    batch: *mut BatchValidator,
+    value_balance: i64,
+    binding_sig: *const [c_uchar; 64],
+    sighash_value: *const [c_uchar; 32],
+) -> bool {
+    let batch = unsafe { &mut *batch };
+    let bvk = std::mem::replace(&mut batch.bvk, jubjub::ExtendedPoint::identity());
+
+    // The magnitude of a valid Amount is bounded by MAX_MONEY, so it can
+    // always be negated.
+    let value_balance = match Amount::from_i64(value_balance) {
+        Ok(vb) => i64::from(vb),
+        Err(()) => return false,
+    };
+
+    // Deserialize the signature
+    let binding_sig = match Signature::read(&(unsafe { &*binding_sig })[..]) {
+        Ok(sig) => sig,
+        Err(_) => return false,
+    };
+
+    // Obtain the current value balance in the exponent of the value
+    // commitment base.
+    let mut value_balance_point: jubjub::ExtendedPoint = (VALUE_COMMITMENT_VALUE_GENERATOR
+        * jubjub::Fr::from(value_balance.abs() as u64))
+    .into();
+    if value_balance < 0 {
+        value_balance_point = -value_balance_point;
+    }
+
+    // Subtract value_balance from the accumulated value commitments.
+    let bvk = PublicKey(bvk - value_balance_point);
+
+    // Compute the signature's message for bvk/binding_sig
+    let mut data_to_be_signed = [0u8; 64];
+    data_to_be_signed[0..32].copy_from_slice(&bvk.0.to_bytes());
+    data_to_be_signed[32..64].copy_from_slice(unsafe { &*sighash_value });
+
+    bvk.verify(
+        &data_to_be_signed,
+        &binding_sig,
+        VALUE_COMMITMENT_RANDOMNESS_GENERATOR,
+    )
+}
+
+/// Verifies every Groth16 proof queued in the batch. Returns false if any of
+/// them is invalid, without identifying which.
+#[no_mangle]
+pub extern "C" fn librustzcash_sapling_batch_validator_validate(
+    batch: *mut BatchValidator,
+) -> bool {
+    let batch = unsafe { &mut *batch };
+
+    let spend_vk = unsafe { SAPLING_SPEND_BATCH_VK.as_ref() }
+        .expect("parameters should have been initialized");
+    let output_vk = unsafe { SAPLING_OUTPUT_BATCH_VK.as_ref() }
+        .expect("parameters should have been initialized");
+
+    let valid = verify_groth16_batch(spend_vk, &batch.spends)
+        && verify_groth16_batch(output_vk, &batch.outputs);
+
+    batch.spends.clear();
+    batch.outputs.clear();
+
+    valid
+}
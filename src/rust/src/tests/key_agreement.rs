@@ -4,7 +4,7 @@ use zcash_primitives::primitives::{Diversifier, ViewingKey};
 
 use crate::{
     librustzcash_sapling_generate_r, librustzcash_sapling_ka_agree,
-    librustzcash_sapling_ka_derivepublic,
+    librustzcash_sapling_ka_agree_batch, librustzcash_sapling_ka_derivepublic,
 };
 
 #[test]
@@ -68,4 +68,25 @@ fn test_key_agreement() {
 
     assert!(!shared_secret_sender.iter().all(|&v| v == 0));
     assert_eq!(shared_secret_sender, shared_secret_recipient);
+
+    // The recipient gets the same shared secret from a batch, alongside
+    // an invalid epk and an unrelated ivk
+    let invalid_epk = [0xffu8; 32];
+    let other_ivk = [1u8; 32];
+    let epks = [epk, invalid_epk];
+    let ivks = [other_ivk, ivk_serialized];
+    let mut results = [[0u8; 32]; 4];
+    let mut valid = [false; 4];
+    librustzcash_sapling_ka_agree_batch(
+        epks.as_ptr(),
+        epks.len(),
+        ivks.as_ptr(),
+        ivks.len(),
+        results.as_mut_ptr(),
+        valid.as_mut_ptr(),
+    );
+
+    assert_eq!(valid, [true, true, false, false]);
+    assert_ne!(results[0], shared_secret_sender);
+    assert_eq!(results[1], shared_secret_sender);
 }
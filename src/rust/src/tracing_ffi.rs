@@ -1,23 +1,30 @@
 use libc::c_char;
+use std::cell::{Cell, RefCell};
+use std::collections::HashMap;
 use std::ffi::CStr;
+use std::fs::File;
+use std::io::{BufWriter, Write};
 use std::path::Path;
 use std::slice;
 use std::str;
-use std::sync::atomic::{AtomicUsize, Ordering};
+use std::sync::atomic::{AtomicBool, AtomicU64, AtomicUsize, Ordering};
+use std::sync::{Arc, Mutex};
+use std::time::{Duration, Instant};
 use tracing::{
     callsite::{Callsite, Identifier},
     field::{FieldSet, Value},
     level_enabled,
     metadata::Kind,
-    span::Entered,
+    span::{self as tspan, Entered},
     subscriber::{Interest, Subscriber},
-    Event, Metadata, Span,
+    Event, Level, Metadata, Span,
 };
-use tracing_appender::non_blocking::WorkerGuard;
+use tracing_appender::non_blocking::{ErrorCounter, NonBlockingBuilder, WorkerGuard};
 use tracing_core::Once;
 use tracing_subscriber::{
     filter::EnvFilter,
-    layer::{Layer, SubscriberExt},
+    layer::{Context, Layer, SubscriberExt},
+    registry::LookupSpan,
     reload::{self, Handle},
     util::SubscriberInitExt,
 };
@@ -46,9 +53,175 @@ where
     }
 }
 
+/// The state of the span profiler, shared between the `FlameLayer` and the
+/// `TracingHandle` that switches it on and off.
+#[derive(Default)]
+struct FlameProfile {
+    enabled: AtomicBool,
+    sample_rate: AtomicU64,
+    roots: AtomicU64,
+    writer: Mutex<Option<BufWriter<File>>>,
+}
+
+struct FlameFrame {
+    id: tspan::Id,
+    name: &'static str,
+    entered: Instant,
+    children: Duration,
+}
+
+thread_local! {
+    static FLAME_STACK: RefCell<Vec<FlameFrame>> = RefCell::new(Vec::new());
+    static FLAME_SAMPLED: Cell<bool> = Cell::new(false);
+}
+
+/// A layer that records the time spent in each entered span, excluding its
+/// children, in the folded stack format read by flame graph tools such as
+/// inferno and flamegraph.pl. Only one in every `sample_rate` trees of spans
+/// rooted on a thread is recorded, so that it can run on production nodes.
+struct FlameLayer {
+    profile: Arc<FlameProfile>,
+}
+
+impl<S> Layer<S> for FlameLayer
+where
+    S: Subscriber + for<'a> LookupSpan<'a>,
+{
+    fn on_enter(&self, id: &tspan::Id, ctx: Context<'_, S>) {
+        if !self.profile.enabled.load(Ordering::Relaxed) {
+            return;
+        }
+        let name = match ctx.metadata(id) {
+            Some(metadata) => metadata.name(),
+            None => return,
+        };
+        FLAME_STACK.with(|stack| {
+            let mut stack = stack.borrow_mut();
+            if stack.is_empty() {
+                let root = self.profile.roots.fetch_add(1, Ordering::Relaxed);
+                let sample_rate = self.profile.sample_rate.load(Ordering::Relaxed).max(1);
+                FLAME_SAMPLED.with(|sampled| sampled.set(root % sample_rate == 0));
+            }
+            stack.push(FlameFrame {
+                id: id.clone(),
+                name,
+                entered: Instant::now(),
+                children: Duration::default(),
+            });
+        });
+    }
+
+    fn on_exit(&self, id: &tspan::Id, _ctx: Context<'_, S>) {
+        FLAME_STACK.with(|stack| {
+            let mut stack = stack.borrow_mut();
+            // Spans entered before the profiler was switched on are not on
+            // the stack.
+            match stack.last() {
+                Some(frame) if frame.id == *id => (),
+                _ => return,
+            }
+            let frame = stack.pop().unwrap();
+            let elapsed = frame.entered.elapsed();
+            if let Some(parent) = stack.last_mut() {
+                parent.children += elapsed;
+            }
+
+            if !FLAME_SAMPLED.with(|sampled| sampled.get()) {
+                return;
+            }
+            let mut folded = String::new();
+            for parent in stack.iter() {
+                folded.push_str(parent.name);
+                folded.push(';');
+            }
+            folded.push_str(frame.name);
+            let self_time = elapsed.checked_sub(frame.children).unwrap_or_default();
+            if let Some(writer) = self.profile.writer.lock().unwrap().as_mut() {
+                let _ = writeln!(writer, "{} {}", folded, self_time.as_micros());
+            }
+        });
+    }
+}
+
+/// The debug and trace events of one target that were logged in the current
+/// one-second window.
+struct RateWindow {
+    start: Instant,
+    logged: u32,
+    dropped: u64,
+}
+
+/// A layer that drops the debug and trace events of each target (the
+/// category of `LogPrint`) beyond `limit` per second, so that a busy category
+/// cannot flood the log. The number of dropped events is exported as a
+/// metric when the next window of the target starts.
+struct RateLimitLayer {
+    limit: u32,
+    windows: Mutex<HashMap<String, RateWindow>>,
+}
+
+impl RateLimitLayer {
+    fn limits(&self, metadata: &Metadata<'_>) -> bool {
+        let level = *metadata.level();
+        self.limit != 0 && metadata.is_event() && (level == Level::DEBUG || level == Level::TRACE)
+    }
+}
+
+impl<S: Subscriber> Layer<S> for RateLimitLayer {
+    fn register_callsite(&self, metadata: &'static Metadata<'static>) -> Interest {
+        if self.limits(metadata) {
+            Interest::sometimes()
+        } else {
+            Interest::always()
+        }
+    }
+
+    fn enabled(&self, metadata: &Metadata<'_>, _ctx: Context<'_, S>) -> bool {
+        if !self.limits(metadata) {
+            return true;
+        }
+
+        let now = Instant::now();
+        let mut windows = self.windows.lock().unwrap();
+        if !windows.contains_key(metadata.target()) {
+            windows.insert(
+                metadata.target().to_owned(),
+                RateWindow {
+                    start: now,
+                    logged: 0,
+                    dropped: 0,
+                },
+            );
+        }
+        let window = windows.get_mut(metadata.target()).unwrap();
+        if now.duration_since(window.start) >= Duration::from_secs(1) {
+            if window.dropped != 0 {
+                metrics::counter!(
+                    "zcashd.debug_log.dropped_lines",
+                    window.dropped,
+                    "reason" => "rate_limit",
+                    "category" => metadata.target().to_owned()
+                );
+            }
+            window.start = now;
+            window.logged = 0;
+            window.dropped = 0;
+        }
+        if window.logged < self.limit {
+            window.logged += 1;
+            true
+        } else {
+            window.dropped += 1;
+            false
+        }
+    }
+}
+
 pub struct TracingHandle {
     _file_guard: Option<WorkerGuard>,
+    dropped_lines: Option<ErrorCounter>,
     reload_handle: Box<dyn ReloadHandle>,
+    flame_profile: Arc<FlameProfile>,
 }
 
 #[no_mangle]
@@ -58,6 +231,9 @@ pub extern "C" fn tracing_init(
     log_path_len: usize,
     initial_filter: *const c_char,
     log_timestamps: bool,
+    buffered_lines: usize,
+    lossy: bool,
+    rate_limit: u32,
 ) -> *mut TracingHandle {
     let initial_filter = unsafe { CStr::from_ptr(initial_filter) }
         .to_str()
@@ -77,12 +253,20 @@ pub extern "C" fn tracing_init(
 
     let log_path = log_path.as_ref().map(Path::new);
 
+    let mut dropped_lines = None;
     let (file_logger, file_no_timestamps, file_guard) = if let Some(log_path) = log_path {
         let file_appender = tracing_appender::rolling::never(
             log_path.parent().unwrap(),
             log_path.file_name().unwrap(),
         );
-        let (non_blocking, file_guard) = tracing_appender::non_blocking(file_appender);
+        // Lines are written to the file by a worker thread, through a bounded
+        // queue. When the queue is full, lines are dropped if `lossy` is set,
+        // and the logging thread waits otherwise.
+        let (non_blocking, file_guard) = NonBlockingBuilder::default()
+            .buffered_lines_limit(buffered_lines)
+            .lossy(lossy)
+            .finish(file_appender);
+        dropped_lines = Some(non_blocking.error_counter());
 
         if log_timestamps {
             (
@@ -129,17 +313,28 @@ pub extern "C" fn tracing_init(
 
     let (filter, reload_handle) = reload::Layer::new(EnvFilter::from(initial_filter));
 
+    let flame_profile = Arc::new(FlameProfile::default());
+
     tracing_subscriber::registry()
         .with(stdout_logger)
         .with(stdout_no_timestamps)
         .with(file_logger)
         .with(file_no_timestamps)
+        .with(FlameLayer {
+            profile: flame_profile.clone(),
+        })
+        .with(RateLimitLayer {
+            limit: rate_limit,
+            windows: Mutex::new(HashMap::new()),
+        })
         .with(filter)
         .init();
 
     Box::into_raw(Box::new(TracingHandle {
         _file_guard: file_guard,
+        dropped_lines,
         reload_handle: Box::new(reload_handle),
+        flame_profile,
     }))
 }
 
@@ -148,6 +343,17 @@ pub extern "C" fn tracing_free(handle: *mut TracingHandle) {
     drop(unsafe { Box::from_raw(handle) });
 }
 
+#[no_mangle]
+pub extern "C" fn tracing_dropped_lines(handle: *const TracingHandle) -> u64 {
+    let handle = unsafe { &*handle };
+
+    handle
+        .dropped_lines
+        .as_ref()
+        .map(|counter| counter.dropped_lines() as u64)
+        .unwrap_or(0)
+}
+
 #[no_mangle]
 pub extern "C" fn tracing_reload(handle: *mut TracingHandle, new_filter: *const c_char) -> bool {
     let handle = unsafe { &mut *handle };
@@ -171,6 +377,53 @@ pub extern "C" fn tracing_reload(handle: *mut TracingHandle, new_filter: *const
     }
 }
 
+#[no_mangle]
+pub extern "C" fn tracing_profile_start(
+    handle: *mut TracingHandle,
+    #[cfg(not(target_os = "windows"))] profile_path: *const u8,
+    #[cfg(target_os = "windows")] profile_path: *const u16,
+    profile_path_len: usize,
+    sample_rate: u64,
+) -> bool {
+    let handle = unsafe { &mut *handle };
+
+    let profile_path = unsafe { slice::from_raw_parts(profile_path, profile_path_len) };
+
+    #[cfg(not(target_os = "windows"))]
+    let profile_path = OsStr::from_bytes(profile_path);
+
+    #[cfg(target_os = "windows")]
+    let profile_path = OsString::from_wide(profile_path);
+
+    match File::create(Path::new(&profile_path)) {
+        Err(e) => {
+            tracing::error!("Failed to create the span profile: {}", e);
+            false
+        }
+        Ok(file) => {
+            let profile = &handle.flame_profile;
+            let mut writer = profile.writer.lock().unwrap();
+            if let Some(mut previous) = writer.replace(BufWriter::new(file)) {
+                let _ = previous.flush();
+            }
+            profile.sample_rate.store(sample_rate, Ordering::Relaxed);
+            profile.enabled.store(true, Ordering::Relaxed);
+            true
+        }
+    }
+}
+
+#[no_mangle]
+pub extern "C" fn tracing_profile_stop(handle: *mut TracingHandle) {
+    let handle = unsafe { &mut *handle };
+
+    let profile = &handle.flame_profile;
+    profile.enabled.store(false, Ordering::Relaxed);
+    if let Some(mut writer) = profile.writer.lock().unwrap().take() {
+        let _ = writer.flush();
+    }
+}
+
 pub struct FfiCallsite {
     interest: AtomicUsize,
     meta: Option<Metadata<'static>>,
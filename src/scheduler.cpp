@@ -11,7 +11,7 @@
 
 #include <boost/bind/bind.hpp>
 
-CScheduler::CScheduler() : nThreadsServicingQueue(0), stopRequested(false), stopWhenEmpty(false)
+CScheduler::CScheduler() : nThreadsServicingQueue(0), nLowPriorityRunning(0), stopRequested(false), stopWhenEmpty(false)
 {
 }
 
@@ -21,6 +21,24 @@ CScheduler::~CScheduler()
 }
 
 
+CScheduler::TaskQueue::iterator CScheduler::nextTask(boost::chrono::system_clock::time_point now)
+{
+    // When several threads service the queue, one of them is kept free of
+    // low priority tasks.
+    bool fMayRunLow = nThreadsServicingQueue <= 1 || nLowPriorityRunning < nThreadsServicingQueue - 1;
+    TaskQueue::iterator best = taskQueue.end();
+    for (TaskQueue::iterator it = taskQueue.begin(); it != taskQueue.end() && it->first <= now; ++it) {
+        if (it->second.priority == PRIORITY_LOW && !fMayRunLow)
+            continue;
+        if (best == taskQueue.end() || it->second.priority < best->second.priority) {
+            best = it;
+            if (best->second.priority == PRIORITY_HIGH)
+                break;
+        }
+    }
+    return best;
+}
+
 void CScheduler::serviceQueue()
 {
     boost::unique_lock<boost::mutex> lock(newTaskMutex);
@@ -31,38 +49,58 @@ void CScheduler::serviceQueue()
     // is called.
     while (!shouldStop()) {
         try {
-            while (!shouldStop() && taskQueue.empty()) {
+            if (taskQueue.empty()) {
                 // Wait until there is something to do.
                 newTaskScheduled.wait(lock);
+                continue;
             }
 
-            // Wait until either there is a new task, or until
-            // the time of the first item on the queue:
-
-            // Some boost versions have a conflicting overload of wait_until that returns void.
-            // Explicitly use a template here to avoid hitting that overload.
-            while (!shouldStop() && !taskQueue.empty())
-            {
-                auto copy = taskQueue.begin()->first;
-                if (newTaskScheduled.wait_until<>(lock, copy) == boost::cv_status::timeout) {
-                    break;
+            auto now = boost::chrono::system_clock::now();
+            TaskQueue::iterator it = nextTask(now);
+            if (it == taskQueue.end()) {
+                // Wait until either there is a new task, or until the time of
+                // the first item on the queue, or, if it is due but only low
+                // priority tasks are, until one of those finishes.
+                // Some boost versions have a conflicting overload of wait_until that returns void.
+                // Explicitly use a template here to avoid hitting that overload.
+                auto first = taskQueue.begin()->first;
+                if (first > now) {
+                    newTaskScheduled.wait_until<>(lock, first);
+                } else {
+                    newTaskScheduled.wait(lock);
                 }
-            }
-
-            // If there are multiple threads, the queue can empty while we're waiting (another
-            // thread may service the task we were waiting on).
-            if (shouldStop() || taskQueue.empty())
                 continue;
+            }
 
-            Function f = taskQueue.begin()->second;
-            taskQueue.erase(taskQueue.begin());
+            Task task = std::move(it->second);
+            int64_t nLatencyMicros = boost::chrono::duration_cast<boost::chrono::microseconds>(now - it->first).count();
+            taskQueue.erase(it);
+            if (task.priority == PRIORITY_LOW)
+                ++nLowPriorityRunning;
 
-            {
+            try {
                 // Unlock before calling f, so it can reschedule itself or another task
                 // without deadlocking:
                 reverse_lock<boost::unique_lock<boost::mutex> > rlock(lock);
-                f();
+                task.f();
+            } catch (...) {
+                if (task.priority == PRIORITY_LOW)
+                    --nLowPriorityRunning;
+                throw;
             }
+
+            if (task.priority == PRIORITY_LOW) {
+                --nLowPriorityRunning;
+                // A thread may be waiting for this task to finish.
+                newTaskScheduled.notify_all();
+            }
+            Stats& taskStats = stats[task.priority];
+            taskStats.nTasks++;
+            taskStats.nLatencyMicros += nLatencyMicros;
+            taskStats.nRunMicros += boost::chrono::duration_cast<boost::chrono::microseconds>(
+                boost::chrono::system_clock::now() - now).count();
+            if (nLatencyMicros >= SCHEDULER_OVERRUN_MICROS)
+                taskStats.nOverruns++;
         } catch (...) {
             --nThreadsServicingQueue;
             throw;
@@ -84,29 +122,30 @@ void CScheduler::stop(bool drain)
     newTaskScheduled.notify_all();
 }
 
-void CScheduler::schedule(CScheduler::Function f, boost::chrono::system_clock::time_point t)
+void CScheduler::schedule(CScheduler::Function f, boost::chrono::system_clock::time_point t, Priority priority)
 {
+    assert(priority < PRIORITY_COUNT);
     {
         boost::unique_lock<boost::mutex> lock(newTaskMutex);
-        taskQueue.insert(std::make_pair(t, f));
+        taskQueue.insert(std::make_pair(t, Task{f, priority}));
     }
     newTaskScheduled.notify_one();
 }
 
-void CScheduler::scheduleFromNow(CScheduler::Function f, int64_t deltaSeconds)
+void CScheduler::scheduleFromNow(CScheduler::Function f, int64_t deltaSeconds, Priority priority)
 {
-    schedule(f, boost::chrono::system_clock::now() + boost::chrono::seconds(deltaSeconds));
+    schedule(f, boost::chrono::system_clock::now() + boost::chrono::seconds(deltaSeconds), priority);
 }
 
-static void Repeat(CScheduler* s, CScheduler::Function f, int64_t deltaSeconds)
+static void Repeat(CScheduler* s, CScheduler::Function f, int64_t deltaSeconds, CScheduler::Priority priority)
 {
     f();
-    s->scheduleFromNow(boost::bind(&Repeat, s, f, deltaSeconds), deltaSeconds);
+    s->scheduleFromNow(boost::bind(&Repeat, s, f, deltaSeconds, priority), deltaSeconds, priority);
 }
 
-void CScheduler::scheduleEvery(CScheduler::Function f, int64_t deltaSeconds)
+void CScheduler::scheduleEvery(CScheduler::Function f, int64_t deltaSeconds, Priority priority)
 {
-    scheduleFromNow(boost::bind(&Repeat, this, f, deltaSeconds), deltaSeconds);
+    scheduleFromNow(boost::bind(&Repeat, this, f, deltaSeconds, priority), deltaSeconds, priority);
 }
 
 size_t CScheduler::getQueueInfo(boost::chrono::system_clock::time_point &first,
@@ -120,3 +159,23 @@ size_t CScheduler::getQueueInfo(boost::chrono::system_clock::time_point &first,
     }
     return result;
 }
+
+CScheduler::Stats CScheduler::getStats(Priority priority) const
+{
+    assert(priority < PRIORITY_COUNT);
+    boost::unique_lock<boost::mutex> lock(newTaskMutex);
+    return stats[priority];
+}
+
+const char* CScheduler::PriorityName(Priority priority)
+{
+    switch (priority) {
+        case PRIORITY_HIGH:
+            return "high";
+        case PRIORITY_NORMAL:
+            return "normal";
+        default:
+            assert(priority == PRIORITY_LOW);
+            return "low";
+    }
+}
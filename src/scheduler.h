@@ -14,6 +14,13 @@
 #include <boost/thread.hpp>
 #include <map>
 
+/** Maximum number of threads servicing the scheduler queue */
+static const int MAX_SCHEDULER_THREADS = 16;
+/** -schedulerthreads default (number of threads servicing the scheduler queue) */
+static const int DEFAULT_SCHEDULER_THREADS = 2;
+/** A task that starts this many microseconds after its time is counted as an overrun */
+static const int64_t SCHEDULER_OVERRUN_MICROS = 1000000;
+
 //
 // Simple class for background tasks that should be run
 // periodically or once "after a while"
@@ -31,6 +38,11 @@
 // delete t;
 // delete s; // Must be done after thread is interrupted/joined.
 //
+// Several threads may service the queue. Of the tasks that are due, those
+// of the highest priority run first, and when more than one thread services
+// the queue, one of them is kept free of low priority tasks, so that a long
+// low priority task does not hold up the others.
+//
 
 class CScheduler
 {
@@ -40,18 +52,33 @@ public:
 
     typedef std::function<void(void)> Function;
 
+    enum Priority {
+        PRIORITY_HIGH,
+        PRIORITY_NORMAL,
+        PRIORITY_LOW,
+        PRIORITY_COUNT
+    };
+
+    // How late the tasks of a priority started, and for how long they ran
+    struct Stats {
+        uint64_t nTasks = 0;
+        uint64_t nLatencyMicros = 0;
+        uint64_t nRunMicros = 0;
+        uint64_t nOverruns = 0;
+    };
+
     // Call func at/after time t
-    void schedule(Function f, boost::chrono::system_clock::time_point t);
+    void schedule(Function f, boost::chrono::system_clock::time_point t, Priority priority = PRIORITY_NORMAL);
 
     // Convenience method: call f once deltaSeconds from now
-    void scheduleFromNow(Function f, int64_t deltaSeconds);
+    void scheduleFromNow(Function f, int64_t deltaSeconds, Priority priority = PRIORITY_NORMAL);
 
     // Another convenience method: call f approximately
     // every deltaSeconds forever, starting deltaSeconds from now.
     // To be more precise: every time f is finished, it
     // is rescheduled to run deltaSeconds later. If you
     // need more accurate scheduling, don't use this method.
-    void scheduleEvery(Function f, int64_t deltaSeconds);
+    void scheduleEvery(Function f, int64_t deltaSeconds, Priority priority = PRIORITY_NORMAL);
 
     // To keep things as simple as possible, there is no unschedule.
 
@@ -69,14 +96,29 @@ public:
     size_t getQueueInfo(boost::chrono::system_clock::time_point &first,
                         boost::chrono::system_clock::time_point &last) const;
 
+    // Returns the totals for the tasks of a priority that have run so far
+    Stats getStats(Priority priority) const;
+
+    static const char* PriorityName(Priority priority);
+
 private:
-    std::multimap<boost::chrono::system_clock::time_point, Function> taskQueue;
+    struct Task {
+        Function f;
+        Priority priority;
+    };
+    typedef std::multimap<boost::chrono::system_clock::time_point, Task> TaskQueue;
+
+    TaskQueue taskQueue;
     boost::condition_variable newTaskScheduled;
     mutable boost::mutex newTaskMutex;
     int nThreadsServicingQueue;
+    int nLowPriorityRunning;
     bool stopRequested;
     bool stopWhenEmpty;
+    Stats stats[PRIORITY_COUNT];
     bool shouldStop() { return stopRequested || (stopWhenEmpty && taskQueue.empty()); }
+    // The due task that should run next on this thread, or end() if none may
+    TaskQueue::iterator nextTask(boost::chrono::system_clock::time_point now);
 };
 
 #endif
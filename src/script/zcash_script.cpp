@@ -6,11 +6,19 @@
 #include "zcash_script.h"
 
 #include "consensus/upgrades.h"
+#include "crypto/sha256.h"
+#include "cuckoocache.h"
 #include "primitives/transaction.h"
 #include "pubkey.h"
 #include "script/interpreter.h"
 #include "version.h"
 
+#include <algorithm>
+#include <atomic>
+#include <random>
+#include <shared_mutex>
+#include <thread>
+
 namespace {
 
 /** A class that deserializes a single CTransaction one time. */
@@ -69,6 +77,96 @@ struct ECCryptoClosure
 };
 
 ECCryptoClosure instance_of_eccryptoclosure;
+
+/** The entries are salted hashes, whose bytes can be used as they are. */
+class SignatureCacheHasher
+{
+public:
+    template <uint8_t hash_select>
+    uint32_t operator()(const uint256& key) const
+    {
+        static_assert(hash_select < 8, "SignatureCacheHasher only has 8 hashes available.");
+        uint32_t u;
+        std::memcpy(&u, key.begin() + 4 * hash_select, 4);
+        return u;
+    }
+};
+
+/**
+ * The valid signatures seen by the library, as in CSignatureCache in
+ * zcashd, which the library does not link.
+ */
+class LibrarySignatureCache
+{
+private:
+    //! Entries are SHA256(salt || signature hash || public key || signature):
+    uint256 salt;
+    CuckooCache::cache<uint256, SignatureCacheHasher> setValid;
+    std::shared_mutex cs_sigcache;
+    std::atomic<bool> fEnabled{false};
+
+public:
+    LibrarySignatureCache()
+    {
+        std::random_device rd;
+        for (unsigned char* p = salt.begin(); p != salt.end(); p++) {
+            *p = (unsigned char)rd();
+        }
+    }
+
+    void Init(size_t nMaxBytes)
+    {
+        std::unique_lock<std::shared_mutex> lock(cs_sigcache);
+        fEnabled = nMaxBytes > 0;
+        setValid.setup_bytes(fEnabled ? nMaxBytes : sizeof(uint256));
+    }
+
+    bool IsEnabled() const { return fEnabled; }
+
+    void ComputeEntry(uint256& entry, const uint256& hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubkey)
+    {
+        CSHA256().Write(salt.begin(), 32).Write(hash.begin(), 32).Write(pubkey.begin(), pubkey.size()).Write(vchSig.data(), vchSig.size()).Finalize(entry.begin());
+    }
+
+    bool Get(const uint256& entry)
+    {
+        std::shared_lock<std::shared_mutex> lock(cs_sigcache);
+        return setValid.contains(entry, false);
+    }
+
+    void Set(const uint256& entry)
+    {
+        std::unique_lock<std::shared_mutex> lock(cs_sigcache);
+        setValid.insert(entry);
+    }
+};
+
+LibrarySignatureCache signatureCache;
+
+/** Checks signatures through the library's signature cache, if it is enabled. */
+class LibrarySignatureChecker : public TransactionSignatureChecker
+{
+public:
+    LibrarySignatureChecker(const CTransaction* txToIn, unsigned int nInIn, const CAmount& amount, const PrecomputedTransactionData& txdataIn) :
+        TransactionSignatureChecker(txToIn, nInIn, amount, txdataIn) {}
+
+    bool VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& pubkey, const uint256& sighash) const
+    {
+        if (!signatureCache.IsEnabled()) {
+            return TransactionSignatureChecker::VerifySignature(vchSig, pubkey, sighash);
+        }
+        uint256 entry;
+        signatureCache.ComputeEntry(entry, sighash, vchSig, pubkey);
+        if (signatureCache.Get(entry)) {
+            return true;
+        }
+        if (!TransactionSignatureChecker::VerifySignature(vchSig, pubkey, sighash)) {
+            return false;
+        }
+        signatureCache.Set(entry);
+        return true;
+    }
+};
 }
 
 struct PrecomputedTransaction {
@@ -129,11 +227,63 @@ int zcash_script_verify_precomputed(
         preTx->tx.vin[nIn].scriptSig,
         CScript(scriptPubKey, scriptPubKey + scriptPubKeyLen),
         flags,
-        TransactionSignatureChecker(&preTx->tx, nIn, amount, preTx->txdata),
+        LibrarySignatureChecker(&preTx->tx, nIn, amount, preTx->txdata),
         consensusBranchId,
         NULL);
 }
 
+int zcash_script_verify_all_precomputed(
+    const void* pre_preTx,
+    const zcash_script_spent_output* spentOutputs,
+    unsigned int nSpentOutputs,
+    unsigned int flags,
+    uint32_t consensusBranchId,
+    unsigned int nThreads,
+    zcash_script_error* err)
+{
+    const PrecomputedTransaction* preTx = static_cast<const PrecomputedTransaction*>(pre_preTx);
+    if (nSpentOutputs != preTx->tx.vin.size())
+        return set_error(err, zcash_script_ERR_SPENT_OUTPUTS_MISMATCH);
+
+    // Regardless of the verification result, the tx did not error.
+    set_error(err, zcash_script_ERR_OK);
+
+    // Each thread takes the next input that has not been verified yet, until
+    // they are all done or one of them fails.
+    std::atomic<unsigned int> nNext(0);
+    std::atomic<bool> fFailed(false);
+    auto worker = [&]() {
+        unsigned int nIn;
+        while (!fFailed && (nIn = nNext++) < nSpentOutputs) {
+            const zcash_script_spent_output& spent = spentOutputs[nIn];
+            if (!VerifyScript(
+                    preTx->tx.vin[nIn].scriptSig,
+                    CScript(spent.scriptPubKey, spent.scriptPubKey + spent.scriptPubKeyLen),
+                    flags,
+                    LibrarySignatureChecker(&preTx->tx, nIn, spent.amount, preTx->txdata),
+                    consensusBranchId,
+                    NULL)) {
+                fFailed = true;
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned int i = 1; i < std::min(nThreads, nSpentOutputs); i++) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    return !fFailed;
+}
+
+void zcash_script_init_signature_cache(size_t nMaxBytes)
+{
+    signatureCache.Init(nMaxBytes);
+}
+
 int zcash_script_verify(
     const unsigned char *scriptPubKey, unsigned int scriptPubKeyLen,
     int64_t amount,
@@ -158,7 +308,7 @@ int zcash_script_verify(
             tx.vin[nIn].scriptSig,
             CScript(scriptPubKey, scriptPubKey + scriptPubKeyLen),
             flags,
-            TransactionSignatureChecker(&tx, nIn, amount, txdata),
+            LibrarySignatureChecker(&tx, nIn, amount, txdata),
             consensusBranchId,
             NULL);
     } catch (const std::exception&) {
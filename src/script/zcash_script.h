@@ -6,6 +6,7 @@
 #ifndef ZCASH_SCRIPT_ZCASH_SCRIPT_H
 #define ZCASH_SCRIPT_ZCASH_SCRIPT_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 #if defined(BUILD_BITCOIN_INTERNAL) && defined(HAVE_CONFIG_H)
@@ -33,7 +34,7 @@
 extern "C" {
 #endif
 
-#define ZCASH_SCRIPT_API_VER 1
+#define ZCASH_SCRIPT_API_VER 2
 
 typedef enum zcash_script_error_t
 {
@@ -41,6 +42,7 @@ typedef enum zcash_script_error_t
     zcash_script_ERR_TX_INDEX,
     zcash_script_ERR_TX_SIZE_MISMATCH,
     zcash_script_ERR_TX_DESERIALIZE,
+    zcash_script_ERR_SPENT_OUTPUTS_MISMATCH,
 } zcash_script_error;
 
 /** Script verification flags */
@@ -51,6 +53,14 @@ enum
     zcash_script_SCRIPT_FLAGS_VERIFY_CHECKLOCKTIMEVERIFY = (1U << 9), // enable CHECKLOCKTIMEVERIFY (BIP65)
 };
 
+/** An output spent by an input of a transaction. */
+typedef struct zcash_script_spent_output
+{
+    const unsigned char* scriptPubKey;
+    unsigned int scriptPubKeyLen;
+    int64_t amount;
+} zcash_script_spent_output;
+
 /// Deserializes the given transaction and precomputes values to improve
 /// script verification performance.
 ///
@@ -84,6 +94,39 @@ EXPORT_SYMBOL int zcash_script_verify_precomputed(
     uint32_t consensusBranchId,
     zcash_script_error* err);
 
+/// Returns 1 if every input of the precomputed transaction pointed to by
+/// preTx correctly spends the output at the same index of spentOutputs,
+/// under the additional constraints specified by flags.
+///
+/// nSpentOutputs must be the number of inputs of the transaction. If nThreads
+/// is greater than 1, the inputs are verified on up to that many threads,
+/// which are started for the call; this is only worthwhile for transactions
+/// with many inputs. Verification stops at the first input that fails.
+///
+/// If not NULL, err will contain an error/success code for the operation.
+/// Note that script verification failure is indicated by err being set to
+/// zcash_script_ERR_OK and a return value of 0.
+EXPORT_SYMBOL int zcash_script_verify_all_precomputed(
+    const void* preTx,
+    const zcash_script_spent_output* spentOutputs,
+    unsigned int nSpentOutputs,
+    unsigned int flags,
+    uint32_t consensusBranchId,
+    unsigned int nThreads,
+    zcash_script_error* err);
+
+/// Makes every verification function remember the signatures that it has
+/// found to be valid, in a cache of at most nMaxBytes shared by all threads,
+/// so that a signature checked once, for example when a transaction is
+/// relayed, does not need to be checked again when it is mined. A size of 0
+/// disables the cache, which is how the library starts.
+///
+/// This must not be called while verification functions are running. The
+/// precomputed transactions and verification functions may otherwise be
+/// used from any number of threads at once, so callers can also verify
+/// inputs on their own thread pool with zcash_script_verify_precomputed.
+EXPORT_SYMBOL void zcash_script_init_signature_cache(size_t nMaxBytes);
+
 /// Returns 1 if the input nIn of the serialized transaction pointed to by
 /// txTo correctly spends the scriptPubKey pointed to by scriptPubKey under
 /// the additional constraints specified by flags.
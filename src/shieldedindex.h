@@ -0,0 +1,94 @@
+// Copyright (c) 2021 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifndef ZCASH_SHIELDEDINDEX_H
+#define ZCASH_SHIELDEDINDEX_H
+
+#include "serialize.h"
+#include "uint256.h"
+
+#include <stdint.h>
+#include <utility>
+
+/** The Sapling spend that revealed a nullifier, as kept by -shieldedindex. */
+struct CSaplingSpendIndexValue {
+    uint256 txid;
+    //! Index of the spend in the vShieldedSpend of the transaction
+    unsigned int spendIndex;
+    int blockHeight;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(txid);
+        READWRITE(VARINT(spendIndex));
+        READWRITE(VARINT(blockHeight));
+    }
+
+    CSaplingSpendIndexValue(uint256 t, unsigned int i, int h) : txid(t), spendIndex(i), blockHeight(h) {}
+
+    CSaplingSpendIndexValue() {
+        SetNull();
+    }
+
+    void SetNull() {
+        txid.SetNull();
+        spendIndex = 0;
+        blockHeight = 0;
+    }
+};
+
+/**
+ * The Sapling output that created a note commitment, with the position of the
+ * commitment in the Sapling note commitment tree, as kept by -shieldedindex.
+ */
+struct CSaplingOutputIndexValue {
+    uint256 txid;
+    //! Index of the output in the vShieldedOutput of the transaction
+    unsigned int outputIndex;
+    int blockHeight;
+    //! Number of commitments appended to the tree before this one
+    uint64_t position;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(txid);
+        READWRITE(VARINT(outputIndex));
+        READWRITE(VARINT(blockHeight));
+        READWRITE(VARINT(position));
+    }
+
+    CSaplingOutputIndexValue(uint256 t, unsigned int i, int h, uint64_t p) : txid(t), outputIndex(i), blockHeight(h), position(p) {}
+
+    CSaplingOutputIndexValue() {
+        SetNull();
+    }
+
+    void SetNull() {
+        txid.SetNull();
+        outputIndex = 0;
+        blockHeight = 0;
+        position = 0;
+    }
+};
+
+//! A nullifier and the spend that revealed it.
+typedef std::pair<uint256, CSaplingSpendIndexValue> CSaplingSpendIndexDbEntry;
+//! A note commitment (cmu) and the output that created it.
+typedef std::pair<uint256, CSaplingOutputIndexValue> CSaplingOutputIndexDbEntry;
+//! A node of the Sapling note commitment tree, by level (0 for the commitments) and index in its level.
+typedef std::pair<uint8_t, uint64_t> CSaplingTreeNodeKey;
+typedef std::pair<CSaplingTreeNodeKey, uint256> CSaplingTreeNodeDbEntry;
+
+/**
+ * The shielded index keeps the commitments of the Sapling tree and the roots
+ * of its complete subtrees at every SAPLING_TREE_INDEX_STRIDE levels, from
+ * which any other node is computed with at most 2^(stride - 1) reads.
+ */
+static const int SAPLING_TREE_INDEX_STRIDE = 4;
+
+#endif // ZCASH_SHIELDEDINDEX_H
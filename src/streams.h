@@ -69,6 +69,55 @@ OverrideStream<S> WithVersion(S* s, int nVersion)
     return OverrideStream<S>(s, s->GetType(), nVersion);
 }
 
+/** Read-only stream over a region of memory that it does not own, which is
+ * deserialized from in place rather than copied into a buffer first.
+ */
+class CMemoryReader
+{
+private:
+    const int nType;
+    const int nVersion;
+
+    const char* pcur;
+    const char* pend;
+
+public:
+    CMemoryReader(int nTypeIn, int nVersionIn, const char* pbegin, const char* pendIn) :
+        nType(nTypeIn), nVersion(nVersionIn), pcur(pbegin), pend(pendIn) {}
+
+    template<typename T>
+    CMemoryReader& operator>>(T&& obj)
+    {
+        // Unserialize from this stream
+        ::Unserialize(*this, obj);
+        return (*this);
+    }
+
+    void read(char* pch, size_t nSize)
+    {
+        if (nSize > size())
+            throw std::ios_base::failure("CMemoryReader::read: end of data");
+        if (nSize > 0)
+            memcpy(pch, pcur, nSize);
+        pcur += nSize;
+    }
+
+    void ignore(size_t nSize)
+    {
+        if (nSize > size())
+            throw std::ios_base::failure("CMemoryReader::ignore: end of data");
+        pcur += nSize;
+    }
+
+    //! The data that has not been read yet
+    const char* data() const { return pcur; }
+    size_t size() const { return pend - pcur; }
+    bool empty() const  { return pcur == pend; }
+
+    int GetVersion() const { return nVersion; }
+    int GetType() const { return nType; }
+};
+
 /** Double ended buffer combining vector and stream-like interfaces.
  *
  * >> and << read and write unformatted data using the above serialization templates.
@@ -350,6 +399,12 @@ public:
         d.insert(d.end(), begin(), end());
         clear();
     }
+
+    //! Exchange the buffer with d, without copying either, and rewind.
+    void swap(vector_type& d) {
+        vch.swap(d);
+        nReadPos = 0;
+    }
 };
 
 class CDataStream : public CBaseDataStream<CSerializeData>
@@ -380,6 +435,34 @@ public:
 
 };
 
+/**
+ * Allocator of CNetSerializeData, which allocates as std::allocator does.
+ * Unlike zero_after_free_allocator, it does not clear memory when freeing it.
+ */
+template <typename T>
+struct net_data_allocator : public std::allocator<T> {
+    net_data_allocator() noexcept {}
+    template <typename U>
+    net_data_allocator(const net_data_allocator<U>& a) noexcept {}
+    template <typename U>
+    struct rebind {
+        typedef net_data_allocator<U> other;
+    };
+};
+
+/** Byte-vector for data that is not secret, which is not cleared when it is freed. */
+typedef std::vector<char, net_data_allocator<char>> CNetSerializeData;
+
+/**
+ * A CDataStream for network messages. They are not secret, so unlike
+ * CDataStream its buffer is not cleared when it is freed.
+ */
+class CNetDataStream : public CBaseDataStream<CNetSerializeData>
+{
+public:
+    explicit CNetDataStream(int nTypeIn, int nVersionIn) : CBaseDataStream(nTypeIn, nVersionIn) { }
+};
+
 
 
 
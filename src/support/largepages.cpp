@@ -0,0 +1,136 @@
+// Copyright (c) 2021 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "support/largepages.h"
+
+#include "logging.h"
+
+#ifndef WIN32
+#include <sys/mman.h> // for mmap, madvise
+#endif
+#if defined(__linux__)
+#include <linux/mempolicy.h> // for MPOL_INTERLEAVE
+#include <sys/syscall.h> // for SYS_mbind
+#include <unistd.h> // for syscall
+#endif
+
+#include <atomic>
+#include <cstdint>
+#include <new>
+
+static std::atomic<LargePageMode> largePageMode{LargePageMode::NONE};
+static std::atomic<bool> fNumaInterleave{false};
+
+bool ParseLargePageMode(const std::string& str, LargePageMode& mode)
+{
+    if (str == "none") {
+        mode = LargePageMode::NONE;
+    } else if (str == "transparent") {
+        mode = LargePageMode::TRANSPARENT;
+    } else if (str == "explicit") {
+        mode = LargePageMode::EXPLICIT;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+void SetLargePageOptions(LargePageMode mode, bool fInterleave)
+{
+    largePageMode = mode;
+    fNumaInterleave = fInterleave;
+}
+
+bool LargePagesEnabled()
+{
+    return largePageMode.load() != LargePageMode::NONE;
+}
+
+#ifndef WIN32
+static size_t MappedBytes(size_t nBytes)
+{
+    return (nBytes + LARGE_PAGE_BYTES - 1) / LARGE_PAGE_BYTES * LARGE_PAGE_BYTES;
+}
+
+/** Map nMapped bytes aligned to LARGE_PAGE_BYTES, so that they can be backed by huge pages. */
+static void* MapAligned(size_t nMapped)
+{
+    void* p = mmap(nullptr, nMapped + LARGE_PAGE_BYTES, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        return nullptr;
+    }
+    // Give back the pages before and after the aligned range.
+    uintptr_t nStart = reinterpret_cast<uintptr_t>(p);
+    uintptr_t nAligned = (nStart + LARGE_PAGE_BYTES - 1) / LARGE_PAGE_BYTES * LARGE_PAGE_BYTES;
+    if (nAligned > nStart) {
+        munmap(p, nAligned - nStart);
+    }
+    munmap(reinterpret_cast<void*>(nAligned + nMapped), nStart + LARGE_PAGE_BYTES - nAligned);
+    return reinterpret_cast<void*>(nAligned);
+}
+#endif
+
+void* LargePageAlloc(size_t nBytes, size_t nAlign)
+{
+#ifdef WIN32
+    return ::operator new(nBytes, std::align_val_t{nAlign});
+#else
+    if (nBytes < LARGE_PAGE_BYTES) {
+        return ::operator new(nBytes, std::align_val_t{nAlign});
+    }
+
+    size_t nMapped = MappedBytes(nBytes);
+    LargePageMode mode = largePageMode.load();
+    void* p = nullptr;
+#ifdef MAP_HUGETLB
+    if (mode == LargePageMode::EXPLICIT) {
+        p = mmap(nullptr, nMapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p == MAP_FAILED) {
+            p = nullptr;
+            static std::atomic<bool> fWarned{false};
+            if (!fWarned.exchange(true)) {
+                LogPrintf("Warning: no huge pages left for a %u byte allocation, using transparent huge pages; raise vm.nr_hugepages\n", nMapped);
+            }
+        }
+    }
+#endif
+    if (p == nullptr) {
+        p = MapAligned(nMapped);
+        if (p == nullptr) {
+            throw std::bad_alloc();
+        }
+#ifdef MADV_HUGEPAGE
+        if (mode != LargePageMode::NONE) {
+            madvise(p, nMapped, MADV_HUGEPAGE);
+        }
+#endif
+    }
+
+#if defined(__linux__) && defined(SYS_mbind)
+    // The pages are not touched yet, so the policy applies to all of them.
+    // The kernel drops the nodes that the process may not use from the mask.
+    if (fNumaInterleave.load()) {
+        unsigned long nNodeMask = ~0UL;
+        syscall(SYS_mbind, p, nMapped, MPOL_INTERLEAVE, &nNodeMask, sizeof(nNodeMask) * 8, 0);
+    }
+#endif
+    return p;
+#endif
+}
+
+void LargePageFree(void* p, size_t nBytes, size_t nAlign) noexcept
+{
+    if (p == nullptr) {
+        return;
+    }
+#ifdef WIN32
+    ::operator delete(p, std::align_val_t{nAlign});
+#else
+    if (nBytes < LARGE_PAGE_BYTES) {
+        ::operator delete(p, std::align_val_t{nAlign});
+        return;
+    }
+    munmap(p, MappedBytes(nBytes));
+#endif
+}
@@ -0,0 +1,89 @@
+// Copyright (c) 2021 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifndef BITCOIN_SUPPORT_LARGEPAGES_H
+#define BITCOIN_SUPPORT_LARGEPAGES_H
+
+#include <cstddef>
+#include <string>
+
+/**
+ * The size of a huge page on x86-64 and aarch64 Linux. Allocations by
+ * LargePageAlloc() of at least this size are mapped on their own, so that
+ * they can be backed by huge pages.
+ */
+static const size_t LARGE_PAGE_BYTES = 2 * 1024 * 1024;
+
+/** How the large allocations of the caches are backed (-largepages). */
+enum class LargePageMode {
+    //! Ordinary pages.
+    NONE,
+    //! Transparent huge pages, requested with madvise(MADV_HUGEPAGE).
+    TRANSPARENT,
+    //! Huge pages reserved through vm.nr_hugepages, with MAP_HUGETLB. Falls
+    //! back to transparent huge pages when none are left.
+    EXPLICIT,
+};
+
+/** Default for -largepages */
+static const char* const DEFAULT_LARGE_PAGES = "none";
+/** Default for -numainterleave */
+static const bool DEFAULT_NUMA_INTERLEAVE = false;
+
+/** Parse a -largepages value. Returns false if it is not a mode. */
+bool ParseLargePageMode(const std::string& str, LargePageMode& mode);
+
+/**
+ * Set how the allocations made from now on are backed, and whether their
+ * pages are interleaved across the NUMA nodes rather than placed on the node
+ * of the thread that first touches them. Called at startup, before the
+ * caches are created.
+ */
+void SetLargePageOptions(LargePageMode mode, bool fInterleave);
+
+/** Whether -largepages asked for huge pages. */
+bool LargePagesEnabled();
+
+/**
+ * Allocate nBytes aligned to nAlign. Allocations smaller than
+ * LARGE_PAGE_BYTES come from operator new. Larger ones are mapped on their
+ * own, rounded up to a multiple of LARGE_PAGE_BYTES and aligned to it, and
+ * backed as SetLargePageOptions() asked. Throws std::bad_alloc on failure.
+ */
+void* LargePageAlloc(size_t nBytes, size_t nAlign);
+
+/** Free an allocation of LargePageAlloc(), given the same size and alignment. */
+void LargePageFree(void* p, size_t nBytes, size_t nAlign) noexcept;
+
+/**
+ * An allocator for the big, randomly accessed tables of the caches, such as
+ * the signature cache, that backs them as LargePageAlloc() does.
+ */
+template <typename T>
+class LargePageAllocator
+{
+public:
+    typedef T value_type;
+
+    LargePageAllocator() noexcept {}
+    template <typename U>
+    LargePageAllocator(const LargePageAllocator<U>&) noexcept {}
+
+    T* allocate(std::size_t n)
+    {
+        return static_cast<T*>(LargePageAlloc(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T* p, std::size_t n) noexcept
+    {
+        LargePageFree(p, n * sizeof(T), alignof(T));
+    }
+};
+
+template <typename T, typename U>
+bool operator==(const LargePageAllocator<T>&, const LargePageAllocator<U>&) noexcept { return true; }
+template <typename T, typename U>
+bool operator!=(const LargePageAllocator<T>&, const LargePageAllocator<U>&) noexcept { return false; }
+
+#endif // BITCOIN_SUPPORT_LARGEPAGES_H
@@ -23,6 +23,8 @@
 
 #include <algorithm>
 #include <cassert>
+#include <new>
+#include <vector>
 #ifdef ARENA_DEBUG
 #include <iomanip>
 #include <iostream>
@@ -300,15 +302,16 @@ void* LockedPool::alloc(size_t size)
     if (size == 0 || size > ARENA_SIZE)
         return nullptr;
 
-    // Try allocating from each current arena
-    for (auto &arena: arenas) {
-        void *addr = arena.alloc(size);
+    // Try allocating from each current arena, newest (and largest) first
+    for (auto it = arenas.rbegin(); it != arenas.rend(); ++it) {
+        void *addr = it->alloc(size);
         if (addr) {
             return addr;
         }
     }
-    // If that fails, create a new one
-    if (new_arena(ARENA_SIZE, ARENA_ALIGN)) {
+    // If that fails, create a new one, twice the size of the last one
+    size_t arena_size = arenas.empty() ? ARENA_SIZE : std::min(2 * arenas.back().stats().total, MAX_ARENA_SIZE);
+    if (new_arena(arena_size, ARENA_ALIGN)) {
         return arenas.back().alloc(size);
     }
     return nullptr;
@@ -322,11 +325,12 @@ void LockedPool::free(void *ptr) noexcept
     }
 
     std::lock_guard<std::mutex> lock(mutex);
-    // TODO we can do better than this linear search by keeping a map of arena
-    // extents to arena, and looking up the address.
-    for (auto &arena: arenas) {
-        if (arena.addressInArena(ptr)) {
-            arena.free(ptr);
+    // The arena is the one with the highest base address not above ptr.
+    auto it = arenas_by_base.upper_bound(static_cast<char*>(ptr));
+    if (it != arenas_by_base.begin()) {
+        --it;
+        if (it->second->addressInArena(ptr)) {
+            it->second->free(ptr);
             return;
         }
     }
@@ -355,11 +359,19 @@ bool LockedPool::new_arena(size_t size, size_t align)
     // by the process limit. This makes sure that the first arena will at least
     // be locked. An exception to this is if the process limit is 0:
     // in this case no memory can be locked at all so we'll skip past this logic.
+    //
+    // Later arenas are capped by what is left of the limit, but not below
+    // ARENA_SIZE, so that growth does not turn memory that could have been
+    // locked into an unlocked arena.
+    size_t limit = allocator->GetLimit();
     if (arenas.empty()) {
-        size_t limit = allocator->GetLimit();
         if (limit > 0) {
             size = std::min(size, limit);
         }
+    } else if (limit > cumulative_bytes_locked) {
+        size = std::max(std::min(size, limit - cumulative_bytes_locked), ARENA_SIZE);
+    } else {
+        size = ARENA_SIZE;
     }
     void *addr = allocator->AllocateLocked(size, &locked);
     if (!addr) {
@@ -374,6 +386,7 @@ bool LockedPool::new_arena(size_t size, size_t align)
         }
     }
     arenas.emplace_back(allocator.get(), addr, size, align);
+    arenas_by_base.emplace(static_cast<char*>(addr), &arenas.back());
     return true;
 }
 
@@ -394,6 +407,65 @@ LockedPoolManager::LockedPoolManager(std::unique_ptr<LockedPageAllocator> alloca
 {
 }
 
+namespace {
+
+/** Chunks freed by this thread, by size in units of LockedPool::ARENA_ALIGN */
+class LockedPoolThreadCache
+{
+public:
+    std::vector<void*> chunks[LockedPoolManager::THREAD_CACHE_MAX_SIZE / LockedPool::ARENA_ALIGN];
+
+    ~LockedPoolThreadCache()
+    {
+        for (auto& sized : chunks) {
+            for (void* ptr : sized) {
+                LockedPoolManager::Instance().LockedPool::free(ptr);
+            }
+        }
+    }
+};
+
+thread_local LockedPoolThreadCache thread_cache;
+
+/** Index into LockedPoolThreadCache::chunks for chunks of size bytes, or -1 if they are not cached */
+int ThreadCacheIndex(size_t size)
+{
+    if (size == 0 || size > LockedPoolManager::THREAD_CACHE_MAX_SIZE) {
+        return -1;
+    }
+    return (align_up(size, LockedPool::ARENA_ALIGN) / LockedPool::ARENA_ALIGN) - 1;
+}
+
+}
+
+void* LockedPoolManager::alloc(size_t size)
+{
+    int index = ThreadCacheIndex(size);
+    if (index >= 0 && !thread_cache.chunks[index].empty()) {
+        void* ptr = thread_cache.chunks[index].back();
+        thread_cache.chunks[index].pop_back();
+        return ptr;
+    }
+    return LockedPool::alloc(size);
+}
+
+void LockedPoolManager::free(void *ptr, size_t size) noexcept
+{
+    if (ptr == nullptr) {
+        return;
+    }
+    int index = ThreadCacheIndex(size);
+    if (index >= 0 && thread_cache.chunks[index].size() < THREAD_CACHE_CHUNKS) {
+        try {
+            thread_cache.chunks[index].push_back(ptr);
+            return;
+        } catch (const std::bad_alloc&) {
+            // Fall back to freeing it to the pool.
+        }
+    }
+    LockedPool::free(ptr);
+}
+
 bool LockedPoolManager::LockingFailed()
 {
     // TODO: log something but how? without including util.h
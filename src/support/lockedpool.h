@@ -131,6 +131,12 @@ public:
      * more locked memory from the OS than strictly necessary.
      */
     static const size_t ARENA_SIZE = 256*1024;
+    /** Largest size of an arena. Each new arena is twice the size of the
+     * previous one up to this size, so that a pool that keeps growing
+     * locks its memory in a few large chunks rather than many small ones.
+     * Allocations are still limited to ARENA_SIZE.
+     */
+    static const size_t MAX_ARENA_SIZE = 16*ARENA_SIZE;
     /** Chunk alignment. Another compromise. Setting this too high will waste
      * memory, setting it too low will facilitate fragmentation.
      */
@@ -195,6 +201,9 @@ private:
     bool new_arena(size_t size, size_t align);
 
     std::list<LockedPageArena> arenas;
+    /** Map from the base address of each arena to the arena, to find the
+     * arena that a chunk being freed belongs to */
+    std::map<char*, LockedPageArena*> arenas_by_base;
     LockingFailed_Callback lf_cb;
     size_t cumulative_bytes_locked;
     /** Mutex protects access to this pool's data structures, including arenas.
@@ -224,6 +233,23 @@ public:
         return *LockedPoolManager::_instance;
     }
 
+    /** Largest chunk kept in the per-thread caches */
+    static const size_t THREAD_CACHE_MAX_SIZE = 256;
+    /** Number of chunks of each size kept in each thread's cache */
+    static const size_t THREAD_CACHE_CHUNKS = 32;
+
+    /** Allocate size bytes, taking a chunk of that size from this thread's
+     * cache if it has one, without locking the pool.
+     */
+    void* alloc(size_t size);
+    /** Free a chunk of size bytes, which must have been cleared already.
+     * Small chunks are kept in this thread's cache, up to
+     * THREAD_CACHE_CHUNKS of each size, and count as used meanwhile; they
+     * are returned to the pool when the thread exits.
+     */
+    void free(void *ptr, size_t size) noexcept;
+    using LockedPool::free;
+
 private:
     explicit LockedPoolManager(std::unique_ptr<LockedPageAllocator> allocator);
 
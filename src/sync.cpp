@@ -11,6 +11,33 @@
 
 #include <boost/thread.hpp>
 
+// The registry of lock sites. The sites are never removed, as they are
+// function-local statics that live until the process exits.
+static boost::mutex& LockSitesMutex()
+{
+    static boost::mutex mutex;
+    return mutex;
+}
+
+static std::vector<const CLockSite*>& LockSites()
+{
+    static std::vector<const CLockSite*> sites;
+    return sites;
+}
+
+CLockSite::CLockSite(const char* pszNameIn, const char* pszFileIn, int nLineIn) :
+    pszName(pszNameIn), pszFile(pszFileIn), nLine(nLineIn)
+{
+    boost::unique_lock<boost::mutex> lock(LockSitesMutex());
+    LockSites().push_back(this);
+}
+
+std::vector<const CLockSite*> GetLockSites()
+{
+    boost::unique_lock<boost::mutex> lock(LockSitesMutex());
+    return LockSites();
+}
+
 #ifdef DEBUG_LOCKCONTENTION
 void PrintLockContention(const char* pszName, const char* pszFile, int nLine)
 {
@@ -8,6 +8,11 @@
 
 #include "threadsafety.h"
 
+#include <atomic>
+#include <chrono>
+#include <stdint.h>
+#include <vector>
+
 #include <boost/thread/condition_variable.hpp>
 #include <boost/thread/locks.hpp>
 #include <boost/thread/mutex.hpp>
@@ -111,37 +116,86 @@ typedef boost::condition_variable CConditionVariable;
 void PrintLockContention(const char* pszName, const char* pszFile, int nLine);
 #endif
 
+/**
+ * The number of locks taken at a LOCK, LOCK2 or TRY_LOCK site, how many of
+ * them had to wait for another thread, and the total time spent waiting for
+ * and holding them. The counters are relaxed atomics and only the steady
+ * clock is read, so the profiling is cheap enough to always be on.
+ */
+class CLockSite
+{
+public:
+    const char* const pszName;
+    const char* const pszFile;
+    const int nLine;
+
+    std::atomic<uint64_t> nLocks{0};
+    std::atomic<uint64_t> nContentions{0};
+    std::atomic<uint64_t> nWaitMicros{0};
+    std::atomic<uint64_t> nHoldMicros{0};
+
+    /** Registers the site, which must have static storage duration. */
+    CLockSite(const char* pszNameIn, const char* pszFileIn, int nLineIn);
+
+    static int64_t Now()
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+};
+
+/** The lock sites that have been reached so far. */
+std::vector<const CLockSite*> GetLockSites();
+
 /** Wrapper around boost::unique_lock<Mutex> */
 template <typename Mutex>
 class SCOPED_LOCKABLE CMutexLock
 {
 private:
     boost::unique_lock<Mutex> lock;
+    CLockSite* site = nullptr;
+    int64_t nLockedAt = 0;
 
     void Enter(const char* pszName, const char* pszFile, int nLine)
     {
         EnterCritical(pszName, pszFile, nLine, (void*)(lock.mutex()));
-#ifdef DEBUG_LOCKCONTENTION
         if (!lock.try_lock()) {
+#ifdef DEBUG_LOCKCONTENTION
             PrintLockContention(pszName, pszFile, nLine);
 #endif
+            int64_t nWaitStart = site ? CLockSite::Now() : 0;
             lock.lock();
-#ifdef DEBUG_LOCKCONTENTION
+            if (site) {
+                nLockedAt = CLockSite::Now();
+                site->nContentions.fetch_add(1, std::memory_order_relaxed);
+                site->nWaitMicros.fetch_add(nLockedAt - nWaitStart, std::memory_order_relaxed);
+            }
+        } else if (site) {
+            nLockedAt = CLockSite::Now();
+        }
+        if (site) {
+            site->nLocks.fetch_add(1, std::memory_order_relaxed);
         }
-#endif
     }
 
     bool TryEnter(const char* pszName, const char* pszFile, int nLine)
     {
         EnterCritical(pszName, pszFile, nLine, (void*)(lock.mutex()), true);
         lock.try_lock();
-        if (!lock.owns_lock())
+        if (!lock.owns_lock()) {
             LeaveCritical();
+            if (site) {
+                site->nContentions.fetch_add(1, std::memory_order_relaxed);
+            }
+        } else if (site) {
+            nLockedAt = CLockSite::Now();
+            site->nLocks.fetch_add(1, std::memory_order_relaxed);
+        }
         return lock.owns_lock();
     }
 
 public:
-    CMutexLock(Mutex& mutexIn, const char* pszName, const char* pszFile, int nLine, bool fTry = false) EXCLUSIVE_LOCK_FUNCTION(mutexIn) : lock(mutexIn, boost::defer_lock)
+    CMutexLock(Mutex& mutexIn, const char* pszName, const char* pszFile, int nLine, bool fTry = false, CLockSite* siteIn = nullptr) EXCLUSIVE_LOCK_FUNCTION(mutexIn) : lock(mutexIn, boost::defer_lock), site(siteIn)
     {
         if (fTry)
             TryEnter(pszName, pszFile, nLine);
@@ -149,7 +203,7 @@ public:
             Enter(pszName, pszFile, nLine);
     }
 
-    CMutexLock(Mutex* pmutexIn, const char* pszName, const char* pszFile, int nLine, bool fTry = false) EXCLUSIVE_LOCK_FUNCTION(pmutexIn)
+    CMutexLock(Mutex* pmutexIn, const char* pszName, const char* pszFile, int nLine, bool fTry = false, CLockSite* siteIn = nullptr) EXCLUSIVE_LOCK_FUNCTION(pmutexIn) : site(siteIn)
     {
         if (!pmutexIn) return;
 
@@ -162,8 +216,12 @@ public:
 
     ~CMutexLock() UNLOCK_FUNCTION()
     {
-        if (lock.owns_lock())
+        if (lock.owns_lock()) {
+            if (site) {
+                site->nHoldMicros.fetch_add(CLockSite::Now() - nLockedAt, std::memory_order_relaxed);
+            }
             LeaveCritical();
+        }
     }
 
     operator bool()
@@ -177,9 +235,12 @@ typedef CMutexLock<CCriticalSection> CCriticalBlock;
 #define PASTE(x, y) x ## y
 #define PASTE2(x, y) PASTE(x, y)
 
-#define LOCK(cs) CCriticalBlock PASTE2(criticalblock, __COUNTER__)(cs, #cs, __FILE__, __LINE__)
-#define LOCK2(cs1, cs2) CCriticalBlock criticalblock1(cs1, #cs1, __FILE__, __LINE__), criticalblock2(cs2, #cs2, __FILE__, __LINE__)
-#define TRY_LOCK(cs, name) CCriticalBlock name(cs, #cs, __FILE__, __LINE__, true)
+// The profiling counters of the lock site that this macro is expanded at
+#define LOCK_SITE(cs) ([]() -> CLockSite* { static CLockSite site(#cs, __FILE__, __LINE__); return &site; }())
+
+#define LOCK(cs) CCriticalBlock PASTE2(criticalblock, __COUNTER__)(cs, #cs, __FILE__, __LINE__, false, LOCK_SITE(cs))
+#define LOCK2(cs1, cs2) CCriticalBlock criticalblock1(cs1, #cs1, __FILE__, __LINE__, false, LOCK_SITE(cs1)), criticalblock2(cs2, #cs2, __FILE__, __LINE__, false, LOCK_SITE(cs2))
+#define TRY_LOCK(cs, name) CCriticalBlock name(cs, #cs, __FILE__, __LINE__, true, LOCK_SITE(cs))
 
 #define ENTER_CRITICAL_SECTION(cs)                            \
     {                                                         \
@@ -185,6 +185,19 @@ BOOST_AUTO_TEST_CASE(addrman_select)
         ports.insert(addrman.Select().GetPort());
     }
     BOOST_CHECK_EQUAL(ports.size(), 3);
+
+    // Test 12b: Select always finds an entry in the sparse tables, from new
+    // and tried alike.
+    std::set<CService> tried = {addr1, addr5, addr6, addr7};
+    std::set<bool> tables;
+    for (int i = 0; i < 50; ++i) {
+        CAddrInfo addr_ret = addrman.Select();
+        BOOST_CHECK(addr_ret.IsValid());
+        tables.insert(tried.count(addr_ret) > 0);
+        CAddrInfo addr_new = addrman.Select(newOnly);
+        BOOST_CHECK(addr_new.IsValid() && !tried.count(addr_new));
+    }
+    BOOST_CHECK_EQUAL(tables.size(), 2);
 }
 
 BOOST_AUTO_TEST_CASE(addrman_new_collisions)
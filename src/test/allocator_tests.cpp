@@ -4,10 +4,14 @@
 
 #include "util.h"
 
+#include "memusage.h"
+#include "support/allocators/pool.h"
 #include "support/allocators/secure.h"
+#include "support/largepages.h"
 #include "test/test_bitcoin.h"
 
 #include <boost/test/unit_test.hpp>
+#include <boost/unordered_map.hpp>
 
 BOOST_FIXTURE_TEST_SUITE(allocator_tests, BasicTestingSetup)
 
@@ -176,27 +180,25 @@ BOOST_AUTO_TEST_CASE(lockedpool_tests_mock)
     void *a0 = pool.alloc(LockedPool::ARENA_SIZE / 2);
     BOOST_CHECK(a0);
     BOOST_CHECK(pool.stats().locked == LockedPool::ARENA_SIZE);
-    void *a1 = pool.alloc(LockedPool::ARENA_SIZE / 2);
-    BOOST_CHECK(a1);
-    void *a2 = pool.alloc(LockedPool::ARENA_SIZE / 2);
-    BOOST_CHECK(a2);
-    void *a3 = pool.alloc(LockedPool::ARENA_SIZE / 2);
-    BOOST_CHECK(a3);
-    void *a4 = pool.alloc(LockedPool::ARENA_SIZE / 2);
-    BOOST_CHECK(a4);
-    void *a5 = pool.alloc(LockedPool::ARENA_SIZE / 2);
-    BOOST_CHECK(a5);
+    // Each new arena is twice the size of the previous one, so the three
+    // arenas hold 1 + 2 + 4 times ARENA_SIZE
+    std::vector<void*> addr{a0};
+    for (int x = 1; x < 14; ++x) {
+        void *a = pool.alloc(LockedPool::ARENA_SIZE / 2);
+        BOOST_CHECK(a);
+        addr.push_back(a);
+    }
+    BOOST_CHECK(pool.stats().total == 7*LockedPool::ARENA_SIZE);
     // We've passed a count of three arenas, so this allocation should fail
-    void *a6 = pool.alloc(16);
-    BOOST_CHECK(!a6);
+    void *a14 = pool.alloc(16);
+    BOOST_CHECK(!a14);
 
-    pool.free(a0);
-    pool.free(a2);
-    pool.free(a4);
-    pool.free(a1);
-    pool.free(a3);
-    pool.free(a5);
-    BOOST_CHECK(pool.stats().total == 3*LockedPool::ARENA_SIZE);
+    // Free in an order that visits every arena
+    for (int x = 0; x < 14; x += 2)
+        pool.free(addr[x]);
+    for (int x = 1; x < 14; x += 2)
+        pool.free(addr[x]);
+    BOOST_CHECK(pool.stats().total == 7*LockedPool::ARENA_SIZE);
     BOOST_CHECK(pool.stats().locked == LockedPool::ARENA_SIZE);
     BOOST_CHECK(pool.stats().used == 0);
 }
@@ -223,6 +225,105 @@ BOOST_AUTO_TEST_CASE(lockedpool_tests_live)
 
     // Check that LockedPool::free may be called on nullptr.
     pool.free(nullptr);
+
+    // A small chunk freed with its size is kept in this thread's cache,
+    // and handed out again for the next allocation of that size.
+    void *a1 = pool.alloc(32);
+    BOOST_CHECK(a1);
+    pool.free(a1, 32);
+    void *a2 = pool.alloc(30);
+    BOOST_CHECK(a2 == a1);
+    pool.free(a2, 32);
+}
+
+BOOST_AUTO_TEST_CASE(pool_resource_tests)
+{
+    PoolResource<64, 8> resource(1024);
+    BOOST_CHECK_EQUAL(resource.ChunkSizeBytes(), 1024);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 1);
+
+    // Blocks are carved out of the chunk, rounded up to the alignment.
+    void* a = resource.Allocate(8, 8);
+    void* b = resource.Allocate(12, 8);
+    BOOST_CHECK_EQUAL(static_cast<char*>(b) - static_cast<char*>(a), 8);
+
+    // A freed block is handed out again for the same rounded size.
+    resource.Deallocate(b, 12, 8);
+    BOOST_CHECK(resource.Allocate(16, 8) == b);
+
+    // Blocks that are too large or too aligned for the pool are not taken
+    // from the chunks.
+    void* big = resource.Allocate(128, 8);
+    void* aligned = resource.Allocate(8, 64);
+    BOOST_CHECK(reinterpret_cast<uintptr_t>(aligned) % 64 == 0);
+    resource.Deallocate(big, 128, 8);
+    resource.Deallocate(aligned, 8, 64);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 1);
+
+    // Exhausting the chunk allocates another one.
+    for (int i = 0; i < 64; i++) {
+        resource.Allocate(64, 8);
+    }
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 5);
+}
+
+BOOST_AUTO_TEST_CASE(pool_allocator_map_tests)
+{
+    typedef PoolAllocator<std::pair<const uint64_t, uint64_t>, 64, alignof(void*)> Allocator;
+    typedef boost::unordered_map<uint64_t, uint64_t, boost::hash<uint64_t>, std::equal_to<uint64_t>, Allocator> Map;
+
+    Allocator::ResourceType resource(4096);
+    Map map(0, boost::hash<uint64_t>(), std::equal_to<uint64_t>(), &resource);
+    for (uint64_t i = 0; i < 10000; i++) {
+        map[i] = i;
+    }
+    size_t chunks = resource.NumAllocatedChunks();
+    BOOST_CHECK(chunks > 1);
+
+    // Erased nodes go to the freelist and are reused for new ones.
+    for (uint64_t i = 0; i < 10000; i++) {
+        map.erase(i);
+    }
+    for (uint64_t i = 10000; i < 20000; i++) {
+        map[i] = i;
+    }
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), chunks);
+    BOOST_CHECK_EQUAL(map.size(), 10000);
+
+    // The nodes are accounted for by the resource, the buckets by the map.
+    BOOST_CHECK_EQUAL(memusage::DynamicUsage(map), memusage::MallocUsage(sizeof(void*) * map.bucket_count()));
+    BOOST_CHECK(memusage::DynamicUsage(resource) >= chunks * resource.ChunkSizeBytes());
+}
+
+BOOST_AUTO_TEST_CASE(large_page_tests)
+{
+    LargePageMode mode;
+    BOOST_CHECK(ParseLargePageMode("transparent", mode));
+    BOOST_CHECK(mode == LargePageMode::TRANSPARENT);
+    BOOST_CHECK(!ParseLargePageMode("huge", mode));
+
+    for (LargePageMode m : {LargePageMode::NONE, LargePageMode::TRANSPARENT, LargePageMode::EXPLICIT}) {
+        SetLargePageOptions(m, m == LargePageMode::EXPLICIT);
+
+        // Small allocations come from operator new, large ones are mapped
+        // at a huge page boundary.
+        void* small = LargePageAlloc(100, 64);
+        BOOST_CHECK(reinterpret_cast<uintptr_t>(small) % 64 == 0);
+        LargePageFree(small, 100, 64);
+        void* large = LargePageAlloc(LARGE_PAGE_BYTES + 1, 8);
+        memset(large, 0xaa, LARGE_PAGE_BYTES + 1);
+#ifndef WIN32
+        BOOST_CHECK(reinterpret_cast<uintptr_t>(large) % LARGE_PAGE_BYTES == 0);
+#endif
+        LargePageFree(large, LARGE_PAGE_BYTES + 1, 8);
+
+        PoolResource<64, 8> resource(LARGE_PAGE_BYTES);
+        for (size_t i = 0; i < LARGE_PAGE_BYTES / 64 + 1; i++) {
+            memset(resource.Allocate(64, 8), 0, 64);
+        }
+        BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 2);
+    }
+    SetLargePageOptions(LargePageMode::NONE, false);
 }
 
 BOOST_AUTO_TEST_SUITE_END()
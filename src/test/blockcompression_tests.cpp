@@ -0,0 +1,97 @@
+// Copyright (c) 2021 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "blockcompression.h"
+
+#include "chainparams.h"
+#include "clientversion.h"
+#include "consensus/consensus.h"
+#include "random.h"
+#include "streams.h"
+#include "test/test_bitcoin.h"
+
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockcompression_tests, BasicTestingSetup)
+
+static void CheckRoundTrip(const std::vector<char>& vData)
+{
+    std::vector<char> vCompressed;
+    BOOST_CHECK(CompressBlockRecord(vData.data(), vData.data() + vData.size(), vCompressed));
+    BOOST_CHECK(vCompressed.size() < vData.size());
+
+    std::vector<char> vDecompressed;
+    BOOST_CHECK(DecompressBlockRecord(vCompressed.data(), vCompressed.data() + vCompressed.size(), vDecompressed, vData.size()));
+    BOOST_CHECK(vDecompressed == vData);
+
+    // The decompressed size is limited.
+    BOOST_CHECK(!DecompressBlockRecord(vCompressed.data(), vCompressed.data() + vCompressed.size(), vDecompressed, vData.size() - 1));
+
+    // Truncated records are rejected.
+    for (size_t i = 0; i < vCompressed.size(); i++) {
+        BOOST_CHECK(!DecompressBlockRecord(vCompressed.data(), vCompressed.data() + i, vDecompressed, vData.size()));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(blockcompression_roundtrip)
+{
+    // Repeated data, with matches overlapping their output.
+    CheckRoundTrip(std::vector<char>(100000, 'a'));
+
+    std::vector<char> vData;
+    for (int i = 0; i < 1000; i++) {
+        std::vector<char> vChunk(GetRandInt(300) + 1);
+        GetRandBytes((unsigned char*)vChunk.data(), vChunk.size());
+        vData.insert(vData.end(), vChunk.begin(), vChunk.end());
+        vData.insert(vData.end(), vChunk.begin(), vChunk.end());
+    }
+    CheckRoundTrip(vData);
+
+    // The genesis block, which is mostly its Equihash solution.
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << Params(CBaseChainParams::MAIN).GenesisBlock();
+    std::vector<char> vBlock(ss.begin(), ss.end());
+    std::vector<char> vCompressed;
+    if (CompressBlockRecord(vBlock.data(), vBlock.data() + vBlock.size(), vCompressed)) {
+        std::vector<char> vDecompressed;
+        BOOST_CHECK(DecompressBlockRecord(vCompressed.data(), vCompressed.data() + vCompressed.size(), vDecompressed, MAX_BLOCK_SIZE));
+        BOOST_CHECK(vDecompressed == vBlock);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(blockcompression_incompressible)
+{
+    std::vector<char> vData(10000);
+    GetRandBytes((unsigned char*)vData.data(), vData.size());
+    std::vector<char> vCompressed;
+    BOOST_CHECK(!CompressBlockRecord(vData.data(), vData.data() + vData.size(), vCompressed));
+    BOOST_CHECK(vCompressed.empty());
+
+    BOOST_CHECK(!CompressBlockRecord(vData.data(), vData.data(), vCompressed));
+}
+
+BOOST_AUTO_TEST_CASE(blockcompression_invalid)
+{
+    std::vector<char> vData(1000, 'z');
+    std::vector<char> vCompressed;
+    BOOST_CHECK(CompressBlockRecord(vData.data(), vData.data() + vData.size(), vCompressed));
+
+    std::vector<char> vDecompressed;
+    std::vector<char> vInvalid = vCompressed;
+    vInvalid[0] = BLOCK_RECORD_FORMAT_LZ4 + 1;
+    BOOST_CHECK(!DecompressBlockRecord(vInvalid.data(), vInvalid.data() + vInvalid.size(), vDecompressed, MAX_BLOCK_SIZE));
+
+    // A match may not refer to before the start of the dictionary.
+    const char vOffset[] = {BLOCK_RECORD_FORMAT_LZ4, 8, 0, 0, 0, 0x04, (char)0xff, 0x7f, 0x00};
+    BOOST_CHECK(!DecompressBlockRecord(vOffset, vOffset + sizeof(vOffset), vDecompressed, MAX_BLOCK_SIZE));
+
+    // Trailing data is rejected.
+    vInvalid = vCompressed;
+    vInvalid.push_back(0);
+    BOOST_CHECK(!DecompressBlockRecord(vInvalid.data(), vInvalid.data() + vInvalid.size(), vDecompressed, MAX_BLOCK_SIZE));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
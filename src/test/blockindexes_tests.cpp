@@ -0,0 +1,280 @@
+// Copyright (c) 2021 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "arith_uint256.h"
+#include "index/blockindexes.h"
+#include "main.h"
+#include "script/standard.h"
+#include "txdb.h"
+#include "utilstrencodings.h"
+#include "zcash/IncrementalMerkleTree.hpp"
+
+#include "test/test_bitcoin.h"
+
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockindexes_tests, TestingSetup)
+
+/* A block and the undo data of its second transaction, which spends an
+ * earlier output and pays part of it to a new address.
+ */
+static void BuildBlock(CBlock& block, CBlockUndo& blockundo, CScript& scriptFrom, CScript& scriptTo)
+{
+    scriptFrom = GetScriptForDestination(CKeyID(uint160(ParseHex("0101010101010101010101010101010101010101"))));
+    scriptTo = GetScriptForDestination(CKeyID(uint160(ParseHex("0202020202020202020202020202020202020202"))));
+
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vin[0].prevout.SetNull();
+    coinbase.vout.push_back(CTxOut(1000, scriptTo));
+
+    CMutableTransaction spend;
+    spend.vin.resize(1);
+    spend.vin[0].prevout = COutPoint(uint256S("0a"), 0);
+    spend.vout.push_back(CTxOut(300, scriptTo));
+    spend.vout.push_back(CTxOut(600, scriptFrom));
+
+    block.vtx.push_back(CTransaction(coinbase));
+    block.vtx.push_back(CTransaction(spend));
+
+    CTxUndo txundo;
+    txundo.vprevout.push_back(Coin(CTxOut(1000, scriptFrom), 5, false));
+    blockundo.vtxundo.push_back(txundo);
+}
+
+BOOST_AUTO_TEST_CASE(address_index_entries)
+{
+    CBlock block;
+    CBlockUndo blockundo;
+    CScript scriptFrom, scriptTo;
+    BuildBlock(block, blockundo, scriptFrom, scriptTo);
+    uint160 hashFrom = scriptFrom.AddressHash();
+    uint160 hashTo = scriptTo.AddressHash();
+
+    std::vector<CAddressIndexDbEntry> addressIndex;
+    std::vector<CAddressUnspentDbEntry> addressUnspentIndex;
+    GetAddressIndexEntries(block, blockundo, 10, false, addressIndex, addressUnspentIndex);
+    BOOST_CHECK_EQUAL(addressIndex.size(), 4);
+    BOOST_CHECK_EQUAL(addressUnspentIndex.size(), 4);
+    BOOST_CHECK(pblocktree->WriteAddressIndex(addressIndex, true));
+    BOOST_CHECK(pblocktree->UpdateAddressUnspentIndex(addressUnspentIndex));
+
+    CAddressBalanceValue balance;
+    BOOST_CHECK(pblocktree->ReadAddressBalance(hashFrom, CScript::P2PKH, balance));
+    BOOST_CHECK_EQUAL(balance.balance, -400);
+    BOOST_CHECK_EQUAL(balance.received, 600);
+    BOOST_CHECK(pblocktree->ReadAddressBalance(hashTo, CScript::P2PKH, balance));
+    BOOST_CHECK_EQUAL(balance.balance, 1300);
+
+    // Writing the block again, as a build does after a restart, changes nothing.
+    BOOST_CHECK(pblocktree->WriteAddressIndex(addressIndex, true));
+    BOOST_CHECK(pblocktree->ReadAddressBalance(hashTo, CScript::P2PKH, balance));
+    BOOST_CHECK_EQUAL(balance.balance, 1300);
+
+    std::vector<CAddressUnspentDbEntry> unspent;
+    BOOST_CHECK(pblocktree->ReadAddressUnspentIndex(hashFrom, CScript::P2PKH, unspent));
+    BOOST_CHECK_EQUAL(unspent.size(), 1);
+
+    // Disconnecting the block restores the output that it spent.
+    std::vector<CAddressIndexDbEntry> addressIndexUndo;
+    std::vector<CAddressUnspentDbEntry> addressUnspentIndexUndo;
+    GetAddressIndexEntries(block, blockundo, 10, true, addressIndexUndo, addressUnspentIndexUndo);
+    BOOST_CHECK(pblocktree->EraseAddressIndex(addressIndexUndo, true));
+    BOOST_CHECK(pblocktree->UpdateAddressUnspentIndex(addressUnspentIndexUndo));
+
+    BOOST_CHECK(pblocktree->ReadAddressBalance(hashTo, CScript::P2PKH, balance));
+    BOOST_CHECK(balance.IsNull());
+    std::vector<CAddressIndexDbEntry> history;
+    BOOST_CHECK(pblocktree->ReadAddressIndex(hashFrom, CScript::P2PKH, history));
+    BOOST_CHECK(history.empty());
+    unspent.clear();
+    BOOST_CHECK(pblocktree->ReadAddressUnspentIndex(hashFrom, CScript::P2PKH, unspent));
+    BOOST_REQUIRE_EQUAL(unspent.size(), 1);
+    BOOST_CHECK(unspent[0].first.txhash == uint256S("0a"));
+    BOOST_CHECK_EQUAL(unspent[0].second.blockHeight, 5);
+}
+
+BOOST_AUTO_TEST_CASE(spent_index_entries)
+{
+    CBlock block;
+    CBlockUndo blockundo;
+    CScript scriptFrom, scriptTo;
+    BuildBlock(block, blockundo, scriptFrom, scriptTo);
+
+    // The lookup of an unspent output is cached until the output is spent.
+    CSpentIndexKey key(uint256S("0a"), 0);
+    CSpentIndexValue value;
+    BOOST_CHECK(!pblocktree->ReadSpentIndex(key, value));
+
+    std::vector<CSpentIndexDbEntry> spentIndex;
+    GetSpentIndexEntries(block, blockundo, 10, false, spentIndex);
+    BOOST_REQUIRE_EQUAL(spentIndex.size(), 1);
+    BOOST_CHECK(pblocktree->UpdateSpentIndex(spentIndex));
+
+    BOOST_CHECK(pblocktree->ReadSpentIndex(key, value));
+    BOOST_CHECK(value.txid == block.vtx[1].GetHash());
+    BOOST_CHECK_EQUAL(value.satoshis, 1000);
+
+    std::vector<CSpentIndexDbEntry> spentIndexUndo;
+    GetSpentIndexEntries(block, blockundo, 10, true, spentIndexUndo);
+    BOOST_CHECK(pblocktree->UpdateSpentIndex(spentIndexUndo));
+    BOOST_CHECK(!pblocktree->ReadSpentIndex(key, value));
+}
+
+/* A block with a transaction of nSpends Sapling spends and nOutputs Sapling
+ * outputs, whose nullifiers and note commitments start from nFirst.
+ */
+static CBlock BuildShieldedBlock(int nFirst, int nSpends, int nOutputs)
+{
+    CMutableTransaction mtx;
+    mtx.fOverwintered = true;
+    mtx.nVersion = SAPLING_TX_VERSION;
+    mtx.nVersionGroupId = SAPLING_VERSION_GROUP_ID;
+    for (int i = 0; i < nSpends; i++) {
+        mtx.vShieldedSpend.emplace_back();
+        mtx.vShieldedSpend.back().nullifier = ArithToUint256(arith_uint256(nFirst + i));
+    }
+    for (int i = 0; i < nOutputs; i++) {
+        mtx.vShieldedOutput.emplace_back();
+        mtx.vShieldedOutput.back().cmu = ArithToUint256(arith_uint256(nFirst + i));
+    }
+    CBlock block;
+    block.vtx.push_back(CTransaction(mtx));
+    return block;
+}
+
+BOOST_AUTO_TEST_CASE(shielded_index_entries)
+{
+    uint256 hashGenesis = uint256S("01"), hash1 = uint256S("02"), hash2 = uint256S("03");
+    CBlockIndex genesis, index1, index2;
+    genesis.phashBlock = &hashGenesis;
+    index1.phashBlock = &hash1;
+    index1.pprev = &genesis;
+    index1.nHeight = 1;
+    index2.phashBlock = &hash2;
+    index2.pprev = &index1;
+    index2.nHeight = 2;
+
+    CBlock block1 = BuildShieldedBlock(10, 1, 3);
+    CBlock block2 = BuildShieldedBlock(20, 2, 2);
+    BOOST_CHECK(WriteShieldedIndex(block1, &index1));
+    BOOST_CHECK(WriteShieldedIndex(block2, &index2));
+
+    // The commitments of the second block follow those of the first in the tree.
+    CSaplingOutputIndexValue output;
+    BOOST_CHECK(pblocktree->ReadSaplingOutputIndex(ArithToUint256(arith_uint256(12)), output));
+    BOOST_CHECK(output.txid == block1.vtx[0].GetHash());
+    BOOST_CHECK_EQUAL(output.outputIndex, 2);
+    BOOST_CHECK_EQUAL(output.position, 2);
+    BOOST_CHECK(pblocktree->ReadSaplingOutputIndex(ArithToUint256(arith_uint256(21)), output));
+    BOOST_CHECK_EQUAL(output.blockHeight, 2);
+    BOOST_CHECK_EQUAL(output.position, 4);
+
+    CSaplingSpendIndexValue spend;
+    BOOST_CHECK(pblocktree->ReadSaplingSpendIndex(ArithToUint256(arith_uint256(21)), spend));
+    BOOST_CHECK(spend.txid == block2.vtx[0].GetHash());
+    BOOST_CHECK_EQUAL(spend.spendIndex, 1);
+    BOOST_CHECK_EQUAL(spend.blockHeight, 2);
+
+    // Rewinding the second block leaves the entries of the first.
+    BOOST_CHECK(EraseShieldedIndex(block2, &index2));
+    BOOST_CHECK(!pblocktree->ReadSaplingSpendIndex(ArithToUint256(arith_uint256(21)), spend));
+    BOOST_CHECK(!pblocktree->ReadSaplingOutputIndex(ArithToUint256(arith_uint256(20)), output));
+    BOOST_CHECK(pblocktree->ReadSaplingSpendIndex(ArithToUint256(arith_uint256(10)), spend));
+
+    BOOST_CHECK(pblocktree->DropShieldedIndex());
+    BOOST_CHECK(!pblocktree->ReadSaplingOutputIndex(ArithToUint256(arith_uint256(10)), output));
+    uint64_t nTreeSize;
+    BOOST_CHECK(!pblocktree->ReadSaplingTreeSize(hash1, nTreeSize));
+}
+
+BOOST_AUTO_TEST_CASE(sapling_auth_path)
+{
+    uint256 hashGenesis = uint256S("01"), hash1 = uint256S("02"), hash2 = uint256S("03");
+    CBlockIndex genesis, index1, index2;
+    genesis.phashBlock = &hashGenesis;
+    index1.phashBlock = &hash1;
+    index1.pprev = &genesis;
+    index1.nHeight = 1;
+    index2.phashBlock = &hash2;
+    index2.pprev = &index1;
+    index2.nHeight = 2;
+
+    // The second block completes the first two subtrees of 16 commitments,
+    // which are kept in the index.
+    CBlock block1 = BuildShieldedBlock(100, 0, 3);
+    CBlock block2 = BuildShieldedBlock(103, 0, 37);
+    BOOST_CHECK(WriteShieldedIndex(block1, &index1));
+    BOOST_CHECK(WriteShieldedIndex(block2, &index2));
+    uint256 node;
+    BOOST_CHECK(pblocktree->ReadSaplingTreeNode(CSaplingTreeNodeKey(SAPLING_TREE_INDEX_STRIDE, 1), node));
+    BOOST_CHECK(!pblocktree->ReadSaplingTreeNode(CSaplingTreeNodeKey(SAPLING_TREE_INDEX_STRIDE, 2), node));
+
+    SaplingMerkleTree tree;
+    std::vector<SaplingMerkleTree> trees;
+    for (int i = 0; i < 40; i++) {
+        tree.append(ArithToUint256(arith_uint256(100 + i)));
+        trees.push_back(tree);
+    }
+
+    // Each path leads from its commitment to the root of the tree as of
+    // the anchor, be it the first block or the second.
+    for (uint64_t nTreeSize : {3, 40}) {
+        for (uint64_t nPosition : {0, 1, 2, 17, 32, 39}) {
+            std::vector<libzcash::PedersenHash> path;
+            libzcash::PedersenHash root;
+            if (nPosition >= nTreeSize) {
+                BOOST_CHECK(!GetSaplingAuthPath(nTreeSize, nPosition, path, root));
+                continue;
+            }
+            BOOST_REQUIRE(GetSaplingAuthPath(nTreeSize, nPosition, path, root));
+            BOOST_REQUIRE_EQUAL(path.size(), SAPLING_INCREMENTAL_MERKLE_TREE_DEPTH);
+            BOOST_CHECK(root == trees[nTreeSize - 1].root());
+
+            libzcash::PedersenHash hash = ArithToUint256(arith_uint256(100 + nPosition));
+            for (size_t d = 0; d < path.size(); d++) {
+                hash = (nPosition >> d) & 1 ? libzcash::PedersenHash::combine(path[d], hash, d)
+                                            : libzcash::PedersenHash::combine(hash, path[d], d);
+            }
+            BOOST_CHECK(hash == root);
+        }
+    }
+
+    BOOST_CHECK(pblocktree->DropShieldedIndex());
+}
+
+BOOST_AUTO_TEST_CASE(drop_index)
+{
+    CBlock block;
+    CBlockUndo blockundo;
+    CScript scriptFrom, scriptTo;
+    BuildBlock(block, blockundo, scriptFrom, scriptTo);
+
+    std::vector<CAddressIndexDbEntry> addressIndex;
+    std::vector<CAddressUnspentDbEntry> addressUnspentIndex;
+    GetAddressIndexEntries(block, blockundo, 10, false, addressIndex, addressUnspentIndex);
+    BOOST_CHECK(pblocktree->WriteAddressIndex(addressIndex, true));
+    BOOST_CHECK(pblocktree->UpdateAddressUnspentIndex(addressUnspentIndex));
+    BOOST_CHECK(pblocktree->WriteIndexBest("addressindex", uint256S("0b")));
+
+    BOOST_CHECK(pblocktree->DropAddressIndex());
+    BOOST_CHECK(pblocktree->EraseIndexBest("addressindex"));
+
+    uint160 hashTo = scriptTo.AddressHash();
+    std::vector<CAddressIndexDbEntry> history;
+    BOOST_CHECK(pblocktree->ReadAddressIndex(hashTo, CScript::P2PKH, history));
+    BOOST_CHECK(history.empty());
+    std::vector<CAddressUnspentDbEntry> unspent;
+    BOOST_CHECK(pblocktree->ReadAddressUnspentIndex(hashTo, CScript::P2PKH, unspent));
+    BOOST_CHECK(unspent.empty());
+    CAddressBalanceValue balance;
+    BOOST_CHECK(pblocktree->ReadAddressBalance(hashTo, CScript::P2PKH, balance));
+    BOOST_CHECK(balance.IsNull());
+    uint256 hashBest;
+    BOOST_CHECK(!pblocktree->ReadIndexBest("addressindex", hashBest));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
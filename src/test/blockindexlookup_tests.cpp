@@ -0,0 +1,100 @@
+// Copyright (c) 2021 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "blockindexlookup.h"
+
+#include "arith_uint256.h"
+#include "chain.h"
+#include "test/test_bitcoin.h"
+
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockindexlookup_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(blockindexlookup_insert_lookup)
+{
+    // Enough entries that every shard grows its table a few times.
+    std::vector<uint256> vHash(5000);
+    std::vector<CBlockIndex> vBlocks(vHash.size());
+    for (unsigned int i=0; i<vBlocks.size(); i++) {
+        vHash[i] = ArithToUint256(arith_uint256(i) * 2654435761U + 1);
+        vBlocks[i].nHeight = i;
+        vBlocks[i].phashBlock = &vHash[i];
+    }
+
+    CBlockIndexLookup lookup;
+    BOOST_CHECK(lookup.Lookup(vHash[0]) == NULL);
+
+    for (unsigned int i=0; i<vBlocks.size(); i++) {
+        lookup.Insert(&vBlocks[i]);
+        BOOST_CHECK(lookup.Lookup(vHash[i]) == &vBlocks[i]);
+    }
+    BOOST_CHECK_EQUAL(lookup.Size(), vBlocks.size());
+
+    // Every entry is still found once the tables have been replaced.
+    for (unsigned int i=0; i<vBlocks.size(); i++) {
+        BOOST_CHECK(lookup.Lookup(vHash[i]) == &vBlocks[i]);
+    }
+    BOOST_CHECK(lookup.Lookup(uint256()) == NULL);
+    BOOST_CHECK(lookup.Lookup(uint256S("ff")) == NULL);
+
+    // Adding a hash again does not add another entry.
+    lookup.Insert(&vBlocks[7]);
+    BOOST_CHECK_EQUAL(lookup.Size(), vBlocks.size());
+
+    lookup.Clear();
+    BOOST_CHECK_EQUAL(lookup.Size(), 0);
+    BOOST_CHECK(lookup.Lookup(vHash[7]) == NULL);
+}
+
+BOOST_AUTO_TEST_CASE(blockindexlookup_remove)
+{
+    std::vector<uint256> vHash(5000);
+    std::vector<CBlockIndex> vBlocks(vHash.size());
+    for (unsigned int i=0; i<vBlocks.size(); i++) {
+        vHash[i] = ArithToUint256(arith_uint256(i) * 2654435761U + 1);
+        vBlocks[i].nHeight = i;
+        vBlocks[i].phashBlock = &vHash[i];
+    }
+
+    CBlockIndexLookup lookup;
+    for (unsigned int i=0; i<vBlocks.size(); i++) {
+        lookup.Insert(&vBlocks[i]);
+    }
+
+    // Removing every other entry leaves the rest reachable past the tombstones.
+    for (unsigned int i=0; i<vBlocks.size(); i+=2) {
+        lookup.Remove(&vBlocks[i]);
+    }
+    BOOST_CHECK_EQUAL(lookup.Size(), vBlocks.size() / 2);
+    for (unsigned int i=0; i<vBlocks.size(); i++) {
+        BOOST_CHECK(lookup.Lookup(vHash[i]) == (i % 2 ? &vBlocks[i] : NULL));
+    }
+
+    // Removing an entry twice, or one that was never added, has no effect.
+    lookup.Remove(&vBlocks[0]);
+    BOOST_CHECK_EQUAL(lookup.Size(), vBlocks.size() / 2);
+
+    // Removed entries can be added again, reusing or clearing out the
+    // tombstones.
+    for (int nRound = 0; nRound < 10; nRound++) {
+        for (unsigned int i=0; i<vBlocks.size(); i+=2) {
+            lookup.Insert(&vBlocks[i]);
+        }
+        for (unsigned int i=0; i<vBlocks.size(); i+=2) {
+            lookup.Remove(&vBlocks[i]);
+        }
+    }
+    for (unsigned int i=0; i<vBlocks.size(); i+=2) {
+        lookup.Insert(&vBlocks[i]);
+    }
+    BOOST_CHECK_EQUAL(lookup.Size(), vBlocks.size());
+    for (unsigned int i=0; i<vBlocks.size(); i++) {
+        BOOST_CHECK(lookup.Lookup(vHash[i]) == &vBlocks[i]);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
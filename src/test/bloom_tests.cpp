@@ -537,4 +537,70 @@ BOOST_AUTO_TEST_CASE(rolling_bloom)
     }
 }
 
+BOOST_AUTO_TEST_CASE(growing_rolling_bloom)
+{
+    // Starts out sized for 10 entries, grows up to 160.
+    CGrowingRollingBloomFilter grb(160, 0.001, 10);
+    BOOST_CHECK_EQUAL(grb.GetElements(), 10);
+    size_t nInitialUsage = grb.DynamicMemoryUsage();
+
+    // The last 160 entries are remembered while the filter grows, and after.
+    static const int DATASIZE=1000;
+    std::vector<unsigned char> data[DATASIZE];
+    for (int i = 0; i < DATASIZE; i++) {
+        data[i] = RandomData();
+        grb.insert(data[i]);
+        for (int j = std::max(0, i - 159); j <= i; j++) {
+            BOOST_CHECK(grb.contains(data[j]));
+        }
+    }
+    BOOST_CHECK_EQUAL(grb.GetElements(), 160);
+    BOOST_CHECK(grb.DynamicMemoryUsage() > nInitialUsage);
+
+    // A reset forgets everything and shrinks it back.
+    grb.reset();
+    BOOST_CHECK_EQUAL(grb.GetElements(), 10);
+    BOOST_CHECK_EQUAL(grb.DynamicMemoryUsage(), nInitialUsage);
+    BOOST_CHECK(!grb.contains(data[DATASIZE-1]));
+
+    // A filter that few entries are inserted into stays small.
+    for (int i = 0; i < 10; i++) {
+        grb.insert(data[i]);
+    }
+    BOOST_CHECK_EQUAL(grb.GetElements(), 10);
+}
+
+BOOST_AUTO_TEST_CASE(blocked_bloom)
+{
+    CBlockedBloomFilter filter(10000);
+    BOOST_CHECK_EQUAL(filter.GetCapacity(), 10000);
+
+    std::vector<uint256> keys;
+    for (int i = 0; i < 10000; i++) {
+        keys.push_back(GetRandHash());
+        filter.insert(keys.back());
+    }
+    // No false negatives:
+    for (const uint256& key : keys) {
+        BOOST_CHECK(filter.contains(key));
+    }
+
+    // At capacity the false positive rate is about 1%, so we should get
+    // about 100 hits when testing 10,000 random keys.
+    unsigned int nHits = 0;
+    for (int i = 0; i < 10000; i++) {
+        if (filter.contains(GetRandHash()))
+            ++nHits;
+    }
+    BOOST_TEST_MESSAGE("BlockedBloomFilter got " << nHits << " false positives (~120 expected)");
+    BOOST_CHECK(nHits > 25);
+    BOOST_CHECK(nHits < 300);
+
+    // An empty filter contains nothing.
+    CBlockedBloomFilter empty(0);
+    BOOST_CHECK(!empty.contains(keys[0]));
+    empty.insert(keys[0]);
+    BOOST_CHECK(empty.contains(keys[0]));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
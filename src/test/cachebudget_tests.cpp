@@ -0,0 +1,79 @@
+// Copyright (c) 2021 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "cachebudget.h"
+
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(cachebudget_tests, BasicTestingSetup)
+
+static const size_t MiB = 1 << 20;
+
+BOOST_AUTO_TEST_CASE(cachebudget_initial_block_download)
+{
+    const CCacheBudgets configured(64 * MiB, 32 * MiB, 96 * MiB);
+    CCacheObservations observations;
+    observations.fInitialBlockDownload = true;
+    observations.nMempoolCost = 4 * MiB;
+
+    // The UTXO set cache grows a sixteenth of the total at a time, taking
+    // from the mempool first, until the others are at their minimums.
+    CCacheBudgets budgets = RebalanceCacheBudgets(configured, configured, observations);
+    BOOST_CHECK(budgets == CCacheBudgets(76 * MiB, 32 * MiB, 84 * MiB));
+    for (int i = 0; i < 20; i++) {
+        budgets = RebalanceCacheBudgets(budgets, configured, observations);
+        BOOST_CHECK_EQUAL(budgets.Total(), configured.Total());
+    }
+    BOOST_CHECK(budgets == CCacheBudgets(160 * MiB, 8 * MiB, 24 * MiB));
+
+    // The mempool keeps what it holds.
+    observations.nMempoolCost = 40 * MiB;
+    budgets = RebalanceCacheBudgets(configured, configured, observations);
+    for (int i = 0; i < 20; i++) {
+        budgets = RebalanceCacheBudgets(budgets, configured, observations);
+    }
+    BOOST_CHECK(budgets == CCacheBudgets(144 * MiB, 8 * MiB, 40 * MiB));
+}
+
+BOOST_AUTO_TEST_CASE(cachebudget_tip)
+{
+    const CCacheBudgets configured(64 * MiB, 32 * MiB, 96 * MiB);
+    CCacheObservations observations;
+
+    // Leaving initial block download restores the mempool limit at once.
+    CCacheBudgets budgets = RebalanceCacheBudgets(CCacheBudgets(160 * MiB, 8 * MiB, 24 * MiB), configured, observations);
+    BOOST_CHECK(budgets == CCacheBudgets(88 * MiB, 8 * MiB, 96 * MiB));
+
+    // Nothing moves while both caches miss as often.
+    observations.nCoinsHits = 900;
+    observations.nCoinsMisses = 100;
+    observations.nChainstateReads = 100;
+    observations.nChainstateFileReads = 10;
+    BOOST_CHECK(RebalanceCacheBudgets(budgets, configured, observations) == budgets);
+
+    // The LevelDB block cache gets memory when it misses more often.
+    observations.nChainstateFileReads = 80;
+    budgets = RebalanceCacheBudgets(budgets, configured, observations);
+    BOOST_CHECK(budgets == CCacheBudgets(76 * MiB, 20 * MiB, 96 * MiB));
+
+    // And gives it back when the UTXO set cache does.
+    observations.nCoinsHits = 50;
+    observations.nCoinsMisses = 950;
+    budgets = RebalanceCacheBudgets(budgets, configured, observations);
+    BOOST_CHECK(budgets == CCacheBudgets(88 * MiB, 8 * MiB, 96 * MiB));
+    BOOST_CHECK(RebalanceCacheBudgets(budgets, configured, observations) == budgets);
+
+    // A nearly full mempool grows, and shrinks back to its limit once it empties.
+    observations = CCacheObservations();
+    observations.nMempoolCost = 90 * MiB;
+    budgets = RebalanceCacheBudgets(budgets, configured, observations);
+    BOOST_CHECK(budgets == CCacheBudgets(76 * MiB, 8 * MiB, 108 * MiB));
+    observations.nMempoolCost = 10 * MiB;
+    budgets = RebalanceCacheBudgets(budgets, configured, observations);
+    BOOST_CHECK(budgets == CCacheBudgets(88 * MiB, 8 * MiB, 96 * MiB));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -124,6 +124,18 @@ struct FrozenCleanupCheck {
     void swap(FrozenCleanupCheck& x){std::swap(should_freeze, x.should_freeze);};
 };
 
+struct ThreadRecordingCheck {
+    static std::mutex m;
+    static std::unordered_set<std::thread::id> threads;
+    bool operator()()
+    {
+        std::lock_guard<std::mutex> l(m);
+        threads.insert(std::this_thread::get_id());
+        return true;
+    }
+    void swap(ThreadRecordingCheck& x){};
+};
+
 // Static Allocations
 std::mutex FrozenCleanupCheck::m{};
 std::atomic<uint64_t> FrozenCleanupCheck::nFrozen{0};
@@ -132,12 +144,15 @@ std::mutex UniqueCheck::m;
 std::unordered_multiset<size_t> UniqueCheck::results;
 std::atomic<size_t> FakeCheckCheckCompletion::n_calls{0};
 std::atomic<size_t> MemoryCheck::fake_allocated_memory{0};
+std::mutex ThreadRecordingCheck::m;
+std::unordered_set<std::thread::id> ThreadRecordingCheck::threads;
 
 // Queue Typedefs
 typedef CCheckQueue<FakeCheckCheckCompletion> Correct_Queue;
 typedef CCheckQueue<FakeCheck> Standard_Queue;
 typedef CCheckQueue<FailingCheck> Failing_Queue;
 typedef CCheckQueue<UniqueCheck> Unique_Queue;
+typedef CCheckQueue<ThreadRecordingCheck> ThreadRecording_Queue;
 typedef CCheckQueue<MemoryCheck> Memory_Queue;
 typedef CCheckQueue<FrozenCleanupCheck> FrozenCleanup_Queue;
 
@@ -376,6 +391,81 @@ BOOST_AUTO_TEST_CASE(test_CheckQueue_FrozenCleanup)
     BOOST_REQUIRE(!fails);
 }
 
+// Test that queues of different types of checks can share the workers of a
+// pool, with both in use at once, and that a failure in one of them doesn't
+// affect the other.
+BOOST_AUTO_TEST_CASE(test_CheckQueue_SharedPool)
+{
+    CCheckPool pool;
+    auto correct_queue = std::unique_ptr<Correct_Queue>(new Correct_Queue {QUEUE_BATCH_SIZE, &pool});
+    auto fail_queue = std::unique_ptr<Failing_Queue>(new Failing_Queue {1, &pool});
+    boost::thread_group tg;
+    for (auto x = 0; x < nScriptCheckThreads; ++x) {
+       tg.create_thread([&]{pool.Thread();});
+    }
+    for (size_t i = 0; i < 101; ++i) {
+        size_t total = i * 10;
+        FakeCheckCheckCompletion::n_calls = 0;
+        CCheckQueueControl<FakeCheckCheckCompletion> control(correct_queue.get());
+        CCheckQueueControl<FailingCheck> fail_control(fail_queue.get());
+        while (total) {
+            std::vector<FakeCheckCheckCompletion> vChecks(std::min(total, (size_t) GetRand(10)));
+            total -= vChecks.size();
+            control.Add(vChecks);
+            std::vector<FailingCheck> vFailing;
+            vFailing.emplace_back(total == 0 && i % 2 == 0);
+            fail_control.Add(vFailing);
+        }
+        BOOST_REQUIRE_EQUAL(fail_control.Wait(), i == 0 || i % 2 == 1);
+        BOOST_REQUIRE(control.Wait());
+        BOOST_REQUIRE_EQUAL(FakeCheckCheckCompletion::n_calls, i * 10);
+    }
+    tg.interrupt_all();
+    tg.join_all();
+}
+
+// Test that parked workers run no checks, that the master then runs them all,
+// and that the workers take checks again once they are let back in.
+BOOST_AUTO_TEST_CASE(test_CheckQueue_ActiveWorkers)
+{
+    CCheckPool pool;
+    auto queue = std::unique_ptr<ThreadRecording_Queue>(new ThreadRecording_Queue {QUEUE_BATCH_SIZE, &pool});
+    // Park the workers before they start, so that none of them can be
+    // running a batch already.
+    pool.SetActiveWorkers(0);
+    boost::thread_group tg;
+    for (auto x = 0; x < nScriptCheckThreads; ++x) {
+       tg.create_thread([&]{pool.Thread();});
+    }
+    while (pool.NumWorkers() < nScriptCheckThreads) {
+        MilliSleep(1);
+    }
+    BOOST_CHECK_EQUAL(pool.NumActiveWorkers(), 0);
+
+    {
+        CCheckQueueControl<ThreadRecordingCheck> control(queue.get());
+        std::vector<ThreadRecordingCheck> vChecks(QUEUE_BATCH_SIZE * 10);
+        control.Add(vChecks);
+        BOOST_REQUIRE(control.Wait());
+    }
+    BOOST_CHECK_EQUAL(ThreadRecordingCheck::threads.size(), 1);
+    BOOST_CHECK(ThreadRecordingCheck::threads.count(std::this_thread::get_id()));
+    BOOST_CHECK_EQUAL(pool.TakePeakBacklog(), 10);
+    BOOST_CHECK_EQUAL(pool.TakePeakBacklog(), 0);
+
+    pool.SetActiveWorkers(2);
+    BOOST_CHECK_EQUAL(pool.NumActiveWorkers(), 2);
+    ThreadRecordingCheck::threads.clear();
+    for (size_t i = 0; i < 100; ++i) {
+        CCheckQueueControl<ThreadRecordingCheck> control(queue.get());
+        std::vector<ThreadRecordingCheck> vChecks(QUEUE_BATCH_SIZE * 10);
+        control.Add(vChecks);
+        BOOST_REQUIRE(control.Wait());
+    }
+    BOOST_CHECK(ThreadRecordingCheck::threads.size() <= 3);
+    tg.interrupt_all();
+    tg.join_all();
+}
 
 /** Test that CCheckQueueControl is threadsafe */
 BOOST_AUTO_TEST_CASE(test_CheckQueueControl_Locks)
@@ -3,6 +3,7 @@
 // file COPYING or https://www.opensource.org/licenses/mit-license.php .
 
 #include "coins.h"
+#include "coinssnapshot.h"
 #include "test_random.h"
 #include "script/standard.h"
 #include "uint256.h"
@@ -10,6 +11,7 @@
 #include "test/test_bitcoin.h"
 #include "consensus/validation.h"
 #include "main.h"
+#include "txdb.h"
 #include "undo.h"
 #include "primitives/transaction.h"
 #include "pubkey.h"
@@ -21,14 +23,25 @@
 #include <boost/test/unit_test.hpp>
 #include "zcash/IncrementalMerkleTree.hpp"
 
+void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, CTxUndo &txundo, int nHeight);
+
 namespace
 {
+//! equality test
+bool operator==(const Coin &a, const Coin &b) {
+    // Empty Coin objects are always equal.
+    if (a.IsSpent() && b.IsSpent()) return true;
+    return a.fCoinBase == b.fCoinBase &&
+           a.nHeight == b.nHeight &&
+           a.out == b.out;
+}
+
 class CCoinsViewTest : public CCoinsView
 {
     uint256 hashBestBlock_;
     uint256 hashBestSproutAnchor_;
     uint256 hashBestSaplingAnchor_;
-    std::map<uint256, CCoins> map_;
+    std::map<COutPoint, Coin> map_;
     std::map<uint256, SproutMerkleTree> mapSproutAnchors_;
     std::map<uint256, SaplingMerkleTree> mapSaplingAnchors_;
     std::map<uint256, bool> mapSproutNullifiers_;
@@ -108,29 +121,23 @@ public:
         }
     }
 
-    bool GetCoins(const uint256& txid, CCoins& coins) const
+    bool GetCoin(const COutPoint& outpoint, Coin& coin) const
     {
-        std::map<uint256, CCoins>::const_iterator it = map_.find(txid);
+        std::map<COutPoint, Coin>::const_iterator it = map_.find(outpoint);
         if (it == map_.end()) {
             return false;
         }
-        coins = it->second;
-        if (coins.IsPruned() && insecure_rand() % 2 == 0) {
+        coin = it->second;
+        if (coin.IsSpent() && insecure_rand() % 2 == 0) {
             // Randomly return false in case of an empty entry.
             return false;
         }
         return true;
     }
 
-    bool HaveCoins(const uint256& txid) const
-    {
-        CCoins coins;
-        return GetCoins(txid, coins);
-    }
-
     uint256 GetBestBlock() const { return hashBestBlock_; }
 
-    void BatchWriteNullifiers(CNullifiersMap& mapNullifiers, std::map<uint256, bool>& cacheNullifiers)
+    void BatchWriteNullifiers(CNullifiersMap& mapNullifiers, std::map<uint256, bool>& cacheNullifiers, bool fErase)
     {
         for (CNullifiersMap::iterator it = mapNullifiers.begin(); it != mapNullifiers.end(); ) {
             if (it->second.flags & CNullifiersCacheEntry::DIRTY) {
@@ -141,12 +148,12 @@ public:
                     cacheNullifiers.erase(it->first);
                 }
             }
-            it = mapNullifiers.erase(it);
+            it = fErase ? mapNullifiers.erase(it) : std::next(it);
         }
     }
 
     template<typename Tree, typename Map, typename MapEntry>
-    void BatchWriteAnchors(Map& mapAnchors, std::map<uint256, Tree>& cacheAnchors)
+    void BatchWriteAnchors(Map& mapAnchors, std::map<uint256, Tree>& cacheAnchors, bool fErase)
     {
         for (auto it = mapAnchors.begin(); it != mapAnchors.end(); ) {
             if (it->second.flags & MapEntry::DIRTY) {
@@ -160,7 +167,7 @@ public:
                     cacheAnchors.erase(it->first);
                 }
             }
-            it = mapAnchors.erase(it);
+            it = fErase ? mapAnchors.erase(it) : std::next(it);
         }
     }
 
@@ -172,25 +179,26 @@ public:
                     CAnchorsSaplingMap& mapSaplingAnchors,
                     CNullifiersMap& mapSproutNullifiers,
                     CNullifiersMap& mapSaplingNullifiers,
-                    CHistoryCacheMap &historyCacheMap)
+                    CHistoryCacheMap &historyCacheMap,
+                    bool fErase)
     {
         for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end(); ) {
             if (it->second.flags & CCoinsCacheEntry::DIRTY) {
                 // Same optimization used in CCoinsViewDB is to only write dirty entries.
-                map_[it->first] = it->second.coins;
-                if (it->second.coins.IsPruned() && insecure_rand() % 3 == 0) {
+                map_[it->first] = it->second.coin;
+                if (it->second.coin.IsSpent() && insecure_rand() % 3 == 0) {
                     // Randomly delete empty entries on write.
                     map_.erase(it->first);
                 }
             }
-            it = mapCoins.erase(it);
+            it = fErase ? mapCoins.erase(it) : std::next(it);
         }
 
-        BatchWriteAnchors<SproutMerkleTree, CAnchorsSproutMap, CAnchorsSproutCacheEntry>(mapSproutAnchors, mapSproutAnchors_);
-        BatchWriteAnchors<SaplingMerkleTree, CAnchorsSaplingMap, CAnchorsSaplingCacheEntry>(mapSaplingAnchors, mapSaplingAnchors_);
+        BatchWriteAnchors<SproutMerkleTree, CAnchorsSproutMap, CAnchorsSproutCacheEntry>(mapSproutAnchors, mapSproutAnchors_, fErase);
+        BatchWriteAnchors<SaplingMerkleTree, CAnchorsSaplingMap, CAnchorsSaplingCacheEntry>(mapSaplingAnchors, mapSaplingAnchors_, fErase);
 
-        BatchWriteNullifiers(mapSproutNullifiers, mapSproutNullifiers_);
-        BatchWriteNullifiers(mapSaplingNullifiers, mapSaplingNullifiers_);
+        BatchWriteNullifiers(mapSproutNullifiers, mapSproutNullifiers_, fErase);
+        BatchWriteNullifiers(mapSaplingNullifiers, mapSaplingNullifiers_, fErase);
 
         if (!hashBlock.IsNull())
             hashBestBlock_ = hashBlock;
@@ -212,14 +220,15 @@ public:
     void SelfTest() const
     {
         // Manually recompute the dynamic usage of the whole data, and compare it.
-        size_t ret = memusage::DynamicUsage(cacheCoins) +
+        size_t ret = memusage::DynamicUsage(cacheMemoryResource) +
+                     memusage::DynamicUsage(cacheCoins) +
                      memusage::DynamicUsage(cacheSproutAnchors) +
                      memusage::DynamicUsage(cacheSaplingAnchors) +
                      memusage::DynamicUsage(cacheSproutNullifiers) +
                      memusage::DynamicUsage(cacheSaplingNullifiers) +
                      memusage::DynamicUsage(historyCacheMap);
         for (CCoinsMap::iterator it = cacheCoins.begin(); it != cacheCoins.end(); it++) {
-            ret += it->second.coins.DynamicMemoryUsage();
+            ret += it->second.coin.DynamicMemoryUsage();
         }
         BOOST_CHECK_EQUAL(DynamicMemoryUsage(), ret);
     }
@@ -608,6 +617,63 @@ BOOST_AUTO_TEST_CASE(anchors_flush_test)
     }
 }
 
+BOOST_AUTO_TEST_CASE(sapling_anchor_recent_test)
+{
+    CCoinsViewTest base;
+    CCoinsViewCacheTest tip(&base);
+    uint256 oldrt = tip.GetBestAnchor(SAPLING);
+    uint256 newrt;
+    {
+        CCoinsViewCacheTest cache(&tip);
+        SaplingMerkleTree tree;
+        BOOST_CHECK(cache.GetSaplingAnchorAt(oldrt, tree));
+        tree.append(GetRandHash());
+        newrt = tree.root();
+        cache.PushAnchor(tree);
+        BOOST_CHECK(cache.HaveSaplingAnchor(newrt));
+        BOOST_CHECK(cache.Flush());
+    }
+    BOOST_CHECK(tip.Flush());
+
+    // The flushed root is still known to the tip, and is found through it.
+    BOOST_CHECK(tip.HaveSaplingAnchor(newrt));
+    BOOST_CHECK(CCoinsViewCacheTest(&tip).HaveSaplingAnchor(newrt));
+    BOOST_CHECK(!tip.HaveSaplingAnchor(GetRandHash()));
+
+    // Popping the anchor in a child and flushing forgets it.
+    {
+        CCoinsViewCacheTest cache(&tip);
+        cache.PopAnchor(oldrt, SAPLING);
+        BOOST_CHECK(!cache.HaveSaplingAnchor(newrt));
+        BOOST_CHECK(cache.HaveSaplingAnchor(oldrt));
+        BOOST_CHECK(cache.Flush());
+    }
+    BOOST_CHECK(!tip.HaveSaplingAnchor(newrt));
+    BOOST_CHECK(tip.Flush());
+    BOOST_CHECK(!tip.HaveSaplingAnchor(newrt));
+    BOOST_CHECK(tip.HaveSaplingAnchor(oldrt));
+}
+
+BOOST_AUTO_TEST_CASE(recent_anchors_eviction)
+{
+    CRecentAnchors recent(3);
+    uint256 a = GetRandHash(), b = GetRandHash(), c = GetRandHash(), d = GetRandHash();
+    recent.insert(a);
+    recent.insert(b);
+    recent.insert(c);
+    // Using a makes b the least recently used root.
+    BOOST_CHECK(recent.contains(a));
+    recent.insert(d);
+    BOOST_CHECK_EQUAL(recent.size(), 3);
+    BOOST_CHECK(!recent.contains(b));
+    BOOST_CHECK(recent.contains(a));
+    BOOST_CHECK(recent.contains(c));
+    BOOST_CHECK(recent.contains(d));
+    recent.erase(c);
+    BOOST_CHECK(!recent.contains(c));
+    BOOST_CHECK_EQUAL(recent.size(), 2);
+}
+
 BOOST_AUTO_TEST_CASE(chained_joinsplits)
 {
     // TODO update this or add a similar test when the SaplingNote class exist
@@ -771,7 +837,7 @@ static const unsigned int NUM_SIMULATION_ITERATIONS = 40000;
 // This is a large randomized insert/remove simulation test on a variable-size
 // stack of caches on top of CCoinsViewTest.
 //
-// It will randomly create/update/delete CCoins entries to a tip of caches, with
+// It will randomly create/update/delete Coin entries to a tip of caches, with
 // txids picked from a limited list of random 256-bit hashes. Occasionally, a
 // new tip is added to the stack of caches, or the tip is flushed and removed.
 //
@@ -783,13 +849,14 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
     bool removed_all_caches = false;
     bool reached_4_caches = false;
     bool added_an_entry = false;
+    bool added_an_unspendable_entry = false;
     bool removed_an_entry = false;
     bool updated_an_entry = false;
     bool found_an_entry = false;
     bool missed_an_entry = false;
 
     // A simple map to track what we expect the cache stack to represent.
-    std::map<uint256, CCoins> result;
+    std::map<COutPoint, Coin> result;
 
     // The cache stack.
     CCoinsViewTest base; // A CCoinsViewTest at the bottom.
@@ -807,36 +874,43 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
         // Do a random modification.
         {
             uint256 txid = txids[insecure_rand() % txids.size()]; // txid we're going to modify in this iteration.
-            CCoins& coins = result[txid];
-            CCoinsModifier entry = stack.back()->ModifyCoins(txid);
-            BOOST_CHECK(coins == *entry);
-            if (insecure_rand() % 5 == 0 || coins.IsPruned()) {
-                if (coins.IsPruned()) {
-                    added_an_entry = true;
+            Coin& coin = result[COutPoint(txid, 0)];
+            const Coin& entry = (insecure_rand() % 500 == 0) ? AccessByTxid(*stack.back(), txid) : stack.back()->AccessCoin(COutPoint(txid, 0));
+            BOOST_CHECK(coin == entry);
+
+            if (insecure_rand() % 5 == 0 || coin.IsSpent()) {
+                Coin newcoin;
+                newcoin.out.nValue = insecure_rand();
+                newcoin.nHeight = 1;
+                if (insecure_rand() % 16 == 0 && coin.IsSpent()) {
+                    newcoin.out.scriptPubKey.assign(1 + (insecure_rand() & 0x3F), OP_RETURN);
+                    BOOST_CHECK(newcoin.out.scriptPubKey.IsUnspendable());
+                    added_an_unspendable_entry = true;
                 } else {
-                    updated_an_entry = true;
+                    newcoin.out.scriptPubKey.assign(insecure_rand() & 0x3F, 0); // Random sizes so we can test memory usage accounting
+                    (coin.IsSpent() ? added_an_entry : updated_an_entry) = true;
+                    coin = newcoin;
                 }
-                coins.nVersion = insecure_rand();
-                coins.vout.resize(1);
-                coins.vout[0].nValue = insecure_rand();
-                *entry = coins;
+                stack.back()->AddCoin(COutPoint(txid, 0), std::move(newcoin), !coin.IsSpent() || insecure_rand() & 1);
             } else {
-                coins.Clear();
-                entry->Clear();
                 removed_an_entry = true;
+                coin.Clear();
+                stack.back()->SpendCoin(COutPoint(txid, 0));
             }
         }
 
         // Once every 1000 iterations and at the end, verify the full cache.
         if (insecure_rand() % 1000 == 1 || i == NUM_SIMULATION_ITERATIONS - 1) {
-            for (std::map<uint256, CCoins>::iterator it = result.begin(); it != result.end(); it++) {
-                const CCoins* coins = stack.back()->AccessCoins(it->first);
-                if (coins) {
-                    BOOST_CHECK(*coins == it->second);
-                    found_an_entry = true;
-                } else {
-                    BOOST_CHECK(it->second.IsPruned());
+            for (std::map<COutPoint, Coin>::iterator it = result.begin(); it != result.end(); it++) {
+                bool have = stack.back()->HaveCoin(it->first);
+                const Coin& coin = stack.back()->AccessCoin(it->first);
+                BOOST_CHECK(have == !coin.IsSpent());
+                BOOST_CHECK(coin == it->second);
+                if (coin.IsSpent()) {
                     missed_an_entry = true;
+                } else {
+                    BOOST_CHECK(stack.back()->HaveCoinInCache(it->first));
+                    found_an_entry = true;
                 }
             }
             for (const CCoinsViewCacheTest *test : stack) {
@@ -876,12 +950,289 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
     BOOST_CHECK(removed_all_caches);
     BOOST_CHECK(reached_4_caches);
     BOOST_CHECK(added_an_entry);
+    BOOST_CHECK(added_an_unspendable_entry);
     BOOST_CHECK(removed_an_entry);
     BOOST_CHECK(updated_an_entry);
     BOOST_CHECK(found_an_entry);
     BOOST_CHECK(missed_an_entry);
 }
 
+BOOST_AUTO_TEST_CASE(coins_cache_pool_release)
+{
+    CCoinsViewTest base;
+    CCoinsViewCacheTest cache(&base);
+    const size_t emptyUsage = cache.DynamicMemoryUsage();
+
+    for (uint32_t i = 0; i < 100000; i++) {
+        Coin coin;
+        coin.out.nValue = i;
+        coin.nHeight = 1;
+        cache.AddCoin(COutPoint(uint256(), i), std::move(coin), false);
+    }
+    cache.SelfTest();
+    BOOST_CHECK(cache.DynamicMemoryUsage() > emptyUsage);
+
+    // Flushing writes the coins to the base view and releases the pool
+    // that held them.
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK_EQUAL(cache.DynamicMemoryUsage(), emptyUsage);
+    BOOST_CHECK(cache.HaveCoin(COutPoint(uint256(), 99999)));
+    cache.SelfTest();
+}
+
+BOOST_AUTO_TEST_CASE(coins_cache_sync)
+{
+    CCoinsViewTest base;
+    CCoinsViewCacheTest cache(&base);
+
+    for (uint32_t i = 0; i < 10000; i++) {
+        Coin coin;
+        coin.out.nValue = i;
+        coin.nHeight = 1 + i;
+        cache.AddCoin(COutPoint(uint256(), i), std::move(coin), false);
+    }
+    cache.SpendCoin(COutPoint(uint256(), 9999));
+
+    // With enough room, every unspent coin stays cached, and is clean.
+    BOOST_CHECK(cache.Sync(std::numeric_limits<size_t>::max()));
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 9999);
+    cache.SelfTest();
+
+    // Changes after a sync are written by the next one.
+    cache.SpendCoin(COutPoint(uint256(), 0));
+    BOOST_CHECK(cache.Sync(std::numeric_limits<size_t>::max()));
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 9998);
+
+    // Over the target, only the youngest coins are kept.
+    size_t usage = cache.DynamicMemoryUsage();
+    BOOST_CHECK(cache.Sync(usage / 4));
+    BOOST_CHECK(cache.DynamicMemoryUsage() < usage);
+    BOOST_CHECK(cache.GetCacheSize() < 9998);
+    BOOST_CHECK(cache.GetCacheSize() > 0);
+    BOOST_CHECK(cache.HaveCoinInCache(COutPoint(uint256(), 9998)));
+    BOOST_CHECK(!cache.HaveCoinInCache(COutPoint(uint256(), 1)));
+    cache.SelfTest();
+
+    // The base view has all of the unspent coins.
+    CCoinsViewCacheTest fresh(&base);
+    BOOST_CHECK(!fresh.HaveCoin(COutPoint(uint256(), 0)));
+    BOOST_CHECK(fresh.HaveCoin(COutPoint(uint256(), 1)));
+    BOOST_CHECK(fresh.HaveCoin(COutPoint(uint256(), 9998)));
+    BOOST_CHECK(!fresh.HaveCoin(COutPoint(uint256(), 9999)));
+}
+
+BOOST_AUTO_TEST_CASE(coins_snapshot_layer)
+{
+    CCoinsViewTest base;
+    CCoinsViewSnapshot snapshot(&base);
+    CCoinsViewCacheTest cache(&snapshot);
+
+    for (uint32_t i = 0; i < 100; i++) {
+        Coin coin;
+        coin.out.nValue = i;
+        coin.nHeight = 1;
+        cache.AddCoin(COutPoint(uint256(), i), std::move(coin), false);
+    }
+    TxWithNullifiers txWithNullifiers;
+    cache.SetNullifiers(txWithNullifiers.tx, true);
+    uint256 hashBlock = GetRandHash();
+    cache.SetBestBlock(hashBlock);
+    BOOST_CHECK(cache.Flush());
+
+    // Until the batch is written, it is only visible through the snapshot.
+    BOOST_CHECK(snapshot.DynamicMemoryUsage() > 0);
+    BOOST_CHECK(!base.HaveCoin(COutPoint(uint256(), 0)));
+    BOOST_CHECK(cache.HaveCoin(COutPoint(uint256(), 0)));
+    BOOST_CHECK(cache.GetBestBlock() == hashBlock);
+    checkNullifierCache(cache, txWithNullifiers, true);
+
+    // Spending a coin that is in the pending batch hides it.
+    cache.SpendCoin(COutPoint(uint256(), 1));
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK(!cache.HaveCoin(COutPoint(uint256(), 1)));
+    BOOST_CHECK(snapshot.Finish());
+    BOOST_CHECK_EQUAL(snapshot.DynamicMemoryUsage(), 0);
+
+    // Once written, the base view has the changes.
+    BOOST_CHECK(base.HaveCoin(COutPoint(uint256(), 0)));
+    BOOST_CHECK(!base.HaveCoin(COutPoint(uint256(), 1)));
+    BOOST_CHECK(base.GetBestBlock() == hashBlock);
+    CCoinsViewCacheTest fresh(&base);
+    checkNullifierCache(fresh, txWithNullifiers, true);
+
+    // Nothing is pending now.
+    BOOST_CHECK(snapshot.ReleaseIfWritten());
+    BOOST_CHECK(snapshot.Finish());
+}
+
+BOOST_AUTO_TEST_CASE(coins_snapshot_sapling_anchors)
+{
+    CCoinsViewTest base;
+    CCoinsViewSnapshot snapshot(&base);
+    uint256 oldrt = snapshot.GetBestAnchor(SAPLING);
+    uint256 newrt;
+    {
+        CCoinsViewCacheTest cache(&snapshot);
+        SaplingMerkleTree tree;
+        BOOST_CHECK(cache.GetSaplingAnchorAt(oldrt, tree));
+        tree.append(GetRandHash());
+        newrt = tree.root();
+        cache.PushAnchor(tree);
+        BOOST_CHECK(cache.Flush());
+    }
+
+    // A pushed anchor that is only in the pending batch is found, both
+    // directly and through a cache that has not seen it.
+    BOOST_CHECK(!base.HaveSaplingAnchor(newrt));
+    BOOST_CHECK(snapshot.HaveSaplingAnchor(newrt));
+    BOOST_CHECK(CCoinsViewCacheTest(&snapshot).HaveSaplingAnchor(newrt));
+    BOOST_CHECK(snapshot.Finish());
+    BOOST_CHECK(base.HaveSaplingAnchor(newrt));
+
+    // An anchor popped in the pending batch is missing, although the base
+    // view still has it.
+    {
+        CCoinsViewCacheTest cache(&snapshot);
+        cache.PopAnchor(oldrt, SAPLING);
+        BOOST_CHECK(cache.Flush());
+    }
+    BOOST_CHECK(base.HaveSaplingAnchor(newrt));
+    BOOST_CHECK(!snapshot.HaveSaplingAnchor(newrt));
+    BOOST_CHECK(!CCoinsViewCacheTest(&snapshot).HaveSaplingAnchor(newrt));
+    BOOST_CHECK(snapshot.HaveSaplingAnchor(oldrt));
+    BOOST_CHECK(snapshot.Finish());
+    BOOST_CHECK(!base.HaveSaplingAnchor(newrt));
+}
+
+BOOST_AUTO_TEST_CASE(coins_prefetch)
+{
+    CCoinsViewTest base;
+    uint256 txid = GetRandHash();
+    TxWithNullifiers txWithNullifiers;
+    {
+        CCoinsViewCacheTest cache(&base);
+        for (uint32_t i = 0; i < 10; i++) {
+            Coin coin;
+            coin.out.nValue = i;
+            coin.nHeight = 1;
+            cache.AddCoin(COutPoint(txid, i), std::move(coin), false);
+        }
+        cache.SetNullifiers(txWithNullifiers.tx, true);
+        BOOST_CHECK(cache.Flush());
+    }
+
+    CMutableTransaction mtx1;
+    for (uint32_t i = 0; i < 5; i++) {
+        mtx1.vin.emplace_back(COutPoint(txid, i));
+    }
+    mtx1.vout.resize(1);
+    mtx1.vout[0].nValue = 1;
+    CTransaction tx1(mtx1);
+    CMutableTransaction mtx2;
+    mtx2.vin.emplace_back(COutPoint(tx1.GetHash(), 0));
+    mtx2.vin.emplace_back(COutPoint(txid, 5));
+    mtx2.vin.emplace_back(COutPoint(txid, 4));
+    CTransaction tx2(mtx2);
+    std::vector<CTransaction> vtx = {tx1, tx2, txWithNullifiers.tx};
+
+    CCoinsViewCacheTest cache(&base);
+    BOOST_CHECK(cache.HaveCoin(COutPoint(txid, 5)));
+
+    // Cached coins, duplicates and the outputs of earlier transactions are
+    // not looked up; the anchors and nullifiers are.
+    CCoinsPrefetch prefetch = cache.GetPrefetch(vtx);
+    BOOST_CHECK_EQUAL(prefetch.size(), 5 + 2 + 3);
+    for (size_t i = 0; i < prefetch.size(); i++) {
+        prefetch.Fetch(i);
+    }
+    cache.AddPrefetched(prefetch);
+    cache.SelfTest();
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 6);
+    for (uint32_t i = 0; i < 6; i++) {
+        BOOST_CHECK(cache.HaveCoinInCache(COutPoint(txid, i)));
+    }
+    BOOST_CHECK(!cache.HaveCoinInCache(COutPoint(tx1.GetHash(), 0)));
+    checkNullifierCache(cache, txWithNullifiers, true);
+
+    // Only the unknown anchors are left to look up.
+    BOOST_CHECK_EQUAL(cache.GetPrefetch(vtx).size(), 2);
+}
+
+BOOST_FIXTURE_TEST_CASE(coins_db_nullifier_filter, TestingSetup)
+{
+    CCoinsViewDB db(1 << 20, true);
+    TxWithNullifiers spentBefore, spentAfter, unspent;
+    {
+        CCoinsViewCacheTest cache(&db);
+        cache.SetNullifiers(spentBefore.tx, true);
+        BOOST_CHECK(cache.Flush());
+    }
+    db.LoadNullifierFilters();
+
+    // Nullifiers written after the filters were loaded are added to them.
+    {
+        CCoinsViewCacheTest cache(&db);
+        cache.SetNullifiers(spentAfter.tx, true);
+        BOOST_CHECK(cache.Flush());
+    }
+    checkNullifierCache(CCoinsViewCacheTest(&db), spentBefore, true);
+    checkNullifierCache(CCoinsViewCacheTest(&db), spentAfter, true);
+    checkNullifierCache(CCoinsViewCacheTest(&db), unspent, false);
+
+    // Nullifiers removed from the database are not found, although they
+    // stay in the filters.
+    {
+        CCoinsViewCacheTest cache(&db);
+        cache.SetNullifiers(spentBefore.tx, false);
+        BOOST_CHECK(cache.Flush());
+    }
+    checkNullifierCache(CCoinsViewCacheTest(&db), spentBefore, false);
+}
+
+BOOST_FIXTURE_TEST_CASE(coins_db_bulk_write, TestingSetup)
+{
+    // A write buffer of 256 KiB, so that the coins are written in several chunks.
+    CCoinsViewDB db(1 << 20, true);
+    db.SetBulkWrite(true);
+    std::vector<COutPoint> outpoints;
+    for (int i = 0; i < 5000; i++) {
+        uint256 txid = GetRandHash();
+        for (uint32_t n = 0; n < 4; n++) {
+            outpoints.push_back(COutPoint(txid, n));
+        }
+    }
+    {
+        CCoinsViewCacheTest cache(&db);
+        for (size_t i = 0; i < outpoints.size(); i++) {
+            CTxOut out(i, CScript() << OP_TRUE);
+            cache.AddCoin(outpoints[i], Coin(out, 1, false), false);
+        }
+        cache.SetBestBlock(GetRandHash());
+        BOOST_CHECK(cache.Flush());
+    }
+    BOOST_CHECK(!db.IsBulkWriteInterrupted());
+
+    // Spend half of the coins.
+    uint256 hashBest = GetRandHash();
+    {
+        CCoinsViewCacheTest cache(&db);
+        for (size_t i = 0; i < outpoints.size(); i += 2) {
+            BOOST_CHECK(cache.SpendCoin(outpoints[i]));
+        }
+        cache.SetBestBlock(hashBest);
+        BOOST_CHECK(cache.Flush());
+    }
+    BOOST_CHECK(!db.IsBulkWriteInterrupted());
+    BOOST_CHECK(db.GetBestBlock() == hashBest);
+    for (size_t i = 0; i < outpoints.size(); i++) {
+        Coin coin;
+        BOOST_CHECK_EQUAL(db.GetCoin(outpoints[i], coin), i % 2 == 1);
+        if (i % 2 == 1) {
+            BOOST_CHECK_EQUAL(coin.out.nValue, (CAmount)i);
+        }
+    }
+}
+
 BOOST_AUTO_TEST_CASE(coins_coinbase_spends)
 {
     CCoinsViewTest base;
@@ -929,80 +1280,103 @@ BOOST_AUTO_TEST_CASE(coins_coinbase_spends)
 // This test is similar to the previous test
 // except the emphasis is on testing the functionality of UpdateCoins
 // random txs are created and UpdateCoins is used to update the cache stack
+// In particular it is tested that spending a coin records it in the undo data
 BOOST_AUTO_TEST_CASE(updatecoins_simulation_test)
 {
     // A simple map to track what we expect the cache stack to represent.
-    std::map<uint256, CCoins> result;
+    std::map<COutPoint, Coin> result;
 
     // The cache stack.
     CCoinsViewTest base; // A CCoinsViewTest at the bottom.
     std::vector<CCoinsViewCacheTest*> stack; // A stack of CCoinsViewCaches on top.
     stack.push_back(new CCoinsViewCacheTest(&base)); // Start with one cache.
 
-    // Track the txids we've used and whether they have been spent or not
-    std::map<uint256, CAmount> coinbaseids;
-    std::set<uint256> alltxids;
+    // Track the outpoints we've created and whether they are still unspent
+    std::set<COutPoint> coinbase_coins;
+    std::set<COutPoint> utxoset;
 
     for (unsigned int i = 0; i < NUM_SIMULATION_ITERATIONS; i++) {
         {
             CMutableTransaction tx;
             tx.vin.resize(1);
             tx.vout.resize(1);
-            tx.vout[0].nValue = i; //Keep txs unique
+            tx.vout[0].nValue = i; //Keep txs unique unless intended to duplicate
+            tx.vout[0].scriptPubKey.assign(insecure_rand() & 0x3F, 0); // Random sizes so we can test memory usage accounting
             unsigned int height = insecure_rand();
+            Coin old_coin;
 
             // 1/10 times create a coinbase
-            if (insecure_rand() % 10 == 0 || coinbaseids.size() < 10) {
-                coinbaseids[tx.GetHash()] = tx.vout[0].nValue;
+            if (insecure_rand() % 10 == 0 || coinbase_coins.size() < 10) {
                 assert(CTransaction(tx).IsCoinBase());
+                coinbase_coins.insert(COutPoint(tx.GetHash(), 0));
             }
             // 9/10 times create a regular tx
             else {
-                uint256 prevouthash;
+                COutPoint prevout;
                 // equally likely to spend coinbase or non coinbase
-                std::set<uint256>::iterator txIt = alltxids.lower_bound(GetRandHash());
-                if (txIt == alltxids.end()) {
-                    txIt = alltxids.begin();
+                std::set<COutPoint>::iterator utxod = utxoset.lower_bound(COutPoint(GetRandHash(), 0));
+                if (utxod == utxoset.end()) {
+                    utxod = utxoset.begin();
                 }
-                prevouthash = *txIt;
+                prevout = *utxod;
 
-                // Construct the tx to spend the coins of prevouthash
-                tx.vin[0].prevout.hash = prevouthash;
-                tx.vin[0].prevout.n = 0;
-
-                // Update the expected result of prevouthash to know these coins are spent
-                CCoins& oldcoins = result[prevouthash];
-                oldcoins.Clear();
+                // Construct the tx to spend the coin at prevout
+                tx.vin[0].prevout = prevout;
+                assert(!CTransaction(tx).IsCoinBase());
 
-                alltxids.erase(prevouthash);
-                coinbaseids.erase(prevouthash);
+                // Update the expected result to know this coin is spent
+                old_coin = result[prevout];
+                result[prevout].Clear();
 
-                assert(!CTransaction(tx).IsCoinBase());
+                utxoset.erase(prevout);
+                coinbase_coins.erase(prevout);
             }
-            // Track this tx to possibly spend later
-            alltxids.insert(tx.GetHash());
-
             // Update the expected result to know about the new output coins
-            CCoins &coins = result[tx.GetHash()];
-            coins.FromTx(tx, height);
+            assert(tx.vout.size() == 1);
+            const COutPoint outpoint(tx.GetHash(), 0);
+            result[outpoint] = Coin(tx.vout[0], height, CTransaction(tx).IsCoinBase());
+
+            // Call UpdateCoins on the top cache
+            CTxUndo undo;
+            UpdateCoins(tx, *(stack.back()), undo, height);
+
+            // Spending a coin records exactly that coin in the undo data
+            if (CTransaction(tx).IsCoinBase()) {
+                BOOST_CHECK(undo.vprevout.empty());
+            } else {
+                BOOST_CHECK_EQUAL(undo.vprevout.size(), 1);
+                BOOST_CHECK(undo.vprevout[0] == old_coin);
+
+                // ... and the undo record round-trips through its disk format
+                CDataStream ss(SER_DISK, CLIENT_VERSION);
+                ss << undo;
+                CTxUndo undo2;
+                ss >> undo2;
+                BOOST_CHECK_EQUAL(undo2.vprevout.size(), 1);
+                BOOST_CHECK(undo2.vprevout[0] == old_coin);
+            }
 
-            UpdateCoins(tx, *(stack.back()), height);
+            // Track this output to possibly spend later
+            utxoset.insert(outpoint);
         }
 
         // Once every 1000 iterations and at the end, verify the full cache.
         if (insecure_rand() % 1000 == 1 || i == NUM_SIMULATION_ITERATIONS - 1) {
-            for (std::map<uint256, CCoins>::iterator it = result.begin(); it != result.end(); it++) {
-                const CCoins* coins = stack.back()->AccessCoins(it->first);
-                if (coins) {
-                    BOOST_CHECK(*coins == it->second);
-                 } else {
-                    BOOST_CHECK(it->second.IsPruned());
-                 }
+            for (std::map<COutPoint, Coin>::iterator it = result.begin(); it != result.end(); it++) {
+                bool have = stack.back()->HaveCoin(it->first);
+                const Coin& coin = stack.back()->AccessCoin(it->first);
+                BOOST_CHECK(have == !coin.IsSpent());
+                BOOST_CHECK(coin == it->second);
             }
         }
 
+        // Occasionally check the memory usage accounting of a random cache.
+        if (insecure_rand() % 30 == 0) {
+            stack[insecure_rand() % stack.size()]->SelfTest();
+        }
+
         if (insecure_rand() % 100 == 0) {
-            // Every 100 iterations, change the cache stack.
+            // Every 100 iterations, flush an intermediate cache
             if (stack.size() > 0 && insecure_rand() % 2 == 0) {
                 stack.back()->Flush();
                 delete stack.back();
@@ -1014,7 +1388,7 @@ BOOST_AUTO_TEST_CASE(updatecoins_simulation_test)
                     tip = stack.back();
                 }
                 stack.push_back(new CCoinsViewCacheTest(tip));
-           }
+            }
         }
     }
 
@@ -1028,53 +1402,36 @@ BOOST_AUTO_TEST_CASE(updatecoins_simulation_test)
 BOOST_AUTO_TEST_CASE(ccoins_serialization)
 {
     // Good example
-    CDataStream ss1(ParseHex("0104835800816115944e077fe7c803cfa57f29b36bf87c1d358bb85e"), SER_DISK, CLIENT_VERSION);
-    CCoins cc1;
+    CDataStream ss1(ParseHex("97f23c835800816115944e077fe7c803cfa57f29b36bf87c1d35"), SER_DISK, CLIENT_VERSION);
+    Coin cc1;
     ss1 >> cc1;
-    BOOST_CHECK_EQUAL(cc1.nVersion, 1);
     BOOST_CHECK_EQUAL(cc1.fCoinBase, false);
     BOOST_CHECK_EQUAL(cc1.nHeight, 203998);
-    BOOST_CHECK_EQUAL(cc1.vout.size(), 2);
-    BOOST_CHECK_EQUAL(cc1.IsAvailable(0), false);
-    BOOST_CHECK_EQUAL(cc1.IsAvailable(1), true);
-    BOOST_CHECK_EQUAL(cc1.vout[1].nValue, 60000000000ULL);
-    BOOST_CHECK_EQUAL(HexStr(cc1.vout[1].scriptPubKey), HexStr(GetScriptForDestination(CKeyID(uint160(ParseHex("816115944e077fe7c803cfa57f29b36bf87c1d35"))))));
+    BOOST_CHECK_EQUAL(cc1.out.nValue, 60000000000ULL);
+    BOOST_CHECK_EQUAL(HexStr(cc1.out.scriptPubKey), HexStr(GetScriptForDestination(CKeyID(uint160(ParseHex("816115944e077fe7c803cfa57f29b36bf87c1d35"))))));
 
     // Good example
-    CDataStream ss2(ParseHex("0109044086ef97d5790061b01caab50f1b8e9c50a5057eb43c2d9563a4eebbd123008c988f1a4a4de2161e0f50aac7f17e7f9555caa486af3b"), SER_DISK, CLIENT_VERSION);
-    CCoins cc2;
+    CDataStream ss2(ParseHex("8ddf77bbd123008c988f1a4a4de2161e0f50aac7f17e7f9555caa4"), SER_DISK, CLIENT_VERSION);
+    Coin cc2;
     ss2 >> cc2;
-    BOOST_CHECK_EQUAL(cc2.nVersion, 1);
     BOOST_CHECK_EQUAL(cc2.fCoinBase, true);
     BOOST_CHECK_EQUAL(cc2.nHeight, 120891);
-    BOOST_CHECK_EQUAL(cc2.vout.size(), 17);
-    for (int i = 0; i < 17; i++) {
-        BOOST_CHECK_EQUAL(cc2.IsAvailable(i), i == 4 || i == 16);
-    }
-    BOOST_CHECK_EQUAL(cc2.vout[4].nValue, 234925952);
-    BOOST_CHECK_EQUAL(HexStr(cc2.vout[4].scriptPubKey), HexStr(GetScriptForDestination(CKeyID(uint160(ParseHex("61b01caab50f1b8e9c50a5057eb43c2d9563a4ee"))))));
-    BOOST_CHECK_EQUAL(cc2.vout[16].nValue, 110397);
-    BOOST_CHECK_EQUAL(HexStr(cc2.vout[16].scriptPubKey), HexStr(GetScriptForDestination(CKeyID(uint160(ParseHex("8c988f1a4a4de2161e0f50aac7f17e7f9555caa4"))))));
+    BOOST_CHECK_EQUAL(cc2.out.nValue, 110397);
+    BOOST_CHECK_EQUAL(HexStr(cc2.out.scriptPubKey), HexStr(GetScriptForDestination(CKeyID(uint160(ParseHex("8c988f1a4a4de2161e0f50aac7f17e7f9555caa4"))))));
 
     // Smallest possible example
-    CDataStream ssx(SER_DISK, CLIENT_VERSION);
-    BOOST_CHECK_EQUAL(HexStr(ssx.begin(), ssx.end()), "");
-
-    CDataStream ss3(ParseHex("0002000600"), SER_DISK, CLIENT_VERSION);
-    CCoins cc3;
+    CDataStream ss3(ParseHex("000006"), SER_DISK, CLIENT_VERSION);
+    Coin cc3;
     ss3 >> cc3;
-    BOOST_CHECK_EQUAL(cc3.nVersion, 0);
     BOOST_CHECK_EQUAL(cc3.fCoinBase, false);
     BOOST_CHECK_EQUAL(cc3.nHeight, 0);
-    BOOST_CHECK_EQUAL(cc3.vout.size(), 1);
-    BOOST_CHECK_EQUAL(cc3.IsAvailable(0), true);
-    BOOST_CHECK_EQUAL(cc3.vout[0].nValue, 0);
-    BOOST_CHECK_EQUAL(cc3.vout[0].scriptPubKey.size(), 0);
+    BOOST_CHECK_EQUAL(cc3.out.nValue, 0);
+    BOOST_CHECK_EQUAL(cc3.out.scriptPubKey.size(), 0);
 
     // scriptPubKey that ends beyond the end of the stream
-    CDataStream ss4(ParseHex("0002000800"), SER_DISK, CLIENT_VERSION);
+    CDataStream ss4(ParseHex("000007"), SER_DISK, CLIENT_VERSION);
     try {
-        CCoins cc4;
+        Coin cc4;
         ss4 >> cc4;
         BOOST_CHECK_MESSAGE(false, "We should have thrown");
     } catch (const std::ios_base::failure& e) {
@@ -1085,13 +1442,40 @@ BOOST_AUTO_TEST_CASE(ccoins_serialization)
     uint64_t x = 3000000000ULL;
     tmp << VARINT(x);
     BOOST_CHECK_EQUAL(HexStr(tmp.begin(), tmp.end()), "8a95c0bb00");
-    CDataStream ss5(ParseHex("0002008a95c0bb0000"), SER_DISK, CLIENT_VERSION);
+    CDataStream ss5(ParseHex("00008a95c0bb00"), SER_DISK, CLIENT_VERSION);
     try {
-        CCoins cc5;
+        Coin cc5;
         ss5 >> cc5;
         BOOST_CHECK_MESSAGE(false, "We should have thrown");
     } catch (const std::ios_base::failure& e) {
     }
 }
 
+BOOST_AUTO_TEST_CASE(txundo_serialization)
+{
+    // An undo record for a spend of the first example coin above keeps the
+    // dummy version byte that the per-transaction format wrote after the
+    // height, so undo data written before the upgrade remains readable.
+    CDataStream ss1(ParseHex("0197f23c00835800816115944e077fe7c803cfa57f29b36bf87c1d35"), SER_DISK, CLIENT_VERSION);
+    CTxUndo undo1;
+    ss1 >> undo1;
+    BOOST_CHECK_EQUAL(undo1.vprevout.size(), 1);
+    BOOST_CHECK_EQUAL(undo1.vprevout[0].fCoinBase, false);
+    BOOST_CHECK_EQUAL(undo1.vprevout[0].nHeight, 203998);
+    BOOST_CHECK_EQUAL(undo1.vprevout[0].out.nValue, 60000000000ULL);
+
+    CDataStream ss2(SER_DISK, CLIENT_VERSION);
+    ss2 << undo1;
+    BOOST_CHECK_EQUAL(HexStr(ss2.begin(), ss2.end()), "0197f23c00835800816115944e077fe7c803cfa57f29b36bf87c1d35");
+
+    // Spends that are not the last output of their transaction were stored
+    // without height or version.
+    CDataStream ss3(ParseHex("0100835800816115944e077fe7c803cfa57f29b36bf87c1d35"), SER_DISK, CLIENT_VERSION);
+    CTxUndo undo3;
+    ss3 >> undo3;
+    BOOST_CHECK_EQUAL(undo3.vprevout.size(), 1);
+    BOOST_CHECK_EQUAL(undo3.vprevout[0].nHeight, 0);
+    BOOST_CHECK_EQUAL(undo3.vprevout[0].out.nValue, 60000000000ULL);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -10,6 +10,8 @@
 #include "crypto/sha512.h"
 #include "crypto/hmac_sha256.h"
 #include "crypto/hmac_sha512.h"
+#include "crypto/muhash.h"
+#include "streams.h"
 #include "test_random.h"
 #include "utilstrencodings.h"
 #include "test/test_bitcoin.h"
@@ -267,6 +269,40 @@ BOOST_AUTO_TEST_CASE(sha256_testvectors) {
     TestSHA256(test1, "a316d55510b49662420f49d145d42fb83f31ef8dc016aa4e32df049991a91e26");
 }
 
+BOOST_AUTO_TEST_CASE(sha256d64)
+{
+    for (int i = 0; i <= 32; ++i) {
+        unsigned char in[64 * 32];
+        unsigned char out1[32 * 32], out2[32 * 32];
+        for (int j = 0; j < 64 * i; ++j) {
+            in[j] = insecure_rand();
+        }
+        for (int j = 0; j < i; ++j) {
+            unsigned char tmp[32];
+            CSHA256().Write(in + 64 * j, 64).Finalize(tmp);
+            CSHA256().Write(tmp, 32).Finalize(out1 + 32 * j);
+        }
+        SHA256D64(out2, in, i);
+        BOOST_CHECK(memcmp(out1, out2, 32 * i) == 0);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(sha256compress64)
+{
+    for (int i = 0; i <= 32; ++i) {
+        unsigned char in[64 * 32];
+        unsigned char out1[32 * 32], out2[32 * 32];
+        for (int j = 0; j < 64 * i; ++j) {
+            in[j] = insecure_rand();
+        }
+        for (int j = 0; j < i; ++j) {
+            CSHA256().Write(in + 64 * j, 64).FinalizeNoPadding(out1 + 32 * j);
+        }
+        SHA256Compress64(out2, in, i);
+        BOOST_CHECK(memcmp(out1, out2, 32 * i) == 0);
+    }
+}
+
 BOOST_AUTO_TEST_CASE(sha512_testvectors) {
     TestSHA512("",
                "cf83e1357eefb8bdf1542850d66d8007d620e4050b5715dc83f4a921d36ce9ce"
@@ -482,6 +518,73 @@ BOOST_AUTO_TEST_CASE(chacha20_testvector)
                  "fab78c9");
 }
 
+static MuHash3072 FromInt(unsigned char i) {
+    unsigned char tmp[32] = {i, 0};
+    MuHash3072 muhash;
+    muhash.Insert(tmp, 32);
+    return muhash;
+}
+
+static uint256 FinalizeMuHash(MuHash3072 muhash) {
+    uint256 out;
+    muhash.Finalize(out.begin());
+    return out;
+}
+
+BOOST_AUTO_TEST_CASE(muhash_tests)
+{
+    // Test vector from Bitcoin Core.
+    MuHash3072 acc = FromInt(0);
+    acc *= FromInt(1);
+    acc /= FromInt(2);
+    BOOST_CHECK_EQUAL(FinalizeMuHash(acc).GetHex(), "10d312b100cbd32ada024a6646e40d3482fcff103668d2625f10002a607d5863");
+
+    // The hash of a set does not depend on the order in which its elements
+    // were added or removed, or on how it was split into subsets.
+    for (int iter = 0; iter < 10; ++iter) {
+        unsigned char x = insecure_rand() & 0xff;
+        unsigned char y = insecure_rand() & 0xff;
+        unsigned char z = insecure_rand() & 0xff;
+
+        MuHash3072 xyz = FromInt(x);
+        xyz *= FromInt(y);
+        xyz *= FromInt(z);
+
+        MuHash3072 zyx = FromInt(z);
+        zyx *= FromInt(y);
+        zyx *= FromInt(x);
+        BOOST_CHECK(FinalizeMuHash(xyz) == FinalizeMuHash(zyx));
+
+        unsigned char data[32] = {y, 0};
+        MuHash3072 xz = xyz;
+        xz.Remove(data, sizeof(data));
+        MuHash3072 expected = FromInt(x);
+        expected *= FromInt(z);
+        BOOST_CHECK(FinalizeMuHash(xz) == FinalizeMuHash(expected));
+
+        xz /= FromInt(x);
+        xz /= FromInt(z);
+        BOOST_CHECK(FinalizeMuHash(xz) == FinalizeMuHash(MuHash3072()));
+    }
+
+    // Finalizing does not change the set.
+    MuHash3072 finalized = acc;
+    uint256 hash;
+    finalized.Finalize(hash.begin());
+    finalized *= FromInt(3);
+    MuHash3072 unfinalized = acc;
+    unfinalized *= FromInt(3);
+    BOOST_CHECK(FinalizeMuHash(finalized) == FinalizeMuHash(unfinalized));
+
+    // Serialization round trip.
+    CDataStream ss(SER_DISK, PROTOCOL_VERSION);
+    ss << acc;
+    BOOST_CHECK_EQUAL(ss.size(), 2 * Num3072::BYTE_SIZE);
+    MuHash3072 deserialized;
+    ss >> deserialized;
+    BOOST_CHECK(FinalizeMuHash(deserialized) == FinalizeMuHash(acc));
+}
+
 BOOST_AUTO_TEST_CASE(countbits_tests)
 {
     FastRandomContext ctx;
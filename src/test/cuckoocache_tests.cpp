@@ -0,0 +1,168 @@
+// Copyright (c) 2012-2016 The Bitcoin Core developers
+// Copyright (c) 2021 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "cuckoocache.h"
+#include "random.h"
+#include "uint256.h"
+
+#include "test/test_bitcoin.h"
+
+#include <cstring>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+/** Test Suite for CuckooCache
+ *
+ * All tests use a deterministic FastRandomContext, so the thresholds below
+ * act as regression checks on the cache's replacement behaviour.
+ */
+
+namespace {
+
+/** Same slicing as the signature cache: entries are already random. */
+struct TestHasher
+{
+    template <uint8_t hash_select>
+    uint32_t operator()(const uint256& key) const
+    {
+        static_assert(hash_select < 8, "TestHasher only has 8 hashes available.");
+        uint32_t u;
+        std::memcpy(&u, key.begin() + 4 * hash_select, 4);
+        return u;
+    }
+};
+
+typedef CuckooCache::cache<uint256, TestHasher> test_cache;
+
+uint256 RandomEntry(FastRandomContext& ctx)
+{
+    uint256 entry;
+    for (int i = 0; i < 4; ++i) {
+        uint64_t word = ctx.rand64();
+        std::memcpy(entry.begin() + 8 * i, &word, 8);
+    }
+    return entry;
+}
+
+/** Insert load * capacity random entries into a cache of `megabytes` and
+ *  return the fraction of them that can still be found.
+ */
+double TestHitRate(double load, size_t megabytes)
+{
+    FastRandomContext ctx(true);
+    test_cache set;
+    size_t bytes = megabytes * (1 << 20);
+    uint32_t n_insert = static_cast<uint32_t>(load * (bytes / sizeof(uint256)));
+
+    std::vector<uint256> hashes(n_insert);
+    for (uint32_t i = 0; i < n_insert; ++i) {
+        hashes[i] = RandomEntry(ctx);
+    }
+
+    set.setup_bytes(bytes);
+    for (const uint256& h : hashes) {
+        set.insert(h);
+    }
+
+    double count = 0;
+    for (const uint256& h : hashes) {
+        count += set.contains(h, false);
+    }
+    return count / n_insert;
+}
+
+/** Adjust a hit rate for loads above 1.0, where at most 1/load of the
+ *  entries can possibly fit.
+ */
+double NormalizeHitRate(double hits, double load)
+{
+    return hits * std::max(load, 1.0);
+}
+
+}
+
+BOOST_FIXTURE_TEST_SUITE(cuckoocache_tests, BasicTestingSetup)
+
+/* Check that no values are reported present that were never inserted. */
+BOOST_AUTO_TEST_CASE(cuckoocache_no_fakes)
+{
+    FastRandomContext ctx(true);
+    test_cache set;
+    set.setup_bytes(1 << 20);
+
+    for (int i = 0; i < 100000; ++i) {
+        set.insert(RandomEntry(ctx));
+    }
+    for (int i = 0; i < 100000; ++i) {
+        BOOST_CHECK(!set.contains(RandomEntry(ctx), false));
+    }
+}
+
+/* Nearly everything inserted into a cache that is at most full should stay
+ * findable, and an overloaded cache should stay close to capacity.
+ */
+BOOST_AUTO_TEST_CASE(cuckoocache_hit_rate)
+{
+    const double HitRateThresh = 0.98;
+    const size_t megabytes = 4;
+    for (double load = 0.1; load < 2; load *= 2) {
+        double hits = TestHitRate(load, megabytes);
+        BOOST_CHECK(NormalizeHitRate(hits, load) > HitRateThresh);
+    }
+}
+
+/* Entries flagged for erasure remain readable until their slot is needed,
+ * and are the first to go once the cache fills up.
+ */
+BOOST_AUTO_TEST_CASE(cuckoocache_erase)
+{
+    FastRandomContext ctx(true);
+    test_cache set;
+    size_t bytes = 1 << 20;
+    uint32_t capacity = set.setup_bytes(bytes);
+    BOOST_CHECK_EQUAL(capacity, bytes / sizeof(uint256));
+
+    // Fill half the cache and erase the first half of what we inserted.
+    uint32_t n_insert = capacity / 2;
+    std::vector<uint256> hashes(n_insert);
+    for (uint32_t i = 0; i < n_insert; ++i) {
+        hashes[i] = RandomEntry(ctx);
+        set.insert(hashes[i]);
+    }
+    for (uint32_t i = 0; i < n_insert / 2; ++i) {
+        BOOST_CHECK(set.contains(hashes[i], true));
+    }
+    // Erasure is lazy: the entries are still there.
+    for (uint32_t i = 0; i < n_insert / 2; ++i) {
+        BOOST_CHECK(set.contains(hashes[i], false));
+    }
+
+    // Fill the remainder of the cache; the new entries should displace the
+    // erased ones rather than the ones we still want to keep.
+    std::vector<uint256> more(capacity - n_insert);
+    for (uint256& h : more) {
+        h = RandomEntry(ctx);
+        set.insert(h);
+    }
+
+    double kept = 0;
+    for (uint32_t i = n_insert / 2; i < n_insert; ++i) {
+        kept += set.contains(hashes[i], false);
+    }
+    for (const uint256& h : more) {
+        kept += set.contains(h, false);
+    }
+    double erased = 0;
+    for (uint32_t i = 0; i < n_insert / 2; ++i) {
+        erased += set.contains(hashes[i], false);
+    }
+    double kept_rate = kept / ((n_insert - n_insert / 2) + more.size());
+    double erased_rate = erased / (n_insert / 2);
+    BOOST_CHECK(kept_rate > 0.9);
+    BOOST_CHECK(erased_rate < 0.5);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -79,6 +79,52 @@ BOOST_AUTO_TEST_CASE(dbwrapper_batch)
     }
 }
 
+// Test the counters of point lookups
+BOOST_AUTO_TEST_CASE(dbwrapper_read_stats)
+{
+    {
+        path ph = temp_directory_path() / unique_path();
+        CDBOptions dbOptions;
+        dbOptions.nBloomBits = 16;
+        dbOptions.nBlockSize = 1024;
+        CDBWrapper dbw(ph, (1 << 20), true, false, dbOptions);
+
+        uint256 in = GetRandHash();
+        uint256 res;
+        for (uint32_t i = 0; i < 1000; i++) {
+            BOOST_CHECK(dbw.Write(std::make_pair('a', i), in));
+        }
+        BOOST_CHECK(dbw.Write('b', in));
+        BOOST_CHECK(dbw.GetReadStats().empty());
+
+        // Move the records from the memtable to a table file.
+        dbw.CompactRange('a', 'c');
+
+        BOOST_CHECK(dbw.Read(std::make_pair('a', (uint32_t)500), res));
+        BOOST_CHECK(!dbw.Read(std::make_pair('a', (uint32_t)5000), res));
+        BOOST_CHECK(dbw.Exists('b'));
+
+        std::map<unsigned char, CDBReadStats> mapStats = dbw.GetReadStats();
+        BOOST_CHECK_EQUAL(mapStats.size(), 2);
+        BOOST_CHECK_EQUAL(mapStats['a'].nReads, 2);
+        BOOST_CHECK_EQUAL(mapStats['a'].nFound, 1);
+        BOOST_CHECK_EQUAL(mapStats['b'].nReads, 1);
+        BOOST_CHECK_EQUAL(mapStats['b'].nFound, 1);
+        uint64_t nFileReads = mapStats['a'].nFileReads;
+        BOOST_CHECK(nFileReads > 0);
+        BOOST_CHECK(mapStats['a'].nFileBytes > 0);
+
+        // The block of the record is now in the block cache.
+        BOOST_CHECK(dbw.Read(std::make_pair('a', (uint32_t)500), res));
+        mapStats = dbw.GetReadStats();
+        BOOST_CHECK_EQUAL(mapStats['a'].nReads, 3);
+        BOOST_CHECK_EQUAL(mapStats['a'].nFileReads, nFileReads);
+
+        BOOST_CHECK(!dbw.GetProperty("leveldb.stats").empty());
+        BOOST_CHECK(dbw.GetProperty("leveldb.unknown").empty());
+    }
+}
+
 BOOST_AUTO_TEST_CASE(dbwrapper_iterator)
 {
     {
@@ -182,6 +228,51 @@ struct StringContentsSerializer {
     }
 };
 
+//! A key whose serialization sorts in numeric order, unlike the little-endian integers.
+static std::pair<uint8_t, uint8_t> Key(uint32_t x)
+{
+    return std::make_pair((uint8_t)(x >> 8), (uint8_t)x);
+}
+
+BOOST_AUTO_TEST_CASE(range_reader)
+{
+    path ph = temp_directory_path() / unique_path();
+    CDBWrapper dbw(ph, (1 << 20), true, false);
+    for (int x = 0; x < 1000; ++x) {
+        BOOST_CHECK(dbw.Write(std::make_pair('a', Key(x)), (uint64_t)x * x));
+        BOOST_CHECK(dbw.Write(std::make_pair('b', Key(x)), (uint64_t)x));
+    }
+
+    // The range stops before its end key, and small batches split it.
+    CDBRangeReader reader(dbw, std::make_pair('a', Key(100)), 'b', 1000);
+    int nBatches = 0;
+    uint32_t nNext = 100;
+    while (reader.ReadBatch()) {
+        nBatches++;
+        BOOST_CHECK(reader.size() > 0);
+        for (size_t i = 0; i < reader.size(); i++) {
+            std::pair<char, std::pair<uint8_t, uint8_t>> key;
+            uint64_t value;
+            BOOST_CHECK(reader.GetKey(i, key));
+            BOOST_CHECK(reader.GetValue(i, value));
+            BOOST_CHECK_EQUAL(key.first, 'a');
+            BOOST_CHECK(key.second == Key(nNext));
+            BOOST_CHECK_EQUAL(value, (uint64_t)nNext * nNext);
+            nNext++;
+        }
+    }
+    BOOST_CHECK_EQUAL(nNext, 1000);
+    BOOST_CHECK(nBatches > 1);
+    BOOST_CHECK(!reader.ReadBatch());
+
+    // Records that do not deserialize as the type asked for are reported.
+    CDBRangeReader reader2(dbw, 'b', 'c');
+    BOOST_CHECK(reader2.ReadBatch());
+    BOOST_CHECK_EQUAL(reader2.size(), 1000);
+    std::pair<char, uint256> badKey;
+    BOOST_CHECK(!reader2.GetKey(0, badKey));
+}
+
 BOOST_AUTO_TEST_CASE(iterator_string_ordering)
 {
     char buf[10];
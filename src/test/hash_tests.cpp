@@ -122,6 +122,45 @@ BOOST_AUTO_TEST_CASE(siphash)
         hasher3.Write(uint64_t(x)|(uint64_t(x+1)<<8)|(uint64_t(x+2)<<16)|(uint64_t(x+3)<<24)|
                      (uint64_t(x+4)<<32)|(uint64_t(x+5)<<40)|(uint64_t(x+6)<<48)|(uint64_t(x+7)<<56));
     }
+
+    // Check that SipHashUint256Extra hashes a uint256 followed by a 32-bit
+    // little-endian integer
+    uint256 val = uint256S("1f1e1d1c1b1a191817161514131211100f0e0d0c0b0a09080706050403020100");
+    uint32_t extra = 0x23222120;
+    CSipHasher hasher4(0x0706050403020100ULL, 0x0F0E0D0C0B0A0908ULL);
+    hasher4.Write(val.begin(), 32);
+    unsigned char extraBytes[4] = {0x20, 0x21, 0x22, 0x23};
+    hasher4.Write(extraBytes, 4);
+    BOOST_CHECK_EQUAL(SipHashUint256Extra(0x0706050403020100ULL, 0x0F0E0D0C0B0A0908ULL, val, extra), hasher4.Finalize());
+}
+
+BOOST_AUTO_TEST_CASE(blake2b_writer)
+{
+    const unsigned char personal[BLAKE2bPersonalBytes] = {'Z','c','a','s','h','W','r','i','t','e','r','T','e','s','t','_'};
+    std::vector<char> data(300);
+    for (size_t i = 0; i < data.size(); i++) {
+        data[i] = i % 251;
+    }
+
+    // The hash must not depend on how the input is split between writes,
+    // whether the writes fill the buffer exactly, cross it or bypass it.
+    const std::vector<std::vector<size_t>> splits = {
+        {300},
+        {1, 3, 7, 13, 31, 73, 172},
+        {128, 128, 44},
+        {100, 150, 50},
+        {127, 2, 171},
+    };
+    for (const auto& split : splits) {
+        CBLAKE2bWriter ss(SER_GETHASH, 0, personal);
+        size_t pos = 0;
+        for (size_t len : split) {
+            ss.write(&data[pos], len);
+            pos += len;
+        }
+        BOOST_CHECK_EQUAL(pos, data.size());
+        BOOST_CHECK_EQUAL(ss.GetHash().ToString(), "22d14d371ba8bf4021dac1b5d2e90b72dc724884b949e4eb3576f0d4e9b75f09");
+    }
 }
 
 BOOST_AUTO_TEST_SUITE_END()
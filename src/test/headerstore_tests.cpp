@@ -0,0 +1,70 @@
+// Copyright (c) 2021 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "headerstore.h"
+
+#include "chainparams.h"
+#include "crypto/equihash.h"
+#include "primitives/block.h"
+#include "streams.h"
+#include "version.h"
+#include "test/test_bitcoin.h"
+
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(headerstore_tests, TestingSetup)
+
+static std::vector<char> SerializeHeader(const CBlockHeader& header)
+{
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << CBlock(header);
+    return std::vector<char>(ss.begin(), ss.end());
+}
+
+BOOST_AUTO_TEST_CASE(headerstore_read_write)
+{
+    const Consensus::Params& params = Params().GetConsensus();
+    fs::path path = pathTemp / "headers.dat";
+    CHeaderStore store;
+    BOOST_CHECK(store.Open(path, equihash_solution_size(params.nEquihashN, params.nEquihashK)));
+
+    CBlockHeader header = Params().GenesisBlock().GetBlockHeader();
+    CBlockHeader header2 = header;
+    header2.nTime++;
+
+    CRawBlock raw;
+    BOOST_CHECK(!store.Read(0, header.GetHash(), raw));
+
+    // A record can be written past the end of the file, leaving a gap.
+    store.Write(0, header);
+    store.Write(5, header2);
+    BOOST_CHECK(store.Read(0, header.GetHash(), raw));
+    BOOST_CHECK(std::vector<char>(raw.begin(), raw.end()) == SerializeHeader(header));
+    BOOST_CHECK(store.Read(5, header2.GetHash(), raw));
+    BOOST_CHECK(std::vector<char>(raw.begin(), raw.end()) == SerializeHeader(header2));
+    BOOST_CHECK(!store.Read(3, header.GetHash(), raw));
+    BOOST_CHECK(!store.Read(6, header.GetHash(), raw));
+
+    // A record with another hash is a miss, and can be replaced.
+    BOOST_CHECK(!store.Read(0, header2.GetHash(), raw));
+    store.Write(0, header2);
+    BOOST_CHECK(!store.Read(0, header.GetHash(), raw));
+    BOOST_CHECK(store.Read(0, header2.GetHash(), raw));
+
+    // Headers with solutions of another size are not stored.
+    CBlockHeader header3 = header;
+    header3.nSolution.pop_back();
+    store.Write(1, header3);
+    BOOST_CHECK(!store.Read(1, header3.GetHash(), raw));
+
+    // The records are kept when the file is opened again.
+    store.Close();
+    BOOST_CHECK(store.Open(path, equihash_solution_size(params.nEquihashN, params.nEquihashK)));
+    BOOST_CHECK(store.Read(5, header2.GetHash(), raw));
+    BOOST_CHECK(std::vector<char>(raw.begin(), raw.end()) == SerializeHeader(header2));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -190,6 +190,34 @@ BOOST_AUTO_TEST_CASE(key_test1)
     BOOST_CHECK(detsigc == ParseHex("2052d8a32079c11e79db95af63bb9600c5b04f21a9ca33dc129c2bfa8ac9dc1cd561d8ae5e0f6c1a16bde3719c64c2fd70e404b6428ab9a69566962e8771b5944d"));
 }
 
+BOOST_AUTO_TEST_CASE(verify_parsed_pubkey_cache)
+{
+    // Find two keys whose public keys share their first x coordinate byte,
+    // so that they compete for the same entry of the parsed key cache.
+    CKey key1, key2;
+    key1.MakeNewKey(true);
+    do {
+        key2.MakeNewKey(true);
+    } while (key2.GetPubKey()[1] != key1.GetPubKey()[1]);
+    CPubKey pubkey1 = key1.GetPubKey();
+    CPubKey pubkey2 = key2.GetPubKey();
+    CPubKey pubkey1U = pubkey1;
+    BOOST_CHECK(pubkey1U.Decompress());
+
+    uint256 hashMsg = GetRandHash();
+    std::vector<unsigned char> sig1, sig2;
+    BOOST_CHECK(key1.Sign(hashMsg, sig1));
+    BOOST_CHECK(key2.Sign(hashMsg, sig2));
+
+    for (int i = 0; i < 3; i++) {
+        BOOST_CHECK(pubkey1.Verify(hashMsg, sig1));
+        BOOST_CHECK(!pubkey2.Verify(hashMsg, sig1));
+        BOOST_CHECK(pubkey2.Verify(hashMsg, sig2));
+        BOOST_CHECK(!pubkey1.Verify(hashMsg, sig2));
+        BOOST_CHECK(pubkey1U.Verify(hashMsg, sig1));
+    }
+}
+
 BOOST_AUTO_TEST_CASE(zc_address_test)
 {
     KeyIO keyIO(Params());
@@ -0,0 +1,57 @@
+// Copyright (c) 2021 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "lrucache.h"
+
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(lrucache_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(lrucache_test)
+{
+    // create a cache capped at 3 items
+    lrucache<int, int> cache(3);
+    BOOST_CHECK_EQUAL(cache.max_size(), 3);
+    BOOST_CHECK(cache.empty());
+
+    cache.put(1, 10);
+    cache.put(2, 20);
+    cache.put(3, 30);
+    BOOST_CHECK_EQUAL(cache.size(), 3);
+
+    // looking up 1 makes 2 the least recently used item
+    int value = 0;
+    BOOST_CHECK(cache.get(1, value));
+    BOOST_CHECK_EQUAL(value, 10);
+
+    // so it is the one evicted to make room for 4
+    cache.put(4, 40);
+    BOOST_CHECK_EQUAL(cache.size(), 3);
+    BOOST_CHECK(!cache.get(2, value));
+    BOOST_CHECK(cache.get(3, value));
+    BOOST_CHECK(cache.get(4, value));
+    BOOST_CHECK(cache.get(1, value));
+
+    // replacing a value does not add an item
+    cache.put(3, 31);
+    BOOST_CHECK_EQUAL(cache.size(), 3);
+    BOOST_CHECK(cache.get(3, value));
+    BOOST_CHECK_EQUAL(value, 31);
+
+    // 4 is now the least recently used item
+    cache.put(5, 50);
+    BOOST_CHECK(!cache.get(4, value));
+
+    cache.erase(5);
+    BOOST_CHECK(!cache.get(5, value));
+    BOOST_CHECK_EQUAL(cache.size(), 2);
+
+    cache.clear();
+    BOOST_CHECK(cache.empty());
+    BOOST_CHECK(!cache.get(1, value));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
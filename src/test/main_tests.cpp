@@ -4,6 +4,7 @@
 
 #include "chainparams.h"
 #include "main.h"
+#include "txdb.h"
 
 #include "test/test_bitcoin.h"
 
@@ -123,4 +124,29 @@ BOOST_AUTO_TEST_CASE(test_combiner_all)
     BOOST_CHECK(Test());
 }
 
+BOOST_AUTO_TEST_CASE(trimmed_solution_test)
+{
+    const CBlock& genesis = Params().GenesisBlock();
+    uint256 hash = genesis.GetHash();
+    CBlockIndex index(genesis);
+    index.phashBlock = &hash;
+    BOOST_CHECK(index.HasSolution());
+
+    std::vector<std::pair<int, const CBlockFileInfo*> > vFiles;
+    std::vector<const CBlockIndex*> vBlocks = {&index};
+    BOOST_CHECK(pblocktree->WriteBatchSync(vFiles, 0, vBlocks));
+
+    // The trimmed solution is read back from the block index database.
+    index.TrimSolution();
+    BOOST_CHECK(!index.HasSolution());
+    BOOST_CHECK(index.GetSolution() == genesis.nSolution);
+    BOOST_CHECK(index.GetBlockHeader().GetHash() == hash);
+
+    // A solution that is neither in memory nor on disk cannot be read.
+    uint256 hashMissing;
+    CBlockIndex missing;
+    missing.phashBlock = &hashMissing;
+    BOOST_CHECK_THROW(missing.GetSolution(), std::runtime_error);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
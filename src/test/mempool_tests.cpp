@@ -2,8 +2,12 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or https://www.opensource.org/licenses/mit-license.php .
 
+#include "arith_uint256.h"
 #include "consensus/upgrades.h"
 #include "main.h"
+#include "policy/policy.h"
+#include "script/interpreter.h"
+#include "script/standard.h"
 #include "txmempool.h"
 #include "util.h"
 
@@ -157,6 +161,160 @@ BOOST_AUTO_TEST_CASE(MempoolIndexingTest)
     BOOST_CHECK(it == pool.mapTx.get<1>().end());
 }
 
+BOOST_AUTO_TEST_CASE(MempoolMiningScoreTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+    entry.hadNoDependencies = true;
+
+    CMutableTransaction tx1 = CMutableTransaction();
+    tx1.vout.resize(1);
+    tx1.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx1.vout[0].nValue = 10 * COIN;
+    pool.addUnchecked(tx1.GetHash(), entry.Fee(10000LL).FromTx(tx1));
+
+    CMutableTransaction tx2 = CMutableTransaction();
+    tx2.vout.resize(1);
+    tx2.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx2.vout[0].nValue = 2 * COIN;
+    pool.addUnchecked(tx2.GetHash(), entry.Fee(20000LL).FromTx(tx2));
+
+    // Prioritised before it enters the pool
+    CMutableTransaction tx3 = CMutableTransaction();
+    tx3.vout.resize(1);
+    tx3.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx3.vout[0].nValue = 5 * COIN;
+    pool.PrioritiseTransaction(tx3.GetHash(), tx3.GetHash().ToString(), 0.0, 15000LL);
+    pool.addUnchecked(tx3.GetHash(), entry.Fee(0LL).FromTx(tx3));
+
+    // The mining score index includes fee deltas: tx2, tx3, tx1
+    auto& index = pool.mapTx.get<mining_score>();
+    auto it = index.begin();
+    BOOST_CHECK_EQUAL(it++->GetTx().GetHash().ToString(), tx2.GetHash().ToString());
+    BOOST_CHECK_EQUAL(it++->GetTx().GetHash().ToString(), tx3.GetHash().ToString());
+    BOOST_CHECK_EQUAL(it++->GetTx().GetHash().ToString(), tx1.GetHash().ToString());
+    BOOST_CHECK(it == index.end());
+
+    // Prioritising a transaction in the pool moves it: tx1, tx2, tx3
+    pool.PrioritiseTransaction(tx1.GetHash(), tx1.GetHash().ToString(), 0.0, 20000LL);
+    it = index.begin();
+    BOOST_CHECK_EQUAL(it++->GetTx().GetHash().ToString(), tx1.GetHash().ToString());
+    BOOST_CHECK_EQUAL(it++->GetTx().GetHash().ToString(), tx2.GetHash().ToString());
+    BOOST_CHECK_EQUAL(it++->GetTx().GetHash().ToString(), tx3.GetHash().ToString());
+    BOOST_CHECK_EQUAL(pool.mapTx.find(tx1.GetHash())->GetModifiedFee(), 30000LL);
+
+    // Clearing the prioritisation restores the fee: tx2, tx3, tx1
+    pool.ClearPrioritisation(tx1.GetHash());
+    it = index.begin();
+    BOOST_CHECK_EQUAL(it++->GetTx().GetHash().ToString(), tx2.GetHash().ToString());
+    BOOST_CHECK_EQUAL(it++->GetTx().GetHash().ToString(), tx3.GetHash().ToString());
+    BOOST_CHECK_EQUAL(it++->GetTx().GetHash().ToString(), tx1.GetHash().ToString());
+}
+
+BOOST_AUTO_TEST_CASE(MempoolPackageTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+
+    // A chain tx1 <- tx2 <- tx3, and tx4 spending both tx1 and tx2
+    CMutableTransaction tx1 = CMutableTransaction();
+    tx1.vout.resize(2);
+    for (int i = 0; i < 2; i++) {
+        tx1.vout[i].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        tx1.vout[i].nValue = 10 * COIN;
+    }
+    CMutableTransaction tx2 = CMutableTransaction();
+    tx2.vin.resize(1);
+    tx2.vin[0].prevout = COutPoint(tx1.GetHash(), 0);
+    tx2.vin[0].scriptSig = CScript() << OP_11;
+    tx2.vout.resize(2);
+    for (int i = 0; i < 2; i++) {
+        tx2.vout[i].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        tx2.vout[i].nValue = 4 * COIN;
+    }
+    CMutableTransaction tx3 = CMutableTransaction();
+    tx3.vin.resize(1);
+    tx3.vin[0].prevout = COutPoint(tx2.GetHash(), 0);
+    tx3.vin[0].scriptSig = CScript() << OP_11;
+    tx3.vout.resize(1);
+    tx3.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx3.vout[0].nValue = 3 * COIN;
+    CMutableTransaction tx4 = CMutableTransaction();
+    tx4.vin.resize(2);
+    tx4.vin[0].prevout = COutPoint(tx1.GetHash(), 1);
+    tx4.vin[0].scriptSig = CScript() << OP_11;
+    tx4.vin[1].prevout = COutPoint(tx2.GetHash(), 1);
+    tx4.vin[1].scriptSig = CScript() << OP_11;
+    tx4.vout.resize(1);
+    tx4.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx4.vout[0].nValue = 13 * COIN;
+
+    pool.addUnchecked(tx1.GetHash(), entry.Fee(1000LL).FromTx(tx1));
+    pool.addUnchecked(tx2.GetHash(), entry.Fee(2000LL).FromTx(tx2));
+    pool.addUnchecked(tx3.GetHash(), entry.Fee(30000LL).FromTx(tx3));
+    pool.addUnchecked(tx4.GetHash(), entry.Fee(4000LL).FromTx(tx4));
+
+    uint64_t nSize1 = pool.mapTx.find(tx1.GetHash())->GetTxSize();
+    uint64_t nSize2 = pool.mapTx.find(tx2.GetHash())->GetTxSize();
+    uint64_t nSize3 = pool.mapTx.find(tx3.GetHash())->GetTxSize();
+    uint64_t nSize4 = pool.mapTx.find(tx4.GetHash())->GetTxSize();
+
+    auto e1 = pool.mapTx.find(tx1.GetHash());
+    BOOST_CHECK_EQUAL(e1->GetCountWithAncestors(), 1);
+    BOOST_CHECK_EQUAL(e1->GetCountWithDescendants(), 4);
+    BOOST_CHECK_EQUAL(e1->GetSizeWithDescendants(), nSize1 + nSize2 + nSize3 + nSize4);
+    BOOST_CHECK_EQUAL(e1->GetModFeesWithDescendants(), 37000LL);
+
+    auto e4 = pool.mapTx.find(tx4.GetHash());
+    BOOST_CHECK_EQUAL(e4->GetCountWithAncestors(), 3);
+    BOOST_CHECK_EQUAL(e4->GetSizeWithAncestors(), nSize1 + nSize2 + nSize4);
+    BOOST_CHECK_EQUAL(e4->GetModFeesWithAncestors(), 7000LL);
+    BOOST_CHECK_EQUAL(e4->GetCountWithDescendants(), 1);
+
+    // The child paying for its parents is first by ancestor fee rate
+    auto& index = pool.mapTx.get<ancestor_score>();
+    BOOST_CHECK_EQUAL(index.begin()->GetTx().GetHash().ToString(), tx3.GetHash().ToString());
+
+    // Fee deltas reach the aggregates of ancestors and descendants
+    pool.PrioritiseTransaction(tx2.GetHash(), tx2.GetHash().ToString(), 0.0, 500LL);
+    BOOST_CHECK_EQUAL(pool.mapTx.find(tx1.GetHash())->GetModFeesWithDescendants(), 37500LL);
+    BOOST_CHECK_EQUAL(pool.mapTx.find(tx3.GetHash())->GetModFeesWithAncestors(), 33500LL);
+    BOOST_CHECK_EQUAL(pool.mapTx.find(tx4.GetHash())->GetModFeesWithAncestors(), 7500LL);
+    pool.ClearPrioritisation(tx2.GetHash());
+    BOOST_CHECK_EQUAL(pool.mapTx.find(tx4.GetHash())->GetModFeesWithAncestors(), 7000LL);
+
+    // Removing tx1 as if it were mined leaves its descendants without it
+    std::list<CTransaction> removed;
+    pool.remove(tx1, removed, false);
+    BOOST_CHECK_EQUAL(removed.size(), 1);
+    auto e2 = pool.mapTx.find(tx2.GetHash());
+    BOOST_CHECK_EQUAL(e2->GetCountWithAncestors(), 1);
+    BOOST_CHECK_EQUAL(e2->GetSizeWithAncestors(), nSize2);
+    BOOST_CHECK_EQUAL(e2->GetCountWithDescendants(), 3);
+    e4 = pool.mapTx.find(tx4.GetHash());
+    BOOST_CHECK_EQUAL(e4->GetCountWithAncestors(), 2);
+    BOOST_CHECK_EQUAL(e4->GetModFeesWithAncestors(), 6000LL);
+
+    // Removing tx3 recursively only updates its ancestors
+    removed.clear();
+    pool.remove(tx3, removed, true);
+    BOOST_CHECK_EQUAL(removed.size(), 1);
+    e2 = pool.mapTx.find(tx2.GetHash());
+    BOOST_CHECK_EQUAL(e2->GetCountWithDescendants(), 2);
+    BOOST_CHECK_EQUAL(e2->GetSizeWithDescendants(), nSize2 + nSize4);
+    BOOST_CHECK_EQUAL(e2->GetModFeesWithDescendants(), 6000LL);
+
+    // Adding tx1 back, as when its block is disconnected, makes it an
+    // ancestor of the transactions already in the pool
+    pool.addUnchecked(tx1.GetHash(), entry.Fee(1000LL).FromTx(tx1));
+    e1 = pool.mapTx.find(tx1.GetHash());
+    BOOST_CHECK_EQUAL(e1->GetCountWithDescendants(), 3);
+    BOOST_CHECK_EQUAL(e1->GetModFeesWithDescendants(), 7000LL);
+    e4 = pool.mapTx.find(tx4.GetHash());
+    BOOST_CHECK_EQUAL(e4->GetCountWithAncestors(), 3);
+    BOOST_CHECK_EQUAL(e4->GetSizeWithAncestors(), nSize1 + nSize2 + nSize4);
+}
+
 BOOST_AUTO_TEST_CASE(RemoveWithoutBranchId) {
     CTxMemPool pool(CFeeRate(0));
     TestMemPoolEntryHelper entry;
@@ -212,6 +370,163 @@ BOOST_AUTO_TEST_CASE(RemoveWithoutBranchId) {
     BOOST_CHECK_EQUAL(pool.size(), 0);
 }
 
+BOOST_AUTO_TEST_CASE(RemoveForReorg) {
+    LOCK(cs_main);
+    CTxMemPool pool(CFeeRate(0));
+    CCoinsView coinsDummy;
+    CCoinsViewCache coins(&coinsDummy);
+    TestMemPoolEntryHelper entry;
+    entry.nFee = 10000LL;
+    entry.hadNoDependencies = true;
+    uint32_t nBranchId = NetworkUpgradeInfo[Consensus::UPGRADE_OVERWINTER].nBranchId;
+
+    uint256 sproutAnchorValid = uint256S("01");
+    uint256 sproutAnchorInvalid = uint256S("02");
+    uint256 saplingAnchorValid = uint256S("03");
+    uint256 saplingAnchorInvalid = uint256S("04");
+
+    // Sprout transactions, using either anchor
+    std::vector<CTransaction> vSproutTxs;
+    for (auto i = 0; i < 4; i++) {
+        CMutableTransaction tx = CMutableTransaction();
+        tx.vJoinSplit.resize(1);
+        tx.vJoinSplit[0].anchor = i % 2 ? sproutAnchorInvalid : sproutAnchorValid;
+        tx.vJoinSplit[0].nullifiers[0] = ArithToUint256(arith_uint256(2 * i + 1));
+        tx.vJoinSplit[0].nullifiers[1] = ArithToUint256(arith_uint256(2 * i + 2));
+        pool.addUnchecked(tx.GetHash(), entry.BranchId(nBranchId).FromTx(tx));
+        vSproutTxs.push_back(tx);
+    }
+
+    // Sapling transactions, using either anchor
+    std::vector<CTransaction> vSaplingTxs;
+    for (auto i = 0; i < 4; i++) {
+        CMutableTransaction tx = CMutableTransaction();
+        tx.vShieldedSpend.resize(1);
+        tx.vShieldedSpend[0].anchor = i % 2 ? saplingAnchorInvalid : saplingAnchorValid;
+        tx.vShieldedSpend[0].nullifier = ArithToUint256(arith_uint256(i + 100));
+        pool.addUnchecked(tx.GetHash(), entry.BranchId(nBranchId).FromTx(tx));
+        vSaplingTxs.push_back(tx);
+    }
+
+    // Transparent transactions validated against another branch
+    for (auto i = 1; i < 3; i++) {
+        CMutableTransaction tx = CMutableTransaction();
+        tx.vout.resize(1);
+        tx.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        tx.vout[0].nValue = i * COIN;
+        pool.addUnchecked(tx.GetHash(), entry.BranchId(NetworkUpgradeInfo[Consensus::BASE_SPROUT].nBranchId).FromTx(tx));
+    }
+    BOOST_CHECK_EQUAL(pool.size(), 10);
+
+    // Without invalid anchors, only the transactions of the other branch are removed
+    pool.removeForReorg(&coins, 1, STANDARD_LOCKTIME_VERIFY_FLAGS, {}, {}, nBranchId);
+    BOOST_CHECK_EQUAL(pool.size(), 8);
+
+    pool.removeForReorg(&coins, 1, STANDARD_LOCKTIME_VERIFY_FLAGS,
+                        {sproutAnchorInvalid}, {saplingAnchorInvalid}, nBranchId);
+    BOOST_CHECK_EQUAL(pool.size(), 4);
+    for (auto i = 0; i < 4; i++) {
+        BOOST_CHECK_EQUAL(pool.exists(vSproutTxs[i].GetHash()), i % 2 == 0);
+        BOOST_CHECK_EQUAL(pool.exists(vSaplingTxs[i].GetHash()), i % 2 == 0);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(LazyInsightIndexes) {
+    CCoinsView coinsDummy;
+    TestMemPoolEntryHelper entry;
+    entry.nFee = 10000LL;
+    CKeyID keyA(uint160(std::vector<unsigned char>(20, 0x0a)));
+    CKeyID keyB(uint160(std::vector<unsigned char>(20, 0x0b)));
+
+    // A parent paying to A and B, and a child spending the output to A
+    CMutableTransaction txParent;
+    txParent.vout.resize(2);
+    txParent.vout[0].scriptPubKey = GetScriptForDestination(keyA);
+    txParent.vout[0].nValue = 2 * COIN;
+    txParent.vout[1].scriptPubKey = GetScriptForDestination(keyB);
+    txParent.vout[1].nValue = 3 * COIN;
+    CMutableTransaction txChild;
+    txChild.vin.resize(1);
+    txChild.vin[0].prevout = COutPoint(txParent.GetHash(), 0);
+    txChild.vout.resize(1);
+    txChild.vout[0].scriptPubKey = GetScriptForDestination(keyB);
+    txChild.vout[0].nValue = COIN;
+
+    std::vector<std::pair<uint160, int>> addresses = {{keyA, CScript::P2PKH}, {keyB, CScript::P2PKH}};
+    for (bool fLazy : {false, true}) {
+        CTxMemPool pool(CFeeRate(0));
+        pool.setLazyInsightIndexes(fLazy);
+        CCoinsViewMemPool viewMemPool(&coinsDummy, pool);
+        CCoinsViewCache view(&viewMemPool);
+        for (CMutableTransaction* ptx : {&txParent, &txChild}) {
+            CTxMemPoolEntry poolEntry = entry.FromTx(*ptx);
+            pool.addUnchecked(ptx->GetHash(), poolEntry);
+            pool.addAddressIndex(poolEntry, view);
+            pool.addSpentIndex(poolEntry, view);
+        }
+
+        std::vector<std::pair<CMempoolAddressDeltaKey, CMempoolAddressDelta>> results;
+        pool.getAddressIndex(addresses, results, &coinsDummy);
+        BOOST_CHECK_EQUAL(results.size(), 4);
+        CAmount nBalance = 0;
+        for (const auto& result : results) {
+            nBalance += result.second.amount;
+        }
+        BOOST_CHECK_EQUAL(nBalance, 4 * COIN);
+
+        CSpentIndexValue value;
+        BOOST_CHECK(pool.getSpentIndex(CSpentIndexKey(txParent.GetHash(), 0), value, &coinsDummy));
+        BOOST_CHECK(value.txid == txChild.GetHash());
+        BOOST_CHECK_EQUAL(value.satoshis, 2 * COIN);
+        BOOST_CHECK(!pool.getSpentIndex(CSpentIndexKey(txParent.GetHash(), 1), value, &coinsDummy));
+
+        // Once built, the indexes are kept up to date
+        pool.removeAddressIndex(txChild.GetHash());
+        pool.removeSpentIndex(txChild.GetHash());
+        results.clear();
+        pool.getAddressIndex(addresses, results, &coinsDummy);
+        BOOST_CHECK_EQUAL(results.size(), 2);
+        BOOST_CHECK(!pool.getSpentIndex(CSpentIndexKey(txParent.GetHash(), 0), value, &coinsDummy));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(EntryTxData) {
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+
+    CMutableTransaction mtx;
+    mtx.vin.resize(1);
+    mtx.vin[0].scriptSig = CScript() << OP_11;
+    mtx.vout.resize(2);
+    mtx.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    mtx.vout[0].nValue = 10 * COIN;
+    mtx.vout[1].scriptPubKey = CScript() << OP_12 << OP_EQUAL;
+    mtx.vout[1].nValue = 5 * COIN;
+    CTransaction tx(mtx);
+
+    std::shared_ptr<const PrecomputedTransactionData> txdata;
+    size_t nTxSize = 0;
+    BOOST_CHECK(!pool.GetTxData(tx.GetHash(), txdata, nTxSize));
+
+    pool.addUnchecked(tx.GetHash(), entry.FromTx(mtx));
+    BOOST_CHECK(pool.GetTxData(tx.GetHash(), txdata, nTxSize));
+    BOOST_REQUIRE(txdata);
+    BOOST_CHECK_EQUAL(nTxSize, ::GetSerializeSize(tx, SER_DISK, CLIENT_VERSION));
+
+    // The midstates kept with the entry are those of the transaction
+    PrecomputedTransactionData expected(tx);
+    BOOST_CHECK(txdata->hashPrevouts == expected.hashPrevouts);
+    BOOST_CHECK(txdata->hashSequence == expected.hashSequence);
+    BOOST_CHECK(txdata->hashOutputs == expected.hashOutputs);
+    BOOST_CHECK(txdata->hashJoinSplits == expected.hashJoinSplits);
+    BOOST_CHECK(txdata->hashShieldedSpends == expected.hashShieldedSpends);
+    BOOST_CHECK(txdata->hashShieldedOutputs == expected.hashShieldedOutputs);
+
+    std::list<CTransaction> removed;
+    pool.remove(tx, removed, false);
+    BOOST_CHECK(!pool.GetTxData(tx.GetHash(), txdata, nTxSize));
+}
+
 // Test that nCheckFrequency is set correctly when calling setSanityCheck().
 // https://github.com/zcash/zcash/issues/3134
 BOOST_AUTO_TEST_CASE(SetSanityCheck) {
@@ -222,4 +537,45 @@ BOOST_AUTO_TEST_CASE(SetSanityCheck) {
     BOOST_CHECK_EQUAL(pool.GetCheckFrequency(), 0);
 }
 
+BOOST_AUTO_TEST_CASE(MempoolEventLog) {
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+
+    CMutableTransaction tx1 = CMutableTransaction();
+    tx1.vout.resize(1);
+    tx1.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx1.vout[0].nValue = 10 * COIN;
+    CMutableTransaction tx2 = tx1;
+    tx2.vout[0].nValue = 20 * COIN;
+
+    BOOST_CHECK_EQUAL(pool.GetEventSequence(), 0);
+    pool.addUnchecked(tx1.GetHash(), entry.FromTx(tx1));
+    pool.addUnchecked(tx2.GetHash(), entry.FromTx(tx2));
+    std::list<CTransaction> removed;
+    pool.remove(tx1, removed);
+    BOOST_CHECK_EQUAL(pool.GetEventSequence(), 3);
+
+    std::vector<CMempoolEvent> events;
+    BOOST_CHECK(pool.GetEventsSince(0, events));
+    BOOST_CHECK_EQUAL(events.size(), 3);
+    BOOST_CHECK(events[0].txid == tx1.GetHash() && events[0].fAdded && events[0].nSequence == 1);
+    BOOST_CHECK(events[1].txid == tx2.GetHash() && events[1].fAdded && events[1].nSequence == 2);
+    BOOST_CHECK(events[2].txid == tx1.GetHash() && !events[2].fAdded && events[2].nSequence == 3);
+
+    events.clear();
+    BOOST_CHECK(pool.GetEventsSince(2, events));
+    BOOST_CHECK_EQUAL(events.size(), 1);
+    events.clear();
+    BOOST_CHECK(pool.GetEventsSince(3, events));
+    BOOST_CHECK(events.empty());
+    BOOST_CHECK(!pool.GetEventsSince(4, events));
+
+    // Clearing the pool is not logged, so earlier sequence numbers are no
+    // longer enough to catch up.
+    pool.clear();
+    BOOST_CHECK(!pool.GetEventsSince(3, events));
+    BOOST_CHECK(events.empty());
+    BOOST_CHECK(pool.GetEventsSince(pool.GetEventSequence(), events));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,59 @@
+// Copyright (c) 2021 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "consensus/merkle.h"
+#include "test_random.h"
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(merkle_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(merkle_root_matches_tree)
+{
+    seed_insecure_rand(false);
+
+    for (int nTx = 0; nTx < 40; nTx++) {
+        // Check the plain block, one with its last transaction repeated (the
+        // CVE-2012-2459 mutation), and one with its last two repeated.
+        for (int nDup = 0; nDup < 3; nDup++) {
+            if (nTx < nDup) continue;
+
+            CBlock block;
+            for (int j = 0; j < nTx; j++) {
+                CMutableTransaction tx;
+                tx.nLockTime = insecure_rand();
+                block.vtx.push_back(CTransaction(tx));
+            }
+            for (int j = 0; j < nDup; j++) {
+                block.vtx.push_back(block.vtx[nTx - nDup + j]);
+            }
+
+            bool fTreeMutated = false;
+            uint256 treeRoot = block.BuildMerkleTree(&fTreeMutated);
+
+            bool fMutated = false;
+            BOOST_CHECK_EQUAL(BlockMerkleRoot(block, &fMutated).ToString(), treeRoot.ToString());
+            BOOST_CHECK_EQUAL(fMutated, fTreeMutated);
+
+            std::vector<uint256> leaves;
+            for (const CTransaction& tx : block.vtx) {
+                leaves.push_back(tx.GetHash());
+            }
+            BOOST_CHECK_EQUAL(ComputeMerkleRoot(leaves).ToString(), treeRoot.ToString());
+
+            if (nDup > 0) {
+                // Whenever repeating the last transactions leaves the root
+                // unchanged, the repetition has to be detected.
+                CBlock original;
+                original.vtx.assign(block.vtx.begin(), block.vtx.begin() + nTx);
+                if (BlockMerkleRoot(original) == treeRoot) {
+                    BOOST_CHECK(fMutated);
+                }
+            }
+        }
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -222,5 +222,52 @@ BOOST_DATA_TEST_CASE(multisig_Sign, boost::unit_test::data::xrange(static_cast<i
     }
 }
 
+// Signing every input against the unsigned transaction, with the signature
+// hash components computed once, as signrawtransaction does, gives a
+// transaction that verifies.
+BOOST_DATA_TEST_CASE(multisig_SignPrecomputed, boost::unit_test::data::xrange(static_cast<int>(Consensus::MAX_NETWORK_UPGRADES)))
+{
+    uint32_t consensusBranchId = NetworkUpgradeInfo[sample].nBranchId;
+
+    CBasicKeyStore keystore;
+    CKey key[3];
+    for (int i = 0; i < 3; i++)
+    {
+        key[i].MakeNewKey(true);
+        keystore.AddKey(key[i]);
+    }
+
+    CMutableTransaction txFrom;
+    txFrom.vout.resize(2);
+    txFrom.vout[0].scriptPubKey << OP_2 << ToByteVector(key[0].GetPubKey()) << ToByteVector(key[1].GetPubKey()) << OP_2 << OP_CHECKMULTISIG;
+    txFrom.vout[0].nValue = 10;
+    txFrom.vout[1].scriptPubKey = GetScriptForDestination(key[2].GetPubKey().GetID());
+    txFrom.vout[1].nValue = 20;
+
+    CMutableTransaction txTo;
+    txTo.vin.resize(2);
+    txTo.vout.resize(1);
+    for (int i = 0; i < 2; i++)
+    {
+        txTo.vin[i].prevout.n = i;
+        txTo.vin[i].prevout.hash = txFrom.GetHash();
+    }
+    txTo.vout[0].nValue = 25;
+
+    const CTransaction txConst(txTo);
+    const PrecomputedTransactionData txdata(txConst);
+    for (int i = 0; i < 2; i++)
+    {
+        SignatureData sigdata;
+        BOOST_CHECK(ProduceSignature(TransactionSignatureCreator(&keystore, &txConst, i, txFrom.vout[i].nValue, txdata), txFrom.vout[i].scriptPubKey, sigdata, consensusBranchId));
+        UpdateTransaction(txTo, i, sigdata);
+    }
+    for (int i = 0; i < 2; i++)
+    {
+        ScriptError serror;
+        BOOST_CHECK_MESSAGE(VerifyScript(txTo.vin[i].scriptSig, txFrom.vout[i].scriptPubKey, STANDARD_SCRIPT_VERIFY_FLAGS,
+            MutableTransactionSignatureChecker(&txTo, i, txFrom.vout[i].nValue), consensusBranchId, &serror), strprintf("VerifyScript %d", i));
+    }
+}
 
 BOOST_AUTO_TEST_SUITE_END()
@@ -133,4 +133,32 @@ BOOST_AUTO_TEST_CASE(caddrdb_read_corrupted)
     BOOST_CHECK(addrman2.size() == 0);
 }
 
+BOOST_AUTO_TEST_CASE(token_bucket)
+{
+    CTokenBucket bucket;
+    int64_t nNow = GetTimeMicros();
+
+    // Without a rate there is no limit.
+    BOOST_CHECK(!bucket.IsLimited());
+    bucket.Consume(1000000, nNow);
+    BOOST_CHECK_EQUAL(bucket.TimeUntilAvailable(nNow), 0);
+
+    // The bucket starts full, and may be taken into debt.
+    bucket.SetRate(1000);
+    BOOST_CHECK(bucket.IsLimited());
+    nNow = GetTimeMicros();
+    BOOST_CHECK_EQUAL(bucket.TimeUntilAvailable(nNow), 0);
+    bucket.Consume(3000, nNow);
+    // 2000 bytes of debt take two seconds to repay.
+    BOOST_CHECK_EQUAL(bucket.TimeUntilAvailable(nNow), 2000000);
+    BOOST_CHECK_EQUAL(bucket.TimeUntilAvailable(nNow + 1000000), 1000000);
+    BOOST_CHECK_EQUAL(bucket.TimeUntilAvailable(nNow + 2000000), 0);
+
+    // It holds at most one second's worth.
+    nNow += 60 * 1000000;
+    BOOST_CHECK_EQUAL(bucket.TimeUntilAvailable(nNow), 0);
+    bucket.Consume(2000, nNow);
+    BOOST_CHECK_EQUAL(bucket.TimeUntilAvailable(nNow), 1000000);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -171,6 +171,37 @@ public:
         test();
     }
 
+    void move() {
+        real_vector = std::move(real_vector_alt);
+        real_vector_alt.clear();
+        pre_vector = std::move(pre_vector_alt);
+        pre_vector_alt.clear();
+        test();
+    }
+
+    void copy() {
+        real_vector = real_vector_alt;
+        pre_vector = pre_vector_alt;
+        test();
+    }
+
+    void resize_uninitialized(realtype values) {
+        size_t r = values.size();
+        size_t s = real_vector.size() / 2;
+        real_vector.resize(s);
+        pre_vector.resize_uninitialized(s);
+        for (auto v : values) {
+            real_vector.push_back(v);
+        }
+        auto p = pre_vector.size();
+        pre_vector.resize_uninitialized(p + r);
+        for (auto v : values) {
+            pre_vector[p] = v;
+            ++p;
+        }
+        test();
+    }
+
     ~prevector_tester() {
         BOOST_CHECK_MESSAGE(passed, "insecure_rand: " + rand_seed.ToString());
     }
@@ -244,6 +275,20 @@ BOOST_AUTO_TEST_CASE(PrevectorTestInt)
             if (((r >> 15) % 64) == 3) {
                 test.swap();
             }
+            if (((r >> 15) % 64) == 4) {
+                test.move();
+            }
+            if (((r >> 15) % 64) == 5) {
+                test.copy();
+            }
+            if (((r >> 15) % 32) == 6) {
+                int num = 1 + (insecure_rand() % 15);
+                std::vector<int> values(num);
+                for (auto& v : values) {
+                    v = insecure_rand();
+                }
+                test.resize_uninitialized(values);
+            }
         }
     }
 }
@@ -9,6 +9,7 @@
 #include "key_io.h"
 #include "main.h"
 #include "netbase.h"
+#include "txdb.h"
 #include "utilstrencodings.h"
 
 #include "test/test_bitcoin.h"
@@ -162,6 +163,133 @@ BOOST_AUTO_TEST_CASE(rpc_parse_monetary_values)
     BOOST_CHECK_THROW(AmountFromValue(ValueFromString("93e+9")), UniValue); //overflow error
 }
 
+BOOST_AUTO_TEST_CASE(rpc_stream_writer)
+{
+    UniValue inner(UniValue::VARR);
+    inner.push_back(1);
+    inner.push_back("two \"quoted\"");
+    inner.push_back(UniValue(UniValue::VOBJ));
+    inner.push_back(UniValue(UniValue::VARR));
+    UniValue obj(UniValue::VOBJ);
+    obj.pushKV("a", inner);
+    obj.pushKV("key\nwith escapes", NullUniValue);
+    obj.pushKV("b", 1.5);
+
+    // Small chunks check that no text is lost or reordered between them.
+    std::string written;
+    size_t nChunks = 0;
+    JSONStreamWriter out([&](const char* data, size_t len) {
+        written.append(data, len);
+        nChunks++;
+    }, 7);
+    out.BeginObject();
+    out.Key("a");
+    out.BeginArray();
+    for (const UniValue& v : inner.getValues()) {
+        out.Value(v);
+    }
+    out.EndArray();
+    out.KV("key\nwith escapes", NullUniValue);
+    out.KV("b", 1.5);
+    out.EndObject();
+    out.Flush();
+    BOOST_CHECK_EQUAL(written, obj.write());
+    BOOST_CHECK(nChunks > 1);
+
+    // A streamed reply matches JSONRPCReply.
+    written.clear();
+    JSONStreamWriter reply([&](const char* data, size_t len) {
+        written.append(data, len);
+    });
+    JSONRPCStreamReply(reply, [&](JSONStreamWriter& out) { out.Value(obj); }, UniValue(3));
+    BOOST_CHECK_EQUAL(written, JSONRPCReply(obj, NullUniValue, UniValue(3)));
+}
+
+BOOST_AUTO_TEST_CASE(rpc_stream_commands)
+{
+    for (int verbosity = 0; verbosity <= 2; verbosity++) {
+        UniValue params(UniValue::VARR);
+        params.push_back("0");
+        params.push_back(verbosity);
+        std::string written;
+        JSONStreamWriter out([&](const char* data, size_t len) {
+            written.append(data, len);
+        });
+        tableRPC.executeStream("getblock", params, out);
+        out.Flush();
+        BOOST_CHECK_EQUAL(written, tableRPC.execute("getblock", params).write());
+    }
+
+    for (bool fVerbose : {false, true}) {
+        UniValue params(UniValue::VARR);
+        params.push_back(fVerbose);
+        std::string written;
+        JSONStreamWriter out([&](const char* data, size_t len) {
+            written.append(data, len);
+        });
+        tableRPC.executeStream("getrawmempool", params, out);
+        out.Flush();
+        BOOST_CHECK_EQUAL(written, tableRPC.execute("getrawmempool", params).write());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(rpc_binary_commands)
+{
+    // The binary form of a hex result is the same data.
+    UniValue params(UniValue::VARR);
+    params.push_back("0");
+    params.push_back(0);
+    std::string binary;
+    BOOST_CHECK(tableRPC.executeBinary("getblock", params, binary));
+    BOOST_CHECK_EQUAL(HexStr(binary.begin(), binary.end()),
+                      tableRPC.execute("getblock", params).get_str());
+
+    // JSON results have no binary form.
+    params.setArray();
+    params.push_back("0");
+    params.push_back(1);
+    binary.clear();
+    BOOST_CHECK(!tableRPC.executeBinary("getblock", params, binary));
+    BOOST_CHECK(binary.empty());
+    BOOST_CHECK(!tableRPC.executeBinary("getbestblockhash", UniValue(UniValue::VARR), binary));
+
+    // Errors are reported as for JSON requests.
+    params.setArray();
+    params.push_back("0000000000000000000000000000000000000000000000000000000000000000");
+    BOOST_CHECK_THROW(tableRPC.executeBinary("getrawtransaction", params, binary), UniValue);
+}
+
+BOOST_AUTO_TEST_CASE(rpc_batch_parallel)
+{
+    UniValue batch(UniValue::VARR);
+    for (int i = 0; i < 100; i++) {
+        UniValue req(UniValue::VOBJ);
+        req.pushKV("id", i);
+        req.pushKV("method", i % 3 == 0 ? "getblockcount" : i % 3 == 1 ? "getbestblockhash" : "nosuchmethod");
+        req.pushKV("params", UniValue(UniValue::VARR));
+        batch.push_back(req);
+    }
+
+    // The replies are in the order of the requests, however many threads
+    // run them.
+    UniValue expected;
+    BOOST_CHECK(expected.read(JSONRPCExecBatch(batch)));
+    int nThreadsSaved = nRPCBatchThreads;
+    for (int nThreads : {2, 4, MAX_RPC_BATCH_THREADS}) {
+        nRPCBatchThreads = nThreads;
+        UniValue replies;
+        BOOST_CHECK(replies.read(JSONRPCExecBatch(batch)));
+        BOOST_CHECK_EQUAL(replies.write(), expected.write());
+    }
+    nRPCBatchThreads = nThreadsSaved;
+
+    BOOST_REQUIRE_EQUAL(expected.size(), 100);
+    for (int i = 0; i < 100; i++) {
+        BOOST_CHECK_EQUAL(find_value(expected[i], "id").get_int(), i);
+        BOOST_CHECK_EQUAL(find_value(expected[i], "error").isNull(), i % 3 != 2);
+    }
+}
+
 BOOST_AUTO_TEST_CASE(json_parse_errors)
 {
     // Valid
@@ -371,6 +499,12 @@ BOOST_AUTO_TEST_CASE(rpc_insightexplorer)
     CheckRPCThrows("getaddressdeltas {\"addresses\":[],\"start\":2,\"end\":3,\"chainInfo\":true}",
         "Start or end is outside chain range");
 
+    BOOST_CHECK_NO_THROW(CallRPC("getaddressdeltas {\"addresses\":[],\"limit\":10}"));
+    CheckRPCThrows("getaddressdeltas {\"addresses\":[],\"limit\":0}",
+        "Limit is expected to be greater than zero");
+    CheckRPCThrows("getaddressdeltas {\"addresses\":[],\"cursor\":\"00\"}",
+        "Invalid cursor");
+
     BOOST_CHECK_NO_THROW(CallRPC("getaddressbalance {\"addresses\":[]}"));
 
     BOOST_CHECK_NO_THROW(CallRPC("getaddresstxids {\"addresses\":[]}"));
@@ -412,4 +546,41 @@ BOOST_AUTO_TEST_CASE(rpc_insightexplorer)
     fTimestampIndex = false;
 }
 
+BOOST_AUTO_TEST_CASE(rpc_addressindex_balances)
+{
+    uint160 hash(ParseHex("0102030405060708090a0b0c0d0e0f1011121314"));
+    int type = CScript::P2PKH;
+    auto entry = [&](int height, size_t index, CAmount value) {
+        return std::make_pair(CAddressIndexKey(type, hash, height, 0, uint256(), index, value < 0), value);
+    };
+    std::vector<CAddressIndexDbEntry> block1 = {entry(1, 0, 500), entry(1, 1, 200)};
+    std::vector<CAddressIndexDbEntry> block2 = {entry(2, 0, -500), entry(2, 1, 100)};
+
+    BOOST_CHECK(pblocktree->WriteAddressIndex(block1, true));
+    BOOST_CHECK(pblocktree->WriteAddressIndex(block2, true));
+    CAddressBalanceValue value;
+    BOOST_CHECK(pblocktree->ReadAddressBalance(hash, type, value));
+    BOOST_CHECK_EQUAL(value.balance, 300);
+    BOOST_CHECK_EQUAL(value.received, 800);
+
+    // Read the history a page at a time.
+    std::vector<CAddressIndexDbEntry> page;
+    BOOST_CHECK(pblocktree->ReadAddressIndex(hash, type, page, 0, 0, nullptr, 3));
+    BOOST_CHECK_EQUAL(page.size(), 3);
+    CAddressIndexKey after = page.back().first;
+    page.clear();
+    BOOST_CHECK(pblocktree->ReadAddressIndex(hash, type, page, 0, 0, &after, 3));
+    BOOST_CHECK_EQUAL(page.size(), 1);
+    BOOST_CHECK_EQUAL(page[0].first.blockHeight, 2);
+
+    // Disconnecting the blocks takes their deltas off again.
+    BOOST_CHECK(pblocktree->EraseAddressIndex(block2, true));
+    BOOST_CHECK(pblocktree->ReadAddressBalance(hash, type, value));
+    BOOST_CHECK_EQUAL(value.balance, 700);
+    BOOST_CHECK_EQUAL(value.received, 700);
+    BOOST_CHECK(pblocktree->EraseAddressIndex(block1, true));
+    BOOST_CHECK(pblocktree->ReadAddressBalance(hash, type, value));
+    BOOST_CHECK(value.IsNull());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
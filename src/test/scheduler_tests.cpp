@@ -107,4 +107,98 @@ BOOST_AUTO_TEST_CASE(manythreads)
     BOOST_CHECK_EQUAL(counterSum, 200);
 }
 
+static void RecordTask(boost::mutex& mutex, std::vector<int>& order, int n)
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    order.push_back(n);
+}
+
+BOOST_AUTO_TEST_CASE(priorities)
+{
+    // Due tasks run highest priority first, and in time order within a
+    // priority.
+    CScheduler scheduler;
+    boost::mutex mutex;
+    std::vector<int> order;
+    boost::chrono::system_clock::time_point now = boost::chrono::system_clock::now();
+    scheduler.schedule(boost::bind(&RecordTask, boost::ref(mutex), boost::ref(order), 5), now - boost::chrono::seconds(3), CScheduler::PRIORITY_LOW);
+    scheduler.schedule(boost::bind(&RecordTask, boost::ref(mutex), boost::ref(order), 3), now - boost::chrono::seconds(2), CScheduler::PRIORITY_NORMAL);
+    scheduler.schedule(boost::bind(&RecordTask, boost::ref(mutex), boost::ref(order), 1), now - boost::chrono::seconds(1), CScheduler::PRIORITY_HIGH);
+    scheduler.schedule(boost::bind(&RecordTask, boost::ref(mutex), boost::ref(order), 4), now - boost::chrono::seconds(1), CScheduler::PRIORITY_NORMAL);
+    scheduler.schedule(boost::bind(&RecordTask, boost::ref(mutex), boost::ref(order), 2), now, CScheduler::PRIORITY_HIGH);
+
+    scheduler.stop(true);
+    boost::thread thread(boost::bind(&CScheduler::serviceQueue, &scheduler));
+    thread.join();
+
+    BOOST_CHECK(order == std::vector<int>({1, 2, 3, 4, 5}));
+    BOOST_CHECK_EQUAL(scheduler.getStats(CScheduler::PRIORITY_HIGH).nTasks, 2);
+    BOOST_CHECK_EQUAL(scheduler.getStats(CScheduler::PRIORITY_NORMAL).nTasks, 2);
+    BOOST_CHECK_EQUAL(scheduler.getStats(CScheduler::PRIORITY_LOW).nTasks, 1);
+    // The low priority task was scheduled three seconds ago.
+    BOOST_CHECK_EQUAL(scheduler.getStats(CScheduler::PRIORITY_LOW).nOverruns, 1);
+    BOOST_CHECK(scheduler.getStats(CScheduler::PRIORITY_LOW).nLatencyMicros >= 3000000);
+}
+
+static void WaitForRelease(boost::mutex& mutex, boost::condition_variable& cond, bool& fStarted, bool& fReleased)
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    fStarted = true;
+    cond.notify_all();
+    while (!fReleased) {
+        cond.wait(lock);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(low_priority_thread_limit)
+{
+    // With two threads, a long low priority task does not keep a normal
+    // priority task from running, and a second low priority task waits for
+    // the first one.
+    CScheduler scheduler;
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    bool fStarted = false;
+    bool fReleased = false;
+    std::vector<int> order;
+
+    boost::thread_group threads;
+    for (int i = 0; i < 2; i++)
+        threads.create_thread(boost::bind(&CScheduler::serviceQueue, &scheduler));
+
+    boost::chrono::system_clock::time_point now = boost::chrono::system_clock::now();
+    scheduler.schedule(boost::bind(&WaitForRelease, boost::ref(mutex), boost::ref(cond), boost::ref(fStarted), boost::ref(fReleased)),
+                       now, CScheduler::PRIORITY_LOW);
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (!fStarted) {
+            cond.wait(lock);
+        }
+    }
+    scheduler.schedule(boost::bind(&RecordTask, boost::ref(mutex), boost::ref(order), 2), now, CScheduler::PRIORITY_LOW);
+    scheduler.schedule(boost::bind(&RecordTask, boost::ref(mutex), boost::ref(order), 1), now, CScheduler::PRIORITY_NORMAL);
+
+    // The normal priority task runs while the first low priority task is
+    // still running, but the second one does not.
+    for (int i = 0; i < 1000; i++) {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            if (!order.empty())
+                break;
+        }
+        MicroSleep(1000);
+    }
+    MicroSleep(10000);
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        BOOST_CHECK(order == std::vector<int>({1}));
+        fReleased = true;
+        cond.notify_all();
+    }
+
+    scheduler.stop(true);
+    threads.join_all();
+    BOOST_CHECK(order == std::vector<int>({1, 2}));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -91,6 +91,21 @@ void DoTest(const CScript& scriptPubKey, const CScript& scriptSig, int flags, ui
         0, flags,
         consensusBranchId,
         NULL) == expect,message);
+
+    zcash_script_error serr;
+    void* preTx = zcash_script_new_precomputed_tx((const unsigned char*)&stream[0], stream.size(), &serr);
+    BOOST_CHECK_EQUAL(serr, zcash_script_ERR_OK);
+    zcash_script_spent_output spent = {begin_ptr(scriptPubKey), (unsigned int)scriptPubKey.size(), txCredit.vout[0].nValue};
+    BOOST_CHECK_MESSAGE(zcash_script_verify_all_precomputed(preTx, &spent, 1, flags, consensusBranchId, 2, NULL) == expect, message);
+    // The second verification finds the signatures in the cache.
+    zcash_script_init_signature_cache(1 << 20);
+    for (int i = 0; i < 2; i++) {
+        BOOST_CHECK_MESSAGE(zcash_script_verify_all_precomputed(preTx, &spent, 1, flags, consensusBranchId, 1, NULL) == expect, message);
+    }
+    zcash_script_init_signature_cache(0);
+    BOOST_CHECK_EQUAL(zcash_script_verify_all_precomputed(preTx, &spent, 2, flags, consensusBranchId, 1, &serr), 0);
+    BOOST_CHECK_EQUAL(serr, zcash_script_ERR_SPENT_OUTPUTS_MISMATCH);
+    zcash_script_free_precomputed_tx(preTx);
 #endif
 }
 
@@ -332,4 +332,40 @@ BOOST_AUTO_TEST_CASE(sighash_from_data)
         BOOST_CHECK_MESSAGE(sh.GetHex() == sigHashHex, strTest);
     }
 }
+// Deserializing from memory takes the txid and size from the bytes that were
+// read, which must be the same as those of the transaction serialized again.
+BOOST_AUTO_TEST_CASE(txid_from_memory)
+{
+    for (int i = 0; i < 1000; i++) {
+        uint32_t consensusBranchId = NetworkUpgradeInfo[insecure_rand() % Consensus::MAX_NETWORK_UPGRADES].nBranchId;
+        CMutableTransaction mtx;
+        RandomTransaction(mtx, false, consensusBranchId);
+        CTransaction expected(mtx);
+
+        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+        ss << expected;
+        size_t nSize = ss.size();
+        BOOST_CHECK_EQUAL(::GetSerializeSize(mtx, SER_NETWORK, PROTOCOL_VERSION), nSize);
+        BOOST_CHECK_EQUAL(::GetSerializeSize(expected, SER_DISK, CLIENT_VERSION), nSize);
+
+        CMemoryReader reader(SER_NETWORK, PROTOCOL_VERSION, &ss[0], &ss[0] + ss.size());
+        CTransaction tx;
+        reader >> tx;
+        BOOST_CHECK(reader.empty());
+        BOOST_CHECK_EQUAL(tx.GetHash().GetHex(), expected.GetHash().GetHex());
+        BOOST_CHECK_EQUAL(::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION), nSize);
+
+        CTransaction txStream;
+        ss >> txStream;
+        BOOST_CHECK_EQUAL(txStream.GetHash().GetHex(), expected.GetHash().GetHex());
+        BOOST_CHECK_EQUAL(::GetSerializeSize(txStream, SER_NETWORK, PROTOCOL_VERSION), nSize);
+
+        CTransaction txAssigned;
+        BOOST_CHECK_EQUAL(::GetSerializeSize(txAssigned, SER_NETWORK, PROTOCOL_VERSION),
+                          ::GetSerializeSize(CMutableTransaction(), SER_NETWORK, PROTOCOL_VERSION));
+        txAssigned = tx;
+        BOOST_CHECK_EQUAL(::GetSerializeSize(txAssigned, SER_NETWORK, PROTOCOL_VERSION), nSize);
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
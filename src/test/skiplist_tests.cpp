@@ -100,4 +100,74 @@ BOOST_AUTO_TEST_CASE(getlocator_test)
     }
 }
 
+BOOST_AUTO_TEST_CASE(atomictip_test)
+{
+    std::vector<uint256> vHash(100);
+    std::vector<CBlockIndex> vBlocks(100);
+    for (unsigned int i=0; i<vBlocks.size(); i++) {
+        vHash[i] = ArithToUint256(i);
+        vBlocks[i].nHeight = i;
+        vBlocks[i].pprev = i ? &vBlocks[i - 1] : NULL;
+        vBlocks[i].phashBlock = &vHash[i];
+        vBlocks[i].BuildSkip();
+    }
+
+    CChain chain;
+    BOOST_CHECK(chain.AtomicTip() == NULL);
+
+    // The published tip follows the tip through extensions and rewinds.
+    chain.SetTip(&vBlocks[99]);
+    BOOST_CHECK(chain.AtomicTip() == chain.Tip());
+    BOOST_CHECK(chain.AtomicTip() == &vBlocks[99]);
+    chain.SetTip(&vBlocks[49]);
+    BOOST_CHECK(chain.AtomicTip() == &vBlocks[49]);
+    BOOST_CHECK_EQUAL(chain.AtomicTip()->GetAncestor(10), chain[10]);
+
+    chain.SetTip(NULL);
+    BOOST_CHECK(chain.AtomicTip() == NULL);
+}
+
+BOOST_AUTO_TEST_CASE(findfork_test)
+{
+    // A main chain of 10000 blocks, and a branch of 5000 blocks off block 2999.
+    std::vector<CBlockIndex> vBlocksMain(10000);
+    for (unsigned int i=0; i<vBlocksMain.size(); i++) {
+        vBlocksMain[i].nHeight = i;
+        vBlocksMain[i].pprev = i ? &vBlocksMain[i - 1] : NULL;
+        vBlocksMain[i].BuildSkip();
+    }
+    std::vector<CBlockIndex> vBlocksSide(5000);
+    for (unsigned int i=0; i<vBlocksSide.size(); i++) {
+        vBlocksSide[i].nHeight = i + 3000;
+        vBlocksSide[i].pprev = i ? &vBlocksSide[i - 1] : &vBlocksMain[2999];
+        vBlocksSide[i].BuildSkip();
+    }
+
+    CChain chain;
+    chain.SetTip(&vBlocksMain.back());
+
+    for (int n=0; n<100; n++) {
+        int r = insecure_rand() % vBlocksMain.size();
+        BOOST_CHECK(chain.FindFork(&vBlocksMain[r]) == &vBlocksMain[r]);
+        int s = insecure_rand() % vBlocksSide.size();
+        BOOST_CHECK(chain.FindFork(&vBlocksSide[s]) == &vBlocksMain[2999]);
+        BOOST_CHECK(LastCommonAncestor(&vBlocksMain[r], &vBlocksSide[s]) == &vBlocksMain[std::min(r, 2999)]);
+        BOOST_CHECK(LastCommonAncestor(&vBlocksSide[s], &vBlocksSide[n]) == &vBlocksSide[std::min(s, n)]);
+
+        // The lock-free lookups agree with the chain.
+        BOOST_CHECK(chain.AtomicAt(r) == chain[r]);
+        BOOST_CHECK(chain.AtomicContains(&vBlocksMain[r]));
+        BOOST_CHECK(!chain.AtomicContains(&vBlocksSide[s]));
+    }
+    BOOST_CHECK(chain.AtomicAt(-1) == NULL);
+    BOOST_CHECK(chain.AtomicAt(vBlocksMain.size()) == NULL);
+
+    // Once the chain switches to the branch, the fork point is the same.
+    chain.SetTip(&vBlocksSide.back());
+    BOOST_CHECK(chain.FindFork(&vBlocksMain.back()) == &vBlocksMain[2999]);
+    BOOST_CHECK(chain.AtomicAt(5000) == &vBlocksSide[2000]);
+    BOOST_CHECK(chain.AtomicContains(&vBlocksMain[2999]));
+    BOOST_CHECK(!chain.AtomicContains(&vBlocksMain[3000]));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -254,4 +254,29 @@ BOOST_AUTO_TEST_CASE(streams_buffered_file_rand)
     fs::remove("streams_test_tmp");
 }
 
+BOOST_AUTO_TEST_CASE(streams_memory_reader)
+{
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    uint32_t a = 0x01020304;
+    std::vector<unsigned char> v = {5, 6, 7};
+    ss << a << v << uint8_t(8);
+
+    CMemoryReader reader(SER_DISK, CLIENT_VERSION, &ss[0], &ss[0] + ss.size());
+    BOOST_CHECK_EQUAL(reader.size(), ss.size());
+    uint32_t a2;
+    std::vector<unsigned char> v2;
+    reader >> a2 >> v2;
+    BOOST_CHECK_EQUAL(a2, a);
+    BOOST_CHECK(v2 == v);
+    BOOST_CHECK_EQUAL(reader.size(), 1);
+
+    // Reading past the end throws, and leaves the stream unchanged.
+    uint16_t b;
+    BOOST_CHECK_THROW(reader >> b, std::ios_base::failure);
+    BOOST_CHECK_EQUAL(reader.size(), 1);
+    reader.ignore(1);
+    BOOST_CHECK(reader.empty());
+    BOOST_CHECK_THROW(reader.ignore(1), std::ios_base::failure);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -12,6 +12,7 @@
 #ifdef ENABLE_MINING
 #include "crypto/equihash.h"
 #endif
+#include "crypto/sha256.h"
 #include "fs.h"
 #include "key.h"
 #include "main.h"
@@ -22,6 +23,7 @@
 #include "txmempool.h"
 #include "ui_interface.h"
 #include "rpc/server.h"
+#include "script/sigcache.h"
 #include "rpc/register.h"
 
 #include <boost/test/unit_test.hpp>
@@ -60,7 +62,10 @@ JoinSplitTestingSetup::JoinSplitTestingSetup(const std::string& chainName) : Bas
         reinterpret_cast<const codeunit*>(sapling_output_str.c_str()),
         sapling_output_str.length(),
         reinterpret_cast<const codeunit*>(sprout_groth16_str.c_str()),
-        sprout_groth16_str.length()
+        sprout_groth16_str.length(),
+        nullptr,
+        0,
+        false
     );
 }
 
@@ -71,7 +76,9 @@ JoinSplitTestingSetup::~JoinSplitTestingSetup()
 BasicTestingSetup::BasicTestingSetup(const std::string& chainName)
 {
     assert(sodium_init() != -1);
+    SHA256AutoDetect();
     ECC_Start();
+    InitSignatureCache();
     SetupEnvironment();
     SetupNetworking();
     fPrintToDebugLog = false; // don't want to write to debug.log file
@@ -105,7 +112,7 @@ TestingSetup::TestingSetup(const std::string& chainName) : JoinSplitTestingSetup
         InitBlockIndex(chainparams);
         nScriptCheckThreads = 3;
         for (int i=0; i < nScriptCheckThreads-1; i++)
-            threadGroup.create_thread(&ThreadScriptCheck);
+            threadGroup.create_thread(&ThreadCheckPool);
         RegisterNodeSignals(GetNodeSignals());
 }
 
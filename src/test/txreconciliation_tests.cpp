@@ -0,0 +1,100 @@
+// Copyright (c) 2021 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "txreconciliation.h"
+
+#include "random.h"
+#include "streams.h"
+#include "version.h"
+#include "test/test_bitcoin.h"
+
+#include <algorithm>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(txreconciliation_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(sketch_reconciliation)
+{
+    CTxReconciliationState initiator(true, 1234, 5678);
+    CTxReconciliationState responder(false, 5678, 1234);
+
+    std::set<uint256> setCommon, setInitiator, setResponder;
+    for (int i = 0; i < 200; i++) {
+        uint256 txid = GetRandHash();
+        // Both peers compute the same short IDs.
+        BOOST_CHECK_EQUAL(initiator.GetShortID(txid), responder.GetShortID(txid));
+        setCommon.insert(txid);
+    }
+    std::set<uint256> setOnlyInitiator, setOnlyResponder;
+    for (int i = 0; i < 10; i++) {
+        setOnlyInitiator.insert(GetRandHash());
+        setOnlyResponder.insert(GetRandHash());
+    }
+    setInitiator = setCommon;
+    setInitiator.insert(setOnlyInitiator.begin(), setOnlyInitiator.end());
+    setResponder = setCommon;
+    setResponder.insert(setOnlyResponder.begin(), setOnlyResponder.end());
+
+    size_t nCells = GetSketchCells(setResponder.size(), setInitiator.size());
+    CTxSketch sketch = responder.GetSketch(setResponder, nCells);
+
+    // The sketch goes over the wire.
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << sketch;
+    CTxSketch received;
+    ss >> received;
+    BOOST_CHECK(received.IsValid());
+    BOOST_CHECK_EQUAL(received.size(), sketch.size());
+
+    BOOST_CHECK(received.Subtract(initiator.GetSketch(setInitiator, received.size())));
+    std::vector<uint32_t> vAsk, vMissing;
+    BOOST_CHECK(received.Decode(vAsk, vMissing));
+
+    std::vector<uint256> vAsked = responder.GetByShortIDs(setResponder, vAsk);
+    std::vector<uint256> vAnnounced = initiator.GetByShortIDs(setInitiator, vMissing);
+    BOOST_CHECK(std::set<uint256>(vAsked.begin(), vAsked.end()) == setOnlyResponder);
+    BOOST_CHECK(std::set<uint256>(vAnnounced.begin(), vAnnounced.end()) == setOnlyInitiator);
+
+    // Sketches of different sizes cannot be subtracted.
+    BOOST_CHECK(!sketch.Subtract(CTxSketch(sketch.size() + 3)));
+}
+
+BOOST_AUTO_TEST_CASE(sketch_overflow)
+{
+    CTxReconciliationState recon(true, 1, 2);
+    std::set<uint256> setTxids;
+    for (int i = 0; i < 100; i++) {
+        setTxids.insert(GetRandHash());
+    }
+
+    // A difference of many more IDs than cells cannot be decoded.
+    CTxSketch sketch = recon.GetSketch(setTxids, 30);
+    sketch.Subtract(CTxSketch(30));
+    std::vector<uint32_t> vPositive, vNegative;
+    BOOST_CHECK(!sketch.Decode(vPositive, vNegative));
+
+    // An empty difference decodes to nothing.
+    CTxSketch sketch2 = recon.GetSketch(setTxids, 30);
+    sketch2.Subtract(recon.GetSketch(setTxids, 30));
+    BOOST_CHECK(sketch2.Decode(vPositive, vNegative));
+    BOOST_CHECK(vPositive.empty() && vNegative.empty());
+
+    BOOST_CHECK(!CTxSketch().IsValid());
+    BOOST_CHECK(!CTxSketch(MAX_SKETCH_CELLS + 3).IsValid());
+    BOOST_CHECK_EQUAL(GetSketchCells(0, 0), 12);
+    BOOST_CHECK_EQUAL(GetSketchCells(100000, 0), MAX_SKETCH_CELLS);
+}
+
+BOOST_AUTO_TEST_CASE(reconciliation_set_limit)
+{
+    CTxReconciliationState recon(false, 1, 2);
+    for (size_t i = 0; i < MAX_RECON_SET_SIZE; i++) {
+        BOOST_CHECK(recon.AddTransaction(GetRandHash()));
+    }
+    BOOST_CHECK(!recon.AddTransaction(GetRandHash()));
+    BOOST_CHECK(recon.AddTransaction(*recon.setLocal.begin()));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -12,6 +12,8 @@
 #include "utilmoneystr.h"
 #include "test/test_bitcoin.h"
 
+#include <algorithm>
+#include <atomic>
 #include <stdint.h>
 #include <vector>
 
@@ -63,6 +65,23 @@ BOOST_AUTO_TEST_CASE(util_ParseHex)
     // Stop parsing at invalid value
     result = ParseHex("1234 invalid 1234");
     BOOST_CHECK(result.size() == 2 && result[0] == 0x12 && result[1] == 0x34);
+
+    // Long inputs are decoded in blocks, which must stop at the same place
+    std::string hex = HexStr(ParseHex_expected, ParseHex_expected + sizeof(ParseHex_expected));
+    result = ParseHex(hex + " " + hex);
+    BOOST_CHECK_EQUAL(result.size(), 2 * sizeof(ParseHex_expected));
+    BOOST_CHECK_EQUAL(HexStr(result), hex + hex);
+    std::string upper = hex;
+    std::transform(upper.begin(), upper.end(), upper.begin(), ::toupper);
+    result = ParseHex(upper);
+    BOOST_CHECK_EQUAL_COLLECTIONS(result.begin(), result.end(), expected.begin(), expected.end());
+    for (size_t i = 0; i < hex.size(); i++) {
+        std::string invalid = hex;
+        invalid[i] = 'g';
+        result = ParseHex(invalid);
+        BOOST_CHECK_EQUAL(result.size(), i / 2);
+        BOOST_CHECK_EQUAL_COLLECTIONS(result.begin(), result.end(), expected.begin(), expected.begin() + i / 2);
+    }
 }
 
 BOOST_AUTO_TEST_CASE(util_HexStr)
@@ -84,6 +103,12 @@ BOOST_AUTO_TEST_CASE(util_HexStr)
     BOOST_CHECK_EQUAL(
         HexStr(ParseHex_vec, true),
         "04 67 8a fd b0");
+
+    // Iterators that are not pointers are encoded through a buffer
+    std::vector<char> ParseHex_chars(ParseHex_expected, ParseHex_expected + sizeof(ParseHex_expected));
+    BOOST_CHECK_EQUAL(
+        HexStr(ParseHex_chars.rbegin(), ParseHex_chars.rend()),
+        "5f1df16b2b704c8a578d0bbaf74d385cde12c11ee50455f3c438ef4c3fbcf649b6de611feae06279a60939e028a8d65c10b73071a6f16719274855feb0fd8a6704");
 }
 
 
@@ -492,4 +517,25 @@ BOOST_AUTO_TEST_CASE(test_ParseFixedPoint)
     BOOST_CHECK(!ParseFixedPoint("1.", 8, &amount));
 }
 
+BOOST_AUTO_TEST_CASE(test_ParallelFor)
+{
+    std::vector<int> vCalls(1000, 0);
+    ParallelFor(vCalls.size(), 4, [&](size_t i) { vCalls[i]++; });
+    BOOST_CHECK(std::all_of(vCalls.begin(), vCalls.end(), [](int n) { return n == 1; }));
+
+    // Nested and concurrent calls share the workers without waiting for each other.
+    std::atomic<size_t> nCalls(0);
+    ParallelFor(8, 8, [&](size_t i) {
+        ParallelFor(100, 8, [&](size_t j) { nCalls++; }, WorkPriority::VALIDATION);
+    }, WorkPriority::WALLET);
+    BOOST_CHECK_EQUAL(nCalls, 800U);
+
+    ParallelFor(0, 4, [&](size_t i) { BOOST_ERROR("called with no items"); });
+
+    // An exception from any thread is passed on once the workers are done.
+    BOOST_CHECK_THROW(ParallelFor(1000, 4, [&](size_t i) {
+        if (i == 500) throw std::runtime_error("item 500");
+    }), std::runtime_error);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -8,6 +8,9 @@
 #include "net.h"
 #include "util.h"
 #include "crypto/hmac_sha256.h"
+#include "random.h"
+
+#include <rust/metrics.h>
 
 #include <vector>
 #include <deque>
@@ -43,6 +46,13 @@ static const std::string TOR_SAFE_CLIENTKEY = "Tor safe cookie authentication co
 static const float RECONNECT_TIMEOUT_START = 1.0;
 /** Exponential backoff configuration - growth factor */
 static const float RECONNECT_TIMEOUT_EXP = 1.5;
+/** Exponential backoff configuration - maximum timeout in seconds */
+static const float RECONNECT_TIMEOUT_MAX = 600.0;
+/** Seconds a connection may take to get from connecting to a published
+ * onion service before it is dropped and retried, so that a Tor that accepts
+ * the connection but does not answer does not stall the controller.
+ */
+static const int TOR_SETUP_TIMEOUT = 60;
 /** Maximum length for lines received on TorControlConnection.
  * tor-control-spec.txt mentions that there is explicitly no limit defined to line length,
  * this is belt-and-suspenders sanity limit to prevent memory exhaustion.
@@ -429,6 +439,10 @@ private:
     bool reconnect;
     struct event *reconnect_ev;
     float reconnect_timeout;
+    /** Drops a connection that has not published the service in time */
+    struct event *setup_ev;
+    /** When the current connection attempt started, in microseconds */
+    int64_t setup_start;
     CService service;
     /** Cooie for SAFECOOKIE auth */
     std::vector<uint8_t> cookie;
@@ -448,23 +462,32 @@ private:
     /** Callback after connection lost or failed connection attempt */
     void disconnected_cb(TorControlConnection& conn);
 
+    /** Start a connection attempt, and the timer that bounds it */
+    void StartConnect();
+    /** Give up on the current connection attempt, and schedule the next one */
+    void Retry(const char* reason);
+
     /** Callback for reconnect timer */
     static void reconnect_cb(evutil_socket_t fd, short what, void *arg);
+    /** Callback for setup timer */
+    static void setup_cb(evutil_socket_t fd, short what, void *arg);
 };
 
 TorController::TorController(struct event_base* _base, const std::string& _target):
     base(_base),
     target(_target), conn(base), reconnect(true), reconnect_ev(0),
-    reconnect_timeout(RECONNECT_TIMEOUT_START)
+    reconnect_timeout(RECONNECT_TIMEOUT_START), setup_ev(0), setup_start(0)
 {
     reconnect_ev = event_new(base, -1, 0, reconnect_cb, this);
     if (!reconnect_ev)
         LogPrintf("tor: Failed to create event for reconnection: out of memory?\n");
+    setup_ev = event_new(base, -1, 0, setup_cb, this);
+    if (!setup_ev)
+        LogPrintf("tor: Failed to create event for setup timeout: out of memory?\n");
+    MetricsGauge("zcash.tor.control.connected", 0);
+    MetricsGauge("zcash.tor.onion.published", 0);
     // Start connection attempts immediately
-    if (!conn.Connect(_target, boost::bind(&TorController::connected_cb, this, _1),
-         boost::bind(&TorController::disconnected_cb, this, _1) )) {
-        LogPrintf("tor: Initiating connection to Tor control port %s failed\n", _target);
-    }
+    StartConnect();
     // Read service private key if cached
     std::pair<bool,std::string> pkf = ReadBinaryFile(GetPrivateKeyFile());
     if (pkf.first) {
@@ -479,6 +502,10 @@ TorController::~TorController()
         event_free(reconnect_ev);
         reconnect_ev = 0;
     }
+    if (setup_ev) {
+        event_free(setup_ev);
+        setup_ev = 0;
+    }
     if (service.IsValid()) {
         RemoveLocal(service);
     }
@@ -513,10 +540,17 @@ void TorController::add_onion_cb(TorControlConnection& _conn, const TorControlRe
         }
         AddLocal(service, LOCAL_MANUAL);
         // ... onion requested - keep connection open
+        if (setup_ev)
+            event_del(setup_ev);
+        reconnect_timeout = RECONNECT_TIMEOUT_START;
+        MetricsGauge("zcash.tor.onion.published", 1);
+        MetricsGauge("zcash.tor.onion.setup.seconds", (GetTimeMicros() - setup_start) / 1e6);
     } else if (reply.code == 510) { // 510 Unrecognized command
         LogPrintf("tor: Add onion failed with unrecognized command (You probably need to upgrade Tor)\n");
+        MetricsIncrementCounter("zcash.tor.control.failures", "stage", "add_onion");
     } else {
         LogPrintf("tor: Add onion failed; error code %d\n", reply.code);
+        MetricsIncrementCounter("zcash.tor.control.failures", "stage", "add_onion");
     }
 }
 
@@ -543,6 +577,7 @@ void TorController::auth_cb(TorControlConnection& _conn, const TorControlReply&
             boost::bind(&TorController::add_onion_cb, this, _1, _2));
     } else {
         LogPrintf("tor: Authentication failed\n");
+        MetricsIncrementCounter("zcash.tor.control.failures", "stage", "auth");
     }
 }
 
@@ -684,7 +719,7 @@ void TorController::protocolinfo_cb(TorControlConnection& _conn, const TorContro
 
 void TorController::connected_cb(TorControlConnection& _conn)
 {
-    reconnect_timeout = RECONNECT_TIMEOUT_START;
+    MetricsGauge("zcash.tor.control.connected", 1);
     // First send a PROTOCOLINFO command to figure out what authentication is expected
     if (!_conn.Command("PROTOCOLINFO 1", boost::bind(&TorController::protocolinfo_cb, this, _1, _2)))
         LogPrintf("tor: Error sending initial protocolinfo command\n");
@@ -696,16 +731,45 @@ void TorController::disconnected_cb(TorControlConnection& _conn)
     if (service.IsValid())
         RemoveLocal(service);
     service = CService();
+    MetricsGauge("zcash.tor.control.connected", 0);
+    MetricsGauge("zcash.tor.onion.published", 0);
+    if (setup_ev)
+        event_del(setup_ev);
     if (!reconnect)
         return;
 
     LogPrint("tor", "tor: Not connected to Tor control port %s, trying to reconnect\n", target);
+    Retry("disconnect");
+}
+
+void TorController::Retry(const char* reason)
+{
+    MetricsIncrementCounter("zcash.tor.control.failures", "stage", reason);
 
-    // Single-shot timer for reconnect. Use exponential backoff.
-    struct timeval time = MillisToTimeval(int64_t(reconnect_timeout * 1000.0));
+    // Single-shot timer for reconnect. Use exponential backoff, capped, with
+    // up to a quarter of jitter either way so that nodes sharing a Tor
+    // instance that restarted do not all come back at once.
+    float delay = reconnect_timeout * (0.75 + GetRand(501) / 1000.0);
+    struct timeval time = MillisToTimeval(int64_t(delay * 1000.0));
     if (reconnect_ev)
         event_add(reconnect_ev, &time);
-    reconnect_timeout *= RECONNECT_TIMEOUT_EXP;
+    MetricsGauge("zcash.tor.control.backoff.seconds", delay);
+    reconnect_timeout = std::min(reconnect_timeout * RECONNECT_TIMEOUT_EXP, RECONNECT_TIMEOUT_MAX);
+}
+
+void TorController::StartConnect()
+{
+    setup_start = GetTimeMicros();
+    if (!conn.Connect(target, boost::bind(&TorController::connected_cb, this, _1),
+         boost::bind(&TorController::disconnected_cb, this, _1) )) {
+        LogPrintf("tor: Initiating connection to Tor control port %s failed\n", target);
+        conn.Disconnect();
+        Retry("connect");
+        return;
+    }
+    struct timeval time = MillisToTimeval(int64_t(TOR_SETUP_TIMEOUT) * 1000);
+    if (setup_ev)
+        event_add(setup_ev, &time);
 }
 
 void TorController::Reconnect()
@@ -713,10 +777,8 @@ void TorController::Reconnect()
     /* Try to reconnect and reestablish if we get booted - for example, Tor
      * may be restarting.
      */
-    if (!conn.Connect(target, boost::bind(&TorController::connected_cb, this, _1),
-         boost::bind(&TorController::disconnected_cb, this, _1) )) {
-        LogPrintf("tor: Re-initiating connection to Tor control port %s failed\n", target);
-    }
+    MetricsIncrementCounter("zcash.tor.control.reconnects");
+    StartConnect();
 }
 
 fs::path TorController::GetPrivateKeyFile()
@@ -730,6 +792,17 @@ void TorController::reconnect_cb(evutil_socket_t fd, short what, void *arg)
     self->Reconnect();
 }
 
+void TorController::setup_cb(evutil_socket_t fd, short what, void *arg)
+{
+    TorController *self = (TorController*)arg;
+    LogPrintf("tor: No onion service after %d seconds on Tor control port %s, trying to reconnect\n", TOR_SETUP_TIMEOUT, self->target);
+    // Dropping the connection does not call disconnected_cb, which is only
+    // called for events seen on the socket.
+    self->conn.Disconnect();
+    MetricsGauge("zcash.tor.control.connected", 0);
+    self->Retry("timeout");
+}
+
 /****** Thread ********/
 static struct event_base *gBase;
 static boost::thread torControlThread;
@@ -9,11 +9,55 @@
 #include "pubkey.h"
 #include "rpc/protocol.h"
 #include "script/sign.h"
+#include "util.h"
 #include "utilmoneystr.h"
 #include "zcash/Note.hpp"
+#include "zcash/ProvingBackend.hpp"
 
 #include <librustzcash.h>
 #include <rust/ed25519.h>
+#include <rust/metrics.h>
+
+#include <condition_variable>
+#include <mutex>
+
+static std::mutex csProvingThreads;
+static std::condition_variable condProvingThreads;
+static int nProvingThreadsLimit = 0;
+static int nProvingThreadsInUse = 0;
+
+void ProvingThreads::SetLimit(int nLimit)
+{
+    std::lock_guard<std::mutex> lock(csProvingThreads);
+    nProvingThreadsLimit = nLimit;
+    condProvingThreads.notify_all();
+}
+
+ProvingThreads::ProvingThreads(size_t nWanted) : nThreads(0)
+{
+    if (nWanted == 0) {
+        return;
+    }
+    std::unique_lock<std::mutex> lock(csProvingThreads);
+    if (nProvingThreadsLimit <= 0) {
+        nProvingThreadsLimit = std::max(1, GetNumCores());
+    }
+    condProvingThreads.wait(lock, [] { return nProvingThreadsInUse < nProvingThreadsLimit; });
+    nThreads = std::min((size_t)(nProvingThreadsLimit - nProvingThreadsInUse), nWanted);
+    nProvingThreadsInUse += nThreads;
+    MetricsGauge("zcash.wallet.proving.threads", (double)nProvingThreadsInUse);
+}
+
+ProvingThreads::~ProvingThreads()
+{
+    if (nThreads == 0) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(csProvingThreads);
+    nProvingThreadsInUse -= nThreads;
+    MetricsGauge("zcash.wallet.proving.threads", (double)nProvingThreadsInUse);
+    condProvingThreads.notify_all();
+}
 
 SpendDescriptionInfo::SpendDescriptionInfo(
     libzcash::SaplingExpandedSpendingKey expsk,
@@ -46,7 +90,7 @@ std::optional<OutputDescription> OutputDescriptionInfo::Build(void* ctx) {
 
     OutputDescription odesc;
     uint256 rcm = this->note.rcm();
-    if (!librustzcash_sapling_output_proof(
+    if (!libzcash::ProveSaplingOutput(
             ctx,
             encryptor.get_esk().begin(),
             addressBytes.data(),
@@ -71,6 +115,13 @@ std::optional<OutputDescription> OutputDescriptionInfo::Build(void* ctx) {
     return odesc;
 }
 
+void* SaplingProvingContextInit()
+{
+    return PlaceholderProofs() ?
+        librustzcash_sapling_proving_ctx_init_placeholder() :
+        librustzcash_sapling_proving_ctx_init();
+}
+
 JSDescription JSDescriptionInfo::BuildDeterministic(
     bool computeProof,
     uint256 *esk // payment disclosure
@@ -95,7 +146,7 @@ JSDescription JSDescriptionInfo::BuildDeterministic(
         vpub_old,
         vpub_new,
         anchor,
-        computeProof,
+        computeProof && !PlaceholderProofs(),
         esk // payment disclosure
     );
 
@@ -119,6 +170,7 @@ JSDescription JSDescriptionInfo::BuildRandomized(
     MappedShuffle(inputs.begin(), inputMap.begin(), ZC_NUM_JS_INPUTS, gen);
     MappedShuffle(outputs.begin(), outputMap.begin(), ZC_NUM_JS_OUTPUTS, gen);
 
+    ProvingThreads threads(1);
     return BuildDeterministic(computeProof, esk);
 }
 
@@ -359,61 +411,91 @@ TransactionBuilderResult TransactionBuilder::Build()
 
     auto ctx = librustzcash_sapling_proving_ctx_init();
 
-    // Create Sapling SpendDescriptions
-    for (auto spend : spends) {
-        auto cm = spend.note.cmu();
-        auto nf = spend.note.nullifier(
-            spend.expsk.full_viewing_key(), spend.witness.position());
-        if (!cm || !nf) {
-            librustzcash_sapling_proving_ctx_free(ctx);
-            return TransactionBuilderResult("Spend is invalid");
-        }
+    // The proofs of the spends and outputs are independent of each other, so
+    // they are created in parallel on the proving threads that are free, each
+    // with a proving context of its own. The contexts are then merged into
+    // ctx for the binding signature.
+    size_t nSpends = spends.size();
+    size_t nProofs = nSpends + outputs.size();
+    std::vector<void*> proofCtxs(nProofs);
+    std::vector<SpendDescription> sdescs(nSpends);
+    std::vector<OutputDescription> odescs(outputs.size());
+    std::vector<std::string> errors(nProofs);
+    {
+        ProvingThreads threads(nProofs);
+        ParallelFor(nProofs, threads.Count(), [&](size_t i) {
+            proofCtxs[i] = SaplingProvingContextInit();
+
+            if (i >= nSpends) {
+                // Create a Sapling OutputDescription
+                auto& output = outputs[i - nSpends];
+                // Check this out here as well to provide better logging.
+                if (!output.note.cmu()) {
+                    errors[i] = "Output is invalid";
+                    return;
+                }
 
-        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-        ss << spend.witness.path();
-        std::vector<unsigned char> witness(ss.begin(), ss.end());
-
-        SpendDescription sdesc;
-        uint256 rcm = spend.note.rcm();
-        if (!librustzcash_sapling_spend_proof(
-                ctx,
-                spend.expsk.full_viewing_key().ak.begin(),
-                spend.expsk.nsk.begin(),
-                spend.note.d.data(),
-                rcm.begin(),
-                spend.alpha.begin(),
-                spend.note.value(),
-                spend.anchor.begin(),
-                witness.data(),
-                sdesc.cv.begin(),
-                sdesc.rk.begin(),
-                sdesc.zkproof.data())) {
-            librustzcash_sapling_proving_ctx_free(ctx);
-            return TransactionBuilderResult("Spend proof failed");
-        }
+                auto odesc = output.Build(proofCtxs[i]);
+                if (!odesc) {
+                    errors[i] = "Failed to create output description";
+                    return;
+                }
+                odescs[i - nSpends] = odesc.value();
+                return;
+            }
 
-        sdesc.anchor = spend.anchor;
-        sdesc.nullifier = *nf;
-        mtx.vShieldedSpend.push_back(sdesc);
-    }
+            // Create a Sapling SpendDescription
+            const auto& spend = spends[i];
+            auto cm = spend.note.cmu();
+            auto nf = spend.note.nullifier(
+                spend.expsk.full_viewing_key(), spend.witness.position());
+            if (!cm || !nf) {
+                errors[i] = "Spend is invalid";
+                return;
+            }
 
-    // Create Sapling OutputDescriptions
-    for (auto output : outputs) {
-        // Check this out here as well to provide better logging.
-        if (!output.note.cmu()) {
-            librustzcash_sapling_proving_ctx_free(ctx);
-            return TransactionBuilderResult("Output is invalid");
-        }
+            CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+            ss << spend.witness.path();
+            std::vector<unsigned char> witness(ss.begin(), ss.end());
+
+            SpendDescription& sdesc = sdescs[i];
+            uint256 rcm = spend.note.rcm();
+            if (!libzcash::ProveSaplingSpend(
+                    proofCtxs[i],
+                    spend.expsk.full_viewing_key().ak.begin(),
+                    spend.expsk.nsk.begin(),
+                    spend.note.d.data(),
+                    rcm.begin(),
+                    spend.alpha.begin(),
+                    spend.note.value(),
+                    spend.anchor.begin(),
+                    witness.data(),
+                    sdesc.cv.begin(),
+                    sdesc.rk.begin(),
+                    sdesc.zkproof.data())) {
+                errors[i] = "Spend proof failed";
+                return;
+            }
 
-        auto odesc = output.Build(ctx);
-        if (!odesc) {
+            sdesc.anchor = spend.anchor;
+            sdesc.nullifier = *nf;
+        }, WorkPriority::WALLET);
+    }
+
+    for (void* proofCtx : proofCtxs) {
+        librustzcash_sapling_proving_ctx_merge(ctx, proofCtx);
+        librustzcash_sapling_proving_ctx_free(proofCtx);
+    }
+    for (const std::string& error : errors) {
+        if (!error.empty()) {
             librustzcash_sapling_proving_ctx_free(ctx);
-            return TransactionBuilderResult("Failed to create output description");
+            return TransactionBuilderResult(error);
         }
-
-        mtx.vShieldedOutput.push_back(odesc.value());
     }
 
+    mtx.vShieldedSpend.insert(mtx.vShieldedSpend.end(), sdescs.begin(), sdescs.end());
+    mtx.vShieldedOutput.insert(mtx.vShieldedOutput.end(), odescs.begin(), odescs.end());
+
     //
     // Sprout JoinSplits
     //
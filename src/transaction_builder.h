@@ -23,6 +23,37 @@
 
 #define NO_MEMO {{0xF6}}
 
+/** Default for -provingthreads (0 = one per core). */
+static const int DEFAULT_PROVING_THREADS = 0;
+
+/**
+ * A share of the threads that may create zk-SNARK proofs at once. All the
+ * transactions being built, such as those of async RPC operations running on
+ * several workers, draw on the same -provingthreads threads, so that they
+ * share the cores instead of oversubscribing them.
+ */
+class ProvingThreads
+{
+private:
+    int nThreads;
+
+public:
+    /** Set the number of proving threads. Called once, at startup. */
+    static void SetLimit(int nLimit);
+
+    /**
+     * Wait until a proving thread is free, then take up to nWanted of the
+     * free ones. They are given back when this object is destroyed.
+     */
+    explicit ProvingThreads(size_t nWanted);
+    ~ProvingThreads();
+
+    ProvingThreads(const ProvingThreads&) = delete;
+    ProvingThreads& operator=(const ProvingThreads&) = delete;
+
+    int Count() const { return nThreads; }
+};
+
 struct SpendDescriptionInfo {
     libzcash::SaplingExpandedSpendingKey expsk;
     libzcash::SaplingNote note;
@@ -37,6 +68,12 @@ struct SpendDescriptionInfo {
         SaplingWitness witness);
 };
 
+/**
+ * Create a Sapling proving context, which writes placeholders instead of
+ * proofs under -regtestfastmode. Free it with librustzcash_sapling_proving_ctx_free.
+ */
+void* SaplingProvingContextInit();
+
 struct OutputDescriptionInfo {
     uint256 ovk;
     libzcash::SaplingNote note;
@@ -6,12 +6,23 @@
 #include "txdb.h"
 
 #include "chainparams.h"
+#include "compactblockindex.h"
 #include "hash.h"
+#include "init.h"
 #include "main.h"
 #include "pow.h"
+#include "streams.h"
+#include "ui_interface.h"
+#include "random.h"
 #include "uint256.h"
+#include "util.h"
+
+#include <rust/metrics.h>
 
 #include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
 
 #include <boost/thread.hpp>
 
@@ -23,17 +34,29 @@ static const char DB_SPROUT_ANCHOR = 'A';
 static const char DB_SAPLING_ANCHOR = 'Z';
 static const char DB_NULLIFIER = 's';
 static const char DB_SAPLING_NULLIFIER = 'S';
+static const char DB_COIN = 'C';
 static const char DB_COINS = 'c';
 static const char DB_BLOCK_FILES = 'f';
 static const char DB_TXINDEX = 't';
+static const char DB_COMPACT_BLOCK = 'k';
+static const char DB_BLOCK_FILTER = 'g';
+static const char DB_SAPLING_SPENDINDEX = 'n';
+static const char DB_SAPLING_OUTPUTINDEX = 'o';
+static const char DB_SAPLING_TREE_SIZE = 'q';
+static const char DB_SAPLING_TREE_NODE = 'y';
 static const char DB_BLOCK_INDEX = 'b';
 
 static const char DB_BEST_BLOCK = 'B';
 static const char DB_BEST_SPROUT_ANCHOR = 'a';
 static const char DB_BEST_SAPLING_ANCHOR = 'z';
+static const char DB_SNAPSHOT_LOADING = 'L';
+static const char DB_SNAPSHOT_BASE = 'v';
+static const char DB_BULK_WRITE = 'W';
 static const char DB_FLAG = 'F';
 static const char DB_REINDEX_FLAG = 'R';
 static const char DB_LAST_BLOCK = 'l';
+static const char DB_UTXO_STATS = 'U';
+static const char DB_BLOCK_INDEX_CACHE = 'I';
 
 static const char DB_MMR_LENGTH = 'M';
 static const char DB_MMR_NODE = 'm';
@@ -45,11 +68,123 @@ static const char DB_ADDRESSUNSPENTINDEX = 'u';
 static const char DB_SPENTINDEX = 'p';
 static const char DB_TIMESTAMPINDEX = 'T';
 static const char DB_BLOCKHASHINDEX = 'h';
+static const char DB_ADDRESSBALANCE = 'e';
+
+static const char DB_INDEX_BEST = 'x';
+
+/** Size of the batches in which the records of a dropped index are erased. */
+static const size_t DROP_INDEX_BATCH_SIZE = 16 << 20;
+/** Size of the batches in which the records of a scan are read, and deserialized in parallel. */
+static const size_t SCAN_BATCH_SIZE = 16 << 20;
+/** Maximum number of threads that deserialize the records of a scan. */
+static const int MAX_SCAN_THREADS = 8;
 
-CCoinsViewDB::CCoinsViewDB(std::string dbName, size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / dbName, nCacheSize, fMemory, fWipe) {
+static int ScanThreads()
+{
+    return std::max(1, std::min(GetNumCores(), MAX_SCAN_THREADS));
 }
 
-CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe) 
+namespace {
+
+struct CoinEntry {
+    COutPoint* outpoint;
+    char key;
+    CoinEntry(const COutPoint* ptr) : outpoint(const_cast<COutPoint*>(ptr)), key(DB_COIN) {}
+
+    template<typename Stream>
+    void Serialize(Stream &s) const {
+        s << key;
+        s << outpoint->hash;
+        s << VARINT(outpoint->n);
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream& s) {
+        s >> key;
+        s >> outpoint->hash;
+        s >> VARINT(outpoint->n);
+    }
+};
+
+/**
+ * The per-transaction UTXO records (DB_COINS) used before the per-output
+ * layout, kept so that CCoinsViewDB::Upgrade can read them.
+ *
+ * Serialized format:
+ * - VARINT(nVersion)
+ * - VARINT(nCode)
+ * - unspentness bitvector, for vout[2] and further; least significant byte first
+ * - the non-spent CTxOuts (via CTxOutCompressor)
+ * - VARINT(nHeight)
+ *
+ * The nCode value consists of:
+ * - bit 1: IsCoinBase()
+ * - bit 2: vout[0] is not spent
+ * - bit 4: vout[1] is not spent
+ * - The higher bits encode N, the number of non-zero bytes in the following bitvector.
+ *   - In case both bit 2 and bit 4 are unset, they encode N-1, as there must be at
+ *     least one non-spent output).
+ */
+class CLegacyCoins
+{
+public:
+    //! whether transaction is a coinbase
+    bool fCoinBase;
+
+    //! unspent transaction outputs; spent outputs are .IsNull()
+    std::vector<CTxOut> vout;
+
+    //! at which height this transaction was included in the active block chain
+    int nHeight;
+
+    CLegacyCoins() : fCoinBase(false), vout(0), nHeight(0) { }
+
+    template<typename Stream>
+    void Unserialize(Stream &s) {
+        unsigned int nCode = 0;
+        // version
+        int nVersionDummy;
+        ::Unserialize(s, VARINT(nVersionDummy));
+        // header code
+        ::Unserialize(s, VARINT(nCode));
+        fCoinBase = nCode & 1;
+        std::vector<bool> vAvail(2, false);
+        vAvail[0] = (nCode & 2) != 0;
+        vAvail[1] = (nCode & 4) != 0;
+        unsigned int nMaskCode = (nCode / 8) + ((nCode & 6) != 0 ? 0 : 1);
+        // spentness bitmask
+        while (nMaskCode > 0) {
+            unsigned char chAvail = 0;
+            ::Unserialize(s, chAvail);
+            for (unsigned int p = 0; p < 8; p++) {
+                bool f = (chAvail & (1 << p)) != 0;
+                vAvail.push_back(f);
+            }
+            if (chAvail != 0)
+                nMaskCode--;
+        }
+        // txouts themself
+        vout.assign(vAvail.size(), CTxOut());
+        for (unsigned int i = 0; i < vAvail.size(); i++) {
+            if (vAvail[i])
+                ::Unserialize(s, REF(CTxOutCompressor(vout[i])));
+        }
+        // coinbase height
+        ::Unserialize(s, VARINT(nHeight));
+    }
+};
+
+}
+
+//! The smallest number of nullifiers that a nullifier filter is sized for.
+static const size_t NULLIFIER_FILTER_MIN_CAPACITY = 1 << 20;
+
+CCoinsViewDB::CCoinsViewDB(std::string dbName, size_t nCacheSize, bool fMemory, bool fWipe) :
+    nSproutNullifiers(0), nSaplingNullifiers(0), fBulkWrite(false), db(GetDataDir() / dbName, nCacheSize, fMemory, fWipe) {
+}
+
+CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe, const CDBOptions& dbOptions) :
+    nSproutNullifiers(0), nSaplingNullifiers(0), fBulkWrite(false), db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe, dbOptions)
 {
 }
 
@@ -78,6 +213,14 @@ bool CCoinsViewDB::GetSaplingAnchorAt(const uint256 &rt, SaplingMerkleTree &tree
     return read;
 }
 
+bool CCoinsViewDB::HaveSaplingAnchor(const uint256 &rt) const {
+    if (rt == SaplingMerkleTree::empty_root()) {
+        return true;
+    }
+
+    return db.Exists(make_pair(DB_SAPLING_ANCHOR, rt));
+}
+
 bool CCoinsViewDB::GetNullifier(const uint256 &nf, ShieldedType type) const {
     bool spent = false;
     char dbChar;
@@ -91,15 +234,22 @@ bool CCoinsViewDB::GetNullifier(const uint256 &nf, ShieldedType type) const {
         default:
             throw runtime_error("Unknown shielded type");
     }
+    {
+        LOCK(cs_nullifierFilters);
+        const std::unique_ptr<CBlockedBloomFilter>& filter = (type == SPROUT) ? sproutNullifierFilter : saplingNullifierFilter;
+        if (filter && !filter->contains(nf)) {
+            return false;
+        }
+    }
     return db.Read(make_pair(dbChar, nf), spent);
 }
 
-bool CCoinsViewDB::GetCoins(const uint256 &txid, CCoins &coins) const {
-    return db.Read(make_pair(DB_COINS, txid), coins);
+bool CCoinsViewDB::GetCoin(const COutPoint &outpoint, Coin &coin) const {
+    return db.Read(CoinEntry(&outpoint), coin);
 }
 
-bool CCoinsViewDB::HaveCoins(const uint256 &txid) const {
-    return db.Exists(make_pair(DB_COINS, txid));
+bool CCoinsViewDB::HaveCoin(const COutPoint &outpoint) const {
+    return db.Exists(CoinEntry(&outpoint));
 }
 
 uint256 CCoinsViewDB::GetBestBlock() const {
@@ -166,7 +316,7 @@ uint256 CCoinsViewDB::GetHistoryRoot(uint32_t epochId) const {
     return root;
 }
 
-void BatchWriteNullifiers(CDBBatch& batch, CNullifiersMap& mapToUse, const char& dbChar)
+void BatchWriteNullifiers(CDBBatch& batch, CNullifiersMap& mapToUse, const char& dbChar, bool fErase)
 {
     for (CNullifiersMap::iterator it = mapToUse.begin(); it != mapToUse.end();) {
         if (it->second.flags & CNullifiersCacheEntry::DIRTY) {
@@ -176,12 +326,12 @@ void BatchWriteNullifiers(CDBBatch& batch, CNullifiersMap& mapToUse, const char&
                 batch.Write(make_pair(dbChar, it->first), true);
             // TODO: changed++? ... See comment in CCoinsViewDB::BatchWrite. If this is needed we could return an int
         }
-        it = mapToUse.erase(it);
+        it = fErase ? mapToUse.erase(it) : std::next(it);
     }
 }
 
 template<typename Map, typename MapIterator, typename MapEntry, typename Tree>
-void BatchWriteAnchors(CDBBatch& batch, Map& mapToUse, const char& dbChar)
+void BatchWriteAnchors(CDBBatch& batch, Map& mapToUse, const char& dbChar, bool fErase)
 {
     for (MapIterator it = mapToUse.begin(); it != mapToUse.end();) {
         if (it->second.flags & MapEntry::DIRTY) {
@@ -194,7 +344,7 @@ void BatchWriteAnchors(CDBBatch& batch, Map& mapToUse, const char& dbChar)
             }
             // TODO: changed++?
         }
-        it = mapToUse.erase(it);
+        it = fErase ? mapToUse.erase(it) : std::next(it);
     }
 }
 
@@ -232,27 +382,35 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins,
                               CAnchorsSaplingMap &mapSaplingAnchors,
                               CNullifiersMap &mapSproutNullifiers,
                               CNullifiersMap &mapSaplingNullifiers,
-                              CHistoryCacheMap &historyCacheMap) {
+                              CHistoryCacheMap &historyCacheMap,
+                              bool fErase) {
     CDBBatch batch(db);
-    size_t count = 0;
+    size_t count = mapCoins.size();
     size_t changed = 0;
-    for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
-        if (it->second.flags & CCoinsCacheEntry::DIRTY) {
-            if (it->second.coins.IsPruned())
-                batch.Erase(make_pair(DB_COINS, it->first));
-            else
-                batch.Write(make_pair(DB_COINS, it->first), it->second.coins);
-            changed++;
+    if (fBulkWrite) {
+        if (!BulkWriteCoins(mapCoins, batch, changed))
+            return false;
+        if (fErase)
+            mapCoins.clear();
+    } else {
+        for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
+            if (it->second.flags & CCoinsCacheEntry::DIRTY) {
+                CoinEntry entry(&it->first);
+                if (it->second.coin.IsSpent())
+                    batch.Erase(entry);
+                else
+                    batch.Write(entry, it->second.coin);
+                changed++;
+            }
+            it = fErase ? mapCoins.erase(it) : std::next(it);
         }
-        count++;
-        it = mapCoins.erase(it);
     }
 
-    ::BatchWriteAnchors<CAnchorsSproutMap, CAnchorsSproutMap::iterator, CAnchorsSproutCacheEntry, SproutMerkleTree>(batch, mapSproutAnchors, DB_SPROUT_ANCHOR);
-    ::BatchWriteAnchors<CAnchorsSaplingMap, CAnchorsSaplingMap::iterator, CAnchorsSaplingCacheEntry, SaplingMerkleTree>(batch, mapSaplingAnchors, DB_SAPLING_ANCHOR);
+    ::BatchWriteAnchors<CAnchorsSproutMap, CAnchorsSproutMap::iterator, CAnchorsSproutCacheEntry, SproutMerkleTree>(batch, mapSproutAnchors, DB_SPROUT_ANCHOR, fErase);
+    ::BatchWriteAnchors<CAnchorsSaplingMap, CAnchorsSaplingMap::iterator, CAnchorsSaplingCacheEntry, SaplingMerkleTree>(batch, mapSaplingAnchors, DB_SAPLING_ANCHOR, fErase);
 
-    ::BatchWriteNullifiers(batch, mapSproutNullifiers, DB_NULLIFIER);
-    ::BatchWriteNullifiers(batch, mapSaplingNullifiers, DB_SAPLING_NULLIFIER);
+    ::BatchWriteNullifiers(batch, mapSproutNullifiers, DB_NULLIFIER, fErase);
+    ::BatchWriteNullifiers(batch, mapSaplingNullifiers, DB_SAPLING_NULLIFIER, fErase);
 
     ::BatchWriteHistory(batch, historyCacheMap);
 
@@ -263,11 +421,405 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins,
     if (!hashSaplingAnchor.IsNull())
         batch.Write(DB_BEST_SAPLING_ANCHOR, hashSaplingAnchor);
 
-    LogPrint("coindb", "Committing %u changed transactions (out of %u) to coin database...\n", (unsigned int)changed, (unsigned int)count);
-    return db.WriteBatch(batch);
+    // The filters must have the new nullifiers before the database does.
+    AddToNullifierFilter(mapSproutNullifiers, SPROUT);
+    AddToNullifierFilter(mapSaplingNullifiers, SAPLING);
+
+    LogPrint("coindb", "Committing %u changed transaction outputs (out of %u) to coin database...\n", (unsigned int)changed, (unsigned int)count);
+    if (!db.WriteBatch(batch))
+        return false;
+
+    // Rebuild a filter that holds more nullifiers than it was sized for, as
+    // its false positive rate is then increasing.
+    if (sproutNullifierFilter && nSproutNullifiers > sproutNullifierFilter->GetCapacity()) {
+        std::unique_ptr<CBlockedBloomFilter> filter = BuildNullifierFilter(DB_NULLIFIER, nSproutNullifiers);
+        LOCK(cs_nullifierFilters);
+        sproutNullifierFilter = std::move(filter);
+    }
+    if (saplingNullifierFilter && nSaplingNullifiers > saplingNullifierFilter->GetCapacity()) {
+        std::unique_ptr<CBlockedBloomFilter> filter = BuildNullifierFilter(DB_SAPLING_NULLIFIER, nSaplingNullifiers);
+        LOCK(cs_nullifierFilters);
+        saplingNullifierFilter = std::move(filter);
+    }
+    return true;
+}
+
+void CCoinsViewDB::AddToNullifierFilter(const CNullifiersMap &mapNullifiers, ShieldedType type) {
+    LOCK(cs_nullifierFilters);
+    CBlockedBloomFilter* filter = (type == SPROUT) ? sproutNullifierFilter.get() : saplingNullifierFilter.get();
+    if (!filter) {
+        return;
+    }
+    size_t& nNullifiers = (type == SPROUT) ? nSproutNullifiers : nSaplingNullifiers;
+    for (const auto& entry : mapNullifiers) {
+        if ((entry.second.flags & CNullifiersCacheEntry::DIRTY) && entry.second.entered) {
+            filter->insert(entry.first);
+            nNullifiers++;
+        }
+    }
+}
+
+std::unique_ptr<CBlockedBloomFilter> CCoinsViewDB::BuildNullifierFilter(char dbChar, size_t &nNullifiers) const {
+    // Count the nullifiers first, to size the filter with room to grow.
+    nNullifiers = 0;
+    {
+        CDBRangeReader reader(const_cast<CDBWrapper&>(db), make_pair(dbChar, uint256()), char(dbChar + 1));
+        while (reader.ReadBatch()) {
+            nNullifiers += reader.size();
+        }
+    }
+
+    std::unique_ptr<CBlockedBloomFilter> filter(new CBlockedBloomFilter(std::max(NULLIFIER_FILTER_MIN_CAPACITY, 2 * nNullifiers)));
+    CDBRangeReader reader(const_cast<CDBWrapper&>(db), make_pair(dbChar, uint256()), char(dbChar + 1));
+    std::pair<char, uint256> key;
+    while (reader.ReadBatch()) {
+        for (size_t i = 0; i < reader.size(); i++) {
+            if (reader.GetKey(i, key))
+                filter->insert(key.second);
+        }
+    }
+    LogPrint("coindb", "Built a filter of %u bytes over %u nullifiers ('%c')\n",
+             (unsigned int)filter->DynamicMemoryUsage(), (unsigned int)nNullifiers, dbChar);
+    return filter;
+}
+
+void CCoinsViewDB::LoadNullifierFilters() {
+    int64_t nStart = GetTimeMillis();
+    size_t nSprout = 0, nSapling = 0;
+    std::unique_ptr<CBlockedBloomFilter> sproutFilter = BuildNullifierFilter(DB_NULLIFIER, nSprout);
+    std::unique_ptr<CBlockedBloomFilter> saplingFilter = BuildNullifierFilter(DB_SAPLING_NULLIFIER, nSapling);
+
+    LOCK(cs_nullifierFilters);
+    sproutNullifierFilter = std::move(sproutFilter);
+    saplingNullifierFilter = std::move(saplingFilter);
+    nSproutNullifiers = nSprout;
+    nSaplingNullifiers = nSapling;
+    LogPrintf("Loaded the filters over %u Sprout and %u Sapling nullifiers in %dms\n",
+              (unsigned int)nSprout, (unsigned int)nSapling, GetTimeMillis() - nStart);
+}
+
+namespace {
+
+//! The serialized nodes of the history tree, as stored in the database.
+typedef std::array<unsigned char, NODE_SERIALIZED_LENGTH> HistoryNodeBytes;
+
+//! The size of the buffer in which snapshot records are serialized before they are written.
+static const size_t SNAPSHOT_BUFFER_SIZE = 1 << 20;
+
+//! The size of the database batches in which a snapshot is loaded.
+static const size_t SNAPSHOT_BATCH_SIZE = 1 << 24;
+
+/** Append the record under pcursor, with a key of type K after its type byte and a value of type V, to ss. */
+template <typename K, typename V>
+bool AppendSnapshotRecord(CDBIterator* pcursor, char ch, CDataStream& ss)
+{
+    std::pair<char, K> key;
+    V value;
+    if (!pcursor->GetKey(key) || !pcursor->GetValue(value))
+        return false;
+    ss << ch << key.second << value;
+    return true;
+}
+
+/** Append the record under pcursor, whose key is only its type byte, to ss. */
+template <typename V>
+bool AppendSnapshotValue(CDBIterator* pcursor, char ch, CDataStream& ss)
+{
+    V value;
+    if (!pcursor->GetValue(value))
+        return false;
+    ss << ch << value;
+    return true;
 }
 
-CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe) {
+/** Read the key and value of a snapshot record of the given type, and add it to pbatch if it is not null. */
+template <typename K, typename V>
+void ReadSnapshotRecord(CAutoFile& file, CHashWriter& hasher, char ch, CDBBatch* pbatch)
+{
+    K key;
+    V value;
+    file >> key >> value;
+    hasher << key << value;
+    if (pbatch)
+        pbatch->Write(std::make_pair(ch, key), value);
+}
+
+/** Read the value of a snapshot record whose key is only its type byte. */
+template <typename V>
+void ReadSnapshotValue(CAutoFile& file, CHashWriter& hasher, char ch, CDBBatch* pbatch)
+{
+    V value;
+    file >> value;
+    hasher << value;
+    if (pbatch)
+        pbatch->Write(ch, value);
+}
+
+/** Add the erasure of the record under pcursor, with a key of type K after its type byte, to batch. */
+template <typename K>
+bool EraseRecord(CDBIterator* pcursor, CDBBatch& batch)
+{
+    std::pair<char, K> key;
+    if (!pcursor->GetKey(key))
+        return false;
+    batch.Erase(key);
+    return true;
+}
+
+} // namespace
+
+CDBIterator* CCoinsViewDB::NewSnapshotCursor() const {
+    // A LevelDB iterator reads from an implicit snapshot of the database.
+    return const_cast<CDBWrapper*>(&db)->NewIterator();
+}
+
+bool CCoinsViewDB::WriteSnapshot(CDBIterator* pcursor, CAutoFile& file, CHashWriter& hasher, uint64_t& nCoins) const {
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    auto flush = [&]() {
+        file.write(&ss[0], ss.size());
+        hasher.write(&ss[0], ss.size());
+        ss.clear();
+    };
+
+    nCoins = 0;
+    for (pcursor->SeekToFirst(); pcursor->Valid(); pcursor->Next()) {
+        boost::this_thread::interruption_point();
+        char ch;
+        if (!pcursor->GetKey(ch))
+            return error("%s: unable to read key", __func__);
+        bool fOk = true;
+        switch (ch) {
+            case DB_COIN: {
+                COutPoint outpoint;
+                CoinEntry entry(&outpoint);
+                Coin coin;
+                fOk = pcursor->GetKey(entry) && pcursor->GetValue(coin);
+                if (fOk) {
+                    ss << ch << outpoint << coin;
+                    nCoins++;
+                }
+                break;
+            }
+            case DB_SPROUT_ANCHOR:
+                fOk = AppendSnapshotRecord<uint256, SproutMerkleTree>(pcursor, ch, ss);
+                break;
+            case DB_SAPLING_ANCHOR:
+                fOk = AppendSnapshotRecord<uint256, SaplingMerkleTree>(pcursor, ch, ss);
+                break;
+            case DB_NULLIFIER:
+            case DB_SAPLING_NULLIFIER:
+                fOk = AppendSnapshotRecord<uint256, bool>(pcursor, ch, ss);
+                break;
+            case DB_BEST_SPROUT_ANCHOR:
+            case DB_BEST_SAPLING_ANCHOR:
+                fOk = AppendSnapshotValue<uint256>(pcursor, ch, ss);
+                break;
+            case DB_MMR_LENGTH:
+                fOk = AppendSnapshotRecord<uint32_t, HistoryIndex>(pcursor, ch, ss);
+                break;
+            case DB_MMR_NODE:
+                fOk = AppendSnapshotRecord<std::pair<uint32_t, HistoryIndex>, HistoryNodeBytes>(pcursor, ch, ss);
+                break;
+            case DB_MMR_ROOT:
+                fOk = AppendSnapshotRecord<uint32_t, uint256>(pcursor, ch, ss);
+                break;
+            default:
+                // The best block is in the snapshot metadata.
+                break;
+        }
+        if (!fOk)
+            return error("%s: unable to read record of type '%c'", __func__, ch);
+        if (ss.size() >= SNAPSHOT_BUFFER_SIZE)
+            flush();
+    }
+    ss << (char)0;
+    flush();
+    return true;
+}
+
+bool CCoinsViewDB::ReadSnapshot(CAutoFile& file, CHashWriter& hasher, bool fWrite, uint64_t& nCoins) {
+    CDBBatch batch(db);
+    CDBBatch* pbatch = fWrite ? &batch : nullptr;
+
+    nCoins = 0;
+    while (true) {
+        boost::this_thread::interruption_point();
+        char ch;
+        file >> ch;
+        hasher << ch;
+        switch (ch) {
+            case 0:
+                return !fWrite || db.WriteBatch(batch);
+            case DB_COIN: {
+                COutPoint outpoint;
+                Coin coin;
+                file >> outpoint >> coin;
+                hasher << outpoint << coin;
+                if (pbatch)
+                    batch.Write(CoinEntry(&outpoint), coin);
+                nCoins++;
+                break;
+            }
+            case DB_SPROUT_ANCHOR:
+                ReadSnapshotRecord<uint256, SproutMerkleTree>(file, hasher, ch, pbatch);
+                break;
+            case DB_SAPLING_ANCHOR:
+                ReadSnapshotRecord<uint256, SaplingMerkleTree>(file, hasher, ch, pbatch);
+                break;
+            case DB_NULLIFIER:
+            case DB_SAPLING_NULLIFIER:
+                ReadSnapshotRecord<uint256, bool>(file, hasher, ch, pbatch);
+                break;
+            case DB_BEST_SPROUT_ANCHOR:
+            case DB_BEST_SAPLING_ANCHOR:
+                ReadSnapshotValue<uint256>(file, hasher, ch, pbatch);
+                break;
+            case DB_MMR_LENGTH:
+                ReadSnapshotRecord<uint32_t, HistoryIndex>(file, hasher, ch, pbatch);
+                break;
+            case DB_MMR_NODE:
+                ReadSnapshotRecord<std::pair<uint32_t, HistoryIndex>, HistoryNodeBytes>(file, hasher, ch, pbatch);
+                break;
+            case DB_MMR_ROOT:
+                ReadSnapshotRecord<uint32_t, uint256>(file, hasher, ch, pbatch);
+                break;
+            default:
+                return error("%s: unknown record type %d", __func__, (int)ch);
+        }
+        if (fWrite && batch.SizeEstimate() > SNAPSHOT_BATCH_SIZE) {
+            if (!db.WriteBatch(batch))
+                return false;
+            batch.Clear();
+        }
+    }
+}
+
+bool CCoinsViewDB::BeginLoadSnapshot() {
+    // Mark the database first, so that an interrupted load is detected at startup.
+    if (!db.Write(DB_SNAPSHOT_LOADING, true, true))
+        return false;
+
+    CDBBatch batch(db);
+    boost::scoped_ptr<CDBIterator> pcursor(db.NewIterator());
+    for (pcursor->SeekToFirst(); pcursor->Valid(); pcursor->Next()) {
+        boost::this_thread::interruption_point();
+        char ch;
+        if (!pcursor->GetKey(ch))
+            return error("%s: unable to read key", __func__);
+        bool fOk = true;
+        switch (ch) {
+            case DB_COIN: {
+                COutPoint outpoint;
+                CoinEntry entry(&outpoint);
+                fOk = pcursor->GetKey(entry);
+                if (fOk)
+                    batch.Erase(entry);
+                break;
+            }
+            case DB_COINS:
+            case DB_SPROUT_ANCHOR:
+            case DB_SAPLING_ANCHOR:
+            case DB_NULLIFIER:
+            case DB_SAPLING_NULLIFIER:
+                fOk = EraseRecord<uint256>(pcursor.get(), batch);
+                break;
+            case DB_MMR_LENGTH:
+            case DB_MMR_ROOT:
+                fOk = EraseRecord<uint32_t>(pcursor.get(), batch);
+                break;
+            case DB_MMR_NODE:
+                fOk = EraseRecord<std::pair<uint32_t, HistoryIndex>>(pcursor.get(), batch);
+                break;
+            case DB_BEST_BLOCK:
+            case DB_BEST_SPROUT_ANCHOR:
+            case DB_BEST_SAPLING_ANCHOR:
+                batch.Erase(ch);
+                break;
+            default:
+                break;
+        }
+        if (!fOk)
+            return error("%s: unable to read key of type '%c'", __func__, ch);
+        if (batch.SizeEstimate() > SNAPSHOT_BATCH_SIZE) {
+            if (!db.WriteBatch(batch))
+                return false;
+            batch.Clear();
+        }
+    }
+    return db.WriteBatch(batch, true);
+}
+
+bool CCoinsViewDB::EndLoadSnapshot(const uint256 &hashBlock) {
+    CDBBatch batch(db);
+    batch.Write(DB_BEST_BLOCK, hashBlock);
+    batch.Erase(DB_SNAPSHOT_LOADING);
+    if (!db.WriteBatch(batch, true))
+        return false;
+
+    bool fFilters;
+    {
+        LOCK(cs_nullifierFilters);
+        fFilters = sproutNullifierFilter || saplingNullifierFilter;
+    }
+    if (fFilters)
+        LoadNullifierFilters();
+    return true;
+}
+
+bool CCoinsViewDB::IsLoadingSnapshot() const {
+    return db.Exists(DB_SNAPSHOT_LOADING);
+}
+
+bool CCoinsViewDB::BulkWriteCoins(CCoinsMap &mapCoins, CDBBatch &batch, size_t &changed) {
+    std::vector<CCoinsMap::const_iterator> vChanged;
+    for (CCoinsMap::const_iterator it = mapCoins.begin(); it != mapCoins.end(); ++it) {
+        if (it->second.flags & CCoinsCacheEntry::DIRTY)
+            vChanged.push_back(it);
+    }
+    // The keys are the transaction hash followed by the output index, whose
+    // VARINT encoding sorts in numeric order.
+    std::sort(vChanged.begin(), vChanged.end(), [](CCoinsMap::const_iterator a, CCoinsMap::const_iterator b) {
+        int nCompare = memcmp(a->first.hash.begin(), b->first.hash.begin(), a->first.hash.size());
+        return nCompare < 0 || (nCompare == 0 && a->first.n < b->first.n);
+    });
+
+    // The chunks before the last batch are written after the mark, which the
+    // last batch erases together with the new best block.
+    size_t nChunkSize = db.GetWriteBufferSize();
+    bool fMarked = false;
+    for (CCoinsMap::const_iterator it : vChanged) {
+        CoinEntry entry(&it->first);
+        if (it->second.coin.IsSpent())
+            batch.Erase(entry);
+        else
+            batch.Write(entry, it->second.coin);
+        if (batch.SizeEstimate() >= nChunkSize) {
+            if (!fMarked) {
+                if (!db.Write(DB_BULK_WRITE, true, true))
+                    return false;
+                fMarked = true;
+            }
+            if (!db.WriteBatch(batch))
+                return false;
+            batch.Clear();
+        }
+    }
+    if (fMarked)
+        batch.Erase(DB_BULK_WRITE);
+    changed = vChanged.size();
+    return true;
+}
+
+bool CCoinsViewDB::IsBulkWriteInterrupted() const {
+    return db.Exists(DB_BULK_WRITE);
+}
+
+CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) :
+    CDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe),
+    spentIndexCache(SPENT_INDEX_CACHE_SIZE), timestampIndexCache(TIMESTAMP_INDEX_CACHE_SIZE) {
+    if (!fMemory) {
+        pathCache = GetDataDir() / "blocks" / "index.cache";
+    }
 }
 
 bool CBlockTreeDB::ReadBlockFileInfo(int nFile, CBlockFileInfo &info) {
@@ -290,52 +842,148 @@ bool CBlockTreeDB::ReadLastBlockFile(int &nFile) {
     return Read(DB_LAST_BLOCK, nFile);
 }
 
+bool CBlockTreeDB::WriteUTXOStats(const CCoinsStats &stats) {
+    return Write(DB_UTXO_STATS, stats);
+}
+
+bool CBlockTreeDB::ReadUTXOStats(CCoinsStats &stats) {
+    return Read(DB_UTXO_STATS, stats);
+}
+
+bool CBlockTreeDB::WriteSnapshotBase(const CSnapshotMetadata &metadata) {
+    return Write(DB_SNAPSHOT_BASE, metadata, true);
+}
+
+bool CBlockTreeDB::ReadSnapshotBase(CSnapshotMetadata &metadata) {
+    return Read(DB_SNAPSHOT_BASE, metadata);
+}
+
+static void ApplyStats(CCoinsStats &stats, CHashWriter &ss, const uint256 &hash, const std::map<uint32_t, Coin> &outputs)
+{
+    assert(!outputs.empty());
+    stats.nTransactions++;
+    for (const auto& output : outputs) {
+        ss << VARINT(output.first + 1);
+        ss << output.second.out;
+        stats.AddCoin(COutPoint(hash, output.first), output.second);
+    }
+    ss << VARINT(0);
+}
+
 bool CCoinsViewDB::GetStats(CCoinsStats &stats) const {
     /* It seems that there are no "const iterators" for LevelDB.  Since we
        only need read operations on it, use a const-cast to get around
        that restriction.  */
-    boost::scoped_ptr<CDBIterator> pcursor(const_cast<CDBWrapper*>(&db)->NewIterator());
-    pcursor->Seek(DB_COINS);
+    CDBRangeReader reader(const_cast<CDBWrapper&>(db), DB_COIN, char(DB_COIN + 1), SCAN_BATCH_SIZE);
 
+    // The serialized hash commits to the unspent outputs of each transaction
+    // in output order, as it did for the per-transaction records.
     CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
     stats.hashBlock = GetBestBlock();
     ss << stats.hashBlock;
-    CAmount nTotalAmount = 0;
-    while (pcursor->Valid()) {
+    uint256 prevkey;
+    std::map<uint32_t, Coin> outputs;
+    // The coins of each batch are deserialized in parallel, and then added
+    // to the statistics in order.
+    int nThreads = ScanThreads();
+    std::vector<std::pair<COutPoint, Coin>> vCoins;
+    std::vector<char> vValid;
+    while (reader.ReadBatch()) {
         boost::this_thread::interruption_point();
-        std::pair<char, uint256> key;
-        CCoins coins;
-        if (pcursor->GetKey(key) && key.first == DB_COINS) {
-            if (pcursor->GetValue(coins)) {
-                stats.nTransactions++;
-                for (unsigned int i=0; i<coins.vout.size(); i++) {
-                    const CTxOut &out = coins.vout[i];
-                    if (!out.IsNull()) {
-                        stats.nTransactionOutputs++;
-                        ss << VARINT(i+1);
-                        ss << out;
-                        nTotalAmount += out.nValue;
-                    }
-                }
-                stats.nSerializedSize += 32 + pcursor->GetValueSize();
-                ss << VARINT(0);
-            } else {
-                return error("CCoinsViewDB::GetStats() : unable to read value");
+        vCoins.resize(reader.size());
+        vValid.assign(reader.size(), false);
+        ParallelFor(reader.size(), nThreads, [&](size_t i) {
+            CoinEntry entry(&vCoins[i].first);
+            vValid[i] = reader.GetKey(i, entry) && reader.GetValue(i, vCoins[i].second);
+        });
+        for (size_t i = 0; i < vCoins.size(); i++) {
+            if (!vValid[i]) {
+                return error("CCoinsViewDB::GetStats() : unable to read coin");
             }
-        } else {
-            break;
+            const COutPoint& key = vCoins[i].first;
+            if (!outputs.empty() && key.hash != prevkey) {
+                ApplyStats(stats, ss, prevkey, outputs);
+                outputs.clear();
+            }
+            prevkey = key.hash;
+            outputs[key.n] = std::move(vCoins[i].second);
         }
-        pcursor->Next();
+    }
+    if (!outputs.empty()) {
+        ApplyStats(stats, ss, prevkey, outputs);
     }
     {
         LOCK(cs_main);
         stats.nHeight = mapBlockIndex.find(stats.hashBlock)->second->nHeight;
     }
     stats.hashSerialized = ss.GetHash();
-    stats.nTotalAmount = nTotalAmount;
     return true;
 }
 
+bool CCoinsViewDB::Upgrade() {
+    boost::scoped_ptr<CDBIterator> pcursor(db.NewIterator());
+    pcursor->Seek(make_pair(DB_COINS, uint256()));
+    if (!pcursor->Valid()) {
+        return true;
+    }
+
+    int64_t count = 0;
+    LogPrintf("Upgrading UTXO database...\n");
+    LogPrintf("[0%%]...");
+    uiInterface.ShowProgress(_("Upgrading UTXO database"), 0);
+    size_t batch_size = 1 << 24;
+    CDBBatch batch(db);
+    int reportDone = 0;
+    std::pair<unsigned char, uint256> key;
+    std::pair<unsigned char, uint256> prev_key = {DB_COINS, uint256()};
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        if (ShutdownRequested()) {
+            break;
+        }
+        if (pcursor->GetKey(key) && key.first == DB_COINS) {
+            if (count++ % 256 == 0) {
+                uint32_t high = 0x100 * *key.second.begin() + *(key.second.begin() + 1);
+                int percentageDone = (int)(high * 100.0 / 65536.0 + 0.5);
+                uiInterface.ShowProgress(_("Upgrading UTXO database"), percentageDone);
+                if (reportDone < percentageDone/10) {
+                    // report max. every 10% step
+                    LogPrintf("[%d%%]...", percentageDone);
+                    reportDone = percentageDone/10;
+                }
+            }
+            CLegacyCoins old_coins;
+            if (!pcursor->GetValue(old_coins)) {
+                return error("%s: cannot parse legacy coins record", __func__);
+            }
+            COutPoint outpoint(key.second, 0);
+            for (size_t i = 0; i < old_coins.vout.size(); ++i) {
+                if (!old_coins.vout[i].IsNull() && !old_coins.vout[i].scriptPubKey.IsUnspendable()) {
+                    Coin newcoin(std::move(old_coins.vout[i]), old_coins.nHeight, old_coins.fCoinBase);
+                    outpoint.n = i;
+                    CoinEntry entry(&outpoint);
+                    batch.Write(entry, newcoin);
+                }
+            }
+            batch.Erase(key);
+            if (batch.SizeEstimate() > batch_size) {
+                db.WriteBatch(batch);
+                batch.Clear();
+                db.CompactRange(prev_key, key);
+                prev_key = key;
+            }
+            pcursor->Next();
+        } else {
+            break;
+        }
+    }
+    db.WriteBatch(batch);
+    db.CompactRange(prev_key, key);
+    uiInterface.ShowProgress("", 100);
+    LogPrintf("[%s].\n", ShutdownRequested() ? "CANCELLED" : "DONE");
+    return !ShutdownRequested();
+}
+
 bool CBlockTreeDB::WriteBatchSync(const std::vector<std::pair<int, const CBlockFileInfo*> >& fileInfo, int nLastFile, const std::vector<const CBlockIndex*>& blockinfo) {
     CDBBatch batch(*this);
     for (std::vector<std::pair<int, const CBlockFileInfo*> >::const_iterator it=fileInfo.begin(); it != fileInfo.end(); it++) {
@@ -348,6 +996,10 @@ bool CBlockTreeDB::WriteBatchSync(const std::vector<std::pair<int, const CBlockF
     return WriteBatch(batch, true);
 }
 
+bool CBlockTreeDB::ReadDiskBlockIndex(const uint256 &hash, CDiskBlockIndex &dbindex) {
+    return Read(make_pair(DB_BLOCK_INDEX, hash), dbindex);
+}
+
 bool CBlockTreeDB::EraseBatchSync(const std::vector<const CBlockIndex*>& blockinfo) {
     CDBBatch batch(*this);
     for (std::vector<const CBlockIndex*>::const_iterator it=blockinfo.begin(); it != blockinfo.end(); it++) {
@@ -367,6 +1019,63 @@ bool CBlockTreeDB::WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos>
     return WriteBatch(batch);
 }
 
+bool CBlockTreeDB::ReadCompactBlock(const uint256 &hash, CCompactBlock &block) {
+    return Read(make_pair(DB_COMPACT_BLOCK, hash), block);
+}
+
+bool CBlockTreeDB::WriteCompactBlock(const uint256 &hash, const CCompactBlock &block) {
+    return Write(make_pair(DB_COMPACT_BLOCK, hash), block);
+}
+
+bool CBlockTreeDB::ReadBlockFilter(const uint256 &hash, CBlockFilterEntry &entry) {
+    return Read(make_pair(DB_BLOCK_FILTER, hash), entry);
+}
+
+bool CBlockTreeDB::WriteBlockFilter(const uint256 &hash, const CBlockFilterEntry &entry) {
+    return Write(make_pair(DB_BLOCK_FILTER, hash), entry);
+}
+
+bool CBlockTreeDB::ReadSaplingSpendIndex(const uint256 &nullifier, CSaplingSpendIndexValue &value) {
+    return Read(make_pair(DB_SAPLING_SPENDINDEX, nullifier), value);
+}
+
+bool CBlockTreeDB::ReadSaplingOutputIndex(const uint256 &cmu, CSaplingOutputIndexValue &value) {
+    return Read(make_pair(DB_SAPLING_OUTPUTINDEX, cmu), value);
+}
+
+bool CBlockTreeDB::ReadSaplingTreeSize(const uint256 &hash, uint64_t &nSize) {
+    return Read(make_pair(DB_SAPLING_TREE_SIZE, hash), nSize);
+}
+
+bool CBlockTreeDB::ReadSaplingTreeNode(const CSaplingTreeNodeKey &key, uint256 &node) {
+    return Read(make_pair(DB_SAPLING_TREE_NODE, key), node);
+}
+
+bool CBlockTreeDB::WriteShieldedIndex(const std::vector<CSaplingSpendIndexDbEntry> &spends,
+                                      const std::vector<CSaplingOutputIndexDbEntry> &outputs,
+                                      const std::vector<CSaplingTreeNodeDbEntry> &nodes,
+                                      const uint256 &hash, uint64_t nTreeSize) {
+    CDBBatch batch(*this);
+    for (const CSaplingSpendIndexDbEntry& entry : spends)
+        batch.Write(make_pair(DB_SAPLING_SPENDINDEX, entry.first), entry.second);
+    for (const CSaplingOutputIndexDbEntry& entry : outputs)
+        batch.Write(make_pair(DB_SAPLING_OUTPUTINDEX, entry.first), entry.second);
+    for (const CSaplingTreeNodeDbEntry& entry : nodes)
+        batch.Write(make_pair(DB_SAPLING_TREE_NODE, entry.first), entry.second);
+    batch.Write(make_pair(DB_SAPLING_TREE_SIZE, hash), nTreeSize);
+    return WriteBatch(batch);
+}
+
+bool CBlockTreeDB::EraseShieldedIndex(const std::vector<CSaplingSpendIndexDbEntry> &spends,
+                                      const std::vector<CSaplingOutputIndexDbEntry> &outputs) {
+    CDBBatch batch(*this);
+    for (const CSaplingSpendIndexDbEntry& entry : spends)
+        batch.Erase(make_pair(DB_SAPLING_SPENDINDEX, entry.first));
+    for (const CSaplingOutputIndexDbEntry& entry : outputs)
+        batch.Erase(make_pair(DB_SAPLING_OUTPUTINDEX, entry.first));
+    return WriteBatch(batch);
+}
+
 // START insightexplorer
 // https://github.com/bitpay/bitcoin/commit/017f548ea6d89423ef568117447e61dd5707ec42#diff-81e4f16a1b5d5b7ca25351a63d07cb80R183
 bool CBlockTreeDB::UpdateAddressUnspentIndex(const std::vector<CAddressUnspentDbEntry> &vect)
@@ -402,51 +1111,197 @@ bool CBlockTreeDB::ReadAddressUnspentIndex(uint160 addressHash, int type, std::v
     return true;
 }
 
-bool CBlockTreeDB::WriteAddressIndex(const std::vector<CAddressIndexDbEntry> &vect) {
+// Add the deltas of address index entries to the running balances of their
+// addresses, or take them off when the entries are erased.
+void CBlockTreeDB::BatchAddressBalances(CDBBatch &batch, const std::vector<CAddressIndexDbEntry> &vect, bool fErase)
+{
+    std::map<std::pair<int, uint160>, CAddressBalanceValue> balances;
+    for (const CAddressIndexDbEntry& entry : vect) {
+        // Only count entries that the batch adds or erases, so that writing
+        // a block a second time does not count it twice.
+        if (Exists(make_pair(DB_ADDRESSINDEX, entry.first)) != fErase)
+            continue;
+        std::pair<int, uint160> address(entry.first.type, entry.first.hashBytes);
+        auto it = balances.find(address);
+        if (it == balances.end()) {
+            it = balances.emplace(address, CAddressBalanceValue()).first;
+            ReadAddressBalance(address.second, address.first, it->second);
+        }
+        CAmount nDelta = fErase ? -entry.second : entry.second;
+        it->second.balance += nDelta;
+        if (entry.second > 0)
+            it->second.received += nDelta;
+    }
+    for (const auto& it : balances) {
+        std::pair<char, CAddressIndexIteratorKey> key(DB_ADDRESSBALANCE, CAddressIndexIteratorKey(it.first.first, it.first.second));
+        if (it.second.IsNull()) {
+            batch.Erase(key);
+        } else {
+            batch.Write(key, it.second);
+        }
+    }
+}
+
+bool CBlockTreeDB::WriteAddressIndex(const std::vector<CAddressIndexDbEntry> &vect, bool fBalances) {
     CDBBatch batch(*this);
     for (std::vector<CAddressIndexDbEntry>::const_iterator it=vect.begin(); it!=vect.end(); it++)
         batch.Write(make_pair(DB_ADDRESSINDEX, it->first), it->second);
+    if (fBalances)
+        BatchAddressBalances(batch, vect, false);
     return WriteBatch(batch);
 }
 
-bool CBlockTreeDB::EraseAddressIndex(const std::vector<CAddressIndexDbEntry> &vect) {
+bool CBlockTreeDB::EraseAddressIndex(const std::vector<CAddressIndexDbEntry> &vect, bool fBalances) {
     CDBBatch batch(*this);
     for (std::vector<CAddressIndexDbEntry>::const_iterator it=vect.begin(); it!=vect.end(); it++)
         batch.Erase(make_pair(DB_ADDRESSINDEX, it->first));
+    if (fBalances)
+        BatchAddressBalances(batch, vect, true);
     return WriteBatch(batch);
 }
 
 bool CBlockTreeDB::ReadAddressIndex(
         uint160 addressHash, int type,
         std::vector<CAddressIndexDbEntry> &addressIndex,
-        int start, int end)
+        int start, int end,
+        const CAddressIndexKey* after, size_t limit)
 {
     boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
 
-    if (start > 0 && end > 0) {
+    if (after && (start <= 0 || after->blockHeight >= start)) {
+        pcursor->Seek(make_pair(DB_ADDRESSINDEX, *after));
+    } else if (start > 0 && end > 0) {
         pcursor->Seek(make_pair(DB_ADDRESSINDEX, CAddressIndexIteratorHeightKey(type, addressHash, start)));
     } else {
         pcursor->Seek(make_pair(DB_ADDRESSINDEX, CAddressIndexIteratorKey(type, addressHash)));
     }
 
-    while (pcursor->Valid()) {
+    size_t nRead = 0;
+    while (pcursor->Valid() && (limit == 0 || nRead < limit)) {
         boost::this_thread::interruption_point();
         std::pair<char,CAddressIndexKey> key;
         if (!(pcursor->GetKey(key) && key.first == DB_ADDRESSINDEX && key.second.hashBytes == addressHash))
             break;
         if (end > 0 && key.second.blockHeight > end)
             break;
+        // Skip the entry that the previous page ended with.
+        if (after && key.second == *after) {
+            pcursor->Next();
+            continue;
+        }
         CAmount nValue;
         if (!pcursor->GetValue(nValue))
             return error("failed to get address index value");
         addressIndex.push_back(make_pair(key.second, nValue));
+        nRead++;
         pcursor->Next();
     }
     return true;
 }
 
+bool CBlockTreeDB::ReadAddressBalance(uint160 addressHash, int type, CAddressBalanceValue &value) {
+    if (!Read(make_pair(DB_ADDRESSBALANCE, CAddressIndexIteratorKey(type, addressHash)), value))
+        value.SetNull();
+    return true;
+}
+
+bool CBlockTreeDB::ReadIndexBest(const std::string &name, uint256 &hash) {
+    return Read(std::make_pair(DB_INDEX_BEST, name), hash);
+}
+
+bool CBlockTreeDB::WriteIndexBest(const std::string &name, const uint256 &hash) {
+    return Write(std::make_pair(DB_INDEX_BEST, name), hash);
+}
+
+bool CBlockTreeDB::EraseIndexBest(const std::string &name) {
+    return Erase(std::make_pair(DB_INDEX_BEST, name));
+}
+
+// Erase every record under a key prefix, whose keys are of type K.
+template <typename K>
+bool CBlockTreeDB::EraseRecords(char prefix)
+{
+    boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+    CDBBatch batch(*this);
+
+    pcursor->Seek(prefix);
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        std::pair<char, K> key;
+        if (!(pcursor->GetKey(key) && key.first == prefix))
+            break;
+        batch.Erase(key);
+        if (batch.SizeEstimate() > DROP_INDEX_BATCH_SIZE) {
+            if (!WriteBatch(batch))
+                return false;
+            batch.Clear();
+        }
+        pcursor->Next();
+    }
+    return WriteBatch(batch);
+}
+
+bool CBlockTreeDB::DropTxIndex() {
+    return EraseRecords<uint256>(DB_TXINDEX);
+}
+
+bool CBlockTreeDB::DropAddressIndex() {
+    return EraseRecords<CAddressIndexKey>(DB_ADDRESSINDEX) &&
+           EraseRecords<CAddressUnspentKey>(DB_ADDRESSUNSPENTINDEX) &&
+           EraseRecords<CAddressIndexIteratorKey>(DB_ADDRESSBALANCE);
+}
+
+bool CBlockTreeDB::DropBlockFilterIndex() {
+    return EraseRecords<uint256>(DB_BLOCK_FILTER);
+}
+
+bool CBlockTreeDB::DropShieldedIndex() {
+    return EraseRecords<uint256>(DB_SAPLING_SPENDINDEX) &&
+           EraseRecords<uint256>(DB_SAPLING_OUTPUTINDEX) &&
+           EraseRecords<uint256>(DB_SAPLING_TREE_SIZE) &&
+           EraseRecords<CSaplingTreeNodeKey>(DB_SAPLING_TREE_NODE);
+}
+
+bool CBlockTreeDB::DropSpentIndex() {
+    bool ret = EraseRecords<CSpentIndexKey>(DB_SPENTINDEX);
+    LOCK(cs_indexCache);
+    nIndexCacheGeneration++;
+    spentIndexCache.clear();
+    return ret;
+}
+
+bool CBlockTreeDB::DropTimestampIndex() {
+    bool ret = EraseRecords<CTimestampIndexKey>(DB_TIMESTAMPINDEX) &&
+               EraseRecords<uint256>(DB_BLOCKHASHINDEX);
+    ClearTimestampIndexCache();
+    return ret;
+}
+
 bool CBlockTreeDB::ReadSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value) {
-    return Read(make_pair(DB_SPENTINDEX, key), value);
+    uint64_t nGeneration;
+    {
+        LOCK(cs_indexCache);
+        if (spentIndexCache.get(key, value)) {
+            MetricsIncrementCounter("zcash.index.cache.hits", "index", "spent");
+            return !value.IsNull();
+        }
+        nGeneration = nIndexCacheGeneration;
+    }
+    MetricsIncrementCounter("zcash.index.cache.misses", "index", "spent");
+
+    CSpentIndexValue valueRead;
+    bool fFound = Read(make_pair(DB_SPENTINDEX, key), valueRead);
+    if (!fFound) {
+        valueRead.SetNull();
+    }
+    LOCK(cs_indexCache);
+    if (nGeneration == nIndexCacheGeneration) {
+        spentIndexCache.put(key, valueRead);
+    }
+    if (fFound) {
+        value = valueRead;
+    }
+    return fFound;
 }
 
 bool CBlockTreeDB::UpdateSpentIndex(const std::vector<CSpentIndexDbEntry> &vect) {
@@ -458,18 +1313,42 @@ bool CBlockTreeDB::UpdateSpentIndex(const std::vector<CSpentIndexDbEntry> &vect)
             batch.Write(make_pair(DB_SPENTINDEX, it->first), it->second);
         }
     }
-    return WriteBatch(batch);
+    bool ret = WriteBatch(batch);
+
+    LOCK(cs_indexCache);
+    nIndexCacheGeneration++;
+    for (const CSpentIndexDbEntry& entry : vect) {
+        spentIndexCache.erase(entry.first);
+    }
+    return ret;
 }
 
 bool CBlockTreeDB::WriteTimestampIndex(const CTimestampIndexKey &timestampIndex) {
     CDBBatch batch(*this);
     batch.Write(make_pair(DB_TIMESTAMPINDEX, timestampIndex), 0);
-    return WriteBatch(batch);
+    bool ret = WriteBatch(batch);
+    ClearTimestampIndexCache();
+    return ret;
 }
 
 bool CBlockTreeDB::ReadTimestampIndex(unsigned int high, unsigned int low,
     const bool fActiveOnly, std::vector<std::pair<uint256, unsigned int> > &hashes)
 {
+    const auto cacheKey = std::make_tuple(high, low, fActiveOnly);
+    uint64_t nGeneration;
+    {
+        LOCK(cs_indexCache);
+        std::vector<std::pair<uint256, unsigned int> > cached;
+        if (timestampIndexCache.get(cacheKey, cached)) {
+            MetricsIncrementCounter("zcash.index.cache.hits", "index", "timestamp");
+            hashes.insert(hashes.end(), cached.begin(), cached.end());
+            return true;
+        }
+        nGeneration = nIndexCacheGeneration;
+    }
+    MetricsIncrementCounter("zcash.index.cache.misses", "index", "timestamp");
+
+    std::vector<std::pair<uint256, unsigned int> > found;
     boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
 
     pcursor->Seek(make_pair(DB_TIMESTAMPINDEX, CTimestampIndexIteratorKey(low)));
@@ -483,16 +1362,31 @@ bool CBlockTreeDB::ReadTimestampIndex(unsigned int high, unsigned int low,
         if (fActiveOnly) {
             CBlockIndex* pblockindex = mapBlockIndex[key.second.blockHash];
             if (chainActive.Contains(pblockindex)) {
-                hashes.push_back(std::make_pair(key.second.blockHash, key.second.timestamp));
+                found.push_back(std::make_pair(key.second.blockHash, key.second.timestamp));
             }
         } else {
-            hashes.push_back(std::make_pair(key.second.blockHash, key.second.timestamp));
+            found.push_back(std::make_pair(key.second.blockHash, key.second.timestamp));
         }
         pcursor->Next();
     }
+
+    if (found.size() <= TIMESTAMP_INDEX_CACHE_MAX_BLOCKS) {
+        LOCK(cs_indexCache);
+        if (nGeneration == nIndexCacheGeneration) {
+            timestampIndexCache.put(cacheKey, found);
+        }
+    }
+    hashes.insert(hashes.end(), found.begin(), found.end());
     return true;
 }
 
+void CBlockTreeDB::ClearTimestampIndexCache()
+{
+    LOCK(cs_indexCache);
+    nIndexCacheGeneration++;
+    timestampIndexCache.clear();
+}
+
 bool CBlockTreeDB::WriteTimestampBlockIndex(const CTimestampBlockIndexKey &blockhashIndex,
     const CTimestampBlockIndexValue &logicalts)
 {
@@ -524,92 +1418,303 @@ bool CBlockTreeDB::ReadFlag(const std::string &name, bool &fValue) {
     return true;
 }
 
+namespace {
+
+/** Bytes of block index records that are read from the database and checked together. */
+const size_t BLOCK_INDEX_LOAD_BATCH_SIZE = 16 << 20;
+/** Number of block index entries in each checksummed chunk of the cache. */
+const size_t BLOCK_INDEX_CACHE_CHUNK = 4096;
+const uint32_t BLOCK_INDEX_CACHE_MAGIC = 0x7a636269;
+const int BLOCK_INDEX_CACHE_VERSION = 1;
+
+struct LoadedBlockIndex {
+    uint256 hash;
+    CDiskBlockIndex diskindex;
+};
+
+struct BlockIndexCacheChunk {
+    uint32_t nCount;
+    std::vector<char> vData;
+    uint256 checksum;
+    std::vector<LoadedBlockIndex> vEntries;
+};
+
+/**
+ * Deserialize a block index record read from the database, and check it.
+ * Returns an error message, or the empty string if the record is valid.
+ */
+std::string ParseBlockIndexRecord(
+    const CDBRangeReader& reader,
+    size_t nRecord,
+    const CChainParams& chainParams,
+    LoadedBlockIndex& loaded)
+{
+    const CDiskBlockIndex& diskindex = loaded.diskindex;
+    std::pair<char, uint256> key;
+    if (!reader.GetKey(nRecord, key)) {
+        return "failed to read key";
+    }
+    loaded.hash = key.second;
+    if (!reader.GetValue(nRecord, loaded.diskindex)) {
+        return "failed to read value";
+    }
+
+    // Consistency checks
+    if (diskindex.GetBlockHash() != loaded.hash)
+        return strprintf("block header inconsistency detected: on-disk = %s, key = %s",
+            diskindex.ToString(), loaded.hash.ToString());
+    if (!CheckProofOfWork(loaded.hash, diskindex.nBits, chainParams.GetConsensus()))
+        return strprintf("CheckProofOfWork failed: %s", diskindex.ToString());
+
+    // ZIP 221 consistency checks
+    // These checks should only be performed for block index entries marked
+    // as consensus-valid (at the time they were written).
+    //
+    if (diskindex.IsValid(BLOCK_VALID_CONSENSUS)) {
+        // We assume block index entries on disk that are not at least
+        // CHAIN_HISTORY_ROOT_VERSION were created by nodes that were
+        // not Heartwood aware. Such a node would not see Heartwood block
+        // headers as valid, and so this must *either* be an index entry
+        // for a block header on a non-Heartwood chain, or be marked as
+        // consensus-invalid.
+        //
+        // It can also happen that the block index entry was written
+        // by this node when it was Heartwood-aware (so its version
+        // will be >= CHAIN_HISTORY_ROOT_VERSION), but received from
+        // a non-upgraded peer. However that case the entry will be
+        // marked as consensus-invalid.
+        //
+        if (diskindex.nClientVersion >= CHAIN_HISTORY_ROOT_VERSION &&
+            chainParams.GetConsensus().NetworkUpgradeActive(diskindex.nHeight, Consensus::UPGRADE_HEARTWOOD)) {
+            if (diskindex.hashLightClientRoot != diskindex.hashChainHistoryRoot) {
+                return strprintf(
+                    "block index inconsistency detected (post-Heartwood; hashLightClientRoot %s != hashChainHistoryRoot %s): %s",
+                    diskindex.hashLightClientRoot.ToString(), diskindex.hashChainHistoryRoot.ToString(), diskindex.ToString());
+            }
+        } else {
+            if (diskindex.hashLightClientRoot != diskindex.hashFinalSaplingRoot) {
+                return strprintf(
+                    "block index inconsistency detected (pre-Heartwood; hashLightClientRoot %s != hashFinalSaplingRoot %s): %s",
+                    diskindex.hashLightClientRoot.ToString(), diskindex.hashFinalSaplingRoot.ToString(), diskindex.ToString());
+            }
+        }
+    }
+    return "";
+}
+
+/** Verify the checksum of a chunk of the block index cache, and deserialize its entries. */
+bool ParseBlockIndexCacheChunk(BlockIndexCacheChunk& chunk)
+{
+    if (Hash(chunk.vData.begin(), chunk.vData.end()) != chunk.checksum) {
+        return false;
+    }
+    try {
+        CDataStream ss(chunk.vData.data(), chunk.vData.data() + chunk.vData.size(), SER_DISK, CLIENT_VERSION);
+        chunk.vEntries.resize(chunk.nCount);
+        for (LoadedBlockIndex& loaded : chunk.vEntries) {
+            ss >> loaded.hash >> loaded.diskindex;
+        }
+        return ss.empty();
+    } catch (const std::exception&) {
+        return false;
+    }
+}
+
+void InsertLoadedBlockIndex(
+    const std::function<CBlockIndex*(const uint256&)>& insertBlockIndex,
+    const LoadedBlockIndex& loaded)
+{
+    const CDiskBlockIndex& diskindex = loaded.diskindex;
+
+    // Construct block index object
+    CBlockIndex* pindexNew = insertBlockIndex(loaded.hash);
+    pindexNew->pprev          = insertBlockIndex(diskindex.hashPrev);
+    pindexNew->nHeight        = diskindex.nHeight;
+    pindexNew->nFile          = diskindex.nFile;
+    pindexNew->nDataPos       = diskindex.nDataPos;
+    pindexNew->nUndoPos       = diskindex.nUndoPos;
+    pindexNew->hashSproutAnchor     = diskindex.hashSproutAnchor;
+    pindexNew->nVersion       = diskindex.nVersion;
+    pindexNew->hashMerkleRoot = diskindex.hashMerkleRoot;
+    pindexNew->hashLightClientRoot  = diskindex.hashLightClientRoot;
+    pindexNew->nTime          = diskindex.nTime;
+    pindexNew->nBits          = diskindex.nBits;
+    pindexNew->nNonce         = diskindex.nNonce;
+    pindexNew->nStatus        = diskindex.nStatus;
+    pindexNew->nCachedBranchId = diskindex.nCachedBranchId;
+    pindexNew->nTx            = diskindex.nTx;
+    pindexNew->nSproutValue   = diskindex.nSproutValue;
+    pindexNew->nSaplingValue  = diskindex.nSaplingValue;
+    pindexNew->hashFinalSaplingRoot = diskindex.hashFinalSaplingRoot;
+    pindexNew->hashChainHistoryRoot = diskindex.hashChainHistoryRoot;
+}
+
+} // namespace
+
+uint256 CBlockTreeDB::GetBlockFilesHash()
+{
+    int nFile = 0;
+    CBlockFileInfo info;
+    if (ReadLastBlockFile(nFile)) {
+        ReadBlockFileInfo(nFile, info);
+    }
+    return SerializeHash(std::make_pair(nFile, info));
+}
+
+bool CBlockTreeDB::WriteBlockIndexCache(const std::vector<const CBlockIndex*>& blockinfo)
+{
+    if (pathCache.empty()) {
+        return false;
+    }
+
+    uint64_t nNonce = GetRand(std::numeric_limits<uint64_t>::max());
+    fs::path pathTmp = pathCache;
+    pathTmp += ".new";
+    CAutoFile fileout(fsbridge::fopen(pathTmp, "wb"), SER_DISK, CLIENT_VERSION);
+    if (fileout.IsNull()) {
+        return error("%s: failed to open %s", __func__, pathTmp.string());
+    }
+    try {
+        fileout << BLOCK_INDEX_CACHE_MAGIC << BLOCK_INDEX_CACHE_VERSION << nNonce << GetBlockFilesHash();
+        for (size_t nStart = 0; nStart < blockinfo.size(); nStart += BLOCK_INDEX_CACHE_CHUNK) {
+            size_t nEnd = std::min(nStart + BLOCK_INDEX_CACHE_CHUNK, blockinfo.size());
+            CDataStream ss(SER_DISK, CLIENT_VERSION);
+            for (size_t i = nStart; i < nEnd; i++) {
+                // Entries are trimmed once written, so the solutions are left out.
+                CDiskBlockIndex diskindex(blockinfo[i], false);
+                diskindex.TrimSolution();
+                ss << blockinfo[i]->GetBlockHash() << diskindex;
+            }
+            std::vector<char> vData(ss.begin(), ss.end());
+            fileout << uint32_t(nEnd - nStart) << vData << Hash(vData.begin(), vData.end());
+        }
+        fileout << uint32_t(0);
+    } catch (const std::exception& e) {
+        return error("%s: failed to write %s: %s", __func__, pathTmp.string(), e.what());
+    }
+    FileCommit(fileout.Get());
+    fileout.fclose();
+    if (!RenameOver(pathTmp, pathCache)) {
+        return error("%s: failed to rename %s", __func__, pathTmp.string());
+    }
+
+    // The cache is only valid while the database holds its nonce.
+    return Write(DB_BLOCK_INDEX_CACHE, nNonce, true);
+}
+
+bool CBlockTreeDB::LoadBlockIndexCache(std::function<CBlockIndex*(const uint256&)> insertBlockIndex)
+{
+    if (pathCache.empty()) {
+        return false;
+    }
+
+    // The cache can only be used once: the database is about to change.
+    uint64_t nNonce = 0;
+    bool fHaveNonce = Read(DB_BLOCK_INDEX_CACHE, nNonce);
+    if (fHaveNonce && !Erase(DB_BLOCK_INDEX_CACHE, true)) {
+        fHaveNonce = false;
+    }
+
+    CAutoFile filein(fsbridge::fopen(pathCache, "rb"), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull()) {
+        return false;
+    }
+
+    // The file is read sequentially in chunks, and the checksums and
+    // entries of each group of chunks are parsed in parallel.
+    bool fLoaded = false;
+    size_t nEntries = 0;
+    try {
+        uint32_t nMagic;
+        int nVersion;
+        uint64_t nFileNonce;
+        uint256 hashBlockFiles;
+        filein >> nMagic >> nVersion >> nFileNonce >> hashBlockFiles;
+        if (!fHaveNonce || nMagic != BLOCK_INDEX_CACHE_MAGIC || nVersion != BLOCK_INDEX_CACHE_VERSION ||
+            nFileNonce != nNonce || hashBlockFiles != GetBlockFilesHash()) {
+            LogPrintf("%s: the block index cache is stale\n", __func__);
+        } else {
+            int nThreads = ScanThreads();
+            std::vector<BlockIndexCacheChunk> vChunks;
+            bool fEnd = false;
+            fLoaded = true;
+            while (fLoaded && !fEnd) {
+                boost::this_thread::interruption_point();
+                vChunks.clear();
+                while (vChunks.size() < size_t(2 * nThreads)) {
+                    BlockIndexCacheChunk chunk;
+                    filein >> chunk.nCount;
+                    if (chunk.nCount == 0) {
+                        fEnd = true;
+                        break;
+                    }
+                    filein >> chunk.vData >> chunk.checksum;
+                    vChunks.push_back(std::move(chunk));
+                }
+
+                std::atomic<bool> fValid(true);
+                ParallelFor(vChunks.size(), nThreads, [&](size_t i) {
+                    if (!ParseBlockIndexCacheChunk(vChunks[i])) {
+                        fValid = false;
+                    }
+                }, WorkPriority::VALIDATION);
+                if (!fValid) {
+                    LogPrintf("%s: the block index cache is corrupt\n", __func__);
+                    fLoaded = false;
+                    break;
+                }
+                for (const BlockIndexCacheChunk& chunk : vChunks) {
+                    for (const LoadedBlockIndex& loaded : chunk.vEntries) {
+                        InsertLoadedBlockIndex(insertBlockIndex, loaded);
+                    }
+                    nEntries += chunk.vEntries.size();
+                }
+            }
+        }
+    } catch (const std::exception& e) {
+        LogPrintf("%s: failed to read the block index cache: %s\n", __func__, e.what());
+        fLoaded = false;
+    }
+    filein.fclose();
+    fs::remove(pathCache);
+
+    if (fLoaded) {
+        LogPrintf("%s: loaded %u block index entries from the cache\n", __func__, nEntries);
+    }
+    return fLoaded;
+}
+
 bool CBlockTreeDB::LoadBlockIndexGuts(
     std::function<CBlockIndex*(const uint256&)> insertBlockIndex,
     const CChainParams& chainParams)
 {
-    boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+    // Entries of a stale or corrupt cache that were already inserted are
+    // overwritten below, as the database holds every entry in the cache.
+    if (LoadBlockIndexCache(insertBlockIndex)) {
+        return true;
+    }
 
-    pcursor->Seek(make_pair(DB_BLOCK_INDEX, uint256()));
+    CDBRangeReader reader(*this, make_pair(DB_BLOCK_INDEX, uint256()), char(DB_BLOCK_INDEX + 1), BLOCK_INDEX_LOAD_BATCH_SIZE);
 
-    // Load mapBlockIndex
-    while (pcursor->Valid()) {
+    // Load mapBlockIndex. The records are read in batches, and the header
+    // hashes and proofs of work of each batch, which dominate the loading
+    // time, are checked in parallel before its entries are inserted.
+    int nThreads = ScanThreads();
+    std::vector<LoadedBlockIndex> vLoaded;
+    std::vector<std::string> vErrors;
+    while (reader.ReadBatch()) {
         boost::this_thread::interruption_point();
-        std::pair<char, uint256> key;
-        if (pcursor->GetKey(key) && key.first == DB_BLOCK_INDEX) {
-            CDiskBlockIndex diskindex;
-            if (pcursor->GetValue(diskindex)) {
-                // Construct block index object
-                CBlockIndex* pindexNew = insertBlockIndex(diskindex.GetBlockHash());
-                pindexNew->pprev          = insertBlockIndex(diskindex.hashPrev);
-                pindexNew->nHeight        = diskindex.nHeight;
-                pindexNew->nFile          = diskindex.nFile;
-                pindexNew->nDataPos       = diskindex.nDataPos;
-                pindexNew->nUndoPos       = diskindex.nUndoPos;
-                pindexNew->hashSproutAnchor     = diskindex.hashSproutAnchor;
-                pindexNew->nVersion       = diskindex.nVersion;
-                pindexNew->hashMerkleRoot = diskindex.hashMerkleRoot;
-                pindexNew->hashLightClientRoot  = diskindex.hashLightClientRoot;
-                pindexNew->nTime          = diskindex.nTime;
-                pindexNew->nBits          = diskindex.nBits;
-                pindexNew->nNonce         = diskindex.nNonce;
-                pindexNew->nSolution      = diskindex.nSolution;
-                pindexNew->nStatus        = diskindex.nStatus;
-                pindexNew->nCachedBranchId = diskindex.nCachedBranchId;
-                pindexNew->nTx            = diskindex.nTx;
-                pindexNew->nSproutValue   = diskindex.nSproutValue;
-                pindexNew->nSaplingValue  = diskindex.nSaplingValue;
-                pindexNew->hashFinalSaplingRoot = diskindex.hashFinalSaplingRoot;
-                pindexNew->hashChainHistoryRoot = diskindex.hashChainHistoryRoot;
-
-                // Consistency checks
-                auto header = pindexNew->GetBlockHeader();
-                if (header.GetHash() != pindexNew->GetBlockHash())
-                    return error("LoadBlockIndex(): block header inconsistency detected: on-disk = %s, in-memory = %s",
-                       diskindex.ToString(),  pindexNew->ToString());
-                if (!CheckProofOfWork(pindexNew->GetBlockHash(), pindexNew->nBits, Params().GetConsensus()))
-                    return error("LoadBlockIndex(): CheckProofOfWork failed: %s", pindexNew->ToString());
-
-                // ZIP 221 consistency checks
-                // These checks should only be performed for block index entries marked
-                // as consensus-valid (at the time they were written).
-                //
-                if (pindexNew->IsValid(BLOCK_VALID_CONSENSUS)) {
-                    // We assume block index entries on disk that are not at least
-                    // CHAIN_HISTORY_ROOT_VERSION were created by nodes that were
-                    // not Heartwood aware. Such a node would not see Heartwood block
-                    // headers as valid, and so this must *either* be an index entry
-                    // for a block header on a non-Heartwood chain, or be marked as
-                    // consensus-invalid.
-                    //
-                    // It can also happen that the block index entry was written
-                    // by this node when it was Heartwood-aware (so its version
-                    // will be >= CHAIN_HISTORY_ROOT_VERSION), but received from
-                    // a non-upgraded peer. However that case the entry will be
-                    // marked as consensus-invalid.
-                    //
-                    if (diskindex.nClientVersion >= CHAIN_HISTORY_ROOT_VERSION &&
-                        chainParams.GetConsensus().NetworkUpgradeActive(pindexNew->nHeight, Consensus::UPGRADE_HEARTWOOD)) {
-                        if (pindexNew->hashLightClientRoot != pindexNew->hashChainHistoryRoot) {
-                            return error(
-                                "LoadBlockIndex(): block index inconsistency detected (post-Heartwood; hashLightClientRoot %s != hashChainHistoryRoot %s): %s",
-                                pindexNew->hashLightClientRoot.ToString(), pindexNew->hashChainHistoryRoot.ToString(), pindexNew->ToString());
-                        }
-                    } else {
-                        if (pindexNew->hashLightClientRoot != pindexNew->hashFinalSaplingRoot) {
-                            return error(
-                                "LoadBlockIndex(): block index inconsistency detected (pre-Heartwood; hashLightClientRoot %s != hashFinalSaplingRoot %s): %s",
-                                pindexNew->hashLightClientRoot.ToString(), pindexNew->hashFinalSaplingRoot.ToString(), pindexNew->ToString());
-                        }
-                    }
-                }
-
-                pcursor->Next();
-            } else {
-                return error("LoadBlockIndex() : failed to read value");
+        vLoaded.clear();
+        vLoaded.resize(reader.size());
+        vErrors.assign(reader.size(), std::string());
+        ParallelFor(reader.size(), nThreads, [&](size_t i) {
+            vErrors[i] = ParseBlockIndexRecord(reader, i, chainParams, vLoaded[i]);
+        }, WorkPriority::VALIDATION);
+        for (size_t i = 0; i < vLoaded.size(); i++) {
+            if (!vErrors[i].empty()) {
+                return error("LoadBlockIndex(): %s", vErrors[i]);
             }
-        } else {
-            break;
+            InsertLoadedBlockIndex(insertBlockIndex, vLoaded[i]);
         }
     }
 
@@ -6,19 +6,33 @@
 #ifndef BITCOIN_TXDB_H
 #define BITCOIN_TXDB_H
 
+#include "blockfilter.h"
+#include "bloom.h"
 #include "coins.h"
 #include "dbwrapper.h"
 #include "chain.h"
+#include "lrucache.h"
+#include "shieldedindex.h"
+#include "spentindex.h"
+#include "sync.h"
 
+#include <array>
+#include <atomic>
 #include <map>
+#include <memory>
+#include <optional>
 #include <string>
+#include <tuple>
 #include <utility>
 #include <vector>
 
 #include <boost/function.hpp>
 #include "zcash/History.hpp"
 
+class CAutoFile;
 class CBlockIndex;
+class CHashWriter;
+struct CCompactBlock;
 
 // START insightexplorer
 struct CAddressUnspentKey;
@@ -26,6 +40,7 @@ struct CAddressUnspentValue;
 struct CAddressIndexKey;
 struct CAddressIndexIteratorKey;
 struct CAddressIndexIteratorHeightKey;
+struct CAddressBalanceValue;
 struct CSpentIndexKey;
 struct CSpentIndexValue;
 struct CTimestampIndexKey;
@@ -40,26 +55,56 @@ typedef std::pair<CSpentIndexKey, CSpentIndexValue> CSpentIndexDbEntry;
 
 class uint256;
 
+//! Number of spent index lookups kept in memory
+static const size_t SPENT_INDEX_CACHE_SIZE = 50000;
+//! Number of timestamp index range lookups kept in memory
+static const size_t TIMESTAMP_INDEX_CACHE_SIZE = 256;
+//! Largest timestamp index range lookup, in blocks, that is kept in memory
+static const size_t TIMESTAMP_INDEX_CACHE_MAX_BLOCKS = 2000;
+
 //! -dbcache default (MiB)
 static const int64_t nDefaultDbCache = 450;
 //! max. -dbcache (MiB)
 static const int64_t nMaxDbCache = sizeof(void*) > 4 ? 16384 : 1024;
 //! min. -dbcache in (MiB)
 static const int64_t nMinDbCache = 4;
+//! -dbcachekeep default (percent of the in-memory UTXO set cache)
+static const int64_t nDefaultDbCacheKeep = 0;
+//! max. -dbcachekeep (percent)
+static const int64_t nMaxDbCacheKeep = 75;
+//! -nullifierfilter default
+static const bool DEFAULT_NULLIFIER_FILTER = true;
+//! -chainstatebulkwrite default
+static const bool DEFAULT_CHAINSTATE_BULK_WRITE = false;
 
 struct CDiskTxPos : public CDiskBlockPos
 {
     unsigned int nTxOffset; // after header
+    //! Serialized size of the transaction, or 0 in entries written before it was recorded
+    unsigned int nTxSize;
 
-    ADD_SERIALIZE_METHODS;
+    // The size follows the offset only when it is known, so that entries
+    // written by earlier versions still read.
+    template <typename Stream>
+    void Serialize(Stream& s) const {
+        s << *(const CDiskBlockPos*)this;
+        s << VARINT(nTxOffset);
+        if (nTxSize != 0) {
+            s << VARINT(nTxSize);
+        }
+    }
 
-    template <typename Stream, typename Operation>
-    inline void SerializationOp(Stream& s, Operation ser_action) {
-        READWRITE(*(CDiskBlockPos*)this);
-        READWRITE(VARINT(nTxOffset));
+    template <typename Stream>
+    void Unserialize(Stream& s) {
+        s >> *(CDiskBlockPos*)this;
+        s >> VARINT(nTxOffset);
+        nTxSize = 0;
+        if (!s.empty()) {
+            s >> VARINT(nTxSize);
+        }
     }
 
-    CDiskTxPos(const CDiskBlockPos &blockIn, unsigned int nTxOffsetIn) : CDiskBlockPos(blockIn.nFile, blockIn.nPos), nTxOffset(nTxOffsetIn) {
+    CDiskTxPos(const CDiskBlockPos &blockIn, unsigned int nTxOffsetIn) : CDiskBlockPos(blockIn.nFile, blockIn.nPos), nTxOffset(nTxOffsetIn), nTxSize(0) {
     }
 
     CDiskTxPos() {
@@ -69,23 +114,84 @@ struct CDiskTxPos : public CDiskBlockPos
     void SetNull() {
         CDiskBlockPos::SetNull();
         nTxOffset = 0;
+        nTxSize = 0;
+    }
+};
+
+/**
+ * The header of a UTXO set snapshot file, written by dumptxoutset.
+ *
+ * It is followed by the records of the chain state at the block, each a
+ * type byte and the key and value of a coin, commitment tree, nullifier,
+ * best anchor or history tree entry, then a zero type byte, and finally the
+ * double SHA256 of everything before it, which is the hash of the snapshot.
+ */
+struct CSnapshotMetadata
+{
+    static const uint32_t CURRENT_VERSION = 1;
+
+    uint32_t nVersion;
+    //! The message start of the network, so that snapshots of one are not loaded on another.
+    std::array<unsigned char, 4> networkMagic;
+    uint256 hashBlock;
+    int nHeight;
+    //! Values of the block index entry for the block, which cannot be computed without the blocks before it.
+    uint64_t nChainTx;
+    std::optional<CAmount> nChainSproutValue;
+    std::optional<CAmount> nChainSaplingValue;
+
+    CSnapshotMetadata() : nVersion(CURRENT_VERSION), networkMagic(), nHeight(0), nChainTx(0) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(nVersion);
+        READWRITE(networkMagic);
+        READWRITE(hashBlock);
+        READWRITE(nHeight);
+        READWRITE(nChainTx);
+        READWRITE(nChainSproutValue);
+        READWRITE(nChainSaplingValue);
     }
 };
 
 /** CCoinsView backed by the coin database (chainstate/) */
 class CCoinsViewDB : public CCoinsView
 {
+private:
+    /**
+     * In-memory filters over the Sprout and Sapling nullifier sets, once
+     * loaded by LoadNullifierFilters(). Only the writer (BatchWrite) replaces
+     * them, holding cs_nullifierFilters; lookups take the lock to read them.
+     */
+    mutable CCriticalSection cs_nullifierFilters;
+    std::unique_ptr<CBlockedBloomFilter> sproutNullifierFilter;
+    std::unique_ptr<CBlockedBloomFilter> saplingNullifierFilter;
+    //! Upper bounds on the sizes of the nullifier sets, to know when to rebuild the filters.
+    size_t nSproutNullifiers;
+    size_t nSaplingNullifiers;
+
+    std::unique_ptr<CBlockedBloomFilter> BuildNullifierFilter(char dbChar, size_t &nNullifiers) const;
+    void AddToNullifierFilter(const CNullifiersMap &mapNullifiers, ShieldedType type);
+
+    //! Whether BatchWrite() writes the coins in sorted chunks, see SetBulkWrite().
+    std::atomic<bool> fBulkWrite;
+    //! Write the changed coins of mapCoins to the database in chunks sorted by key.
+    bool BulkWriteCoins(CCoinsMap &mapCoins, CDBBatch &batch, size_t &changed);
+
 protected:
     CDBWrapper db;
     CCoinsViewDB(std::string dbName, size_t nCacheSize, bool fMemory = false, bool fWipe = false);
 public:
-    CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false, const CDBOptions& dbOptions = CDBOptions());
 
     bool GetSproutAnchorAt(const uint256 &rt, SproutMerkleTree &tree) const;
     bool GetSaplingAnchorAt(const uint256 &rt, SaplingMerkleTree &tree) const;
+    bool HaveSaplingAnchor(const uint256 &rt) const;
     bool GetNullifier(const uint256 &nf, ShieldedType type) const;
-    bool GetCoins(const uint256 &txid, CCoins &coins) const;
-    bool HaveCoins(const uint256 &txid) const;
+    bool GetCoin(const COutPoint &outpoint, Coin &coin) const;
+    bool HaveCoin(const COutPoint &outpoint) const;
     uint256 GetBestBlock() const;
     uint256 GetBestAnchor(ShieldedType type) const;
     HistoryIndex GetHistoryLength(uint32_t epochId) const;
@@ -99,8 +205,64 @@ public:
                     CAnchorsSaplingMap &mapSaplingAnchors,
                     CNullifiersMap &mapSproutNullifiers,
                     CNullifiersMap &mapSaplingNullifiers,
-                    CHistoryCacheMap &historyCacheMap);
+                    CHistoryCacheMap &historyCacheMap,
+                    bool fErase);
     bool GetStats(CCoinsStats &stats) const;
+
+    /**
+     * Build the nullifier filters from the database, so that GetNullifier()
+     * answers most lookups of unspent nullifiers without reading it.
+     */
+    void LoadNullifierFilters();
+
+    //! A cursor over the database as it is now, unaffected by later writes, for WriteSnapshot().
+    CDBIterator* NewSnapshotCursor() const;
+
+    /**
+     * Write the records of the chain state seen by pcursor, except for its
+     * best block, to a UTXO set snapshot, followed by the end marker. The
+     * bytes written are also passed to hasher. Throws if the file cannot be
+     * written.
+     */
+    bool WriteSnapshot(CDBIterator* pcursor, CAutoFile& file, CHashWriter& hasher, uint64_t& nCoins) const;
+
+    /**
+     * Read the records of a UTXO set snapshot up to its end marker, passing
+     * them to hasher, and write them to the database if fWrite is set (after
+     * BeginLoadSnapshot()). Returns false if a record has an unknown type.
+     * Throws if the file cannot be read.
+     */
+    bool ReadSnapshot(CAutoFile& file, CHashWriter& hasher, bool fWrite, uint64_t& nCoins);
+
+    /**
+     * While set, BatchWrite() sorts the changed coins by key and writes them
+     * in chunks of the size of the LevelDB write buffer, rather than in one
+     * batch. Each chunk then becomes a table covering a small range of keys,
+     * which LevelDB compacts with less of the tables below it, or places
+     * below level 0 directly. The database is marked as incomplete until the
+     * last chunk is written, as a crash in between leaves it inconsistent.
+     */
+    void SetBulkWrite(bool fBulkWriteIn) { fBulkWrite = fBulkWriteIn; }
+    //! Whether a write in chunks was interrupted, leaving the database incomplete.
+    bool IsBulkWriteInterrupted() const;
+
+    //! Erase the chain state, marking the database as incomplete until EndLoadSnapshot().
+    bool BeginLoadSnapshot();
+    //! Set the best block of a chain state loaded from a snapshot, and rebuild the nullifier filters.
+    bool EndLoadSnapshot(const uint256 &hashBlock);
+    //! Whether loading a snapshot was interrupted, leaving the database incomplete.
+    bool IsLoadingSnapshot() const;
+
+    //! The counters of the point lookups in the database, by record type.
+    std::map<unsigned char, CDBReadStats> GetReadStats() const { return db.GetReadStats(); }
+    //! Change the capacity of the cache of table blocks, as CDBWrapper::SetBlockCacheSize().
+    void SetBlockCacheSize(size_t nSize) { db.SetBlockCacheSize(nSize); }
+    //! A LevelDB property of the database, as CDBWrapper::GetProperty().
+    std::string GetDBProperty(const std::string& name) const { return db.GetProperty(name); }
+
+    //! Convert the per-transaction records of an older database to per-output records.
+    //! Returns false if the conversion failed or was interrupted by a shutdown request.
+    bool Upgrade();
 };
 
 /** Access to the block database (blocks/index/) */
@@ -111,22 +273,100 @@ public:
 private:
     CBlockTreeDB(const CBlockTreeDB&);
     void operator=(const CBlockTreeDB&);
+
+    //! Location of the block index cache, or empty for an in-memory database.
+    fs::path pathCache;
+
+    //! Hash identifying the state of the block files, to detect a stale cache.
+    uint256 GetBlockFilesHash();
+    //! Load the block index from the cache, if it is present and current.
+    bool LoadBlockIndexCache(std::function<CBlockIndex*(const uint256&)> insertBlockIndex);
+    //! Add the running balance updates for address index entries to a batch.
+    void BatchAddressBalances(CDBBatch &batch, const std::vector<CAddressIndexDbEntry> &vect, bool fErase);
+    template <typename K>
+    bool EraseRecords(char prefix);
+
+    /**
+     * Recent lookups of the spent and timestamp indexes, which explorers
+     * repeat for the same recent outputs and blocks. An output that is not
+     * in the spent index is cached as a null value. Writes to the indexes
+     * invalidate the lookups they change once they are done, and bump the
+     * generation so that lookups that read the database in the meantime are
+     * not cached.
+     */
+    CCriticalSection cs_indexCache;
+    uint64_t nIndexCacheGeneration = 0;
+    lrucache<CSpentIndexKey, CSpentIndexValue, CSpentIndexKeyCompare> spentIndexCache;
+    lrucache<std::tuple<unsigned int, unsigned int, bool>, std::vector<std::pair<uint256, unsigned int>>> timestampIndexCache;
 public:
     bool WriteBatchSync(const std::vector<std::pair<int, const CBlockFileInfo*> >& fileInfo, int nLastFile, const std::vector<const CBlockIndex*>& blockinfo);
+    bool ReadDiskBlockIndex(const uint256 &hash, CDiskBlockIndex &dbindex);
     bool EraseBatchSync(const std::vector<const CBlockIndex*>& blockinfo);
     bool ReadBlockFileInfo(int nFile, CBlockFileInfo &info);
     bool ReadLastBlockFile(int &nFile);
     bool WriteReindexing(bool fReindexing);
     bool ReadReindexing(bool &fReindexing);
+    bool WriteUTXOStats(const CCoinsStats &stats);
+    bool ReadUTXOStats(CCoinsStats &stats);
+    bool WriteSnapshotBase(const CSnapshotMetadata &metadata);
+    bool ReadSnapshotBase(CSnapshotMetadata &metadata);
     bool ReadTxIndex(const uint256 &txid, CDiskTxPos &pos);
     bool WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> > &vect);
+    bool ReadCompactBlock(const uint256 &hash, CCompactBlock &block);
+    bool WriteCompactBlock(const uint256 &hash, const CCompactBlock &block);
+    //! The basic filter of a block, with its hash and header, as kept by -blockfilterindex.
+    bool ReadBlockFilter(const uint256 &hash, CBlockFilterEntry &entry);
+    bool WriteBlockFilter(const uint256 &hash, const CBlockFilterEntry &entry);
+    //! The Sapling spends and outputs of the active chain, as kept by -shieldedindex.
+    bool ReadSaplingSpendIndex(const uint256 &nullifier, CSaplingSpendIndexValue &value);
+    bool ReadSaplingOutputIndex(const uint256 &cmu, CSaplingOutputIndexValue &value);
+    //! The size of the Sapling note commitment tree as of the end of a block.
+    bool ReadSaplingTreeSize(const uint256 &hash, uint64_t &nSize);
+    bool ReadSaplingTreeNode(const CSaplingTreeNodeKey &key, uint256 &node);
+    /**
+     * Write the shielded index entries of a block, with the tree nodes that
+     * its commitments fill in, along with the size of the Sapling tree as of
+     * its end. Erasing them leaves the tree size, which is kept by block
+     * hash, and the tree nodes, which are overwritten when their positions
+     * are filled again.
+     */
+    bool WriteShieldedIndex(const std::vector<CSaplingSpendIndexDbEntry> &spends,
+                            const std::vector<CSaplingOutputIndexDbEntry> &outputs,
+                            const std::vector<CSaplingTreeNodeDbEntry> &nodes,
+                            const uint256 &hash, uint64_t nTreeSize);
+    bool EraseShieldedIndex(const std::vector<CSaplingSpendIndexDbEntry> &spends,
+                            const std::vector<CSaplingOutputIndexDbEntry> &outputs);
 
     // START insightexplorer
     bool UpdateAddressUnspentIndex(const std::vector<CAddressUnspentDbEntry> &vect);
     bool ReadAddressUnspentIndex(uint160 addressHash, int type, std::vector<CAddressUnspentDbEntry> &vect);
-    bool WriteAddressIndex(const std::vector<CAddressIndexDbEntry> &vect);
-    bool EraseAddressIndex(const std::vector<CAddressIndexDbEntry> &vect);
-    bool ReadAddressIndex(uint160 addressHash, int type, std::vector<CAddressIndexDbEntry> &addressIndex, int start = 0, int end = 0);
+    /**
+     * Write or erase address index entries. If fBalances is set, the running
+     * balances of their addresses are updated in the same batch.
+     */
+    bool WriteAddressIndex(const std::vector<CAddressIndexDbEntry> &vect, bool fBalances = false);
+    bool EraseAddressIndex(const std::vector<CAddressIndexDbEntry> &vect, bool fBalances = false);
+    /**
+     * Read the address index entries of an address, in key order, optionally
+     * within a height range. If after is given, reading starts after that
+     * entry, and if limit is nonzero, at most limit entries are read, so that
+     * a long history can be read a page at a time.
+     */
+    bool ReadAddressIndex(uint160 addressHash, int type, std::vector<CAddressIndexDbEntry> &addressIndex, int start = 0, int end = 0,
+                          const CAddressIndexKey* after = nullptr, size_t limit = 0);
+    /** Read the running balance of an address; it is null if the address has no entries. */
+    bool ReadAddressBalance(uint160 addressHash, int type, CAddressBalanceValue &value);
+    //! The last block written by the background build of an index, if it is being built.
+    bool ReadIndexBest(const std::string &name, uint256 &hash);
+    bool WriteIndexBest(const std::string &name, const uint256 &hash);
+    bool EraseIndexBest(const std::string &name);
+    //! Erase all the records of an index.
+    bool DropTxIndex();
+    bool DropAddressIndex();
+    bool DropSpentIndex();
+    bool DropTimestampIndex();
+    bool DropBlockFilterIndex();
+    bool DropShieldedIndex();
     bool ReadSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value);
     bool UpdateSpentIndex(const std::vector<CSpentIndexDbEntry> &vect);
     bool WriteTimestampIndex(const CTimestampIndexKey &timestampIndex);
@@ -135,6 +375,9 @@ public:
     bool WriteTimestampBlockIndex(const CTimestampBlockIndexKey &blockhashIndex,
             const CTimestampBlockIndexValue &logicalts);
     bool ReadTimestampBlockIndex(const uint256 &hash, unsigned int &logicalTS);
+    //! Forget the cached timestamp index lookups, whose active-chain-only
+    //! results change when a block is disconnected.
+    void ClearTimestampIndexCache();
     // END insightexplorer
 
     bool WriteFlag(const std::string &name, bool fValue);
@@ -142,6 +385,13 @@ public:
     bool LoadBlockIndexGuts(
         std::function<CBlockIndex*(const uint256&)> insertBlockIndex,
         const CChainParams& chainParams);
+
+    /**
+     * Write the given block index entries to a cache file, which the next
+     * LoadBlockIndexGuts() reads instead of the database. The cache is only
+     * used if the database has not been changed since it was written.
+     */
+    bool WriteBlockIndexCache(const std::vector<const CBlockIndex*>& blockinfo);
 };
 
 #endif // BITCOIN_TXDB_H
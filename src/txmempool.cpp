@@ -8,8 +8,10 @@
 #include "clientversion.h"
 #include "consensus/consensus.h"
 #include "consensus/validation.h"
+#include "hash.h"
 #include "main.h"
 #include "policy/fees.h"
+#include "script/interpreter.h"
 #include "streams.h"
 #include "timedata.h"
 #include "util.h"
@@ -17,29 +19,52 @@
 #include "validationinterface.h"
 #include "version.h"
 
+#include <algorithm>
 #include <optional>
 
 using namespace std;
 
 CTxMemPoolEntry::CTxMemPoolEntry():
-    nFee(0), nTxSize(0), nModSize(0), nUsageSize(0), nTime(0), dPriority(0.0),
-    hadNoDependencies(false), spendsCoinbase(false)
+    tx(MakeTransactionRef()), nFee(0), nTxSize(0), nModSize(0), nUsageSize(0), nTime(0), dPriority(0.0),
+    hadNoDependencies(false), spendsCoinbase(false), feeDelta(0),
+    nCountWithDescendants(1), nSizeWithDescendants(0), nModFeesWithDescendants(0),
+    nCountWithAncestors(1), nSizeWithAncestors(0), nModFeesWithAncestors(0)
 {
     nHeight = MEMPOOL_HEIGHT;
 }
 
-CTxMemPoolEntry::CTxMemPoolEntry(const CTransaction& _tx, const CAmount& _nFee,
+CTxMemPoolEntry::CTxMemPoolEntry(const CTransactionRef& _tx, const CAmount& _nFee,
                                  int64_t _nTime, double _dPriority,
                                  unsigned int _nHeight, bool poolHasNoInputsOf,
-                                 bool _spendsCoinbase, uint32_t _nBranchId):
-    tx(_tx), nFee(_nFee), nTime(_nTime), dPriority(_dPriority), nHeight(_nHeight),
+                                 bool _spendsCoinbase, uint32_t _nBranchId,
+                                 std::shared_ptr<const PrecomputedTransactionData> _txdata):
+    tx(_tx), txdata(std::move(_txdata)), nFee(_nFee), nTime(_nTime), dPriority(_dPriority), nHeight(_nHeight),
     hadNoDependencies(poolHasNoInputsOf),
-    spendsCoinbase(_spendsCoinbase), nBranchId(_nBranchId)
+    spendsCoinbase(_spendsCoinbase), nBranchId(_nBranchId), feeDelta(0)
 {
-    nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-    nModSize = tx.CalculateModifiedSize(nTxSize);
-    nUsageSize = RecursiveDynamicUsage(tx);
+    nTxSize = ::GetSerializeSize(*tx, SER_NETWORK, PROTOCOL_VERSION);
+    nModSize = tx->CalculateModifiedSize(nTxSize);
+    if (!txdata)
+        txdata = std::make_shared<const PrecomputedTransactionData>(*tx);
+    nUsageSize = RecursiveDynamicUsage(tx) + memusage::DynamicUsage(txdata);
     feeRate = CFeeRate(nFee, nTxSize);
+
+    nCountWithDescendants = 1;
+    nSizeWithDescendants = nTxSize;
+    nModFeesWithDescendants = nFee;
+
+    nCountWithAncestors = 1;
+    nSizeWithAncestors = nTxSize;
+    nModFeesWithAncestors = nFee;
+}
+
+CTxMemPoolEntry::CTxMemPoolEntry(const CTransaction& _tx, const CAmount& _nFee,
+                                 int64_t _nTime, double _dPriority,
+                                 unsigned int _nHeight, bool poolHasNoInputsOf,
+                                 bool _spendsCoinbase, uint32_t _nBranchId):
+    CTxMemPoolEntry(MakeTransactionRef(_tx), _nFee, _nTime, _dPriority, _nHeight,
+                    poolHasNoInputsOf, _spendsCoinbase, _nBranchId)
+{
 }
 
 CTxMemPoolEntry::CTxMemPoolEntry(const CTxMemPoolEntry& other)
@@ -50,12 +75,37 @@ CTxMemPoolEntry::CTxMemPoolEntry(const CTxMemPoolEntry& other)
 double
 CTxMemPoolEntry::GetPriority(unsigned int currentHeight) const
 {
-    CAmount nValueIn = tx.GetValueOut()+nFee;
+    CAmount nValueIn = tx->GetValueOut()+nFee;
     double deltaPriority = ((double)(currentHeight-nHeight)*nValueIn)/nModSize;
     double dResult = dPriority + deltaPriority;
     return dResult;
 }
 
+void CTxMemPoolEntry::UpdateFeeDelta(CAmount newFeeDelta)
+{
+    nModFeesWithDescendants += newFeeDelta - feeDelta;
+    nModFeesWithAncestors += newFeeDelta - feeDelta;
+    feeDelta = newFeeDelta;
+}
+
+void CTxMemPoolEntry::UpdateDescendantState(int64_t modifySize, CAmount modifyFee, int64_t modifyCount)
+{
+    nSizeWithDescendants += modifySize;
+    assert(int64_t(nSizeWithDescendants) > 0);
+    nModFeesWithDescendants += modifyFee;
+    nCountWithDescendants += modifyCount;
+    assert(int64_t(nCountWithDescendants) > 0);
+}
+
+void CTxMemPoolEntry::UpdateAncestorState(int64_t modifySize, CAmount modifyFee, int64_t modifyCount)
+{
+    nSizeWithAncestors += modifySize;
+    assert(int64_t(nSizeWithAncestors) > 0);
+    nModFeesWithAncestors += modifyFee;
+    nCountWithAncestors += modifyCount;
+    assert(int64_t(nCountWithAncestors) > 0);
+}
+
 CTxMemPool::CTxMemPool(const CFeeRate& _minRelayFee) :
     nTransactionsUpdated(0)
 {
@@ -74,17 +124,10 @@ CTxMemPool::~CTxMemPool()
     delete weightedTxTree;
 }
 
-void CTxMemPool::pruneSpent(const uint256 &hashTx, CCoins &coins)
+bool CTxMemPool::isSpent(const COutPoint& outpoint)
 {
     LOCK(cs);
-
-    std::map<COutPoint, CInPoint>::iterator it = mapNextTx.lower_bound(COutPoint(hashTx, 0));
-
-    // iterate over all COutPoints in mapNextTx whose hash equals the provided hashTx
-    while (it != mapNextTx.end() && it->first.hash == hashTx) {
-        coins.Spend(it->first.n); // and remove those outputs from coins
-        it++;
-    }
+    return mapNextTx.count(outpoint);
 }
 
 unsigned int CTxMemPool::GetTransactionsUpdated() const
@@ -106,11 +149,16 @@ bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry,
     // Used by main.cpp AcceptToMemoryPool(), which DOES do
     // all the appropriate checks.
     LOCK(cs);
-    weightedTxTree->add(WeightedTxInfo::from(entry.GetTx(), entry.GetFee()));
-    mapTx.insert(entry);
-    const CTransaction& tx = mapTx.find(hash)->GetTx();
+    weightedTxTree->add(WeightedTxInfo::from(entry.GetTx(), entry.GetFee(), GetEntryMemoryUsage(entry)));
+    indexed_transaction_set::iterator newit = mapTx.insert(entry).first;
+    // The transaction may have been prioritised before it entered the pool.
+    DeltasMap::const_iterator pos = mapDeltas.find(hash);
+    if (pos != mapDeltas.end() && pos->second.second != 0)
+        mapTx.modify(newit, update_fee_delta(pos->second.second));
+    const CTransaction& tx = newit->GetTx();
     mapRecentlyAddedTx[tx.GetHash()] = &tx;
     nRecentlyAddedSequence += 1;
+    AddEvent(hash, true);
     for (unsigned int i = 0; i < tx.vin.size(); i++)
         mapNextTx[tx.vin[i].prevout] = CInPoint(&tx, i);
     for (const JSDescription &joinsplit : tx.vJoinSplit) {
@@ -121,6 +169,34 @@ bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry,
     for (const SpendDescription &spendDescription : tx.vShieldedSpend) {
         mapSaplingNullifiers[spendDescription.nullifier] = &tx;
     }
+
+    // Update the package aggregates. A transaction normally enters the pool
+    // after its parents and before its children, so it only becomes a
+    // descendant of its ancestors. When transactions from a disconnected
+    // block are added back, their children may already be in the pool; the
+    // aggregates of every affected entry are then recomputed.
+    std::set<uint256> setAncestors;
+    CalculateMemPoolAncestors(tx, setAncestors);
+    std::set<uint256> setDescendants;
+    CalculateDescendants(hash, setDescendants);
+    if (setDescendants.empty()) {
+        int64_t nSizeWithAncestors = 0;
+        CAmount nModFeesWithAncestors = 0;
+        for (const uint256& ancestor : setAncestors) {
+            const CTxMemPoolEntry& ancestorEntry = *mapTx.find(ancestor);
+            nSizeWithAncestors += ancestorEntry.GetTxSize();
+            nModFeesWithAncestors += ancestorEntry.GetModifiedFee();
+        }
+        mapTx.modify(newit, update_ancestor_state(nSizeWithAncestors, nModFeesWithAncestors, setAncestors.size()));
+        UpdateAncestorsOf(true, *newit, setAncestors);
+    } else {
+        UpdatePackageState(hash);
+        for (const uint256& ancestor : setAncestors)
+            UpdatePackageState(ancestor);
+        for (const uint256& descendant : setDescendants)
+            UpdatePackageState(descendant);
+    }
+
     nTransactionsUpdated++;
     totalTxSize += entry.GetTxSize();
     cachedInnerUsage += entry.DynamicMemoryUsage();
@@ -129,9 +205,28 @@ bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry,
     return true;
 }
 
+// START insightexplorer
+SaltedAddressHasher::SaltedAddressHasher() : k0(GetRand(std::numeric_limits<uint64_t>::max())), k1(GetRand(std::numeric_limits<uint64_t>::max())) {}
+
+size_t SaltedAddressHasher::operator()(const std::pair<int, uint160>& address) const {
+    return CSipHasher(k0, k1).Write(address.first).Write(address.second.begin(), address.second.size()).Finalize();
+}
+
+SaltedSpentIndexKeyHasher::SaltedSpentIndexKeyHasher() : k0(GetRand(std::numeric_limits<uint64_t>::max())), k1(GetRand(std::numeric_limits<uint64_t>::max())) {}
+
+void CTxMemPool::setLazyInsightIndexes(bool fLazy)
+{
+    LOCK(cs);
+    assert(mapTx.empty());
+    fAddressIndexBuilt = !fLazy;
+    fSpentIndexBuilt = !fLazy;
+}
+
 void CTxMemPool::addAddressIndex(const CTxMemPoolEntry &entry, const CCoinsViewCache &view)
 {
     LOCK(cs);
+    if (!fAddressIndexBuilt)
+        return;
     const CTransaction& tx = entry.GetTx();
     std::vector<CMempoolAddressDeltaKey> inserted;
 
@@ -144,7 +239,7 @@ void CTxMemPool::addAddressIndex(const CTxMemPoolEntry &entry, const CCoinsViewC
             continue;
         CMempoolAddressDeltaKey key(type, prevout.scriptPubKey.AddressHash(), txhash, j, 1);
         CMempoolAddressDelta delta(entry.GetTime(), prevout.nValue * -1, input.prevout.hash, input.prevout.n);
-        mapAddress.insert(make_pair(key, delta));
+        mapAddress[std::make_pair(key.type, key.addressBytes)].emplace_back(key, delta);
         inserted.push_back(key);
     }
 
@@ -154,24 +249,38 @@ void CTxMemPool::addAddressIndex(const CTxMemPoolEntry &entry, const CCoinsViewC
         if (type == CScript::UNKNOWN)
             continue;
         CMempoolAddressDeltaKey key(type, out.scriptPubKey.AddressHash(), txhash, j, 0);
-        mapAddress.insert(make_pair(key, CMempoolAddressDelta(entry.GetTime(), out.nValue)));
+        mapAddress[std::make_pair(key.type, key.addressBytes)].emplace_back(key, CMempoolAddressDelta(entry.GetTime(), out.nValue));
         inserted.push_back(key);
     }
 
     mapAddressInserted.insert(make_pair(txhash, inserted));
 }
 
-// START insightexplorer
+void CTxMemPool::buildAddressIndex(CCoinsView *pcoinsBase)
+{
+    AssertLockHeld(cs);
+    int64_t nStart = GetTimeMillis();
+    CCoinsViewMemPool viewMemPool(pcoinsBase, *this);
+    CCoinsViewCache view(&viewMemPool);
+    fAddressIndexBuilt = true;
+    for (const CTxMemPoolEntry& entry : mapTx) {
+        addAddressIndex(entry, view);
+    }
+    LogPrint("mempool", "Built the mempool address index for %u transactions: %dms\n", mapTx.size(), GetTimeMillis() - nStart);
+}
+
 void CTxMemPool::getAddressIndex(
     const std::vector<std::pair<uint160, int>>& addresses,
-    std::vector<std::pair<CMempoolAddressDeltaKey, CMempoolAddressDelta>>& results)
+    std::vector<std::pair<CMempoolAddressDeltaKey, CMempoolAddressDelta>>& results,
+    CCoinsView *pcoinsBase)
 {
     LOCK(cs);
+    if (!fAddressIndexBuilt)
+        buildAddressIndex(pcoinsBase);
     for (const auto& it : addresses) {
-        auto ait = mapAddress.lower_bound(CMempoolAddressDeltaKey(it.second, it.first));
-        while (ait != mapAddress.end() && (*ait).first.addressBytes == it.first && (*ait).first.type == it.second) {
-            results.push_back(*ait);
-            ait++;
+        auto ait = mapAddress.find(std::make_pair(it.second, it.first));
+        if (ait != mapAddress.end()) {
+            results.insert(results.end(), ait->second.begin(), ait->second.end());
         }
     }
 }
@@ -182,9 +291,17 @@ void CTxMemPool::removeAddressIndex(const uint256& txhash)
     auto it = mapAddressInserted.find(txhash);
 
     if (it != mapAddressInserted.end()) {
-        std::vector<CMempoolAddressDeltaKey> keys = it->second;
-        for (const auto& mit : keys) {
-            mapAddress.erase(mit);
+        for (const auto& mit : it->second) {
+            auto ait = mapAddress.find(std::make_pair(mit.type, mit.addressBytes));
+            if (ait == mapAddress.end())
+                continue; // already removed for an earlier key of the same address
+            auto& deltas = ait->second;
+            deltas.erase(std::remove_if(deltas.begin(), deltas.end(),
+                [&](const std::pair<CMempoolAddressDeltaKey, CMempoolAddressDelta>& delta) {
+                    return delta.first.txhash == txhash;
+                }), deltas.end());
+            if (deltas.empty())
+                mapAddress.erase(ait);
         }
         mapAddressInserted.erase(it);
     }
@@ -193,6 +310,8 @@ void CTxMemPool::removeAddressIndex(const uint256& txhash)
 void CTxMemPool::addSpentIndex(const CTxMemPoolEntry &entry, const CCoinsViewCache &view)
 {
     LOCK(cs);
+    if (!fSpentIndexBuilt)
+        return;
     const CTransaction& tx = entry.GetTx();
     uint256 txhash = tx.GetHash();
     std::vector<CSpentIndexKey> inserted;
@@ -210,10 +329,25 @@ void CTxMemPool::addSpentIndex(const CTxMemPoolEntry &entry, const CCoinsViewCac
     mapSpentInserted.insert(make_pair(txhash, inserted));
 }
 
-bool CTxMemPool::getSpentIndex(const CSpentIndexKey &key, CSpentIndexValue &value)
+void CTxMemPool::buildSpentIndex(CCoinsView *pcoinsBase)
+{
+    AssertLockHeld(cs);
+    int64_t nStart = GetTimeMillis();
+    CCoinsViewMemPool viewMemPool(pcoinsBase, *this);
+    CCoinsViewCache view(&viewMemPool);
+    fSpentIndexBuilt = true;
+    for (const CTxMemPoolEntry& entry : mapTx) {
+        addSpentIndex(entry, view);
+    }
+    LogPrint("mempool", "Built the mempool spent index for %u transactions: %dms\n", mapTx.size(), GetTimeMillis() - nStart);
+}
+
+bool CTxMemPool::getSpentIndex(const CSpentIndexKey &key, CSpentIndexValue &value, CCoinsView *pcoinsBase)
 {
     LOCK(cs);
-    std::map<CSpentIndexKey, CSpentIndexValue, CSpentIndexKeyCompare>::iterator it = mapSpent.find(key);
+    if (!fSpentIndexBuilt)
+        buildSpentIndex(pcoinsBase);
+    auto it = mapSpent.find(key);
     if (it != mapSpent.end()) {
         value = it->second;
         return true;
@@ -227,9 +361,8 @@ void CTxMemPool::removeSpentIndex(const uint256 txhash)
     auto it = mapSpentInserted.find(txhash);
 
     if (it != mapSpentInserted.end()) {
-        std::vector<CSpentIndexKey> keys = (*it).second;
-        for (std::vector<CSpentIndexKey>::iterator mit = keys.begin(); mit != keys.end(); mit++) {
-            mapSpent.erase(*mit);
+        for (const CSpentIndexKey& key : it->second) {
+            mapSpent.erase(key);
         }
         mapSpentInserted.erase(it);
     }
@@ -249,28 +382,58 @@ void CTxMemPool::remove(const CTransaction &origTx, std::list<CTransaction>& rem
             // happen during chain re-orgs if origTx isn't re-accepted into
             // the mempool for any reason.
             for (unsigned int i = 0; i < origTx.vout.size(); i++) {
-                std::map<COutPoint, CInPoint>::iterator it = mapNextTx.find(COutPoint(origTx.GetHash(), i));
+                NextTxMap::iterator it = mapNextTx.find(COutPoint(origTx.GetHash(), i));
                 if (it == mapNextTx.end())
                     continue;
                 txToRemove.push_back(it->second.ptx->GetHash());
             }
         }
+        std::vector<uint256> vToRemove;
+        std::set<uint256> setToRemove;
         while (!txToRemove.empty())
         {
             uint256 hash = txToRemove.front();
             txToRemove.pop_front();
-            if (!mapTx.count(hash))
+            if (!mapTx.count(hash) || !setToRemove.insert(hash).second)
                 continue;
-            const CTransaction& tx = mapTx.find(hash)->GetTx();
+            vToRemove.push_back(hash);
             if (fRecursive) {
-                for (unsigned int i = 0; i < tx.vout.size(); i++) {
-                    std::map<COutPoint, CInPoint>::iterator it = mapNextTx.find(COutPoint(hash, i));
+                for (unsigned int i = 0; i < mapTx.find(hash)->GetTx().vout.size(); i++) {
+                    NextTxMap::iterator it = mapNextTx.find(COutPoint(hash, i));
                     if (it == mapNextTx.end())
                         continue;
                     txToRemove.push_back(it->second.ptx->GetHash());
                 }
             }
+        }
+        // Update the package aggregates of the transactions that stay in the
+        // pool before any links are removed. When removing recursively, every
+        // descendant of a removed transaction is removed too. Otherwise the
+        // transaction is in a connected block, so its in-mempool ancestors
+        // were in the block as well and have already been removed; its
+        // descendants only lose it as an ancestor.
+        for (const uint256& hash : vToRemove)
+        {
+            const CTxMemPoolEntry& entry = *mapTx.find(hash);
+            std::set<uint256> setAncestors;
+            CalculateMemPoolAncestors(entry.GetTx(), setAncestors);
+            std::set<uint256> setStayingAncestors;
+            for (const uint256& ancestor : setAncestors) {
+                if (!setToRemove.count(ancestor))
+                    setStayingAncestors.insert(ancestor);
+            }
+            UpdateAncestorsOf(false, entry, setStayingAncestors);
+            if (!fRecursive) {
+                std::set<uint256> setDescendants;
+                CalculateDescendants(hash, setDescendants);
+                UpdateDescendantsOf(false, entry, setDescendants);
+            }
+        }
+        for (const uint256& hash : vToRemove)
+        {
+            const CTransaction& tx = mapTx.find(hash)->GetTx();
             mapRecentlyAddedTx.erase(hash);
+            AddEvent(hash, false);
             for (const CTxIn& txin : tx.vin)
                 mapNextTx.erase(txin.prevout);
             for (const JSDescription& joinsplit : tx.vJoinSplit) {
@@ -300,23 +463,50 @@ void CTxMemPool::remove(const CTransaction &origTx, std::list<CTransaction>& rem
     }
 }
 
-void CTxMemPool::removeForReorg(const CCoinsViewCache *pcoins, unsigned int nMemPoolHeight, int flags)
+void CTxMemPool::removeForReorg(const CCoinsViewCache *pcoins, unsigned int nMemPoolHeight, int flags,
+                                const std::set<uint256>& setInvalidSproutAnchors,
+                                const std::set<uint256>& setInvalidSaplingAnchors,
+                                uint32_t nMemPoolBranchId)
 {
-    // Remove transactions spending a coinbase which are now immature and no-longer-final transactions
+    // Remove transactions spending a coinbase which are now immature and no-longer-final transactions.
+    // If a block is disconnected from the tip and the root changed, we must also invalidate
+    // transactions which spend from that root -- almost as though they were spending coinbases
+    // which are no longer valid to spend due to coinbase maturity.
     LOCK(cs);
     list<CTransaction> transactionsToRemove;
     for (indexed_transaction_set::const_iterator it = mapTx.begin(); it != mapTx.end(); it++) {
         const CTransaction& tx = it->GetTx();
-        if (!CheckFinalTx(tx, flags)) {
+        if (it->GetValidatedBranchId() != nMemPoolBranchId || !CheckFinalTx(tx, flags)) {
+            transactionsToRemove.push_back(tx);
+            continue;
+        }
+        bool fInvalidAnchor = false;
+        if (!setInvalidSproutAnchors.empty()) {
+            for (const JSDescription& joinsplit : tx.vJoinSplit) {
+                if (setInvalidSproutAnchors.count(joinsplit.anchor)) {
+                    fInvalidAnchor = true;
+                    break;
+                }
+            }
+        }
+        if (!fInvalidAnchor && !setInvalidSaplingAnchors.empty()) {
+            for (const SpendDescription& spendDescription : tx.vShieldedSpend) {
+                if (setInvalidSaplingAnchors.count(spendDescription.anchor)) {
+                    fInvalidAnchor = true;
+                    break;
+                }
+            }
+        }
+        if (fInvalidAnchor) {
             transactionsToRemove.push_back(tx);
         } else if (it->GetSpendsCoinbase()) {
             for (const CTxIn& txin : tx.vin) {
                 indexed_transaction_set::const_iterator it2 = mapTx.find(txin.prevout.hash);
                 if (it2 != mapTx.end())
                     continue;
-                const CCoins *coins = pcoins->AccessCoins(txin.prevout.hash);
-		if (nCheckFrequency != 0) assert(coins);
-                if (!coins || (coins->IsCoinBase() && ((signed long)nMemPoolHeight) - coins->nHeight < COINBASE_MATURITY)) {
+                const Coin &coin = pcoins->AccessCoin(txin.prevout);
+                if (nCheckFrequency != 0) assert(!coin.IsSpent());
+                if (coin.IsSpent() || (coin.IsCoinBase() && ((signed long)nMemPoolHeight) - coin.nHeight < COINBASE_MATURITY)) {
                     transactionsToRemove.push_back(tx);
                     break;
                 }
@@ -329,54 +519,13 @@ void CTxMemPool::removeForReorg(const CCoinsViewCache *pcoins, unsigned int nMem
     }
 }
 
-
-void CTxMemPool::removeWithAnchor(const uint256 &invalidRoot, ShieldedType type)
-{
-    // If a block is disconnected from the tip, and the root changed,
-    // we must invalidate transactions from the mempool which spend
-    // from that root -- almost as though they were spending coinbases
-    // which are no longer valid to spend due to coinbase maturity.
-    LOCK(cs);
-    list<CTransaction> transactionsToRemove;
-
-    for (indexed_transaction_set::const_iterator it = mapTx.begin(); it != mapTx.end(); it++) {
-        const CTransaction& tx = it->GetTx();
-        switch (type) {
-            case SPROUT:
-                for (const JSDescription& joinsplit : tx.vJoinSplit) {
-                    if (joinsplit.anchor == invalidRoot) {
-                        transactionsToRemove.push_back(tx);
-                        break;
-                    }
-                }
-            break;
-            case SAPLING:
-                for (const SpendDescription& spendDescription : tx.vShieldedSpend) {
-                    if (spendDescription.anchor == invalidRoot) {
-                        transactionsToRemove.push_back(tx);
-                        break;
-                    }
-                }
-            break;
-            default:
-                throw runtime_error("Unknown shielded type");
-            break;
-        }
-    }
-
-    for (const CTransaction& tx : transactionsToRemove) {
-        list<CTransaction> removed;
-        remove(tx, removed, true);
-    }
-}
-
 void CTxMemPool::removeConflicts(const CTransaction &tx, std::list<CTransaction>& removed)
 {
     // Remove transactions which depend on inputs of tx, recursively
     list<CTransaction> result;
     LOCK(cs);
     for (const CTxIn &txin : tx.vin) {
-        std::map<COutPoint, CInPoint>::iterator it = mapNextTx.find(txin.prevout);
+        NextTxMap::iterator it = mapNextTx.find(txin.prevout);
         if (it != mapNextTx.end()) {
             const CTransaction &txConflict = *it->second.ptx;
             if (txConflict != tx)
@@ -388,7 +537,7 @@ void CTxMemPool::removeConflicts(const CTransaction &tx, std::list<CTransaction>
 
     for (const JSDescription &joinsplit : tx.vJoinSplit) {
         for (const uint256 &nf : joinsplit.nullifiers) {
-            std::map<uint256, const CTransaction*>::iterator it = mapSproutNullifiers.find(nf);
+            NullifiersMap::iterator it = mapSproutNullifiers.find(nf);
             if (it != mapSproutNullifiers.end()) {
                 const CTransaction &txConflict = *it->second;
                 if (txConflict != tx) {
@@ -398,7 +547,7 @@ void CTxMemPool::removeConflicts(const CTransaction &tx, std::list<CTransaction>
         }
     }
     for (const SpendDescription &spendDescription : tx.vShieldedSpend) {
-        std::map<uint256, const CTransaction*>::iterator it = mapSaplingNullifiers.find(spendDescription.nullifier);
+        NullifiersMap::iterator it = mapSaplingNullifiers.find(spendDescription.nullifier);
         if (it != mapSaplingNullifiers.end()) {
             const CTransaction &txConflict = *it->second;
             if (txConflict != tx) {
@@ -437,15 +586,18 @@ void CTxMemPool::removeForBlock(const std::vector<CTransaction>& vtx, unsigned i
                                 std::list<CTransaction>& conflicts, bool fCurrentEstimate)
 {
     LOCK(cs);
-    std::vector<CTxMemPoolEntry> entries;
+    std::vector<const CTxMemPoolEntry*> entries;
     for (const CTransaction& tx : vtx)
     {
         uint256 hash = tx.GetHash();
 
         indexed_transaction_set::iterator i = mapTx.find(hash);
         if (i != mapTx.end())
-            entries.push_back(*i);
+            entries.push_back(&*i);
     }
+    // Queue the confirmations up for the policy estimates while the entries
+    // are still in the pool; the estimator folds them in off this thread.
+    minerPolicyEstimator->processBlock(nBlockHeight, entries, fCurrentEstimate);
     for (const CTransaction& tx : vtx)
     {
         std::list<CTransaction> dummy;
@@ -453,8 +605,6 @@ void CTxMemPool::removeForBlock(const std::vector<CTransaction>& vtx, unsigned i
         removeConflicts(tx, conflicts);
         ClearPrioritisation(tx.GetHash());
     }
-    // After the txs in the new block have been removed from the mempool, update policy estimates
-    minerPolicyEstimator->processBlock(nBlockHeight, entries, fCurrentEstimate);
 }
 
 /**
@@ -484,6 +634,10 @@ void CTxMemPool::clear()
     LOCK(cs);
     mapTx.clear();
     mapNextTx.clear();
+    // The removals are not logged, so no earlier sequence number can be
+    // caught up from.
+    eventLog.clear();
+    nEventLogStart = ++nEventSequence;
     totalTxSize = 0;
     cachedInnerUsage = 0;
     ++nTransactionsUpdated;
@@ -521,11 +675,10 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
                 assert(tx2.vout.size() > txin.prevout.n && !tx2.vout[txin.prevout.n].IsNull());
                 fDependsWait = true;
             } else {
-                const CCoins* coins = pcoins->AccessCoins(txin.prevout.hash);
-                assert(coins && coins->IsAvailable(txin.prevout.n));
+                assert(pcoins->HaveCoin(txin.prevout));
             }
             // Check whether its inputs are marked in mapNextTx.
-            std::map<COutPoint, CInPoint>::const_iterator it3 = mapNextTx.find(txin.prevout);
+            NextTxMap::const_iterator it3 = mapNextTx.find(txin.prevout);
             assert(it3 != mapNextTx.end());
             assert(it3->second.ptx == &tx);
             assert(it3->second.n == i);
@@ -562,6 +715,30 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
             assert(pcoins->GetSaplingAnchorAt(spendDescription.anchor, tree));
             assert(!pcoins->GetNullifier(spendDescription.nullifier, SAPLING));
         }
+        // Check the package aggregates against the in-mempool relatives.
+        std::set<uint256> setAncestors;
+        CalculateMemPoolAncestors(tx, setAncestors);
+        uint64_t nSizeCheck = it->GetTxSize();
+        CAmount nFeesCheck = it->GetModifiedFee();
+        for (const uint256& ancestor : setAncestors) {
+            nSizeCheck += mapTx.find(ancestor)->GetTxSize();
+            nFeesCheck += mapTx.find(ancestor)->GetModifiedFee();
+        }
+        assert(it->GetCountWithAncestors() == setAncestors.size() + 1);
+        assert(it->GetSizeWithAncestors() == nSizeCheck);
+        assert(it->GetModFeesWithAncestors() == nFeesCheck);
+        std::set<uint256> setDescendants;
+        CalculateDescendants(tx.GetHash(), setDescendants);
+        nSizeCheck = it->GetTxSize();
+        nFeesCheck = it->GetModifiedFee();
+        for (const uint256& descendant : setDescendants) {
+            nSizeCheck += mapTx.find(descendant)->GetTxSize();
+            nFeesCheck += mapTx.find(descendant)->GetModifiedFee();
+        }
+        assert(it->GetCountWithDescendants() == setDescendants.size() + 1);
+        assert(it->GetSizeWithDescendants() == nSizeCheck);
+        assert(it->GetModFeesWithDescendants() == nFeesCheck);
+
         if (fDependsWait)
             waitingOnDependants.push_back(&(*it));
         else {
@@ -589,7 +766,7 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
             stepsSinceLastRemove = 0;
         }
     }
-    for (std::map<COutPoint, CInPoint>::const_iterator it = mapNextTx.begin(); it != mapNextTx.end(); it++) {
+    for (NextTxMap::const_iterator it = mapNextTx.begin(); it != mapNextTx.end(); it++) {
         uint256 hash = it->second.ptx->GetHash();
         indexed_transaction_set::const_iterator it2 = mapTx.find(hash);
         const CTransaction& tx = it2->GetTx();
@@ -608,7 +785,7 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
 
 void CTxMemPool::checkNullifiers(ShieldedType type) const
 {
-    const std::map<uint256, const CTransaction*>* mapToUse;
+    const NullifiersMap* mapToUse;
     switch (type) {
         case SPROUT:
             mapToUse = &mapSproutNullifiers;
@@ -647,22 +824,44 @@ bool CTxMemPool::lookup(uint256 hash, CTransaction& result) const
     return true;
 }
 
-CFeeRate CTxMemPool::estimateFee(int nBlocks) const
+CTransactionRef CTxMemPool::get(const uint256& hash) const
 {
     LOCK(cs);
+    indexed_transaction_set::const_iterator i = mapTx.find(hash);
+    if (i == mapTx.end())
+        return nullptr;
+    return i->GetSharedTx();
+}
+
+bool CTxMemPool::GetTxData(const uint256& hash, std::shared_ptr<const PrecomputedTransactionData>& txdata, size_t& nTxSize) const
+{
+    LOCK(cs);
+    indexed_transaction_set::const_iterator i = mapTx.find(hash);
+    if (i == mapTx.end())
+        return false;
+    txdata = i->GetTxData();
+    nTxSize = i->GetTxSize();
+    return true;
+}
+
+CFeeRate CTxMemPool::estimateFee(int nBlocks) const
+{
     return minerPolicyEstimator->estimateFee(nBlocks);
 }
 double CTxMemPool::estimatePriority(int nBlocks) const
 {
-    LOCK(cs);
     return minerPolicyEstimator->estimatePriority(nBlocks);
 }
 
+void CTxMemPool::UpdateFeeEstimates()
+{
+    minerPolicyEstimator->processPendingBlocks();
+}
+
 bool
 CTxMemPool::WriteFeeEstimates(CAutoFile& fileout) const
 {
     try {
-        LOCK(cs);
         fileout << 109900; // version required to read: 0.10.99 or later
         fileout << CLIENT_VERSION; // version that wrote the file
         minerPolicyEstimator->Write(fileout);
@@ -683,7 +882,6 @@ CTxMemPool::ReadFeeEstimates(CAutoFile& filein)
         if (nVersionRequired > CLIENT_VERSION)
             return error("CTxMemPool::ReadFeeEstimates(): up-version (%d) fee estimate file", nVersionRequired);
 
-        LOCK(cs);
         minerPolicyEstimator->Read(filein);
     }
     catch (const std::exception&) {
@@ -693,6 +891,18 @@ CTxMemPool::ReadFeeEstimates(CAutoFile& filein)
     return true;
 }
 
+void CTxMemPool::WriteRecentlyEvicted(CAutoFile& fileout) const
+{
+    LOCK(cs);
+    fileout << *recentlyEvicted;
+}
+
+void CTxMemPool::ReadRecentlyEvicted(CAutoFile& filein)
+{
+    LOCK(cs);
+    filein >> *recentlyEvicted;
+}
+
 void CTxMemPool::PrioritiseTransaction(const uint256 hash, const std::string strHash, double dPriorityDelta, const CAmount& nFeeDelta)
 {
     {
@@ -700,6 +910,8 @@ void CTxMemPool::PrioritiseTransaction(const uint256 hash, const std::string str
         std::pair<double, CAmount> &deltas = mapDeltas[hash];
         deltas.first += dPriorityDelta;
         deltas.second += nFeeDelta;
+        if (mapTx.count(hash))
+            UpdateFeeDelta(hash, deltas.second);
     }
     LogPrintf("PrioritiseTransaction: %s priority += %f, fee += %d\n", strHash, dPriorityDelta, FormatMoney(nFeeDelta));
 }
@@ -707,7 +919,7 @@ void CTxMemPool::PrioritiseTransaction(const uint256 hash, const std::string str
 void CTxMemPool::ApplyDeltas(const uint256 hash, double &dPriorityDelta, CAmount &nFeeDelta)
 {
     LOCK(cs);
-    std::map<uint256, std::pair<double, CAmount> >::iterator pos = mapDeltas.find(hash);
+    DeltasMap::iterator pos = mapDeltas.find(hash);
     if (pos == mapDeltas.end())
         return;
     const std::pair<double, CAmount> &deltas = pos->second;
@@ -719,6 +931,25 @@ void CTxMemPool::ClearPrioritisation(const uint256 hash)
 {
     LOCK(cs);
     mapDeltas.erase(hash);
+    if (mapTx.count(hash))
+        UpdateFeeDelta(hash, 0);
+}
+
+void CTxMemPool::UpdateFeeDelta(const uint256& hash, CAmount nFeeDelta)
+{
+    indexed_transaction_set::iterator it = mapTx.find(hash);
+    CAmount nModifyFee = nFeeDelta - (it->GetModifiedFee() - it->GetFee());
+    if (nModifyFee == 0)
+        return;
+    mapTx.modify(it, update_fee_delta(nFeeDelta));
+    std::set<uint256> setAncestors;
+    CalculateMemPoolAncestors(it->GetTx(), setAncestors);
+    for (const uint256& ancestor : setAncestors)
+        mapTx.modify(mapTx.find(ancestor), update_descendant_state(0, nModifyFee, 0));
+    std::set<uint256> setDescendants;
+    CalculateDescendants(hash, setDescendants);
+    for (const uint256& descendant : setDescendants)
+        mapTx.modify(mapTx.find(descendant), update_ancestor_state(0, nModifyFee, 0));
 }
 
 bool CTxMemPool::HasNoInputsOf(const CTransaction &tx) const
@@ -729,6 +960,103 @@ bool CTxMemPool::HasNoInputsOf(const CTransaction &tx) const
     return true;
 }
 
+void CTxMemPool::CalculateMemPoolAncestors(const CTransaction &tx, std::set<uint256> &ancestors) const
+{
+    std::vector<const CTransaction*> stage;
+    stage.push_back(&tx);
+    while (!stage.empty()) {
+        const CTransaction* ptx = stage.back();
+        stage.pop_back();
+        for (const CTxIn& txin : ptx->vin) {
+            indexed_transaction_set::const_iterator it = mapTx.find(txin.prevout.hash);
+            if (it != mapTx.end() && ancestors.insert(txin.prevout.hash).second)
+                stage.push_back(&it->GetTx());
+        }
+    }
+}
+
+void CTxMemPool::CalculateDescendants(const uint256 &hash, std::set<uint256> &descendants) const
+{
+    std::vector<uint256> stage;
+    stage.push_back(hash);
+    while (!stage.empty()) {
+        uint256 parent = stage.back();
+        stage.pop_back();
+        indexed_transaction_set::const_iterator parentIt = mapTx.find(parent);
+        if (parentIt == mapTx.end())
+            continue;
+        for (uint32_t i = 0; i < parentIt->GetTx().vout.size(); i++) {
+            NextTxMap::const_iterator it = mapNextTx.find(COutPoint(parent, i));
+            if (it == mapNextTx.end())
+                continue;
+            const uint256& child = it->second.ptx->GetHash();
+            if (descendants.insert(child).second)
+                stage.push_back(child);
+        }
+    }
+}
+
+void CTxMemPool::UpdateAncestorsOf(bool add, const CTxMemPoolEntry &entry, const std::set<uint256> &ancestors)
+{
+    int64_t modifySize = entry.GetTxSize();
+    CAmount modifyFee = entry.GetModifiedFee();
+    int64_t modifyCount = 1;
+    if (!add) {
+        modifySize = -modifySize;
+        modifyFee = -modifyFee;
+        modifyCount = -modifyCount;
+    }
+    for (const uint256& ancestor : ancestors)
+        mapTx.modify(mapTx.find(ancestor), update_descendant_state(modifySize, modifyFee, modifyCount));
+}
+
+void CTxMemPool::UpdateDescendantsOf(bool add, const CTxMemPoolEntry &entry, const std::set<uint256> &descendants)
+{
+    int64_t modifySize = entry.GetTxSize();
+    CAmount modifyFee = entry.GetModifiedFee();
+    int64_t modifyCount = 1;
+    if (!add) {
+        modifySize = -modifySize;
+        modifyFee = -modifyFee;
+        modifyCount = -modifyCount;
+    }
+    for (const uint256& descendant : descendants)
+        mapTx.modify(mapTx.find(descendant), update_ancestor_state(modifySize, modifyFee, modifyCount));
+}
+
+void CTxMemPool::UpdatePackageState(const uint256 &hash)
+{
+    indexed_transaction_set::iterator it = mapTx.find(hash);
+
+    std::set<uint256> setAncestors;
+    CalculateMemPoolAncestors(it->GetTx(), setAncestors);
+    int64_t nSizeWithAncestors = it->GetTxSize();
+    CAmount nModFeesWithAncestors = it->GetModifiedFee();
+    for (const uint256& ancestor : setAncestors) {
+        const CTxMemPoolEntry& ancestorEntry = *mapTx.find(ancestor);
+        nSizeWithAncestors += ancestorEntry.GetTxSize();
+        nModFeesWithAncestors += ancestorEntry.GetModifiedFee();
+    }
+    mapTx.modify(it, update_ancestor_state(
+        nSizeWithAncestors - (int64_t)it->GetSizeWithAncestors(),
+        nModFeesWithAncestors - it->GetModFeesWithAncestors(),
+        (int64_t)setAncestors.size() + 1 - (int64_t)it->GetCountWithAncestors()));
+
+    std::set<uint256> setDescendants;
+    CalculateDescendants(hash, setDescendants);
+    int64_t nSizeWithDescendants = it->GetTxSize();
+    CAmount nModFeesWithDescendants = it->GetModifiedFee();
+    for (const uint256& descendant : setDescendants) {
+        const CTxMemPoolEntry& descendantEntry = *mapTx.find(descendant);
+        nSizeWithDescendants += descendantEntry.GetTxSize();
+        nModFeesWithDescendants += descendantEntry.GetModifiedFee();
+    }
+    mapTx.modify(it, update_descendant_state(
+        nSizeWithDescendants - (int64_t)it->GetSizeWithDescendants(),
+        nModFeesWithDescendants - it->GetModFeesWithDescendants(),
+        (int64_t)setDescendants.size() + 1 - (int64_t)it->GetCountWithDescendants()));
+}
+
 bool CTxMemPool::nullifierExists(const uint256& nullifier, ShieldedType type) const
 {
     switch (type) {
@@ -769,6 +1097,34 @@ bool CTxMemPool::IsFullyNotified() {
     return nRecentlyAddedSequence == nNotifiedSequence;
 }
 
+void CTxMemPool::AddEvent(const uint256& txid, bool fAdded)
+{
+    AssertLockHeld(cs);
+    if (eventLog.size() >= MEMPOOL_EVENT_LOG_SIZE) {
+        nEventLogStart = eventLog.front().nSequence;
+        eventLog.pop_front();
+    }
+    eventLog.emplace_back(++nEventSequence, txid, fAdded);
+}
+
+uint64_t CTxMemPool::GetEventSequence() const
+{
+    LOCK(cs);
+    return nEventSequence;
+}
+
+bool CTxMemPool::GetEventsSince(uint64_t nSince, std::vector<CMempoolEvent>& events) const
+{
+    LOCK(cs);
+    if (nSince > nEventSequence) {
+        return false;
+    }
+    // The log holds consecutive sequence numbers, ending at nEventSequence.
+    size_t nCount = std::min<uint64_t>(nEventSequence - nSince, eventLog.size());
+    events.insert(events.end(), eventLog.end() - nCount, eventLog.end());
+    return nSince >= nEventLogStart;
+}
+
 CCoinsViewMemPool::CCoinsViewMemPool(CCoinsView *baseIn, CTxMemPool &mempoolIn) : CCoinsViewBacked(baseIn), mempool(mempoolIn) { }
 
 bool CCoinsViewMemPool::GetNullifier(const uint256 &nf, ShieldedType type) const
@@ -776,20 +1132,55 @@ bool CCoinsViewMemPool::GetNullifier(const uint256 &nf, ShieldedType type) const
     return mempool.nullifierExists(nf, type) || base->GetNullifier(nf, type);
 }
 
-bool CCoinsViewMemPool::GetCoins(const uint256 &txid, CCoins &coins) const {
+bool CCoinsViewMemPool::GetCoin(const COutPoint &outpoint, Coin &coin) const {
     // If an entry in the mempool exists, always return that one, as it's guaranteed to never
     // conflict with the underlying cache, and it cannot have pruned entries (as it contains full)
     // transactions. First checking the underlying cache risks returning a pruned entry instead.
     CTransaction tx;
-    if (mempool.lookup(txid, tx)) {
-        coins = CCoins(tx, MEMPOOL_HEIGHT);
-        return true;
+    if (mempool.lookup(outpoint.hash, tx)) {
+        if (outpoint.n < tx.vout.size()) {
+            coin = Coin(tx.vout[outpoint.n], MEMPOOL_HEIGHT, false);
+            return true;
+        } else {
+            return false;
+        }
     }
-    return (base->GetCoins(txid, coins) && !coins.IsPruned());
+    return (base->GetCoin(outpoint, coin) && !coin.IsSpent());
 }
 
-bool CCoinsViewMemPool::HaveCoins(const uint256 &txid) const {
-    return mempool.exists(txid) || base->HaveCoins(txid);
+bool CCoinsViewMemPool::HaveCoin(const COutPoint &outpoint) const {
+    return mempool.exists(outpoint) || base->HaveCoin(outpoint);
+}
+
+// Estimate the overhead of mapTx to be 12 pointers + an allocation, as no exact formula for
+// boost::multi_index_contained is implemented.
+static size_t MapTxEntryUsage()
+{
+    return memusage::MallocUsage(sizeof(CTxMemPoolEntry) + 12 * sizeof(void*));
+}
+
+size_t CTxMemPool::GetEntryMemoryUsage(const CTxMemPoolEntry &entry) const
+{
+    const CTransaction& tx = entry.GetTx();
+    // Records in the hash maps take a node plus, at a load factor of about
+    // one, a bucket pointer.
+    const size_t nullifierUsage = memusage::MallocUsage(sizeof(memusage::boost_unordered_node<std::pair<const uint256, const CTransaction*>>)) + sizeof(void*);
+
+    size_t nullifiers = tx.vShieldedSpend.size();
+    for (const JSDescription& joinsplit : tx.vJoinSplit) {
+        nullifiers += joinsplit.nullifiers.size();
+    }
+
+    size_t usage = MapTxEntryUsage() + entry.DynamicMemoryUsage();
+    usage += (memusage::MallocUsage(sizeof(memusage::boost_unordered_node<std::pair<const COutPoint, CInPoint>>)) + sizeof(void*)) * tx.vin.size();
+    // Nullifier maps
+    usage += nullifierUsage * nullifiers;
+    // The wallet notification map, until it is drained
+    usage += memusage::MallocUsage(sizeof(memusage::stl_tree_node<std::pair<const uint256, const CTransaction*>>));
+    // The entry in weightedTxTree itself
+    usage += sizeof(WeightedTxInfo) + sizeof(TxWeight) +
+        memusage::MallocUsage(sizeof(memusage::stl_tree_node<std::pair<const uint256, size_t>>));
+    return usage;
 }
 
 size_t CTxMemPool::DynamicMemoryUsage() const {
@@ -797,9 +1188,7 @@ size_t CTxMemPool::DynamicMemoryUsage() const {
 
     size_t total = 0;
 
-    // Estimate the overhead of mapTx to be 6 pointers + an allocation, as no exact formula for
-    // boost::multi_index_contained is implemented.
-    total += memusage::MallocUsage(sizeof(CTxMemPoolEntry) + 6 * sizeof(void*)) * mapTx.size();
+    total += MapTxEntryUsage() * mapTx.size();
 
     // Two metadata maps inherited from Bitcoin Core
     total += memusage::DynamicUsage(mapNextTx) + memusage::DynamicUsage(mapDeltas);
@@ -807,8 +1196,9 @@ size_t CTxMemPool::DynamicMemoryUsage() const {
     // Saves iterating over the full map
     total += cachedInnerUsage;
 
-    // Wallet notification
+    // Wallet notification, and the log for getmempoolchanges
     total += memusage::DynamicUsage(mapRecentlyAddedTx);
+    total += sizeof(CMempoolEvent) * eventLog.size();
 
     // Nullifier set tracking
     total += memusage::DynamicUsage(mapSproutNullifiers) + memusage::DynamicUsage(mapSaplingNullifiers);
@@ -817,14 +1207,20 @@ size_t CTxMemPool::DynamicMemoryUsage() const {
     total += memusage::DynamicUsage(recentlyEvicted) + memusage::DynamicUsage(weightedTxTree);
 
     // Insight-related structures
+    total += InsightMemoryUsage();
+
+    return total;
+}
+
+size_t CTxMemPool::InsightMemoryUsage() const {
+    LOCK(cs);
+
     size_t insight = 0;
     insight += memusage::DynamicUsage(mapAddress);
     insight += memusage::DynamicUsage(mapAddressInserted);
     insight += memusage::DynamicUsage(mapSpent);
     insight += memusage::DynamicUsage(mapSpentInserted);
-    total += insight;
-
-    return total;
+    return insight;
 }
 
 void CTxMemPool::SetMempoolCostLimit(int64_t totalCostLimit, int64_t evictionMemorySeconds) {
@@ -836,6 +1232,23 @@ void CTxMemPool::SetMempoolCostLimit(int64_t totalCostLimit, int64_t evictionMem
     weightedTxTree = new WeightedTxTree(totalCostLimit);
 }
 
+void CTxMemPool::ResizeMempoolCostLimit(int64_t totalCostLimit) {
+    LOCK(cs);
+    LogPrint("mempool", "Resizing mempool cost limit: (limit=%d)\n", totalCostLimit);
+    weightedTxTree->setCapacity(totalCostLimit);
+    EnsureSizeLimit();
+}
+
+int64_t CTxMemPool::GetMempoolCostLimit() {
+    LOCK(cs);
+    return weightedTxTree->getCapacity();
+}
+
+int64_t CTxMemPool::GetMempoolCost() {
+    LOCK(cs);
+    return weightedTxTree->getTotalWeight().cost;
+}
+
 bool CTxMemPool::IsRecentlyEvicted(const uint256& txId) {
     LOCK(cs);
     return recentlyEvicted->contains(txId);
@@ -6,7 +6,9 @@
 #ifndef BITCOIN_TXMEMPOOL_H
 #define BITCOIN_TXMEMPOOL_H
 
+#include <deque>
 #include <list>
+#include <set>
 
 #include "amount.h"
 #include "coins.h"
@@ -21,8 +23,10 @@
 #include "boost/multi_index_container.hpp"
 #include "boost/multi_index/ordered_index.hpp"
 #include "boost/multi_index/hashed_index.hpp"
+#include "boost/unordered_map.hpp"
 
 class CAutoFile;
+struct PrecomputedTransactionData;
 
 inline double AllowFreeThreshold()
 {
@@ -36,16 +40,33 @@ inline bool AllowFree(double dPriority)
     return dPriority > AllowFreeThreshold();
 }
 
-/** Fake height value used in CCoins to signify they are only in the memory pool (since 0.8) */
+/** Fake height value used in Coin to signify they are only in the memory pool (since 0.8) */
 static const unsigned int MEMPOOL_HEIGHT = 0x7FFFFFFF;
 
+/** The number of mempool additions and removals kept for getmempoolchanges */
+static const size_t MEMPOOL_EVENT_LOG_SIZE = 100000;
+
+/** A transaction entering or leaving the mempool. */
+struct CMempoolEvent
+{
+    //! Numbers the additions and removals in the order they happened, from 1.
+    uint64_t nSequence;
+    uint256 txid;
+    bool fAdded;
+
+    CMempoolEvent(uint64_t nSequenceIn, const uint256& txidIn, bool fAddedIn) :
+        nSequence(nSequenceIn), txid(txidIn), fAdded(fAddedIn) {}
+};
+
 /**
  * CTxMemPool stores these:
  */
 class CTxMemPoolEntry
 {
 private:
-    CTransaction tx;
+    CTransactionRef tx;
+    //! The signature hash midstates of tx, reused when it is mined
+    std::shared_ptr<const PrecomputedTransactionData> txdata;
     CAmount nFee;              //!< Cached to avoid expensive parent-transaction lookups
     size_t nTxSize;            //!< ... and avoid recomputing tx size
     size_t nModSize;           //!< ... and modified size for priority
@@ -57,18 +78,38 @@ private:
     bool hadNoDependencies;    //!< Not dependent on any other txs when it entered the mempool
     bool spendsCoinbase;       //!< keep track of transactions that spend a coinbase
     uint32_t nBranchId;        //!< Branch ID this transaction is known to commit to, cached for efficiency
+    CAmount feeDelta;          //!< Fee delta set by prioritisetransaction, used when selecting transactions for blocks
+
+    // Information about descendants of this transaction that are in the
+    // mempool, including this one.
+    uint64_t nCountWithDescendants;  //!< number of descendant transactions
+    uint64_t nSizeWithDescendants;   //!< ... and size
+    CAmount nModFeesWithDescendants; //!< ... and total fees (all including us)
+
+    // Analogous statistics for ancestor transactions
+    uint64_t nCountWithAncestors;
+    uint64_t nSizeWithAncestors;
+    CAmount nModFeesWithAncestors;
 
 public:
+    /** txdata is computed from _tx if it is null. */
+    CTxMemPoolEntry(const CTransactionRef& _tx, const CAmount& _nFee,
+                    int64_t _nTime, double _dPriority, unsigned int _nHeight,
+                    bool poolHasNoInputsOf, bool spendsCoinbase, uint32_t nBranchId,
+                    std::shared_ptr<const PrecomputedTransactionData> txdata = nullptr);
     CTxMemPoolEntry(const CTransaction& _tx, const CAmount& _nFee,
                     int64_t _nTime, double _dPriority, unsigned int _nHeight,
                     bool poolHasNoInputsOf, bool spendsCoinbase, uint32_t nBranchId);
     CTxMemPoolEntry();
     CTxMemPoolEntry(const CTxMemPoolEntry& other);
 
-    const CTransaction& GetTx() const { return this->tx; }
+    const CTransaction& GetTx() const { return *this->tx; }
+    const CTransactionRef& GetSharedTx() const { return this->tx; }
+    const std::shared_ptr<const PrecomputedTransactionData>& GetTxData() const { return this->txdata; }
     double GetPriority(unsigned int currentHeight) const;
     CAmount GetFee() const { return nFee; }
     CFeeRate GetFeeRate() const { return feeRate; }
+    CAmount GetModifiedFee() const { return nFee + feeDelta; }
     size_t GetTxSize() const { return nTxSize; }
     int64_t GetTime() const { return nTime; }
     unsigned int GetHeight() const { return nHeight; }
@@ -77,6 +118,61 @@ public:
 
     bool GetSpendsCoinbase() const { return spendsCoinbase; }
     uint32_t GetValidatedBranchId() const { return nBranchId; }
+
+    // Adjusts the package aggregates as well as the entry's own modified fee.
+    void UpdateFeeDelta(CAmount newFeeDelta);
+    // Adjusts the descendant state
+    void UpdateDescendantState(int64_t modifySize, CAmount modifyFee, int64_t modifyCount);
+    // Adjusts the ancestor state
+    void UpdateAncestorState(int64_t modifySize, CAmount modifyFee, int64_t modifyCount);
+
+    uint64_t GetCountWithDescendants() const { return nCountWithDescendants; }
+    uint64_t GetSizeWithDescendants() const { return nSizeWithDescendants; }
+    CAmount GetModFeesWithDescendants() const { return nModFeesWithDescendants; }
+
+    uint64_t GetCountWithAncestors() const { return nCountWithAncestors; }
+    uint64_t GetSizeWithAncestors() const { return nSizeWithAncestors; }
+    CAmount GetModFeesWithAncestors() const { return nModFeesWithAncestors; }
+};
+
+struct update_fee_delta
+{
+    update_fee_delta(CAmount _feeDelta) : feeDelta(_feeDelta) { }
+
+    void operator() (CTxMemPoolEntry &e) { e.UpdateFeeDelta(feeDelta); }
+
+private:
+    CAmount feeDelta;
+};
+
+struct update_descendant_state
+{
+    update_descendant_state(int64_t _modifySize, CAmount _modifyFee, int64_t _modifyCount) :
+        modifySize(_modifySize), modifyFee(_modifyFee), modifyCount(_modifyCount)
+    {}
+
+    void operator() (CTxMemPoolEntry &e)
+        { e.UpdateDescendantState(modifySize, modifyFee, modifyCount); }
+
+private:
+    int64_t modifySize;
+    CAmount modifyFee;
+    int64_t modifyCount;
+};
+
+struct update_ancestor_state
+{
+    update_ancestor_state(int64_t _modifySize, CAmount _modifyFee, int64_t _modifyCount) :
+        modifySize(_modifySize), modifyFee(_modifyFee), modifyCount(_modifyCount)
+    {}
+
+    void operator() (CTxMemPoolEntry &e)
+        { e.UpdateAncestorState(modifySize, modifyFee, modifyCount); }
+
+private:
+    int64_t modifySize;
+    CAmount modifyFee;
+    int64_t modifyCount;
 };
 
 // extracts a TxMemPoolEntry's transaction hash
@@ -92,7 +188,7 @@ struct mempoolentry_txid
 class CompareTxMemPoolEntryByFee
 {
 public:
-    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b)
+    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b) const
     {
         if (a.GetFeeRate() == b.GetFeeRate())
             return a.GetTime() < b.GetTime();
@@ -100,6 +196,46 @@ public:
     }
 };
 
+/**
+ * Sort by the fee rate including the fee delta of the transaction, which is
+ * the order in which CreateNewBlock() considers transactions once it has
+ * filled the part of the block reserved for high-priority ones.
+ */
+class CompareTxMemPoolEntryByScore
+{
+public:
+    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b) const
+    {
+        double f1 = (double)a.GetModifiedFee() * b.GetTxSize();
+        double f2 = (double)b.GetModifiedFee() * a.GetTxSize();
+        if (f1 == f2)
+            return a.GetTx().GetHash() < b.GetTx().GetHash();
+        return f1 > f2;
+    }
+};
+
+/**
+ * Sort by the fee rate of the transaction together with all of its in-mempool
+ * ancestors, which is what a miner earns per byte for including the package
+ * that the transaction needs.
+ */
+class CompareTxMemPoolEntryByAncestorFee
+{
+public:
+    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b) const
+    {
+        double f1 = (double)a.GetModFeesWithAncestors() * b.GetSizeWithAncestors();
+        double f2 = (double)b.GetModFeesWithAncestors() * a.GetSizeWithAncestors();
+        if (f1 == f2)
+            return a.GetTx().GetHash() < b.GetTx().GetHash();
+        return f1 > f2;
+    }
+};
+
+// Multi_index tag names
+struct mining_score {};
+struct ancestor_score {};
+
 class CBlockPolicyEstimator;
 
 /** An inpoint - a combination of a transaction and an index n into its vin */
@@ -116,6 +252,33 @@ public:
     size_t DynamicMemoryUsage() const { return 0; }
 };
 
+// insightexplorer
+class SaltedAddressHasher
+{
+private:
+    /** Salt */
+    const uint64_t k0, k1;
+
+public:
+    SaltedAddressHasher();
+
+    size_t operator()(const std::pair<int, uint160>& address) const;
+};
+
+class SaltedSpentIndexKeyHasher
+{
+private:
+    /** Salt */
+    const uint64_t k0, k1;
+
+public:
+    SaltedSpentIndexKeyHasher();
+
+    size_t operator()(const CSpentIndexKey& key) const {
+        return SipHashUint256Extra(k0, k1, key.txid, key.outputIndex);
+    }
+};
+
 /**
  * CTxMemPool stores valid-according-to-the-current-best-chain
  * transactions that may be included in the next block.
@@ -128,6 +291,11 @@ public:
  */
 class CTxMemPool
 {
+public:
+    typedef boost::unordered_map<uint256, const CTransaction*, SaltedTxidHasher> NullifiersMap;
+    typedef boost::unordered_map<COutPoint, CInPoint, SaltedOutpointHasher> NextTxMap;
+    typedef boost::unordered_map<uint256, std::pair<double, CAmount>, SaltedTxidHasher> DeltasMap;
+
 private:
     uint32_t nCheckFrequency; //!< Value n means that n times in 2^32 we check.
     unsigned int nTransactionsUpdated;
@@ -140,13 +308,36 @@ private:
     uint64_t nRecentlyAddedSequence = 0;
     uint64_t nNotifiedSequence = 0;
 
-    std::map<uint256, const CTransaction*> mapSproutNullifiers;
-    std::map<uint256, const CTransaction*> mapSaplingNullifiers;
+    //! The last additions and removals, and the sequence number of the last
+    //! one. The log holds every event after nEventLogStart.
+    std::deque<CMempoolEvent> eventLog;
+    uint64_t nEventSequence = 0;
+    uint64_t nEventLogStart = 0;
+
+    NullifiersMap mapSproutNullifiers;
+    NullifiersMap mapSaplingNullifiers;
     RecentlyEvictedList* recentlyEvicted = new RecentlyEvictedList(DEFAULT_MEMPOOL_EVICTION_MEMORY_MINUTES * 60);
     WeightedTxTree* weightedTxTree = new WeightedTxTree(DEFAULT_MEMPOOL_TOTAL_COST_LIMIT);
 
     void checkNullifiers(ShieldedType type) const;
-    
+
+    /** Estimate the memory used by the transaction of an entry and its records in the pool. */
+    size_t GetEntryMemoryUsage(const CTxMemPoolEntry &entry) const;
+
+    /**
+     * Add (or subtract) the size, modified fee and count of the entry to the
+     * descendant state of each of the given ancestors, or to the ancestor
+     * state of each of the given descendants.
+     */
+    void UpdateAncestorsOf(bool add, const CTxMemPoolEntry &entry, const std::set<uint256> &ancestors);
+    void UpdateDescendantsOf(bool add, const CTxMemPoolEntry &entry, const std::set<uint256> &descendants);
+    /** Recompute the package aggregates of an entry from its in-mempool ancestors and descendants. */
+    void UpdatePackageState(const uint256 &hash);
+    /** Set the fee delta of an entry in the pool and of its ancestors' and descendants' aggregates. */
+    void UpdateFeeDelta(const uint256& hash, CAmount nFeeDelta);
+    /** Append an addition or removal to eventLog, dropping the oldest once it is full. */
+    void AddEvent(const uint256& txid, bool fAdded);
+
 public:
     typedef boost::multi_index_container<
         CTxMemPoolEntry,
@@ -157,6 +348,18 @@ public:
             boost::multi_index::ordered_non_unique<
                 boost::multi_index::identity<CTxMemPoolEntry>,
                 CompareTxMemPoolEntryByFee
+            >,
+            // sorted by modified fee rate, for selecting transactions for blocks
+            boost::multi_index::ordered_non_unique<
+                boost::multi_index::tag<mining_score>,
+                boost::multi_index::identity<CTxMemPoolEntry>,
+                CompareTxMemPoolEntryByScore
+            >,
+            // sorted by fee rate including in-mempool ancestors
+            boost::multi_index::ordered_non_unique<
+                boost::multi_index::tag<ancestor_score>,
+                boost::multi_index::identity<CTxMemPoolEntry>,
+                CompareTxMemPoolEntryByAncestorFee
             >
         >
     > indexed_transaction_set;
@@ -166,14 +369,23 @@ public:
 
 private:
     // insightexplorer
-    std::map<CMempoolAddressDeltaKey, CMempoolAddressDelta, CMempoolAddressDeltaKeyCompare> mapAddress;
-    std::map<uint256, std::vector<CMempoolAddressDeltaKey> > mapAddressInserted;
-    std::map<CSpentIndexKey, CSpentIndexValue, CSpentIndexKeyCompare> mapSpent;
-    std::map<uint256, std::vector<CSpentIndexKey>> mapSpentInserted;
+    typedef std::pair<int, uint160> address_t; //!< address type and hash
+    boost::unordered_map<address_t, std::vector<std::pair<CMempoolAddressDeltaKey, CMempoolAddressDelta>>, SaltedAddressHasher> mapAddress;
+    boost::unordered_map<uint256, std::vector<CMempoolAddressDeltaKey>, SaltedTxidHasher> mapAddressInserted;
+    boost::unordered_map<CSpentIndexKey, CSpentIndexValue, SaltedSpentIndexKeyHasher> mapSpent;
+    boost::unordered_map<uint256, std::vector<CSpentIndexKey>, SaltedTxidHasher> mapSpentInserted;
+    // Whether the address and spent indexes are up to date. With lazy
+    // indexes, each is only built when it is first queried, and then kept up
+    // to date as transactions are added and removed.
+    bool fAddressIndexBuilt = true;
+    bool fSpentIndexBuilt = true;
+
+    void buildAddressIndex(CCoinsView *pcoinsBase);
+    void buildSpentIndex(CCoinsView *pcoinsBase);
 
 public:
-    std::map<COutPoint, CInPoint> mapNextTx;
-    std::map<uint256, std::pair<double, CAmount> > mapDeltas;
+    NextTxMap mapNextTx;
+    DeltasMap mapDeltas;
 
     CTxMemPool(const CFeeRate& _minRelayFee);
     ~CTxMemPool();
@@ -190,19 +402,37 @@ public:
     bool addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry, bool fCurrentEstimate = true);
 
     // START insightexplorer
+    /**
+     * Build the address and spent indexes only when they are first queried,
+     * instead of as transactions are added. Must be set while the pool is empty.
+     */
+    void setLazyInsightIndexes(bool fLazy);
+
+    // The getters look up the inputs of the pool's transactions in pcoinsBase
+    // (with cs_main held) if the index has not been built yet.
     void addAddressIndex(const CTxMemPoolEntry &entry, const CCoinsViewCache &view);
     void getAddressIndex(const std::vector<std::pair<uint160, int>>& addresses,
-                         std::vector<std::pair<CMempoolAddressDeltaKey, CMempoolAddressDelta>>& results);
+                         std::vector<std::pair<CMempoolAddressDeltaKey, CMempoolAddressDelta>>& results,
+                         CCoinsView *pcoinsBase);
     void removeAddressIndex(const uint256& txhash);
 
     void addSpentIndex(const CTxMemPoolEntry &entry, const CCoinsViewCache &view);
-    bool getSpentIndex(const CSpentIndexKey &key, CSpentIndexValue &value);
+    bool getSpentIndex(const CSpentIndexKey &key, CSpentIndexValue &value, CCoinsView *pcoinsBase);
     void removeSpentIndex(const uint256 txhash);
     // END insightexplorer
 
     void remove(const CTransaction &tx, std::list<CTransaction>& removed, bool fRecursive = false);
-    void removeWithAnchor(const uint256 &invalidRoot, ShieldedType type);
-    void removeForReorg(const CCoinsViewCache *pcoins, unsigned int nMemPoolHeight, int flags);
+    /**
+     * Remove, in a single pass over the mempool, the transactions that a
+     * reorg has made invalid: those that are no longer final, that spend a
+     * coinbase which is now immature, that use a Sprout or Sapling anchor
+     * which is no longer in the chain, or that were validated against a
+     * consensus branch other than nMemPoolBranchId.
+     */
+    void removeForReorg(const CCoinsViewCache *pcoins, unsigned int nMemPoolHeight, int flags,
+                        const std::set<uint256>& setInvalidSproutAnchors,
+                        const std::set<uint256>& setInvalidSaplingAnchors,
+                        uint32_t nMemPoolBranchId);
     void removeConflicts(const CTransaction &tx, std::list<CTransaction>& removed);
     std::vector<uint256> removeExpired(unsigned int nBlockHeight);
     void removeForBlock(const std::vector<CTransaction>& vtx, unsigned int nBlockHeight,
@@ -210,16 +440,28 @@ public:
     void removeWithoutBranchId(uint32_t nMemPoolBranchId);
     void clear();
     void queryHashes(std::vector<uint256>& vtxid);
-    void pruneSpent(const uint256& hash, CCoins &coins);
+    bool isSpent(const COutPoint& outpoint);
     unsigned int GetTransactionsUpdated() const;
     void AddTransactionsUpdated(unsigned int n);
+    /**
+     * Collect the txids of the in-mempool ancestors of tx, which need not be
+     * in the mempool itself. The transaction's own txid is not included.
+     */
+    void CalculateMemPoolAncestors(const CTransaction &tx, std::set<uint256> &ancestors) const;
+    /**
+     * Collect the txids of the in-mempool descendants of the transaction with
+     * the given txid, which need not be in the mempool itself. Txids already
+     * in the set are assumed to have had their descendants collected.
+     */
+    void CalculateDescendants(const uint256 &hash, std::set<uint256> &descendants) const;
+
     /**
      * Check that none of this transactions inputs are in the mempool, and thus
      * the tx is not dependent on other mempool transactions to be included in a block.
      */
     bool HasNoInputsOf(const CTransaction& tx) const;
 
-    /** Affect CreateNewBlock prioritisation of transactions */
+    /** Affect CreateNewBlock prioritisation of transactions. The fee delta is also applied to the entry, if the transaction is in the pool. */
     void PrioritiseTransaction(const uint256 hash, const std::string strHash, double dPriorityDelta, const CAmount& nFeeDelta);
     void ApplyDeltas(const uint256 hash, double &dPriorityDelta, CAmount &nFeeDelta);
     void ClearPrioritisation(const uint256 hash);
@@ -230,6 +472,15 @@ public:
     void SetNotifiedSequence(uint64_t recentlyAddedSequence);
     bool IsFullyNotified();
 
+    /** The sequence number of the last addition or removal. */
+    uint64_t GetEventSequence() const;
+    /**
+     * Append the additions and removals after nSince to events. Returns false
+     * if some of them are no longer kept, in which case only those that are
+     * kept are appended.
+     */
+    bool GetEventsSince(uint64_t nSince, std::vector<CMempoolEvent>& events) const;
+
     unsigned long size()
     {
         LOCK(cs);
@@ -248,26 +499,56 @@ public:
         return (mapTx.count(hash) != 0);
     }
 
+    bool exists(const COutPoint& outpoint) const
+    {
+        LOCK(cs);
+        auto it = mapTx.find(outpoint.hash);
+        return (it != mapTx.end() && outpoint.n < it->GetTx().vout.size());
+    }
+
     bool lookup(uint256 hash, CTransaction& result) const;
+    /** Return the transaction with the given hash, shared with the pool, or null if it is not in the pool */
+    CTransactionRef get(const uint256& hash) const;
+    /**
+     * Get the signature hash midstates and the serialized size computed when
+     * the transaction with the given hash was admitted. Returns false if it is
+     * not in the pool.
+     */
+    bool GetTxData(const uint256& hash, std::shared_ptr<const PrecomputedTransactionData>& txdata, size_t& nTxSize) const;
 
     /** Estimate fee rate needed to get into the next nBlocks */
     CFeeRate estimateFee(int nBlocks) const;
 
     /** Estimate priority needed to get into the next nBlocks */
     double estimatePriority(int nBlocks) const;
+
+    /** Fold the blocks connected since the last call into the fee and priority estimates */
+    void UpdateFeeEstimates();
     
     /** Write/Read estimates to disk */
     bool WriteFeeEstimates(CAutoFile& fileout) const;
     bool ReadFeeEstimates(CAutoFile& filein);
 
     size_t DynamicMemoryUsage() const;
+    //! The part of DynamicMemoryUsage used by the address and spent indexes
+    size_t InsightMemoryUsage() const;
 
     /** Return nCheckFrequency */
     uint32_t GetCheckFrequency() const {
         return nCheckFrequency;
     }
 
+    /** Write/Read the list of recently evicted transactions to/from mempool.dat */
+    void WriteRecentlyEvicted(CAutoFile& fileout) const;
+    void ReadRecentlyEvicted(CAutoFile& filein);
+
     void SetMempoolCostLimit(int64_t totalCostLimit, int64_t evictionMemorySeconds);
+    // Change the cost limit, keeping the transactions and the recently evicted list.
+    // Transactions over a lower limit are evicted.
+    void ResizeMempoolCostLimit(int64_t totalCostLimit);
+    int64_t GetMempoolCostLimit();
+    // Returns the total cost of the transactions in the mempool
+    int64_t GetMempoolCost();
     // Returns true if a transaction has been recently evicted
     bool IsRecentlyEvicted(const uint256& txId);
     // If the mempool size limit is exceeded, this evicts transactions from the mempool until it is below capacity
@@ -286,8 +567,8 @@ protected:
 public:
     CCoinsViewMemPool(CCoinsView *baseIn, CTxMemPool &mempoolIn);
     bool GetNullifier(const uint256 &txid, ShieldedType type) const;
-    bool GetCoins(const uint256 &txid, CCoins &coins) const;
-    bool HaveCoins(const uint256 &txid) const;
+    bool GetCoin(const COutPoint &outpoint, Coin &coin) const;
+    bool HaveCoin(const COutPoint &outpoint) const;
 };
 
 #endif // BITCOIN_TXMEMPOOL_H
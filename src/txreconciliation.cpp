@@ -0,0 +1,139 @@
+// Copyright (c) 2021 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "txreconciliation.h"
+
+#include "crypto/common.h"
+#include "crypto/sha256.h"
+#include "hash.h"
+
+#include <algorithm>
+
+namespace {
+
+/** Mix a short ID with the index of a table, or of the checksum of a cell. */
+inline uint32_t MixID(uint32_t id, uint32_t n)
+{
+    uint32_t h = id * 0x9e3779b1U + n * 0x85ebca77U;
+    h ^= h >> 16;
+    h *= 0x85ebca6bU;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35U;
+    h ^= h >> 16;
+    return h;
+}
+
+const uint32_t CHECKSUM_INDEX = 3;
+
+} // namespace
+
+void CTxSketch::Toggle(uint32_t id, int32_t n)
+{
+    size_t nTable = cells.size() / 3;
+    uint32_t hash = MixID(id, CHECKSUM_INDEX);
+    for (uint32_t i = 0; i < 3; i++) {
+        Cell& cell = cells[i * nTable + MixID(id, i) % nTable];
+        cell.count += n;
+        cell.idSum ^= id;
+        cell.hashSum ^= hash;
+    }
+}
+
+bool CTxSketch::Subtract(const CTxSketch& other)
+{
+    if (other.cells.size() != cells.size())
+        return false;
+    for (size_t i = 0; i < cells.size(); i++) {
+        cells[i].count -= other.cells[i].count;
+        cells[i].idSum ^= other.cells[i].idSum;
+        cells[i].hashSum ^= other.cells[i].hashSum;
+    }
+    return true;
+}
+
+bool CTxSketch::Decode(std::vector<uint32_t>& vPositive, std::vector<uint32_t>& vNegative) const
+{
+    vPositive.clear();
+    vNegative.clear();
+    if (cells.empty() || cells.size() % 3 != 0)
+        return false;
+
+    // Peel off the cells that hold a single ID, until none are left.
+    CTxSketch sketch(*this);
+    std::vector<size_t> vPure;
+    for (size_t i = 0; i < cells.size(); i++)
+        vPure.push_back(i);
+    size_t nMaxIDs = cells.size();
+    while (!vPure.empty()) {
+        const Cell& cell = sketch.cells[vPure.back()];
+        vPure.pop_back();
+        if ((cell.count != 1 && cell.count != -1) || cell.hashSum != MixID(cell.idSum, CHECKSUM_INDEX))
+            continue;
+        uint32_t id = cell.idSum;
+        int32_t count = cell.count;
+        if (vPositive.size() + vNegative.size() >= nMaxIDs)
+            return false;
+        (count > 0 ? vPositive : vNegative).push_back(id);
+        sketch.Toggle(id, -count);
+        size_t nTable = cells.size() / 3;
+        for (uint32_t i = 0; i < 3; i++)
+            vPure.push_back(i * nTable + MixID(id, i) % nTable);
+    }
+    return std::all_of(sketch.cells.begin(), sketch.cells.end(), [](const Cell& cell) { return cell.IsEmpty(); });
+}
+
+size_t GetSketchCells(size_t nLocal, size_t nRemote)
+{
+    // Most transactions are in both sets, but the difference is at least
+    // that of their sizes. An IBLT with three tables decodes a difference
+    // of d with high probability if it has at least about 1.3 * d cells, and
+    // small differences need more.
+    size_t nDifference = std::max(nLocal, nRemote) - std::min(nLocal, nRemote) + std::min(nLocal, nRemote) / 4 + 1;
+    return std::min(std::max<size_t>(2 * nDifference, 12), MAX_SKETCH_CELLS);
+}
+
+CTxReconciliationState::CTxReconciliationState(bool fInitiatorIn, uint64_t nSaltLocal, uint64_t nSaltRemote) :
+    fInitiator(fInitiatorIn)
+{
+    // Both peers compute the same keys, from their salts in ascending order.
+    unsigned char salts[16];
+    WriteLE64(salts, std::min(nSaltLocal, nSaltRemote));
+    WriteLE64(salts + 8, std::max(nSaltLocal, nSaltRemote));
+    uint256 hash;
+    CSHA256().Write(salts, sizeof(salts)).Finalize(hash.begin());
+    k0 = hash.GetUint64(0);
+    k1 = hash.GetUint64(1);
+}
+
+uint32_t CTxReconciliationState::GetShortID(const uint256& txid) const
+{
+    return (uint32_t)SipHashUint256(k0, k1, txid);
+}
+
+bool CTxReconciliationState::AddTransaction(const uint256& txid)
+{
+    if (setLocal.size() >= MAX_RECON_SET_SIZE && setLocal.count(txid) == 0)
+        return false;
+    setLocal.insert(txid);
+    return true;
+}
+
+CTxSketch CTxReconciliationState::GetSketch(const std::set<uint256>& setTxids, size_t nCells) const
+{
+    CTxSketch sketch(nCells);
+    for (const uint256& txid : setTxids)
+        sketch.Add(GetShortID(txid));
+    return sketch;
+}
+
+std::vector<uint256> CTxReconciliationState::GetByShortIDs(const std::set<uint256>& setTxids, const std::vector<uint32_t>& vShortIDs) const
+{
+    std::set<uint32_t> setShortIDs(vShortIDs.begin(), vShortIDs.end());
+    std::vector<uint256> vTxids;
+    for (const uint256& txid : setTxids) {
+        if (setShortIDs.count(GetShortID(txid)))
+            vTxids.push_back(txid);
+    }
+    return vTxids;
+}
@@ -0,0 +1,133 @@
+// Copyright (c) 2021 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifndef BITCOIN_TXRECONCILIATION_H
+#define BITCOIN_TXRECONCILIATION_H
+
+#include "serialize.h"
+#include "uint256.h"
+
+#include <set>
+#include <stdint.h>
+#include <vector>
+
+/** Version of the transaction reconciliation protocol. */
+static const uint32_t TXRECONCILIATION_VERSION = 1;
+/** Default for -txreconciliation. */
+static const bool DEFAULT_TXRECONCILIATION = false;
+/** How often, in seconds, a peer that we reconcile transactions with as the initiator is asked for a sketch. */
+static const int64_t RECON_REQUEST_INTERVAL = 4;
+/** How long, in seconds, a peer may take to respond to a request for a sketch. */
+static const int64_t RECON_RESPONSE_TIMEOUT = 60;
+/** The maximum number of transactions waiting to be reconciled with a peer; others are announced with inv. */
+static const size_t MAX_RECON_SET_SIZE = 3000;
+/** The maximum number of cells of a sketch. */
+static const size_t MAX_SKETCH_CELLS = 3 * 1024;
+
+/**
+ * An invertible Bloom lookup table of the short IDs of a set of transactions.
+ * Subtracting the sketch of the set of one peer from the sketch of the set of
+ * another, of the same size, lets the short IDs of the transactions that only
+ * one of them has be recovered, as long as there are at most about half as
+ * many of them as there are cells.
+ */
+class CTxSketch
+{
+public:
+    struct Cell {
+        int32_t count = 0;
+        uint32_t idSum = 0;
+        uint32_t hashSum = 0;
+
+        ADD_SERIALIZE_METHODS;
+
+        template <typename Stream, typename Operation>
+        inline void SerializationOp(Stream& s, Operation ser_action) {
+            READWRITE(count);
+            READWRITE(idSum);
+            READWRITE(hashSum);
+        }
+
+        bool IsEmpty() const { return count == 0 && idSum == 0 && hashSum == 0; }
+    };
+
+private:
+    //! Three tables of the same size, each of which every ID is added to once.
+    std::vector<Cell> cells;
+
+    void Toggle(uint32_t id, int32_t n);
+
+public:
+    CTxSketch() {}
+    //! nCells is rounded up to a multiple of three.
+    explicit CTxSketch(size_t nCells) : cells((nCells + 2) / 3 * 3) {}
+
+    size_t size() const { return cells.size(); }
+    //! Whether a received sketch can be used.
+    bool IsValid() const { return !cells.empty() && cells.size() % 3 == 0 && cells.size() <= MAX_SKETCH_CELLS; }
+
+    void Add(uint32_t id) { Toggle(id, 1); }
+
+    /** Subtract a sketch of the same size from this one. */
+    bool Subtract(const CTxSketch& other);
+
+    /**
+     * Recover the IDs that were added to only one of two subtracted sketches,
+     * in vPositive those of this one and in vNegative those of the other.
+     * Returns false if they cannot all be recovered.
+     */
+    bool Decode(std::vector<uint32_t>& vPositive, std::vector<uint32_t>& vNegative) const;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(cells);
+    }
+};
+
+/** The number of cells of a sketch for reconciling sets of the given sizes. */
+size_t GetSketchCells(size_t nLocal, size_t nRemote);
+
+/**
+ * The state of the reconciliation of the transactions to announce with a
+ * peer, which replaces inv announcements of transactions on a connection on
+ * which both peers sent "sendrecon". The peer that made the connection, the
+ * initiator, periodically asks the other for a sketch of its set, subtracts
+ * the sketch of its own, and announces the transactions that the other peer
+ * lacks. It also asks for the ones that it lacks itself; the other peer then
+ * announces them. Protected by the cs_inventory of the peer.
+ */
+class CTxReconciliationState
+{
+private:
+    uint64_t k0, k1;
+
+public:
+    //! Whether we made the connection, and ask the peer for its sketches.
+    const bool fInitiator;
+    //! The transactions to announce to the peer at the next reconciliation.
+    std::set<uint256> setLocal;
+    //! For the responder, the transactions of the sketch that it sent last, until the initiator tells which of them it lacks.
+    std::set<uint256> setSketched;
+    bool fAwaitingDiff = false;
+    //! For the initiator, whether a sketch has been asked for, and when to ask for the next.
+    bool fAwaitingSketch = false;
+    int64_t nNextRequest = 0;
+
+    /** The salts of both peers, which were sent in their "sendrecon" messages, key the short IDs. */
+    CTxReconciliationState(bool fInitiatorIn, uint64_t nSaltLocal, uint64_t nSaltRemote);
+
+    uint32_t GetShortID(const uint256& txid) const;
+
+    /** Add a transaction to announce at the next reconciliation, unless there are too many already. */
+    bool AddTransaction(const uint256& txid);
+
+    CTxSketch GetSketch(const std::set<uint256>& setTxids, size_t nCells) const;
+
+    /** The transactions of setTxids with one of the given short IDs. */
+    std::vector<uint256> GetByShortIDs(const std::set<uint256>& setTxids, const std::vector<uint32_t>& vShortIDs) const;
+};
+
+#endif // BITCOIN_TXRECONCILIATION_H
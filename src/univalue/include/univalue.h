@@ -12,6 +12,8 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <memory>
+#include <unordered_map>
 #include <cassert>
 
 #include <sstream>        // .get_int64()
@@ -21,10 +23,14 @@ public:
     enum VType { VNULL, VOBJ, VARR, VSTR, VNUM, VBOOL, };
 
     UniValue() { typ = VNULL; }
-    UniValue(UniValue::VType initialType, const std::string& initialStr = "") {
+    UniValue(UniValue::VType initialType, std::string initialStr = "") {
         typ = initialType;
-        val = initialStr;
+        val = std::move(initialStr);
     }
+    UniValue(const UniValue& other);
+    UniValue(UniValue&& other) noexcept = default;
+    UniValue& operator=(const UniValue& other);
+    UniValue& operator=(UniValue&& other) noexcept = default;
     UniValue(uint64_t val_) {
         setInt(val_);
     }
@@ -40,12 +46,11 @@ public:
     UniValue(double val_) {
         setFloat(val_);
     }
-    UniValue(const std::string& val_) {
-        setStr(val_);
+    UniValue(std::string val_) {
+        setStr(std::move(val_));
     }
     UniValue(const char *val_) {
-        std::string s(val_);
-        setStr(s);
+        setStr(val_);
     }
 
     void clear();
@@ -57,7 +62,7 @@ public:
     bool setInt(int64_t val);
     bool setInt(int val_) { return setInt((int64_t)val_); }
     bool setFloat(double val);
-    bool setStr(const std::string& val);
+    bool setStr(std::string val);
     bool setArray();
     bool setObject();
 
@@ -83,66 +88,59 @@ public:
     bool isArray() const { return (typ == VARR); }
     bool isObject() const { return (typ == VOBJ); }
 
-    bool push_back(const UniValue& val);
+    bool push_back(UniValue val);
     bool push_back(const std::string& val_) {
-        UniValue tmpVal(VSTR, val_);
-        return push_back(tmpVal);
+        return push_back(UniValue(VSTR, val_));
+    }
+    bool push_back(std::string&& val_) {
+        return push_back(UniValue(VSTR, std::move(val_)));
     }
     bool push_back(const char *val_) {
-        std::string s(val_);
-        return push_back(s);
+        return push_back(UniValue(VSTR, val_));
     }
     bool push_back(uint64_t val_) {
-        UniValue tmpVal(val_);
-        return push_back(tmpVal);
+        return push_back(UniValue(val_));
     }
     bool push_back(int64_t val_) {
-        UniValue tmpVal(val_);
-        return push_back(tmpVal);
+        return push_back(UniValue(val_));
     }
     bool push_back(bool val_) {
-        UniValue tmpVal(val_);
-        return push_back(tmpVal);
+        return push_back(UniValue(val_));
     }
     bool push_back(int val_) {
-        UniValue tmpVal(val_);
-        return push_back(tmpVal);
+        return push_back(UniValue(val_));
     }
     bool push_back(double val_) {
-        UniValue tmpVal(val_);
-        return push_back(tmpVal);
+        return push_back(UniValue(val_));
     }
     bool push_backV(const std::vector<UniValue>& vec);
+    bool push_backV(std::vector<UniValue>&& vec);
 
-    void _pushKV(const std::string& key, const UniValue& val);
-    bool pushKV(const std::string& key, const UniValue& val);
-    bool pushKV(const std::string& key, const std::string& val_) {
-        UniValue tmpVal(VSTR, val_);
-        return pushKV(key, tmpVal);
+    void _pushKV(std::string key, UniValue val);
+    bool pushKV(std::string key, UniValue val);
+    bool pushKV(std::string key, const std::string& val_) {
+        return pushKV(std::move(key), UniValue(VSTR, val_));
     }
-    bool pushKV(const std::string& key, const char *val_) {
-        std::string _val(val_);
-        return pushKV(key, _val);
+    bool pushKV(std::string key, std::string&& val_) {
+        return pushKV(std::move(key), UniValue(VSTR, std::move(val_)));
     }
-    bool pushKV(const std::string& key, int64_t val_) {
-        UniValue tmpVal(val_);
-        return pushKV(key, tmpVal);
+    bool pushKV(std::string key, const char *val_) {
+        return pushKV(std::move(key), UniValue(VSTR, val_));
     }
-    bool pushKV(const std::string& key, uint64_t val_) {
-        UniValue tmpVal(val_);
-        return pushKV(key, tmpVal);
+    bool pushKV(std::string key, int64_t val_) {
+        return pushKV(std::move(key), UniValue(val_));
     }
-    bool pushKV(const std::string& key, bool val_) {
-        UniValue tmpVal(val_);
-        return pushKV(key, tmpVal);
+    bool pushKV(std::string key, uint64_t val_) {
+        return pushKV(std::move(key), UniValue(val_));
     }
-    bool pushKV(const std::string& key, int val_) {
-        UniValue tmpVal((int64_t)val_);
-        return pushKV(key, tmpVal);
+    bool pushKV(std::string key, bool val_) {
+        return pushKV(std::move(key), UniValue(val_));
     }
-    bool pushKV(const std::string& key, double val_) {
-        UniValue tmpVal(val_);
-        return pushKV(key, tmpVal);
+    bool pushKV(std::string key, int val_) {
+        return pushKV(std::move(key), UniValue((int64_t)val_));
+    }
+    bool pushKV(std::string key, double val_) {
+        return pushKV(std::move(key), UniValue(val_));
     }
     bool pushKVs(const UniValue& obj);
 
@@ -160,8 +158,16 @@ private:
     std::string val;                       // numbers are stored as C++ strings
     std::vector<std::string> keys;
     std::vector<UniValue> values;
+    // Index from the hash of each key to its position in keys, kept only
+    // for objects with at least KEY_INDEX_MIN_SIZE keys.
+    std::unique_ptr<std::unordered_multimap<size_t, size_t>> keyIndex;
+
+    static const size_t KEY_INDEX_MIN_SIZE = 32;
 
     bool findKey(const std::string& key, size_t& retIdx) const;
+    void indexKey(size_t idx);
+    void indexKeys();
+    void writeTo(unsigned int prettyIndent, unsigned int indentLevel, std::string& s) const;
     void writeArray(unsigned int prettyIndent, unsigned int indentLevel, std::string& s) const;
     void writeObject(unsigned int prettyIndent, unsigned int indentLevel, std::string& s) const;
 
@@ -5,6 +5,7 @@
 
 #include <stdint.h>
 #include <iomanip>
+#include <iterator>
 #include <sstream>
 #include <stdlib.h>
 
@@ -12,12 +13,27 @@
 
 const UniValue NullUniValue;
 
+UniValue::UniValue(const UniValue& other) :
+    typ(other.typ), val(other.val), keys(other.keys), values(other.values)
+{
+    if (other.keyIndex)
+        keyIndex.reset(new std::unordered_multimap<size_t, size_t>(*other.keyIndex));
+}
+
+UniValue& UniValue::operator=(const UniValue& other)
+{
+    if (this != &other)
+        *this = UniValue(other);
+    return *this;
+}
+
 void UniValue::clear()
 {
     typ = VNULL;
     val.clear();
     keys.clear();
     values.clear();
+    keyIndex.reset();
 }
 
 bool UniValue::setNull()
@@ -83,11 +99,11 @@ bool UniValue::setFloat(double val_)
     return ret;
 }
 
-bool UniValue::setStr(const std::string& val_)
+bool UniValue::setStr(std::string val_)
 {
     clear();
     typ = VSTR;
-    val = val_;
+    val = std::move(val_);
     return true;
 }
 
@@ -105,12 +121,12 @@ bool UniValue::setObject()
     return true;
 }
 
-bool UniValue::push_back(const UniValue& val_)
+bool UniValue::push_back(UniValue val_)
 {
     if (typ != VARR)
         return false;
 
-    values.push_back(val_);
+    values.push_back(std::move(val_));
     return true;
 }
 
@@ -124,22 +140,40 @@ bool UniValue::push_backV(const std::vector<UniValue>& vec)
     return true;
 }
 
-void UniValue::_pushKV(const std::string& key, const UniValue& val_)
+bool UniValue::push_backV(std::vector<UniValue>&& vec)
+{
+    if (typ != VARR)
+        return false;
+
+    if (values.empty()) {
+        values = std::move(vec);
+    } else {
+        values.insert(values.end(), std::make_move_iterator(vec.begin()), std::make_move_iterator(vec.end()));
+    }
+
+    return true;
+}
+
+void UniValue::_pushKV(std::string key, UniValue val_)
 {
-    keys.push_back(key);
-    values.push_back(val_);
+    keys.push_back(std::move(key));
+    values.push_back(std::move(val_));
+    if (keyIndex)
+        indexKey(keys.size() - 1);
+    else
+        indexKeys();
 }
 
-bool UniValue::pushKV(const std::string& key, const UniValue& val_)
+bool UniValue::pushKV(std::string key, UniValue val_)
 {
     if (typ != VOBJ)
         return false;
 
     size_t idx;
     if (findKey(key, idx))
-        values[idx] = val_;
+        values[idx] = std::move(val_);
     else
-        _pushKV(key, val_);
+        _pushKV(std::move(key), std::move(val_));
     return true;
 }
 
@@ -166,6 +200,17 @@ void UniValue::getObjMap(std::map<std::string,UniValue>& kv) const
 
 bool UniValue::findKey(const std::string& key, size_t& retIdx) const
 {
+    if (keyIndex) {
+        auto range = keyIndex->equal_range(std::hash<std::string>()(key));
+        for (auto it = range.first; it != range.second; ++it) {
+            if (keys[it->second] == key) {
+                retIdx = it->second;
+                return true;
+            }
+        }
+        return false;
+    }
+
     for (size_t i = 0; i < keys.size(); i++) {
         if (keys[i] == key) {
             retIdx = i;
@@ -176,6 +221,28 @@ bool UniValue::findKey(const std::string& key, size_t& retIdx) const
     return false;
 }
 
+// Add a key to the index, unless an earlier key is equal to it, so that
+// lookups find the first of duplicate keys as a linear search would.
+void UniValue::indexKey(size_t idx)
+{
+    size_t existing;
+    if (!findKey(keys[idx], existing))
+        keyIndex->emplace(std::hash<std::string>()(keys[idx]), idx);
+}
+
+// Index the keys of an object once it is large enough for a linear search to
+// be slow.
+void UniValue::indexKeys()
+{
+    if (keyIndex || keys.size() < KEY_INDEX_MIN_SIZE)
+        return;
+
+    keyIndex.reset(new std::unordered_multimap<size_t, size_t>());
+    keyIndex->reserve(keys.size());
+    for (size_t i = 0; i < keys.size(); i++)
+        indexKey(i);
+}
+
 bool UniValue::checkObject(const std::map<std::string,UniValue::VType>& t) const
 {
     if (typ != VOBJ)
@@ -233,10 +300,10 @@ const char *uvTypeName(UniValue::VType t)
 
 const UniValue& find_value(const UniValue& obj, const std::string& name)
 {
-    for (unsigned int i = 0; i < obj.keys.size(); i++)
-        if (obj.keys[i] == name)
-            return obj.values.at(i);
+    size_t index = 0;
+    if (!obj.findKey(name, index))
+        return NullUniValue;
 
-    return NullUniValue;
+    return obj.values.at(index);
 }
 
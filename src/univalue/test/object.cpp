@@ -359,6 +359,45 @@ BOOST_AUTO_TEST_CASE(univalue_object)
 
 }
 
+BOOST_AUTO_TEST_CASE(univalue_object_large)
+{
+    // Objects with many keys look them up through an index, which must
+    // agree with a linear search.
+    UniValue obj(UniValue::VOBJ);
+    for (int i = 0; i < 100; i++) {
+        obj.pushKV("key" + std::to_string(i), i);
+    }
+    BOOST_CHECK_EQUAL(obj.size(), 100);
+    BOOST_CHECK_EQUAL(obj["key0"].get_int(), 0);
+    BOOST_CHECK_EQUAL(obj["key99"].get_int(), 99);
+    BOOST_CHECK(obj["key100"].isNull());
+    BOOST_CHECK(!obj.exists("key100"));
+
+    obj.pushKV("key50", "replaced");
+    BOOST_CHECK_EQUAL(obj.size(), 100);
+    BOOST_CHECK_EQUAL(find_value(obj, "key50").get_str(), "replaced");
+
+    // The first of duplicate keys is found
+    obj._pushKV("key7", "duplicate");
+    BOOST_CHECK_EQUAL(obj.size(), 101);
+    BOOST_CHECK_EQUAL(obj["key7"].get_int(), 7);
+
+    UniValue copy(obj);
+    BOOST_CHECK_EQUAL(copy["key99"].get_int(), 99);
+    UniValue moved(std::move(copy));
+    BOOST_CHECK_EQUAL(moved["key98"].get_int(), 98);
+
+    UniValue parsed;
+    BOOST_CHECK(parsed.read(obj.write()));
+    BOOST_CHECK_EQUAL(parsed.write(), obj.write());
+    BOOST_CHECK_EQUAL(parsed["key7"].get_int(), 7);
+    BOOST_CHECK_EQUAL(parsed["key50"].get_str(), "replaced");
+
+    obj.clear();
+    obj.setObject();
+    BOOST_CHECK(obj["key0"].isNull());
+}
+
 static const char *json1 =
 "[1.10000000,{\"key1\":\"str\\u0000\",\"key2\":800,\"key3\":{\"name\":\"martian http://test.com\"}}]";
 
@@ -414,6 +453,7 @@ int main (int argc, char *argv[])
     univalue_set();
     univalue_array();
     univalue_object();
+    univalue_object_large();
     univalue_readwrite();
     return 0;
 }
@@ -64,6 +64,11 @@
 #include <sys/prctl.h>
 #endif
 
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
+
 #include <boost/algorithm/string/case_conv.hpp> // for to_lower()
 #include <boost/algorithm/string/join.hpp>
 #include <boost/algorithm/string/predicate.hpp> // for startswith() and endswith()
@@ -671,3 +676,141 @@ int GetNumCores()
 {
     return boost::thread::physical_concurrency();
 }
+
+namespace {
+
+struct ParallelJob
+{
+    const std::function<void(size_t)>& f;
+    const size_t nItems;
+    const WorkPriority priority;
+    std::atomic<size_t> nNext{0};
+    //! Workers that may still join, and workers running items (guarded by WorkerPool::cs).
+    int nHelpersWanted;
+    int nHelpers = 0;
+
+    ParallelJob(const std::function<void(size_t)>& fIn, size_t nItemsIn, WorkPriority priorityIn, int nHelpersWantedIn) :
+        f(fIn), nItems(nItemsIn), priority(priorityIn), nHelpersWanted(nHelpersWantedIn) {}
+
+    //! The first exception thrown by f, which ParallelFor() passes on.
+    std::mutex csError;
+    std::exception_ptr error;
+
+    void Run()
+    {
+        try {
+            for (size_t i = nNext++; i < nItems; i = nNext++) {
+                f(i);
+            }
+        } catch (...) {
+            // Leave the remaining items, so that the job ends at once.
+            nNext = nItems;
+            std::lock_guard<std::mutex> lock(csError);
+            if (!error) {
+                error = std::current_exception();
+            }
+        }
+    }
+};
+
+class WorkerPool
+{
+private:
+    std::mutex cs;
+    std::condition_variable condWork;
+    std::condition_variable condDone;
+    //! Jobs that want more workers, in the order they were queued.
+    std::vector<ParallelJob*> vJobs;
+    int nThreads = -1;
+
+    void Start()
+    {
+        if (nThreads < 0) {
+            nThreads = std::max(1, GetNumCores()) - 1;
+        }
+        for (int i = 0; i < nThreads; i++) {
+            // The pool is never destroyed, so the workers can outlive main().
+            std::thread([this] { Worker(); }).detach();
+        }
+    }
+
+    void Worker()
+    {
+        RenameThread("zcash-worker");
+        std::unique_lock<std::mutex> lock(cs);
+        while (true) {
+            condWork.wait(lock, [this] { return !vJobs.empty(); });
+            auto it = std::min_element(vJobs.begin(), vJobs.end(),
+                [](const ParallelJob* a, const ParallelJob* b) { return a->priority < b->priority; });
+            ParallelJob* job = *it;
+            if (--job->nHelpersWanted == 0) {
+                vJobs.erase(it);
+            }
+            job->nHelpers++;
+            lock.unlock();
+            job->Run();
+            lock.lock();
+            if (--job->nHelpers == 0) {
+                condDone.notify_all();
+            }
+        }
+    }
+
+public:
+    void SetThreads(int n)
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        if (nThreads < 0) {
+            nThreads = std::max(0, n);
+        }
+    }
+
+    void Run(ParallelJob& job)
+    {
+        {
+            std::lock_guard<std::mutex> lock(cs);
+            static std::once_flag startFlag;
+            std::call_once(startFlag, [this] { Start(); });
+            job.nHelpersWanted = std::min(job.nHelpersWanted, nThreads);
+            if (job.nHelpersWanted > 0) {
+                vJobs.push_back(&job);
+                condWork.notify_all();
+            }
+        }
+        job.Run();
+        // All items have been taken; wait for the workers still running one.
+        std::unique_lock<std::mutex> lock(cs);
+        vJobs.erase(std::remove(vJobs.begin(), vJobs.end(), &job), vJobs.end());
+        condDone.wait(lock, [&job] { return job.nHelpers == 0; });
+    }
+};
+
+WorkerPool& GetWorkerPool()
+{
+    static WorkerPool* pool = new WorkerPool();
+    return *pool;
+}
+
+}
+
+void SetWorkerThreads(int nThreads)
+{
+    GetWorkerPool().SetThreads(nThreads);
+}
+
+void ParallelFor(size_t nItems, int nThreads, const std::function<void(size_t)>& f, WorkPriority priority)
+{
+    if (nItems == 0) {
+        return;
+    }
+    int nHelpersWanted = (int)std::min((size_t)std::max(nThreads - 1, 0), nItems - 1);
+    ParallelJob job(f, nItems, priority, nHelpersWanted);
+    if (nHelpersWanted == 0) {
+        job.Run();
+    } else {
+        GetWorkerPool().Run(job);
+    }
+    if (job.error) {
+        std::rethrow_exception(job.error);
+    }
+}
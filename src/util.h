@@ -22,6 +22,7 @@
 
 #include <atomic>
 #include <exception>
+#include <functional>
 #include <map>
 #include <stdint.h>
 #include <string>
@@ -171,6 +172,39 @@ std::string HelpMessageOpt(const std::string& option, const std::string& message
  */
 int GetNumCores();
 
+/** Default for -threads (0 = one per core). */
+static const int DEFAULT_WORKER_THREADS = 0;
+
+/**
+ * Priority classes of the work that ParallelFor() shares out, highest first.
+ * A worker thread that becomes free joins the pending work of the highest
+ * class, so that consensus validation is not held up by wallet or RPC work.
+ */
+enum class WorkPriority {
+    VALIDATION,
+    MEMPOOL,
+    WALLET,
+    RPC,
+};
+
+/**
+ * Set the number of process-wide worker threads that ParallelFor() runs on,
+ * besides the threads that call it. Called once, at startup, before the
+ * first ParallelFor(); without it, there is one thread per core.
+ */
+void SetWorkerThreads(int nThreads);
+
+/**
+ * Call f(0), ..., f(nItems - 1) on this thread and on up to nThreads - 1
+ * of the shared worker threads. The workers that are busy with other work
+ * join as they become free, so concurrent callers share the cores instead
+ * of starting threads of their own. f may itself call ParallelFor(). If f
+ * throws, the items not yet started are skipped and the first exception is
+ * rethrown here.
+ */
+void ParallelFor(size_t nItems, int nThreads, const std::function<void(size_t)>& f,
+                 WorkPriority priority = WorkPriority::RPC);
+
 void SetThreadPriority(int nPriority);
 void RenameThread(const char* name);
 
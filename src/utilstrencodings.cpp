@@ -3,6 +3,10 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or https://www.opensource.org/licenses/mit-license.php .
 
+#if defined(HAVE_CONFIG_H)
+#include "config/bitcoin-config.h"
+#endif
+
 #include "utilstrencodings.h"
 
 #include "tinyformat.h"
@@ -13,6 +17,28 @@
 #include <iomanip>
 #include <limits>
 
+#if defined(ENABLE_SSE41) && !defined(BUILD_BITCOIN_INTERNAL) && (defined(__x86_64__) || defined(__amd64__) || defined(__i386__))
+#define USE_HEX_SSE41
+#include <cpuid.h>
+
+namespace hex_sse41
+{
+/** Encode the leading multiple of 16 bytes of the input, and return how many bytes were encoded. */
+size_t Encode(const unsigned char* in, size_t len, char* out);
+/** Decode 32-character blocks of hex digits until one holds a character that is not a hex digit, and return how many bytes were decoded. */
+size_t Decode(const char* in, size_t len, unsigned char* out);
+}
+
+static bool HaveSSE41()
+{
+    static const bool fHave = []() {
+        unsigned int eax, ebx, ecx, edx;
+        return __get_cpuid(1, &eax, &ebx, &ecx, &edx) && ((ecx >> 19) & 1);
+    }();
+    return fHave;
+}
+#endif
+
 using namespace std;
 
 static const string CHARS_ALPHA_NUM = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
@@ -99,10 +125,56 @@ bool IsHex(const string& str)
     return (str.size() > 0) && (str.size()%2 == 0);
 }
 
+void HexEncode(const unsigned char* data, size_t len, char* out)
+{
+    static const char hexmap[16] = { '0', '1', '2', '3', '4', '5', '6', '7',
+                                     '8', '9', 'a', 'b', 'c', 'd', 'e', 'f' };
+    size_t i = 0;
+#ifdef USE_HEX_SSE41
+    if (HaveSSE41()) {
+        i = hex_sse41::Encode(data, len, out);
+    }
+#endif
+    for (; i < len; i++) {
+        out[2 * i] = hexmap[data[i] >> 4];
+        out[2 * i + 1] = hexmap[data[i] & 15];
+    }
+}
+
+/**
+ * Decode pairs of hex digits from the start of the input until one holds a
+ * character that is not a hex digit, and return how many bytes were decoded.
+ */
+static size_t HexDecode(const char* in, size_t len, unsigned char* out)
+{
+    size_t i = 0;
+#ifdef USE_HEX_SSE41
+    if (HaveSSE41()) {
+        i = hex_sse41::Decode(in, len, out);
+    }
+#endif
+    for (; 2 * i + 1 < len; i++) {
+        signed char hi = HexDigit(in[2 * i]);
+        signed char lo = HexDigit(in[2 * i + 1]);
+        if (hi < 0 || lo < 0)
+            break;
+        out[i] = (hi << 4) | lo;
+    }
+    return i;
+}
+
 vector<unsigned char> ParseHex(const char* psz)
 {
     // convert hex dump to vector
-    vector<unsigned char> vch;
+    size_t len = strlen(psz);
+    vector<unsigned char> vch(len / 2);
+    unsigned char* out = vch.data();
+
+    // Decode the leading run of hex digits in bulk, and the rest, which may
+    // be separated by whitespace, a byte at a time.
+    size_t nBulk = HexDecode(psz, len, out);
+    psz += 2 * nBulk;
+    out += nBulk;
     while (true)
     {
         while (isspace(*psz))
@@ -115,8 +187,9 @@ vector<unsigned char> ParseHex(const char* psz)
         if (c == (signed char)-1)
             break;
         n |= c;
-        vch.push_back(n);
+        *out++ = n;
     }
+    vch.resize(out - vch.data());
     return vch;
 }
 
@@ -9,8 +9,11 @@
 #ifndef BITCOIN_UTILSTRENCODINGS_H
 #define BITCOIN_UTILSTRENCODINGS_H
 
+#include <algorithm>
+#include <iterator>
 #include <stdint.h>
 #include <string>
+#include <type_traits>
 #include <vector>
 
 #define BEGIN(a)            ((char*)&(a))
@@ -78,22 +81,49 @@ bool ParseInt64(const std::string& str, int64_t *out);
  */
 bool ParseDouble(const std::string& str, double *out);
 
+/**
+ * Write the hex encoding of len bytes to out, which must have room for
+ * 2 * len characters. Uses SSE4.1 where the CPU supports it.
+ */
+void HexEncode(const unsigned char* data, size_t len, char* out);
+
 template<typename T>
 std::string HexStr(const T itbegin, const T itend, bool fSpaces=false)
 {
     std::string rv;
-    static const char hexmap[16] = { '0', '1', '2', '3', '4', '5', '6', '7',
-                                     '8', '9', 'a', 'b', 'c', 'd', 'e', 'f' };
-    rv.reserve((itend-itbegin)*3);
-    for(T it = itbegin; it < itend; ++it)
-    {
-        unsigned char val = (unsigned char)(*it);
-        if(fSpaces && it != itbegin)
-            rv.push_back(' ');
-        rv.push_back(hexmap[val>>4]);
-        rv.push_back(hexmap[val&15]);
+    if (itbegin >= itend)
+        return rv;
+
+    if (fSpaces) {
+        static const char hexmap[16] = { '0', '1', '2', '3', '4', '5', '6', '7',
+                                         '8', '9', 'a', 'b', 'c', 'd', 'e', 'f' };
+        rv.reserve((itend-itbegin)*3);
+        for(T it = itbegin; it < itend; ++it)
+        {
+            unsigned char val = (unsigned char)(*it);
+            if(it != itbegin)
+                rv.push_back(' ');
+            rv.push_back(hexmap[val>>4]);
+            rv.push_back(hexmap[val&15]);
+        }
+        return rv;
     }
 
+    rv.resize((itend-itbegin)*2);
+    char* out = &rv[0];
+    if constexpr (std::is_pointer<T>::value && sizeof(typename std::iterator_traits<T>::value_type) == 1) {
+        HexEncode((const unsigned char*)itbegin, itend - itbegin, out);
+    } else {
+        // Copy the bytes out in chunks, so that they can be encoded in bulk.
+        unsigned char buf[256];
+        for (T it = itbegin; it < itend; ) {
+            size_t n = std::min<size_t>(sizeof(buf), itend - it);
+            std::transform(it, it + n, buf, [](const auto& val) { return (unsigned char)val; });
+            HexEncode(buf, n, out);
+            it += n;
+            out += 2 * n;
+        }
+    }
     return rv;
 }
 
@@ -8,12 +8,16 @@
 #include "chainparams.h"
 #include "init.h"
 #include "main.h"
+#include "scheduler.h"
+#include "sync.h"
 #include "txmempool.h"
 #include "ui_interface.h"
 
 #include <boost/thread.hpp>
 
 #include <chrono>
+#include <future>
+#include <list>
 #include <thread>
 
 using namespace boost::placeholders;
@@ -31,19 +35,25 @@ void RegisterValidationInterface(CValidationInterface* pwalletIn) {
     g_signals.EraseTransaction.connect(boost::bind(&CValidationInterface::EraseFromWallet, pwalletIn, _1));
     g_signals.UpdatedTransaction.connect(boost::bind(&CValidationInterface::UpdatedTransaction, pwalletIn, _1));
     g_signals.ChainTip.connect(boost::bind(&CValidationInterface::ChainTip, pwalletIn, _1, _2, _3));
+    g_signals.BlocksDisconnected.connect(boost::bind(&CValidationInterface::BlocksDisconnected, pwalletIn, _1, _2));
     g_signals.Inventory.connect(boost::bind(&CValidationInterface::Inventory, pwalletIn, _1));
     g_signals.Broadcast.connect(boost::bind(&CValidationInterface::ResendWalletTransactions, pwalletIn, _1));
     g_signals.BlockChecked.connect(boost::bind(&CValidationInterface::BlockChecked, pwalletIn, _1, _2));
     g_signals.AddressForMining.connect(boost::bind(&CValidationInterface::GetAddressForMining, pwalletIn, _1));
     g_signals.BlockFound.connect(boost::bind(&CValidationInterface::ResetRequestCount, pwalletIn, _1));
+    g_signals.NewBlockTemplate.connect(boost::bind(&CValidationInterface::NewBlockTemplate, pwalletIn, _1));
+    g_signals.MempoolChanged.connect(boost::bind(&CValidationInterface::MempoolChanged, pwalletIn, _1));
 }
 
 void UnregisterValidationInterface(CValidationInterface* pwalletIn) {
+    g_signals.MempoolChanged.disconnect(boost::bind(&CValidationInterface::MempoolChanged, pwalletIn, _1));
+    g_signals.NewBlockTemplate.disconnect(boost::bind(&CValidationInterface::NewBlockTemplate, pwalletIn, _1));
     g_signals.BlockFound.disconnect(boost::bind(&CValidationInterface::ResetRequestCount, pwalletIn, _1));
     g_signals.AddressForMining.disconnect(boost::bind(&CValidationInterface::GetAddressForMining, pwalletIn, _1));
     g_signals.BlockChecked.disconnect(boost::bind(&CValidationInterface::BlockChecked, pwalletIn, _1, _2));
     g_signals.Broadcast.disconnect(boost::bind(&CValidationInterface::ResendWalletTransactions, pwalletIn, _1));
     g_signals.Inventory.disconnect(boost::bind(&CValidationInterface::Inventory, pwalletIn, _1));
+    g_signals.BlocksDisconnected.disconnect(boost::bind(&CValidationInterface::BlocksDisconnected, pwalletIn, _1, _2));
     g_signals.ChainTip.disconnect(boost::bind(&CValidationInterface::ChainTip, pwalletIn, _1, _2, _3));
     g_signals.UpdatedTransaction.disconnect(boost::bind(&CValidationInterface::UpdatedTransaction, pwalletIn, _1));
     g_signals.EraseTransaction.disconnect(boost::bind(&CValidationInterface::EraseFromWallet, pwalletIn, _1));
@@ -52,11 +62,14 @@ void UnregisterValidationInterface(CValidationInterface* pwalletIn) {
 }
 
 void UnregisterAllValidationInterfaces() {
+    g_signals.MempoolChanged.disconnect_all_slots();
+    g_signals.NewBlockTemplate.disconnect_all_slots();
     g_signals.BlockFound.disconnect_all_slots();
     g_signals.AddressForMining.disconnect_all_slots();
     g_signals.BlockChecked.disconnect_all_slots();
     g_signals.Broadcast.disconnect_all_slots();
     g_signals.Inventory.disconnect_all_slots();
+    g_signals.BlocksDisconnected.disconnect_all_slots();
     g_signals.ChainTip.disconnect_all_slots();
     g_signals.UpdatedTransaction.disconnect_all_slots();
     g_signals.EraseTransaction.disconnect_all_slots();
@@ -64,6 +77,114 @@ void UnregisterAllValidationInterfaces() {
     g_signals.UpdatedBlockTip.disconnect_all_slots();
 }
 
+/**
+ * Functions queued by CallFunctionInValidationInterfaceQueue. At most one
+ * of them is scheduled at a time, so that they run one after another in
+ * the order they were queued, whatever the number of scheduler threads.
+ */
+static CCriticalSection cs_validationQueue;
+static CScheduler* pValidationQueueScheduler = nullptr;
+static std::list<std::function<void ()>> validationQueue;
+static bool fValidationQueueRunning = false;
+
+static void ProcessValidationInterfaceQueue();
+
+static void MaybeScheduleValidationInterfaceQueue()
+{
+    AssertLockHeld(cs_validationQueue);
+    if (fValidationQueueRunning || validationQueue.empty() || !pValidationQueueScheduler)
+        return;
+    fValidationQueueRunning = true;
+    pValidationQueueScheduler->schedule(ProcessValidationInterfaceQueue, boost::chrono::system_clock::now(), CScheduler::PRIORITY_HIGH);
+}
+
+static void ProcessValidationInterfaceQueue()
+{
+    std::function<void ()> func;
+    {
+        LOCK(cs_validationQueue);
+        if (validationQueue.empty()) {
+            fValidationQueueRunning = false;
+            return;
+        }
+        func = std::move(validationQueue.front());
+        validationQueue.pop_front();
+    }
+
+    try {
+        func();
+    } catch (const boost::thread_interrupted&) {
+        LOCK(cs_validationQueue);
+        fValidationQueueRunning = false;
+        throw;
+    } catch (const std::exception& e) {
+        PrintExceptionContinue(&e, "ProcessValidationInterfaceQueue()");
+    } catch (...) {
+        PrintExceptionContinue(NULL, "ProcessValidationInterfaceQueue()");
+    }
+
+    LOCK(cs_validationQueue);
+    fValidationQueueRunning = false;
+    MaybeScheduleValidationInterfaceQueue();
+}
+
+void RegisterBackgroundSignalScheduler(CScheduler& scheduler)
+{
+    LOCK(cs_validationQueue);
+    assert(!pValidationQueueScheduler);
+    pValidationQueueScheduler = &scheduler;
+    MaybeScheduleValidationInterfaceQueue();
+}
+
+void UnregisterBackgroundSignalScheduler()
+{
+    std::list<std::function<void ()>> pending;
+    {
+        LOCK(cs_validationQueue);
+        pValidationQueueScheduler = nullptr;
+        fValidationQueueRunning = false;
+        pending.swap(validationQueue);
+    }
+    for (auto& func : pending) {
+        func();
+    }
+}
+
+void CallFunctionInValidationInterfaceQueue(std::function<void ()> func)
+{
+    {
+        LOCK(cs_validationQueue);
+        if (pValidationQueueScheduler) {
+            validationQueue.push_back(std::move(func));
+            MaybeScheduleValidationInterfaceQueue();
+            return;
+        }
+    }
+    func();
+}
+
+void SyncWithValidationInterfaceQueue()
+{
+    AssertLockNotHeld(cs_main);
+    std::promise<void> promise;
+    CallFunctionInValidationInterfaceQueue([&promise] {
+        promise.set_value();
+    });
+    promise.get_future().wait();
+}
+
+void LimitValidationInterfaceQueue()
+{
+    size_t nQueued;
+    {
+        LOCK(cs_validationQueue);
+        nQueued = validationQueue.size();
+    }
+    if (nQueued > MAX_VALIDATION_INTERFACE_QUEUE_SIZE) {
+        SyncWithValidationInterfaceQueue();
+    }
+}
+
 void SyncWithWallets(const CTransaction &tx, const CBlock *pblock, const int nHeight) {
     g_signals.SyncTransaction(tx, pblock, nHeight);
 }
@@ -93,6 +214,9 @@ void ThreadNotifyWallets(CBlockIndex *pindexLastTip)
         MilliSleep(50);
     }
 
+    // Mempool changes are notified from when the thread starts.
+    uint64_t nMempoolEventSequence = mempool.GetEventSequence();
+
     while (true) {
         // Run the notifier on an integer second in the steady clock.
         auto now = std::chrono::steady_clock::now().time_since_epoch();
@@ -119,6 +243,8 @@ void ThreadNotifyWallets(CBlockIndex *pindexLastTip)
         std::pair<std::map<CBlockIndex*, std::list<CTransaction>>, uint64_t> recentlyConflicted;
         // Transactions that have been recently added to the mempool.
         std::pair<std::vector<CTransaction>, uint64_t> recentlyAdded;
+        // Transactions that have been added to or removed from the mempool.
+        std::vector<CMempoolEvent> mempoolEvents;
 
         {
             LOCK(cs_main);
@@ -128,6 +254,13 @@ void ThreadNotifyWallets(CBlockIndex *pindexLastTip)
             CBlockIndex *pindex = chainActive.Tip();
             pindexFork = chainActive.FindFork(pindexLastTip);
 
+            // The blocks up to the base of a UTXO set snapshot are not stored,
+            // so notifications start after it.
+            if (pindexSnapshotBase && pindexFork->nHeight < pindexSnapshotBase->nHeight) {
+                pindexLastTip = pindexSnapshotBase;
+                pindexFork = pindexSnapshotBase;
+            }
+
             // Fetch recently-conflicted transactions. These will include any
             // block that has been connected since the last cycle, but we only
             // notify for the conflicts created by the current active chain.
@@ -162,6 +295,12 @@ void ThreadNotifyWallets(CBlockIndex *pindexLastTip)
             }
 
             recentlyAdded = mempool.DrainRecentlyAdded();
+            // Listeners see a gap in the sequence numbers if the log has
+            // dropped some of the events.
+            mempool.GetEventsSince(nMempoolEventSequence, mempoolEvents);
+            if (!mempoolEvents.empty()) {
+                nMempoolEventSequence = mempoolEvents.back().nSequence;
+            }
         }
 
         //
@@ -172,6 +311,8 @@ void ThreadNotifyWallets(CBlockIndex *pindexLastTip)
         //
 
         // Notify block disconnects
+        const CBlockIndex *pindexOldTip = pindexLastTip;
+        int nDisconnected = 0;
         while (pindexLastTip && pindexLastTip != pindexFork) {
             // Read block from disk.
             CBlock block;
@@ -188,11 +329,16 @@ void ThreadNotifyWallets(CBlockIndex *pindexLastTip)
             for (const CTransaction &tx : block.vtx) {
                 SyncWithWallets(tx, NULL, pindexLastTip->nHeight);
             }
-            // Update cached incremental witnesses
             GetMainSignals().ChainTip(pindexLastTip, &block, std::nullopt);
 
             // On to the next block!
             pindexLastTip = pindexLastTip->pprev;
+            nDisconnected++;
+        }
+        // Update cached incremental witnesses, in one pass for all the
+        // disconnected blocks
+        if (nDisconnected > 0) {
+            GetMainSignals().BlocksDisconnected(pindexOldTip, nDisconnected);
         }
 
         // Notify block connections
@@ -212,6 +358,7 @@ void ThreadNotifyWallets(CBlockIndex *pindexLastTip)
 
             // Tell wallet about transactions that went from mempool
             // to conflicted:
+            int64_t nTimeNotifyStart = GetTimeMicros();
             for (const CTransaction &tx : blockData.txConflicted) {
                 SyncWithWallets(tx, NULL, blockData.pindex->nHeight + 1);
             }
@@ -221,6 +368,7 @@ void ThreadNotifyWallets(CBlockIndex *pindexLastTip)
             }
             // Update cached incremental witnesses
             GetMainSignals().ChainTip(blockData.pindex, &block, blockData.oldTrees);
+            RecordBlockStageTime("notify", BlockMetricsLabels(block), GetTimeMicros() - nTimeNotifyStart);
 
             // This block is done!
             pindexLastTip = blockData.pindex;
@@ -239,6 +387,10 @@ void ThreadNotifyWallets(CBlockIndex *pindexLastTip)
             }
         }
 
+        if (!mempoolEvents.empty()) {
+            GetMainSignals().MempoolChanged(mempoolEvents);
+        }
+
         // Update the notified sequence numbers. We only need this in regtest mode,
         // and should not lock on cs or cs_main here otherwise.
         if (chainParams.NetworkIDString() == "regtest") {
@@ -6,7 +6,10 @@
 #ifndef BITCOIN_VALIDATIONINTERFACE_H
 #define BITCOIN_VALIDATIONINTERFACE_H
 
+#include <functional>
 #include <optional>
+#include <string>
+#include <vector>
 
 #include <boost/signals2/signal.hpp>
 #include <boost/shared_ptr.hpp>
@@ -17,7 +20,9 @@
 class CBlock;
 class CBlockIndex;
 struct CBlockLocator;
+struct CMempoolEvent;
 class CReserveScript;
+class CScheduler;
 class CTransaction;
 class CValidationInterface;
 class CValidationState;
@@ -32,18 +37,42 @@ void UnregisterValidationInterface(CValidationInterface* pwalletIn);
 /** Unregister all wallets from core */
 void UnregisterAllValidationInterfaces();
 
+/** The maximum number of notifications that may wait in the queue before block connection waits for them */
+static const size_t MAX_VALIDATION_INTERFACE_QUEUE_SIZE = 10;
+
+/** Deliver the queued notifications in order on a thread of this scheduler */
+void RegisterBackgroundSignalScheduler(CScheduler& scheduler);
+/** Stop using the scheduler, delivering the notifications still queued on this thread */
+void UnregisterBackgroundSignalScheduler();
+/**
+ * Queue a function, usually one that fires a signal, to run after all the
+ * functions queued before it. It runs at once if there is no background
+ * scheduler.
+ */
+void CallFunctionInValidationInterfaceQueue(std::function<void ()> func);
+/**
+ * Wait until all the functions queued so far have run. Must not be called
+ * with cs_main held, since they may take it.
+ */
+void SyncWithValidationInterfaceQueue();
+/** Wait for the queue to drain if it holds more than MAX_VALIDATION_INTERFACE_QUEUE_SIZE functions. */
+void LimitValidationInterfaceQueue();
+
 class CValidationInterface {
 protected:
     virtual void UpdatedBlockTip(const CBlockIndex *pindex) {}
     virtual void SyncTransaction(const CTransaction &tx, const CBlock *pblock, const int nHeight) {}
     virtual void EraseFromWallet(const uint256 &hash) {}
     virtual void ChainTip(const CBlockIndex *pindex, const CBlock *pblock, std::optional<std::pair<SproutMerkleTree, SaplingMerkleTree>> added) {}
+    virtual void BlocksDisconnected(const CBlockIndex *pindexOldTip, int nBlocks) {}
     virtual void UpdatedTransaction(const uint256 &hash) {}
     virtual void Inventory(const uint256 &hash) {}
     virtual void ResendWalletTransactions(int64_t nBestBlockTime) {}
     virtual void BlockChecked(const CBlock&, const CValidationState&) {}
     virtual void GetAddressForMining(MinerAddress&) {};
     virtual void ResetRequestCount(const uint256 &hash) {};
+    virtual void NewBlockTemplate(const std::string &longpollid) {};
+    virtual void MempoolChanged(const std::vector<CMempoolEvent> &events) {};
     friend void ::RegisterValidationInterface(CValidationInterface*);
     friend void ::UnregisterValidationInterface(CValidationInterface*);
     friend void ::UnregisterAllValidationInterfaces();
@@ -60,6 +89,8 @@ struct CMainSignals {
     boost::signals2::signal<void (const uint256 &)> UpdatedTransaction;
     /** Notifies listeners of a change to the tip of the active block chain. */
     boost::signals2::signal<void (const CBlockIndex *, const CBlock *, std::optional<std::pair<SproutMerkleTree, SaplingMerkleTree>>)> ChainTip;
+    /** Notifies listeners that the nBlocks blocks up to the old tip were disconnected, after ChainTip was called for each of them. */
+    boost::signals2::signal<void (const CBlockIndex *, int)> BlocksDisconnected;
     /** Notifies listeners about an inventory item being seen on the network. */
     boost::signals2::signal<void (const uint256 &)> Inventory;
     /** Tells listeners to broadcast their data. */
@@ -70,6 +101,10 @@ struct CMainSignals {
     boost::signals2::signal<void (MinerAddress&)> AddressForMining;
     /** Notifies listeners that a block has been successfully mined */
     boost::signals2::signal<void (const uint256 &)> BlockFound;
+    /** Notifies listeners that getblocktemplate has a new template, identified by its longpollid */
+    boost::signals2::signal<void (const std::string &)> NewBlockTemplate;
+    /** Notifies listeners, about once a second, of the transactions added to and removed from the mempool since the last call */
+    boost::signals2::signal<void (const std::vector<CMempoolEvent> &)> MempoolChanged;
 };
 
 CMainSignals& GetMainSignals();
@@ -4,6 +4,8 @@
 #include "init.h"
 #include "rpc/protocol.h"
 
+#include <algorithm>
+
 extern UniValue signrawtransaction(const UniValue& params, bool fHelp);
 
 UniValue SendTransaction(CTransaction& tx, std::optional<std::reference_wrapper<CReserveKey>> reservekey, bool testmode) {
@@ -57,3 +59,46 @@ std::pair<CTransaction, UniValue> SignSendRawTransaction(UniValue obj, std::opti
 
     return std::make_pair(tx, sendResult);
 }
+
+std::vector<SaplingNoteEntry> SelectSaplingNotes(std::vector<SaplingNoteEntry> notes, CAmount targetAmount, size_t nOutputs) {
+    auto byValueDesc = [](const SaplingNoteEntry& i, const SaplingNoteEntry& j) -> bool {
+        return i.note.value() > j.note.value();
+    };
+    std::sort(notes.begin(), notes.end(), byValueDesc);
+
+    // The shortest prefix of the largest notes that reaches the target is
+    // the smallest number of spends that can.
+    CAmount sum = 0;
+    size_t nSpends = 0;
+    while (nSpends < notes.size() && sum < targetAmount) {
+        sum += notes[nSpends].note.value();
+        nSpends++;
+    }
+    if (sum < targetAmount) {
+        return notes;
+    }
+
+    // The last spend only has to cover what the others leave, so use the
+    // smallest note that still does to keep the change down.
+    if (nSpends > 0) {
+        CAmount rest = sum - notes[nSpends - 1].note.value();
+        for (size_t i = notes.size(); i-- > nSpends; ) {
+            if (rest + notes[i].note.value() >= targetAmount) {
+                std::swap(notes[nSpends - 1], notes[i]);
+                std::sort(notes.begin() + nSpends, notes.end(), byValueDesc);
+                break;
+            }
+        }
+    }
+
+    // Consolidate dust, smallest first, while the spends are still free.
+    size_t nFreeSpends = std::max(nOutputs, ZIP317_GRACE_ACTIONS);
+    std::vector<SaplingNoteEntry> selected(notes.begin(), notes.begin() + nSpends);
+    for (size_t i = notes.size(); i-- > nSpends && selected.size() < nFreeSpends; ) {
+        if (notes[i].note.value() >= ZIP317_MARGINAL_FEE) {
+            break;
+        }
+        selected.push_back(notes[i]);
+    }
+    return selected;
+}
@@ -30,4 +30,23 @@ UniValue SendTransaction(CTransaction& tx, std::optional<std::reference_wrapper<
  */
 std::pair<CTransaction, UniValue> SignSendRawTransaction(UniValue obj, std::optional<std::reference_wrapper<CReserveKey>> reservekey, bool testmode);
 
+/** The ZIP 317 marginal fee per logical action, in zatoshis */
+static const CAmount ZIP317_MARGINAL_FEE = 5000;
+/** The number of logical actions ZIP 317 charges for at a minimum */
+static const size_t ZIP317_GRACE_ACTIONS = 2;
+
+/**
+ * Select the Sapling notes to spend to reach targetAmount.
+ *
+ * Every spend needs its own Groth16 proof, so the notes are chosen to reach
+ * the target with as few spends as possible, and among those with as little
+ * change as possible. Notes worth less than the ZIP 317 marginal fee (dust)
+ * are then added while the transaction has no more spends than nOutputs
+ * Sapling outputs (or the grace actions), where they cost no extra fee.
+ *
+ * If the notes do not reach targetAmount, all of them are returned and it
+ * is up to the caller to report the shortfall.
+ */
+std::vector<SaplingNoteEntry> SelectSaplingNotes(std::vector<SaplingNoteEntry> notes, CAmount targetAmount, size_t nOutputs);
+
 #endif // ZCASH_WALLET_ASYNCRPCOPERATION_COMMON_H
@@ -273,6 +273,8 @@ bool AsyncRPCOperation_mergetoaddress::main_impl()
     }
     LogPrint("zrpc", "%s: fee: %s\n", getId(), FormatMoney(minersFee));
 
+    set_phase("proving");
+
     // Grab the current consensus branch ID
     {
         LOCK(cs_main);
@@ -356,6 +358,7 @@ bool AsyncRPCOperation_mergetoaddress::main_impl()
         // Build the transaction
         tx_ = builder_.Build().GetTxOrThrow();
 
+        set_phase("sending");
         UniValue sendResult = SendTransaction(tx_, std::nullopt, testmode);
         set_result(sendResult);
 
@@ -376,6 +379,7 @@ bool AsyncRPCOperation_mergetoaddress::main_impl()
     if (isPureTaddrOnlyTx) {
         UniValue obj(UniValue::VOBJ);
         obj.pushKV("rawtxn", EncodeHexTx(tx_));
+        set_phase("sending");
         auto txAndResult = SignSendRawTransaction(obj, std::nullopt, testmode);
         tx_ = txAndResult.first;
         set_result(txAndResult.second);
@@ -414,6 +418,7 @@ bool AsyncRPCOperation_mergetoaddress::main_impl()
         info.vjsout.push_back(jso);
 
         UniValue obj = perform_joinsplit(info);
+        set_phase("sending");
         auto txAndResult = SignSendRawTransaction(obj, std::nullopt, testmode);
         tx_ = txAndResult.first;
         set_result(txAndResult.second);
@@ -720,6 +725,7 @@ bool AsyncRPCOperation_mergetoaddress::main_impl()
     assert(zInputsDeque.size() == 0);
     assert(vpubNewProcessed);
 
+    set_phase("sending");
     auto txAndResult = SignSendRawTransaction(obj, std::nullopt, testmode);
     tx_ = txAndResult.first;
     set_result(txAndResult.second);
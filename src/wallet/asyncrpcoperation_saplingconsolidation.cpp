@@ -0,0 +1,207 @@
+#include "assert.h"
+#include "asyncrpcoperation_saplingconsolidation.h"
+#include "asyncrpcoperation_common.h"
+#include "init.h"
+#include "rpc/protocol.h"
+#include "sync.h"
+#include "tinyformat.h"
+#include "transaction_builder.h"
+#include "util.h"
+#include "utilmoneystr.h"
+#include "wallet.h"
+
+#include <algorithm>
+#include <map>
+#include <optional>
+
+AsyncRPCOperation_saplingconsolidation::AsyncRPCOperation_saplingconsolidation(int targetHeight) : targetHeight_(targetHeight) {}
+
+AsyncRPCOperation_saplingconsolidation::~AsyncRPCOperation_saplingconsolidation() {}
+
+void AsyncRPCOperation_saplingconsolidation::main() {
+    if (isCancelled())
+        return;
+
+    set_state(OperationStatus::EXECUTING);
+    start_execution_clock();
+
+    bool success = false;
+
+    try {
+        success = main_impl();
+    } catch (const UniValue& objError) {
+        int code = find_value(objError, "code").get_int();
+        std::string message = find_value(objError, "message").get_str();
+        set_error_code(code);
+        set_error_message(message);
+    } catch (const runtime_error& e) {
+        set_error_code(-1);
+        set_error_message("runtime error: " + string(e.what()));
+    } catch (const logic_error& e) {
+        set_error_code(-1);
+        set_error_message("logic error: " + string(e.what()));
+    } catch (const exception& e) {
+        set_error_code(-1);
+        set_error_message("general exception: " + string(e.what()));
+    } catch (...) {
+        set_error_code(-2);
+        set_error_message("unknown error");
+    }
+
+    unlock_notes();
+
+    stop_execution_clock();
+
+    if (success) {
+        set_state(OperationStatus::SUCCESS);
+    } else {
+        set_state(OperationStatus::FAILED);
+    }
+
+    std::string s = strprintf("%s: Sapling consolidation transactions created. (status=%s", getId(), getStateAsString());
+    if (success) {
+        s += strprintf(", success)\n");
+    } else {
+        s += strprintf(", error=%s)\n", getErrorMessage());
+    }
+
+    LogPrintf("%s", s);
+}
+
+bool AsyncRPCOperation_saplingconsolidation::main_impl() {
+    LogPrint("zrpcunsafe", "%s: Beginning AsyncRPCOperation_saplingconsolidation.\n", getId());
+    const Consensus::Params& consensusParams = Params().GetConsensus();
+    CAmount fee = pwalletMain->nSaplingConsolidationFee;
+
+    // The notes of each address, smallest first. The notes that are merged
+    // are locked right away, so that no other operation spends them.
+    std::map<libzcash::SaplingPaymentAddress, std::vector<SaplingNoteEntry>> mapAddressNotes;
+    {
+        LOCK2(cs_main, pwalletMain->cs_wallet);
+        std::vector<SproutNoteEntry> sproutEntries;
+        std::vector<SaplingNoteEntry> saplingEntries;
+        std::set<libzcash::PaymentAddress> noFilter;
+        pwalletMain->GetFilteredNotes(sproutEntries, saplingEntries, noFilter, CONSOLIDATION_MIN_DEPTH);
+        for (const SaplingNoteEntry& entry : saplingEntries) {
+            mapAddressNotes[entry.address].push_back(entry);
+        }
+        for (auto& [address, notes] : mapAddressNotes) {
+            if (notes.size() < CONSOLIDATION_MIN_NOTES) {
+                notes.clear();
+                continue;
+            }
+            std::sort(notes.begin(), notes.end(), [](const SaplingNoteEntry& i, const SaplingNoteEntry& j) -> bool {
+                return i.note.value() < j.note.value();
+            });
+            notes.resize(std::min(notes.size(), CONSOLIDATION_MAX_NOTES));
+            for (const SaplingNoteEntry& entry : notes) {
+                pwalletMain->LockNote(entry.op);
+                locked_sapling_notes_.push_back(entry.op);
+            }
+        }
+    }
+
+    int numTxCreated = 0;
+    CAmount amountConsolidated = 0;
+    std::vector<std::string> consolidationTxIds;
+    for (const auto& [address, notes] : mapAddressNotes) {
+        if (notes.empty()) {
+            continue;
+        }
+        if (numTxCreated >= CONSOLIDATION_MAX_TXS || isCancelled()) {
+            break;
+        }
+
+        CAmount amountToSend = -fee;
+        for (const SaplingNoteEntry& entry : notes) {
+            amountToSend += entry.note.value();
+        }
+        if (amountToSend <= 0) {
+            LogPrint("zrpcunsafe", "%s: The notes of an address are worth less than the fee (%s). Skipping it.\n",
+                getId(), FormatMoney(fee));
+            continue;
+        }
+
+        libzcash::SaplingExtendedSpendingKey extsk;
+        if (!pwalletMain->GetSaplingExtendedSpendingKey(address, extsk)) {
+            // The wallet was locked since the notes were selected
+            LogPrint("zrpcunsafe", "%s: Spending key not available. Skipping an address.\n", getId());
+            continue;
+        }
+        auto expsk = extsk.expsk;
+        auto ovk = expsk.full_viewing_key().ovk;
+
+        std::vector<SaplingOutPoint> ops;
+        for (const SaplingNoteEntry& entry : notes) {
+            ops.push_back(entry.op);
+        }
+        uint256 anchor;
+        std::vector<std::optional<SaplingWitness>> witnesses;
+        {
+            LOCK2(cs_main, pwalletMain->cs_wallet);
+            pwalletMain->GetSaplingNoteWitnesses(ops, witnesses, anchor);
+        }
+
+        auto builder = TransactionBuilder(consensusParams, targetHeight_, pwalletMain);
+        builder.SetFee(fee);
+        LogPrint("zrpcunsafe", "%s: Beginning creating transaction merging %d notes into amount=%s\n",
+            getId(), notes.size(), FormatMoney(amountToSend));
+        for (size_t i = 0; i < notes.size(); i++) {
+            if (!witnesses[i]) {
+                throw JSONRPCError(RPC_WALLET_ERROR, "Missing witness for Sapling note");
+            }
+            builder.AddSaplingSpend(expsk, notes[i].note, anchor, witnesses[i].value());
+        }
+        builder.AddSaplingOutput(ovk, address, amountToSend);
+        CTransaction tx = builder.Build().GetTxOrThrow();
+        if (isCancelled()) {
+            LogPrint("zrpcunsafe", "%s: Canceled. Stopping.\n", getId());
+            break;
+        }
+        SendTransaction(tx, std::nullopt, false);
+        LogPrint("zrpcunsafe", "%s: Sent consolidation transaction with txid=%s\n", getId(), tx.GetHash().ToString());
+        ++numTxCreated;
+        amountConsolidated += amountToSend;
+        consolidationTxIds.push_back(tx.GetHash().ToString());
+    }
+
+    LogPrint("zrpcunsafe", "%s: Created %d transactions with total Sapling output amount=%s\n", getId(), numTxCreated, FormatMoney(amountConsolidated));
+    setConsolidationResult(numTxCreated, amountConsolidated, consolidationTxIds);
+    return true;
+}
+
+/**
+ * Unlock the notes locked by main_impl(). The notes that were spent stay
+ * unavailable, as the wallet now sees them spent by its own transactions.
+ */
+void AsyncRPCOperation_saplingconsolidation::unlock_notes() {
+    LOCK(pwalletMain->cs_wallet);
+    for (const SaplingOutPoint& op : locked_sapling_notes_) {
+        pwalletMain->UnlockNote(op);
+    }
+    locked_sapling_notes_.clear();
+}
+
+void AsyncRPCOperation_saplingconsolidation::setConsolidationResult(int numTxCreated, const CAmount& amountConsolidated, const std::vector<std::string>& consolidationTxIds) {
+    UniValue res(UniValue::VOBJ);
+    res.pushKV("num_tx_created", numTxCreated);
+    res.pushKV("amount_consolidated", FormatMoney(amountConsolidated));
+    UniValue txIds(UniValue::VARR);
+    for (const std::string& txId : consolidationTxIds) {
+        txIds.push_back(txId);
+    }
+    res.pushKV("consolidation_txids", txIds);
+    set_result(res);
+}
+
+void AsyncRPCOperation_saplingconsolidation::cancel() {
+    set_state(OperationStatus::CANCELLED);
+}
+
+UniValue AsyncRPCOperation_saplingconsolidation::getStatus() const {
+    UniValue v = AsyncRPCOperation::getStatus();
+    UniValue obj = v.get_obj();
+    obj.pushKV("method", "saplingconsolidation");
+    obj.pushKV("target_height", targetHeight_);
+    return obj;
+}
@@ -0,0 +1,41 @@
+#ifndef ZCASH_WALLET_ASYNCRPCOPERATION_SAPLINGCONSOLIDATION_H
+#define ZCASH_WALLET_ASYNCRPCOPERATION_SAPLINGCONSOLIDATION_H
+
+#include "amount.h"
+#include "asyncrpcoperation.h"
+#include "primitives/transaction.h"
+#include "univalue.h"
+#include "zcash/Address.hpp"
+
+class AsyncRPCOperation_saplingconsolidation : public AsyncRPCOperation
+{
+public:
+    AsyncRPCOperation_saplingconsolidation(int targetHeight);
+    virtual ~AsyncRPCOperation_saplingconsolidation();
+
+    // We don't want to be copied or moved around
+    AsyncRPCOperation_saplingconsolidation(AsyncRPCOperation_saplingconsolidation const&) = delete;            // Copy construct
+    AsyncRPCOperation_saplingconsolidation(AsyncRPCOperation_saplingconsolidation&&) = delete;                 // Move construct
+    AsyncRPCOperation_saplingconsolidation& operator=(AsyncRPCOperation_saplingconsolidation const&) = delete; // Copy assign
+    AsyncRPCOperation_saplingconsolidation& operator=(AsyncRPCOperation_saplingconsolidation&&) = delete;      // Move assign
+
+    virtual void main();
+
+    virtual void cancel();
+
+    virtual UniValue getStatus() const;
+
+private:
+    int targetHeight_;
+
+    // The notes locked while the operation runs
+    std::vector<SaplingOutPoint> locked_sapling_notes_;
+
+    bool main_impl();
+
+    void unlock_notes();
+
+    void setConsolidationResult(int numTxCreated, const CAmount& amountConsolidated, const std::vector<std::string>& consolidationTxIds);
+};
+
+#endif // ZCASH_WALLET_ASYNCRPCOPERATION_SAPLINGCONSOLIDATION_H
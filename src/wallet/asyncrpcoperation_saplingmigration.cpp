@@ -104,9 +104,8 @@ bool AsyncRPCOperation_saplingmigration::main_impl() {
 
 
     // Up to the limit of 5, as many transactions are sent as are needed to migrate the remaining funds
-    int numTxCreated = 0;
-    CAmount amountMigrated = 0;
-    std::vector<std::string> migrationTxIds;
+    std::vector<TransactionBuilder> builders;
+    std::vector<CAmount> amountsToSend;
     int noteIndex = 0;
     CCoinsViewCache coinsView(pcoinsTip);
     do {
@@ -147,17 +146,44 @@ bool AsyncRPCOperation_saplingmigration::main_impl() {
         // the value of the Sapling output will be 0.00001 ZEC less.
         builder.SetFee(DEFAULT_FEE);
         builder.AddSaplingOutput(ovkForShieldingFromTaddr(seed), migrationDestAddress, amountToSend - DEFAULT_FEE);
-        CTransaction tx = builder.Build().GetTxOrThrow();
-        if (isCancelled()) {
-            LogPrint("zrpcunsafe", "%s: Canceled. Stopping.\n", getId());
-            break;
+        builders.push_back(builder);
+        amountsToSend.push_back(amountToSend);
+    } while (builders.size() < 5 && availableFunds > CENT);
+
+    // The transactions spend distinct notes, so their proofs are created in
+    // parallel rather than one transaction after another. The builders share
+    // the proving threads, and read the Sprout anchors under cs_main.
+    std::vector<std::optional<CTransaction>> txs(builders.size());
+    std::vector<std::string> errors(builders.size());
+    ParallelFor(builders.size(), builders.size(), [&](size_t i) {
+        auto result = builders[i].Build();
+        if (result.IsTx()) {
+            txs[i] = result.GetTxOrThrow();
+        } else {
+            errors[i] = result.GetError();
         }
-        pwalletMain->AddPendingSaplingMigrationTx(tx);
-        LogPrint("zrpcunsafe", "%s: Added pending migration transaction with txid=%s\n", getId(), tx.GetHash().ToString());
-        ++numTxCreated;
-        amountMigrated += amountToSend - DEFAULT_FEE;
-        migrationTxIds.push_back(tx.GetHash().ToString());
-    } while (numTxCreated < 5 && availableFunds > CENT);
+    }, WorkPriority::WALLET);
+    for (const std::string& error : errors) {
+        if (!error.empty()) {
+            throw JSONRPCError(RPC_WALLET_ERROR, "Failed to build transaction: " + error);
+        }
+    }
+
+    int numTxCreated = 0;
+    CAmount amountMigrated = 0;
+    std::vector<std::string> migrationTxIds;
+    if (isCancelled()) {
+        LogPrint("zrpcunsafe", "%s: Canceled. Stopping.\n", getId());
+    } else {
+        for (size_t i = 0; i < txs.size(); i++) {
+            const CTransaction& tx = txs[i].value();
+            pwalletMain->AddPendingSaplingMigrationTx(tx);
+            LogPrint("zrpcunsafe", "%s: Added pending migration transaction with txid=%s\n", getId(), tx.GetHash().ToString());
+            ++numTxCreated;
+            amountMigrated += amountsToSend[i] - DEFAULT_FEE;
+            migrationTxIds.push_back(tx.GetHash().ToString());
+        }
+    }
 
     LogPrint("zrpcunsafe", "%s: Created %d transactions with total Sapling output amount=%s\n", getId(), numTxCreated, FormatMoney(amountMigrated));
     setMigrationResult(numTxCreated, amountMigrated, migrationTxIds);
@@ -164,6 +164,8 @@ void AsyncRPCOperation_sendmany::main() {
         set_error_message("unknown error");
     }
 
+    unlock_inputs();
+
 #ifdef ENABLE_MINING
     GenerateBitcoins(GetBoolArg("-gen", false), GetArg("-genproclimit", 1), Params());
 #endif
@@ -212,7 +214,8 @@ struct TxValues {
 // Notes:
 // 1. #1159 Currently there is no limit set on the number of joinsplits, so size of tx could be invalid.
 // 2. #1360 Note selection is not optimal
-// 3. #1277 Spendable notes are not locked, so an operation running in parallel could also try to use them
+// 3. The inputs are locked as they are selected, so that operations running
+//    on other workers do not select them as well
 bool AsyncRPCOperation_sendmany::main_impl() {
 
     assert(isfromtaddr_ != isfromzaddr_);
@@ -235,29 +238,44 @@ bool AsyncRPCOperation_sendmany::main_impl() {
     CAmount sendAmount = txValues.z_outputs_total + txValues.t_outputs_total;
     txValues.targetAmount = sendAmount + minersFee;
 
-    // When spending coinbase utxos, you can only specify a single zaddr as the change must go somewhere
-    // and if there are multiple zaddrs, we don't know where to send it.
-    if (isfromtaddr_) {
-        // Only select coinbase if we are spending from a single t-address to a single z-address.
-        if (!useanyutxo_ && isSingleZaddrOutput) {
-            bool b = find_utxos(true, txValues);
-            if (!b) {
-                throw JSONRPCError(RPC_WALLET_INSUFFICIENT_FUNDS, "Insufficient transparent funds, no UTXOs found for taddr from address.");
-            }
-        } else {
-            bool b = find_utxos(false, txValues);
-            if (!b) {
-                if (isMultipleZaddrOutput) {
-                    throw JSONRPCError(RPC_WALLET_INSUFFICIENT_FUNDS, "Could not find any non-coinbase UTXOs to spend. Coinbase UTXOs can only be sent to a single zaddr recipient from a single taddr.");
-                } else {
-                    throw JSONRPCError(RPC_WALLET_INSUFFICIENT_FUNDS, "Could not find any non-coinbase UTXOs to spend.");
+    set_phase("selection");
+
+    {
+        // The inputs are selected and locked under cs_wallet, so that no
+        // other operation can select them in between.
+        LOCK2(cs_main, pwalletMain->cs_wallet);
+
+        // When spending coinbase utxos, you can only specify a single zaddr as the change must go somewhere
+        // and if there are multiple zaddrs, we don't know where to send it.
+        if (isfromtaddr_) {
+            // Only select coinbase if we are spending from a single t-address to a single z-address.
+            if (!useanyutxo_ && isSingleZaddrOutput) {
+                bool b = find_utxos(true, txValues);
+                if (!b) {
+                    throw JSONRPCError(RPC_WALLET_INSUFFICIENT_FUNDS, "Insufficient transparent funds, no UTXOs found for taddr from address.");
+                }
+            } else {
+                bool b = find_utxos(false, txValues);
+                if (!b) {
+                    if (isMultipleZaddrOutput) {
+                        throw JSONRPCError(RPC_WALLET_INSUFFICIENT_FUNDS, "Could not find any non-coinbase UTXOs to spend. Coinbase UTXOs can only be sent to a single zaddr recipient from a single taddr.");
+                    } else {
+                        throw JSONRPCError(RPC_WALLET_INSUFFICIENT_FUNDS, "Could not find any non-coinbase UTXOs to spend.");
+                    }
                 }
             }
         }
-    }
 
-    if (isfromzaddr_ && !find_unspent_notes()) {
-        throw JSONRPCError(RPC_WALLET_INSUFFICIENT_FUNDS, "Insufficient funds, no unspent notes found for zaddr from address.");
+        if (isfromzaddr_ && !find_unspent_notes()) {
+            throw JSONRPCError(RPC_WALLET_INSUFFICIENT_FUNDS, "Insufficient funds, no unspent notes found for zaddr from address.");
+        }
+
+        if (isfromzaddr_) {
+            // Sapling spends, plus the outputs and the change
+            z_sapling_inputs_ = SelectSaplingNotes(z_sapling_inputs_, txValues.targetAmount, z_outputs_.size() + 1);
+        }
+
+        lock_inputs();
     }
 
     // At least one of z_sprout_inputs_ and z_sapling_inputs_ must be empty by design
@@ -292,6 +310,8 @@ bool AsyncRPCOperation_sendmany::main_impl() {
     LogPrint("zrpcunsafe", "%s: private output: %s\n", getId(), FormatMoney(txValues.z_outputs_total));
     LogPrint("zrpc", "%s: fee: %s\n", getId(), FormatMoney(minersFee));
 
+    set_phase("proving");
+
     KeyIO keyIO(Params());
 
     /**
@@ -339,17 +359,12 @@ bool AsyncRPCOperation_sendmany::main_impl() {
             builder_.SendChangeTo(changeAddr);
         }
 
-        // Select Sapling notes
+        // The Sapling notes were selected with the other inputs
         std::vector<SaplingOutPoint> ops;
         std::vector<SaplingNote> notes;
-        CAmount sum = 0;
         for (auto t : z_sapling_inputs_) {
             ops.push_back(t.op);
             notes.push_back(t.note);
-            sum += t.note.value();
-            if (sum >= txValues.targetAmount) {
-                break;
-            }
         }
 
         // Fetch Sapling anchor and witnesses
@@ -395,6 +410,7 @@ bool AsyncRPCOperation_sendmany::main_impl() {
         // Build the transaction
         tx_ = builder_.Build().GetTxOrThrow();
 
+        set_phase("sending");
         UniValue sendResult = SendTransaction(tx_, keyChange, testmode);
         set_result(sendResult);
 
@@ -437,6 +453,7 @@ bool AsyncRPCOperation_sendmany::main_impl() {
 
         UniValue obj(UniValue::VOBJ);
         obj.pushKV("rawtxn", EncodeHexTx(tx_));
+        set_phase("sending");
         auto txAndResult = SignSendRawTransaction(obj, keyChange, testmode);
         tx_ = txAndResult.first;
         set_result(txAndResult.second);
@@ -546,6 +563,7 @@ bool AsyncRPCOperation_sendmany::main_impl() {
             obj = perform_joinsplit(info);
         }
 
+        set_phase("sending");
         auto txAndResult = SignSendRawTransaction(obj, keyChange, testmode);
         tx_ = txAndResult.first;
         set_result(txAndResult.second);
@@ -831,6 +849,7 @@ bool AsyncRPCOperation_sendmany::main_impl() {
     assert(zOutputsDeque.size() == 0);
     assert(vpubNewProcessed);
 
+    set_phase("sending");
     auto txAndResult = SignSendRawTransaction(obj, std::nullopt, testmode);
     tx_ = txAndResult.first;
     set_result(txAndResult.second);
@@ -1230,6 +1249,46 @@ std::array<unsigned char, ZC_MEMO_SIZE> AsyncRPCOperation_sendmany::get_memo_fro
 /**
  * Override getStatus() to append the operation's input parameters to the default status object.
  */
+/**
+ * Lock the selected inputs: the transparent ones, the Sapling notes and
+ * the Sprout notes.
+ */
+void AsyncRPCOperation_sendmany::lock_inputs() {
+    LOCK2(cs_main, pwalletMain->cs_wallet);
+    for (const COutput& out : t_inputs_) {
+        COutPoint outpt(out.tx->GetHash(), out.i);
+        pwalletMain->LockCoin(outpt);
+        locked_utxos_.push_back(outpt);
+    }
+    for (const SendManyInputJSOP& t : z_sprout_inputs_) {
+        pwalletMain->LockNote(t.point);
+        locked_sprout_notes_.push_back(t.point);
+    }
+    for (const SaplingNoteEntry& t : z_sapling_inputs_) {
+        pwalletMain->LockNote(t.op);
+        locked_sapling_notes_.push_back(t.op);
+    }
+}
+
+/**
+ * Unlock the inputs locked by lock_inputs()
+ */
+void AsyncRPCOperation_sendmany::unlock_inputs() {
+    LOCK2(cs_main, pwalletMain->cs_wallet);
+    for (COutPoint& outpt : locked_utxos_) {
+        pwalletMain->UnlockCoin(outpt);
+    }
+    for (const JSOutPoint& jsop : locked_sprout_notes_) {
+        pwalletMain->UnlockNote(jsop);
+    }
+    for (const SaplingOutPoint& op : locked_sapling_notes_) {
+        pwalletMain->UnlockNote(op);
+    }
+    locked_utxos_.clear();
+    locked_sprout_notes_.clear();
+    locked_sapling_notes_.clear();
+}
+
 UniValue AsyncRPCOperation_sendmany::getStatus() const {
     UniValue v = AsyncRPCOperation::getStatus();
     if (contextinfo_.isNull()) {
@@ -121,10 +121,17 @@ private:
     TransactionBuilder builder_;
     CTransaction tx_;
 
+    // The inputs locked while the operation runs
+    std::vector<COutPoint> locked_utxos_;
+    std::vector<JSOutPoint> locked_sprout_notes_;
+    std::vector<SaplingOutPoint> locked_sapling_notes_;
+
     void add_taddr_change_output_to_tx(CReserveKey& keyChange, CAmount amount);
     void add_taddr_outputs_to_tx();
     bool find_unspent_notes();
     bool find_utxos(bool fAcceptCoinbase, TxValues& txValues);
+    void lock_inputs();
+    void unlock_inputs();
     // Load transparent inputs into the transaction or the transactionBuilder (in case of have it)
     bool load_inputs(TxValues& txValues);
     std::array<unsigned char, ZC_MEMO_SIZE> get_memo_from_hex_string(std::string s);
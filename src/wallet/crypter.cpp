@@ -212,6 +212,7 @@ bool CCryptoKeyStore::Lock()
         if (!SetCrypted())
             return false;
         vMasterKey.clear();
+        mapDecryptedSecrets.clear();
     }
 
     NotifyStatusChanged(this);
@@ -357,7 +358,16 @@ bool CCryptoKeyStore::GetHDSeed(HDSeed& seedOut) const
     if (cryptedHDSeed.second.empty())
         return false;
 
-    return DecryptHDSeed(vMasterKey, cryptedHDSeed.second, cryptedHDSeed.first, seedOut);
+    auto it = mapDecryptedSecrets.find(cryptedHDSeed.first);
+    if (it != mapDecryptedSecrets.end()) {
+        RawHDSeed rawSeed(it->second);
+        seedOut = HDSeed(rawSeed);
+        return true;
+    }
+    if (!DecryptHDSeed(vMasterKey, cryptedHDSeed.second, cryptedHDSeed.first, seedOut))
+        return false;
+    mapDecryptedSecrets.emplace(cryptedHDSeed.first, seedOut.RawSeed());
+    return true;
 }
 
 bool CCryptoKeyStore::AddKeyPubKey(const CKey& key, const CPubKey &pubkey)
@@ -399,7 +409,15 @@ bool CCryptoKeyStore::GetKey(const CKeyID &address, CKey& keyOut) const
     {
         const CPubKey &vchPubKey = (*mi).second.first;
         const std::vector<unsigned char> &vchCryptedSecret = (*mi).second.second;
-        return DecryptKey(vMasterKey, vchCryptedSecret, vchPubKey, keyOut);
+        auto it = mapDecryptedSecrets.find(vchPubKey.GetHash());
+        if (it != mapDecryptedSecrets.end()) {
+            keyOut.Set(it->second.begin(), it->second.end(), vchPubKey.IsCompressed());
+            return true;
+        }
+        if (!DecryptKey(vMasterKey, vchCryptedSecret, vchPubKey, keyOut))
+            return false;
+        mapDecryptedSecrets.emplace(vchPubKey.GetHash(), CKeyingMaterial(keyOut.begin(), keyOut.end()));
+        return true;
     }
     return false;
 }
@@ -506,7 +524,18 @@ bool CCryptoKeyStore::GetSproutSpendingKey(const libzcash::SproutPaymentAddress
     if (mi != mapCryptedSproutSpendingKeys.end())
     {
         const std::vector<unsigned char> &vchCryptedSecret = (*mi).second;
-        return DecryptSproutSpendingKey(vMasterKey, vchCryptedSecret, address, skOut);
+        auto it = mapDecryptedSecrets.find(address.GetHash());
+        if (it != mapDecryptedSecrets.end()) {
+            CSecureDataStream ss(it->second, SER_NETWORK, PROTOCOL_VERSION);
+            ss >> skOut;
+            return true;
+        }
+        if (!DecryptSproutSpendingKey(vMasterKey, vchCryptedSecret, address, skOut))
+            return false;
+        CSecureDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+        ss << skOut;
+        mapDecryptedSecrets.emplace(address.GetHash(), CKeyingMaterial(ss.begin(), ss.end()));
+        return true;
     }
     return false;
 }
@@ -519,11 +548,23 @@ bool CCryptoKeyStore::GetSaplingSpendingKey(
     if (!fUseCrypto)
         return CBasicKeyStore::GetSaplingSpendingKey(extfvk, skOut);
 
-    for (auto entry : mapCryptedSaplingSpendingKeys) {
-        if (entry.first == extfvk) {
-            const std::vector<unsigned char> &vchCryptedSecret = entry.second;
-            return DecryptSaplingSpendingKey(vMasterKey, vchCryptedSecret, entry.first, skOut);
+    CryptedSaplingSpendingKeyMap::const_iterator mi = mapCryptedSaplingSpendingKeys.find(extfvk);
+    if (mi != mapCryptedSaplingSpendingKeys.end())
+    {
+        const std::vector<unsigned char> &vchCryptedSecret = (*mi).second;
+        uint256 fingerprint = extfvk.fvk.GetFingerprint();
+        auto it = mapDecryptedSecrets.find(fingerprint);
+        if (it != mapDecryptedSecrets.end()) {
+            CSecureDataStream ss(it->second, SER_NETWORK, PROTOCOL_VERSION);
+            ss >> skOut;
+            return true;
         }
+        if (!DecryptSaplingSpendingKey(vMasterKey, vchCryptedSecret, extfvk, skOut))
+            return false;
+        CSecureDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+        ss << skOut;
+        mapDecryptedSecrets.emplace(fingerprint, CKeyingMaterial(ss.begin(), ss.end()));
+        return true;
     }
     return false;
 }
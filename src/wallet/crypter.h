@@ -145,6 +145,11 @@ private:
     //! keeps track of whether Unlock has run a thorough check before
     bool fDecryptionThoroughlyChecked;
 
+    //! Secrets decrypted and checked since the wallet was unlocked, by the
+    //! hash that is their IV, so that each is decrypted once per unlock. They
+    //! are held in locked memory, which is wiped when Lock() frees them.
+    mutable std::map<uint256, CKeyingMaterial> mapDecryptedSecrets;
+
 protected:
     bool SetCrypted();
 
@@ -9,6 +9,7 @@
 #include "primitives/block.h"
 #include "random.h"
 #include "transaction_builder.h"
+#include "wallet/asyncrpcoperation_common.h"
 #include "utiltest.h"
 #include "wallet/wallet.h"
 #include "zcash/JoinSplit.hpp"
@@ -17,6 +18,8 @@
 
 #include <optional>
 
+#include <boost/thread.hpp>
+
 using ::testing::Return;
 
 ACTION(ThrowLogicError) {
@@ -30,6 +33,10 @@ public:
     MOCK_METHOD0(TxnAbort, bool());
 
     MOCK_METHOD2(WriteTx, bool(uint256 hash, const CWalletTx& wtx));
+    MOCK_METHOD3(WriteNoteWitness, bool(const JSOutPoint& jsoutpt, int nHeight, const SproutWitness& witness));
+    MOCK_METHOD3(WriteNoteWitness, bool(const SaplingOutPoint& op, int nHeight, const SaplingWitness& witness));
+    MOCK_METHOD2(EraseNoteWitness, bool(const JSOutPoint& jsoutpt, int nHeight));
+    MOCK_METHOD2(EraseNoteWitness, bool(const SaplingOutPoint& op, int nHeight));
     MOCK_METHOD1(WriteWitnessCacheSize, bool(int64_t nWitnessCacheSize));
     MOCK_METHOD1(WriteBestBlock, bool(const CBlockLocator& loc));
 };
@@ -55,8 +62,8 @@ public:
                                 SaplingMerkleTree& saplingTree) {
         CWallet::IncrementNoteWitnesses(pindex, pblock, sproutTree, saplingTree);
     }
-    void DecrementNoteWitnesses(const CBlockIndex* pindex) {
-        CWallet::DecrementNoteWitnesses(pindex);
+    void DecrementNoteWitnesses(const CBlockIndex* pindex, int nBlocks = 1) {
+        CWallet::DecrementNoteWitnesses(pindex, nBlocks);
     }
     void SetBestChain(MockWalletDB& walletdb, const CBlockLocator& loc) {
         CWallet::SetBestChainINTERNAL(walletdb, loc);
@@ -528,6 +535,71 @@ TEST(WalletTests, FindMySaplingNotes) {
     RegtestDeactivateSapling();
 }
 
+TEST(WalletTests, FindMySaplingNotesInParallel) {
+    auto consensusParams = RegtestActivateSapling();
+
+    TestWallet wallet;
+    LOCK(wallet.cs_wallet);
+
+    // Add enough other keys that trial decryption is split into several
+    // jobs per output, with the wallet's key in the last one.
+    auto masterKey = GetTestMasterSaplingSpendingKey();
+    for (int i = 0; i < 2 * SAPLING_TRIAL_DECRYPTION_KEYS_PER_JOB; i++) {
+        ASSERT_TRUE(wallet.AddSaplingZKey(masterKey.Derive(i)));
+    }
+    auto sk = masterKey.Derive(2 * SAPLING_TRIAL_DECRYPTION_KEYS_PER_JOB);
+    auto extfvk = sk.ToXFVK();
+    auto pa = sk.DefaultAddress();
+
+    auto testNote = GetTestSaplingNote(pa, 50000);
+    auto builder = TransactionBuilder(consensusParams, 1);
+    builder.AddSaplingSpend(sk.expsk, testNote.note, testNote.tree.root(), testNote.tree.witness());
+    builder.AddSaplingOutput(extfvk.fvk.ovk, pa, 25000, {});
+    auto tx = builder.Build().GetTxOrThrow();
+    CWalletTx wtx {&wallet, tx};
+
+    CCheckQueue<CSaplingTrialDecryption> queue(4);
+    boost::thread_group workers;
+    for (int i = 0; i < 3; i++) {
+        workers.create_thread([&queue]() { queue.Thread(); });
+    }
+
+    auto noteMap = wallet.FindMySaplingNotes(wtx, 1, &queue).first;
+    EXPECT_EQ(0, noteMap.size());
+
+    ASSERT_TRUE(wallet.AddSaplingZKey(sk));
+    noteMap = wallet.FindMySaplingNotes(wtx, 1, &queue).first;
+    EXPECT_EQ(2, noteMap.size());
+    for (const auto& entry : noteMap) {
+        EXPECT_EQ(extfvk.fvk.in_viewing_key(), entry.second.ivk);
+    }
+    EXPECT_EQ(wallet.FindMySaplingNotes(wtx, 1, nullptr).first, noteMap);
+
+    // Outgoing viewing keys are tried in the same pass, split into jobs in
+    // the same way. Both outputs were sent with the wallet's ovk.
+    std::vector<uint256> ovks;
+    for (int i = 0; i < 2 * SAPLING_TRIAL_DECRYPTION_KEYS_PER_JOB; i++) {
+        ovks.push_back(masterKey.Derive(i).ToXFVK().fvk.ovk);
+    }
+    ovks.push_back(extfvk.fvk.ovk);
+    std::vector<std::optional<size_t>> ovkMatches;
+    EXPECT_EQ(wallet.FindMySaplingNotes(wtx, 1, &queue, ovks, ovkMatches).first, noteMap);
+    ASSERT_EQ(2, ovkMatches.size());
+    for (const auto& match : ovkMatches) {
+        EXPECT_EQ(std::optional<size_t>(ovks.size() - 1), match);
+    }
+    EXPECT_EQ(wallet.FindSaplingOutputsSentWith(wtx, ovks), ovkMatches);
+    ovks.pop_back();
+    EXPECT_EQ(wallet.FindSaplingOutputsSentWith(wtx, ovks),
+              std::vector<std::optional<size_t>>(2, std::nullopt));
+
+    workers.interrupt_all();
+    workers.join_all();
+
+    // Revert to default
+    RegtestDeactivateSapling();
+}
+
 TEST(WalletTests, FindMySproutNotes) {
     CWallet wallet;
     LOCK(wallet.cs_wallet);
@@ -1475,6 +1547,49 @@ TEST(WalletTests, CachedWitnessesCleanIndex) {
     }
 }
 
+TEST(WalletTests, CachedWitnessesBatchedDecrement) {
+    TestWallet wallet;
+    LOCK(wallet.cs_wallet);
+    std::vector<CBlock> blocks;
+    std::vector<CBlockIndex> indices;
+    std::vector<JSOutPoint> sproutNotes;
+    std::vector<SaplingOutPoint> saplingNotes;
+    std::vector<std::pair<uint256, uint256>> anchors;
+    SproutMerkleTree sproutTree;
+    SaplingMerkleTree saplingTree;
+    std::vector<std::optional<SproutWitness>> sproutWitnesses;
+    std::vector<std::optional<SaplingWitness>> saplingWitnesses;
+
+    auto sk = libzcash::SproutSpendingKey::random();
+    wallet.AddSproutSpendingKey(sk);
+
+    // Generate a chain
+    size_t numBlocks = 10;
+    blocks.resize(numBlocks);
+    indices.resize(numBlocks);
+    for (size_t i = 0; i < numBlocks; i++) {
+        indices[i].nHeight = i;
+        auto outpts = CreateValidBlock(wallet, sk, indices[i], blocks[i], sproutTree, saplingTree);
+        sproutNotes.push_back(outpts.first);
+        saplingNotes.push_back(outpts.second);
+        anchors.push_back(GetWitnessesAndAnchors(wallet, sproutNotes, saplingNotes, sproutWitnesses, saplingWitnesses));
+    }
+
+    // Disconnecting the last four blocks at once should give the witnesses
+    // and anchors as of the block below them.
+    size_t numDisconnected = 4;
+    size_t numKept = numBlocks - numDisconnected;
+    wallet.DecrementNoteWitnesses(&(indices[numBlocks - 1]), numDisconnected);
+
+    auto anchorsAfter = GetWitnessesAndAnchors(wallet, sproutNotes, saplingNotes, sproutWitnesses, saplingWitnesses);
+    for (size_t j = 0; j < numBlocks; j++) {
+        EXPECT_EQ(j < numKept, (bool) sproutWitnesses[j]);
+        EXPECT_EQ(j < numKept, (bool) saplingWitnesses[j]);
+    }
+    EXPECT_EQ(anchors[numKept - 1].first, anchorsAfter.first);
+    EXPECT_EQ(anchors[numKept - 1].second, anchorsAfter.second);
+}
+
 TEST(WalletTests, ClearNoteWitnessCache) {
     TestWallet wallet;
     LOCK(wallet.cs_wallet);
@@ -1555,12 +1670,22 @@ TEST(WalletTests, WriteWitnessCache) {
     auto note = GetSproutNote(sk, wtx, 0, 1);
     auto nullifier = note.nullifier(sk);
 
+    // A witness cached in the transaction record, as written by an older
+    // version, which the next SetBestChain() moves into a witness record.
+    SproutMerkleTree tree;
+    tree.append(note.cm());
     mapSproutNoteData_t noteData;
     JSOutPoint jsoutpt {wtx.GetHash(), 0, 1};
     SproutNoteData nd {sk.address(), nullifier};
+    nd.witnesses.push_front(tree.witness());
+    nd.witnessHeight = 1;
     noteData[jsoutpt] = nd;
     wtx.SetSproutNoteData(noteData);
     wallet.AddToWallet(wtx, true, NULL);
+    std::map<JSOutPoint, std::map<int, SproutWitness>> sproutWitnesses;
+    std::map<SaplingOutPoint, std::map<int, SaplingWitness>> saplingWitnesses;
+    wallet.LoadNoteWitnesses(sproutWitnesses, saplingWitnesses);
+    wallet.nWitnessCacheSize = 1;
 
     // TxnBegin fails
     EXPECT_CALL(walletdb, TxnBegin())
@@ -1585,20 +1710,36 @@ TEST(WalletTests, WriteWitnessCache) {
     EXPECT_CALL(walletdb, WriteTx(wtx.GetHash(), wtx))
         .WillRepeatedly(Return(true));
 
+    // WriteNoteWitness fails
+    EXPECT_CALL(walletdb, WriteNoteWitness(jsoutpt, 1, ::testing::_))
+        .WillOnce(Return(false));
+    EXPECT_CALL(walletdb, TxnAbort())
+        .Times(1);
+    wallet.SetBestChain(walletdb, loc);
+
+    // WriteNoteWitness throws
+    EXPECT_CALL(walletdb, WriteNoteWitness(jsoutpt, 1, ::testing::_))
+        .WillOnce(ThrowLogicError());
+    EXPECT_CALL(walletdb, TxnAbort())
+        .Times(1);
+    wallet.SetBestChain(walletdb, loc);
+    EXPECT_CALL(walletdb, WriteNoteWitness(jsoutpt, 1, ::testing::_))
+        .WillRepeatedly(Return(true));
+
     // WriteWitnessCacheSize fails
-    EXPECT_CALL(walletdb, WriteWitnessCacheSize(0))
+    EXPECT_CALL(walletdb, WriteWitnessCacheSize(1))
         .WillOnce(Return(false));
     EXPECT_CALL(walletdb, TxnAbort())
         .Times(1);
     wallet.SetBestChain(walletdb, loc);
 
     // WriteWitnessCacheSize throws
-    EXPECT_CALL(walletdb, WriteWitnessCacheSize(0))
+    EXPECT_CALL(walletdb, WriteWitnessCacheSize(1))
         .WillOnce(ThrowLogicError());
     EXPECT_CALL(walletdb, TxnAbort())
         .Times(1);
     wallet.SetBestChain(walletdb, loc);
-    EXPECT_CALL(walletdb, WriteWitnessCacheSize(0))
+    EXPECT_CALL(walletdb, WriteWitnessCacheSize(1))
         .WillRepeatedly(Return(true));
 
     // WriteBestBlock fails
@@ -1626,6 +1767,88 @@ TEST(WalletTests, WriteWitnessCache) {
 
     // Everything succeeds
     wallet.SetBestChain(walletdb, loc);
+
+    // Nothing has changed since, so neither the transaction nor the witness
+    // is written again
+    EXPECT_CALL(walletdb, WriteTx(wtx.GetHash(), wtx))
+        .Times(0);
+    EXPECT_CALL(walletdb, WriteNoteWitness(jsoutpt, 1, ::testing::_))
+        .Times(0);
+    wallet.SetBestChain(walletdb, loc);
+}
+
+TEST(WalletTests, SetBestChainWritesOnlyChangedWitnesses) {
+    TestWallet wallet;
+    LOCK(wallet.cs_wallet);
+    MockWalletDB walletdb;
+    CBlockLocator loc;
+
+    auto sk = libzcash::SproutSpendingKey::random();
+    wallet.AddSproutSpendingKey(sk);
+
+    EXPECT_CALL(walletdb, TxnBegin())
+        .WillRepeatedly(Return(true));
+    EXPECT_CALL(walletdb, WriteWitnessCacheSize(::testing::_))
+        .WillRepeatedly(Return(true));
+    EXPECT_CALL(walletdb, WriteBestBlock(loc))
+        .WillRepeatedly(Return(true));
+    EXPECT_CALL(walletdb, TxnCommit())
+        .WillRepeatedly(Return(true));
+
+    SproutMerkleTree sproutTree;
+    SaplingMerkleTree saplingTree;
+
+    // Connect a block containing our notes
+    CBlock block1;
+    CBlockIndex index1(block1);
+    index1.nHeight = 1;
+    auto outpts = CreateValidBlock(wallet, sk, index1, block1, sproutTree, saplingTree);
+    EXPECT_CALL(walletdb, WriteNoteWitness(outpts.first, 1, ::testing::_))
+        .WillOnce(Return(true));
+    EXPECT_CALL(walletdb, WriteNoteWitness(outpts.second, 1, ::testing::_))
+        .WillOnce(Return(true));
+    wallet.SetBestChain(walletdb, loc);
+
+    // Connect two more blocks; only their witnesses are written
+    CBlock block2;
+    block2.hashPrevBlock = block1.GetHash();
+    CBlockIndex index2(block2);
+    index2.nHeight = 2;
+    wallet.IncrementNoteWitnesses(&index2, &block2, sproutTree, saplingTree);
+    CBlock block3;
+    block3.hashPrevBlock = block2.GetHash();
+    CBlockIndex index3(block3);
+    index3.nHeight = 3;
+    wallet.IncrementNoteWitnesses(&index3, &block3, sproutTree, saplingTree);
+    for (int nHeight : {2, 3}) {
+        EXPECT_CALL(walletdb, WriteNoteWitness(outpts.first, nHeight, ::testing::_))
+            .WillOnce(Return(true));
+        EXPECT_CALL(walletdb, WriteNoteWitness(outpts.second, nHeight, ::testing::_))
+            .WillOnce(Return(true));
+    }
+    wallet.SetBestChain(walletdb, loc);
+
+    // Disconnect the last block; its witnesses are erased
+    wallet.DecrementNoteWitnesses(&index3);
+    EXPECT_CALL(walletdb, EraseNoteWitness(outpts.first, 3))
+        .WillOnce(Return(true));
+    EXPECT_CALL(walletdb, EraseNoteWitness(outpts.second, 3))
+        .WillOnce(Return(true));
+    wallet.SetBestChain(walletdb, loc);
+
+    // Connect a different block at the same height; its witnesses are
+    // written, and the older ones are left alone
+    CBlock block3a;
+    block3a.hashPrevBlock = block2.GetHash();
+    block3a.nVersion = 5;
+    CBlockIndex index3a(block3a);
+    index3a.nHeight = 3;
+    wallet.IncrementNoteWitnesses(&index3a, &block3a, sproutTree, saplingTree);
+    EXPECT_CALL(walletdb, WriteNoteWitness(outpts.first, 3, ::testing::_))
+        .WillOnce(Return(true));
+    EXPECT_CALL(walletdb, WriteNoteWitness(outpts.second, 3, ::testing::_))
+        .WillOnce(Return(true));
+    wallet.SetBestChain(walletdb, loc);
 }
 
 TEST(WalletTests, SetBestChainIgnoresTxsWithoutShieldedData) {
@@ -1689,6 +1912,22 @@ TEST(WalletTests, SetBestChainIgnoresTxsWithoutShieldedData) {
     CWalletTx wtxSaplingTransparent {nullptr, mtxSaplingTransparent};
     wallet.AddToWallet(wtxSaplingTransparent, true, nullptr);
 
+    // The transactions with notes are only rewritten if their note data
+    // has changed, here because they had witnesses cached by an older version.
+    std::map<JSOutPoint, std::map<int, SproutWitness>> sproutWitnesses;
+    std::map<SaplingOutPoint, std::map<int, SaplingWitness>> saplingWitnesses;
+    for (auto wtx : {&wtxSprout, &wtxSapling}) {
+        for (auto& item : wallet.mapWallet[wtx->GetHash()].mapSproutNoteData) {
+            item.second.witnesses.push_front(SproutMerkleTree().witness());
+            item.second.witnessHeight = 1;
+        }
+        for (auto& item : wallet.mapWallet[wtx->GetHash()].mapSaplingNoteData) {
+            item.second.witnesses.push_front(SaplingMerkleTree().witness());
+            item.second.witnessHeight = 1;
+        }
+    }
+    wallet.LoadNoteWitnesses(sproutWitnesses, saplingWitnesses);
+
     EXPECT_CALL(walletdb, TxnBegin())
         .WillOnce(Return(true));
     EXPECT_CALL(walletdb, WriteTx(wtxTransparent.GetHash(), wtxTransparent))
@@ -1699,6 +1938,10 @@ TEST(WalletTests, SetBestChainIgnoresTxsWithoutShieldedData) {
         .Times(0);
     EXPECT_CALL(walletdb, WriteTx(wtxSapling.GetHash(), wtxSapling))
         .Times(1).WillOnce(Return(true));
+    EXPECT_CALL(walletdb, WriteNoteWitness(::testing::An<const JSOutPoint&>(), ::testing::_, ::testing::_))
+        .WillRepeatedly(Return(true));
+    EXPECT_CALL(walletdb, WriteNoteWitness(::testing::An<const SaplingOutPoint&>(), ::testing::_, ::testing::_))
+        .WillRepeatedly(Return(true));
     EXPECT_CALL(walletdb, WriteTx(wtxSaplingTransparent.GetHash(), wtxSaplingTransparent))
         .Times(0);
     EXPECT_CALL(walletdb, WriteWitnessCacheSize(0))
@@ -2114,3 +2357,67 @@ TEST(WalletTests, SaplingNoteLocking) {
     EXPECT_FALSE(wallet.IsLockedNote(sop1));
     EXPECT_FALSE(wallet.IsLockedNote(sop2));
 }
+
+TEST(WalletTests, CachedBalance) {
+    TestWallet wallet;
+    LOCK2(cs_main, wallet.cs_wallet);
+
+    int nComputed = 0;
+    auto compute = [&]() { nComputed++; return CAmount(5); };
+
+    // A balance is computed once, and then read from the cache.
+    EXPECT_EQ(5, wallet.GetCachedBalance("a", compute));
+    EXPECT_EQ(5, wallet.GetCachedBalance("a", compute));
+    EXPECT_EQ(1, nComputed);
+
+    // Each query is cached separately.
+    EXPECT_EQ(5, wallet.GetCachedBalance("b", compute));
+    EXPECT_EQ(2, nComputed);
+
+    // Locking a note changes the spendable balance.
+    SaplingOutPoint sop {uint256(), 1};
+    wallet.LockNote(sop);
+    EXPECT_EQ(5, wallet.GetCachedBalance("a", compute));
+    EXPECT_EQ(3, nComputed);
+
+    // So does any change to the mempool.
+    mempool.AddTransactionsUpdated(1);
+    EXPECT_EQ(5, wallet.GetCachedBalance("a", compute));
+    EXPECT_EQ(4, nComputed);
+    EXPECT_EQ(5, wallet.GetCachedBalance("a", compute));
+    EXPECT_EQ(4, nComputed);
+}
+
+TEST(WalletTests, SelectSaplingNotes) {
+    auto pa = GetTestMasterSaplingSpendingKey().DefaultAddress();
+    auto entries = [&](std::vector<CAmount> values) {
+        std::vector<SaplingNoteEntry> result;
+        for (size_t i = 0; i < values.size(); i++) {
+            libzcash::SaplingNote note(pa, values[i], libzcash::Zip212Enabled::BeforeZip212);
+            result.push_back(SaplingNoteEntry {SaplingOutPoint(uint256(), i), pa, note, {}, 1});
+        }
+        return result;
+    };
+    auto values = [](std::vector<SaplingNoteEntry> selected) {
+        std::vector<CAmount> result;
+        for (const auto& entry : selected) {
+            result.push_back(entry.note.value());
+        }
+        return result;
+    };
+
+    // The fewest notes, with the smallest last note that still reaches the target.
+    EXPECT_THAT(values(SelectSaplingNotes(entries({10000, 90000, 40000, 70000}), 100000, 2)),
+        testing::ElementsAre(90000, 10000));
+    EXPECT_THAT(values(SelectSaplingNotes(entries({60000, 50000, 45000}), 100000, 2)),
+        testing::ElementsAre(60000, 45000));
+
+    // Dust is consolidated while the spends are free.
+    EXPECT_THAT(values(SelectSaplingNotes(entries({100000, 3000, 1000, 2000}), 50000, 3)),
+        testing::ElementsAre(100000, 1000, 2000));
+    EXPECT_THAT(values(SelectSaplingNotes(entries({100000, 3000, 1000, 2000}), 50000, 1)),
+        testing::ElementsAre(100000, 1000));
+
+    // Without enough funds, every note is returned.
+    EXPECT_EQ(3u, SelectSaplingNotes(entries({1000, 2000, 3000}), 10000, 2).size());
+}
@@ -105,6 +105,99 @@ TEST(WalletZkeysTest, StoreAndLoadSaplingZkeys) {
     EXPECT_TRUE(wallet.HaveSaplingIncomingViewingKey(dpa2));
 }
 
+TEST(WalletZkeysTest, SaplingAddressPool) {
+    SelectParams(CBaseChainParams::MAIN);
+
+    CWallet wallet;
+    CKeyingMaterial rawSeed(32, 0);
+    HDSeed seed(rawSeed);
+    {
+        LOCK(wallet.cs_wallet);
+        wallet.LoadHDSeed(seed);
+    }
+
+    // The pool is filled with keys of their own, handed out oldest first.
+    wallet.nSaplingAddressPoolSize = 3;
+    wallet.TopUpSaplingAddressPool();
+    auto pool = wallet.GetSaplingAddressPool();
+    ASSERT_EQ(3, pool.size());
+    std::set<libzcash::SaplingPaymentAddress> addrs;
+    wallet.GetSaplingPaymentAddresses(addrs);
+    EXPECT_EQ(3, addrs.size());
+    {
+        LOCK(wallet.cs_wallet);
+        auto addr = wallet.GetNewSaplingAddress();
+        EXPECT_EQ(1, pool.count(addr));
+        EXPECT_EQ(0, wallet.GetSaplingAddressPool().count(addr));
+        EXPECT_EQ(2, wallet.GetSaplingAddressPool().size());
+    }
+    wallet.TopUpSaplingAddressPool();
+    EXPECT_EQ(3, wallet.GetSaplingAddressPool().size());
+
+    // Diversified addresses of one key are added once the pool is drained.
+    wallet.fSaplingAddressPoolDiversified = true;
+    {
+        LOCK(wallet.cs_wallet);
+        for (int i = 0; i < 3; i++) {
+            wallet.GetNewSaplingAddress();
+        }
+        EXPECT_EQ(0, wallet.GetSaplingAddressPool().size());
+    }
+    wallet.TopUpSaplingAddressPool();
+    pool = wallet.GetSaplingAddressPool();
+    ASSERT_EQ(3, pool.size());
+    std::set<libzcash::SaplingIncomingViewingKey> ivks;
+    for (const auto& addr : pool) {
+        libzcash::SaplingIncomingViewingKey ivk;
+        ASSERT_TRUE(wallet.GetSaplingIncomingViewingKey(addr, ivk));
+        ivks.insert(ivk);
+    }
+    EXPECT_EQ(1, ivks.size());
+    addrs.clear();
+    wallet.GetSaplingPaymentAddresses(addrs);
+    // The default address of the pool key is not handed out.
+    EXPECT_EQ(8, addrs.size());
+}
+
+TEST(WalletZkeysTest, SaplingDiversifiedAddresses) {
+    SelectParams(CBaseChainParams::MAIN);
+
+    CWallet wallet;
+    LOCK(wallet.cs_wallet);
+    CKeyingMaterial rawSeed(32, 0);
+    HDSeed seed(rawSeed);
+    wallet.LoadHDSeed(seed);
+
+    auto defaultAddr = wallet.GenerateNewSaplingZKey();
+    libzcash::SaplingIncomingViewingKey ivk;
+    libzcash::SaplingExtendedFullViewingKey extfvk;
+    ASSERT_TRUE(wallet.GetSaplingIncomingViewingKey(defaultAddr, ivk));
+    ASSERT_TRUE(wallet.GetSaplingFullViewingKey(ivk, extfvk));
+    EXPECT_FALSE(wallet.GetSaplingDiversifierIndex(defaultAddr));
+
+    // Each call returns a new address of the same key, past the default one.
+    auto first = wallet.GenerateDiversifiedSaplingAddress(extfvk);
+    auto second = wallet.GenerateDiversifiedSaplingAddress(extfvk);
+    EXPECT_FALSE(first.first == defaultAddr);
+    EXPECT_FALSE(second.first == first.first);
+    EXPECT_EQ(extfvk.Address(first.second).value().second, first.first);
+    EXPECT_EQ(extfvk.Address(second.second).value().second, second.first);
+    libzcash::SaplingIncomingViewingKey ivkOut;
+    ASSERT_TRUE(wallet.GetSaplingIncomingViewingKey(second.first, ivkOut));
+    EXPECT_EQ(ivk, ivkOut);
+    EXPECT_EQ(first.second, wallet.GetSaplingDiversifierIndex(first.first).value());
+
+    // A wallet that loads the addresses carries on after the last of them.
+    CWallet wallet2;
+    LOCK(wallet2.cs_wallet);
+    wallet2.LoadSaplingDiversifiedAddress(second.first, ivk, second.second);
+    wallet2.LoadSaplingDiversifiedAddress(first.first, ivk, first.second);
+    EXPECT_TRUE(wallet2.HaveSaplingIncomingViewingKey(first.first));
+    auto third = wallet2.GenerateDiversifiedSaplingAddress(extfvk);
+    EXPECT_FALSE(third.first == first.first);
+    EXPECT_FALSE(third.first == second.first);
+}
+
 /**
  * This test covers methods on CWallet
  * GenerateNewSproutZKey()
@@ -690,6 +690,8 @@ UniValue z_importkey(const UniValue& params, bool fHelp)
             "2. rescan             (string, optional, default=\"whenkeyisnew\") Rescan the wallet for transactions - can be \"yes\", \"no\" or \"whenkeyisnew\"\n"
             "3. startHeight        (numeric, optional, default=0) Block height to start rescan from\n"
             "\nNote: This call can take minutes to complete if rescan is true.\n"
+            "With -compactblockindex, a rescan for a Sapling key only reads the blocks that involve the\n"
+            "wallet's Sapling keys, so it will not find transactions for keys imported earlier without a rescan.\n"
             "\nResult:\n"
             "{\n"
             "  \"type\" : \"xxxx\",                         (string) \"sprout\" or \"sapling\"\n"
@@ -775,7 +777,13 @@ UniValue z_importkey(const UniValue& params, bool fHelp)
     
     // We want to scan for transactions and notes
     if (fRescan) {
-        pwalletMain->ScanForWalletTransactions(chainActive[nRescanHeight], true);
+        // Only the new key needs to be tried on the outputs of the chain
+        if (auto extsk = std::get_if<libzcash::SaplingExtendedSpendingKey>(&spendingkey)) {
+            std::vector<libzcash::SaplingIncomingViewingKey> ivks {extsk->ToXFVK().fvk.in_viewing_key()};
+            pwalletMain->ScanForWalletTransactions(chainActive[nRescanHeight], true, &ivks);
+        } else {
+            pwalletMain->ScanForWalletTransactions(chainActive[nRescanHeight], true);
+        }
     }
 
     return result;
@@ -795,6 +803,8 @@ UniValue z_importviewingkey(const UniValue& params, bool fHelp)
             "2. rescan             (string, optional, default=\"whenkeyisnew\") Rescan the wallet for transactions - can be \"yes\", \"no\" or \"whenkeyisnew\"\n"
             "3. startHeight        (numeric, optional, default=0) Block height to start rescan from\n"
             "\nNote: This call can take minutes to complete if rescan is true.\n"
+            "With -compactblockindex, a rescan for a Sapling key only reads the blocks that involve the\n"
+            "wallet's Sapling keys, so it will not find transactions for keys imported earlier without a rescan.\n"
             "\nResult:\n"
             "{\n"
             "  \"type\" : \"xxxx\",                         (string) \"sprout\" or \"sapling\"\n"
@@ -871,7 +881,13 @@ UniValue z_importviewingkey(const UniValue& params, bool fHelp)
 
     // We want to scan for transactions and notes
     if (fRescan) {
-        pwalletMain->ScanForWalletTransactions(chainActive[nRescanHeight], true);
+        // Only the new key needs to be tried on the outputs of the chain
+        if (auto extfvk = std::get_if<libzcash::SaplingExtendedFullViewingKey>(&viewingkey)) {
+            std::vector<libzcash::SaplingIncomingViewingKey> ivks {extfvk->fvk.in_viewing_key()};
+            pwalletMain->ScanForWalletTransactions(chainActive[nRescanHeight], true, &ivks);
+        } else {
+            pwalletMain->ScanForWalletTransactions(chainActive[nRescanHeight], true);
+        }
     }
 
     return result;
@@ -816,27 +816,30 @@ UniValue getbalance(const UniValue& params, bool fHelp)
         // Calculate total balance a different way from GetBalance()
         // (GetBalance() sums up all unspent TxOuts)
         // getbalance and "getbalance * 1 true" should return the same number
-        CAmount nBalance = 0;
-        for (map<uint256, CWalletTx>::iterator it = pwalletMain->mapWallet.begin(); it != pwalletMain->mapWallet.end(); ++it)
-        {
-            const CWalletTx& wtx = (*it).second;
-            if (!CheckFinalTx(wtx) || wtx.GetBlocksToMaturity() > 0 || wtx.GetDepthInMainChain() < 0)
-                continue;
-
-            CAmount allFee;
-            string strSentAccount;
-            list<COutputEntry> listReceived;
-            list<COutputEntry> listSent;
-            wtx.GetAmounts(listReceived, listSent, allFee, strSentAccount, filter);
-            if (wtx.GetDepthInMainChain() >= nMinDepth)
+        CAmount nBalance = pwalletMain->GetCachedBalance(strprintf("*:%d:%d", nMinDepth, (int)filter), [&]() {
+            CAmount nTotal = 0;
+            for (map<uint256, CWalletTx>::iterator it = pwalletMain->mapWallet.begin(); it != pwalletMain->mapWallet.end(); ++it)
             {
-                for (const COutputEntry& r : listReceived)
-                    nBalance += r.amount;
+                const CWalletTx& wtx = (*it).second;
+                if (!CheckFinalTx(wtx) || wtx.GetBlocksToMaturity() > 0 || wtx.GetDepthInMainChain() < 0)
+                    continue;
+
+                CAmount allFee;
+                string strSentAccount;
+                list<COutputEntry> listReceived;
+                list<COutputEntry> listSent;
+                wtx.GetAmounts(listReceived, listSent, allFee, strSentAccount, filter);
+                if (wtx.GetDepthInMainChain() >= nMinDepth)
+                {
+                    for (const COutputEntry& r : listReceived)
+                        nTotal += r.amount;
+                }
+                for (const COutputEntry& s : listSent)
+                    nTotal -= s.amount;
+                nTotal -= allFee;
             }
-            for (const COutputEntry& s : listSent)
-                nBalance -= s.amount;
-            nBalance -= allFee;
-        }
+            return nTotal;
+        });
 
         // inZat
         if (params.size() > 3 && params[3].get_bool()) {
@@ -1426,7 +1429,7 @@ void ListTransactions(const CWalletTx& wtx, const string& strAccount, int nMinDe
             if (fLong)
                 WalletTxToJSON(wtx, entry);
             entry.pushKV("size", static_cast<uint64_t>(GetSerializeSize(static_cast<CTransaction>(wtx), SER_NETWORK, PROTOCOL_VERSION)));
-            ret.push_back(entry);
+            ret.push_back(std::move(entry));
         }
     }
 
@@ -1464,7 +1467,7 @@ void ListTransactions(const CWalletTx& wtx, const string& strAccount, int nMinDe
                 if (fLong)
                     WalletTxToJSON(wtx, entry);
                 entry.pushKV("size", static_cast<uint64_t>(GetSerializeSize(static_cast<CTransaction>(wtx), SER_NETWORK, PROTOCOL_VERSION)));
-                ret.push_back(entry);
+                ret.push_back(std::move(entry));
             }
         }
     }
@@ -1484,7 +1487,7 @@ void AcentryToJSON(const CAccountingEntry& acentry, const string& strAccount, Un
         entry.pushKV("amountZat", acentry.nCreditDebit);
         entry.pushKV("otheraccount", acentry.strOtherAccount);
         entry.pushKV("comment", acentry.strComment);
-        ret.push_back(entry);
+        ret.push_back(std::move(entry));
     }
 }
 
@@ -1495,13 +1498,17 @@ UniValue listtransactions(const UniValue& params, bool fHelp)
 
     if (fHelp || params.size() > 4)
         throw runtime_error(
-            "listtransactions ( \"account\" count from includeWatchonly)\n"
+            "listtransactions ( \"account\" count from includeWatchonly before )\n"
             "\nReturns up to 'count' most recent transactions skipping the first 'from' transactions for account 'account'.\n"
+            "\nTo page through a long history, pass the 'orderpos' of the oldest entry returned as 'before' in the next call,\n"
+            "rather than increasing 'from'. With 'before', the entries of a transaction are never split between pages, so\n"
+            "more than 'count' entries may be returned.\n"
             "\nArguments:\n"
             "1. \"account\"    (string, optional) DEPRECATED. The account name. Should be \"*\".\n"
             "2. count          (numeric, optional, default=10) The number of transactions to return\n"
             "3. from           (numeric, optional, default=0) The number of transactions to skip\n"
             "4. includeWatchonly (bool, optional, default=false) Include transactions to watchonly addresses (see 'importaddress')\n"
+            "5. before         (numeric, optional) Only list the transactions whose 'orderpos' is less than this\n"
             "\nResult:\n"
             "[\n"
             "  {\n"
@@ -1537,6 +1544,7 @@ UniValue listtransactions(const UniValue& params, bool fHelp)
             "                                          from (for receiving funds, positive amounts), or went to (for sending funds,\n"
             "                                          negative amounts).\n"
             "    \"size\": n,                (numeric) Transaction size in bytes\n"
+            "    \"orderpos\": n,            (numeric) The position of the transaction in the wallet history, for 'before'\n"
             "  }\n"
             "]\n"
 
@@ -1545,6 +1553,8 @@ UniValue listtransactions(const UniValue& params, bool fHelp)
             + HelpExampleCli("listtransactions", "") +
             "\nList transactions 100 to 120\n"
             + HelpExampleCli("listtransactions", "\"*\" 20 100") +
+            "\nList the 20 transactions before position 500\n"
+            + HelpExampleCli("listtransactions", "\"*\" 20 0 false 500") +
             "\nAs a json rpc call\n"
             + HelpExampleRpc("listtransactions", "\"*\", 20, 100")
         );
@@ -1563,55 +1573,77 @@ UniValue listtransactions(const UniValue& params, bool fHelp)
     if(params.size() > 3)
         if(params[3].get_bool())
             filter = filter | ISMINE_WATCH_ONLY;
+    std::optional<int64_t> nBefore;
+    if (params.size() > 4 && !params[4].isNull())
+        nBefore = params[4].get_int64();
 
     if (nCount < 0)
         throw JSONRPCError(RPC_INVALID_PARAMETER, "Negative count");
     if (nFrom < 0)
         throw JSONRPCError(RPC_INVALID_PARAMETER, "Negative from");
 
-    UniValue ret(UniValue::VARR);
+    // The entries to return, newest to oldest.
+    std::vector<UniValue> vEntries;
 
-    std::list<CAccountingEntry> acentries;
     {
         LOCK2(cs_main, pwalletMain->cs_wallet);
-        CWallet::TxItems txOrdered = pwalletMain->OrderedTxItems(acentries, strAccount);
 
-        // iterate backwards until we have nCount items to return:
-        for (CWallet::TxItems::reverse_iterator it = txOrdered.rbegin(); it != txOrdered.rend(); ++it)
+        std::list<CAccountingEntry> acentries;
+        CWalletDB(pwalletMain->strWalletFile).ListAccountCreditDebit(strAccount, acentries);
+        std::multimap<int64_t, const CAccountingEntry*> mapAcentries;
+        for (const CAccountingEntry& acentry : acentries)
+            mapAcentries.insert(std::make_pair(acentry.nOrderPos, &acentry));
+        const std::multimap<int64_t, CWalletTx*>& mapOrderedTxs = pwalletMain->GetOrderedTxs();
+
+        // Walk back from the newest transaction or move before the cursor. A
+        // move is listed before a transaction at the same position, as in
+        // OrderedTxItems().
+        auto itTx = nBefore ? mapOrderedTxs.lower_bound(*nBefore) : mapOrderedTxs.end();
+        auto itAc = nBefore ? mapAcentries.lower_bound(*nBefore) : mapAcentries.end();
+        int nSeen = 0;
+        while (itTx != mapOrderedTxs.begin() || itAc != mapAcentries.begin())
         {
-            CWalletTx *const pwtx = (*it).second.first;
-            if (pwtx != 0)
-                ListTransactions(*pwtx, strAccount, 0, true, ret, filter);
-            CAccountingEntry *const pacentry = (*it).second.second;
-            if (pacentry != 0)
-                AcentryToJSON(*pacentry, strAccount, ret);
-
-            if ((int)ret.size() >= (nCount+nFrom)) break;
+            if (nBefore ? (int)vEntries.size() >= nCount : nSeen >= nFrom + nCount)
+                break;
+
+            bool fMove = itTx == mapOrderedTxs.begin() ||
+                (itAc != mapAcentries.begin() && std::prev(itAc)->first >= std::prev(itTx)->first);
+            int64_t nOrderPos;
+            UniValue entries(UniValue::VARR);
+            if (fMove) {
+                --itAc;
+                nOrderPos = itAc->first;
+                AcentryToJSON(*itAc->second, strAccount, entries);
+            } else {
+                --itTx;
+                nOrderPos = itTx->first;
+                // The entries that are skipped are only counted, so their
+                // details are not filled in.
+                ListTransactions(*itTx->second, strAccount, 0, nSeen >= nFrom, entries, filter);
+                if (nSeen < nFrom && nSeen + (int)entries.size() > nFrom) {
+                    entries.clear();
+                    entries.setArray();
+                    ListTransactions(*itTx->second, strAccount, 0, true, entries, filter);
+                }
+            }
+
+            // Unless a cursor is given, stop at exactly nCount entries.
+            // With a cursor, the entries of the last transaction are all
+            // kept, so that the next page can start before it.
+            for (size_t i = 0; i < entries.size(); i++, nSeen++) {
+                if (nSeen < nFrom || (!nBefore && nSeen >= nFrom + nCount))
+                    continue;
+                UniValue entry = entries[i];
+                entry.pushKV("orderpos", nOrderPos);
+                vEntries.push_back(std::move(entry));
+            }
         }
     }
 
-    // ret is newest to oldest
+    std::reverse(vEntries.begin(), vEntries.end()); // Return oldest to newest
 
-    if (nFrom > (int)ret.size())
-        nFrom = ret.size();
-    if ((nFrom + nCount) > (int)ret.size())
-        nCount = ret.size() - nFrom;
-
-    vector<UniValue> arrTmp = ret.getValues();
-
-    vector<UniValue>::iterator first = arrTmp.begin();
-    std::advance(first, nFrom);
-    vector<UniValue>::iterator last = arrTmp.begin();
-    std::advance(last, nFrom+nCount);
-
-    if (last != arrTmp.end()) arrTmp.erase(last, arrTmp.end());
-    if (first != arrTmp.begin()) arrTmp.erase(arrTmp.begin(), first);
-
-    std::reverse(arrTmp.begin(), arrTmp.end()); // Return oldest to newest
-
-    ret.clear();
-    ret.setArray();
-    ret.push_backV(arrTmp);
+    UniValue ret(UniValue::VARR);
+    ret.push_backV(std::move(vEntries));
 
     return ret;
 }
@@ -1772,12 +1804,19 @@ UniValue listsinceblock(const UniValue& params, bool fHelp)
 
     UniValue transactions(UniValue::VARR);
 
-    for (map<uint256, CWalletTx>::iterator it = pwalletMain->mapWallet.begin(); it != pwalletMain->mapWallet.end(); it++)
-    {
-        CWalletTx tx = (*it).second;
+    if (pindex == NULL) {
+        for (const std::pair<const uint256, CWalletTx>& item : pwalletMain->mapWallet)
+            ListTransactions(item.second, "*", 0, true, transactions, filter);
+    } else {
+        // Only the transactions that are not in the active chain at or
+        // below pindex can be shallower than it.
+        for (const uint256& hash : pwalletMain->GetTxsSinceBlock(pindex))
+        {
+            const CWalletTx& tx = pwalletMain->mapWallet.at(hash);
 
-        if (depth == -1 || tx.GetDepthInMainChain() < depth)
-            ListTransactions(tx, "*", 0, true, transactions, filter);
+            if (tx.GetDepthInMainChain() < depth)
+                ListTransactions(tx, "*", 0, true, transactions, filter);
+        }
     }
 
     CBlockIndex *pblockLast = chainActive[chainActive.Height() + 1 - target_confirms];
@@ -1856,9 +1895,12 @@ UniValue gettransaction(const UniValue& params, bool fHelp)
             filter = filter | ISMINE_WATCH_ONLY;
 
     UniValue entry(UniValue::VOBJ);
-    if (!pwalletMain->mapWallet.count(hash))
+    // Transactions archived under -walletarchivedepth are read from wallet.dat.
+    CWalletTx wtxArchived;
+    auto it = pwalletMain->mapWallet.find(hash);
+    if (it == pwalletMain->mapWallet.end() && !pwalletMain->GetArchivedTx(hash, wtxArchived))
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid or non-wallet transaction id");
-    const CWalletTx& wtx = pwalletMain->mapWallet[hash];
+    const CWalletTx& wtx = it != pwalletMain->mapWallet.end() ? it->second : wtxArchived;
 
     CAmount nCredit = wtx.GetCredit(filter);
     CAmount nDebit = wtx.GetDebit(filter);
@@ -2363,6 +2405,7 @@ UniValue getwalletinfo(const UniValue& params, bool fHelp)
             "  \"shielded_balance\": xxxxxxx,  (numeric) the total confirmed shielded balance of the wallet in " + CURRENCY_UNIT + "\n"
             "  \"shielded_unconfirmed_balance\": xxx, (numeric) the total unconfirmed shielded balance of the wallet in " + CURRENCY_UNIT + "\n"
             "  \"txcount\": xxxxxxx,         (numeric) the total number of transactions in the wallet\n"
+            "  \"archived_txcount\": xxxxxxx, (numeric) the number of transactions archived out of memory (see -walletarchivedepth)\n"
             "  \"keypoololdest\": xxxxxx,    (numeric) the timestamp (seconds since GMT epoch) of the oldest pre-generated key in the key pool\n"
             "  \"keypoolsize\": xxxx,        (numeric) how many new keys are pre-generated\n"
             "  \"unlocked_until\": ttt,      (numeric) the timestamp in seconds since epoch (midnight Jan 1 1970 GMT) that the wallet is unlocked for transfers, or 0 if the wallet is locked\n"
@@ -2384,6 +2427,7 @@ UniValue getwalletinfo(const UniValue& params, bool fHelp)
     obj.pushKV("shielded_balance",    FormatMoney(getBalanceZaddr("", 1, INT_MAX)));
     obj.pushKV("shielded_unconfirmed_balance", FormatMoney(getBalanceZaddr("", 0, 0)));
     obj.pushKV("txcount",       (int)pwalletMain->mapWallet.size());
+    obj.pushKV("archived_txcount", (int)pwalletMain->GetArchivedTxCount());
     obj.pushKV("keypoololdest", pwalletMain->GetOldestKeyPoolTime());
     obj.pushKV("keypoolsize",   (int)pwalletMain->GetKeyPoolSize());
     if (pwalletMain->IsCrypted())
@@ -2570,6 +2614,7 @@ UniValue z_listunspent(const UniValue& params, bool fHelp)
             "    \"confirmations\" : n,       (numeric) the number of confirmations\n"
             "    \"spendable\" : true|false,  (boolean) true if note can be spent by wallet, false if address is watchonly\n"
             "    \"address\" : \"address\",    (string) the shielded address\n"
+            "    \"diversifierindex\" (sapling) : \"hex\",  (string) the diversifier index of the address, if it was returned by z_getdiversifiedaddress\n"
             "    \"amount\": xxxxx,          (numeric) the amount of value in the note\n"
             "    \"memo\": xxxxx,            (string) hexademical string representation of memo field\n"
             "    \"change\": true|false,     (boolean) true if the address that received the note is also one of the sending addresses\n"
@@ -2689,6 +2734,10 @@ UniValue z_listunspent(const UniValue& params, bool fHelp)
             bool hasSaplingSpendingKey = HaveSpendingKeyForPaymentAddress(pwalletMain)(entry.address);
             obj.pushKV("spendable", hasSaplingSpendingKey);
             obj.pushKV("address", keyIO.EncodePaymentAddress(entry.address));
+            auto diversifierIndex = pwalletMain->GetSaplingDiversifierIndex(entry.address);
+            if (diversifierIndex) {
+                obj.pushKV("diversifierindex", diversifierIndex.value().GetHex());
+            }
             obj.pushKV("amount", ValueFromAmount(CAmount(entry.note.value()))); // note.value() is equivalent to plaintext.value()
             obj.pushKV("memo", HexStr(entry.memo));
             if (hasSaplingSpendingKey) {
@@ -2878,7 +2927,12 @@ UniValue zc_benchmark(const UniValue& params, bool fHelp)
             sample_times.push_back(benchmark_try_decrypt_sprout_notes(nKeys));
         } else if (benchmarktype == "trydecryptsaplingnotes") {
             int nKeys = params[2].get_int();
-            sample_times.push_back(benchmark_try_decrypt_sapling_notes(nKeys));
+            if (params.size() < 4) {
+                sample_times.push_back(benchmark_try_decrypt_sapling_notes(nKeys));
+            } else {
+                int nThreads = params[3].get_int();
+                sample_times.push_back(benchmark_try_decrypt_sapling_notes_threaded(nKeys, nThreads));
+            }
         } else if (benchmarktype == "incnotewitnesses") {
             int nTxs = params[2].get_int();
             sample_times.push_back(benchmark_increment_sprout_note_witnesses(nTxs));
@@ -2904,7 +2958,17 @@ UniValue zc_benchmark(const UniValue& params, bool fHelp)
         } else if (benchmarktype == "listunspent") {
             sample_times.push_back(benchmark_listunspent());
         } else if (benchmarktype == "createsaplingspend") {
-            sample_times.push_back(benchmark_create_sapling_spend());
+            if (params.size() < 3) {
+                sample_times.push_back(benchmark_create_sapling_spend());
+            } else {
+                int nThreads = params[2].get_int();
+                if (nThreads <= 0) {
+                    throw JSONRPCError(RPC_TYPE_ERROR, "Invalid number of threads");
+                }
+                // Divide by nThreads to get average seconds per spend, as
+                // nThreads spends are proved at once.
+                sample_times.push_back(benchmark_create_sapling_spend_threaded(nThreads) / nThreads);
+            }
         } else if (benchmarktype == "createsaplingoutput") {
             sample_times.push_back(benchmark_create_sapling_output());
         } else if (benchmarktype == "verifysaplingspend") {
@@ -3292,13 +3356,68 @@ UniValue z_getnewaddress(const UniValue& params, bool fHelp)
     if (addrType == ADDR_TYPE_SPROUT) {
         return keyIO.EncodePaymentAddress(pwalletMain->GenerateNewSproutZKey());
     } else if (addrType == ADDR_TYPE_SAPLING) {
-        return keyIO.EncodePaymentAddress(pwalletMain->GenerateNewSaplingZKey());
+        return keyIO.EncodePaymentAddress(pwalletMain->GetNewSaplingAddress());
     } else {
         throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid address type");
     }
 }
 
 
+UniValue z_getdiversifiedaddress(const UniValue& params, bool fHelp)
+{
+    if (!EnsureWalletIsAvailable(fHelp))
+        return NullUniValue;
+
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "z_getdiversifiedaddress \"zaddr\"\n"
+            "\nReturns a new diversified address of the Sapling key that 'zaddr' belongs to.\n"
+            "Notes received at any diversified address of a key are found by trial-decrypting\n"
+            "with that key once, so the addresses returned by this call do not slow down the\n"
+            "scanning of blocks the way new keys from z_getnewaddress do.\n"
+            "\nArguments:\n"
+            "1. \"zaddr\"         (string, required) A Sapling address of the wallet, whose full viewing key it holds\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"address\" : \"zaddr\",           (string) The new diversified address\n"
+            "  \"diversifierindex\" : \"hex\",    (string) The diversifier index of the address\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("z_getdiversifiedaddress", "\"myaddress\"")
+            + HelpExampleRpc("z_getdiversifiedaddress", "\"myaddress\"")
+        );
+
+    LOCK(pwalletMain->cs_wallet);
+
+    KeyIO keyIO(Params());
+    auto address = keyIO.DecodePaymentAddress(params[0].get_str());
+    if (!IsValidPaymentAddress(address)) {
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid zaddr");
+    }
+    auto saplingAddress = std::get_if<libzcash::SaplingPaymentAddress>(&address);
+    if (saplingAddress == nullptr) {
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Only Sapling addresses have diversified addresses");
+    }
+    libzcash::SaplingIncomingViewingKey ivk;
+    libzcash::SaplingExtendedFullViewingKey extfvk;
+    if (!pwalletMain->GetSaplingIncomingViewingKey(*saplingAddress, ivk) ||
+        !pwalletMain->GetSaplingFullViewingKey(ivk, extfvk)) {
+        throw JSONRPCError(RPC_WALLET_ERROR, "Wallet does not hold the full viewing key for this zaddr");
+    }
+
+    std::pair<libzcash::SaplingPaymentAddress, libzcash::diversifier_index_t> diversified;
+    try {
+        diversified = pwalletMain->GenerateDiversifiedSaplingAddress(extfvk);
+    } catch (const std::runtime_error& e) {
+        throw JSONRPCError(RPC_WALLET_ERROR, e.what());
+    }
+    UniValue result(UniValue::VOBJ);
+    result.pushKV("address", keyIO.EncodePaymentAddress(diversified.first));
+    result.pushKV("diversifierindex", diversified.second.GetHex());
+    return result;
+}
+
+
 UniValue z_listaddresses(const UniValue& params, bool fHelp)
 {
     if (!EnsureWalletIsAvailable(fHelp))
@@ -3341,7 +3460,12 @@ UniValue z_listaddresses(const UniValue& params, bool fHelp)
     {
         std::set<libzcash::SaplingPaymentAddress> addresses;
         pwalletMain->GetSaplingPaymentAddresses(addresses);
+        // The addresses in the pool have not been handed out yet.
+        std::set<libzcash::SaplingPaymentAddress> pool = pwalletMain->GetSaplingAddressPool();
         for (auto addr : addresses) {
+            if (pool.count(addr)) {
+                continue;
+            }
             if (fIncludeWatchonly || HaveSpendingKeyForPaymentAddress(pwalletMain)(addr)) {
                 ret.push_back(keyIO.EncodePaymentAddress(addr));
             }
@@ -3366,32 +3490,35 @@ CAmount getBalanceTaddr(std::string transparentAddress, int minDepth=1, bool ign
 
     LOCK2(cs_main, pwalletMain->cs_wallet);
 
-    pwalletMain->AvailableCoins(vecOutputs, false, NULL, true);
+    std::string strKey = strprintf("taddr:%s:%d:%d", transparentAddress, minDepth, ignoreUnspendable);
+    return pwalletMain->GetCachedBalance(strKey, [&]() {
+        pwalletMain->AvailableCoins(vecOutputs, false, NULL, true);
 
-    for (const COutput& out : vecOutputs) {
-        if (out.nDepth < minDepth) {
-            continue;
-        }
-
-        if (ignoreUnspendable && !out.fSpendable) {
-            continue;
-        }
-
-        if (destinations.size()) {
-            CTxDestination address;
-            if (!ExtractDestination(out.tx->vout[out.i].scriptPubKey, address)) {
+        for (const COutput& out : vecOutputs) {
+            if (out.nDepth < minDepth) {
                 continue;
             }
 
-            if (!destinations.count(address)) {
+            if (ignoreUnspendable && !out.fSpendable) {
                 continue;
             }
-        }
 
-        CAmount nValue = out.tx->vout[out.i].nValue;
-        balance += nValue;
-    }
-    return balance;
+            if (destinations.size()) {
+                CTxDestination address;
+                if (!ExtractDestination(out.tx->vout[out.i].scriptPubKey, address)) {
+                    continue;
+                }
+
+                if (!destinations.count(address)) {
+                    continue;
+                }
+            }
+
+            CAmount nValue = out.tx->vout[out.i].nValue;
+            balance += nValue;
+        }
+        return balance;
+    });
 }
 
 CAmount getBalanceZaddr(std::string address, int minDepth, int maxDepth, bool ignoreUnspendable) {
@@ -3406,14 +3533,17 @@ CAmount getBalanceZaddr(std::string address, int minDepth, int maxDepth, bool ig
         filterAddresses.insert(keyIO.DecodePaymentAddress(address));
     }
 
-    pwalletMain->GetFilteredNotes(sproutEntries, saplingEntries, filterAddresses, minDepth, maxDepth, true, ignoreUnspendable);
-    for (auto & entry : sproutEntries) {
-        balance += CAmount(entry.note.value());
-    }
-    for (auto & entry : saplingEntries) {
-        balance += CAmount(entry.note.value());
-    }
-    return balance;
+    std::string strKey = strprintf("zaddr:%s:%d:%d:%d", address, minDepth, maxDepth, ignoreUnspendable);
+    return pwalletMain->GetCachedBalance(strKey, [&]() {
+        pwalletMain->GetFilteredNotes(sproutEntries, saplingEntries, filterAddresses, minDepth, maxDepth, true, ignoreUnspendable);
+        for (auto & entry : sproutEntries) {
+            balance += CAmount(entry.note.value());
+        }
+        for (auto & entry : saplingEntries) {
+            balance += CAmount(entry.note.value());
+        }
+        return balance;
+    });
 }
 
 struct txblock
@@ -3732,9 +3862,12 @@ UniValue z_viewtransaction(const UniValue& params, bool fHelp)
     hash.SetHex(params[0].get_str());
 
     UniValue entry(UniValue::VOBJ);
-    if (!pwalletMain->mapWallet.count(hash))
+    // Transactions archived under -walletarchivedepth are read from wallet.dat.
+    CWalletTx wtxArchived;
+    auto it = pwalletMain->mapWallet.find(hash);
+    if (it == pwalletMain->mapWallet.end() && !pwalletMain->GetArchivedTx(hash, wtxArchived))
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid or non-wallet transaction id");
-    const CWalletTx& wtx = pwalletMain->mapWallet[hash];
+    const CWalletTx& wtx = it != pwalletMain->mapWallet.end() ? it->second : wtxArchived;
 
     entry.pushKV("txid", hash.GetHex());
 
@@ -3829,16 +3962,11 @@ UniValue z_viewtransaction(const UniValue& params, bool fHelp)
             continue;
         }
         auto op = res->second;
-        auto wtxPrev = pwalletMain->mapWallet.at(op.hash);
-
-        // We don't need to check the leadbyte here: if wtx exists in
-        // the wallet, it must have been successfully decrypted. This
-        // means the plaintext leadbyte was valid at the block height
-        // where the note was received.
-        // https://zips.z.cash/zip-0212#changes-to-the-process-of-receiving-sapling-notes
-        auto decrypted = wtxPrev.DecryptSaplingNoteWithoutLeadByteCheck(op).value();
-        auto notePt = decrypted.first;
-        auto pa = decrypted.second;
+        const CWalletTx& wtxPrev = pwalletMain->mapWallet.at(op.hash);
+
+        // The note was decrypted when its transaction entered the wallet.
+        const SaplingNoteEntry& noteEntry = pwalletMain->mapSaplingNoteEntries.at(op);
+        auto pa = noteEntry.address;
 
         // Store the OutgoingViewingKey for recovering outputs
         libzcash::SaplingExtendedFullViewingKey extfvk;
@@ -3851,34 +3979,59 @@ UniValue z_viewtransaction(const UniValue& params, bool fHelp)
         entry.pushKV("txidPrev", op.hash.GetHex());
         entry.pushKV("outputPrev", (int)op.n);
         entry.pushKV("address", keyIO.EncodePaymentAddress(pa));
-        entry.pushKV("value", ValueFromAmount(notePt.value()));
-        entry.pushKV("valueZat", notePt.value());
+        entry.pushKV("value", ValueFromAmount(noteEntry.note.value()));
+        entry.pushKV("valueZat", noteEntry.note.value());
         spends.push_back(entry);
     }
 
+    // Try every ovk on every output that the wallet did not receive, in one
+    // batched pass.
+    std::vector<uint256> vOvks(ovks.begin(), ovks.end());
+    auto ovkMatches = pwalletMain->FindSaplingOutputsSentWith(wtx, vOvks);
+
+    // The notes of an archived transaction have left the note indexes.
+    std::map<SaplingOutPoint, SaplingNoteEntry> archivedNotes;
+    if (&wtx == &wtxArchived) {
+        for (const SaplingNoteEntry& noteEntry : wtxArchived.DecryptSaplingNoteEntries()) {
+            archivedNotes.emplace(noteEntry.op, noteEntry);
+        }
+    }
+
     // Sapling outputs
     for (uint32_t i = 0; i < wtx.vShieldedOutput.size(); ++i) {
         auto op = SaplingOutPoint(hash, i);
 
-        SaplingNotePlaintext notePt;
+        CAmount value;
+        std::array<unsigned char, ZC_MEMO_SIZE> memo;
         SaplingPaymentAddress pa;
         bool isOutgoing;
 
-        // We don't need to check the leadbyte here: if wtx exists in
-        // the wallet, it must have been successfully decrypted. This
-        // means the plaintext leadbyte was valid at the block height
-        // where the note was received.
-        // https://zips.z.cash/zip-0212#changes-to-the-process-of-receiving-sapling-notes
-        auto decrypted = wtx.DecryptSaplingNoteWithoutLeadByteCheck(op);
-        if (decrypted) {
-            notePt = decrypted->first;
-            pa = decrypted->second;
+        // Notes received by the wallet were decrypted when wtx entered it,
+        // or above if it was archived.
+        const std::map<SaplingOutPoint, SaplingNoteEntry>& noteEntries =
+            &wtx == &wtxArchived ? archivedNotes : pwalletMain->mapSaplingNoteEntries;
+        auto cached = noteEntries.find(op);
+        if (cached != noteEntries.end()) {
+            value = cached->second.note.value();
+            memo = cached->second.memo;
+            pa = cached->second.address;
             isOutgoing = false;
         } else {
             // Try recovering the output
-            auto recovered = wtx.RecoverSaplingNoteWithoutLeadByteCheck(op, ovks);
+            //
+            // We don't need to check the leadbyte here: if wtx exists in
+            // the wallet, it must have been successfully decrypted. This
+            // means the plaintext leadbyte was valid at the block height
+            // where the note was received.
+            // https://zips.z.cash/zip-0212#changes-to-the-process-of-receiving-sapling-notes
+            std::optional<std::pair<SaplingNotePlaintext, SaplingPaymentAddress>> recovered;
+            if (ovkMatches[i]) {
+                std::set<uint256> matchedOvk = {vOvks[*ovkMatches[i]]};
+                recovered = wtx.RecoverSaplingNoteWithoutLeadByteCheck(op, matchedOvk);
+            }
             if (recovered) {
-                notePt = recovered->first;
+                value = recovered->first.value();
+                memo = recovered->first.memo();
                 pa = recovered->second;
                 isOutgoing = true;
             } else {
@@ -3886,15 +4039,14 @@ UniValue z_viewtransaction(const UniValue& params, bool fHelp)
                 continue;
             }
         }
-        auto memo = notePt.memo();
 
         UniValue entry(UniValue::VOBJ);
         entry.pushKV("type", ADDR_TYPE_SAPLING);
         entry.pushKV("output", (int)op.n);
         entry.pushKV("outgoing", isOutgoing);
         entry.pushKV("address", keyIO.EncodePaymentAddress(pa));
-        entry.pushKV("value", ValueFromAmount(notePt.value()));
-        entry.pushKV("valueZat", notePt.value());
+        entry.pushKV("value", ValueFromAmount(value));
+        entry.pushKV("valueZat", value);
         addMemo(entry, memo);
         outputs.push_back(entry);
     }
@@ -3981,6 +4133,13 @@ UniValue z_getoperationstatus_IMPL(const UniValue& params, bool fRemoveFinishedO
 
         UniValue obj = operation->getStatus();
         std::string s = obj["status"].get_str();
+        if ("queued"==s) {
+            // How many operations will be started before this one
+            int pos = q->getQueuePosition(id);
+            if (pos >= 0) {
+                obj.pushKV("queue_position", pos);
+            }
+        }
         if (fRemoveFinishedOperations) {
             // Caller is only interested in retrieving finished results
             if ("success"==s || "failed"==s || "cancelled"==s) {
@@ -3995,7 +4154,7 @@ UniValue z_getoperationstatus_IMPL(const UniValue& params, bool fRemoveFinishedO
     std::vector<UniValue> arrTmp = ret.getValues();
 
     // sort results chronologically by creation_time
-    std::sort(arrTmp.begin(), arrTmp.end(), [](UniValue a, UniValue b) -> bool {
+    std::sort(arrTmp.begin(), arrTmp.end(), [](const UniValue& a, const UniValue& b) -> bool {
         const int64_t t1 = find_value(a.get_obj(), "creation_time").get_int64();
         const int64_t t2 = find_value(b.get_obj(), "creation_time").get_int64();
         return t1 < t2;
@@ -4003,7 +4162,7 @@ UniValue z_getoperationstatus_IMPL(const UniValue& params, bool fRemoveFinishedO
 
     ret.clear();
     ret.setArray();
-    ret.push_backV(arrTmp);
+    ret.push_backV(std::move(arrTmp));
 
     return ret;
 }
@@ -5280,6 +5439,7 @@ static const CRPCCommand commands[] =
     { "wallet",             "z_getoperationresult",     &z_getoperationresult,     true  },
     { "wallet",             "z_listoperationids",       &z_listoperationids,       true  },
     { "wallet",             "z_getnewaddress",          &z_getnewaddress,          true  },
+    { "wallet",             "z_getdiversifiedaddress",  &z_getdiversifiedaddress,  true  },
     { "wallet",             "z_listaddresses",          &z_listaddresses,          true  },
     { "wallet",             "z_exportkey",              &z_exportkey,              true  },
     { "wallet",             "z_importkey",              &z_importkey,              true  },
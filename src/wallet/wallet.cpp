@@ -8,7 +8,9 @@
 #include "asyncrpcqueue.h"
 #include "checkpoints.h"
 #include "coincontrol.h"
+#include "compactblockindex.h"
 #include "core_io.h"
+#include "core_memusage.h"
 #include "consensus/upgrades.h"
 #include "consensus/validation.h"
 #include "consensus/consensus.h"
@@ -24,16 +26,21 @@
 #include "script/script.h"
 #include "script/sign.h"
 #include "timedata.h"
+#include "transaction_builder.h"
+#include "txdb.h"
 #include "utilmoneystr.h"
 #include "zcash/JoinSplit.hpp"
 #include "zcash/Note.hpp"
+#include "zcash/ProvingBackend.hpp"
 #include "crypter.h"
+#include "wallet/asyncrpcoperation_saplingconsolidation.h"
 #include "wallet/asyncrpcoperation_saplingmigration.h"
 
 #include <algorithm>
 #include <assert.h>
 #include <variant>
 
+#include <boost/algorithm/string/join.hpp>
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/thread.hpp>
 
@@ -47,6 +54,8 @@ unsigned int nTxConfirmTarget = DEFAULT_TX_CONFIRM_TARGET;
 bool bSpendZeroConfChange = DEFAULT_SPEND_ZEROCONF_CHANGE;
 bool fSendFreeTransactions = DEFAULT_SEND_FREE_TRANSACTIONS;
 bool fPayAtLeastCustomFee = true;
+int nSaplingDecryptThreads = 0;
+int nWitnessUpdateThreads = 0;
 
 const char * DEFAULT_WALLET_DAT = "wallet.dat";
 
@@ -158,6 +167,150 @@ SaplingPaymentAddress CWallet::GenerateNewSaplingZKey()
     return xsk.DefaultAddress();
 }
 
+// The diversifier index is a little-endian integer.
+static void IncrementDiversifierIndex(diversifier_index_t& j)
+{
+    for (unsigned char* p = j.begin(); p != j.end(); p++) {
+        if (++*p != 0) {
+            break;
+        }
+    }
+}
+
+static bool DiversifierIndexLess(const diversifier_index_t& a, const diversifier_index_t& b)
+{
+    for (int i = a.size() - 1; i >= 0; i--) {
+        if (a.begin()[i] != b.begin()[i]) {
+            return a.begin()[i] < b.begin()[i];
+        }
+    }
+    return false;
+}
+
+std::pair<SaplingPaymentAddress, diversifier_index_t> CWallet::GenerateDiversifiedSaplingAddress(
+    const SaplingExtendedFullViewingKey &extfvk)
+{
+    AssertLockHeld(cs_wallet);
+
+    auto ivk = extfvk.fvk.in_viewing_key();
+    auto it = mapSaplingNextDiversifier.find(ivk);
+    if (it == mapSaplingNextDiversifier.end()) {
+        // Start just past the default address.
+        auto defaultAddr = extfvk.Address(diversifier_index_t());
+        if (!defaultAddr) {
+            throw std::runtime_error("CWallet::GenerateDiversifiedSaplingAddress(): no diversifiers left");
+        }
+        diversifier_index_t j = defaultAddr.value().first;
+        IncrementDiversifierIndex(j);
+        it = mapSaplingNextDiversifier.emplace(ivk, j).first;
+    }
+
+    auto found = extfvk.Address(it->second);
+    if (!found) {
+        throw std::runtime_error("CWallet::GenerateDiversifiedSaplingAddress(): no diversifiers left");
+    }
+    auto addr = found.value().second;
+    diversifier_index_t j = found.value().first;
+    it->second = j;
+    IncrementDiversifierIndex(it->second);
+    mapSaplingDiversifierIndex[addr] = j;
+
+    if (!AddSaplingIncomingViewingKey(ivk, addr)) {
+        throw std::runtime_error("CWallet::GenerateDiversifiedSaplingAddress(): AddSaplingIncomingViewingKey failed");
+    }
+    if (fFileBacked && !CWalletDB(strWalletFile).WriteSaplingDiversifiedAddress(addr, ivk, j)) {
+        throw std::runtime_error("CWallet::GenerateDiversifiedSaplingAddress(): writing the diversifier index failed");
+    }
+    return std::make_pair(addr, j);
+}
+
+void CWallet::LoadSaplingDiversifiedAddress(
+    const SaplingPaymentAddress &addr,
+    const SaplingIncomingViewingKey &ivk,
+    const diversifier_index_t &j)
+{
+    AssertLockHeld(cs_wallet);
+
+    mapSaplingDiversifierIndex[addr] = j;
+    diversifier_index_t next = j;
+    IncrementDiversifierIndex(next);
+    auto it = mapSaplingNextDiversifier.find(ivk);
+    if (it == mapSaplingNextDiversifier.end()) {
+        mapSaplingNextDiversifier.emplace(ivk, next);
+    } else if (DiversifierIndexLess(it->second, next)) {
+        it->second = next;
+    }
+    // Encrypted wallets do not store the addresses of their keys.
+    CCryptoKeyStore::AddSaplingIncomingViewingKey(ivk, addr);
+}
+
+std::optional<diversifier_index_t> CWallet::GetSaplingDiversifierIndex(const SaplingPaymentAddress &addr) const
+{
+    LOCK(cs_wallet);
+    auto it = mapSaplingDiversifierIndex.find(addr);
+    if (it == mapSaplingDiversifierIndex.end()) {
+        return std::nullopt;
+    }
+    return it->second;
+}
+
+SaplingPaymentAddress CWallet::GenerateSaplingPoolAddress()
+{
+    AssertLockHeld(cs_wallet);
+
+    if (!fSaplingAddressPoolDiversified) {
+        return GenerateNewSaplingZKey();
+    }
+
+    // The pool key is created on the first use after the wallet is loaded,
+    // so each run adds one incoming viewing key however many addresses it
+    // hands out.
+    if (!saplingPoolXFVK) {
+        auto defaultAddr = GenerateNewSaplingZKey();
+        libzcash::SaplingIncomingViewingKey ivk;
+        libzcash::SaplingExtendedFullViewingKey xfvk;
+        if (!GetSaplingIncomingViewingKey(defaultAddr, ivk) || !GetSaplingFullViewingKey(ivk, xfvk)) {
+            throw std::runtime_error("CWallet::GenerateSaplingPoolAddress(): new key not found");
+        }
+        saplingPoolXFVK = xfvk;
+    }
+    return GenerateDiversifiedSaplingAddress(*saplingPoolXFVK).first;
+}
+
+SaplingPaymentAddress CWallet::GetNewSaplingAddress()
+{
+    AssertLockHeld(cs_wallet);
+
+    if (!saplingAddressPool.empty()) {
+        auto addr = saplingAddressPool.front();
+        saplingAddressPool.pop_front();
+        return addr;
+    }
+    return GenerateSaplingPoolAddress();
+}
+
+void CWallet::TopUpSaplingAddressPool()
+{
+    while (!ShutdownRequested()) {
+        LOCK(cs_wallet);
+        if (saplingAddressPool.size() >= nSaplingAddressPoolSize || IsLocked()) {
+            return;
+        }
+        try {
+            saplingAddressPool.push_back(GenerateSaplingPoolAddress());
+        } catch (const std::exception& e) {
+            LogPrintf("%s: %s\n", __func__, e.what());
+            return;
+        }
+    }
+}
+
+std::set<SaplingPaymentAddress> CWallet::GetSaplingAddressPool() const
+{
+    LOCK(cs_wallet);
+    return std::set<SaplingPaymentAddress>(saplingAddressPool.begin(), saplingAddressPool.end());
+}
+
 // Add spending key to keystore 
 bool CWallet::AddSaplingZKey(const libzcash::SaplingExtendedSpendingKey &sk)
 {
@@ -166,7 +319,8 @@ bool CWallet::AddSaplingZKey(const libzcash::SaplingExtendedSpendingKey &sk)
     if (!CCryptoKeyStore::AddSaplingSpendingKey(sk)) {
         return false;
     }
-    
+    InvalidateBalanceCache();
+
     if (!fFileBacked) {
         return true;
     }
@@ -186,6 +340,7 @@ bool CWallet::AddSaplingFullViewingKey(const libzcash::SaplingExtendedFullViewin
     if (!CCryptoKeyStore::AddSaplingFullViewingKey(extfvk)) {
         return false;
     }
+    InvalidateBalanceCache();
 
     if (!fFileBacked) {
         return true;
@@ -204,6 +359,7 @@ bool CWallet::AddSaplingIncomingViewingKey(
     if (!CCryptoKeyStore::AddSaplingIncomingViewingKey(ivk, addr)) {
         return false;
     }
+    InvalidateBalanceCache();
 
     if (!fFileBacked) {
         return true;
@@ -225,6 +381,7 @@ bool CWallet::AddSproutZKey(const libzcash::SproutSpendingKey &key)
 
     if (!CCryptoKeyStore::AddSproutSpendingKey(key))
         return false;
+    InvalidateBalanceCache();
 
     // check if we need to remove from viewing keys
     if (HaveSproutViewingKey(addr))
@@ -262,8 +419,11 @@ CPubKey CWallet::GenerateNewKey()
     if (!nTimeFirstKey || nCreationTime < nTimeFirstKey)
         nTimeFirstKey = nCreationTime;
 
+    // A new key cannot own any of the outputs already in the wallet.
+    bool fStale = fUnspentOutputsStale;
     if (!AddKeyPubKey(secret, pubkey))
         throw std::runtime_error("CWallet::GenerateNewKey(): AddKey failed");
+    fUnspentOutputsStale = fStale;
     return pubkey;
 }
 
@@ -272,6 +432,8 @@ bool CWallet::AddKeyPubKey(const CKey& secret, const CPubKey &pubkey)
     AssertLockHeld(cs_wallet); // mapKeyMetadata
     if (!CCryptoKeyStore::AddKeyPubKey(secret, pubkey))
         return false;
+    InvalidateBalanceCache();
+    fUnspentOutputsStale = true;
 
     // check if we need to remove from watch-only
     CScript script;
@@ -428,6 +590,7 @@ bool CWallet::AddSproutViewingKey(const libzcash::SproutViewingKey &vk)
     if (!CCryptoKeyStore::AddSproutViewingKey(vk)) {
         return false;
     }
+    InvalidateBalanceCache();
     nTimeFirstKey = 1; // No birthday information for viewing keys.
     if (!fFileBacked) {
         return true;
@@ -459,6 +622,11 @@ bool CWallet::AddCScript(const CScript& redeemScript)
 {
     if (!CCryptoKeyStore::AddCScript(redeemScript))
         return false;
+    InvalidateBalanceCache();
+    {
+        LOCK(cs_wallet);
+        fUnspentOutputsStale = true;
+    }
     if (!fFileBacked)
         return true;
     return CWalletDB(strWalletFile).WriteCScript(Hash160(redeemScript), redeemScript);
@@ -485,6 +653,11 @@ bool CWallet::AddWatchOnly(const CScript &dest)
 {
     if (!CCryptoKeyStore::AddWatchOnly(dest))
         return false;
+    InvalidateBalanceCache();
+    {
+        LOCK(cs_wallet);
+        fUnspentOutputsStale = true;
+    }
     nTimeFirstKey = 1; // No birthday information for watch-only keys.
     NotifyWatchonlyChanged(true);
     if (!fFileBacked)
@@ -497,6 +670,7 @@ bool CWallet::RemoveWatchOnly(const CScript &dest)
     AssertLockHeld(cs_wallet);
     if (!CCryptoKeyStore::RemoveWatchOnly(dest))
         return false;
+    InvalidateBalanceCache();
     if (!HaveWatchOnly())
         NotifyWatchonlyChanged(false);
     if (fFileBacked)
@@ -590,7 +764,11 @@ void CWallet::ChainTipAdded(const CBlockIndex *pindex,
 {
     IncrementNoteWitnesses(pindex, pblock, sproutTree, saplingTree);
     UpdateSaplingNullifierNoteMapForBlock(pblock);
+    MaybeSetBestChain(pindex);
+}
 
+void CWallet::MaybeSetBestChain(const CBlockIndex *pindex)
+{
     // SetBestChain() can be expensive for large wallets, so do only
     // this sometimes; the wallet state will be brought up to date
     // during rescanning on startup.
@@ -603,14 +781,11 @@ void CWallet::ChainTipAdded(const CBlockIndex *pindex,
             nLastSetChain + (int64_t)WITNESS_WRITE_INTERVAL * 1000000 < nNow) {
         nLastSetChain = nNow;
         nSetChainUpdates = 0;
-        CBlockLocator loc;
-        {
-            // The locator must be derived from the pindex used to increment
-            // the witnesses above; pindex can be behind chainActive.Tip().
-            LOCK(cs_main);
-            loc = chainActive.GetLocator(pindex);
-        }
-        SetBestChain(loc);
+        // The locator must be derived from the pindex used to increment
+        // the witnesses above; pindex can be behind chainActive.Tip(). It
+        // only walks the ancestors of pindex, so cs_main is not needed.
+        SetBestChain(GetLocator(pindex));
+        ArchiveSpentTxs(pindex);
     }
 }
 
@@ -626,22 +801,33 @@ void CWallet::ChainTip(const CBlockIndex *pindex,
             pblock->GetBlockTime() > GetTime() - 3 * 60 * 60)
         {
             RunSaplingMigration(pindex->nHeight);
+            RunSaplingConsolidation(pindex->nHeight);
         }
     } else {
-        DecrementNoteWitnesses(pindex);
+        // The witnesses are decremented by BlocksDisconnected, once all the
+        // disconnected blocks have been notified.
         UpdateSaplingNullifierNoteMapForBlock(pblock);
     }
 }
 
+void CWallet::BlocksDisconnected(const CBlockIndex *pindexOldTip, int nBlocks)
+{
+    DecrementNoteWitnesses(pindexOldTip, nBlocks);
+    // Outputs spent in the disconnected blocks may be unspent again.
+    LOCK(cs_wallet);
+    fUnspentOutputsStale = true;
+    const CBlockIndex* pindex = pindexOldTip;
+    for (int i = 0; i < nBlocks && pindex; i++, pindex = pindex->pprev) {
+        if (mapTxsByBlock.count(pindex->GetBlockHash())) {
+            setStaleTxBlocks.insert(pindex->GetBlockHash());
+        }
+    }
+}
+
 void CWallet::RunSaplingMigration(int blockHeight) {
     if (!Params().GetConsensus().NetworkUpgradeActive(blockHeight, Consensus::UPGRADE_SAPLING)) {
         return;
     }
-    // need cs_wallet to call CommitTransaction()
-    LOCK2(cs_main, cs_wallet);
-    if (!fSaplingMigrationEnabled) {
-        return;
-    }
     // The migration transactions to be sent in a particular batch can take
     // significant time to generate, and this time depends on the speed of the user's
     // computer. If they were generated only after a block is seen at the target
@@ -649,6 +835,10 @@ void CWallet::RunSaplingMigration(int blockHeight) {
     // height N, implementations SHOULD start generating the transactions at around
     // height N-5
     if (blockHeight % 500 == 495) {
+        LOCK(cs_wallet);
+        if (!fSaplingMigrationEnabled) {
+            return;
+        }
         std::shared_ptr<AsyncRPCQueue> q = getAsyncRPCQueue();
         std::shared_ptr<AsyncRPCOperation> lastOperation = q->getOperationForId(saplingMigrationOperationId);
         if (lastOperation != nullptr) {
@@ -659,6 +849,12 @@ void CWallet::RunSaplingMigration(int blockHeight) {
         saplingMigrationOperationId = operation->getId();
         q->addOperation(operation);
     } else if (blockHeight % 500 == 499) {
+        // need cs_main and cs_wallet to call CommitTransaction(); the other
+        // wallet notifications run without cs_main
+        LOCK2(cs_main, cs_wallet);
+        if (!fSaplingMigrationEnabled) {
+            return;
+        }
         std::shared_ptr<AsyncRPCQueue> q = getAsyncRPCQueue();
         std::shared_ptr<AsyncRPCOperation> lastOperation = q->getOperationForId(saplingMigrationOperationId);
         if (lastOperation != nullptr) {
@@ -673,6 +869,25 @@ void CWallet::RunSaplingMigration(int blockHeight) {
     }
 }
 
+void CWallet::RunSaplingConsolidation(int blockHeight) {
+    if (!Params().GetConsensus().NetworkUpgradeActive(blockHeight, Consensus::UPGRADE_SAPLING)) {
+        return;
+    }
+    LOCK(cs_wallet);
+    if (!fSaplingConsolidationEnabled || blockHeight % nSaplingConsolidationInterval != 0) {
+        return;
+    }
+    std::shared_ptr<AsyncRPCQueue> q = getAsyncRPCQueue();
+    std::shared_ptr<AsyncRPCOperation> lastOperation = q->getOperationForId(saplingConsolidationOperationId);
+    if (lastOperation != nullptr && (lastOperation->isReady() || lastOperation->isExecuting())) {
+        // Don't queue another run behind one that has not finished yet
+        return;
+    }
+    std::shared_ptr<AsyncRPCOperation> operation(new AsyncRPCOperation_saplingconsolidation(blockHeight + 1));
+    saplingConsolidationOperationId = operation->getId();
+    q->addOperation(operation);
+}
+
 void CWallet::AddPendingSaplingMigrationTx(const CTransaction& tx) {
     LOCK(cs_wallet);
     pendingSaplingMigrationTxs.push_back(tx);
@@ -862,6 +1077,47 @@ void CWallet::Flush(bool shutdown)
     bitdb.Flush(shutdown);
 }
 
+void CWallet::GetMemoryUsage(size_t& nTransactions, size_t& nWitnesses, size_t& nNotes) const
+{
+    AssertLockHeld(cs_wallet);
+
+    // A witness is held in a node of a std::list.
+    const size_t nListNodeOverhead = 2 * sizeof(void*);
+    nTransactions = memusage::DynamicUsage(mapWallet);
+    nWitnesses = 0;
+    for (const std::pair<const uint256, CWalletTx>& item : mapWallet) {
+        const CWalletTx& wtx = item.second;
+        nTransactions += RecursiveDynamicUsage(wtx) +
+            memusage::DynamicUsage(wtx.mapSproutNoteData) +
+            memusage::DynamicUsage(wtx.mapSaplingNoteData);
+        for (const auto& nd : wtx.mapSproutNoteData) {
+            for (const SproutWitness& witness : nd.second.witnesses) {
+                nWitnesses += memusage::MallocUsage(sizeof(SproutWitness) + nListNodeOverhead) +
+                    witness.DynamicMemoryUsage();
+            }
+        }
+        for (const auto& nd : wtx.mapSaplingNoteData) {
+            for (const SaplingWitness& witness : nd.second.witnesses) {
+                nWitnesses += memusage::MallocUsage(sizeof(SaplingWitness) + nListNodeOverhead) +
+                    witness.DynamicMemoryUsage();
+            }
+        }
+    }
+
+    nNotes = memusage::DynamicUsage(mapSproutNoteEntries) +
+        memusage::DynamicUsage(mapSaplingNoteEntries) +
+        memusage::DynamicUsage(mapSproutNotesByAddress) +
+        memusage::DynamicUsage(mapSaplingNotesByAddress) +
+        memusage::DynamicUsage(mapSproutNullifiersToNotes) +
+        memusage::DynamicUsage(mapSaplingNullifiersToNotes);
+    for (const auto& item : mapSproutNotesByAddress) {
+        nNotes += memusage::DynamicUsage(item.second);
+    }
+    for (const auto& item : mapSaplingNotesByAddress) {
+        nNotes += memusage::DynamicUsage(item.second);
+    }
+}
+
 bool static UIError(const std::string &str)
 {
     uiInterface.ThreadSafeMessageBox(str, "", CClientUIInterface::MSG_ERROR);
@@ -955,6 +1211,8 @@ void CWallet::SyncMetaData(pair<typename TxSpendMap<T>::iterator, typename TxSpe
     for (typename TxSpendMap<T>::iterator it = range.first; it != range.second; ++it)
     {
         const uint256& hash = it->second;
+        if (mapArchivedTxs.count(hash))
+            continue;
         int n = mapWallet[hash].nOrderPos;
         if (n < nMinOrderPos)
         {
@@ -966,6 +1224,8 @@ void CWallet::SyncMetaData(pair<typename TxSpendMap<T>::iterator, typename TxSpe
     for (typename TxSpendMap<T>::iterator it = range.first; it != range.second; ++it)
     {
         const uint256& hash = it->second;
+        if (mapArchivedTxs.count(hash))
+            continue;
         CWalletTx* copyTo = &mapWallet[hash];
         if (copyFrom == copyTo) continue;
         copyTo->mapValue = copyFrom->mapValue;
@@ -995,6 +1255,8 @@ bool CWallet::IsSpent(const uint256& hash, unsigned int n) const
     for (TxSpends::const_iterator it = range.first; it != range.second; ++it)
     {
         const uint256& wtxid = it->second;
+        if (mapArchivedTxs.count(wtxid))
+            return true; // Spent deep in the chain
         std::map<uint256, CWalletTx>::const_iterator mit = mapWallet.find(wtxid);
         if (mit != mapWallet.end() && mit->second.GetDepthInMainChain() >= 0)
             return true; // Spent
@@ -1013,6 +1275,9 @@ bool CWallet::IsSproutSpent(const uint256& nullifier) const {
 
     for (TxNullifiers::const_iterator it = range.first; it != range.second; ++it) {
         const uint256& wtxid = it->second;
+        if (mapArchivedTxs.count(wtxid)) {
+            return true; // Spent deep in the chain
+        }
         std::map<uint256, CWalletTx>::const_iterator mit = mapWallet.find(wtxid);
         if (mit != mapWallet.end() && mit->second.GetDepthInMainChain() >= 0) {
             return true; // Spent
@@ -1028,6 +1293,9 @@ bool CWallet::IsSaplingSpent(const uint256& nullifier) const {
 
     for (TxNullifiers::const_iterator it = range.first; it != range.second; ++it) {
         const uint256& wtxid = it->second;
+        if (mapArchivedTxs.count(wtxid)) {
+            return true; // Spent deep in the chain
+        }
         std::map<uint256, CWalletTx>::const_iterator mit = mapWallet.find(wtxid);
         if (mit != mapWallet.end() && mit->second.GetDepthInMainChain() >= 0) {
             return true; // Spent
@@ -1099,6 +1367,57 @@ void CWallet::ClearNoteWitnessCache()
     nWitnessCacheSize = 0;
 }
 
+template<typename NoteDataMap, typename Witness>
+void LoadNoteWitnessRecords(std::map<uint256, CWalletTx>& mapWallet, NoteDataMap CWalletTx::*noteDataMap,
+                            std::map<typename NoteDataMap::key_type, std::map<int, Witness>>& witnesses,
+                            std::map<typename NoteDataMap::key_type, std::pair<int, int>>& records,
+                            std::set<uint256>& setNoteDataDirty)
+{
+    for (auto& item : witnesses) {
+        if (item.second.empty()) {
+            continue;
+        }
+        int nOldest = item.second.begin()->first;
+        int nNewest = item.second.rbegin()->first;
+        // Records of notes that are no longer in the wallet are erased by the
+        // next SetBestChain().
+        records[item.first] = std::make_pair(nOldest, nNewest);
+
+        auto wtxIt = mapWallet.find(item.first.hash);
+        if (wtxIt == mapWallet.end() || !(wtxIt->second.*noteDataMap).count(item.first)) {
+            continue;
+        }
+        auto* nd = &((wtxIt->second.*noteDataMap).at(item.first));
+        // Only the witnesses at consecutive heights down from the newest one
+        // form a usable cache.
+        nd->witnesses.clear();
+        int nHeight = nNewest;
+        for (auto it = item.second.rbegin(); it != item.second.rend() && it->first == nHeight; it++, nHeight--) {
+            nd->witnesses.push_back(it->second);
+        }
+        nd->witnessHeight = nNewest;
+    }
+
+    // Witnesses that are still in the transaction records (written by an
+    // older version) are moved to witness records.
+    for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
+        for (auto& item : wtxItem.second.*noteDataMap) {
+            if (!item.second.witnesses.empty() && !records.count(item.first)) {
+                setNoteDataDirty.insert(wtxItem.first);
+            }
+        }
+    }
+}
+
+void CWallet::LoadNoteWitnesses(
+    std::map<JSOutPoint, std::map<int, SproutWitness>>& sproutWitnesses,
+    std::map<SaplingOutPoint, std::map<int, SaplingWitness>>& saplingWitnesses)
+{
+    AssertLockHeld(cs_wallet);
+    ::LoadNoteWitnessRecords(mapWallet, &CWalletTx::mapSproutNoteData, sproutWitnesses, mapSproutWitnessRecords, setNoteDataDirty);
+    ::LoadNoteWitnessRecords(mapWallet, &CWalletTx::mapSaplingNoteData, saplingWitnesses, mapSaplingWitnessRecords, setNoteDataDirty);
+}
+
 template<typename NoteDataMap>
 void CopyPreviousWitnesses(NoteDataMap& noteDataMap, int indexHeight, int64_t nWitnessCacheSize)
 {
@@ -1126,18 +1445,77 @@ void CopyPreviousWitnesses(NoteDataMap& noteDataMap, int indexHeight, int64_t nW
     }
 }
 
-template<typename NoteDataMap>
-void AppendNoteCommitment(NoteDataMap& noteDataMap, int indexHeight, int64_t nWitnessCacheSize, const uint256& note_commitment)
+bool CNoteWitnessAppend::operator()()
 {
-    for (auto& item : noteDataMap) {
-        auto* nd = &(item.second);
-        if (nd->witnessHeight < indexHeight && nd->witnesses.size() > 0) {
-            // Check the validity of the cache
-            // See comment in CopyPreviousWitnesses about validity.
-            assert(nWitnessCacheSize >= nd->witnesses.size());
-            nd->witnesses.front().append(note_commitment);
+    try {
+        if (psproutCommitments) {
+            SproutWitness::append_all(sproutWitnesses, *psproutCommitments);
+        }
+        if (psaplingCommitments) {
+            SaplingWitness::append_all(saplingWitnesses, *psaplingCommitments);
         }
+    } catch (const std::exception& e) {
+        LogPrintf("CNoteWitnessAppend(): %s\n", e.what());
+        return false;
     }
+    return true;
+}
+
+static CCheckQueue<CNoteWitnessAppend> witnessupdatequeue(1);
+
+void ThreadNoteWitnessUpdate() {
+    RenameThread("zcash-witness");
+    witnessupdatequeue.Thread();
+}
+
+/**
+ * Append the pending note commitments to the latest witness of every note in
+ * the wallet that is behind indexHeight, and clear them. The witnesses share
+ * the work of hashing the commitments (see IncrementalWitness::append_all),
+ * so commitments should be batched up until the next note of ours, or the
+ * end of the block. If nWitnessUpdateThreads is set, the witnesses are split
+ * into shards that are updated concurrently.
+ */
+template<typename NoteDataMap, typename Hash>
+void AppendNoteCommitments(std::map<uint256, CWalletTx>& mapWallet, NoteDataMap CWalletTx::*noteDataMap,
+                           int indexHeight, int64_t nWitnessCacheSize, std::vector<Hash>& note_commitments)
+{
+    using Witness = typename decltype(NoteDataMap::mapped_type::witnesses)::value_type;
+
+    if (note_commitments.empty()) {
+        return;
+    }
+
+    std::vector<Witness*> witnesses;
+    for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
+        for (auto& item : wtxItem.second.*noteDataMap) {
+            auto* nd = &(item.second);
+            if (nd->witnessHeight < indexHeight && nd->witnesses.size() > 0) {
+                // Check the validity of the cache
+                // See comment in CopyPreviousWitnesses about validity.
+                assert(nWitnessCacheSize >= nd->witnesses.size());
+                witnesses.push_back(&nd->witnesses.front());
+            }
+        }
+    }
+
+    size_t nJobs = std::min((size_t)nWitnessUpdateThreads, witnesses.size() / WITNESS_UPDATE_WITNESSES_PER_JOB);
+    if (nJobs > 1) {
+        std::vector<CNoteWitnessAppend> vJobs;
+        for (size_t nJob = 0; nJob < nJobs; nJob++) {
+            auto begin = witnesses.begin() + (witnesses.size() * nJob) / nJobs;
+            auto end = witnesses.begin() + (witnesses.size() * (nJob + 1)) / nJobs;
+            vJobs.emplace_back(std::vector<Witness*>(begin, end), note_commitments);
+        }
+        CCheckQueueControl<CNoteWitnessAppend> control(&witnessupdatequeue);
+        control.Add(vJobs);
+        if (!control.Wait()) {
+            throw std::runtime_error("AppendNoteCommitments(): failed to append note commitments");
+        }
+    } else {
+        Witness::append_all(witnesses, note_commitments);
+    }
+    note_commitments.clear();
 }
 
 template<typename OutPoint, typename NoteData, typename Witness>
@@ -1196,6 +1574,7 @@ void CWallet::IncrementNoteWitnesses(const CBlockIndex* pindex,
        ::CopyPreviousWitnesses(wtxItem.second.mapSaplingNoteData, pindex->nHeight, nWitnessCacheSize);
     }
 
+    nWitnessesDirtyHeight = std::min(nWitnessesDirtyHeight, pindex->nHeight);
     if (nWitnessCacheSize < WITNESS_CACHE_SIZE) {
         nWitnessCacheSize += 1;
     }
@@ -1207,6 +1586,10 @@ void CWallet::IncrementNoteWitnesses(const CBlockIndex* pindex,
         pblock = &block;
     }
 
+    // Commitments that have not yet been appended to existing witnesses
+    std::vector<SHA256Compress> sproutCommitments;
+    std::vector<PedersenHash> saplingCommitments;
+
     for (const CTransaction& tx : pblock->vtx) {
         auto hash = tx.GetHash();
         bool txIsOurs = mapWallet.count(hash);
@@ -1216,15 +1599,13 @@ void CWallet::IncrementNoteWitnesses(const CBlockIndex* pindex,
             for (uint8_t j = 0; j < jsdesc.commitments.size(); j++) {
                 const uint256& note_commitment = jsdesc.commitments[j];
                 sproutTree.append(note_commitment);
+                sproutCommitments.push_back(note_commitment);
 
-                // Increment existing witnesses
-                for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
-                    ::AppendNoteCommitment(wtxItem.second.mapSproutNoteData, pindex->nHeight, nWitnessCacheSize, note_commitment);
-                }
-
-                // If this is our note, witness it
-                if (txIsOurs) {
-                    JSOutPoint jsoutpt {hash, i, j};
+                // If this is our note, bring existing witnesses up to date
+                // and witness it
+                JSOutPoint jsoutpt {hash, i, j};
+                if (txIsOurs && mapWallet[hash].mapSproutNoteData.count(jsoutpt)) {
+                    ::AppendNoteCommitments(mapWallet, &CWalletTx::mapSproutNoteData, pindex->nHeight, nWitnessCacheSize, sproutCommitments);
                     ::WitnessNoteIfMine(mapWallet[hash].mapSproutNoteData, pindex->nHeight, nWitnessCacheSize, jsoutpt, sproutTree.witness());
                 }
             }
@@ -1233,20 +1614,22 @@ void CWallet::IncrementNoteWitnesses(const CBlockIndex* pindex,
         for (uint32_t i = 0; i < tx.vShieldedOutput.size(); i++) {
             const uint256& note_commitment = tx.vShieldedOutput[i].cmu;
             saplingTree.append(note_commitment);
+            saplingCommitments.push_back(note_commitment);
 
-            // Increment existing witnesses
-            for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
-                ::AppendNoteCommitment(wtxItem.second.mapSaplingNoteData, pindex->nHeight, nWitnessCacheSize, note_commitment);
-            }
-
-            // If this is our note, witness it
-            if (txIsOurs) {
-                SaplingOutPoint outPoint {hash, i};
+            // If this is our note, bring existing witnesses up to date and
+            // witness it
+            SaplingOutPoint outPoint {hash, i};
+            if (txIsOurs && mapWallet[hash].mapSaplingNoteData.count(outPoint)) {
+                ::AppendNoteCommitments(mapWallet, &CWalletTx::mapSaplingNoteData, pindex->nHeight, nWitnessCacheSize, saplingCommitments);
                 ::WitnessNoteIfMine(mapWallet[hash].mapSaplingNoteData, pindex->nHeight, nWitnessCacheSize, outPoint, saplingTree.witness());
             }
         }
     }
 
+    // Increment existing witnesses
+    ::AppendNoteCommitments(mapWallet, &CWalletTx::mapSproutNoteData, pindex->nHeight, nWitnessCacheSize, sproutCommitments);
+    ::AppendNoteCommitments(mapWallet, &CWalletTx::mapSaplingNoteData, pindex->nHeight, nWitnessCacheSize, saplingCommitments);
+
     // Update witness heights
     for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
         ::UpdateWitnessHeights(wtxItem.second.mapSproutNoteData, pindex->nHeight, nWitnessCacheSize);
@@ -1258,12 +1641,63 @@ void CWallet::IncrementNoteWitnesses(const CBlockIndex* pindex,
     // of the wallet.dat is maintained).
 }
 
+void CWallet::IncrementNoteWitnesses(const CBlockIndex* pindex,
+                                     const CCompactBlock& block,
+                                     SaplingMerkleTree& saplingTree)
+{
+    LOCK(cs_wallet);
+    for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
+       ::CopyPreviousWitnesses(wtxItem.second.mapSproutNoteData, pindex->nHeight, nWitnessCacheSize);
+       ::CopyPreviousWitnesses(wtxItem.second.mapSaplingNoteData, pindex->nHeight, nWitnessCacheSize);
+    }
+
+    nWitnessesDirtyHeight = std::min(nWitnessesDirtyHeight, pindex->nHeight);
+    if (nWitnessCacheSize < WITNESS_CACHE_SIZE) {
+        nWitnessCacheSize += 1;
+    }
+
+    // Commitments that have not yet been appended to existing witnesses
+    std::vector<PedersenHash> saplingCommitments;
+
+    for (const CCompactTx& tx : block.vtx) {
+        bool txIsOurs = mapWallet.count(tx.hash);
+        for (uint32_t i = 0; i < tx.vSaplingOutputs.size(); i++) {
+            const uint256& note_commitment = tx.vSaplingOutputs[i].cmu;
+            saplingTree.append(note_commitment);
+            saplingCommitments.push_back(note_commitment);
+
+            // If this is our note, bring existing witnesses up to date and
+            // witness it
+            SaplingOutPoint outPoint {tx.hash, i};
+            if (txIsOurs && mapWallet[tx.hash].mapSaplingNoteData.count(outPoint)) {
+                ::AppendNoteCommitments(mapWallet, &CWalletTx::mapSaplingNoteData, pindex->nHeight, nWitnessCacheSize, saplingCommitments);
+                ::WitnessNoteIfMine(mapWallet[tx.hash].mapSaplingNoteData, pindex->nHeight, nWitnessCacheSize, outPoint, saplingTree.witness());
+            }
+        }
+    }
+
+    // Increment existing witnesses
+    ::AppendNoteCommitments(mapWallet, &CWalletTx::mapSaplingNoteData, pindex->nHeight, nWitnessCacheSize, saplingCommitments);
+
+    // Update witness heights
+    for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
+        ::UpdateWitnessHeights(wtxItem.second.mapSproutNoteData, pindex->nHeight, nWitnessCacheSize);
+        ::UpdateWitnessHeights(wtxItem.second.mapSaplingNoteData, pindex->nHeight, nWitnessCacheSize);
+    }
+}
+
+/**
+ * Decrement the witnesses for the nBlocks blocks from indexHeight down, as
+ * if they were decremented for each of the blocks in turn.
+ */
 template<typename NoteDataMap>
-void DecrementNoteWitnesses(NoteDataMap& noteDataMap, int indexHeight, int64_t nWitnessCacheSize)
+void DecrementNoteWitnesses(NoteDataMap& noteDataMap, int indexHeight, int nBlocks, int64_t nWitnessCacheSize)
 {
     for (auto& item : noteDataMap) {
         auto* nd = &(item.second);
-        // Only decrement witnesses that are not above the current height
+        // Only decrement witnesses that are not above the current height.
+        // Those that are decremented for the first block are decremented
+        // for each of the others as well.
         if (nd->witnessHeight <= indexHeight) {
             // Check the validity of the cache
             // See comment below (this would be invalid if there were a
@@ -1273,12 +1707,12 @@ void DecrementNoteWitnesses(NoteDataMap& noteDataMap, int indexHeight, int64_t n
             // (never incremented or decremented) or equal to the height
             // of the block being removed (indexHeight)
             assert((nd->witnessHeight == -1) || (nd->witnessHeight == indexHeight));
-            if (nd->witnesses.size() > 0) {
-                nd->witnesses.pop_front();
-            }
-            // indexHeight is the height of the block being removed, so 
-            // the new witness cache height is one below it.
-            nd->witnessHeight = indexHeight - 1;
+            auto itEnd = nd->witnesses.begin();
+            std::advance(itEnd, std::min<size_t>(nBlocks, nd->witnesses.size()));
+            nd->witnesses.erase(nd->witnesses.begin(), itEnd);
+            // indexHeight is the height of the highest block being removed,
+            // so the new witness cache height is nBlocks below it.
+            nd->witnessHeight = indexHeight - nBlocks;
         }
         // Check the validity of the cache
         // Technically if there are notes witnessed above the current
@@ -1290,22 +1724,24 @@ void DecrementNoteWitnesses(NoteDataMap& noteDataMap, int indexHeight, int64_t n
         // We don't set nWitnessCacheSize to zero at the start of the
         // reindex because the on-disk blocks had already resulted in a
         // chain that didn't trigger the assertion below.
-        if (nd->witnessHeight < indexHeight) {
-            // Subtract 1 to compare to what nWitnessCacheSize will be after
-            // decrementing.
-            assert((nWitnessCacheSize - 1) >= nd->witnesses.size());
+        if (nd->witnessHeight < indexHeight - nBlocks + 1) {
+            // Subtract nBlocks to compare to what nWitnessCacheSize will be
+            // after decrementing.
+            assert((nWitnessCacheSize - nBlocks) >= nd->witnesses.size());
         }
     }
 }
 
-void CWallet::DecrementNoteWitnesses(const CBlockIndex* pindex)
+void CWallet::DecrementNoteWitnesses(const CBlockIndex* pindex, int nBlocks)
 {
+    assert(nBlocks > 0);
     LOCK(cs_wallet);
     for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
-        ::DecrementNoteWitnesses(wtxItem.second.mapSproutNoteData, pindex->nHeight, nWitnessCacheSize);
-        ::DecrementNoteWitnesses(wtxItem.second.mapSaplingNoteData, pindex->nHeight, nWitnessCacheSize);
+        ::DecrementNoteWitnesses(wtxItem.second.mapSproutNoteData, pindex->nHeight, nBlocks, nWitnessCacheSize);
+        ::DecrementNoteWitnesses(wtxItem.second.mapSaplingNoteData, pindex->nHeight, nBlocks, nWitnessCacheSize);
     }
-    nWitnessCacheSize -= 1;
+    nWitnessesDirtyHeight = std::min(nWitnessesDirtyHeight, pindex->nHeight - nBlocks + 1);
+    nWitnessCacheSize -= nBlocks;
     // TODO: If nWitnessCache is zero, we need to regenerate the caches (#1302)
     assert(nWitnessCacheSize > 0);
 
@@ -1442,12 +1878,99 @@ CWallet::TxItems CWallet::OrderedTxItems(std::list<CAccountingEntry>& acentries,
     return txOrdered;
 }
 
+const std::multimap<int64_t, CWalletTx*>& CWallet::GetOrderedTxs()
+{
+    AssertLockHeld(cs_wallet);
+    if (fOrderedTxsStale) {
+        mapOrderedTxs.clear();
+        for (std::pair<const uint256, CWalletTx>& item : mapWallet) {
+            mapOrderedTxs.insert(std::make_pair(item.second.nOrderPos, &item.second));
+        }
+        fOrderedTxsStale = false;
+    }
+    return mapOrderedTxs;
+}
+
+void CWallet::MarkOrderedTxsStale()
+{
+    AssertLockHeld(cs_wallet);
+    fOrderedTxsStale = true;
+}
+
+void CWallet::AddToTxsByBlock(const uint256& hashBlock, const uint256& hash)
+{
+    mapTxsByBlock[hashBlock].insert(hash);
+}
+
+void CWallet::EraseFromTxsByBlock(const uint256& hashBlock, const uint256& hash)
+{
+    auto it = mapTxsByBlock.find(hashBlock);
+    if (it != mapTxsByBlock.end()) {
+        it->second.erase(hash);
+        if (it->second.empty()) {
+            mapTxsByBlock.erase(it);
+            setStaleTxBlocks.erase(hashBlock);
+        }
+    }
+}
+
+std::set<uint256> CWallet::GetTxsSinceBlock(const CBlockIndex* pindex)
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+
+    if (fStaleTxBlocksUnknown) {
+        for (const auto& item : mapTxsByBlock) {
+            if (!item.first.IsNull()) {
+                BlockMap::const_iterator mi = mapBlockIndex.find(item.first);
+                if (mi == mapBlockIndex.end() || !chainActive.Contains(mi->second)) {
+                    setStaleTxBlocks.insert(item.first);
+                }
+            }
+        }
+        fStaleTxBlocksUnknown = false;
+    }
+
+    std::set<uint256> txids;
+    auto addBlock = [&](const uint256& hashBlock) {
+        auto it = mapTxsByBlock.find(hashBlock);
+        if (it != mapTxsByBlock.end()) {
+            txids.insert(it->second.begin(), it->second.end());
+        }
+    };
+
+    // Blocks of the active chain after the fork, and of the branch of
+    // pindex, if it is no longer in the active chain.
+    const CBlockIndex* pfork = chainActive.FindFork(pindex);
+    for (int nHeight = pfork ? pfork->nHeight + 1 : 0; nHeight <= chainActive.Height(); nHeight++) {
+        addBlock(chainActive[nHeight]->GetBlockHash());
+    }
+    for (const CBlockIndex* p = pindex; p && p != pfork; p = p->pprev) {
+        addBlock(p->GetBlockHash());
+    }
+
+    // Blocks that left the active chain, unless they are back in it.
+    for (auto it = setStaleTxBlocks.begin(); it != setStaleTxBlocks.end(); ) {
+        BlockMap::const_iterator mi = mapBlockIndex.find(*it);
+        if (mi != mapBlockIndex.end() && chainActive.Contains(mi->second)) {
+            it = setStaleTxBlocks.erase(it);
+        } else {
+            addBlock(*it);
+            ++it;
+        }
+    }
+
+    addBlock(uint256());
+    return txids;
+}
+
 void CWallet::MarkDirty()
 {
     {
         LOCK(cs_wallet);
         for (std::pair<const uint256, CWalletTx>& item : mapWallet)
             item.second.MarkDirty();
+        InvalidateBalanceCache();
     }
 }
 
@@ -1479,6 +2002,7 @@ bool CWallet::UpdateNullifierNoteMap()
                             dec,
                             hSig,
                             item.first.n);
+                        setNoteDataDirty.insert(wtxItem.first);
                     }
                 }
             }
@@ -1488,6 +2012,7 @@ bool CWallet::UpdateNullifierNoteMap()
 
             UpdateNullifierNoteMapWithTx(wtxItem.second);
         }
+        InvalidateBalanceCache();
     }
     return true;
 }
@@ -1514,6 +2039,78 @@ void CWallet::UpdateNullifierNoteMapWithTx(const CWalletTx& wtx)
     }
 }
 
+/**
+ * Add the notes of this tx to mapSproutNotesByAddress and
+ * mapSaplingNotesByAddress, decrypting its Sapling notes unless they
+ * have already been loaded.
+ */
+void CWallet::IndexNotes(const CWalletTx& wtx)
+{
+    LOCK(cs_wallet);
+
+    for (const mapSproutNoteData_t::value_type& item : wtx.mapSproutNoteData) {
+        mapSproutNotesByAddress[item.second.address].insert(item.first);
+    }
+
+    bool fDecrypted = true;
+    for (const mapSaplingNoteData_t::value_type& item : wtx.mapSaplingNoteData) {
+        if (!mapSaplingNoteEntries.count(item.first)) {
+            fDecrypted = false;
+        }
+    }
+    if (!fDecrypted) {
+        for (const SaplingNoteEntry& entry : wtx.DecryptSaplingNoteEntries()) {
+            LoadSaplingNoteEntry(entry);
+        }
+    }
+
+    for (const mapSaplingNoteData_t::value_type& item : wtx.mapSaplingNoteData) {
+        mapSaplingNotesByAddress[mapSaplingNoteEntries.at(item.first).address].insert(item.first);
+    }
+}
+
+void CWallet::LoadSaplingNoteEntry(const SaplingNoteEntry& entry)
+{
+    LOCK(cs_wallet);
+    mapSaplingNoteEntries.erase(entry.op);
+    mapSaplingNoteEntries.emplace(entry.op, entry);
+}
+
+/**
+ * Remove the notes of this tx from mapSproutNotesByAddress and
+ * mapSaplingNotesByAddress, along with their decrypted entries.
+ */
+void CWallet::UnindexNotes(const CWalletTx& wtx)
+{
+    LOCK(cs_wallet);
+
+    for (const mapSproutNoteData_t::value_type& item : wtx.mapSproutNoteData) {
+        auto it = mapSproutNotesByAddress.find(item.second.address);
+        if (it != mapSproutNotesByAddress.end()) {
+            it->second.erase(item.first);
+            if (it->second.empty()) {
+                mapSproutNotesByAddress.erase(it);
+            }
+        }
+        mapSproutNoteEntries.erase(item.first);
+    }
+
+    for (const mapSaplingNoteData_t::value_type& item : wtx.mapSaplingNoteData) {
+        auto entry = mapSaplingNoteEntries.find(item.first);
+        if (entry == mapSaplingNoteEntries.end()) {
+            continue;
+        }
+        auto it = mapSaplingNotesByAddress.find(entry->second.address);
+        if (it != mapSaplingNotesByAddress.end()) {
+            it->second.erase(item.first);
+            if (it->second.empty()) {
+                mapSaplingNotesByAddress.erase(it);
+            }
+        }
+        mapSaplingNoteEntries.erase(entry);
+    }
+}
+
 /**
  * Update mapSaplingNullifiersToNotes, computing the nullifier from a cached witness if necessary.
  */
@@ -1528,27 +2125,36 @@ void CWallet::UpdateSaplingNullifierNoteMapWithTx(CWalletTx& wtx) {
             // If there are no witnesses, erase the nullifier and associated mapping.
             if (item.second.nullifier) {
                 mapSaplingNullifiersToNotes.erase(item.second.nullifier.value());
+                setNoteDataDirty.insert(wtx.GetHash());
             }
             item.second.nullifier = std::nullopt;
         }
         else {
             uint64_t position = nd.witnesses.front().position();
             auto extfvk = mapSaplingFullViewingKeys.at(nd.ivk);
-            OutputDescription output = wtx.vShieldedOutput[op.n];
 
-            auto optDeserialized = SaplingNotePlaintext::attempt_sapling_enc_decryption_deserialization(output.encCiphertext, nd.ivk, output.ephemeralKey);
+            // Use the note decrypted when the tx was indexed if there is one.
+            std::optional<SaplingNote> optNote;
+            auto entry = mapSaplingNoteEntries.find(op);
+            if (entry != mapSaplingNoteEntries.end()) {
+                optNote = entry->second.note;
+            } else {
+                OutputDescription output = wtx.vShieldedOutput[op.n];
+
+                auto optDeserialized = SaplingNotePlaintext::attempt_sapling_enc_decryption_deserialization(output.encCiphertext, nd.ivk, output.ephemeralKey);
 
-            // The transaction would not have entered the wallet unless
-            // its plaintext had been successfully decrypted previously.
-            assert(optDeserialized != std::nullopt);
+                // The transaction would not have entered the wallet unless
+                // its plaintext had been successfully decrypted previously.
+                assert(optDeserialized != std::nullopt);
 
-            auto optPlaintext = SaplingNotePlaintext::plaintext_checks_without_height(*optDeserialized, nd.ivk, output.ephemeralKey, output.cmu);
+                auto optPlaintext = SaplingNotePlaintext::plaintext_checks_without_height(*optDeserialized, nd.ivk, output.ephemeralKey, output.cmu);
 
-            // An item in mapSaplingNoteData must have already been successfully decrypted,
-            // otherwise the item would not exist in the first place.
-            assert(optPlaintext != std::nullopt);
+                // An item in mapSaplingNoteData must have already been successfully decrypted,
+                // otherwise the item would not exist in the first place.
+                assert(optPlaintext != std::nullopt);
 
-            auto optNote = optPlaintext.value().note(nd.ivk);
+                optNote = optPlaintext.value().note(nd.ivk);
+            }
             assert(optNote != std::nullopt);
 
             auto optNullifier = optNote.value().nullifier(extfvk.fvk, position);
@@ -1556,6 +2162,9 @@ void CWallet::UpdateSaplingNullifierNoteMapWithTx(CWalletTx& wtx) {
             assert(optNullifier != std::nullopt);
             uint256 nullifier = optNullifier.value();
             mapSaplingNullifiersToNotes[nullifier] = op;
+            if (item.second.nullifier != nullifier) {
+                setNoteDataDirty.insert(wtx.GetHash());
+            }
             item.second.nullifier = nullifier;
         }
     }
@@ -1583,10 +2192,18 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletD
 
     if (fFromLoadWallet)
     {
+        if (mapWallet.count(hash)) {
+            UnindexNotes(mapWallet[hash]);
+            EraseFromTxsByBlock(mapWallet[hash].hashBlock, hash);
+        }
         mapWallet[hash] = wtxIn;
         mapWallet[hash].BindWallet(this);
         UpdateNullifierNoteMapWithTx(mapWallet[hash]);
+        IndexNotes(mapWallet[hash]);
         AddToSpends(hash);
+        AddUnspentOutputs(mapWallet[hash]);
+        AddToTxsByBlock(wtxIn.hashBlock, hash);
+        fOrderedTxsStale = true;
     }
     else
     {
@@ -1648,15 +2265,25 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletD
                              wtxIn.hashBlock.ToString());
             }
             AddToSpends(hash);
+            AddUnspentOutputs(wtx);
+            AddToTxsByBlock(wtx.hashBlock, hash);
+            // The new transaction has the highest position so far.
+            if (!fOrderedTxsStale) {
+                mapOrderedTxs.insert(mapOrderedTxs.end(), std::make_pair(wtx.nOrderPos, &wtx));
+            }
         }
 
         bool fUpdated = false;
         if (!fInsertedNew)
         {
+            UnindexNotes(wtx);
+
             // Merge
             if (!wtxIn.hashBlock.IsNull() && wtxIn.hashBlock != wtx.hashBlock)
             {
+                EraseFromTxsByBlock(wtx.hashBlock, hash);
                 wtx.hashBlock = wtxIn.hashBlock;
+                AddToTxsByBlock(wtx.hashBlock, hash);
                 fUpdated = true;
             }
             if (wtxIn.nIndex != -1 && (wtxIn.vMerkleBranch != wtx.vMerkleBranch || wtxIn.nIndex != wtx.nIndex))
@@ -1674,6 +2301,7 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletD
                 fUpdated = true;
             }
         }
+        IndexNotes(wtx);
 
         //// debug print
         LogPrintf("AddToWallet %s  %s%s\n", wtxIn.GetHash().ToString(), (fInsertedNew ? "new" : ""), (fUpdated ? "update" : ""));
@@ -1685,6 +2313,7 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletD
 
         // Break debit/credit balance caches:
         wtx.MarkDirty();
+        InvalidateBalanceCache();
 
         // Notify UI of new or updated transaction
         NotifyTransactionChanged(this, hash, fInsertedNew ? CT_NEW : CT_UPDATED);
@@ -1755,10 +2384,23 @@ bool CWallet::AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pbl
 {
     {
         AssertLockHeld(cs_wallet);
+        if (IsArchivedTx(tx.GetHash()) && (!fUpdate || !UnarchiveTx(tx.GetHash()))) return false;
+        bool fExisted = mapWallet.count(tx.GetHash()) != 0;
+        if (fExisted && !fUpdate) return false;
+        return AddToWalletIfInvolvingMe(tx, pblock, nHeight, fUpdate, FindMySaplingNotes(tx, nHeight));
+    }
+}
+
+bool CWallet::AddToWalletIfInvolvingMe(
+    const CTransaction& tx, const CBlock* pblock, const int nHeight, bool fUpdate,
+    const std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap>& saplingNoteDataAndAddressesToAdd)
+{
+    {
+        AssertLockHeld(cs_wallet);
+        if (IsArchivedTx(tx.GetHash()) && (!fUpdate || !UnarchiveTx(tx.GetHash()))) return false;
         bool fExisted = mapWallet.count(tx.GetHash()) != 0;
         if (fExisted && !fUpdate) return false;
         auto sproutNoteData = FindMySproutNotes(tx);
-        auto saplingNoteDataAndAddressesToAdd = FindMySaplingNotes(tx, nHeight);
         auto saplingNoteData = saplingNoteDataAndAddressesToAdd.first;
         auto addressesToAdd = saplingNoteDataAndAddressesToAdd.second;
         for (const auto &addressToAdd : addressesToAdd) {
@@ -1803,6 +2445,8 @@ void CWallet::SyncTransaction(const CTransaction& tx, const CBlock* pblock, cons
 
 void CWallet::MarkAffectedTransactionsDirty(const CTransaction& tx)
 {
+    InvalidateBalanceCache();
+
     // If a transaction changes 'conflicted' state, that changes the balance
     // available of the outputs it spends. So force those to be
     // recomputed, also:
@@ -1835,12 +2479,228 @@ void CWallet::EraseFromWallet(const uint256 &hash)
         return;
     {
         LOCK(cs_wallet);
-        if (mapWallet.erase(hash))
+        auto it = mapWallet.find(hash);
+        if (it != mapWallet.end()) {
+            UnindexNotes(it->second);
+            EraseFromTxsByBlock(it->second.hashBlock, hash);
+            mapWallet.erase(it);
+            // The outputs it spent may be unspent again.
+            fUnspentOutputsStale = true;
+            fOrderedTxsStale = true;
             CWalletDB(strWalletFile).EraseTx(hash);
+        }
+        InvalidateBalanceCache();
     }
     return;
 }
 
+CArchivedWalletTx::CArchivedWalletTx(const CWalletTx& wtx, const CKeyStore& keystore)
+{
+    if (!wtx.IsCoinBase()) {
+        for (const CTxIn& txin : wtx.vin) {
+            vPrevouts.push_back(txin.prevout);
+        }
+    }
+    for (const JSDescription& jsdesc : wtx.vJoinSplit) {
+        vSproutNullifiers.insert(vSproutNullifiers.end(), jsdesc.nullifiers.begin(), jsdesc.nullifiers.end());
+    }
+    for (const SpendDescription& spend : wtx.vShieldedSpend) {
+        vSaplingNullifiers.push_back(spend.nullifier);
+    }
+    for (uint32_t i = 0; i < wtx.vout.size(); i++) {
+        if (::IsMine(keystore, wtx.vout[i].scriptPubKey) != ISMINE_NO) {
+            mapOurOutputs.emplace(i, wtx.vout[i]);
+        }
+    }
+}
+
+bool CWallet::IsArchivedTx(const uint256& hash) const
+{
+    LOCK(cs_wallet);
+    return mapArchivedTxs.count(hash) != 0;
+}
+
+size_t CWallet::GetArchivedTxCount() const
+{
+    LOCK(cs_wallet);
+    return mapArchivedTxs.size();
+}
+
+const CTxOut* CWallet::GetArchivedOutput(const COutPoint& outpoint) const
+{
+    AssertLockHeld(cs_wallet);
+    auto it = mapArchivedTxs.find(outpoint.hash);
+    if (it == mapArchivedTxs.end()) {
+        return NULL;
+    }
+    auto itOutput = it->second.mapOurOutputs.find(outpoint.n);
+    return itOutput == it->second.mapOurOutputs.end() ? NULL : &itOutput->second;
+}
+
+bool CWallet::GetArchivedTx(const uint256& hash, CWalletTx& wtx)
+{
+    LOCK(cs_wallet);
+    if (!fFileBacked || !mapArchivedTxs.count(hash)) {
+        return false;
+    }
+    if (!CWalletDB(strWalletFile, "r").ReadArchivedTx(hash, wtx)) {
+        return error("%s: unable to read archived transaction %s", __func__, hash.ToString());
+    }
+    wtx.BindWallet(this);
+    return true;
+}
+
+void CWallet::LoadArchivedTx(const uint256& hash, const CArchivedWalletTx& archived)
+{
+    LOCK(cs_wallet);
+    // If the transaction record was not erased when it was archived, the
+    // transaction stays in memory until it is archived again.
+    if (mapWallet.count(hash)) {
+        return;
+    }
+    mapArchivedTxs[hash] = archived;
+    for (const COutPoint& prevout : archived.vPrevouts) {
+        AddToTransparentSpends(prevout, hash);
+    }
+    for (const uint256& nullifier : archived.vSproutNullifiers) {
+        AddToSproutSpends(nullifier, hash);
+    }
+    for (const uint256& nullifier : archived.vSaplingNullifiers) {
+        AddToSaplingSpends(nullifier, hash);
+    }
+}
+
+bool CWallet::IsArchivable(const CWalletTx& wtx, const CBlockIndex* pindexTip) const
+{
+    AssertLockHeld(cs_wallet);
+    if (wtx.GetDepthInChain(pindexTip) < nArchiveDepth) {
+        return false;
+    }
+
+    // Whether one of the transactions in range, which spend an output or a
+    // note of wtx, is archived or is at least as deep as wtx has to be.
+    auto SpentDeep = [&](auto range) {
+        for (auto it = range.first; it != range.second; ++it) {
+            if (mapArchivedTxs.count(it->second)) {
+                return true;
+            }
+            auto mit = mapWallet.find(it->second);
+            if (mit != mapWallet.end() && mit->second.GetDepthInChain(pindexTip) >= nArchiveDepth) {
+                return true;
+            }
+        }
+        return false;
+    };
+
+    uint256 hash = wtx.GetHash();
+    for (uint32_t i = 0; i < wtx.vout.size(); i++) {
+        if (IsMine(wtx.vout[i]) != ISMINE_NO && !SpentDeep(mapTxSpends.equal_range(COutPoint(hash, i)))) {
+            return false;
+        }
+    }
+    for (const mapSproutNoteData_t::value_type& item : wtx.mapSproutNoteData) {
+        if (!item.second.nullifier || !SpentDeep(mapTxSproutNullifiers.equal_range(*item.second.nullifier))) {
+            return false;
+        }
+    }
+    for (const mapSaplingNoteData_t::value_type& item : wtx.mapSaplingNoteData) {
+        if (!item.second.nullifier || !SpentDeep(mapTxSaplingNullifiers.equal_range(*item.second.nullifier))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+size_t CWallet::ArchiveSpentTxs(const CBlockIndex* pindexTip)
+{
+    if (nArchiveDepth <= 0 || !fFileBacked || pindexTip == nullptr) {
+        return 0;
+    }
+    LOCK(cs_wallet);
+
+    std::vector<uint256> vArchive;
+    for (const std::pair<const uint256, CWalletTx>& item : mapWallet) {
+        if (IsArchivable(item.second, pindexTip)) {
+            vArchive.push_back(item.first);
+        }
+    }
+    if (vArchive.empty()) {
+        return 0;
+    }
+
+    CWalletDB walletdb(strWalletFile);
+    size_t nArchived = 0;
+    for (const uint256& hash : vArchive) {
+        auto it = mapWallet.find(hash);
+        const CWalletTx& wtx = it->second;
+        CArchivedWalletTx archived(wtx, *this);
+        // The transaction record is erased after the archive record is
+        // written, so that one of them is always there.
+        if (!walletdb.WriteArchivedTx(hash, archived, wtx) || !walletdb.EraseTx(hash)) {
+            LogPrintf("%s: unable to archive transaction %s\n", __func__, hash.ToString());
+            break;
+        }
+
+        // Its notes are all spent, so they leave the note indexes with it.
+        UnindexNotes(wtx);
+        for (const mapSproutNoteData_t::value_type& item : wtx.mapSproutNoteData) {
+            mapSproutNullifiersToNotes.erase(*item.second.nullifier);
+        }
+        for (const mapSaplingNoteData_t::value_type& item : wtx.mapSaplingNoteData) {
+            mapSaplingNullifiersToNotes.erase(*item.second.nullifier);
+        }
+        EraseFromTxsByBlock(wtx.hashBlock, hash);
+        mapRequestCount.erase(hash);
+        setNoteDataDirty.erase(hash);
+        mapWallet.erase(it);
+        mapArchivedTxs.emplace(hash, std::move(archived));
+        nArchived++;
+    }
+    fUnspentOutputsStale = true;
+    fOrderedTxsStale = true;
+    InvalidateBalanceCache();
+    LogPrintf("%s: archived %u fully spent transactions, %u are in memory\n", __func__, nArchived, mapWallet.size());
+    return nArchived;
+}
+
+bool CWallet::UnarchiveTx(const uint256& hash)
+{
+    AssertLockHeld(cs_wallet);
+    auto it = mapArchivedTxs.find(hash);
+    if (it == mapArchivedTxs.end()) {
+        return false;
+    }
+    CWalletDB walletdb(strWalletFile);
+    CWalletTx wtx;
+    if (!walletdb.ReadArchivedTx(hash, wtx)) {
+        return error("%s: unable to read archived transaction %s", __func__, hash.ToString());
+    }
+
+    // AddToWallet adds the spends of the transaction again.
+    auto EraseSpends = [&](auto& spends, const auto& key) {
+        auto range = spends.equal_range(key);
+        for (auto itSpend = range.first; itSpend != range.second; ) {
+            itSpend = itSpend->second == hash ? spends.erase(itSpend) : std::next(itSpend);
+        }
+    };
+    for (const COutPoint& prevout : it->second.vPrevouts) {
+        EraseSpends(mapTxSpends, prevout);
+    }
+    for (const uint256& nullifier : it->second.vSproutNullifiers) {
+        EraseSpends(mapTxSproutNullifiers, nullifier);
+    }
+    for (const uint256& nullifier : it->second.vSaplingNullifiers) {
+        EraseSpends(mapTxSaplingNullifiers, nullifier);
+    }
+    mapArchivedTxs.erase(it);
+
+    AddToWallet(wtx, true, NULL);
+    if (!walletdb.WriteTx(hash, wtx) || !walletdb.EraseArchivedTx(hash)) {
+        LogPrintf("%s: unable to write transaction %s\n", __func__, hash.ToString());
+    }
+    return true;
+}
+
 
 /**
  * Returns a nullifier if the SpendingKey is available
@@ -1927,6 +2787,51 @@ mapSproutNoteData_t CWallet::FindMySproutNotes(const CTransaction &tx) const
 }
 
 
+bool CSaplingTrialDecryption::operator()()
+{
+    // Compute the shared secrets for every output and every key in the range
+    // with a single call into librustzcash.
+    std::vector<uint256> ivks(pivks->begin() + ivkBegin, pivks->begin() + ivkEnd);
+    std::vector<std::optional<uint256>> dhsecrets;
+    if (!ivks.empty()) {
+        std::vector<uint256> epks;
+        epks.reserve(poutputs->size());
+        for (const OutputDescription& output : *poutputs) {
+            epks.push_back(output.ephemeralKey);
+        }
+        dhsecrets = SaplingKaAgreeBatch(epks, ivks);
+    }
+
+    for (size_t i = 0; i < poutputs->size(); i++) {
+        const OutputDescription& output = (*poutputs)[i];
+        for (size_t j = 0; j < ivks.size(); j++) {
+            const auto& dhsecret = dhsecrets[i * ivks.size() + j];
+            if (dhsecret && SaplingNotePlaintext::decrypt_with_shared_secret(
+                    *pparams, height, output.encCiphertext, ivks[j], *dhsecret,
+                    output.ephemeralKey, output.cmu)) {
+                (*pmatches)[i * nJobs + nJob] = ivkBegin + j;
+                break;
+            }
+        }
+        for (size_t j = ovkBegin; j < ovkEnd; j++) {
+            if (SaplingOutgoingPlaintext::decrypt(
+                    output.outCiphertext, (*povks)[j],
+                    output.cv, output.cmu, output.ephemeralKey)) {
+                (*povkMatches)[i * nJobs + nJob] = j;
+                break;
+            }
+        }
+    }
+    return true;
+}
+
+static CCheckQueue<CSaplingTrialDecryption> saplingdecryptqueue(4);
+
+void ThreadSaplingTrialDecryption() {
+    RenameThread("zcash-decrypt");
+    saplingdecryptqueue.Thread();
+}
+
 /**
  * Finds all output notes in the given transaction that have been sent to
  * SaplingPaymentAddresses in this wallet.
@@ -1936,59 +2841,249 @@ mapSproutNoteData_t CWallet::FindMySproutNotes(const CTransaction &tx) const
  * already have been cached in CWalletTx.mapSaplingNoteData.
  */
 std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap> CWallet::FindMySaplingNotes(const CTransaction &tx, int height) const
+{
+    return FindMySaplingNotes(tx, height, nSaplingDecryptThreads ? &saplingdecryptqueue : nullptr);
+}
+
+/**
+ * Trial-decrypts the given Sapling outputs with ivks, and with ovks in the
+ * same pass, spreading the work over the workers of pqueue if it is non-null
+ * and there is enough work to be worth it. Returns, for each output, the
+ * index in ivks of the first key that decrypts it, if any, and sets
+ * ovkMatches likewise for ovks.
+ */
+static std::vector<std::optional<size_t>> TrialDecryptSaplingOutputs(
+    const Consensus::Params& consensusParams, int height,
+    const std::vector<OutputDescription>& outputs,
+    const std::vector<SaplingIncomingViewingKey>& ivks,
+    const std::vector<uint256>& ovks,
+    std::vector<std::optional<size_t>>& ovkMatches,
+    CCheckQueue<CSaplingTrialDecryption>* pqueue)
+{
+    std::vector<std::optional<size_t>> ret(outputs.size());
+    ovkMatches.assign(outputs.size(), std::nullopt);
+    if (outputs.empty() || (ivks.empty() && ovks.empty())) {
+        return ret;
+    }
+
+    // Protocol Spec: 4.19 Block Chain Scanning (Sapling)
+    //
+    // Trial decryption is split into jobs over ranges of keys, each of which
+    // computes the key agreements for all of the outputs in one batch, and
+    // tries its range of outgoing viewing keys on each output as it goes.
+    // Each job records, for each output, the first key in its ranges that
+    // decrypts it, and the first match over all jobs is taken, so that the
+    // result does not depend on how the work was scheduled.
+    const size_t K = SAPLING_TRIAL_DECRYPTION_KEYS_PER_JOB;
+    size_t nJobs = std::max((ivks.size() + K - 1) / K, (ovks.size() + K - 1) / K);
+    std::vector<std::optional<size_t>> matches(outputs.size() * nJobs);
+    std::vector<std::optional<size_t>> ovkJobMatches(outputs.size() * nJobs);
+    std::vector<CSaplingTrialDecryption> vJobs;
+    vJobs.reserve(nJobs);
+    for (size_t j = 0; j < nJobs; j++) {
+        size_t ivkBegin = std::min(ivks.size(), j * K);
+        size_t ivkEnd = std::min(ivks.size(), ivkBegin + K);
+        size_t ovkBegin = std::min(ovks.size(), j * K);
+        size_t ovkEnd = std::min(ovks.size(), ovkBegin + K);
+        vJobs.emplace_back(
+            consensusParams, height, outputs,
+            ivks, ivkBegin, ivkEnd, matches,
+            ovks, ovkBegin, ovkEnd, ovkJobMatches,
+            nJobs, j);
+    }
+
+    if (pqueue && vJobs.size() > 1) {
+        CCheckQueueControl<CSaplingTrialDecryption> control(pqueue);
+        control.Add(vJobs);
+        control.Wait();
+    } else {
+        for (auto& job : vJobs) {
+            job();
+        }
+    }
+
+    for (size_t i = 0; i < outputs.size(); ++i) {
+        for (size_t j = 0; j < nJobs && !ret[i]; j++) {
+            ret[i] = matches[i * nJobs + j];
+        }
+        for (size_t j = 0; j < nJobs && !ovkMatches[i]; j++) {
+            ovkMatches[i] = ovkJobMatches[i * nJobs + j];
+        }
+    }
+    return ret;
+}
+
+static std::vector<std::optional<size_t>> TrialDecryptSaplingOutputs(
+    const Consensus::Params& consensusParams, int height,
+    const std::vector<OutputDescription>& outputs,
+    const std::vector<SaplingIncomingViewingKey>& ivks,
+    CCheckQueue<CSaplingTrialDecryption>* pqueue)
+{
+    std::vector<std::optional<size_t>> ovkMatches;
+    return TrialDecryptSaplingOutputs(
+        consensusParams, height, outputs, ivks, std::vector<uint256>(), ovkMatches, pqueue);
+}
+
+std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap> CWallet::FindMySaplingNotes(
+    const CTransaction &tx, int height,
+    CCheckQueue<CSaplingTrialDecryption>* pqueue) const
+{
+    std::vector<std::optional<size_t>> ovkMatches;
+    return FindMySaplingNotes(tx, height, pqueue, std::vector<uint256>(), ovkMatches);
+}
+
+std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap> CWallet::FindMySaplingNotes(
+    const CTransaction &tx, int height,
+    CCheckQueue<CSaplingTrialDecryption>* pqueue,
+    const std::vector<uint256>& ovks,
+    std::vector<std::optional<size_t>>& ovkMatches) const
 {
     LOCK(cs_KeyStore);
+
+    if (tx.vShieldedOutput.empty() || (mapSaplingFullViewingKeys.empty() && ovks.empty())) {
+        ovkMatches.assign(tx.vShieldedOutput.size(), std::nullopt);
+        return std::make_pair(mapSaplingNoteData_t(), SaplingIncomingViewingKeyMap());
+    }
+
+    std::vector<SaplingIncomingViewingKey> ivks;
+    ivks.reserve(mapSaplingFullViewingKeys.size());
+    for (auto it = mapSaplingFullViewingKeys.begin(); it != mapSaplingFullViewingKeys.end(); ++it) {
+        ivks.push_back(it->first);
+    }
+
+    auto matches = TrialDecryptSaplingOutputs(
+        Params().GetConsensus(), height, tx.vShieldedOutput, ivks, ovks, ovkMatches, pqueue);
+    return SaplingNotesForMatches(tx, height, ivks, matches);
+}
+
+std::vector<std::optional<size_t>> CWallet::FindSaplingOutputsSentWith(
+    const CTransaction& tx,
+    const std::vector<uint256>& ovks) const
+{
+    // The height only affects decryption with incoming viewing keys.
+    std::vector<std::optional<size_t>> ovkMatches;
+    TrialDecryptSaplingOutputs(
+        Params().GetConsensus(), 0, tx.vShieldedOutput,
+        std::vector<SaplingIncomingViewingKey>(), ovks, ovkMatches,
+        nSaplingDecryptThreads ? &saplingdecryptqueue : nullptr);
+    return ovkMatches;
+}
+
+std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap> CWallet::SaplingNotesForMatches(
+    const CTransaction &tx, int height,
+    const std::vector<SaplingIncomingViewingKey>& ivks,
+    const std::vector<std::optional<size_t>>& matches) const
+{
+    LOCK(cs_KeyStore);
+    const Consensus::Params& consensusParams = Params().GetConsensus();
     uint256 hash = tx.GetHash();
 
     mapSaplingNoteData_t noteData;
     SaplingIncomingViewingKeyMap viewingKeysToAdd;
 
-    // Protocol Spec: 4.19 Block Chain Scanning (Sapling)
     for (uint32_t i = 0; i < tx.vShieldedOutput.size(); ++i) {
-        const OutputDescription output = tx.vShieldedOutput[i];
-        for (auto it = mapSaplingFullViewingKeys.begin(); it != mapSaplingFullViewingKeys.end(); ++it) {
-            SaplingIncomingViewingKey ivk = it->first;
+        if (!matches[i]) {
+            continue;
+        }
 
-            auto result = SaplingNotePlaintext::decrypt(Params().GetConsensus(), height, output.encCiphertext, ivk, output.ephemeralKey, output.cmu);
-            if (!result) {
-                continue;
-            }
-            auto address = ivk.address(result.value().d);
-            if (address && mapSaplingIncomingViewingKeys.count(address.value()) == 0) {
-                viewingKeysToAdd[address.value()] = ivk;
-            }
-            // We don't cache the nullifier here as computing it requires knowledge of the note position
-            // in the commitment tree, which can only be determined when the transaction has been mined.
-            SaplingOutPoint op {hash, i};
-            SaplingNoteData nd;
-            nd.ivk = ivk;
-            noteData.insert(std::make_pair(op, nd));
-            break;
+        const OutputDescription& output = tx.vShieldedOutput[i];
+        const SaplingIncomingViewingKey& ivk = ivks[*matches[i]];
+        auto result = SaplingNotePlaintext::decrypt(consensusParams, height, output.encCiphertext, ivk, output.ephemeralKey, output.cmu);
+        assert(result);
+        auto address = ivk.address(result.value().d);
+        if (address && mapSaplingIncomingViewingKeys.count(address.value()) == 0) {
+            viewingKeysToAdd[address.value()] = ivk;
         }
+        // We don't cache the nullifier here as computing it requires knowledge of the note position
+        // in the commitment tree, which can only be determined when the transaction has been mined.
+        SaplingOutPoint op {hash, i};
+        SaplingNoteData nd;
+        nd.ivk = ivk;
+        noteData.insert(std::make_pair(op, nd));
     }
 
     return std::make_pair(noteData, viewingKeysToAdd);
 }
 
-bool CWallet::IsSproutNullifierFromMe(const uint256& nullifier) const
-{
-    {
-        LOCK(cs_wallet);
-        if (mapSproutNullifiersToNotes.count(nullifier) &&
-                mapWallet.count(mapSproutNullifiersToNotes.at(nullifier).hash)) {
-            return true;
+bool CWallet::IsSproutNullifierFromMe(const uint256& nullifier) const
+{
+    {
+        LOCK(cs_wallet);
+        if (mapSproutNullifiersToNotes.count(nullifier) &&
+                mapWallet.count(mapSproutNullifiersToNotes.at(nullifier).hash)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool CWallet::IsSaplingNullifierFromMe(const uint256& nullifier) const
+{
+    {
+        LOCK(cs_wallet);
+        if (mapSaplingNullifiersToNotes.count(nullifier) &&
+                mapWallet.count(mapSaplingNullifiersToNotes.at(nullifier).hash)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Returns true if any Sapling output of the compact block decrypts with one
+ * of ivks.
+ */
+static bool CompactBlockHasSaplingNotes(
+    const Consensus::Params& consensusParams,
+    const CCompactBlock& block, int height,
+    const std::vector<SaplingIncomingViewingKey>& ivks)
+{
+    std::vector<const CCompactSaplingOutput*> outputs;
+    for (const CCompactTx& tx : block.vtx) {
+        for (const CCompactSaplingOutput& output : tx.vSaplingOutputs) {
+            outputs.push_back(&output);
+        }
+    }
+
+    if (outputs.empty() || ivks.empty()) {
+        return false;
+    }
+
+    std::vector<uint256> epks;
+    epks.reserve(outputs.size());
+    for (const CCompactSaplingOutput* output : outputs) {
+        epks.push_back(output->epk);
+    }
+
+    // Trial-decrypt every output in the block, in batches of keys so that
+    // the shared secrets for large wallets need not all be held at once.
+    for (size_t ivkBegin = 0; ivkBegin < ivks.size(); ivkBegin += SAPLING_TRIAL_DECRYPTION_KEYS_PER_JOB) {
+        size_t ivkEnd = std::min(ivks.size(), ivkBegin + SAPLING_TRIAL_DECRYPTION_KEYS_PER_JOB);
+        std::vector<uint256> batch(ivks.begin() + ivkBegin, ivks.begin() + ivkEnd);
+
+        auto dhsecrets = SaplingKaAgreeBatch(epks, batch);
+        for (size_t i = 0; i < outputs.size(); i++) {
+            for (size_t j = 0; j < batch.size(); j++) {
+                const auto& dhsecret = dhsecrets[i * batch.size() + j];
+                if (dhsecret && SaplingNotePlaintext::decrypt_compact_with_shared_secret(
+                        consensusParams, height, outputs[i]->ciphertext, batch[j], *dhsecret,
+                        outputs[i]->epk, outputs[i]->cmu)) {
+                    return true;
+                }
+            }
         }
     }
+
     return false;
 }
 
-bool CWallet::IsSaplingNullifierFromMe(const uint256& nullifier) const
+bool CWallet::CompactBlockHasSaplingNullifierFromMe(const CCompactBlock& block) const
 {
-    {
-        LOCK(cs_wallet);
-        if (mapSaplingNullifiersToNotes.count(nullifier) &&
-                mapWallet.count(mapSaplingNullifiersToNotes.at(nullifier).hash)) {
-            return true;
+    for (const CCompactTx& tx : block.vtx) {
+        for (const uint256& nullifier : tx.vSaplingNullifiers) {
+            if (IsSaplingNullifierFromMe(nullifier)) {
+                return true;
+            }
         }
     }
     return false;
@@ -2059,6 +3154,9 @@ isminetype CWallet::IsMine(const CTxIn &txin) const
             if (txin.prevout.n < prev.vout.size())
                 return IsMine(prev.vout[txin.prevout.n]);
         }
+        const CTxOut* ptxout = GetArchivedOutput(txin.prevout);
+        if (ptxout)
+            return IsMine(*ptxout);
     }
     return ISMINE_NO;
 }
@@ -2075,6 +3173,9 @@ CAmount CWallet::GetDebit(const CTxIn &txin, const isminefilter& filter) const
                 if (IsMine(prev.vout[txin.prevout.n]) & filter)
                     return prev.vout[txin.prevout.n].nValue;
         }
+        const CTxOut* ptxout = GetArchivedOutput(txin.prevout);
+        if (ptxout && (IsMine(*ptxout) & filter))
+            return ptxout->nValue;
     }
     return 0;
 }
@@ -2306,6 +3407,18 @@ void CWalletTx::SetSaplingNoteData(mapSaplingNoteData_t &noteData)
     }
 }
 
+void CWalletTx::ClearNoteWitnesses()
+{
+    for (auto& item : mapSproutNoteData) {
+        item.second.witnesses.clear();
+        item.second.witnessHeight = -1;
+    }
+    for (auto& item : mapSaplingNoteData) {
+        item.second.witnesses.clear();
+        item.second.witnessHeight = -1;
+    }
+}
+
 std::pair<SproutNotePlaintext, SproutPaymentAddress> CWalletTx::DecryptSproutNote(
     JSOutPoint jsop) const
 {
@@ -2412,6 +3525,30 @@ std::optional<std::pair<
     return std::make_pair(notePt, pa);
 }
 
+std::vector<SaplingNoteEntry> CWalletTx::DecryptSaplingNoteEntries() const
+{
+    std::vector<SaplingNoteEntry> entries;
+    for (const mapSaplingNoteData_t::value_type& item : mapSaplingNoteData) {
+        SaplingOutPoint op = item.first;
+        const SaplingNoteData& nd = item.second;
+
+        auto optDeserialized = SaplingNotePlaintext::attempt_sapling_enc_decryption_deserialization(vShieldedOutput[op.n].encCiphertext, nd.ivk, vShieldedOutput[op.n].ephemeralKey);
+
+        // The transaction would not have entered the wallet unless
+        // its plaintext had been successfully decrypted previously.
+        assert(optDeserialized != std::nullopt);
+
+        auto notePt = optDeserialized.value();
+        auto maybe_pa = nd.ivk.address(notePt.d);
+        assert(static_cast<bool>(maybe_pa));
+        auto pa = maybe_pa.value();
+
+        entries.push_back(SaplingNoteEntry {
+            op, pa, notePt.note(nd.ivk).value(), notePt.memo(), 0 });
+    }
+    return entries;
+}
+
 std::optional<std::pair<
     SaplingNotePlaintext,
     SaplingPaymentAddress>> CWalletTx::RecoverSaplingNote(const Consensus::Params& params, int height, SaplingOutPoint op, std::set<uint256>& ovks) const
@@ -2748,12 +3885,99 @@ void CWallet::WitnessNoteCommitment(std::vector<uint256> commitments,
     }
 }
 
+bool CRescanBlockRead::operator()()
+{
+    if (fCompact && pblocktree->ReadCompactBlock(pindex->GetBlockHash(), presult->compactBlock)) {
+        presult->fHaveCompactBlock = true;
+        presult->fCompactBlockHasNotes = CompactBlockHasSaplingNotes(
+            *pparams, presult->compactBlock, pindex->nHeight, *pivks);
+        if (!presult->fCompactBlockHasNotes) {
+            // The commit stage will most likely not need the full block.
+            return true;
+        }
+    }
+
+    ReadBlockFromDisk(presult->block, pindex, *pparams);
+    presult->fHaveBlock = true;
+    presult->vSaplingMatches.reserve(presult->block.vtx.size());
+    for (const CTransaction& tx : presult->block.vtx) {
+        presult->vSaplingMatches.push_back(TrialDecryptSaplingOutputs(
+            *pparams, pindex->nHeight, tx.vShieldedOutput, *pivks, nullptr));
+    }
+    return true;
+}
+
+static CCheckQueue<CRescanBlockRead> rescanreadqueue(1);
+
+void ThreadWalletRescanRead() {
+    RenameThread("zcash-rescan");
+    rescanreadqueue.Thread();
+}
+
+bool CWallet::HaveSproutNoteWitnessesBehind(int nHeight) const
+{
+    AssertLockHeld(cs_wallet);
+    for (const std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
+        for (const auto& item : wtxItem.second.mapSproutNoteData) {
+            if (item.second.witnessHeight < nHeight) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+/**
+ * Add tx to the wallet if it involves the newly added Sapling keys ivks,
+ * given the result of trial-decrypting its outputs with them. The notes of
+ * tx that the wallet already has are kept.
+ */
+bool CWallet::AddToWalletIfInvolvingNewSaplingKeys(
+    const CTransaction& tx, const CBlock* pblock, const int nHeight, bool fUpdate,
+    const std::vector<SaplingIncomingViewingKey>& ivks,
+    const std::vector<std::optional<size_t>>& matches)
+{
+    AssertLockHeld(cs_wallet);
+    auto it = mapWallet.find(tx.GetHash());
+    bool fHasNewNotes = std::any_of(matches.begin(), matches.end(),
+        [](const std::optional<size_t>& match) { return match.has_value(); });
+    if (!fHasNewNotes) {
+        // Otherwise tx can only newly involve us by spending a note of the
+        // new keys, and the transactions that already involved us are known.
+        if (it != mapWallet.end()) {
+            return false;
+        }
+        bool fSpendsMine = false;
+        for (const SpendDescription& spend : tx.vShieldedSpend) {
+            if (IsSaplingNullifierFromMe(spend.nullifier)) {
+                fSpendsMine = true;
+                break;
+            }
+        }
+        if (!fSpendsMine) {
+            return false;
+        }
+    }
+
+    auto saplingNotes = SaplingNotesForMatches(tx, nHeight, ivks, matches);
+    if (it != mapWallet.end()) {
+        saplingNotes.first.insert(it->second.mapSaplingNoteData.begin(), it->second.mapSaplingNoteData.end());
+    }
+    return AddToWalletIfInvolvingMe(tx, pblock, nHeight, fUpdate, saplingNotes);
+}
+
 /**
  * Scan the block chain (starting in pindexStart) for transactions
  * from or to us. If fUpdate is true, found transactions that already
- * exist in the wallet will be updated.
+ * exist in the wallet will be updated. If pNewSaplingIvks is given, the
+ * caller promises that the only keys added since the wallet was last
+ * scanned are these Sapling keys. Only they are then trial-decrypted, only
+ * the transactions that involve them are added or updated, and blocks can
+ * be skipped using the compact block index if it is enabled, so the scan
+ * costs the same whatever the number of keys already in the wallet.
  */
-int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
+int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate,
+                                       const std::vector<SaplingIncomingViewingKey>* pNewSaplingIvks)
 {
     int ret = 0;
     int64_t nNow = GetTime();
@@ -2775,39 +3999,114 @@ int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
         ShowProgress(_("Rescanning..."), 0); // show rescan progress in GUI as dialog or on splashscreen, if -rescan on startup
         double dProgressStart = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false);
         double dProgressTip = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), chainActive.Tip(), false);
+
+        // The set of Sapling keys cannot change while we hold cs_wallet, so
+        // the read-ahead stage can trial-decrypt outputs with a copy of them.
+        std::vector<SaplingIncomingViewingKey> ivks;
+        if (pNewSaplingIvks) {
+            ivks = *pNewSaplingIvks;
+        } else {
+            LOCK(cs_KeyStore);
+            for (auto it = mapSaplingFullViewingKeys.begin(); it != mapSaplingFullViewingKeys.end(); ++it) {
+                ivks.push_back(it->first);
+            }
+        }
+
+        // If only Sapling keys have been added since the wallet was last
+        // scanned, a block can only involve us through its Sapling outputs
+        // and nullifiers, so the compact block index can be used to skip
+        // reading blocks that do not.
+        bool fCompact = pNewSaplingIvks && fCompactBlockIndex;
+
         while (pindex)
         {
-            if (pindex->nHeight % 100 == 0 && dProgressTip - dProgressStart > 0.0)
-                ShowProgress(_("Rescanning..."), std::max(1, std::min(99, (int)((Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false) - dProgressStart) / (dProgressTip - dProgressStart) * 100))));
-
-            CBlock block;
-            ReadBlockFromDisk(block, pindex, Params().GetConsensus());
-            for (CTransaction& tx : block.vtx)
-            {
-                if (AddToWalletIfInvolvingMe(tx, &block, pindex->nHeight, fUpdate)) {
-                    myTxHashes.push_back(tx.GetHash());
-                    ret++;
+            // Read a window of blocks and trial-decrypt their outputs in
+            // parallel. The tip cannot change while we hold cs_main, so every
+            // block in the window stays on the active chain.
+            std::vector<CBlockIndex*> vWindow;
+            for (CBlockIndex* pnext = pindex; pnext && vWindow.size() < WALLET_RESCAN_READ_AHEAD; pnext = chainActive.Next(pnext)) {
+                vWindow.push_back(pnext);
+            }
+            std::vector<CRescanBlock> vBlocks(vWindow.size());
+            std::vector<CRescanBlockRead> vReads;
+            vReads.reserve(vWindow.size());
+            for (size_t i = 0; i < vWindow.size(); i++) {
+                vReads.emplace_back(chainParams.GetConsensus(), vWindow[i], ivks, fCompact, vBlocks[i]);
+            }
+            if (nSaplingDecryptThreads && vReads.size() > 1) {
+                CCheckQueueControl<CRescanBlockRead> control(&rescanreadqueue);
+                control.Add(vReads);
+                control.Wait();
+            } else {
+                for (auto& read : vReads) {
+                    read();
                 }
             }
 
-            SproutMerkleTree sproutTree;
-            SaplingMerkleTree saplingTree;
-            // This should never fail: we should always be able to get the tree
-            // state on the path to the tip of our chain
-            assert(pcoinsTip->GetSproutAnchorAt(pindex->hashSproutAnchor, sproutTree));
-            if (pindex->pprev) {
-                if (Params().GetConsensus().NetworkUpgradeActive(pindex->pprev->nHeight,  Consensus::UPGRADE_SAPLING)) {
-                    assert(pcoinsTip->GetSaplingAnchorAt(pindex->pprev->hashFinalSaplingRoot, saplingTree));
+            // Apply the blocks to the wallet in height order.
+            for (size_t i = 0; i < vWindow.size(); i++) {
+                pindex = vWindow[i];
+                CRescanBlock& rescanBlock = vBlocks[i];
+
+                if (pindex->nHeight % 100 == 0 && dProgressTip - dProgressStart > 0.0)
+                    ShowProgress(_("Rescanning..."), std::max(1, std::min(99, (int)((Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false) - dProgressStart) / (dProgressTip - dProgressStart) * 100))));
+
+                SproutMerkleTree sproutTree;
+                SaplingMerkleTree saplingTree;
+                // This should never fail: we should always be able to get the tree
+                // state on the path to the tip of our chain
+                if (pindex->pprev) {
+                    if (chainParams.GetConsensus().NetworkUpgradeActive(pindex->pprev->nHeight,  Consensus::UPGRADE_SAPLING)) {
+                        assert(pcoinsTip->GetSaplingAnchorAt(pindex->pprev->hashFinalSaplingRoot, saplingTree));
+                    }
                 }
-            }
-            // Increment note witness caches
-            ChainTipAdded(pindex, &block, sproutTree, saplingTree);
 
-            pindex = chainActive.Next(pindex);
-            if (GetTime() >= nNow + 60) {
-                nNow = GetTime();
-                LogPrintf("Still rescanning. At block %d. Progress=%f\n", pindex->nHeight, Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex));
+                // When the compact block shows that the block does not involve
+                // us, there is no need to read the full block, as long as its
+                // Sprout commitments are not needed for our witnesses.
+                if (rescanBlock.fHaveCompactBlock &&
+                        !rescanBlock.fCompactBlockHasNotes &&
+                        !CompactBlockHasSaplingNullifierFromMe(rescanBlock.compactBlock) &&
+                        !HaveSproutNoteWitnessesBehind(pindex->nHeight)) {
+                    // Increment note witness caches
+                    IncrementNoteWitnesses(pindex, rescanBlock.compactBlock, saplingTree);
+                    MaybeSetBestChain(pindex);
+                } else {
+                    CBlock& block = rescanBlock.block;
+                    if (!rescanBlock.fHaveBlock) {
+                        ReadBlockFromDisk(block, pindex, chainParams.GetConsensus());
+                    }
+                    for (size_t j = 0; j < block.vtx.size(); j++) {
+                        const CTransaction& tx = block.vtx[j];
+                        // If the read-ahead stage did not read the block,
+                        // its compact block has no notes of the new keys.
+                        bool fInvolvesMe = pNewSaplingIvks ?
+                            AddToWalletIfInvolvingNewSaplingKeys(tx, &block, pindex->nHeight, fUpdate, ivks,
+                                rescanBlock.fHaveBlock ?
+                                    rescanBlock.vSaplingMatches[j] :
+                                    std::vector<std::optional<size_t>>(tx.vShieldedOutput.size())) :
+                            rescanBlock.fHaveBlock ?
+                            AddToWalletIfInvolvingMe(tx, &block, pindex->nHeight, fUpdate,
+                                SaplingNotesForMatches(tx, pindex->nHeight, ivks, rescanBlock.vSaplingMatches[j])) :
+                            AddToWalletIfInvolvingMe(tx, &block, pindex->nHeight, fUpdate);
+                        if (fInvolvesMe) {
+                            myTxHashes.push_back(tx.GetHash());
+                            ret++;
+                        }
+                    }
+
+                    assert(pcoinsTip->GetSproutAnchorAt(pindex->hashSproutAnchor, sproutTree));
+                    // Increment note witness caches
+                    ChainTipAdded(pindex, &block, sproutTree, saplingTree);
+                }
+
+                if (GetTime() >= nNow + 60) {
+                    nNow = GetTime();
+                    LogPrintf("Still rescanning. At block %d. Progress=%f\n", pindex->nHeight, Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex));
+                }
             }
+
+            pindex = chainActive.Next(vWindow.back());
         }
 
         // After rescanning, persist Sapling note data that might have changed, e.g. nullifiers.
@@ -3129,92 +4428,122 @@ void CWallet::ResendWalletTransactions(int64_t nBestBlockTime)
 
 CAmount CWallet::GetBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
+    LOCK2(cs_main, cs_wallet);
+    return GetCachedBalance("balance", [this]() {
+        CAmount nTotal = 0;
         for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
         {
             const CWalletTx* pcoin = &(*it).second;
             if (pcoin->IsTrusted())
                 nTotal += pcoin->GetAvailableCredit();
         }
-    }
-
-    return nTotal;
+        return nTotal;
+    });
 }
 
 CAmount CWallet::GetUnconfirmedBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
+    LOCK2(cs_main, cs_wallet);
+    return GetCachedBalance("unconfirmed", [this]() {
+        CAmount nTotal = 0;
         for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
         {
             const CWalletTx* pcoin = &(*it).second;
             if (!CheckFinalTx(*pcoin) || (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0))
                 nTotal += pcoin->GetAvailableCredit();
         }
-    }
-    return nTotal;
+        return nTotal;
+    });
 }
 
 CAmount CWallet::GetImmatureBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
+    LOCK2(cs_main, cs_wallet);
+    return GetCachedBalance("immature", [this]() {
+        CAmount nTotal = 0;
         for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
         {
             const CWalletTx* pcoin = &(*it).second;
             nTotal += pcoin->GetImmatureCredit();
         }
-    }
-    return nTotal;
+        return nTotal;
+    });
 }
 
 CAmount CWallet::GetWatchOnlyBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
+    LOCK2(cs_main, cs_wallet);
+    return GetCachedBalance("watchonly", [this]() {
+        CAmount nTotal = 0;
         for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
         {
             const CWalletTx* pcoin = &(*it).second;
             if (pcoin->IsTrusted())
                 nTotal += pcoin->GetAvailableWatchOnlyCredit();
         }
-    }
-
-    return nTotal;
+        return nTotal;
+    });
 }
 
 CAmount CWallet::GetUnconfirmedWatchOnlyBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
+    LOCK2(cs_main, cs_wallet);
+    return GetCachedBalance("unconfirmedwatchonly", [this]() {
+        CAmount nTotal = 0;
         for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
         {
             const CWalletTx* pcoin = &(*it).second;
             if (!CheckFinalTx(*pcoin) || (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0))
                 nTotal += pcoin->GetAvailableWatchOnlyCredit();
         }
-    }
-    return nTotal;
+        return nTotal;
+    });
 }
 
 CAmount CWallet::GetImmatureWatchOnlyBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
+    LOCK2(cs_main, cs_wallet);
+    return GetCachedBalance("immaturewatchonly", [this]() {
+        CAmount nTotal = 0;
         for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
         {
             const CWalletTx* pcoin = &(*it).second;
             nTotal += pcoin->GetImmatureWatchOnlyCredit();
         }
+        return nTotal;
+    });
+}
+
+CAmount CWallet::GetCachedBalance(const std::string& strKey, const std::function<CAmount()>& compute) const
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+
+    // The depth and trust of every transaction depend on the chain tip and
+    // the mempool, so the balances are only valid for the ones they were
+    // computed with.
+    uint256 hashTip = chainActive.Tip() ? chainActive.Tip()->GetBlockHash() : uint256();
+    unsigned int nMempoolUpdates = mempool.GetTransactionsUpdated();
+    if (hashTip != hashBalanceCacheTip || nMempoolUpdates != nBalanceCacheMempoolUpdates ||
+        mapBalanceCache.size() >= MAX_BALANCE_CACHE_ENTRIES) {
+        mapBalanceCache.clear();
+        hashBalanceCacheTip = hashTip;
+        nBalanceCacheMempoolUpdates = nMempoolUpdates;
     }
-    return nTotal;
+
+    auto it = mapBalanceCache.find(strKey);
+    if (it != mapBalanceCache.end()) {
+        return it->second;
+    }
+    CAmount nBalance = compute();
+    mapBalanceCache.emplace(strKey, nBalance);
+    return nBalance;
+}
+
+void CWallet::InvalidateBalanceCache()
+{
+    LOCK(cs_wallet);
+    mapBalanceCache.clear();
 }
 
 void CWallet::AvailableCoins(vector<COutput>& vCoins,
@@ -3232,54 +4561,116 @@ void CWallet::AvailableCoins(vector<COutput>& vCoins,
 
     vCoins.clear();
 
+    if (fUnspentOutputsStale) {
+        RebuildUnspentOutputs();
+    }
+
+    std::set<COutPoint>::iterator it = setUnspentOutputs.begin();
+    while (it != setUnspentOutputs.end())
     {
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const uint256& wtxid = it->first;
-            const CWalletTx* pcoin = &(*it).second;
+        const uint256 wtxid = it->hash;
+        // The outputs of this transaction follow each other in the set.
+        std::set<COutPoint>::iterator itEnd = setUnspentOutputs.upper_bound(
+            COutPoint(wtxid, std::numeric_limits<uint32_t>::max()));
+
+        std::map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(wtxid);
+        if (mi == mapWallet.end()) {
+            it = setUnspentOutputs.erase(it, itEnd);
+            continue;
+        }
+        const CWalletTx* pcoin = &mi->second;
 
-            if (!CheckFinalTx(*pcoin))
-                continue;
+        bool isCoinbase = pcoin->IsCoinBase();
+        int nDepth = 0;
+        if (!CheckFinalTx(*pcoin) ||
+            (fOnlyConfirmed && !pcoin->IsTrusted()) ||
+            (isCoinbase && !fIncludeCoinBase) ||
+            (isCoinbase && pcoin->GetBlocksToMaturity() > 0) ||
+            (nDepth = pcoin->GetDepthInMainChain()) < nMinDepth) {
+            it = itEnd;
+            continue;
+        }
 
-            if (fOnlyConfirmed && !pcoin->IsTrusted())
-                continue;
+        while (it != itEnd) {
+            unsigned int i = it->n;
+            const auto& output = pcoin->vout[i];
+            isminetype mine = IsMine(output);
 
-            if (pcoin->IsCoinBase() && !fIncludeCoinBase)
+            if (IsSpent(wtxid, i)) {
+                // Outputs spent in the chain need not be looked at again,
+                // unless a reorg returns them (see BlocksDisconnected).
+                it = IsSpentInChain(*it) ? setUnspentOutputs.erase(it) : std::next(it);
                 continue;
+            }
+            ++it;
 
-            bool isCoinbase = pcoin->IsCoinBase();
-            if (isCoinbase && pcoin->GetBlocksToMaturity() > 0)
-                continue;
+            bool isSpendable = ((mine & ISMINE_SPENDABLE) != ISMINE_NO) ||
+                                (coinControl && coinControl->fAllowWatchOnly && (mine & ISMINE_WATCH_SOLVABLE) != ISMINE_NO);
 
-            int nDepth = pcoin->GetDepthInMainChain();
-            if (nDepth < nMinDepth)
+            if (fOnlySpendable && !isSpendable)
                 continue;
 
-            for (unsigned int i = 0; i < pcoin->vout.size(); i++) {
-                const auto& output = pcoin->vout[i];
-                isminetype mine = IsMine(output);
-
-                bool isSpendable = ((mine & ISMINE_SPENDABLE) != ISMINE_NO) ||
-                                    (coinControl && coinControl->fAllowWatchOnly && (mine & ISMINE_WATCH_SOLVABLE) != ISMINE_NO);
-
-                if (fOnlySpendable && !isSpendable)
+            // Filter by specific destinations if needed
+            if (onlyFilterByDests && !onlyFilterByDests->empty()) {
+                CTxDestination address;
+                if (!ExtractDestination(output.scriptPubKey, address) || onlyFilterByDests->count(address) == 0) {
                     continue;
-
-                // Filter by specific destinations if needed
-                if (onlyFilterByDests && !onlyFilterByDests->empty()) {
-                    CTxDestination address;
-                    if (!ExtractDestination(output.scriptPubKey, address) || onlyFilterByDests->count(address) == 0) {
-                        continue;
-                    }
                 }
+            }
+
+            if (mine != ISMINE_NO &&
+                !IsLockedCoin(wtxid, i) && (output.nValue > 0 || fIncludeZeroValue) &&
+                (!coinControl || !coinControl->HasSelected() || coinControl->fAllowOtherInputs || coinControl->IsSelected(wtxid, i)))
+                    vCoins.push_back(COutput(pcoin, i, nDepth, isSpendable, isCoinbase));
+        }
+    }
+}
+
+void CWallet::AddUnspentOutputs(const CWalletTx& wtx)
+{
+    AssertLockHeld(cs_wallet);
+    if (fUnspentOutputsStale) {
+        return;
+    }
+    for (unsigned int i = 0; i < wtx.vout.size(); i++) {
+        if (IsMine(wtx.vout[i]) != ISMINE_NO) {
+            setUnspentOutputs.insert(COutPoint(wtx.GetHash(), i));
+        }
+    }
+}
 
-                if (!(IsSpent(wtxid, i)) && mine != ISMINE_NO &&
-                    !IsLockedCoin((*it).first, i) && (pcoin->vout[i].nValue > 0 || fIncludeZeroValue) &&
-                    (!coinControl || !coinControl->HasSelected() || coinControl->fAllowOtherInputs || coinControl->IsSelected((*it).first, i)))
-                        vCoins.push_back(COutput(pcoin, i, nDepth, isSpendable, isCoinbase));
+void CWallet::RebuildUnspentOutputs() const
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+    setUnspentOutputs.clear();
+    for (const std::pair<const uint256, CWalletTx>& item : mapWallet) {
+        for (unsigned int i = 0; i < item.second.vout.size(); i++) {
+            COutPoint outpoint(item.first, i);
+            if (IsMine(item.second.vout[i]) != ISMINE_NO && !IsSpentInChain(outpoint)) {
+                setUnspentOutputs.insert(setUnspentOutputs.end(), outpoint);
             }
         }
     }
+    fUnspentOutputsStale = false;
+}
+
+/**
+ * Outpoint is spent in the chain if a wallet transaction
+ * in a block of the active chain spends it:
+ */
+bool CWallet::IsSpentInChain(const COutPoint& outpoint) const
+{
+    pair<TxSpends::const_iterator, TxSpends::const_iterator> range;
+    range = mapTxSpends.equal_range(outpoint);
+
+    for (TxSpends::const_iterator it = range.first; it != range.second; ++it)
+    {
+        std::map<uint256, CWalletTx>::const_iterator mit = mapWallet.find(it->second);
+        if (mit != mapWallet.end() && mit->second.GetDepthInMainChain() > 0)
+            return true;
+    }
+    return false;
 }
 
 static void ApproximateBestSubset(vector<pair<CAmount, pair<const CWalletTx*,unsigned int> > >vValue, const CAmount& nTotalLower, const CAmount& nTargetValue,
@@ -4445,18 +5836,21 @@ void CWallet::LockCoin(COutPoint& output)
 {
     AssertLockHeld(cs_wallet); // setLockedCoins
     setLockedCoins.insert(output);
+    InvalidateBalanceCache();
 }
 
 void CWallet::UnlockCoin(COutPoint& output)
 {
     AssertLockHeld(cs_wallet); // setLockedCoins
     setLockedCoins.erase(output);
+    InvalidateBalanceCache();
 }
 
 void CWallet::UnlockAllCoins()
 {
     AssertLockHeld(cs_wallet); // setLockedCoins
     setLockedCoins.clear();
+    InvalidateBalanceCache();
 }
 
 bool CWallet::IsLockedCoin(uint256 hash, unsigned int n) const
@@ -4484,18 +5878,21 @@ void CWallet::LockNote(const JSOutPoint& output)
 {
     AssertLockHeld(cs_wallet); // setLockedSproutNotes
     setLockedSproutNotes.insert(output);
+    InvalidateBalanceCache();
 }
 
 void CWallet::UnlockNote(const JSOutPoint& output)
 {
     AssertLockHeld(cs_wallet); // setLockedSproutNotes
     setLockedSproutNotes.erase(output);
+    InvalidateBalanceCache();
 }
 
 void CWallet::UnlockAllSproutNotes()
 {
     AssertLockHeld(cs_wallet); // setLockedSproutNotes
     setLockedSproutNotes.clear();
+    InvalidateBalanceCache();
 }
 
 bool CWallet::IsLockedNote(const JSOutPoint& outpt) const
@@ -4516,18 +5913,21 @@ void CWallet::LockNote(const SaplingOutPoint& output)
 {
     AssertLockHeld(cs_wallet);
     setLockedSaplingNotes.insert(output);
+    InvalidateBalanceCache();
 }
 
 void CWallet::UnlockNote(const SaplingOutPoint& output)
 {
     AssertLockHeld(cs_wallet);
     setLockedSaplingNotes.erase(output);
+    InvalidateBalanceCache();
 }
 
 void CWallet::UnlockAllSaplingNotes()
 {
     AssertLockHeld(cs_wallet);
     setLockedSaplingNotes.clear();
+    InvalidateBalanceCache();
 }
 
 bool CWallet::IsLockedNote(const SaplingOutPoint& output) const
@@ -4675,6 +6075,10 @@ bool CWallet::GetDestData(const CTxDestination &dest, const std::string &key, st
 std::string CWallet::GetWalletHelpString(bool showDebug)
 {
     std::string strUsage = HelpMessageGroup(_("Wallet options:"));
+    strUsage += HelpMessageOpt("-consolidation", _("Periodically merge the small Sapling notes of the addresses that have many of them (default: 0)"));
+    strUsage += HelpMessageOpt("-consolidationinterval=<n>", strprintf(_("Consolidate Sapling notes every <n> blocks (default: %u)"), DEFAULT_CONSOLIDATION_INTERVAL));
+    strUsage += HelpMessageOpt("-consolidationtxfee=<amt>", strprintf(_("Fee (in %s) paid by each consolidation transaction (default: %s)"),
+                                                            CURRENCY_UNIT, FormatMoney(DEFAULT_FEE)));
     strUsage += HelpMessageOpt("-disablewallet", _("Do not load the wallet and disable wallet RPC calls"));
     strUsage += HelpMessageOpt("-keypool=<n>", strprintf(_("Set key pool size to <n> (default: %u)"), DEFAULT_KEYPOOL_SIZE));
     strUsage += HelpMessageOpt("-migration", _("Enable the Sprout to Sapling migration"));
@@ -4683,7 +6087,14 @@ std::string CWallet::GetWalletHelpString(bool showDebug)
                                                             CURRENCY_UNIT, FormatMoney(DEFAULT_TRANSACTION_MINFEE)));
     strUsage += HelpMessageOpt("-paytxfee=<amt>", strprintf(_("Fee (in %s/kB) to add to transactions you send (default: %s)"),
                                                             CURRENCY_UNIT, FormatMoney(payTxFee.GetFeePerK())));
+    strUsage += HelpMessageOpt("-provingbackend=<name>", strprintf(_("Create the zk-SNARK proofs of the transactions being sent with this backend (%s, default: %s)"),
+        boost::algorithm::join(libzcash::ListProvingBackends(), ", "), libzcash::DEFAULT_PROVING_BACKEND));
+    strUsage += HelpMessageOpt("-provingthreads=<n>", strprintf(_("Set the number of threads that create the zk-SNARK proofs of the transactions being sent, shared by all of them (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)"),
+        -GetNumCores(), GetNumCores(), DEFAULT_PROVING_THREADS));
     strUsage += HelpMessageOpt("-rescan", _("Rescan the block chain for missing wallet transactions on startup"));
+    strUsage += HelpMessageOpt("-saplingaddresspool=<n>", strprintf(_("Keep <n> Sapling addresses generated ahead of z_getnewaddress, which hands them out first; they are listed by z_listaddresses only once handed out (0 to %u, default: %u)"),
+        MAX_SAPLING_ADDRESS_POOL_SIZE, DEFAULT_SAPLING_ADDRESS_POOL_SIZE));
+    strUsage += HelpMessageOpt("-saplingaddresspooldiversified", _("Fill the Sapling address pool, and serve z_getnewaddress, with diversified addresses of one key per run instead of a new key for each address, so that they do not add to the keys that outputs are trial-decrypted with (default: 0)"));
     strUsage += HelpMessageOpt("-salvagewallet", _("Attempt to recover private keys from a corrupt wallet on startup"));
     strUsage += HelpMessageOpt("-sendfreetransactions", strprintf(_("Send transactions as zero-fee transactions if possible (default: %u)"), DEFAULT_SEND_FREE_TRANSACTIONS));
     strUsage += HelpMessageOpt("-spendzeroconfchange", strprintf(_("Spend unconfirmed change when sending transactions (default: %u)"), DEFAULT_SPEND_ZEROCONF_CHANGE));
@@ -4691,7 +6102,13 @@ std::string CWallet::GetWalletHelpString(bool showDebug)
     strUsage += HelpMessageOpt("-txexpirydelta", strprintf(_("Set the number of blocks after which a transaction that has not been mined will become invalid (min: %u, default: %u (pre-Blossom) or %u (post-Blossom))"), TX_EXPIRING_SOON_THRESHOLD + 1, DEFAULT_PRE_BLOSSOM_TX_EXPIRY_DELTA, DEFAULT_POST_BLOSSOM_TX_EXPIRY_DELTA));
     strUsage += HelpMessageOpt("-upgradewallet", _("Upgrade wallet to latest format on startup"));
     strUsage += HelpMessageOpt("-wallet=<file>", _("Specify wallet file absolute path or a path relative to the data directory") + " " + strprintf(_("(default: %s)"), DEFAULT_WALLET_DAT));
+    strUsage += HelpMessageOpt("-walletarchivedepth=<n>", strprintf(_("Keep transactions whose outputs and notes were all spent at least <n> blocks deep in wallet.dat only, reading them from it when they are asked for; they are then not listed by listtransactions or listsinceblock, nor counted by the received totals (0 = disabled, or at least %d, default: %d)"),
+        MIN_WALLET_ARCHIVE_DEPTH, DEFAULT_WALLET_ARCHIVE_DEPTH));
     strUsage += HelpMessageOpt("-walletbroadcast", _("Make the wallet broadcast transactions") + " " + strprintf(_("(default: %u)"), DEFAULT_WALLETBROADCAST));
+    strUsage += HelpMessageOpt("-walletdecryptthreads=<n>", strprintf(_("Set the number of threads used to trial-decrypt Sapling outputs (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)"),
+        -GetNumCores(), MAX_SAPLING_DECRYPT_THREADS, DEFAULT_SAPLING_DECRYPT_THREADS));
+    strUsage += HelpMessageOpt("-walletwitnessthreads=<n>", strprintf(_("Set the number of threads used to update note witnesses of large wallets (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)"),
+        -GetNumCores(), MAX_WITNESS_UPDATE_THREADS, DEFAULT_WITNESS_UPDATE_THREADS));
     strUsage += HelpMessageOpt("-walletnotify=<cmd>", _("Execute command when a wallet transaction changes (%s in cmd is replaced by TxID)"));
     strUsage += HelpMessageOpt("-zapwallettxes=<mode>", _("Delete all wallet transactions and only recover those parts of the blockchain through -rescan on startup") +
                                " " + _("(1 = keep tx meta data e.g. account owner and payment request information, 2 = drop tx meta data)"));
@@ -4786,6 +6203,20 @@ bool CWallet::InitLoadWallet(bool clearWitnessCaches)
     // Set sapling migration status
     walletInstance->fSaplingMigrationEnabled = GetBoolArg("-migration", false);
 
+    // Set Sapling note consolidation status
+    walletInstance->fSaplingConsolidationEnabled = GetBoolArg("-consolidation", false);
+    walletInstance->nSaplingConsolidationInterval = GetArg("-consolidationinterval", DEFAULT_CONSOLIDATION_INTERVAL);
+    if (mapArgs.count("-consolidationtxfee")) {
+        ParseMoney(mapArgs["-consolidationtxfee"], walletInstance->nSaplingConsolidationFee);
+    }
+
+    // Set up the Sapling address pool, which is filled in the background
+    walletInstance->nSaplingAddressPoolSize = GetArg("-saplingaddresspool", DEFAULT_SAPLING_ADDRESS_POOL_SIZE);
+    walletInstance->fSaplingAddressPoolDiversified = GetBoolArg("-saplingaddresspooldiversified", false);
+
+    // Archive fully spent transactions out of memory
+    walletInstance->nArchiveDepth = GetArg("-walletarchivedepth", DEFAULT_WALLET_ARCHIVE_DEPTH);
+
     if (fFirstRun)
     {
         // Create new keyUser and set as default key
@@ -4858,8 +6289,14 @@ bool CWallet::InitLoadWallet(bool clearWitnessCaches)
                     copyTo->WriteToDisk(&walletdb);
                 }
             }
+            LOCK(walletInstance->cs_wallet);
+            walletInstance->MarkOrderedTxsStale();
         }
     }
+    // Archive the transactions that became fully spent while the wallet was
+    // not loaded, before anything else reads it.
+    walletInstance->ArchiveSpentTxs(chainActive.AtomicTip());
+
     walletInstance->SetBroadcastTransactions(GetBoolArg("-walletbroadcast", DEFAULT_WALLETBROADCAST));
 
     pwalletMain = walletInstance;
@@ -4905,6 +6342,32 @@ bool CWallet::ParameterInteraction()
         }
     }
     nTxConfirmTarget = GetArg("-txconfirmtarget", DEFAULT_TX_CONFIRM_TARGET);
+    // -walletdecryptthreads=0 means autodetect, but nSaplingDecryptThreads==0 means no concurrency
+    nSaplingDecryptThreads = GetArg("-walletdecryptthreads", DEFAULT_SAPLING_DECRYPT_THREADS);
+    if (nSaplingDecryptThreads <= 0)
+        nSaplingDecryptThreads += GetNumCores();
+    if (nSaplingDecryptThreads <= 1)
+        nSaplingDecryptThreads = 0;
+    else if (nSaplingDecryptThreads > MAX_SAPLING_DECRYPT_THREADS)
+        nSaplingDecryptThreads = MAX_SAPLING_DECRYPT_THREADS;
+    // -walletwitnessthreads=0 means autodetect, but nWitnessUpdateThreads==0 means no concurrency
+    nWitnessUpdateThreads = GetArg("-walletwitnessthreads", DEFAULT_WITNESS_UPDATE_THREADS);
+    if (nWitnessUpdateThreads <= 0)
+        nWitnessUpdateThreads += GetNumCores();
+    if (nWitnessUpdateThreads <= 1)
+        nWitnessUpdateThreads = 0;
+    else if (nWitnessUpdateThreads > MAX_WITNESS_UPDATE_THREADS)
+        nWitnessUpdateThreads = MAX_WITNESS_UPDATE_THREADS;
+    // -provingthreads=0 means one per core
+    int nProvingThreads = GetArg("-provingthreads", DEFAULT_PROVING_THREADS);
+    if (nProvingThreads <= 0)
+        nProvingThreads += GetNumCores();
+    ProvingThreads::SetLimit(std::max(1, nProvingThreads));
+    std::string strProvingBackend = GetArg("-provingbackend", libzcash::DEFAULT_PROVING_BACKEND);
+    if (!libzcash::SelectProvingBackend(strProvingBackend)) {
+        return UIError(strprintf(_("Unknown -provingbackend '%s' (available: %s)"),
+            strProvingBackend, boost::algorithm::join(libzcash::ListProvingBackends(), ", ")));
+    }
     if (mapArgs.count("-txexpirydelta")) {
         int64_t expiryDelta = atoi64(mapArgs["-txexpirydelta"]);
         uint32_t minExpiryDelta = TX_EXPIRING_SOON_THRESHOLD + 1;
@@ -4916,6 +6379,25 @@ bool CWallet::ParameterInteraction()
     bSpendZeroConfChange = GetBoolArg("-spendzeroconfchange", DEFAULT_SPEND_ZEROCONF_CHANGE);
     fSendFreeTransactions = GetBoolArg("-sendfreetransactions", DEFAULT_SEND_FREE_TRANSACTIONS);
 
+    if (GetArg("-consolidationinterval", DEFAULT_CONSOLIDATION_INTERVAL) <= 0) {
+        return UIError(_("-consolidationinterval must be positive."));
+    }
+    int64_t nArchiveDepth = GetArg("-walletarchivedepth", DEFAULT_WALLET_ARCHIVE_DEPTH);
+    if (nArchiveDepth != 0 && (nArchiveDepth < MIN_WALLET_ARCHIVE_DEPTH || nArchiveDepth > std::numeric_limits<int>::max())) {
+        return UIError(strprintf(_("-walletarchivedepth must be 0 or at least %d."), MIN_WALLET_ARCHIVE_DEPTH));
+    }
+    int64_t nSaplingAddressPool = GetArg("-saplingaddresspool", DEFAULT_SAPLING_ADDRESS_POOL_SIZE);
+    if (nSaplingAddressPool < 0 || nSaplingAddressPool > MAX_SAPLING_ADDRESS_POOL_SIZE) {
+        return UIError(strprintf(_("-saplingaddresspool must be between 0 and %u."), MAX_SAPLING_ADDRESS_POOL_SIZE));
+    }
+    if (mapArgs.count("-consolidationtxfee")) {
+        CAmount nFee = 0;
+        if (!ParseMoney(mapArgs["-consolidationtxfee"], nFee) || !MoneyRange(nFee))
+            return UIError(AmountErrMsg("consolidationtxfee", mapArgs["-consolidationtxfee"]));
+        if (nFee > HIGH_MAX_TX_FEE)
+            UIWarning(_("-consolidationtxfee is set very high! This is the fee each consolidation transaction pays."));
+    }
+
     KeyIO keyIO(Params());
     // Check Sapling migration address if set and is a valid Sapling address
     if (mapArgs.count("-migrationdestaddress")) {
@@ -4994,6 +6476,19 @@ int CMerkleTx::GetDepthInMainChainINTERNAL(const CBlockIndex* &pindexRet) const
     return chainActive.Height() - pindex->nHeight + 1;
 }
 
+int CMerkleTx::GetDepthInChain(const CBlockIndex* pindexTip) const
+{
+    if (hashBlock.IsNull() || nIndex == -1 || pindexTip == nullptr)
+        return 0;
+
+    const CBlockIndex* pindex = blockIndexLookup.Lookup(hashBlock);
+    if (pindex == nullptr || pindex->nHeight > pindexTip->nHeight ||
+        pindexTip->GetAncestor(pindex->nHeight) != pindex)
+        return 0;
+
+    return pindexTip->nHeight - pindex->nHeight + 1;
+}
+
 int CMerkleTx::GetDepthInMainChain(const CBlockIndex* &pindexRet) const
 {
     AssertLockHeld(cs_main);
@@ -5057,47 +6552,76 @@ void CWallet::GetFilteredNotes(
 {
     LOCK2(cs_main, cs_wallet);
 
-    KeyIO keyIO(Params());
-    for (auto & p : mapWallet) {
-        CWalletTx wtx = p.second;
+    // Collect the candidate notes from the address index, in the order of
+    // their outpoints, so that only the notes of the requested addresses
+    // are visited.
+    std::set<JSOutPoint> sproutOutPoints;
+    std::set<SaplingOutPoint> saplingOutPoints;
+    if (filterAddresses.empty()) {
+        for (const auto& item : mapSproutNotesByAddress) {
+            sproutOutPoints.insert(item.second.begin(), item.second.end());
+        }
+        for (const auto& item : mapSaplingNotesByAddress) {
+            saplingOutPoints.insert(item.second.begin(), item.second.end());
+        }
+    } else {
+        for (const PaymentAddress& addr : filterAddresses) {
+            if (auto sproutAddr = std::get_if<SproutPaymentAddress>(&addr)) {
+                auto it = mapSproutNotesByAddress.find(*sproutAddr);
+                if (it != mapSproutNotesByAddress.end()) {
+                    sproutOutPoints.insert(it->second.begin(), it->second.end());
+                }
+            } else if (auto saplingAddr = std::get_if<SaplingPaymentAddress>(&addr)) {
+                auto it = mapSaplingNotesByAddress.find(*saplingAddr);
+                if (it != mapSaplingNotesByAddress.end()) {
+                    saplingOutPoints.insert(it->second.begin(), it->second.end());
+                }
+            }
+        }
+    }
 
-        // Filter the transactions before checking for notes
-        if (!CheckFinalTx(wtx) ||
-            wtx.GetDepthInMainChain() < minDepth ||
-            wtx.GetDepthInMainChain() > maxDepth) {
-            continue;
+    // Returns the depth of the tx if it passes the transaction filters.
+    auto filterTx = [&](const CWalletTx& wtx) -> std::optional<int> {
+        int nDepth = wtx.GetDepthInMainChain();
+        if (!CheckFinalTx(wtx) || nDepth < minDepth || nDepth > maxDepth) {
+            return std::nullopt;
         }
 
         // Filter coinbase transactions that don't have Sapling outputs
         if (wtx.IsCoinBase() && wtx.mapSaplingNoteData.empty()) {
-            continue;
+            return std::nullopt;
         }
+        return nDepth;
+    };
 
-        for (auto & pair : wtx.mapSproutNoteData) {
-            JSOutPoint jsop = pair.first;
-            SproutNoteData nd = pair.second;
-            SproutPaymentAddress pa = nd.address;
+    KeyIO keyIO(Params());
+    for (const JSOutPoint& jsop : sproutOutPoints) {
+        const CWalletTx& wtx = mapWallet.at(jsop.hash);
+        auto nDepth = filterTx(wtx);
+        if (!nDepth) {
+            continue;
+        }
 
-            // skip notes which belong to a different payment address in the wallet
-            if (!(filterAddresses.empty() || filterAddresses.count(pa))) {
-                continue;
-            }
+        const SproutNoteData& nd = wtx.mapSproutNoteData.at(jsop);
+        SproutPaymentAddress pa = nd.address;
 
-            // skip note which has been spent
-            if (ignoreSpent && nd.nullifier && IsSproutSpent(*nd.nullifier)) {
-                continue;
-            }
+        // skip note which has been spent
+        if (ignoreSpent && nd.nullifier && IsSproutSpent(*nd.nullifier)) {
+            continue;
+        }
 
-            // skip notes which cannot be spent
-            if (requireSpendingKey && !HaveSproutSpendingKey(pa)) {
-                continue;
-            }
+        // skip notes which cannot be spent
+        if (requireSpendingKey && !HaveSproutSpendingKey(pa)) {
+            continue;
+        }
 
-            // skip locked notes
-            if (ignoreLocked && IsLockedNote(jsop)) {
-                continue;
-            }
+        // skip locked notes
+        if (ignoreLocked && IsLockedNote(jsop)) {
+            continue;
+        }
 
+        auto entry = mapSproutNoteEntries.find(jsop);
+        if (entry == mapSproutNoteEntries.end()) {
             int i = jsop.js; // Index into CTransaction.vJoinSplit
             int j = jsop.n; // Index into JSDescription.ciphertexts
 
@@ -5121,8 +6645,8 @@ void CWallet::GetFilteredNotes(
                         hSig,
                         (unsigned char) j);
 
-                sproutEntries.push_back(SproutNoteEntry {
-                    jsop, pa, plaintext.note(pa), plaintext.memo(), wtx.GetDepthInMainChain() });
+                entry = mapSproutNoteEntries.emplace(jsop, SproutNoteEntry {
+                    jsop, pa, plaintext.note(pa), plaintext.memo(), 0 }).first;
 
             } catch (const note_decryption_failed &err) {
                 // Couldn't decrypt with this spending key
@@ -5133,44 +6657,36 @@ void CWallet::GetFilteredNotes(
             }
         }
 
-        for (auto & pair : wtx.mapSaplingNoteData) {
-            SaplingOutPoint op = pair.first;
-            SaplingNoteData nd = pair.second;
-
-            auto optDeserialized = SaplingNotePlaintext::attempt_sapling_enc_decryption_deserialization(wtx.vShieldedOutput[op.n].encCiphertext, nd.ivk, wtx.vShieldedOutput[op.n].ephemeralKey);
-
-            // The transaction would not have entered the wallet unless
-            // its plaintext had been successfully decrypted previously.
-            assert(optDeserialized != std::nullopt);
-
-            auto notePt = optDeserialized.value();
-            auto maybe_pa = nd.ivk.address(notePt.d);
-            assert(static_cast<bool>(maybe_pa));
-            auto pa = maybe_pa.value();
+        sproutEntries.push_back(entry->second);
+        sproutEntries.back().confirmations = *nDepth;
+    }
 
-            // skip notes which belong to a different payment address in the wallet
-            if (!(filterAddresses.empty() || filterAddresses.count(pa))) {
-                continue;
-            }
+    for (const SaplingOutPoint& op : saplingOutPoints) {
+        const CWalletTx& wtx = mapWallet.at(op.hash);
+        auto nDepth = filterTx(wtx);
+        if (!nDepth) {
+            continue;
+        }
 
-            if (ignoreSpent && nd.nullifier && IsSaplingSpent(*nd.nullifier)) {
-                continue;
-            }
+        const SaplingNoteData& nd = wtx.mapSaplingNoteData.at(op);
+        const SaplingNoteEntry& entry = mapSaplingNoteEntries.at(op);
 
-            // skip notes which cannot be spent
-            if (requireSpendingKey && !HaveSpendingKeyForPaymentAddress(this)(pa)) {
-                continue;
-            }
+        if (ignoreSpent && nd.nullifier && IsSaplingSpent(*nd.nullifier)) {
+            continue;
+        }
 
-            // skip locked notes
-            if (ignoreLocked && IsLockedNote(op)) {
-                continue;
-            }
+        // skip notes which cannot be spent
+        if (requireSpendingKey && !HaveSpendingKeyForPaymentAddress(this)(entry.address)) {
+            continue;
+        }
 
-            auto note = notePt.note(nd.ivk).value();
-            saplingEntries.push_back(SaplingNoteEntry {
-                op, pa, note, notePt.memo(), wtx.GetDepthInMainChain() });
+        // skip locked notes
+        if (ignoreLocked && IsLockedNote(op)) {
+            continue;
         }
+
+        saplingEntries.push_back(entry);
+        saplingEntries.back().confirmations = *nDepth;
     }
 }
 
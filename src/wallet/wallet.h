@@ -8,7 +8,9 @@
 
 #include "amount.h"
 #include "asyncrpcoperation.h"
+#include "checkqueue.h"
 #include "coins.h"
+#include "compactblockindex.h"
 #include "key.h"
 #include "keystore.h"
 #include "main.h"
@@ -28,6 +30,9 @@
 #include "base58.h"
 
 #include <algorithm>
+#include <deque>
+#include <functional>
+#include <limits>
 #include <map>
 #include <optional>
 #include <set>
@@ -49,6 +54,8 @@ extern unsigned int nTxConfirmTarget;
 extern bool bSpendZeroConfChange;
 extern bool fSendFreeTransactions;
 extern bool fPayAtLeastCustomFee;
+extern int nSaplingDecryptThreads;
+extern int nWitnessUpdateThreads;
 
 static const unsigned int DEFAULT_KEYPOOL_SIZE = 100;
 //! -paytxfee default
@@ -71,13 +78,219 @@ static const bool DEFAULT_WALLETBROADCAST = true;
 //  unless there is some exceptional network disruption.
 static const unsigned int WITNESS_CACHE_SIZE = MAX_REORG_LENGTH + 1;
 
+//! -consolidationinterval default (blocks between Sapling note consolidations)
+static const int DEFAULT_CONSOLIDATION_INTERVAL = 10;
+//! Minimum number of notes an address must have for them to be consolidated
+static const size_t CONSOLIDATION_MIN_NOTES = 10;
+//! Maximum number of notes merged by one consolidation transaction
+static const size_t CONSOLIDATION_MAX_NOTES = 50;
+//! Maximum number of consolidation transactions sent per run
+static const int CONSOLIDATION_MAX_TXS = 5;
+//! Confirmations a note needs before it is consolidated
+static const int CONSOLIDATION_MIN_DEPTH = 10;
+
+//! -saplingaddresspool default (number of pregenerated Sapling addresses, 0 = disabled)
+static const unsigned int DEFAULT_SAPLING_ADDRESS_POOL_SIZE = 0;
+//! Maximum size of the Sapling address pool
+static const unsigned int MAX_SAPLING_ADDRESS_POOL_SIZE = 10000;
+//! Seconds between top-ups of the Sapling address pool
+static const int64_t SAPLING_ADDRESS_POOL_TOPUP_INTERVAL = 1;
+
+//! -walletarchivedepth default (confirmations after which spent transactions leave memory, 0 = disabled)
+static const int DEFAULT_WALLET_ARCHIVE_DEPTH = 0;
+//! Minimum -walletarchivedepth, so that archived transactions cannot be reorged out
+static const int MIN_WALLET_ARCHIVE_DEPTH = MAX_REORG_LENGTH + 1;
+
 //! Size of HD seed in bytes
 static const size_t HD_WALLET_SEED_LENGTH = 32;
+//! -walletdecryptthreads default (number of Sapling trial decryption threads, 0 = auto)
+static const int DEFAULT_SAPLING_DECRYPT_THREADS = 0;
+//! Maximum number of Sapling trial decryption threads allowed
+static const int MAX_SAPLING_DECRYPT_THREADS = 16;
+//! Number of incoming viewing keys tried against a transaction's outputs by one trial decryption job
+static const size_t SAPLING_TRIAL_DECRYPTION_KEYS_PER_JOB = 64;
+//! Number of blocks read and trial-decrypted ahead of the commit stage of a rescan
+static const size_t WALLET_RESCAN_READ_AHEAD = 32;
+//! -walletwitnessthreads default (number of note witness update threads, 0 = auto)
+static const int DEFAULT_WITNESS_UPDATE_THREADS = 1;
+//! Maximum number of note witness update threads allowed
+static const int MAX_WITNESS_UPDATE_THREADS = 16;
+//! Minimum number of note witnesses updated by one witness update job
+static const size_t WITNESS_UPDATE_WITNESSES_PER_JOB = 1000;
+//! Number of balances cached between changes to the wallet, the chain tip or the mempool
+static const size_t MAX_BALANCE_CACHE_ENTRIES = 1000;
 
 extern const char * DEFAULT_WALLET_DAT;
 
 class CBlockIndex;
 class CCoinControl;
+
+/**
+ * Closure representing the trial decryption of all the Sapling outputs of a
+ * transaction with a contiguous range of incoming viewing keys, and with a
+ * contiguous range of outgoing viewing keys in the same pass over the
+ * outputs. The key agreements for the whole ivk range are computed in one
+ * batch. For each output i, the index of the first key in the ivk range that
+ * decrypts it, if any, is written to (*pmatches)[i * nJobs + nJob], and the
+ * index of the first key in the ovk range that recovers it, if any, to
+ * (*povkMatches)[i * nJobs + nJob].
+ * Note that this stores references to its inputs, which must outlive it.
+ */
+class CSaplingTrialDecryption
+{
+private:
+    const Consensus::Params* pparams;
+    int height;
+    const std::vector<OutputDescription>* poutputs;
+    const std::vector<libzcash::SaplingIncomingViewingKey>* pivks;
+    size_t ivkBegin;
+    size_t ivkEnd;
+    std::vector<std::optional<size_t>>* pmatches;
+    const std::vector<uint256>* povks;
+    size_t ovkBegin;
+    size_t ovkEnd;
+    std::vector<std::optional<size_t>>* povkMatches;
+    size_t nJobs;
+    size_t nJob;
+
+public:
+    CSaplingTrialDecryption(): pparams(nullptr), height(0), poutputs(nullptr),
+        pivks(nullptr), ivkBegin(0), ivkEnd(0), pmatches(nullptr),
+        povks(nullptr), ovkBegin(0), ovkEnd(0), povkMatches(nullptr), nJobs(0), nJob(0) {}
+    CSaplingTrialDecryption(
+        const Consensus::Params& paramsIn, int heightIn,
+        const std::vector<OutputDescription>& outputsIn,
+        const std::vector<libzcash::SaplingIncomingViewingKey>& ivksIn,
+        size_t ivkBeginIn, size_t ivkEndIn,
+        std::vector<std::optional<size_t>>& matchesIn,
+        const std::vector<uint256>& ovksIn,
+        size_t ovkBeginIn, size_t ovkEndIn,
+        std::vector<std::optional<size_t>>& ovkMatchesIn,
+        size_t nJobsIn, size_t nJobIn) :
+        pparams(&paramsIn), height(heightIn), poutputs(&outputsIn),
+        pivks(&ivksIn), ivkBegin(ivkBeginIn), ivkEnd(ivkEndIn), pmatches(&matchesIn),
+        povks(&ovksIn), ovkBegin(ovkBeginIn), ovkEnd(ovkEndIn), povkMatches(&ovkMatchesIn),
+        nJobs(nJobsIn), nJob(nJobIn) {}
+
+    bool operator()();
+
+    void swap(CSaplingTrialDecryption &check) {
+        std::swap(pparams, check.pparams);
+        std::swap(height, check.height);
+        std::swap(poutputs, check.poutputs);
+        std::swap(pivks, check.pivks);
+        std::swap(ivkBegin, check.ivkBegin);
+        std::swap(ivkEnd, check.ivkEnd);
+        std::swap(pmatches, check.pmatches);
+        std::swap(povks, check.povks);
+        std::swap(ovkBegin, check.ovkBegin);
+        std::swap(ovkEnd, check.ovkEnd);
+        std::swap(povkMatches, check.povkMatches);
+        std::swap(nJobs, check.nJobs);
+        std::swap(nJob, check.nJob);
+    }
+};
+
+/** Run an instance of the Sapling trial decryption thread */
+void ThreadSaplingTrialDecryption();
+
+/**
+ * A block read ahead of the commit stage of a rescan, together with the
+ * results of trial-decrypting its Sapling outputs.
+ */
+struct CRescanBlock
+{
+    //! Whether block has been read. If not, the commit stage reads it itself.
+    bool fHaveBlock = false;
+    CBlock block;
+    //! For each transaction in block, the result of trial-decrypting its Sapling outputs
+    std::vector<std::vector<std::optional<size_t>>> vSaplingMatches;
+
+    //! Whether compactBlock has been read from the compact block index
+    bool fHaveCompactBlock = false;
+    CCompactBlock compactBlock;
+    //! Whether any output of compactBlock decrypts with one of the keys
+    bool fCompactBlockHasNotes = false;
+};
+
+/**
+ * Closure representing the read-ahead stage of a rescan for one block: reading
+ * it from disk (or from the compact block index, if fCompact is set) and
+ * trial-decrypting its Sapling outputs with the given incoming viewing keys.
+ * This only reads the keys it is given, so it can run without cs_KeyStore.
+ * Note that this stores references to its inputs, which must outlive it.
+ */
+class CRescanBlockRead
+{
+private:
+    const Consensus::Params* pparams;
+    const CBlockIndex* pindex;
+    const std::vector<libzcash::SaplingIncomingViewingKey>* pivks;
+    bool fCompact;
+    CRescanBlock* presult;
+
+public:
+    CRescanBlockRead(): pparams(nullptr), pindex(nullptr), pivks(nullptr), fCompact(false), presult(nullptr) {}
+    CRescanBlockRead(
+        const Consensus::Params& paramsIn, const CBlockIndex* pindexIn,
+        const std::vector<libzcash::SaplingIncomingViewingKey>& ivksIn,
+        bool fCompactIn, CRescanBlock& resultIn) :
+        pparams(&paramsIn), pindex(pindexIn), pivks(&ivksIn), fCompact(fCompactIn), presult(&resultIn) {}
+
+    bool operator()();
+
+    void swap(CRescanBlockRead &check) {
+        std::swap(pparams, check.pparams);
+        std::swap(pindex, check.pindex);
+        std::swap(pivks, check.pivks);
+        std::swap(fCompact, check.fCompact);
+        std::swap(presult, check.presult);
+    }
+};
+
+/** Run an instance of the rescan read-ahead thread */
+void ThreadWalletRescanRead();
+
+/**
+ * A job that appends a batch of note commitments to a shard of the latest
+ * note witnesses in the wallet (see CWallet::IncrementNoteWitnesses). The
+ * shards are disjoint, so the jobs can run concurrently. Returns false if
+ * the commitments could not be appended because the tree is full.
+ * Note that this stores a reference to the commitments, which must outlive it.
+ */
+class CNoteWitnessAppend
+{
+private:
+    std::vector<SproutWitness*> sproutWitnesses;
+    const std::vector<libzcash::SHA256Compress>* psproutCommitments;
+    std::vector<SaplingWitness*> saplingWitnesses;
+    const std::vector<libzcash::PedersenHash>* psaplingCommitments;
+
+public:
+    CNoteWitnessAppend(): psproutCommitments(nullptr), psaplingCommitments(nullptr) {}
+    CNoteWitnessAppend(
+        std::vector<SproutWitness*> witnessesIn,
+        const std::vector<libzcash::SHA256Compress>& commitmentsIn) :
+        sproutWitnesses(witnessesIn), psproutCommitments(&commitmentsIn),
+        psaplingCommitments(nullptr) {}
+    CNoteWitnessAppend(
+        std::vector<SaplingWitness*> witnessesIn,
+        const std::vector<libzcash::PedersenHash>& commitmentsIn) :
+        psproutCommitments(nullptr), saplingWitnesses(witnessesIn),
+        psaplingCommitments(&commitmentsIn) {}
+
+    bool operator()();
+
+    void swap(CNoteWitnessAppend &check) {
+        sproutWitnesses.swap(check.sproutWitnesses);
+        std::swap(psproutCommitments, check.psproutCommitments);
+        saplingWitnesses.swap(check.saplingWitnesses);
+        std::swap(psaplingCommitments, check.psaplingCommitments);
+    }
+};
+
+/** Run an instance of the note witness update thread */
+void ThreadNoteWitnessUpdate();
 class COutput;
 class CReserveKey;
 class CScript;
@@ -394,6 +607,13 @@ public:
     int GetDepthInMainChain(const CBlockIndex* &pindexRet) const;
     int GetDepthInMainChain() const { const CBlockIndex *pindexRet; return GetDepthInMainChain(pindexRet); }
     bool IsInMainChain() const { const CBlockIndex *pindexRet; return GetDepthInMainChainINTERNAL(pindexRet) > 0; }
+    /**
+     * Return how many blocks deep the transaction is in the chain ending at
+     * pindexTip, or 0 if it is not in that chain. This takes no lock: it
+     * finds the block through blockIndexLookup and only walks the ancestors
+     * of pindexTip. The merkle branch is not checked.
+     */
+    int GetDepthInChain(const CBlockIndex* pindexTip) const;
     int GetBlocksToMaturity() const;
     /** Pass this transaction to the mempool. Fails if absolute fee exceeds maxTxFee. */
     bool AcceptToMemoryPool(bool fLimitFree=true, bool fRejectAbsurdFee=true);
@@ -563,6 +783,8 @@ public:
 
     void SetSproutNoteData(mapSproutNoteData_t &noteData);
     void SetSaplingNoteData(mapSaplingNoteData_t &noteData);
+    /** Drop the cached witnesses of the notes, as for a never-witnessed note. */
+    void ClearNoteWitnesses();
 
     std::pair<libzcash::SproutNotePlaintext, libzcash::SproutPaymentAddress> DecryptSproutNote(
         JSOutPoint jsop) const;
@@ -572,6 +794,8 @@ public:
     std::optional<std::pair<
         libzcash::SaplingNotePlaintext,
         libzcash::SaplingPaymentAddress>> DecryptSaplingNoteWithoutLeadByteCheck(SaplingOutPoint op) const;
+    /** Decrypt the notes in mapSaplingNoteData, without checking their lead byte. */
+    std::vector<SaplingNoteEntry> DecryptSaplingNoteEntries() const;
     std::optional<std::pair<
         libzcash::SaplingNotePlaintext,
         libzcash::SaplingPaymentAddress>> RecoverSaplingNote(const Consensus::Params& params, int height,
@@ -612,6 +836,35 @@ public:
     std::set<uint256> GetConflicts() const;
 };
 
+/**
+ * What the wallet keeps in memory of a transaction it has archived under
+ * -walletarchivedepth: the outputs and notes that the transaction spends, so
+ * that they stay spent, and its transparent outputs that are ours, so that
+ * the transactions that spend them keep their debit. The transaction itself
+ * is only read from wallet.dat when it is asked for.
+ */
+class CArchivedWalletTx
+{
+public:
+    std::vector<COutPoint> vPrevouts;
+    std::vector<uint256> vSproutNullifiers;
+    std::vector<uint256> vSaplingNullifiers;
+    std::map<uint32_t, CTxOut> mapOurOutputs;
+
+    CArchivedWalletTx() {}
+    CArchivedWalletTx(const CWalletTx& wtx, const CKeyStore& keystore);
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(vPrevouts);
+        READWRITE(vSproutNullifiers);
+        READWRITE(vSaplingNullifiers);
+        READWRITE(mapOurOutputs);
+    }
+};
+
 
 
 
@@ -772,6 +1025,54 @@ private:
     int nSetChainUpdates;
     bool fBroadcastTransactions;
 
+    /**
+     * Balances computed since the wallet, the chain tip or the mempool last
+     * changed, keyed by a description of the query. See GetCachedBalance().
+     */
+    mutable std::map<std::string, CAmount> mapBalanceCache;
+    mutable uint256 hashBalanceCacheTip;
+    mutable unsigned int nBalanceCacheMempoolUpdates;
+
+    /**
+     * The transparent outputs that AvailableCoins() considers, in mapWallet
+     * order: every output of a wallet transaction that is ours, except those
+     * spent by a wallet transaction in the active chain. Other outputs may
+     * still be in it; AvailableCoins() checks each one as before, and drops
+     * those it finds spent in the chain. It is rebuilt from mapWallet when
+     * fUnspentOutputsStale is set, after a change that can make outputs
+     * already in the wallet ours, or unspent again.
+     */
+    mutable std::set<COutPoint> setUnspentOutputs;
+    mutable bool fUnspentOutputsStale;
+
+    void AddUnspentOutputs(const CWalletTx& wtx);
+    void RebuildUnspentOutputs() const;
+    bool IsSpentInChain(const COutPoint& outpoint) const;
+
+    /**
+     * The wallet transactions by nOrderPos. It is rebuilt from mapWallet
+     * when fOrderedTxsStale is set, after the wallet is loaded or the order
+     * of its transactions changes; a new transaction, which takes the next
+     * position, is added at the end. See GetOrderedTxs().
+     */
+    std::multimap<int64_t, CWalletTx*> mapOrderedTxs;
+    bool fOrderedTxsStale;
+
+    /**
+     * The ids of the wallet transactions in each block, by the hashBlock
+     * they were last seen in; those seen in no block are under the null
+     * hash. setStaleTxBlocks holds the blocks in the map that may no longer
+     * be in the active chain: those disconnected since the wallet was
+     * loaded, and, after fStaleTxBlocksUnknown is cleared by a scan of the
+     * map, those that already were not when it was loaded.
+     */
+    std::map<uint256, std::set<uint256>> mapTxsByBlock;
+    std::set<uint256> setStaleTxBlocks;
+    bool fStaleTxBlocksUnknown;
+
+    void AddToTxsByBlock(const uint256& hashBlock, const uint256& hash);
+    void EraseFromTxsByBlock(const uint256& hashBlock, const uint256& hash);
+
     template <class T>
     using TxSpendMap = std::multimap<T, uint256>;
     /**
@@ -791,12 +1092,29 @@ private:
 
     std::vector<CTransaction> pendingSaplingMigrationTxs;
     AsyncRPCOperationId saplingMigrationOperationId;
+    AsyncRPCOperationId saplingConsolidationOperationId;
 
     void AddToTransparentSpends(const COutPoint& outpoint, const uint256& wtxid);
     void AddToSproutSpends(const uint256& nullifier, const uint256& wtxid);
     void AddToSaplingSpends(const uint256& nullifier, const uint256& wtxid);
     void AddToSpends(const uint256& wtxid);
 
+    /**
+     * The transactions archived under -walletarchivedepth, which are not in
+     * mapWallet: those whose outputs and notes that are ours were all spent,
+     * at least nArchiveDepth blocks deep, by transactions that were too. The
+     * spends of an archived transaction stay in mapTxSpends and the nullifier
+     * maps, and count as spent in the chain. See ArchiveSpentTxs().
+     */
+    std::map<uint256, CArchivedWalletTx> mapArchivedTxs;
+
+    /** Whether wtx can be archived, with depths taken in the chain ending at pindexTip. */
+    bool IsArchivable(const CWalletTx& wtx, const CBlockIndex* pindexTip) const;
+    /** The output of an archived transaction spent by outpoint, if it is ours. */
+    const CTxOut* GetArchivedOutput(const COutPoint& outpoint) const;
+    /** Move an archived transaction back into mapWallet, for a rescan that finds it again. */
+    bool UnarchiveTx(const uint256& hash);
+
 public:
     /*
      * Size of the incremental witness cache for the notes in our wallet.
@@ -805,8 +1123,22 @@ public:
      */
     int64_t nWitnessCacheSize;
     bool fSaplingMigrationEnabled = false;
+    bool fSaplingConsolidationEnabled = false;
+    int nSaplingConsolidationInterval = DEFAULT_CONSOLIDATION_INTERVAL;
+    CAmount nSaplingConsolidationFee = DEFAULT_FEE;
+    unsigned int nSaplingAddressPoolSize = DEFAULT_SAPLING_ADDRESS_POOL_SIZE;
+    bool fSaplingAddressPoolDiversified = false;
 
     void ClearNoteWitnessCache();
+    /**
+     * Load the note witness records read from wallet.dat into the notes of
+     * mapWallet. Witnesses that an older version stored in the transaction
+     * records are kept for notes that have no witness records, and will be
+     * moved into witness records by the next SetBestChain().
+     */
+    void LoadNoteWitnesses(
+        std::map<JSOutPoint, std::map<int, SproutWitness>>& sproutWitnesses,
+        std::map<SaplingOutPoint, std::map<int, SaplingWitness>>& saplingWitnesses);
 
 protected:
     /**
@@ -817,9 +1149,100 @@ protected:
                                 SproutMerkleTree& sproutTree,
                                 SaplingMerkleTree& saplingTree);
     /**
-     * pindex is the old tip being disconnected.
+     * As above, but using only the Sapling data of the block. The caller
+     * must ensure that no Sprout note witnesses are behind pindex, because
+     * the block's Sprout commitments are not available.
+     */
+    void IncrementNoteWitnesses(const CBlockIndex* pindex,
+                                const CCompactBlock& block,
+                                SaplingMerkleTree& saplingTree);
+    /**
+     * pindex is the old tip being disconnected, along with the nBlocks - 1
+     * blocks below it.
+     */
+    void DecrementNoteWitnesses(const CBlockIndex* pindex, int nBlocks = 1);
+
+    /**
+     * The heights of the oldest and newest witness records on disk for each
+     * note, as of the last SetBestChain().
      */
-    void DecrementNoteWitnesses(const CBlockIndex* pindex);
+    std::map<JSOutPoint, std::pair<int, int>> mapSproutWitnessRecords;
+    std::map<SaplingOutPoint, std::pair<int, int>> mapSaplingWitnessRecords;
+    /**
+     * The lowest height at which note witnesses have been incremented or
+     * decremented since the last SetBestChain(). Witnesses at or above it may
+     * differ from their records, and witnesses below it may not.
+     */
+    int nWitnessesDirtyHeight;
+    /**
+     * Transactions with note data, other than witnesses, that has changed
+     * since it was last written (such as Sapling nullifiers, which depend on
+     * the witnessed position of the note).
+     */
+    std::set<uint256> setNoteDataDirty;
+
+    /**
+     * Write the witnesses that have changed since the last SetBestChain()
+     * (as recorded in records) and erase those that are no longer cached,
+     * updating records to match.
+     */
+    template <typename WalletDB, typename NoteDataMap>
+    bool WriteNoteWitnesses(WalletDB& walletdb, NoteDataMap CWalletTx::*noteDataMap,
+                            std::map<typename NoteDataMap::key_type, std::pair<int, int>>& records)
+    {
+        // Erase the records of notes that are no longer in the wallet
+        for (auto it = records.begin(); it != records.end(); ) {
+            auto wtxIt = mapWallet.find(it->first.hash);
+            if (wtxIt == mapWallet.end() || !(wtxIt->second.*noteDataMap).count(it->first)) {
+                for (int nHeight = it->second.first; nHeight <= it->second.second; nHeight++) {
+                    if (!walletdb.EraseNoteWitness(it->first, nHeight)) {
+                        return false;
+                    }
+                }
+                it = records.erase(it);
+            } else {
+                it++;
+            }
+        }
+
+        for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
+            for (const auto& item : wtxItem.second.*noteDataMap) {
+                const auto& nd = item.second;
+                auto it = records.find(item.first);
+                // The newest witness is at witnessHeight, and each one after
+                // it is one block older.
+                int nNewest = nd.witnessHeight;
+                int nOldest = nd.witnessHeight - (int)nd.witnesses.size() + 1;
+
+                if (it != records.end()) {
+                    for (int nHeight = it->second.first; nHeight <= it->second.second; nHeight++) {
+                        if ((nHeight < nOldest || nHeight > nNewest) &&
+                            !walletdb.EraseNoteWitness(item.first, nHeight)) {
+                            return false;
+                        }
+                    }
+                }
+
+                int nHeight = nNewest;
+                for (const auto& witness : nd.witnesses) {
+                    bool fRecorded = it != records.end() &&
+                        it->second.first <= nHeight && nHeight <= it->second.second;
+                    if ((!fRecorded || nHeight >= nWitnessesDirtyHeight) &&
+                        !walletdb.WriteNoteWitness(item.first, nHeight, witness)) {
+                        return false;
+                    }
+                    nHeight--;
+                }
+
+                if (!nd.witnesses.empty()) {
+                    records[item.first] = std::make_pair(nOldest, nNewest);
+                } else if (it != records.end()) {
+                    records.erase(it);
+                }
+            }
+        }
+        return true;
+    }
 
     template <typename WalletDB>
     void SetBestChainINTERNAL(WalletDB& walletdb, const CBlockLocator& loc) {
@@ -828,21 +1251,25 @@ protected:
             LogPrintf("SetBestChain(): Couldn't start atomic write\n");
             return;
         }
+        auto sproutRecords = mapSproutWitnessRecords;
+        auto saplingRecords = mapSaplingWitnessRecords;
         try {
-            for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
-                auto wtx = wtxItem.second;
-                // We skip transactions for which mapSproutNoteData and mapSaplingNoteData
-                // are empty. This covers transactions that have no Sprout or Sapling data
-                // (i.e. are purely transparent), as well as shielding and unshielding
-                // transactions in which we only have transparent addresses involved.
-                if (!(wtx.mapSproutNoteData.empty() && wtx.mapSaplingNoteData.empty())) {
-                    if (!walletdb.WriteTx(wtxItem.first, wtx)) {
-                        LogPrintf("SetBestChain(): Failed to write CWalletTx, aborting atomic write\n");
-                        walletdb.TxnAbort();
-                        return;
-                    }
+            // The witnesses are written separately from the transactions, so
+            // that only the ones that have changed need to be written.
+            for (const uint256& hash : setNoteDataDirty) {
+                auto it = mapWallet.find(hash);
+                if (it != mapWallet.end() && !walletdb.WriteTx(hash, it->second)) {
+                    LogPrintf("SetBestChain(): Failed to write CWalletTx, aborting atomic write\n");
+                    walletdb.TxnAbort();
+                    return;
                 }
             }
+            if (!WriteNoteWitnesses(walletdb, &CWalletTx::mapSproutNoteData, sproutRecords) ||
+                !WriteNoteWitnesses(walletdb, &CWalletTx::mapSaplingNoteData, saplingRecords)) {
+                LogPrintf("SetBestChain(): Failed to write note witnesses, aborting atomic write\n");
+                walletdb.TxnAbort();
+                return;
+            }
             if (!walletdb.WriteWitnessCacheSize(nWitnessCacheSize)) {
                 LogPrintf("SetBestChain(): Failed to write nWitnessCacheSize, aborting atomic write\n");
                 walletdb.TxnAbort();
@@ -865,12 +1292,17 @@ protected:
             LogPrintf("SetBestChain(): Couldn't commit atomic write\n");
             return;
         }
+        mapSproutWitnessRecords.swap(sproutRecords);
+        mapSaplingWitnessRecords.swap(saplingRecords);
+        nWitnessesDirtyHeight = std::numeric_limits<int>::max();
+        setNoteDataDirty.clear();
     }
 
 private:
     template <class T>
     void SyncMetaData(std::pair<typename TxSpendMap<T>::iterator, typename TxSpendMap<T>::iterator>);
     void ChainTipAdded(const CBlockIndex *pindex, const CBlock *pblock, SproutMerkleTree sproutTree, SaplingMerkleTree saplingTree);
+    void MaybeSetBestChain(const CBlockIndex *pindex);
 
 protected:
     bool UpdatedNoteData(const CWalletTx& wtxIn, CWalletTx& wtx);
@@ -879,6 +1311,17 @@ protected:
     /* the hd chain data model (chain counters) */
     CHDChain hdChain;
 
+    /* Sapling addresses generated ahead of z_getnewaddress, oldest first */
+    std::deque<libzcash::SaplingPaymentAddress> saplingAddressPool;
+    /* The key whose diversified addresses fill the pool */
+    std::optional<libzcash::SaplingExtendedFullViewingKey> saplingPoolXFVK;
+    /* The diversifier index of each diversified address handed out by the wallet */
+    std::map<libzcash::SaplingPaymentAddress, libzcash::diversifier_index_t> mapSaplingDiversifierIndex;
+    /* The next diversifier index to try, for each key that has handed out diversified addresses */
+    std::map<libzcash::SaplingIncomingViewingKey, libzcash::diversifier_index_t> mapSaplingNextDiversifier;
+
+    libzcash::SaplingPaymentAddress GenerateSaplingPoolAddress();
+
 public:
     /*
      * Main wallet lock.
@@ -932,9 +1375,14 @@ public:
         nLastResend = 0;
         nLastSetChain = 0;
         nSetChainUpdates = 0;
+        nBalanceCacheMempoolUpdates = 0;
+        fUnspentOutputsStale = true;
+        fOrderedTxsStale = true;
+        fStaleTxBlocksUnknown = true;
         nTimeFirstKey = 0;
         fBroadcastTransactions = false;
         nWitnessCacheSize = 0;
+        nWitnessesDirtyHeight = std::numeric_limits<int>::max();
     }
 
     /**
@@ -989,6 +1437,22 @@ public:
 
     std::map<uint256, SaplingOutPoint> mapSaplingNullifiersToNotes;
 
+    /**
+     * Index of the notes in mapWallet by payment address, so that
+     * GetFilteredNotes only visits the notes of the addresses it is asked
+     * for. The decrypted Sapling notes are kept with the index, and are also
+     * used to compute nullifiers and by z_viewtransaction; Sprout notes are
+     * decrypted the first time they are returned, since their decryptors may
+     * not be loaded yet when the transactions are. An entry only depends on
+     * its outpoint, so LoadWallet can decrypt the notes ahead of their
+     * transactions. The confirmations of the cached entries are not kept up
+     * to date.
+     */
+    std::map<libzcash::SproutPaymentAddress, std::set<JSOutPoint>> mapSproutNotesByAddress;
+    std::map<libzcash::SaplingPaymentAddress, std::set<SaplingOutPoint>> mapSaplingNotesByAddress;
+    std::map<JSOutPoint, SproutNoteEntry> mapSproutNoteEntries;
+    std::map<SaplingOutPoint, SaplingNoteEntry> mapSaplingNoteEntries;
+
     std::map<uint256, CWalletTx> mapWallet;
 
     int64_t nOrderPosNext;
@@ -1006,6 +1470,22 @@ public:
 
     const CWalletTx* GetWalletTx(const uint256& hash) const;
 
+    //! Confirmations after which fully spent transactions are archived (-walletarchivedepth, 0 = never)
+    int nArchiveDepth = DEFAULT_WALLET_ARCHIVE_DEPTH;
+
+    bool IsArchivedTx(const uint256& hash) const;
+    size_t GetArchivedTxCount() const;
+    /** Read an archived transaction from wallet.dat. */
+    bool GetArchivedTx(const uint256& hash, CWalletTx& wtx);
+    void LoadArchivedTx(const uint256& hash, const CArchivedWalletTx& archived);
+    /**
+     * Write the transactions in mapWallet that can be archived, as of the
+     * chain ending at pindexTip, to archive records in wallet.dat, and
+     * remove them and their notes from memory. This does not take cs_main.
+     * Returns the number of transactions archived.
+     */
+    size_t ArchiveSpentTxs(const CBlockIndex* pindexTip);
+
     //! check whether we are allowed to upgrade (or already support) to the named feature
     bool CanSupportFeature(enum WalletFeature wf) { AssertLockHeld(cs_wallet); return nWalletMaxVersion >= wf; }
 
@@ -1125,6 +1605,34 @@ public:
     libzcash::SaplingPaymentAddress GenerateNewSaplingZKey();
     //! Adds Sapling spending key to the store, and saves it to disk
     bool AddSaplingZKey(const libzcash::SaplingExtendedSpendingKey &key);
+    /**
+     * Returns a new Sapling address for z_getnewaddress, from the address
+     * pool if it has one, and otherwise from a new key.
+     */
+    libzcash::SaplingPaymentAddress GetNewSaplingAddress();
+    /**
+     * Generate addresses until the pool holds -saplingaddresspool of them.
+     * The lock is taken for one address at a time, so that z_getnewaddress
+     * waits for at most one. Does nothing while the wallet is locked.
+     */
+    void TopUpSaplingAddressPool();
+    //! The addresses in the pool, which have not been handed out yet
+    std::set<libzcash::SaplingPaymentAddress> GetSaplingAddressPool() const;
+    /**
+     * Returns the next diversified address of extfvk, and its diversifier
+     * index, and records it so that it is not handed out again. The default
+     * address is not handed out, as GenerateNewSaplingZKey returns it.
+     */
+    std::pair<libzcash::SaplingPaymentAddress, libzcash::diversifier_index_t>
+        GenerateDiversifiedSaplingAddress(const libzcash::SaplingExtendedFullViewingKey &extfvk);
+    //! Records a diversified address handed out before, without saving it to disk (used by LoadWallet)
+    void LoadSaplingDiversifiedAddress(
+        const libzcash::SaplingPaymentAddress &addr,
+        const libzcash::SaplingIncomingViewingKey &ivk,
+        const libzcash::diversifier_index_t &j);
+    //! The diversifier index of addr, if the wallet handed it out as a diversified address
+    std::optional<libzcash::diversifier_index_t> GetSaplingDiversifierIndex(
+        const libzcash::SaplingPaymentAddress &addr) const;
     //! Add Sapling full viewing key to the wallet.
     //!
     //! This overrides CBasicKeyStore::AddSaplingFullViewingKey to persist the
@@ -1169,20 +1677,56 @@ public:
      */
     TxItems OrderedTxItems(std::list<CAccountingEntry>& acentries, std::string strAccount = "");
 
+    /**
+     * Return the wallet transactions by nOrderPos, without the accounting
+     * entries that OrderedTxItems() adds. Requires cs_wallet; the returned
+     * map is only valid while it is held.
+     */
+    const std::multimap<int64_t, CWalletTx*>& GetOrderedTxs();
+    //! Forget the order of the transactions, after their nOrderPos changed.
+    void MarkOrderedTxsStale();
+
+    /**
+     * Return the ids of the wallet transactions that may not be in the
+     * active chain at or below pindex: those in blocks of the active chain
+     * after its fork from pindex, in blocks that are no longer in the active
+     * chain, and in no block. Requires cs_main and cs_wallet.
+     */
+    std::set<uint256> GetTxsSinceBlock(const CBlockIndex* pindex);
+
     void MarkDirty();
     bool UpdateNullifierNoteMap();
     void UpdateNullifierNoteMapWithTx(const CWalletTx& wtx);
+    void IndexNotes(const CWalletTx& wtx);
+    void LoadSaplingNoteEntry(const SaplingNoteEntry& entry);
+    void UnindexNotes(const CWalletTx& wtx);
     void UpdateSaplingNullifierNoteMapWithTx(CWalletTx& wtx);
     void UpdateSaplingNullifierNoteMapForBlock(const CBlock* pblock);
     bool AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletDB* pwalletdb);
     void SyncTransaction(const CTransaction& tx, const CBlock* pblock, const int nHeight);
     bool AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pblock, const int nHeight, bool fUpdate);
+    /**
+     * As above, with the result of FindMySaplingNotes for tx already known.
+     */
+    bool AddToWalletIfInvolvingMe(
+        const CTransaction& tx, const CBlock* pblock, const int nHeight, bool fUpdate,
+        const std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap>& saplingNoteDataAndAddressesToAdd);
+    /**
+     * As above, for a rescan in which only the Sapling keys ivks are new,
+     * with the result of trial-decrypting the outputs of tx with them.
+     */
+    bool AddToWalletIfInvolvingNewSaplingKeys(
+        const CTransaction& tx, const CBlock* pblock, const int nHeight, bool fUpdate,
+        const std::vector<libzcash::SaplingIncomingViewingKey>& ivks,
+        const std::vector<std::optional<size_t>>& matches);
     void EraseFromWallet(const uint256 &hash);
     void WitnessNoteCommitment(
          std::vector<uint256> commitments,
          std::vector<std::optional<SproutWitness>>& witnesses,
          uint256 &final_anchor);
-    int ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate = false);
+    bool HaveSproutNoteWitnessesBehind(int nHeight) const;
+    int ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate = false,
+                                  const std::vector<libzcash::SaplingIncomingViewingKey>* pNewSaplingIvks = nullptr);
     void ReacceptWalletTransactions();
     void ResendWalletTransactions(int64_t nBestBlockTime);
     std::vector<uint256> ResendWalletTransactionsBefore(int64_t nTime);
@@ -1193,6 +1737,15 @@ public:
     CAmount GetUnconfirmedWatchOnlyBalance() const;
     CAmount GetImmatureWatchOnlyBalance() const;
 
+    /**
+     * Return the balance computed by the given function, which is remembered
+     * under strKey until the wallet, the chain tip or the mempool changes.
+     * Requires cs_main and cs_wallet.
+     */
+    CAmount GetCachedBalance(const std::string& strKey, const std::function<CAmount()>& compute) const;
+    //! Forget the cached balances, after a change that may affect them.
+    void InvalidateBalanceCache();
+
     /**
      * Insert additional inputs into the transaction by
      * calling CreateTransaction();
@@ -1241,8 +1794,43 @@ public:
         uint8_t n) const;
     mapSproutNoteData_t FindMySproutNotes(const CTransaction& tx) const;
     std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap> FindMySaplingNotes(const CTransaction& tx, int height) const;
+    /**
+     * As above, spreading trial decryption over the workers of pqueue if it
+     * is non-null and there is enough work to be worth it.
+     */
+    std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap> FindMySaplingNotes(
+        const CTransaction& tx, int height,
+        CCheckQueue<CSaplingTrialDecryption>* pqueue) const;
+    /**
+     * As above, also trying the outgoing viewing keys ovks on each output in
+     * the same pass. For each output, the index in ovks of the first key that
+     * recovers it, if any, is returned in ovkMatches.
+     */
+    std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap> FindMySaplingNotes(
+        const CTransaction& tx, int height,
+        CCheckQueue<CSaplingTrialDecryption>* pqueue,
+        const std::vector<uint256>& ovks,
+        std::vector<std::optional<size_t>>& ovkMatches) const;
+    /**
+     * Returns, for each Sapling output of tx, the index in ovks of the first
+     * outgoing viewing key that recovers it, if any. The keys are tried in
+     * batches on the -walletdecryptthreads threads.
+     */
+    std::vector<std::optional<size_t>> FindSaplingOutputsSentWith(
+        const CTransaction& tx,
+        const std::vector<uint256>& ovks) const;
+    /**
+     * Builds the Sapling note data for tx from the results of trial
+     * decryption, where matches[i] is the index in ivks of the key that
+     * decrypts output i, if any.
+     */
+    std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap> SaplingNotesForMatches(
+        const CTransaction& tx, int height,
+        const std::vector<libzcash::SaplingIncomingViewingKey>& ivks,
+        const std::vector<std::optional<size_t>>& matches) const;
     bool IsSproutNullifierFromMe(const uint256& nullifier) const;
     bool IsSaplingNullifierFromMe(const uint256& nullifier) const;
+    bool CompactBlockHasSaplingNullifierFromMe(const CCompactBlock& block) const;
 
     void GetSproutNoteWitnesses(
          std::vector<JSOutPoint> notes,
@@ -1269,7 +1857,9 @@ public:
         const CBlockIndex *pindex,
         const CBlock *pblock,
         std::optional<std::pair<SproutMerkleTree, SaplingMerkleTree>> added);
+    void BlocksDisconnected(const CBlockIndex *pindexOldTip, int nBlocks);
     void RunSaplingMigration(int blockHeight);
+    void RunSaplingConsolidation(int blockHeight);
     void AddPendingSaplingMigrationTx(const CTransaction& tx);
     /** Saves witness caches and best block locator to disk. */
     void SetBestChain(const CBlockLocator& loc);
@@ -1326,6 +1916,12 @@ public:
     //! Flush wallet (bitdb flush)
     void Flush(bool shutdown=false);
 
+    /**
+     * Estimate the memory used by mapWallet, by the witnesses cached for its
+     * notes, and by the note indexes and nullifier maps, in bytes.
+     */
+    void GetMemoryUsage(size_t& nTransactions, size_t& nWitnesses, size_t& nNotes) const;
+
     //! Verify the wallet database and perform salvage if required
     static bool Verify();
     
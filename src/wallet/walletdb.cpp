@@ -61,7 +61,10 @@ bool CWalletDB::ErasePurpose(const string& strPurpose)
 bool CWalletDB::WriteTx(uint256 hash, const CWalletTx& wtx)
 {
     nWalletDBUpdateCounter++;
-    return Write(std::make_pair(std::string("tx"), hash), wtx);
+    // Note witnesses are written separately, see WriteNoteWitness().
+    CWalletTx wtxOut = wtx;
+    wtxOut.ClearNoteWitnesses();
+    return Write(std::make_pair(std::string("tx"), hash), wtxOut);
 }
 
 bool CWalletDB::EraseTx(uint256 hash)
@@ -70,6 +73,54 @@ bool CWalletDB::EraseTx(uint256 hash)
     return Erase(std::make_pair(std::string("tx"), hash));
 }
 
+bool CWalletDB::WriteArchivedTx(uint256 hash, const CArchivedWalletTx& archived, const CWalletTx& wtx)
+{
+    nWalletDBUpdateCounter++;
+    // The summary comes first, so that LoadWallet reads only that.
+    CWalletTx wtxOut = wtx;
+    wtxOut.ClearNoteWitnesses();
+    return Write(std::make_pair(std::string("archivedtx"), hash), std::make_pair(archived, wtxOut));
+}
+
+bool CWalletDB::ReadArchivedTx(uint256 hash, CWalletTx& wtx)
+{
+    std::pair<CArchivedWalletTx, CWalletTx> record;
+    if (!Read(std::make_pair(std::string("archivedtx"), hash), record))
+        return false;
+    wtx = record.second;
+    return true;
+}
+
+bool CWalletDB::EraseArchivedTx(uint256 hash)
+{
+    nWalletDBUpdateCounter++;
+    return Erase(std::make_pair(std::string("archivedtx"), hash));
+}
+
+bool CWalletDB::WriteNoteWitness(const JSOutPoint& jsoutpt, int nHeight, const SproutWitness& witness)
+{
+    nWalletDBUpdateCounter++;
+    return Write(std::make_pair(std::string("sproutwitness"), std::make_pair(jsoutpt, nHeight)), witness);
+}
+
+bool CWalletDB::WriteNoteWitness(const SaplingOutPoint& op, int nHeight, const SaplingWitness& witness)
+{
+    nWalletDBUpdateCounter++;
+    return Write(std::make_pair(std::string("saplingwitness"), std::make_pair(op, nHeight)), witness);
+}
+
+bool CWalletDB::EraseNoteWitness(const JSOutPoint& jsoutpt, int nHeight)
+{
+    nWalletDBUpdateCounter++;
+    return Erase(std::make_pair(std::string("sproutwitness"), std::make_pair(jsoutpt, nHeight)));
+}
+
+bool CWalletDB::EraseNoteWitness(const SaplingOutPoint& op, int nHeight)
+{
+    nWalletDBUpdateCounter++;
+    return Erase(std::make_pair(std::string("saplingwitness"), std::make_pair(op, nHeight)));
+}
+
 bool CWalletDB::WriteKey(const CPubKey& vchPubKey, const CPrivKey& vchPrivKey, const CKeyMetadata& keyMeta)
 {
     nWalletDBUpdateCounter++;
@@ -187,6 +238,16 @@ bool CWalletDB::WriteSaplingPaymentAddress(
     return Write(std::make_pair(std::string("sapzaddr"), addr), ivk, false);
 }
 
+bool CWalletDB::WriteSaplingDiversifiedAddress(
+    const libzcash::SaplingPaymentAddress &addr,
+    const libzcash::SaplingIncomingViewingKey &ivk,
+    const libzcash::diversifier_index_t &j)
+{
+    nWalletDBUpdateCounter++;
+
+    return Write(std::make_pair(std::string("sapzaddrdiv"), addr), std::make_pair(ivk, j));
+}
+
 bool CWalletDB::WriteSproutViewingKey(const libzcash::SproutViewingKey &vk)
 {
     nWalletDBUpdateCounter++;
@@ -430,6 +491,7 @@ DBErrors CWalletDB::ReorderTransactions(CWallet* pwallet)
         }
     }
     WriteOrderPosNext(nOrderPosNext);
+    pwallet->MarkOrderedTxsStale();
 
     return DB_LOAD_OK;
 }
@@ -447,6 +509,8 @@ public:
     bool fAnyUnordered;
     int nFileVersion;
     vector<uint256> vWalletUpgrade;
+    std::map<JSOutPoint, std::map<int, SproutWitness>> mapSproutWitnesses;
+    std::map<SaplingOutPoint, std::map<int, SaplingWitness>> mapSaplingWitnesses;
 
     CWalletScanState() {
         nKeys = nCKeys = nKeyMeta = nZKeys = nCZKeys = nZKeyMeta = nSapZAddrs = 0;
@@ -456,6 +520,64 @@ public:
     }
 };
 
+/**
+ * Deserialize and check the transaction of a "tx" record, whose type has
+ * already been read from ssKey. This does not touch the wallet, so that
+ * LoadWallet can run it for many records in parallel.
+ */
+static bool ReadWalletTx(CDataStream& ssKey, CDataStream& ssValue, uint256& hash, CWalletTx& wtx)
+{
+    ssKey >> hash;
+    ssValue >> wtx;
+    CValidationState state;
+    auto verifier = ProofVerifier::Strict();
+    return CheckTransaction(wtx, state, verifier) && (wtx.GetHash() == hash) && state.IsValid();
+}
+
+/** Add a transaction read by ReadWalletTx to the wallet. */
+static void LoadWalletTx(CWallet* pwallet, CDataStream& ssValue, const uint256& hash, CWalletTx& wtx,
+                         CWalletScanState &wss, string& strErr)
+{
+    // Undo serialize changes in 31600
+    if (31404 <= wtx.fTimeReceivedIsTxTime && wtx.fTimeReceivedIsTxTime <= 31703)
+    {
+        if (!ssValue.empty())
+        {
+            char fTmp;
+            char fUnused;
+            ssValue >> fTmp >> fUnused >> wtx.strFromAccount;
+            strErr = strprintf("LoadWallet() upgrading tx ver=%d %d '%s' %s",
+                               wtx.fTimeReceivedIsTxTime, fTmp, wtx.strFromAccount, hash.ToString());
+            wtx.fTimeReceivedIsTxTime = fTmp;
+        }
+        else
+        {
+            strErr = strprintf("LoadWallet() repairing tx ver=%d %s", wtx.fTimeReceivedIsTxTime, hash.ToString());
+            wtx.fTimeReceivedIsTxTime = 0;
+        }
+        wss.vWalletUpgrade.push_back(hash);
+    }
+
+    if (wtx.nOrderPos == -1)
+        wss.fAnyUnordered = true;
+
+    pwallet->AddToWallet(wtx, true, NULL);
+}
+
+/** A "tx" record that LoadWallet reads in a batch with other "tx" records. */
+struct WalletTxRecord
+{
+    CDataStream ssKey;
+    CDataStream ssValue;
+    uint256 hash;
+    CWalletTx wtx;
+    std::vector<SaplingNoteEntry> vSaplingNotes;
+    bool fValid;
+
+    WalletTxRecord(const CDataStream& ssKeyIn, const CDataStream& ssValueIn) :
+        ssKey(ssKeyIn), ssValue(ssValueIn), fValid(false) {}
+};
+
 bool
 ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
              CWalletScanState &wss, string& strType, string& strErr)
@@ -482,38 +604,18 @@ ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
         else if (strType == "tx")
         {
             uint256 hash;
-            ssKey >> hash;
             CWalletTx wtx;
-            ssValue >> wtx;
-            CValidationState state;
-            auto verifier = ProofVerifier::Strict();
-            if (!(CheckTransaction(wtx, state, verifier) && (wtx.GetHash() == hash) && state.IsValid()))
+            if (!ReadWalletTx(ssKey, ssValue, hash, wtx))
                 return false;
-
-            // Undo serialize changes in 31600
-            if (31404 <= wtx.fTimeReceivedIsTxTime && wtx.fTimeReceivedIsTxTime <= 31703)
-            {
-                if (!ssValue.empty())
-                {
-                    char fTmp;
-                    char fUnused;
-                    ssValue >> fTmp >> fUnused >> wtx.strFromAccount;
-                    strErr = strprintf("LoadWallet() upgrading tx ver=%d %d '%s' %s",
-                                       wtx.fTimeReceivedIsTxTime, fTmp, wtx.strFromAccount, hash.ToString());
-                    wtx.fTimeReceivedIsTxTime = fTmp;
-                }
-                else
-                {
-                    strErr = strprintf("LoadWallet() repairing tx ver=%d %s", wtx.fTimeReceivedIsTxTime, hash.ToString());
-                    wtx.fTimeReceivedIsTxTime = 0;
-                }
-                wss.vWalletUpgrade.push_back(hash);
-            }
-
-            if (wtx.nOrderPos == -1)
-                wss.fAnyUnordered = true;
-
-            pwallet->AddToWallet(wtx, true, NULL);
+            LoadWalletTx(pwallet, ssValue, hash, wtx, wss, strErr);
+        }
+        else if (strType == "archivedtx")
+        {
+            uint256 hash;
+            ssKey >> hash;
+            CArchivedWalletTx archived;
+            ssValue >> archived;
+            pwallet->LoadArchivedTx(hash, archived);
         }
         else if (strType == "acentry")
         {
@@ -787,6 +889,17 @@ ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
                 return false;
             }
         }
+        else if (strType == "sapzaddrdiv")
+        {
+            libzcash::SaplingPaymentAddress addr;
+            ssKey >> addr;
+            libzcash::SaplingIncomingViewingKey ivk;
+            libzcash::diversifier_index_t j;
+            ssValue >> ivk;
+            ssValue >> j;
+
+            pwallet->LoadSaplingDiversifiedAddress(addr, ivk, j);
+        }
         else if (strType == "defaultkey")
         {
             ssValue >> pwallet->vchDefaultKey;
@@ -844,6 +957,20 @@ ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
         {
             ssValue >> pwallet->nWitnessCacheSize;
         }
+        else if (strType == "sproutwitness")
+        {
+            JSOutPoint jsoutpt;
+            int nHeight;
+            ssKey >> jsoutpt >> nHeight;
+            ssValue >> wss.mapSproutWitnesses[jsoutpt][nHeight];
+        }
+        else if (strType == "saplingwitness")
+        {
+            SaplingOutPoint op;
+            int nHeight;
+            ssKey >> op >> nHeight;
+            ssValue >> wss.mapSaplingWitnesses[op][nHeight];
+        }
         else if (strType == "hdseed")
         {
             uint256 seedFp;
@@ -904,9 +1031,55 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
 {
     pwallet->vchDefaultKey = CPubKey();
     CWalletScanState wss;
+    std::vector<WalletTxRecord> vTxRecords;
     bool fNoncriticalErrors = false;
     DBErrors result = DB_LOAD_OK;
 
+    // Deserializing a transaction, verifying its proofs and decrypting its
+    // notes are most of the cost of loading a large wallet, and do not
+    // depend on the wallet, so they are done on every core. The
+    // transactions are then added to the wallet in the order of their
+    // records.
+    int nThreads = GetNumCores();
+    const size_t nTxBatchSize = 256 * std::max(nThreads, 1);
+    auto LoadTxRecords = [&]() {
+        ParallelFor(vTxRecords.size(), nThreads, [&](size_t i) {
+            WalletTxRecord& record = vTxRecords[i];
+            try {
+                string strType;
+                record.ssKey >> strType;
+                record.fValid = ReadWalletTx(record.ssKey, record.ssValue, record.hash, record.wtx);
+                if (record.fValid) {
+                    record.vSaplingNotes = record.wtx.DecryptSaplingNoteEntries();
+                }
+            } catch (...) {
+                record.fValid = false;
+            }
+        }, WorkPriority::WALLET);
+
+        for (WalletTxRecord& record : vTxRecords) {
+            string strErr;
+            if (record.fValid) {
+                try {
+                    for (const SaplingNoteEntry& entry : record.vSaplingNotes) {
+                        pwallet->LoadSaplingNoteEntry(entry);
+                    }
+                    LoadWalletTx(pwallet, record.ssValue, record.hash, record.wtx, wss, strErr);
+                } catch (...) {
+                    record.fValid = false;
+                }
+            }
+            if (!record.fValid) {
+                fNoncriticalErrors = true;
+                // Rescan if there is a bad transaction record:
+                SoftSetBoolArg("-rescan", true);
+            }
+            if (!strErr.empty())
+                LogPrintf("%s\n", strErr);
+        }
+        vTxRecords.clear();
+    };
+
     LOCK(pwallet->cs_wallet);
     try {
         int nMinVersion = 0;
@@ -939,8 +1112,29 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
                 return DB_CORRUPT;
             }
 
+            // Transactions are set aside and loaded in batches
+            string strType;
+            try {
+                CDataStream ssType(ssKey);
+                ssType >> strType;
+            } catch (const std::exception&) {
+                strType.clear();
+            }
+            if (strType == "tx") {
+                vTxRecords.emplace_back(ssKey, ssValue);
+                if (vTxRecords.size() >= nTxBatchSize) {
+                    LoadTxRecords();
+                }
+                continue;
+            }
+            // An archive record is only loaded when its transaction has no
+            // "tx" record, which is read before it.
+            if (strType == "archivedtx" && !vTxRecords.empty()) {
+                LoadTxRecords();
+            }
+
             // Try to be tolerant of single corrupt records:
-            string strType, strErr;
+            string strErr;
             if (!ReadKeyValue(pwallet, ssKey, ssValue, wss, strType, strErr))
             {
                 // losing keys is considered a catastrophic error, anything else
@@ -951,15 +1145,14 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
                 {
                     // Leave other errors alone, if we try to fix them we might make things worse.
                     fNoncriticalErrors = true; // ... but do warn the user there is something wrong.
-                    if (strType == "tx")
-                        // Rescan if there is a bad transaction record:
-                        SoftSetBoolArg("-rescan", true);
                 }
             }
             if (!strErr.empty())
                 LogPrintf("%s\n", strErr);
         }
         pcursor->close();
+
+        LoadTxRecords();
     }
     catch (const boost::thread_interrupted&) {
         throw;
@@ -971,6 +1164,9 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
     if (fNoncriticalErrors && result == DB_LOAD_OK)
         result = DB_NONCRITICAL_ERROR;
 
+    // The note witnesses are needed even if other records were unreadable
+    pwallet->LoadNoteWitnesses(wss.mapSproutWitnesses, wss.mapSaplingWitnesses);
+
     // Any wallet corruption at all: skip any rewriting or
     // upgrading, we don't want to make it worse.
     if (result != DB_LOAD_OK)
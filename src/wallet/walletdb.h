@@ -11,6 +11,7 @@
 #include "key.h"
 #include "keystore.h"
 #include "zcash/Address.hpp"
+#include "zcash/IncrementalMerkleTree.hpp"
 
 #include <list>
 #include <stdint.h>
@@ -22,12 +23,15 @@ static const bool DEFAULT_FLUSHWALLET = true;
 
 class CAccount;
 class CAccountingEntry;
+class CArchivedWalletTx;
 struct CBlockLocator;
 class CKeyPool;
 class CMasterKey;
 class CScript;
 class CWallet;
 class CWalletTx;
+class JSOutPoint;
+class SaplingOutPoint;
 class uint160;
 class uint256;
 
@@ -134,6 +138,14 @@ public:
 
     bool WriteTx(uint256 hash, const CWalletTx& wtx);
     bool EraseTx(uint256 hash);
+    bool WriteArchivedTx(uint256 hash, const CArchivedWalletTx& archived, const CWalletTx& wtx);
+    bool ReadArchivedTx(uint256 hash, CWalletTx& wtx);
+    bool EraseArchivedTx(uint256 hash);
+
+    bool WriteNoteWitness(const JSOutPoint& jsoutpt, int nHeight, const SproutWitness& witness);
+    bool WriteNoteWitness(const SaplingOutPoint& op, int nHeight, const SaplingWitness& witness);
+    bool EraseNoteWitness(const JSOutPoint& jsoutpt, int nHeight);
+    bool EraseNoteWitness(const SaplingOutPoint& op, int nHeight);
 
     bool WriteKey(const CPubKey& vchPubKey, const CPrivKey& vchPrivKey, const CKeyMetadata &keyMeta);
     bool WriteCryptedKey(const CPubKey& vchPubKey, const std::vector<unsigned char>& vchCryptedSecret, const CKeyMetadata &keyMeta);
@@ -190,6 +202,9 @@ public:
                           const CKeyMetadata  &keyMeta);
     bool WriteSaplingPaymentAddress(const libzcash::SaplingPaymentAddress &addr,
                                     const libzcash::SaplingIncomingViewingKey &ivk);
+    bool WriteSaplingDiversifiedAddress(const libzcash::SaplingPaymentAddress &addr,
+                                        const libzcash::SaplingIncomingViewingKey &ivk,
+                                        const libzcash::diversifier_index_t &j);
     bool WriteCryptedZKey(const libzcash::SproutPaymentAddress & addr,
                           const libzcash::ReceivingKey & rk,
                           const std::vector<unsigned char>& vchCryptedSecret,
@@ -134,4 +134,57 @@ HistoryEntry LeafToEntry(const HistoryNode node) {
     return result;
 }
 
+HistoryIndex HistoryLeafPosition(uint64_t leafIndex) {
+    // The leaves before this one are stored with all but one node for each
+    // of the perfect subtrees they form, one per set bit of the index.
+    return 2 * leafIndex - __builtin_popcountll(leafIndex);
+}
+
+uint32_t HistoryNodeHeight(HistoryIndex pos) {
+    // Move left past whole perfect subtrees until the 1-based position is
+    // all ones, the root of a perfect subtree whose height is its bit length.
+    uint64_t p = pos + 1;
+    while ((p & (p + 1)) != 0) {
+        uint64_t msb = uint64_t(1) << (63 - __builtin_clzll(p));
+        p -= msb - 1;
+    }
+    return 63 - __builtin_clzll(p);
+}
+
+std::vector<HistoryIndex> HistoryPeaks(HistoryIndex length) {
+    std::vector<HistoryIndex> peaks;
+    HistoryIndex offset = 0;
+    while (offset < length) {
+        // The largest perfect subtree (2^k - 1 nodes) that fits.
+        uint64_t size = (uint64_t(1) << (63 - __builtin_clzll(length - offset + 1))) - 1;
+        peaks.push_back(offset + size - 1);
+        offset += size;
+    }
+    return peaks;
+}
+
+std::vector<HistoryIndex> HistoryAuthPath(HistoryIndex length, HistoryIndex pos) {
+    std::vector<HistoryIndex> path;
+    uint32_t height = HistoryNodeHeight(pos);
+    while (true) {
+        HistoryIndex subtreeSize = (uint64_t(2) << height) - 1;
+        HistoryIndex sibling, parent;
+        if (HistoryNodeHeight(pos + 1) > height) {
+            // A right child is followed by its parent.
+            sibling = pos - subtreeSize;
+            parent = pos + 1;
+        } else {
+            sibling = pos + subtreeSize;
+            parent = sibling + 1;
+        }
+        if (parent >= length) {
+            // pos is a peak.
+            return path;
+        }
+        path.push_back(sibling);
+        pos = parent;
+        height++;
+    }
+}
+
 }
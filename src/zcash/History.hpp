@@ -3,6 +3,7 @@
 
 #include <stdexcept>
 #include <unordered_map>
+#include <vector>
 #include <boost/foreach.hpp>
 
 #include "serialize.h"
@@ -58,6 +59,23 @@ HistoryEntry NodeToEntry(const HistoryNode node, uint32_t left, uint32_t right);
 // Convert history node to leaf node (end nodes without children)
 HistoryEntry LeafToEntry(const HistoryNode node);
 
+// The nodes of a history tree are stored in post-order, the children of each
+// node before it, so a tree of n leaves is stored as the perfect subtrees of
+// its peaks, largest first. These give the positions of its nodes.
+
+// Position of the leaf with the given index.
+HistoryIndex HistoryLeafPosition(uint64_t leafIndex);
+
+// Height above the leaves of the node at the given position.
+uint32_t HistoryNodeHeight(HistoryIndex pos);
+
+// Positions of the peaks of a history of the given length, left to right.
+std::vector<HistoryIndex> HistoryPeaks(HistoryIndex length);
+
+// Positions of the siblings of the node at pos and of its ancestors, up to
+// the peak above it, which prove that the node is in the history.
+std::vector<HistoryIndex> HistoryAuthPath(HistoryIndex length, HistoryIndex pos);
+
 }
 
 typedef libzcash::HistoryCache HistoryCache;
@@ -1,4 +1,6 @@
+#include <algorithm>
 #include <stdexcept>
+#include <string.h>
 
 
 #include "zcash/IncrementalMerkleTree.hpp"
@@ -26,6 +28,18 @@ PedersenHash PedersenHash::combine(
     return res;
 }
 
+void PedersenHash::combine_many(
+    const PedersenHash* nodes,
+    PedersenHash* out,
+    size_t n,
+    size_t depth
+)
+{
+    // Adjacent nodes are the pairs to hash, in a single call into Rust.
+    static_assert(sizeof(PedersenHash) == 32);
+    librustzcash_merkle_hash_many(depth, nodes->begin(), n, out->begin());
+}
+
 PedersenHash PedersenHash::uncommitted() {
     PedersenHash res = PedersenHash();
 
@@ -427,14 +441,26 @@ SHA256Compress SHA256Compress::combine(
 {
     SHA256Compress res = SHA256Compress();
 
-    CSHA256 hasher;
-    hasher.Write(a.begin(), 32);
-    hasher.Write(b.begin(), 32);
-    hasher.FinalizeNoPadding(res.begin());
+    unsigned char blob[64];
+    memcpy(blob, a.begin(), 32);
+    memcpy(blob + 32, b.begin(), 32);
+    SHA256Compress64(res.begin(), blob, 1);
 
     return res;
 }
 
+void SHA256Compress::combine_many(
+    const SHA256Compress* nodes,
+    SHA256Compress* out,
+    size_t n,
+    size_t depth
+)
+{
+    // Adjacent nodes are the 64-byte blocks to compress.
+    static_assert(sizeof(SHA256Compress) == 32);
+    SHA256Compress64(out->begin(), nodes->begin(), n);
+}
+
 static const std::array<SHA256Compress, 66> sha256_empty_roots = {
     uint256(std::vector<unsigned char>{
         0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
@@ -952,6 +978,61 @@ void IncrementalMerkleTree<Depth, Hash>::append(Hash obj) {
     }
 }
 
+template<size_t Depth, typename Hash>
+void IncrementalMerkleTree<Depth, Hash>::append_many(const std::vector<Hash>& objs) {
+    if (objs.empty()) {
+        return;
+    }
+
+    size_t oldSize = size();
+    if (objs.size() > ((size_t)1 << Depth) - oldSize) {
+        throw std::runtime_error("tree is full");
+    }
+    size_t newSize = oldSize + objs.size();
+
+    // The leaves that have not been combined yet: the current ones, then
+    // the new objects.
+    std::vector<Hash> level;
+    level.reserve(objs.size() + 2);
+    if (left) {
+        level.push_back(*left);
+    }
+    if (right) {
+        level.push_back(*right);
+    }
+    level.insert(level.end(), objs.begin(), objs.end());
+
+    // As after append(), the last leaf, or the last two if the tree has an
+    // even number of them, are left uncombined. That leaves an even number
+    // of leaves to combine.
+    size_t nKeep = newSize % 2 == 1 ? 1 : 2;
+    left = level[level.size() - nKeep];
+    right = nKeep == 2 ? std::optional<Hash>(level.back()) : std::nullopt;
+    level.resize(level.size() - nKeep);
+
+    std::vector<Hash> next;
+    for (size_t d = 0; !level.empty(); d++) {
+        next.resize(level.size() / 2);
+        Hash::combine_many(level.data(), next.data(), next.size(), d);
+
+        // The new nodes follow the collapsed subtree at this depth, if any,
+        // and an odd one out is collapsed to wait for its sibling.
+        if (d < parents.size() && parents[d]) {
+            next.insert(next.begin(), *parents[d]);
+        }
+        if (parents.size() <= d) {
+            parents.resize(d + 1);
+        }
+        if (next.size() % 2 == 1) {
+            parents[d] = next.back();
+            next.pop_back();
+        } else {
+            parents[d] = std::nullopt;
+        }
+        level.swap(next);
+    }
+}
+
 // This is for allowing the witness to determine if a subtree has filled
 // to a particular depth, or for append() to ensure we're not appending
 // to a full tree.
@@ -1135,6 +1216,100 @@ void IncrementalWitness<Depth, Hash>::append(Hash obj) {
     }
 }
 
+template<size_t Depth, typename Hash>
+void IncrementalWitness<Depth, Hash>::append_all(
+    const std::vector<IncrementalWitness<Depth, Hash>*>& witnesses,
+    const std::vector<Hash>& objs)
+{
+    // Witnesses into the same tree that have a cursor at the same depth are
+    // building the same subtree of the tree (the one that contains the next
+    // position), so they can share a single cursor.
+    struct CursorGroup {
+        size_t depth;
+        IncrementalMerkleTree<Depth, Hash> cursor;
+        std::vector<IncrementalWitness<Depth, Hash>*> members;
+    };
+    std::vector<CursorGroup> groups;
+    std::vector<IncrementalWitness<Depth, Hash>*> idle;
+
+    if (objs.empty()) {
+        return;
+    }
+
+    for (auto wit : witnesses) {
+        if (!wit->cursor) {
+            idle.push_back(wit);
+            continue;
+        }
+        auto it = std::find_if(groups.begin(), groups.end(), [&](const CursorGroup& g) {
+            return g.depth == wit->cursor_depth && g.cursor == *wit->cursor;
+        });
+        if (it == groups.end()) {
+            groups.push_back({wit->cursor_depth, *wit->cursor, {wit}});
+        } else {
+            it->members.push_back(wit);
+        }
+    }
+
+    for (const Hash& obj : objs) {
+        // Witnesses that completed their cursor on this object will only
+        // start a new one on the next object.
+        std::vector<IncrementalWitness<Depth, Hash>*> starting;
+        starting.swap(idle);
+
+        std::vector<CursorGroup> next;
+        for (auto& g : groups) {
+            g.cursor.append(obj);
+
+            if (g.cursor.is_complete(g.depth)) {
+                Hash root = g.cursor.root(g.depth);
+                for (auto wit : g.members) {
+                    wit->filled.push_back(root);
+                    wit->cursor = std::nullopt;
+                    idle.push_back(wit);
+                }
+            } else {
+                next.push_back(std::move(g));
+            }
+        }
+
+        size_t nExisting = next.size();
+        for (auto wit : starting) {
+            wit->cursor_depth = wit->tree.next_depth(wit->filled.size());
+
+            if (wit->cursor_depth >= Depth) {
+                throw std::runtime_error("tree is full");
+            }
+
+            if (wit->cursor_depth == 0) {
+                wit->filled.push_back(obj);
+                idle.push_back(wit);
+                continue;
+            }
+
+            auto it = std::find_if(next.begin() + nExisting, next.end(), [&](const CursorGroup& g) {
+                return g.depth == wit->cursor_depth;
+            });
+            if (it == next.end()) {
+                CursorGroup g {wit->cursor_depth, IncrementalMerkleTree<Depth, Hash>(), {wit}};
+                g.cursor.append(obj);
+                next.push_back(std::move(g));
+            } else {
+                it->members.push_back(wit);
+            }
+        }
+
+        groups.swap(next);
+    }
+
+    for (const auto& g : groups) {
+        for (auto wit : g.members) {
+            wit->cursor = g.cursor;
+            wit->cursor_depth = g.depth;
+        }
+    }
+}
+
 template class IncrementalMerkleTree<INCREMENTAL_MERKLE_TREE_DEPTH, SHA256Compress>;
 template class IncrementalMerkleTree<INCREMENTAL_MERKLE_TREE_DEPTH_TESTING, SHA256Compress>;
 
@@ -95,6 +95,13 @@ public:
     size_t size() const;
 
     void append(Hash obj);
+
+    // Append each of objs, in order. The result is the same as calling
+    // append() for each object, but the nodes that the objects complete are
+    // combined a level at a time, in batches. Throws without changing the
+    // tree if the objects don't all fit.
+    void append_many(const std::vector<Hash>& objs);
+
     Hash root() const {
         return root(Depth, std::deque<Hash>());
     }
@@ -154,6 +161,12 @@ public:
     // Required for Unserialize()
     IncrementalWitness() {}
 
+    size_t DynamicMemoryUsage() const {
+        return tree.DynamicMemoryUsage() +
+               filled.size() * 32 + // filled
+               (cursor ? cursor->DynamicMemoryUsage() : 0); // cursor
+    }
+
     MerklePath path() const {
         return tree.path(partial_path());
     }
@@ -174,6 +187,14 @@ public:
 
     void append(Hash obj);
 
+    // Append each of objs, in order, to every one of witnesses, which must
+    // all be witnesses into the same tree. The result is the same as calling
+    // append() on each witness for each object, but witnesses that are
+    // building the same subtree share the hashing of it, so the cost grows
+    // with the number of objects rather than with witnesses * objects.
+    static void append_all(const std::vector<IncrementalWitness*>& witnesses,
+                           const std::vector<Hash>& objs);
+
     ADD_SERIALIZE_METHODS;
 
     template <typename Stream, typename Operation>
@@ -218,6 +239,14 @@ public:
         size_t depth
     );
 
+    // Combine each of the n pairs of adjacent nodes in `nodes` into `out`.
+    static void combine_many(
+        const SHA256Compress* nodes,
+        SHA256Compress* out,
+        size_t n,
+        size_t depth
+    );
+
     static SHA256Compress uncommitted() {
         return SHA256Compress();
     }
@@ -235,6 +264,14 @@ public:
         size_t depth
     );
 
+    // Combine each of the n pairs of adjacent nodes in `nodes` into `out`.
+    static void combine_many(
+        const PedersenHash* nodes,
+        PedersenHash* out,
+        size_t n,
+        size_t depth
+    );
+
     static PedersenHash uncommitted();
     static PedersenHash EmptyRoot(size_t);
 };
@@ -1,5 +1,6 @@
 #include "JoinSplit.hpp"
 #include "prf.h"
+#include "ProvingBackend.hpp"
 
 #include "zcash/util.h"
 
@@ -166,7 +167,7 @@ namespace libzcash {
         ss2 << inputs[1].witness.path();
         std::vector<unsigned char> auth2(ss2.begin(), ss2.end());
 
-        librustzcash_sprout_prove(
+        ProveSprout(
             proof.begin(),
 
             phi.begin(),
@@ -215,6 +215,24 @@ std::optional<SaplingOutgoingPlaintext> SaplingOutgoingPlaintext::decrypt(
     }
 }
 
+static std::optional<SaplingNotePlaintext> DeserializeSaplingEncPlaintext(
+    const SaplingEncPlaintext &encPlaintext)
+{
+    // Deserialize from the plaintext
+    SaplingNotePlaintext ret;
+    try {
+        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+        ss << encPlaintext;
+        ss >> ret;
+        assert(ss.size() == 0);
+        return ret;
+    } catch (const boost::thread_interrupted&) {
+        throw;
+    } catch (...) {
+        return std::nullopt;
+    }
+}
+
 std::optional<SaplingNotePlaintext> SaplingNotePlaintext::decrypt(
     const Consensus::Params& params,
     int height,
@@ -242,6 +260,87 @@ std::optional<SaplingNotePlaintext> SaplingNotePlaintext::decrypt(
     }
 }
 
+std::optional<SaplingNotePlaintext> SaplingNotePlaintext::decrypt_with_shared_secret(
+    const Consensus::Params& params,
+    int height,
+    const SaplingEncCiphertext &ciphertext,
+    const uint256 &ivk,
+    const uint256 &dhsecret,
+    const uint256 &epk,
+    const uint256 &cmu
+)
+{
+    // A key the note was not sent to decrypts the lead byte to a random value,
+    // which is neither of the two that DeserializeSaplingEncPlaintext accepts
+    // in all but 2 of 256 cases. Reject those without authenticating the
+    // whole ciphertext.
+    uint256 key = SaplingSymmetricKey(dhsecret, epk);
+    unsigned char leadbyte = AttemptSaplingLeadByteDecryptionWithKey(ciphertext, key);
+    if (leadbyte != 0x01 && leadbyte != 0x02) {
+        return std::nullopt;
+    }
+
+    auto encPlaintext = AttemptSaplingEncDecryptionWithKey(ciphertext, key);
+
+    if (!encPlaintext) {
+        return std::nullopt;
+    }
+
+    auto ret = DeserializeSaplingEncPlaintext(*encPlaintext);
+
+    if (!ret) {
+        return std::nullopt;
+    } else {
+        const SaplingNotePlaintext plaintext = *ret;
+
+        // Check leadbyte is allowed at block height
+        if (!plaintext_version_is_valid(params, height, plaintext.get_leadbyte())) {
+            LogPrint("receiveunsafe", "Received note plaintext with invalid lead byte %d at height %d",
+                     plaintext.get_leadbyte(), height);
+            return std::nullopt;
+        }
+
+        return plaintext_checks_without_height(plaintext, ivk, epk, cmu);
+    }
+}
+
+std::optional<SaplingNotePlaintext> SaplingNotePlaintext::decrypt_compact_with_shared_secret(
+    const Consensus::Params& params,
+    int height,
+    const SaplingCompactCiphertext &ciphertext,
+    const uint256 &ivk,
+    const uint256 &dhsecret,
+    const uint256 &epk,
+    const uint256 &cmu
+)
+{
+    auto compactPlaintext = AttemptSaplingCompactDecryptionWithSecret(ciphertext, dhsecret, epk);
+
+    // The compact plaintext is a prefix of the full plaintext; pad it with an
+    // empty memo so that it can be deserialized in the usual way.
+    SaplingEncPlaintext encPlaintext = {};
+    std::copy(compactPlaintext.begin(), compactPlaintext.end(), encPlaintext.begin());
+
+    auto ret = DeserializeSaplingEncPlaintext(encPlaintext);
+
+    if (!ret) {
+        return std::nullopt;
+    } else {
+        const SaplingNotePlaintext plaintext = *ret;
+
+        // Check leadbyte is allowed at block height
+        if (!plaintext_version_is_valid(params, height, plaintext.get_leadbyte())) {
+            LogPrint("receiveunsafe", "Received note plaintext with invalid lead byte %d at height %d",
+                     plaintext.get_leadbyte(), height);
+            return std::nullopt;
+        }
+
+        // Without an authentication tag, this is what tells us that the
+        // output was really sent to ivk.
+        return plaintext_checks_without_height(plaintext, ivk, epk, cmu);
+    }
+}
+
 std::optional<SaplingNotePlaintext> SaplingNotePlaintext::attempt_sapling_enc_decryption_deserialization(
     const SaplingEncCiphertext &ciphertext,
     const uint256 &ivk,
@@ -254,19 +353,7 @@ std::optional<SaplingNotePlaintext> SaplingNotePlaintext::attempt_sapling_enc_de
         return std::nullopt;
     }
 
-    // Deserialize from the plaintext
-    SaplingNotePlaintext ret;
-    try {
-        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-        ss << encPlaintext.value();
-        ss >> ret;
-        assert(ss.size() == 0);
-        return ret;
-    } catch (const boost::thread_interrupted&) {
-        throw;
-    } catch (...) {
-        return std::nullopt;
-    }
+    return DeserializeSaplingEncPlaintext(*encPlaintext);
 }
 
 std::optional<SaplingNotePlaintext> SaplingNotePlaintext::plaintext_checks_without_height(
@@ -169,6 +169,30 @@ public:
         const uint256 &cmu
     );
 
+    // As above, but with the shared secret from a key agreement between ivk
+    // and epk that has already been computed, e.g. by SaplingKaAgreeBatch.
+    static std::optional<SaplingNotePlaintext> decrypt_with_shared_secret(
+        const Consensus::Params& params,
+        int height,
+        const SaplingEncCiphertext &ciphertext,
+        const uint256 &ivk,
+        const uint256 &dhsecret,
+        const uint256 &epk,
+        const uint256 &cmu
+    );
+
+    // As above, but for the compact ciphertext of an output as described in
+    // ZIP 307. The memo of the result is always empty.
+    static std::optional<SaplingNotePlaintext> decrypt_compact_with_shared_secret(
+        const Consensus::Params& params,
+        int height,
+        const SaplingCompactCiphertext &ciphertext,
+        const uint256 &ivk,
+        const uint256 &dhsecret,
+        const uint256 &epk,
+        const uint256 &cmu
+    );
+
     static std::optional<SaplingNotePlaintext> plaintext_checks_without_height(
         const SaplingNotePlaintext &plaintext,
         const uint256 &ivk,
@@ -2,6 +2,7 @@
 
 #include "random.h"
 
+#include <memory>
 #include <stdexcept>
 #include "sodium.h"
 #include "prf.h"
@@ -141,22 +142,49 @@ std::optional<SaplingEncCiphertext> SaplingNoteEncryption::encrypt_to_recipient(
     return ciphertext;
 }
 
-std::optional<SaplingEncPlaintext> AttemptSaplingEncDecryption(
-    const SaplingEncCiphertext &ciphertext,
-    const uint256 &ivk,
-    const uint256 &epk
+std::vector<std::optional<uint256>> SaplingKaAgreeBatch(
+    const std::vector<uint256> &epks,
+    const std::vector<uint256> &ivks
 )
 {
-    uint256 dhsecret;
+    static_assert(sizeof(uint256) == 32, "uint256 must be a plain 32-byte array");
 
-    if (!librustzcash_sapling_ka_agree(epk.begin(), ivk.begin(), dhsecret.begin())) {
-        return std::nullopt;
+    size_t n = epks.size() * ivks.size();
+    if (n == 0) {
+        return {};
     }
 
-    // Construct the symmetric key
-    unsigned char K[NOTEENCRYPTION_CIPHER_KEYSIZE];
-    KDF_Sapling(K, dhsecret, epk);
+    std::vector<uint256> dhsecrets(n);
+    std::unique_ptr<bool[]> valid(new bool[n]);
+    librustzcash_sapling_ka_agree_batch(
+        epks.data()->begin(), epks.size(),
+        ivks.data()->begin(), ivks.size(),
+        dhsecrets.data()->begin(), valid.get());
+
+    std::vector<std::optional<uint256>> ret(n);
+    for (size_t i = 0; i < n; i++) {
+        if (valid[i]) {
+            ret[i] = dhsecrets[i];
+        }
+    }
+    return ret;
+}
+
+uint256 SaplingSymmetricKey(
+    const uint256 &dhsecret,
+    const uint256 &epk
+)
+{
+    uint256 key;
+    KDF_Sapling(key.begin(), dhsecret, epk);
+    return key;
+}
 
+std::optional<SaplingEncPlaintext> AttemptSaplingEncDecryptionWithKey(
+    const SaplingEncCiphertext &ciphertext,
+    const uint256 &key
+)
+{
     // The nonce is zero because we never reuse keys
     unsigned char cipher_nonce[crypto_aead_chacha20poly1305_IETF_NPUBBYTES] = {};
 
@@ -168,7 +196,7 @@ std::optional<SaplingEncPlaintext> AttemptSaplingEncDecryption(
         ciphertext.begin(), ZC_SAPLING_ENCCIPHERTEXT_SIZE,
         NULL,
         0,
-        cipher_nonce, K) != 0)
+        cipher_nonce, key.begin()) != 0)
     {
         return std::nullopt;
     }
@@ -176,19 +204,21 @@ std::optional<SaplingEncPlaintext> AttemptSaplingEncDecryption(
     return plaintext;
 }
 
-std::optional<SaplingEncPlaintext> AttemptSaplingEncDecryption (
+std::optional<SaplingEncPlaintext> AttemptSaplingEncDecryptionWithSecret(
     const SaplingEncCiphertext &ciphertext,
-    const uint256 &epk,
-    const uint256 &esk,
-    const uint256 &pk_d
+    const uint256 &dhsecret,
+    const uint256 &epk
 )
 {
-    uint256 dhsecret;
-
-    if (!librustzcash_sapling_ka_agree(pk_d.begin(), esk.begin(), dhsecret.begin())) {
-        return std::nullopt;
-    }
+    return AttemptSaplingEncDecryptionWithKey(ciphertext, SaplingSymmetricKey(dhsecret, epk));
+}
 
+SaplingCompactPlaintext AttemptSaplingCompactDecryptionWithSecret(
+    const SaplingCompactCiphertext &ciphertext,
+    const uint256 &dhsecret,
+    const uint256 &epk
+)
+{
     // Construct the symmetric key
     unsigned char K[NOTEENCRYPTION_CIPHER_KEYSIZE];
     KDF_Sapling(K, dhsecret, epk);
@@ -196,20 +226,61 @@ std::optional<SaplingEncPlaintext> AttemptSaplingEncDecryption (
     // The nonce is zero because we never reuse keys
     unsigned char cipher_nonce[crypto_aead_chacha20poly1305_IETF_NPUBBYTES] = {};
 
-    SaplingEncPlaintext plaintext;
+    // The AEAD uses the first block of the ChaCha20 keystream for the
+    // Poly1305 key, so the plaintext is encrypted from block 1 onwards.
+    SaplingCompactPlaintext plaintext;
+    crypto_stream_chacha20_ietf_xor_ic(
+        plaintext.begin(),
+        ciphertext.begin(), ZC_SAPLING_COMPACT_ENCPLAINTEXT_SIZE,
+        cipher_nonce, 1, K);
 
-    if (crypto_aead_chacha20poly1305_ietf_decrypt(
-        plaintext.begin(), NULL,
-        NULL,
-        ciphertext.begin(), ZC_SAPLING_ENCCIPHERTEXT_SIZE,
-        NULL,
-        0,
-        cipher_nonce, K) != 0)
-    {
+    return plaintext;
+}
+
+unsigned char AttemptSaplingLeadByteDecryptionWithKey(
+    const SaplingEncCiphertext &ciphertext,
+    const uint256 &key
+)
+{
+    unsigned char cipher_nonce[crypto_aead_chacha20poly1305_IETF_NPUBBYTES] = {};
+
+    // As for the compact ciphertext, the plaintext starts at block 1.
+    unsigned char leadbyte;
+    crypto_stream_chacha20_ietf_xor_ic(
+        &leadbyte, ciphertext.begin(), 1, cipher_nonce, 1, key.begin());
+
+    return leadbyte;
+}
+
+std::optional<SaplingEncPlaintext> AttemptSaplingEncDecryption(
+    const SaplingEncCiphertext &ciphertext,
+    const uint256 &ivk,
+    const uint256 &epk
+)
+{
+    uint256 dhsecret;
+
+    if (!librustzcash_sapling_ka_agree(epk.begin(), ivk.begin(), dhsecret.begin())) {
         return std::nullopt;
     }
 
-    return plaintext;
+    return AttemptSaplingEncDecryptionWithSecret(ciphertext, dhsecret, epk);
+}
+
+std::optional<SaplingEncPlaintext> AttemptSaplingEncDecryption (
+    const SaplingEncCiphertext &ciphertext,
+    const uint256 &epk,
+    const uint256 &esk,
+    const uint256 &pk_d
+)
+{
+    uint256 dhsecret;
+
+    if (!librustzcash_sapling_ka_agree(pk_d.begin(), esk.begin(), dhsecret.begin())) {
+        return std::nullopt;
+    }
+
+    return AttemptSaplingEncDecryptionWithSecret(ciphertext, dhsecret, epk);
 }
 
 
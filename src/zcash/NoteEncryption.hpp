@@ -14,6 +14,7 @@ https://github.com/zcash/zips/blob/master/protocol/protocol.pdf
 
 #include <array>
 #include <optional>
+#include <vector>
 
 namespace libzcash {
 
@@ -21,6 +22,10 @@ namespace libzcash {
 typedef std::array<unsigned char, ZC_SAPLING_ENCCIPHERTEXT_SIZE> SaplingEncCiphertext;
 typedef std::array<unsigned char, ZC_SAPLING_ENCPLAINTEXT_SIZE> SaplingEncPlaintext;
 
+// Prefix of the ciphertext for the recipient, as stored in compact blocks
+typedef std::array<unsigned char, ZC_SAPLING_COMPACT_ENCPLAINTEXT_SIZE> SaplingCompactCiphertext;
+typedef std::array<unsigned char, ZC_SAPLING_COMPACT_ENCPLAINTEXT_SIZE> SaplingCompactPlaintext;
+
 // Ciphertext for outgoing viewing key to decrypt
 typedef std::array<unsigned char, ZC_SAPLING_OUTCIPHERTEXT_SIZE> SaplingOutCiphertext;
 typedef std::array<unsigned char, ZC_SAPLING_OUTPLAINTEXT_SIZE> SaplingOutPlaintext;
@@ -74,6 +79,58 @@ std::optional<SaplingEncPlaintext> AttemptSaplingEncDecryption(
     const uint256 &epk
 );
 
+// Computes the Sapling key agreement [ivk] [8] epk for every pair of an epk
+// in epks and an ivk in ivks, in a single call into librustzcash. The shared
+// secret for epks[i] and ivks[j] is at index i * ivks.size() + j, and is
+// std::nullopt if either key is invalid.
+std::vector<std::optional<uint256>> SaplingKaAgreeBatch(
+    const std::vector<uint256> &epks,
+    const std::vector<uint256> &ivks
+);
+
+// Derives the symmetric key of a Sapling note ciphertext from the shared
+// secret of a key agreement, so that it can be used for more than one
+// decryption of the same ciphertext.
+uint256 SaplingSymmetricKey(
+    const uint256 &dhsecret,
+    const uint256 &epk
+);
+
+// Attempts to decrypt a Sapling note with a key from SaplingSymmetricKey().
+// This will not check that the contents of the ciphertext are correct.
+std::optional<SaplingEncPlaintext> AttemptSaplingEncDecryptionWithKey(
+    const SaplingEncCiphertext &ciphertext,
+    const uint256 &key
+);
+
+// Attempts to decrypt a Sapling note with the shared secret from a key
+// agreement that has already been computed. This will not check that the
+// contents of the ciphertext are correct.
+std::optional<SaplingEncPlaintext> AttemptSaplingEncDecryptionWithSecret(
+    const SaplingEncCiphertext &ciphertext,
+    const uint256 &dhsecret,
+    const uint256 &epk
+);
+
+// Decrypts the compact ciphertext of a Sapling note with the shared secret
+// from a key agreement, as described in ZIP 307. The compact ciphertext is
+// not authenticated, so the caller must check the resulting note against its
+// commitment.
+SaplingCompactPlaintext AttemptSaplingCompactDecryptionWithSecret(
+    const SaplingCompactCiphertext &ciphertext,
+    const uint256 &dhsecret,
+    const uint256 &epk
+);
+
+// Decrypts only the lead byte of a Sapling note ciphertext with a key from
+// SaplingSymmetricKey(). This costs one ChaCha20 block and no Poly1305, so
+// trial decryption can reject most ciphertexts that were not sent to the key
+// before authenticating them.
+unsigned char AttemptSaplingLeadByteDecryptionWithKey(
+    const SaplingEncCiphertext &ciphertext,
+    const uint256 &key
+);
+
 // Attempts to decrypt a Sapling note using outgoing plaintext.
 // This will not check that the contents of the ciphertext are correct.
 std::optional<SaplingEncPlaintext> AttemptSaplingEncDecryption (
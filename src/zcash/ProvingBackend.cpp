@@ -0,0 +1,235 @@
+#include "ProvingBackend.hpp"
+
+#include "sync.h"
+
+#include <librustzcash.h>
+#include <rust/metrics.h>
+
+#include <atomic>
+#include <chrono>
+#include <map>
+
+namespace libzcash {
+
+class CpuProvingBackend : public ProvingBackend
+{
+public:
+    const char* Name() const { return DEFAULT_PROVING_BACKEND; }
+
+    bool SaplingSpendProof(
+        void* ctx,
+        const unsigned char* ak,
+        const unsigned char* nsk,
+        const unsigned char* diversifier,
+        const unsigned char* rcm,
+        const unsigned char* ar,
+        uint64_t value,
+        const unsigned char* anchor,
+        const unsigned char* witness,
+        unsigned char* cv,
+        unsigned char* rk,
+        unsigned char* zkproof)
+    {
+        return librustzcash_sapling_spend_proof(
+            ctx, ak, nsk, diversifier, rcm, ar, value, anchor, witness, cv, rk, zkproof);
+    }
+
+    bool SaplingOutputProof(
+        void* ctx,
+        const unsigned char* esk,
+        const unsigned char* payment_address,
+        const unsigned char* rcm,
+        uint64_t value,
+        unsigned char* cv,
+        unsigned char* zkproof)
+    {
+        return librustzcash_sapling_output_proof(
+            ctx, esk, payment_address, rcm, value, cv, zkproof);
+    }
+
+    void SproutProof(
+        unsigned char* proof_out,
+        const unsigned char* phi,
+        const unsigned char* rt,
+        const unsigned char* h_sig,
+        const unsigned char* in_sk1,
+        uint64_t in_value1,
+        const unsigned char* in_rho1,
+        const unsigned char* in_r1,
+        const unsigned char* in_auth1,
+        const unsigned char* in_sk2,
+        uint64_t in_value2,
+        const unsigned char* in_rho2,
+        const unsigned char* in_r2,
+        const unsigned char* in_auth2,
+        const unsigned char* out_pk1,
+        uint64_t out_value1,
+        const unsigned char* out_r1,
+        const unsigned char* out_pk2,
+        uint64_t out_value2,
+        const unsigned char* out_r2,
+        uint64_t vpub_old,
+        uint64_t vpub_new)
+    {
+        librustzcash_sprout_prove(
+            proof_out, phi, rt, h_sig,
+            in_sk1, in_value1, in_rho1, in_r1, in_auth1,
+            in_sk2, in_value2, in_rho2, in_r2, in_auth2,
+            out_pk1, out_value1, out_r1,
+            out_pk2, out_value2, out_r2,
+            vpub_old, vpub_new);
+    }
+};
+
+static CCriticalSection cs_provingBackends;
+static std::map<std::string, std::unique_ptr<ProvingBackend>> mapProvingBackends;
+// The backends are never removed, so the selected one can be read without
+// cs_provingBackends by the threads that are proving.
+static std::atomic<ProvingBackend*> pSelectedProvingBackend{nullptr};
+
+static ProvingBackend* CpuBackend()
+{
+    // Registered on first use, so that proofs can be made without any setup.
+    LOCK(cs_provingBackends);
+    auto& backend = mapProvingBackends[DEFAULT_PROVING_BACKEND];
+    if (!backend) {
+        backend.reset(new CpuProvingBackend());
+    }
+    return backend.get();
+}
+
+void RegisterProvingBackend(std::unique_ptr<ProvingBackend> backend)
+{
+    CpuBackend();
+    LOCK(cs_provingBackends);
+    std::string name = backend->Name();
+    if (!mapProvingBackends.count(name)) {
+        mapProvingBackends[name] = std::move(backend);
+    }
+}
+
+bool SelectProvingBackend(const std::string& name)
+{
+    CpuBackend();
+    LOCK(cs_provingBackends);
+    auto it = mapProvingBackends.find(name);
+    if (it == mapProvingBackends.end()) {
+        return false;
+    }
+    pSelectedProvingBackend.store(it->second.get());
+    return true;
+}
+
+std::vector<std::string> ListProvingBackends()
+{
+    CpuBackend();
+    LOCK(cs_provingBackends);
+    std::vector<std::string> names;
+    for (const auto& entry : mapProvingBackends) {
+        names.push_back(entry.first);
+    }
+    return names;
+}
+
+ProvingBackend& GetProvingBackend()
+{
+    ProvingBackend* backend = pSelectedProvingBackend.load();
+    if (backend == nullptr) {
+        backend = CpuBackend();
+        pSelectedProvingBackend.store(backend);
+    }
+    return *backend;
+}
+
+static void RecordProof(const ProvingBackend& backend, const char* kind, bool fSuccess,
+                        std::chrono::steady_clock::time_point start)
+{
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    MetricsHistogram(
+        "zcash.wallet.proving.seconds", elapsed.count(),
+        "backend", backend.Name(),
+        "kind", kind);
+    if (!fSuccess) {
+        MetricsIncrementCounter(
+            "zcash.wallet.proving.failures",
+            "backend", backend.Name(),
+            "kind", kind);
+    }
+}
+
+bool ProveSaplingSpend(
+    void* ctx,
+    const unsigned char* ak,
+    const unsigned char* nsk,
+    const unsigned char* diversifier,
+    const unsigned char* rcm,
+    const unsigned char* ar,
+    uint64_t value,
+    const unsigned char* anchor,
+    const unsigned char* witness,
+    unsigned char* cv,
+    unsigned char* rk,
+    unsigned char* zkproof)
+{
+    ProvingBackend& backend = GetProvingBackend();
+    auto start = std::chrono::steady_clock::now();
+    bool fSuccess = backend.SaplingSpendProof(
+        ctx, ak, nsk, diversifier, rcm, ar, value, anchor, witness, cv, rk, zkproof);
+    RecordProof(backend, "sapling_spend", fSuccess, start);
+    return fSuccess;
+}
+
+bool ProveSaplingOutput(
+    void* ctx,
+    const unsigned char* esk,
+    const unsigned char* payment_address,
+    const unsigned char* rcm,
+    uint64_t value,
+    unsigned char* cv,
+    unsigned char* zkproof)
+{
+    ProvingBackend& backend = GetProvingBackend();
+    auto start = std::chrono::steady_clock::now();
+    bool fSuccess = backend.SaplingOutputProof(
+        ctx, esk, payment_address, rcm, value, cv, zkproof);
+    RecordProof(backend, "sapling_output", fSuccess, start);
+    return fSuccess;
+}
+
+void ProveSprout(
+    unsigned char* proof_out,
+    const unsigned char* phi,
+    const unsigned char* rt,
+    const unsigned char* h_sig,
+    const unsigned char* in_sk1,
+    uint64_t in_value1,
+    const unsigned char* in_rho1,
+    const unsigned char* in_r1,
+    const unsigned char* in_auth1,
+    const unsigned char* in_sk2,
+    uint64_t in_value2,
+    const unsigned char* in_rho2,
+    const unsigned char* in_r2,
+    const unsigned char* in_auth2,
+    const unsigned char* out_pk1,
+    uint64_t out_value1,
+    const unsigned char* out_r1,
+    const unsigned char* out_pk2,
+    uint64_t out_value2,
+    const unsigned char* out_r2,
+    uint64_t vpub_old,
+    uint64_t vpub_new)
+{
+    ProvingBackend& backend = GetProvingBackend();
+    auto start = std::chrono::steady_clock::now();
+    backend.SproutProof(
+        proof_out, phi, rt, h_sig,
+        in_sk1, in_value1, in_rho1, in_r1, in_auth1,
+        in_sk2, in_value2, in_rho2, in_r2, in_auth2,
+        out_pk1, out_value1, out_r1,
+        out_pk2, out_value2, out_r2,
+        vpub_old, vpub_new);
+    RecordProof(backend, "sprout", true, start);
+}
+
+}
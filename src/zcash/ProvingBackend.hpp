@@ -0,0 +1,150 @@
+#ifndef ZC_PROVING_BACKEND_H_
+#define ZC_PROVING_BACKEND_H_
+
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace libzcash {
+
+/** Name of the built-in backend, which is the default for -provingbackend. */
+static const char* const DEFAULT_PROVING_BACKEND = "cpu";
+
+/**
+ * Creates the Groth16 proofs of the Sapling spends and outputs and of the
+ * Sprout JoinSplits of the transactions being built. The arguments are those
+ * of the librustzcash proving functions, so that a backend sees the same
+ * witness as the built-in one does.
+ *
+ * The proofs of a transaction are created in parallel on the proving threads
+ * (see ProvingThreads), so every method must be safe to call from several
+ * threads at once, each with its own proving context.
+ */
+class ProvingBackend
+{
+public:
+    virtual ~ProvingBackend() {}
+
+    /** The name that selects this backend with -provingbackend. */
+    virtual const char* Name() const = 0;
+
+    virtual bool SaplingSpendProof(
+        void* ctx,
+        const unsigned char* ak,
+        const unsigned char* nsk,
+        const unsigned char* diversifier,
+        const unsigned char* rcm,
+        const unsigned char* ar,
+        uint64_t value,
+        const unsigned char* anchor,
+        const unsigned char* witness,
+        unsigned char* cv,
+        unsigned char* rk,
+        unsigned char* zkproof) = 0;
+
+    virtual bool SaplingOutputProof(
+        void* ctx,
+        const unsigned char* esk,
+        const unsigned char* payment_address,
+        const unsigned char* rcm,
+        uint64_t value,
+        unsigned char* cv,
+        unsigned char* zkproof) = 0;
+
+    virtual void SproutProof(
+        unsigned char* proof_out,
+        const unsigned char* phi,
+        const unsigned char* rt,
+        const unsigned char* h_sig,
+        const unsigned char* in_sk1,
+        uint64_t in_value1,
+        const unsigned char* in_rho1,
+        const unsigned char* in_r1,
+        const unsigned char* in_auth1,
+        const unsigned char* in_sk2,
+        uint64_t in_value2,
+        const unsigned char* in_rho2,
+        const unsigned char* in_r2,
+        const unsigned char* in_auth2,
+        const unsigned char* out_pk1,
+        uint64_t out_value1,
+        const unsigned char* out_r1,
+        const unsigned char* out_pk2,
+        uint64_t out_value2,
+        const unsigned char* out_r2,
+        uint64_t vpub_old,
+        uint64_t vpub_new) = 0;
+};
+
+/**
+ * Make a backend available to SelectProvingBackend() under its name. The
+ * built-in "cpu" backend, which proves with librustzcash on the calling
+ * thread, is always registered. Called at startup, before any proof is made.
+ */
+void RegisterProvingBackend(std::unique_ptr<ProvingBackend> backend);
+
+/** Use the backend registered as name. Returns false if there is none. */
+bool SelectProvingBackend(const std::string& name);
+
+/** The names of the registered backends. */
+std::vector<std::string> ListProvingBackends();
+
+/** The backend that the proofs are created with. */
+ProvingBackend& GetProvingBackend();
+
+/**
+ * Create a proof with the selected backend, and record its duration in the
+ * zcash.wallet.proving.seconds histogram, labelled with the backend and the
+ * kind of proof.
+ */
+bool ProveSaplingSpend(
+    void* ctx,
+    const unsigned char* ak,
+    const unsigned char* nsk,
+    const unsigned char* diversifier,
+    const unsigned char* rcm,
+    const unsigned char* ar,
+    uint64_t value,
+    const unsigned char* anchor,
+    const unsigned char* witness,
+    unsigned char* cv,
+    unsigned char* rk,
+    unsigned char* zkproof);
+
+bool ProveSaplingOutput(
+    void* ctx,
+    const unsigned char* esk,
+    const unsigned char* payment_address,
+    const unsigned char* rcm,
+    uint64_t value,
+    unsigned char* cv,
+    unsigned char* zkproof);
+
+void ProveSprout(
+    unsigned char* proof_out,
+    const unsigned char* phi,
+    const unsigned char* rt,
+    const unsigned char* h_sig,
+    const unsigned char* in_sk1,
+    uint64_t in_value1,
+    const unsigned char* in_rho1,
+    const unsigned char* in_r1,
+    const unsigned char* in_auth1,
+    const unsigned char* in_sk2,
+    uint64_t in_value2,
+    const unsigned char* in_rho2,
+    const unsigned char* in_r2,
+    const unsigned char* in_auth2,
+    const unsigned char* out_pk1,
+    uint64_t out_value1,
+    const unsigned char* out_r1,
+    const unsigned char* out_pk2,
+    uint64_t out_value2,
+    const unsigned char* out_r2,
+    uint64_t vpub_old,
+    uint64_t vpub_new);
+
+}
+
+#endif // ZC_PROVING_BACKEND_H_
@@ -4,6 +4,8 @@
 #include <thread>
 #include <unistd.h>
 
+#include <boost/thread.hpp>
+
 #include "coins.h"
 #include "util.h"
 #include "init.h"
@@ -289,6 +291,11 @@ double benchmark_try_decrypt_sprout_notes(size_t nKeys)
 }
 
 double benchmark_try_decrypt_sapling_notes(size_t nKeys)
+{
+    return benchmark_try_decrypt_sapling_notes_threaded(nKeys, 1);
+}
+
+double benchmark_try_decrypt_sapling_notes_threaded(size_t nKeys, int nThreads)
 {
     // Set params
     const Consensus::Params& consensusParams = Params().GetConsensus();
@@ -306,11 +313,23 @@ double benchmark_try_decrypt_sapling_notes(size_t nKeys)
     auto sk = masterKey.Derive(nKeys);
     auto tx = GetValidSaplingReceive(consensusParams, wallet, sk, 10);
 
+    // The calling thread also works through the queue, so start one
+    // worker fewer than the requested number of threads.
+    CCheckQueue<CSaplingTrialDecryption> queue(4);
+    boost::thread_group workers;
+    for (int i = 0; i < nThreads - 1; i++) {
+        workers.create_thread([&queue]() { queue.Thread(); });
+    }
+
     struct timeval tv_start;
     timer_start(tv_start);
-    auto noteDataMapAndAddressesToAdd = wallet.FindMySaplingNotes(tx, 1);
+    auto noteDataMapAndAddressesToAdd = wallet.FindMySaplingNotes(tx, 1, nThreads > 1 ? &queue : nullptr);
     assert(noteDataMapAndAddressesToAdd.first.empty());
-    return timer_stop(tv_start);
+    double ret = timer_stop(tv_start);
+
+    workers.interrupt_all();
+    workers.join_all();
+    return ret;
 }
 
 CWalletTx CreateSproutTxWithNoteData(const libzcash::SproutSpendingKey& sk) {
@@ -433,84 +452,6 @@ double benchmark_increment_sapling_note_witnesses(size_t nTxs)
     return timer_stop(tv_start);
 }
 
-// Fake the input of a given block
-// This class is based on the class CCoinsViewDB, but with limited functionality.
-// The constructor and the functions `GetCoins` and `HaveCoins` come directly from
-// CCoinsViewDB, but the rest are either mocks and/or don't really do anything.
-
-// The following constant is a duplicate of the one found in txdb.cpp
-static const char DB_COINS = 'c';
-
-class FakeCoinsViewDB : public CCoinsView {
-
-    CDBWrapper db;
-
-    uint256 hash;
-    SproutMerkleTree sproutTree;
-    SaplingMerkleTree saplingTree;
-
-public:
-    FakeCoinsViewDB(std::string dbName, uint256& hash) : db(GetDataDir() / dbName, 100, false, false), hash(hash) {}
-
-    bool GetSproutAnchorAt(const uint256 &rt, SproutMerkleTree &tree) const {
-        if (rt == sproutTree.root()) {
-            tree = sproutTree;
-            return true;
-        }
-        return false;
-    }
-
-    bool GetSaplingAnchorAt(const uint256 &rt, SaplingMerkleTree &tree) const {
-        if (rt == saplingTree.root()) {
-            tree = saplingTree;
-            return true;
-        }
-        return false;
-    }
-
-    bool GetNullifier(const uint256 &nf, ShieldedType type) const {
-        return false;
-    }
-
-    bool GetCoins(const uint256 &txid, CCoins &coins) const {
-        return db.Read(std::make_pair(DB_COINS, txid), coins);
-    }
-
-    bool HaveCoins(const uint256 &txid) const {
-        return db.Exists(std::make_pair(DB_COINS, txid));
-    }
-
-    uint256 GetBestBlock() const {
-        return hash;
-    }
-
-    uint256 GetBestAnchor(ShieldedType type) const {
-        switch (type) {
-            case SPROUT:
-                return sproutTree.root();
-            case SAPLING:
-                return saplingTree.root();
-            default:
-                throw new std::runtime_error("Unknown shielded type");
-        }
-    }
-
-    bool BatchWrite(CCoinsMap &mapCoins,
-                    const uint256 &hashBlock,
-                    const uint256 &hashSproutAnchor,
-                    const uint256 &hashSaplingAnchor,
-                    CAnchorsSproutMap &mapSproutAnchors,
-                    CAnchorsSaplingMap &mapSaplingAnchors,
-                    CNullifiersMap &mapSproutNullifiers,
-                    CNullifiersMap &mapSaplingNullifiers) {
-        return false;
-    }
-
-    bool GetStats(CCoinsStats &stats) const {
-        return false;
-    }
-};
-
 double benchmark_connectblock_slow()
 {
     // Test for issue 2017-05-01.a
@@ -590,28 +531,59 @@ double benchmark_listunspent()
     return timer_stop(tv_start);
 }
 
-double benchmark_create_sapling_spend()
-{
-    auto sk = libzcash::SaplingSpendingKey::random();
-    auto expsk = sk.expanded_spending_key();
-    auto address = sk.default_address();
-    SaplingNote note(address, GetRand(MAX_MONEY), libzcash::Zip212Enabled::BeforeZip212);
-    SaplingMerkleTree tree;
-    auto maybe_cmu = note.cmu();
-    tree.append(maybe_cmu.value());
-    auto anchor = tree.root();
-    auto witness = tree.witness();
-    auto maybe_nf = note.nullifier(expsk.full_viewing_key(), witness.position());
-    if (!(maybe_cmu && maybe_nf)) {
-        throw JSONRPCError(RPC_INTERNAL_ERROR, "Could not create note commitment and nullifier");
+/** The inputs of the proof of a spend of a new note, to a random address. */
+struct SaplingSpendProofInputs {
+    libzcash::SaplingSpendingKey sk;
+    libzcash::SaplingExpandedSpendingKey expsk;
+    SaplingNote note;
+    uint256 anchor;
+    std::vector<unsigned char> witness;
+    uint256 alpha;
+
+    SaplingSpendProofInputs() :
+        sk(libzcash::SaplingSpendingKey::random()),
+        expsk(sk.expanded_spending_key()),
+        note(sk.default_address(), GetRand(MAX_MONEY), libzcash::Zip212Enabled::BeforeZip212)
+    {
+        SaplingMerkleTree tree;
+        auto maybe_cmu = note.cmu();
+        tree.append(maybe_cmu.value());
+        anchor = tree.root();
+        auto witnessTree = tree.witness();
+        auto maybe_nf = note.nullifier(expsk.full_viewing_key(), witnessTree.position());
+        if (!(maybe_cmu && maybe_nf)) {
+            throw JSONRPCError(RPC_INTERNAL_ERROR, "Could not create note commitment and nullifier");
+        }
+
+        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+        ss << witnessTree.path();
+        witness.assign(ss.begin(), ss.end());
+
+        librustzcash_sapling_generate_r(alpha.begin());
     }
 
-    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-    ss << witness.path();
-    std::vector<unsigned char> witnessChars(ss.begin(), ss.end());
+    bool Prove(void* ctx, SpendDescription& sdesc) const
+    {
+        uint256 rcm = note.rcm();
+        return librustzcash_sapling_spend_proof(
+            ctx,
+            expsk.full_viewing_key().ak.begin(),
+            expsk.nsk.begin(),
+            note.d.data(),
+            rcm.begin(),
+            alpha.begin(),
+            note.value(),
+            anchor.begin(),
+            witness.data(),
+            sdesc.cv.begin(),
+            sdesc.rk.begin(),
+            sdesc.zkproof.data());
+    }
+};
 
-    uint256 alpha;
-    librustzcash_sapling_generate_r(alpha.begin());
+double benchmark_create_sapling_spend()
+{
+    SaplingSpendProofInputs inputs;
 
     auto ctx = librustzcash_sapling_proving_ctx_init();
 
@@ -619,20 +591,7 @@ double benchmark_create_sapling_spend()
     timer_start(tv_start);
 
     SpendDescription sdesc;
-    uint256 rcm = note.rcm();
-    bool result = librustzcash_sapling_spend_proof(
-        ctx,
-        expsk.full_viewing_key().ak.begin(),
-        expsk.nsk.begin(),
-        note.d.data(),
-        rcm.begin(),
-        alpha.begin(),
-        note.value(),
-        anchor.begin(),
-        witnessChars.data(),
-        sdesc.cv.begin(),
-        sdesc.rk.begin(),
-        sdesc.zkproof.data());
+    bool result = inputs.Prove(ctx, sdesc);
 
     double t = timer_stop(tv_start);
     librustzcash_sapling_proving_ctx_free(ctx);
@@ -642,6 +601,37 @@ double benchmark_create_sapling_spend()
     return t;
 }
 
+double benchmark_create_sapling_spend_threaded(int nThreads)
+{
+    std::vector<SaplingSpendProofInputs> inputs(nThreads);
+    std::vector<SpendDescription> sdescs(nThreads);
+    std::vector<void*> ctxs(nThreads);
+    std::vector<char> results(nThreads);
+
+    auto ctx = librustzcash_sapling_proving_ctx_init();
+
+    struct timeval tv_start;
+    timer_start(tv_start);
+
+    // As in TransactionBuilder::Build, each proof is created with a context
+    // of its own, and the contexts are merged into one afterwards.
+    ParallelFor(nThreads, nThreads, [&](size_t i) {
+        ctxs[i] = librustzcash_sapling_proving_ctx_init();
+        results[i] = inputs[i].Prove(ctxs[i], sdescs[i]);
+    });
+    for (void* proofCtx : ctxs) {
+        librustzcash_sapling_proving_ctx_merge(ctx, proofCtx);
+        librustzcash_sapling_proving_ctx_free(proofCtx);
+    }
+
+    double t = timer_stop(tv_start);
+    librustzcash_sapling_proving_ctx_free(ctx);
+    if (std::find(results.begin(), results.end(), false) != results.end()) {
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "librustzcash_sapling_spend_proof() should return true");
+    }
+    return t;
+}
+
 double benchmark_create_sapling_output()
 {
     auto sk = libzcash::SaplingSpendingKey::random();
@@ -4,6 +4,8 @@
 #include <sys/time.h>
 #include <stdlib.h>
 
+#include "txdb.h"
+
 extern double benchmark_sleep();
 extern double benchmark_create_joinsplit();
 extern std::vector<double> benchmark_create_joinsplit_threaded(int nThreads);
@@ -14,6 +16,7 @@ extern double benchmark_verify_equihash();
 extern double benchmark_large_tx(size_t nInputs);
 extern double benchmark_try_decrypt_sprout_notes(size_t nAddrs);
 extern double benchmark_try_decrypt_sapling_notes(size_t nAddrs);
+extern double benchmark_try_decrypt_sapling_notes_threaded(size_t nAddrs, int nThreads);
 extern double benchmark_increment_sprout_note_witnesses(size_t nTxs);
 extern double benchmark_increment_sapling_note_witnesses(size_t nTxs);
 extern double benchmark_connectblock_slow();
@@ -21,8 +24,77 @@ extern double benchmark_sendtoaddress(CAmount amount);
 extern double benchmark_loadwallet();
 extern double benchmark_listunspent();
 extern double benchmark_create_sapling_spend();
+extern double benchmark_create_sapling_spend_threaded(int nThreads);
 extern double benchmark_create_sapling_output();
 extern double benchmark_verify_sapling_spend();
 extern double benchmark_verify_sapling_output();
 
+// Fake the input of a given block
+// This class is based on the class CCoinsViewDB, but with limited functionality.
+// The functions `GetCoin` and `HaveCoin` come directly from CCoinsViewDB, but
+// the rest are either mocks and/or don't really do anything. The inputs
+// database is stored in the per-transaction format, so it is upgraded in place
+// on first use.
+class FakeCoinsViewDB : public CCoinsViewDB {
+
+    uint256 hash;
+    SproutMerkleTree sproutTree;
+    SaplingMerkleTree saplingTree;
+
+public:
+    FakeCoinsViewDB(std::string dbName, uint256& hash) : CCoinsViewDB(dbName, 100, false, false), hash(hash) {
+        if (!Upgrade()) throw new std::runtime_error("Failed to upgrade block inputs database");
+    }
+
+    bool GetSproutAnchorAt(const uint256 &rt, SproutMerkleTree &tree) const {
+        if (rt == sproutTree.root()) {
+            tree = sproutTree;
+            return true;
+        }
+        return false;
+    }
+
+    bool GetSaplingAnchorAt(const uint256 &rt, SaplingMerkleTree &tree) const {
+        if (rt == saplingTree.root()) {
+            tree = saplingTree;
+            return true;
+        }
+        return false;
+    }
+
+    bool GetNullifier(const uint256 &nf, ShieldedType type) const {
+        return false;
+    }
+
+    uint256 GetBestBlock() const {
+        return hash;
+    }
+
+    uint256 GetBestAnchor(ShieldedType type) const {
+        switch (type) {
+            case SPROUT:
+                return sproutTree.root();
+            case SAPLING:
+                return saplingTree.root();
+            default:
+                throw new std::runtime_error("Unknown shielded type");
+        }
+    }
+
+    bool BatchWrite(CCoinsMap &mapCoins,
+                    const uint256 &hashBlock,
+                    const uint256 &hashSproutAnchor,
+                    const uint256 &hashSaplingAnchor,
+                    CAnchorsSproutMap &mapSproutAnchors,
+                    CAnchorsSaplingMap &mapSaplingAnchors,
+                    CNullifiersMap &mapSproutNullifiers,
+                    CNullifiersMap &mapSaplingNullifiers) {
+        return false;
+    }
+
+    bool GetStats(CCoinsStats &stats) const {
+        return false;
+    }
+};
+
 #endif // ZCASH_ZCBENCHMARKS_H
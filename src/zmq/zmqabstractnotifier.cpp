@@ -21,7 +21,22 @@ bool CZMQAbstractNotifier::NotifyBlock(const CBlock &)
     return true;
 }
 
+bool CZMQAbstractNotifier::NotifyBlockConnected(const CBlockIndex * /*CBlockIndex*/)
+{
+    return true;
+}
+
 bool CZMQAbstractNotifier::NotifyTransaction(const CTransaction &/*transaction*/)
 {
     return true;
 }
+
+bool CZMQAbstractNotifier::NotifyBlockTemplate(const std::string &/*longpollid*/)
+{
+    return true;
+}
+
+bool CZMQAbstractNotifier::NotifyMempoolEvent(const CMempoolEvent &/*event*/)
+{
+    return true;
+}
@@ -8,7 +8,9 @@
 #include "zmqconfig.h"
 
 class CBlockIndex;
+struct CMempoolEvent;
 class CZMQAbstractNotifier;
+class CZMQPublisher;
 
 typedef CZMQAbstractNotifier* (*CZMQNotifierFactory)();
 
@@ -29,12 +31,15 @@ public:
     std::string GetAddress() const { return address; }
     void SetAddress(const std::string &a) { address = a; }
 
-    virtual bool Initialize(void *pcontext) = 0;
+    virtual bool Initialize(void *pcontext, CZMQPublisher *publisher) = 0;
     virtual void Shutdown() = 0;
 
     virtual bool NotifyBlock(const CBlockIndex *pindex);
     virtual bool NotifyBlock(const CBlock& pblock);
+    virtual bool NotifyBlockConnected(const CBlockIndex *pindex);
     virtual bool NotifyTransaction(const CTransaction &transaction);
+    virtual bool NotifyBlockTemplate(const std::string &longpollid);
+    virtual bool NotifyMempoolEvent(const CMempoolEvent &event);
 
 protected:
     void *psocket;
@@ -3,6 +3,7 @@
 // file COPYING or https://www.opensource.org/licenses/mit-license.php .
 
 #include "zmqnotificationinterface.h"
+#include "zmqpublisher.h"
 #include "zmqpublishnotifier.h"
 
 #include "version.h"
@@ -15,7 +16,7 @@ void zmqError(const char *str)
     LogPrint("zmq", "zmq: Error: %s, errno=%s\n", str, zmq_strerror(errno));
 }
 
-CZMQNotificationInterface::CZMQNotificationInterface() : pcontext(NULL)
+CZMQNotificationInterface::CZMQNotificationInterface() : pcontext(NULL), nQueueSize(DEFAULT_ZMQ_QUEUE_SIZE)
 {
 }
 
@@ -40,6 +41,9 @@ CZMQNotificationInterface* CZMQNotificationInterface::CreateWithArguments(const
     factories["pubrawblock"] = CZMQAbstractNotifier::Create<CZMQPublishRawBlockNotifier>;
     factories["pubrawtx"] = CZMQAbstractNotifier::Create<CZMQPublishRawTransactionNotifier>;
     factories["pubcheckedblock"] = CZMQAbstractNotifier::Create<CZMQPublishCheckedBlockNotifier>;
+    factories["pubblocktemplate"] = CZMQAbstractNotifier::Create<CZMQPublishBlockTemplateNotifier>;
+    factories["pubblockconnected"] = CZMQAbstractNotifier::Create<CZMQPublishBlockConnectedNotifier>;
+    factories["pubmempoolchange"] = CZMQAbstractNotifier::Create<CZMQPublishMempoolChangeNotifier>;
 
     for (std::map<std::string, CZMQNotifierFactory>::const_iterator i=factories.begin(); i!=factories.end(); ++i)
     {
@@ -60,6 +64,12 @@ CZMQNotificationInterface* CZMQNotificationInterface::CreateWithArguments(const
         notificationInterface = new CZMQNotificationInterface();
         notificationInterface->notifiers = notifiers;
 
+        std::map<std::string, std::string>::const_iterator j = args.find("-zmqqueuesize");
+        if (j!=args.end())
+        {
+            notificationInterface->nQueueSize = std::max(atoi(j->second), 1);
+        }
+
         if (!notificationInterface->Initialize())
         {
             delete notificationInterface;
@@ -88,11 +98,13 @@ bool CZMQNotificationInterface::Initialize()
         return false;
     }
 
+    publisher.reset(new CZMQPublisher(nQueueSize));
+
     std::list<CZMQAbstractNotifier*>::iterator i=notifiers.begin();
     for (; i!=notifiers.end(); ++i)
     {
         CZMQAbstractNotifier *notifier = *i;
-        if (notifier->Initialize(pcontext))
+        if (notifier->Initialize(pcontext, publisher.get()))
         {
             LogPrint("zmq", "  Notifier %s ready (address = %s)\n", notifier->GetType(), notifier->GetAddress());
         }
@@ -108,6 +120,7 @@ bool CZMQNotificationInterface::Initialize()
         return false;
     }
 
+    publisher->Start();
     return true;
 }
 
@@ -117,6 +130,11 @@ void CZMQNotificationInterface::Shutdown()
     LogPrint("zmq", "zmq: Shutdown notification interface\n");
     if (pcontext)
     {
+        // The publisher thread uses the sockets, so it is stopped first.
+        if (publisher)
+        {
+            publisher->Stop();
+        }
         for (std::list<CZMQAbstractNotifier*>::iterator i=notifiers.begin(); i!=notifiers.end(); ++i)
         {
             CZMQAbstractNotifier *notifier = *i;
@@ -146,6 +164,29 @@ void CZMQNotificationInterface::UpdatedBlockTip(const CBlockIndex *pindex)
     }
 }
 
+void CZMQNotificationInterface::ChainTip(const CBlockIndex *pindex, const CBlock *pblock, std::optional<std::pair<SproutMerkleTree, SaplingMerkleTree>> added)
+{
+    // ChainTip is also called for the blocks that are disconnected, without
+    // the trees that were added.
+    if (!added.has_value()) {
+        return;
+    }
+
+    for (std::list<CZMQAbstractNotifier*>::iterator i = notifiers.begin(); i!=notifiers.end(); )
+    {
+        CZMQAbstractNotifier *notifier = *i;
+        if (notifier->NotifyBlockConnected(pindex))
+        {
+            i++;
+        }
+        else
+        {
+            notifier->Shutdown();
+            i = notifiers.erase(i);
+        }
+    }
+}
+
 void CZMQNotificationInterface::BlockChecked(const CBlock& block, const CValidationState& state)
 {
     if (state.IsInvalid()) {
@@ -183,3 +224,46 @@ void CZMQNotificationInterface::SyncTransaction(const CTransaction &tx, const CB
         }
     }
 }
+
+void CZMQNotificationInterface::NewBlockTemplate(const std::string &longpollid)
+{
+    for (std::list<CZMQAbstractNotifier*>::iterator i = notifiers.begin(); i!=notifiers.end(); )
+    {
+        CZMQAbstractNotifier *notifier = *i;
+        if (notifier->NotifyBlockTemplate(longpollid))
+        {
+            i++;
+        }
+        else
+        {
+            notifier->Shutdown();
+            i = notifiers.erase(i);
+        }
+    }
+}
+
+void CZMQNotificationInterface::MempoolChanged(const std::vector<CMempoolEvent> &events)
+{
+    for (std::list<CZMQAbstractNotifier*>::iterator i = notifiers.begin(); i!=notifiers.end(); )
+    {
+        CZMQAbstractNotifier *notifier = *i;
+        bool fOk = true;
+        for (const CMempoolEvent &event : events)
+        {
+            if (!notifier->NotifyMempoolEvent(event))
+            {
+                fOk = false;
+                break;
+            }
+        }
+        if (fOk)
+        {
+            i++;
+        }
+        else
+        {
+            notifier->Shutdown();
+            i = notifiers.erase(i);
+        }
+    }
+}
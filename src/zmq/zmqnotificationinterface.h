@@ -9,9 +9,11 @@
 #include "consensus/validation.h"
 #include <string>
 #include <map>
+#include <memory>
 
 class CBlockIndex;
 class CZMQAbstractNotifier;
+class CZMQPublisher;
 
 class CZMQNotificationInterface : public CValidationInterface
 {
@@ -27,12 +29,17 @@ protected:
     // CValidationInterface
     void SyncTransaction(const CTransaction &tx, const CBlock *pblock, const int nHeight);
     void UpdatedBlockTip(const CBlockIndex *pindex);
+    void ChainTip(const CBlockIndex *pindex, const CBlock *pblock, std::optional<std::pair<SproutMerkleTree, SaplingMerkleTree>> added);
     void BlockChecked(const CBlock& block, const CValidationState& state);
+    void NewBlockTemplate(const std::string &longpollid);
+    void MempoolChanged(const std::vector<CMempoolEvent> &events);
 
 private:
     CZMQNotificationInterface();
 
     void *pcontext;
+    size_t nQueueSize;
+    std::unique_ptr<CZMQPublisher> publisher;
     std::list<CZMQAbstractNotifier*> notifiers;
 };
 
@@ -0,0 +1,135 @@
+// Copyright (c) 2021 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "zmqpublisher.h"
+#include "zmqconfig.h"
+
+#include "blockfilemap.h"
+#include "chainparams.h"
+#include "main.h"
+#include "util.h"
+
+#include <rust/metrics.h>
+
+#include <functional>
+
+// Internal function to send multipart message
+static int zmq_send_multipart(void *sock, const void* data, size_t size, ...)
+{
+    va_list args;
+    va_start(args, size);
+
+    while (1)
+    {
+        zmq_msg_t msg;
+
+        int rc = zmq_msg_init_size(&msg, size);
+        if (rc != 0)
+        {
+            zmqError("Unable to initialize ZMQ msg");
+            va_end(args);
+            return -1;
+        }
+
+        void *buf = zmq_msg_data(&msg);
+        memcpy(buf, data, size);
+
+        data = va_arg(args, const void*);
+
+        rc = zmq_msg_send(&msg, sock, data ? ZMQ_SNDMORE : 0);
+        if (rc == -1)
+        {
+            zmqError("Unable to send ZMQ msg");
+            zmq_msg_close(&msg);
+            va_end(args);
+            return -1;
+        }
+
+        zmq_msg_close(&msg);
+
+        if (!data)
+            break;
+
+        size = va_arg(args, size_t);
+    }
+    va_end(args);
+    return 0;
+}
+
+CZMQPublisher::~CZMQPublisher()
+{
+    Stop();
+}
+
+void CZMQPublisher::Start()
+{
+    assert(!thread.joinable());
+    thread = std::thread(&TraceThread<std::function<void()>>, "zmqpub",
+                         std::function<void()>(std::bind(&CZMQPublisher::ThreadPublish, this)));
+}
+
+void CZMQPublisher::Stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        fStop = true;
+        cond.notify_all();
+    }
+    if (thread.joinable())
+        thread.join();
+}
+
+bool CZMQPublisher::Push(CZMQMessage&& message)
+{
+    std::lock_guard<std::mutex> lock(cs);
+    if (fStop || queue.size() >= nMaxSize)
+        return false;
+    queue.push_back(std::move(message));
+    MetricsGauge("zcash.zmq.queue.depth", queue.size());
+    cond.notify_one();
+    return true;
+}
+
+bool CZMQPublisher::Send(const CZMQMessage& message)
+{
+    const char* data = message.data.data();
+    size_t size = message.data.size();
+    CRawBlock rawBlock;
+    if (message.pindexRawBlock) {
+        if (!ReadRawBlockFromDisk(rawBlock, message.pindexRawBlock, Params().MessageStart()))
+        {
+            zmqError("Can't read block from disk");
+            return false;
+        }
+        data = rawBlock.begin();
+        size = rawBlock.size();
+    }
+
+    /* send three parts, command & data & a LE 4byte sequence number */
+    unsigned char msgseq[sizeof(uint32_t)];
+    WriteLE32(&msgseq[0], message.nSequence);
+    return zmq_send_multipart(message.psocket, message.command, strlen(message.command), data, size,
+                              msgseq, (size_t)sizeof(uint32_t), (void*)0) == 0;
+}
+
+void CZMQPublisher::ThreadPublish()
+{
+    while (true) {
+        CZMQMessage message;
+        {
+            std::unique_lock<std::mutex> lock(cs);
+            while (!fStop && queue.empty())
+                cond.wait(lock);
+            if (queue.empty())
+                break;
+            message = std::move(queue.front());
+            queue.pop_front();
+            MetricsGauge("zcash.zmq.queue.depth", queue.size());
+        }
+        if (!Send(message)) {
+            LogPrint("zmq", "zmq: Failed to publish %s message %u\n", message.command, message.nSequence);
+            MetricsIncrementCounter("zcash.zmq.dropped.messages", "topic", message.command);
+        }
+    }
+}
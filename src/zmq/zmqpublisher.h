@@ -0,0 +1,64 @@
+// Copyright (c) 2021 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifndef ZCASH_ZMQ_ZMQPUBLISHER_H
+#define ZCASH_ZMQ_ZMQPUBLISHER_H
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <stdint.h>
+
+class CBlockIndex;
+
+static const size_t DEFAULT_ZMQ_QUEUE_SIZE = 1000;
+
+/** A message waiting to be published. */
+struct CZMQMessage
+{
+    void *psocket;
+    const char *command;
+    std::string data;
+    //! If set, the body is this block as stored on disk, which is read when
+    //! the message is sent instead of data.
+    const CBlockIndex *pindexRawBlock;
+    uint32_t nSequence;
+};
+
+/**
+ * Publishes the messages of the ZMQ notifiers on a thread of its own, so
+ * that large messages and slow sockets do not hold up the threads that send
+ * the notifications. The queue is bounded; messages that do not fit are
+ * dropped, which subscribers can tell from the gap in the sequence numbers.
+ */
+class CZMQPublisher
+{
+private:
+    std::mutex cs;
+    std::condition_variable cond;
+    std::deque<CZMQMessage> queue;
+    const size_t nMaxSize;
+    bool fStop;
+    std::thread thread;
+
+    void ThreadPublish();
+    bool Send(const CZMQMessage& message);
+
+public:
+    explicit CZMQPublisher(size_t nMaxSizeIn) : nMaxSize(nMaxSizeIn), fStop(false) {}
+    ~CZMQPublisher();
+
+    void Start();
+
+    /** Send the messages that are still queued, then stop the thread. */
+    void Stop();
+
+    /** Queue a message for sending. Returns false if the queue is full. */
+    bool Push(CZMQMessage&& message);
+};
+
+#endif // ZCASH_ZMQ_ZMQPUBLISHER_H
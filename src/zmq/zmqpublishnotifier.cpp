@@ -5,8 +5,11 @@
 #include "chainparams.h"
 #include "zmqpublishnotifier.h"
 #include "main.h"
+#include "txmempool.h"
 #include "util.h"
 
+#include <rust/metrics.h>
+
 static std::multimap<std::string, CZMQAbstractPublishNotifier*> mapPublishNotifiers;
 
 static const char *MSG_HASHBLOCK = "hashblock";
@@ -14,50 +17,14 @@ static const char *MSG_HASHTX    = "hashtx";
 static const char *MSG_RAWBLOCK  = "rawblock";
 static const char *MSG_RAWTX     = "rawtx";
 static const char *MSG_CHECKEDBLOCK = "checkedblock";
+static const char *MSG_BLOCKTEMPLATE = "blocktemplate";
+static const char *MSG_BLOCKCONNECTED = "blockconnected";
+static const char *MSG_MEMPOOLCHANGE = "mempoolchange";
 
-// Internal function to send multipart message
-static int zmq_send_multipart(void *sock, const void* data, size_t size, ...)
-{
-    va_list args;
-    va_start(args, size);
-
-    while (1)
-    {
-        zmq_msg_t msg;
-
-        int rc = zmq_msg_init_size(&msg, size);
-        if (rc != 0)
-        {
-            zmqError("Unable to initialize ZMQ msg");
-            return -1;
-        }
-
-        void *buf = zmq_msg_data(&msg);
-        memcpy(buf, data, size);
-
-        data = va_arg(args, const void*);
-
-        rc = zmq_msg_send(&msg, sock, data ? ZMQ_SNDMORE : 0);
-        if (rc == -1)
-        {
-            zmqError("Unable to send ZMQ msg");
-            zmq_msg_close(&msg);
-            return -1;
-        }
-
-        zmq_msg_close(&msg);
-
-        if (!data)
-            break;
-
-        size = va_arg(args, size_t);
-    }
-    return 0;
-}
-
-bool CZMQAbstractPublishNotifier::Initialize(void *pcontext)
+bool CZMQAbstractPublishNotifier::Initialize(void *pcontext, CZMQPublisher *publisherIn)
 {
     assert(!psocket);
+    publisher = publisherIn;
 
     // check if address is being used by other publish notifier
     std::multimap<std::string, CZMQAbstractPublishNotifier*>::iterator i = mapPublishNotifiers.find(address);
@@ -124,21 +91,39 @@ void CZMQAbstractPublishNotifier::Shutdown()
     psocket = 0;
 }
 
-bool CZMQAbstractPublishNotifier::SendMessage(const char *command, const void* data, size_t size)
+bool CZMQAbstractPublishNotifier::QueueMessage(CZMQMessage&& message)
 {
-    assert(psocket);
-
-    /* send three parts, command & data & a LE 4byte sequence number */
-    unsigned char msgseq[sizeof(uint32_t)];
-    WriteLE32(&msgseq[0], nSequence);
-    int rc = zmq_send_multipart(psocket, command, strlen(command), data, size, msgseq, (size_t)sizeof(uint32_t), (void*)0);
-    if (rc == -1)
-        return false;
+    assert(psocket && publisher);
+
+    message.psocket = psocket;
+    /* the sequence number is used up even if the message is dropped, so
+       that subscribers can tell that they missed it */
+    message.nSequence = nSequence++;
+    const char *command = message.command;
+    if (!publisher->Push(std::move(message)))
+    {
+        nDropped++;
+        LogPrint("zmq", "zmq: Send queue full, dropped %s message (%u dropped)\n", command, nDropped);
+        MetricsIncrementCounter("zcash.zmq.dropped.messages", "topic", command);
+    }
+    return true;
+}
 
-    /* increment memory only sequence number after sending */
-    nSequence++;
+bool CZMQAbstractPublishNotifier::SendMessage(const char *command, const void* data, size_t size)
+{
+    CZMQMessage message;
+    message.command = command;
+    message.data.assign((const char*)data, size);
+    message.pindexRawBlock = nullptr;
+    return QueueMessage(std::move(message));
+}
 
-    return true;
+bool CZMQAbstractPublishNotifier::SendRawBlockMessage(const char *command, const CBlockIndex *pindex)
+{
+    CZMQMessage message;
+    message.command = command;
+    message.pindexRawBlock = pindex;
+    return QueueMessage(std::move(message));
 }
 
 bool CZMQPublishHashBlockNotifier::NotifyBlock(const CBlockIndex *pindex)
@@ -165,21 +150,21 @@ bool CZMQPublishRawBlockNotifier::NotifyBlock(const CBlockIndex *pindex)
 {
     LogPrint("zmq", "zmq: Publish rawblock %s\n", pindex->GetBlockHash().GetHex());
 
-    const Consensus::Params& consensusParams = Params().GetConsensus();
-    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-    {
-        LOCK(cs_main);
-        CBlock block;
-        if(!ReadBlockFromDisk(block, pindex, consensusParams))
-        {
-            zmqError("Can't read block from disk");
-            return false;
-        }
-
-        ss << block;
-    }
+    // The block is read from disk by the publisher thread, as it is stored,
+    // instead of being deserialized and serialized again here.
+    return SendRawBlockMessage(MSG_RAWBLOCK, pindex);
+}
 
-    return SendMessage(MSG_RAWBLOCK, &(*ss.begin()), ss.size());
+bool CZMQPublishBlockConnectedNotifier::NotifyBlockConnected(const CBlockIndex *pindex)
+{
+    uint256 hash = pindex->GetBlockHash();
+    LogPrint("zmq", "zmq: Publish blockconnected %d %s\n", pindex->nHeight, hash.GetHex());
+    /* a LE 4byte height, followed by the block hash */
+    unsigned char data[sizeof(uint32_t) + 32];
+    WriteLE32(&data[0], pindex->nHeight);
+    for (unsigned int i = 0; i < 32; i++)
+        data[sizeof(uint32_t) + 31 - i] = hash.begin()[i];
+    return SendMessage(MSG_BLOCKCONNECTED, data, sizeof(data));
 }
 
 bool CZMQPublishCheckedBlockNotifier::NotifyBlock(const CBlock& block)
@@ -203,3 +188,22 @@ bool CZMQPublishRawTransactionNotifier::NotifyTransaction(const CTransaction &tr
     ss << transaction;
     return SendMessage(MSG_RAWTX, &(*ss.begin()), ss.size());
 }
+
+bool CZMQPublishBlockTemplateNotifier::NotifyBlockTemplate(const std::string &longpollid)
+{
+    LogPrint("zmq", "zmq: Publish blocktemplate %s\n", longpollid);
+    return SendMessage(MSG_BLOCKTEMPLATE, longpollid.data(), longpollid.size());
+}
+
+bool CZMQPublishMempoolChangeNotifier::NotifyMempoolEvent(const CMempoolEvent &event)
+{
+    LogPrint("zmq", "zmq: Publish mempoolchange %s %s %d\n",
+        event.txid.GetHex(), event.fAdded ? "added" : "removed", event.nSequence);
+    /* the txid, 'A' or 'R', and a LE 8byte mempool sequence number */
+    unsigned char data[32 + 1 + sizeof(uint64_t)];
+    for (unsigned int i = 0; i < 32; i++)
+        data[31 - i] = event.txid.begin()[i];
+    data[32] = event.fAdded ? 'A' : 'R';
+    WriteLE64(&data[33], event.nSequence);
+    return SendMessage(MSG_MEMPOOLCHANGE, data, sizeof(data));
+}
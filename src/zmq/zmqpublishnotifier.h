@@ -6,6 +6,7 @@
 #define BITCOIN_ZMQ_ZMQPUBLISHNOTIFIER_H
 
 #include "zmqabstractnotifier.h"
+#include "zmqpublisher.h"
 
 class CBlockIndex;
 
@@ -13,18 +14,30 @@ class CZMQAbstractPublishNotifier : public CZMQAbstractNotifier
 {
 private:
     uint32_t nSequence; //! upcounting per message sequence number
+    uint64_t nDropped; //! messages dropped because the send queue was full
+    CZMQPublisher *publisher;
+
+    bool QueueMessage(CZMQMessage&& message);
 
 public:
+    CZMQAbstractPublishNotifier() : nSequence(0), nDropped(0), publisher(nullptr) {}
 
-    /* send zmq multipart message
+    /* queue zmq multipart message for the publisher thread
        parts:
           * command
           * data
           * message sequence number
+
+       A message that does not fit in the queue is dropped, using up its
+       sequence number; this is not treated as a failure.
     */
     bool SendMessage(const char *command, const void* data, size_t size);
 
-    bool Initialize(void *pcontext);
+    /* queue a message whose data is a block as stored on disk, which the
+       publisher thread reads when it sends the message */
+    bool SendRawBlockMessage(const char *command, const CBlockIndex *pindex);
+
+    bool Initialize(void *pcontext, CZMQPublisher *publisher);
     void Shutdown();
 };
 
@@ -46,6 +59,12 @@ public:
     bool NotifyBlock(const CBlockIndex *pindex);
 };
 
+class CZMQPublishBlockConnectedNotifier : public CZMQAbstractPublishNotifier
+{
+public:
+    bool NotifyBlockConnected(const CBlockIndex *pindex);
+};
+
 class CZMQPublishRawTransactionNotifier : public CZMQAbstractPublishNotifier
 {
 public:
@@ -58,4 +77,16 @@ public:
     bool NotifyBlock(const CBlock &block);
 };
 
+class CZMQPublishBlockTemplateNotifier : public CZMQAbstractPublishNotifier
+{
+public:
+    bool NotifyBlockTemplate(const std::string &longpollid);
+};
+
+class CZMQPublishMempoolChangeNotifier : public CZMQAbstractPublishNotifier
+{
+public:
+    bool NotifyMempoolEvent(const CMempoolEvent &event);
+};
+
 #endif // BITCOIN_ZMQ_ZMQPUBLISHNOTIFIER_H